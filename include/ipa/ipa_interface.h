@@ -8,6 +8,7 @@
 #define __LIBCAMERA_IPA_INTERFACE_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +18,32 @@ struct ipa_context {
 	const struct ipa_context_ops *ops;
 };
 
+struct ipa_stream {
+	unsigned int id;
+	unsigned int pixel_format;
+	unsigned int width;
+	unsigned int height;
+};
+
+struct ipa_control_info_map {
+	unsigned int id;
+	const uint8_t *data;
+	size_t size;
+};
+
+struct ipa_control_list {
+	const uint8_t *data;
+	size_t size;
+};
+
+struct ipa_operation_data {
+	unsigned int operation;
+	const uint32_t *data;
+	unsigned int num_data;
+	const struct ipa_control_list *lists;
+	unsigned int num_lists;
+};
+
 struct ipa_buffer_plane {
 	int dmabuf;
 	size_t length;
@@ -29,7 +56,8 @@ struct ipa_buffer {
 };
 
 struct ipa_callback_ops {
-	void (*queue_frame_action)(void *cb_ctx, unsigned int frame);
+	void (*queue_frame_action)(void *cb_ctx, unsigned int frame,
+				   const struct ipa_operation_data *data);
 };
 
 struct ipa_context_ops {
@@ -39,13 +67,18 @@ struct ipa_context_ops {
 	void (*register_callbacks)(struct ipa_context *ctx,
 				   const struct ipa_callback_ops *callbacks,
 				   void *cb_ctx);
-	void (*configure)(struct ipa_context *ctx);
+	void (*configure)(struct ipa_context *ctx,
+			  const struct ipa_stream *streams,
+			  unsigned int num_streams,
+			  const struct ipa_control_info_map *maps,
+			  unsigned int num_maps);
 	void (*map_buffers)(struct ipa_context *ctx,
 			    const struct ipa_buffer *buffers,
 			    size_t num_buffers);
 	void (*unmap_buffers)(struct ipa_context *ctx, const unsigned int *ids,
 			      size_t num_buffers);
-	void (*process_event)(struct ipa_context *ctx);
+	void (*process_event)(struct ipa_context *ctx,
+			      const struct ipa_operation_data *data);
 };
 
 struct ipa_context *ipaCreate();
@@ -90,12 +123,23 @@ public:
 
 	virtual void configure(const std::map<unsigned int, IPAStream> &streamConfig,
 			       const std::map<unsigned int, ControlInfoMap> &entityControls) = 0;
+	virtual void configure(std::map<unsigned int, IPAStream> &&streamConfig,
+			       std::map<unsigned int, ControlInfoMap> &&entityControls)
+	{
+		configure(static_cast<const std::map<unsigned int, IPAStream> &>(streamConfig),
+			  static_cast<const std::map<unsigned int, ControlInfoMap> &>(entityControls));
+	}
 
 	virtual void mapBuffers(const std::vector<IPABuffer> &buffers) = 0;
 	virtual void unmapBuffers(const std::vector<unsigned int> &ids) = 0;
 
 	virtual void processEvent(const IPAOperationData &data) = 0;
-	Signal<unsigned int, const IPAOperationData &> queueFrameAction;
+	virtual void processEvent(IPAOperationData &&data)
+	{
+		processEvent(static_cast<const IPAOperationData &>(data));
+	}
+
+	Signal<unsigned int, IPAOperationData &&> queueFrameAction;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipu3.h - Image Processing Algorithm interface for IPU3
+ */
+#ifndef __LIBCAMERA_IPA_INTERFACE_IPU3_H__
+#define __LIBCAMERA_IPA_INTERFACE_IPU3_H__
+
+enum IPU3Operations {
+	IPU3_IPA_ACTION_V4L2_SET = 1,
+	IPU3_IPA_ACTION_PARAM_FILLED = 2,
+	IPU3_IPA_ACTION_METADATA = 3,
+	IPU3_IPA_EVENT_SIGNAL_STAT_BUFFER = 4,
+	IPU3_IPA_EVENT_QUEUE_REQUEST = 5,
+};
+
+#endif /* __LIBCAMERA_IPA_INTERFACE_IPU3_H__ */
@@ -14,6 +14,18 @@ enum RPiOperations {
 	RPI_IPA_ACTION_METADATA = 3,
 	RPI_IPA_EVENT_SIGNAL_STAT_BUFFER = 4,
 	RPI_IPA_EVENT_QUEUE_REQUEST = 5,
+	RPI_IPA_ACTION_STATE = 6,
+	RPI_IPA_EVENT_RESTORE_STATE = 7,
+};
+
+/*
+ * The algorithms state exported by the RPI_IPA_ACTION_STATE action and restored
+ * by the RPI_IPA_EVENT_RESTORE_STATE event, stored in the operation data array.
+ */
+enum RPiState {
+	RPI_IPA_STATE_EXPOSURE = 0,
+	RPI_IPA_STATE_GAIN = 1,
+	RPI_IPA_STATE_SIZE = 2,
 };
 
 #endif /* __LIBCAMERA_IPA_INTERFACE_RASPBERRYPI_H__ */
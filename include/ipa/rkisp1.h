@@ -13,6 +13,21 @@ enum RkISP1Operations {
 	RKISP1_IPA_ACTION_METADATA = 3,
 	RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER = 4,
 	RKISP1_IPA_EVENT_QUEUE_REQUEST = 5,
+	RKISP1_IPA_ACTION_STATE = 6,
+	RKISP1_IPA_EVENT_RESTORE_STATE = 7,
+};
+
+/*
+ * The algorithms state exported by the RKISP1_IPA_ACTION_STATE action and
+ * restored by the RKISP1_IPA_EVENT_RESTORE_STATE event, stored in the
+ * operation data array.
+ */
+enum RkISP1State {
+	RKISP1_IPA_STATE_EXPOSURE = 0,
+	RKISP1_IPA_STATE_GAIN = 1,
+	RKISP1_IPA_STATE_AWB_GAIN_RED = 2,
+	RKISP1_IPA_STATE_AWB_GAIN_BLUE = 3,
+	RKISP1_IPA_STATE_SIZE = 4,
 };
 
 #endif /* __LIBCAMERA_IPA_INTERFACE_RKISP1_H__ */
@@ -7,11 +7,15 @@
 #ifndef __LIBCAMERA_BOUND_METHOD_H__
 #define __LIBCAMERA_BOUND_METHOD_H__
 
+#include <cstddef>
+#include <new>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 namespace libcamera {
 
+class InvokeMessage;
 class Object;
 
 class BoundMethodBase
@@ -27,10 +31,18 @@ public:
 
 	Object *object() const { return object_; }
 
-	void activatePack(void *pack);
 	virtual void invokePack(void *pack) = 0;
 
 protected:
+	friend class Object;
+
+	bool isObjectThread() const;
+
+	static InvokeMessage *prepareInvoke(size_t methodSize, size_t packSize,
+					    void (*destroyPack)(void *),
+					    void **method, void **pack);
+	void postInvoke(InvokeMessage *msg, bool deleteMethod);
+
 	void *obj_;
 	Object *object_;
 };
@@ -60,18 +72,26 @@ private:
 
 	using PackType = std::tuple<typename std::remove_reference<Args>::type...>;
 
+	static_assert(alignof(PackType) <= alignof(std::max_align_t),
+		      "Over-aligned method arguments are not supported");
+
 	template<int... S>
 	void invokePack(void *pack, sequence<S...>)
 	{
-		PackType *args = static_cast<PackType *>(pack);
-		invoke(std::get<S>(*args)...);
-		delete args;
+		/* args is effectively unused when the sequence S is empty. */
+		PackType *args [[gnu::unused]] = static_cast<PackType *>(pack);
+		invoke(std::forward<Args>(std::get<S>(*args))...);
 	}
 
 public:
 	BoundMethodArgs(void *obj, Object *object)
 		: BoundMethodBase(obj, object) {}
 
+	static void destroyPack(void *pack)
+	{
+		static_cast<PackType *>(pack)->~PackType();
+	}
+
 	void invokePack(void *pack) override
 	{
 		invokePack(pack, typename generator<sizeof...(Args)>::type());
@@ -94,15 +114,23 @@ public:
 
 	void activate(Args... args)
 	{
-		if (this->object_)
-			BoundMethodBase::activatePack(new PackType{ args... });
-		else
-			(static_cast<T *>(this->obj_)->*func_)(args...);
+		if (!this->object_ || this->isObjectThread()) {
+			(static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
+			return;
+		}
+
+		void *pack;
+		InvokeMessage *msg =
+			BoundMethodBase::prepareInvoke(0, sizeof(PackType),
+						       &BoundMethodArgs<Args...>::destroyPack,
+						       nullptr, &pack);
+		new (pack) PackType{ std::forward<Args>(args)... };
+		this->postInvoke(msg, false);
 	}
 
 	void invoke(Args... args)
 	{
-		(static_cast<T *>(this->obj_)->*func_)(args...);
+		(static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
 	}
 
 private:
@@ -118,7 +146,7 @@ public:
 
 	bool match(void (*func)(Args...)) const { return func == func_; }
 
-	void activate(Args... args) { (*func_)(args...); }
+	void activate(Args... args) { (*func_)(std::forward<Args>(args)...); }
 	void invoke(Args... args) {}
 
 private:
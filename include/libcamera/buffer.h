@@ -8,6 +8,7 @@
 #define __LIBCAMERA_BUFFER_H__
 
 #include <array>
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
@@ -20,34 +21,118 @@ class Stream;
 class Plane final
 {
 public:
+	enum Access {
+		AccessRead = (1 << 0),
+		AccessWrite = (1 << 1),
+		AccessReadWrite = AccessRead | AccessWrite,
+	};
+
 	Plane();
+	Plane(const Plane &other);
+	Plane(Plane &&other);
 	~Plane();
 
+	Plane &operator=(const Plane &other);
+	Plane &operator=(Plane &&other);
+
 	int dmabuf() const { return fd_; }
 	int setDmabuf(int fd, unsigned int length);
+	int setUserPtr(void *address, unsigned int length);
+	bool isUserPtr() const { return userptr_; }
 
 	void *mem();
 	unsigned int length() const { return length_; }
+	int prefault();
+
+	int beginCpuAccess(Access access);
+	int endCpuAccess(Access access);
 
 private:
 	friend class Stream;
 
-	int mmap();
-	int munmap();
+	int sync(uint64_t flags);
+
+	int mmap(bool populate = false);
+	int munmap(bool cache = false);
 
 	int fd_;
 	unsigned int length_;
 	void *mem_;
+	bool userptr_;
+};
+
+class PlaneArray final
+{
+public:
+	static constexpr unsigned int Capacity = 3;
+
+	using iterator = Plane *;
+	using const_iterator = const Plane *;
+
+	PlaneArray();
+
+	iterator begin() { return planes_.data(); }
+	const_iterator begin() const { return planes_.data(); }
+	iterator end() { return planes_.data() + size_; }
+	const_iterator end() const { return planes_.data() + size_; }
+
+	bool empty() const { return !size_; }
+	unsigned int size() const { return size_; }
+	static constexpr unsigned int max_size() { return Capacity; }
+
+	Plane &operator[](unsigned int index) { return planes_[index]; }
+	const Plane &operator[](unsigned int index) const { return planes_[index]; }
+	Plane &front() { return planes_[0]; }
+	const Plane &front() const { return planes_[0]; }
+	Plane &back() { return planes_[size_ - 1]; }
+	const Plane &back() const { return planes_[size_ - 1]; }
+
+	Plane &emplace_back();
+	void resize(unsigned int size);
+	void clear();
+
+private:
+	std::array<Plane, Capacity> planes_;
+	unsigned int size_;
 };
 
 class BufferMemory final
 {
 public:
-	const std::vector<Plane> &planes() const { return planes_; }
-	std::vector<Plane> &planes() { return planes_; }
+	BufferMemory();
+
+	const PlaneArray &planes() const { return planes_; }
+	PlaneArray &planes() { return planes_; }
+
+	bool deviceOnly() const { return deviceOnly_; }
+	void setDeviceOnly(bool deviceOnly) { deviceOnly_ = deviceOnly; }
+
+	int prefault();
+
+	int beginCpuAccess(Plane::Access access);
+	int endCpuAccess(Plane::Access access);
 
 private:
-	std::vector<Plane> planes_;
+	PlaneArray planes_;
+	bool deviceOnly_;
+};
+
+class CpuAccess final
+{
+public:
+	CpuAccess(Plane &plane, Plane::Access access);
+	CpuAccess(BufferMemory &memory, Plane::Access access);
+	CpuAccess(const CpuAccess &) = delete;
+	CpuAccess &operator=(const CpuAccess &) = delete;
+	~CpuAccess();
+
+	int status() const { return status_; }
+
+private:
+	Plane *plane_;
+	BufferMemory *memory_;
+	Plane::Access access_;
+	int status_;
 };
 
 class BufferPool final
@@ -56,6 +141,7 @@ public:
 	~BufferPool();
 
 	void createBuffers(unsigned int count);
+	int addBuffers(unsigned int count);
 	void destroyBuffers();
 
 	unsigned int count() const { return buffers_.size(); }
@@ -72,6 +158,19 @@ public:
 		BufferSuccess,
 		BufferError,
 		BufferCancelled,
+		BufferSkipped,
+	};
+
+	enum Clock {
+		ClockUnknown,
+		ClockMonotonic,
+		ClockBoottime,
+		ClockRealtime,
+	};
+
+	enum TimestampSource {
+		TimestampEndOfFrame,
+		TimestampStartOfExposure,
 	};
 
 	Buffer(unsigned int index = -1, const Buffer *metadata = nullptr);
@@ -83,21 +182,34 @@ public:
 	BufferMemory *mem() { return mem_; }
 
 	unsigned int bytesused() const { return bytesused_; }
+	const std::array<unsigned int, 3> &planesBytesused() const { return planesBytesused_; }
+	const std::array<unsigned int, 3> &planesOffset() const { return planesOffset_; }
+	uint64_t modifier() const { return modifier_; }
 	uint64_t timestamp() const { return timestamp_; }
+	Clock timestampClock() const { return timestampClock_; }
+	TimestampSource timestampSource() const { return timestampSource_; }
 	unsigned int sequence() const { return sequence_; }
 
 	Status status() const { return status_; }
 	Request *request() const { return request_; }
 	Stream *stream() const { return stream_; }
+	bool held() const { return holds_ > 0; }
 
 private:
+	friend class BufferRef;
 	friend class Camera;
+	friend class JpegEncoder;
 	friend class PipelineHandler;
 	friend class Request;
 	friend class Stream;
 	friend class V4L2VideoDevice;
 
 	void cancel();
+	void skip();
+	void reset();
+
+	void hold();
+	void unhold();
 
 	void setRequest(Request *request) { request_ = request; }
 
@@ -106,12 +218,39 @@ private:
 	BufferMemory *mem_;
 
 	unsigned int bytesused_;
+	std::array<unsigned int, 3> planesBytesused_;
+	std::array<unsigned int, 3> planesOffset_;
+	uint64_t modifier_;
 	uint64_t timestamp_;
+	Clock timestampClock_;
+	TimestampSource timestampSource_;
 	unsigned int sequence_;
 
 	Status status_;
 	Request *request_;
 	Stream *stream_;
+	bool recyclable_;
+	std::atomic<unsigned int> holds_;
+};
+
+class BufferRef final
+{
+public:
+	BufferRef();
+	explicit BufferRef(Buffer *buffer);
+	BufferRef(const BufferRef &other);
+	BufferRef(BufferRef &&other);
+	~BufferRef();
+
+	BufferRef &operator=(const BufferRef &other);
+	BufferRef &operator=(BufferRef &&other);
+
+	bool isValid() const { return buffer_ != nullptr; }
+	Buffer *buffer() const { return buffer_; }
+	void reset();
+
+private:
+	Buffer *buffer_;
 };
 
 } /* namespace libcamera */
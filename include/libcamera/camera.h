@@ -7,22 +7,30 @@
 #ifndef __LIBCAMERA_CAMERA_H__
 #define __LIBCAMERA_CAMERA_H__
 
+#include <array>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
+#include <libcamera/buffer.h>
 #include <libcamera/controls.h>
+#include <libcamera/latency.h>
 #include <libcamera/request.h>
 #include <libcamera/signal.h>
 #include <libcamera/stream.h>
 
 namespace libcamera {
 
+class CameraControlValidator;
+
 class Buffer;
 class PipelineHandler;
 class Request;
+class RequestArenaPool;
 
 class CameraConfiguration
 {
@@ -33,6 +41,12 @@ public:
 		Invalid,
 	};
 
+	enum QueueProfile {
+		Balanced,
+		LowLatency,
+		Throughput,
+	};
+
 	using iterator = std::vector<StreamConfiguration>::iterator;
 	using const_iterator = std::vector<StreamConfiguration>::const_iterator;
 
@@ -60,15 +74,65 @@ public:
 	bool empty() const;
 	std::size_t size() const;
 
+	bool live() const { return live_; }
+
+	unsigned int zslFrames() const { return zslFrames_; }
+	void setZslFrames(unsigned int frames) { zslFrames_ = frames; }
+
+	bool outOfOrderCompletion() const { return outOfOrderCompletion_; }
+	void setOutOfOrderCompletion(bool enable) { outOfOrderCompletion_ = enable; }
+
+	QueueProfile queueProfile() const { return queueProfile_; }
+	void setQueueProfile(QueueProfile profile) { queueProfile_ = profile; }
+	unsigned int queueDepth(unsigned int minimum, unsigned int nominal,
+				unsigned int maximum) const;
+
+	Buffer::Clock timestampClock() const { return timestampClock_; }
+	void setTimestampClock(Buffer::Clock clock) { timestampClock_ = clock; }
+
 protected:
 	CameraConfiguration();
 
+	Status validateModifiers();
+
 	std::vector<StreamConfiguration> config_;
+	bool live_;
+	unsigned int zslFrames_;
+	bool outOfOrderCompletion_;
+	QueueProfile queueProfile_;
+	Buffer::Clock timestampClock_;
+};
+
+struct StreamStatistics {
+	uint64_t framesCompleted;
+	uint64_t framesDropped;
+	unsigned int queueDepth;
+	unsigned int maxQueueDepth;
+};
+
+struct CameraStatistics {
+	struct Percentiles {
+		uint64_t p50;
+		uint64_t p90;
+		uint64_t p99;
+		uint64_t max;
+	};
+
+	uint64_t requestsCompleted;
+	uint64_t requestsCancelled;
+	std::map<Stream *, StreamStatistics> streams;
+	Percentiles latency;
+	Percentiles ipaTime;
 };
 
 class Camera final : public std::enable_shared_from_this<Camera>
 {
 public:
+	enum AllocateFlag {
+		AllocateDefault = 0,
+		AllocatePrefault = (1 << 0),
+	};
+
 	static std::shared_ptr<Camera> create(PipelineHandler *pipe,
 					      const std::string &name,
 					      const std::set<Stream *> &streams);
@@ -78,8 +142,11 @@ public:
 
 	const std::string &name() const;
 
+	Signal<Request *, uint64_t> requestStarted;
 	Signal<Request *, Buffer *> bufferCompleted;
-	Signal<Request *, const std::map<Stream *, Buffer *> &> requestCompleted;
+	Signal<Request *, unsigned int> framesDropped;
+	Signal<Request *, unsigned int> qosLevelChanged;
+	Signal<Request *, const Request::BufferMap &> requestCompleted;
 	Signal<Camera *> disconnected;
 
 	int acquire();
@@ -91,15 +158,22 @@ public:
 	std::unique_ptr<CameraConfiguration> generateConfiguration(const StreamRoles &roles);
 	int configure(CameraConfiguration *config);
 
-	int allocateBuffers();
+	int allocateBuffers(AllocateFlag flags = AllocateDefault);
+	int addBuffers(Stream *stream, unsigned int count);
 	int freeBuffers();
 
 	Request *createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(const std::vector<Request *> &requests);
+	int recycleBuffer(Request *request, Buffer *buffer);
 
 	int start();
 	int stop();
 
+	const LatencyHistogram &latency(Request::Stage stage) const;
+	const LatencyHistogram &ipaTime() const { return ipaTime_; }
+	CameraStatistics statistics() const;
+
 private:
 	enum State {
 		CameraAvailable,
@@ -118,15 +192,34 @@ private:
 	friend class PipelineHandler;
 	void disconnect();
 
+	friend class Request;
+	CameraControlValidator *validator();
+
+	int reconfigure(CameraConfiguration *config);
+	bool isConfigured(const CameraConfiguration *config) const;
+	int prepareRequest(Request *request);
+
 	void requestComplete(Request *request);
+	void recordLatency(Request *request);
 
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string name_;
 	std::set<Stream *> streams_;
 	std::set<Stream *> activeStreams_;
+	std::vector<Stream *> configuredStreams_;
+
+	std::atomic<bool> disconnected_;
+	std::atomic<State> state_;
+	std::atomic<unsigned int> submitters_;
+
+	std::unique_ptr<CameraControlValidator> validator_;
+	std::shared_ptr<RequestArenaPool> arenaPool_;
 
-	bool disconnected_;
-	State state_;
+	std::array<LatencyHistogram, Request::StageCount> latency_;
+	LatencyHistogram ipaTime_;
+	std::atomic<uint64_t> requestsCompleted_;
+	std::atomic<uint64_t> requestsCancelled_;
+	std::atomic<uint64_t> startTime_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_client.h - Consume the frames of a camera shared by a camera server
+ */
+#ifndef __LIBCAMERA_CAMERA_CLIENT_H__
+#define __LIBCAMERA_CAMERA_CLIENT_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class IPCUnixSocket;
+
+class CameraClient
+{
+public:
+	struct StreamInfo {
+		unsigned int pixelFormat;
+		Size size;
+		std::vector<BufferMemory> buffers;
+	};
+
+	struct Frame {
+		unsigned int stream;
+		unsigned int index;
+		unsigned int sequence;
+		unsigned int bytesused;
+		unsigned int dropped;
+		uint64_t timestamp;
+	};
+
+	CameraClient();
+	CameraClient(const CameraClient &) = delete;
+	CameraClient &operator=(const CameraClient &) = delete;
+	~CameraClient();
+
+	int connect(const std::string &path, unsigned int maxHeld);
+	void disconnect();
+
+	bool isConnected() const;
+	bool isReady() const { return ready_; }
+	unsigned int maxHeld() const { return maxHeld_; }
+	const std::vector<StreamInfo> &streams() const { return streams_; }
+	BufferMemory *buffer(const Frame &frame);
+
+	int release(const Frame &frame);
+
+	Signal<CameraClient *> ready;
+	Signal<CameraClient *, const Frame &> frameReady;
+	Signal<CameraClient *> disconnected;
+
+private:
+	void readyRead(IPCUnixSocket *socket);
+	void socketDisconnected(IPCUnixSocket *socket);
+
+	std::unique_ptr<IPCUnixSocket> socket_;
+	std::vector<StreamInfo> streams_;
+	unsigned int maxHeld_;
+	unsigned int pendingStreams_;
+	unsigned int pendingBuffers_;
+	bool welcomed_;
+	bool ready_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_CLIENT_H__ */
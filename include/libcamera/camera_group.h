@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_group.h - Synchronized capture from multiple cameras
+ */
+#ifndef __LIBCAMERA_CAMERA_GROUP_H__
+#define __LIBCAMERA_CAMERA_GROUP_H__
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/object.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class CameraConfiguration;
+class Stream;
+
+class CameraGroup : public Object
+{
+public:
+	static constexpr uint64_t DEFAULT_TOLERANCE = 2000000;
+
+	struct Frame {
+		Camera *camera;
+		uint64_t timestamp;
+		unsigned int sequence;
+		std::map<Stream *, BufferRef> buffers;
+	};
+
+	using FrameSet = std::vector<Frame>;
+
+	CameraGroup(uint64_t tolerance = DEFAULT_TOLERANCE);
+	CameraGroup(const CameraGroup &) = delete;
+	CameraGroup &operator=(const CameraGroup &) = delete;
+	~CameraGroup();
+
+	int addCamera(std::shared_ptr<Camera> camera,
+		      const CameraConfiguration *config);
+	unsigned int size() const { return members_.size(); }
+
+	uint64_t tolerance() const { return tolerance_; }
+	void setTolerance(uint64_t tolerance) { tolerance_ = tolerance; }
+
+	int start();
+	int stop();
+
+	unsigned int droppedFrames() const { return dropped_; }
+
+	Signal<const FrameSet &> frameSetReady;
+
+private:
+	struct Member {
+		std::shared_ptr<Camera> camera;
+		std::vector<Stream *> streams;
+		std::vector<std::deque<Buffer *>> freeBuffers;
+		std::deque<Frame> pending;
+		uint64_t lastTimestamp;
+	};
+
+	void teardown();
+	Member *findMember(Stream *stream);
+	void queueRequests(Member *member);
+	void requestComplete(Request *request, const Request::BufferMap &buffers);
+	void bufferReleased(Buffer *buffer);
+	void match();
+	void drop(Member *member);
+
+	std::vector<Member> members_;
+	uint64_t tolerance_;
+	bool running_;
+	unsigned int dropped_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_GROUP_H__ */
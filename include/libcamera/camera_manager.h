@@ -8,10 +8,12 @@
 #define __LIBCAMERA_CAMERA_MANAGER_H__
 
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
 #include <libcamera/object.h>
+#include <libcamera/thread_scheduling.h>
 
 namespace libcamera {
 
@@ -20,6 +22,13 @@ class DeviceEnumerator;
 class EventDispatcher;
 class PipelineHandler;
 
+struct StartupPhase {
+	std::string name;
+	std::string subject;
+	uint64_t start;
+	uint64_t end;
+};
+
 class CameraManager : public Object
 {
 public:
@@ -42,8 +51,20 @@ public:
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 	EventDispatcher *eventDispatcher();
 
+	void setPipelineThreads(bool enable);
+	void setPipelineThreadScheduling(const ThreadScheduling &scheduling);
+	void setIPAThreadScheduling(const ThreadScheduling &scheduling);
+	void setStandbyPeriod(unsigned int msec);
+
+	static std::vector<StartupPhase> startupTimeline();
+
 private:
+	void createPipelineHandlers();
+
 	std::unique_ptr<DeviceEnumerator> enumerator_;
+	bool pipelineThreads_;
+	ThreadScheduling pipelineScheduling_;
+	unsigned int standbyPeriod_;
 	std::vector<std::shared_ptr<PipelineHandler>> pipes_;
 	std::vector<std::shared_ptr<Camera>> cameras_;
 
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_server.h - Share a camera with other processes
+ */
+#ifndef __LIBCAMERA_CAMERA_SERVER_H__
+#define __LIBCAMERA_CAMERA_SERVER_H__
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/object.h>
+#include <libcamera/request.h>
+
+namespace libcamera {
+
+class Buffer;
+class Camera;
+class CameraConfiguration;
+class EventNotifier;
+class IPCUnixSocket;
+class Stream;
+
+class CameraServer : public Object
+{
+public:
+	static constexpr unsigned int MIN_QUEUED_BUFFERS = 2;
+
+	CameraServer(std::shared_ptr<Camera> camera);
+	CameraServer(const CameraServer &) = delete;
+	CameraServer &operator=(const CameraServer &) = delete;
+	~CameraServer();
+
+	int start(const std::string &path, CameraConfiguration *config);
+	void stop();
+
+	bool isRunning() const { return running_; }
+	unsigned int clients() const;
+	unsigned int availableBuffers() const { return budget_; }
+
+private:
+	struct Client;
+
+	int listen(const std::string &path);
+	void newConnection(EventNotifier *notifier);
+	void readyRead(IPCUnixSocket *socket);
+	void clientDisconnected(IPCUnixSocket *socket);
+	Client *findClient(IPCUnixSocket *socket);
+
+	void welcome(Client *client, unsigned int maxHeld);
+	void release(Client *client, unsigned int stream, unsigned int index);
+	void closeClient(Client *client);
+	void removeClosedClients();
+
+	int streamIndex(Stream *stream) const;
+	void queueRequests();
+	void requestComplete(Request *request, const Request::BufferMap &buffers);
+	void bufferReleased(Buffer *buffer);
+
+	std::shared_ptr<Camera> camera_;
+	std::vector<Stream *> streams_;
+	std::vector<std::deque<Buffer *>> freeBuffers_;
+	bool running_;
+
+	std::string path_;
+	int fd_;
+	EventNotifier *notifier_;
+
+	std::vector<std::unique_ptr<Client>> clients_;
+	unsigned int budget_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_SERVER_H__ */
@@ -8,8 +8,14 @@
 #ifndef __LIBCAMERA_CONTROLS_H__
 #define __LIBCAMERA_CONTROLS_H__
 
+#include <memory>
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <libcamera/geometry.h>
 
 namespace libcamera {
 
@@ -20,6 +26,11 @@ enum ControlType {
 	ControlTypeBool,
 	ControlTypeInteger32,
 	ControlTypeInteger64,
+	ControlTypeByte,
+	ControlTypeUnsigned16,
+	ControlTypeUnsigned32,
+	ControlTypeFloat,
+	ControlTypeRectangle,
 };
 
 class ControlValue
@@ -29,15 +40,40 @@ public:
 	ControlValue(bool value);
 	ControlValue(int32_t value);
 	ControlValue(int64_t value);
+	ControlValue(float value);
+	ControlValue(const Rectangle &value);
+
+	ControlValue(const std::vector<uint8_t> &values);
+	ControlValue(std::vector<uint8_t> &&values);
+	ControlValue(const std::vector<uint16_t> &values);
+	ControlValue(const std::vector<uint32_t> &values);
+	ControlValue(const std::vector<int32_t> &values);
+	ControlValue(const std::vector<int64_t> &values);
+	ControlValue(const std::vector<float> &values);
+	ControlValue(const std::vector<Rectangle> &values);
+	ControlValue(ControlType type, unsigned int numElements);
+
+	static constexpr std::size_t INLINE_STORAGE_SIZE = 40;
 
 	ControlType type() const { return type_; };
 	bool isNone() const { return type_ == ControlTypeNone; };
 
+	bool isArray() const { return isArray_; }
+	unsigned int numElements() const { return numElements_; }
+	uint8_t *data();
+	const uint8_t *data() const;
+	std::size_t dataSize() const { return size_; }
+
 	template<typename T>
 	const T &get() const;
 	template<typename T>
 	void set(const T &value);
 
+	template<typename T>
+	const T *array() const;
+	template<typename T>
+	T *array();
+
 	std::string toString() const;
 
 	bool operator==(const ControlValue &other) const;
@@ -47,28 +83,38 @@ public:
 	}
 
 private:
+	void reset(ControlType type);
+	void setArray(ControlType type, unsigned int numElements,
+		      const void *data);
+
 	ControlType type_;
+	bool isArray_;
+	unsigned int numElements_;
+	std::size_t size_;
 
 	union {
 		bool bool_;
 		int32_t integer32_;
 		int64_t integer64_;
+		float float_;
+		uint8_t storage_[INLINE_STORAGE_SIZE];
 	};
+
+	std::shared_ptr<std::vector<uint8_t>> heap_;
 };
 
 class ControlId
 {
 public:
-	unsigned int id() const { return id_; }
-	const std::string &name() const { return name_; }
-	ControlType type() const { return type_; }
-
-protected:
 	ControlId(unsigned int id, const std::string &name, ControlType type)
 		: id_(id), name_(name), type_(type)
 	{
 	}
 
+	unsigned int id() const { return id_; }
+	const std::string &name() const { return name_; }
+	ControlType type() const { return type_; }
+
 private:
 	ControlId &operator=(const ControlId &) = delete;
 	ControlId(const ControlId &) = delete;
@@ -117,7 +163,58 @@ private:
 	ControlValue max_;
 };
 
-using ControlIdMap = std::unordered_map<unsigned int, const ControlId *>;
+class ControlIdMap
+{
+public:
+	using Map = std::unordered_map<unsigned int, const ControlId *>;
+
+	using key_type = Map::key_type;
+	using mapped_type = Map::mapped_type;
+	using value_type = Map::value_type;
+	using size_type = Map::size_type;
+	using iterator = Map::const_iterator;
+	using const_iterator = Map::const_iterator;
+
+	ControlIdMap();
+	ControlIdMap(std::initializer_list<Map::value_type> init);
+	ControlIdMap(const ControlId *const *table, size_type size);
+
+	ControlIdMap &operator=(Map &&map);
+
+	const_iterator begin() const { return data_->map.begin(); }
+	const_iterator cbegin() const { return data_->map.cbegin(); }
+	const_iterator end() const { return data_->map.end(); }
+	const_iterator cend() const { return data_->map.cend(); }
+
+	const mapped_type &at(const key_type &id) const { return data_->map.at(id); }
+	bool empty() const { return data_->map.empty(); }
+	size_type size() const { return data_->map.size(); }
+	size_type count(const key_type &id) const { return data_->map.count(id); }
+	const_iterator find(const key_type &id) const { return data_->map.find(id); }
+
+	int slot(unsigned int id) const;
+	const ControlId *slotId(unsigned int slot) const { return data_->ids[slot]; }
+
+	bool operator==(const ControlIdMap &other) const;
+	bool operator!=(const ControlIdMap &other) const
+	{
+		return !(*this == other);
+	}
+
+private:
+	struct Data {
+		Map map;
+		std::vector<const ControlId *> ids;
+
+		unsigned int base;
+		std::vector<int> direct;
+		std::unordered_map<unsigned int, unsigned int> slots;
+	};
+
+	void generateSlots(Data *data);
+
+	std::shared_ptr<const Data> data_;
+};
 
 class ControlInfoMap : private std::unordered_map<const ControlId *, ControlRange>
 {
@@ -166,23 +263,70 @@ private:
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<const ControlId *, ControlValue>;
+	using Entry = std::pair<const ControlId *, ControlValue>;
+
+	template<typename List, typename Value>
+	class Iterator
+	{
+	public:
+		Iterator(List *list, unsigned int slot)
+			: list_(list), slot_(slot)
+		{
+			skip();
+		}
+
+		Value &operator*() const { return list_->storage_->values[slot_]; }
+		Value *operator->() const { return &list_->storage_->values[slot_]; }
+
+		Iterator &operator++()
+		{
+			slot_++;
+			skip();
+			return *this;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return slot_ == other.slot_;
+		}
+		bool operator!=(const Iterator &other) const
+		{
+			return slot_ != other.slot_;
+		}
+
+	private:
+		void skip()
+		{
+			const Storage &storage = *list_->storage_;
+			while (slot_ < storage.values.size() && !storage.present[slot_])
+				slot_++;
+		}
+
+		List *list_;
+		unsigned int slot_;
+	};
 
 public:
 	ControlList(const ControlIdMap &idmap, ControlValidator *validator = nullptr);
 	ControlList(const ControlInfoMap &info, ControlValidator *validator = nullptr);
 
-	using iterator = ControlListMap::iterator;
-	using const_iterator = ControlListMap::const_iterator;
+	using iterator = Iterator<ControlList, Entry>;
+	using const_iterator = Iterator<const ControlList, const Entry>;
+
+	iterator begin() { detach(); return iterator(this, 0); }
+	iterator end() { detach(); return iterator(this, storage_->values.size()); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, storage_->values.size()); }
+
+	bool empty() const { return storage_->count == 0; }
+	std::size_t size() const { return storage_->count; }
+	void clear();
 
-	iterator begin() { return controls_.begin(); }
-	iterator end() { return controls_.end(); }
-	const_iterator begin() const { return controls_.begin(); }
-	const_iterator end() const { return controls_.end(); }
+	void merge(const ControlList &other);
+	void swap(ControlList &other);
+	ControlList delta(const ControlList &reference) const;
 
-	bool empty() const { return controls_.empty(); }
-	std::size_t size() const { return controls_.size(); }
-	void clear() { controls_.clear(); }
+	const ControlIdMap &idmap() const { return *idmap_; }
 
 	bool contains(const ControlId &id) const;
 	bool contains(unsigned int id) const;
@@ -213,12 +357,21 @@ public:
 	void set(unsigned int id, const ControlValue &value);
 
 private:
+	struct Storage {
+		std::vector<Entry> values;
+		std::vector<bool> present;
+		std::size_t count;
+	};
+
 	const ControlValue *find(const ControlId &id) const;
 	ControlValue *find(const ControlId &id);
+	ControlValue *insert(unsigned int slot);
+	void detach();
 
 	ControlValidator *validator_;
 	const ControlIdMap *idmap_;
-	ControlListMap controls_;
+
+	std::shared_ptr<Storage> storage_;
 };
 
 } /* namespace libcamera */
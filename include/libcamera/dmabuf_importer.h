@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dmabuf_importer.h - Import of buffers in GPU APIs
+ */
+#ifndef __LIBCAMERA_DMABUF_IMPORTER_H__
+#define __LIBCAMERA_DMABUF_IMPORTER_H__
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class Buffer;
+struct StreamConfiguration;
+
+struct DmabufPlaneLayout {
+	int fd;
+	unsigned int offset;
+	unsigned int pitch;
+	unsigned int size;
+};
+
+struct DmabufImage {
+	uint32_t drmFormat;
+	uint64_t modifier;
+	Size size;
+
+	unsigned int numPlanes;
+	std::array<DmabufPlaneLayout, 3> planes;
+
+	std::vector<int32_t> eglAttributes() const;
+};
+
+class DmabufImporter
+{
+public:
+	DmabufImporter();
+
+	int configure(const StreamConfiguration &cfg);
+	int configure(unsigned int format, const Size &size,
+		      uint64_t modifier = 0);
+
+	uint32_t drmFormat() const { return drmFormat_; }
+
+	int describe(Buffer *buffer, DmabufImage *image) const;
+	int describe(const std::array<int, 3> &fds, DmabufImage *image) const;
+
+private:
+	uint32_t drmFormat_;
+	uint64_t modifier_;
+	Size size_;
+
+	unsigned int numPlanes_;
+	std::array<unsigned int, 3> pitches_;
+	std::array<unsigned int, 3> sizes_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DMABUF_IMPORTER_H__ */
@@ -21,6 +21,7 @@ public:
 
 	virtual void registerEventNotifier(EventNotifier *notifier) = 0;
 	virtual void unregisterEventNotifier(EventNotifier *notifier) = 0;
+	virtual void updateEventNotifier(EventNotifier *notifier);
 
 	virtual void registerTimer(Timer *timer) = 0;
 	virtual void unregisterTimer(Timer *timer) = 0;
@@ -38,6 +38,8 @@ protected:
 	void message(Message *msg) override;
 
 private:
+	void attach();
+
 	int fd_;
 	Type type_;
 	bool enabled_;
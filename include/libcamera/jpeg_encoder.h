@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_encoder.h - Asynchronous JPEG encoding of captured frames
+ */
+#ifndef __LIBCAMERA_JPEG_ENCODER_H__
+#define __LIBCAMERA_JPEG_ENCODER_H__
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Buffer;
+struct StreamConfiguration;
+
+class JpegEncoder
+{
+public:
+	static constexpr int DEFAULT_QUALITY = 95;
+
+	JpegEncoder();
+	JpegEncoder(const JpegEncoder &) = delete;
+	JpegEncoder &operator=(const JpegEncoder &) = delete;
+	~JpegEncoder();
+
+	static const std::vector<unsigned int> &formats();
+
+	int configure(const StreamConfiguration &cfg,
+		      int quality = DEFAULT_QUALITY,
+		      unsigned int maxInFlight = 2);
+	int encode(Buffer *source);
+	void releaseBuffer(Buffer *buffer);
+	void flush();
+
+	const Size &size() const { return size_; }
+	unsigned int bufferSize() const { return bufferSize_; }
+	unsigned int inFlight() const;
+
+	Signal<Buffer *, Buffer *> bufferEncoded;
+
+private:
+	struct Slot;
+
+	void encodeFrame(Slot *slot);
+
+	Size size_;
+	unsigned int pixelFormat_;
+	unsigned int bufferSize_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable idle_;
+	std::vector<std::unique_ptr<Slot>> slots_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_JPEG_ENCODER_H__ */
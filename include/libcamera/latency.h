@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * latency.h - Latency statistics
+ */
+#ifndef __LIBCAMERA_LATENCY_H__
+#define __LIBCAMERA_LATENCY_H__
+
+#include <array>
+#include <atomic>
+#include <stdint.h>
+
+namespace libcamera {
+
+class LatencyHistogram
+{
+public:
+	static constexpr unsigned int NUM_BUCKETS = 32;
+
+	LatencyHistogram();
+	LatencyHistogram(const LatencyHistogram &) = delete;
+	LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+	void add(uint64_t latency);
+	void reset();
+
+	uint64_t samples() const { return samples_.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+	uint64_t bucket(unsigned int index) const;
+	uint64_t percentile(unsigned int percent) const;
+
+	static uint64_t bucketLimit(unsigned int index);
+
+private:
+	std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets_;
+	std::atomic<uint64_t> samples_;
+	std::atomic<uint64_t> max_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_LATENCY_H__ */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_OBJECT_H__
 #define __LIBCAMERA_OBJECT_H__
 
+#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
@@ -32,11 +33,20 @@ public:
 	template<typename T, typename... Args, typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
 	void invokeMethod(void (T::*func)(Args...), Args... args)
 	{
-		T *obj = static_cast<T *>(this);
-		BoundMethodBase *method = new BoundMemberMethod<T, Args...>(obj, this, func);
-		void *pack = new typename BoundMemberMethod<T, Args...>::PackType{ args... };
+		using Method = BoundMemberMethod<T, Args...>;
+		using Pack = typename Method::PackType;
 
-		invokeMethod(method, pack);
+		T *obj = static_cast<T *>(this);
+		void *methodStorage;
+		void *packStorage;
+		InvokeMessage *msg =
+			BoundMethodBase::prepareInvoke(sizeof(Method), sizeof(Pack),
+						       &Method::destroyPack,
+						       &methodStorage, &packStorage);
+
+		Method *method = new (methodStorage) Method(obj, this, func);
+		new (packStorage) Pack{ std::forward<Args>(args)... };
+		method->postInvoke(msg, true);
 	}
 
 	Thread *thread() const { return thread_; }
@@ -53,8 +63,6 @@ private:
 	friend class BoundMethodBase;
 	friend class Thread;
 
-	void invokeMethod(BoundMethodBase *method, void *pack);
-
 	void notifyThreadMove();
 
 	void connect(SignalBase *signal);
@@ -65,7 +73,7 @@ private:
 
 	Thread *thread_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
 };
 
 }; /* namespace libcamera */
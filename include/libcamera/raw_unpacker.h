@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_unpacker.h - Unpacking of packed raw formats
+ */
+#ifndef __LIBCAMERA_RAW_UNPACKER_H__
+#define __LIBCAMERA_RAW_UNPACKER_H__
+
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class RawUnpacker
+{
+public:
+	RawUnpacker();
+
+	int configure(unsigned int format, const Size &size,
+		      unsigned int stride);
+
+	void unpack(const uint8_t *src, uint16_t *dst) const;
+	void unpack(const uint8_t *src, uint16_t *dst, unsigned int first,
+		    unsigned int count) const;
+	void unpack(uint8_t *frame) const;
+	void unpackLine(const uint8_t *src, uint16_t *dst) const;
+
+	static unsigned int minimumStride(unsigned int format,
+					  unsigned int width);
+
+	unsigned int bitsPerSample() const { return bitsPerSample_; }
+	unsigned int frameSize() const;
+	const char *implementation() const { return implementation_; }
+
+private:
+	using UnpackRow = void (*)(const uint8_t *src, uint16_t *dst,
+				   unsigned int width, unsigned int bits);
+
+	Size size_;
+	unsigned int stride_;
+	unsigned int lineLength_;
+	unsigned int bitsPerSample_;
+	const char *implementation_;
+
+	UnpackRow unpackRow_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RAW_UNPACKER_H__ */
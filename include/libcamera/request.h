@@ -7,10 +7,13 @@
 #ifndef __LIBCAMERA_REQUEST_H__
 #define __LIBCAMERA_REQUEST_H__
 
-#include <map>
+#include <array>
 #include <memory>
+#include <new>
+#include <stddef.h>
 #include <stdint.h>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <libcamera/controls.h>
 #include <libcamera/signal.h>
@@ -20,7 +23,10 @@ namespace libcamera {
 class Buffer;
 class Camera;
 class CameraControlValidator;
+class FrameContextRingBase;
+class RequestArena;
 class Stream;
+struct FrameContext;
 
 class Request
 {
@@ -31,41 +37,117 @@ public:
 		RequestCancelled,
 	};
 
+	enum ReuseFlag {
+		Default = 0,
+		ReuseBuffers = (1 << 0),
+	};
+
+	enum Stage {
+		StageQueued,
+		StageDeviceQueued,
+		StageStarted,
+		StageCaptured,
+		StageBufferReady,
+		StageIPAAction,
+		StageCompleted,
+		StageCount,
+	};
+
+	class BufferMap
+	{
+	public:
+		using value_type = std::pair<Stream *, Buffer *>;
+		using const_iterator = const value_type *;
+		using iterator = const_iterator;
+
+		static constexpr unsigned int MAX_BUFFERS = 32;
+
+		const_iterator begin() const { return entries_.data(); }
+		const_iterator end() const { return entries_.data() + entries_.size(); }
+
+		bool empty() const { return entries_.empty(); }
+		std::size_t size() const { return entries_.size(); }
+
+		const_iterator find(Stream *stream) const;
+
+	private:
+		friend class Request;
+
+		std::vector<value_type> entries_;
+	};
+
 	Request(Camera *camera, uint64_t cookie = 0);
 	Request(const Request &) = delete;
 	Request &operator=(const Request &) = delete;
 	~Request();
 
+	void reuse(ReuseFlag flags = Default);
+
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
-	const std::map<Stream *, Buffer *> &buffers() const { return bufferMap_; }
+	const BufferMap &buffers() const { return bufferMap_; }
 	int addBuffer(std::unique_ptr<Buffer> buffer);
+	int addBuffer(Buffer *buffer);
 	Buffer *findBuffer(Stream *stream) const;
 
 	uint64_t cookie() const { return cookie_; }
 	Status status() const { return status_; }
 
-	bool hasPendingBuffers() const { return !pending_.empty(); }
+	bool hasPendingBuffers() const { return pending_ != 0; }
+
+	uint64_t timestamp(Stage stage) const { return timestamps_[stage]; }
+
+	template<typename T, typename... Args>
+	T *create(Args&&... args)
+	{
+		void *memory = allocate(sizeof(T), alignof(T), &destroy<T>);
+		return new (memory) T(std::forward<Args>(args)...);
+	}
 
 private:
 	friend class Camera;
+	friend class FrameContextRingBase;
 	friend class PipelineHandler;
+	friend class RequestQueue;
+	friend class V4L2VideoDevice;
 
 	int prepare();
 	void complete();
 
+	int insertBuffer(Stream *stream, Buffer *buffer);
 	bool completeBuffer(Buffer *buffer);
+	int releaseBuffer(Buffer *buffer);
+	void removeReleasedBuffers();
+
+	void trace(Stage stage);
+	void trace(Stage stage, uint64_t timestamp);
+
+	void *allocate(size_t size, size_t alignment,
+		       void (*destructor)(void *));
+
+	template<typename T>
+	static void destroy(void *object)
+	{
+		static_cast<T *>(object)->~T();
+	}
 
 	Camera *camera_;
+	std::unique_ptr<RequestArena> arena_;
 	CameraControlValidator *validator_;
 	ControlList *controls_;
 	ControlList *metadata_;
-	std::map<Stream *, Buffer *> bufferMap_;
-	std::unordered_set<Buffer *> pending_;
+	BufferMap bufferMap_;
+	uint32_t pending_;
+	uint32_t released_;
+	unsigned int framesDropped_;
+	FrameContext *frameContext_;
+	Request *queueNext_;
+	std::array<uint64_t, StageCount> timestamps_;
 
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
+	bool reused_;
 };
 
 } /* namespace libcamera */
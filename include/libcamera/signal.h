@@ -7,7 +7,6 @@
 #ifndef __LIBCAMERA_SIGNAL_H__
 #define __LIBCAMERA_SIGNAL_H__
 
-#include <list>
 #include <type_traits>
 #include <vector>
 
@@ -22,20 +21,57 @@ public:
 	template<typename T>
 	void disconnect(T *obj)
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			BoundMethodBase *slot = *iter;
-			if (slot->match(obj)) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+		disconnectIf([obj](BoundMethodBase *slot) {
+			return slot->match(obj);
+		});
 	}
 
 protected:
 	friend class Object;
-	std::list<BoundMethodBase *> slots_;
+
+	/*
+	 * An emission in progress, stored on the stack of emit(). Emissions
+	 * are chained from the innermost one to support nested emissions, and
+	 * are marked as destroyed when a slot destroys the signal.
+	 */
+	struct Emission {
+		Emission *outer;
+		bool destroyed;
+	};
+
+	SignalBase()
+		: emission_(nullptr)
+	{
+	}
+
+	~SignalBase();
+
+	/*
+	 * Slots are disconnected by clearing their entry in slots_, and the
+	 * entries are removed once no emission is in progress. This allows
+	 * slots to connect and disconnect slots during emission without the
+	 * need to copy slots_ when emitting the signal.
+	 */
+	template<typename Match>
+	void disconnectIf(Match match)
+	{
+		for (BoundMethodBase *&slot : slots_) {
+			if (slot && match(slot))
+				release(&slot);
+		}
+
+		if (!emission_)
+			compact();
+	}
+
+	void release(BoundMethodBase **slot);
+	void compact();
+	void beginEmit(Emission *emission);
+	void endEmit(Emission *emission);
+
+	std::vector<BoundMethodBase *> slots_;
+	std::vector<BoundMethodBase *> released_;
+	Emission *emission_;
 };
 
 template<typename... Args>
@@ -46,6 +82,9 @@ public:
 	~Signal()
 	{
 		for (BoundMethodBase *slot : slots_) {
+			if (!slot)
+				continue;
+
 			Object *object = slot->object();
 			if (object)
 				object->disconnect(this);
@@ -78,9 +117,7 @@ public:
 
 	void disconnect()
 	{
-		for (BoundMethodBase *slot : slots_)
-			delete slot;
-		slots_.clear();
+		disconnectIf([](BoundMethodBase *) { return true; });
 	}
 
 	template<typename T>
@@ -92,47 +129,54 @@ public:
 	template<typename T>
 	void disconnect(T *obj, void (T::*func)(Args...))
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			BoundMethodArgs<Args...> *slot = static_cast<BoundMethodArgs<Args...> *>(*iter);
-			/*
-			 * If the object matches the slot, the slot is
-			 * guaranteed to be a member slot, so we can safely
-			 * cast it to BoundMemberMethod<T, Args...> to match
-			 * func.
-			 */
-			if (slot->match(obj) &&
-			    static_cast<BoundMemberMethod<T, Args...> *>(slot)->match(func)) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+		/*
+		 * If the object matches the slot, the slot is guaranteed to be
+		 * a member slot, so we can safely cast it to
+		 * BoundMemberMethod<T, Args...> to match func.
+		 */
+		disconnectIf([obj, func](BoundMethodBase *slot) {
+			return slot->match(obj) &&
+			       static_cast<BoundMemberMethod<T, Args...> *>(slot)->match(func);
+		});
 	}
 
 	void disconnect(void (*func)(Args...))
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			BoundMethodArgs<Args...> *slot = *iter;
-			if (slot->match(nullptr) &&
-			    static_cast<BoundStaticMethod<Args...> *>(slot)->match(func)) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+		disconnectIf([func](BoundMethodBase *slot) {
+			return slot->match(nullptr) &&
+			       static_cast<BoundStaticMethod<Args...> *>(slot)->match(func);
+		});
 	}
 
 	void emit(Args... args)
 	{
+		size_t count = slots_.size();
+		if (!count)
+			return;
+
+		Emission emission;
+		beginEmit(&emission);
+
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * Iterate by index as slots connected by the slots themselves
+		 * may reallocate slots_. They are not called for this
+		 * emission.
 		 */
-		std::vector<BoundMethodBase *> slots{ slots_.begin(), slots_.end() };
-		for (BoundMethodBase *slot : slots)
-			static_cast<BoundMethodArgs<Args...> *>(slot)->activate(args...);
+		for (size_t i = 0; i < count; ++i) {
+			BoundMethodBase *slot = slots_[i];
+			if (!slot)
+				continue;
+
+			static_cast<BoundMethodArgs<Args...> *>(slot)->activate(
+				static_cast<typename std::conditional<std::is_rvalue_reference<Args>::value,
+								      Args, Args &>::type>(args)...);
+
+			/* The slot may have destroyed the signal, stop then. */
+			if (emission.destroyed)
+				return;
+		}
+
+		endEmit(&emission);
 	}
 };
 
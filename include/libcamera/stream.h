@@ -7,13 +7,21 @@
 #ifndef __LIBCAMERA_STREAM_H__
 #define __LIBCAMERA_STREAM_H__
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/geometry.h>
+#include <libcamera/signal.h>
 
 namespace libcamera {
 
@@ -25,19 +33,30 @@ class StreamFormats
 public:
 	StreamFormats();
 	StreamFormats(const std::map<unsigned int, std::vector<SizeRange>> &formats);
+	StreamFormats(const std::map<unsigned int, std::vector<SizeRange>> &formats,
+		      const std::map<unsigned int, std::vector<uint64_t>> &modifiers);
 
 	std::vector<unsigned int> pixelformats() const;
 	std::vector<Size> sizes(unsigned int pixelformat) const;
+	std::vector<uint64_t> modifiers(unsigned int pixelformat) const;
 
 	SizeRange range(unsigned int pixelformat) const;
 
 private:
 	std::map<unsigned int, std::vector<SizeRange>> formats_;
+	std::map<unsigned int, std::vector<uint64_t>> modifiers_;
 };
 
 enum MemoryType {
 	InternalMemory,
 	ExternalMemory,
+	UserPtrMemory,
+};
+
+enum StreamPriority {
+	LowPriority,
+	NormalPriority,
+	HighPriority,
 };
 
 struct StreamConfiguration {
@@ -45,10 +64,14 @@ struct StreamConfiguration {
 	StreamConfiguration(const StreamFormats &formats);
 
 	unsigned int pixelFormat;
+	uint64_t modifier;
 	Size size;
+	Rectangle roi;
 
 	MemoryType memoryType;
 	unsigned int bufferCount;
+	unsigned int frameDecimation;
+	StreamPriority priority;
 
 	Stream *stream() const { return stream_; }
 	void setStream(Stream *stream) { stream_ = stream; }
@@ -63,6 +86,7 @@ private:
 
 enum StreamRole {
 	StillCapture,
+	StillCaptureRaw,
 	VideoRecording,
 	Viewfinder,
 };
@@ -76,27 +100,83 @@ public:
 
 	std::unique_ptr<Buffer> createBuffer(unsigned int index);
 	std::unique_ptr<Buffer> createBuffer(const std::array<int, 3> &fds);
+	Buffer *buffer(unsigned int index);
+	Buffer *importBuffer(const std::array<int, 3> &fds);
+	void releaseBuffer(Buffer *buffer);
 
 	BufferPool &bufferPool() { return bufferPool_; }
 	std::vector<BufferMemory> &buffers() { return bufferPool_.buffers(); }
 	const StreamConfiguration &configuration() const { return configuration_; }
 	MemoryType memoryType() const { return memoryType_; }
 
+	unsigned int heldBuffers() const { return heldBuffers_; }
+	unsigned int starvationCount() const { return starvationCount_; }
+
+	Signal<Buffer *> bufferReleased;
+
 protected:
+	friend class Buffer;
 	friend class Camera;
+	friend class PipelineHandler;
+	friend class Request;
 
 	int mapBuffer(const Buffer *buffer);
 	void unmapBuffer(const Buffer *buffer);
 
 	void createBuffers(MemoryType memory, unsigned int count);
+	void addBuffers(unsigned int first, unsigned int count);
 	void destroyBuffers();
 
+	void resetStatistics();
+	void bufferQueued();
+	void bufferCompleted(const Buffer *buffer);
+
 	BufferPool bufferPool_;
 	StreamConfiguration configuration_;
 	MemoryType memoryType_;
 
 private:
-	std::vector<std::pair<std::array<int, 3>, unsigned int>> bufferCache_;
+	struct DmabufIdentity {
+		std::array<std::pair<uint64_t, uint64_t>, 3> planes;
+
+		bool operator==(const DmabufIdentity &other) const
+		{
+			return planes == other.planes;
+		}
+	};
+
+	struct DmabufIdentityHash {
+		std::size_t operator()(const DmabufIdentity &id) const;
+	};
+
+	struct BufferCacheEntry {
+		DmabufIdentity id;
+		bool valid;
+		unsigned int index;
+	};
+
+	using BufferCacheList = std::list<BufferCacheEntry>;
+
+	static bool identify(const std::array<int, 3> &fds, DmabufIdentity *id);
+	static void setDmabufs(BufferMemory *mem, const std::array<int, 3> &fds);
+
+	std::deque<Buffer> recyclableBuffers_;
+	std::list<Buffer> importedBuffers_;
+	std::unordered_map<const Buffer *, BufferCacheEntry> importedIds_;
+	std::atomic<unsigned int> heldBuffers_;
+	std::atomic<unsigned int> starvationCount_;
+
+	std::atomic<unsigned int> queueDepth_;
+	std::atomic<unsigned int> maxQueueDepth_;
+	std::atomic<uint64_t> framesCompleted_;
+	std::atomic<uint64_t> framesDropped_;
+
+	std::mutex bufferCacheMutex_;
+	BufferCacheList bufferCache_;
+	BufferCacheList mappedCache_;
+	std::unordered_map<DmabufIdentity, BufferCacheList::iterator,
+			   DmabufIdentityHash> bufferCacheIndex_;
+	std::vector<BufferCacheList::iterator> mappedBuffers_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * thread_scheduling.h - Thread scheduling parameters
+ */
+#ifndef __LIBCAMERA_THREAD_SCHEDULING_H__
+#define __LIBCAMERA_THREAD_SCHEDULING_H__
+
+#include <string>
+#include <vector>
+
+namespace libcamera {
+
+class ThreadScheduling
+{
+public:
+	enum Policy {
+		PolicyOther,
+		PolicyFifo,
+		PolicyRoundRobin,
+	};
+
+	ThreadScheduling();
+
+	bool isDefault() const;
+	std::string toString() const;
+
+	Policy policy;
+	int priority;
+	int nice;
+	std::vector<unsigned int> cpus;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_THREAD_SCHEDULING_H__ */
@@ -8,6 +8,7 @@
 #define __LIBCAMERA_TIMER_H__
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 
 #include <libcamera/object.h>
@@ -37,11 +38,14 @@ protected:
 	void message(Message *msg) override;
 
 private:
+	friend class TimerQueue;
+
 	void registerTimer();
 	void unregisterTimer();
 
 	bool running_;
 	std::chrono::steady_clock::time_point deadline_;
+	size_t queuePosition_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv_converter.h - YUV to RGB conversion
+ */
+#ifndef __LIBCAMERA_YUV_CONVERTER_H__
+#define __LIBCAMERA_YUV_CONVERTER_H__
+
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class YuvConverter
+{
+public:
+	YuvConverter();
+
+	int configure(unsigned int format, const Size &size);
+	void convert(const uint8_t *src, uint8_t *dst) const;
+	void convert(const uint8_t *src, uint8_t *dst, unsigned int first,
+		     unsigned int count) const;
+
+	const char *implementation() const { return implementation_; }
+
+private:
+	using SemiPlanarRow = void (*)(const uint8_t *y, const uint8_t *uv,
+				       uint8_t *dst, unsigned int width,
+				       bool swap);
+	using PackedRow = void (*)(const uint8_t *src, uint8_t *dst,
+				   unsigned int width, unsigned int yPos,
+				   unsigned int cbPos);
+
+	Size size_;
+	const char *implementation_;
+
+	SemiPlanarRow semiPlanarRow_;
+	PackedRow packedRow_;
+
+	bool packed_;
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+	bool swap_;
+	unsigned int yPos_;
+	unsigned int cbPos_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_YUV_CONVERTER_H__ */
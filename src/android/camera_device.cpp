@@ -7,16 +7,29 @@
 
 #include "camera_device.h"
 
+#include <algorithm>
+#include <unistd.h>
+
 #include "log.h"
 #include "utils.h"
 
 #include "camera_metadata.h"
+#include "jpeg/post_processor_jpeg.h"
+#include "thread_pool.h"
 #include "thread_rpc.h"
 
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(HAL);
 
+/*
+ * The number of buffers of BLOB streams. Still captures are infrequent and
+ * their frames large, one buffer being encoded while the next one is captured
+ * is enough, and bounds both the camera buffers allocated for Internal streams
+ * and the gralloc buffers the framework allocates for all BLOB streams.
+ */
+static const unsigned int JpegBufferCount = 2;
+
 /*
  * \struct Camera3RequestDescriptor
  *
@@ -26,7 +39,8 @@ LOG_DECLARE_CATEGORY(HAL);
 
 CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
 		unsigned int frameNumber, unsigned int numBuffers)
-	: frameNumber(frameNumber), numBuffers(numBuffers)
+	: frameNumber(frameNumber), numBuffers(numBuffers), pendingFences(0),
+	  started(false), numJpegBuffers(0), numSourceBuffers(0), pendingJpegs(0)
 {
 	buffers = new camera3_stream_buffer_t[numBuffers];
 }
@@ -50,15 +64,18 @@ CameraDevice::Camera3RequestDescriptor::~Camera3RequestDescriptor()
  */
 
 CameraDevice::CameraDevice(unsigned int id, const std::shared_ptr<Camera> &camera)
-	: running_(false), camera_(camera), staticMetadata_(nullptr)
+	: running_(false), prepared_(false), camera_(camera),
+	  resultTimestampIndex_(0), jpegJobs_(0)
 {
+	camera_->requestStarted.connect(this, &CameraDevice::requestStarted);
 	camera_->requestCompleted.connect(this, &CameraDevice::requestComplete);
+
+	staticMetadata_ = createStaticMetadata();
 }
 
 CameraDevice::~CameraDevice()
 {
-	if (staticMetadata_)
-		delete staticMetadata_;
+	clearRequestPool();
 
 	for (auto &it : requestTemplates_)
 		delete it.second;
@@ -70,12 +87,12 @@ CameraDevice::~CameraDevice()
 void CameraDevice::call(ThreadRpc *rpc)
 {
 	switch (rpc->tag) {
-	case ThreadRpc::ProcessCaptureRequest:
-		processCaptureRequest(rpc->request);
-		break;
 	case ThreadRpc::Close:
 		close();
 		break;
+	case ThreadRpc::Flush:
+		flush();
+		break;
 	default:
 		LOG(HAL, Error) << "Unknown RPC operation: " << rpc->tag;
 	}
@@ -97,11 +114,119 @@ int CameraDevice::open()
 void CameraDevice::close()
 {
 	camera_->stop();
+	waitJpegEncodings();
+
+	/*
+	 * Drop the requests still waiting for their acquire fences. The HAL
+	 * owns the fences that haven't signalled yet, close them.
+	 */
+	std::vector<Request *> waiting;
+	for (auto &it : fenceRequests_) {
+		::close(it.first->fd());
+
+		if (std::find(waiting.begin(), waiting.end(), it.second) == waiting.end())
+			waiting.push_back(it.second);
+	}
+
+	fenceRequests_.clear();
+	for (Request *request : waiting)
+		releaseRequest(request);
+
+	clearRequestPool();
+	clearImportedBuffers();
 
 	camera_->freeBuffers();
 	camera_->release();
 
 	running_ = false;
+	prepared_ = false;
+}
+
+/*
+ * Return all capture requests in flight to the framework without capturing
+ * them. Stopping the camera cancels the requests queued to it, which complete
+ * with errors, and the requests still waiting for their acquire fences are
+ * aborted. The buffers stay allocated, the camera is restarted by the next
+ * capture request without going through a full reconfiguration, keeping the
+ * flush well within the 100ms the camera3 API allows.
+ */
+void CameraDevice::flush()
+{
+	if (running_) {
+		camera_->stop();
+		running_ = false;
+	}
+
+	abortFenceRequests();
+
+	/* Return the BLOB buffers whose encoding is already in progress. */
+	waitJpegEncodings();
+}
+
+/*
+ * Retrieve a request and its descriptor from the pool of completed requests,
+ * or create a new one if the pool is empty. Requests are reused across
+ * frames to avoid allocating them and their controls lists for every capture
+ * request.
+ */
+Request *CameraDevice::getRequest(uint32_t frameNumber, unsigned int numBuffers)
+{
+	Camera3RequestDescriptor *descriptor;
+	Request *request;
+
+	if (!requestPool_.empty()) {
+		request = requestPool_.back();
+		descriptor = reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+		if (descriptor->numBuffers == numBuffers) {
+			requestPool_.pop_back();
+			descriptor->frameNumber = frameNumber;
+			return request;
+		}
+	}
+
+	descriptor = new Camera3RequestDescriptor(frameNumber, numBuffers);
+	request = camera_->createRequest(reinterpret_cast<uint64_t>(descriptor));
+	if (!request)
+		delete descriptor;
+
+	return request;
+}
+
+/*
+ * Return a request to the pool. The request must not be queued to the camera.
+ */
+void CameraDevice::releaseRequest(Request *request)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	descriptor->fences.clear();
+	descriptor->pendingFences = 0;
+	descriptor->started = false;
+	descriptor->numJpegBuffers = 0;
+	descriptor->numSourceBuffers = 0;
+	descriptor->pendingJpegs = 0;
+
+	/* Return the camera buffers of BLOB streams for use by new requests. */
+	for (const auto &it : request->buffers()) {
+		CameraStream *cameraStream = findInternalStream(it.first);
+		if (cameraStream)
+			cameraStream->freeBuffers.push_back(it.second->index());
+	}
+
+	request->reuse();
+	requestPool_.push_back(request);
+}
+
+void CameraDevice::clearRequestPool()
+{
+	for (Request *request : requestPool_) {
+		delete reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+		delete request;
+	}
+
+	requestPool_.clear();
 }
 
 void CameraDevice::setCallbacks(const camera3_callback_ops_t *callbacks)
@@ -111,12 +236,22 @@ void CameraDevice::setCallbacks(const camera3_callback_ops_t *callbacks)
 
 /*
  * Return static information for the camera.
+ *
+ * The static metadata is created once when the CameraDevice is constructed in
+ * the camera HAL manager thread, and is then shared read-only by all the
+ * get_camera_info() calls and camera opens. It is safe to call this function
+ * from any thread.
  */
-camera_metadata_t *CameraDevice::getStaticMetadata()
+const camera_metadata_t *CameraDevice::getStaticMetadata() const
 {
-	if (staticMetadata_)
-		return staticMetadata_->get();
+	return staticMetadata_ ? staticMetadata_->get() : nullptr;
+}
 
+/*
+ * Create the static information for the camera.
+ */
+std::unique_ptr<CameraMetadata> CameraDevice::createStaticMetadata()
+{
 	/*
 	 * The here reported metadata are enough to implement a basic capture
 	 * example application, but a real camera implementation will require
@@ -125,13 +260,12 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 
 	/*
 	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 50 entries, 666 bytes
+	 * Currently: 51 entries, 678 bytes
 	 */
-	staticMetadata_ = new CameraMetadata(50, 700);
-	if (!staticMetadata_->isValid()) {
+	std::unique_ptr<CameraMetadata> staticMetadata =
+		utils::make_unique<CameraMetadata>(55, 750);
+	if (!staticMetadata->isValid()) {
 		LOG(HAL, Error) << "Failed to allocate static metadata";
-		delete staticMetadata_;
-		staticMetadata_ = nullptr;
 		return nullptr;
 	}
 
@@ -139,9 +273,9 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 	std::vector<uint8_t> aberrationModes = {
 		ANDROID_COLOR_CORRECTION_ABERRATION_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_COLOR_CORRECTION_AVAILABLE_ABERRATION_MODES,
-				  aberrationModes.data(),
-				  aberrationModes.size());
+	staticMetadata->addEntry(ANDROID_COLOR_CORRECTION_AVAILABLE_ABERRATION_MODES,
+				 aberrationModes.data(),
+				 aberrationModes.size());
 
 	/* Control static metadata. */
 	std::vector<uint8_t> aeAvailableAntiBandingModes = {
@@ -150,228 +284,233 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_CONTROL_AE_ANTIBANDING_MODE_60HZ,
 		ANDROID_CONTROL_AE_ANTIBANDING_MODE_AUTO,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_AVAILABLE_ANTIBANDING_MODES,
-				  aeAvailableAntiBandingModes.data(),
-				  aeAvailableAntiBandingModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_AVAILABLE_ANTIBANDING_MODES,
+				 aeAvailableAntiBandingModes.data(),
+				 aeAvailableAntiBandingModes.size());
 
 	std::vector<uint8_t> aeAvailableModes = {
 		ANDROID_CONTROL_AE_MODE_ON,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_AVAILABLE_MODES,
-				  aeAvailableModes.data(),
-				  aeAvailableModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_AVAILABLE_MODES,
+				 aeAvailableModes.data(),
+				 aeAvailableModes.size());
 
 	std::vector<int32_t> availableAeFpsTarget = {
 		15, 30,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_AVAILABLE_TARGET_FPS_RANGES,
-				  availableAeFpsTarget.data(),
-				  availableAeFpsTarget.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_AVAILABLE_TARGET_FPS_RANGES,
+				 availableAeFpsTarget.data(),
+				 availableAeFpsTarget.size());
 
 	std::vector<int32_t> aeCompensationRange = {
 		0, 0,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_COMPENSATION_RANGE,
-				  aeCompensationRange.data(),
-				  aeCompensationRange.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_COMPENSATION_RANGE,
+				 aeCompensationRange.data(),
+				 aeCompensationRange.size());
 
 	const camera_metadata_rational_t aeCompensationStep[] = {
 		{ 0, 1 }
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_COMPENSATION_STEP,
-				  aeCompensationStep, 1);
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_COMPENSATION_STEP,
+				 aeCompensationStep, 1);
 
 	std::vector<uint8_t> availableAfModes = {
 		ANDROID_CONTROL_AF_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AF_AVAILABLE_MODES,
-				  availableAfModes.data(),
-				  availableAfModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AF_AVAILABLE_MODES,
+				 availableAfModes.data(),
+				 availableAfModes.size());
 
 	std::vector<uint8_t> availableEffects = {
 		ANDROID_CONTROL_EFFECT_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_EFFECTS,
-				  availableEffects.data(),
-				  availableEffects.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AVAILABLE_EFFECTS,
+				 availableEffects.data(),
+				 availableEffects.size());
 
 	std::vector<uint8_t> availableSceneModes = {
 		ANDROID_CONTROL_SCENE_MODE_DISABLED,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_SCENE_MODES,
-				  availableSceneModes.data(),
-				  availableSceneModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AVAILABLE_SCENE_MODES,
+				 availableSceneModes.data(),
+				 availableSceneModes.size());
 
 	std::vector<uint8_t> availableStabilizationModes = {
 		ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_VIDEO_STABILIZATION_MODES,
-				  availableStabilizationModes.data(),
-				  availableStabilizationModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AVAILABLE_VIDEO_STABILIZATION_MODES,
+				 availableStabilizationModes.data(),
+				 availableStabilizationModes.size());
 
 	std::vector<uint8_t> availableAwbModes = {
 		ANDROID_CONTROL_AWB_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_AWB_AVAILABLE_MODES,
-				  availableAwbModes.data(),
-				  availableAwbModes.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_AWB_AVAILABLE_MODES,
+				 availableAwbModes.data(),
+				 availableAwbModes.size());
 
 	std::vector<int32_t> availableMaxRegions = {
 		0, 0, 0,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_MAX_REGIONS,
-				  availableMaxRegions.data(),
-				  availableMaxRegions.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_MAX_REGIONS,
+				 availableMaxRegions.data(),
+				 availableMaxRegions.size());
 
 	std::vector<uint8_t> sceneModesOverride = {
 		ANDROID_CONTROL_AE_MODE_ON,
 		ANDROID_CONTROL_AWB_MODE_AUTO,
 		ANDROID_CONTROL_AF_MODE_AUTO,
 	};
-	staticMetadata_->addEntry(ANDROID_CONTROL_SCENE_MODE_OVERRIDES,
-				  sceneModesOverride.data(),
-				  sceneModesOverride.size());
+	staticMetadata->addEntry(ANDROID_CONTROL_SCENE_MODE_OVERRIDES,
+				 sceneModesOverride.data(),
+				 sceneModesOverride.size());
 
 	uint8_t aeLockAvailable = ANDROID_CONTROL_AE_LOCK_AVAILABLE_FALSE;
-	staticMetadata_->addEntry(ANDROID_CONTROL_AE_LOCK_AVAILABLE,
-				  &aeLockAvailable, 1);
+	staticMetadata->addEntry(ANDROID_CONTROL_AE_LOCK_AVAILABLE,
+				 &aeLockAvailable, 1);
 
 	uint8_t awbLockAvailable = ANDROID_CONTROL_AWB_LOCK_AVAILABLE_FALSE;
-	staticMetadata_->addEntry(ANDROID_CONTROL_AWB_LOCK_AVAILABLE,
-				  &awbLockAvailable, 1);
+	staticMetadata->addEntry(ANDROID_CONTROL_AWB_LOCK_AVAILABLE,
+				 &awbLockAvailable, 1);
 
 	char availableControlModes = ANDROID_CONTROL_MODE_AUTO;
-	staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_MODES,
-				  &availableControlModes, 1);
+	staticMetadata->addEntry(ANDROID_CONTROL_AVAILABLE_MODES,
+				 &availableControlModes, 1);
 
 	/* JPEG static metadata. */
 	std::vector<int32_t> availableThumbnailSizes = {
 		0, 0,
+		160, 120,
 	};
-	staticMetadata_->addEntry(ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES,
-				  availableThumbnailSizes.data(),
-				  availableThumbnailSizes.size());
+	staticMetadata->addEntry(ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES,
+				 availableThumbnailSizes.data(),
+				 availableThumbnailSizes.size());
+
+	/* Worst case of the largest BLOB stream, and the blob trailer. */
+	int32_t maxJpegSize = 2560 * 1920 * 3 / 2 + sizeof(camera3_jpeg_blob_t);
+	staticMetadata->addEntry(ANDROID_JPEG_MAX_SIZE, &maxJpegSize, 1);
 
 	/* Sensor static metadata. */
 	int32_t pixelArraySize[] = {
 		2592, 1944,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_PIXEL_ARRAY_SIZE,
-				  &pixelArraySize, 2);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_PIXEL_ARRAY_SIZE,
+				 &pixelArraySize, 2);
 
 	int32_t sensorSizes[] = {
 		0, 0, 2560, 1920,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE,
-				  &sensorSizes, 4);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE,
+				 &sensorSizes, 4);
 
 	int32_t sensitivityRange[] = {
 		32, 2400,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_SENSITIVITY_RANGE,
-				  &sensitivityRange, 2);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_SENSITIVITY_RANGE,
+				 &sensitivityRange, 2);
 
 	uint16_t filterArr = ANDROID_SENSOR_INFO_COLOR_FILTER_ARRANGEMENT_GRBG;
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_COLOR_FILTER_ARRANGEMENT,
-				  &filterArr, 1);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_COLOR_FILTER_ARRANGEMENT,
+				 &filterArr, 1);
 
 	int64_t exposureTimeRange[] = {
 		100000, 200000000,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_EXPOSURE_TIME_RANGE,
-				  &exposureTimeRange, 2);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_EXPOSURE_TIME_RANGE,
+				 &exposureTimeRange, 2);
 
 	int32_t orientation = 0;
-	staticMetadata_->addEntry(ANDROID_SENSOR_ORIENTATION,
-				  &orientation, 1);
+	staticMetadata->addEntry(ANDROID_SENSOR_ORIENTATION,
+				 &orientation, 1);
 
 	std::vector<int32_t> testPatterModes = {
 		ANDROID_SENSOR_TEST_PATTERN_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_AVAILABLE_TEST_PATTERN_MODES,
-				  testPatterModes.data(),
-				  testPatterModes.size());
+	staticMetadata->addEntry(ANDROID_SENSOR_AVAILABLE_TEST_PATTERN_MODES,
+				 testPatterModes.data(),
+				 testPatterModes.size());
 
 	std::vector<float> physicalSize = {
 		2592, 1944,
 	};
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_PHYSICAL_SIZE,
-				  physicalSize.data(),
-				  physicalSize.size());
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_PHYSICAL_SIZE,
+				 physicalSize.data(),
+				 physicalSize.size());
 
 	uint8_t timestampSource = ANDROID_SENSOR_INFO_TIMESTAMP_SOURCE_UNKNOWN;
-	staticMetadata_->addEntry(ANDROID_SENSOR_INFO_TIMESTAMP_SOURCE,
-				  &timestampSource, 1);
+	staticMetadata->addEntry(ANDROID_SENSOR_INFO_TIMESTAMP_SOURCE,
+				 &timestampSource, 1);
 
 	/* Statistics static metadata. */
 	uint8_t faceDetectMode = ANDROID_STATISTICS_FACE_DETECT_MODE_OFF;
-	staticMetadata_->addEntry(ANDROID_STATISTICS_INFO_AVAILABLE_FACE_DETECT_MODES,
-				  &faceDetectMode, 1);
+	staticMetadata->addEntry(ANDROID_STATISTICS_INFO_AVAILABLE_FACE_DETECT_MODES,
+				 &faceDetectMode, 1);
 
 	int32_t maxFaceCount = 0;
-	staticMetadata_->addEntry(ANDROID_STATISTICS_INFO_MAX_FACE_COUNT,
-				  &maxFaceCount, 1);
+	staticMetadata->addEntry(ANDROID_STATISTICS_INFO_MAX_FACE_COUNT,
+				 &maxFaceCount, 1);
 
 	/* Sync static metadata. */
 	int32_t maxLatency = ANDROID_SYNC_MAX_LATENCY_UNKNOWN;
-	staticMetadata_->addEntry(ANDROID_SYNC_MAX_LATENCY, &maxLatency, 1);
+	staticMetadata->addEntry(ANDROID_SYNC_MAX_LATENCY, &maxLatency, 1);
 
 	/* Flash static metadata. */
 	char flashAvailable = ANDROID_FLASH_INFO_AVAILABLE_FALSE;
-	staticMetadata_->addEntry(ANDROID_FLASH_INFO_AVAILABLE,
-				  &flashAvailable, 1);
+	staticMetadata->addEntry(ANDROID_FLASH_INFO_AVAILABLE,
+				 &flashAvailable, 1);
 
 	/* Lens static metadata. */
 	std::vector<float> lensApertures = {
 		2.53 / 100,
 	};
-	staticMetadata_->addEntry(ANDROID_LENS_INFO_AVAILABLE_APERTURES,
-				  lensApertures.data(),
-				  lensApertures.size());
+	staticMetadata->addEntry(ANDROID_LENS_INFO_AVAILABLE_APERTURES,
+				 lensApertures.data(),
+				 lensApertures.size());
 
 	uint8_t lensFacing = ANDROID_LENS_FACING_FRONT;
-	staticMetadata_->addEntry(ANDROID_LENS_FACING, &lensFacing, 1);
+	staticMetadata->addEntry(ANDROID_LENS_FACING, &lensFacing, 1);
 
 	std::vector<float> lensFocalLenghts = {
 		1,
 	};
-	staticMetadata_->addEntry(ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS,
-				  lensFocalLenghts.data(),
-				  lensFocalLenghts.size());
+	staticMetadata->addEntry(ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS,
+				 lensFocalLenghts.data(),
+				 lensFocalLenghts.size());
 
 	std::vector<uint8_t> opticalStabilizations = {
 		ANDROID_LENS_OPTICAL_STABILIZATION_MODE_OFF,
 	};
-	staticMetadata_->addEntry(ANDROID_LENS_INFO_AVAILABLE_OPTICAL_STABILIZATION,
-				  opticalStabilizations.data(),
-				  opticalStabilizations.size());
+	staticMetadata->addEntry(ANDROID_LENS_INFO_AVAILABLE_OPTICAL_STABILIZATION,
+				 opticalStabilizations.data(),
+				 opticalStabilizations.size());
 
 	float hypeFocalDistance = 0;
-	staticMetadata_->addEntry(ANDROID_LENS_INFO_HYPERFOCAL_DISTANCE,
-				  &hypeFocalDistance, 1);
+	staticMetadata->addEntry(ANDROID_LENS_INFO_HYPERFOCAL_DISTANCE,
+				 &hypeFocalDistance, 1);
 
 	float minFocusDistance = 0;
-	staticMetadata_->addEntry(ANDROID_LENS_INFO_MINIMUM_FOCUS_DISTANCE,
-				  &minFocusDistance, 1);
+	staticMetadata->addEntry(ANDROID_LENS_INFO_MINIMUM_FOCUS_DISTANCE,
+				 &minFocusDistance, 1);
 
 	/* Noise reduction modes. */
 	uint8_t noiseReductionModes = ANDROID_NOISE_REDUCTION_MODE_OFF;
-	staticMetadata_->addEntry(ANDROID_NOISE_REDUCTION_AVAILABLE_NOISE_REDUCTION_MODES,
-				  &noiseReductionModes, 1);
+	staticMetadata->addEntry(ANDROID_NOISE_REDUCTION_AVAILABLE_NOISE_REDUCTION_MODES,
+				 &noiseReductionModes, 1);
 
 	/* Scaler static metadata. */
 	float maxDigitalZoom = 1;
-	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_MAX_DIGITAL_ZOOM,
-				  &maxDigitalZoom, 1);
+	staticMetadata->addEntry(ANDROID_SCALER_AVAILABLE_MAX_DIGITAL_ZOOM,
+				 &maxDigitalZoom, 1);
 
 	std::vector<uint32_t> availableStreamFormats = {
 		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB,
 		ANDROID_SCALER_AVAILABLE_FORMATS_YCbCr_420_888,
 		ANDROID_SCALER_AVAILABLE_FORMATS_IMPLEMENTATION_DEFINED,
 	};
-	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_FORMATS,
-				  availableStreamFormats.data(),
-				  availableStreamFormats.size());
+	staticMetadata->addEntry(ANDROID_SCALER_AVAILABLE_FORMATS,
+				 availableStreamFormats.data(),
+				 availableStreamFormats.size());
 
 	std::vector<uint32_t> availableStreamConfigurations = {
 		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920,
@@ -381,49 +520,49 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_SCALER_AVAILABLE_FORMATS_IMPLEMENTATION_DEFINED, 2560, 1920,
 		ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS_OUTPUT,
 	};
-	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS,
-				  availableStreamConfigurations.data(),
-				  availableStreamConfigurations.size());
+	staticMetadata->addEntry(ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS,
+				 availableStreamConfigurations.data(),
+				 availableStreamConfigurations.size());
 
 	std::vector<int64_t> availableStallDurations = {
 		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920, 33333333,
 	};
-	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_STALL_DURATIONS,
-				  availableStallDurations.data(),
-				  availableStallDurations.size());
+	staticMetadata->addEntry(ANDROID_SCALER_AVAILABLE_STALL_DURATIONS,
+				 availableStallDurations.data(),
+				 availableStallDurations.size());
 
 	std::vector<int64_t> minFrameDurations = {
 		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920, 33333333,
 		ANDROID_SCALER_AVAILABLE_FORMATS_IMPLEMENTATION_DEFINED, 2560, 1920, 33333333,
 		ANDROID_SCALER_AVAILABLE_FORMATS_YCbCr_420_888, 2560, 1920, 33333333,
 	};
-	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_MIN_FRAME_DURATIONS,
-				  minFrameDurations.data(),
-				  minFrameDurations.size());
+	staticMetadata->addEntry(ANDROID_SCALER_AVAILABLE_MIN_FRAME_DURATIONS,
+				 minFrameDurations.data(),
+				 minFrameDurations.size());
 
 	uint8_t croppingType = ANDROID_SCALER_CROPPING_TYPE_CENTER_ONLY;
-	staticMetadata_->addEntry(ANDROID_SCALER_CROPPING_TYPE, &croppingType, 1);
+	staticMetadata->addEntry(ANDROID_SCALER_CROPPING_TYPE, &croppingType, 1);
 
 	/* Info static metadata. */
 	uint8_t supportedHWLevel = ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL_LIMITED;
-	staticMetadata_->addEntry(ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL,
-				  &supportedHWLevel, 1);
+	staticMetadata->addEntry(ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL,
+				 &supportedHWLevel, 1);
 
 	/* Request static metadata. */
 	int32_t partialResultCount = 1;
-	staticMetadata_->addEntry(ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
-				  &partialResultCount, 1);
+	staticMetadata->addEntry(ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
+				 &partialResultCount, 1);
 
 	uint8_t maxPipelineDepth = 2;
-	staticMetadata_->addEntry(ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
-				  &maxPipelineDepth, 1);
+	staticMetadata->addEntry(ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
+				 &maxPipelineDepth, 1);
 
 	std::vector<uint8_t> availableCapabilities = {
 		ANDROID_REQUEST_AVAILABLE_CAPABILITIES_BACKWARD_COMPATIBLE,
 	};
-	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
-				  availableCapabilities.data(),
-				  availableCapabilities.size());
+	staticMetadata->addEntry(ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
+				 availableCapabilities.data(),
+				 availableCapabilities.size());
 
 	std::vector<int32_t> availableCharacteristicsKeys = {
 		ANDROID_COLOR_CORRECTION_AVAILABLE_ABERRATION_MODES,
@@ -443,6 +582,7 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_CONTROL_AWB_LOCK_AVAILABLE,
 		ANDROID_CONTROL_AVAILABLE_MODES,
 		ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES,
+		ANDROID_JPEG_MAX_SIZE,
 		ANDROID_SENSOR_INFO_PIXEL_ARRAY_SIZE,
 		ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE,
 		ANDROID_SENSOR_INFO_SENSITIVITY_RANGE,
@@ -474,9 +614,9 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
 		ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
 	};
-	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_CHARACTERISTICS_KEYS,
-				  availableCharacteristicsKeys.data(),
-				  availableCharacteristicsKeys.size());
+	staticMetadata->addEntry(ANDROID_REQUEST_AVAILABLE_CHARACTERISTICS_KEYS,
+				 availableCharacteristicsKeys.data(),
+				 availableCharacteristicsKeys.size());
 
 	std::vector<int32_t> availableRequestKeys = {
 		ANDROID_CONTROL_AE_MODE,
@@ -492,9 +632,9 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_COLOR_CORRECTION_ABERRATION_MODE,
 		ANDROID_CONTROL_CAPTURE_INTENT,
 	};
-	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_REQUEST_KEYS,
-				  availableRequestKeys.data(),
-				  availableRequestKeys.size());
+	staticMetadata->addEntry(ANDROID_REQUEST_AVAILABLE_REQUEST_KEYS,
+				 availableRequestKeys.data(),
+				 availableRequestKeys.size());
 
 	std::vector<int32_t> availableResultKeys = {
 		ANDROID_CONTROL_AE_STATE,
@@ -510,18 +650,16 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
 		ANDROID_STATISTICS_SCENE_FLICKER,
 	};
-	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_RESULT_KEYS,
-				  availableResultKeys.data(),
-				  availableResultKeys.size());
+	staticMetadata->addEntry(ANDROID_REQUEST_AVAILABLE_RESULT_KEYS,
+				 availableResultKeys.data(),
+				 availableResultKeys.size());
 
-	if (!staticMetadata_->isValid()) {
+	if (!staticMetadata->isValid()) {
 		LOG(HAL, Error) << "Failed to construct static metadata";
-		delete staticMetadata_;
-		staticMetadata_ = nullptr;
 		return nullptr;
 	}
 
-	return staticMetadata_->get();
+	return staticMetadata;
 }
 
 /*
@@ -633,6 +771,22 @@ const camera_metadata_t *CameraDevice::constructDefaultRequestSettings(int type)
  */
 int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 {
+	/*
+	 * Stop the camera, it will be restarted by the first capture request.
+	 * Buffers are kept allocated, they will be reused if the new
+	 * configuration is identical to the current one.
+	 */
+	if (running_) {
+		camera_->stop();
+		running_ = false;
+	}
+
+	waitJpegEncodings();
+	streams_.clear();
+
+	/* Gralloc buffers are allocated again for the new streams. */
+	clearImportedBuffers();
+
 	for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
 		camera3_stream_t *stream = stream_list->streams[i];
 
@@ -641,27 +795,184 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 			       << ", width: " << stream->width
 			       << ", height: " << stream->height
 			       << ", format: " << utils::hex(stream->format);
+
+		if (stream->stream_type != CAMERA3_STREAM_OUTPUT) {
+			LOG(HAL, Error) << "Only output streams are supported";
+			return -EINVAL;
+		}
 	}
 
-	/* Hardcode viewfinder role, collecting sizes from the stream config. */
-	if (stream_list->num_streams != 1) {
-		LOG(HAL, Error) << "Only one stream supported";
-		return -EINVAL;
+	/*
+	 * Map each output stream to a libcamera stream. If the camera can't
+	 * produce all of them concurrently, map the BLOB streams on YUV
+	 * streams instead, and encode them from the frames captured for those.
+	 */
+	std::vector<camera3_stream_t *> streams(stream_list->streams,
+						stream_list->streams +
+						stream_list->num_streams);
+	std::map<camera3_stream_t *, camera3_stream_t *> sources;
+
+	if (!tryConfiguration(streams)) {
+		streams.clear();
+		for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
+			camera3_stream_t *camera3Stream = stream_list->streams[i];
+			camera3_stream_t *source = nullptr;
+
+			if (camera3Stream->format == HAL_PIXEL_FORMAT_BLOB)
+				source = findJpegSource(stream_list, camera3Stream);
+
+			if (source)
+				sources[camera3Stream] = source;
+			else
+				streams.push_back(camera3Stream);
+		}
+
+		if (sources.empty() || !tryConfiguration(streams)) {
+			LOG(HAL, Error) << "Unsupported stream configuration";
+			config_.reset();
+			return -EINVAL;
+		}
+
+		LOG(HAL, Info) << "Encoding " << sources.size()
+			       << " BLOB stream(s) from YUV streams";
+	}
+
+	/*
+	 * Once the CameraConfiguration has been adjusted/validated
+	 * it can be applied to the camera.
+	 */
+	int ret = camera_->configure(config_.get());
+	if (ret == -EACCES && prepared_) {
+		/* The configuration has changed, reallocate buffers. */
+		camera_->freeBuffers();
+		prepared_ = false;
+
+		ret = camera_->configure(config_.get());
+	}
+	if (ret) {
+		LOG(HAL, Error) << "Failed to configure camera '"
+				<< camera_->name() << "'";
+		return ret;
+	}
+
+	/*
+	 * Store the HAL stream in the HAL-private field of the Android stream,
+	 * to route the buffers of capture requests.
+	 */
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+		camera3_stream_t *camera3Stream = streams[i];
+		StreamConfiguration &streamConfiguration = config_->at(i);
+
+		CameraStream *cameraStream = new CameraStream();
+		cameraStream->stream = streamConfiguration.stream();
+		streams_.emplace_back(cameraStream);
+
+		camera3Stream->priv = cameraStream;
+		camera3Stream->max_buffers = streamConfiguration.bufferCount;
+
+		if (camera3Stream->format != HAL_PIXEL_FORMAT_BLOB) {
+			cameraStream->type = CameraStream::Direct;
+			continue;
+		}
+
+		cameraStream->type = CameraStream::Internal;
+		for (unsigned int j = 0; j < streamConfiguration.bufferCount; ++j)
+			cameraStream->freeBuffers.push_back(j);
+	}
+
+	for (auto &it : sources) {
+		camera3_stream_t *camera3Stream = it.first;
+		const CameraStream *source =
+			static_cast<CameraStream *>(it.second->priv);
+
+		CameraStream *cameraStream = new CameraStream();
+		cameraStream->type = CameraStream::Mapped;
+		cameraStream->stream = source->stream;
+		streams_.emplace_back(cameraStream);
+
+		camera3Stream->priv = cameraStream;
+		camera3Stream->max_buffers = std::min(it.second->max_buffers,
+						      JpegBufferCount);
+	}
+
+	for (const std::unique_ptr<CameraStream> &cameraStream : streams_) {
+		if (cameraStream->type == CameraStream::Direct)
+			continue;
+
+		const camera3_stream_t *camera3Stream = nullptr;
+		for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
+			if (stream_list->streams[i]->priv == cameraStream.get())
+				camera3Stream = stream_list->streams[i];
+		}
+
+		cameraStream->postProcessor =
+			utils::make_unique<PostProcessorJpeg>(camera_->name());
+		ret = cameraStream->postProcessor->configure(
+			cameraStream->stream->configuration(),
+			{ camera3Stream->width, camera3Stream->height });
+		if (ret) {
+			LOG(HAL, Error) << "Failed to configure JPEG encoder";
+			streams_.clear();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Generate and validate a camera configuration with one libcamera stream for
+ * each of the camera3 \a streams, in the same order. The role of each stream
+ * is derived from its format and gralloc usage flags.
+ */
+bool CameraDevice::tryConfiguration(const std::vector<camera3_stream_t *> &streams)
+{
+	StreamRoles roles;
+	for (const camera3_stream_t *camera3Stream : streams) {
+		switch (camera3Stream->format) {
+		case HAL_PIXEL_FORMAT_BLOB:
+			roles.push_back(StreamRole::StillCapture);
+			break;
+		case HAL_PIXEL_FORMAT_RAW16:
+		case HAL_PIXEL_FORMAT_RAW_OPAQUE:
+			roles.push_back(StreamRole::StillCaptureRaw);
+			break;
+		default:
+			if (camera3Stream->usage & GRALLOC_USAGE_HW_VIDEO_ENCODER)
+				roles.push_back(StreamRole::VideoRecording);
+			else
+				roles.push_back(StreamRole::Viewfinder);
+			break;
+		}
 	}
 
-	StreamRoles roles = { StreamRole::Viewfinder };
 	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->empty()) {
-		LOG(HAL, Error) << "Failed to generate camera configuration";
-		return -EINVAL;
+	if (!config_ || config_->size() != roles.size()) {
+		LOG(HAL, Debug) << "Failed to generate camera configuration";
+		config_.reset();
+		return false;
 	}
 
-	/* Only one stream is supported. */
-	camera3_stream_t *camera3Stream = stream_list->streams[0];
-	StreamConfiguration *streamConfiguration = &config_->at(0);
-	streamConfiguration->size.width = camera3Stream->width;
-	streamConfiguration->size.height = camera3Stream->height;
-	streamConfiguration->memoryType = ExternalMemory;
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+		const camera3_stream_t *camera3Stream = streams[i];
+		StreamConfiguration &streamConfiguration = config_->at(i);
+
+		streamConfiguration.size.width = camera3Stream->width;
+		streamConfiguration.size.height = camera3Stream->height;
+
+		/*
+		 * BLOB streams are captured to buffers allocated by the
+		 * camera, and encoded to the gralloc buffers afterwards.
+		 */
+		if (camera3Stream->format == HAL_PIXEL_FORMAT_BLOB) {
+			streamConfiguration.memoryType = InternalMemory;
+			streamConfiguration.bufferCount =
+				std::min(streamConfiguration.bufferCount,
+					 JpegBufferCount);
+		} else {
+			streamConfiguration.memoryType = ExternalMemory;
+		}
+	}
 
 	/*
 	 * \todo We'll need to translate from Android defined pixel format codes
@@ -671,57 +982,118 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 
 	switch (config_->validate()) {
 	case CameraConfiguration::Valid:
-		break;
+		return true;
 	case CameraConfiguration::Adjusted:
-		LOG(HAL, Info) << "Camera configuration adjusted";
-		config_.reset();
-		return -EINVAL;
+		LOG(HAL, Debug) << "Camera configuration adjusted";
+		break;
 	case CameraConfiguration::Invalid:
-		LOG(HAL, Info) << "Camera configuration invalid";
-		config_.reset();
-		return -EINVAL;
+		LOG(HAL, Debug) << "Camera configuration invalid";
+		break;
 	}
 
-	camera3Stream->max_buffers = streamConfiguration->bufferCount;
+	config_.reset();
+	return false;
+}
 
-	/*
-	 * Once the CameraConfiguration has been adjusted/validated
-	 * it can be applied to the camera.
-	 */
-	int ret = camera_->configure(config_.get());
-	if (ret) {
-		LOG(HAL, Error) << "Failed to configure camera '"
-				<< camera_->name() << "'";
-		return ret;
+/*
+ * Find the YUV stream to encode the frames of \a blobStream from, when the
+ * camera can't produce a dedicated stream for it. A stream of the same size is
+ * preferred, the largest YUV stream is otherwise used and its frames scaled.
+ */
+camera3_stream_t *CameraDevice::findJpegSource(camera3_stream_configuration_t *stream_list,
+					       camera3_stream_t *blobStream)
+{
+	camera3_stream_t *source = nullptr;
+
+	for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
+		camera3_stream_t *camera3Stream = stream_list->streams[i];
+
+		switch (camera3Stream->format) {
+		case HAL_PIXEL_FORMAT_BLOB:
+		case HAL_PIXEL_FORMAT_RAW16:
+		case HAL_PIXEL_FORMAT_RAW_OPAQUE:
+			continue;
+		default:
+			break;
+		}
+
+		if (camera3Stream->width == blobStream->width &&
+		    camera3Stream->height == blobStream->height)
+			return camera3Stream;
+
+		if (!source ||
+		    camera3Stream->width * camera3Stream->height >
+		    source->width * source->height)
+			source = camera3Stream;
 	}
 
-	return 0;
+	return source;
 }
 
+/*
+ * Validate a capture request and queue it for processing in the CameraDevice
+ * thread. This is called in the camera framework thread and returns without
+ * waiting for the request to be processed, errors occurring later are reported
+ * asynchronously through error notifications and capture results.
+ */
 int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Request)
 {
-	StreamConfiguration *streamConfiguration = &config_->at(0);
-	Stream *stream = streamConfiguration->stream();
-
-	if (camera3Request->num_output_buffers != 1) {
-		LOG(HAL, Error) << "Invalid number of output buffers: "
-				<< camera3Request->num_output_buffers;
+	if (!camera3Request->num_output_buffers) {
+		LOG(HAL, Error) << "No output buffer provided";
 		return -EINVAL;
 	}
 
+	for (unsigned int i = 0; i < camera3Request->num_output_buffers; ++i) {
+		if (!camera3Request->output_buffers[i].stream->priv) {
+			LOG(HAL, Error) << "Buffer for an unconfigured stream";
+			return -EINVAL;
+		}
+	}
+
+	/*
+	 * The capture request is only valid for the duration of this call,
+	 * copy the information needed to process it.
+	 */
+	CaptureRequest *captureRequest = new CaptureRequest();
+	captureRequest->frameNumber = camera3Request->frame_number;
+	captureRequest->buffers.assign(camera3Request->output_buffers,
+				       camera3Request->output_buffers +
+				       camera3Request->num_output_buffers);
+
+	invokeMethod(&CameraDevice::queueCaptureRequest, captureRequest);
+
+	return 0;
+}
+
+/*
+ * Process a capture request in the CameraDevice thread. The capture request
+ * has already been accepted, failures are reported through an error capture
+ * result.
+ */
+void CameraDevice::queueCaptureRequest(CaptureRequest *captureRequest)
+{
+	std::unique_ptr<CaptureRequest> camera3Request(captureRequest);
+
 	/* Start the camera if that's the first request we handle. */
 	if (!running_) {
-		int ret = camera_->allocateBuffers();
-		if (ret) {
-			LOG(HAL, Error) << "Failed to allocate buffers";
-			return ret;
+		if (!prepared_) {
+			int ret = camera_->allocateBuffers();
+			if (ret) {
+				LOG(HAL, Error) << "Failed to allocate buffers";
+				abortCaptureRequest(camera3Request.get());
+				return;
+			}
+
+			prepared_ = true;
 		}
 
-		ret = camera_->start();
+		int ret = camera_->start();
 		if (ret) {
 			LOG(HAL, Error) << "Failed to start camera";
 			camera_->freeBuffers();
-			return ret;
+			prepared_ = false;
+			abortCaptureRequest(camera3Request.get());
+			return;
 		}
 
 		running_ = true;
@@ -731,73 +1103,341 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	 * Queue a request for the Camera with the provided dmabuf file
 	 * descriptors.
 	 */
-	const camera3_stream_buffer_t *camera3Buffers =
-					camera3Request->output_buffers;
+	const std::vector<camera3_stream_buffer_t> &camera3Buffers =
+		camera3Request->buffers;
+	int ret;
 
 	/*
-	 * Save the request descriptors for use at completion time.
-	 * The descriptor and the associated memory reserved here are freed
-	 * at request complete time.
+	 * Save the request descriptors for use at completion time. The
+	 * request and its descriptor are returned to the request pool at
+	 * request complete time.
 	 */
-	Camera3RequestDescriptor *descriptor =
-		new Camera3RequestDescriptor(camera3Request->frame_number,
-					     camera3Request->num_output_buffers);
-	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
-		/*
-		 * Keep track of which stream the request belongs to and store
-		 * the native buffer handles.
-		 *
-		 * \todo Currently we only support one capture buffer. Copy
-		 * all of them to be ready once we'll support more.
-		 */
-		descriptor->buffers[i].stream = camera3Buffers[i].stream;
-		descriptor->buffers[i].buffer = camera3Buffers[i].buffer;
+	Request *request = getRequest(camera3Request->frameNumber,
+				      camera3Buffers.size());
+	if (!request) {
+		LOG(HAL, Error) << "Failed to create request";
+		abortCaptureRequest(camera3Request.get());
+		return;
 	}
 
 	/*
-	 * Create a libcamera buffer using the dmabuf descriptors of the first
-	 * and (currently) only supported request buffer.
+	 * Create a libcamera buffer for each output buffer, using its dmabuf
+	 * descriptors, and add them all to the same request. The buffers for
+	 * all streams are thus captured in a single pass.
 	 */
-	const buffer_handle_t camera3Handle = *camera3Buffers[0].buffer;
-	std::array<int, 3> fds = {
-		camera3Handle->data[0],
-		camera3Handle->data[1],
-		camera3Handle->data[2],
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	/*
+	 * Store the BLOB buffers last in the descriptor, preceded by the
+	 * buffers they are encoded from for BLOB streams mapped on YUV streams,
+	 * to return the other buffers without waiting for the JPEG encoding.
+	 */
+	std::vector<Stream *> sourceStreams;
+	for (const camera3_stream_buffer_t &camera3Buffer : camera3Buffers) {
+		CameraStream *cameraStream =
+			static_cast<CameraStream *>(camera3Buffer.stream->priv);
+		if (cameraStream->type == CameraStream::Direct)
+			continue;
+
+		descriptor->numJpegBuffers++;
+		if (cameraStream->type == CameraStream::Mapped)
+			sourceStreams.push_back(cameraStream->stream);
+	}
+
+	for (const camera3_stream_buffer_t &camera3Buffer : camera3Buffers) {
+		CameraStream *cameraStream =
+			static_cast<CameraStream *>(camera3Buffer.stream->priv);
+		if (cameraStream->type != CameraStream::Direct)
+			continue;
+
+		auto it = std::find(sourceStreams.begin(), sourceStreams.end(),
+				    cameraStream->stream);
+		if (it == sourceStreams.end())
+			continue;
+
+		descriptor->numSourceBuffers++;
+		sourceStreams.erase(it);
+	}
+
+	if (!sourceStreams.empty()) {
+		LOG(HAL, Error) << "No buffer to encode the BLOB stream from";
+		releaseRequest(request);
+		abortCaptureRequest(camera3Request.get());
+		return;
+	}
+
+	auto isJpegSource = [&](Stream *stream) {
+		for (const camera3_stream_buffer_t &camera3Buffer : camera3Buffers) {
+			CameraStream *cameraStream =
+				static_cast<CameraStream *>(camera3Buffer.stream->priv);
+			if (cameraStream->type == CameraStream::Mapped &&
+			    cameraStream->stream == stream)
+				return true;
+		}
+
+		return false;
 	};
 
-	std::unique_ptr<Buffer> buffer = stream->createBuffer(fds);
-	if (!buffer) {
-		LOG(HAL, Error) << "Failed to create buffer";
-		delete descriptor;
-		return -EINVAL;
+	unsigned int nextJpeg = descriptor->numBuffers - descriptor->numJpegBuffers;
+	unsigned int nextSource = nextJpeg - descriptor->numSourceBuffers;
+	unsigned int next = 0;
+
+	for (const camera3_stream_buffer_t &camera3Buffer : camera3Buffers) {
+		camera3_stream_t *camera3Stream = camera3Buffer.stream;
+		CameraStream *cameraStream =
+			static_cast<CameraStream *>(camera3Stream->priv);
+		Stream *stream = cameraStream->stream;
+		unsigned int index;
+
+		if (cameraStream->type != CameraStream::Direct)
+			index = nextJpeg++;
+		else if (isJpegSource(stream))
+			index = nextSource++;
+		else
+			index = next++;
+
+		descriptor->buffers[index].stream = camera3Stream;
+		descriptor->buffers[index].buffer = camera3Buffer.buffer;
+		descriptor->buffers[index].acquire_fence = camera3Buffer.acquire_fence;
+
+		/* Mapped streams are encoded from the buffer of their source. */
+		if (cameraStream->type == CameraStream::Mapped)
+			continue;
+
+		std::unique_ptr<Buffer> buffer;
+		Buffer *imported = nullptr;
+		unsigned int jpegBuffer = 0;
+
+		if (cameraStream->type == CameraStream::Internal) {
+			if (cameraStream->freeBuffers.empty()) {
+				LOG(HAL, Error) << "No free buffer for JPEG stream";
+				releaseRequest(request);
+				abortCaptureRequest(camera3Request.get());
+				return;
+			}
+
+			jpegBuffer = cameraStream->freeBuffers.back();
+			buffer = stream->createBuffer(jpegBuffer);
+			if (buffer)
+				cameraStream->freeBuffers.pop_back();
+		} else {
+			imported = importBuffer(stream, *camera3Buffer.buffer);
+		}
+
+		if (!buffer && !imported) {
+			LOG(HAL, Error) << "Failed to create buffer";
+			releaseRequest(request);
+			abortCaptureRequest(camera3Request.get());
+			return;
+		}
+
+		ret = imported ? request->addBuffer(imported)
+			       : request->addBuffer(std::move(buffer));
+		if (ret) {
+			LOG(HAL, Error) << "Failed to add buffer to request";
+			if (cameraStream->type == CameraStream::Internal)
+				cameraStream->freeBuffers.push_back(jpegBuffer);
+			releaseRequest(request);
+			abortCaptureRequest(camera3Request.get());
+			return;
+		}
+	}
+
+	/*
+	 * Wait for the acquire fences asynchronously, without blocking the
+	 * thread. The request is queued to the camera once all of them have
+	 * signalled. The HAL takes ownership of the fences and closes them.
+	 */
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		int fence = camera3Buffers[i].acquire_fence;
+		if (fence < 0)
+			continue;
+
+		EventNotifier *notifier = new EventNotifier(fence, EventNotifier::Read);
+		notifier->activated.connect(this, &CameraDevice::fenceSignalled);
+
+		descriptor->fences.emplace_back(notifier);
+		descriptor->pendingFences++;
+		fenceRequests_[notifier] = request;
+	}
+
+	if (descriptor->pendingFences)
+		return;
+
+	queueRequest(request);
+}
+
+/*
+ * Return all buffers of a capture request that failed before being queued to
+ * the camera. The acquire fences haven't been waited for, they are handed back
+ * to the framework as release fences.
+ */
+void CameraDevice::abortCaptureRequest(CaptureRequest *captureRequest)
+{
+	for (camera3_stream_buffer_t &buffer : captureRequest->buffers) {
+		buffer.release_fence = buffer.acquire_fence;
+		buffer.acquire_fence = -1;
+		buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+	}
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = captureRequest->frameNumber;
+	captureResult.num_output_buffers = captureRequest->buffers.size();
+	captureResult.output_buffers = captureRequest->buffers.data();
+
+	notifyError(captureRequest->frameNumber,
+		    captureRequest->buffers[0].stream);
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+}
+
+/*
+ * Return all buffers of the capture requests waiting for their acquire fences.
+ * The fences that haven't signalled yet are handed back to the framework as
+ * release fences.
+ */
+void CameraDevice::abortFenceRequests()
+{
+	std::vector<Request *> waiting;
+	for (auto &it : fenceRequests_) {
+		Request *request = it.second;
+		if (std::find(waiting.begin(), waiting.end(), request) != waiting.end())
+			continue;
+
+		Camera3RequestDescriptor *descriptor =
+			reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+		for (unsigned int i = 0; i < descriptor->numBuffers; ++i)
+			descriptor->buffers[i].release_fence = -1;
+
+		waiting.push_back(request);
+	}
+
+	for (auto &it : fenceRequests_) {
+		EventNotifier *notifier = it.first;
+		Camera3RequestDescriptor *descriptor =
+			reinterpret_cast<Camera3RequestDescriptor *>(it.second->cookie());
+
+		notifier->setEnabled(false);
+
+		for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+			if (descriptor->buffers[i].acquire_fence == notifier->fd())
+				descriptor->buffers[i].release_fence = notifier->fd();
+		}
 	}
 
-	Request *request =
-		camera_->createRequest(reinterpret_cast<uint64_t>(descriptor));
-	request->addBuffer(std::move(buffer));
+	fenceRequests_.clear();
+
+	for (Request *request : waiting) {
+		Camera3RequestDescriptor *descriptor =
+			reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+		for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+			descriptor->buffers[i].acquire_fence = -1;
+			descriptor->buffers[i].status = CAMERA3_BUFFER_STATUS_ERROR;
+		}
 
+		camera3_capture_result_t captureResult = {};
+		captureResult.frame_number = descriptor->frameNumber;
+		captureResult.num_output_buffers = descriptor->numBuffers;
+		captureResult.output_buffers =
+			const_cast<const camera3_stream_buffer_t *>(descriptor->buffers);
+
+		notifyError(descriptor->frameNumber, descriptor->buffers[0].stream);
+		callbacks_->process_capture_result(callbacks_, &captureResult);
+
+		releaseRequest(request);
+	}
+}
+
+void CameraDevice::fenceSignalled(EventNotifier *notifier)
+{
+	auto it = fenceRequests_.find(notifier);
+	if (it == fenceRequests_.end())
+		return;
+
+	Request *request = it->second;
+	fenceRequests_.erase(it);
+
+	/*
+	 * The notifier can't be deleted from its own signal handler, it is
+	 * disabled here and deleted with the request descriptor.
+	 */
+	notifier->setEnabled(false);
+	::close(notifier->fd());
+
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+	if (--descriptor->pendingFences)
+		return;
+
+	queueRequest(request);
+}
+
+/*
+ * Queue a request whose acquire fences have all signalled. As the capture
+ * request has already been accepted, failures are reported through an error
+ * capture result.
+ */
+void CameraDevice::queueRequest(Request *request)
+{
 	int ret = camera_->queueRequest(request);
-	if (ret) {
-		LOG(HAL, Error) << "Failed to queue request";
-		goto error;
+	if (!ret)
+		return;
+
+	LOG(HAL, Error) << "Failed to queue request";
+
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = descriptor->numBuffers;
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		descriptor->buffers[i].acquire_fence = -1;
+		descriptor->buffers[i].release_fence = -1;
+		descriptor->buffers[i].status = CAMERA3_BUFFER_STATUS_ERROR;
 	}
+	captureResult.output_buffers =
+		const_cast<const camera3_stream_buffer_t *>(descriptor->buffers);
 
-	return 0;
+	notifyError(descriptor->frameNumber, descriptor->buffers[0].stream);
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	releaseRequest(request);
+}
+
+/*
+ * Notify the shutter as soon as the sensor starts exposing the frame, and send
+ * the result metadata with it as they don't depend on the captured buffers.
+ * The buffers are then returned in a separate capture result without metadata
+ * when the request completes.
+ */
+void CameraDevice::requestStarted(Request *request, uint64_t timestamp)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
 
-error:
-	delete request;
-	delete descriptor;
+	const camera_metadata_t *resultMetadata = getResultMetadata(timestamp);
+	if (!resultMetadata)
+		return;
 
-	return ret;
+	notifyShutter(descriptor->frameNumber, timestamp);
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.partial_result = 1;
+	captureResult.result = resultMetadata;
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	descriptor->started = true;
 }
 
 void CameraDevice::requestComplete(Request *request,
-				   const std::map<Stream *, Buffer *> &buffers)
+				   const Request::BufferMap &buffers)
 {
 	Buffer *libcameraBuffer = buffers.begin()->second;
 	camera3_buffer_status status = CAMERA3_BUFFER_STATUS_OK;
-	std::unique_ptr<CameraMetadata> resultMetadata;
-
 	if (request->status() != Request::RequestComplete) {
 		LOG(HAL, Error) << "Request not succesfully completed: "
 				<< request->status();
@@ -810,43 +1450,256 @@ void CameraDevice::requestComplete(Request *request,
 
 	camera3_capture_result_t captureResult = {};
 	captureResult.frame_number = descriptor->frameNumber;
-	captureResult.num_output_buffers = descriptor->numBuffers;
+	captureResult.num_output_buffers = descriptor->numBuffers -
+					   descriptor->numSourceBuffers -
+					   descriptor->numJpegBuffers;
 	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
-		/*
-		 * \todo Currently we only support one capture buffer. Prepare
-		 * all of them to be ready once we'll support more.
-		 */
+		camera3_stream_t *camera3Stream = descriptor->buffers[i].stream;
+		CameraStream *cameraStream =
+			static_cast<CameraStream *>(camera3Stream->priv);
+		Buffer *buffer = request->findBuffer(cameraStream->stream);
+
 		descriptor->buffers[i].acquire_fence = -1;
 		descriptor->buffers[i].release_fence = -1;
-		descriptor->buffers[i].status = status;
+		descriptor->buffers[i].status =
+			buffer && buffer->status() == Buffer::BufferSuccess
+			? status : CAMERA3_BUFFER_STATUS_ERROR;
 	}
 	captureResult.output_buffers =
 		const_cast<const camera3_stream_buffer_t *>(descriptor->buffers);
 
-	if (status == CAMERA3_BUFFER_STATUS_OK) {
-		notifyShutter(descriptor->frameNumber,
-			      libcameraBuffer->timestamp());
+	/*
+	 * If the shutter and metadata have been sent at frame start, only the
+	 * buffers are left to return, with their status reporting errors.
+	 * Otherwise, for pipeline handlers without frame start events, notify
+	 * them now.
+	 */
+	if (!descriptor->started) {
+		if (status == CAMERA3_BUFFER_STATUS_OK) {
+			notifyShutter(descriptor->frameNumber,
+				      libcameraBuffer->timestamp());
+
+			captureResult.partial_result = 1;
+			captureResult.result =
+				getResultMetadata(libcameraBuffer->timestamp());
+		}
+
+		if (status == CAMERA3_BUFFER_STATUS_ERROR || !captureResult.result) {
+			/* \todo Improve error handling. In case we notify an error
+			 * because the metadata generation fails, a shutter event has
+			 * already been notified for this frame number before the error
+			 * is here signalled. Make sure the error path plays well with
+			 * the camera stack state machine.
+			 */
+			notifyError(descriptor->frameNumber,
+				    descriptor->buffers[0].stream);
+		}
+	}
+
+	if (captureResult.num_output_buffers || captureResult.result)
+		callbacks_->process_capture_result(callbacks_, &captureResult);
 
-		captureResult.partial_result = 1;
-		resultMetadata = getResultMetadata(descriptor->frameNumber,
-						   libcameraBuffer->timestamp());
-		captureResult.result = resultMetadata->get();
+	/*
+	 * Encode the BLOB buffers in worker threads. The request is released
+	 * once all of them, and the buffers they are encoded from, have been
+	 * returned.
+	 */
+	for (unsigned int i = descriptor->numBuffers - descriptor->numJpegBuffers;
+	     i < descriptor->numBuffers; ++i) {
+		if (descriptor->buffers[i].status == CAMERA3_BUFFER_STATUS_OK)
+			encodeJpeg(request, i);
+		else
+			returnBuffer(descriptor, i);
 	}
 
-	if (status == CAMERA3_BUFFER_STATUS_ERROR || !captureResult.result) {
-		/* \todo Improve error handling. In case we notify an error
-		 * because the metadata generation fails, a shutter event has
-		 * already been notified for this frame number before the error
-		 * is here signalled. Make sure the error path plays well with
-		 * the camera stack state machine.
-		 */
+	if (!descriptor->pendingJpegs) {
+		returnSourceBuffers(descriptor);
+		releaseRequest(request);
+	}
+}
+
+/*
+ * Retrieve the libcamera buffer for a gralloc buffer of an output stream. The
+ * camera framework cycles a fixed set of gralloc buffers for each stream
+ * configuration, the buffers are thus imported once and cached by handle until
+ * the streams are reconfigured, avoiding a buffer allocation and the dmabuf
+ * identification for every request.
+ */
+Buffer *CameraDevice::importBuffer(Stream *stream, buffer_handle_t handle)
+{
+	auto it = importedBuffers_.find(handle);
+	if (it != importedBuffers_.end()) {
+		Buffer *buffer = it->second;
+		if (buffer->stream() == stream)
+			return buffer;
+
+		buffer->stream()->releaseBuffer(buffer);
+		importedBuffers_.erase(it);
+	}
+
+	std::array<int, 3> fds = {
+		handle->data[0],
+		handle->data[1],
+		handle->data[2],
+	};
+
+	Buffer *buffer = stream->importBuffer(fds);
+	if (buffer)
+		importedBuffers_[handle] = buffer;
+
+	return buffer;
+}
+
+/*
+ * Release the imported buffers. This must only be called when none of them
+ * is part of a request.
+ */
+void CameraDevice::clearImportedBuffers()
+{
+	for (auto &it : importedBuffers_) {
+		Buffer *buffer = it.second;
+		buffer->stream()->releaseBuffer(buffer);
+	}
+
+	importedBuffers_.clear();
+}
+
+/* Retrieve the Internal stream backed by the libcamera \a stream, if any. */
+CameraDevice::CameraStream *CameraDevice::findInternalStream(Stream *stream)
+{
+	for (const std::unique_ptr<CameraStream> &cameraStream : streams_) {
+		if (cameraStream->type == CameraStream::Internal &&
+		    cameraStream->stream == stream)
+			return cameraStream.get();
+	}
+
+	return nullptr;
+}
+
+/*
+ * Encode the frame captured for a BLOB buffer to JPEG, outside of the
+ * CameraDevice thread to avoid delaying the other requests. The buffer is
+ * returned to the framework by jpegEncoded() once the encoding completes.
+ */
+void CameraDevice::encodeJpeg(Request *request, unsigned int index)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+	const camera3_stream_buffer_t &camera3Buffer = descriptor->buffers[index];
+	CameraStream *cameraStream =
+		static_cast<CameraStream *>(camera3Buffer.stream->priv);
+	Stream *stream = cameraStream->stream;
+	PostProcessorJpeg *postProcessor = cameraStream->postProcessor.get();
+	buffer_handle_t destination = *camera3Buffer.buffer;
+
+	/*
+	 * Mapped streams are encoded from the gralloc buffer of their source
+	 * stream, as the camera memory it has been captured to can be reused
+	 * for other gralloc buffers as soon as the request completes.
+	 */
+	BufferMemory *source = nullptr;
+	buffer_handle_t sourceHandle = nullptr;
+
+	if (cameraStream->type == CameraStream::Mapped) {
+		for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+			const camera3_stream_buffer_t &sourceBuffer =
+				descriptor->buffers[i];
+			CameraStream *sourceStream =
+				static_cast<CameraStream *>(sourceBuffer.stream->priv);
+
+			if (sourceStream->type == CameraStream::Direct &&
+			    sourceStream->stream == stream)
+				sourceHandle = *sourceBuffer.buffer;
+		}
+	} else {
+		Buffer *buffer = request->findBuffer(stream);
+		source = &stream->buffers()[buffer->index()];
+	}
+
+	descriptor->pendingJpegs++;
+
+	{
+		MutexLocker locker(jpegMutex_);
+		jpegJobs_++;
+	}
+
+	ThreadPool::instance()->post([=]() {
+		int ret = sourceHandle
+			? postProcessor->process(sourceHandle, destination)
+			: postProcessor->process(source, destination);
+		invokeMethod(&CameraDevice::jpegEncoded, request, index, ret);
+
+		MutexLocker locker(jpegMutex_);
+		if (!--jpegJobs_)
+			jpegDone_.notify_all();
+	});
+}
+
+void CameraDevice::jpegEncoded(Request *request, unsigned int index, int ret)
+{
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	if (ret) {
+		descriptor->buffers[index].status = CAMERA3_BUFFER_STATUS_ERROR;
 		notifyError(descriptor->frameNumber,
-			    descriptor->buffers[0].stream);
+			    descriptor->buffers[index].stream,
+			    CAMERA3_MSG_ERROR_BUFFER);
+	}
+
+	returnBuffer(descriptor, index);
+
+	if (!--descriptor->pendingJpegs) {
+		returnSourceBuffers(descriptor);
+		releaseRequest(request);
+	}
+}
+
+/*
+ * Wait for the JPEG encodings in progress to complete, as they access the
+ * camera buffers. This delivers the pending request completions, which may
+ * start new encodings, and then the encoding completions, returning all
+ * requests to the pool.
+ */
+void CameraDevice::waitJpegEncodings()
+{
+	Thread::current()->dispatchMessages(this);
+
+	{
+		MutexLocker locker(jpegMutex_);
+		jpegDone_.wait(locker, [&] { return !jpegJobs_; });
 	}
 
+	Thread::current()->dispatchMessages(this);
+}
+
+/* Return a single buffer of a request in its own capture result. */
+void CameraDevice::returnBuffer(Camera3RequestDescriptor *descriptor,
+				unsigned int index)
+{
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = 1;
+	captureResult.output_buffers = &descriptor->buffers[index];
+
 	callbacks_->process_capture_result(callbacks_, &captureResult);
+}
 
-	delete descriptor;
+/* Return the buffers the BLOB buffers of a request have been encoded from. */
+void CameraDevice::returnSourceBuffers(Camera3RequestDescriptor *descriptor)
+{
+	if (!descriptor->numSourceBuffers)
+		return;
+
+	unsigned int first = descriptor->numBuffers - descriptor->numJpegBuffers -
+			     descriptor->numSourceBuffers;
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = descriptor->numSourceBuffers;
+	captureResult.output_buffers = &descriptor->buffers[first];
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
 }
 
 void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
@@ -860,86 +1713,102 @@ void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
 	callbacks_->notify(callbacks_, &notify);
 }
 
-void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
+void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			       camera3_error_msg_code_t code)
 {
 	camera3_notify_msg_t notify = {};
 
 	notify.type = CAMERA3_MSG_ERROR;
 	notify.message.error.error_stream = stream;
 	notify.message.error.frame_number = frameNumber;
-	notify.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+	notify.message.error.error_code = code;
 
 	callbacks_->notify(callbacks_, &notify);
 }
 
 /*
  * Produce a set of fixed result metadata.
+ *
+ * The result metadata pack is allocated once with the exact size of its
+ * entries, and only the timestamp is updated in place for every frame. The
+ * camera framework copies the result metadata before process_capture_result()
+ * returns, the same buffer can thus be reused for all capture results.
  */
-std::unique_ptr<CameraMetadata> CameraDevice::getResultMetadata(int frame_number,
-								int64_t timestamp)
+const camera_metadata_t *CameraDevice::getResultMetadata(int64_t timestamp)
 {
-	/*
-	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 12 entries, 36 bytes
-	 */
-	std::unique_ptr<CameraMetadata> resultMetadata =
-		utils::make_unique<CameraMetadata>(15, 50);
-	if (!resultMetadata->isValid()) {
-		LOG(HAL, Error) << "Failed to allocate static metadata";
+	if (!resultMetadata_ && createResultMetadata())
 		return nullptr;
-	}
-
-	const uint8_t ae_state = ANDROID_CONTROL_AE_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
-
-	const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
-
-	uint8_t af_state = ANDROID_CONTROL_AF_STATE_INACTIVE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_STATE, &af_state, 1);
 
-	const uint8_t awb_state = ANDROID_CONTROL_AWB_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_STATE, &awb_state, 1);
-
-	const uint8_t awb_lock = ANDROID_CONTROL_AWB_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1);
+	if (!resultMetadata_->updateEntry(resultTimestampIndex_, &timestamp, 1)) {
+		LOG(HAL, Error) << "Failed to update result metadata";
+		return nullptr;
+	}
 
-	const uint8_t lens_state = ANDROID_LENS_STATE_STATIONARY;
-	resultMetadata->addEntry(ANDROID_LENS_STATE, &lens_state, 1);
+	return resultMetadata_->get();
+}
 
-	int32_t sensorSizes[] = {
+int CameraDevice::createResultMetadata()
+{
+	static const uint8_t ae_state = ANDROID_CONTROL_AE_STATE_CONVERGED;
+	static const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
+	static const uint8_t af_state = ANDROID_CONTROL_AF_STATE_INACTIVE;
+	static const uint8_t awb_state = ANDROID_CONTROL_AWB_STATE_CONVERGED;
+	static const uint8_t awb_lock = ANDROID_CONTROL_AWB_LOCK_OFF;
+	static const uint8_t lens_state = ANDROID_LENS_STATE_STATIONARY;
+	static const int32_t sensorSizes[] = {
 		0, 0, 2560, 1920,
 	};
-	resultMetadata->addEntry(ANDROID_SCALER_CROP_REGION, sensorSizes, 4);
-
-	resultMetadata->addEntry(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
-
+	static const int64_t timestamp = 0;
 	/* 33.3 msec */
-	const int64_t rolling_shutter_skew = 33300000;
-	resultMetadata->addEntry(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
-				 &rolling_shutter_skew, 1);
-
+	static const int64_t rolling_shutter_skew = 33300000;
 	/* 16.6 msec */
-	const int64_t exposure_time = 16600000;
-	resultMetadata->addEntry(ANDROID_SENSOR_EXPOSURE_TIME,
-				 &exposure_time, 1);
+	static const int64_t exposure_time = 16600000;
+	static const uint8_t lens_shading_map_mode =
+		ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
+	static const uint8_t scene_flicker =
+		ANDROID_STATISTICS_SCENE_FLICKER_NONE;
+
+	static const struct {
+		uint32_t tag;
+		const void *data;
+		size_t count;
+	} entries[] = {
+		{ ANDROID_CONTROL_AE_STATE, &ae_state, 1 },
+		{ ANDROID_CONTROL_AE_LOCK, &ae_lock, 1 },
+		{ ANDROID_CONTROL_AF_STATE, &af_state, 1 },
+		{ ANDROID_CONTROL_AWB_STATE, &awb_state, 1 },
+		{ ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1 },
+		{ ANDROID_LENS_STATE, &lens_state, 1 },
+		{ ANDROID_SCALER_CROP_REGION, sensorSizes, 4 },
+		{ ANDROID_SENSOR_TIMESTAMP, &timestamp, 1 },
+		{ ANDROID_SENSOR_ROLLING_SHUTTER_SKEW, &rolling_shutter_skew, 1 },
+		{ ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1 },
+		{ ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &lens_shading_map_mode, 1 },
+		{ ANDROID_STATISTICS_SCENE_FLICKER, &scene_flicker, 1 },
+	};
 
-	const uint8_t lens_shading_map_mode =
-				ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
-				 &lens_shading_map_mode, 1);
+	size_t dataSize = 0;
+	for (const auto &entry : entries)
+		dataSize += calculate_camera_metadata_entry_data_size(
+			get_camera_metadata_tag_type(entry.tag), entry.count);
 
-	const uint8_t scene_flicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
-	resultMetadata->addEntry(ANDROID_STATISTICS_SCENE_FLICKER,
-				 &scene_flicker, 1);
+	std::unique_ptr<CameraMetadata> resultMetadata =
+		utils::make_unique<CameraMetadata>(ARRAY_SIZE(entries), dataSize);
+
+	for (const auto &entry : entries)
+		resultMetadata->addEntry(entry.tag, entry.data, entry.count);
 
-	/*
-	 * Return the result metadata pack even is not valid: get() will return
-	 * nullptr.
-	 */
 	if (!resultMetadata->isValid()) {
 		LOG(HAL, Error) << "Failed to construct result metadata";
+		return -ENOMEM;
 	}
 
-	return resultMetadata;
+	int index = resultMetadata->entryIndex(ANDROID_SENSOR_TIMESTAMP);
+	if (index < 0)
+		return -EINVAL;
+
+	resultTimestampIndex_ = index;
+	resultMetadata_ = std::move(resultMetadata);
+
+	return 0;
 }
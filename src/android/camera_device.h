@@ -7,19 +7,25 @@
 #ifndef __ANDROID_CAMERA_DEVICE_H__
 #define __ANDROID_CAMERA_DEVICE_H__
 
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include <hardware/camera3.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
 #include <libcamera/object.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "message.h"
+#include "thread.h"
 
 class CameraMetadata;
+class PostProcessorJpeg;
 class ThreadRpc;
 
 class CameraDevice : public libcamera::Object
@@ -32,15 +38,23 @@ public:
 
 	int open();
 	void close();
+	void flush();
 	void setCallbacks(const camera3_callback_ops_t *callbacks);
-	camera_metadata_t *getStaticMetadata();
+	const camera_metadata_t *getStaticMetadata() const;
 	const camera_metadata_t *constructDefaultRequestSettings(int type);
 	int configureStreams(camera3_stream_configuration_t *stream_list);
 	int processCaptureRequest(camera3_capture_request_t *request);
+	void requestStarted(libcamera::Request *request, uint64_t timestamp);
 	void requestComplete(libcamera::Request *request,
-			     const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers);
+			     const libcamera::Request::BufferMap &buffers);
 
 private:
+	/* A copy of a camera3 capture request, pending processing. */
+	struct CaptureRequest {
+		uint32_t frameNumber;
+		std::vector<camera3_stream_buffer_t> buffers;
+	};
+
 	struct Camera3RequestDescriptor {
 		Camera3RequestDescriptor(unsigned int frameNumber,
 					 unsigned int numBuffers);
@@ -49,19 +63,97 @@ private:
 		uint32_t frameNumber;
 		uint32_t numBuffers;
 		camera3_stream_buffer_t *buffers;
+
+		/* Acquire fences the request waits for before being queued. */
+		std::vector<std::unique_ptr<libcamera::EventNotifier>> fences;
+		unsigned int pendingFences;
+
+		/* The shutter and result metadata have been sent at frame start. */
+		bool started;
+
+		/*
+		 * BLOB buffers, stored last in buffers, preceded by the buffers
+		 * they are encoded from, and encodings pending.
+		 */
+		unsigned int numJpegBuffers;
+		unsigned int numSourceBuffers;
+		unsigned int pendingJpegs;
+	};
+
+	/*
+	 * The libcamera stream backing a camera3 stream. Direct streams
+	 * capture to the gralloc buffers. BLOB streams are encoded to JPEG,
+	 * from the camera buffers of their own stream for Internal streams, or
+	 * from the buffers of a Direct stream captured in the same request
+	 * for Mapped streams.
+	 */
+	struct CameraStream {
+		enum Type {
+			Direct,
+			Internal,
+			Mapped,
+		};
+
+		Type type;
+		libcamera::Stream *stream;
+		std::unique_ptr<PostProcessorJpeg> postProcessor;
+		std::vector<unsigned int> freeBuffers;
 	};
 
+	std::unique_ptr<CameraMetadata> createStaticMetadata();
+
+	libcamera::Request *getRequest(uint32_t frameNumber,
+				       unsigned int numBuffers);
+	void releaseRequest(libcamera::Request *request);
+	void clearRequestPool();
+
+	bool tryConfiguration(const std::vector<camera3_stream_t *> &streams);
+	camera3_stream_t *findJpegSource(camera3_stream_configuration_t *stream_list,
+					 camera3_stream_t *blobStream);
+
+	libcamera::Buffer *importBuffer(libcamera::Stream *stream,
+					buffer_handle_t handle);
+	void clearImportedBuffers();
+
+	void queueCaptureRequest(CaptureRequest *captureRequest);
+	void abortCaptureRequest(CaptureRequest *captureRequest);
+	void abortFenceRequests();
+
+	CameraStream *findInternalStream(libcamera::Stream *stream);
+	void encodeJpeg(libcamera::Request *request, unsigned int index);
+	void jpegEncoded(libcamera::Request *request, unsigned int index, int ret);
+	void waitJpegEncodings();
+	void returnBuffer(Camera3RequestDescriptor *descriptor,
+			  unsigned int index);
+	void returnSourceBuffers(Camera3RequestDescriptor *descriptor);
+
+	void fenceSignalled(libcamera::EventNotifier *notifier);
+	void queueRequest(libcamera::Request *request);
+
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
-	void notifyError(uint32_t frameNumber, camera3_stream_t *stream);
-	std::unique_ptr<CameraMetadata> getResultMetadata(int frame_number,
-							  int64_t timestamp);
+	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			 camera3_error_msg_code_t code = CAMERA3_MSG_ERROR_REQUEST);
+	const camera_metadata_t *getResultMetadata(int64_t timestamp);
+	int createResultMetadata();
 
 	bool running_;
+	bool prepared_;
 	std::shared_ptr<libcamera::Camera> camera_;
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
 
-	CameraMetadata *staticMetadata_;
+	std::unique_ptr<const CameraMetadata> staticMetadata_;
 	std::map<unsigned int, CameraMetadata *> requestTemplates_;
+	std::unique_ptr<CameraMetadata> resultMetadata_;
+	size_t resultTimestampIndex_;
+	std::vector<libcamera::Request *> requestPool_;
+	std::map<libcamera::EventNotifier *, libcamera::Request *> fenceRequests_;
+	std::map<buffer_handle_t, libcamera::Buffer *> importedBuffers_;
+
+	std::vector<std::unique_ptr<CameraStream>> streams_;
+	libcamera::Mutex jpegMutex_;
+	std::condition_variable jpegDone_;
+	unsigned int jpegJobs_;
+
 	const camera3_callback_ops_t *callbacks_;
 };
 
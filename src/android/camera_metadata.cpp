@@ -46,7 +46,40 @@ bool CameraMetadata::addEntry(uint32_t tag, const void *data, size_t count)
 	return false;
 }
 
+int CameraMetadata::entryIndex(uint32_t tag)
+{
+	camera_metadata_entry_t entry;
+
+	if (!valid_ || find_camera_metadata_entry(metadata_, tag, &entry))
+		return -1;
+
+	return entry.index;
+}
+
+/*
+ * Update the entry at \a index in place. Indexes are stable as long as no entry
+ * is added, they can thus be looked up once with entryIndex() and reused to
+ * update the same entry without searching for the tag.
+ */
+bool CameraMetadata::updateEntry(size_t index, const void *data, size_t count)
+{
+	if (!valid_)
+		return false;
+
+	if (!update_camera_metadata_entry(metadata_, index, data, count, nullptr))
+		return true;
+
+	LOG(CameraMetadata, Error) << "Failed to update entry " << index;
+
+	return false;
+}
+
 camera_metadata_t *CameraMetadata::get()
 {
 	return valid_ ? metadata_ : nullptr;
 }
+
+const camera_metadata_t *CameraMetadata::get() const
+{
+	return valid_ ? metadata_ : nullptr;
+}
@@ -19,8 +19,11 @@ public:
 
 	bool isValid() { return valid_; }
 	bool addEntry(uint32_t tag, const void *data, size_t data_count);
+	int entryIndex(uint32_t tag);
+	bool updateEntry(size_t index, const void *data, size_t data_count);
 
 	camera_metadata_t *get();
+	const camera_metadata_t *get() const;
 
 private:
 	camera_metadata_t *metadata_;
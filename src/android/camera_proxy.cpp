@@ -30,10 +30,11 @@ LOG_DECLARE_CATEGORY(HAL);
  *
  * Bridging operation calls between the framework and the CameraDevice is
  * required as the two run in two different threads and certain operations,
- * such as queueing a new capture request to the camera, shall be called in
- * the thread that dispatches events. Other operations do not require any
- * bridging and resolve to direct function calls on the CameraDevice instance
- * instead.
+ * such as closing the camera, shall be called synchronously in the thread that
+ * dispatches events. Capture requests are validated in the framework thread and
+ * queued asynchronously to the CameraDevice thread without waiting for them to
+ * be processed. Other operations do not require any bridging and resolve to
+ * direct function calls on the CameraDevice instance instead.
  */
 
 static int hal_dev_initialize(const struct camera3_device *dev,
@@ -85,6 +86,12 @@ static void hal_dev_dump(const struct camera3_device *dev, int fd)
 
 static int hal_dev_flush(const struct camera3_device *dev)
 {
+	if (!dev)
+		return -EINVAL;
+
+	CameraProxy *proxy = reinterpret_cast<CameraProxy *>(dev->priv);
+	proxy->flush();
+
 	return 0;
 }
 
@@ -154,6 +161,18 @@ void CameraProxy::close()
 	threadRpcCall(rpcRequest);
 }
 
+/*
+ * Flush is synchronous: all capture requests in flight have been returned to
+ * the framework when it returns.
+ */
+void CameraProxy::flush()
+{
+	ThreadRpc rpcRequest;
+	rpcRequest.tag = ThreadRpc::Flush;
+
+	threadRpcCall(rpcRequest);
+}
+
 void CameraProxy::initialize(const camera3_callback_ops_t *callbacks)
 {
 	cameraDevice_->setCallbacks(callbacks);
@@ -176,13 +195,7 @@ int CameraProxy::configureStreams(camera3_stream_configuration_t *stream_list)
 
 int CameraProxy::processCaptureRequest(camera3_capture_request_t *request)
 {
-	ThreadRpc rpcRequest;
-	rpcRequest.tag = ThreadRpc::ProcessCaptureRequest;
-	rpcRequest.request = request;
-
-	threadRpcCall(rpcRequest);
-
-	return 0;
+	return cameraDevice_->processCaptureRequest(request);
 }
 
 void CameraProxy::threadRpcCall(ThreadRpc &rpcRequest)
@@ -24,6 +24,7 @@ public:
 
 	int open(const hw_module_t *hardwareModule);
 	void close();
+	void flush();
 
 	void initialize(const camera3_callback_ops_t *callbacks);
 	const camera_metadata_t *getStaticMetadata();
@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * exif.cpp - EXIF tag creation
+ */
+
+#include "exif.h"
+
+#include <errno.h>
+
+#include "log.h"
+
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(EXIF)
+
+/*
+ * The EXIF data is stored in a JPEG APP1 segment, whose payload is limited to
+ * 65533 bytes by the 16-bit segment length.
+ */
+static constexpr size_t exifMaxSize = 65533;
+
+/* The TIFF structure starts after the "Exif\0\0" identifier. */
+static const uint8_t exifHeader[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+enum ExifTag : uint16_t {
+	TagCompression = 0x0103,
+	TagMake = 0x010f,
+	TagModel = 0x0110,
+	TagOrientation = 0x0112,
+	TagDateTime = 0x0132,
+	TagJpegInterchangeFormat = 0x0201,
+	TagJpegInterchangeFormatLength = 0x0202,
+	TagExifIfdPointer = 0x8769,
+	TagExifVersion = 0x9000,
+	TagDateTimeOriginal = 0x9003,
+	TagDateTimeDigitized = 0x9004,
+	TagPixelXDimension = 0xa002,
+	TagPixelYDimension = 0xa003,
+};
+
+/*
+ * \class Exif
+ * \brief Generate the EXIF APP1 segment payload of a JPEG image
+ *
+ * The Exif class stores the few tags the Android camera framework relies on,
+ * and serializes them to a little-endian TIFF structure with the 0th IFD, the
+ * EXIF IFD, and an optional 1st IFD referencing a JPEG thumbnail stored at the
+ * end of the payload.
+ */
+
+Exif::Exif()
+	: orientation_(1), timestamp_(0)
+{
+}
+
+void Exif::setMake(const std::string &make)
+{
+	make_ = make;
+}
+
+void Exif::setModel(const std::string &model)
+{
+	model_ = model;
+}
+
+void Exif::setOrientation(uint16_t orientation)
+{
+	orientation_ = orientation;
+}
+
+void Exif::setSize(const Size &size)
+{
+	size_ = size;
+}
+
+void Exif::setTimestamp(time_t timestamp)
+{
+	timestamp_ = timestamp;
+}
+
+void Exif::setThumbnail(const std::vector<uint8_t> &thumbnail)
+{
+	thumbnail_ = thumbnail;
+}
+
+/*
+ * Serialize the tags to the EXIF payload returned by data(). Return 0 on
+ * success, or -E2BIG if the payload, including the thumbnail, doesn't fit in
+ * an APP1 segment.
+ */
+int Exif::generate()
+{
+	char dateTime[20] = {};
+	struct tm tm;
+	localtime_r(&timestamp_, &tm);
+	strftime(dateTime, sizeof(dateTime), "%Y:%m:%d %H:%M:%S", &tm);
+
+	std::vector<Entry> ifd0 = {
+		ascii(TagMake, make_),
+		ascii(TagModel, model_),
+		shortValue(TagOrientation, orientation_),
+		ascii(TagDateTime, dateTime),
+		longValue(TagExifIfdPointer, 0),
+	};
+
+	std::vector<Entry> exifIfd = {
+		{ TagExifVersion, Undefined, 4, { '0', '2', '2', '0' } },
+		ascii(TagDateTimeOriginal, dateTime),
+		ascii(TagDateTimeDigitized, dateTime),
+		longValue(TagPixelXDimension, size_.width),
+		longValue(TagPixelYDimension, size_.height),
+	};
+
+	std::vector<Entry> ifd1;
+	if (!thumbnail_.empty()) {
+		ifd1 = {
+			shortValue(TagCompression, 6),
+			longValue(TagJpegInterchangeFormat, 0),
+			longValue(TagJpegInterchangeFormatLength,
+				  thumbnail_.size()),
+		};
+	}
+
+	/* Lay out the IFDs and thumbnail, with offsets relative to the TIFF header. */
+	uint32_t ifd0Offset = 8;
+	uint32_t exifOffset = ifd0Offset + ifdSize(ifd0);
+	uint32_t ifd1Offset = exifOffset + ifdSize(exifIfd);
+	uint32_t thumbnailOffset = ifd1Offset + ifdSize(ifd1);
+	size_t size = sizeof(exifHeader) + thumbnailOffset + thumbnail_.size();
+
+	if (size > exifMaxSize) {
+		LOG(EXIF, Debug) << "EXIF data too large (" << size << " bytes)";
+		return -E2BIG;
+	}
+
+	ifd0.back() = longValue(TagExifIfdPointer, exifOffset);
+	if (!ifd1.empty())
+		ifd1[1] = longValue(TagJpegInterchangeFormat, thumbnailOffset);
+
+	data_.clear();
+	data_.reserve(size);
+	data_.insert(data_.end(), exifHeader,
+		     exifHeader + sizeof(exifHeader));
+
+	/* Little-endian TIFF header. */
+	data_.push_back('I');
+	data_.push_back('I');
+	write16(42);
+	write32(ifd0Offset);
+
+	writeIfd(ifd0, ifd0Offset, ifd1.empty() ? 0 : ifd1Offset);
+	writeIfd(exifIfd, exifOffset, 0);
+	if (!ifd1.empty()) {
+		writeIfd(ifd1, ifd1Offset, 0);
+		data_.insert(data_.end(), thumbnail_.begin(), thumbnail_.end());
+	}
+
+	return 0;
+}
+
+Exif::Entry Exif::ascii(uint16_t tag, const std::string &value)
+{
+	Entry entry = { tag, Ascii, static_cast<uint32_t>(value.size() + 1), {} };
+	entry.value.assign(value.begin(), value.end());
+	entry.value.push_back('\0');
+	return entry;
+}
+
+Exif::Entry Exif::shortValue(uint16_t tag, uint16_t value)
+{
+	return { tag, Short, 1, {
+		static_cast<uint8_t>(value & 0xff),
+		static_cast<uint8_t>(value >> 8),
+	} };
+}
+
+Exif::Entry Exif::longValue(uint16_t tag, uint32_t value)
+{
+	return { tag, Long, 1, {
+		static_cast<uint8_t>(value & 0xff),
+		static_cast<uint8_t>((value >> 8) & 0xff),
+		static_cast<uint8_t>((value >> 16) & 0xff),
+		static_cast<uint8_t>(value >> 24),
+	} };
+}
+
+/*
+ * An IFD stores the number of entries, 12 bytes per entry and the offset of
+ * the next IFD, followed by the values that don't fit in the 4 bytes of their
+ * entry, aligned to 16-bit boundaries.
+ */
+size_t Exif::ifdSize(const std::vector<Entry> &entries)
+{
+	if (entries.empty())
+		return 0;
+
+	size_t size = 2 + entries.size() * 12 + 4;
+	for (const Entry &entry : entries) {
+		if (entry.value.size() > 4)
+			size += (entry.value.size() + 1) & ~1;
+	}
+
+	return size;
+}
+
+void Exif::writeIfd(const std::vector<Entry> &entries, uint32_t offset,
+		    uint32_t next)
+{
+	uint32_t valueOffset = offset + 2 + entries.size() * 12 + 4;
+
+	write16(entries.size());
+
+	for (const Entry &entry : entries) {
+		write16(entry.tag);
+		write16(entry.type);
+		write32(entry.count);
+
+		if (entry.value.size() <= 4) {
+			data_.insert(data_.end(), entry.value.begin(),
+				     entry.value.end());
+			data_.resize(data_.size() + 4 - entry.value.size());
+		} else {
+			write32(valueOffset);
+			valueOffset += (entry.value.size() + 1) & ~1;
+		}
+	}
+
+	write32(next);
+
+	for (const Entry &entry : entries) {
+		if (entry.value.size() <= 4)
+			continue;
+
+		data_.insert(data_.end(), entry.value.begin(), entry.value.end());
+		if (entry.value.size() % 2)
+			data_.push_back(0);
+	}
+}
+
+void Exif::write16(uint16_t value)
+{
+	data_.push_back(value & 0xff);
+	data_.push_back(value >> 8);
+}
+
+void Exif::write32(uint32_t value)
+{
+	write16(value & 0xffff);
+	write16(value >> 16);
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * exif.h - EXIF tag creation
+ */
+#ifndef __ANDROID_JPEG_EXIF_H__
+#define __ANDROID_JPEG_EXIF_H__
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+class Exif
+{
+public:
+	Exif();
+
+	void setMake(const std::string &make);
+	void setModel(const std::string &model);
+	void setOrientation(uint16_t orientation);
+	void setSize(const libcamera::Size &size);
+	void setTimestamp(time_t timestamp);
+	void setThumbnail(const std::vector<uint8_t> &thumbnail);
+
+	int generate();
+	const std::vector<uint8_t> &data() const { return data_; }
+
+private:
+	enum Type {
+		Ascii = 2,
+		Short = 3,
+		Long = 4,
+		Undefined = 7,
+	};
+
+	struct Entry {
+		uint16_t tag;
+		Type type;
+		uint32_t count;
+		std::vector<uint8_t> value;
+	};
+
+	static Entry ascii(uint16_t tag, const std::string &value);
+	static Entry shortValue(uint16_t tag, uint16_t value);
+	static Entry longValue(uint16_t tag, uint32_t value);
+
+	static size_t ifdSize(const std::vector<Entry> &entries);
+	void writeIfd(const std::vector<Entry> &entries, uint32_t offset,
+		      uint32_t next);
+
+	void write16(uint16_t value);
+	void write32(uint32_t value);
+
+	std::string make_;
+	std::string model_;
+	uint16_t orientation_;
+	libcamera::Size size_;
+	time_t timestamp_;
+	std::vector<uint8_t> thumbnail_;
+
+	std::vector<uint8_t> data_;
+};
+
+#endif /* __ANDROID_JPEG_EXIF_H__ */
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_jpeg.cpp - JPEG post-processing of captured frames
+ */
+
+#include "post_processor_jpeg.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+using namespace libcamera;
+
+namespace libcamera {
+LOG_DECLARE_CATEGORY(JPEG)
+} /* namespace libcamera */
+
+/* Advertised through ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES. */
+static const Size thumbnailSize = { 160, 120 };
+
+static constexpr int jpegQuality = 95;
+static constexpr int thumbnailQuality = 75;
+
+/*
+ * \class PostProcessorJpeg
+ * \brief Produce the JPEG images of HAL_PIXEL_FORMAT_BLOB streams
+ *
+ * The post-processor encodes a captured YUV frame to the gralloc buffer of a
+ * BLOB stream, with EXIF data and a thumbnail, and appends the
+ * camera3_jpeg_blob_t trailer expected by the camera framework at the end of
+ * the buffer. The frames are scaled to the size of the BLOB stream if needed,
+ * to encode them from a YUV stream of a different size.
+ *
+ * process() is meant to be called from worker threads, and serializes the
+ * frames of a stream as the encoders can only compress one image at a time.
+ */
+
+PostProcessorJpeg::PostProcessorJpeg(const std::string &model)
+	: model_(model)
+{
+}
+
+int PostProcessorJpeg::configure(const StreamConfiguration &cfg,
+				 const Size &outputSize)
+{
+	MutexLocker locker(mutex_);
+
+	int ret = encoder_.configure(cfg.size, cfg.pixelFormat, outputSize,
+				     jpegQuality);
+	if (ret)
+		return ret;
+
+	ret = thumbnailEncoder_.configure(cfg.size, cfg.pixelFormat,
+					  thumbnailSize, thumbnailQuality);
+	if (ret)
+		return ret;
+
+	size_ = cfg.size;
+
+	exif_.setMake("libcamera");
+	exif_.setModel(model_);
+	exif_.setSize(outputSize);
+
+	/* A thumbnail can't exceed the APP1 segment size. */
+	thumbnail_.resize(65536);
+
+	return 0;
+}
+
+int PostProcessorJpeg::process(BufferMemory *source, buffer_handle_t destination)
+{
+	MutexLocker locker(mutex_);
+
+	CpuAccess access(*source, Plane::AccessRead);
+	if (access.status() < 0)
+		LOG(JPEG, Warning) << "Failed to synchronize the source buffer";
+
+	PlaneArray &planes = source->planes();
+	const uint8_t *luma = static_cast<const uint8_t *>(planes[0].mem());
+	const uint8_t *chroma = planes.size() > 1
+			      ? static_cast<const uint8_t *>(planes[1].mem())
+			      : luma + size_.width * size_.height;
+	if (!luma || !chroma) {
+		LOG(JPEG, Error) << "Failed to map the source buffer";
+		return -ENOMEM;
+	}
+
+	exif_.setTimestamp(time(nullptr));
+
+	int ret = thumbnailEncoder_.encode(luma, chroma, thumbnail_.data(),
+					   thumbnail_.size(), {});
+	if (ret > 0)
+		exif_.setThumbnail({ thumbnail_.begin(), thumbnail_.begin() + ret });
+	else
+		exif_.setThumbnail({});
+
+	/* Drop the thumbnail if it doesn't fit in the EXIF data. */
+	ret = exif_.generate();
+	if (ret == -E2BIG) {
+		exif_.setThumbnail({});
+		ret = exif_.generate();
+	}
+	if (ret) {
+		LOG(JPEG, Error) << "Failed to generate EXIF data";
+		return ret;
+	}
+
+	/* BLOB buffers are one-dimensional, their size is the dmabuf size. */
+	int fd = destination->data[0];
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size < static_cast<off_t>(sizeof(camera3_jpeg_blob_t))) {
+		LOG(JPEG, Error) << "Invalid destination buffer size";
+		return -EINVAL;
+	}
+
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		ret = -errno;
+		LOG(JPEG, Error)
+			<< "Failed to map the destination buffer: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	uint8_t *dst = static_cast<uint8_t *>(mem);
+	size_t maxJpegSize = size - sizeof(camera3_jpeg_blob_t);
+
+	ret = encoder_.encode(luma, chroma, dst, maxJpegSize, exif_.data());
+	if (ret < 0) {
+		LOG(JPEG, Error) << "Failed to encode JPEG image: "
+				 << strerror(-ret);
+	} else {
+		camera3_jpeg_blob_t *blob =
+			reinterpret_cast<camera3_jpeg_blob_t *>(dst + maxJpegSize);
+		blob->jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
+		blob->jpeg_size = ret;
+
+		LOG(JPEG, Debug) << "Encoded JPEG image of " << ret << " bytes";
+		ret = 0;
+	}
+
+	munmap(mem, size);
+
+	return ret;
+}
+
+/*
+ * Encode a frame captured to a gralloc buffer. The planes are stored in the
+ * dmabufs of the handle, or contiguously in the first one.
+ */
+int PostProcessorJpeg::process(buffer_handle_t source, buffer_handle_t destination)
+{
+	BufferMemory memory;
+
+	for (int i = 0; i < source->numFds && i < 3; ++i) {
+		memory.planes().emplace_back();
+		int ret = memory.planes().back().setDmabuf(source->data[i], 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return process(&memory, destination);
+}
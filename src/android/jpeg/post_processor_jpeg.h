@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_jpeg.h - JPEG post-processing of captured frames
+ */
+#ifndef __ANDROID_JPEG_POST_PROCESSOR_JPEG_H__
+#define __ANDROID_JPEG_POST_PROCESSOR_JPEG_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <hardware/camera3.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#include "encoder_libjpeg.h"
+#include "thread.h"
+
+#include "exif.h"
+
+class PostProcessorJpeg
+{
+public:
+	PostProcessorJpeg(const std::string &model);
+
+	int configure(const libcamera::StreamConfiguration &cfg,
+		      const libcamera::Size &outputSize);
+	int process(libcamera::BufferMemory *source, buffer_handle_t destination);
+	int process(buffer_handle_t source, buffer_handle_t destination);
+
+private:
+	std::string model_;
+	libcamera::Size size_;
+
+	libcamera::Mutex mutex_;
+	libcamera::EncoderLibJpeg encoder_;
+	libcamera::EncoderLibJpeg thumbnailEncoder_;
+	std::vector<uint8_t> thumbnail_;
+	Exif exif_;
+};
+
+#endif /* __ANDROID_JPEG_POST_PROCESSOR_JPEG_H__ */
@@ -10,14 +10,12 @@
 #include <condition_variable>
 #include <mutex>
 
-#include <hardware/camera3.h>
-
 class ThreadRpc
 {
 public:
 	enum RpcTag {
-		ProcessCaptureRequest,
 		Close,
+		Flush,
 	};
 
 	ThreadRpc()
@@ -28,8 +26,6 @@ public:
 
 	RpcTag tag;
 
-	camera3_capture_request_t *request;
-
 private:
 	bool delivered_;
 	std::mutex mutex_;
@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.cpp - Cam capture benchmark
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <libcamera/buffer.h>
+#include <libcamera/control_ids.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+namespace {
+
+struct Distribution {
+	Distribution(const std::vector<uint64_t> &samples)
+		: mean(0), samples_(samples)
+	{
+		std::sort(samples_.begin(), samples_.end());
+
+		for (uint64_t sample : samples_)
+			mean += sample;
+		if (!samples_.empty())
+			mean /= samples_.size();
+	}
+
+	uint64_t percentile(unsigned int percent) const
+	{
+		if (samples_.empty())
+			return 0;
+
+		return samples_[(samples_.size() - 1) * percent / 100];
+	}
+
+	std::string json() const
+	{
+		std::stringstream ss;
+		ss << "{ \"min\": " << percentile(0)
+		   << ", \"p50\": " << percentile(50)
+		   << ", \"p90\": " << percentile(90)
+		   << ", \"p99\": " << percentile(99)
+		   << ", \"max\": " << percentile(100)
+		   << ", \"mean\": " << mean << " }";
+		return ss.str();
+	}
+
+	std::string text(double scale, const char *unit) const
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3)
+		   << "min " << percentile(0) / scale << unit
+		   << ", p50 " << percentile(50) / scale << unit
+		   << ", p90 " << percentile(90) / scale << unit
+		   << ", p99 " << percentile(99) / scale << unit
+		   << ", max " << percentile(100) / scale << unit;
+		return ss.str();
+	}
+
+	uint64_t mean;
+
+private:
+	std::vector<uint64_t> samples_;
+};
+
+double seconds(const struct timeval &tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+} /* namespace */
+
+/*
+ * Run the benchmark until all streams have captured a number of frames, or for
+ * a duration in seconds. When both are zero the benchmark runs until
+ * interrupted. A single benchmark can record the requests of multiple cameras,
+ * as long as their stream names are unique.
+ */
+Benchmark::Benchmark(unsigned int frames, unsigned int duration)
+	: frames_(frames), duration_(std::chrono::seconds(duration)),
+	  completed_(0), finished_(false)
+{
+}
+
+/*
+ * Register a stream to be benchmarked. The benchmark only completes once all
+ * registered streams have captured the requested number of frames.
+ */
+void Benchmark::addStream(const std::string &name)
+{
+	streams_[name];
+}
+
+void Benchmark::start()
+{
+	completed_ = 0;
+	finished_ = false;
+	for (auto &it : streams_)
+		it.second = StreamStats();
+	latencies_.clear();
+
+	getrusage(RUSAGE_SELF, &startUsage_);
+	start_ = std::chrono::steady_clock::now();
+	end_ = start_;
+}
+
+/*
+ * Record the statistics of a completed request. Return true when the
+ * benchmark is complete.
+ */
+bool Benchmark::record(Request *request,
+		       const std::map<Stream *, std::string> &names)
+{
+	if (finished_)
+		return true;
+
+	for (const auto &it : request->buffers()) {
+		Buffer *buffer = it.second;
+		auto name = names.find(it.first);
+		if (name == names.end())
+			continue;
+
+		StreamStats &stats = streams_[name->second];
+
+		if (stats.frames) {
+			if (buffer->sequence() > stats.lastSequence + 1)
+				stats.dropped += buffer->sequence() - stats.lastSequence - 1;
+
+			if (buffer->timestamp() > stats.lastTimestamp)
+				stats.intervals.push_back(buffer->timestamp() -
+							  stats.lastTimestamp);
+		}
+
+		stats.frames++;
+		stats.bytes += buffer->bytesused();
+		stats.lastSequence = buffer->sequence();
+		stats.lastTimestamp = buffer->timestamp();
+	}
+
+	const ControlList &metadata = request->metadata();
+	if (metadata.contains(controls::LatencyCompleted))
+		latencies_.push_back(metadata.get(controls::LatencyCompleted));
+
+	completed_++;
+
+	if (frames_ &&
+	    std::all_of(streams_.begin(), streams_.end(),
+			[this](const std::pair<const std::string, StreamStats> &it) {
+				return it.second.frames >= frames_;
+			}))
+		finished_ = true;
+
+	if (duration_.count() &&
+	    std::chrono::steady_clock::now() - start_ >= duration_)
+		finished_ = true;
+
+	return finished_;
+}
+
+void Benchmark::stop()
+{
+	end_ = std::chrono::steady_clock::now();
+	getrusage(RUSAGE_SELF, &endUsage_);
+}
+
+void Benchmark::print(std::ostream &out) const
+{
+	double elapsed = std::chrono::duration<double>(end_ - start_).count();
+	double cpu = seconds(endUsage_.ru_utime) - seconds(startUsage_.ru_utime) +
+		     seconds(endUsage_.ru_stime) - seconds(startUsage_.ru_stime);
+
+	out << std::fixed << std::setprecision(2)
+	    << "Benchmark: " << completed_ << " requests in " << elapsed
+	    << " s, CPU usage " << (elapsed ? cpu * 100 / elapsed : 0.0)
+	    << "%" << std::endl;
+
+	unsigned int frames = 0;
+	uint64_t bytes = 0;
+
+	for (const auto &it : streams_) {
+		const StreamStats &stats = it.second;
+		Distribution intervals(stats.intervals);
+
+		out << "  " << it.first << ": " << stats.frames << " frames, "
+		    << stats.dropped << " dropped, "
+		    << std::setprecision(2)
+		    << (intervals.mean ? 1e9 / intervals.mean : 0.0) << " fps, "
+		    << (elapsed ? stats.bytes / elapsed / 1e6 : 0.0) << " MB/s"
+		    << std::endl
+		    << "    frame interval: " << intervals.text(1e6, " ms")
+		    << std::endl;
+
+		frames += stats.frames;
+		bytes += stats.bytes;
+	}
+
+	if (streams_.size() > 1)
+		out << "  total: " << frames << " frames, "
+		    << (elapsed ? frames / elapsed : 0.0) << " fps, "
+		    << (elapsed ? bytes / elapsed / 1e6 : 0.0) << " MB/s"
+		    << std::endl;
+
+	Distribution latencies(latencies_);
+	out << "  request latency: " << latencies.text(1e6, " ms") << std::endl;
+}
+
+std::string Benchmark::json() const
+{
+	double elapsed = std::chrono::duration<double>(end_ - start_).count();
+	double cpu = seconds(endUsage_.ru_utime) - seconds(startUsage_.ru_utime) +
+		     seconds(endUsage_.ru_stime) - seconds(startUsage_.ru_stime);
+
+	std::stringstream json;
+	json << "{" << std::endl
+	     << "  \"benchmark\": \"capture\"," << std::endl
+	     << "  \"requests\": " << completed_ << "," << std::endl
+	     << "  \"duration_s\": " << elapsed << "," << std::endl
+	     << "  \"cpu_percent\": " << (elapsed ? cpu * 100 / elapsed : 0.0)
+	     << "," << std::endl
+	     << "  \"streams\": {";
+
+	unsigned int frames = 0;
+	uint64_t bytes = 0;
+	bool first = true;
+
+	for (const auto &it : streams_) {
+		const StreamStats &stats = it.second;
+		Distribution intervals(stats.intervals);
+
+		json << (first ? "" : ",") << std::endl
+		     << "    \"" << it.first << "\": {" << std::endl
+		     << "      \"frames\": " << stats.frames << "," << std::endl
+		     << "      \"dropped\": " << stats.dropped << "," << std::endl
+		     << "      \"fps\": "
+		     << (intervals.mean ? 1e9 / intervals.mean : 0.0) << ","
+		     << std::endl
+		     << "      \"bytes_per_s\": "
+		     << (elapsed ? stats.bytes / elapsed : 0.0) << "," << std::endl
+		     << "      \"frame_interval_ns\": " << intervals.json()
+		     << std::endl
+		     << "    }";
+		first = false;
+		frames += stats.frames;
+		bytes += stats.bytes;
+	}
+
+	json << std::endl << "  }," << std::endl
+	     << "  \"total\": { \"frames\": " << frames
+	     << ", \"fps\": " << (elapsed ? frames / elapsed : 0.0)
+	     << ", \"bytes_per_s\": " << (elapsed ? bytes / elapsed : 0.0)
+	     << " }," << std::endl
+	     << "  \"request_latency_ns\": " << Distribution(latencies_).json()
+	     << std::endl
+	     << "}" << std::endl;
+
+	return json.str();
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.h - Cam capture benchmark
+ */
+#ifndef __CAM_BENCHMARK_H__
+#define __CAM_BENCHMARK_H__
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include <libcamera/request.h>
+
+class Benchmark
+{
+public:
+	Benchmark(unsigned int frames, unsigned int duration);
+
+	void addStream(const std::string &name);
+
+	void start();
+	bool record(libcamera::Request *request,
+		    const std::map<libcamera::Stream *, std::string> &names);
+	void stop();
+
+	void print(std::ostream &out) const;
+	std::string json() const;
+
+private:
+	struct StreamStats {
+		StreamStats()
+			: frames(0), dropped(0), bytes(0), lastSequence(0),
+			  lastTimestamp(0)
+		{
+		}
+
+		unsigned int frames;
+		unsigned int dropped;
+		uint64_t bytes;
+		unsigned int lastSequence;
+		uint64_t lastTimestamp;
+		std::vector<uint64_t> intervals;
+	};
+
+	unsigned int frames_;
+	std::chrono::steady_clock::duration duration_;
+
+	unsigned int completed_;
+	bool finished_;
+	std::chrono::steady_clock::time_point start_;
+	std::chrono::steady_clock::time_point end_;
+	struct rusage startUsage_;
+	struct rusage endUsage_;
+
+	std::map<std::string, StreamStats> streams_;
+	std::vector<uint64_t> latencies_;
+};
+
+#endif /* __CAM_BENCHMARK_H__ */
@@ -5,18 +5,58 @@
  * buffer_writer.cpp - Buffer writer
  */
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "buffer_writer.h"
+#include "frame_stream.h"
 
-BufferWriter::BufferWriter(const std::string &pattern)
-	: pattern_(pattern)
+using namespace libcamera;
+
+namespace {
+
+/* Preallocate stream files by large chunks to limit fragmentation. */
+constexpr uint64_t PreallocationSize = 256 * 1024 * 1024;
+
+/* Alignment of the data written with direct I/O, in bytes. */
+constexpr uint32_t DirectIOAlignment = 4096;
+
+constexpr mode_t FileMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+			    S_IROTH | S_IWOTH;
+
+static_assert(sizeof(FrameStreamRecord) == 64,
+	      "Invalid frame stream record size");
+
+} /* namespace */
+
+BufferWriter::BufferWriter(const std::string &pattern, unsigned int flags)
+	: pattern_(pattern), flags_(flags), fd_(-1), offset_(0), allocated_(0),
+	  alignment_(1), bounce_(nullptr), bounceSize_(0), eventfd_(-1),
+	  notifier_(nullptr), queueDepth_(0), queued_(0), dropped_(0),
+	  exit_(false)
+{
+}
+
+BufferWriter::~BufferWriter()
 {
+	stop();
+
+	if (fd_ != -1) {
+		/* Release the preallocated space past the end of the stream. */
+		if (flags_ & Container && ftruncate(fd_, offset_))
+			std::cerr << "Failed to truncate stream file" << std::endl;
+
+		close(fd_);
+	}
+
+	free(bounce_);
 }
 
 int BufferWriter::write(libcamera::Buffer *buffer, const std::string &streamName)
@@ -32,19 +72,44 @@ int BufferWriter::write(libcamera::Buffer *buffer, const std::string &streamName
 		ss << streamName << "-" << std::setw(6)
 		   << std::setfill('0') << buffer->sequence();
 		filename.replace(pos, 1, ss.str());
-	}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1)
-		return -errno;
+		fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			  FileMode);
+		if (fd == -1)
+			return -errno;
+	} else {
+		/* All frames are written to a single file, kept open. */
+		if (fd_ == -1) {
+			ret = openFile();
+			if (ret)
+				return ret;
+		}
+
+		if (flags_ & Container)
+			return writeRecord(buffer, streamName);
+
+		fd = fd_;
+	}
 
 	libcamera::BufferMemory *mem = buffer->mem();
-	for (libcamera::Plane &plane : mem->planes()) {
-		void *data = plane.mem();
+	libcamera::CpuAccess access(*mem, libcamera::Plane::AccessRead);
+
+	libcamera::PlaneArray &planes = mem->planes();
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		libcamera::Plane &plane = planes[i];
+		unsigned int offset = 0;
 		unsigned int length = plane.length();
 
+		/* Only write the payload when the buffer reports it. */
+		if (i < buffer->planesBytesused().size() &&
+		    buffer->planesBytesused()[i]) {
+			offset = std::min(buffer->planesOffset()[i], length);
+			length = std::min(buffer->planesBytesused()[i],
+					  length - offset);
+		}
+
+		const uint8_t *data = static_cast<const uint8_t *>(plane.mem()) + offset;
+
 		ret = ::write(fd, data, length);
 		if (ret < 0) {
 			ret = -errno;
@@ -59,7 +124,319 @@ int BufferWriter::write(libcamera::Buffer *buffer, const std::string &streamName
 		}
 	}
 
-	close(fd);
+	if (fd != fd_)
+		close(fd);
 
 	return ret;
 }
+
+/*
+ * Open the file all frames are written to. In container mode the file is
+ * truncated and starts with the stream header, otherwise frames are appended.
+ */
+int BufferWriter::openFile()
+{
+	int flags = O_CREAT | O_WRONLY;
+
+	if (flags_ & Container)
+		flags |= O_TRUNC;
+	else
+		flags |= O_APPEND;
+
+	if (flags_ & DirectIO)
+		flags |= O_DIRECT;
+
+	fd_ = open(pattern_.c_str(), flags, FileMode);
+	if (fd_ == -1)
+		return -errno;
+
+	if (!(flags_ & Container))
+		return 0;
+
+	/*
+	 * Direct I/O requires the file offset, length and memory of all writes
+	 * to be aligned, headers are written from an aligned bounce buffer.
+	 */
+	alignment_ = flags_ & DirectIO ? DirectIOAlignment : 1;
+
+	if (!bounce_) {
+		if (posix_memalign(&bounce_, DirectIOAlignment, DirectIOAlignment)) {
+			bounce_ = nullptr;
+			close(fd_);
+			fd_ = -1;
+			return -ENOMEM;
+		}
+
+		bounceSize_ = DirectIOAlignment;
+	}
+
+	FrameStreamHeader header = {};
+	header.magic = FrameStreamMagic;
+	header.version = FrameStreamVersion;
+	header.alignment = alignment_;
+
+	size_t size = frameStreamAlign(sizeof(header), alignment_);
+	memset(bounce_, 0, size);
+	memcpy(bounce_, &header, sizeof(header));
+
+	int ret = writeData(bounce_, size);
+	if (ret) {
+		close(fd_);
+		fd_ = -1;
+		offset_ = 0;
+		allocated_ = 0;
+	}
+
+	return ret;
+}
+
+int BufferWriter::writeData(const void *data, size_t length)
+{
+	/* Extend the preallocated space ahead of the writes. */
+	if (offset_ + length > allocated_) {
+		uint64_t size = std::max<uint64_t>(PreallocationSize, length);
+
+		if (!fallocate(fd_, FALLOC_FL_KEEP_SIZE, offset_, size))
+			allocated_ = offset_ + size;
+		else
+			allocated_ = UINT64_MAX;
+	}
+
+	const uint8_t *ptr = static_cast<const uint8_t *>(data);
+
+	while (length) {
+		ssize_t ret = ::write(fd_, ptr, length);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ret = -errno;
+			std::cerr << "write error: " << strerror(-ret)
+				  << std::endl;
+			return ret;
+		}
+
+		ptr += ret;
+		length -= ret;
+		offset_ += ret;
+	}
+
+	return 0;
+}
+
+/* Write a frame record to the stream file. */
+int BufferWriter::writeRecord(libcamera::Buffer *buffer, const std::string &streamName)
+{
+	libcamera::BufferMemory *mem = buffer->mem();
+	libcamera::PlaneArray &planes = mem->planes();
+
+	if (planes.size() > FrameStreamMaxPlanes) {
+		std::cerr << "Too many planes to write" << std::endl;
+		return -EINVAL;
+	}
+
+	libcamera::CpuAccess access(*mem, libcamera::Plane::AccessRead);
+
+	FrameStreamRecord record = {};
+	record.magic = FrameRecordMagic;
+	record.numPlanes = planes.size();
+	record.timestamp = buffer->timestamp();
+	record.sequence = buffer->sequence();
+	strncpy(record.stream, streamName.c_str(), sizeof(record.stream) - 1);
+
+	std::vector<std::pair<const uint8_t *, size_t>> data;
+	size_t headerSize = frameStreamAlign(sizeof(record), alignment_);
+	record.size = headerSize;
+
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		libcamera::Plane &plane = planes[i];
+		unsigned int offset = 0;
+		unsigned int length = plane.length();
+
+		/* Only write the payload when the buffer reports it. */
+		if (i < buffer->planesBytesused().size() &&
+		    buffer->planesBytesused()[i]) {
+			offset = std::min(buffer->planesOffset()[i], length);
+			length = std::min(buffer->planesBytesused()[i],
+					  length - offset);
+		}
+
+		data.emplace_back(static_cast<const uint8_t *>(plane.mem()) + offset,
+				  length);
+		record.bytesused[i] = length;
+		record.size += frameStreamAlign(length, alignment_);
+	}
+
+	memset(bounce_, 0, headerSize);
+	memcpy(bounce_, &record, sizeof(record));
+
+	int ret = writeData(bounce_, headerSize);
+	if (ret)
+		return ret;
+
+	for (unsigned int i = 0; i < data.size(); ++i) {
+		const uint8_t *ptr = data[i].first;
+		size_t length = data[i].second;
+		size_t padded = frameStreamAlign(length, alignment_);
+
+		if (!(flags_ & DirectIO)) {
+			ret = writeData(ptr, length);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		/*
+		 * Write directly from page-aligned planes, reading the padding
+		 * from the end of the mapped pages. Other planes are copied to
+		 * the bounce buffer.
+		 */
+		const uint8_t *mapped = static_cast<const uint8_t *>(planes[i].mem());
+		size_t mappedSize = frameStreamAlign(planes[i].length(),
+						     DirectIOAlignment);
+		bool aligned = !(reinterpret_cast<uintptr_t>(ptr) % DirectIOAlignment) &&
+			       ptr + padded <= mapped + mappedSize;
+		if (!aligned) {
+			if (bounceSize_ < padded) {
+				void *bounce;
+				if (posix_memalign(&bounce, DirectIOAlignment, padded))
+					return -ENOMEM;
+
+				free(bounce_);
+				bounce_ = bounce;
+				bounceSize_ = padded;
+			}
+
+			memcpy(bounce_, ptr, length);
+			memset(static_cast<uint8_t *>(bounce_) + length, 0,
+			       padded - length);
+			ptr = static_cast<const uint8_t *>(bounce_);
+		}
+
+		ret = writeData(ptr, padded);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Start the writer thread. Up to queueDepth requests are held by the writer at
+ * any time, from the call to queue() until the requestWritten signal is
+ * emitted for them from the event loop thread.
+ */
+int BufferWriter::start(unsigned int queueDepth)
+{
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		return -errno;
+
+	notifier_ = new EventNotifier(eventfd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &BufferWriter::framesWritten);
+
+	queueDepth_ = std::max(queueDepth, 1U);
+	queued_ = 0;
+	dropped_ = 0;
+	exit_ = false;
+
+	thread_ = std::thread(&BufferWriter::run, this);
+
+	return 0;
+}
+
+/*
+ * Stop the writer thread after writing the pending frames. The requests held
+ * by the writer are not signalled.
+ */
+void BufferWriter::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		exit_ = true;
+	}
+	cv_.notify_one();
+	thread_.join();
+
+	delete notifier_;
+	notifier_ = nullptr;
+	close(eventfd_);
+	eventfd_ = -1;
+
+	pending_.clear();
+	written_.clear();
+	queued_ = 0;
+}
+
+/*
+ * Queue the buffers of a completed request for writing. Return false if the
+ * queue is full, the caller then keeps ownership of the request.
+ */
+bool BufferWriter::queue(Request *request, BufferList buffers)
+{
+	if (!thread_.joinable() || queued_ >= queueDepth_) {
+		dropped_++;
+		return false;
+	}
+
+	queued_++;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		pending_.push_back({ request, std::move(buffers) });
+	}
+	cv_.notify_one();
+
+	return true;
+}
+
+void BufferWriter::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cv_.wait(locker, [&] { return exit_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;
+
+		Frame frame = std::move(pending_.front());
+		pending_.pop_front();
+
+		locker.unlock();
+
+		for (const auto &buffer : frame.buffers)
+			write(buffer.first, buffer.second);
+
+		locker.lock();
+
+		written_.push_back(frame.request);
+
+		uint64_t value = 1;
+		ssize_t ret = ::write(eventfd_, &value, sizeof(value));
+		if (ret != sizeof(value))
+			std::cerr << "Failed to signal written frame" << std::endl;
+	}
+}
+
+void BufferWriter::framesWritten(EventNotifier *notifier)
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value))
+		return;
+
+	std::vector<Request *> requests;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		requests.swap(written_);
+	}
+
+	for (Request *request : requests) {
+		queued_--;
+		requestWritten.emit(request);
+	}
+}
@@ -7,19 +7,79 @@
 #ifndef __LIBCAMERA_BUFFER_WRITER_H__
 #define __LIBCAMERA_BUFFER_WRITER_H__
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
 
 class BufferWriter
 {
 public:
-	BufferWriter(const std::string &pattern = "frame-#.bin");
+	using BufferList = std::vector<std::pair<libcamera::Buffer *, std::string>>;
+
+	enum Flag {
+		Container = (1 << 0),
+		DirectIO = (1 << 1),
+	};
+
+	BufferWriter(const std::string &pattern = "frame-#.bin",
+		     unsigned int flags = 0);
+	~BufferWriter();
 
 	int write(libcamera::Buffer *buffer, const std::string &streamName);
 
+	int start(unsigned int queueDepth);
+	void stop();
+
+	bool queue(libcamera::Request *request, BufferList buffers);
+	unsigned int dropped() const { return dropped_; }
+
+	libcamera::Signal<libcamera::Request *> requestWritten;
+
 private:
+	struct Frame {
+		libcamera::Request *request;
+		BufferList buffers;
+	};
+
+	void run();
+	void framesWritten(libcamera::EventNotifier *notifier);
+
+	int openFile();
+	int writeData(const void *data, size_t length);
+	int writeRecord(libcamera::Buffer *buffer, const std::string &streamName);
+
 	std::string pattern_;
+	unsigned int flags_;
+
+	/* Output file, kept open when all frames are written to one file. */
+	int fd_;
+	uint64_t offset_;
+	uint64_t allocated_;
+	uint32_t alignment_;
+	void *bounce_;
+	size_t bounceSize_;
+
+	std::thread thread_;
+	int eventfd_;
+	libcamera::EventNotifier *notifier_;
+	unsigned int queueDepth_;
+	unsigned int queued_;
+	unsigned int dropped_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool exit_;
+	std::deque<Frame> pending_;
+	std::vector<libcamera::Request *> written_;
 };
 
 #endif /* __LIBCAMERA_BUFFER_WRITER_H__ */
@@ -12,16 +12,33 @@
 #include <sstream>
 
 #include "capture.h"
+#ifdef HAVE_KMS
+#include "kms_sink.h"
+#endif
 #include "main.h"
 
 using namespace libcamera;
 
-Capture::Capture(Camera *camera, CameraConfiguration *config)
-	: camera_(camera), config_(config), writer_(nullptr)
+/*
+ * The name identifies the capture when multiple cameras are captured
+ * concurrently. It prefixes the stream names, and thus the names of the files
+ * frames are written to, as well as the per-frame output.
+ */
+Capture::Capture(Camera *camera, CameraConfiguration *config,
+		 const std::string &name)
+	: camera_(camera), config_(config), name_(name), loop_(nullptr),
+	  writer_(nullptr), sink_(nullptr), benchmark_(nullptr),
+	  meter_(nullptr)
 {
 }
 
-int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
+/*
+ * Start capturing. Completed requests are processed from the event loop,
+ * which is exited when the benchmark or the latency measurement, if any,
+ * completes.
+ */
+int Capture::start(EventLoop *loop, const OptionsParser::Options &options,
+		   Benchmark *benchmark)
 {
 	int ret;
 
@@ -30,10 +47,12 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 		return -ENODEV;
 	}
 
+	std::string prefix = name_.empty() ? "" : name_ + "-";
+
 	streamName_.clear();
 	for (unsigned int index = 0; index < config_->size(); ++index) {
 		StreamConfiguration &cfg = config_->at(index);
-		streamName_[cfg.stream()] = "stream" + std::to_string(index);
+		streamName_[cfg.stream()] = prefix + "stream" + std::to_string(index);
 	}
 
 	ret = camera_->configure(config_);
@@ -42,34 +61,141 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 		return ret;
 	}
 
-	ret = camera_->allocateBuffers();
+	/* Measure the latency of a control on the first stream. */
+	if (options.isSet(OptLatency)) {
+		KeyValueParser::Options opts = options[OptLatency].toKeyValues();
+		unsigned int trials = opts.isSet("trials") ? opts["trials"].toInteger() : 10;
+		unsigned int interval = opts.isSet("interval") ? opts["interval"].toInteger() : 10;
+
+		meter_ = new LatencyMeter(trials, interval);
+		ret = meter_->configure(camera_, config_->at(0).stream(),
+					opts["control"].toString(),
+					opts.isSet("low") ? opts["low"].toString() : "",
+					opts.isSet("high") ? opts["high"].toString() : "");
+		if (ret) {
+			delete meter_;
+			meter_ = nullptr;
+			return ret;
+		}
+	}
+
+	/* Prefault the buffers memory when frames are written to disk. */
+	ret = camera_->allocateBuffers(options.isSet(OptFile)
+				       ? Camera::AllocatePrefault
+				       : Camera::AllocateDefault);
 	if (ret) {
 		std::cerr << "Failed to allocate buffers" << std::endl;
+		delete meter_;
+		meter_ = nullptr;
 		return ret;
 	}
 
 	camera_->requestCompleted.connect(this, &Capture::requestComplete);
 
 	if (options.isSet(OptFile)) {
+		unsigned int flags = 0;
+		if (options.isSet(OptContainer))
+			flags |= BufferWriter::Container;
+		if (options.isSet(OptDirectIO))
+			flags |= BufferWriter::DirectIO;
+
 		if (!options[OptFile].toString().empty())
-			writer_ = new BufferWriter(options[OptFile]);
+			writer_ = new BufferWriter(options[OptFile], flags);
 		else
-			writer_ = new BufferWriter();
+			writer_ = new BufferWriter("frame-#.bin", flags);
 	}
 
-	ret = capture(loop);
+#ifdef HAVE_KMS
+	if (options.isSet(OptDisplay)) {
+		sink_ = new KMSSink(options[OptDisplay].toString());
+
+		ret = sink_->configure(config_->at(0));
+		if (!ret)
+			ret = sink_->start();
+		if (ret) {
+			camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+			delete sink_;
+			sink_ = nullptr;
+			camera_->freeBuffers();
+			return ret;
+		}
 
-	if (options.isSet(OptFile)) {
+		sink_->requestReleased.connect(this, &Capture::queueRequest);
+	}
+#endif
+
+	loop_ = loop;
+	benchmark_ = benchmark;
+	if (benchmark_) {
+		for (const auto &it : streamName_)
+			benchmark_->addStream(it.second);
+	}
+
+	ret = capture();
+	if (ret) {
+		camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+		delete meter_;
+		meter_ = nullptr;
 		delete writer_;
 		writer_ = nullptr;
+#ifdef HAVE_KMS
+		delete sink_;
+		sink_ = nullptr;
+#endif
+		camera_->freeBuffers();
 	}
 
+	return ret;
+}
+
+void Capture::stop()
+{
+	if (writer_) {
+		writer_->stop();
+		if (writer_->dropped())
+			std::cout << (name_.empty() ? "" : name_ + ": ")
+				  << writer_->dropped()
+				  << " frames not written" << std::endl;
+	}
+
+	int ret = camera_->stop();
+	if (ret)
+		std::cout << "Failed to stop capture" << std::endl;
+
+	camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+
+	delete writer_;
+	writer_ = nullptr;
+
+	if (meter_)
+		meter_->print(std::cout, name_);
+
+	delete meter_;
+	meter_ = nullptr;
+
+#ifdef HAVE_KMS
+	/* The framebuffers must be released before the buffers are freed. */
+	if (sink_) {
+		sink_->stop();
+		std::cout << (name_.empty() ? "" : name_ + ": ")
+			  << sink_->displayed() << " frames displayed, "
+			  << sink_->dropped() << " frames not displayed, latency avg "
+			  << std::fixed << std::setprecision(2)
+			  << sink_->averageLatency() / 1000000.0 << " ms max "
+			  << sink_->maxLatency() / 1000000.0 << " ms" << std::endl;
+	}
+
+	delete sink_;
+	sink_ = nullptr;
+#endif
+
 	camera_->freeBuffers();
 
-	return ret;
+	loop_ = nullptr;
+	benchmark_ = nullptr;
 }
 
-int Capture::capture(EventLoop *loop)
+int Capture::capture()
 {
 	int ret;
 
@@ -78,6 +204,21 @@ int Capture::capture(EventLoop *loop)
 	for (StreamConfiguration &cfg : *config_)
 		nbuffers = std::min(nbuffers, cfg.bufferCount);
 
+	/*
+	 * Write frames from a separate thread to keep disk stalls from
+	 * starving the camera. Requests are requeued once written, keep half
+	 * of them queued to the camera at all times.
+	 */
+	if (writer_) {
+		ret = writer_->start(nbuffers / 2);
+		if (ret) {
+			std::cerr << "Failed to start buffer writer" << std::endl;
+			return ret;
+		}
+
+		writer_->requestWritten.connect(this, &Capture::queueRequest);
+	}
+
 	/*
 	 * TODO: make cam tool smarter to support still capture by for
 	 * example pushing a button. For now run all streams all the time.
@@ -94,9 +235,9 @@ int Capture::capture(EventLoop *loop)
 		std::map<Stream *, Buffer *> map;
 		for (StreamConfiguration &cfg : *config_) {
 			Stream *stream = cfg.stream();
-			std::unique_ptr<Buffer> buffer = stream->createBuffer(i);
+			Buffer *buffer = stream->buffer(i);
 
-			ret = request->addBuffer(std::move(buffer));
+			ret = request->addBuffer(buffer);
 			if (ret < 0) {
 				std::cerr << "Can't set buffer for request"
 					  << std::endl;
@@ -113,32 +254,33 @@ int Capture::capture(EventLoop *loop)
 		return ret;
 	}
 
-	for (Request *request : requests) {
-		ret = camera_->queueRequest(request);
-		if (ret < 0) {
-			std::cerr << "Can't queue request" << std::endl;
-			camera_->stop();
-			return ret;
-		}
+	ret = camera_->queueRequests(requests);
+	if (ret != static_cast<int>(requests.size())) {
+		std::cerr << "Can't queue requests" << std::endl;
+		camera_->stop();
+		return ret < 0 ? ret : -EINVAL;
 	}
 
-	std::cout << "Capture until user interrupts by SIGINT" << std::endl;
-	ret = loop->exec();
-	if (ret)
-		std::cout << "Failed to run capture loop" << std::endl;
-
-	ret = camera_->stop();
-	if (ret)
-		std::cout << "Failed to stop capture" << std::endl;
-
-	return ret;
+	return 0;
 }
 
-void Capture::requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+void Capture::requestComplete(Request *request, const Request::BufferMap &buffers)
 {
 	if (request->status() == Request::RequestCancelled)
 		return;
 
+	/*
+	 * Benchmarks and latency measurements only print a summary at the end
+	 * of the capture.
+	 */
+	bool verbose = !benchmark_ && !meter_;
+
+	if (benchmark_ && benchmark_->record(request, streamName_))
+		loop_->exit();
+
+	if (meter_ && meter_->record(request))
+		loop_->exit();
+
 	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 	double fps = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_).count();
 	fps = last_ != std::chrono::steady_clock::time_point() && fps
@@ -146,8 +288,12 @@ void Capture::requestComplete(Request *request, const std::map<Stream *, Buffer
 	last_ = now;
 
 	std::stringstream info;
+	if (!name_.empty())
+		info << name_ << ": ";
 	info << "fps: " << std::fixed << std::setprecision(2) << fps;
 
+	BufferWriter::BufferList frame;
+
 	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
 		Stream *stream = it->first;
 		Buffer *buffer = it->second;
@@ -159,34 +305,46 @@ void Capture::requestComplete(Request *request, const std::map<Stream *, Buffer
 		     << " bytesused: " << buffer->bytesused();
 
 		if (writer_)
-			writer_->write(buffer, name);
+			frame.emplace_back(buffer, name);
 	}
 
-	std::cout << info.str() << std::endl;
-
-	/*
-	 * Create a new request and populate it with one buffer for each
-	 * stream.
-	 */
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
-		return;
+#ifdef HAVE_KMS
+	/* The sink requeues the request once its buffer isn't displayed anymore. */
+	if (sink_) {
+		auto it = buffers.find(config_->at(0).stream());
+		if (it != buffers.end() && sink_->queue(request, it->second)) {
+			if (verbose)
+				std::cout << info.str() << std::endl;
+			return;
+		}
 	}
+#endif
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		Buffer *buffer = it->second;
-		unsigned int index = buffer->index();
-
-		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(index);
-		if (!newBuffer) {
-			std::cerr << "Can't create buffer " << index << std::endl;
+	/* The writer requeues the request once its buffers are written. */
+	if (writer_) {
+		if (writer_->queue(request, std::move(frame))) {
+			if (verbose)
+				std::cout << info.str() << std::endl;
 			return;
 		}
 
-		request->addBuffer(std::move(newBuffer));
+		info << " dropped: " << writer_->dropped();
 	}
 
+	if (verbose)
+		std::cout << info.str() << std::endl;
+
+	queueRequest(request);
+}
+
+void Capture::queueRequest(Request *request)
+{
+	/*
+	 * Reuse the request and its buffers, set the controls whose latency is
+	 * measured, and queue it again to the camera.
+	 */
+	request->reuse(Request::ReuseBuffers);
+	if (meter_)
+		meter_->prepare(request);
 	camera_->queueRequest(request);
 }
@@ -9,33 +9,48 @@
 
 #include <chrono>
 #include <memory>
+#include <string>
 
 #include <libcamera/camera.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "benchmark.h"
 #include "buffer_writer.h"
 #include "event_loop.h"
+#include "latency_meter.h"
 #include "options.h"
 
+class KMSSink;
+
 class Capture
 {
 public:
 	Capture(libcamera::Camera *camera,
-		libcamera::CameraConfiguration *config);
+		libcamera::CameraConfiguration *config,
+		const std::string &name = std::string());
+
+	int start(EventLoop *loop, const OptionsParser::Options &options,
+		  Benchmark *benchmark = nullptr);
+	void stop();
 
-	int run(EventLoop *loop, const OptionsParser::Options &options);
 private:
-	int capture(EventLoop *loop);
+	int capture();
 
 	void requestComplete(libcamera::Request *request,
-			     const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers);
+			     const libcamera::Request::BufferMap &buffers);
+	void queueRequest(libcamera::Request *request);
 
 	libcamera::Camera *camera_;
 	libcamera::CameraConfiguration *config_;
+	std::string name_;
+	EventLoop *loop_;
 
 	std::map<libcamera::Stream *, std::string> streamName_;
 	BufferWriter *writer_;
+	KMSSink *sink_;
+	Benchmark *benchmark_;
+	LatencyMeter *meter_;
 	std::chrono::steady_clock::time_point last_;
 };
 
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_stream.h - Frame stream container format
+ */
+#ifndef __CAM_FRAME_STREAM_H__
+#define __CAM_FRAME_STREAM_H__
+
+#include <stdint.h>
+
+/*
+ * A frame stream file starts with a FrameStreamHeader, followed by one record
+ * per frame. Each record starts with a FrameStreamRecord, followed by the
+ * payload of each plane. The file header, the record header and each plane
+ * are padded to the alignment stored in the file header. All fields are
+ * stored in native endianness.
+ */
+
+static constexpr uint32_t FrameStreamMagic = 0x5346434c; /* "LCFS" */
+static constexpr uint32_t FrameRecordMagic = 0x5246434c; /* "LCFR" */
+static constexpr uint32_t FrameStreamVersion = 1;
+static constexpr unsigned int FrameStreamMaxPlanes = 4;
+
+struct FrameStreamHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t alignment;
+	uint32_t reserved;
+};
+
+struct FrameStreamRecord {
+	uint32_t magic;
+	uint32_t numPlanes;
+	uint64_t size;
+	uint64_t timestamp;
+	uint32_t sequence;
+	uint32_t reserved;
+	uint32_t bytesused[FrameStreamMaxPlanes];
+	char stream[16];
+};
+
+static inline uint64_t frameStreamAlign(uint64_t value, uint32_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+#endif /* __CAM_FRAME_STREAM_H__ */
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_stream_reader.cpp - cam-stream - Read frame stream container files
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "frame_stream.h"
+
+namespace {
+
+void usage(const char *argv0)
+{
+	std::cout << "Usage: " << argv0 << " input-file [output-pattern]" << std::endl
+		  << "List the frames stored in a cam stream container file." << std::endl
+		  << "When an output pattern is given, write each frame to a separate file," << std::endl
+		  << "the first '#' character is expanded to the stream name and frame" << std::endl
+		  << "sequence number." << std::endl;
+}
+
+int readData(int fd, void *data, size_t length)
+{
+	uint8_t *ptr = static_cast<uint8_t *>(data);
+
+	while (length) {
+		ssize_t ret = read(fd, ptr, length);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (ret == 0)
+			return -ENODATA;
+
+		ptr += ret;
+		length -= ret;
+	}
+
+	return 0;
+}
+
+int writeFrame(const std::string &pattern, const FrameStreamRecord &record,
+	       const std::vector<uint8_t> &payload, uint32_t alignment)
+{
+	std::string filename = pattern;
+	size_t pos = filename.find_first_of('#');
+	if (pos != std::string::npos) {
+		std::stringstream ss;
+		ss << record.stream << "-" << std::setw(6)
+		   << std::setfill('0') << record.sequence;
+		filename.replace(pos, 1, ss.str());
+	}
+
+	int fd = open(filename.c_str(), O_CREAT | O_WRONLY |
+		      (pos == std::string::npos ? O_APPEND : O_TRUNC), 0644);
+	if (fd == -1)
+		return -errno;
+
+	int ret = 0;
+	size_t offset = 0;
+
+	for (unsigned int i = 0; i < record.numPlanes; ++i) {
+		ssize_t size = ::write(fd, payload.data() + offset,
+				       record.bytesused[i]);
+		if (size != record.bytesused[i]) {
+			ret = size < 0 ? -errno : -EIO;
+			break;
+		}
+
+		offset += frameStreamAlign(record.bytesused[i], alignment);
+	}
+
+	close(fd);
+	return ret;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2 && argc != 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	if (fd == -1) {
+		std::cerr << "Failed to open input file '" << argv[1] << "': "
+			  << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	FrameStreamHeader header;
+	int ret = readData(fd, &header, sizeof(header));
+	if (ret || header.magic != FrameStreamMagic ||
+	    header.version != FrameStreamVersion || !header.alignment) {
+		std::cerr << "Invalid stream file header" << std::endl;
+		close(fd);
+		return 1;
+	}
+
+	uint64_t offset = frameStreamAlign(sizeof(header), header.alignment);
+	std::vector<uint8_t> payload;
+	unsigned int frames = 0;
+
+	while (true) {
+		FrameStreamRecord record;
+
+		if (lseek(fd, offset, SEEK_SET) == -1)
+			break;
+
+		ret = readData(fd, &record, sizeof(record));
+		if (ret == -ENODATA)
+			break;
+
+		uint64_t headerSize = frameStreamAlign(sizeof(record),
+						       header.alignment);
+
+		if (ret || record.magic != FrameRecordMagic ||
+		    record.numPlanes > FrameStreamMaxPlanes ||
+		    record.size < headerSize) {
+			std::cerr << "Invalid frame record at offset " << offset
+				  << std::endl;
+			break;
+		}
+
+		record.stream[sizeof(record.stream) - 1] = '\0';
+
+		std::cout << record.stream
+			  << " seq: " << std::setw(6) << std::setfill('0')
+			  << record.sequence << std::setfill(' ')
+			  << " timestamp: " << record.timestamp
+			  << " bytesused:";
+		for (unsigned int i = 0; i < record.numPlanes; ++i)
+			std::cout << (i ? "," : " ") << record.bytesused[i];
+		std::cout << std::endl;
+
+		if (argc == 3) {
+			payload.resize(record.size - headerSize);
+
+			if (lseek(fd, offset + headerSize, SEEK_SET) == -1 ||
+			    readData(fd, payload.data(), payload.size())) {
+				std::cerr << "Truncated frame record at offset "
+					  << offset << std::endl;
+				break;
+			}
+
+			ret = writeFrame(argv[2], record, payload,
+					 header.alignment);
+			if (ret) {
+				std::cerr << "Failed to write frame: "
+					  << strerror(-ret) << std::endl;
+				break;
+			}
+		}
+
+		offset += record.size;
+		frames++;
+	}
+
+	close(fd);
+
+	std::cout << frames << " frames" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,661 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * kms_sink.cpp - cam - KMS display sink
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+
+#include "kms_sink.h"
+
+using namespace libcamera;
+
+namespace {
+
+struct FormatInfo {
+	uint32_t format;
+	unsigned int bytesPerPixel;
+	unsigned int planes;
+	unsigned int vertSubSample;
+};
+
+/*
+ * The formats that can be displayed, with the layout of their planes. The
+ * chroma plane of the semi-planar formats has the same pitch as the luma plane.
+ */
+const FormatInfo formatInfo[] = {
+	{ DRM_FORMAT_NV12, 1, 2, 2 },
+	{ DRM_FORMAT_NV21, 1, 2, 2 },
+	{ DRM_FORMAT_NV16, 1, 2, 1 },
+	{ DRM_FORMAT_NV61, 1, 2, 1 },
+	{ DRM_FORMAT_YUYV, 2, 1, 1 },
+	{ DRM_FORMAT_YVYU, 2, 1, 1 },
+	{ DRM_FORMAT_UYVY, 2, 1, 1 },
+	{ DRM_FORMAT_VYUY, 2, 1, 1 },
+	{ DRM_FORMAT_RGB565, 2, 1, 1 },
+	{ DRM_FORMAT_RGB888, 3, 1, 1 },
+	{ DRM_FORMAT_BGR888, 3, 1, 1 },
+	{ DRM_FORMAT_XRGB8888, 4, 1, 1 },
+	{ DRM_FORMAT_XBGR8888, 4, 1, 1 },
+	{ DRM_FORMAT_ARGB8888, 4, 1, 1 },
+	{ DRM_FORMAT_ABGR8888, 4, 1, 1 },
+};
+
+const FormatInfo *findFormatInfo(uint32_t format)
+{
+	for (const FormatInfo &info : formatInfo) {
+		if (info.format == format)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+/* The connector type names, as used by the kernel. */
+const char *const connectorTypeNames[] = {
+	"Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO",
+	"LVDS", "Component", "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP",
+	"Virtual", "DSI", "DPI",
+};
+
+std::string connectorName(const drmModeConnector *connector)
+{
+	const char *type = connector->connector_type <
+			   sizeof(connectorTypeNames) / sizeof(connectorTypeNames[0])
+			 ? connectorTypeNames[connector->connector_type]
+			 : "Unknown";
+
+	return std::string(type) + "-" +
+	       std::to_string(connector->connector_type_id);
+}
+
+} /* namespace */
+
+/*
+ * The KMSSink displays frames on a KMS plane without copying them. The dmabufs
+ * of the camera buffers are imported as framebuffers when the capture starts,
+ * and completed frames are flipped to with non-blocking atomic commits. A
+ * request is held until the frame that replaces its buffer on the display has
+ * been flipped to, and is then handed back through the requestReleased signal.
+ * When frames complete faster than the display refresh rate, the frame waiting
+ * for the next flip is replaced and its request released immediately.
+ *
+ * The connector is selected by name (e.g. HDMI-A-1) or ID, and defaults to the
+ * first connected connector that has a plane supporting the stream format.
+ */
+KMSSink::KMSSink(const std::string &connector)
+	: connectorName_(connector), fd_(-1), notifier_(nullptr),
+	  connectorId_(0), crtcId_(0), planeId_(0), modeBlob_(0),
+	  modeset_(true), stream_(nullptr), bufferCount_(0), format_(0),
+	  modifier_(0), width_(0), height_(0),
+	  active_(), pending_(), queued_(), displayed_(0), dropped_(0),
+	  measured_(0), totalLatency_(0), maxLatency_(0)
+{
+	memset(&mode_, 0, sizeof(mode_));
+	memset(&props_, 0, sizeof(props_));
+}
+
+KMSSink::~KMSSink()
+{
+	stop();
+
+	if (fd_ != -1)
+		close(fd_);
+}
+
+int KMSSink::configure(const StreamConfiguration &cfg)
+{
+	if (!findFormatInfo(cfg.pixelFormat)) {
+		std::cerr << "Pixel format " << cfg.toString()
+			  << " can't be displayed" << std::endl;
+		return -EINVAL;
+	}
+
+	stream_ = cfg.stream();
+	bufferCount_ = cfg.bufferCount;
+	format_ = cfg.pixelFormat;
+	modifier_ = cfg.modifier;
+	width_ = cfg.size.width;
+	height_ = cfg.size.height;
+
+	if (fd_ != -1) {
+		close(fd_);
+		fd_ = -1;
+	}
+
+	return openDevice();
+}
+
+/*
+ * Import the buffers of the stream and prepare the display. The buffers shall
+ * have been allocated.
+ */
+int KMSSink::start()
+{
+	int ret;
+
+	for (unsigned int i = 0; i < bufferCount_; ++i) {
+		ret = importBuffer(stream_->buffer(i));
+		if (ret < 0) {
+			std::cerr << "Failed to import buffer " << i
+				  << " as a framebuffer: " << strerror(-ret)
+				  << std::endl;
+			stop();
+			return ret;
+		}
+	}
+
+	ret = drmModeCreatePropertyBlob(fd_, &mode_, sizeof(mode_), &modeBlob_);
+	if (ret < 0) {
+		ret = -errno;
+		stop();
+		return ret;
+	}
+
+	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &KMSSink::eventReady);
+
+	modeset_ = true;
+	displayed_ = 0;
+	dropped_ = 0;
+	measured_ = 0;
+	totalLatency_ = 0;
+	maxLatency_ = 0;
+
+	return 0;
+}
+
+/*
+ * Stop displaying frames and release the framebuffers. The requests held by
+ * the sink are not signalled.
+ */
+void KMSSink::stop()
+{
+	if (notifier_) {
+		/* Wait for the pending flip before disabling the display. */
+		struct pollfd pfd = { fd_, POLLIN, 0 };
+		while (pending_.request && poll(&pfd, 1, 1000) > 0)
+			eventReady(notifier_);
+
+		disable();
+
+		delete notifier_;
+		notifier_ = nullptr;
+	}
+
+	if (modeBlob_) {
+		drmModeDestroyPropertyBlob(fd_, modeBlob_);
+		modeBlob_ = 0;
+	}
+
+	for (const auto &it : framebuffers_)
+		drmModeRmFB(fd_, it.second);
+	framebuffers_.clear();
+
+	for (uint32_t handle : handles_) {
+		struct drm_gem_close gemClose = {};
+		gemClose.handle = handle;
+		drmIoctl(fd_, DRM_IOCTL_GEM_CLOSE, &gemClose);
+	}
+	handles_.clear();
+
+	active_ = {};
+	pending_ = {};
+	queued_ = {};
+}
+
+/*
+ * Queue the buffer of a completed request for display. Return false if the
+ * buffer can't be displayed, the caller then keeps ownership of the request.
+ */
+bool KMSSink::queue(Request *request, Buffer *buffer)
+{
+	if (!notifier_ || framebuffers_.find(buffer) == framebuffers_.end())
+		return false;
+
+	Frame frame = { request, buffer };
+
+	/*
+	 * Flip to the frame right away if no flip is pending, otherwise
+	 * replace the frame waiting for the next flip.
+	 */
+	if (pending_.request) {
+		Request *dropped = queued_.request;
+		queued_ = frame;
+
+		if (dropped) {
+			dropped_++;
+			requestReleased.emit(dropped);
+		}
+
+		return true;
+	}
+
+	int ret = commit(frame);
+	if (ret < 0) {
+		std::cerr << "Failed to display frame: " << strerror(-ret)
+			  << std::endl;
+		dropped_++;
+		return false;
+	}
+
+	pending_ = frame;
+	return true;
+}
+
+/*
+ * The average and maximum latency between the end of exposure, as reported by
+ * the buffer timestamp, and the flip to the frame, in nanoseconds.
+ */
+uint64_t KMSSink::averageLatency() const
+{
+	return measured_ ? totalLatency_ / measured_ : 0;
+}
+
+int KMSSink::openDevice()
+{
+	for (unsigned int i = 0; i < 16; ++i) {
+		std::string path = "/dev/dri/card" + std::to_string(i);
+
+		fd_ = open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd_ == -1) {
+			if (errno == ENOENT)
+				break;
+			continue;
+		}
+
+		if (!drmSetClientCap(fd_, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) &&
+		    !drmSetClientCap(fd_, DRM_CLIENT_CAP_ATOMIC, 1)) {
+			drmModeRes *resources = drmModeGetResources(fd_);
+			if (resources) {
+				int ret = selectPipeline(resources);
+				drmModeFreeResources(resources);
+
+				if (!ret && !findProperties())
+					return 0;
+			}
+		}
+
+		close(fd_);
+		fd_ = -1;
+	}
+
+	std::cerr << "No display found";
+	if (!connectorName_.empty())
+		std::cerr << " for connector " << connectorName_;
+	std::cerr << std::endl;
+
+	return -ENODEV;
+}
+
+/*
+ * Select the connector, its preferred mode, and a CRTC with a plane that can
+ * display the stream format.
+ */
+int KMSSink::selectPipeline(drmModeRes *resources)
+{
+	for (int i = 0; i < resources->count_connectors; ++i) {
+		drmModeConnector *connector =
+			drmModeGetConnector(fd_, resources->connectors[i]);
+		if (!connector)
+			continue;
+
+		if (!connectorName_.empty() &&
+		    connectorName_ != connectorName(connector) &&
+		    connectorName_ != std::to_string(connector->connector_id)) {
+			drmModeFreeConnector(connector);
+			continue;
+		}
+
+		if (connector->connection != DRM_MODE_CONNECTED ||
+		    !connector->count_modes) {
+			drmModeFreeConnector(connector);
+			continue;
+		}
+
+		mode_ = connector->modes[0];
+		for (int m = 0; m < connector->count_modes; ++m) {
+			if (connector->modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+				mode_ = connector->modes[m];
+				break;
+			}
+		}
+
+		for (int e = 0; e < connector->count_encoders; ++e) {
+			drmModeEncoder *encoder =
+				drmModeGetEncoder(fd_, connector->encoders[e]);
+			if (!encoder)
+				continue;
+
+			uint32_t possibleCrtcs = encoder->possible_crtcs;
+			drmModeFreeEncoder(encoder);
+
+			for (int c = 0; c < resources->count_crtcs; ++c) {
+				if (!(possibleCrtcs & (1 << c)) || selectPlane(c))
+					continue;
+
+				connectorId_ = connector->connector_id;
+				crtcId_ = resources->crtcs[c];
+				drmModeFreeConnector(connector);
+				return 0;
+			}
+		}
+
+		drmModeFreeConnector(connector);
+	}
+
+	return -ENODEV;
+}
+
+/* Select a plane of the CRTC that supports the format, preferably primary. */
+int KMSSink::selectPlane(unsigned int crtcIndex)
+{
+	drmModePlaneRes *planes = drmModeGetPlaneResources(fd_);
+	if (!planes)
+		return -ENODEV;
+
+	uint32_t overlay = 0;
+	planeId_ = 0;
+
+	for (unsigned int i = 0; i < planes->count_planes && !planeId_; ++i) {
+		drmModePlane *plane = drmModeGetPlane(fd_, planes->planes[i]);
+		if (!plane)
+			continue;
+
+		bool supported = (plane->possible_crtcs & (1 << crtcIndex)) &&
+				 std::find(plane->formats,
+					   plane->formats + plane->count_formats,
+					   format_) != plane->formats + plane->count_formats;
+
+		if (supported) {
+			uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+			propertyId(plane->plane_id, DRM_MODE_OBJECT_PLANE,
+				   "type", &type);
+
+			if (type == DRM_PLANE_TYPE_PRIMARY)
+				planeId_ = plane->plane_id;
+			else if (type == DRM_PLANE_TYPE_OVERLAY && !overlay)
+				overlay = plane->plane_id;
+		}
+
+		drmModeFreePlane(plane);
+	}
+
+	drmModeFreePlaneResources(planes);
+
+	if (!planeId_)
+		planeId_ = overlay;
+
+	return planeId_ ? 0 : -ENODEV;
+}
+
+int KMSSink::findProperties()
+{
+	props_.connectorCrtcId = propertyId(connectorId_, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	props_.crtcModeId = propertyId(crtcId_, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	props_.crtcActive = propertyId(crtcId_, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+	props_.planeFbId = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	props_.planeCrtcId = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+	props_.planeSrcX = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "SRC_X");
+	props_.planeSrcY = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+	props_.planeSrcW = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "SRC_W");
+	props_.planeSrcH = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "SRC_H");
+	props_.planeCrtcX = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+	props_.planeCrtcY = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+	props_.planeCrtcW = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+	props_.planeCrtcH = propertyId(planeId_, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+
+	const uint32_t *ids = reinterpret_cast<const uint32_t *>(&props_);
+	for (unsigned int i = 0; i < sizeof(props_) / sizeof(*ids); ++i) {
+		if (!ids[i])
+			return -ENODEV;
+	}
+
+	return 0;
+}
+
+uint32_t KMSSink::propertyId(uint32_t object, uint32_t type, const char *name,
+			     uint64_t *value)
+{
+	drmModeObjectProperties *props =
+		drmModeObjectGetProperties(fd_, object, type);
+	if (!props)
+		return 0;
+
+	uint32_t id = 0;
+
+	for (unsigned int i = 0; i < props->count_props && !id; ++i) {
+		drmModePropertyRes *prop = drmModeGetProperty(fd_, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, name)) {
+			id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+/*
+ * Create a framebuffer for the buffer. Lines are assumed not to be padded, and
+ * the planes of single-planar buffers to be contiguous.
+ */
+int KMSSink::importBuffer(Buffer *buffer)
+{
+	const FormatInfo *info = findFormatInfo(format_);
+	uint32_t handles[4] = {};
+	uint32_t pitches[4] = {};
+	uint32_t offsets[4] = {};
+	unsigned int offset = 0;
+	int ret;
+
+	for (unsigned int i = 0; i < info->planes; ++i) {
+		unsigned int height = i ? height_ / info->vertSubSample : height_;
+		int dmabuf = buffer->dmabufs()[i];
+
+		if (dmabuf == -1) {
+			dmabuf = buffer->dmabufs()[0];
+			offsets[i] = offset;
+		}
+
+		ret = drmPrimeFDToHandle(fd_, dmabuf, &handles[i]);
+		if (ret < 0)
+			return -errno;
+
+		handles_.insert(handles[i]);
+
+		pitches[i] = width_ * info->bytesPerPixel;
+		offset += pitches[i] * height;
+	}
+
+	/*
+	 * Compressed and tiled layouts are passed to the display as-is, the
+	 * display controller decodes them during scanout.
+	 */
+	uint32_t fb;
+	if (modifier_) {
+		uint64_t modifiers[4] = {};
+		for (unsigned int i = 0; i < info->planes; ++i)
+			modifiers[i] = modifier_;
+
+		ret = drmModeAddFB2WithModifiers(fd_, width_, height_, format_,
+						 handles, pitches, offsets,
+						 modifiers, &fb,
+						 DRM_MODE_FB_MODIFIERS);
+	} else {
+		ret = drmModeAddFB2(fd_, width_, height_, format_, handles,
+				    pitches, offsets, &fb, 0);
+	}
+	if (ret < 0)
+		return -errno;
+
+	framebuffers_[buffer] = fb;
+
+	return 0;
+}
+
+/*
+ * Flip to the frame with a non-blocking atomic commit. The first commit also
+ * sets the mode and the plane position, the following ones only update the
+ * framebuffer.
+ */
+int KMSSink::commit(const Frame &frame)
+{
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+
+	if (modeset_) {
+		/*
+		 * Display the frame centred, scaled down to fit the display
+		 * while preserving its aspect ratio if needed.
+		 */
+		unsigned int width = width_;
+		unsigned int height = height_;
+
+		if (width > mode_.hdisplay) {
+			height = height * mode_.hdisplay / width;
+			width = mode_.hdisplay;
+		}
+		if (height > mode_.vdisplay) {
+			width = width * mode_.vdisplay / height;
+			height = mode_.vdisplay;
+		}
+
+		drmModeAtomicAddProperty(req, connectorId_, props_.connectorCrtcId, crtcId_);
+		drmModeAtomicAddProperty(req, crtcId_, props_.crtcModeId, modeBlob_);
+		drmModeAtomicAddProperty(req, crtcId_, props_.crtcActive, 1);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcId, crtcId_);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeSrcX, 0);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeSrcY, 0);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeSrcW, width_ << 16);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeSrcH, height_ << 16);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcX,
+					 (mode_.hdisplay - width) / 2);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcY,
+					 (mode_.vdisplay - height) / 2);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcW, width);
+		drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcH, height);
+
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	drmModeAtomicAddProperty(req, planeId_, props_.planeFbId,
+				 framebuffers_[frame.buffer]);
+
+	int ret = drmModeAtomicCommit(fd_, req, flags, this);
+	if (ret < 0)
+		ret = -errno;
+
+	drmModeAtomicFree(req);
+
+	if (!ret)
+		modeset_ = false;
+
+	return ret;
+}
+
+/* Disable the plane and the CRTC, and wait for the commit to complete. */
+void KMSSink::disable()
+{
+	if (modeset_)
+		return;
+
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	if (!req)
+		return;
+
+	drmModeAtomicAddProperty(req, planeId_, props_.planeFbId, 0);
+	drmModeAtomicAddProperty(req, planeId_, props_.planeCrtcId, 0);
+	drmModeAtomicAddProperty(req, crtcId_, props_.crtcActive, 0);
+	drmModeAtomicAddProperty(req, crtcId_, props_.crtcModeId, 0);
+	drmModeAtomicAddProperty(req, connectorId_, props_.connectorCrtcId, 0);
+
+	if (drmModeAtomicCommit(fd_, req, DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr) < 0)
+		std::cerr << "Failed to disable display: " << strerror(errno)
+			  << std::endl;
+
+	drmModeAtomicFree(req);
+
+	modeset_ = true;
+}
+
+void KMSSink::eventReady(EventNotifier *notifier)
+{
+	drmEventContext context = {};
+	context.version = 2;
+	context.page_flip_handler = &KMSSink::pageFlipHandler;
+
+	drmHandleEvent(fd_, &context);
+}
+
+void KMSSink::pageFlipHandler(int fd, unsigned int sequence,
+			      unsigned int tvSec, unsigned int tvUsec,
+			      void *data)
+{
+	KMSSink *sink = static_cast<KMSSink *>(data);
+	uint64_t timestamp = tvSec * 1000000000ULL + tvUsec * 1000ULL;
+
+	sink->flipComplete(timestamp);
+}
+
+/*
+ * The pending frame is now displayed. Release the previous frame, and flip to
+ * the next frame if one has completed in the meantime.
+ */
+void KMSSink::flipComplete(uint64_t timestamp)
+{
+	Request *released = active_.request;
+
+	active_ = pending_;
+	pending_ = {};
+
+	if (!active_.request)
+		return;
+
+	/* The flip timestamps are measured on the monotonic clock. */
+	Buffer *buffer = active_.buffer;
+	if (buffer->timestampClock() == Buffer::ClockMonotonic &&
+	    buffer->timestamp() && timestamp > buffer->timestamp()) {
+		uint64_t latency = timestamp - buffer->timestamp();
+		totalLatency_ += latency;
+		measured_++;
+		maxLatency_ = std::max(maxLatency_, latency);
+	}
+
+	displayed_++;
+
+	if (queued_.request) {
+		Frame frame = queued_;
+		queued_ = {};
+
+		if (!commit(frame)) {
+			pending_ = frame;
+		} else {
+			dropped_++;
+			requestReleased.emit(frame.request);
+		}
+	}
+
+	if (released)
+		requestReleased.emit(released);
+}
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * kms_sink.h - cam - KMS display sink
+ */
+#ifndef __CAM_KMS_SINK_H__
+#define __CAM_KMS_SINK_H__
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+
+#include <xf86drmMode.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+class KMSSink
+{
+public:
+	KMSSink(const std::string &connector = std::string());
+	~KMSSink();
+
+	int configure(const libcamera::StreamConfiguration &cfg);
+	int start();
+	void stop();
+
+	bool queue(libcamera::Request *request, libcamera::Buffer *buffer);
+
+	unsigned int displayed() const { return displayed_; }
+	unsigned int dropped() const { return dropped_; }
+	uint64_t averageLatency() const;
+	uint64_t maxLatency() const { return maxLatency_; }
+
+	libcamera::Signal<libcamera::Request *> requestReleased;
+
+private:
+	struct Frame {
+		libcamera::Request *request;
+		libcamera::Buffer *buffer;
+	};
+
+	struct Properties {
+		uint32_t connectorCrtcId;
+		uint32_t crtcModeId;
+		uint32_t crtcActive;
+		uint32_t planeFbId;
+		uint32_t planeCrtcId;
+		uint32_t planeSrcX;
+		uint32_t planeSrcY;
+		uint32_t planeSrcW;
+		uint32_t planeSrcH;
+		uint32_t planeCrtcX;
+		uint32_t planeCrtcY;
+		uint32_t planeCrtcW;
+		uint32_t planeCrtcH;
+	};
+
+	int openDevice();
+	int selectPipeline(drmModeRes *resources);
+	int selectPlane(unsigned int crtcIndex);
+	int findProperties();
+	uint32_t propertyId(uint32_t object, uint32_t type, const char *name,
+			    uint64_t *value = nullptr);
+
+	int importBuffer(libcamera::Buffer *buffer);
+	int commit(const Frame &frame);
+	void disable();
+
+	void eventReady(libcamera::EventNotifier *notifier);
+	static void pageFlipHandler(int fd, unsigned int sequence,
+				    unsigned int tvSec, unsigned int tvUsec,
+				    void *data);
+	void flipComplete(uint64_t timestamp);
+
+	std::string connectorName_;
+	int fd_;
+	libcamera::EventNotifier *notifier_;
+
+	uint32_t connectorId_;
+	uint32_t crtcId_;
+	uint32_t planeId_;
+	drmModeModeInfo mode_;
+	uint32_t modeBlob_;
+	Properties props_;
+	bool modeset_;
+
+	libcamera::Stream *stream_;
+	unsigned int bufferCount_;
+	uint32_t format_;
+	uint64_t modifier_;
+	unsigned int width_;
+	unsigned int height_;
+	std::map<libcamera::Buffer *, uint32_t> framebuffers_;
+	std::set<uint32_t> handles_;
+
+	/*
+	 * The frame being scanned out, the frame whose flip is pending, and the
+	 * next frame to flip to.
+	 */
+	Frame active_;
+	Frame pending_;
+	Frame queued_;
+
+	unsigned int displayed_;
+	unsigned int dropped_;
+	unsigned int measured_;
+	uint64_t totalLatency_;
+	uint64_t maxLatency_;
+};
+
+#endif /* __CAM_KMS_SINK_H__ */
@@ -0,0 +1,322 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * latency_meter.cpp - Cam control latency measurement
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include <libcamera/buffer.h>
+
+#include "latency_meter.h"
+
+using namespace libcamera;
+
+namespace {
+
+const double NotAvailable = std::numeric_limits<double>::quiet_NaN();
+
+double toDouble(const ControlValue &value)
+{
+	switch (value.type()) {
+	case ControlTypeBool:
+		return value.get<bool>() ? 1.0 : 0.0;
+	case ControlTypeInteger32:
+		return value.get<int32_t>();
+	case ControlTypeInteger64:
+		return value.get<int64_t>();
+	case ControlTypeFloat:
+		return value.get<float>();
+	default:
+		return NotAvailable;
+	}
+}
+
+int parseValue(ControlType type, const std::string &str, ControlValue *value)
+{
+	std::istringstream ss(str);
+	double number;
+
+	ss >> number;
+	if (ss.fail() || !ss.eof())
+		return -EINVAL;
+
+	switch (type) {
+	case ControlTypeBool:
+		*value = ControlValue(number != 0.0);
+		return 0;
+	case ControlTypeInteger32:
+		*value = ControlValue(static_cast<int32_t>(number));
+		return 0;
+	case ControlTypeInteger64:
+		*value = ControlValue(static_cast<int64_t>(number));
+		return 0;
+	case ControlTypeFloat:
+		*value = ControlValue(static_cast<float>(number));
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Average one byte out of 16 of the first plane. This isn't a calibrated
+ * luminance, but for the formats cam captures it follows the brightness of the
+ * image closely enough to detect when a control changes it.
+ */
+double meanLuma(Buffer *buffer)
+{
+	BufferMemory *mem = buffer->mem();
+	if (!mem || mem->deviceOnly() || mem->planes().empty())
+		return NotAvailable;
+
+	Plane &plane = mem->planes()[0];
+	CpuAccess access(plane, Plane::AccessRead);
+
+	const uint8_t *data = static_cast<const uint8_t *>(plane.mem());
+	if (!data)
+		return NotAvailable;
+
+	unsigned int offset = 0;
+	unsigned int length = plane.length();
+	if (buffer->planesBytesused()[0]) {
+		offset = std::min(buffer->planesOffset()[0], length);
+		length = std::min(buffer->planesBytesused()[0], length - offset);
+	}
+
+	uint64_t sum = 0;
+	unsigned int count = 0;
+	for (unsigned int i = offset; i < offset + length; i += 16, ++count)
+		sum += data[i];
+
+	return count ? static_cast<double>(sum) / count : NotAvailable;
+}
+
+} /* namespace */
+
+/*
+ * Measure the number of frames between the request a control is set in and
+ * the frame its effect shows in. The control is toggled between two values
+ * every interval requests, and the frames around each toggle are searched for
+ * the first one whose mean luma, frame interval or metadata value of the
+ * control is closer to its value after the toggle than to its value before.
+ *
+ * Latencies are expressed relative to the sequence number of the frame
+ * captured for the request the control was set in, and range from minus half
+ * the interval, for pipelines which apply controls ahead of time, to half the
+ * interval. The interval must thus be larger than twice the latency of the
+ * pipeline.
+ */
+LatencyMeter::LatencyMeter(unsigned int trials, unsigned int interval)
+	: trials_(trials), interval_(std::max(interval, 2U)), stream_(nullptr),
+	  control_(nullptr), queued_(0), toggles_(0), finished_(false)
+{
+}
+
+int LatencyMeter::configure(Camera *camera, Stream *stream,
+			    const std::string &control, const std::string &low,
+			    const std::string &high)
+{
+	const ControlInfoMap &infoMap = camera->controls();
+	auto info = std::find_if(infoMap.begin(), infoMap.end(),
+				 [&](const ControlInfoMap::value_type &entry) {
+					 return entry.first->name() == control;
+				 });
+	if (info == infoMap.end()) {
+		std::cerr << "Control " << control << " not supported by "
+			  << camera->name() << std::endl;
+		return -EINVAL;
+	}
+
+	control_ = info->first;
+	values_[0] = info->second.min();
+	values_[1] = info->second.max();
+
+	if ((!low.empty() && parseValue(control_->type(), low, &values_[0])) ||
+	    (!high.empty() && parseValue(control_->type(), high, &values_[1]))) {
+		std::cerr << "Invalid value for control " << control << std::endl;
+		return -EINVAL;
+	}
+
+	if (values_[0] == values_[1]) {
+		std::cerr << "Control " << control
+			  << " can't be toggled between identical values"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	stream_ = stream;
+	queued_ = 0;
+	toggles_ = 0;
+	toggled_.clear();
+	samples_.clear();
+	toggleIndexes_.clear();
+	finished_ = false;
+
+	return 0;
+}
+
+/*
+ * Set the control in the request about to be queued. The first request sets
+ * the low value to start from a known state, and every interval requests
+ * toggle the control until all trials have been queued.
+ */
+void LatencyMeter::prepare(Request *request)
+{
+	if (!control_)
+		return;
+
+	queued_++;
+
+	if (queued_ == 1) {
+		request->controls().set(control_->id(), values_[0]);
+		return;
+	}
+
+	if (queued_ % interval_ || toggles_ >= trials_)
+		return;
+
+	toggles_++;
+	request->controls().set(control_->id(), values_[toggles_ % 2]);
+	toggled_.insert(request);
+}
+
+/*
+ * Record the effect of the control on a completed request. Return true once
+ * the frames following the last toggle have been captured.
+ */
+bool LatencyMeter::record(Request *request)
+{
+	if (!control_ || finished_)
+		return finished_;
+
+	Buffer *buffer = request->findBuffer(stream_);
+	if (!buffer)
+		return false;
+
+	Sample sample;
+	sample.sequence = buffer->sequence();
+	sample.timestamp = buffer->timestamp();
+	sample.luma = buffer->status() == Buffer::BufferSuccess
+		    ? meanLuma(buffer) : NotAvailable;
+	sample.interval = NotAvailable;
+	sample.metadata = request->metadata().contains(control_->id())
+			? toDouble(request->metadata().get(control_->id()))
+			: NotAvailable;
+	sample.toggled = toggled_.erase(request);
+
+	/* Normalize the interval to the frames dropped since the last sample. */
+	if (!samples_.empty()) {
+		const Sample &last = samples_.back();
+		if (sample.sequence > last.sequence && sample.timestamp > last.timestamp)
+			sample.interval = static_cast<double>(sample.timestamp - last.timestamp)
+					/ (sample.sequence - last.sequence);
+	}
+
+	if (sample.toggled)
+		toggleIndexes_.push_back(samples_.size());
+
+	samples_.push_back(sample);
+
+	finished_ = toggles_ == trials_ && toggled_.empty() &&
+		    (toggleIndexes_.empty() ||
+		     samples_.size() >= toggleIndexes_.back() + interval_ - interval_ / 2);
+
+	return finished_;
+}
+
+void LatencyMeter::analyze(std::ostream &out, const char *name,
+			   Observable value, double threshold) const
+{
+	std::vector<int> latencies;
+	unsigned int available = 0;
+	unsigned int half = interval_ / 2;
+
+	for (unsigned int index : toggleIndexes_) {
+		if (index < half || index + interval_ - half > samples_.size())
+			continue;
+
+		unsigned int first = index - half;
+		unsigned int last = index + interval_ - half - 1;
+		double before = samples_[first].*value;
+		double after = samples_[last].*value;
+		if (std::isnan(before) || std::isnan(after))
+			continue;
+
+		available++;
+
+		/* Skip the trials the control had no visible effect in. */
+		if (std::abs(after - before) <= threshold * std::max(std::abs(before), 1.0))
+			continue;
+
+		for (unsigned int i = first + 1; i <= last; ++i) {
+			double current = samples_[i].*value;
+			if (std::isnan(current) ||
+			    std::abs(current - after) >= std::abs(current - before))
+				continue;
+
+			latencies.push_back(static_cast<int>(samples_[i].sequence) -
+					    static_cast<int>(samples_[index].sequence));
+			break;
+		}
+	}
+
+	out << "  " << std::left << std::setw(16) << name << std::right;
+
+	if (!available) {
+		out << "not available" << std::endl;
+		return;
+	}
+
+	if (latencies.empty()) {
+		out << "no effect in " << available << " trials" << std::endl;
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	std::map<int, unsigned int> histogram;
+	for (int latency : latencies)
+		histogram[latency]++;
+
+	out << latencies.size() << "/" << available << " trials, frames min "
+	    << latencies.front() << " p50 " << latencies[(latencies.size() - 1) / 2]
+	    << " max " << latencies.back() << " [";
+
+	for (auto it = histogram.begin(); it != histogram.end(); ++it) {
+		if (it != histogram.begin())
+			out << ", ";
+		out << std::showpos << it->first << std::noshowpos
+		    << ": " << it->second;
+	}
+
+	out << "]" << std::endl;
+}
+
+void LatencyMeter::print(std::ostream &out, const std::string &name) const
+{
+	if (!control_)
+		return;
+
+	out << (name.empty() ? "" : name + ": ")
+	    << "Latency of " << control_->name() << " toggled between "
+	    << values_[0].toString() << " and " << values_[1].toString()
+	    << " every " << interval_ << " frames, " << toggleIndexes_.size()
+	    << " trials" << std::endl;
+
+	/*
+	 * Changes of less than 1% of the mean luma and of less than 5% of the
+	 * frame interval are considered as noise.
+	 */
+	analyze(out, "luma", &Sample::luma, 0.01);
+	analyze(out, "frame interval", &Sample::interval, 0.05);
+	analyze(out, "metadata", &Sample::metadata, 0.0);
+}
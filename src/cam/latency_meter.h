@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * latency_meter.h - Cam control latency measurement
+ */
+#ifndef __CAM_LATENCY_METER_H__
+#define __CAM_LATENCY_METER_H__
+
+#include <ostream>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+class LatencyMeter
+{
+public:
+	LatencyMeter(unsigned int trials, unsigned int interval);
+
+	int configure(libcamera::Camera *camera, libcamera::Stream *stream,
+		      const std::string &control, const std::string &low,
+		      const std::string &high);
+
+	void prepare(libcamera::Request *request);
+	bool record(libcamera::Request *request);
+
+	void print(std::ostream &out, const std::string &name) const;
+
+private:
+	struct Sample {
+		unsigned int sequence;
+		uint64_t timestamp;
+		double luma;
+		double interval;
+		double metadata;
+		bool toggled;
+	};
+
+	using Observable = double Sample::*;
+
+	void analyze(std::ostream &out, const char *name, Observable value,
+		     double threshold) const;
+
+	unsigned int trials_;
+	unsigned int interval_;
+
+	libcamera::Stream *stream_;
+	const libcamera::ControlId *control_;
+	libcamera::ControlValue values_[2];
+
+	unsigned int queued_;
+	unsigned int toggles_;
+	std::set<libcamera::Request *> toggled_;
+
+	std::vector<Sample> samples_;
+	std::vector<unsigned int> toggleIndexes_;
+	bool finished_;
+};
+
+#endif /* __CAM_LATENCY_METER_H__ */
@@ -5,6 +5,8 @@
  * main.cpp - cam - The libcamera swiss army knife
  */
 
+#include <algorithm>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <signal.h>
@@ -12,6 +14,7 @@
 
 #include <libcamera/libcamera.h>
 
+#include "benchmark.h"
 #include "capture.h"
 #include "event_loop.h"
 #include "main.h"
@@ -34,23 +37,32 @@ public:
 	void quit();
 
 private:
+	struct CameraState {
+		std::string option;
+		std::shared_ptr<Camera> camera;
+		std::unique_ptr<libcamera::CameraConfiguration> config;
+	};
+
 	int parseOptions(int argc, char *argv[]);
-	int prepareConfig();
+	int addCamera(const std::string &cameraName);
+	int prepareConfig(CameraState *state);
 	int infoConfiguration();
+	int printConfiguration(const libcamera::CameraConfiguration &config);
+	int capture();
+	void printTimeline();
 	int run();
 
 	static CamApp *app_;
 	OptionsParser::Options options_;
 	CameraManager *cm_;
-	std::shared_ptr<Camera> camera_;
-	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::vector<CameraState> cameras_;
 	EventLoop *loop_;
 };
 
 CamApp *CamApp::app_ = nullptr;
 
 CamApp::CamApp()
-	: cm_(nullptr), camera_(nullptr), config_(nullptr), loop_(nullptr)
+	: cm_(nullptr), loop_(nullptr)
 {
 	CamApp::app_ = this;
 }
@@ -75,6 +87,9 @@ int CamApp::init(int argc, char **argv)
 
 	cm_ = new CameraManager();
 
+	/* cam uses the default event dispatcher, run pipelines in threads. */
+	cm_->setPipelineThreads(true);
+
 	ret = cm_->start();
 	if (ret) {
 		std::cout << "Failed to start camera manager: "
@@ -83,34 +98,13 @@ int CamApp::init(int argc, char **argv)
 	}
 
 	if (options_.isSet(OptCamera)) {
-		const std::string &cameraName = options_[OptCamera];
-		char *endptr;
-		unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
-		if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
-			camera_ = cm_->cameras()[index - 1];
-		else
-			camera_ = cm_->get(cameraName);
-
-		if (!camera_) {
-			std::cout << "Camera "
-				  << std::string(options_[OptCamera])
-				  << " not found" << std::endl;
-			cm_->stop();
-			return -ENODEV;
-		}
-
-		if (camera_->acquire()) {
-			std::cout << "Failed to acquire camera" << std::endl;
-			camera_.reset();
-			cm_->stop();
-			return -EINVAL;
+		for (const OptionValue &value : options_[OptCamera].toArray()) {
+			ret = addCamera(value);
+			if (ret) {
+				cleanup();
+				return ret;
+			}
 		}
-
-		std::cout << "Using camera " << camera_->name() << std::endl;
-
-		ret = prepareConfig();
-		if (ret)
-			return ret;
 	}
 
 	loop_ = new EventLoop(cm_->eventDispatcher());
@@ -123,12 +117,12 @@ void CamApp::cleanup()
 	delete loop_;
 	loop_ = nullptr;
 
-	if (camera_) {
-		camera_->release();
-		camera_.reset();
+	for (CameraState &state : cameras_) {
+		if (state.camera)
+			state.camera->release();
 	}
 
-	config_.reset();
+	cameras_.clear();
 
 	cm_->stop();
 }
@@ -153,7 +147,7 @@ int CamApp::parseOptions(int argc, char *argv[])
 {
 	KeyValueParser streamKeyValue;
 	streamKeyValue.addOption("role", OptionString,
-				 "Role for the stream (viewfinder, video, still)",
+				 "Role for the stream (viewfinder, video, still, raw)",
 				 ArgumentRequired);
 	streamKeyValue.addOption("width", OptionInteger, "Width in pixels",
 				 ArgumentRequired);
@@ -162,10 +156,38 @@ int CamApp::parseOptions(int argc, char *argv[])
 	streamKeyValue.addOption("pixelformat", OptionInteger, "Pixel format",
 				 ArgumentRequired);
 
+	KeyValueParser benchmarkKeyValue;
+	benchmarkKeyValue.addOption("frames", OptionInteger,
+				    "Number of frames to capture per stream", ArgumentRequired);
+	benchmarkKeyValue.addOption("duration", OptionInteger,
+				    "Capture duration in seconds", ArgumentRequired);
+	benchmarkKeyValue.addOption("json", OptionString,
+				    "File to write the JSON results to", ArgumentRequired);
+
+	KeyValueParser latencyKeyValue;
+	latencyKeyValue.addOption("control", OptionString,
+				  "Name of the control to measure", ArgumentRequired);
+	latencyKeyValue.addOption("trials", OptionInteger,
+				  "Number of times to toggle the control", ArgumentRequired);
+	latencyKeyValue.addOption("interval", OptionInteger,
+				  "Number of frames between toggles", ArgumentRequired);
+	latencyKeyValue.addOption("low", OptionString,
+				  "Low value of the control, defaults to its minimum",
+				  ArgumentRequired);
+	latencyKeyValue.addOption("high", OptionString,
+				  "High value of the control, defaults to its maximum",
+				  ArgumentRequired);
+
+	streamKeyValue.addOption("camera", OptionString,
+				 "Camera the stream belongs to, as given to the camera option.\n"
+				 "Defaults to all cameras.",
+				 ArgumentRequired);
+
 	OptionsParser parser;
 	parser.addOption(OptCamera, OptionString,
-			 "Specify which camera to operate on, by name or by index", "camera",
-			 ArgumentRequired, "camera");
+			 "Specify which camera to operate on, by name or by index\n"
+			 "The option can be repeated to operate on multiple cameras concurrently.",
+			 "camera", ArgumentRequired, "camera", true);
 	parser.addOption(OptCapture, OptionNone,
 			 "Capture until interrupted by user", "capture");
 	parser.addOption(OptFile, OptionString,
@@ -173,6 +195,30 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename");
+#ifdef HAVE_KMS
+	parser.addOption(OptDisplay, OptionString,
+			 "Display viewfinder frames on a KMS connector, without copying them\n"
+			 "The connector is given by name (e.g. HDMI-A-1) or by ID, and defaults\n"
+			 "to the first connected connector. Only the first stream is displayed.",
+			 "display", ArgumentOptional, "connector");
+#endif
+	parser.addOption(OptContainer, OptionNone,
+			 "Write all frames to a single stream container file, with a header per frame\n"
+			 "The file name given to the file option shall not contain a '#' character.",
+			 "container");
+	parser.addOption(OptDirectIO, OptionNone,
+			 "Bypass the page cache when writing the stream container file",
+			 "direct-io");
+	parser.addOption(OptBenchmark, &benchmarkKeyValue,
+			 "Capture for a number of requests or a duration, and print frame rate,\n"
+			 "dropped frames, latency and CPU usage statistics. Defaults to 300 frames.",
+			 "benchmark");
+	parser.addOption(OptLatency, &latencyKeyValue,
+			 "Measure the latency of a control on the first stream. Toggle the control\n"
+			 "between two values every interval frames, and print the distribution of\n"
+			 "the number of frames until its effect shows in the mean luma, the frame\n"
+			 "interval and the metadata. Defaults to 10 trials every 10 frames.",
+			 "latency");
 	parser.addOption(OptStream, &streamKeyValue,
 			 "Set configuration of a camera stream", "stream", true);
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
@@ -180,6 +226,10 @@ int CamApp::parseOptions(int argc, char *argv[])
 	parser.addOption(OptInfo, OptionNone,
 			 "Display information about stream(s)", "info");
 	parser.addOption(OptList, OptionNone, "List all cameras", "list");
+	parser.addOption(OptTimeline, OptionNone,
+			 "Print the timeline of the startup phases before exiting, from the\n"
+			 "camera manager start to the first completed request",
+			 "timeline");
 
 	options_ = parser.parse(argc, argv);
 	if (!options_.valid())
@@ -190,20 +240,91 @@ int CamApp::parseOptions(int argc, char *argv[])
 		return options_.empty() ? -EINVAL : -EINTR;
 	}
 
+	if (options_.isSet(OptContainer) &&
+	    (!options_.isSet(OptFile) ||
+	     options_[OptFile].toString().empty() ||
+	     options_[OptFile].toString().find('#') != std::string::npos)) {
+		std::cerr << "The container option requires a file name without '#'"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (options_.isSet(OptContainer) && options_.isSet(OptCamera) &&
+	    options_[OptCamera].toArray().size() > 1) {
+		std::cerr << "The container option supports a single camera"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (options_.isSet(OptDisplay) && options_.isSet(OptFile)) {
+		std::cerr << "The display and file options are mutually exclusive"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (options_.isSet(OptDisplay) && options_.isSet(OptCamera) &&
+	    options_[OptCamera].toArray().size() > 1) {
+		std::cerr << "The display option supports a single camera"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if (options_.isSet(OptDirectIO) && !options_.isSet(OptContainer)) {
+		std::cerr << "Direct I/O is only supported in container mode"
+			  << std::endl;
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
-int CamApp::prepareConfig()
+int CamApp::addCamera(const std::string &cameraName)
 {
+	CameraState state;
+	state.option = cameraName;
+
+	char *endptr;
+	unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
+	if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
+		state.camera = cm_->cameras()[index - 1];
+	else
+		state.camera = cm_->get(cameraName);
+
+	if (!state.camera) {
+		std::cout << "Camera " << cameraName << " not found" << std::endl;
+		return -ENODEV;
+	}
+
+	if (state.camera->acquire()) {
+		std::cout << "Failed to acquire camera " << cameraName << std::endl;
+		return -EINVAL;
+	}
+
+	std::cout << "Using camera " << state.camera->name() << std::endl;
+
+	cameras_.push_back(std::move(state));
+
+	return prepareConfig(&cameras_.back());
+}
+
+int CamApp::prepareConfig(CameraState *state)
+{
+	std::vector<KeyValueParser::Options> streamOptions;
 	StreamRoles roles;
 
+	/* Select the streams that apply to the camera. */
 	if (options_.isSet(OptStream)) {
-		const std::vector<OptionValue> &streamOptions =
-			options_[OptStream].toArray();
+		for (auto const &value : options_[OptStream].toArray()) {
+			KeyValueParser::Options opt = value.toKeyValues();
+			if (!opt.isSet("camera") ||
+			    opt["camera"].toString() == state->option)
+				streamOptions.push_back(opt);
+		}
+	}
 
+	if (!streamOptions.empty()) {
 		/* Use roles and get a default configuration. */
-		for (auto const &value : streamOptions) {
-			KeyValueParser::Options opt = value.toKeyValues();
+		for (const KeyValueParser::Options &opt : streamOptions) {
 
 			if (!opt.isSet("role")) {
 				roles.push_back(StreamRole::VideoRecording);
@@ -213,6 +334,8 @@ int CamApp::prepareConfig()
 				roles.push_back(StreamRole::VideoRecording);
 			} else if (opt["role"].toString() == "still") {
 				roles.push_back(StreamRole::StillCapture);
+			} else if (opt["role"].toString() == "raw") {
+				roles.push_back(StreamRole::StillCaptureRaw);
 			} else {
 				std::cerr << "Unknown stream role "
 					  << opt["role"].toString() << std::endl;
@@ -224,22 +347,19 @@ int CamApp::prepareConfig()
 		roles.push_back(StreamRole::VideoRecording);
 	}
 
-	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->size() != roles.size()) {
+	std::unique_ptr<CameraConfiguration> &config = state->config;
+	config = state->camera->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
 		std::cerr << "Failed to get default stream configuration"
 			  << std::endl;
 		return -EINVAL;
 	}
 
 	/* Apply configuration if explicitly requested. */
-	if (options_.isSet(OptStream)) {
-		const std::vector<OptionValue> &streamOptions =
-			options_[OptStream].toArray();
-
+	if (!streamOptions.empty()) {
 		unsigned int i = 0;
-		for (auto const &value : streamOptions) {
-			KeyValueParser::Options opt = value.toKeyValues();
-			StreamConfiguration &cfg = config_->at(i++);
+		for (const KeyValueParser::Options &opt : streamOptions) {
+			StreamConfiguration &cfg = config->at(i++);
 
 			if (opt.isSet("width"))
 				cfg.size.width = opt["width"];
@@ -253,7 +373,7 @@ int CamApp::prepareConfig()
 		}
 	}
 
-	switch (config_->validate()) {
+	switch (config->validate()) {
 	case CameraConfiguration::Valid:
 		break;
 	case CameraConfiguration::Adjusted:
@@ -261,7 +381,7 @@ int CamApp::prepareConfig()
 		break;
 	case CameraConfiguration::Invalid:
 		std::cout << "Camera configuration invalid" << std::endl;
-		config_.reset();
+		config.reset();
 		return -EINVAL;
 	}
 
@@ -270,14 +390,26 @@ int CamApp::prepareConfig()
 
 int CamApp::infoConfiguration()
 {
-	if (!config_) {
+	if (cameras_.empty()) {
 		std::cout << "Cannot print stream information without a camera"
 			  << std::endl;
 		return -EINVAL;
 	}
 
+	for (const CameraState &state : cameras_) {
+		if (cameras_.size() > 1)
+			std::cout << state.camera->name() << ":" << std::endl;
+
+		printConfiguration(*state.config);
+	}
+
+	return 0;
+}
+
+int CamApp::printConfiguration(const CameraConfiguration &config)
+{
 	unsigned int index = 0;
-	for (const StreamConfiguration &cfg : *config_) {
+	for (const StreamConfiguration &cfg : config) {
 		std::cout << index << ": " << cfg.toString() << std::endl;
 
 		const StreamFormats &formats = cfg.formats();
@@ -319,13 +451,115 @@ int CamApp::run()
 	}
 
 	if (options_.isSet(OptCapture)) {
-		Capture capture(camera_.get(), config_.get());
-		return capture.run(loop_, options_);
+		ret = capture();
+		if (ret)
+			return ret;
 	}
 
+	if (options_.isSet(OptTimeline))
+		printTimeline();
+
 	return 0;
 }
 
+void CamApp::printTimeline()
+{
+	std::vector<StartupPhase> phases = CameraManager::startupTimeline();
+	if (phases.empty())
+		return;
+
+	std::stable_sort(phases.begin(), phases.end(),
+			 [](const StartupPhase &a, const StartupPhase &b) {
+				 return a.start < b.start;
+			 });
+
+	uint64_t origin = phases.front().start;
+
+	std::cout << "Startup timeline (start, duration in ms):" << std::endl;
+
+	for (const StartupPhase &phase : phases) {
+		std::cout << std::fixed << std::setprecision(3)
+			  << std::setw(10) << (phase.start - origin) / 1e6
+			  << std::setw(10) << (phase.end - phase.start) / 1e6
+			  << "  " << phase.name;
+		if (!phase.subject.empty())
+			std::cout << " " << phase.subject;
+		std::cout << std::endl;
+	}
+}
+
+int CamApp::capture()
+{
+	std::vector<std::unique_ptr<Capture>> captures;
+	std::unique_ptr<Benchmark> benchmark;
+	std::string benchmarkJson;
+	int ret = 0;
+
+	if (cameras_.empty()) {
+		std::cout << "Can't capture without a camera" << std::endl;
+		return -ENODEV;
+	}
+
+	if (options_.isSet(OptBenchmark)) {
+		KeyValueParser::Options opts = options_[OptBenchmark].toKeyValues();
+		unsigned int frames = opts.isSet("frames") ? opts["frames"].toInteger() : 0;
+		unsigned int duration = opts.isSet("duration") ? opts["duration"].toInteger() : 0;
+		if (!frames && !duration)
+			frames = 300;
+
+		benchmark.reset(new Benchmark(frames, duration));
+		if (opts.isSet("json"))
+			benchmarkJson = opts["json"].toString();
+	}
+
+	/*
+	 * All cameras share the event loop. Name the captures when there is
+	 * more than one camera, to tell their frames apart.
+	 */
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		CameraState &state = cameras_[i];
+		std::string name = cameras_.size() > 1
+				 ? "cam" + std::to_string(i) : std::string();
+
+		std::unique_ptr<Capture> capture(new Capture(state.camera.get(),
+							     state.config.get(),
+							     name));
+		ret = capture->start(loop_, options_, benchmark.get());
+		if (ret)
+			break;
+
+		captures.push_back(std::move(capture));
+	}
+
+	if (!ret) {
+		if (benchmark)
+			benchmark->start();
+
+		std::cout << "Capture until user interrupts by SIGINT" << std::endl;
+		ret = loop_->exec();
+		if (ret)
+			std::cout << "Failed to run capture loop" << std::endl;
+	}
+
+	if (benchmark && !ret) {
+		benchmark->stop();
+		benchmark->print(std::cout);
+
+		if (!benchmarkJson.empty()) {
+			std::ofstream file(benchmarkJson);
+			file << benchmark->json();
+			if (!file)
+				std::cerr << "Failed to write " << benchmarkJson
+					  << std::endl;
+		}
+	}
+
+	for (std::unique_ptr<Capture> &capture : captures)
+		capture->stop();
+
+	return ret;
+}
+
 void signalHandler(int signal)
 {
 	std::cout << "Exiting" << std::endl;
@@ -10,11 +10,17 @@
 enum {
 	OptCamera = 'c',
 	OptCapture = 'C',
+	OptDisplay = 'D',
 	OptFile = 'F',
 	OptHelp = 'h',
 	OptInfo = 'I',
 	OptList = 'l',
 	OptStream = 's',
+	OptContainer = 256,
+	OptDirectIO = 257,
+	OptBenchmark = 258,
+	OptTimeline = 259,
+	OptLatency = 260,
 };
 
 #endif /* __CAM_MAIN_H__ */
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * main.cpp - camerad - Share a camera with multiple processes
+ */
+
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcamera/libcamera.h>
+
+#include "../cam/event_loop.h"
+#include "../cam/options.h"
+
+using namespace libcamera;
+
+enum {
+	OptBuffers = 'b',
+	OptCamera = 'c',
+	OptHelp = 'h',
+	OptSocket = 'S',
+	OptStream = 's',
+};
+
+static const char *defaultSocket = "/run/libcamera/camerad.sock";
+
+static EventLoop *loop;
+
+static void signalHandler(int signal)
+{
+	std::cout << "Exiting" << std::endl;
+	if (loop)
+		loop->exit();
+}
+
+static int parseOptions(int argc, char *argv[], OptionsParser::Options *options)
+{
+	KeyValueParser streamKeyValue;
+	streamKeyValue.addOption("role", OptionString,
+				 "Role for the stream (viewfinder, video, still, raw)",
+				 ArgumentRequired);
+	streamKeyValue.addOption("width", OptionInteger, "Width in pixels",
+				 ArgumentRequired);
+	streamKeyValue.addOption("height", OptionInteger, "Height in pixels",
+				 ArgumentRequired);
+	streamKeyValue.addOption("pixelformat", OptionInteger, "Pixel format",
+				 ArgumentRequired);
+
+	OptionsParser parser;
+	parser.addOption(OptBuffers, OptionInteger,
+			 "Number of buffers per stream, shared by all clients",
+			 "buffers", ArgumentRequired, "count");
+	parser.addOption(OptCamera, OptionString,
+			 "Specify which camera to share, by name or by index",
+			 "camera", ArgumentRequired, "camera");
+	parser.addOption(OptHelp, OptionNone, "Display this help message",
+			 "help");
+	parser.addOption(OptSocket, OptionString,
+			 "Path of the socket the clients connect to",
+			 "socket", ArgumentRequired, "path");
+	parser.addOption(OptStream, &streamKeyValue,
+			 "Set configuration of a camera stream", "stream", true);
+
+	*options = parser.parse(argc, argv);
+	if (!options->valid())
+		return -EINVAL;
+
+	if (options->isSet(OptHelp)) {
+		parser.usage();
+		return -EINTR;
+	}
+
+	return 0;
+}
+
+static std::shared_ptr<Camera> findCamera(CameraManager *cm,
+					  const OptionsParser::Options &options)
+{
+	if (!options.isSet(OptCamera))
+		return cm->cameras().empty() ? nullptr : cm->cameras()[0];
+
+	const std::string name = options[OptCamera];
+
+	char *endptr;
+	unsigned long index = strtoul(name.c_str(), &endptr, 10);
+	if (*endptr == '\0' && index > 0 && index <= cm->cameras().size())
+		return cm->cameras()[index - 1];
+
+	return cm->get(name);
+}
+
+static std::unique_ptr<CameraConfiguration>
+prepareConfig(Camera *camera, const OptionsParser::Options &options)
+{
+	std::vector<KeyValueParser::Options> streamOptions;
+	StreamRoles roles;
+
+	if (options.isSet(OptStream)) {
+		for (auto const &value : options[OptStream].toArray())
+			streamOptions.push_back(value.toKeyValues());
+	}
+
+	for (const KeyValueParser::Options &opt : streamOptions) {
+		if (!opt.isSet("role")) {
+			roles.push_back(StreamRole::VideoRecording);
+		} else if (opt["role"].toString() == "viewfinder") {
+			roles.push_back(StreamRole::Viewfinder);
+		} else if (opt["role"].toString() == "video") {
+			roles.push_back(StreamRole::VideoRecording);
+		} else if (opt["role"].toString() == "still") {
+			roles.push_back(StreamRole::StillCapture);
+		} else if (opt["role"].toString() == "raw") {
+			roles.push_back(StreamRole::StillCaptureRaw);
+		} else {
+			std::cerr << "Unknown stream role "
+				  << opt["role"].toString() << std::endl;
+			return nullptr;
+		}
+	}
+
+	/* If no configuration is provided assume a single video stream. */
+	if (roles.empty())
+		roles.push_back(StreamRole::VideoRecording);
+
+	std::unique_ptr<CameraConfiguration> config =
+		camera->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
+		std::cerr << "Failed to get default stream configuration"
+			  << std::endl;
+		return nullptr;
+	}
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+
+		if (i < streamOptions.size()) {
+			const KeyValueParser::Options &opt = streamOptions[i];
+
+			if (opt.isSet("width"))
+				cfg.size.width = opt["width"];
+			if (opt.isSet("height"))
+				cfg.size.height = opt["height"];
+			if (opt.isSet("pixelformat"))
+				cfg.pixelFormat = opt["pixelformat"];
+		}
+
+		/*
+		 * The buffers are shared by all clients, default to more than
+		 * the pipeline handler needs for capture alone.
+		 */
+		if (options.isSet(OptBuffers))
+			cfg.bufferCount = static_cast<int>(options[OptBuffers]);
+		else
+			cfg.bufferCount += CameraServer::MIN_QUEUED_BUFFERS + 2;
+	}
+
+	switch (config->validate()) {
+	case CameraConfiguration::Valid:
+		break;
+	case CameraConfiguration::Adjusted:
+		std::cout << "Camera configuration adjusted" << std::endl;
+		break;
+	case CameraConfiguration::Invalid:
+		std::cout << "Camera configuration invalid" << std::endl;
+		return nullptr;
+	}
+
+	return config;
+}
+
+int main(int argc, char **argv)
+{
+	OptionsParser::Options options;
+	int ret;
+
+	ret = parseOptions(argc, argv, &options);
+	if (ret)
+		return ret == -EINTR ? 0 : EXIT_FAILURE;
+
+	CameraManager cm;
+
+	/* camerad uses the default event dispatcher, run pipelines in threads. */
+	cm.setPipelineThreads(true);
+
+	ret = cm.start();
+	if (ret) {
+		std::cerr << "Failed to start camera manager: "
+			  << strerror(-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::shared_ptr<Camera> camera = findCamera(&cm, options);
+	if (!camera) {
+		std::cerr << "Camera not found" << std::endl;
+		cm.stop();
+		return EXIT_FAILURE;
+	}
+
+	if (camera->acquire()) {
+		std::cerr << "Failed to acquire camera " << camera->name()
+			  << std::endl;
+		camera.reset();
+		cm.stop();
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<CameraConfiguration> config =
+		prepareConfig(camera.get(), options);
+	std::string path = options.isSet(OptSocket)
+			 ? options[OptSocket].toString() : defaultSocket;
+
+	ret = -EINVAL;
+	if (config) {
+		CameraServer server(camera);
+
+		ret = server.start(path, config.get());
+		if (!ret) {
+			std::cout << "Sharing camera " << camera->name()
+				  << " on " << path << std::endl;
+
+			EventLoop eventLoop(cm.eventDispatcher());
+			loop = &eventLoop;
+
+			struct sigaction sa = {};
+			sa.sa_handler = &signalHandler;
+			sigaction(SIGINT, &sa, nullptr);
+			sigaction(SIGTERM, &sa, nullptr);
+
+			eventLoop.exec();
+			loop = nullptr;
+		} else {
+			std::cerr << "Failed to start server: "
+				  << strerror(-ret) << std::endl;
+		}
+	}
+
+	camera->release();
+	camera.reset();
+	cm.stop();
+
+	return ret ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-thread.cpp - Thread running the libcamera camera manager
+ */
+
+#include "gstlibcamera-thread.h"
+
+using namespace libcamera;
+
+/*
+ * The camera manager is a process-wide singleton, shared by all libcamerasrc
+ * elements. Its event loop runs in a dedicated thread, created along with the
+ * camera manager so that all libcamera objects are bound to it. The Camera
+ * methods must be called from that thread, with post() or call().
+ */
+
+static std::mutex instance_lock;
+static std::weak_ptr<CameraThread> instance;
+
+CameraThread::CameraThread()
+	: cm_(nullptr), dispatcher_(nullptr), started_(false), status_(0),
+	  exit_(false)
+{
+}
+
+CameraThread::~CameraThread()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		exit_ = true;
+	}
+
+	if (dispatcher_)
+		dispatcher_->interrupt();
+
+	thread_.join();
+}
+
+/* Retrieve the camera thread, starting it if needed. */
+std::shared_ptr<CameraThread> CameraThread::get()
+{
+	std::lock_guard<std::mutex> locker(instance_lock);
+
+	std::shared_ptr<CameraThread> thread = instance.lock();
+	if (thread)
+		return thread;
+
+	thread.reset(new CameraThread());
+	if (thread->start() < 0)
+		return nullptr;
+
+	instance = thread;
+	return thread;
+}
+
+/* Queue a task to be run asynchronously in the camera thread. */
+void CameraThread::post(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+
+	dispatcher_->interrupt();
+}
+
+/* Run a function in the camera thread and wait for its return value. */
+int CameraThread::call(const std::function<int()> &func)
+{
+	if (std::this_thread::get_id() == thread_.get_id())
+		return func();
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool done = false;
+	int ret = 0;
+
+	post([&]() {
+		ret = func();
+
+		std::lock_guard<std::mutex> locker(mutex);
+		done = true;
+		cv.notify_one();
+	});
+
+	std::unique_lock<std::mutex> locker(mutex);
+	cv.wait(locker, [&]() { return done; });
+
+	return ret;
+}
+
+int CameraThread::start()
+{
+	thread_ = std::thread(&CameraThread::run, this);
+
+	std::unique_lock<std::mutex> locker(mutex_);
+	cv_.wait(locker, [&]() { return started_; });
+
+	return status_;
+}
+
+void CameraThread::run()
+{
+	CameraManager *cm = new CameraManager();
+	int ret = cm->start();
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		if (!ret) {
+			cm_ = cm;
+			dispatcher_ = cm->eventDispatcher();
+		}
+		status_ = ret;
+		started_ = true;
+	}
+	cv_.notify_all();
+
+	if (ret) {
+		delete cm;
+		return;
+	}
+
+	while (true) {
+		std::deque<std::function<void()>> tasks;
+
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+			if (exit_ && tasks_.empty())
+				break;
+
+			tasks.swap(tasks_);
+		}
+
+		for (std::function<void()> &task : tasks)
+			task();
+
+		/*
+		 * Tasks posted while events are processed interrupt the event
+		 * dispatcher, and are run on the next iteration.
+		 */
+		if (tasks.empty())
+			dispatcher_->processEvents();
+	}
+
+	cm->stop();
+	delete cm;
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-thread.h - Thread running the libcamera camera manager
+ */
+#ifndef __GST_LIBCAMERA_THREAD_H__
+#define __GST_LIBCAMERA_THREAD_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+
+class CameraThread
+{
+public:
+	~CameraThread();
+
+	static std::shared_ptr<CameraThread> get();
+
+	libcamera::CameraManager *manager() const { return cm_; }
+
+	void post(std::function<void()> task);
+	int call(const std::function<int()> &func);
+
+private:
+	CameraThread();
+
+	int start();
+	void run();
+
+	std::thread thread_;
+	libcamera::CameraManager *cm_;
+	libcamera::EventDispatcher *dispatcher_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::function<void()>> tasks_;
+	bool started_;
+	int status_;
+	bool exit_;
+};
+
+#endif /* __GST_LIBCAMERA_THREAD_H__ */
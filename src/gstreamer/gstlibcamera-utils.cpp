@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-utils.cpp - GStreamer libcamera utility functions
+ */
+
+#include "gstlibcamera-utils.h"
+
+#include <linux/videodev2.h>
+
+using namespace libcamera;
+
+static struct {
+	GstVideoFormat gst_format;
+	unsigned int fourcc;
+} format_map[] = {
+	{ GST_VIDEO_FORMAT_NV12, V4L2_PIX_FMT_NV12 },
+	{ GST_VIDEO_FORMAT_NV21, V4L2_PIX_FMT_NV21 },
+	{ GST_VIDEO_FORMAT_NV16, V4L2_PIX_FMT_NV16 },
+	{ GST_VIDEO_FORMAT_NV61, V4L2_PIX_FMT_NV61 },
+	{ GST_VIDEO_FORMAT_YUY2, V4L2_PIX_FMT_YUYV },
+	{ GST_VIDEO_FORMAT_YVYU, V4L2_PIX_FMT_YVYU },
+	{ GST_VIDEO_FORMAT_UYVY, V4L2_PIX_FMT_UYVY },
+	{ GST_VIDEO_FORMAT_VYUY, V4L2_PIX_FMT_VYUY },
+	{ GST_VIDEO_FORMAT_RGB, V4L2_PIX_FMT_RGB24 },
+	{ GST_VIDEO_FORMAT_BGR, V4L2_PIX_FMT_BGR24 },
+	{ GST_VIDEO_FORMAT_BGRA, V4L2_PIX_FMT_ABGR32 },
+	{ GST_VIDEO_FORMAT_BGRx, V4L2_PIX_FMT_XBGR32 },
+	{ GST_VIDEO_FORMAT_ARGB, V4L2_PIX_FMT_ARGB32 },
+	{ GST_VIDEO_FORMAT_xRGB, V4L2_PIX_FMT_XRGB32 },
+	{ GST_VIDEO_FORMAT_GRAY8, V4L2_PIX_FMT_GREY },
+};
+
+static GstVideoFormat
+fourcc_to_gst_format(unsigned int fourcc)
+{
+	for (const auto &item : format_map) {
+		if (item.fourcc == fourcc)
+			return item.gst_format;
+	}
+
+	return GST_VIDEO_FORMAT_UNKNOWN;
+}
+
+static unsigned int
+gst_format_to_fourcc(GstVideoFormat gst_format)
+{
+	for (const auto &item : format_map) {
+		if (item.gst_format == gst_format)
+			return item.fourcc;
+	}
+
+	return 0;
+}
+
+/* Create a caps structure for a fourcc, or return nullptr if unsupported. */
+static GstStructure *
+fourcc_to_bare_struct(unsigned int fourcc)
+{
+	if (fourcc == V4L2_PIX_FMT_MJPEG)
+		return gst_structure_new_empty("image/jpeg");
+
+	GstVideoFormat gst_format = fourcc_to_gst_format(fourcc);
+	if (gst_format == GST_VIDEO_FORMAT_UNKNOWN)
+		return nullptr;
+
+	return gst_structure_new("video/x-raw", "format", G_TYPE_STRING,
+				 gst_video_format_to_string(gst_format),
+				 nullptr);
+}
+
+GstCaps *
+gst_libcamera_stream_formats_to_caps(const StreamFormats &formats)
+{
+	GstCaps *caps = gst_caps_new_empty();
+
+	for (unsigned int fourcc : formats.pixelformats()) {
+		GstStructure *bare_s = fourcc_to_bare_struct(fourcc);
+		if (!bare_s) {
+			GST_WARNING("Unsupported pixel format 0x%08x", fourcc);
+			continue;
+		}
+
+		for (const Size &size : formats.sizes(fourcc)) {
+			GstStructure *s = gst_structure_copy(bare_s);
+			gst_structure_set(s,
+					  "width", G_TYPE_INT, size.width,
+					  "height", G_TYPE_INT, size.height,
+					  nullptr);
+			gst_caps_append_structure(caps, s);
+		}
+
+		/* Formats without discrete sizes are described by a range. */
+		const SizeRange range = formats.range(fourcc);
+		if (formats.sizes(fourcc).empty() && range.max.width &&
+		    range.max.height) {
+			GstStructure *s = gst_structure_copy(bare_s);
+			gst_structure_set(s,
+					  "width", GST_TYPE_INT_RANGE,
+					  range.min.width, range.max.width,
+					  "height", GST_TYPE_INT_RANGE,
+					  range.min.height, range.max.height,
+					  nullptr);
+			gst_caps_append_structure(caps, s);
+		}
+
+		gst_structure_free(bare_s);
+	}
+
+	return caps;
+}
+
+GstCaps *
+gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg)
+{
+	GstStructure *s = fourcc_to_bare_struct(stream_cfg.pixelFormat);
+	if (!s)
+		return gst_caps_new_empty();
+
+	gst_structure_set(s,
+			  "width", G_TYPE_INT, stream_cfg.size.width,
+			  "height", G_TYPE_INT, stream_cfg.size.height,
+			  nullptr);
+
+	GstCaps *caps = gst_caps_new_empty();
+	gst_caps_append_structure(caps, s);
+
+	return caps;
+}
+
+/*
+ * Update the stream configuration with the fixed \a caps. The configuration
+ * still needs to be validated, and may be adjusted by the pipeline handler.
+ */
+void
+gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
+					 GstCaps *caps)
+{
+	GstStructure *s = gst_caps_get_structure(caps, 0);
+	gint width, height;
+
+	if (gst_structure_has_name(s, "image/jpeg")) {
+		stream_cfg.pixelFormat = V4L2_PIX_FMT_MJPEG;
+	} else if (gst_structure_has_name(s, "video/x-raw")) {
+		const gchar *format = gst_structure_get_string(s, "format");
+		GstVideoFormat gst_format = gst_video_format_from_string(format);
+		stream_cfg.pixelFormat = gst_format_to_fourcc(gst_format);
+	}
+
+	if (gst_structure_get_int(s, "width", &width) &&
+	    gst_structure_get_int(s, "height", &height)) {
+		stream_cfg.size.width = width;
+		stream_cfg.size.height = height;
+	}
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-utils.h - GStreamer libcamera utility functions
+ */
+#ifndef __GST_LIBCAMERA_UTILS_H__
+#define __GST_LIBCAMERA_UTILS_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <libcamera/stream.h>
+
+GstCaps *gst_libcamera_stream_formats_to_caps(const libcamera::StreamFormats &formats);
+GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfiguration &stream_cfg);
+void gst_libcamera_configure_stream_from_caps(libcamera::StreamConfiguration &stream_cfg,
+					      GstCaps *caps);
+
+/* Lock the object lock of a GstObject for the lifetime of the locker. */
+class GLibLocker
+{
+public:
+	GLibLocker(GstObject *object)
+		: mutex_(GST_OBJECT_GET_LOCK(object))
+	{
+		g_mutex_lock(mutex_);
+	}
+
+	~GLibLocker()
+	{
+		g_mutex_unlock(mutex_);
+	}
+
+private:
+	GMutex *mutex_;
+};
+
+#endif /* __GST_LIBCAMERA_UTILS_H__ */
@@ -0,0 +1,1006 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerasrc.cpp - GStreamer capture element
+ */
+
+/**
+ * \todo Expose the camera controls as element properties
+ * \todo Support renegotiation without restarting the camera
+ */
+
+#include "gstlibcamerasrc.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <time.h>
+#include <vector>
+
+#include <gst/allocators/allocators.h>
+#include <gst/base/base.h>
+#include <gst/video/video.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "gstlibcamera-thread.h"
+#include "gstlibcamera-utils.h"
+#include "gstlibcamerapad.h"
+
+using namespace libcamera;
+
+GST_DEBUG_CATEGORY_STATIC(source_debug);
+#define GST_CAT_DEFAULT source_debug
+
+/* A captured frame, holding one buffer per source pad. */
+struct Frame {
+	std::vector<BufferRef> buffers;
+};
+
+/*
+ * The element state shared between the GStreamer streaming thread and the
+ * camera thread. The camera and its configuration are only accessed from the
+ * camera thread once the camera has been acquired, except for the immutable
+ * data read by the streaming thread while the camera is running.
+ */
+struct GstLibcameraSrcState {
+	GstLibcameraSrc *src;
+
+	std::shared_ptr<CameraThread> thread;
+	std::shared_ptr<Camera> camera;
+	std::unique_ptr<CameraConfiguration> config;
+	std::vector<GstPad *> srcpads;
+	std::vector<GstVideoInfo> infos;
+
+	/* Buffers available for capture, accessed from the camera thread. */
+	std::vector<std::deque<Buffer *>> freeBuffers;
+
+	std::mutex lock;
+	std::condition_variable cv;
+	std::deque<std::unique_ptr<Frame>> frames;
+	bool flushing;
+	bool running;
+	bool eos;
+
+	int streamIndex(Stream *stream) const;
+	void queueRequests();
+	void requestCompleted(Request *request, const Request::BufferMap &buffers);
+	void bufferReleased(Buffer *buffer);
+	void requeueBuffer(Buffer *buffer);
+};
+
+struct _GstLibcameraSrc {
+	GstElement parent;
+
+	GRecMutex stream_lock;
+	GstTask *task;
+
+	gchar *camera_name;
+
+	GstLibcameraSrcState *state;
+	GstFlowCombiner *flow_combiner;
+	GstAllocator *allocator;
+};
+
+enum {
+	PROP_0,
+	PROP_CAMERA_NAME
+};
+
+G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
+			GST_DEBUG_CATEGORY_INIT(source_debug, "libcamerasrc", 0,
+						"libcamera Source"));
+
+#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; image/jpeg")
+
+/* For the simple case, we have a first pad that is always present. */
+GstStaticPadTemplate src_template = {
+	"src", GST_PAD_SRC, GST_PAD_ALWAYS, TEMPLATE_CAPS
+};
+
+/* More pads can be requested in state < PAUSED. */
+GstStaticPadTemplate request_src_template = {
+	"src_%u", GST_PAD_SRC, GST_PAD_REQUEST, TEMPLATE_CAPS
+};
+
+static GQuark
+gst_libcamera_buffer_quark()
+{
+	static GQuark quark = 0;
+
+	if (!quark)
+		quark = g_quark_from_static_string("GstLibcameraBufferRef");
+
+	return quark;
+}
+
+int GstLibcameraSrcState::streamIndex(Stream *stream) const
+{
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		if (config->at(i).stream() == stream)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Queue requests as long as a buffer is available for every stream. Called
+ * from the camera thread.
+ */
+void GstLibcameraSrcState::queueRequests()
+{
+	while (running) {
+		for (const std::deque<Buffer *> &buffers : freeBuffers) {
+			if (buffers.empty())
+				return;
+		}
+
+		Request *request = camera->createRequest();
+		if (!request) {
+			GST_ERROR_OBJECT(src, "Failed to create request");
+			return;
+		}
+
+		for (std::deque<Buffer *> &buffers : freeBuffers) {
+			Buffer *buffer = buffers.front();
+			buffers.pop_front();
+			request->addBuffer(buffer);
+		}
+
+		int ret = camera->queueRequest(request);
+		if (ret < 0) {
+			GST_ERROR_OBJECT(src, "Failed to queue request: %s",
+					 g_strerror(-ret));
+
+			for (const auto &item : request->buffers()) {
+				int index = streamIndex(item.first);
+				freeBuffers[index].push_back(item.second);
+			}
+
+			delete request;
+			return;
+		}
+	}
+}
+
+/* Called from the camera thread. */
+void GstLibcameraSrcState::requestCompleted(Request *request,
+					    const Request::BufferMap &buffers)
+{
+	bool failed = request->status() != Request::RequestComplete;
+	for (const auto &item : buffers) {
+		if (item.second->status() != Buffer::BufferSuccess)
+			failed = true;
+	}
+
+	/*
+	 * Buffers of failed requests are returned to the free lists right
+	 * away. The buffers of completed requests are held by the frame, and
+	 * requeued through Stream::bufferReleased when GStreamer releases
+	 * them.
+	 */
+	if (failed) {
+		for (const auto &item : buffers) {
+			int index = streamIndex(item.first);
+			freeBuffers[index].push_back(item.second);
+		}
+
+		queueRequests();
+		return;
+	}
+
+	std::unique_ptr<Frame> frame(new Frame());
+	frame->buffers.resize(config->size());
+	for (const auto &item : buffers) {
+		int index = streamIndex(item.first);
+		frame->buffers[index] = BufferRef(item.second);
+	}
+
+	std::lock_guard<std::mutex> locker(lock);
+	frames.push_back(std::move(frame));
+	cv.notify_all();
+}
+
+/*
+ * Called from the thread releasing the last reference to the buffer, which
+ * may be any GStreamer thread.
+ */
+void GstLibcameraSrcState::bufferReleased(Buffer *buffer)
+{
+	std::lock_guard<std::mutex> locker(lock);
+	if (!running)
+		return;
+
+	thread->post([this, buffer]() { requeueBuffer(buffer); });
+}
+
+/* Called from the camera thread. */
+void GstLibcameraSrcState::requeueBuffer(Buffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(lock);
+		if (!running)
+			return;
+	}
+
+	int index = streamIndex(buffer->stream());
+	if (index < 0)
+		return;
+
+	freeBuffers[index].push_back(buffer);
+	queueRequests();
+}
+
+static void
+gst_libcamera_buffer_ref_destroy(gpointer data)
+{
+	delete static_cast<BufferRef *>(data);
+}
+
+/*
+ * Convert a buffer timestamp, expressed in nanoseconds on the clock reported
+ * by the buffer, to the element running time.
+ */
+static GstClockTime
+gst_libcamera_src_timestamp(GstLibcameraSrc *self, const Buffer *buffer)
+{
+	GstClock *clock = gst_element_get_clock(GST_ELEMENT(self));
+	if (!clock)
+		return GST_CLOCK_TIME_NONE;
+
+	clockid_t clockid;
+	switch (buffer->timestampClock()) {
+	case Buffer::ClockBoottime:
+		clockid = CLOCK_BOOTTIME;
+		break;
+	case Buffer::ClockRealtime:
+		clockid = CLOCK_REALTIME;
+		break;
+	default:
+		clockid = CLOCK_MONOTONIC;
+		break;
+	}
+
+	uint64_t timestamp = buffer->timestamp();
+	struct timespec ts;
+	clock_gettime(clockid, &ts);
+	uint64_t sys_now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	GstClockTime gst_now = gst_clock_get_time(clock);
+	GstClockTime base_time = gst_element_get_base_time(GST_ELEMENT(self));
+	gst_object_unref(clock);
+
+	uint64_t age = sys_now > timestamp ? sys_now - timestamp : 0;
+	if (gst_now < base_time + age)
+		return 0;
+
+	return gst_now - base_time - age;
+}
+
+/*
+ * Wrap the dmabufs of a captured buffer in a GstBuffer without copying. Each
+ * memory holds a reference to the libcamera buffer, released when GStreamer
+ * frees the memory.
+ */
+static GstBuffer *
+gst_libcamera_src_wrap_buffer(GstLibcameraSrc *self, const BufferRef &ref,
+			      const GstVideoInfo *info)
+{
+	Buffer *buffer = ref.buffer();
+	GstBuffer *gstbuf = gst_buffer_new();
+	gsize offset = 0;
+
+	gsize offsets[GST_VIDEO_MAX_PLANES] = {};
+	gint strides[GST_VIDEO_MAX_PLANES] = {};
+	for (unsigned int i = 0; i < GST_VIDEO_INFO_N_PLANES(info); ++i) {
+		offsets[i] = GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+		strides[i] = GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+	}
+
+	const PlaneArray &planes = buffer->mem()->planes();
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		const Plane &plane = planes[i];
+		GstMemory *mem = gst_fd_allocator_alloc(self->allocator,
+							plane.dmabuf(),
+							plane.length(),
+							GST_FD_MEMORY_FLAG_DONT_CLOSE);
+		gst_mini_object_set_qdata(GST_MINI_OBJECT(mem),
+					  gst_libcamera_buffer_quark(),
+					  new BufferRef(ref),
+					  gst_libcamera_buffer_ref_destroy);
+		gst_buffer_append_memory(gstbuf, mem);
+
+		/* Planes stored in separate dmabufs follow each other. */
+		if (planes.size() > 1 && i < GST_VIDEO_MAX_PLANES)
+			offsets[i] = offset;
+		offset += plane.length();
+	}
+
+	if (GST_VIDEO_INFO_FORMAT(info) != GST_VIDEO_FORMAT_UNKNOWN &&
+	    GST_VIDEO_INFO_FORMAT(info) != GST_VIDEO_FORMAT_ENCODED)
+		gst_buffer_add_video_meta_full(gstbuf, GST_VIDEO_FRAME_FLAG_NONE,
+					       GST_VIDEO_INFO_FORMAT(info),
+					       GST_VIDEO_INFO_WIDTH(info),
+					       GST_VIDEO_INFO_HEIGHT(info),
+					       GST_VIDEO_INFO_N_PLANES(info),
+					       offsets, strides);
+
+	/* Compressed frames are smaller than their buffer. */
+	if (planes.size() == 1 && buffer->bytesused())
+		gst_buffer_set_size(gstbuf, buffer->bytesused());
+
+	GST_BUFFER_PTS(gstbuf) = gst_libcamera_src_timestamp(self, buffer);
+	GST_BUFFER_OFFSET(gstbuf) = buffer->sequence();
+	GST_BUFFER_OFFSET_END(gstbuf) = buffer->sequence() + 1;
+
+	return gstbuf;
+}
+
+static void
+gst_libcamera_src_task_run(gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+	std::unique_ptr<Frame> frame;
+	bool eos;
+
+	{
+		std::unique_lock<std::mutex> locker(state->lock);
+		state->cv.wait(locker, [&]() {
+			return state->flushing || state->eos ||
+			       !state->frames.empty();
+		});
+
+		if (state->flushing)
+			return;
+
+		eos = state->eos;
+		if (!eos) {
+			frame = std::move(state->frames.front());
+			state->frames.pop_front();
+		}
+	}
+
+	if (eos) {
+		GST_DEBUG_OBJECT(self, "Pushing EOS");
+		for (GstPad *srcpad : state->srcpads)
+			gst_pad_push_event(srcpad, gst_event_new_eos());
+		gst_task_pause(self->task);
+		return;
+	}
+
+	GstFlowReturn ret = GST_FLOW_OK;
+	for (unsigned int i = 0; i < state->srcpads.size(); ++i) {
+		GstPad *srcpad = state->srcpads[i];
+		GstBuffer *gstbuf = gst_libcamera_src_wrap_buffer(self,
+								  frame->buffers[i],
+								  &state->infos[i]);
+
+		/* The GstBuffer now holds the libcamera buffer. */
+		frame->buffers[i].reset();
+
+		ret = gst_pad_push(srcpad, gstbuf);
+		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
+							srcpad, ret);
+	}
+
+	switch (ret) {
+	case GST_FLOW_OK:
+		break;
+
+	case GST_FLOW_EOS: {
+		GST_DEBUG_OBJECT(self, "Downstream reached EOS");
+		for (GstPad *srcpad : state->srcpads)
+			gst_pad_push_event(srcpad, gst_event_new_eos());
+		gst_task_pause(self->task);
+		break;
+	}
+
+	case GST_FLOW_FLUSHING:
+		gst_task_pause(self->task);
+		break;
+
+	default:
+		GST_ELEMENT_FLOW_ERROR(self, ret);
+		for (GstPad *srcpad : state->srcpads)
+			gst_pad_push_event(srcpad, gst_event_new_eos());
+		gst_task_pause(self->task);
+		break;
+	}
+}
+
+/*
+ * Negotiate the stream configurations with downstream, then configure and
+ * start the camera. Called from the streaming thread.
+ */
+static void
+gst_libcamera_src_task_enter(GstTask *task, GThread *thread, gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+	GstFlowReturn flow_ret = GST_FLOW_OK;
+	int ret;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread has started");
+
+	StreamRoles roles;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		for (GstPad *srcpad : state->srcpads)
+			roles.push_back(gst_libcamera_pad_get_role(srcpad));
+	}
+
+	ret = state->thread->call([&]() {
+		state->config = state->camera->generateConfiguration(roles);
+		return state->config ? 0 : -EINVAL;
+	});
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to generate camera configuration"),
+				  ("The camera does not support the requested stream roles"));
+		gst_task_stop(task);
+		return;
+	}
+
+	g_assert(state->config->size() == state->srcpads.size());
+
+	for (unsigned int i = 0; i < state->srcpads.size(); ++i) {
+		GstPad *srcpad = state->srcpads[i];
+		StreamConfiguration &stream_cfg = state->config->at(i);
+
+		/* Retrieve the supported caps. */
+		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
+		if (gst_caps_is_empty(caps)) {
+			flow_ret = GST_FLOW_NOT_NEGOTIATED;
+			break;
+		}
+
+		/* Fixate caps and configure the stream. */
+		caps = gst_caps_make_writable(caps);
+		caps = gst_caps_fixate(caps);
+		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
+	}
+
+	if (flow_ret != GST_FLOW_OK)
+		goto done;
+
+	/* Validate the configuration. */
+	ret = state->thread->call([&]() {
+		return state->config->validate() == CameraConfiguration::Invalid
+		       ? -EINVAL : 0;
+	});
+	if (ret) {
+		flow_ret = GST_FLOW_NOT_NEGOTIATED;
+		goto done;
+	}
+
+	/*
+	 * Report the negotiated caps downstream, as the configuration may have
+	 * been adjusted by the pipeline handler.
+	 */
+	state->infos.resize(state->srcpads.size());
+	for (unsigned int i = 0; i < state->srcpads.size(); ++i) {
+		GstPad *srcpad = state->srcpads[i];
+		const StreamConfiguration &stream_cfg = state->config->at(i);
+
+		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+		if (gst_caps_is_empty(caps) || !gst_pad_peer_query_accept_caps(srcpad, caps)) {
+			flow_ret = GST_FLOW_NOT_NEGOTIATED;
+			break;
+		}
+
+		gst_video_info_init(&state->infos[i]);
+		if (gst_structure_has_name(gst_caps_get_structure(caps, 0),
+					   "video/x-raw"))
+			gst_video_info_from_caps(&state->infos[i], caps);
+
+		g_autofree gchar *stream_id =
+			gst_pad_create_stream_id_printf(srcpad, GST_ELEMENT(self),
+							"%u", i);
+		GstEvent *event = gst_event_new_stream_start(stream_id);
+		gst_event_set_group_id(event, gst_util_group_id_next());
+		gst_pad_push_event(srcpad, event);
+		gst_pad_push_event(srcpad, gst_event_new_caps(caps));
+
+		GstSegment segment;
+		gst_segment_init(&segment, GST_FORMAT_TIME);
+		gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
+	}
+
+	if (flow_ret != GST_FLOW_OK)
+		goto done;
+
+	{
+		std::lock_guard<std::mutex> locker(state->lock);
+		state->running = true;
+	}
+
+	ret = state->thread->call([&]() {
+		int ret = state->camera->configure(state->config.get());
+		if (ret) {
+			GST_ERROR_OBJECT(self, "Failed to configure the camera: %s",
+					 g_strerror(-ret));
+			return ret;
+		}
+
+		ret = state->camera->allocateBuffers();
+		if (ret) {
+			GST_ERROR_OBJECT(self, "Failed to allocate buffers: %s",
+					 g_strerror(-ret));
+			return ret;
+		}
+
+		state->freeBuffers.clear();
+		state->freeBuffers.resize(state->config->size());
+		for (unsigned int i = 0; i < state->config->size(); ++i) {
+			const StreamConfiguration &stream_cfg = state->config->at(i);
+			Stream *stream = stream_cfg.stream();
+
+			stream->bufferReleased.connect(state, &GstLibcameraSrcState::bufferReleased);
+			for (unsigned int j = 0; j < stream_cfg.bufferCount; ++j)
+				state->freeBuffers[i].push_back(stream->buffer(j));
+		}
+
+		state->camera->requestCompleted.connect(state, &GstLibcameraSrcState::requestCompleted);
+
+		ret = state->camera->start();
+		if (ret) {
+			GST_ERROR_OBJECT(self, "Failed to start the camera: %s",
+					 g_strerror(-ret));
+			return ret;
+		}
+
+		state->queueRequests();
+		return 0;
+	});
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, FAILED,
+				  ("Failed to start the camera"),
+				  ("Camera.start() failed with error code %i", ret));
+		gst_task_stop(task);
+		return;
+	}
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		for (GstPad *srcpad : state->srcpads) {
+			gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
+		}
+	}
+
+done:
+	switch (flow_ret) {
+	case GST_FLOW_NOT_NEGOTIATED:
+		GST_ELEMENT_FLOW_ERROR(self, flow_ret);
+		gst_task_stop(task);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Stop the camera and free its buffers. Called from the streaming thread. */
+static void
+gst_libcamera_src_task_leave(GstTask *task, GThread *thread, gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread is about to stop");
+
+	bool running;
+	{
+		std::lock_guard<std::mutex> locker(state->lock);
+		running = state->running;
+		state->running = false;
+	}
+
+	if (running) {
+		state->thread->call([&]() {
+			state->camera->stop();
+			state->camera->requestCompleted.disconnect(state);
+
+			for (unsigned int i = 0; i < state->config->size(); ++i) {
+				Stream *stream = state->config->at(i).stream();
+				if (stream)
+					stream->bufferReleased.disconnect(state);
+			}
+
+			return 0;
+		});
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(state->lock);
+		state->frames.clear();
+	}
+
+	if (running) {
+		state->thread->call([&]() {
+			/*
+			 * Buffers still held downstream can't be freed safely.
+			 * This only happens when downstream elements keep
+			 * buffers after being flushed.
+			 */
+			for (unsigned int i = 0; i < state->config->size(); ++i) {
+				Stream *stream = state->config->at(i).stream();
+				if (stream && stream->heldBuffers())
+					GST_WARNING_OBJECT(self, "%u buffers still held downstream",
+							   stream->heldBuffers());
+			}
+
+			state->freeBuffers.clear();
+			state->camera->freeBuffers();
+			return 0;
+		});
+	}
+
+	state->thread->call([&]() {
+		state->config.reset();
+		return 0;
+	});
+
+	gst_flow_combiner_reset(self->flow_combiner);
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		for (GstPad *srcpad : state->srcpads)
+			gst_flow_combiner_remove_pad(self->flow_combiner, srcpad);
+	}
+}
+
+static gboolean
+gst_libcamera_src_open(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+	std::shared_ptr<Camera> cam;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Opening camera device ...");
+
+	state->thread = CameraThread::get();
+	if (!state->thread) {
+		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
+				  ("Failed to start the camera manager"),
+				  ("CameraManager.start() failed"));
+		return false;
+	}
+
+	g_autofree gchar *camera_name = nullptr;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		camera_name = g_strdup(self->camera_name);
+	}
+
+	ret = state->thread->call([&]() {
+		CameraManager *cm = state->thread->manager();
+
+		if (camera_name) {
+			cam = cm->get(camera_name);
+			if (!cam)
+				return -ENODEV;
+		} else {
+			if (cm->cameras().empty())
+				return -ENODEV;
+			cam = cm->cameras()[0];
+		}
+
+		return cam->acquire();
+	});
+	if (ret == -ENODEV) {
+		if (camera_name)
+			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+					  ("Could not find a camera named '%s'.", camera_name),
+					  ("libcamera::CameraMananger::get() returned nullptr"));
+		else
+			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+					  ("Could not find any supported camera on this system."),
+					  ("libcamera::CameraMananger::cameras() is empty"));
+		state->thread.reset();
+		return false;
+	} else if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, BUSY,
+				  ("Camera name '%s' is already in use.",
+				   cam->name().c_str()),
+				  ("libcamera::Camera::acquire() failed: %s",
+				   g_strerror(-ret)));
+		state->thread->call([&]() { cam.reset(); return 0; });
+		state->thread.reset();
+		return false;
+	}
+
+	GST_INFO_OBJECT(self, "Using camera named '%s'", cam->name().c_str());
+
+	state->camera = cam;
+
+	return true;
+}
+
+static void
+gst_libcamera_src_close(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	GST_DEBUG_OBJECT(self, "Releasing resources");
+
+	if (!state->thread || !state->camera)
+		return;
+
+	state->thread->call([&]() {
+		int ret = state->camera->release();
+		if (ret)
+			GST_ELEMENT_WARNING(self, RESOURCE, BUSY,
+					    ("Camera name '%s' is still in use.",
+					     state->camera->name().c_str()),
+					    ("libcamera::Camera.release() failed: %s",
+					     g_strerror(-ret)));
+
+		state->camera.reset();
+		return 0;
+	});
+
+	state->thread.reset();
+}
+
+static void
+gst_libcamera_src_set_property(GObject *object, guint prop_id,
+			       const GValue *value, GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAME:
+		g_free(self->camera_name);
+		self->camera_name = g_value_dup_string(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
+			       GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAME:
+		g_value_set_string(value, self->camera_name);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_set_flushing(GstLibcameraSrc *self, bool flushing)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	std::lock_guard<std::mutex> locker(state->lock);
+	state->flushing = flushing;
+	if (!flushing)
+		state->eos = false;
+	state->cv.notify_all();
+}
+
+static GstStateChangeReturn
+gst_libcamera_src_change_state(GstElement *element, GstStateChange transition)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_src_parent_class);
+
+	switch (transition) {
+	case GST_STATE_CHANGE_NULL_TO_READY:
+		if (!gst_libcamera_src_open(self))
+			return GST_STATE_CHANGE_FAILURE;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		/* Unblock the streaming thread before stopping it. */
+		gst_libcamera_src_set_flushing(self, true);
+		gst_task_stop(self->task);
+		break;
+	default:
+		break;
+	}
+
+	ret = klass->change_state(element, transition);
+	if (ret == GST_STATE_CHANGE_FAILURE)
+		return ret;
+
+	switch (transition) {
+	case GST_STATE_CHANGE_READY_TO_PAUSED:
+		/* This needs to be called after pads activation. */
+		gst_libcamera_src_set_flushing(self, false);
+		if (!gst_task_pause(self->task))
+			return GST_STATE_CHANGE_FAILURE;
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+		gst_task_start(self->task);
+		break;
+	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		/*
+		 * \todo this might require some thread unblocking in the future
+		 * if the streaming thread starts doing any kind of blocking
+		 * operations. If this was the case, we would need to do so
+		 * before pad deactivation, so before chaining to the parent
+		 * change_state function.
+		 */
+		gst_task_join(self->task);
+		break;
+	case GST_STATE_CHANGE_READY_TO_NULL:
+		gst_libcamera_src_close(self);
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+static gboolean
+gst_libcamera_src_send_event(GstElement *element, GstEvent *event)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	GstLibcameraSrcState *state = self->state;
+	gboolean ret = FALSE;
+
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_EOS: {
+		std::lock_guard<std::mutex> locker(state->lock);
+		state->eos = true;
+		state->cv.notify_all();
+		ret = TRUE;
+		break;
+	}
+	default:
+		break;
+	}
+
+	gst_event_unref(event);
+
+	return ret;
+}
+
+static void
+gst_libcamera_src_finalize(GObject *object)
+{
+	GObjectClass *klass = G_OBJECT_CLASS(gst_libcamera_src_parent_class);
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	g_rec_mutex_clear(&self->stream_lock);
+	g_clear_object(&self->task);
+	g_clear_object(&self->allocator);
+	g_free(self->camera_name);
+	gst_flow_combiner_free(self->flow_combiner);
+	delete self->state;
+
+	return klass->finalize(object);
+}
+
+static void
+gst_libcamera_src_init(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = new GstLibcameraSrcState();
+	GstPadTemplate *templ = gst_element_get_pad_template(GST_ELEMENT(self), "src");
+
+	g_rec_mutex_init(&self->stream_lock);
+	self->task = gst_task_new(gst_libcamera_src_task_run, self, nullptr);
+	gst_task_set_enter_callback(self->task, gst_libcamera_src_task_enter, self, nullptr);
+	gst_task_set_leave_callback(self->task, gst_libcamera_src_task_leave, self, nullptr);
+	gst_task_set_lock(self->task, &self->stream_lock);
+
+	self->allocator = gst_dmabuf_allocator_new();
+	self->flow_combiner = gst_flow_combiner_new();
+
+	state->src = self;
+	state->flushing = true;
+	state->running = false;
+	state->eos = false;
+	state->srcpads.push_back(gst_pad_new_from_template(templ, "src"));
+	gst_element_add_pad(GST_ELEMENT(self), state->srcpads[0]);
+
+	/* C-style friend. */
+	self->state = state;
+}
+
+static GstPad *
+gst_libcamera_src_request_new_pad(GstElement *element, GstPadTemplate *templ,
+				  const gchar *name,
+				  const GstCaps *caps)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	g_autoptr(GstPad) pad = nullptr;
+
+	GST_DEBUG_OBJECT(self, "new request pad created");
+
+	pad = gst_pad_new_from_template(templ, name);
+	g_object_ref_sink(pad);
+
+	if (gst_element_add_pad(element, pad)) {
+		GLibLocker lock(GST_OBJECT(self));
+		self->state->srcpads.push_back(reinterpret_cast<GstPad *>(g_object_ref(pad)));
+	} else {
+		GST_ELEMENT_ERROR(element, STREAM, FAILED,
+				  ("Internal data stream error."),
+				  ("Could not add pad to element"));
+		return nullptr;
+	}
+
+	return reinterpret_cast<GstPad *>(g_steal_pointer(&pad));
+}
+
+static void
+gst_libcamera_src_release_pad(GstElement *element, GstPad *pad)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+
+	GST_DEBUG_OBJECT(self, "Pad %" GST_PTR_FORMAT " being released", pad);
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		std::vector<GstPad *> &pads = self->state->srcpads;
+		auto begin_iterator = pads.begin();
+		auto end_iterator = pads.end();
+		auto pad_iterator = std::find(begin_iterator, end_iterator, pad);
+
+		if (pad_iterator != end_iterator) {
+			g_object_unref(*pad_iterator);
+			pads.erase(pad_iterator);
+		}
+	}
+	gst_element_remove_pad(element, pad);
+}
+
+static void
+gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
+{
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->set_property = gst_libcamera_src_set_property;
+	object_class->get_property = gst_libcamera_src_get_property;
+	object_class->finalize = gst_libcamera_src_finalize;
+
+	element_class->request_new_pad = gst_libcamera_src_request_new_pad;
+	element_class->release_pad = gst_libcamera_src_release_pad;
+	element_class->change_state = gst_libcamera_src_change_state;
+	element_class->send_event = gst_libcamera_src_send_event;
+
+	gst_element_class_set_metadata(element_class,
+				       "libcamera Source", "Source/Video",
+				       "Linux Camera source using libcamera",
+				       "Nicolas Dufresne <nicolas.dufresne@collabora.com");
+	gst_element_class_add_static_pad_template_with_gtype(element_class,
+							      &src_template,
+							      GST_TYPE_LIBCAMERA_PAD);
+	gst_element_class_add_static_pad_template_with_gtype(element_class,
+							      &request_src_template,
+							      GST_TYPE_LIBCAMERA_PAD);
+
+	GParamSpec *spec = g_param_spec_string("camera-name", "Camera Name",
+					       "Select by name which camera to use.", nullptr,
+					       (GParamFlags)(GST_PARAM_MUTABLE_READY
+							     | G_PARAM_CONSTRUCT
+							     | G_PARAM_READWRITE
+							     | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+}
@@ -0,0 +1,492 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipu3.cpp - IPU3 Image Processing Algorithms
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/intel-ipu3.h>
+#include <linux/v4l2-controls.h>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/ipa_module_info.h>
+#include <ipa/ipu3.h>
+#include <libcamera/buffer.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "log.h"
+#include "utils.h"
+
+#include "../libipa/ipa_interface_wrapper.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAIPU3)
+
+/*
+ * Default Bayer noise reduction configuration, from the ImgU CSS firmware. The
+ * white balance gains, optical center and column size are computed for each
+ * frame.
+ */
+static const ipu3_uapi_bnr_static_config bnrDefaults = {
+	{ 8192, 8192, 8192, 8192 },		/* wb_gains */
+	{ 255, 255, 255, 255 },			/* wb_gains_thr */
+	{ 1700, 0, 31, 31, 0, 16 },		/* thr_coeffs */
+	{ 26, 26, 26, 26 },			/* thr_ctrl_shd */
+	{ -648, 0, -366, 0 },			/* opt_center */
+	{ {					/* lut */
+		17, 23, 28, 32, 36, 39, 42, 45,
+		48, 51, 53, 55, 58, 60, 62, 64,
+		66, 68, 70, 72, 73, 75, 77, 78,
+		80, 82, 83, 85, 86, 88, 89, 90,
+	} },
+	{ 20, 0, 1, 40, 0, 6, 0, 6, 0 },	/* bp_ctrl */
+	{ 9, 3, 4, 0, 8, 0, 1, 1, 1, 1, 0 },	/* dn_detect_ctrl */
+	1296,					/* column_size */
+	{ 419904, 133956 },			/* opt_center_sqr */
+};
+
+class IPAIPU3 : public IPAInterface
+{
+public:
+	IPAIPU3()
+		: sensorControls_(controls::controls), autoExposure_(false),
+		  autoWhiteBalance_(true)
+	{
+	}
+
+	int init() override { return 0; }
+
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, ControlInfoMap> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+
+private:
+	/* The BNR white balance gains are unsigned 3.13 fixed point values. */
+	static constexpr unsigned int AWB_GAIN_UNITY = 8192;
+	static constexpr unsigned int AWB_GAIN_MAX = 65535;
+
+	/* Bounds of the AWB statistics grid, in cells. */
+	static constexpr unsigned int AWB_GRID_MAX_WIDTH = 160;
+	static constexpr unsigned int AWB_GRID_MAX_HEIGHT = 56;
+
+	/* Depth of the per-frame AWB gains history. */
+	static constexpr unsigned int FRAME_DEPTH = 16;
+
+	struct AwbGains {
+		double red;
+		double blue;
+	};
+
+	void configureGrid(const Size &bdsSize);
+	void fillParams(unsigned int frame, ipu3_uapi_params *params);
+
+	void queueRequest(unsigned int frame, BufferMemory &mem,
+			  const ControlList &controls);
+	void updateStatistics(unsigned int frame, BufferMemory &mem);
+
+	void setControls(unsigned int frame);
+	void metadataReady(unsigned int frame, unsigned int aeState,
+			   ControlList &ctrls);
+
+	std::map<unsigned int, BufferMemory> bufferInfo_;
+
+	ControlInfoMap ctrls_;
+	ControlList sensorControls_;
+
+	/* Camera sensor controls. */
+	bool autoExposure_;
+	uint32_t exposure_;
+	uint32_t minExposure_;
+	uint32_t maxExposure_;
+	uint32_t gain_;
+	uint32_t minGain_;
+	uint32_t maxGain_;
+
+	/* ISP algorithms state. */
+	bool autoWhiteBalance_;
+	Size bdsSize_;
+	ipu3_uapi_grid_config awbGrid_;
+	unsigned int awbStride_;
+	AwbGains awbGains_;
+	std::array<AwbGains, FRAME_DEPTH> frameGains_;
+
+	/* Luminance of the AWB grid cells of the current and previous frames. */
+	std::vector<uint8_t> luma_;
+	std::vector<uint8_t> prevLuma_;
+};
+
+void IPAIPU3::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			const std::map<unsigned int, ControlInfoMap> &entityControls)
+{
+	autoExposure_ = false;
+	prevLuma_.clear();
+
+	/*
+	 * The statistics are measured on the BDS output, whose size is passed
+	 * as stream 1. Start the white balance from unity gains.
+	 */
+	auto itBds = streamConfig.find(1);
+	configureGrid(itBds != streamConfig.end() ? itBds->second.size : Size{});
+	awbGains_ = { 1.0, 1.0 };
+	frameGains_.fill(awbGains_);
+
+	if (entityControls.empty())
+		return;
+
+	ctrls_ = entityControls.at(0);
+	sensorControls_ = ControlList(ctrls_);
+
+	const auto itExp = ctrls_.find(V4L2_CID_EXPOSURE);
+	if (itExp == ctrls_.end()) {
+		LOG(IPAIPU3, Error) << "Can't find exposure control";
+		return;
+	}
+
+	const auto itGain = ctrls_.find(V4L2_CID_ANALOGUE_GAIN);
+	if (itGain == ctrls_.end()) {
+		LOG(IPAIPU3, Error) << "Can't find gain control";
+		return;
+	}
+
+	autoExposure_ = true;
+
+	minExposure_ = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	maxExposure_ = itExp->second.max().get<int32_t>();
+	exposure_ = minExposure_;
+
+	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
+	maxGain_ = itGain->second.max().get<int32_t>();
+	gain_ = minGain_;
+
+	LOG(IPAIPU3, Info)
+		<< "Exposure: " << minExposure_ << "-" << maxExposure_
+		<< " Gain: " << minGain_ << "-" << maxGain_;
+
+	setControls(0);
+}
+
+/*
+ * Cover the BDS output with the largest AWB grid the ImgU supports, using the
+ * smallest cells that keep the grid within bounds.
+ */
+void IPAIPU3::configureGrid(const Size &bdsSize)
+{
+	bdsSize_ = bdsSize;
+
+	unsigned int widthLog2 = 3;
+	while (widthLog2 < 7 && (bdsSize.width >> widthLog2) > AWB_GRID_MAX_WIDTH)
+		widthLog2++;
+
+	unsigned int heightLog2 = 3;
+	while (heightLog2 < 7 && (bdsSize.height >> heightLog2) > AWB_GRID_MAX_HEIGHT)
+		heightLog2++;
+
+	memset(&awbGrid_, 0, sizeof(awbGrid_));
+	awbGrid_.width = std::min<unsigned int>(bdsSize.width >> widthLog2,
+						AWB_GRID_MAX_WIDTH);
+	awbGrid_.height = std::min<unsigned int>(bdsSize.height >> heightLog2,
+						 AWB_GRID_MAX_HEIGHT);
+	awbGrid_.block_width_log2 = widthLog2;
+	awbGrid_.block_height_log2 = heightLog2;
+	awbGrid_.height_per_slice = 2;
+	awbGrid_.x_start = 0;
+	awbGrid_.y_start = 0;
+	awbGrid_.x_end = std::max<int>((awbGrid_.width << widthLog2) - 1, 0);
+	awbGrid_.y_end = std::max<int>((awbGrid_.height << heightLog2) - 1, 0);
+
+	/* The ImgU stores the grid rows with a 4 cells alignment. */
+	awbStride_ = (awbGrid_.width + 3) & ~3;
+
+	LOG(IPAIPU3, Debug)
+		<< "AWB grid " << static_cast<unsigned int>(awbGrid_.width)
+		<< "x" << static_cast<unsigned int>(awbGrid_.height)
+		<< " cells of " << (1 << widthLog2) << "x" << (1 << heightLog2)
+		<< " pixels for BDS output " << bdsSize.toString();
+}
+
+void IPAIPU3::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	for (const IPABuffer &buffer : buffers) {
+		bufferInfo_[buffer.id] = buffer.memory;
+		bufferInfo_[buffer.id].prefault();
+	}
+}
+
+void IPAIPU3::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids)
+		bufferInfo_.erase(id);
+}
+
+void IPAIPU3::processEvent(const IPAOperationData &event)
+{
+	switch (event.operation) {
+	case IPU3_IPA_EVENT_SIGNAL_STAT_BUFFER: {
+		unsigned int frame = event.data[0];
+		unsigned int bufferId = event.data[1];
+
+		updateStatistics(frame, bufferInfo_[bufferId]);
+		break;
+	}
+	case IPU3_IPA_EVENT_QUEUE_REQUEST: {
+		/*
+		 * The event carries one or more requests, with a frame number
+		 * and parameters buffer ID pair and a control list for each.
+		 */
+		for (unsigned int i = 0; i < event.controls.size(); ++i) {
+			unsigned int frame = event.data[i * 2];
+			unsigned int bufferId = event.data[i * 2 + 1];
+
+			queueRequest(frame, bufferInfo_[bufferId],
+				     event.controls[i]);
+		}
+		break;
+	}
+	default:
+		LOG(IPAIPU3, Error) << "Unknown event " << event.operation;
+		break;
+	}
+}
+
+void IPAIPU3::queueRequest(unsigned int frame, BufferMemory &mem,
+			   const ControlList &controls)
+{
+	if (controls.contains(controls::AeEnable) && !ctrls_.empty())
+		autoExposure_ = controls.get(controls::AeEnable);
+	if (controls.contains(controls::AwbEnable))
+		autoWhiteBalance_ = controls.get(controls::AwbEnable);
+
+	/*
+	 * Prepare the parameters buffer. The pipeline handler queues it to the
+	 * ImgU ahead of the frame once the PARAM_FILLED action is received.
+	 */
+	Plane &plane = mem.planes()[0];
+	if (plane.length() < sizeof(ipu3_uapi_params)) {
+		LOG(IPAIPU3, Error) << "Parameters buffer too small";
+		return;
+	}
+
+	mem.beginCpuAccess(Plane::AccessWrite);
+	ipu3_uapi_params *params = static_cast<ipu3_uapi_params *>(plane.mem());
+	memset(params, 0, sizeof(*params));
+	fillParams(frame, params);
+	mem.endCpuAccess(Plane::AccessWrite);
+
+	IPAOperationData op;
+	op.operation = IPU3_IPA_ACTION_PARAM_FILLED;
+
+	queueFrameAction.emit(frame, std::move(op));
+}
+
+void IPAIPU3::fillParams(unsigned int frame, ipu3_uapi_params *params)
+{
+	/* Measure the AWB statistics on the grid computed at configure time. */
+	ipu3_uapi_awb_config_s &awb = params->acc_param.awb.config;
+	awb.rgbs_thr_gr = 8191;
+	awb.rgbs_thr_r = 8191;
+	awb.rgbs_thr_gb = 8191;
+	awb.rgbs_thr_b = 8191 | IPU3_UAPI_AWB_RGBS_THR_B_EN
+		       | IPU3_UAPI_AWB_RGBS_THR_B_INCL_SAT;
+	awb.grid = awbGrid_;
+	params->use.acc_awb = 1;
+
+	/*
+	 * Apply the white balance gains in the Bayer noise reduction block,
+	 * with the optical center approximated as the center of the BDS
+	 * output. Record the gains to interpret the statistics of the frame,
+	 * which are measured after them.
+	 */
+	ipu3_uapi_bnr_static_config &bnr = params->acc_param.bnr;
+	bnr = bnrDefaults;
+	bnr.column_size = bdsSize_.width;
+	bnr.opt_center.x_reset = awbGrid_.x_start - static_cast<int>(bdsSize_.width / 2);
+	bnr.opt_center.y_reset = awbGrid_.y_start - static_cast<int>(bdsSize_.height / 2);
+	bnr.opt_center_sqr.x_sqr_reset = bnr.opt_center.x_reset * bnr.opt_center.x_reset;
+	bnr.opt_center_sqr.y_sqr_reset = bnr.opt_center.y_reset * bnr.opt_center.y_reset;
+
+	bnr.wb_gains.gr = AWB_GAIN_UNITY;
+	bnr.wb_gains.r = utils::clamp<unsigned int>(awbGains_.red * AWB_GAIN_UNITY,
+						    0, AWB_GAIN_MAX);
+	bnr.wb_gains.b = utils::clamp<unsigned int>(awbGains_.blue * AWB_GAIN_UNITY,
+						    0, AWB_GAIN_MAX);
+	bnr.wb_gains.gb = AWB_GAIN_UNITY;
+	params->use.acc_bnr = 1;
+
+	frameGains_[frame % FRAME_DEPTH] = {
+		static_cast<double>(bnr.wb_gains.r) / AWB_GAIN_UNITY,
+		static_cast<double>(bnr.wb_gains.b) / AWB_GAIN_UNITY,
+	};
+}
+
+void IPAIPU3::updateStatistics(unsigned int frame, BufferMemory &mem)
+{
+	Plane &plane = mem.planes()[0];
+	if (plane.length() < sizeof(ipu3_uapi_stats_3a)) {
+		LOG(IPAIPU3, Error) << "Statistics buffer too small";
+		return;
+	}
+
+	const ipu3_uapi_stats_3a *stats =
+		static_cast<ipu3_uapi_stats_3a *>(plane.mem());
+	const ipu3_uapi_awb_set_item *cells = stats->awb_raw_buffer.meta_data;
+	unsigned int numCells = awbGrid_.width * awbGrid_.height;
+	unsigned int aeState = 0;
+
+	CpuAccess access(mem, Plane::AccessRead);
+
+	/*
+	 * Compute the average luminance over the cells that contain no
+	 * saturated pixels, as they would bias the measurement. Report the
+	 * mean luminance over all cells, and the change from the previous
+	 * frame, as frame metadata.
+	 */
+	ControlList metadata(controls::controls);
+	std::vector<uint8_t> &luma = luma_;
+	luma.resize(numCells);
+	uint64_t sum = 0;
+	unsigned int num = 0;
+	uint64_t total = 0;
+	uint64_t diff = 0;
+	uint64_t redSum = 0;
+	uint64_t greenSum = 0;
+	uint64_t blueSum = 0;
+
+	for (unsigned int i = 0; i < numCells; ++i) {
+		unsigned int x = i % awbGrid_.width;
+		unsigned int y = i / awbGrid_.width;
+		const ipu3_uapi_awb_set_item &cell = cells[y * awbStride_ + x];
+		unsigned int green = (cell.Gr_avg + cell.Gb_avg) / 2;
+		luma[i] = (cell.R_avg * 77 + green * 150 + cell.B_avg * 29) >> 8;
+
+		total += luma[i];
+		if (prevLuma_.size() == numCells)
+			diff += abs(luma[i] - prevLuma_[i]);
+
+		if (cell.sat_ratio)
+			continue;
+
+		sum += luma[i];
+		num++;
+
+		redSum += cell.R_avg;
+		greenSum += green;
+		blueSum += cell.B_avg;
+	}
+
+	/*
+	 * Gray world algorithm: the means are measured after the gains
+	 * programmed for the frame, compute the gains that would have equalled
+	 * the red and blue means to the green mean, and converge half way.
+	 */
+	if (autoWhiteBalance_ && redSum && blueSum) {
+		const AwbGains &applied = frameGains_[frame % FRAME_DEPTH];
+		double red = applied.red * greenSum / redSum;
+		double blue = applied.blue * greenSum / blueSum;
+		double maxGain = static_cast<double>(AWB_GAIN_MAX) / AWB_GAIN_UNITY;
+
+		awbGains_.red = utils::clamp(sqrt(awbGains_.red * red), 0.0, maxGain);
+		awbGains_.blue = utils::clamp(sqrt(awbGains_.blue * blue), 0.0, maxGain);
+	}
+
+	if (numCells) {
+		metadata.set(controls::LumaMean,
+			     static_cast<float>(total) / numCells / 255.0f);
+		if (prevLuma_.size() == numCells)
+			metadata.set(controls::MotionScore,
+				     static_cast<float>(diff) / numCells / 255.0f);
+	}
+
+	std::swap(luma_, prevLuma_);
+
+	if (num && autoExposure_) {
+		const unsigned int target = 60;
+
+		unsigned int value = std::max<unsigned int>(sum / num, 1);
+		double factor = (double)target / value;
+
+		if (frame % 3 == 0) {
+			double exposure;
+
+			exposure = factor * exposure_ * gain_ / minGain_;
+			exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
+							   minExposure_,
+							   maxExposure_);
+
+			exposure = exposure / exposure_ * minGain_;
+			gain_ = utils::clamp<uint64_t>((uint64_t)exposure,
+						       minGain_, maxGain_);
+
+			setControls(frame + 1);
+		}
+
+		aeState = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
+	}
+
+	metadataReady(frame, aeState, metadata);
+}
+
+void IPAIPU3::setControls(unsigned int frame)
+{
+	IPAOperationData op;
+	op.operation = IPU3_IPA_ACTION_V4L2_SET;
+
+	ControlList ctrls(ctrls_);
+	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
+
+	/* Skip the action when the sensor controls haven't changed. */
+	ControlList changes = ctrls.delta(sensorControls_);
+	if (changes.empty())
+		return;
+
+	sensorControls_.merge(changes);
+	op.controls.push_back(std::move(changes));
+
+	queueFrameAction.emit(frame, std::move(op));
+}
+
+void IPAIPU3::metadataReady(unsigned int frame, unsigned int aeState,
+			    ControlList &ctrls)
+{
+	if (aeState)
+		ctrls.set(controls::AeLocked, aeState == 2);
+
+	IPAOperationData op;
+	op.operation = IPU3_IPA_ACTION_METADATA;
+	op.controls.push_back(ctrls);
+
+	queueFrameAction.emit(frame, std::move(op));
+}
+
+/*
+ * External IPA module interface
+ */
+
+extern "C" {
+const struct IPAModuleInfo ipaModuleInfo = {
+	IPA_MODULE_API_VERSION,
+	1,
+	"PipelineHandlerIPU3",
+	"IPU3 IPA",
+	"LGPL-2.1-or-later",
+};
+
+struct ipa_context *ipaCreate()
+{
+	return new IPAInterfaceWrapper(new IPAIPU3());
+}
+};
+
+}; /* namespace libcamera */
@@ -7,10 +7,13 @@
 
 #include "ipa_interface_wrapper.h"
 
+#include <map>
 #include <unistd.h>
 
 #include <ipa/ipa_interface.h>
 
+#include "byte_stream_buffer.h"
+
 /**
  * \file ipa_interface_wrapper.h
  * \brief Image Processing Algorithm interface wrapper
@@ -18,6 +21,16 @@
 
 namespace libcamera {
 
+namespace {
+
+/* Control packets are aligned in the serialization buffer. */
+constexpr size_t packetSize(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+} /* namespace */
+
 /**
  * \class IPAInterfaceWrapper
  * \brief Wrap an IPAInterface and expose it as an ipa_context
@@ -43,6 +56,12 @@ namespace libcamera {
  * 	return new IPAInterfaceWrapper(new MyIPA());
  * }
  * \endcode
+ *
+ * The ControlInfoMap and ControlList packets passed through the ipa_context
+ * API are deserialized with a ControlSerializer, reset when the IPA is
+ * configured. Events are decoded into storage reused across calls, and frame
+ * actions are encoded the same way, to avoid memory allocations for the data
+ * arrays once they have grown to their largest size.
  */
 
 /**
@@ -50,7 +69,8 @@ namespace libcamera {
  * \param[in] interface The interface to wrap
  */
 IPAInterfaceWrapper::IPAInterfaceWrapper(IPAInterface *interface)
-	: ipa_(interface), callbacks_(nullptr), cb_ctx_(nullptr)
+	: ipa_(interface), callbacks_(nullptr), cb_ctx_(nullptr),
+	  processing_(false), queueing_(false)
 {
 	ops = &operations_;
 
@@ -89,8 +109,40 @@ void IPAInterfaceWrapper::register_callbacks(struct ipa_context *_ctx,
 	ctx->cb_ctx_ = cb_ctx;
 }
 
-void IPAInterfaceWrapper::configure(struct ipa_context *_ctx)
+void IPAInterfaceWrapper::configure(struct ipa_context *_ctx,
+				    const struct ipa_stream *streams,
+				    unsigned int num_streams,
+				    const struct ipa_control_info_map *maps,
+				    unsigned int num_maps)
 {
+	IPAInterfaceWrapper *ctx = static_cast<IPAInterfaceWrapper *>(_ctx);
+
+	ctx->serializer_.reset();
+
+	/* Translate the IPA stream configurations map. */
+	std::map<unsigned int, IPAStream> ipaStreams;
+
+	for (unsigned int i = 0; i < num_streams; ++i) {
+		const struct ipa_stream &stream = streams[i];
+
+		ipaStreams[stream.id] = {
+			stream.pixel_format,
+			Size(stream.width, stream.height),
+		};
+	}
+
+	/* Translate the IPA entity controls map. */
+	std::map<unsigned int, ControlInfoMap> entityControls;
+
+	for (unsigned int i = 0; i < num_maps; ++i) {
+		const struct ipa_control_info_map &ipa_map = maps[i];
+		ByteStreamBuffer byteStream(ipa_map.data, ipa_map.size);
+		unsigned int id = ipa_map.id;
+
+		entityControls.emplace(id, ctx->serializer_.deserialize<ControlInfoMap>(byteStream));
+	}
+
+	ctx->ipa_->configure(std::move(ipaStreams), std::move(entityControls));
 }
 
 void IPAInterfaceWrapper::map_buffers(struct ipa_context *_ctx,
@@ -103,7 +155,7 @@ void IPAInterfaceWrapper::map_buffers(struct ipa_context *_ctx,
 	for (unsigned int i = 0; i < num_buffers; ++i) {
 		const struct ipa_buffer &_buffer = _buffers[i];
 		IPABuffer &buffer = buffers[i];
-		std::vector<Plane> &planes = buffer.memory.planes();
+		PlaneArray &planes = buffer.memory.planes();
 
 		buffer.id = _buffer.id;
 
@@ -128,15 +180,97 @@ void IPAInterfaceWrapper::unmap_buffers(struct ipa_context *_ctx,
 	ctx->ipa_->unmapBuffers(ids);
 }
 
-void IPAInterfaceWrapper::process_event(struct ipa_context *_ctx)
+void IPAInterfaceWrapper::process_event(struct ipa_context *_ctx,
+					const struct ipa_operation_data *data)
+{
+	IPAInterfaceWrapper *ctx = static_cast<IPAInterfaceWrapper *>(_ctx);
+
+	/*
+	 * Nested events, sent by the pipeline handler when it handles a frame
+	 * action queued during the processing of an event, can't reuse the
+	 * event storage.
+	 */
+	if (ctx->processing_) {
+		IPAOperationData event;
+		ctx->decodeOperationData(data, &event);
+		ctx->ipa_->processEvent(std::move(event));
+		return;
+	}
+
+	ctx->decodeOperationData(data, &ctx->event_);
+
+	ctx->processing_ = true;
+	ctx->ipa_->processEvent(ctx->event_);
+	ctx->processing_ = false;
+}
+
+void IPAInterfaceWrapper::decodeOperationData(const struct ipa_operation_data *c_data,
+					      IPAOperationData *data)
 {
+	data->operation = c_data->operation;
+	data->data.assign(c_data->data, c_data->data + c_data->num_data);
+
+	/*
+	 * ControlList instances can't be deserialized in place, they're
+	 * replaced, but the vector storage is kept.
+	 */
+	data->controls.clear();
+
+	for (unsigned int i = 0; i < c_data->num_lists; ++i) {
+		const struct ipa_control_list &c_list = c_data->lists[i];
+		ByteStreamBuffer byteStream(c_list.data, c_list.size);
+		data->controls.push_back(serializer_.deserialize<ControlList>(byteStream));
+	}
 }
 
 void IPAInterfaceWrapper::queueFrameAction(unsigned int frame,
-					   const IPAOperationData &data)
+					   IPAOperationData &&data)
 {
-	if (callbacks_)
-		callbacks_->queue_frame_action(cb_ctx_, frame);
+	if (!callbacks_)
+		return;
+
+	/* Nested frame actions can't reuse the buffers in use. */
+	bool nested = queueing_;
+	std::vector<uint8_t> nestedData;
+	std::vector<struct ipa_control_list> nestedLists;
+	std::vector<uint8_t> &controlsData = nested ? nestedData : controlsData_;
+	std::vector<struct ipa_control_list> &lists = nested ? nestedLists : lists_;
+
+	size_t size = 0;
+	for (const ControlList &list : data.controls)
+		size += packetSize(ControlSerializer::binarySize(list));
+
+	if (controlsData.size() < size)
+		controlsData.resize(size);
+
+	lists.clear();
+
+	size_t offset = 0;
+	for (const ControlList &list : data.controls) {
+		size_t listSize = ControlSerializer::binarySize(list);
+		ByteStreamBuffer byteStream(controlsData.data() + offset, listSize);
+
+		if (serializer_.serialize(list, byteStream) || byteStream.overflow())
+			return;
+
+		struct ipa_control_list c_list;
+		c_list.data = controlsData.data() + offset;
+		c_list.size = listSize;
+		lists.push_back(c_list);
+
+		offset += packetSize(listSize);
+	}
+
+	struct ipa_operation_data c_data;
+	c_data.operation = data.operation;
+	c_data.data = data.data.data();
+	c_data.num_data = data.data.size();
+	c_data.lists = lists.data();
+	c_data.num_lists = lists.size();
+
+	queueing_ = true;
+	callbacks_->queue_frame_action(cb_ctx_, frame, &c_data);
+	queueing_ = nested;
 }
 
 #ifndef __DOXYGEN__
@@ -7,8 +7,13 @@
 #ifndef __LIBCAMERA_IPA_INTERFACE_WRAPPER_H__
 #define __LIBCAMERA_IPA_INTERFACE_WRAPPER_H__
 
+#include <stdint.h>
+#include <vector>
+
 #include <ipa/ipa_interface.h>
 
+#include "control_serializer.h"
+
 namespace libcamera {
 
 class IPAInterfaceWrapper : public ipa_context
@@ -23,22 +28,37 @@ private:
 	static void register_callbacks(struct ipa_context *ctx,
 				       const struct ipa_callback_ops *callbacks,
 				       void *cb_ctx);
-	static void configure(struct ipa_context *ctx);
+	static void configure(struct ipa_context *ctx,
+			      const struct ipa_stream *streams,
+			      unsigned int num_streams,
+			      const struct ipa_control_info_map *maps,
+			      unsigned int num_maps);
 	static void map_buffers(struct ipa_context *ctx,
 				const struct ipa_buffer *c_buffers,
 				size_t num_buffers);
 	static void unmap_buffers(struct ipa_context *ctx,
 				  const unsigned int *ids,
 				  size_t num_buffers);
-	static void process_event(struct ipa_context *ctx);
+	static void process_event(struct ipa_context *ctx,
+				  const struct ipa_operation_data *data);
 
 	static const struct ipa_context_ops operations_;
 
-	void queueFrameAction(unsigned int frame, const IPAOperationData &data);
+	void queueFrameAction(unsigned int frame, IPAOperationData &&data);
+
+	void decodeOperationData(const struct ipa_operation_data *c_data,
+				 IPAOperationData *data);
 
 	IPAInterface *ipa_;
 	const struct ipa_callback_ops *callbacks_;
 	void *cb_ctx_;
+
+	ControlSerializer serializer_;
+	IPAOperationData event_;
+	bool processing_;
+	std::vector<uint8_t> controlsData_;
+	std::vector<struct ipa_control_list> lists_;
+	bool queueing_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,703 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_statistics.cpp - Image Processing Algorithm statistics helpers
+ */
+
+#include "ipa_statistics.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file ipa_statistics.h
+ * \brief Image Processing Algorithm statistics helpers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAStatistics)
+
+namespace {
+
+/*
+ * The kernels reduce contiguous runs of 8-bit samples. sumPairs() accumulates
+ * the even and odd samples of a run of interleaved pairs separately, for the
+ * Bayer lines, the interleaved chroma planes and the luma of packed YUV.
+ */
+
+uint64_t sumScalar(const uint8_t *values, unsigned int count)
+{
+	uint64_t sum = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+		sum += values[i];
+
+	return sum;
+}
+
+void sumPairsScalar(const uint8_t *values, unsigned int pairs,
+		    uint64_t *even, uint64_t *odd)
+{
+	for (unsigned int i = 0; i < pairs; ++i) {
+		*even += values[i * 2];
+		*odd += values[i * 2 + 1];
+	}
+}
+
+uint64_t sumAbsDiffScalar(const uint8_t *a, const uint8_t *b,
+			  unsigned int count)
+{
+	uint64_t sum = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+		sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+	return sum;
+}
+
+uint64_t dotScalar(const uint8_t *a, const uint8_t *b, unsigned int count)
+{
+	uint64_t sum = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+#if defined(__SSE2__)
+
+uint64_t reduceSse2(__m128i acc)
+{
+	uint64_t lanes[2];
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+	return lanes[0] + lanes[1];
+}
+
+uint64_t sumSse2(const uint8_t *values, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+	}
+
+	return reduceSse2(acc) + sumScalar(values + i, count - i);
+}
+
+void sumPairsSse2(const uint8_t *values, unsigned int pairs,
+		  uint64_t *even, uint64_t *odd)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i evenAcc = zero;
+	__m128i oddAcc = zero;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= pairs; i += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i * 2));
+
+		evenAcc = _mm_add_epi64(evenAcc, _mm_sad_epu8(_mm_and_si128(v, mask), zero));
+		oddAcc = _mm_add_epi64(oddAcc, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+	}
+
+	*even += reduceSse2(evenAcc);
+	*odd += reduceSse2(oddAcc);
+
+	sumPairsScalar(values + i * 2, pairs - i, even, odd);
+}
+
+uint64_t sumAbsDiffSse2(const uint8_t *a, const uint8_t *b, unsigned int count)
+{
+	__m128i acc = _mm_setzero_si128();
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+	}
+
+	return reduceSse2(acc) + sumAbsDiffScalar(a + i, b + i, count - i);
+}
+
+uint64_t dotSse2(const uint8_t *a, const uint8_t *b, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+
+		/* Widen to 16 bits, multiply and add pairs to 32 bits. */
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(va, zero),
+					    _mm_unpacklo_epi8(vb, zero));
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(va, zero),
+					    _mm_unpackhi_epi8(vb, zero));
+		__m128i sum = _mm_add_epi32(lo, hi);
+
+		/* Accumulate in 64 bits to avoid overflows on long runs. */
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sum, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sum, zero));
+	}
+
+	return reduceSse2(acc) + dotScalar(a + i, b + i, count - i);
+}
+
+#endif /* __SSE2__ */
+
+#if defined(__ARM_NEON)
+
+uint64_t reduceNeon(uint64x2_t acc)
+{
+	return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+}
+
+uint64x2_t accumulateNeon(uint64x2_t acc, uint8x16_t v)
+{
+	return vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(v)));
+}
+
+uint64_t sumNeon(const uint8_t *values, unsigned int count)
+{
+	uint64x2_t acc = vdupq_n_u64(0);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16)
+		acc = accumulateNeon(acc, vld1q_u8(values + i));
+
+	return reduceNeon(acc) + sumScalar(values + i, count - i);
+}
+
+void sumPairsNeon(const uint8_t *values, unsigned int pairs,
+		  uint64_t *even, uint64_t *odd)
+{
+	uint64x2_t evenAcc = vdupq_n_u64(0);
+	uint64x2_t oddAcc = vdupq_n_u64(0);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= pairs; i += 16) {
+		uint8x16x2_t v = vld2q_u8(values + i * 2);
+
+		evenAcc = accumulateNeon(evenAcc, v.val[0]);
+		oddAcc = accumulateNeon(oddAcc, v.val[1]);
+	}
+
+	*even += reduceNeon(evenAcc);
+	*odd += reduceNeon(oddAcc);
+
+	sumPairsScalar(values + i * 2, pairs - i, even, odd);
+}
+
+uint64_t sumAbsDiffNeon(const uint8_t *a, const uint8_t *b, unsigned int count)
+{
+	uint64x2_t acc = vdupq_n_u64(0);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16)
+		acc = accumulateNeon(acc, vabdq_u8(vld1q_u8(a + i),
+						   vld1q_u8(b + i)));
+
+	return reduceNeon(acc) + sumAbsDiffScalar(a + i, b + i, count - i);
+}
+
+uint64_t dotNeon(const uint8_t *a, const uint8_t *b, unsigned int count)
+{
+	uint64x2_t acc = vdupq_n_u64(0);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i);
+		uint8x16_t vb = vld1q_u8(b + i);
+		uint16x8_t lo = vmull_u8(vget_low_u8(va), vget_low_u8(vb));
+		uint16x8_t hi = vmull_u8(vget_high_u8(va), vget_high_u8(vb));
+
+		acc = vpadalq_u32(acc, vpaddlq_u16(lo));
+		acc = vpadalq_u32(acc, vpaddlq_u16(hi));
+	}
+
+	return reduceNeon(acc) + dotScalar(a + i, b + i, count - i);
+}
+
+#endif /* __ARM_NEON */
+
+struct Implementation {
+	const char *name;
+	uint64_t (*sum)(const uint8_t *values, unsigned int count);
+	void (*sumPairs)(const uint8_t *values, unsigned int pairs,
+			 uint64_t *even, uint64_t *odd);
+	uint64_t (*sumAbsDiff)(const uint8_t *a, const uint8_t *b,
+			       unsigned int count);
+	uint64_t (*dot)(const uint8_t *a, const uint8_t *b, unsigned int count);
+};
+
+/* Implementations, by order of preference. */
+const Implementation implementations[] = {
+#if defined(__SSE2__)
+	{ "sse2", sumSse2, sumPairsSse2, sumAbsDiffSse2, dotSse2 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", sumNeon, sumPairsNeon, sumAbsDiffNeon, dotNeon },
+#endif
+	{ "scalar", sumScalar, sumPairsScalar, sumAbsDiffScalar, dotScalar },
+};
+
+const Implementation &selectImplementation()
+{
+	const char *name = utils::secure_getenv("LIBCAMERA_IPA_STATISTICS");
+
+	if (name) {
+		for (const Implementation &impl : implementations) {
+			if (!strcmp(impl.name, name))
+				return impl;
+		}
+
+		LOG(IPAStatistics, Warning)
+			<< "Statistics implementation " << name
+			<< " not available";
+	}
+
+	return implementations[0];
+}
+
+const Implementation &impl()
+{
+	static const Implementation &implementation = selectImplementation();
+	return implementation;
+}
+
+/* Sum the samples [first, last[ of a line of \a plane. */
+uint64_t sumSamples(const IPAStatistics::Plane &plane, const uint8_t *line,
+		    unsigned int first, unsigned int last)
+{
+	const uint8_t *start = line + first * plane.pixelStride;
+	unsigned int count = last - first;
+
+	switch (plane.pixelStride) {
+	case 1:
+		return impl().sum(start, count);
+
+	case 2: {
+		uint64_t even = 0;
+		uint64_t odd = 0;
+
+		if (!count)
+			return 0;
+
+		/*
+		 * Sum the last sample separately, its pair may extend past the
+		 * end of the plane.
+		 */
+		impl().sumPairs(start, count - 1, &even, &odd);
+		return even + start[(count - 1) * 2];
+	}
+
+	default: {
+		uint64_t sum = 0;
+
+		for (unsigned int i = 0; i < count; ++i)
+			sum += start[i * plane.pixelStride];
+
+		return sum;
+	}
+	}
+}
+
+} /* namespace */
+
+/**
+ * \class IPAStatistics
+ * \brief Reduce frames and ISP statistics to the values used by algorithms
+ *
+ * The algorithms of IPAs reduce statistics to a few values for every frame:
+ * the mean of a luminance grid for AE, the sums of the colour channels for a
+ * grey world AWB, or a histogram and its percentiles when they analyse the
+ * frames themselves. The IPAStatistics class provides those reductions, for
+ * all IPAs to compute them consistently within the frame time.
+ *
+ * The helpers operate on 8-bit samples, either arrays of ISP statistics or
+ * planes of raw or YUV frames described by a Plane. The sums at their core are
+ * vectorized with SSE2 on x86 and NEON on ARM, and all implementations produce
+ * identical results. The LIBCAMERA_IPA_STATISTICS environment variable selects
+ * the implementation ("sse2", "neon" or "scalar") for testing purpose. It is
+ * ignored if the implementation isn't available.
+ *
+ * All methods are thread-safe.
+ */
+
+/**
+ * \struct IPAStatistics::Plane
+ * \brief A plane of 8-bit samples
+ *
+ * The samples of a line are located at \a pixelStride bytes from each other,
+ * for instance 1 for the luma plane of NV12 and 2 for the luma samples of YUYV.
+ *
+ * \var IPAStatistics::Plane::data
+ * \brief The address of the first sample of the plane
+ * \var IPAStatistics::Plane::width
+ * \brief The number of samples in a line
+ * \var IPAStatistics::Plane::height
+ * \brief The number of lines
+ * \var IPAStatistics::Plane::stride
+ * \brief The distance between the start of two lines, in bytes
+ * \var IPAStatistics::Plane::pixelStride
+ * \brief The distance between two samples of a line, in bytes
+ */
+
+/**
+ * \enum IPAStatistics::BayerOrder
+ * \brief The order of the colour components in the top-left 2x2 quad of a
+ * Bayer frame
+ * \var IPAStatistics::BayerRGGB
+ * \brief Red, green, green, blue
+ * \var IPAStatistics::BayerGRBG
+ * \brief Green, red, blue, green
+ * \var IPAStatistics::BayerGBRG
+ * \brief Green, blue, red, green
+ * \var IPAStatistics::BayerBGGR
+ * \brief Blue, green, green, red
+ */
+
+/**
+ * \struct IPAStatistics::ColourSums
+ * \brief The sums of the colour components of a Bayer frame
+ *
+ * \var IPAStatistics::ColourSums::red
+ * \brief The sum of the red samples
+ * \var IPAStatistics::ColourSums::green
+ * \brief The sum of the green samples, which are twice as many as the red and
+ * blue samples
+ * \var IPAStatistics::ColourSums::blue
+ * \brief The sum of the blue samples
+ * \var IPAStatistics::ColourSums::count
+ * \brief The number of 2x2 quads
+ */
+
+/**
+ * \brief Retrieve the name of the implementation in use
+ * \return The implementation name ("sse2", "neon" or "scalar")
+ */
+const char *IPAStatistics::implementation()
+{
+	return impl().name;
+}
+
+/**
+ * \brief Compute the sum of an array of values
+ * \param[in] values The values
+ * \param[in] count The number of values
+ * \return The sum of the values
+ */
+uint64_t IPAStatistics::sum(const uint8_t *values, unsigned int count)
+{
+	return impl().sum(values, count);
+}
+
+/**
+ * \brief Compute the mean of an array of values
+ * \param[in] values The values
+ * \param[in] count The number of values
+ * \param[in] minimum The minimum value taken into account
+ *
+ * Values lower than \a minimum are ignored, to exclude the dark zones of a
+ * luminance grid for instance.
+ *
+ * \return The mean of the values, or 0.0 if no value is taken into account
+ */
+double IPAStatistics::mean(const uint8_t *values, unsigned int count,
+			   uint8_t minimum)
+{
+	uint64_t sum;
+	unsigned int num;
+
+	if (!minimum) {
+		sum = impl().sum(values, count);
+		num = count;
+	} else {
+		sum = 0;
+		num = 0;
+
+		for (unsigned int i = 0; i < count; ++i) {
+			if (values[i] < minimum)
+				continue;
+
+			sum += values[i];
+			num++;
+		}
+	}
+
+	return num ? static_cast<double>(sum) / num : 0.0;
+}
+
+/**
+ * \brief Compute the weighted mean of an array of values
+ * \param[in] values The values
+ * \param[in] weights The weight of each value
+ * \param[in] count The number of values and weights
+ * \return The weighted mean of the values, or 0.0 if all weights are null
+ */
+double IPAStatistics::weightedMean(const uint8_t *values,
+				   const uint8_t *weights, unsigned int count)
+{
+	uint64_t total = impl().sum(weights, count);
+	if (!total)
+		return 0.0;
+
+	return static_cast<double>(impl().dot(values, weights, count)) / total;
+}
+
+/**
+ * \brief Compute the sum of the absolute differences between two arrays
+ * \param[in] a The first array
+ * \param[in] b The second array
+ * \param[in] count The number of values in each array
+ *
+ * This is typically used to measure the motion between the luminance grids of
+ * two consecutive frames.
+ *
+ * \return The sum of the absolute differences
+ */
+uint64_t IPAStatistics::sumAbsDiff(const uint8_t *a, const uint8_t *b,
+				   unsigned int count)
+{
+	return impl().sumAbsDiff(a, b, count);
+}
+
+/**
+ * \brief Compute the histogram of a plane
+ * \param[in] plane The plane
+ * \param[out] bins The histogram bins
+ * \param[in] numBins The number of bins, a power of two between 1 and 256
+ *
+ * The bins are cleared, and each sample of the plane is counted in the bin
+ * covering its value.
+ */
+void IPAStatistics::histogram(const Plane &plane, uint32_t *bins,
+			      unsigned int numBins)
+{
+	unsigned int shift = 8;
+	while (shift && (1U << (8 - shift)) < numBins)
+		shift--;
+
+	/*
+	 * Count the samples in four interleaved histograms, to avoid stalling
+	 * on consecutive increments of the same bin.
+	 */
+	std::vector<uint32_t> counts(4 * 256);
+	uint32_t *c0 = &counts[0];
+	uint32_t *c1 = &counts[256];
+	uint32_t *c2 = &counts[512];
+	uint32_t *c3 = &counts[768];
+
+	for (unsigned int y = 0; y < plane.height; ++y) {
+		const uint8_t *line = plane.data + y * plane.stride;
+		const unsigned int step = plane.pixelStride;
+		unsigned int x;
+
+		for (x = 0; x + 4 <= plane.width; x += 4) {
+			c0[line[x * step]]++;
+			c1[line[(x + 1) * step]]++;
+			c2[line[(x + 2) * step]]++;
+			c3[line[(x + 3) * step]]++;
+		}
+
+		for (; x < plane.width; ++x)
+			c0[line[x * step]]++;
+	}
+
+	std::fill(bins, bins + numBins, 0);
+
+	for (unsigned int value = 0; value < 256; ++value)
+		bins[value >> shift] += c0[value] + c1[value] + c2[value] +
+					c3[value];
+}
+
+/**
+ * \brief Compute the mean value of the samples counted in a histogram
+ * \param[in] bins The histogram bins
+ * \param[in] numBins The number of bins
+ * \param[in] first The first bin taken into account
+ * \param[in] last The bin following the last bin taken into account
+ *
+ * The bins cover the [0, 256[ range of values evenly, and the samples counted
+ * in a bin are accounted for at the centre of the bin. The bins outside of
+ * [\a first, \a last[ are ignored, to exclude the saturated samples for
+ * instance.
+ *
+ * \return The mean value, or 0.0 if no sample is taken into account
+ */
+double IPAStatistics::histogramMean(const uint32_t *bins, unsigned int numBins,
+				    unsigned int first, unsigned int last)
+{
+	const double binSize = 256.0 / numBins;
+	double sum = 0.0;
+	uint64_t num = 0;
+
+	for (unsigned int i = first; i < last && i < numBins; ++i) {
+		sum += bins[i] * (i + 0.5) * binSize;
+		num += bins[i];
+	}
+
+	return num ? sum / num : 0.0;
+}
+
+/**
+ * \brief Compute a percentile of the samples counted in a histogram
+ * \param[in] bins The histogram bins
+ * \param[in] numBins The number of bins
+ * \param[in] fraction The fraction of samples, between 0.0 and 1.0
+ *
+ * Find the value below which \a fraction of the samples lie. The samples are
+ * assumed to be evenly distributed within each bin.
+ *
+ * \return The value in the [0, 256] range, or 0.0 if the histogram is empty
+ */
+double IPAStatistics::histogramPercentile(const uint32_t *bins,
+					  unsigned int numBins, double fraction)
+{
+	const double binSize = 256.0 / numBins;
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < numBins; ++i)
+		total += bins[i];
+
+	if (!total)
+		return 0.0;
+
+	double target = fraction * total;
+	uint64_t cumulative = 0;
+
+	for (unsigned int i = 0; i < numBins; ++i) {
+		if (!bins[i] || cumulative + bins[i] < target) {
+			cumulative += bins[i];
+			continue;
+		}
+
+		return (i + (target - cumulative) / bins[i]) * binSize;
+	}
+
+	return 256.0;
+}
+
+/**
+ * \brief Compute the average value of the zones of a plane
+ * \param[in] plane The plane
+ * \param[in] columns The number of zone columns
+ * \param[in] rows The number of zone rows
+ * \param[out] averages The average of each zone, in row-major order
+ *
+ * The plane is split in a grid of \a columns by \a rows zones of (nearly)
+ * equal sizes, and \a averages is filled with the average sample value of each
+ * zone. \a averages shall have room for \a columns * \a rows values.
+ */
+void IPAStatistics::zoneAverages(const Plane &plane, unsigned int columns,
+				 unsigned int rows, double *averages)
+{
+	std::vector<uint64_t> sums(columns * rows);
+
+	for (unsigned int y = 0; y < plane.height; ++y) {
+		const uint8_t *line = plane.data + y * plane.stride;
+		unsigned int row = y * rows / plane.height;
+
+		for (unsigned int column = 0; column < columns; ++column) {
+			unsigned int first = column * plane.width / columns;
+			unsigned int last = (column + 1) * plane.width / columns;
+
+			sums[row * columns + column] +=
+				sumSamples(plane, line, first, last);
+		}
+	}
+
+	for (unsigned int row = 0; row < rows; ++row) {
+		unsigned int height = (row + 1) * plane.height / rows -
+				      row * plane.height / rows;
+
+		for (unsigned int column = 0; column < columns; ++column) {
+			unsigned int width = (column + 1) * plane.width / columns -
+					     column * plane.width / columns;
+			unsigned int count = width * height;
+			unsigned int zone = row * columns + column;
+
+			averages[zone] = count ? static_cast<double>(sums[zone]) / count
+					       : 0.0;
+		}
+	}
+}
+
+/**
+ * \brief Compute the sums of the colour components of a Bayer frame
+ * \param[in] plane The plane of the Bayer frame, with 8-bit samples
+ * \param[in] order The Bayer order of the frame
+ *
+ * The pixelStride of the \a plane is ignored, the samples shall be contiguous.
+ * An odd last column or line is ignored. The sums are typically used to compute
+ * the gains of a grey world AWB.
+ *
+ * \return The sums of the colour components
+ */
+IPAStatistics::ColourSums IPAStatistics::bayerSums(const Plane &plane,
+						   BayerOrder order)
+{
+	/* Locate the red sample in the 2x2 quads, blue is opposite. */
+	unsigned int redX = order == BayerGRBG || order == BayerBGGR ? 1 : 0;
+	unsigned int redY = order == BayerGBRG || order == BayerBGGR ? 1 : 0;
+	unsigned int pairs = plane.width / 2;
+	uint64_t line[2][2] = {};
+
+	for (unsigned int y = 0; y + 2 <= plane.height; y += 2) {
+		for (unsigned int i = 0; i < 2; ++i)
+			impl().sumPairs(plane.data + (y + i) * plane.stride,
+					pairs, &line[i][0], &line[i][1]);
+	}
+
+	ColourSums sums;
+	sums.red = line[redY][redX];
+	sums.blue = line[!redY][!redX];
+	sums.green = line[redY][!redX] + line[!redY][redX];
+	sums.count = pairs * (plane.height / 2);
+
+	return sums;
+}
+
+/**
+ * \brief Compute the sums of the chroma components of an interleaved plane
+ * \param[in] plane The interleaved Cb and Cr plane
+ * \param[out] cb The sum of the Cb samples
+ * \param[out] cr The sum of the Cr samples
+ *
+ * The \a plane width is the number of Cb/Cr pairs in a line, as for the
+ * chroma plane of NV12 and NV16, and its pixelStride is ignored. For NV21 and
+ * NV61, the sums are swapped. The sums are typically used to compute the gains
+ * of a grey world AWB.
+ */
+void IPAStatistics::chromaSums(const Plane &plane, uint64_t *cb, uint64_t *cr)
+{
+	*cb = 0;
+	*cr = 0;
+
+	for (unsigned int y = 0; y < plane.height; ++y)
+		impl().sumPairs(plane.data + y * plane.stride, plane.width,
+				cb, cr);
+}
+
+} /* namespace libcamera */
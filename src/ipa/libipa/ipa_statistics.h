@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_statistics.h - Image Processing Algorithm statistics helpers
+ */
+#ifndef __LIBCAMERA_IPA_STATISTICS_H__
+#define __LIBCAMERA_IPA_STATISTICS_H__
+
+#include <stdint.h>
+
+namespace libcamera {
+
+class IPAStatistics
+{
+public:
+	struct Plane {
+		const uint8_t *data;
+		unsigned int width;
+		unsigned int height;
+		unsigned int stride;
+		unsigned int pixelStride;
+	};
+
+	enum BayerOrder {
+		BayerRGGB,
+		BayerGRBG,
+		BayerGBRG,
+		BayerBGGR,
+	};
+
+	struct ColourSums {
+		uint64_t red;
+		uint64_t green;
+		uint64_t blue;
+		unsigned int count;
+	};
+
+	static const char *implementation();
+
+	static uint64_t sum(const uint8_t *values, unsigned int count);
+	static double mean(const uint8_t *values, unsigned int count,
+			   uint8_t minimum = 0);
+	static double weightedMean(const uint8_t *values, const uint8_t *weights,
+				   unsigned int count);
+	static uint64_t sumAbsDiff(const uint8_t *a, const uint8_t *b,
+				   unsigned int count);
+
+	static void histogram(const Plane &plane, uint32_t *bins,
+			      unsigned int numBins);
+	static double histogramMean(const uint32_t *bins, unsigned int numBins,
+				    unsigned int first, unsigned int last);
+	static double histogramPercentile(const uint32_t *bins,
+					  unsigned int numBins, double fraction);
+
+	static void zoneAverages(const Plane &plane, unsigned int columns,
+				 unsigned int rows, double *averages);
+	static ColourSums bayerSums(const Plane &plane, BayerOrder order);
+	static void chromaSums(const Plane &plane, uint64_t *cb, uint64_t *cr);
+
+private:
+	IPAStatistics() = delete;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_STATISTICS_H__ */
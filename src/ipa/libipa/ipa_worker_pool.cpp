@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_worker_pool.cpp - Image Processing Algorithm worker thread pool
+ */
+
+#include "ipa_worker_pool.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <thread>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file ipa_worker_pool.h
+ * \brief Image Processing Algorithm worker thread pool
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAWorkerPool)
+
+/*
+ * Worker threads don't use an event loop, they wait for tasks on the pool
+ * condition variable until the pool is destroyed.
+ */
+class IPAWorkerPool::Worker : public Thread
+{
+public:
+	Worker(IPAWorkerPool *pool)
+		: pool_(pool)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		pool_->workerLoop();
+	}
+
+private:
+	IPAWorkerPool *pool_;
+};
+
+/**
+ * \class IPAWorkerPool
+ * \brief Run independent algorithms of an IPA in parallel
+ *
+ * IPAs commonly run several algorithms (AE, AWB, AF, lens shading, ...) on
+ * the statistics of every frame. When those algorithms are independent of
+ * each other, running them serially in processEvent() needlessly extends the
+ * time spent processing a frame. The IPAWorkerPool spreads the algorithms
+ * over a set of worker threads.
+ *
+ * Algorithms are registered once as tasks with addTask(). The run() method
+ * then executes all tasks, on the worker threads and on the calling thread,
+ * and returns once all of them have completed. An IPA typically calls run()
+ * from processEvent() after obtaining the statistics, and emits its
+ * queueFrameAction signal with the combined results after run() returns.
+ *
+ * \code{.cpp}
+ * MyIPA::MyIPA()
+ * 	: pool_(2)
+ * {
+ * 	pool_.addTask("agc", [this]() { agc_.process(stats_); });
+ * 	pool_.addTask("awb", [this]() { awb_.process(stats_); });
+ * }
+ *
+ * void MyIPA::updateStatistics(unsigned int frame, const Statistics *stats)
+ * {
+ * 	stats_ = stats;
+ * 	pool_.run();
+ *
+ * 	metadataReady(frame);
+ * }
+ * \endcode
+ *
+ * Tasks run concurrently and must not modify state shared with other tasks.
+ * The state written by tasks is visible to the caller of run() when it
+ * returns. A pool created without worker threads runs all tasks serially on
+ * the calling thread, which allows IPAs to use the same code path regardless
+ * of the number of CPUs.
+ *
+ * The execution time of each task is measured and can be retrieved with
+ * timing(), to help IPAs deciding how to balance their algorithms and to
+ * check that the per-frame budget is met.
+ *
+ * The IPAWorkerPool is not thread-safe, all its methods shall be called from
+ * the same thread.
+ */
+
+/**
+ * \struct IPAWorkerPool::Timing
+ * \brief Execution time statistics of a task
+ *
+ * \var IPAWorkerPool::Timing::last
+ * \brief The execution time of the last run of the task
+ *
+ * \var IPAWorkerPool::Timing::max
+ * \brief The longest execution time of the task
+ *
+ * \var IPAWorkerPool::Timing::total
+ * \brief The accumulated execution time of all runs of the task
+ *
+ * \var IPAWorkerPool::Timing::count
+ * \brief The number of runs of the task
+ */
+
+/**
+ * \brief Construct an IPAWorkerPool with \a workers threads
+ * \param[in] workers The number of worker threads
+ *
+ * The calling thread of run() also executes tasks, a pool with N workers
+ * thus runs up to N + 1 tasks in parallel. When \a workers is 0 all tasks run
+ * on the calling thread.
+ */
+IPAWorkerPool::IPAWorkerPool(unsigned int workers)
+	: active_(false), stopping_(false), next_(0), pending_(0)
+{
+	for (unsigned int i = 0; i < workers; ++i) {
+		Worker *worker = new Worker(this);
+		workers_.emplace_back(worker);
+		worker->start();
+	}
+}
+
+IPAWorkerPool::~IPAWorkerPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		stopping_ = true;
+	}
+
+	workAvailable_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/**
+ * \brief Retrieve the number of worker threads configured by the user
+ *
+ * The number of worker threads is set by the LIBCAMERA_IPA_WORKERS environment
+ * variable, and is limited to one less than the number of CPUs. When the
+ * variable isn't set, IPAs run their algorithms serially as the cost of
+ * waking up worker threads exceeds the processing time of simple algorithms.
+ *
+ * \return The number of worker threads to be used by IPAs
+ */
+unsigned int IPAWorkerPool::defaultWorkers()
+{
+	const char *env = utils::secure_getenv("LIBCAMERA_IPA_WORKERS");
+	if (!env || !*env)
+		return 0;
+
+	char *end;
+	unsigned long count = strtoul(env, &end, 10);
+	if (*end) {
+		LOG(IPAWorkerPool, Warning) << "Invalid worker count " << env;
+		return 0;
+	}
+
+	unsigned int cpus = std::thread::hardware_concurrency();
+	if (cpus)
+		count = std::min<unsigned long>(count, cpus - 1);
+
+	return count;
+}
+
+/**
+ * \fn IPAWorkerPool::workers()
+ * \brief Retrieve the number of worker threads
+ * \return The number of worker threads
+ */
+
+/**
+ * \brief Register a task
+ * \param[in] name The task name, for diagnostic purpose
+ * \param[in] func The function implementing the task
+ *
+ * Register a task to be executed at every run(). Tasks shall not be added
+ * while run() is executing.
+ *
+ * \return The task index, to be used with name() and timing()
+ */
+unsigned int IPAWorkerPool::addTask(const std::string &name,
+				    const std::function<void()> &func)
+{
+	tasks_.push_back({ name, func, {} });
+	return tasks_.size() - 1;
+}
+
+/**
+ * \fn IPAWorkerPool::tasks()
+ * \brief Retrieve the number of registered tasks
+ * \return The number of registered tasks
+ */
+
+/**
+ * \brief Execute all tasks and wait for their completion
+ *
+ * Tasks are distributed to the worker threads and to the calling thread in
+ * their registration order. This method returns once all tasks have
+ * completed.
+ */
+void IPAWorkerPool::run()
+{
+	if (workers_.empty() || tasks_.size() < 2) {
+		for (Task &task : tasks_)
+			runTask(task);
+		return;
+	}
+
+	MutexLocker locker(mutex_);
+
+	next_ = 0;
+	pending_ = tasks_.size();
+	active_ = true;
+
+	workAvailable_.notify_all();
+
+	runTasks(locker);
+
+	workDone_.wait(locker, [&] { return !pending_; });
+	active_ = false;
+}
+
+/**
+ * \brief Retrieve the name of a task
+ * \param[in] task The task index
+ * \return The name of the task
+ */
+const std::string &IPAWorkerPool::name(unsigned int task) const
+{
+	return tasks_[task].name;
+}
+
+/**
+ * \brief Retrieve the execution time statistics of a task
+ * \param[in] task The task index
+ * \return The execution time statistics of the task
+ */
+const IPAWorkerPool::Timing &IPAWorkerPool::timing(unsigned int task) const
+{
+	return tasks_[task].timing;
+}
+
+/**
+ * \brief Reset the execution time statistics of all tasks
+ */
+void IPAWorkerPool::resetTimings()
+{
+	for (Task &task : tasks_)
+		task.timing = {};
+}
+
+void IPAWorkerPool::workerLoop()
+{
+	MutexLocker locker(mutex_);
+
+	while (true) {
+		workAvailable_.wait(locker, [&] {
+			return stopping_ || (active_ && next_ < tasks_.size());
+		});
+
+		if (stopping_)
+			return;
+
+		runTasks(locker);
+	}
+}
+
+/* Claim and run tasks until none is left, with the pool mutex \a locked. */
+void IPAWorkerPool::runTasks(MutexLocker &locker)
+{
+	while (next_ < tasks_.size()) {
+		Task &task = tasks_[next_++];
+
+		locker.unlock();
+		runTask(task);
+		locker.lock();
+
+		if (!--pending_)
+			workDone_.notify_one();
+	}
+}
+
+void IPAWorkerPool::runTask(Task &task)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	task.func();
+
+	auto end = std::chrono::steady_clock::now();
+	auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+
+	Timing &timing = task.timing;
+	timing.last = duration;
+	timing.max = std::max(timing.max, duration);
+	timing.total += duration;
+	timing.count++;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_worker_pool.h - Image Processing Algorithm worker thread pool
+ */
+#ifndef __LIBCAMERA_IPA_WORKER_POOL_H__
+#define __LIBCAMERA_IPA_WORKER_POOL_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class IPAWorkerPool
+{
+public:
+	struct Timing {
+		std::chrono::nanoseconds last;
+		std::chrono::nanoseconds max;
+		std::chrono::nanoseconds total;
+		unsigned int count;
+	};
+
+	IPAWorkerPool(unsigned int workers);
+	~IPAWorkerPool();
+
+	static unsigned int defaultWorkers();
+
+	unsigned int workers() const { return workers_.size(); }
+
+	unsigned int addTask(const std::string &name,
+			     const std::function<void()> &func);
+	unsigned int tasks() const { return tasks_.size(); }
+
+	void run();
+
+	const std::string &name(unsigned int task) const;
+	const Timing &timing(unsigned int task) const;
+	void resetTimings();
+
+private:
+	class Worker;
+
+	struct Task {
+		std::string name;
+		std::function<void()> func;
+		Timing timing;
+	};
+
+	void workerLoop();
+	void runTasks(MutexLocker &locker);
+	static void runTask(Task &task);
+
+	std::vector<Task> tasks_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+
+	Mutex mutex_;
+	std::condition_variable workAvailable_;
+	std::condition_variable workDone_;
+	bool active_;
+	bool stopping_;
+	unsigned int next_;
+	unsigned int pending_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_WORKER_POOL_H__ */
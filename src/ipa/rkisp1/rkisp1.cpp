@@ -6,9 +6,11 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <math.h>
 #include <queue>
+#include <stdlib.h>
 #include <string.h>
 
 #include <linux/rkisp1-config.h>
@@ -24,6 +26,8 @@
 #include "utils.h"
 
 #include "../libipa/ipa_interface_wrapper.h"
+#include "../libipa/ipa_statistics.h"
+#include "../libipa/ipa_worker_pool.h"
 
 namespace libcamera {
 
@@ -32,6 +36,23 @@ LOG_DEFINE_CATEGORY(IPARkISP1)
 class IPARkISP1 : public IPAInterface
 {
 public:
+	IPARkISP1()
+		: sensorControls_(controls::controls), autoExposure_(false),
+		  aeLocked_(false), autoWhiteBalance_(true),
+		  speed_(convergenceSpeed()),
+		  pool_(IPAWorkerPool::defaultWorkers()), stats_(nullptr)
+	{
+		pool_.addTask("agc", [this]() {
+			aeValid_ = updateExposure(stats_, &aeFactor_);
+		});
+		pool_.addTask("awb", [this]() {
+			if (autoWhiteBalance_)
+				updateWhiteBalance(statsFrame_, stats_);
+		});
+	}
+
+	~IPARkISP1();
+
 	int init() override { return 0; }
 
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
@@ -39,19 +60,46 @@ public:
 	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
 	void unmapBuffers(const std::vector<unsigned int> &ids) override;
 	void processEvent(const IPAOperationData &event) override;
+	void processEvent(IPAOperationData &&event) override;
 
 private:
-	void queueRequest(unsigned int frame, rkisp1_isp_params_cfg *params,
+	/* The AWB gains are unsigned 2.8 fixed point values, 0x100 is 1.0. */
+	static constexpr unsigned int AWB_GAIN_UNITY = 0x100;
+	static constexpr unsigned int AWB_GAIN_MIN = 0x40;
+	static constexpr unsigned int AWB_GAIN_MAX = 0x3ff;
+
+	/* Depth of the per-frame AWB gains history. */
+	static constexpr unsigned int FRAME_DEPTH = 16;
+
+	struct AwbGains {
+		double red;
+		double blue;
+	};
+
+	static double convergenceSpeed();
+
+	void queueRequest(unsigned int frame, BufferMemory &mem,
 			  const ControlList &controls);
+	void fillParams(unsigned int frame, rkisp1_isp_params_cfg *params);
 	void updateStatistics(unsigned int frame,
 			      const rkisp1_stat_buffer *stats);
+	bool updateExposure(const rkisp1_stat_buffer *stats, double *factor);
+	void updateWhiteBalance(unsigned int frame,
+				const rkisp1_stat_buffer *stats);
+
+	void restoreState(const std::vector<uint32_t> &state);
+	void exportState();
 
 	void setControls(unsigned int frame);
-	void metadataReady(unsigned int frame, unsigned int aeState);
+	void reportStatistics(const rkisp1_stat_buffer *stats,
+			      ControlList *ctrls);
+	void metadataReady(unsigned int frame, unsigned int aeState,
+			   const rkisp1_stat_buffer *stats);
 
 	std::map<unsigned int, BufferMemory> bufferInfo_;
 
 	ControlInfoMap ctrls_;
+	ControlList sensorControls_;
 
 	/* Camera sensor controls. */
 	bool autoExposure_;
@@ -61,15 +109,67 @@ private:
 	uint32_t gain_;
 	uint32_t minGain_;
 	uint32_t maxGain_;
+	bool aeLocked_;
+
+	/* ISP algorithms state. */
+	bool autoWhiteBalance_;
+	double speed_;
+	Size window_;
+	bool configured_;
+	AwbGains awbGains_;
+	std::array<AwbGains, FRAME_DEPTH> frameGains_;
+
+	/*
+	 * The algorithms run in parallel on the statistics of a frame, and
+	 * store their results for updateStatistics() to combine them.
+	 */
+	IPAWorkerPool pool_;
+	const rkisp1_stat_buffer *stats_;
+	unsigned int statsFrame_;
+	bool aeValid_;
+	double aeFactor_;
+
+	/* Luminance grid of the previous frame, to measure motion. */
+	std::array<uint8_t, CIFISP_AE_MEAN_MAX> prevAeMeans_;
+	bool prevAeValid_;
+
+	/* Metadata lists lent by the pipeline handler with the statistics. */
+	std::vector<ControlList> lentMetadata_;
 };
 
+IPARkISP1::~IPARkISP1()
+{
+	for (unsigned int i = 0; i < pool_.tasks(); ++i) {
+		const IPAWorkerPool::Timing &timing = pool_.timing(i);
+		if (!timing.count)
+			continue;
+
+		LOG(IPARkISP1, Debug)
+			<< "Algorithm " << pool_.name(i) << ": "
+			<< timing.count << " runs, average "
+			<< timing.total.count() / timing.count << "ns, max "
+			<< timing.max.count() << "ns";
+	}
+}
+
 void IPARkISP1::configure(const std::map<unsigned int, IPAStream> &streamConfig,
 			  const std::map<unsigned int, ControlInfoMap> &entityControls)
 {
+	/*
+	 * Measure the statistics on the main stream area, and start the white
+	 * balance from unity gains unless a previous state is restored.
+	 */
+	auto itStream = streamConfig.find(0);
+	window_ = itStream != streamConfig.end() ? itStream->second.size : Size{};
+	configured_ = false;
+	prevAeValid_ = false;
+	awbGains_ = { 1.0, 1.0 };
+
 	if (entityControls.empty())
 		return;
 
 	ctrls_ = entityControls.at(0);
+	sensorControls_ = ControlList(ctrls_);
 
 	const auto itExp = ctrls_.find(V4L2_CID_EXPOSURE);
 	if (itExp == ctrls_.end()) {
@@ -92,6 +192,7 @@ void IPARkISP1::configure(const std::map<unsigned int, IPAStream> &streamConfig,
 	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
 	maxGain_ = itGain->second.max().get<int32_t>();
 	gain_ = minGain_;
+	aeLocked_ = false;
 
 	LOG(IPARkISP1, Info)
 		<< "Exposure: " << minExposure_ << "-" << maxExposure_
@@ -104,7 +205,7 @@ void IPARkISP1::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
 	for (const IPABuffer &buffer : buffers) {
 		bufferInfo_[buffer.id] = buffer.memory;
-		bufferInfo_[buffer.id].planes()[0].mem();
+		bufferInfo_[buffer.id].prefault();
 	}
 }
 
@@ -114,6 +215,19 @@ void IPARkISP1::unmapBuffers(const std::vector<unsigned int> &ids)
 		bufferInfo_.erase(id);
 }
 
+void IPARkISP1::processEvent(IPAOperationData &&event)
+{
+	/*
+	 * The pipeline handler lends an empty metadata list with the
+	 * statistics, keep it for metadataReady() to fill it in place.
+	 */
+	if (event.operation == RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER &&
+	    !event.controls.empty())
+		lentMetadata_.push_back(std::move(event.controls[0]));
+
+	processEvent(static_cast<const IPAOperationData &>(event));
+}
+
 void IPARkISP1::processEvent(const IPAOperationData &event)
 {
 	switch (event.operation) {
@@ -121,77 +235,190 @@ void IPARkISP1::processEvent(const IPAOperationData &event)
 		unsigned int frame = event.data[0];
 		unsigned int bufferId = event.data[1];
 
+		BufferMemory &mem = bufferInfo_[bufferId];
 		const rkisp1_stat_buffer *stats =
-			static_cast<rkisp1_stat_buffer *>(bufferInfo_[bufferId].planes()[0].mem());
+			static_cast<rkisp1_stat_buffer *>(mem.planes()[0].mem());
 
+		CpuAccess access(mem, Plane::AccessRead);
 		updateStatistics(frame, stats);
 		break;
 	}
 	case RKISP1_IPA_EVENT_QUEUE_REQUEST: {
-		unsigned int frame = event.data[0];
-		unsigned int bufferId = event.data[1];
-
-		rkisp1_isp_params_cfg *params =
-			static_cast<rkisp1_isp_params_cfg *>(bufferInfo_[bufferId].planes()[0].mem());
-
-		queueRequest(frame, params, event.controls[0]);
+		/*
+		 * The event carries one or more requests, with a frame number
+		 * and parameters buffer ID pair and a control list for each.
+		 */
+		for (unsigned int i = 0; i < event.controls.size(); ++i) {
+			unsigned int frame = event.data[i * 2];
+			unsigned int bufferId = event.data[i * 2 + 1];
+
+			queueRequest(frame, bufferInfo_[bufferId],
+				     event.controls[i]);
+		}
 		break;
 	}
+	case RKISP1_IPA_EVENT_RESTORE_STATE:
+		restoreState(event.data);
+		break;
 	default:
 		LOG(IPARkISP1, Error) << "Unkown event " << event.operation;
 		break;
 	}
 }
 
-void IPARkISP1::queueRequest(unsigned int frame, rkisp1_isp_params_cfg *params,
+/*
+ * The algorithms apply a fraction of their correction on every frame, which
+ * sets their convergence speed. The fraction defaults to 0.5 and can be tuned
+ * from 0 (excluded) to 1 with the LIBCAMERA_RKISP1_3A_SPEED environment
+ * variable.
+ */
+double IPARkISP1::convergenceSpeed()
+{
+	const double speed = 0.5;
+
+	const char *env = utils::secure_getenv("LIBCAMERA_RKISP1_3A_SPEED");
+	if (!env || !*env)
+		return speed;
+
+	char *end;
+	double value = strtod(env, &end);
+	if (*end || !(value > 0.0 && value <= 1.0)) {
+		LOG(IPARkISP1, Warning)
+			<< "Invalid convergence speed " << env
+			<< ", using " << speed;
+		return speed;
+	}
+
+	return value;
+}
+
+void IPARkISP1::queueRequest(unsigned int frame, BufferMemory &mem,
 			     const ControlList &controls)
 {
-	/* Prepare parameters buffer. */
-	memset(params, 0, sizeof(*params));
+	rkisp1_isp_params_cfg *params =
+		static_cast<rkisp1_isp_params_cfg *>(mem.planes()[0].mem());
 
-	/* Auto Exposure on/off. */
-	if (controls.contains(controls::AeEnable)) {
-		autoExposure_ = controls.get(controls::AeEnable);
-		if (autoExposure_)
-			params->module_ens = CIFISP_MODULE_AEC;
+	if (controls.contains(controls::AeEnable))
+		autoExposure_ = controls.get(controls::AeEnable) && !ctrls_.empty();
 
-		params->module_en_update = CIFISP_MODULE_AEC;
-	}
+	if (controls.contains(controls::AwbEnable))
+		autoWhiteBalance_ = controls.get(controls::AwbEnable);
+
+	/* Prepare parameters buffer. */
+	mem.beginCpuAccess(Plane::AccessWrite);
+	memset(params, 0, sizeof(*params));
+	fillParams(frame, params);
+	mem.endCpuAccess(Plane::AccessWrite);
 
 	IPAOperationData op;
 	op.operation = RKISP1_IPA_ACTION_PARAM_FILLED;
 
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, std::move(op));
+}
+
+void IPARkISP1::fillParams(unsigned int frame, rkisp1_isp_params_cfg *params)
+{
+	/*
+	 * The measurement blocks are configured once, with the first
+	 * parameters buffer, and stay enabled. The AE measurement follows the
+	 * AeEnable control.
+	 */
+	if (!configured_ && window_.width && window_.height) {
+		cifisp_hst_config &hst = params->meas.hst_config;
+		hst.mode = CIFISP_HISTOGRAM_MODE_Y_HISTOGRAM;
+		hst.meas_window = { 0, 0, static_cast<__u16>(window_.width),
+				    static_cast<__u16>(window_.height) };
+		std::fill(std::begin(hst.hist_weight), std::end(hst.hist_weight), 1);
+
+		/*
+		 * The bin counters are 16-bit wide, subsample the window to
+		 * keep the total number of measured pixels within range.
+		 */
+		uint64_t pixels = static_cast<uint64_t>(window_.width) * window_.height;
+		unsigned int step = 1;
+		while (pixels / (step * step) > UINT16_MAX)
+			step++;
+		hst.histogram_predivider = std::min(step, 127U);
+
+		cifisp_awb_meas_config &awb = params->meas.awb_meas_config;
+		awb.awb_mode = CIFISP_AWB_MODE_RGB;
+		awb.awb_wnd = hst.meas_window;
+		awb.max_y = 230;
+		awb.min_y = 16;
+		awb.max_csum = 250;
+		awb.min_c = 16;
+		awb.frames = 0;
+		awb.enable_ymax_cmp = 1;
+
+		/*
+		 * Measure the sharpness over the whole frame, the window must
+		 * not touch the frame borders.
+		 */
+		cifisp_afc_config &afc = params->meas.afc_config;
+		afc.num_afm_win = 1;
+		afc.afm_win[0] = { 2, 2, static_cast<__u16>(window_.width - 4),
+				   static_cast<__u16>(window_.height - 4) };
+		afc.thres = 4;
+		afc.var_shift = 4;
+
+		const unsigned int modules = CIFISP_MODULE_HST | CIFISP_MODULE_AWB |
+					     CIFISP_MODULE_AFC;
+		params->module_ens |= modules;
+		params->module_en_update |= modules;
+		params->module_cfg_update |= modules;
+
+		configured_ = true;
+	}
+
+	if (autoExposure_)
+		params->module_ens |= CIFISP_MODULE_AEC;
+	params->module_en_update |= CIFISP_MODULE_AEC;
+
+	/*
+	 * Program the AWB gains for every frame, and record them to interpret
+	 * the statistics of the frame, which are measured after the gains.
+	 */
+	cifisp_awb_gain_config &gains = params->others.awb_gain_config;
+	gains.gain_red = utils::clamp<unsigned int>(awbGains_.red * AWB_GAIN_UNITY,
+						    AWB_GAIN_MIN, AWB_GAIN_MAX);
+	gains.gain_green_r = AWB_GAIN_UNITY;
+	gains.gain_blue = utils::clamp<unsigned int>(awbGains_.blue * AWB_GAIN_UNITY,
+						     AWB_GAIN_MIN, AWB_GAIN_MAX);
+	gains.gain_green_b = AWB_GAIN_UNITY;
+
+	frameGains_[frame % FRAME_DEPTH] = {
+		static_cast<double>(gains.gain_red) / AWB_GAIN_UNITY,
+		static_cast<double>(gains.gain_blue) / AWB_GAIN_UNITY,
+	};
+
+	params->module_ens |= CIFISP_MODULE_AWB_GAIN;
+	params->module_en_update |= CIFISP_MODULE_AWB_GAIN;
+	params->module_cfg_update |= CIFISP_MODULE_AWB_GAIN;
 }
 
 void IPARkISP1::updateStatistics(unsigned int frame,
 				 const rkisp1_stat_buffer *stats)
 {
-	const cifisp_stat *params = &stats->params;
 	unsigned int aeState = 0;
 
-	if (stats->meas_type & CIFISP_STAT_AUTOEXP) {
-		const cifisp_ae_stat *ae = &params->ae;
-
-		const unsigned int target = 60;
-
-		unsigned int value = 0;
-		unsigned int num = 0;
-		for (int i = 0; i < CIFISP_AE_MEAN_MAX; i++) {
-			if (ae->exp_mean[i] <= 15)
-				continue;
-
-			value += ae->exp_mean[i];
-			num++;
-		}
-		value /= num;
-
-		double factor = (double)target / value;
-
-		if (frame % 3 == 0) {
+	stats_ = stats;
+	statsFrame_ = frame;
+	pool_.run();
+	stats_ = nullptr;
+
+	if (aeValid_) {
+		double factor = aeFactor_;
+
+		if (autoExposure_) {
+			/*
+			 * Apply a fraction of the correction only, as the
+			 * sensor controls take effect with a delay and the
+			 * next statistics may not reflect them yet.
+			 */
+			double dampened = pow(factor, speed_);
 			double exposure;
 
-			exposure = factor * exposure_ * gain_ / minGain_;
+			exposure = dampened * exposure_ * gain_ / minGain_;
 			exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
 							   minExposure_,
 							   maxExposure_);
@@ -206,7 +433,128 @@ void IPARkISP1::updateStatistics(unsigned int frame,
 		aeState = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
 	}
 
-	metadataReady(frame, aeState);
+	/* Export the state every time the exposure converges. */
+	if (aeState == 2 && !aeLocked_)
+		exportState();
+	aeLocked_ = aeState == 2;
+
+	metadataReady(frame, aeState, stats);
+}
+
+bool IPARkISP1::updateExposure(const rkisp1_stat_buffer *stats, double *factor)
+{
+	const cifisp_stat *params = &stats->params;
+	const double target = 60.0;
+	double value = 0.0;
+
+	if (stats->meas_type & CIFISP_STAT_HIST) {
+		/*
+		 * Compute the mean luminance from the histogram, excluding
+		 * the top bin that accumulates saturated pixels and would
+		 * hide the real scene brightness.
+		 */
+		std::array<uint32_t, CIFISP_HIST_BIN_N_MAX> bins;
+		std::copy(std::begin(params->hist.hist_bins),
+			  std::end(params->hist.hist_bins), bins.begin());
+
+		uint64_t num = 0;
+		for (unsigned int i = 0; i < CIFISP_HIST_BIN_N_MAX - 1; i++)
+			num += bins[i];
+
+		uint64_t saturated = bins[CIFISP_HIST_BIN_N_MAX - 1];
+		value = IPAStatistics::histogramMean(bins.data(), bins.size(),
+						     0, CIFISP_HIST_BIN_N_MAX - 1);
+
+		/*
+		 * Pull the exposure down when more than a quarter of the
+		 * pixels are saturated.
+		 */
+		if (saturated * 3 > num)
+			value = std::max(value, target * 2);
+	} else if (stats->meas_type & CIFISP_STAT_AUTOEXP) {
+		/* Ignore the darkest zones of the grid. */
+		value = IPAStatistics::mean(params->ae.exp_mean,
+					    CIFISP_AE_MEAN_MAX, 16);
+	} else {
+		return false;
+	}
+
+	*factor = target / std::max(value, 1.0);
+	return true;
+}
+
+void IPARkISP1::updateWhiteBalance(unsigned int frame,
+				   const rkisp1_stat_buffer *stats)
+{
+	if (!(stats->meas_type & CIFISP_STAT_AWB))
+		return;
+
+	const cifisp_awb_meas &meas = stats->params.awb.awb_mean[0];
+	if (!meas.cnt || !meas.mean_cr_or_r || !meas.mean_cb_or_b)
+		return;
+
+	/*
+	 * Gray world algorithm: the means are measured after the gains
+	 * programmed for the frame, compute the gains that would have equalled
+	 * the red and blue means to the green mean.
+	 */
+	const AwbGains &applied = frameGains_[frame % FRAME_DEPTH];
+	double green = meas.mean_y_or_g;
+	double red = applied.red * green / meas.mean_cr_or_r;
+	double blue = applied.blue * green / meas.mean_cb_or_b;
+
+	awbGains_.red = awbGains_.red * pow(red / awbGains_.red, speed_);
+	awbGains_.blue = awbGains_.blue * pow(blue / awbGains_.blue, speed_);
+
+	double minGain = static_cast<double>(AWB_GAIN_MIN) / AWB_GAIN_UNITY;
+	double maxGain = static_cast<double>(AWB_GAIN_MAX) / AWB_GAIN_UNITY;
+	awbGains_.red = utils::clamp(awbGains_.red, minGain, maxGain);
+	awbGains_.blue = utils::clamp(awbGains_.blue, minGain, maxGain);
+}
+
+/*
+ * Start the algorithms from the state they had converged to in a previous
+ * capture session, limited to the ranges of the current configuration.
+ */
+void IPARkISP1::restoreState(const std::vector<uint32_t> &state)
+{
+	if (ctrls_.empty() || state.size() != RKISP1_IPA_STATE_SIZE)
+		return;
+
+	exposure_ = utils::clamp(state[RKISP1_IPA_STATE_EXPOSURE],
+				 minExposure_, maxExposure_);
+	gain_ = utils::clamp(state[RKISP1_IPA_STATE_GAIN], minGain_, maxGain_);
+
+	double minGain = static_cast<double>(AWB_GAIN_MIN) / AWB_GAIN_UNITY;
+	double maxGain = static_cast<double>(AWB_GAIN_MAX) / AWB_GAIN_UNITY;
+	awbGains_.red = utils::clamp(static_cast<double>(state[RKISP1_IPA_STATE_AWB_GAIN_RED]) / AWB_GAIN_UNITY,
+				     minGain, maxGain);
+	awbGains_.blue = utils::clamp(static_cast<double>(state[RKISP1_IPA_STATE_AWB_GAIN_BLUE]) / AWB_GAIN_UNITY,
+				      minGain, maxGain);
+
+	LOG(IPARkISP1, Debug)
+		<< "Restored exposure " << exposure_ << ", gain " << gain_
+		<< ", AWB gains " << awbGains_.red << "/" << awbGains_.blue;
+
+	/*
+	 * Replace the initial sensor controls set by configure() with the
+	 * complete set of restored values.
+	 */
+	sensorControls_ = ControlList(ctrls_);
+	setControls(0);
+}
+
+void IPARkISP1::exportState()
+{
+	IPAOperationData op;
+	op.operation = RKISP1_IPA_ACTION_STATE;
+	op.data.resize(RKISP1_IPA_STATE_SIZE);
+	op.data[RKISP1_IPA_STATE_EXPOSURE] = exposure_;
+	op.data[RKISP1_IPA_STATE_GAIN] = gain_;
+	op.data[RKISP1_IPA_STATE_AWB_GAIN_RED] = awbGains_.red * AWB_GAIN_UNITY;
+	op.data[RKISP1_IPA_STATE_AWB_GAIN_BLUE] = awbGains_.blue * AWB_GAIN_UNITY;
+
+	queueFrameAction.emit(0, std::move(op));
 }
 
 void IPARkISP1::setControls(unsigned int frame)
@@ -217,23 +565,87 @@ void IPARkISP1::setControls(unsigned int frame)
 	ControlList ctrls(ctrls_);
 	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
 	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
-	op.controls.push_back(ctrls);
 
-	queueFrameAction.emit(frame, op);
+	/* Skip the action when the sensor controls haven't changed. */
+	ControlList changes = ctrls.delta(sensorControls_);
+	if (changes.empty())
+		return;
+
+	sensorControls_.merge(changes);
+	op.controls.push_back(std::move(changes));
+
+	queueFrameAction.emit(frame, std::move(op));
 }
 
-void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
+/*
+ * Report the measurements of the ISP as frame metadata, for applications that
+ * analyse the frames without processing their pixels.
+ */
+void IPARkISP1::reportStatistics(const rkisp1_stat_buffer *stats,
+				 ControlList *ctrls)
 {
-	ControlList ctrls(controls::controls);
+	const cifisp_stat *params = &stats->params;
+
+	if (stats->meas_type & CIFISP_STAT_HIST) {
+		std::vector<uint32_t> bins(std::begin(params->hist.hist_bins),
+					   std::end(params->hist.hist_bins));
+		double mean = IPAStatistics::histogramMean(bins.data(), bins.size(),
+							   0, bins.size());
+
+		ctrls->set(controls::LumaHistogram, bins);
+		if (mean)
+			ctrls->set(controls::LumaMean,
+				   static_cast<float>(mean) / 255.0f);
+	}
+
+	if (stats->meas_type & CIFISP_STAT_AFM_FIN)
+		ctrls->set(controls::SharpnessScore,
+			   static_cast<int64_t>(params->af.window[0].sum));
+
+	if (!(stats->meas_type & CIFISP_STAT_AUTOEXP)) {
+		prevAeValid_ = false;
+		return;
+	}
+
+	const cifisp_ae_stat *ae = &params->ae;
+
+	if (prevAeValid_) {
+		uint64_t diff = IPAStatistics::sumAbsDiff(ae->exp_mean,
+							  prevAeMeans_.data(),
+							  CIFISP_AE_MEAN_MAX);
+
+		ctrls->set(controls::MotionScore,
+			   static_cast<float>(diff) / CIFISP_AE_MEAN_MAX / 255.0f);
+	}
+
+	std::copy(std::begin(ae->exp_mean), std::end(ae->exp_mean),
+		  prevAeMeans_.begin());
+	prevAeValid_ = true;
+}
+
+void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState,
+			      const rkisp1_stat_buffer *stats)
+{
+	/*
+	 * Avoid allocating a new list for every frame when the pipeline
+	 * handler has lent one.
+	 */
+	ControlList ctrls = lentMetadata_.empty()
+			  ? ControlList(controls::controls)
+			  : std::move(lentMetadata_.back());
+	if (!lentMetadata_.empty())
+		lentMetadata_.pop_back();
 
 	if (aeState)
 		ctrls.set(controls::AeLocked, aeState == 2);
 
+	reportStatistics(stats, &ctrls);
+
 	IPAOperationData op;
 	op.operation = RKISP1_IPA_ACTION_METADATA;
-	op.controls.push_back(ctrls);
+	op.controls.push_back(std::move(ctrls));
 
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, std::move(op));
 }
 
 /*
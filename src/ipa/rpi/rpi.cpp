@@ -40,6 +40,11 @@ enum rpi_ae_state {
 class IPARPi : public IPAInterface
 {
 public:
+	IPARPi()
+		: autoExposure_(false), aeLocked_(false)
+	{
+	}
+
 	int init() override { return 0; }
 
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
@@ -49,13 +54,18 @@ public:
 	void processEvent(const IPAOperationData &event) override;
 
 private:
-	void queueRequest(unsigned int frame, rpi_isp_params_cfg *params,
+	void queueRequest(unsigned int frame, BufferMemory &mem,
 			  const ControlList &controls);
 	void updateStatistics(unsigned int frame,
-			      const rpi_stat_buffer *stats);
+			      const rpi_stat_buffer *stats,
+			      const ControlList &sensorMetadata);
+
+	void restoreState(const std::vector<uint32_t> &state);
+	void exportState();
 
 	void setControls(unsigned int frame);
-	void metadataReady(unsigned int frame, unsigned int aeState);
+	void metadataReady(unsigned int frame, unsigned int aeState,
+			   const rpi_stat_buffer *stats);
 
 	std::map<unsigned int, BufferMemory> bufferInfo_;
 
@@ -69,6 +79,7 @@ private:
 	uint32_t gain_;
 	uint32_t minGain_;
 	uint32_t maxGain_;
+	bool aeLocked_;
 };
 
 void IPARPi::configure(const std::map<unsigned int, IPAStream> &streamConfig,
@@ -93,13 +104,18 @@ void IPARPi::configure(const std::map<unsigned int, IPAStream> &streamConfig,
 
 	autoExposure_ = true;
 
+	/*
+	 * Start from the middle of the exposure range, as the sensor doesn't
+	 * report a default value, and let the AE converge from there.
+	 */
 	minExposure_ = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
 	maxExposure_ = itExp->second.max().get<int32_t>();
-	exposure_ = minExposure_;
+	exposure_ = minExposure_ + (maxExposure_ - minExposure_) / 2;
 
 	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
 	maxGain_ = itGain->second.max().get<int32_t>();
 	gain_ = minGain_;
+	aeLocked_ = false;
 
 	LOG(IPARPI, Info)
 		<< "Exposure: " << minExposure_ << "-" << maxExposure_
@@ -112,7 +128,7 @@ void IPARPi::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
 	for (const IPABuffer &buffer : buffers) {
 		bufferInfo_[buffer.id] = buffer.memory;
-		bufferInfo_[buffer.id].planes()[0].mem();
+		bufferInfo_[buffer.id].prefault();
 	}
 }
 
@@ -129,32 +145,46 @@ void IPARPi::processEvent(const IPAOperationData &event)
 		unsigned int frame = event.data[0];
 		unsigned int bufferId = event.data[1];
 
+		BufferMemory &mem = bufferInfo_[bufferId];
 		const rpi_stat_buffer *stats =
-			static_cast<rpi_stat_buffer *>(bufferInfo_[bufferId].planes()[0].mem());
-
-		updateStatistics(frame, stats);
+			static_cast<rpi_stat_buffer *>(mem.planes()[0].mem());
+
+		/*
+		 * The pipeline handler passes the sensor settings the frame
+		 * has been captured with when known.
+		 */
+		ControlList sensorMetadata(controls::controls);
+		if (!event.controls.empty())
+			sensorMetadata = event.controls[0];
+
+		CpuAccess access(mem, Plane::AccessRead);
+		updateStatistics(frame, stats, sensorMetadata);
 		break;
 	}
 	case RPI_IPA_EVENT_QUEUE_REQUEST: {
 		unsigned int frame = event.data[0];
 		unsigned int bufferId = event.data[1];
 
-		rpi_isp_params_cfg *params =
-			static_cast<rpi_isp_params_cfg *>(bufferInfo_[bufferId].planes()[0].mem());
-
-		queueRequest(frame, params, event.controls[0]);
+		queueRequest(frame, bufferInfo_[bufferId], event.controls[0]);
 		break;
 	}
+	case RPI_IPA_EVENT_RESTORE_STATE:
+		restoreState(event.data);
+		break;
 	default:
 		LOG(IPARPI, Error) << "Unknown event " << event.operation;
 		break;
 	}
 }
 
-void IPARPi::queueRequest(unsigned int frame, rpi_isp_params_cfg *params,
+void IPARPi::queueRequest(unsigned int frame, BufferMemory &mem,
 			  const ControlList &controls)
 {
+	rpi_isp_params_cfg *params =
+		static_cast<rpi_isp_params_cfg *>(mem.planes()[0].mem());
+
 	/* Prepare parameters buffer. */
+	mem.beginCpuAccess(Plane::AccessWrite);
 	memset(params, 0, sizeof(*params));
 
 	/* Auto Exposure on/off. */
@@ -165,20 +195,94 @@ void IPARPi::queueRequest(unsigned int frame, rpi_isp_params_cfg *params,
 		}
 	}
 
+	mem.endCpuAccess(Plane::AccessWrite);
+
 	IPAOperationData op;
 	op.operation = RPI_IPA_ACTION_PARAM_FILLED;
 
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, std::move(op));
 }
 
 void IPARPi::updateStatistics(unsigned int frame,
-			      const rpi_stat_buffer *stats)
+			      const rpi_stat_buffer *stats,
+			      const ControlList &sensorMetadata)
 {
 	enum rpi_ae_state aeState = RPI_AE_NOLOCK;
 
-	/* Do anything here */
+	/*
+	 * The ISP reports the mean luminance of the frame. Aim for an 18%
+	 * grey level, applying half of the correction for every frame to
+	 * absorb the sensor controls latency without oscillating.
+	 */
+	if (autoExposure_ && !ctrls_.empty()) {
+		const double target = 46.0;
+
+		double value = std::max<double>(stats->exposure, 1.0);
+		double factor = target / value;
+		double exposure;
+
+		/*
+		 * Base the correction on the settings the frame has been
+		 * captured with when the sensor reports them, and on the last
+		 * settings requested otherwise.
+		 */
+		uint32_t frameExposure = exposure_;
+		uint32_t frameGain = gain_;
+		if (sensorMetadata.contains(controls::SensorExposure) &&
+		    sensorMetadata.contains(controls::SensorAnalogueGain)) {
+			frameExposure = sensorMetadata.get(controls::SensorExposure);
+			frameGain = std::max<int32_t>(sensorMetadata.get(controls::SensorAnalogueGain), 1);
+		}
+
+		exposure = sqrt(factor) * frameExposure * frameGain / minGain_;
+		exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
+						   minExposure_, maxExposure_);
+
+		exposure = exposure / exposure_ * minGain_;
+		gain_ = utils::clamp<uint64_t>((uint64_t)exposure,
+					       minGain_, maxGain_);
+
+		setControls(frame + 1);
 
-	metadataReady(frame, aeState);
+		aeState = fabs(factor - 1.0) < 0.05 ? RPI_AE_LOCKED : RPI_AE_NOLOCK;
+	}
+
+	/* Export the state every time the exposure converges. */
+	if (aeState == RPI_AE_LOCKED && !aeLocked_)
+		exportState();
+	aeLocked_ = aeState == RPI_AE_LOCKED;
+
+	metadataReady(frame, aeState, stats);
+}
+
+/*
+ * Start the exposure from the value it had converged to in a previous capture
+ * session, limited to the ranges of the current configuration.
+ */
+void IPARPi::restoreState(const std::vector<uint32_t> &state)
+{
+	if (ctrls_.empty() || state.size() != RPI_IPA_STATE_SIZE)
+		return;
+
+	exposure_ = utils::clamp(state[RPI_IPA_STATE_EXPOSURE],
+				 minExposure_, maxExposure_);
+	gain_ = utils::clamp(state[RPI_IPA_STATE_GAIN], minGain_, maxGain_);
+
+	LOG(IPARPI, Debug)
+		<< "Restored exposure " << exposure_ << ", gain " << gain_;
+
+	setControls(0);
+}
+
+void IPARPi::exportState()
+{
+	IPAOperationData op;
+	op.operation = RPI_IPA_ACTION_STATE;
+	op.data.resize(RPI_IPA_STATE_SIZE);
+	op.data[RPI_IPA_STATE_EXPOSURE] = exposure_;
+	op.data[RPI_IPA_STATE_GAIN] = gain_;
+
+	queueFrameAction.emit(0, std::move(op));
 }
 
 void IPARPi::setControls(unsigned int frame)
@@ -189,23 +293,28 @@ void IPARPi::setControls(unsigned int frame)
 	ControlList ctrls(ctrls_);
 	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
 	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
-	op.controls.push_back(ctrls);
+	op.controls.push_back(std::move(ctrls));
 
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, std::move(op));
 }
 
-void IPARPi::metadataReady(unsigned int frame, unsigned int aeState)
+void IPARPi::metadataReady(unsigned int frame, unsigned int aeState,
+			    const rpi_stat_buffer *stats)
 {
 	ControlList ctrls(controls::controls);
 
 	if (aeState)
 		ctrls.set(controls::AeLocked, aeState == RPI_AE_LOCKED);
 
+	/* The ISP reports the mean luminance on an 8-bit scale. */
+	ctrls.set(controls::LumaMean,
+		  std::min(stats->exposure / 255.0f, 1.0f));
+
 	IPAOperationData op;
 	op.operation = RPI_IPA_ACTION_METADATA;
-	op.controls.push_back(ctrls);
+	op.controls.push_back(std::move(ctrls));
 
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, std::move(op));
 }
 
 /*
@@ -9,19 +9,31 @@
 
 #include "message.h"
 #include "thread.h"
-#include "utils.h"
 
 namespace libcamera {
 
-void BoundMethodBase::activatePack(void *pack)
+bool BoundMethodBase::isObjectThread() const
 {
-	if (Thread::current() == object_->thread()) {
-		invokePack(pack);
-	} else {
-		std::unique_ptr<Message> msg =
-			utils::make_unique<InvokeMessage>(this, pack);
-		object_->postMessage(std::move(msg));
-	}
+	return Thread::current() == object_->thread();
+}
+
+InvokeMessage *BoundMethodBase::prepareInvoke(size_t methodSize, size_t packSize,
+					      void (*destroyPack)(void *),
+					      void **method, void **pack)
+{
+	InvokeMessage *msg = new InvokeMessage(methodSize, packSize, destroyPack);
+
+	if (method)
+		*method = msg->methodStorage();
+	*pack = msg->packStorage();
+
+	return msg;
+}
+
+void BoundMethodBase::postInvoke(InvokeMessage *msg, bool deleteMethod)
+{
+	msg->setMethod(this, deleteMethod);
+	object_->postMessage(std::unique_ptr<Message>(msg));
 }
 
 } /* namespace libcamera */
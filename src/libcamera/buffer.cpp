@@ -6,13 +6,22 @@
  */
 
 #include <libcamera/buffer.h>
+#include <libcamera/stream.h>
 
+#include <algorithm>
 #include <errno.h>
+#include <linux/dma-buf.h>
+#include <list>
+#include <map>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <tuple>
 #include <unistd.h>
 
 #include "log.h"
+#include "thread.h"
+#include "utils.h"
 
 /**
  * \file buffer.h
@@ -23,6 +32,212 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Buffer)
 
+namespace {
+
+/* Matches the V4L2 VIDEO_MAX_FRAME limit. */
+constexpr unsigned int MAX_POOL_BUFFERS = 32;
+
+} /* namespace */
+
+/**
+ * \brief Process-wide registry of CPU mappings of dmabuf objects
+ *
+ * The PlaneMappingRegistry class tracks all CPU mappings created by Plane
+ * instances and shares them between planes that reference the same dmabuf
+ * object. Dmabuf objects are identified by the device and inode numbers of
+ * their file descriptor, regardless of the file descriptor number. On kernels
+ * older than v5.3, where all dmabuf objects share an anonymous inode, they have
+ * no usable identity and mappings are not shared.
+ *
+ * Mappings are reference-counted. Mappings released by Plane::setDmabuf() are
+ * kept in an idle list when their reference count drops to zero, to be reused
+ * without a new mmap() if the same dmabuf comes back. Idle mappings are evicted
+ * in least recently used order when the total mapped size exceeds
+ * MAX_MAPPED_BYTES, and all of them are dropped when a BufferPool is
+ * destroyed, as mappings prevent V4L2 devices from freeing their buffers.
+ */
+class PlaneMappingRegistry
+{
+public:
+	static PlaneMappingRegistry *instance();
+
+	void *map(int fd, unsigned int length, bool populate);
+	void ref(void *mem);
+	int unmap(void *mem, bool cache);
+	void purge();
+
+private:
+	static constexpr std::size_t MAX_MAPPED_BYTES = 256 << 20;
+
+	using Key = std::tuple<uint64_t, uint64_t, unsigned int>;
+
+	struct Mapping {
+		unsigned int length;
+		unsigned int refcount;
+		bool indexed;
+		Key key;
+		std::list<void *>::iterator idle;
+	};
+
+	PlaneMappingRegistry();
+
+	void evict(std::size_t length);
+	int release(std::map<void *, Mapping>::iterator it);
+
+	Mutex mutex_;
+	std::map<void *, Mapping> mappings_;
+	std::map<Key, void *> index_;
+	std::list<void *> idle_;
+	std::size_t mappedBytes_;
+};
+
+PlaneMappingRegistry::PlaneMappingRegistry()
+	: mappedBytes_(0)
+{
+}
+
+/**
+ * \brief Retrieve the mapping registry instance
+ * \return The mapping registry
+ */
+PlaneMappingRegistry *PlaneMappingRegistry::instance()
+{
+	static PlaneMappingRegistry instance;
+	return &instance;
+}
+
+/**
+ * \brief Map \a length bytes of the dmabuf \a fd, reusing existing mappings
+ * \param[in] fd The dmabuf file descriptor
+ * \param[in] length The size of the memory region
+ * \param[in] populate Prefault the page tables of new mappings
+ * \return The CPU address of the mapping, or MAP_FAILED on error with errno
+ * set to the error code
+ */
+void *PlaneMappingRegistry::map(int fd, unsigned int length, bool populate)
+{
+	MutexLocker locker(mutex_);
+
+	uint64_t dev, ino;
+	bool indexed = utils::dmabuf_identity(fd, &dev, &ino);
+	Key key;
+
+	if (indexed) {
+		key = Key(dev, ino, length);
+
+		auto it = index_.find(key);
+		if (it != index_.end()) {
+			Mapping &mapping = mappings_[it->second];
+			if (!mapping.refcount++)
+				idle_.erase(mapping.idle);
+
+			return it->second;
+		}
+	}
+
+	evict(length);
+
+	int flags = MAP_SHARED | (populate ? MAP_POPULATE : 0);
+	void *mem = ::mmap(NULL, length, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (mem == MAP_FAILED)
+		return mem;
+
+	Mapping &mapping = mappings_[mem];
+	mapping.length = length;
+	mapping.refcount = 1;
+	mapping.indexed = indexed;
+	mapping.key = key;
+	mapping.idle = idle_.end();
+
+	if (indexed)
+		index_[key] = mem;
+
+	mappedBytes_ += length;
+
+	return mem;
+}
+
+/**
+ * \brief Acquire a new reference to the mapping at \a mem
+ * \param[in] mem The CPU address of a mapping returned by map()
+ */
+void PlaneMappingRegistry::ref(void *mem)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = mappings_.find(mem);
+	ASSERT(it != mappings_.end());
+
+	if (!it->second.refcount++)
+		idle_.erase(it->second.idle);
+}
+
+/**
+ * \brief Release a reference to the mapping at \a mem
+ * \param[in] mem The CPU address of a mapping returned by map()
+ * \param[in] cache Keep the mapping in the idle list when unused
+ * \return 0 on success or a negative error code otherwise
+ */
+int PlaneMappingRegistry::unmap(void *mem, bool cache)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = mappings_.find(mem);
+	ASSERT(it != mappings_.end());
+
+	Mapping &mapping = it->second;
+	ASSERT(mapping.refcount);
+
+	if (--mapping.refcount)
+		return 0;
+
+	if (cache && mapping.indexed && mappedBytes_ <= MAX_MAPPED_BYTES) {
+		mapping.idle = idle_.insert(idle_.end(), mem);
+		return 0;
+	}
+
+	return release(it);
+}
+
+/**
+ * \brief Unmap all idle mappings
+ */
+void PlaneMappingRegistry::purge()
+{
+	MutexLocker locker(mutex_);
+
+	while (!idle_.empty()) {
+		auto it = mappings_.find(idle_.front());
+		idle_.pop_front();
+		release(it);
+	}
+}
+
+void PlaneMappingRegistry::evict(std::size_t length)
+{
+	while (!idle_.empty() && mappedBytes_ + length > MAX_MAPPED_BYTES) {
+		auto it = mappings_.find(idle_.front());
+		idle_.pop_front();
+		release(it);
+	}
+}
+
+int PlaneMappingRegistry::release(std::map<void *, Mapping>::iterator it)
+{
+	Mapping &mapping = it->second;
+
+	if (::munmap(it->first, mapping.length) < 0)
+		return -errno;
+
+	if (mapping.indexed)
+		index_.erase(mapping.key);
+
+	mappedBytes_ -= mapping.length;
+	mappings_.erase(it);
+
+	return 0;
+}
+
 /**
  * \class Plane
  * \brief A memory region to store a single plane of a frame
@@ -43,11 +258,63 @@ LOG_DEFINE_CATEGORY(Buffer)
  * To support CPU access, planes carry the CPU address of their backing memory.
  * Similarly to the dmabuf file handles, the CPU addresses for planes composing
  * an image may or may not be contiguous.
+ *
+ * CPU mappings are shared process-wide between all planes that reference the
+ * same dmabuf object, and are reference-counted. Copying a plane duplicates its
+ * dmabuf file handle and shares its CPU mapping.
+ *
+ * CPU mappings are cached on some platforms where DMA isn't coherent with the
+ * CPU caches. All CPU accesses to the plane memory shall thus be bracketed by
+ * calls to beginCpuAccess() and endCpuAccess(), or be performed within the
+ * scope of a CpuAccess instance, to synchronise the caches with the memory.
+ *
+ * Planes can alternatively reference memory allocated by the application and
+ * identified by a CPU address only, for use with devices that support the
+ * V4L2 USERPTR memory type. Such planes carry no dmabuf file handle, and their
+ * memory is owned by the application, which shall keep it valid for as long as
+ * the plane references it. Copying a user pointer plane shares the address.
+ */
+
+/**
+ * \enum Plane::Access
+ * \brief The type of CPU access to the plane memory
+ * \var Plane::AccessRead
+ * The memory is read by the CPU
+ * \var Plane::AccessWrite
+ * The memory is written by the CPU
+ * \var Plane::AccessReadWrite
+ * The memory is read and written by the CPU
  */
 
 Plane::Plane()
-	: fd_(-1), length_(0), mem_(0)
+	: fd_(-1), length_(0), mem_(0), userptr_(false)
+{
+}
+
+/**
+ * \brief Copy constructor, duplicate the dmabuf file handle of \a other and
+ * share its CPU mapping
+ * \param[in] other The other plane
+ */
+Plane::Plane(const Plane &other)
+	: fd_(-1), length_(0), mem_(0), userptr_(false)
 {
+	*this = other;
+}
+
+/**
+ * \brief Move constructor, transfer the dmabuf file handle and CPU mapping of
+ * \a other to the new plane
+ * \param[in] other The other plane
+ */
+Plane::Plane(Plane &&other)
+	: fd_(other.fd_), length_(other.length_), mem_(other.mem_),
+	  userptr_(other.userptr_)
+{
+	other.fd_ = -1;
+	other.length_ = 0;
+	other.mem_ = 0;
+	other.userptr_ = false;
 }
 
 Plane::~Plane()
@@ -58,6 +325,64 @@ Plane::~Plane()
 		close(fd_);
 }
 
+/**
+ * \brief Copy assignment operator, duplicate the dmabuf file handle of \a
+ * other and share its CPU mapping
+ * \param[in] other The other plane
+ * \return A reference to this plane
+ */
+Plane &Plane::operator=(const Plane &other)
+{
+	if (this == &other)
+		return *this;
+
+	munmap();
+	if (fd_ != -1)
+		close(fd_);
+
+	fd_ = other.fd_ != -1 ? dup(other.fd_) : -1;
+	length_ = other.length_;
+	mem_ = 0;
+	userptr_ = other.userptr_;
+
+	if (userptr_) {
+		mem_ = other.mem_;
+	} else if (other.mem_ && fd_ != -1) {
+		PlaneMappingRegistry::instance()->ref(other.mem_);
+		mem_ = other.mem_;
+	}
+
+	return *this;
+}
+
+/**
+ * \brief Move assignment operator, transfer the dmabuf file handle and CPU
+ * mapping of \a other to this plane
+ * \param[in] other The other plane
+ * \return A reference to this plane
+ */
+Plane &Plane::operator=(Plane &&other)
+{
+	if (this == &other)
+		return *this;
+
+	munmap();
+	if (fd_ != -1)
+		close(fd_);
+
+	fd_ = other.fd_;
+	length_ = other.length_;
+	mem_ = other.mem_;
+	userptr_ = other.userptr_;
+
+	other.fd_ = -1;
+	other.length_ = 0;
+	other.mem_ = 0;
+	other.userptr_ = false;
+
+	return *this;
+}
+
 /**
  * \fn Plane::dmabuf()
  * \brief Get the dmabuf file handle backing the buffer
@@ -71,6 +396,10 @@ Plane::~Plane()
  * The \a fd dmabuf file handle is duplicated and stored. The caller may close
  * the original file handle.
  *
+ * Any existing CPU mapping of the plane is released. The mapping is kept in a
+ * process-wide cache and will be reused by the next call to mem() if \a fd
+ * references the same dmabuf object.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int Plane::setDmabuf(int fd, unsigned int length)
@@ -80,6 +409,8 @@ int Plane::setDmabuf(int fd, unsigned int length)
 		return -EINVAL;
 	}
 
+	munmap(true);
+
 	if (fd_ != -1) {
 		close(fd_);
 		fd_ = -1;
@@ -98,24 +429,81 @@ int Plane::setDmabuf(int fd, unsigned int length)
 	return 0;
 }
 
+/**
+ * \brief Set the application memory backing the plane
+ * \param[in] address The CPU address of the memory region
+ * \param[in] length The size of the memory region
+ *
+ * Reference a memory region allocated by the application, for use with streams
+ * of the UserPtrMemory type. Any dmabuf file handle and CPU mapping previously
+ * associated with the plane are released. The memory isn't copied, and the
+ * caller shall keep it valid until the plane is destroyed or assigned another
+ * backing memory.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::setUserPtr(void *address, unsigned int length)
+{
+	if (!address || !length) {
+		LOG(Buffer, Error) << "Invalid user memory provided";
+		return -EINVAL;
+	}
+
+	munmap(true);
+
+	if (fd_ != -1) {
+		close(fd_);
+		fd_ = -1;
+	}
+
+	mem_ = address;
+	length_ = length;
+	userptr_ = true;
+
+	return 0;
+}
+
+/**
+ * \fn Plane::isUserPtr()
+ * \brief Check if the plane references application memory
+ * \return True if the plane memory was set by setUserPtr(), false otherwise
+ */
+
 /**
  * \brief Map the plane memory data to a CPU accessible address
+ * \param[in] populate Prefault the page tables of the mapping
  *
  * The file descriptor to map the memory from must be set by a call to
- * setDmaBuf() before calling this function.
+ * setDmaBuf() before calling this function. If the plane length is unknown, the
+ * size of the dmabuf is used.
+ *
+ * An existing mapping of the same dmabuf object is reused if available.
  *
  * \sa setDmaBuf()
  *
  * \return 0 on success or a negative error code otherwise
  */
-int Plane::mmap()
+int Plane::mmap(bool populate)
 {
 	void *map;
 
 	if (mem_)
 		return 0;
 
-	map = ::mmap(NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (fd_ == -1)
+		return -EINVAL;
+
+	if (!length_) {
+		off_t size = lseek(fd_, 0, SEEK_END);
+		if (size <= 0) {
+			LOG(Buffer, Error) << "Unable to determine plane size";
+			return -EINVAL;
+		}
+
+		length_ = size;
+	}
+
+	map = PlaneMappingRegistry::instance()->map(fd_, length_, populate);
 	if (map == MAP_FAILED) {
 		int ret = -errno;
 		LOG(Buffer, Error)
@@ -130,20 +518,29 @@ int Plane::mmap()
 
 /**
  * \brief Unmap any existing CPU accessible mapping
+ * \param[in] cache Keep the mapping cached for reuse when unused
  *
- * Unmap the memory mapped by an earlier call to mmap().
+ * Release the memory mapped by an earlier call to mmap(). The memory is
+ * unmapped when the last plane referencing it releases it, unless \a cache is
+ * true in which case the mapping is kept for reuse.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int Plane::munmap()
+int Plane::munmap(bool cache)
 {
 	int ret = 0;
 
+	if (userptr_) {
+		/* The application owns the memory, just drop the reference. */
+		mem_ = 0;
+		userptr_ = false;
+		return 0;
+	}
+
 	if (mem_)
-		ret = ::munmap(mem_, length_);
+		ret = PlaneMappingRegistry::instance()->unmap(mem_, cache);
 
 	if (ret) {
-		ret = -errno;
 		LOG(Buffer, Warning)
 			<< "Failed to unmap plane: " << strerror(-ret);
 	} else {
@@ -166,12 +563,262 @@ void *Plane::mem()
 	return mem_;
 }
 
+/**
+ * \brief Map and prefault the memory of the Plane
+ *
+ * The first CPU access to each page of a plane mapping causes a page fault,
+ * which for full frames adds up to a noticeable latency on the first frames
+ * captured. This method maps the plane if not already mapped and populates
+ * its page tables, such that subsequent accesses through mem() have the same
+ * cost as in steady state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::prefault()
+{
+	if (!mem_)
+		return mmap(true);
+
+	/*
+	 * The plane is already mapped, possibly through a cached mapping.
+	 * Hint the kernel that the pages will be needed soon.
+	 */
+	if (madvise(mem_, length_, MADV_WILLNEED) < 0) {
+		int ret = -errno;
+		LOG(Buffer, Debug)
+			<< "Failed to prefault plane: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * \fn Plane::length()
  * \brief Retrieve the length of the memory region
  * \return The length of the memory region
  */
 
+/**
+ * \brief Prepare the plane memory for CPU access
+ * \param[in] access The type of CPU access
+ *
+ * Synchronise the CPU caches with the memory to make data written by devices
+ * visible to the CPU. This method shall be called before the CPU accesses the
+ * memory through the pointer returned by mem(), and be matched by a call to
+ * endCpuAccess() with the same \a access once the CPU access completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::beginCpuAccess(Access access)
+{
+	return sync(DMA_BUF_SYNC_START | access);
+}
+
+/**
+ * \brief Complete CPU access to the plane memory
+ * \param[in] access The type of CPU access
+ *
+ * Synchronise the memory with the CPU caches to make data written by the CPU
+ * visible to devices. This method shall be called after the CPU is done
+ * accessing the memory.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::endCpuAccess(Access access)
+{
+	return sync(DMA_BUF_SYNC_END | access);
+}
+
+int Plane::sync(uint64_t flags)
+{
+	static_assert(AccessRead == DMA_BUF_SYNC_READ &&
+		      AccessWrite == DMA_BUF_SYNC_WRITE,
+		      "Plane access flags don't match DMA_BUF_SYNC flags");
+
+	/* The kernel handles cache coherency for user pointer memory. */
+	if (userptr_)
+		return 0;
+
+	if (fd_ == -1)
+		return -EINVAL;
+
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	int ret;
+	do {
+		ret = ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0) {
+		ret = -errno;
+
+		/* Memory that isn't backed by a dmabuf needs no sync. */
+		if (ret == -ENOTTY)
+			return 0;
+
+		LOG(Buffer, Error)
+			<< "Failed to sync plane: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \class PlaneArray
+ * \brief Fixed-capacity inline storage for the planes of a buffer
+ *
+ * Buffers have at most three planes. The PlaneArray stores them inline in the
+ * BufferMemory instead of allocating them from the heap, such that filling the
+ * planes of a buffer each time it is queued, or copying buffer memory to share
+ * it with IPA modules, doesn't allocate memory.
+ *
+ * The PlaneArray implements the subset of the std::vector interface used with
+ * planes. Growing the array past its max_size() results in undefined
+ * behaviour, callers that fill the array from external sources shall check
+ * the number of planes first.
+ */
+
+/**
+ * \var PlaneArray::Capacity
+ * \brief The maximum number of planes in a buffer
+ */
+
+/**
+ * \typedef PlaneArray::iterator
+ * \brief Iterator for the planes in the array
+ */
+
+/**
+ * \typedef PlaneArray::const_iterator
+ * \brief Const iterator for the planes in the array
+ */
+
+/**
+ * \brief Construct an empty plane array
+ */
+PlaneArray::PlaneArray()
+	: size_(0)
+{
+}
+
+/**
+ * \fn PlaneArray::begin()
+ * \brief Retrieve an iterator to the first plane
+ * \return An iterator to the first plane
+ */
+
+/**
+ * \fn PlaneArray::begin() const
+ * \brief Retrieve a const iterator to the first plane
+ * \return A const iterator to the first plane
+ */
+
+/**
+ * \fn PlaneArray::end()
+ * \brief Retrieve an iterator pointing to the past-the-end plane
+ * \return An iterator to the element following the last plane
+ */
+
+/**
+ * \fn PlaneArray::end() const
+ * \brief Retrieve a const iterator pointing to the past-the-end plane
+ * \return A const iterator to the element following the last plane
+ */
+
+/**
+ * \fn PlaneArray::empty()
+ * \brief Check if the array contains no plane
+ * \return True if the array is empty, false otherwise
+ */
+
+/**
+ * \fn PlaneArray::size()
+ * \brief Retrieve the number of planes in the array
+ * \return The number of planes
+ */
+
+/**
+ * \fn PlaneArray::max_size()
+ * \brief Retrieve the maximum number of planes the array can store
+ * \return The capacity of the array
+ */
+
+/**
+ * \fn Plane &PlaneArray::operator[](unsigned int index)
+ * \brief Retrieve a plane by index
+ * \param[in] index The plane index, shall be lower than size()
+ * \return A reference to the plane
+ */
+
+/**
+ * \fn const Plane &PlaneArray::operator[](unsigned int index) const
+ * \brief Retrieve a const plane by index
+ * \param[in] index The plane index, shall be lower than size()
+ * \return A const reference to the plane
+ */
+
+/**
+ * \fn PlaneArray::front()
+ * \brief Retrieve the first plane, the array shall not be empty
+ * \return A reference to the first plane
+ */
+
+/**
+ * \fn PlaneArray::front() const
+ * \brief Retrieve the first plane, the array shall not be empty
+ * \return A const reference to the first plane
+ */
+
+/**
+ * \fn PlaneArray::back()
+ * \brief Retrieve the last plane, the array shall not be empty
+ * \return A reference to the last plane
+ */
+
+/**
+ * \fn PlaneArray::back() const
+ * \brief Retrieve the last plane, the array shall not be empty
+ * \return A const reference to the last plane
+ */
+
+/**
+ * \brief Append an empty plane to the array
+ *
+ * The array shall contain less than max_size() planes.
+ *
+ * \return A reference to the new plane
+ */
+Plane &PlaneArray::emplace_back()
+{
+	return planes_[size_++];
+}
+
+/**
+ * \brief Resize the array
+ * \param[in] size The new number of planes, up to max_size()
+ *
+ * Planes removed from the array are reset, releasing their memory. Planes
+ * added to the array are empty.
+ */
+void PlaneArray::resize(unsigned int size)
+{
+	for (unsigned int i = size; i < size_; ++i)
+		planes_[i] = Plane();
+
+	size_ = size;
+}
+
+/**
+ * \brief Remove all planes from the array
+ */
+void PlaneArray::clear()
+{
+	resize(0);
+}
+
 /**
  * \class BufferMemory
  * \brief A memory buffer to store an image
@@ -181,6 +828,14 @@ void *Plane::mem()
  * image format is multi-planar.
  */
 
+/**
+ * \brief Construct a BufferMemory without planes, accessible by the CPU
+ */
+BufferMemory::BufferMemory()
+	: deviceOnly_(false)
+{
+}
+
 /**
  * \fn BufferMemory::planes() const
  * \brief Retrieve the planes within the buffer
@@ -193,6 +848,153 @@ void *Plane::mem()
  * \return A reference to a vector holding all Planes within the buffer
  */
 
+/**
+ * \fn BufferMemory::deviceOnly()
+ * \brief Check if the buffer is only accessed by devices
+ * \return True if the CPU never accesses the buffer, false otherwise
+ * \sa setDeviceOnly()
+ */
+
+/**
+ * \fn BufferMemory::setDeviceOnly()
+ * \brief Mark the buffer as only accessed by devices
+ * \param[in] deviceOnly True if the CPU never accesses the buffer
+ *
+ * Queuing a buffer to a V4L2 device cleans the CPU caches for the buffer
+ * memory, and dequeuing it invalidates them, so that the CPU and the device
+ * see the same data. On platforms where DMA isn't cache coherent, this cache
+ * maintenance is a significant CPU cost at high resolutions, and is wasted for
+ * buffers that are only passed from one device to another.
+ *
+ * Buffers marked as device-only are queued with the V4L2 hints to skip cache
+ * maintenance. Pipeline handlers mark their internal buffers this way, and
+ * applications may mark the buffers of streams they never map. The content of
+ * a device-only buffer read by the CPU is undefined.
+ *
+ * Cache maintenance hints are honoured by the kernel for buffers allocated by
+ * the V4L2 device only, when the device supports them, and are otherwise
+ * ignored.
+ */
+
+/**
+ * \brief Map and prefault the memory of all planes
+ * \sa Plane::prefault()
+ * \return 0 on success or a negative error code otherwise
+ */
+int BufferMemory::prefault()
+{
+	for (Plane &plane : planes_) {
+		int ret = plane.prefault();
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Prepare the memory of all planes for CPU access
+ * \param[in] access The type of CPU access
+ *
+ * If CPU access can't be prepared for one of the planes, CPU access is
+ * completed for the planes it has been prepared for, and the caller shall not
+ * call endCpuAccess().
+ *
+ * \sa Plane::beginCpuAccess()
+ * \return 0 on success or a negative error code otherwise
+ */
+int BufferMemory::beginCpuAccess(Plane::Access access)
+{
+	for (auto plane = planes_.begin(); plane != planes_.end(); ++plane) {
+		int ret = plane->beginCpuAccess(access);
+		if (!ret)
+			continue;
+
+		while (plane != planes_.begin())
+			(--plane)->endCpuAccess(access);
+
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Complete CPU access to the memory of all planes
+ * \param[in] access The type of CPU access
+ * \sa Plane::endCpuAccess()
+ * \return 0 on success or a negative error code otherwise
+ */
+int BufferMemory::endCpuAccess(Plane::Access access)
+{
+	int ret = 0;
+
+	for (Plane &plane : planes_) {
+		int err = plane.endCpuAccess(access);
+		if (err && !ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+/**
+ * \class CpuAccess
+ * \brief Scoped CPU access to plane or buffer memory
+ *
+ * The CpuAccess class brackets CPU access to the memory of a Plane or of all
+ * the planes of a BufferMemory for the duration of its lifetime. CPU access is
+ * started when the instance is constructed, and completed when it is
+ * destroyed.
+ *
+ * \code{.cpp}
+ * {
+ *	CpuAccess access(memory, Plane::AccessRead);
+ *	process(memory.planes()[0].mem());
+ * }
+ * \endcode
+ */
+
+/**
+ * \brief Begin CPU access to the memory of \a plane
+ * \param[in] plane The plane
+ * \param[in] access The type of CPU access
+ */
+CpuAccess::CpuAccess(Plane &plane, Plane::Access access)
+	: plane_(&plane), memory_(nullptr), access_(access)
+{
+	status_ = plane_->beginCpuAccess(access_);
+}
+
+/**
+ * \brief Begin CPU access to the memory of all planes of \a memory
+ * \param[in] memory The buffer memory
+ * \param[in] access The type of CPU access
+ */
+CpuAccess::CpuAccess(BufferMemory &memory, Plane::Access access)
+	: plane_(nullptr), memory_(&memory), access_(access)
+{
+	status_ = memory_->beginCpuAccess(access_);
+}
+
+CpuAccess::~CpuAccess()
+{
+	if (status_)
+		return;
+
+	if (plane_)
+		plane_->endCpuAccess(access_);
+	else
+		memory_->endCpuAccess(access_);
+}
+
+/**
+ * \fn CpuAccess::status()
+ * \brief Retrieve the status of the CPU access start
+ * \return 0 if CPU access was started successfully, or a negative error code
+ * otherwise
+ */
+
 /**
  * \class BufferPool
  * \brief A pool of buffers
@@ -210,21 +1012,53 @@ BufferPool::~BufferPool()
 /**
  * \brief Create buffers in the Pool
  * \param[in] count The number of buffers to create
+ *
+ * Storage is reserved for at least MAX_POOL_BUFFERS buffers, such that the
+ * pool can later be grown with addBuffers() without relocating the existing
+ * buffers.
  */
 void BufferPool::createBuffers(unsigned int count)
 {
+	buffers_.reserve(std::max(count, MAX_POOL_BUFFERS));
 	buffers_.resize(count);
 }
 
+/**
+ * \brief Add buffers to the pool
+ * \param[in] count The number of buffers to add
+ *
+ * Grow the pool by \a count empty buffers. The existing buffers are not
+ * relocated, and references to them stay valid. The pool can't be grown past
+ * the storage reserved by createBuffers().
+ *
+ * \return The index of the first added buffer on success, or a negative error
+ * code otherwise
+ * \retval -ENOSPC The pool can't be grown by \a count buffers
+ */
+int BufferPool::addBuffers(unsigned int count)
+{
+	unsigned int first = buffers_.size();
+	if (first + count > buffers_.capacity())
+		return -ENOSPC;
+
+	buffers_.resize(first + count);
+
+	return first;
+}
+
 /**
  * \brief Release all buffers from pool
  *
  * If no buffers have been created or if buffers have already been released no
  * operation is performed.
+ *
+ * All unused CPU mappings cached for reuse by Plane::setDmabuf() are released,
+ * to allow the devices that have allocated the buffers to free them.
  */
 void BufferPool::destroyBuffers()
 {
 	buffers_.resize(0);
+	PlaneMappingRegistry::instance()->purge();
 }
 
 /**
@@ -251,6 +1085,13 @@ void BufferPool::destroyBuffers()
  * Buffer instances are allocated dynamically for a stream through
  * Stream::createBuffer(), added to a request with Request::addBuffer() and
  * deleted automatically after the request complete handler returns.
+ *
+ * Alternatively, streams using the InternalMemory type provide one
+ * preconstructed Buffer instance per buffer memory, retrieved with
+ * Stream::buffer(). Those instances are owned by the stream, are not deleted
+ * when the request they have been added to completes, and can be added to a
+ * new request from the request completion handler without any memory
+ * allocation.
  */
 
 /**
@@ -258,13 +1099,19 @@ void BufferPool::destroyBuffers()
  * Buffer completion status
  * \var Buffer::BufferSuccess
  * The buffer has completed with success and contains valid data. All its other
- * metadata (such as bytesused(), timestamp() or sequence() number) are valid.
+ * metadata (such as bytesused(), planesBytesused(), timestamp() or sequence()
+ * number) are valid.
  * \var Buffer::BufferError
  * The buffer has completed with an error and doesn't contain valid data. Its
  * other metadata are valid.
  * \var Buffer::BufferCancelled
  * The buffer has been cancelled due to capture stop. Its other metadata are
  * invalid and shall not be used.
+ * \var Buffer::BufferSkipped
+ * The buffer hasn't been filled as its stream skips the frame, due to the
+ * stream frame decimation. Its other metadata are invalid and shall not be
+ * used. Unlike cancelled buffers, skipped buffers don't cause the request to
+ * complete in the cancelled state.
  */
 
 /**
@@ -277,16 +1124,26 @@ void BufferPool::destroyBuffers()
 Buffer::Buffer(unsigned int index, const Buffer *metadata)
 	: index_(index), dmabuf_({ -1, -1, -1 }),
 	  status_(Buffer::BufferSuccess), request_(nullptr),
-	  stream_(nullptr)
+	  stream_(nullptr), recyclable_(false), holds_(0)
 {
 	if (metadata) {
 		bytesused_ = metadata->bytesused_;
+		planesBytesused_ = metadata->planesBytesused_;
+		planesOffset_ = metadata->planesOffset_;
+		modifier_ = metadata->modifier_;
 		sequence_ = metadata->sequence_;
 		timestamp_ = metadata->timestamp_;
+		timestampClock_ = metadata->timestampClock_;
+		timestampSource_ = metadata->timestampSource_;
 	} else {
 		bytesused_ = 0;
+		planesBytesused_ = { 0, 0, 0 };
+		planesOffset_ = { 0, 0, 0 };
+		modifier_ = 0;
 		sequence_ = 0;
 		timestamp_ = 0;
+		timestampClock_ = ClockUnknown;
+		timestampSource_ = TimestampEndOfFrame;
 	}
 }
 
@@ -323,15 +1180,95 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  * \return Number of bytes occupied in the buffer
  */
 
+/**
+ * \fn Buffer::planesBytesused()
+ * \brief Retrieve the number of bytes of valid data in each buffer plane
+ *
+ * The planesBytesused array contains one entry per plane, in the same order as
+ * the dmabufs() and the BufferMemory planes. Each entry reports the size of the
+ * payload stored in the plane, starting at the corresponding planesOffset().
+ * Unused entries are set to 0.
+ *
+ * Unlike bytesused(), which reports the total for the whole buffer, this allows
+ * locating the data of each plane of multi-planar formats, and only processing
+ * the valid payload of variable size formats such as MJPEG.
+ *
+ * \return The number of bytes of valid data in each plane
+ */
+
+/**
+ * \fn Buffer::planesOffset()
+ * \brief Retrieve the offset of the valid data in each buffer plane
+ *
+ * The planesOffset array contains one entry per plane, expressed in bytes from
+ * the start of the plane. Unused entries are set to 0.
+ *
+ * \return The offset of the valid data in each plane
+ */
+
+/**
+ * \fn Buffer::modifier()
+ * \brief Retrieve the DRM format modifier of the buffer contents
+ *
+ * The modifier describes the memory layout of the image stored in the buffer,
+ * as configured with StreamConfiguration::modifier. It is set when the buffer
+ * completes, and is 0, DRM_FORMAT_MOD_LINEAR, for linear images.
+ *
+ * \return The DRM format modifier of the buffer contents
+ */
+
 /**
  * \fn Buffer::timestamp()
  * \brief Retrieve the time when the buffer was processed
  *
- * The timestamp is expressed as a number of nanoseconds since the epoch.
+ * The timestamp is expressed as a number of nanoseconds in the clock domain
+ * reported by timestampClock(), and refers to the event of the frame reported
+ * by timestampSource().
  *
  * \return Timestamp when the buffer was processed
  */
 
+/**
+ * \enum Buffer::Clock
+ * \brief The clock domain of a buffer timestamp
+ * \var Buffer::ClockUnknown
+ * The timestamp clock is unknown, for instance when the driver copies the
+ * timestamps of memory-to-memory devices from their input buffers
+ * \var Buffer::ClockMonotonic
+ * The timestamp is expressed on the CLOCK_MONOTONIC clock
+ * \var Buffer::ClockBoottime
+ * The timestamp is expressed on the CLOCK_BOOTTIME clock, which includes the
+ * time spent in suspend
+ * \var Buffer::ClockRealtime
+ * The timestamp is expressed on the CLOCK_REALTIME clock
+ */
+
+/**
+ * \enum Buffer::TimestampSource
+ * \brief The frame event a buffer timestamp refers to
+ * \var Buffer::TimestampEndOfFrame
+ * The timestamp has been taken when the last pixel of the frame has been
+ * received
+ * \var Buffer::TimestampStartOfExposure
+ * The timestamp has been taken when the exposure of the frame started
+ */
+
+/**
+ * \fn Buffer::timestampClock()
+ * \brief Retrieve the clock domain of the buffer timestamp
+ *
+ * Timestamps are converted by the camera to the clock domain requested with
+ * CameraConfiguration::setTimestampClock() when their clock is known.
+ *
+ * \return The clock domain of the buffer timestamp
+ */
+
+/**
+ * \fn Buffer::timestampSource()
+ * \brief Retrieve the frame event the buffer timestamp refers to
+ * \return The frame event the buffer timestamp refers to
+ */
+
 /**
  * \fn Buffer::sequence()
  * \brief Retrieve the buffer sequence number
@@ -382,17 +1319,81 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  * is not associated with a stream
  */
 
+/**
+ * \fn Buffer::held()
+ * \brief Check if the buffer is held by a BufferRef
+ *
+ * A held buffer can't be added to a request or queued to a camera until all
+ * the BufferRef instances referencing it have been destroyed or reset.
+ *
+ * \return True if the buffer is held, false otherwise
+ */
+
 /**
  * \brief Mark a buffer as cancel by setting its status to BufferCancelled
  */
 void Buffer::cancel()
 {
 	bytesused_ = 0;
+	planesBytesused_ = { 0, 0, 0 };
+	planesOffset_ = { 0, 0, 0 };
+	modifier_ = 0;
 	timestamp_ = 0;
+	timestampClock_ = ClockUnknown;
+	timestampSource_ = TimestampEndOfFrame;
 	sequence_ = 0;
 	status_ = BufferCancelled;
 }
 
+/**
+ * \brief Mark a buffer as skipped by setting its status to BufferSkipped
+ */
+void Buffer::skip()
+{
+	cancel();
+	status_ = BufferSkipped;
+}
+
+/**
+ * \brief Reset the buffer metadata and status for reuse in a new request
+ */
+void Buffer::reset()
+{
+	bytesused_ = 0;
+	planesBytesused_ = { 0, 0, 0 };
+	planesOffset_ = { 0, 0, 0 };
+	modifier_ = 0;
+	timestamp_ = 0;
+	timestampClock_ = ClockUnknown;
+	timestampSource_ = TimestampEndOfFrame;
+	sequence_ = 0;
+	status_ = BufferSuccess;
+}
+
+/**
+ * \brief Acquire a hold on the buffer
+ */
+void Buffer::hold()
+{
+	if (holds_++ == 0 && stream_)
+		stream_->heldBuffers_++;
+}
+
+/**
+ * \brief Release a hold on the buffer
+ *
+ * When the last hold is released, the Stream::bufferReleased signal is emitted
+ * to notify that the buffer can be queued again.
+ */
+void Buffer::unhold()
+{
+	if (--holds_ != 0 || !stream_)
+		return;
+
+	stream_->heldBuffers_--;
+	stream_->bufferReleased.emit(this);
+}
+
 /**
  * \fn Buffer::setRequest()
  * \brief Set the request this buffer belongs to
@@ -400,4 +1401,146 @@ void Buffer::cancel()
  * The intended callers are Request::prepare() and Request::completeBuffer().
  */
 
+/**
+ * \class BufferRef
+ * \brief A reference-counted hold on a recyclable Buffer
+ *
+ * Recyclable buffers retrieved with Stream::buffer() are normally added to a
+ * new request as soon as the request they belong to completes. When a frame
+ * needs to be processed by multiple consumers, such as an encoder, a preview
+ * sink and an analysis engine, copying it to a separate pool before requeuing
+ * the buffer is costly. The BufferRef class allows instead sharing the buffer
+ * with all consumers without copying it.
+ *
+ * Each BufferRef instance holds the buffer it references. BufferRef instances
+ * can be freely copied, and passed to consumers running in different threads.
+ * While held, the buffer can't be added to a request or queued to the camera,
+ * and Request::addBuffer() or Camera::queueRequest() return -EBUSY. When the
+ * last BufferRef referencing the buffer is destroyed or reset, the
+ * Stream::bufferReleased signal is emitted, and the buffer can be queued
+ * again. The number of buffers held and of queueing attempts rejected due to
+ * held buffers are reported by Stream::heldBuffers() and
+ * Stream::starvationCount() respectively, to help sizing the buffer pool.
+ *
+ * Only recyclable buffers can be held, as other buffers are deleted with the
+ * request they belong to. Buffers shall not be held when the camera buffers are
+ * freed.
+ */
+
+/**
+ * \brief Construct a BufferRef not referencing any buffer
+ */
+BufferRef::BufferRef()
+	: buffer_(nullptr)
+{
+}
+
+/**
+ * \brief Construct a BufferRef holding \a buffer
+ * \param[in] buffer The recyclable buffer
+ *
+ * If \a buffer is null or is not a recyclable buffer, the BufferRef is
+ * constructed invalid.
+ */
+BufferRef::BufferRef(Buffer *buffer)
+	: buffer_(nullptr)
+{
+	if (!buffer || !buffer->recyclable_) {
+		LOG(Buffer, Error) << "Only recyclable buffers can be held";
+		return;
+	}
+
+	buffer_ = buffer;
+	buffer_->hold();
+}
+
+/**
+ * \brief Copy constructor, acquire a new hold on the buffer of \a other
+ * \param[in] other The other BufferRef
+ */
+BufferRef::BufferRef(const BufferRef &other)
+	: buffer_(other.buffer_)
+{
+	if (buffer_)
+		buffer_->hold();
+}
+
+/**
+ * \brief Move constructor, transfer the hold of \a other
+ * \param[in] other The other BufferRef
+ *
+ * The \a other BufferRef is invalidated.
+ */
+BufferRef::BufferRef(BufferRef &&other)
+	: buffer_(other.buffer_)
+{
+	other.buffer_ = nullptr;
+}
+
+BufferRef::~BufferRef()
+{
+	reset();
+}
+
+/**
+ * \brief Copy assignment operator, acquire a new hold on the buffer of \a other
+ * \param[in] other The other BufferRef
+ * \return A reference to this BufferRef
+ */
+BufferRef &BufferRef::operator=(const BufferRef &other)
+{
+	if (other.buffer_)
+		other.buffer_->hold();
+
+	reset();
+	buffer_ = other.buffer_;
+
+	return *this;
+}
+
+/**
+ * \brief Move assignment operator, transfer the hold of \a other
+ * \param[in] other The other BufferRef
+ *
+ * The \a other BufferRef is invalidated.
+ *
+ * \return A reference to this BufferRef
+ */
+BufferRef &BufferRef::operator=(BufferRef &&other)
+{
+	if (this == &other)
+		return *this;
+
+	reset();
+	buffer_ = other.buffer_;
+	other.buffer_ = nullptr;
+
+	return *this;
+}
+
+/**
+ * \fn BufferRef::isValid()
+ * \brief Check if the BufferRef references a buffer
+ * \return True if the BufferRef references a buffer, false otherwise
+ */
+
+/**
+ * \fn BufferRef::buffer()
+ * \brief Retrieve the referenced buffer
+ * \return The referenced buffer, or nullptr if the BufferRef is invalid
+ */
+
+/**
+ * \brief Release the hold on the buffer and invalidate the BufferRef
+ */
+void BufferRef::reset()
+{
+	if (!buffer_)
+		return;
+
+	Buffer *buffer = buffer_;
+	buffer_ = nullptr;
+	buffer->unhold();
+}
+
 } /* namespace libcamera */
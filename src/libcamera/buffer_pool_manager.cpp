@@ -0,0 +1,411 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * buffer_pool_manager.cpp - Internal buffer pools shared between cameras
+ */
+
+#include "buffer_pool_manager.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * \file buffer_pool_manager.h
+ * \brief Internal buffer pools shared between cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(BufferPoolManager)
+
+/**
+ * \class BufferPoolManager
+ * \brief Share the intermediate buffers of a pipeline handler between cameras
+ *
+ * Pipeline handlers need internal buffers to carry frames and metadata between
+ * the devices of a camera, such as the raw frames captured by a CSI-2 receiver
+ * and processed by an ISP, or the ISP parameters and statistics. When those
+ * buffers are allocated per camera, the memory consumption grows with the
+ * number of cameras, even though the cameras of a pipeline handler often can't
+ * run concurrently.
+ *
+ * The BufferPoolManager allocates internal buffers from a dma-heap, and shares
+ * them between the cameras that can't be active together. Pipeline handlers
+ * assign each camera to a group with addCamera(). Cameras that can run
+ * concurrently shall be assigned to different groups, and cameras that can't
+ * to the same group. Pools are identified by a name, and the pool of a given
+ * name is shared by all the cameras of a group.
+ *
+ * Pools are allocated lazily when a camera acquires them with acquire(), and
+ * are reused as long as their buffers are large enough for the requested
+ * format and number of buffers. They are otherwise reallocated. The pools of a
+ * camera are returned with release(), and their memory is freed, either
+ * immediately, or once the idle period set with setIdlePeriod() expires
+ * without the pools being acquired again.
+ *
+ * When no dma-heap is available, the pools are exported by the video device
+ * passed to acquire(), and thus can't be shared or retained. They're freed
+ * when the camera releases them.
+ *
+ * The BufferPoolManager shall be created, used and destroyed in the pipeline
+ * handler thread.
+ */
+
+/**
+ * \brief Construct a BufferPoolManager allocating from a dma-heap of \a type
+ * \param[in] type The type of dma-heap
+ *
+ * Use the DmaHeap::Cma type for devices that require physically contiguous
+ * memory.
+ */
+BufferPoolManager::BufferPoolManager(DmaHeap::Type type)
+	: heap_(type), idlePeriod_(0)
+{
+	idleTimer_.timeout.connect(this, &BufferPoolManager::idleTimeout);
+}
+
+/**
+ * \brief Destroy the BufferPoolManager and free all its pools
+ *
+ * All the pools shall have been released, and the buffers imported from them
+ * released by the devices.
+ */
+BufferPoolManager::~BufferPoolManager()
+{
+	for (auto &entry : slots_)
+		free(&entry.second);
+}
+
+/**
+ * \fn BufferPoolManager::isValid()
+ * \brief Check if pools can be allocated from a dma-heap and shared
+ * \return True if the dma-heap is available, false otherwise
+ */
+
+/**
+ * \fn BufferPoolManager::setIdlePeriod()
+ * \brief Set the time the released pools are retained for
+ * \param[in] msec The idle period in milliseconds, 0 to free pools on release
+ *
+ * Retaining the pools avoids reallocating them when a camera is restarted, or
+ * when another camera of the same group starts, shortly after they have been
+ * released. The idle period is 0 by default.
+ */
+
+/**
+ * \brief Assign a camera to a group of cameras sharing pools
+ * \param[in] data The camera data
+ * \param[in] group The group
+ *
+ * All the cameras in \a group share the same pools, and shall thus never be
+ * active at the same time. Cameras shall be added before they acquire pools.
+ */
+void BufferPoolManager::addCamera(const CameraData *data, unsigned int group)
+{
+	groups_[data] = group;
+}
+
+/**
+ * \brief Acquire a pool of dmabuf buffers for the camera \a data
+ * \param[in] data The camera data
+ * \param[in] name The pool name
+ * \param[in] format The format describing the size of each plane
+ * \param[in] count The number of buffers
+ *
+ * Acquire the pool \a name of the group of the camera, and populate it with
+ * \a count buffers backed by dmabufs large enough for \a format. The memory is
+ * allocated when the pool doesn't exist yet or is too small, and reused
+ * otherwise. The returned pool can be imported by any number of devices.
+ *
+ * The pool stays owned by the camera until it is released with release(), and
+ * can't be acquired by another camera of the group in the meantime. The camera
+ * may acquire it again, which replaces the buffers of the pool.
+ *
+ * \return The pool on success, or nullptr if no dma-heap is available, if the
+ * pool is in use or if allocation fails
+ */
+BufferPool *BufferPoolManager::acquire(const CameraData *data,
+				       const std::string &name,
+				       const V4L2DeviceFormat &format,
+				       unsigned int count)
+{
+	if (!isValid())
+		return nullptr;
+
+	Slot *s = slot(data, name);
+	if (!s)
+		return nullptr;
+
+	int ret = populate(s, format, count);
+	if (ret)
+		return nullptr;
+
+	s->user = data;
+
+	return &s->pool;
+}
+
+/**
+ * \brief Acquire a pool of buffers for the camera \a data and \a video
+ * \param[in] data The camera data
+ * \param[in] name The pool name
+ * \param[in] video The video device the buffers are used with
+ * \param[in] count The number of buffers
+ *
+ * Acquire the pool \a name sized for the current format of \a video, and
+ * import it in \a video. When no dma-heap is available, buffers are exported
+ * by \a video instead, and the pool isn't shared. In both cases the pool can
+ * be imported by other devices.
+ *
+ * \return The pool on success, or nullptr otherwise
+ */
+BufferPool *BufferPoolManager::acquire(const CameraData *data,
+				       const std::string &name,
+				       V4L2VideoDevice *video,
+				       unsigned int count)
+{
+	int ret;
+
+	if (!isValid()) {
+		Slot *s = slot(data, name);
+		if (!s)
+			return nullptr;
+
+		s->pool.createBuffers(count);
+		ret = video->exportBuffers(&s->pool);
+		if (ret) {
+			s->pool.destroyBuffers();
+			return nullptr;
+		}
+
+		s->user = data;
+
+		return &s->pool;
+	}
+
+	V4L2DeviceFormat format = {};
+	ret = video->getFormat(&format);
+	if (ret)
+		return nullptr;
+
+	Slot *s = slot(data, name);
+	if (!s)
+		return nullptr;
+
+	ret = populate(s, format, count);
+	if (ret)
+		return nullptr;
+
+	ret = video->importBuffers(&s->pool);
+	if (ret) {
+		if (put(s))
+			idleTimer_.start(idlePeriod_);
+		return nullptr;
+	}
+
+	s->user = data;
+
+	return &s->pool;
+}
+
+/**
+ * \brief Release the pools acquired by the camera \a data
+ * \param[in] data The camera data
+ *
+ * The devices shall have released the buffers of the pools before this method
+ * is called. The pools memory is freed when the idle period expires, or
+ * immediately if no idle period is set.
+ */
+void BufferPoolManager::release(const CameraData *data)
+{
+	bool idle = false;
+
+	for (auto &entry : slots_) {
+		Slot *s = &entry.second;
+		if (s->user != data)
+			continue;
+
+		idle |= put(s);
+	}
+
+	if (idle)
+		idleTimer_.start(idlePeriod_);
+}
+
+/**
+ * \brief Retrieve the memory allocated for all the pools
+ *
+ * Pools exported by video devices when no dma-heap is available aren't
+ * accounted for.
+ *
+ * \return The allocated size in bytes
+ */
+size_t BufferPoolManager::allocatedSize() const
+{
+	size_t size = 0;
+
+	for (const auto &entry : slots_) {
+		const Slot &s = entry.second;
+		for (unsigned int p = 0; p < s.planesCount; ++p)
+			size += s.sizes[p] * s.dmabufs.size();
+	}
+
+	return size;
+}
+
+BufferPoolManager::Slot *BufferPoolManager::slot(const CameraData *data,
+						 const std::string &name)
+{
+	auto group = groups_.find(data);
+	if (group == groups_.end()) {
+		LOG(BufferPoolManager, Error)
+			<< "Camera not assigned to a group";
+		return nullptr;
+	}
+
+	Slot *s = &slots_[{ group->second, name }];
+	if (s->user && s->user != data) {
+		LOG(BufferPoolManager, Error)
+			<< "Pool " << name << " in use by another camera";
+		return nullptr;
+	}
+
+	/* The camera acquires the pool again, after a failed allocation. */
+	s->pool.destroyBuffers();
+
+	return s;
+}
+
+int BufferPoolManager::allocate(Slot *slot, const V4L2DeviceFormat &format,
+				unsigned int count)
+{
+	if (!format.planesCount || format.planesCount > 3)
+		return -EINVAL;
+
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	std::array<size_t, 3> sizes = {};
+	bool fits = slot->planesCount == format.planesCount &&
+		    slot->dmabufs.size() >= count;
+
+	for (unsigned int p = 0; p < format.planesCount; ++p) {
+		sizes[p] = (format.planes[p].size + pageSize - 1)
+			 / pageSize * pageSize;
+		if (slot->sizes[p] < sizes[p])
+			fits = false;
+	}
+
+	if (fits)
+		return 0;
+
+	free(slot);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::array<int, 3> fds = { -1, -1, -1 };
+
+		for (unsigned int p = 0; p < format.planesCount; ++p) {
+			int fd = heap_.alloc(sizes[p]);
+			if (fd < 0) {
+				for (int other : fds) {
+					if (other >= 0)
+						::close(other);
+				}
+
+				free(slot);
+				return fd;
+			}
+
+			fds[p] = fd;
+		}
+
+		slot->dmabufs.push_back(fds);
+	}
+
+	slot->planesCount = format.planesCount;
+	slot->sizes = sizes;
+
+	LOG(BufferPoolManager, Debug)
+		<< "Allocated " << count << " buffers for "
+		<< format.toString() << ", " << allocatedSize()
+		<< " bytes in use";
+
+	return 0;
+}
+
+/*
+ * Fill the pool of \a slot with \a count buffers for \a format, allocating the
+ * memory if needed.
+ */
+int BufferPoolManager::populate(Slot *slot, const V4L2DeviceFormat &format,
+				unsigned int count)
+{
+	int ret = allocate(slot, format, count);
+	if (ret)
+		return ret;
+
+	slot->pool.createBuffers(count);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		PlaneArray &planes = slot->pool.buffers()[i].planes();
+
+		planes.clear();
+		for (unsigned int p = 0; p < format.planesCount; ++p) {
+			planes.emplace_back();
+			ret = planes.back().setDmabuf(slot->dmabufs[i][p],
+						      format.planes[p].size);
+			if (ret) {
+				slot->pool.destroyBuffers();
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Return the pool of \a slot, and free its memory unless it is retained for
+ * the idle period. Return true if the memory is retained.
+ */
+bool BufferPoolManager::put(Slot *slot)
+{
+	slot->user = nullptr;
+	slot->pool.destroyBuffers();
+
+	if (!idlePeriod_) {
+		free(slot);
+		return false;
+	}
+
+	return !slot->dmabufs.empty();
+}
+
+void BufferPoolManager::free(Slot *slot)
+{
+	for (const std::array<int, 3> &fds : slot->dmabufs) {
+		for (int fd : fds) {
+			if (fd >= 0)
+				::close(fd);
+		}
+	}
+
+	slot->dmabufs.clear();
+	slot->planesCount = 0;
+	slot->sizes = {};
+}
+
+void BufferPoolManager::idleTimeout(Timer *timer)
+{
+	for (auto &entry : slots_) {
+		Slot *s = &entry.second;
+		if (!s->user)
+			free(s);
+	}
+
+	LOG(BufferPoolManager, Debug)
+		<< "Freed idle pools, " << allocatedSize() << " bytes in use";
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * byte_stream_buffer.cpp - Byte stream buffer
+ */
+
+#include "byte_stream_buffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <utility>
+
+#include "log.h"
+
+/**
+ * \file byte_stream_buffer.h
+ * \brief Buffer to read or write a byte stream
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Serialization)
+
+/**
+ * \class ByteStreamBuffer
+ * \brief Wrap a memory buffer and provide sequential data read and write
+ *
+ * The ByteStreamBuffer class wraps a memory buffer and exposes sequential read
+ * and write operation with integrated boundary checks. Access beyond the end
+ * of the buffer are blocked and logged, allowing error checks to take place at
+ * the end of access operations instead of at each access. This simplifies
+ * serialization and deserialization of data.
+ *
+ * A byte stream buffer is created with a base memory pointer and a size. If the
+ * memory pointer is const, the buffer operates in read-only mode, and write
+ * operations are denied. Otherwise the buffer operates in write-only mode, and
+ * read operations are denied.
+ *
+ * The buffer never allocates memory. Callers are expected to compute the size
+ * of the data to be serialized beforehand and to provide a buffer large enough
+ * to hold it.
+ *
+ * Once a buffer is created, data is read or written with read() and write()
+ * respectively. Access is strictly sequential, the buffer keeps track of the
+ * current access location and advances it automatically. Reading or writing
+ * the same location multiple times is thus not possible. Bytes may also be
+ * skipped with the skip() method.
+ *
+ * The ByteStreamBuffer also supports carving out pieces of memory into other
+ * ByteStreamBuffer instances. Like a read or write operation, a carveOut()
+ * advances the internal access location, but allows the carved out memory to
+ * be accessed at a later time.
+ *
+ * All accesses beyond the end of the buffer (read, write, skip or carve out)
+ * are blocked. The first of such accesses causes a message to be logged, and
+ * the buffer being marked as having overflown. If the buffer has been carved
+ * out from a parent buffer, the parent buffer is also marked as having
+ * overflown. Any later access on an overflown buffer is blocked. The buffer
+ * overflow status can be checked with the overflow() method.
+ */
+
+/**
+ * \brief Construct a read ByteStreamBuffer from the memory area \a base
+ * of \a size
+ * \param[in] base The address of the memory area to wrap
+ * \param[in] size The size of the memory area to wrap
+ */
+ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
+	: parent_(nullptr), base_(base), size_(size), overflow_(false),
+	  read_(base), write_(nullptr)
+{
+}
+
+/**
+ * \brief Construct a write ByteStreamBuffer from the memory area \a base
+ * of \a size
+ * \param[in] base The address of the memory area to wrap
+ * \param[in] size The size of the memory area to wrap
+ */
+ByteStreamBuffer::ByteStreamBuffer(uint8_t *base, size_t size)
+	: parent_(nullptr), base_(base), size_(size), overflow_(false),
+	  read_(nullptr), write_(base)
+{
+}
+
+/**
+ * \brief Construct a ByteStreamBuffer from the contents of \a other using move
+ * semantics
+ * \param[in] other The other buffer
+ *
+ * After the move construction the \a other buffer is invalidated. Any attempt
+ * to access its contents will be considered as an overflow.
+ */
+ByteStreamBuffer::ByteStreamBuffer(ByteStreamBuffer &&other)
+{
+	*this = std::move(other);
+}
+
+/**
+ * \brief Replace the contents of the buffer with those of \a other using move
+ * semantics
+ * \param[in] other The other buffer
+ *
+ * After the assignment the \a other buffer is invalidated. Any attempt to
+ * access its contents will be considered as an overflow.
+ */
+ByteStreamBuffer &ByteStreamBuffer::operator=(ByteStreamBuffer &&other)
+{
+	parent_ = other.parent_;
+	base_ = other.base_;
+	size_ = other.size_;
+	overflow_ = other.overflow_;
+	read_ = other.read_;
+	write_ = other.write_;
+
+	other.parent_ = nullptr;
+	other.base_ = nullptr;
+	other.size_ = 0;
+	other.overflow_ = false;
+	other.read_ = nullptr;
+	other.write_ = nullptr;
+
+	return *this;
+}
+
+/**
+ * \fn ByteStreamBuffer::base()
+ * \brief Retrieve a pointer to the start location of the managed memory buffer
+ * \return A pointer to the managed memory buffer
+ */
+
+/**
+ * \fn ByteStreamBuffer::offset()
+ * \brief Retrieve the offset of the current access location from the base
+ * \return The offset in bytes
+ */
+
+/**
+ * \fn ByteStreamBuffer::size()
+ * \brief Retrieve the size of the managed memory buffer
+ * \return The size of managed memory buffer
+ */
+
+/**
+ * \fn ByteStreamBuffer::overflow()
+ * \brief Check if the buffer has overflown
+ * \return True if the buffer has overflow, false otherwise
+ */
+
+void ByteStreamBuffer::setOverflow()
+{
+	if (parent_)
+		parent_->setOverflow();
+
+	overflow_ = true;
+}
+
+/**
+ * \brief Carve out an area of \a size bytes into a new ByteStreamBuffer
+ * \param[in] size The size of the newly created memory buffer
+ *
+ * This method carves out an area of \a size bytes from the buffer into a new
+ * ByteStreamBuffer, and returns the new buffer. It operates identically to a
+ * read or write access from the point of view of the current buffer, but allows
+ * the new buffer to be read or written at a later time after other read or
+ * write accesses on the current buffer.
+ *
+ * \return A newly created ByteStreamBuffer of \a size
+ */
+ByteStreamBuffer ByteStreamBuffer::carveOut(size_t size)
+{
+	if (!size_ || overflow_)
+		return ByteStreamBuffer(static_cast<const uint8_t *>(nullptr), 0);
+
+	const uint8_t *curr = read_ ? read_ : write_;
+	if (curr + size > base_ + size_) {
+		LOG(Serialization, Error)
+			<< "Unable to reserve " << size << " bytes";
+		setOverflow();
+
+		return ByteStreamBuffer(static_cast<const uint8_t *>(nullptr), 0);
+	}
+
+	if (read_) {
+		ByteStreamBuffer b(read_, size);
+		b.parent_ = this;
+		read_ += size;
+		return b;
+	} else {
+		ByteStreamBuffer b(write_, size);
+		b.parent_ = this;
+		write_ += size;
+		return b;
+	}
+}
+
+/**
+ * \brief Skip \a size bytes from the buffer
+ * \param[in] size The number of bytes to skip
+ *
+ * This method skips the next \a size bytes from the buffer.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+int ByteStreamBuffer::skip(size_t size)
+{
+	if (overflow_)
+		return -ENOSPC;
+
+	const uint8_t *curr = read_ ? read_ : write_;
+	if (curr + size > base_ + size_) {
+		LOG(Serialization, Error)
+			<< "Unable to skip " << size << " bytes";
+		setOverflow();
+
+		return -ENOSPC;
+	}
+
+	if (read_) {
+		read_ += size;
+	} else {
+		memset(write_, 0, size);
+		write_ += size;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Skip bytes to align the access location to \a alignment
+ * \param[in] alignment The alignment in bytes, shall be a power of two
+ *
+ * Padding bytes skipped in write mode are set to zero.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+int ByteStreamBuffer::align(size_t alignment)
+{
+	size_t offset = this->offset();
+	size_t padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+
+	return padding ? skip(padding) : 0;
+}
+
+/**
+ * \fn template<typename T> int ByteStreamBuffer::read(T *t, size_t count)
+ * \brief Read \a count values of type \a T from the buffer
+ * \param[out] t Pointer to the memory to fill with the read data
+ * \param[in] count The number of values to read
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC no more data is available in the managed memory buffer
+ */
+
+/**
+ * \fn template<typename T> const T *ByteStreamBuffer::read(size_t count)
+ * \brief Return a pointer to \a count values of type \a T in the buffer
+ * \param[in] count The number of values
+ *
+ * This method returns a pointer to the current access location in the buffer
+ * and advances it by \a count values of type \a T, without copying the data.
+ * The caller is responsible for ensuring that the data is suitably aligned for
+ * the type \a T.
+ *
+ * \return A pointer to the data in the buffer, or nullptr if there isn't
+ * enough data left in the buffer
+ */
+
+/**
+ * \fn template<typename T> int ByteStreamBuffer::write(const T *t, size_t count)
+ * \brief Write \a count values of type \a T to the buffer
+ * \param[in] t Pointer to the data to write
+ * \param[in] count The number of values to write
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+
+int ByteStreamBuffer::readBytes(uint8_t *data, size_t size)
+{
+	const uint8_t *src = readBytes(size, 1);
+	if (!src)
+		return -ENOSPC;
+
+	if (size)
+		memcpy(data, src, size);
+	return 0;
+}
+
+const uint8_t *ByteStreamBuffer::readBytes(size_t size, size_t count)
+{
+	if (!read_)
+		return nullptr;
+
+	if (overflow_)
+		return nullptr;
+
+	size *= count;
+	if (read_ + size > base_ + size_) {
+		LOG(Serialization, Error)
+			<< "Unable to read " << size << " bytes: out of bounds";
+		setOverflow();
+		return nullptr;
+	}
+
+	const uint8_t *data = read_;
+	read_ += size;
+	return data;
+}
+
+int ByteStreamBuffer::writeBytes(const uint8_t *data, size_t size)
+{
+	if (!write_)
+		return -EACCES;
+
+	if (overflow_)
+		return -ENOSPC;
+
+	if (write_ + size > base_ + size_) {
+		LOG(Serialization, Error)
+			<< "Unable to write " << size << " bytes: no space left";
+		setOverflow();
+		return -ENOSPC;
+	}
+
+	if (size)
+		memcpy(write_, data, size);
+	write_ += size;
+
+	return 0;
+}
+
+} /* namespace libcamera */
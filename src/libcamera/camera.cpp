@@ -7,13 +7,21 @@
 
 #include <libcamera/camera.h>
 
+#include <algorithm>
+#include <inttypes.h>
 #include <iomanip>
+#include <thread>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "camera_controls.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "request_arena.h"
+#include "startup_timeline.h"
+#include "tracepoints.h"
 #include "utils.h"
 
 /**
@@ -76,6 +84,17 @@ LOG_DECLARE_CATEGORY(Camera)
  * The configuration is invalid and can't be adjusted automatically
  */
 
+/**
+ * \enum CameraConfiguration::QueueProfile
+ * \brief Trade-off between latency and throughput for the buffer queues
+ * \var CameraConfiguration::Balanced
+ * Use the queue depths of the pipeline handler, suitable for most use cases
+ * \var CameraConfiguration::LowLatency
+ * Minimise the queue depths, and complete requests as soon as possible
+ * \var CameraConfiguration::Throughput
+ * Maximise the queue depths to tolerate long processing times
+ */
+
 /**
  * \typedef CameraConfiguration::iterator
  * \brief Iterator for the stream configurations in the camera configuration
@@ -91,7 +110,9 @@ LOG_DECLARE_CATEGORY(Camera)
  * \brief Create an empty camera configuration
  */
 CameraConfiguration::CameraConfiguration()
-	: config_({})
+	: config_({}), live_(false), zslFrames_(0),
+	  outOfOrderCompletion_(false), queueProfile_(Balanced),
+	  timestampClock_(Buffer::ClockMonotonic)
 {
 }
 
@@ -133,6 +154,9 @@ void CameraConfiguration::addConfiguration(const StreamConfiguration &cfg)
  * configuration carefully.
  * \retval CameraConfiguration::Valid The configuration was already valid and
  * hasn't been adjusted.
+ *
+ * In addition to the validation status, this method reports through live()
+ * whether the configuration can be applied to the camera while it is running.
  */
 
 /**
@@ -248,11 +272,283 @@ std::size_t CameraConfiguration::size() const
 	return config_.size();
 }
 
+/**
+ * \fn CameraConfiguration::live()
+ * \brief Check if the configuration can be applied to a running camera
+ *
+ * Some pipeline handlers can apply changes to the current configuration
+ * without stopping the camera, for instance when only the resolution of an
+ * output that doesn't affect capture from the sensor changes. This method
+ * reports the result of the last validate() call in that regard, and is only
+ * meaningful after the configuration has been validated.
+ *
+ * A live configuration can be passed to Camera::configure() while the camera
+ * is running. Requests in flight for the reconfigured streams may complete
+ * with cancelled buffers, while the other streams keep capturing.
+ *
+ * \return True if the configuration can be applied to the running camera,
+ * false otherwise
+ */
+
+/**
+ * \var CameraConfiguration::live_
+ * \brief Whether the configuration can be applied to a running camera
+ *
+ * This field is reset to false at construction time. Pipeline handlers that
+ * support live reconfiguration shall update it in their validate()
+ * implementation.
+ */
+
+/**
+ * \fn CameraConfiguration::zslFrames()
+ * \brief Retrieve the number of frames retained for zero shutter lag capture
+ * \return The number of retained frames
+ * \sa setZslFrames()
+ */
+
+/**
+ * \fn CameraConfiguration::setZslFrames()
+ * \brief Set the number of frames retained for zero shutter lag capture
+ * \param[in] frames The number of retained frames
+ *
+ * Pipeline handlers that support zero shutter lag capture keep the last \a
+ * frames captured from the sensor, at full resolution and with their
+ * metadata, in addition to the buffers they need for streaming. Requests can
+ * then select one of those frames with the controls::ZslTimestamp control,
+ * to process it instead of the next captured frame.
+ *
+ * The retained frames are allocated with the other internal buffers, setting
+ * this value thus bounds the memory the application dedicates to zero shutter
+ * lag. It defaults to 0, which disables frame retention. validate() reduces
+ * the value to the number of frames the pipeline handler can retain, down to
+ * 0 if it doesn't support zero shutter lag capture.
+ */
+
+/**
+ * \var CameraConfiguration::zslFrames_
+ * \brief The number of frames retained for zero shutter lag capture
+ */
+
+/**
+ * \fn CameraConfiguration::outOfOrderCompletion()
+ * \brief Check if requests can complete out of order
+ * \return True if requests can complete out of order, false otherwise
+ * \sa setOutOfOrderCompletion()
+ */
+
+/**
+ * \fn CameraConfiguration::setOutOfOrderCompletion()
+ * \brief Allow requests to complete out of order
+ * \param[in] enable True to allow out of order completion
+ *
+ * Requests complete in the order they have been queued by default, a request
+ * whose buffers have all completed is held back until all the requests queued
+ * before it have completed. When a stream is processed slower than the others,
+ * such as a still capture stream that goes through JPEG compression, it delays
+ * the completion of the requests of all the other streams.
+ *
+ * Enabling out of order completion lets requests complete as soon as all their
+ * buffers have completed. Applications shall then not rely on the completion
+ * order to identify requests, but on their cookie or sequence numbers. The
+ * frames dropped by the devices are still detected per stream, in capture
+ * order. Out of order completion is disabled by default.
+ */
+
+/**
+ * \var CameraConfiguration::outOfOrderCompletion_
+ * \brief Whether requests can complete out of order
+ */
+
+/**
+ * \fn CameraConfiguration::queueProfile()
+ * \brief Retrieve the queue profile
+ * \return The queue profile
+ * \sa setQueueProfile()
+ */
+
+/**
+ * \fn CameraConfiguration::setQueueProfile()
+ * \brief Set the queue profile
+ * \param[in] profile The queue profile
+ *
+ * Every buffer queued ahead of the one being captured adds a frame duration to
+ * the end-to-end latency, but also gives the application and the pipeline
+ * more time to process each frame before the devices run out of buffers and
+ * drop frames. The queue profile selects how this trade-off is resolved for
+ * all the queues of the camera, both the stream buffers and the internal
+ * buffers of the pipeline handler.
+ *
+ * With the Balanced profile, the default, streams use four buffers: one being
+ * captured, one queued to the device to capture the next frame without a gap,
+ * one being processed by the application and one in transit between the two.
+ * Pipeline handlers size their internal pools to similar margins.
+ *
+ * The LowLatency profile reduces all queues to their minimum depth. Internal
+ * buffers are queued to the devices just in time for the frame they are used
+ * for, and requests complete as soon as all their buffers have completed, as
+ * with setOutOfOrderCompletion(). Frames that the application can't consume
+ * in time are dropped instead of being delayed.
+ *
+ * The Throughput profile increases all queues to their maximum depth, for
+ * applications that process frames in batches or with a variable latency.
+ *
+ * validate() overrides the StreamConfiguration::bufferCount of all streams
+ * with the depth selected by the LowLatency and Throughput profiles.
+ */
+
+/**
+ * \brief Compute a queue depth for the queue profile
+ * \param[in] minimum The minimum depth of the queue
+ * \param[in] nominal The depth of the queue for the Balanced profile
+ * \param[in] maximum The maximum depth of the queue
+ *
+ * This helper is used by pipeline handlers to size their buffer queues
+ * according to the queue profile.
+ *
+ * The LowLatency profile never selects a depth larger than the \a nominal
+ * depth, and the Throughput profile never selects a smaller one, to honour
+ * nominal depths overridden by the user.
+ *
+ * \return The \a minimum depth for the LowLatency profile, the \a maximum
+ * depth for the Throughput profile, and the \a nominal depth otherwise
+ */
+unsigned int CameraConfiguration::queueDepth(unsigned int minimum,
+					     unsigned int nominal,
+					     unsigned int maximum) const
+{
+	switch (queueProfile_) {
+	case LowLatency:
+		return std::min(minimum, nominal);
+	case Throughput:
+		return std::max(maximum, nominal);
+	case Balanced:
+	default:
+		return nominal;
+	}
+}
+
+/**
+ * \var CameraConfiguration::queueProfile_
+ * \brief The queue profile
+ */
+
+/**
+ * \brief Validate the DRM format modifiers of all streams
+ *
+ * This helper is used by pipeline handlers in their validate() implementation.
+ * It resets the StreamConfiguration::modifier of every stream to
+ * DRM_FORMAT_MOD_LINEAR when it isn't advertised by the formats() of the
+ * stream for its pixel format. Pipeline handlers that don't produce non-linear
+ * layouts thus only need to call it.
+ *
+ * \return Adjusted if any modifier has been reset, Valid otherwise
+ */
+CameraConfiguration::Status CameraConfiguration::validateModifiers()
+{
+	Status status = Valid;
+
+	for (StreamConfiguration &cfg : config_) {
+		if (!cfg.modifier)
+			continue;
+
+		std::vector<uint64_t> modifiers = cfg.formats().modifiers(cfg.pixelFormat);
+		if (std::find(modifiers.begin(), modifiers.end(), cfg.modifier) !=
+		    modifiers.end())
+			continue;
+
+		LOG(Camera, Debug)
+			<< "Modifier " << utils::hex(cfg.modifier)
+			<< " not supported, using the linear layout";
+		cfg.modifier = 0;
+		status = Adjusted;
+	}
+
+	return status;
+}
+
+/**
+ * \fn CameraConfiguration::timestampClock()
+ * \brief Retrieve the clock domain of the buffer timestamps
+ * \return The clock domain of the buffer timestamps
+ * \sa setTimestampClock()
+ */
+
+/**
+ * \fn CameraConfiguration::setTimestampClock()
+ * \brief Select the clock domain of the buffer timestamps
+ * \param[in] clock The clock domain
+ *
+ * Devices timestamp buffers on different clocks, reported per buffer by
+ * Buffer::timestampClock(). The camera converts the timestamps of completed
+ * buffers to the \a clock domain, to synchronize them with audio or with
+ * other devices without converting every timestamp in the application. The
+ * offsets between the clocks are correlated periodically, no system call is
+ * made for each frame.
+ *
+ * Timestamps whose clock isn't known are not converted. Selecting the
+ * Buffer::ClockUnknown clock disables the conversion. Timestamps are
+ * converted to Buffer::ClockMonotonic by default.
+ */
+
+/**
+ * \var CameraConfiguration::timestampClock_
+ * \brief The clock domain of the buffer timestamps
+ */
+
 /**
  * \var CameraConfiguration::config_
  * \brief The vector of stream configurations
  */
 
+/**
+ * \struct StreamStatistics
+ * \brief Runtime statistics of a stream of a camera
+ * \var StreamStatistics::framesCompleted
+ * \brief The number of frames captured successfully
+ * \var StreamStatistics::framesDropped
+ * \brief The number of frames dropped by the device, computed from the gaps
+ * in the sequence numbers of the captured buffers
+ * \var StreamStatistics::queueDepth
+ * \brief The number of buffers currently queued to the stream
+ * \var StreamStatistics::maxQueueDepth
+ * \brief The maximum number of buffers queued to the stream at a time
+ */
+
+/**
+ * \struct CameraStatistics
+ * \brief A snapshot of the runtime statistics of a camera
+ * \sa Camera::statistics()
+ * \var CameraStatistics::requestsCompleted
+ * \brief The number of requests that completed successfully
+ * \var CameraStatistics::requestsCancelled
+ * \brief The number of requests that have been cancelled
+ * \var CameraStatistics::streams
+ * \brief The statistics of the streams of the capture session
+ * \var CameraStatistics::latency
+ * \brief The percentiles of the time elapsed between queueing and completing
+ * the requests, in nanoseconds
+ * \var CameraStatistics::ipaTime
+ * \brief The percentiles of the time elapsed between capturing the frames and
+ * handling the last IPA action of the requests, in nanoseconds
+ */
+
+/**
+ * \struct CameraStatistics::Percentiles
+ * \brief Percentiles of a LatencyHistogram
+ *
+ * The percentiles are upper bounds, rounded to the limit of the histogram
+ * bucket they fall in.
+ *
+ * \var CameraStatistics::Percentiles::p50
+ * \brief The median value
+ * \var CameraStatistics::Percentiles::p90
+ * \brief The 90th percentile
+ * \var CameraStatistics::Percentiles::p99
+ * \brief The 99th percentile
+ * \var CameraStatistics::Percentiles::max
+ * \brief The maximum value
+ */
+
 /**
  * \class Camera
  * \brief Camera device
@@ -281,8 +577,10 @@ std::size_t CameraConfiguration::size() const
  * and the camera released.
  *
  * An application may start and stop a camera multiple times as long as it is
- * not released. The camera may also be reconfigured provided that all
- * resources allocated are freed prior to the reconfiguration.
+ * not released, and buffers are kept allocated across stop() and start(). The
+ * camera may also be reconfigured provided that all resources allocated are
+ * freed prior to the reconfiguration, unless the new configuration is
+ * identical to the current one, in which case the resources are reused.
  *
  * \subsection Camera States
  *
@@ -310,11 +608,11 @@ std::size_t CameraConfiguration::size() const
  *   Configured -> Prepared [label = "allocateBuffers()"];
  *
  *   Prepared -> Configured [label = "freeBuffers()"];
- *   Prepared -> Prepared [label = "createRequest()"];
+ *   Prepared -> Prepared [label = "configure()*, createRequest()"];
  *   Prepared -> Running [label = "start()"];
  *
  *   Running -> Prepared [label = "stop()"];
- *   Running -> Running [label = "createRequest(), queueRequest()"];
+ *   Running -> Running [label = "configure()**, createRequest(), queueRequest()"];
  * }
  * \enddot
  *
@@ -323,6 +621,12 @@ std::size_t CameraConfiguration::size() const
  * camera to determine if it wishes to use it. If an application wishes to use
  * a camera it should acquire() it to proceed to the Acquired state.
  *
+ * Cameras are enumerated with their name and streams only. The pipeline
+ * handler completes the initialization of a camera, opening its devices and
+ * loading its IPA module, the first time the camera is acquired, or its
+ * controls or configurations are retrieved. The cost of starting the camera
+ * manager thus doesn't depend on the number of cameras in the system.
+ *
  * \subsubsection Acquired
  * In the acquired state an application has exclusive access to the camera and
  * may modify the camera's parameters to configure it and proceed to the
@@ -338,10 +642,34 @@ std::size_t CameraConfiguration::size() const
  * started. The application may free the camera's resources to get back to the
  * Configured state or start() it to progress to the Running state.
  *
+ * The camera can also be configured again in this state with a configuration
+ * identical to the current one (marked with a * in the state diagram). The
+ * allocated resources are then kept, avoiding a costly free and reallocation
+ * cycle when an application reapplies the same configuration.
+ *
  * \subsubsection Running
  * The camera is running and ready to process requests queued by the
  * application. The camera remains in this state until it is stopped and moved
  * to the Prepared state.
+ *
+ * The camera can be reconfigured in this state (marked with ** in the state
+ * diagram) with a configuration that the pipeline handler reports as live,
+ * see CameraConfiguration::live().
+ *
+ * \section camera_threading Thread Safety
+ *
+ * The Camera methods shall be called from the thread the camera manager runs
+ * in, with the exception of createRequest(), queueRequest(), queueRequests()
+ * and recycleBuffer(), as well as the statistics() and latency() accessors,
+ * which may be called from any thread. Applications can thus requeue requests
+ * directly from the threads that consume the frames, such as encoder or
+ * inference threads, without going through the camera manager event loop.
+ *
+ * Requests queued from other threads are passed to the pipeline handler
+ * through a lock-free queue. A request queued concurrently with a call to
+ * stop() is either rejected with -EACCES, or accepted and completed in the
+ * cancelled state by stop(). All signals are emitted in the camera manager
+ * thread, regardless of the thread the requests have been queued from.
  */
 
 /**
@@ -380,10 +708,49 @@ const std::string &Camera::name() const
 	return name_;
 }
 
+/**
+ * \var Camera::requestStarted
+ * \brief Signal emitted when the sensor starts capturing the frame for a
+ * request queued to the camera
+ *
+ * The signal carries the frame start timestamp in nanoseconds, in the same
+ * clock as the buffer timestamps. It is emitted before the buffers of the
+ * request complete, and only by pipeline handlers whose devices report frame
+ * start events.
+ */
+
 /**
  * \var Camera::bufferCompleted
  * \brief Signal emitted when a buffer for a request queued to the camera has
  * completed
+ *
+ * The buffer can be processed as soon as the signal is emitted, without
+ * waiting for the other buffers of the request. Recyclable buffers can also be
+ * returned to the application early with recycleBuffer(), to be added to a new
+ * request before the request completes.
+ */
+
+/**
+ * \var Camera::framesDropped
+ * \brief Signal emitted when frames have been dropped before a request
+ *
+ * The signal carries the number of frames dropped by the devices since the
+ * frame captured for the previous request, as also reported by the
+ * controls::FramesDropped metadata. It is emitted right before the \ref
+ * requestCompleted signal for the request. It allows consumers to tell frames
+ * dropped by the camera apart from requests queued too late by the
+ * application, which don't create gaps in the sequence numbers.
+ */
+
+/**
+ * \var Camera::qosLevelChanged
+ * \brief Signal emitted when the throttling level of the camera changes
+ *
+ * The camera raises its throttling level when it drops frames or falls behind
+ * the frame rate, and lowers it once the load has receded, as described in
+ * controls::QosLevel. The signal carries the new level, and is emitted right
+ * before the \ref requestCompleted signal for the first request completed at
+ * that level.
  */
 
 /**
@@ -403,9 +770,37 @@ const std::string &Camera::name() const
  * application API calls by returning errors immediately.
  */
 
+namespace {
+
+/*
+ * Count the threads queueing requests, for stop() to wait until the requests
+ * queued by threads that have seen the camera running have been submitted.
+ */
+class SubmissionGuard
+{
+public:
+	SubmissionGuard(std::atomic<unsigned int> &count)
+		: count_(count)
+	{
+		count_.fetch_add(1);
+	}
+
+	~SubmissionGuard()
+	{
+		count_.fetch_sub(1);
+	}
+
+private:
+	std::atomic<unsigned int> &count_;
+};
+
+} /* namespace */
+
 Camera::Camera(PipelineHandler *pipe, const std::string &name)
 	: pipe_(pipe->shared_from_this()), name_(name), disconnected_(false),
-	  state_(CameraAvailable)
+	  state_(CameraAvailable), submitters_(0),
+	  arenaPool_(std::make_shared<RequestArenaPool>()),
+	  requestsCompleted_(0), requestsCancelled_(0), startTime_(0)
 {
 }
 
@@ -425,13 +820,14 @@ static const char *const camera_state_names[] = {
 
 bool Camera::stateBetween(State low, State high) const
 {
-	if (state_ >= low && state_ <= high)
+	State state = state_.load();
+	if (state >= low && state <= high)
 		return true;
 
 	ASSERT(static_cast<unsigned int>(low) < ARRAY_SIZE(camera_state_names) &&
 	       static_cast<unsigned int>(high) < ARRAY_SIZE(camera_state_names));
 
-	LOG(Camera, Debug) << "Camera in " << camera_state_names[state_]
+	LOG(Camera, Debug) << "Camera in " << camera_state_names[state]
 			   << " state trying operation requiring state between "
 			   << camera_state_names[low] << " and "
 			   << camera_state_names[high];
@@ -441,12 +837,13 @@ bool Camera::stateBetween(State low, State high) const
 
 bool Camera::stateIs(State state) const
 {
-	if (state_ == state)
+	State current = state_.load();
+	if (current == state)
 		return true;
 
 	ASSERT(static_cast<unsigned int>(state) < ARRAY_SIZE(camera_state_names));
 
-	LOG(Camera, Debug) << "Camera in " << camera_state_names[state_]
+	LOG(Camera, Debug) << "Camera in " << camera_state_names[current]
 			   << " state trying operation requiring state "
 			   << camera_state_names[state];
 
@@ -502,6 +899,9 @@ void Camera::disconnect()
  *
  * This function affects the state of the camera, see \ref camera_operation.
  *
+ * The camera is initialized by the pipeline handler the first time it is
+ * acquired, see \ref camera_operation.
+ *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EBUSY The camera is not free and can't be acquired by the caller
@@ -520,6 +920,19 @@ int Camera::acquire()
 		return -EBUSY;
 	}
 
+	int ret = pipe_->invoke([&]() {
+		return pipe_->initialize(this);
+	});
+	if (ret) {
+		pipe_->unlock();
+		return ret;
+	}
+
+	pipe_->invoke([&]() {
+		pipe_->wake(this);
+		return 0;
+	});
+
 	state_ = CameraAcquired;
 
 	return 0;
@@ -531,6 +944,10 @@ int Camera::acquire()
  * Releasing the camera device allows other users to acquire exclusive access
  * with the acquire() function.
  *
+ * When a standby period is set with CameraManager::setStandbyPeriod(), the
+ * camera devices stay powered for the standby period after the camera is
+ * released, and acquiring the camera again within that period is immediate.
+ *
  * This function affects the state of the camera, see \ref camera_operation.
  *
  * \return 0 on success or a negative error code otherwise
@@ -541,6 +958,11 @@ int Camera::release()
 	if (!stateBetween(CameraAvailable, CameraConfigured))
 		return -EBUSY;
 
+	pipe_->invoke([&]() {
+		pipe_->standby(this);
+		return 0;
+	});
+
 	pipe_->unlock();
 
 	state_ = CameraAvailable;
@@ -551,15 +973,37 @@ int Camera::release()
 /**
  * \brief Retrieve the list of controls supported by the camera
  *
- * Camera controls remain constant through the lifetime of the camera.
+ * Camera controls remain constant through the lifetime of the camera. The
+ * camera is initialized, if needed, to enumerate its controls.
  *
- * \return A ControlInfoMap listing the controls supported by the camera
+ * \return A ControlInfoMap listing the controls supported by the camera, empty
+ * if the camera fails to initialize
  */
 const ControlInfoMap &Camera::controls()
 {
+	pipe_->invoke([&]() {
+		return pipe_->initialize(this);
+	});
+
 	return pipe_->controls(this);
 }
 
+/**
+ * \brief Retrieve the validator for the camera controls
+ *
+ * The validator is shared by all requests of the camera. It is created on
+ * first use, once the pipeline handler has registered the camera controls.
+ *
+ * \return The camera control validator
+ */
+CameraControlValidator *Camera::validator()
+{
+	if (!validator_)
+		validator_ = utils::make_unique<CameraControlValidator>(this);
+
+	return validator_.get();
+}
+
 /**
  * \brief Retrieve all the camera's stream information
  *
@@ -593,7 +1037,14 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
 	if (disconnected_ || roles.size() > streams_.size())
 		return nullptr;
 
-	CameraConfiguration *config = pipe_->generateConfiguration(this, roles);
+	CameraConfiguration *config = nullptr;
+	pipe_->invoke([&]() {
+		if (pipe_->initialize(this))
+			return 0;
+
+		config = pipe_->generateConfiguration(this, roles);
+		return 0;
+	});
 	if (!config) {
 		LOG(Camera, Debug)
 			<< "Pipeline handler failed to generate configuration";
@@ -634,6 +1085,16 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
  * Upon return the StreamConfiguration entries in \a config are associated with
  * Stream instances which can be retrieved with StreamConfiguration::stream().
  *
+ * When buffers are allocated, the camera can only be configured with a
+ * configuration identical to the current one. The configuration of the
+ * pipeline handler, the buffer pools and their mappings are then kept
+ * untouched, and this function only associates the StreamConfiguration
+ * entries with their streams.
+ *
+ * When the camera is running, \a config is applied without stopping the
+ * camera if CameraConfiguration::live() reports it can be, and is rejected
+ * otherwise.
+ *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not in a state where it can be configured
@@ -646,15 +1107,35 @@ int Camera::configure(CameraConfiguration *config)
 	if (disconnected_)
 		return -ENODEV;
 
-	if (!stateBetween(CameraAcquired, CameraConfigured))
+	if (!stateBetween(CameraAcquired, CameraRunning))
 		return -EACCES;
 
+	StartupTimeline::Scope phase("configure", name_);
+
 	if (config->validate() != CameraConfiguration::Valid) {
 		LOG(Camera, Error)
 			<< "Can't configure camera with invalid configuration";
 		return -EINVAL;
 	}
 
+	if (stateIs(CameraPrepared)) {
+		if (!isConfigured(config)) {
+			LOG(Camera, Error)
+				<< "Can't change configuration with buffers allocated";
+			return -EACCES;
+		}
+
+		for (unsigned int index = 0; index < config->size(); ++index)
+			config->at(index).setStream(configuredStreams_[index]);
+
+		LOG(Camera, Debug) << "Configuration unchanged, keeping buffers";
+
+		return 0;
+	}
+
+	if (stateIs(CameraRunning))
+		return reconfigure(config);
+
 	std::ostringstream msg("configuring streams:", std::ios_base::ate);
 
 	for (unsigned int index = 0; index < config->size(); ++index) {
@@ -665,11 +1146,22 @@ int Camera::configure(CameraConfiguration *config)
 
 	LOG(Camera, Info) << msg.str();
 
-	ret = pipe_->configure(this, config);
+	ret = pipe_->invoke([&]() {
+		int err = pipe_->configure(this, config);
+		if (err)
+			return err;
+
+		pipe_->setOutOfOrderCompletion(this,
+			config->outOfOrderCompletion() ||
+			config->queueProfile() == CameraConfiguration::LowLatency);
+		pipe_->setTimestampClock(this, config->timestampClock());
+		return 0;
+	});
 	if (ret)
 		return ret;
 
 	activeStreams_.clear();
+	configuredStreams_.clear();
 	for (const StreamConfiguration &cfg : *config) {
 		Stream *stream = cfg.stream();
 		if (!stream)
@@ -678,6 +1170,7 @@ int Camera::configure(CameraConfiguration *config)
 
 		stream->configuration_ = cfg;
 		activeStreams_.insert(stream);
+		configuredStreams_.push_back(stream);
 
 		/*
 		 * Allocate buffer objects in the pool.
@@ -691,8 +1184,95 @@ int Camera::configure(CameraConfiguration *config)
 	return 0;
 }
 
+/**
+ * \brief Apply a live configuration to the running camera
+ * \param[in] config The configuration
+ * \sa configure()
+ * \return 0 on success or a negative error code otherwise
+ */
+int Camera::reconfigure(CameraConfiguration *config)
+{
+	if (!config->live()) {
+		LOG(Camera, Error)
+			<< "Can't apply configuration while the camera is running";
+		return -EACCES;
+	}
+
+	for (StreamConfiguration &cfg : *config)
+		cfg.setStream(nullptr);
+
+	int ret = pipe_->invoke([&]() {
+		return pipe_->reconfigure(this, config);
+	});
+	if (ret) {
+		LOG(Camera, Error) << "Failed to reconfigure camera";
+		return ret;
+	}
+
+	configuredStreams_.clear();
+	for (const StreamConfiguration &cfg : *config) {
+		Stream *stream = cfg.stream();
+		if (activeStreams_.find(stream) == activeStreams_.end())
+			LOG(Camera, Fatal)
+				<< "Pipeline handler changed the active streams";
+
+		LOG(Camera, Info) << "Reconfigured stream " << cfg.toString();
+
+		stream->configuration_ = cfg;
+		configuredStreams_.push_back(stream);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Check if a configuration is identical to the current configuration
+ * \param[in] config The configuration
+ *
+ * The configurations are compared stream by stream, in order, on all the
+ * parameters applied to the streams.
+ *
+ * \return True if \a config matches the current configuration, false otherwise
+ */
+bool Camera::isConfigured(const CameraConfiguration *config) const
+{
+	if (config->size() != configuredStreams_.size())
+		return false;
+
+	for (unsigned int index = 0; index < config->size(); ++index) {
+		const StreamConfiguration &cfg = config->at(index);
+		const StreamConfiguration &current =
+			configuredStreams_[index]->configuration();
+
+		if (cfg.pixelFormat != current.pixelFormat ||
+		    cfg.size != current.size ||
+		    cfg.memoryType != current.memoryType ||
+		    cfg.bufferCount != current.bufferCount)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * \enum Camera::AllocateFlag
+ * \brief Flags controlling buffer allocation
+ * \var Camera::AllocateDefault
+ * Allocate the buffers only, their memory is mapped on first CPU access
+ * \var Camera::AllocatePrefault
+ * Map and prefault the memory of all internally allocated buffers, to avoid
+ * page faults on the first CPU access to each buffer of the first frames
+ */
+
 /**
  * \brief Allocate buffers for all configured streams
+ * \param[in] flags Allocation flags
+ *
+ * When the AllocatePrefault flag is set, the memory of all buffers allocated
+ * for streams using internal memory is mapped and its page tables populated
+ * before this function returns. This trades a longer allocation time for
+ * steady state latencies from the very first frames, and is recommended for
+ * applications that access frame contents with the CPU.
  *
  * This function affects the state of the camera, see \ref camera_operation.
  *
@@ -701,7 +1281,7 @@ int Camera::configure(CameraConfiguration *config)
  * \retval -EACCES The camera is not in a state where buffers can be allocated
  * \retval -EINVAL The configuration is not valid
  */
-int Camera::allocateBuffers()
+int Camera::allocateBuffers(AllocateFlag flags)
 {
 	if (disconnected_)
 		return -ENODEV;
@@ -715,17 +1295,95 @@ int Camera::allocateBuffers()
 		return -EINVAL;
 	}
 
-	int ret = pipe_->allocateBuffers(this, activeStreams_);
+	StartupTimeline::Scope phase("allocate-buffers", name_);
+
+	int ret = pipe_->invoke([&]() {
+		return pipe_->allocateBuffers(this, activeStreams_);
+	});
 	if (ret) {
 		LOG(Camera, Error) << "Failed to allocate buffers";
 		return ret;
 	}
 
+	if (flags & AllocatePrefault) {
+		for (Stream *stream : activeStreams_) {
+			if (stream->memoryType() != InternalMemory)
+				continue;
+
+			for (BufferMemory &mem : stream->bufferPool().buffers()) {
+				/* Failures only impact latency, don't abort. */
+				if (mem.prefault() < 0) {
+					LOG(Camera, Warning)
+						<< "Failed to prefault buffers";
+					break;
+				}
+			}
+		}
+	}
+
 	state_ = CameraPrepared;
 
 	return 0;
 }
 
+/**
+ * \brief Allocate additional buffers for a stream
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] count The number of buffers to add
+ *
+ * Grow the buffer pool of \a stream by \a count buffers after buffers have
+ * been allocated with allocateBuffers(). This can be called while the camera
+ * is running, without stopping the stream or disturbing the buffers in use,
+ * to transiently deepen the queue (for instance for burst capture). The new
+ * buffers are appended to the pool, and for streams using internal memory,
+ * can be retrieved with Stream::buffer() using indexes starting at the
+ * previous pool size.
+ *
+ * Buffers can't be removed individually, they are all freed by freeBuffers().
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera doesn't have buffers allocated
+ * \retval -EINVAL The stream is not part of the active configuration
+ * \retval -ENOSPC The pool can't be grown by \a count buffers
+ * \retval -ENOTSUP The pipeline handler doesn't support growing buffer pools
+ */
+int Camera::addBuffers(Stream *stream, unsigned int count)
+{
+	if (disconnected_)
+		return -ENODEV;
+
+	if (!stateBetween(CameraPrepared, CameraRunning))
+		return -EACCES;
+
+	if (activeStreams_.find(stream) == activeStreams_.end()) {
+		LOG(Camera, Error) << "Invalid stream";
+		return -EINVAL;
+	}
+
+	if (!count)
+		return 0;
+
+	int first = stream->bufferPool().addBuffers(count);
+	if (first < 0) {
+		LOG(Camera, Error) << "Unable to grow buffer pool";
+		return first;
+	}
+
+	int ret = pipe_->invoke([&]() {
+		return pipe_->addBuffers(this, stream, count);
+	});
+	if (ret) {
+		LOG(Camera, Error) << "Failed to add buffers";
+		stream->buffers().resize(first);
+		return ret;
+	}
+
+	stream->addBuffers(first, count);
+
+	return 0;
+}
+
 /**
  * \brief Release all buffers from allocated pools in each stream
  *
@@ -749,7 +1407,9 @@ int Camera::freeBuffers()
 
 	state_ = CameraConfigured;
 
-	return pipe_->freeBuffers(this, activeStreams_);
+	return pipe_->invoke([&]() {
+		return pipe_->freeBuffers(this, activeStreams_);
+	});
 }
 
 /**
@@ -768,7 +1428,8 @@ int Camera::freeBuffers()
  * responsible for either queueing the request or deleting it.
  *
  * This function shall only be called when the camera is in the Prepared
- * or Running state, see \ref camera_operation.
+ * or Running state, see \ref camera_operation. It may be called from any
+ * thread, see \ref camera_threading.
  *
  * \return A pointer to the newly created request, or nullptr on error
  */
@@ -794,22 +1455,158 @@ Request *Camera::createRequest(uint64_t cookie)
  * through the \ref requestCompleted signal.
  *
  * Ownership of the request is transferred to the camera. It will be deleted
- * automatically after it completes.
+ * automatically after it completes, unless the application reuses it with
+ * Request::reuse() from the request completion handler.
+ *
+ * When pipeline threads are enabled with CameraManager::setPipelineThreads(),
+ * or when this method is called from a thread other than the camera manager
+ * thread, the request is passed to the pipeline handler asynchronously. Errors
+ * reported by the pipeline handler can then not be returned by this method,
+ * and the request completes in the Request::RequestCancelled state instead.
+ *
+ * This method may be called from any thread, see \ref camera_threading.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not running so requests can't be queued
  * \retval -EINVAL The request is invalid
  * \retval -ENOMEM No buffer memory was available to handle the request
+ * \retval -EBUSY A buffer of the request is held by a BufferRef
  */
 int Camera::queueRequest(Request *request)
 {
 	if (disconnected_)
 		return -ENODEV;
 
+	SubmissionGuard guard(submitters_);
 	if (!stateIs(CameraRunning))
 		return -EACCES;
 
+	int ret = prepareRequest(request);
+	if (ret)
+		return ret;
+
+	for (auto const &it : request->buffers())
+		it.first->bufferQueued();
+
+	ret = pipe_->submitRequest(this, request);
+	if (ret) {
+		for (auto const &it : request->buffers())
+			it.first->bufferCompleted(it.second);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Queue multiple requests to the camera
+ * \param[in] requests The requests to queue to the camera
+ *
+ * This method queues a batch of \a requests to the camera for capture, in
+ * order. It is equivalent to calling queueRequest() for each request, but
+ * allows the pipeline handler to process the whole batch at once, for
+ * instance to perform a single round trip with its IPA. Applications should
+ * use it when submitting requests in bursts, such as when priming the
+ * pipeline at capture start, or when capturing an exposure bracket with
+ * per-request SensorExposure and SensorAnalogueGain controls.
+ *
+ * All requests are validated before being passed to the pipeline handler. If
+ * a request is invalid, it and all the requests that follow it are not queued
+ * and their ownership stays with the application. The number of requests
+ * that have been queued is returned in that case.
+ *
+ * This method may be called from any thread, see \ref camera_threading.
+ *
+ * \return The number of requests queued on success or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ */
+int Camera::queueRequests(const std::vector<Request *> &requests)
+{
+	if (disconnected_)
+		return -ENODEV;
+
+	SubmissionGuard guard(submitters_);
+	if (!stateIs(CameraRunning))
+		return -EACCES;
+
+	std::vector<Request *> batch;
+	batch.reserve(requests.size());
+
+	for (Request *request : requests) {
+		if (prepareRequest(request))
+			break;
+
+		batch.push_back(request);
+	}
+
+	if (batch.empty())
+		return 0;
+
+	for (Request *request : batch) {
+		for (auto const &it : request->buffers())
+			it.first->bufferQueued();
+	}
+
+	int ret = pipe_->submitRequests(this, batch);
+	if (ret) {
+		for (Request *request : batch) {
+			for (auto const &it : request->buffers())
+				it.first->bufferCompleted(it.second);
+		}
+		return ret;
+	}
+
+	return batch.size();
+}
+
+/**
+ * \brief Recycle a completed buffer before its request completes
+ * \param[in] request The request the buffer belongs to
+ * \param[in] buffer The completed buffer
+ *
+ * This method returns a recyclable \a buffer to the application as soon as it
+ * has completed, without waiting for the other buffers of its \a request. It
+ * is meant to be called from the \ref bufferCompleted signal handler, to add
+ * the buffer to a new request right away, for instance to keep a viewfinder
+ * stream running while a still capture buffer of the same request is still
+ * being processed.
+ *
+ * The buffer is removed from the request, and isn't part of the buffers
+ * reported by the \ref requestCompleted signal anymore. Its metadata stay
+ * valid until it is added to a new request.
+ *
+ * This method may be called from any thread, see \ref camera_threading.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The buffer is not a recyclable buffer
+ * \retval -EBUSY The buffer hasn't completed yet
+ * \retval -ENOENT The buffer isn't part of the request
+ */
+int Camera::recycleBuffer(Request *request, Buffer *buffer)
+{
+	int ret = pipe_->invoke([&]() { return request->releaseBuffer(buffer); });
+	if (ret)
+		return ret;
+
+	Stream *stream = buffer->stream();
+	if (stream->memoryType() == ExternalMemory)
+		stream->unmapBuffer(buffer);
+
+	stream->bufferCompleted(buffer);
+
+	return 0;
+}
+
+/**
+ * \brief Validate a request and prepare it to be queued
+ * \param[in] request The request
+ * \return 0 on success or a negative error code otherwise
+ * \sa queueRequest()
+ */
+int Camera::prepareRequest(Request *request)
+{
 	for (auto const &it : request->buffers()) {
 		Stream *stream = it.first;
 		Buffer *buffer = it.second;
@@ -819,6 +1616,12 @@ int Camera::queueRequest(Request *request)
 			return -EINVAL;
 		}
 
+		if (buffer->held()) {
+			LOG(Camera, Debug) << "Buffer held by a BufferRef";
+			stream->starvationCount_++;
+			return -EBUSY;
+		}
+
 		if (stream->memoryType() == ExternalMemory) {
 			int index = stream->mapBuffer(buffer);
 			if (index < 0) {
@@ -830,6 +1633,14 @@ int Camera::queueRequest(Request *request)
 		}
 
 		buffer->mem_ = &stream->buffers()[buffer->index_];
+
+		if (stream->memoryType() == UserPtrMemory) {
+			const PlaneArray &planes = buffer->mem_->planes();
+			if (planes.empty() || !planes[0].isUserPtr()) {
+				LOG(Camera, Error) << "User memory not set";
+				return -EINVAL;
+			}
+		}
 	}
 
 	int ret = request->prepare();
@@ -838,7 +1649,10 @@ int Camera::queueRequest(Request *request)
 		return ret;
 	}
 
-	return pipe_->queueRequest(this, request);
+	LIBCAMERA_TRACEPOINT(request_queue, "camera=%s request=%p cookie=%" PRIu64,
+			     name_.c_str(), request, request->cookie());
+
+	return 0;
 }
 
 /**
@@ -864,10 +1678,25 @@ int Camera::start()
 
 	LOG(Camera, Debug) << "Starting capture";
 
-	int ret = pipe_->start(this);
+	for (LatencyHistogram &histogram : latency_)
+		histogram.reset();
+	ipaTime_.reset();
+	requestsCompleted_.store(0, std::memory_order_relaxed);
+	requestsCancelled_.store(0, std::memory_order_relaxed);
+	for (Stream *stream : activeStreams_)
+		stream->resetStatistics();
+
+	uint64_t started = StartupTimeline::now();
+
+	int ret = pipe_->invoke([&]() { return pipe_->start(this); });
 	if (ret)
 		return ret;
 
+	/* The first-request phase ends when the first request completes. */
+	StartupTimeline::instance()->record("start", name_, started,
+					    StartupTimeline::now());
+	startTime_.store(started, std::memory_order_relaxed);
+
 	state_ = CameraRunning;
 
 	return 0;
@@ -896,31 +1725,198 @@ int Camera::stop()
 	LOG(Camera, Debug) << "Stopping capture";
 
 	state_ = CameraPrepared;
+	startTime_.store(0, std::memory_order_relaxed);
+
+	/*
+	 * Wait for the requests being queued from other threads, and pass them
+	 * to the pipeline handler for it to cancel them.
+	 */
+	while (submitters_.load())
+		std::this_thread::yield();
 
-	pipe_->stop(this);
+	pipe_->invoke([&]() {
+		pipe_->stopCamera(this);
+		return 0;
+	});
+
+	/*
+	 * When the pipeline handler runs in its own thread, the cancelled
+	 * requests are delivered asynchronously. Complete them before
+	 * returning.
+	 */
+	pipe_->flushCompletions();
 
 	return 0;
 }
 
+/**
+ * \brief Retrieve the latency histogram of a processing stage
+ * \param[in] stage The processing stage
+ *
+ * The camera accumulates, for each processing stage of the requests, the time
+ * elapsed between queueing requests and reaching the stage in a histogram.
+ * Only requests that complete successfully are taken into account. The
+ * histograms are reset when the camera is started, and can be read at any
+ * time from any thread, for instance to monitor the latency percentiles of a
+ * capture session. The histogram for Request::StageQueued is always empty.
+ *
+ * \return The latency histogram for \a stage
+ */
+const LatencyHistogram &Camera::latency(Request::Stage stage) const
+{
+	return latency_[stage];
+}
+
+/**
+ * \fn Camera::ipaTime()
+ * \brief Retrieve the histogram of the IPA processing time
+ *
+ * The IPA processing time of a request is measured from the capture of its
+ * frame, as reported by Request::StageCaptured, to the handling of its last
+ * IPA action, as reported by Request::StageIPAAction. It thus includes the
+ * time spent by the ISP to produce the statistics consumed by the IPA. Only
+ * requests that complete successfully on pipelines that use an IPA are taken
+ * into account. The histogram is reset when the camera is started.
+ *
+ * \return The IPA processing time histogram
+ */
+
+/**
+ * \brief Retrieve a snapshot of the runtime statistics of the camera
+ *
+ * The camera counts the completed and cancelled requests, the frames captured
+ * and dropped on each stream, and tracks the number of buffers queued to each
+ * stream. The counters are updated without locking when requests are queued
+ * and completed, and are only gathered when this method is called, which can
+ * be done from any thread while the camera is running. As the counters are
+ * read individually, the snapshot isn't atomic and the values may be slightly
+ * inconsistent with each other.
+ *
+ * The statistics cover the current capture session, or the last one if the
+ * camera is stopped. They are reset when the camera is started.
+ *
+ * \return The camera statistics
+ */
+CameraStatistics Camera::statistics() const
+{
+	CameraStatistics stats;
+
+	stats.requestsCompleted = requestsCompleted_.load(std::memory_order_relaxed);
+	stats.requestsCancelled = requestsCancelled_.load(std::memory_order_relaxed);
+
+	for (Stream *stream : activeStreams_) {
+		StreamStatistics &streamStats = stats.streams[stream];
+		streamStats.framesCompleted = stream->framesCompleted_.load(std::memory_order_relaxed);
+		streamStats.framesDropped = stream->framesDropped_.load(std::memory_order_relaxed);
+		streamStats.queueDepth = stream->queueDepth_.load(std::memory_order_relaxed);
+		streamStats.maxQueueDepth = stream->maxQueueDepth_.load(std::memory_order_relaxed);
+	}
+
+	const std::pair<const LatencyHistogram *, CameraStatistics::Percentiles *> histograms[] = {
+		{ &latency_[Request::StageCompleted], &stats.latency },
+		{ &ipaTime_, &stats.ipaTime },
+	};
+
+	for (const auto &item : histograms) {
+		const LatencyHistogram *histogram = item.first;
+		CameraStatistics::Percentiles *percentiles = item.second;
+
+		percentiles->p50 = histogram->percentile(50);
+		percentiles->p90 = histogram->percentile(90);
+		percentiles->p99 = histogram->percentile(99);
+		percentiles->max = histogram->max();
+	}
+
+	return stats;
+}
+
+/**
+ * \brief Record the latencies of a completed request
+ * \param[in] request The request
+ *
+ * Report the latency of each processing stage reached by the \a request,
+ * relative to the time it was queued, in the request metadata, and add it to
+ * the latency histograms of the camera if the request hasn't been cancelled.
+ */
+void Camera::recordLatency(Request *request)
+{
+	static const std::array<const Control<int64_t> *, Request::StageCount> controls = { {
+		nullptr,
+		&controls::LatencyDeviceQueued,
+		&controls::LatencyStarted,
+		&controls::LatencyCaptured,
+		&controls::LatencyBufferReady,
+		&controls::LatencyIPAAction,
+		&controls::LatencyCompleted,
+	} };
+
+	uint64_t queued = request->timestamp(Request::StageQueued);
+	ControlList &metadata = request->metadata();
+
+	for (unsigned int i = Request::StageQueued + 1; i < Request::StageCount; ++i) {
+		Request::Stage stage = static_cast<Request::Stage>(i);
+		uint64_t timestamp = request->timestamp(stage);
+		if (!timestamp)
+			continue;
+
+		uint64_t latency = timestamp > queued ? timestamp - queued : 0;
+
+		/* Cancelled requests would skew the statistics. */
+		if (request->status() == Request::RequestComplete)
+			latency_[stage].add(latency);
+
+		metadata.set(*controls[stage], static_cast<int64_t>(latency));
+	}
+
+	uint64_t captured = request->timestamp(Request::StageCaptured);
+	uint64_t ipaAction = request->timestamp(Request::StageIPAAction);
+	if (request->status() == Request::RequestComplete && captured && ipaAction)
+		ipaTime_.add(ipaAction > captured ? ipaAction - captured : 0);
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
  *
  * This function is called by the pipeline handler to notify the camera that
  * the request has completed. It emits the requestCompleted signal and deletes
- * the request.
+ * the request, unless it has been reused by the signal handler.
  */
 void Camera::requestComplete(Request *request)
 {
+	request->removeReleasedBuffers();
+
 	for (auto it : request->buffers()) {
 		Stream *stream = it.first;
 		Buffer *buffer = it.second;
 		if (stream->memoryType() == ExternalMemory)
 			stream->unmapBuffer(buffer);
+
+		stream->bufferCompleted(buffer);
+	}
+
+	if (request->status() == Request::RequestComplete) {
+		requestsCompleted_.fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t started = startTime_.exchange(0, std::memory_order_relaxed);
+		if (started)
+			StartupTimeline::instance()->record("first-request", name_,
+							    started,
+							    StartupTimeline::now());
+	} else {
+		requestsCancelled_.fetch_add(1, std::memory_order_relaxed);
 	}
 
+	recordLatency(request);
+
+	LIBCAMERA_TRACEPOINT(request_complete, "camera=%s request=%p status=%d",
+			     name_.c_str(), request, request->status());
+
+	request->reused_ = false;
 	requestCompleted.emit(request, request->buffers());
-	delete request;
+
+	if (!request->reused_)
+		delete request;
 }
 
 } /* namespace libcamera */
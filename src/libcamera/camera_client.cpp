@@ -0,0 +1,354 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_client.cpp - Consume the frames of a camera shared by a camera server
+ */
+
+#include <libcamera/camera_client.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "camera_server_protocol.h"
+#include "ipc_unixsocket.h"
+#include "log.h"
+
+/**
+ * \file camera_client.h
+ * \brief Consume the frames of a camera shared by a CameraServer
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraClient)
+
+using namespace CameraServerProtocol;
+
+/**
+ * \class CameraClient
+ * \brief Receive the frames of a camera shared by a CameraServer
+ *
+ * The CameraClient connects to a CameraServer running in another process, and
+ * receives the frames the server captures without copying them. The server
+ * sends the configuration of its streams and the dmabufs of all their buffers
+ * when the client connects. The ready signal is emitted once they have been
+ * received, and the streams() are available. The frameReady signal is then
+ * emitted for each frame, whose memory is retrieved with buffer().
+ *
+ * The server doesn't reuse the buffer of a frame until the client releases it
+ * with release(). The client can hold at most maxHeld() frames per stream, as
+ * granted by the server based on the number requested by connect(). The
+ * server skips frames for a client that holds the maximum number of frames,
+ * which is reported by Frame::dropped.
+ *
+ * The client is driven by the event loop of the thread it lives in.
+ */
+
+/**
+ * \struct CameraClient::StreamInfo
+ * \brief The description of a stream shared by the server
+ * \var CameraClient::StreamInfo::pixelFormat
+ * \brief The stream pixel format
+ * \var CameraClient::StreamInfo::size
+ * \brief The stream frame size
+ * \var CameraClient::StreamInfo::buffers
+ * \brief The stream buffers, indexed by Frame::index
+ */
+
+/**
+ * \struct CameraClient::Frame
+ * \brief A frame received from the server
+ * \var CameraClient::Frame::stream
+ * \brief The index of the stream in streams()
+ * \var CameraClient::Frame::index
+ * \brief The index of the buffer in the stream buffers
+ * \var CameraClient::Frame::sequence
+ * \brief The frame sequence number
+ * \var CameraClient::Frame::bytesused
+ * \brief The number of bytes occupied by the frame data
+ * \var CameraClient::Frame::dropped
+ * \brief The number of frames of the stream skipped since the previous one
+ * \var CameraClient::Frame::timestamp
+ * \brief The frame capture timestamp, in nanoseconds
+ */
+
+CameraClient::CameraClient()
+	: maxHeld_(0), pendingStreams_(0), pendingBuffers_(0),
+	  welcomed_(false), ready_(false)
+{
+}
+
+CameraClient::~CameraClient()
+{
+	disconnect();
+}
+
+/**
+ * \brief Connect to the server listening on \a path
+ * \param[in] path The path of the server Unix socket
+ * \param[in] maxHeld The maximum number of frames per stream the client
+ * requests to hold at a time
+ *
+ * The ready signal is emitted once the server has accepted the client and
+ * sent the streams. The disconnected signal is emitted if the server rejects
+ * the client.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraClient::connect(const std::string &path, unsigned int maxHeld)
+{
+	struct sockaddr_un addr = {};
+
+	if (isConnected())
+		return -EBUSY;
+
+	if (!maxHeld)
+		return -EINVAL;
+
+	if (path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+		      sizeof(addr))) {
+		int ret = -errno;
+		LOG(CameraClient, Error)
+			<< "Failed to connect to " << path << ": "
+			<< strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	socket_.reset(new IPCUnixSocket());
+	socket_->bind(fd);
+	socket_->readyRead.connect(this, &CameraClient::readyRead);
+	socket_->disconnected.connect(this, &CameraClient::socketDisconnected);
+
+	Hello hello = {};
+	hello.type = HelloMessage;
+	hello.version = Version;
+	hello.maxHeld = maxHeld;
+
+	IPCUnixSocket::Payload payload;
+	pack(&payload, hello);
+
+	int ret = socket_->send(payload);
+	if (ret) {
+		disconnect();
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Disconnect from the server
+ *
+ * The frames held by the client are released, and the buffers are unmapped.
+ * The disconnected signal isn't emitted.
+ */
+void CameraClient::disconnect()
+{
+	socket_.reset();
+	streams_.clear();
+	maxHeld_ = 0;
+	pendingStreams_ = 0;
+	pendingBuffers_ = 0;
+	welcomed_ = false;
+	ready_ = false;
+}
+
+/**
+ * \brief Check if the client is connected to a server
+ * \return True if the client is connected, false otherwise
+ */
+bool CameraClient::isConnected() const
+{
+	return socket_ && socket_->isBound();
+}
+
+/**
+ * \fn CameraClient::isReady()
+ * \brief Check if the streams have been received from the server
+ * \return True if the client receives frames, false otherwise
+ */
+
+/**
+ * \fn CameraClient::maxHeld()
+ * \brief Retrieve the number of frames the client can hold per stream
+ * \return The number of frames granted by the server
+ */
+
+/**
+ * \fn CameraClient::streams()
+ * \brief Retrieve the streams shared by the server
+ * \return The streams, empty until the client is ready
+ */
+
+/**
+ * \brief Retrieve the memory of the buffer of a \a frame
+ * \param[in] frame The frame
+ *
+ * The memory planes are mapped to the CPU on demand by Plane::mem().
+ *
+ * \return The buffer memory, or nullptr if the frame is invalid
+ */
+BufferMemory *CameraClient::buffer(const Frame &frame)
+{
+	if (frame.stream >= streams_.size() ||
+	    frame.index >= streams_[frame.stream].buffers.size())
+		return nullptr;
+
+	return &streams_[frame.stream].buffers[frame.index];
+}
+
+/**
+ * \brief Release a \a frame to let the server reuse its buffer
+ * \param[in] frame The frame
+ *
+ * The frame memory shall not be accessed after it has been released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraClient::release(const Frame &frame)
+{
+	if (!ready_)
+		return -ENOTCONN;
+
+	Release message = {};
+	message.type = ReleaseMessage;
+	message.stream = frame.stream;
+	message.index = frame.index;
+
+	IPCUnixSocket::Payload payload;
+	pack(&payload, message);
+
+	return socket_->send(payload);
+}
+
+/**
+ * \var CameraClient::ready
+ * \brief Signal emitted when the streams have been received from the server
+ */
+
+/**
+ * \var CameraClient::frameReady
+ * \brief Signal emitted when a frame has been received from the server
+ */
+
+/**
+ * \var CameraClient::disconnected
+ * \brief Signal emitted when the server closes the connection
+ *
+ * The client shall not be disconnected or deleted from within the signal
+ * handler.
+ */
+
+void CameraClient::readyRead(IPCUnixSocket *socket)
+{
+	IPCUnixSocket::Payload payload;
+	int ret = socket->receive(&payload);
+	if (ret)
+		return;
+
+	switch (type(payload)) {
+	case WelcomeMessage: {
+		Welcome welcome;
+		if (welcomed_ || !unpack(payload, &welcome) ||
+		    welcome.version != Version)
+			break;
+
+		welcomed_ = true;
+		maxHeld_ = welcome.maxHeld;
+		streams_.resize(welcome.streams);
+		pendingStreams_ = welcome.streams;
+		return;
+	}
+
+	case StreamInfoMessage: {
+		CameraServerProtocol::StreamInfo info;
+		if (!welcomed_ || !unpack(payload, &info) ||
+		    info.stream >= streams_.size() || !pendingStreams_ ||
+		    !info.bufferCount)
+			break;
+
+		CameraClient::StreamInfo &stream = streams_[info.stream];
+		stream.pixelFormat = info.pixelFormat;
+		stream.size = Size(info.width, info.height);
+		stream.buffers.resize(info.bufferCount);
+		pendingBuffers_ += info.bufferCount;
+		pendingStreams_--;
+		return;
+	}
+
+	case BufferInfoMessage: {
+		BufferInfo info;
+		if (!welcomed_ || !unpack(payload, &info) ||
+		    info.stream >= streams_.size() ||
+		    info.index >= streams_[info.stream].buffers.size() ||
+		    info.planes > PlaneArray::Capacity ||
+		    info.planes != payload.fds.size() || !pendingBuffers_)
+			break;
+
+		BufferMemory &memory = streams_[info.stream].buffers[info.index];
+		memory.planes().clear();
+		for (unsigned int i = 0; i < info.planes; ++i) {
+			memory.planes().emplace_back();
+			memory.planes().back().setDmabuf(payload.fds[i],
+							 info.length[i]);
+			::close(payload.fds[i]);
+		}
+
+		if (--pendingBuffers_ == 0 && !pendingStreams_) {
+			ready_ = true;
+			ready.emit(this);
+		}
+		return;
+	}
+
+	case FrameMessage: {
+		CameraServerProtocol::Frame frame;
+		if (!ready_ || !unpack(payload, &frame))
+			break;
+
+		CameraClient::Frame info;
+		info.stream = frame.stream;
+		info.index = frame.index;
+		info.sequence = frame.sequence;
+		info.bytesused = frame.bytesused;
+		info.dropped = frame.dropped;
+		info.timestamp = frame.timestamp;
+		frameReady.emit(this, info);
+		return;
+	}
+
+	default:
+		break;
+	}
+
+	LOG(CameraClient, Warning)
+		<< "Invalid message type " << type(payload);
+
+	for (int fd : payload.fds)
+		::close(fd);
+}
+
+void CameraClient::socketDisconnected(IPCUnixSocket *socket)
+{
+	LOG(CameraClient, Debug) << "Server closed the connection";
+
+	ready_ = false;
+	disconnected.emit(this);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,480 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_group.cpp - Synchronized capture from multiple cameras
+ */
+
+#include <libcamera/camera_group.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/stream.h>
+
+#include "log.h"
+
+/**
+ * \file camera_group.h
+ * \brief Synchronized capture from multiple cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraGroup)
+
+namespace {
+
+/*
+ * Frames of the other cameras complete within a frame period, frames pending
+ * for longer are dropped to let their buffers be queued again.
+ */
+constexpr unsigned int MaxPendingFrames = 2;
+
+} /* namespace */
+
+/**
+ * \class CameraGroup
+ * \brief Capture from multiple cameras and deliver matched sets of frames
+ *
+ * Cameras running at the same time, such as the two sensors of a stereo pair,
+ * complete their requests independently, and the frames of a single camera
+ * don't tell which frames of the other cameras have been captured at the same
+ * time. The CameraGroup captures from several cameras together, pairs their
+ * frames by timestamp, and delivers each matched set of frames, one per
+ * camera, with a single frameSetReady signal.
+ *
+ * The cameras are added to the group with addCamera() once configured and
+ * with their buffers allocated. The group then manages the requests: start()
+ * starts the cameras back to back and queues all the buffers of all cameras,
+ * and the buffers are queued again once the frames they contain have been
+ * delivered or dropped.
+ *
+ * Frames are matched when their timestamps are within the tolerance() of each
+ * other. The group keeps the frames not matched yet, in capture order, and
+ * drops a frame as soon as it can't be matched anymore, that is when another
+ * camera has captured a frame later than the frame timestamp plus the
+ * tolerance without any frame within the tolerance. Unmatched frames thus
+ * only hold their buffers until the next frames of the other cameras are
+ * captured, and at most two frames are kept per camera when the other cameras
+ * stop delivering frames. The number of dropped frames is reported by
+ * droppedFrames().
+ *
+ * The tolerance shall be smaller than half of the frame period for pairing to
+ * be unambiguous. Cameras whose sensors are synchronized in hardware capture
+ * frames within a few microseconds of each other, and are matched with any
+ * tolerance. Free-running cameras are matched only when they happen to run
+ * in phase.
+ *
+ * The group holds the buffers of the frames it delivers with BufferRef
+ * instances stored in the FrameSet. The buffers are queued again when the
+ * last reference is released, which happens when the frameSetReady signal
+ * handlers return, unless they copy the frame set to process it later. Frame
+ * sets can be released from any thread.
+ *
+ * The group lives in the thread of the camera manager, where the cameras
+ * shall be used.
+ */
+
+/**
+ * \var CameraGroup::DEFAULT_TOLERANCE
+ * \brief The default tolerance for matching frame timestamps, in nanoseconds
+ */
+
+/**
+ * \struct CameraGroup::Frame
+ * \brief A frame captured by one camera of the group
+ * \var CameraGroup::Frame::camera
+ * \brief The camera that captured the frame
+ * \var CameraGroup::Frame::timestamp
+ * \brief The frame capture timestamp, in nanoseconds
+ * \var CameraGroup::Frame::sequence
+ * \brief The frame sequence number
+ * \var CameraGroup::Frame::buffers
+ * \brief The buffers of the frame, one per configured stream of the camera
+ */
+
+/**
+ * \typedef CameraGroup::FrameSet
+ * \brief A set of matched frames, one per camera, in the order the cameras
+ * have been added to the group
+ */
+
+/**
+ * \brief Construct an empty camera group
+ * \param[in] tolerance The tolerance for matching frame timestamps, in
+ * nanoseconds
+ */
+CameraGroup::CameraGroup(uint64_t tolerance)
+	: tolerance_(tolerance), running_(false), dropped_(0)
+{
+}
+
+CameraGroup::~CameraGroup()
+{
+	stop();
+}
+
+/**
+ * \brief Add a camera to the group
+ * \param[in] camera The camera
+ * \param[in] config The configuration the camera has been configured with
+ *
+ * The \a camera shall be configured with \a config and have its buffers
+ * allocated. All the configured streams of the camera are captured.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The group is running
+ * \retval -EEXIST The camera is already part of the group
+ * \retval -EINVAL The configuration has no stream
+ */
+int CameraGroup::addCamera(std::shared_ptr<Camera> camera,
+			   const CameraConfiguration *config)
+{
+	if (running_)
+		return -EBUSY;
+
+	for (const Member &member : members_) {
+		if (member.camera == camera)
+			return -EEXIST;
+	}
+
+	if (!config || config->empty())
+		return -EINVAL;
+
+	Member member;
+	member.camera = camera;
+	member.lastTimestamp = 0;
+
+	for (const StreamConfiguration &cfg : *config) {
+		if (!cfg.stream())
+			return -EINVAL;
+
+		member.streams.push_back(cfg.stream());
+	}
+
+	members_.push_back(std::move(member));
+
+	return 0;
+}
+
+/**
+ * \fn CameraGroup::size()
+ * \brief Retrieve the number of cameras in the group
+ * \return The number of cameras
+ */
+
+/**
+ * \fn CameraGroup::tolerance()
+ * \brief Retrieve the tolerance for matching frame timestamps
+ * \return The tolerance, in nanoseconds
+ */
+
+/**
+ * \fn CameraGroup::setTolerance()
+ * \brief Set the tolerance for matching frame timestamps
+ * \param[in] tolerance The tolerance, in nanoseconds
+ */
+
+/**
+ * \brief Start capturing from all cameras
+ *
+ * The cameras are started back to back, and requests for all their buffers
+ * are then queued to all of them, to minimize the skew between their first
+ * frames. If a camera fails to start the cameras already started are stopped.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraGroup::start()
+{
+	if (running_)
+		return -EBUSY;
+
+	if (members_.empty())
+		return -EINVAL;
+
+	dropped_ = 0;
+
+	for (Member &member : members_) {
+		member.freeBuffers.clear();
+		member.freeBuffers.resize(member.streams.size());
+		member.pending.clear();
+		member.lastTimestamp = 0;
+
+		for (unsigned int i = 0; i < member.streams.size(); ++i) {
+			Stream *stream = member.streams[i];
+			unsigned int count = stream->configuration().bufferCount;
+
+			for (unsigned int j = 0; j < count; ++j)
+				member.freeBuffers[i].push_back(stream->buffer(j));
+
+			stream->bufferReleased.connect(this, &CameraGroup::bufferReleased);
+		}
+
+		member.camera->requestCompleted.connect(this, &CameraGroup::requestComplete);
+	}
+
+	for (unsigned int i = 0; i < members_.size(); ++i) {
+		int ret = members_[i].camera->start();
+		if (ret) {
+			LOG(CameraGroup, Error)
+				<< "Failed to start camera "
+				<< members_[i].camera->name();
+
+			for (unsigned int j = 0; j < i; ++j)
+				members_[j].camera->stop();
+
+			teardown();
+			return ret;
+		}
+	}
+
+	running_ = true;
+
+	for (Member &member : members_)
+		queueRequests(&member);
+
+	return 0;
+}
+
+/**
+ * \brief Stop capturing from all cameras
+ *
+ * The frames not matched yet are dropped. Frame sets still held by the
+ * application shall be released before the camera buffers are freed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraGroup::stop()
+{
+	if (!running_)
+		return 0;
+
+	running_ = false;
+
+	int ret = 0;
+	for (Member &member : members_) {
+		int err = member.camera->stop();
+		if (err && !ret)
+			ret = err;
+	}
+
+	teardown();
+
+	return ret;
+}
+
+/**
+ * \fn CameraGroup::droppedFrames()
+ * \brief Retrieve the number of frames dropped as they couldn't be matched
+ * \return The number of frames dropped since the group has been started
+ */
+
+/**
+ * \var CameraGroup::frameSetReady
+ * \brief Signal emitted when a set of matched frames is ready
+ */
+
+void CameraGroup::teardown()
+{
+	for (Member &member : members_) {
+		member.camera->requestCompleted.disconnect(this);
+		for (Stream *stream : member.streams)
+			stream->bufferReleased.disconnect(this);
+
+		member.pending.clear();
+		member.freeBuffers.clear();
+	}
+}
+
+CameraGroup::Member *CameraGroup::findMember(Stream *stream)
+{
+	for (Member &member : members_) {
+		auto iter = std::find(member.streams.begin(),
+				      member.streams.end(), stream);
+		if (iter != member.streams.end())
+			return &member;
+	}
+
+	return nullptr;
+}
+
+/* Queue requests as long as a buffer is available for every stream. */
+void CameraGroup::queueRequests(Member *member)
+{
+	while (running_) {
+		for (const std::deque<Buffer *> &buffers : member->freeBuffers) {
+			if (buffers.empty())
+				return;
+		}
+
+		Request *request = member->camera->createRequest();
+		if (!request)
+			return;
+
+		for (std::deque<Buffer *> &buffers : member->freeBuffers) {
+			request->addBuffer(buffers.front());
+			buffers.pop_front();
+		}
+
+		int ret = member->camera->queueRequest(request);
+		if (ret < 0) {
+			LOG(CameraGroup, Error)
+				<< "Failed to queue request: " << strerror(-ret);
+
+			for (const auto &item : request->buffers()) {
+				auto iter = std::find(member->streams.begin(),
+						      member->streams.end(),
+						      item.first);
+				member->freeBuffers[iter - member->streams.begin()]
+					.push_back(item.second);
+			}
+
+			delete request;
+			return;
+		}
+	}
+}
+
+void CameraGroup::requestComplete(Request *request,
+				  const Request::BufferMap &buffers)
+{
+	if (buffers.empty())
+		return;
+
+	Member *member = findMember(buffers.begin()->first);
+	if (!member)
+		return;
+
+	bool failed = request->status() != Request::RequestComplete;
+	for (const auto &item : buffers) {
+		if (item.second->status() != Buffer::BufferSuccess)
+			failed = true;
+	}
+
+	if (failed) {
+		for (const auto &item : buffers) {
+			auto iter = std::find(member->streams.begin(),
+					      member->streams.end(), item.first);
+			member->freeBuffers[iter - member->streams.begin()]
+				.push_back(item.second);
+		}
+
+		queueRequests(member);
+		return;
+	}
+
+	Buffer *first = buffers.begin()->second;
+
+	Frame frame;
+	frame.camera = member->camera.get();
+	frame.timestamp = first->timestamp();
+	frame.sequence = first->sequence();
+	for (const auto &item : buffers)
+		frame.buffers[item.first] = BufferRef(item.second);
+
+	member->lastTimestamp = frame.timestamp;
+	member->pending.push_back(std::move(frame));
+
+	while (member->pending.size() > MaxPendingFrames)
+		drop(member);
+
+	match();
+}
+
+/* Called when the last reference to a delivered or dropped frame is released. */
+void CameraGroup::bufferReleased(Buffer *buffer)
+{
+	Member *member = findMember(buffer->stream());
+	if (!member || !running_)
+		return;
+
+	auto iter = std::find(member->streams.begin(), member->streams.end(),
+			      buffer->stream());
+	member->freeBuffers[iter - member->streams.begin()].push_back(buffer);
+
+	queueRequests(member);
+}
+
+void CameraGroup::drop(Member *member)
+{
+	LOG(CameraGroup, Debug)
+		<< "Dropping frame " << member->pending.front().sequence
+		<< " of camera " << member->camera->name();
+
+	dropped_++;
+	member->pending.pop_front();
+}
+
+/*
+ * Deliver the sets of matched frames, and drop the frames that can't be
+ * matched anymore. The pending frames of each camera are in capture order.
+ */
+void CameraGroup::match()
+{
+	while (true) {
+		bool complete = true;
+		bool dropped = false;
+
+		for (Member &member : members_) {
+			if (member.pending.empty()) {
+				complete = false;
+				continue;
+			}
+
+			/*
+			 * The next frames of a camera without pending frame
+			 * are later than its last timestamp.
+			 */
+			uint64_t timestamp = member.pending.front().timestamp;
+			for (const Member &other : members_) {
+				if (!other.pending.empty())
+					continue;
+
+				if (other.lastTimestamp > timestamp + tolerance_) {
+					drop(&member);
+					dropped = true;
+					break;
+				}
+			}
+		}
+
+		if (dropped)
+			continue;
+
+		if (!complete)
+			return;
+
+		auto compare = [](const Member &a, const Member &b) {
+			return a.pending.front().timestamp <
+			       b.pending.front().timestamp;
+		};
+		auto minmax = std::minmax_element(members_.begin(),
+						  members_.end(), compare);
+		Member &earliest = *minmax.first;
+		const Member &latest = *minmax.second;
+
+		/*
+		 * If the earliest frame can't be matched with the next frame
+		 * of the latest camera, it can't be matched with any later
+		 * frame.
+		 */
+		if (latest.pending.front().timestamp -
+		    earliest.pending.front().timestamp > tolerance_) {
+			drop(&earliest);
+			continue;
+		}
+
+		FrameSet set;
+		for (Member &member : members_) {
+			set.push_back(std::move(member.pending.front()));
+			member.pending.pop_front();
+		}
+
+		frameSetReady.emit(set);
+	}
+}
+
+} /* namespace libcamera */
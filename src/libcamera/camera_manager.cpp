@@ -12,8 +12,10 @@
 
 #include "device_enumerator.h"
 #include "event_dispatcher_poll.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "startup_timeline.h"
 #include "thread.h"
 #include "utils.h"
 
@@ -26,6 +28,21 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Camera)
 
+/**
+ * \struct StartupPhase
+ * \brief A phase of the startup timeline
+ * \sa CameraManager::startupTimeline()
+ * \var StartupPhase::name
+ * \brief The phase name
+ * \var StartupPhase::subject
+ * \brief The object the phase applies to, such as a pipeline handler, media
+ * device, camera sensor, IPA module, process or camera
+ * \var StartupPhase::start
+ * \brief The phase start time, in nanoseconds on the CLOCK_MONOTONIC clock
+ * \var StartupPhase::end
+ * \brief The phase end time, in nanoseconds on the CLOCK_MONOTONIC clock
+ */
+
 /**
  * \class CameraManager
  * \brief Provide access and manage all cameras in the system
@@ -62,7 +79,7 @@ LOG_DEFINE_CATEGORY(Camera)
 CameraManager *CameraManager::self_ = nullptr;
 
 CameraManager::CameraManager()
-	: enumerator_(nullptr)
+	: enumerator_(nullptr), pipelineThreads_(false), standbyPeriod_(0)
 {
 	if (self_)
 		LOG(Camera, Fatal)
@@ -93,10 +110,39 @@ int CameraManager::start()
 
 	LOG(Camera, Info) << "libcamera " << version_;
 
-	enumerator_ = DeviceEnumerator::create();
-	if (!enumerator_ || enumerator_->enumerate())
-		return -ENODEV;
+	StartupTimeline::Scope phase("manager-start", "");
+
+	{
+		StartupTimeline::Scope enumeration("enumerate", "");
+
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_ || enumerator_->enumerate())
+			return -ENODEV;
+	}
+
+	/*
+	 * Start the IPA proxy workers, if requested, before the pipeline
+	 * handlers create their IPA.
+	 */
+	IPAManager::instance()->prestartProxies();
+
+	createPipelineHandlers();
 
+	/*
+	 * Match hotplugged devices. The enumerator batches hotplug events,
+	 * and matching skips devices already in use by cameras.
+	 */
+	enumerator_->devicesAdded.connect(this, &CameraManager::createPipelineHandlers);
+
+	return 0;
+}
+
+/*
+ * Create pipeline handlers for all the media devices they match that are not
+ * in use yet.
+ */
+void CameraManager::createPipelineHandlers()
+{
 	/*
 	 * TODO: Try to read handlers and order from configuration
 	 * file and only fallback on all handlers if there is no
@@ -104,14 +150,30 @@ int CameraManager::start()
 	 */
 	std::vector<PipelineHandlerFactory *> &factories = PipelineHandlerFactory::factories();
 
+	/*
+	 * Pipeline handlers are matched sequentially, as match() creates
+	 * event notifiers, loads IPA modules and registers cameras, none of
+	 * which is thread-safe. The expensive device probing steps, media
+	 * graph population and sensor initialisation, are parallelized by
+	 * the device enumerator and CameraSensor::initAll() instead.
+	 */
 	for (PipelineHandlerFactory *factory : factories) {
 		/*
 		 * Try each pipeline handler until it exhaust
 		 * all pipelines it can provide.
 		 */
 		while (1) {
-			std::shared_ptr<PipelineHandler> pipe = factory->create(this);
-			if (!pipe->match(enumerator_.get()))
+			std::shared_ptr<PipelineHandler> pipe =
+				factory->create(this, pipelineThreads_,
+						pipelineScheduling_);
+			pipe->setStandbyPeriod(standbyPeriod_);
+
+			DeviceEnumerator *enumerator = enumerator_.get();
+			int matched = pipe->invoke([&]() {
+				StartupTimeline::Scope phase("match", factory->name());
+				return pipe->match(enumerator);
+			});
+			if (!matched)
 				break;
 
 			LOG(Camera, Debug)
@@ -120,10 +182,6 @@ int CameraManager::start()
 			pipes_.push_back(std::move(pipe));
 		}
 	}
-
-	/* TODO: register hot-plug callback here */
-
-	return 0;
 }
 
 /**
@@ -138,12 +196,11 @@ int CameraManager::start()
  */
 void CameraManager::stop()
 {
-	/* TODO: unregister hot-plug callback here */
-
 	/*
 	 * Release all references to cameras and pipeline handlers to ensure
 	 * they all get destroyed before the device enumerator deletes the
-	 * media devices.
+	 * media devices. The enumerator's devicesAdded signal is disconnected
+	 * from the manager when the enumerator is destroyed.
 	 */
 	pipes_.clear();
 	cameras_.clear();
@@ -263,4 +320,146 @@ EventDispatcher *CameraManager::eventDispatcher()
 	return thread()->eventDispatcher();
 }
 
+/**
+ * \brief Run pipeline handlers in dedicated threads
+ * \param[in] enable Whether to enable pipeline threads
+ *
+ * By default, pipeline handlers process buffer completion, IPA events and
+ * timers in the camera manager thread, through the event dispatcher used by
+ * the application's event loop. A slow requestCompleted signal handler then
+ * delays buffer handling for all cameras.
+ *
+ * When pipeline threads are enabled, each pipeline handler runs in its own
+ * internal thread. Requests queued to a camera are passed to its pipeline
+ * handler through a lock-free queue, and the Camera::bufferCompleted and
+ * Camera::requestCompleted signals are delivered asynchronously to the camera
+ * manager thread. The Camera methods shall then only be called from the camera
+ * manager thread.
+ *
+ * Asynchronous delivery relies on the messages of the camera manager thread
+ * being dispatched by its event dispatcher, which the default poll-based
+ * event dispatcher guarantees. Pipeline threads shall thus not be enabled
+ * with a custom event dispatcher. This function shall be called before the
+ * camera manager is started with start().
+ */
+void CameraManager::setPipelineThreads(bool enable)
+{
+	if (enumerator_) {
+		LOG(Camera, Error)
+			<< "Pipeline threads can't be changed once started";
+		return;
+	}
+
+	pipelineThreads_ = enable;
+}
+
+/**
+ * \brief Set the scheduling parameters of the pipeline handler threads
+ * \param[in] scheduling The scheduling parameters
+ *
+ * When pipeline threads are enabled with setPipelineThreads(), the pipeline
+ * handler threads are started with the \a scheduling parameters. This allows,
+ * for instance, running buffer completion handling with a real-time policy on
+ * isolated CPUs. Parameters that can't be applied are reported in the log and
+ * the threads then run with the default scheduling.
+ *
+ * This function shall be called before the camera manager is started with
+ * start().
+ */
+void CameraManager::setPipelineThreadScheduling(const ThreadScheduling &scheduling)
+{
+	if (enumerator_) {
+		LOG(Camera, Error)
+			<< "Pipeline thread scheduling can't be changed once started";
+		return;
+	}
+
+	pipelineScheduling_ = scheduling;
+}
+
+/**
+ * \brief Set the scheduling parameters of the IPA threads
+ * \param[in] scheduling The scheduling parameters
+ *
+ * IPA modules that run in a thread of their own are started with the \a
+ * scheduling parameters. The parameters apply to the IPA modules created after
+ * this call, and should thus be set before the camera manager is started with
+ * start().
+ */
+void CameraManager::setIPAThreadScheduling(const ThreadScheduling &scheduling)
+{
+	IPAManager::instance()->setThreadScheduling(scheduling);
+}
+
+/**
+ * \brief Keep the cameras warm for a grace period after they're released
+ * \param[in] msec The grace period in milliseconds, 0 to disable standby
+ *
+ * The camera device nodes are opened and the media links set up when the
+ * cameras are registered, and stay so until the cameras are removed. The
+ * sensors and the other devices of a camera are however powered up by their
+ * drivers when the camera starts, and powered down when it stops, which can
+ * add hundreds of milliseconds to every capture session.
+ *
+ * When a standby period is set, the devices of a camera are kept powered from
+ * the time the camera is acquired until \a msec milliseconds after it is
+ * released. A camera stopped and started again, or released and acquired again
+ * within the grace period, then starts streaming without powering its devices
+ * up. When the grace period expires the devices are handed back to the runtime
+ * power management of their drivers, which puts them in their low-power state.
+ *
+ * Keeping the devices powered requires write access to their runtime power
+ * management control in sysfs. Cameras whose devices can't be controlled are
+ * power managed by their drivers as usual.
+ *
+ * Standby is disabled by default. This function shall be called before the
+ * camera manager is started with start().
+ */
+void CameraManager::setStandbyPeriod(unsigned int msec)
+{
+	if (enumerator_) {
+		LOG(Camera, Error)
+			<< "Standby period can't be changed once started";
+		return;
+	}
+
+	standbyPeriod_ = msec;
+}
+
+/**
+ * \brief Retrieve the timeline of the phases leading to the first frames
+ *
+ * libcamera records the start and end time of the phases that contribute to
+ * the time to first frame of the cameras, to help locating the slowest ones on
+ * a platform. The following phases are recorded, with their subject:
+ *
+ * - manager-start: CameraManager::start()
+ * - enumerate: the device enumeration in CameraManager::start()
+ * - populate: MediaDevice::populate(), for each media device node
+ * - match: the match() call of a pipeline handler, for each pipeline handler
+ *   factory name
+ * - sensor-init: CameraSensor::init(), for each sensor entity name
+ * - camera-init: the initialization of a camera on first use, for each camera
+ * - ipa-load: the loading of an IPA module, for each module path
+ * - process-start: Process::start(), for each executable path, including the
+ *   isolated IPA proxies
+ * - configure, allocate-buffers and start: Camera::configure(),
+ *   Camera::allocateBuffers() and Camera::start(), for each camera
+ * - first-request: from Camera::start() to the completion of the first request
+ *   of the capture session, for each camera
+ *
+ * Phases can nest, and can overlap when they run in different threads. The
+ * timeline is process-wide and retains the first StartupTimeline::MAX_PHASES
+ * phases only. The phases are also emitted as startup_phase tracepoints when
+ * tracing is enabled.
+ *
+ * This function is thread-safe.
+ *
+ * \return The recorded phases, in the order they have completed
+ */
+std::vector<StartupPhase> CameraManager::startupTimeline()
+{
+	return StartupTimeline::instance()->phases();
+}
+
 } /* namespace libcamera */
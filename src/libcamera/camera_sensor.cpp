@@ -11,9 +11,17 @@
 #include <float.h>
 #include <iomanip>
 #include <limits.h>
+#include <map>
 #include <math.h>
+#include <thread>
+
+#include <linux/v4l2-common.h>
+#include <linux/v4l2-controls.h>
+
+#include <libcamera/controls.h>
 
 #include "formats.h"
+#include "startup_timeline.h"
 #include "utils.h"
 #include "v4l2_subdevice.h"
 
@@ -26,6 +34,39 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(CameraSensor);
 
+/**
+ * \struct CameraSensorMode
+ * \brief A sensor output size along with its timing limits
+ *
+ * The sensor modes are computed once at CameraSensor::init() time from the
+ * frame sizes, the pixel rate and the blanking limits reported by the sensor
+ * driver.
+ *
+ * \var CameraSensorMode::size
+ * \brief The sensor output size
+ *
+ * \var CameraSensorMode::lineLength
+ * \brief The minimum line length in pixels, including horizontal blanking
+ *
+ * \var CameraSensorMode::frameLength
+ * \brief The minimum frame length in lines, including vertical blanking
+ *
+ * \var CameraSensorMode::maxFrameLength
+ * \brief The maximum frame length in lines, including vertical blanking
+ *
+ * \var CameraSensorMode::maxFrameRate
+ * \brief The maximum frame rate in frames per second, or 0 if unknown
+ *
+ * The maximum frame rate is computed from the pixel rate using the minimum
+ * line and frame lengths. Drivers that don't report their pixel rate lead to
+ * an unknown maximum frame rate.
+ *
+ * The frame duration of a mode is the product of its line length and frame
+ * length divided by the pixel rate. It is controlled by changing the vertical
+ * blanking, and thus the frame length, between the frameLength and
+ * maxFrameLength limits.
+ */
+
 /**
  * \class CameraSensor
  * \brief A camera sensor based on V4L2 subdevices
@@ -47,7 +88,9 @@ LOG_DEFINE_CATEGORY(CameraSensor);
  * Once constructed the instance must be initialized with init().
  */
 CameraSensor::CameraSensor(const MediaEntity *entity)
-	: entity_(entity)
+	: entity_(entity), pixelRate_(0), hasVblank_(false), hblank_(0),
+	  vblank_(0), maxVblank_(0), mode_(nullptr), cropSupported_(false),
+	  cropActive_(false), cropBounds_(), cropDefault_(), cropMode_()
 {
 	subdev_ = new V4L2Subdevice(entity);
 }
@@ -70,6 +113,7 @@ CameraSensor::~CameraSensor()
  */
 int CameraSensor::init()
 {
+	StartupTimeline::Scope phase("sensor-init", entity_->name());
 	int ret;
 
 	if (entity_->pads().size() != 1) {
@@ -119,9 +163,193 @@ int CameraSensor::init()
 	std::sort(mbusCodes_.begin(), mbusCodes_.end());
 	std::sort(sizes_.begin(), sizes_.end());
 
+	initCrop();
+	initModes();
+
+	return 0;
+}
+
+/*
+ * Retrieve the crop capabilities of the sensor, and infer the supported binning
+ * factors from the frame sizes. A factor is considered supported when the
+ * sensor resolution divided by the factor is one of the frame sizes, as single
+ * pad sensor drivers implement binning by scaling the crop rectangle down to
+ * the output format.
+ */
+void CameraSensor::initCrop()
+{
+	cropSupported_ = !subdev_->getSelection(0, V4L2_SEL_TGT_CROP_BOUNDS,
+						&cropBounds_) &&
+			 cropBounds_.w && cropBounds_.h;
+	if (!cropSupported_)
+		return;
+
+	if (subdev_->getSelection(0, V4L2_SEL_TGT_CROP_DEFAULT, &cropDefault_))
+		cropDefault_ = cropBounds_;
+
+	static const unsigned int factors[] = { 1, 2, 4 };
+	const Size &res = resolution();
+
+	binningFactors_.clear();
+	for (unsigned int factor : factors) {
+		Size binned{ res.width / factor, res.height / factor };
+		if (std::binary_search(sizes_.begin(), sizes_.end(), binned))
+			binningFactors_.push_back(factor);
+	}
+
+	LOG(CameraSensor, Debug)
+		<< "Crop bounds " << cropBounds_.toString() << ", "
+		<< binningFactors_.size() << " binning factors";
+}
+
+/*
+ * Compute the sensor modes for all the supported sizes, and group them by
+ * aspect ratio in increasing order of size to speed up format selection.
+ *
+ * The blanking limits are those reported by the driver for the format
+ * configured at init time. Drivers that adjust the limits based on the output
+ * size may allow higher frame rates than computed here for some modes.
+ */
+void CameraSensor::initModes()
+{
+	const ControlInfoMap &controls = subdev_->controls();
+
+	auto iter = controls.find(V4L2_CID_HBLANK);
+	if (iter != controls.end())
+		hblank_ = std::max(iter->second.min().get<int32_t>(), 0);
+
+	iter = controls.find(V4L2_CID_VBLANK);
+	if (iter != controls.end()) {
+		vblank_ = std::max(iter->second.min().get<int32_t>(), 0);
+		maxVblank_ = std::max<int32_t>(iter->second.max().get<int32_t>(),
+					       vblank_);
+		hasVblank_ = true;
+	}
+
+	if (controls.count(V4L2_CID_PIXEL_RATE)) {
+		ControlList ctrls(controls);
+		ctrls.set(V4L2_CID_PIXEL_RATE, ControlValue(static_cast<int64_t>(0)));
+
+		if (!subdev_->getControls(&ctrls)) {
+			int64_t rate = ctrls.get(V4L2_CID_PIXEL_RATE).get<int64_t>();
+			pixelRate_ = std::max<int64_t>(rate, 0);
+		}
+	}
+
+	/*
+	 * Group the sizes by their reduced width/height fraction. Sizes with
+	 * an identical aspect ratio grow in both dimensions, and the sizes_
+	 * vector is sorted, the modes of each group are thus sorted as well.
+	 */
+	std::map<std::pair<unsigned int, unsigned int>, ModeGroup> groups;
+
+	for (const Size &size : sizes_) {
+		if (!size.width || !size.height)
+			continue;
+
+		unsigned int a = size.width;
+		unsigned int b = size.height;
+		while (b) {
+			unsigned int r = a % b;
+			a = b;
+			b = r;
+		}
+
+		ModeGroup &group = groups[{ size.width / a, size.height / a }];
+		group.aspectRatio = static_cast<float>(size.width) / size.height;
+
+		group.modes.push_back(computeMode(size));
+	}
+
+	modeGroups_.clear();
+	for (auto &group : groups)
+		modeGroups_.push_back(std::move(group.second));
+
+	std::sort(modeGroups_.begin(), modeGroups_.end(),
+		  [](const ModeGroup &a, const ModeGroup &b) {
+			  return a.aspectRatio < b.aspectRatio;
+		  });
+
+	for (const ModeGroup &group : modeGroups_) {
+		for (const CameraSensorMode &mode : group.modes)
+			LOG(CameraSensor, Debug)
+				<< "Mode " << mode.size.toString() << " up to "
+				<< mode.maxFrameRate << " fps";
+	}
+}
+
+/*
+ * Compute the timings of a sensor mode that outputs \a size, from the blanking
+ * limits and pixel rate retrieved at init time.
+ */
+CameraSensorMode CameraSensor::computeMode(const Size &size) const
+{
+	CameraSensorMode mode;
+	mode.size = size;
+	mode.lineLength = size.width + hblank_;
+	mode.frameLength = size.height + vblank_;
+	mode.maxFrameLength = size.height + maxVblank_;
+	mode.maxFrameRate = static_cast<double>(pixelRate_) /
+			    (static_cast<uint64_t>(mode.lineLength) * mode.frameLength);
+
+	return mode;
+}
+
+/*
+ * Select the first code of \a mbusCodes supported by the sensor, or return 0 if
+ * none is supported.
+ */
+unsigned int CameraSensor::findCode(const std::vector<unsigned int> &mbusCodes) const
+{
+	for (unsigned int code : mbusCodes) {
+		if (std::binary_search(mbusCodes_.begin(), mbusCodes_.end(), code))
+			return code;
+	}
+
 	return 0;
 }
 
+/**
+ * \brief Initialize multiple camera sensor instances concurrently
+ * \param[in] sensors The camera sensors to initialize
+ *
+ * Sensor initialisation opens the subdevice, enumerates its formats and frame
+ * sizes and queries its controls. Depending on the driver this can power the
+ * sensor up and access it over a slow bus, making it the most time-consuming
+ * part of pipeline handler matching. This method runs init() for all \a
+ * sensors in parallel, each from its own helper thread, and waits for all of
+ * them to complete.
+ *
+ * init() only operates on the sensor's own subdevice and doesn't create any
+ * event notifier or timer, it is thus safe to call from any thread. The sensors
+ * shall not be accessed concurrently by the caller until this method returns.
+ *
+ * \return A vector of init() return values, one for each sensor, in the order
+ * of \a sensors
+ */
+std::vector<int> CameraSensor::initAll(const std::vector<CameraSensor *> &sensors)
+{
+	std::vector<int> results(sensors.size(), 0);
+
+	if (sensors.size() == 1) {
+		results[0] = sensors[0]->init();
+		return results;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(sensors.size());
+
+	for (unsigned int i = 0; i < sensors.size(); ++i)
+		threads.emplace_back([&sensors, &results, i]() {
+			results[i] = sensors[i]->init();
+		});
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	return results;
+}
+
 /**
  * \fn CameraSensor::entity()
  * \brief Retrieve the sensor media entity
@@ -153,10 +381,75 @@ const Size &CameraSensor::resolution() const
 	return sizes_.back();
 }
 
+/**
+ * \fn CameraSensor::pixelRate()
+ * \brief Retrieve the sensor pixel rate
+ * \return The sensor pixel rate in pixels per second, or 0 if unknown
+ */
+
+/**
+ * \brief Find the best sensor mode for a desired output size and frame rate
+ * \param[in] size The desired size
+ * \param[in] minFrameRate The minimum desired frame rate, or 0 for any
+ *
+ * This method selects the best mode according to the criteria documented in
+ * getFormat(). Modes whose maximum frame rate is known and lower than \a
+ * minFrameRate are ignored.
+ *
+ * The modes are grouped by aspect ratio at init() time, the lookup performs a
+ * binary search in each group.
+ *
+ * \return The best sensor mode, or nullptr if no mode matches
+ */
+const CameraSensorMode *CameraSensor::findMode(const Size &size,
+					       float minFrameRate) const
+{
+	unsigned int desiredArea = size.width * size.height;
+	unsigned int bestArea = UINT_MAX;
+	float desiredRatio = static_cast<float>(size.width) / size.height;
+	float bestRatio = FLT_MAX;
+	const CameraSensorMode *bestMode = nullptr;
+
+	for (const ModeGroup &group : modeGroups_) {
+		float ratioDiff = fabsf(group.aspectRatio - desiredRatio);
+		if (ratioDiff > bestRatio)
+			continue;
+
+		/*
+		 * Find the smallest mode of the group in which the desired
+		 * size fits. Larger modes of the group have a lower frame
+		 * rate, the group doesn't match if this one is too slow.
+		 */
+		auto mode = std::lower_bound(group.modes.begin(), group.modes.end(),
+					     size,
+					     [](const CameraSensorMode &m, const Size &s) {
+						     return m.size.width < s.width ||
+							    m.size.height < s.height;
+					     });
+		if (mode == group.modes.end())
+			continue;
+
+		if (mode->maxFrameRate && mode->maxFrameRate < minFrameRate)
+			continue;
+
+		unsigned int areaDiff = mode->size.width * mode->size.height
+				      - desiredArea;
+
+		if (ratioDiff < bestRatio || areaDiff < bestArea) {
+			bestRatio = ratioDiff;
+			bestArea = areaDiff;
+			bestMode = &*mode;
+		}
+	}
+
+	return bestMode;
+}
+
 /**
  * \brief Retrieve the best sensor format for a desired output
  * \param[in] mbusCodes The list of acceptable media bus codes
  * \param[in] size The desired size
+ * \param[in] minFrameRate The minimum desired frame rate, or 0 for any
  *
  * Media bus codes are selected from \a mbusCodes, which lists all acceptable
  * codes in decreasing order of preference. This method selects the first code
@@ -173,6 +466,8 @@ const Size &CameraSensor::resolution() const
  *   need to crop the field of view.
  * - The sensor output size shall be as small as possible to lower the required
  *   bandwidth.
+ * - The sensor output size shall allow capturing at \a minFrameRate, when the
+ *   maximum frame rate of the sensor modes is known.
  *
  * The use of this method is optional, as the above criteria may not match the
  * needs of all pipeline handlers. Pipeline handlers may implement custom
@@ -185,54 +480,106 @@ const Size &CameraSensor::resolution() const
  * and size on success, or an empty format otherwise.
  */
 V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbusCodes,
-					    const Size &size) const
+					    const Size &size,
+					    float minFrameRate) const
 {
 	V4L2SubdeviceFormat format{};
 
-	for (unsigned int code : mbusCodes) {
-		if (std::any_of(mbusCodes_.begin(), mbusCodes_.end(),
-				[code](unsigned int c) { return c == code; })) {
-			format.mbus_code = code;
-			break;
-		}
-	}
-
+	format.mbus_code = findCode(mbusCodes);
 	if (!format.mbus_code) {
 		LOG(CameraSensor, Debug) << "No supported format found";
 		return format;
 	}
 
-	unsigned int desiredArea = size.width * size.height;
-	unsigned int bestArea = UINT_MAX;
-	float desiredRatio = static_cast<float>(size.width) / size.height;
-	float bestRatio = FLT_MAX;
-	const Size *bestSize = nullptr;
+	const CameraSensorMode *mode = findMode(size, minFrameRate);
+	if (!mode) {
+		LOG(CameraSensor, Debug) << "No supported size found";
+		return format;
+	}
 
-	for (const Size &sz : sizes_) {
-		if (sz.width < size.width || sz.height < size.height)
-			continue;
+	format.size = mode->size;
 
-		float ratio = static_cast<float>(sz.width) / sz.height;
-		float ratioDiff = fabsf(ratio - desiredRatio);
-		unsigned int area = sz.width * sz.height;
-		unsigned int areaDiff = area - desiredArea;
+	return format;
+}
 
-		if (ratioDiff > bestRatio)
-			continue;
+/**
+ * \brief Retrieve the best sensor format and crop for a region of interest
+ * \param[in] mbusCodes The list of acceptable media bus codes
+ * \param[in] size The desired size
+ * \param[in] roi The region of interest in pixel array coordinates
+ * \param[out] crop The sensor crop rectangle
+ * \param[in] minFrameRate The minimum desired frame rate, or 0 for any
+ *
+ * This method selects a sensor format that only outputs the \a roi region of
+ * the pixel array, to lower the bandwidth on the sensor bus and in the
+ * pipeline. The \a roi is clamped to the sensor crop bounds, and aligned to
+ * even coordinates and sizes to preserve the Bayer pattern order. The largest
+ * binning factor that still produces an output at least as large as the
+ * desired \a size in both dimensions is then selected, and the sensor output
+ * size is the crop rectangle size divided by the binning factor.
+ *
+ * Media bus codes are selected from \a mbusCodes as in getFormat(). When the
+ * sensor doesn't support cropping or the \a roi is empty, this method behaves
+ * as getFormat() and sets \a crop to an empty rectangle.
+ *
+ * The returned format and \a crop shall be passed to setFormat(), which may
+ * still adjust them if the sensor driver doesn't support them exactly.
+ *
+ * \return The best sensor output format for the region of interest on success,
+ * or an empty format otherwise
+ */
+V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbusCodes,
+					    const Size &size, const Rectangle &roi,
+					    Rectangle *crop,
+					    float minFrameRate) const
+{
+	*crop = {};
 
-		if (ratioDiff < bestRatio || areaDiff < bestArea) {
-			bestRatio = ratioDiff;
-			bestArea = areaDiff;
-			bestSize = &sz;
-		}
+	if (!cropSupported_ || !roi.w || !roi.h)
+		return getFormat(mbusCodes, size, minFrameRate);
+
+	V4L2SubdeviceFormat format{};
+
+	format.mbus_code = findCode(mbusCodes);
+	if (!format.mbus_code) {
+		LOG(CameraSensor, Debug) << "No supported format found";
+		return format;
 	}
 
-	if (!bestSize) {
-		LOG(CameraSensor, Debug) << "No supported size found";
+	/* Clamp the region of interest and align it relative to the bounds. */
+	const Rectangle &bounds = cropBounds_;
+	int x = utils::clamp<int>(roi.x, bounds.x, bounds.x + bounds.w - 2);
+	int y = utils::clamp<int>(roi.y, bounds.y, bounds.y + bounds.h - 2);
+	x = bounds.x + ((x - bounds.x) & ~1);
+	y = bounds.y + ((y - bounds.y) & ~1);
+
+	Rectangle rect;
+	rect.x = x;
+	rect.y = y;
+	rect.w = std::max(std::min<unsigned int>(roi.w, bounds.x + bounds.w - x) & ~1U, 2U);
+	rect.h = std::max(std::min<unsigned int>(roi.h, bounds.y + bounds.h - y) & ~1U, 2U);
+
+	unsigned int binning = 1;
+	for (unsigned int factor : binningFactors_) {
+		if (rect.w / factor >= size.width && rect.h / factor >= size.height)
+			binning = factor;
+	}
+
+	Size output{ (rect.w / binning) & ~1U, (rect.h / binning) & ~1U };
+	CameraSensorMode mode = computeMode(output);
+	if (mode.maxFrameRate && mode.maxFrameRate < minFrameRate) {
+		LOG(CameraSensor, Debug)
+			<< "Region of interest " << rect.toString()
+			<< " too large for " << minFrameRate << " fps";
 		return format;
 	}
 
-	format.size = *bestSize;
+	LOG(CameraSensor, Debug)
+		<< "Cropping to " << rect.toString() << " with binning "
+		<< binning << " for " << output.toString();
+
+	format.size = output;
+	*crop = rect;
 
 	return format;
 }
@@ -240,11 +587,197 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 /**
  * \brief Set the sensor output format
  * \param[in] format The desired sensor output format
+ *
+ * If the sensor has been cropped by a previous call to setFormat() with a crop
+ * rectangle, the crop is reset to the sensor default.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int CameraSensor::setFormat(V4L2SubdeviceFormat *format)
 {
-	return subdev_->setFormat(0, format);
+	int ret;
+
+	if (cropActive_) {
+		Rectangle rect = cropDefault_;
+		ret = subdev_->setCrop(0, &rect);
+		if (ret)
+			return ret;
+
+		cropActive_ = false;
+	}
+
+	ret = subdev_->setFormat(0, format);
+	if (ret)
+		return ret;
+
+	mode_ = nullptr;
+	for (const ModeGroup &group : modeGroups_) {
+		for (const CameraSensorMode &mode : group.modes) {
+			if (mode.size == format->size) {
+				mode_ = &mode;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Set the sensor crop rectangle and output format
+ * \param[inout] format The desired sensor output format
+ * \param[inout] crop The desired sensor crop rectangle
+ *
+ * The crop rectangle is applied first, as sensor drivers adjust the output
+ * format to the crop rectangle. Both \a crop and \a format are updated with the
+ * values applied to the sensor. The values returned by the getFormat() method
+ * for a region of interest are meant to be passed to this method.
+ *
+ * The configured mode() is computed for the sensor output size, using the
+ * blanking limits of the sensor.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support cropping
+ */
+int CameraSensor::setFormat(V4L2SubdeviceFormat *format, Rectangle *crop)
+{
+	if (!cropSupported_)
+		return -ENOTSUP;
+
+	int ret = subdev_->setCrop(0, crop);
+	if (ret)
+		return ret;
+
+	cropActive_ = true;
+
+	ret = subdev_->setFormat(0, format);
+	if (ret)
+		return ret;
+
+	cropMode_ = computeMode(format->size);
+	mode_ = &cropMode_;
+
+	return 0;
+}
+
+/**
+ * \fn CameraSensor::cropSupported()
+ * \brief Check if the sensor supports cropping its pixel array
+ * \return True if the sensor reports crop bounds, false otherwise
+ */
+
+/**
+ * \fn CameraSensor::cropBounds()
+ * \brief Retrieve the bounds of the sensor crop rectangle
+ * \return The crop bounds in pixel array coordinates, or an empty rectangle if
+ * the sensor doesn't support cropping
+ */
+
+/**
+ * \fn CameraSensor::binningFactors()
+ * \brief Retrieve the binning factors supported by the sensor
+ *
+ * The binning factors are inferred at init() time from the frame sizes of
+ * sensors that support cropping. A factor is considered supported when the
+ * sensor resolution divided by the factor is one of the frame sizes.
+ *
+ * \return The supported binning factors in increasing order
+ */
+
+/**
+ * \fn CameraSensor::mode()
+ * \brief Retrieve the sensor mode configured by the last call to setFormat()
+ * \return The configured sensor mode, or nullptr if no format has been
+ * configured or the configured size doesn't match any mode
+ */
+
+/*
+ * Compute the duration in microseconds of a frame of \a frameLength lines in
+ * \a mode.
+ */
+int64_t CameraSensor::frameDuration(const CameraSensorMode &mode,
+				    unsigned int frameLength) const
+{
+	return static_cast<uint64_t>(mode.lineLength) * frameLength * 1000000
+	       / pixelRate_;
+}
+
+/**
+ * \brief Retrieve the frame duration limits of the sensor
+ * \param[out] minDuration The minimum frame duration in microseconds
+ * \param[out] maxDuration The maximum frame duration in microseconds
+ * \param[in] mode The sensor mode, or nullptr for all modes
+ *
+ * When \a mode is nullptr, the limits span all the sensor modes, from the
+ * fastest mode to the slowest one.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ */
+int CameraSensor::frameDurationLimits(int64_t *minDuration, int64_t *maxDuration,
+				      const CameraSensorMode *mode) const
+{
+	if (!pixelRate_ || !hasVblank_)
+		return -ENOTSUP;
+
+	if (mode) {
+		*minDuration = frameDuration(*mode, mode->frameLength);
+		*maxDuration = frameDuration(*mode, mode->maxFrameLength);
+		return 0;
+	}
+
+	*minDuration = INT64_MAX;
+	*maxDuration = 0;
+
+	for (const ModeGroup &group : modeGroups_) {
+		for (const CameraSensorMode &m : group.modes) {
+			*minDuration = std::min(*minDuration,
+						frameDuration(m, m.frameLength));
+			*maxDuration = std::max(*maxDuration,
+						frameDuration(m, m.maxFrameLength));
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Compute the sensor controls for a desired frame duration
+ * \param[inout] ctrls The sensor controls list
+ * \param[inout] duration The frame duration in microseconds
+ *
+ * This method computes the vertical blanking that achieves the frame \a
+ * duration closest to the requested value in the currently configured mode,
+ * and stores it in \a ctrls. The list shall have been constructed from the
+ * sensor controls() and can then be passed to setControls(), along with other
+ * sensor controls.
+ *
+ * The \a duration is updated with the frame duration that will be achieved,
+ * after clamping to the limits of the mode and rounding to a whole number of
+ * lines.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ * \retval -EINVAL No sensor mode has been configured
+ */
+int CameraSensor::setFrameDuration(ControlList *ctrls, int64_t *duration) const
+{
+	if (!pixelRate_ || !hasVblank_)
+		return -ENOTSUP;
+
+	if (!mode_)
+		return -EINVAL;
+
+	uint64_t lines = std::max<int64_t>(*duration, 0) * pixelRate_
+		       / (static_cast<uint64_t>(mode_->lineLength) * 1000000);
+	unsigned int frameLength = utils::clamp<uint64_t>(lines, mode_->frameLength,
+							  mode_->maxFrameLength);
+
+	ctrls->set(V4L2_CID_VBLANK,
+		   ControlValue(static_cast<int32_t>(frameLength - mode_->size.height)));
+	*duration = frameDuration(*mode_, frameLength);
+
+	return 0;
 }
 
 /**
@@ -264,9 +797,12 @@ const ControlInfoMap &CameraSensor::controls() const
  * their values in the corresponding \a ctrls entry.
  *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is a compound control, or if any
- * other error occurs during validation of the requested controls, no control is
- * read and this method returns -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
+ * during validation of the requested controls, no control is read and this
+ * method returns -EINVAL.
+ *
+ * The payload of array and compound controls is read directly into the storage
+ * of the corresponding array ControlValue, which is allocated if needed.
  *
  * If an error occurs while reading the controls, the index of the first control
  * that couldn't be read is returned. The value of all controls below that index
@@ -287,16 +823,20 @@ int CameraSensor::getControls(ControlList *ctrls)
 /**
  * \brief Write controls to the sensor
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in, or nullptr
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is a
- * compound control, or if any other error occurs during validation of
- * the requested controls, no control is written and this method returns
- * -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is an array or
+ * compound control whose value doesn't match the control payload size, or if
+ * any other error occurs during validation of the requested controls, no
+ * control is written and this method returns -EINVAL.
+ *
+ * The payload of array and compound controls is passed to the kernel directly
+ * from the storage of the array ControlValue, without intermediate copies.
  *
  * If an error occurs while writing the controls, the index of the first
  * control that couldn't be written is returned. All controls below that index
@@ -309,9 +849,62 @@ int CameraSensor::getControls(ControlList *ctrls)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int CameraSensor::setControls(ControlList *ctrls)
+int CameraSensor::setControls(ControlList *ctrls, MediaRequest *request)
+{
+	return subdev_->setControls(ctrls, request);
+}
+
+/**
+ * \brief Prepare a control batch for repeated access to sensor controls
+ * \param[out] batch The control batch to prepare
+ * \param[in] ids The V4L2 IDs of the controls
+ * \sa V4L2Device::prepareControls()
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraSensor::prepareControls(V4L2ControlBatch *batch,
+				  const std::vector<unsigned int> &ids) const
+{
+	return subdev_->prepareControls(batch, ids);
+}
+
+/**
+ * \brief Read the controls of a prepared batch from the sensor
+ * \param[inout] batch The control batch
+ * \sa V4L2Device::getControls(V4L2ControlBatch *)
+ * \return 0 on success or an error code otherwise
+ */
+int CameraSensor::getControls(V4L2ControlBatch *batch)
+{
+	return subdev_->getControls(batch);
+}
+
+/**
+ * \brief Write the controls of a prepared batch to the sensor
+ * \param[inout] batch The control batch
+ * \param[in] request The media request to store the controls in, or nullptr
+ * \sa V4L2Device::setControls(V4L2ControlBatch *, MediaRequest *)
+ * \return 0 on success or an error code otherwise
+ */
+int CameraSensor::setControls(V4L2ControlBatch *batch, MediaRequest *request)
+{
+	return subdev_->setControls(batch, request);
+}
+
+/**
+ * \brief Enable or disable caching of the sensor control values
+ * \param[in] enable True to enable the control cache, false to disable it
+ *
+ * Once enabled, getControls() reads the values of cached controls without
+ * accessing the device. This is useful for controls such as exposure and gain
+ * that are read back for every frame.
+ *
+ * \sa V4L2Device::setControlEventsEnabled()
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraSensor::setControlEventsEnabled(bool enable)
 {
-	return subdev_->setControls(ctrls);
+	return subdev_->setControlEventsEnabled(enable);
 }
 
 std::string CameraSensor::logPrefix() const
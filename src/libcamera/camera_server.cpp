@@ -0,0 +1,608 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_server.cpp - Share a camera with other processes
+ */
+
+#include <libcamera/camera_server.h>
+
+#include <algorithm>
+#include <climits>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/stream.h>
+
+#include "camera_server_protocol.h"
+#include "ipc_unixsocket.h"
+#include "log.h"
+
+/**
+ * \file camera_server.h
+ * \brief Share the frames of a camera with other processes
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraServer)
+
+using namespace CameraServerProtocol;
+
+/*
+ * A connected client. The client holds a reference to each buffer it has been
+ * sent a frame for, until it releases the frame or disconnects.
+ */
+struct CameraServer::Client {
+	Client(unsigned int streams)
+		: held(streams), heldCount(streams, 0), dropped(streams, 0),
+		  maxHeld(0), welcomed(false), closed(false)
+	{
+	}
+
+	std::unique_ptr<IPCUnixSocket> socket;
+
+	/* Indexed by stream, then by buffer index for held. */
+	std::vector<std::vector<BufferRef>> held;
+	std::vector<unsigned int> heldCount;
+	std::vector<unsigned int> dropped;
+
+	unsigned int maxHeld;
+	bool welcomed;
+	bool closed;
+};
+
+/**
+ * \class CameraServer
+ * \brief Share the frames of a camera with multiple processes
+ *
+ * Only one process can acquire a camera. The CameraServer lets a camera owned
+ * by one process, typically a daemon, be consumed by multiple other processes
+ * without copying the frames. The server captures from the camera and sends
+ * every captured frame to all the connected CameraClient instances, over a
+ * Unix socket bound to a file system path.
+ *
+ * When a client connects it receives the configuration of the streams and the
+ * dmabuf file descriptors of all the stream buffers, once. Frames are then
+ * signalled by the index of the buffer they have been captured to. The server
+ * holds each buffer with a BufferRef per client it has sent the frame to, and
+ * the buffer is queued to the camera again only once all those clients have
+ * released it. Multiple consumers thus share one capture, and each buffer is
+ * reference-counted per client.
+ *
+ * Buffer lifetimes are negotiated per client. When connecting, a client
+ * requests the number of frames it may hold at a time per stream. The server
+ * grants it at most the number of buffers it has left, keeping
+ * MIN_QUEUED_BUFFERS buffers per stream for the camera, and rejects the client
+ * when no buffer is left. As the sum of the granted frames never exceeds the
+ * pool, clients can't starve the camera or each other. A client that holds as
+ * many frames as it has been granted, or whose socket is full, skips frames
+ * until it releases some, and is told how many frames it missed with the next
+ * frame it receives. A slow consumer thus never delays the other ones.
+ *
+ * The server and the camera are driven by the event loop of the thread the
+ * server lives in. The camera shall have been acquired by the caller.
+ */
+
+/**
+ * \var CameraServer::MIN_QUEUED_BUFFERS
+ * \brief The number of buffers per stream never granted to clients
+ */
+
+/**
+ * \brief Construct a server for the \a camera
+ * \param[in] camera The camera, acquired by the caller
+ */
+CameraServer::CameraServer(std::shared_ptr<Camera> camera)
+	: camera_(camera), running_(false), fd_(-1), notifier_(nullptr),
+	  budget_(0)
+{
+}
+
+CameraServer::~CameraServer()
+{
+	stop();
+}
+
+/**
+ * \brief Configure and start the camera, and accept clients on \a path
+ * \param[in] path The path of the Unix socket the clients connect to
+ * \param[in] config The camera configuration
+ *
+ * The camera is configured with \a config, its buffers are allocated, and it
+ * is started. The socket \a path shall not exist, and is removed by stop().
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The server is already running
+ * \retval -EINVAL The configuration leaves no buffer for the clients
+ */
+int CameraServer::start(const std::string &path, CameraConfiguration *config)
+{
+	if (running_)
+		return -EBUSY;
+
+	int ret = camera_->configure(config);
+	if (ret)
+		return ret;
+
+	budget_ = UINT_MAX;
+	for (const StreamConfiguration &cfg : *config)
+		budget_ = std::min(budget_, cfg.bufferCount);
+
+	if (budget_ <= MIN_QUEUED_BUFFERS) {
+		LOG(CameraServer, Error)
+			<< "At least " << MIN_QUEUED_BUFFERS + 1
+			<< " buffers per stream are needed";
+		return -EINVAL;
+	}
+	budget_ -= MIN_QUEUED_BUFFERS;
+
+	ret = camera_->allocateBuffers();
+	if (ret)
+		return ret;
+
+	streams_.clear();
+	freeBuffers_.clear();
+	freeBuffers_.resize(config->size());
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		const StreamConfiguration &cfg = config->at(i);
+		Stream *stream = cfg.stream();
+
+		streams_.push_back(stream);
+		for (unsigned int j = 0; j < cfg.bufferCount; ++j)
+			freeBuffers_[i].push_back(stream->buffer(j));
+
+		stream->bufferReleased.connect(this, &CameraServer::bufferReleased);
+	}
+
+	camera_->requestCompleted.connect(this, &CameraServer::requestComplete);
+
+	ret = listen(path);
+	if (ret)
+		goto error;
+
+	ret = camera_->start();
+	if (ret)
+		goto error;
+
+	running_ = true;
+	queueRequests();
+
+	return 0;
+
+error:
+	stop();
+	return ret;
+}
+
+/**
+ * \brief Disconnect all clients and stop the camera
+ *
+ * The clients are disconnected, the camera is stopped and its buffers are
+ * freed. The processes of the clients may still access the buffers they have
+ * mapped until they close their file descriptors.
+ */
+void CameraServer::stop()
+{
+	bool running = running_;
+	running_ = false;
+
+	if (notifier_) {
+		delete notifier_;
+		notifier_ = nullptr;
+		::close(fd_);
+		fd_ = -1;
+		unlink(path_.c_str());
+	}
+
+	clients_.clear();
+
+	if (streams_.empty())
+		return;
+
+	if (running)
+		camera_->stop();
+
+	camera_->requestCompleted.disconnect(this);
+	for (Stream *stream : streams_)
+		stream->bufferReleased.disconnect(this);
+
+	camera_->freeBuffers();
+	streams_.clear();
+	freeBuffers_.clear();
+	budget_ = 0;
+}
+
+/**
+ * \fn CameraServer::isRunning()
+ * \brief Check if the server is running
+ * \return True if the server has been started, false otherwise
+ */
+
+/**
+ * \brief Retrieve the number of connected clients
+ * \return The number of clients that have been granted frames
+ */
+unsigned int CameraServer::clients() const
+{
+	return std::count_if(clients_.begin(), clients_.end(),
+			     [](const std::unique_ptr<Client> &client) {
+				     return client->welcomed && !client->closed;
+			     });
+}
+
+/**
+ * \fn CameraServer::availableBuffers()
+ * \brief Retrieve the number of frames that can still be granted to clients
+ * \return The number of frames per stream not granted to any client
+ */
+
+int CameraServer::listen(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+
+	if (path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(CameraServer, Error)
+			<< "Failed to create socket: " << strerror(-ret);
+		return ret;
+	}
+
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ||
+	    ::listen(fd, 8)) {
+		int ret = -errno;
+		LOG(CameraServer, Error)
+			<< "Failed to listen on " << path << ": " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	fd_ = fd;
+	path_ = path;
+	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &CameraServer::newConnection);
+
+	LOG(CameraServer, Info) << "Listening on " << path;
+
+	return 0;
+}
+
+void CameraServer::newConnection(EventNotifier *notifier)
+{
+	while (true) {
+		int fd = accept4(fd_, nullptr, nullptr,
+				 SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG(CameraServer, Error)
+					<< "Failed to accept connection: "
+					<< strerror(errno);
+			return;
+		}
+
+		std::unique_ptr<Client> client(new Client(streams_.size()));
+		client->socket.reset(new IPCUnixSocket());
+		client->socket->bind(fd);
+		client->socket->readyRead.connect(this, &CameraServer::readyRead);
+		client->socket->disconnected.connect(this, &CameraServer::clientDisconnected);
+
+		for (unsigned int i = 0; i < streams_.size(); ++i)
+			client->held[i].resize(streams_[i]->buffers().size());
+
+		clients_.push_back(std::move(client));
+	}
+}
+
+CameraServer::Client *CameraServer::findClient(IPCUnixSocket *socket)
+{
+	for (std::unique_ptr<Client> &client : clients_) {
+		if (client->socket.get() == socket)
+			return client->closed ? nullptr : client.get();
+	}
+
+	return nullptr;
+}
+
+void CameraServer::readyRead(IPCUnixSocket *socket)
+{
+	IPCUnixSocket::Payload payload;
+	int ret = socket->receive(&payload);
+	if (ret)
+		return;
+
+	for (int fd : payload.fds)
+		::close(fd);
+
+	Client *client = findClient(socket);
+	if (!client)
+		return;
+
+	switch (type(payload)) {
+	case HelloMessage: {
+		Hello hello;
+		if (client->welcomed || !unpack(payload, &hello) ||
+		    hello.version != Version) {
+			LOG(CameraServer, Warning) << "Invalid hello message";
+			closeClient(client);
+			return;
+		}
+
+		welcome(client, hello.maxHeld);
+		break;
+	}
+
+	case ReleaseMessage: {
+		Release message;
+		if (!client->welcomed || !unpack(payload, &message)) {
+			LOG(CameraServer, Warning) << "Invalid release message";
+			closeClient(client);
+			return;
+		}
+
+		release(client, message.stream, message.index);
+		break;
+	}
+
+	default:
+		LOG(CameraServer, Warning)
+			<< "Unknown message type " << type(payload);
+		closeClient(client);
+		break;
+	}
+}
+
+void CameraServer::clientDisconnected(IPCUnixSocket *socket)
+{
+	Client *client = findClient(socket);
+	if (client)
+		closeClient(client);
+}
+
+/*
+ * Grant frames to the client, and send it the stream configurations and the
+ * buffers.
+ */
+void CameraServer::welcome(Client *client, unsigned int maxHeld)
+{
+	unsigned int granted = std::min(maxHeld, budget_);
+	std::vector<IPCUnixSocket::Payload> payloads;
+	IPCUnixSocket::Payload payload;
+
+	Welcome welcome = {};
+	welcome.type = WelcomeMessage;
+	welcome.version = Version;
+	welcome.maxHeld = granted;
+	welcome.streams = streams_.size();
+	pack(&payload, welcome);
+	payloads.push_back(payload);
+
+	if (!granted) {
+		LOG(CameraServer, Warning)
+			<< "No buffer left, rejecting client";
+		client->socket->send(payloads);
+		closeClient(client);
+		return;
+	}
+
+	for (unsigned int i = 0; i < streams_.size(); ++i) {
+		const StreamConfiguration &cfg = streams_[i]->configuration();
+		std::vector<BufferMemory> &buffers = streams_[i]->buffers();
+
+		StreamInfo info = {};
+		info.type = StreamInfoMessage;
+		info.stream = i;
+		info.pixelFormat = cfg.pixelFormat;
+		info.width = cfg.size.width;
+		info.height = cfg.size.height;
+		info.bufferCount = buffers.size();
+		pack(&payload, info);
+		payloads.push_back(payload);
+
+		for (unsigned int j = 0; j < buffers.size(); ++j) {
+			const PlaneArray &planes = buffers[j].planes();
+
+			BufferInfo message = {};
+			message.type = BufferInfoMessage;
+			message.stream = i;
+			message.index = j;
+			message.planes = std::min<size_t>(planes.size(), MaxPlanes);
+			for (unsigned int k = 0; k < message.planes; ++k)
+				message.length[k] = planes[k].length();
+
+			pack(&payload, message);
+			for (unsigned int k = 0; k < message.planes; ++k)
+				payload.fds.push_back(planes[k].dmabuf());
+			payloads.push_back(payload);
+		}
+	}
+
+	int ret = client->socket->send(payloads);
+	if (ret != static_cast<int>(payloads.size())) {
+		LOG(CameraServer, Error) << "Failed to send the buffers to client";
+		closeClient(client);
+		return;
+	}
+
+	client->maxHeld = granted;
+	client->welcomed = true;
+	budget_ -= granted;
+
+	LOG(CameraServer, Debug)
+		<< "Client granted " << granted << " frames, "
+		<< budget_ << " left";
+}
+
+void CameraServer::release(Client *client, unsigned int stream,
+			   unsigned int index)
+{
+	if (stream >= client->held.size() ||
+	    index >= client->held[stream].size() ||
+	    !client->held[stream][index].isValid()) {
+		LOG(CameraServer, Warning)
+			<< "Client released a buffer it doesn't hold";
+		return;
+	}
+
+	client->heldCount[stream]--;
+
+	/* The buffer is requeued when the last client releases it. */
+	client->held[stream][index].reset();
+}
+
+/*
+ * Release the buffers held by the \a client and stop communicating with it.
+ * The socket is destroyed later, as this may be called from its signals.
+ */
+void CameraServer::closeClient(Client *client)
+{
+	if (client->closed)
+		return;
+
+	client->closed = true;
+	if (client->welcomed)
+		budget_ += client->maxHeld;
+
+	for (std::vector<BufferRef> &refs : client->held) {
+		for (BufferRef &ref : refs)
+			ref.reset();
+	}
+
+	invokeMethod(&CameraServer::removeClosedClients);
+}
+
+void CameraServer::removeClosedClients()
+{
+	clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+				      [](const std::unique_ptr<Client> &client) {
+					      return client->closed;
+				      }),
+		       clients_.end());
+}
+
+int CameraServer::streamIndex(Stream *stream) const
+{
+	auto iter = std::find(streams_.begin(), streams_.end(), stream);
+	if (iter == streams_.end())
+		return -1;
+
+	return iter - streams_.begin();
+}
+
+/* Queue requests as long as a buffer is available for every stream. */
+void CameraServer::queueRequests()
+{
+	while (running_) {
+		for (const std::deque<Buffer *> &buffers : freeBuffers_) {
+			if (buffers.empty())
+				return;
+		}
+
+		Request *request = camera_->createRequest();
+		if (!request)
+			return;
+
+		for (std::deque<Buffer *> &buffers : freeBuffers_) {
+			request->addBuffer(buffers.front());
+			buffers.pop_front();
+		}
+
+		int ret = camera_->queueRequest(request);
+		if (ret < 0) {
+			LOG(CameraServer, Error)
+				<< "Failed to queue request: " << strerror(-ret);
+
+			for (const auto &item : request->buffers())
+				freeBuffers_[streamIndex(item.first)].push_back(item.second);
+
+			delete request;
+			return;
+		}
+	}
+}
+
+void CameraServer::requestComplete(Request *request,
+				   const Request::BufferMap &buffers)
+{
+	bool failed = request->status() != Request::RequestComplete;
+	for (const auto &item : buffers) {
+		if (item.second->status() != Buffer::BufferSuccess)
+			failed = true;
+	}
+
+	if (failed) {
+		for (const auto &item : buffers)
+			freeBuffers_[streamIndex(item.first)].push_back(item.second);
+
+		queueRequests();
+		return;
+	}
+
+	for (const auto &item : buffers) {
+		unsigned int stream = streamIndex(item.first);
+		Buffer *buffer = item.second;
+
+		/*
+		 * Hold the buffer while it is distributed. If no client takes
+		 * it, releasing the reference requeues it right away.
+		 */
+		BufferRef ref(buffer);
+
+		for (std::unique_ptr<Client> &client : clients_) {
+			if (!client->welcomed || client->closed)
+				continue;
+
+			if (client->heldCount[stream] >= client->maxHeld) {
+				client->dropped[stream]++;
+				continue;
+			}
+
+			Frame frame = {};
+			frame.type = FrameMessage;
+			frame.stream = stream;
+			frame.index = buffer->index();
+			frame.sequence = buffer->sequence();
+			frame.bytesused = buffer->bytesused();
+			frame.dropped = client->dropped[stream];
+			frame.timestamp = buffer->timestamp();
+
+			IPCUnixSocket::Payload payload;
+			pack(&payload, frame);
+
+			/* A full socket doesn't block the other clients. */
+			if (client->socket->send(payload)) {
+				client->dropped[stream]++;
+				continue;
+			}
+
+			client->held[stream][buffer->index()] = ref;
+			client->heldCount[stream]++;
+			client->dropped[stream] = 0;
+		}
+	}
+}
+
+/* Called when the last client holding the buffer releases it. */
+void CameraServer::bufferReleased(Buffer *buffer)
+{
+	int index = streamIndex(buffer->stream());
+	if (index < 0)
+		return;
+
+	freeBuffers_[index].push_back(buffer);
+	queueRequests();
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * clock_correlator.cpp - Conversion of timestamps between clock domains
+ */
+
+#include "clock_correlator.h"
+
+#include <time.h>
+
+/**
+ * \file clock_correlator.h
+ * \brief Conversion of timestamps between clock domains
+ */
+
+namespace libcamera {
+
+namespace {
+
+int64_t readClock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+/**
+ * \class ClockCorrelator
+ * \brief Convert timestamps between the system clock domains
+ *
+ * Buffers are timestamped by the drivers on different clocks, and applications
+ * synchronizing frames with audio or other devices need them on the clock used
+ * by those devices. The ClockCorrelator converts timestamps between the
+ * CLOCK_MONOTONIC, CLOCK_BOOTTIME and CLOCK_REALTIME clocks.
+ *
+ * The offsets between the clocks are sampled when the first timestamp is
+ * converted, and sampled again once the timestamps move past the correlation
+ * period. The offsets only change when the system is suspended or the
+ * realtime clock is adjusted, a period of about a second bounds the error
+ * without reading the clocks for every frame.
+ *
+ * The class isn't thread-safe, each instance shall be used in a single thread.
+ */
+
+/**
+ * \var ClockCorrelator::DefaultPeriod
+ * \brief The default correlation period, in nanoseconds
+ */
+
+/**
+ * \brief Construct a clock correlator
+ * \param[in] period The correlation period, in nanoseconds
+ */
+ClockCorrelator::ClockCorrelator(uint64_t period)
+	: period_(period), valid_(false), lastSample_(0), offsets_{}
+{
+}
+
+/**
+ * \brief Convert a timestamp between clock domains
+ * \param[in] timestamp The timestamp, in nanoseconds
+ * \param[in] from The clock domain of \a timestamp
+ * \param[in] to The clock domain to convert \a timestamp to
+ * \param[out] result The converted timestamp
+ * \return True if the timestamp has been converted, false if any of the
+ * clocks is unknown
+ */
+bool ClockCorrelator::convert(uint64_t timestamp, Buffer::Clock from,
+			      Buffer::Clock to, uint64_t *result)
+{
+	if (from == to) {
+		*result = timestamp;
+		return true;
+	}
+
+	if (from == Buffer::ClockUnknown || to == Buffer::ClockUnknown)
+		return false;
+
+	if (!valid_)
+		sample();
+
+	int64_t monotonic = static_cast<int64_t>(timestamp) - offsets_[from];
+	if (monotonic > static_cast<int64_t>(lastSample_ + period_)) {
+		sample();
+		monotonic = static_cast<int64_t>(timestamp) - offsets_[from];
+	}
+
+	*result = monotonic + offsets_[to];
+	return true;
+}
+
+/**
+ * \fn ClockCorrelator::reset()
+ * \brief Discard the clock offsets, to sample them again on next use
+ */
+
+void ClockCorrelator::sample()
+{
+	/*
+	 * Read the other clocks between two readings of the monotonic clock,
+	 * and correlate them with the midpoint.
+	 */
+	int64_t before = readClock(CLOCK_MONOTONIC);
+	int64_t boottime = readClock(CLOCK_BOOTTIME);
+	int64_t realtime = readClock(CLOCK_REALTIME);
+	int64_t after = readClock(CLOCK_MONOTONIC);
+	int64_t monotonic = before + (after - before) / 2;
+
+	offsets_[Buffer::ClockMonotonic] = 0;
+	offsets_[Buffer::ClockBoottime] = boottime - monotonic;
+	offsets_[Buffer::ClockRealtime] = realtime - monotonic;
+
+	lastSample_ = monotonic;
+	valid_ = true;
+}
+
+} /* namespace libcamera */
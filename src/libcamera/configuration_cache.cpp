@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration_cache.cpp - Cache of camera configuration validation results
+ */
+
+#include "configuration_cache.h"
+
+#include <sstream>
+
+#include <libcamera/stream.h>
+
+/**
+ * \file configuration_cache.h
+ * \brief Cache of camera configuration validation results
+ */
+
+namespace libcamera {
+
+/**
+ * \class ConfigurationCache
+ * \brief Per-camera cache of CameraConfiguration::validate() results
+ *
+ * Validating a camera configuration searches the sensor formats and the
+ * device size tables, and adjusts each stream to the hardware constraints.
+ * Applications and adaptation layers that negotiate a configuration validate
+ * it many times with the same parameters, repeating the same searches.
+ *
+ * The ConfigurationCache stores the validated configurations of a camera,
+ * indexed by a key computed from the configuration before validation. A
+ * pipeline handler's validate() implementation calls validate() with its
+ * uncached validation method. On a hit the cached result is copied, including
+ * the pipeline-specific state of the configuration. On a miss the
+ * configuration is validated and a copy of the result is stored.
+ *
+ * The cache is bounded and evicts the least recently used entries. Pipeline
+ * handlers whose validation depends on the state of the camera, such as the
+ * currently configured streams, shall clear() the cache when that state
+ * changes.
+ *
+ * All methods of this class are thread-safe.
+ */
+
+/**
+ * \var ConfigurationCache::DefaultCapacity
+ * \brief The default maximum number of cached configurations
+ */
+
+/**
+ * \fn ConfigurationCache::ConfigurationCache()
+ * \brief Construct an empty configuration cache
+ * \param[in] capacity The maximum number of cached configurations
+ */
+
+/**
+ * \brief Compute the cache key of a camera configuration
+ * \param[in] config The camera configuration
+ *
+ * The key normalizes all the parameters of the configuration that can be set
+ * by applications. Two configurations with the same key thus validate to the
+ * same result.
+ *
+ * \return The cache key of \a config
+ */
+std::string ConfigurationCache::key(const CameraConfiguration &config)
+{
+	std::ostringstream key;
+
+	key << config.zslFrames() << ":" << config.outOfOrderCompletion()
+	    << ":" << config.queueProfile() << ":" << config.timestampClock();
+
+	for (const StreamConfiguration &cfg : config) {
+		key << "/" << cfg.pixelFormat << ":" << cfg.modifier
+		    << ":" << cfg.size.toString()
+		    << ":" << cfg.roi.toString() << ":" << cfg.memoryType
+		    << ":" << cfg.bufferCount << ":" << cfg.frameDecimation
+		    << ":" << cfg.priority;
+	}
+
+	return key.str();
+}
+
+/**
+ * \fn ConfigurationCache::lookup()
+ * \brief Retrieve a validated configuration from the cache
+ * \param[in] key The cache key of the configuration
+ * \param[out] config The configuration to update with the cached result
+ * \param[out] status The cached validation status
+ *
+ * The \a Config type shall be the type of the configuration stored with the
+ * same \a key. The whole configuration is copied, the caller shall restore
+ * the members that store() didn't preserve, such as the camera reference.
+ *
+ * \return True if the \a key has been found in the cache, false otherwise
+ */
+
+/**
+ * \brief Store a validated configuration in the cache
+ * \param[in] key The cache key of the configuration before validation
+ * \param[in] config A copy of the validated configuration
+ * \param[in] status The validation status
+ *
+ * The cache owns the stored \a config. As the cache is stored in the camera
+ * data, the copy shall not hold a reference to the camera.
+ */
+void ConfigurationCache::store(const std::string &key,
+			       std::unique_ptr<CameraConfiguration> config,
+			       CameraConfiguration::Status status)
+{
+	MutexLocker locker(mutex_);
+
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (it->key == key) {
+			entries_.erase(it);
+			break;
+		}
+	}
+
+	entries_.push_front({ key, std::move(config), status });
+
+	while (entries_.size() > capacity_)
+		entries_.pop_back();
+}
+
+/**
+ * \fn ConfigurationCache::validate()
+ * \brief Validate a configuration, using the cached result if available
+ * \param[in] config The configuration to validate
+ * \param[in] validator The \a Config method that validates the configuration
+ * \param[in] camera The \a Config member that references the camera
+ *
+ * Look \a config up in the cache, and copy the cached result to \a config on
+ * a hit. Otherwise validate \a config with \a validator and store a copy of
+ * the result. The cached copies don't reference the camera, to avoid a
+ * reference cycle through the camera data, and the \a camera reference of
+ * \a config is preserved on a hit.
+ *
+ * \return The validation status of \a config
+ */
+
+/**
+ * \brief Remove all configurations from the cache
+ */
+void ConfigurationCache::clear()
+{
+	MutexLocker locker(mutex_);
+
+	entries_.clear();
+}
+
+const ConfigurationCache::Entry *ConfigurationCache::find(const std::string &key)
+{
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (it->key != key)
+			continue;
+
+		/* Move the entry to the front to keep the list in LRU order. */
+		entries_.splice(entries_.begin(), entries_, it);
+		return &entries_.front();
+	}
+
+	return nullptr;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,641 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * control_serializer.cpp - Control (de)serializer
+ */
+
+#include "control_serializer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <ipa/ipa_controls.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file control_serializer.h
+ * \brief Serialization and deserialization helpers for controls
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Serialization)
+
+namespace {
+
+static constexpr size_t VALUE_ALIGNMENT = 8;
+
+size_t alignedSize(size_t size)
+{
+	return (size + VALUE_ALIGNMENT - 1) & ~(VALUE_ALIGNMENT - 1);
+}
+
+size_t scalarSize(ControlType type)
+{
+	switch (type) {
+	case ControlTypeBool:
+		return sizeof(uint8_t);
+	case ControlTypeInteger32:
+		return sizeof(int32_t);
+	case ControlTypeInteger64:
+		return sizeof(int64_t);
+	case ControlTypeFloat:
+		return sizeof(float);
+	case ControlTypeRectangle:
+		return sizeof(Rectangle);
+	default:
+		return 0;
+	}
+}
+
+enum ipa_controls_id_map_type idMapType(const ControlInfoMap &info)
+{
+	for (const auto &ctrl : info) {
+		auto iter = controls::controls.find(ctrl.first->id());
+		if (iter == controls::controls.end() ||
+		    iter->second != ctrl.first)
+			return IPA_CONTROL_ID_MAP_V4L2;
+	}
+
+	return IPA_CONTROL_ID_MAP_CONTROLS;
+}
+
+} /* namespace */
+
+/**
+ * \class ControlSerializer
+ * \brief Serializer and deserializer for control-related classes
+ *
+ * The control serializer is a helper to serialize and deserialize
+ * ControlInfoMap and ControlValue instances for the purpose of communication
+ * with IPA modules.
+ *
+ * Neither the ControlInfoMap nor the ControlList are self-contained data
+ * container. ControlInfoMap references an external ControlId in each of its
+ * entries, and ControlList references a ControlInfoMap for the purpose of
+ * validation. Serializing and deserializing those objects thus requires a
+ * context that maintains the associations between them. The control serializer
+ * fulfils this task.
+ *
+ * ControlInfoMap instances can be serialized on their own, but require
+ * ControlId instances to be provided at deserialization time. The serializer
+ * recreates those ControlId instances when deserializing a ControlInfoMap,
+ * unless the map only refers to the global controls::controls.
+ *
+ * ControlList instances need to be associated with a ControlInfoMap when
+ * deserialized. To make this possible, the control lists are serialized with a
+ * handle to their ControlInfoMap, and the map is looked up from the handle at
+ * deserialization time. To make this possible, the serializer assigns a
+ * numerical handle to ControlInfoMap instances when they are serialized, and
+ * stores the mapping between handle and ControlInfoMap when they are
+ * deserialized. The ControlInfoMap shall thus be serialized before any
+ * ControlList that refers to it, and a serializer instance shall be used to
+ * either serialize or deserialize ControlInfoMap, but not both. Lists built
+ * on the global controls::controls don't require any ControlInfoMap.
+ *
+ * Serialization is split in two steps. The binarySize() methods compute the
+ * size of the serialized data, allowing the caller to allocate a buffer large
+ * enough for a whole message at once. The serialize() methods then store the
+ * data in a ByteStreamBuffer wrapping that memory, without any further memory
+ * allocation. The binary format is described by the structures defined in
+ * ipa_controls.h.
+ */
+
+/**
+ * \brief Construct a new ControlSerializer
+ */
+ControlSerializer::ControlSerializer()
+	: serial_(0)
+{
+}
+
+/**
+ * \brief Reset the serializer
+ *
+ * Reset the internal state of the serializer. This method shall be called
+ * when no ControlInfoMap or ControlList deserialized by the serializer is in
+ * use anymore, as it destroys the ControlId instances they reference.
+ */
+void ControlSerializer::reset()
+{
+	serial_ = 0;
+
+	infoMaps_.clear();
+	controlIds_.clear();
+}
+
+size_t ControlSerializer::binarySize(const ControlValue &value)
+{
+	if (value.isArray())
+		return alignedSize(value.dataSize());
+
+	return alignedSize(scalarSize(value.type()));
+}
+
+size_t ControlSerializer::binarySize(const ControlRange &range)
+{
+	return binarySize(range.min()) + binarySize(range.max());
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize a ControlInfoMap
+ * \param[in] info The control info map
+ *
+ * Compute and return the size in bytes required to store the serialized
+ * ControlInfoMap.
+ *
+ * \return The size in bytes required to store the serialized ControlInfoMap
+ */
+size_t ControlSerializer::binarySize(const ControlInfoMap &info)
+{
+	size_t size = sizeof(struct ipa_controls_header)
+		    + info.size() * sizeof(struct ipa_control_range_entry);
+
+	for (const auto &ctrl : info)
+		size += binarySize(ctrl.second);
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize a ControlList
+ * \param[in] list The control list
+ *
+ * Compute and return the size in bytes required to store the serialized
+ * ControlList.
+ *
+ * \return The size in bytes required to store the serialized ControlList
+ */
+size_t ControlSerializer::binarySize(const ControlList &list)
+{
+	size_t size = sizeof(struct ipa_controls_header)
+		    + list.size() * sizeof(struct ipa_control_value_entry);
+
+	for (const auto &ctrl : list)
+		size += binarySize(ctrl.second);
+
+	return size;
+}
+
+void ControlSerializer::store(const ControlValue &value,
+			      ByteStreamBuffer &buffer)
+{
+	if (value.isArray()) {
+		buffer.write(value.data(), value.dataSize());
+		buffer.align(VALUE_ALIGNMENT);
+		return;
+	}
+
+	switch (value.type()) {
+	case ControlTypeBool: {
+		uint8_t data = value.get<bool>();
+		buffer.write(&data);
+		break;
+	}
+
+	case ControlTypeInteger32:
+		buffer.write(&value.get<int32_t>());
+		break;
+
+	case ControlTypeInteger64:
+		buffer.write(&value.get<int64_t>());
+		break;
+
+	case ControlTypeFloat:
+		buffer.write(&value.get<float>());
+		break;
+
+	case ControlTypeRectangle:
+		buffer.write(&value.get<Rectangle>());
+		break;
+
+	default:
+		break;
+	}
+
+	buffer.align(VALUE_ALIGNMENT);
+}
+
+void ControlSerializer::store(const ControlRange &range,
+			      ByteStreamBuffer &buffer)
+{
+	store(range.min(), buffer);
+	store(range.max(), buffer);
+}
+
+/**
+ * \brief Serialize a ControlInfoMap in a buffer
+ * \param[in] info The control info map to serialize
+ * \param[in] buffer The memory buffer where to serialize the ControlInfoMap
+ *
+ * Serialize the \a info map into the \a buffer using the serialization format
+ * defined by the IPA context interface in ipa_controls.h. A handle is assigned
+ * to the map and stored in the packet, maps sharing the same ControlIdMap
+ * reuse the same handle.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -EINVAL The map contains array ranges, which can't be serialized
+ * \retval -ENOSPC Not enough space is available in the buffer
+ */
+int ControlSerializer::serialize(const ControlInfoMap &info,
+				 ByteStreamBuffer &buffer)
+{
+	for (const auto &ctrl : info) {
+		const ControlRange &range = ctrl.second;
+		if (range.min().isArray() || range.max().isArray()) {
+			LOG(Serialization, Error)
+				<< "Control " << utils::hex(ctrl.first->id())
+				<< " has an array range";
+			return -EINVAL;
+		}
+	}
+
+	auto iter = std::find_if(infoMaps_.begin(), infoMaps_.end(),
+				 [&](const std::pair<const unsigned int, ControlInfoMap> &map) {
+					 return map.second.idmap() == info.idmap();
+				 });
+
+	unsigned int handle;
+	if (iter != infoMaps_.end()) {
+		handle = iter->first;
+	} else {
+		handle = ++serial_;
+		infoMaps_[handle] = info;
+	}
+
+	size_t dataOffset = sizeof(struct ipa_controls_header)
+			  + info.size() * sizeof(struct ipa_control_range_entry);
+
+	struct ipa_controls_header hdr = {};
+	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
+	hdr.handle = handle;
+	hdr.entries = info.size();
+	hdr.size = binarySize(info);
+	hdr.data_offset = dataOffset;
+	hdr.id_map_type = idMapType(info);
+
+	buffer.write(&hdr);
+
+	ByteStreamBuffer entries = buffer.carveOut(dataOffset - sizeof(hdr));
+	ByteStreamBuffer values = buffer.carveOut(hdr.size - dataOffset);
+
+	for (const auto &ctrl : info) {
+		const ControlId *id = ctrl.first;
+		const ControlRange &range = ctrl.second;
+
+		struct ipa_control_range_entry entry = {};
+		entry.id = id->id();
+		entry.type = id->type();
+		entry.offset = values.offset();
+		entry.min_type = range.min().type();
+		entry.max_type = range.max().type();
+		entries.write(&entry);
+
+		store(range, values);
+	}
+
+	if (buffer.overflow())
+		return -ENOSPC;
+
+	return 0;
+}
+
+/**
+ * \brief Serialize a ControlList in a buffer
+ * \param[in] list The control list to serialize
+ * \param[in] buffer The memory buffer where to serialize the ControlList
+ *
+ * Serialize the \a list into the \a buffer using the serialization format
+ * defined by the IPA context interface in ipa_controls.h. Lists that don't use
+ * the global controls::controls ID map shall refer to a ControlInfoMap
+ * previously serialized by this serializer.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOENT The ControlList is related to an unknown ControlInfoMap
+ * \retval -ENOSPC Not enough space is available in the buffer
+ */
+int ControlSerializer::serialize(const ControlList &list,
+				 ByteStreamBuffer &buffer)
+{
+	unsigned int handle = 0;
+	enum ipa_controls_id_map_type idMap = IPA_CONTROL_ID_MAP_CONTROLS;
+
+	if (list.idmap() != controls::controls) {
+		auto iter = std::find_if(infoMaps_.begin(), infoMaps_.end(),
+					 [&](const std::pair<const unsigned int, ControlInfoMap> &map) {
+						 return map.second.idmap() == list.idmap();
+					 });
+		if (iter == infoMaps_.end()) {
+			LOG(Serialization, Error)
+				<< "Can't serialize ControlList with unknown ControlInfoMap";
+			return -ENOENT;
+		}
+
+		handle = iter->first;
+		idMap = idMapType(iter->second);
+	}
+
+	size_t dataOffset = sizeof(struct ipa_controls_header)
+			  + list.size() * sizeof(struct ipa_control_value_entry);
+
+	struct ipa_controls_header hdr = {};
+	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
+	hdr.handle = handle;
+	hdr.entries = list.size();
+	hdr.size = binarySize(list);
+	hdr.data_offset = dataOffset;
+	hdr.id_map_type = idMap;
+
+	buffer.write(&hdr);
+
+	ByteStreamBuffer entries = buffer.carveOut(dataOffset - sizeof(hdr));
+	ByteStreamBuffer values = buffer.carveOut(hdr.size - dataOffset);
+
+	for (const auto &ctrl : list) {
+		const ControlValue &value = ctrl.second;
+
+		struct ipa_control_value_entry entry = {};
+		entry.id = ctrl.first->id();
+		entry.type = value.type();
+		entry.is_array = value.isArray();
+		entry.count = value.isArray() ? value.numElements() : 1;
+		entry.offset = values.offset();
+		entries.write(&entry);
+
+		store(value, values);
+	}
+
+	if (buffer.overflow())
+		return -ENOSPC;
+
+	return 0;
+}
+
+ControlValue ControlSerializer::loadValue(ByteStreamBuffer &buffer,
+					  ControlType type, bool isArray,
+					  unsigned int count)
+{
+	ControlValue value;
+
+	if (isArray) {
+		value = ControlValue(type, count);
+		buffer.read(value.data(), value.dataSize());
+		buffer.align(VALUE_ALIGNMENT);
+		return value;
+	}
+
+	switch (type) {
+	case ControlTypeBool: {
+		uint8_t data = 0;
+		buffer.read(&data);
+		value = ControlValue(static_cast<bool>(data));
+		break;
+	}
+
+	case ControlTypeInteger32: {
+		int32_t data = 0;
+		buffer.read(&data);
+		value = ControlValue(data);
+		break;
+	}
+
+	case ControlTypeInteger64: {
+		int64_t data = 0;
+		buffer.read(&data);
+		value = ControlValue(data);
+		break;
+	}
+
+	case ControlTypeFloat: {
+		float data = 0.0f;
+		buffer.read(&data);
+		value = ControlValue(data);
+		break;
+	}
+
+	case ControlTypeRectangle: {
+		Rectangle data = {};
+		buffer.read(&data);
+		value = ControlValue(data);
+		break;
+	}
+
+	case ControlTypeNone:
+		break;
+
+	default:
+		LOG(Serialization, Error)
+			<< "Invalid scalar control type " << type;
+		break;
+	}
+
+	buffer.align(VALUE_ALIGNMENT);
+	return value;
+}
+
+ControlRange ControlSerializer::loadRange(ByteStreamBuffer &buffer,
+					  ControlType minType,
+					  ControlType maxType)
+{
+	ControlValue min = loadValue(buffer, minType);
+	ControlValue max = loadValue(buffer, maxType);
+
+	return ControlRange(min, max);
+}
+
+int ControlSerializer::readHeader(ByteStreamBuffer &buffer,
+				  struct ipa_controls_header *hdr)
+{
+	if (buffer.read(hdr)) {
+		LOG(Serialization, Error) << "Out of data";
+		return -ENOSPC;
+	}
+
+	if (hdr->version != IPA_CONTROLS_FORMAT_VERSION) {
+		LOG(Serialization, Error)
+			<< "Unsupported controls format version "
+			<< hdr->version;
+		return -EINVAL;
+	}
+
+	if (hdr->data_offset < sizeof(*hdr) || hdr->size < hdr->data_offset) {
+		LOG(Serialization, Error) << "Invalid controls header";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \fn template<typename T> T ControlSerializer::deserialize(ByteStreamBuffer &buffer)
+ * \brief Deserialize an object from a binary buffer
+ * \param[in] buffer The memory buffer that contains the object
+ *
+ * This method is only valid when specialized for ControlInfoMap or
+ * ControlList. Any other typename \a T is not supported.
+ */
+
+/**
+ * \brief Deserialize a ControlInfoMap from a binary buffer
+ * \param[in] buffer The memory buffer that contains the serialized map
+ *
+ * Re-construct a ControlInfoMap from a binary \a buffer containing data
+ * serialized using the serialize() method. The map is stored in the serializer
+ * under its handle, for use by the control lists that refer to it. Maps
+ * previously deserialized with the same handle are not parsed again.
+ *
+ * \return The deserialized ControlInfoMap, or an empty map on error
+ */
+template<>
+ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &buffer)
+{
+	struct ipa_controls_header hdr;
+	if (readHeader(buffer, &hdr))
+		return {};
+
+	auto iter = infoMaps_.find(hdr.handle);
+	if (iter != infoMaps_.end()) {
+		buffer.skip(hdr.size - sizeof(hdr));
+		return iter->second;
+	}
+
+	ByteStreamBuffer entries = buffer.carveOut(hdr.data_offset - sizeof(hdr));
+	ByteStreamBuffer values = buffer.carveOut(hdr.size - hdr.data_offset);
+
+	if (buffer.overflow()) {
+		LOG(Serialization, Error) << "Out of data";
+		return {};
+	}
+
+	ControlInfoMap::Map ctrls;
+
+	for (unsigned int i = 0; i < hdr.entries; ++i) {
+		struct ipa_control_range_entry entry;
+		if (entries.read(&entry)) {
+			LOG(Serialization, Error) << "Out of data";
+			return {};
+		}
+
+		if (entry.offset != values.offset()) {
+			LOG(Serialization, Error)
+				<< "Bad data, entry offset mismatch (entry "
+				<< i << ")";
+			return {};
+		}
+
+		const ControlId *id;
+		if (hdr.id_map_type == IPA_CONTROL_ID_MAP_CONTROLS) {
+			auto idIter = controls::controls.find(entry.id);
+			if (idIter == controls::controls.end()) {
+				LOG(Serialization, Error)
+					<< "Unknown control " << utils::hex(entry.id);
+				return {};
+			}
+
+			id = idIter->second;
+		} else {
+			/* Create and cache the individual ControlId. */
+			ControlType type = static_cast<ControlType>(entry.type);
+			controlIds_.emplace_back(utils::make_unique<ControlId>(entry.id, "", type));
+			id = controlIds_.back().get();
+		}
+
+		ControlRange range = loadRange(values,
+					       static_cast<ControlType>(entry.min_type),
+					       static_cast<ControlType>(entry.max_type));
+		ctrls.emplace(id, range);
+	}
+
+	if (values.overflow()) {
+		LOG(Serialization, Error) << "Out of data";
+		return {};
+	}
+
+	/*
+	 * Store the map in the serializer. All copies share the same
+	 * ControlIdMap, which allows looking up the handle when serializing
+	 * lists.
+	 */
+	ControlInfoMap &info = infoMaps_[hdr.handle];
+	info = std::move(ctrls);
+
+	return info;
+}
+
+/**
+ * \brief Deserialize a ControlList from a binary buffer
+ * \param[in] buffer The memory buffer that contains the serialized list
+ *
+ * Re-construct a ControlList from a binary \a buffer containing data
+ * serialized using the serialize() method. The list refers to the
+ * ControlInfoMap with the handle stored in the packet, which shall have been
+ * previously serialized or deserialized by this serializer, or to the global
+ * controls::controls for packets with a zero handle.
+ *
+ * \return The deserialized ControlList, or an empty list on error
+ */
+template<>
+ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer)
+{
+	struct ipa_controls_header hdr;
+	if (readHeader(buffer, &hdr))
+		return ControlList(controls::controls);
+
+	const ControlIdMap *idmap = &controls::controls;
+	if (hdr.handle) {
+		auto iter = infoMaps_.find(hdr.handle);
+		if (iter == infoMaps_.end()) {
+			LOG(Serialization, Error)
+				<< "Can't deserialize ControlList: unknown ControlInfoMap";
+			buffer.skip(hdr.size - sizeof(hdr));
+			return ControlList(controls::controls);
+		}
+
+		idmap = &iter->second.idmap();
+	}
+
+	ByteStreamBuffer entries = buffer.carveOut(hdr.data_offset - sizeof(hdr));
+	ByteStreamBuffer values = buffer.carveOut(hdr.size - hdr.data_offset);
+
+	if (buffer.overflow()) {
+		LOG(Serialization, Error) << "Out of data";
+		return ControlList(controls::controls);
+	}
+
+	ControlList ctrls(*idmap);
+
+	for (unsigned int i = 0; i < hdr.entries; ++i) {
+		struct ipa_control_value_entry entry;
+		if (entries.read(&entry)) {
+			LOG(Serialization, Error) << "Out of data";
+			return ControlList(controls::controls);
+		}
+
+		if (entry.offset != values.offset()) {
+			LOG(Serialization, Error)
+				<< "Bad data, entry offset mismatch (entry "
+				<< i << ")";
+			return ControlList(controls::controls);
+		}
+
+		ControlType type = static_cast<ControlType>(entry.type);
+		ctrls.set(entry.id, loadValue(values, type, entry.is_array,
+					      entry.count));
+	}
+
+	if (values.overflow()) {
+		LOG(Serialization, Error) << "Out of data";
+		return ControlList(controls::controls);
+	}
+
+	return ctrls;
+}
+
+} /* namespace libcamera */
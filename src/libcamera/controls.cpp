@@ -7,9 +7,11 @@
 
 #include <libcamera/controls.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <string.h>
 
 #include "control_validator.h"
 #include "log.h"
@@ -58,19 +60,83 @@ LOG_DEFINE_CATEGORY(Controls)
  * The control stores a 32-bit integer value
  * \var ControlTypeInteger64
  * The control stores a 64-bit integer value
+ * \var ControlTypeByte
+ * The control stores an array of 8-bit unsigned integers, or the raw payload
+ * of a compound control
+ * \var ControlTypeUnsigned16
+ * The control stores an array of 16-bit unsigned integers
+ * \var ControlTypeUnsigned32
+ * The control stores an array of 32-bit unsigned integers
+ * \var ControlTypeFloat
+ * The control stores a 32-bit floating point value
+ * \var ControlTypeRectangle
+ * The control stores a Rectangle value
  */
 
+namespace {
+
+size_t controlTypeSize(ControlType type)
+{
+	switch (type) {
+	case ControlTypeNone:
+		return 0;
+	case ControlTypeBool:
+	case ControlTypeByte:
+		return 1;
+	case ControlTypeUnsigned16:
+		return 2;
+	case ControlTypeInteger32:
+	case ControlTypeUnsigned32:
+	case ControlTypeFloat:
+		return 4;
+	case ControlTypeInteger64:
+		return 8;
+	case ControlTypeRectangle:
+		return sizeof(Rectangle);
+	}
+
+	return 0;
+}
+
+static_assert(sizeof(Rectangle) <= ControlValue::INLINE_STORAGE_SIZE,
+	      "Rectangle doesn't fit in ControlValue inline storage");
+
+} /* namespace */
+
 /**
  * \class ControlValue
  * \brief Abstract type representing the value of a control
+ *
+ * A ControlValue stores either a single value of type bool, int32_t, int64_t,
+ * float or Rectangle, or an array of values. Arrays are used for controls such
+ * as colour gains or colour correction matrices, for V4L2 array controls, and
+ * for the payload of compound controls, such as lens shading tables or gamma
+ * curves, which are stored as arrays of bytes.
+ *
+ * The array elements are stored contiguously in memory, accessible through
+ * data(). This allows passing the payload to the kernel directly, without an
+ * intermediate copy.
+ *
+ * Arrays that fit in INLINE_STORAGE_SIZE bytes are stored inside the
+ * ControlValue and never allocate memory. Larger arrays are stored on the heap
+ * and shared between copies of the ControlValue, such that copying a
+ * ControlList, for instance to pass it to an IPA, doesn't duplicate large
+ * payloads. A shared payload is copied the first time it is accessed through
+ * one of the non-const data() or array() methods.
+ */
+
+/**
+ * \var ControlValue::INLINE_STORAGE_SIZE
+ * \brief The size of the largest array stored inside the ControlValue
  */
 
 /**
  * \brief Construct an empty ControlValue.
  */
 ControlValue::ControlValue()
-	: type_(ControlTypeNone)
+	: type_(ControlTypeNone), isArray_(false), numElements_(0), size_(0)
 {
+	integer64_ = 0;
 }
 
 /**
@@ -78,8 +144,10 @@ ControlValue::ControlValue()
  * \param[in] value Boolean value to store
  */
 ControlValue::ControlValue(bool value)
-	: type_(ControlTypeBool), bool_(value)
+	: ControlValue()
 {
+	type_ = ControlTypeBool;
+	bool_ = value;
 }
 
 /**
@@ -87,8 +155,10 @@ ControlValue::ControlValue(bool value)
  * \param[in] value Integer value to store
  */
 ControlValue::ControlValue(int32_t value)
-	: type_(ControlTypeInteger32), integer32_(value)
+	: ControlValue()
 {
+	type_ = ControlTypeInteger32;
+	integer32_ = value;
 }
 
 /**
@@ -96,8 +166,139 @@ ControlValue::ControlValue(int32_t value)
  * \param[in] value Integer value to store
  */
 ControlValue::ControlValue(int64_t value)
-	: type_(ControlTypeInteger64), integer64_(value)
+	: ControlValue()
+{
+	type_ = ControlTypeInteger64;
+	integer64_ = value;
+}
+
+/**
+ * \brief Construct a floating point ControlValue
+ * \param[in] value Floating point value to store
+ */
+ControlValue::ControlValue(float value)
+	: ControlValue()
+{
+	type_ = ControlTypeFloat;
+	float_ = value;
+}
+
+/**
+ * \brief Construct a Rectangle ControlValue
+ * \param[in] value Rectangle value to store
+ */
+ControlValue::ControlValue(const Rectangle &value)
+	: ControlValue()
+{
+	type_ = ControlTypeRectangle;
+	memcpy(storage_, &value, sizeof(value));
+}
+
+/**
+ * \brief Construct a byte array ControlValue
+ * \param[in] values The array of bytes to store
+ */
+ControlValue::ControlValue(const std::vector<uint8_t> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeByte, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a byte array ControlValue by moving \a values
+ * \param[in] values The array of bytes to store
+ *
+ * The storage of \a values is transferred to the ControlValue without copying
+ * the data if the array doesn't fit in the inline storage, which is useful for
+ * large compound control payloads.
+ */
+ControlValue::ControlValue(std::vector<uint8_t> &&values)
+	: ControlValue()
+{
+	if (values.size() <= INLINE_STORAGE_SIZE) {
+		setArray(ControlTypeByte, values.size(), values.data());
+		return;
+	}
+
+	type_ = ControlTypeByte;
+	isArray_ = true;
+	numElements_ = values.size();
+	size_ = values.size();
+	heap_ = std::make_shared<std::vector<uint8_t>>(std::move(values));
+}
+
+/**
+ * \brief Construct a 16-bit unsigned integer array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<uint16_t> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeUnsigned16, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a 32-bit unsigned integer array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<uint32_t> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeUnsigned32, values.size(), values.data());
+}
+
+/**
+ * \brief Construct an integer array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<int32_t> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeInteger32, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a 64 bit integer array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<int64_t> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeInteger64, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a floating point array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<float> &values)
+	: ControlValue()
+{
+	setArray(ControlTypeFloat, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a Rectangle array ControlValue
+ * \param[in] values The array of values to store
+ */
+ControlValue::ControlValue(const std::vector<Rectangle> &values)
+	: ControlValue()
 {
+	setArray(ControlTypeRectangle, values.size(), values.data());
+}
+
+/**
+ * \brief Construct a zero-initialised array ControlValue
+ * \param[in] type The array element type
+ * \param[in] numElements The number of elements in the array
+ *
+ * This constructor is mostly useful to provide storage for array controls read
+ * from a device.
+ */
+ControlValue::ControlValue(ControlType type, unsigned int numElements)
+	: ControlValue()
+{
+	setArray(type, numElements, nullptr);
 }
 
 /**
@@ -112,6 +313,76 @@ ControlValue::ControlValue(int64_t value)
  * \return True if the value type is ControlTypeNone, false otherwise
  */
 
+/**
+ * \fn ControlValue::isArray()
+ * \brief Determine if the value stores an array
+ * \return True if the value stores an array, false otherwise
+ */
+
+/**
+ * \fn ControlValue::numElements()
+ * \brief Retrieve the number of elements stored in an array value
+ * \return The number of array elements, or 0 if the value isn't an array
+ */
+
+/**
+ * \brief Retrieve the memory storing the array elements
+ *
+ * If the array storage is shared with other ControlValue instances, it is
+ * copied first, such that modifications through the returned pointer don't
+ * affect the other instances.
+ *
+ * \return A pointer to the array storage, or nullptr if the value isn't an
+ * array
+ */
+uint8_t *ControlValue::data()
+{
+	if (!isArray_)
+		return nullptr;
+
+	if (!heap_)
+		return storage_;
+
+	if (heap_.use_count() > 1)
+		heap_ = std::make_shared<std::vector<uint8_t>>(*heap_);
+
+	return heap_->data();
+}
+
+/**
+ * \brief Retrieve the memory storing the array elements
+ * \return A pointer to the array storage, or nullptr if the value isn't an
+ * array
+ */
+const uint8_t *ControlValue::data() const
+{
+	if (!isArray_)
+		return nullptr;
+
+	return heap_ ? heap_->data() : storage_;
+}
+
+/**
+ * \fn ControlValue::dataSize()
+ * \brief Retrieve the size in bytes of the array elements
+ * \return The array storage size in bytes, or 0 if the value isn't an array
+ */
+
+/**
+ * \fn template<typename T> const T *ControlValue::array() const
+ * \brief Retrieve the array elements
+ *
+ * The value shall be an array whose element type matches the type T,
+ * otherwise the behaviour is undefined.
+ *
+ * \return A pointer to the first array element
+ */
+
+/**
+ * \fn template<typename T> T *ControlValue::array()
+ * \copydoc ControlValue::array() const
+ */
+
 /**
  * \fn template<typename T> const T &ControlValue::get() const
  * \brief Get the control value
@@ -132,7 +403,7 @@ ControlValue::ControlValue(int64_t value)
 template<>
 const bool &ControlValue::get<bool>() const
 {
-	ASSERT(type_ == ControlTypeBool);
+	ASSERT(type_ == ControlTypeBool && !isArray_);
 
 	return bool_;
 }
@@ -141,6 +412,7 @@ template<>
 const int32_t &ControlValue::get<int32_t>() const
 {
 	ASSERT(type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64);
+	ASSERT(!isArray_);
 
 	return integer32_;
 }
@@ -149,38 +421,258 @@ template<>
 const int64_t &ControlValue::get<int64_t>() const
 {
 	ASSERT(type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64);
+	ASSERT(!isArray_);
 
 	return integer64_;
 }
 
+template<>
+const float &ControlValue::get<float>() const
+{
+	ASSERT(type_ == ControlTypeFloat && !isArray_);
+
+	return float_;
+}
+
+template<>
+const Rectangle &ControlValue::get<Rectangle>() const
+{
+	ASSERT(type_ == ControlTypeRectangle && !isArray_);
+
+	return *reinterpret_cast<const Rectangle *>(storage_);
+}
+
 template<>
 void ControlValue::set<bool>(const bool &value)
 {
-	type_ = ControlTypeBool;
+	reset(ControlTypeBool);
 	bool_ = value;
 }
 
 template<>
 void ControlValue::set<int32_t>(const int32_t &value)
 {
-	type_ = ControlTypeInteger32;
+	reset(ControlTypeInteger32);
 	integer32_ = value;
 }
 
 template<>
 void ControlValue::set<int64_t>(const int64_t &value)
 {
-	type_ = ControlTypeInteger64;
+	reset(ControlTypeInteger64);
 	integer64_ = value;
 }
+
+template<>
+void ControlValue::set<float>(const float &value)
+{
+	reset(ControlTypeFloat);
+	float_ = value;
+}
+
+template<>
+void ControlValue::set<Rectangle>(const Rectangle &value)
+{
+	reset(ControlTypeRectangle);
+	memcpy(storage_, &value, sizeof(value));
+}
+
+template<>
+void ControlValue::set<std::vector<uint32_t>>(const std::vector<uint32_t> &value)
+{
+	setArray(ControlTypeUnsigned32, value.size(), value.data());
+}
+
+template<>
+const uint8_t *ControlValue::array<uint8_t>() const
+{
+	ASSERT(type_ == ControlTypeByte && isArray_);
+
+	return reinterpret_cast<const uint8_t *>(data());
+}
+
+template<>
+uint8_t *ControlValue::array<uint8_t>()
+{
+	ASSERT(type_ == ControlTypeByte && isArray_);
+
+	return reinterpret_cast<uint8_t *>(data());
+}
+
+template<>
+const uint16_t *ControlValue::array<uint16_t>() const
+{
+	ASSERT(type_ == ControlTypeUnsigned16 && isArray_);
+
+	return reinterpret_cast<const uint16_t *>(data());
+}
+
+template<>
+uint16_t *ControlValue::array<uint16_t>()
+{
+	ASSERT(type_ == ControlTypeUnsigned16 && isArray_);
+
+	return reinterpret_cast<uint16_t *>(data());
+}
+
+template<>
+const uint32_t *ControlValue::array<uint32_t>() const
+{
+	ASSERT(type_ == ControlTypeUnsigned32 && isArray_);
+
+	return reinterpret_cast<const uint32_t *>(data());
+}
+
+template<>
+uint32_t *ControlValue::array<uint32_t>()
+{
+	ASSERT(type_ == ControlTypeUnsigned32 && isArray_);
+
+	return reinterpret_cast<uint32_t *>(data());
+}
+
+template<>
+const int32_t *ControlValue::array<int32_t>() const
+{
+	ASSERT(type_ == ControlTypeInteger32 && isArray_);
+
+	return reinterpret_cast<const int32_t *>(data());
+}
+
+template<>
+int32_t *ControlValue::array<int32_t>()
+{
+	ASSERT(type_ == ControlTypeInteger32 && isArray_);
+
+	return reinterpret_cast<int32_t *>(data());
+}
+
+template<>
+const int64_t *ControlValue::array<int64_t>() const
+{
+	ASSERT(type_ == ControlTypeInteger64 && isArray_);
+
+	return reinterpret_cast<const int64_t *>(data());
+}
+
+template<>
+int64_t *ControlValue::array<int64_t>()
+{
+	ASSERT(type_ == ControlTypeInteger64 && isArray_);
+
+	return reinterpret_cast<int64_t *>(data());
+}
+
+template<>
+const float *ControlValue::array<float>() const
+{
+	ASSERT(type_ == ControlTypeFloat && isArray_);
+
+	return reinterpret_cast<const float *>(data());
+}
+
+template<>
+float *ControlValue::array<float>()
+{
+	ASSERT(type_ == ControlTypeFloat && isArray_);
+
+	return reinterpret_cast<float *>(data());
+}
+
+template<>
+const Rectangle *ControlValue::array<Rectangle>() const
+{
+	ASSERT(type_ == ControlTypeRectangle && isArray_);
+
+	return reinterpret_cast<const Rectangle *>(data());
+}
+
+template<>
+Rectangle *ControlValue::array<Rectangle>()
+{
+	ASSERT(type_ == ControlTypeRectangle && isArray_);
+
+	return reinterpret_cast<Rectangle *>(data());
+}
 #endif /* __DOXYGEN__ */
 
+void ControlValue::reset(ControlType type)
+{
+	type_ = type;
+	isArray_ = false;
+	numElements_ = 0;
+	size_ = 0;
+	heap_.reset();
+	integer64_ = 0;
+}
+
+void ControlValue::setArray(ControlType type, unsigned int numElements,
+			    const void *data)
+{
+	size_t size = controlTypeSize(type) * numElements;
+
+	reset(type);
+	isArray_ = true;
+	numElements_ = numElements;
+	size_ = size;
+
+	uint8_t *storage = storage_;
+	if (size > INLINE_STORAGE_SIZE) {
+		heap_ = std::make_shared<std::vector<uint8_t>>(size);
+		storage = heap_->data();
+	}
+
+	if (data && size)
+		memcpy(storage, data, size);
+	else
+		memset(storage, 0, size);
+}
+
 /**
  * \brief Assemble and return a string describing the value
  * \return A string describing the ControlValue
  */
 std::string ControlValue::toString() const
 {
+	if (isArray_) {
+		std::stringstream ss;
+		ss << "[ ";
+
+		for (unsigned int i = 0; i < numElements_; ++i) {
+			if (i)
+				ss << ", ";
+
+			switch (type_) {
+			case ControlTypeByte:
+				ss << static_cast<unsigned int>(array<uint8_t>()[i]);
+				break;
+			case ControlTypeUnsigned16:
+				ss << array<uint16_t>()[i];
+				break;
+			case ControlTypeUnsigned32:
+				ss << array<uint32_t>()[i];
+				break;
+			case ControlTypeInteger32:
+				ss << array<int32_t>()[i];
+				break;
+			case ControlTypeInteger64:
+				ss << array<int64_t>()[i];
+				break;
+			case ControlTypeFloat:
+				ss << array<float>()[i];
+				break;
+			case ControlTypeRectangle:
+				ss << array<Rectangle>()[i].toString();
+				break;
+			default:
+				break;
+			}
+		}
+
+		ss << " ]";
+		return ss.str();
+	}
+
 	switch (type_) {
 	case ControlTypeNone:
 		return "<None>";
@@ -190,6 +682,14 @@ std::string ControlValue::toString() const
 		return std::to_string(integer32_);
 	case ControlTypeInteger64:
 		return std::to_string(integer64_);
+	case ControlTypeFloat:
+		return std::to_string(float_);
+	case ControlTypeRectangle:
+		return get<Rectangle>().toString();
+	case ControlTypeByte:
+	case ControlTypeUnsigned16:
+	case ControlTypeUnsigned32:
+		break;
 	}
 
 	return "<ValueType Error>";
@@ -201,9 +701,13 @@ std::string ControlValue::toString() const
  */
 bool ControlValue::operator==(const ControlValue &other) const
 {
-	if (type_ != other.type_)
+	if (type_ != other.type_ || isArray_ != other.isArray_)
 		return false;
 
+	if (isArray_)
+		return size_ == other.size_ &&
+		       !memcmp(data(), other.data(), size_);
+
 	switch (type_) {
 	case ControlTypeBool:
 		return bool_ == other.bool_;
@@ -211,6 +715,10 @@ bool ControlValue::operator==(const ControlValue &other) const
 		return integer32_ == other.integer32_;
 	case ControlTypeInteger64:
 		return integer64_ == other.integer64_;
+	case ControlTypeFloat:
+		return float_ == other.float_;
+	case ControlTypeRectangle:
+		return get<Rectangle>() == other.get<Rectangle>();
 	default:
 		return false;
 	}
@@ -289,9 +797,11 @@ bool ControlValue::operator==(const ControlValue &other) const
  * instead of Control.
  *
  * Controls of any type can be defined through template specialisation, but
- * libcamera only supports the bool, int32_t and int64_t types natively (this
- * includes types that are equivalent to the supported types, such as int and
- * long int).
+ * libcamera only supports the bool, int32_t, int64_t, float and Rectangle
+ * types natively (this includes types that are equivalent to the supported
+ * types, such as int and long int), as well as arrays of uint32_t stored as
+ * std::vector<uint32_t>. Array controls can be set with ControlList::set(),
+ * and their values retrieved with ControlValue::array().
  *
  * Controls IDs shall be unique. While nothing prevents multiple instances of
  * the Control class to be created with the same ID for the same object, doing
@@ -336,6 +846,24 @@ Control<int64_t>::Control(unsigned int id, const char *name)
 	: ControlId(id, name, ControlTypeInteger64)
 {
 }
+
+template<>
+Control<float>::Control(unsigned int id, const char *name)
+	: ControlId(id, name, ControlTypeFloat)
+{
+}
+
+template<>
+Control<Rectangle>::Control(unsigned int id, const char *name)
+	: ControlId(id, name, ControlTypeRectangle)
+{
+}
+
+template<>
+Control<std::vector<uint32_t>>::Control(unsigned int id, const char *name)
+	: ControlId(id, name, ControlTypeUnsigned32)
+{
+}
 #endif /* __DOXYGEN__ */
 
 /**
@@ -384,14 +912,265 @@ std::string ControlRange::toString() const
 }
 
 /**
- * \typedef ControlIdMap
+ * \class ControlIdMap
  * \brief A map of numerical control ID to ControlId
  *
  * The map is used by ControlList instances to access controls by numerical
  * IDs. A global map of all libcamera controls is provided by
  * controls::controls.
+ *
+ * In addition to the map, the class assigns a dense slot number to each of the
+ * controls it contains. ControlList instances use the slots to store their
+ * values in a flat array allocated once at construction time. When the
+ * numerical IDs are dense, as for the libcamera controls, slots are looked up
+ * by direct indexing without any hashing.
+ *
+ * Like the ControlInfoMap, the ControlIdMap is immutable once constructed, and
+ * only exposes the read accessors of std::unordered_map<>. Its content is
+ * shared between copies, which are thus cheap.
+ */
+
+/**
+ * \typedef ControlIdMap::Map
+ * \brief The underlying std::unordered_map<> container
+ */
+
+/**
+ * \typedef ControlIdMap::key_type
+ * \brief The map key type, the control numerical ID
+ */
+
+/**
+ * \typedef ControlIdMap::mapped_type
+ * \brief The map mapped type, a pointer to the ControlId
+ */
+
+/**
+ * \typedef ControlIdMap::value_type
+ * \brief The map value type
+ */
+
+/**
+ * \typedef ControlIdMap::size_type
+ * \brief The map size type
+ */
+
+/**
+ * \typedef ControlIdMap::iterator
+ * \brief Iterator over the map entries, the map is immutable
+ */
+
+/**
+ * \typedef ControlIdMap::const_iterator
+ * \brief Const iterator over the map entries
+ */
+
+/**
+ * \brief Construct an empty ControlIdMap
+ */
+ControlIdMap::ControlIdMap()
+{
+	static std::shared_ptr<const Data> empty = [] {
+		Data *data = new Data();
+		data->base = 0;
+		return std::shared_ptr<const Data>(data);
+	}();
+
+	data_ = empty;
+}
+
+/**
+ * \brief Construct a ControlIdMap from an initializer list
+ * \param[in] init The initializer list
+ */
+ControlIdMap::ControlIdMap(std::initializer_list<Map::value_type> init)
+{
+	Data *data = new Data();
+	data->map = init;
+	generateSlots(data);
+	data_.reset(data);
+}
+
+/**
+ * \brief Construct a ControlIdMap from a table of controls
+ * \param[in] table The table of controls
+ * \param[in] size The number of entries in \a table
+ *
+ * The slot of each control is its index in the \a table. This constructor is
+ * used for tables generated at compile time, such as controls::controls.
+ */
+ControlIdMap::ControlIdMap(const ControlId *const *table, size_type size)
+{
+	Data *data = new Data();
+	for (size_type i = 0; i < size; ++i)
+		data->map[table[i]->id()] = table[i];
+	data->ids.assign(table, table + size);
+	generateSlots(data);
+	data_.reset(data);
+}
+
+/**
+ * \brief Move assignment operator from a plain map
+ * \param[in] map The control ID plain map
+ *
+ * Populate the map by replacing its contents with those of \a map using move
+ * semantics. Upon return the \a map will be empty.
+ *
+ * \return A reference to the populated ControlIdMap
+ */
+ControlIdMap &ControlIdMap::operator=(Map &&map)
+{
+	Data *data = new Data();
+	data->map = std::move(map);
+	generateSlots(data);
+	data_.reset(data);
+	return *this;
+}
+
+/**
+ * \fn ControlIdMap::begin()
+ * \brief Retrieve an iterator to the first entry of the map
+ * \return An iterator to the first entry of the map
+ */
+
+/**
+ * \fn ControlIdMap::cbegin()
+ * \copydoc ControlIdMap::begin()
+ */
+
+/**
+ * \fn ControlIdMap::end()
+ * \brief Retrieve an iterator past the last entry of the map
+ * \return An iterator past the last entry of the map
+ */
+
+/**
+ * \fn ControlIdMap::cend()
+ * \copydoc ControlIdMap::end()
+ */
+
+/**
+ * \fn ControlIdMap::at()
+ * \brief Access the ControlId for a numerical ID
+ * \param[in] id The control numerical ID
+ * \return The ControlId, throws std::out_of_range if not found
+ */
+
+/**
+ * \fn ControlIdMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map is empty, false otherwise
+ */
+
+/**
+ * \fn ControlIdMap::size()
+ * \brief Retrieve the number of entries in the map
+ * \return The number of entries in the map
  */
 
+/**
+ * \fn ControlIdMap::count()
+ * \brief Count the number of entries matching a numerical ID
+ * \param[in] id The control numerical ID
+ * \return The number of entries matching \a id
+ */
+
+/**
+ * \fn ControlIdMap::find()
+ * \brief Find the entry matching a numerical ID
+ * \param[in] id The control numerical ID
+ * \return An iterator to the entry matching \a id, or end() if not found
+ */
+
+/**
+ * \brief Retrieve the slot number of a control
+ * \param[in] id The control numerical ID
+ * \return The slot number of the control, or -1 if the control isn't part of
+ * the map
+ */
+int ControlIdMap::slot(unsigned int id) const
+{
+	const Data &data = *data_;
+
+	if (!data.direct.empty()) {
+		unsigned int index = id - data.base;
+		return index < data.direct.size() ? data.direct[index] : -1;
+	}
+
+	const auto iter = data.slots.find(id);
+	if (iter == data.slots.end())
+		return -1;
+
+	return iter->second;
+}
+
+/**
+ * \fn ControlIdMap::slotId()
+ * \brief Retrieve the control stored in a slot
+ * \param[in] slot The slot number
+ *
+ * The \a slot shall be lower than the map size.
+ *
+ * \return The ControlId stored in \a slot
+ */
+
+/**
+ * \brief Compare two control ID maps for equality
+ * \param[in] other The other map
+ *
+ * Two maps are equal if they associate the same numerical IDs to the same
+ * ControlId instances. Copies of a map share their data and are compared
+ * without inspecting their contents.
+ *
+ * \return True if the two maps are equal, false otherwise
+ */
+bool ControlIdMap::operator==(const ControlIdMap &other) const
+{
+	return data_ == other.data_ || data_->map == other.data_->map;
+}
+
+/**
+ * \fn ControlIdMap::operator!=()
+ * \brief Compare two control ID maps for inequality
+ * \param[in] other The other map
+ * \return True if the two maps are not equal, false otherwise
+ */
+
+void ControlIdMap::generateSlots(Data *data)
+{
+	if (data->ids.empty()) {
+		data->ids.reserve(data->map.size());
+		for (const auto &ctrl : data->map)
+			data->ids.push_back(ctrl.second);
+	}
+
+	data->base = 0;
+	if (data->ids.empty())
+		return;
+
+	unsigned int min = data->ids[0]->id();
+	unsigned int max = min;
+	for (const ControlId *id : data->ids) {
+		min = std::min(min, id->id());
+		max = std::max(max, id->id());
+	}
+
+	/*
+	 * Use a direct lookup table when the IDs are dense enough, and fall
+	 * back to a hash map otherwise, as for V4L2 controls whose IDs are
+	 * spread over multiple control classes.
+	 */
+	if (max - min < 2 * data->ids.size()) {
+		data->base = min;
+		data->direct.assign(max - min + 1, -1);
+		for (unsigned int i = 0; i < data->ids.size(); ++i)
+			data->direct[data->ids[i]->id() - min] = i;
+	} else {
+		for (unsigned int i = 0; i < data->ids.size(); ++i)
+			data->slots[data->ids[i]->id()] = i;
+	}
+}
+
 /**
  * \class ControlInfoMap
  * \brief A map of ControlId to ControlRange
@@ -529,9 +1308,11 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
 
 void ControlInfoMap::generateIdmap()
 {
-	idmap_.clear();
+	ControlIdMap::Map idmap;
 	for (const auto &ctrl : *this)
-		idmap_[ctrl.first->id()] = ctrl.first;
+		idmap[ctrl.first->id()] = ctrl.first;
+
+	idmap_ = std::move(idmap);
 }
 
 /**
@@ -545,6 +1326,17 @@ void ControlInfoMap::generateIdmap()
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * The values are stored in a flat array with one slot per control of the
+ * ControlIdMap, allocated when the list is constructed. Adding, updating and
+ * looking up controls thus never allocates memory. Iterating over the list
+ * visits the controls it contains in slot order.
+ *
+ * Copies of a ControlList share their storage until one of them is modified,
+ * at which point the modified copy duplicates the storage. Passing control
+ * lists by value, for instance from pipeline handlers to IPAs, is thus cheap.
+ * Combined with merge() and delta(), this allows propagating only the controls
+ * that changed between frames.
  */
 
 /**
@@ -557,8 +1349,14 @@ void ControlInfoMap::generateIdmap()
  * argument.
  */
 ControlList::ControlList(const ControlIdMap &idmap, ControlValidator *validator)
-	: validator_(validator), idmap_(&idmap)
+	: validator_(validator), idmap_(&idmap), storage_(std::make_shared<Storage>())
 {
+	storage_->values.resize(idmap.size());
+	storage_->present.resize(idmap.size());
+	storage_->count = 0;
+
+	for (unsigned int i = 0; i < storage_->values.size(); ++i)
+		storage_->values[i].first = idmap.slotId(i);
 }
 
 /**
@@ -567,7 +1365,7 @@ ControlList::ControlList(const ControlIdMap &idmap, ControlValidator *validator)
  * \param[in] validator The validator (may be null)
  */
 ControlList::ControlList(const ControlInfoMap &info, ControlValidator *validator)
-	: validator_(validator), idmap_(&info.idmap())
+	: ControlList(info.idmap(), validator)
 {
 }
 
@@ -620,9 +1418,105 @@ ControlList::ControlList(const ControlInfoMap &info, ControlValidator *validator
  */
 
 /**
- * \fn ControlList::clear()
+ * \fn ControlList::idmap()
+ * \brief Retrieve the ControlIdMap used to construct the list
+ * \return The ControlIdMap used to construct the list
+ */
+
+/**
  * \brief Removes all controls from the list
+ *
+ * The storage of the list is kept for reuse.
  */
+void ControlList::clear()
+{
+	if (!storage_->count)
+		return;
+
+	detach();
+	std::fill(storage_->present.begin(), storage_->present.end(), false);
+	storage_->count = 0;
+}
+
+/**
+ * \brief Merge the controls of \a other into the list
+ * \param[in] other The other control list
+ *
+ * Set the value of all controls contained in \a other in this list, adding
+ * them to the list if needed. Controls contained in this list only are not
+ * modified. Both lists shall refer to the same ControlIdMap, otherwise the
+ * behaviour is undefined.
+ *
+ * This is typically used to accumulate the state resulting from successive
+ * sets of controls, as a reference for delta().
+ */
+void ControlList::merge(const ControlList &other)
+{
+	if (other.storage_ == storage_ || other.empty())
+		return;
+
+	if (empty()) {
+		storage_ = other.storage_;
+		return;
+	}
+
+	const Storage &source = *other.storage_;
+	for (unsigned int slot = 0; slot < source.values.size(); ++slot) {
+		if (source.present[slot])
+			*insert(slot) = source.values[slot].second;
+	}
+}
+
+/**
+ * \brief Exchange the content of the list with \a other
+ * \param[in] other The other control list
+ *
+ * Swap the controls, the ControlIdMap and the validator of the two lists
+ * without copying or allocating any storage. This is typically used to recycle
+ * the storage of a control list that has been consumed.
+ */
+void ControlList::swap(ControlList &other)
+{
+	std::swap(validator_, other.validator_);
+	std::swap(idmap_, other.idmap_);
+	storage_.swap(other.storage_);
+}
+
+/**
+ * \brief Compute the controls that differ from a reference list
+ * \param[in] reference The reference control list
+ *
+ * Create a new list containing the controls of this list that are either
+ * absent from \a reference or have a different value. Both lists shall refer to
+ * the same ControlIdMap, otherwise the behaviour is undefined.
+ *
+ * Lists that share their storage have no difference, and are compared without
+ * inspecting their values.
+ *
+ * \return A new control list with the controls that changed
+ */
+ControlList ControlList::delta(const ControlList &reference) const
+{
+	ControlList changes(*idmap_, validator_);
+	if (reference.storage_ == storage_ || empty())
+		return changes;
+
+	const Storage &current = *storage_;
+	const Storage &previous = *reference.storage_;
+
+	for (unsigned int slot = 0; slot < current.values.size(); ++slot) {
+		if (!current.present[slot])
+			continue;
+
+		if (slot < previous.values.size() && previous.present[slot] &&
+		    previous.values[slot].second == current.values[slot].second)
+			continue;
+
+		*changes.insert(slot) = current.values[slot].second;
+	}
+
+	return changes;
+}
 
 /**
  * \brief Check if the list contains a control with the specified \a id
@@ -632,7 +1526,8 @@ ControlList::ControlList(const ControlInfoMap &info, ControlValidator *validator
  */
 bool ControlList::contains(const ControlId &id) const
 {
-	return controls_.find(&id) != controls_.end();
+	int slot = idmap_->slot(id.id());
+	return slot >= 0 && storage_->present[slot];
 }
 
 /**
@@ -643,11 +1538,8 @@ bool ControlList::contains(const ControlId &id) const
  */
 bool ControlList::contains(unsigned int id) const
 {
-	const auto iter = idmap_->find(id);
-	if (iter == idmap_->end())
-		return false;
-
-	return contains(*iter->second);
+	int slot = idmap_->slot(id);
+	return slot >= 0 && storage_->present[slot];
 }
 
 /**
@@ -693,15 +1585,15 @@ const ControlValue &ControlList::get(unsigned int id) const
 {
 	static ControlValue zero;
 
-	const auto ctrl = idmap_->find(id);
-	if (ctrl == idmap_->end()) {
+	int slot = idmap_->slot(id);
+	if (slot < 0) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id)
 			<< " is not supported";
 		return zero;
 	}
 
-	const ControlValue *val = find(*ctrl->second);
+	const ControlValue *val = find(*storage_->values[slot].first);
 	if (!val)
 		return zero;
 
@@ -722,15 +1614,15 @@ const ControlValue &ControlList::get(unsigned int id) const
  */
 void ControlList::set(unsigned int id, const ControlValue &value)
 {
-	const auto ctrl = idmap_->find(id);
-	if (ctrl == idmap_->end()) {
+	int slot = idmap_->slot(id);
+	if (slot < 0) {
 		LOG(Controls, Error)
 			<< "Control 0x" << utils::hex(id)
 			<< " is not supported";
 		return;
 	}
 
-	ControlValue *val = find(*ctrl->second);
+	ControlValue *val = find(*storage_->values[slot].first);
 	if (!val)
 		return;
 
@@ -739,15 +1631,15 @@ void ControlList::set(unsigned int id, const ControlValue &value)
 
 const ControlValue *ControlList::find(const ControlId &id) const
 {
-	const auto iter = controls_.find(&id);
-	if (iter == controls_.end()) {
+	int slot = idmap_->slot(id.id());
+	if (slot < 0 || !storage_->present[slot]) {
 		LOG(Controls, Error)
 			<< "Control " << id.name() << " not found";
 
 		return nullptr;
 	}
 
-	return &iter->second;
+	return &storage_->values[slot].second;
 }
 
 ControlValue *ControlList::find(const ControlId &id)
@@ -759,7 +1651,33 @@ ControlValue *ControlList::find(const ControlId &id)
 		return nullptr;
 	}
 
-	return &controls_[&id];
+	int slot = idmap_->slot(id.id());
+	if (slot < 0) {
+		LOG(Controls, Error)
+			<< "Control " << id.name() << " is not supported";
+		return nullptr;
+	}
+
+	return insert(slot);
+}
+
+ControlValue *ControlList::insert(unsigned int slot)
+{
+	detach();
+
+	Storage &storage = *storage_;
+	if (!storage.present[slot]) {
+		storage.present[slot] = true;
+		storage.count++;
+	}
+
+	return &storage.values[slot].second;
+}
+
+void ControlList::detach()
+{
+	if (storage_.use_count() > 1)
+		storage_ = std::make_shared<Storage>(*storage_);
 }
 
 } /* namespace libcamera */
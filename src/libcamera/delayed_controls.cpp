@@ -0,0 +1,345 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed_controls.cpp - Sensor controls applied with a per-control delay
+ */
+
+#include "delayed_controls.h"
+
+#include <algorithm>
+
+#include "camera_sensor.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file delayed_controls.h
+ * \brief Sensor controls applied with a per-control delay
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DelayedControls)
+
+/**
+ * \class DelayedControls
+ * \brief Helper to apply sensor controls at the frame they target
+ *
+ * Sensors latch most controls at frame boundaries, and a control written
+ * during one frame only takes effect a sensor-specific number of frames later.
+ * The delay usually differs between controls, exposure often takes one frame
+ * longer than gain to apply. Writing all controls as soon as the IPA computes
+ * them thus produces frames captured with a mix of old and new values, which
+ * makes exposure control loops oscillate.
+ *
+ * The DelayedControls class records the delay of each control, and queues the
+ * control values per frame. The push() method queues the values for the next
+ * frame, and the pipeline handler calls applyControls() at the start of every
+ * frame to write each control the number of frames ahead of its target frame
+ * given by its delay. All controls of a pushed list thus take effect on the
+ * same frame.
+ *
+ * The pushFrame() method overrides the values of a single frame instead, for
+ * instance to capture an exposure bracket with frame-exact manual settings
+ * while the IPA keeps pushing the values of the other frames.
+ *
+ * The get() method reports the control values a frame has been captured with,
+ * taking into account the frames that have been skipped, if any.
+ *
+ * Frames are identified by their sequence number, starting at 0 for the first
+ * frame captured after a call to reset().
+ */
+
+/**
+ * \var DelayedControls::FRAME_DEPTH
+ * \brief The number of frames of control values stored by the helper
+ *
+ * Half of the depth is available to queue values ahead of the frame being
+ * captured, the other half keeps the history reported by get().
+ */
+
+/**
+ * \brief Construct a DelayedControls instance
+ * \param[in] sensor The camera sensor the controls are applied to
+ * \param[in] delays The delay of each control, indexed by V4L2 control ID
+ *
+ * The \a delays map lists all the controls handled by the instance, along with
+ * the number of frames it takes for a value written to the sensor to take
+ * effect. Only the controls listed in \a delays can be pushed.
+ *
+ * The instance shall be reset() before use.
+ */
+DelayedControls::DelayedControls(CameraSensor *sensor,
+				 const std::unordered_map<uint32_t, unsigned int> &delays)
+	: sensor_(sensor), maxDelay_(0), queueCount_(0), writeCount_(0),
+	  values_(FRAME_DEPTH, ControlList(sensor->controls())),
+	  queued_(sensor->controls()), written_(sensor->controls())
+{
+	const ControlInfoMap &controls = sensor_->controls();
+
+	for (const auto &delay : delays) {
+		if (controls.find(delay.first) == controls.end()) {
+			LOG(DelayedControls, Warning)
+				<< "Control " << utils::hex(delay.first)
+				<< " not supported by the sensor";
+			continue;
+		}
+
+		delays_[delay.first] = delay.second;
+		maxDelay_ = std::max(maxDelay_, delay.second);
+	}
+
+	maxDelay_ = std::min(maxDelay_, FRAME_DEPTH / 2 - 1);
+}
+
+/**
+ * \brief Reset the control values to the current sensor state
+ *
+ * This method reads the current value of all the controls from the sensor and
+ * discards all queued values and frame overrides. It shall be called before the sensor starts
+ * streaming, the next frame then has sequence number 0.
+ *
+ * The first frame that pushed values can target is maxDelay() + 1, all the
+ * previous frames are captured with the current values.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DelayedControls::reset()
+{
+	const ControlInfoMap &controls = sensor_->controls();
+	ControlList ctrls(controls);
+
+	for (const auto &delay : delays_)
+		ctrls.set(delay.first, controls.at(delay.first).min());
+
+	int ret = sensor_->getControls(&ctrls);
+	if (ret)
+		return ret < 0 ? ret : -EINVAL;
+
+	for (unsigned int i = 0; i <= maxDelay_; ++i)
+		values_[i] = ctrls;
+
+	queued_ = ctrls;
+	overrides_.clear();
+	written_ = ctrls;
+	queueCount_ = maxDelay_ + 1;
+	writeCount_ = 0;
+
+	return 0;
+}
+
+/**
+ * \brief Queue control values for the next frame
+ * \param[in] controls The control values
+ *
+ * This method queues \a controls for the frame following the last queued
+ * frame. Controls not present in \a controls keep the value they had in the
+ * previous frame, not taking into account the values overridden for that frame
+ * by pushFrame().
+ *
+ * When the values are pushed late, the frames for which no values have been
+ * queued by the time they have to be written repeat the previous values, and
+ * \a controls then targets the first frame for which all controls can still
+ * be written on time.
+ *
+ * \return True if the values have been queued, or false if \a controls
+ * contains a control not handled by the instance or too many frames are
+ * already queued
+ */
+bool DelayedControls::push(const ControlList &controls)
+{
+	for (const auto &ctrl : controls) {
+		if (!delays_.count(ctrl.first->id())) {
+			LOG(DelayedControls, Error)
+				<< "Control " << ctrl.first->name()
+				<< " has no delay";
+			return false;
+		}
+	}
+
+	if (queueCount_ - writeCount_ >= FRAME_DEPTH / 2 + maxDelay_) {
+		LOG(DelayedControls, Error) << "Too many frames queued";
+		return false;
+	}
+
+	for (const auto &ctrl : controls)
+		queued_.set(ctrl.first->id(), ctrl.second);
+
+	queueFrame();
+
+	return true;
+}
+
+/**
+ * \brief Override control values for a single frame
+ * \param[in] controls The control values
+ * \param[inout] sequence The sequence number of the frame
+ *
+ * This method sets \a controls for one frame only, on top of the values queued
+ * for that frame by push(), which they take precedence over. The frames that
+ * follow it are not affected.
+ *
+ * The values target the first frame starting from \a sequence for which all
+ * controls in \a controls can still be written on time, and \a sequence is
+ * updated with the sequence number of that frame. Overriding consecutive
+ * frames thus only requires passing the previous frame sequence number plus
+ * one.
+ *
+ * \return True if the values have been queued, or false if \a controls
+ * contains a control not handled by the instance or the frame is too far in
+ * the future
+ */
+bool DelayedControls::pushFrame(const ControlList &controls, uint32_t *sequence)
+{
+	uint32_t frame = std::max(*sequence, writeCount_);
+
+	for (const auto &ctrl : controls) {
+		auto delay = delays_.find(ctrl.first->id());
+		if (delay == delays_.end()) {
+			LOG(DelayedControls, Error)
+				<< "Control " << ctrl.first->name()
+				<< " has no delay";
+			return false;
+		}
+
+		frame = std::max(frame, writeCount_ + delay->second);
+	}
+
+	if (frame - writeCount_ >= FRAME_DEPTH / 2 + maxDelay_) {
+		LOG(DelayedControls, Error)
+			<< "Frame " << frame << " is too far ahead";
+		return false;
+	}
+
+	/*
+	 * The frames already queued are updated in place, the values of the
+	 * next ones are stored until push() or applyControls() queue them.
+	 */
+	ControlList *frameValues;
+	if (frame < queueCount_)
+		frameValues = &values(frame);
+	else
+		frameValues = &overrides_.emplace(frame, sensor_->controls()).first->second;
+
+	for (const auto &ctrl : controls)
+		frameValues->set(ctrl.first->id(), ctrl.second);
+
+	*sequence = frame;
+
+	return true;
+}
+
+/**
+ * \brief Retrieve the control values a frame has been captured with
+ * \param[in] sequence The frame sequence number
+ *
+ * The values are final once applyControls() has been called for all frames up
+ * to \a sequence. Values of later frames report the queued values, and values
+ * of frames older than FRAME_DEPTH / 2 frames are not available anymore.
+ *
+ * \return The control values of frame \a sequence
+ */
+ControlList DelayedControls::get(uint32_t sequence) const
+{
+	if (sequence >= queueCount_) {
+		ControlList ctrls = queued_;
+
+		auto it = overrides_.find(sequence);
+		if (it != overrides_.end()) {
+			for (const auto &ctrl : it->second)
+				ctrls.set(ctrl.first->id(), ctrl.second);
+		}
+
+		return ctrls;
+	}
+
+	if (queueCount_ - sequence > FRAME_DEPTH) {
+		LOG(DelayedControls, Warning)
+			<< "Frame " << sequence << " is too old";
+		return values(queueCount_ - FRAME_DEPTH);
+	}
+
+	return values(sequence);
+}
+
+/**
+ * \brief Write the controls to the sensor at the start of a frame
+ * \param[in] sequence The sequence number of the frame that has started
+ *
+ * This method shall be called at the start of every frame, usually from the
+ * frame start event handler. It writes to the sensor the value of each control
+ * for the frame that is its delay ahead of frame \a sequence. When frames have
+ * been skipped since the previous call, the values reported by get() for the
+ * affected frames are updated with the values actually applied.
+ */
+void DelayedControls::applyControls(uint32_t sequence)
+{
+	/* Repeat the last values for the frames that haven't been queued. */
+	while (queueCount_ <= sequence + maxDelay_)
+		queueFrame();
+
+	ControlList ctrls(sensor_->controls());
+	uint32_t first = std::max(writeCount_, sequence - std::min(sequence, FRAME_DEPTH / 2));
+
+	for (const auto &delay : delays_) {
+		uint32_t id = delay.first;
+		unsigned int target = sequence + delay.second;
+		const ControlValue &current = written_.get(id);
+
+		/*
+		 * The values of the frames whose write has been skipped are
+		 * those in effect before this call.
+		 */
+		for (uint32_t frame = first + delay.second; frame < target; ++frame)
+			values(frame).set(id, current);
+
+		const ControlValue &value = values(target).get(id);
+		if (value == current)
+			continue;
+
+		ctrls.set(id, value);
+	}
+
+	writeCount_ = sequence + 1;
+
+	if (ctrls.empty())
+		return;
+
+	int ret = sensor_->setControls(&ctrls);
+	if (ret) {
+		LOG(DelayedControls, Error)
+			<< "Failed to set controls for frame " << sequence;
+		return;
+	}
+
+	for (const auto &ctrl : ctrls)
+		written_.set(ctrl.first->id(), ctrl.second);
+}
+
+/*
+ * Queue the values of the next frame, made of the last values passed to push()
+ * and the values overridden for the frame, if any.
+ */
+void DelayedControls::queueFrame()
+{
+	ControlList &next = values(queueCount_);
+	next = queued_;
+
+	auto it = overrides_.find(queueCount_);
+	if (it != overrides_.end()) {
+		for (const auto &ctrl : it->second)
+			next.set(ctrl.first->id(), ctrl.second);
+		overrides_.erase(it);
+	}
+
+	queueCount_++;
+}
+
+/**
+ * \fn DelayedControls::maxDelay()
+ * \brief Retrieve the largest delay of the controls
+ * \return The largest control delay in frames
+ */
+
+} /* namespace libcamera */
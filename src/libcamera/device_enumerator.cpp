@@ -10,6 +10,7 @@
 #include "device_enumerator_udev.h"
 
 #include <string.h>
+#include <thread>
 
 #include "log.h"
 #include "media_device.h"
@@ -185,7 +186,8 @@ DeviceEnumerator::~DeviceEnumerator()
  *
  * This function finds and add all media devices in the system to the
  * enumerator. It shall be implemented by all subclasses of DeviceEnumerator
- * using system-specific methods.
+ * using system-specific methods. Media devices may be only probed with
+ * probeDevices(), in which case they are populated on demand by search().
  *
  * Individual media devices that can't be properly enumerated shall be skipped
  * with a warning message logged, without returning an error. Only errors that
@@ -228,6 +230,115 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 	return media;
 }
 
+/**
+ * \brief Probe media devices for deferred population
+ * \param[in] deviceNodes paths to the media devices to probe
+ *
+ * Create a media device for each entry in \a deviceNodes and only retrieve its
+ * device information with MediaDevice::probe(). Populating the media graph and
+ * associating its entities with device nodes is deferred until a search()
+ * pattern matches the driver name of the media device. Media devices that no
+ * pipeline handler is interested in, such as DVB or audio devices, are thus
+ * never populated.
+ *
+ * Media devices that fail to be probed are skipped.
+ */
+void DeviceEnumerator::probeDevices(const std::vector<std::string> &deviceNodes)
+{
+	for (const std::string &deviceNode : deviceNodes) {
+		std::shared_ptr<MediaDevice> media = std::make_shared<MediaDevice>(deviceNode);
+
+		int ret = media->probe();
+		if (ret < 0) {
+			LOG(DeviceEnumerator, Info)
+				<< "Unable to probe media device " << deviceNode
+				<< " (" << strerror(-ret) << "), skipping";
+			continue;
+		}
+
+		LOG(DeviceEnumerator, Debug)
+			<< "Probed media device \"" << media->driver()
+			<< "\" from " << deviceNode;
+
+		probed_.push_back(std::move(media));
+	}
+}
+
+/**
+ * \fn DeviceEnumerator::populateMediaDevice()
+ * \brief Associate the entities of a populated media device with device nodes
+ * \param[in] media The media device
+ *
+ * This function is called for media devices created with probeDevices()
+ * once their media graph has been populated. It shall associate the media
+ * device entities with device node paths as explained in createDevice().
+ *
+ * \return 0 if the media device is ready to be used, a positive value if the
+ * media device has unmet dependencies and will be added with addDevice() by
+ * the enumerator when they are met, or a negative error code otherwise
+ */
+
+/*
+ * Populate the probed media devices whose driver name is \a driver, and add
+ * them to the enumerator. Populating the media graph of a device only involves
+ * ioctls on its own device node, the devices are thus populated in parallel
+ * from helper threads to reduce enumeration time on systems with many media
+ * devices. The enumerator-specific part is then performed from the calling
+ * thread.
+ */
+void DeviceEnumerator::populateDevices(const std::string &driver)
+{
+	std::vector<std::shared_ptr<MediaDevice>> devices;
+
+	for (auto iter = probed_.begin(); iter != probed_.end();) {
+		if ((*iter)->driver() == driver) {
+			devices.push_back(std::move(*iter));
+			iter = probed_.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+
+	if (devices.empty())
+		return;
+
+	std::vector<int> results(devices.size());
+	std::vector<std::thread> threads;
+	threads.reserve(devices.size());
+
+	for (unsigned int i = 0; i < devices.size(); ++i)
+		threads.emplace_back([&devices, &results, i]() {
+			results[i] = devices[i]->populate();
+		});
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	for (unsigned int i = 0; i < devices.size(); ++i) {
+		const std::shared_ptr<MediaDevice> &media = devices[i];
+		int ret = results[i];
+
+		if (ret < 0) {
+			LOG(DeviceEnumerator, Info)
+				<< "Unable to populate media device "
+				<< media->deviceNode() << " ("
+				<< strerror(-ret) << "), skipping";
+			continue;
+		}
+
+		ret = populateMediaDevice(media);
+		if (ret < 0) {
+			LOG(DeviceEnumerator, Warning)
+				<< "Unable to associate device nodes to media device "
+				<< media->deviceNode() << ", skipping";
+			continue;
+		}
+
+		if (ret == 0)
+			addDevice(media);
+	}
+}
+
 /**
  * \brief Add a media device to the enumerator
  * \param[in] media media device instance to add
@@ -278,6 +389,18 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
 	media->disconnected.emit(media.get());
 }
 
+/**
+ * \var DeviceEnumerator::devicesAdded
+ * \brief Signal emitted when new media devices have been added to the
+ * enumerator after enumerate()
+ *
+ * Enumerators that support hotplug emit this signal once per batch of
+ * hotplugged devices, after adding them. Devices already in use by cameras
+ * are busy and skipped by search(), matching pipeline handlers again thus
+ * only considers the new devices and the devices that no pipeline handler
+ * has claimed.
+ */
+
 /**
  * \brief Search available media devices for a pattern match
  * \param[in] dm Search pattern
@@ -287,10 +410,15 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
  * it the caller is responsible for acquiring the MediaDevice object and
  * releasing it when done with it.
  *
+ * Media devices probed with probeDevices() whose driver name matches \a dm are
+ * populated first.
+ *
  * \return pointer to the matching MediaDevice, or nullptr if no match is found
  */
 std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 {
+	populateDevices(dm.driver());
+
 	for (std::shared_ptr<MediaDevice> media : devices_) {
 		if (media->busy())
 			continue;
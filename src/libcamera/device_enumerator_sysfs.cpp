@@ -33,7 +33,6 @@ int DeviceEnumeratorSysfs::enumerate()
 {
 	struct dirent *ent;
 	DIR *dir;
-	int ret = 0;
 
 	static const char * const sysfs_dirs[] = {
 		"/sys/subsystem/media/devices",
@@ -47,12 +46,19 @@ int DeviceEnumeratorSysfs::enumerate()
 			break;
 	}
 
+	/*
+	 * Without media device directory, as in containers, there's no media
+	 * device to enumerate. Pipeline handlers that don't need any, such as
+	 * the synthetic cameras, can still be matched.
+	 */
 	if (!dir) {
-		LOG(DeviceEnumerator, Error)
+		LOG(DeviceEnumerator, Warning)
 			<< "No valid sysfs media device directory";
-		return -ENODEV;
+		return 0;
 	}
 
+	std::vector<std::string> devnodes;
+
 	while ((ent = readdir(dir)) != nullptr) {
 		if (strncmp(ent->d_name, "media", 5))
 			continue;
@@ -73,23 +79,14 @@ int DeviceEnumeratorSysfs::enumerate()
 			continue;
 		}
 
-		std::shared_ptr<MediaDevice> media = createDevice(devnode);
-		if (!media) {
-			ret = -ENODEV;
-			break;
-		}
-
-		if (populateMediaDevice(media) < 0) {
-			ret = -ENODEV;
-			break;
-		}
-
-		addDevice(media);
+		devnodes.push_back(devnode);
 	}
 
 	closedir(dir);
 
-	return ret;
+	probeDevices(devnodes);
+
+	return 0;
 }
 
 int DeviceEnumeratorSysfs::populateMediaDevice(const std::shared_ptr<MediaDevice> &media)
@@ -27,13 +27,28 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(DeviceEnumerator)
 
+namespace {
+
+/*
+ * Time during which hotplug events are accumulated before being processed.
+ * Devices with multiple interfaces, such as USB cameras, generate bursts of
+ * events that are then handled in one go.
+ */
+constexpr std::chrono::milliseconds HotplugEventsWindow(100);
+
+} /* namespace */
+
 DeviceEnumeratorUdev::DeviceEnumeratorUdev()
 	: udev_(nullptr)
 {
+	eventsTimer_.timeout.connect(this, &DeviceEnumeratorUdev::processEvents);
 }
 
 DeviceEnumeratorUdev::~DeviceEnumeratorUdev()
 {
+	for (struct udev_device *dev : events_)
+		udev_device_unref(dev);
+
 	delete notifier_;
 
 	if (monitor_)
@@ -100,6 +115,7 @@ int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::vector<std::string> mediaNodes;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -146,6 +162,19 @@ int DeviceEnumeratorUdev::enumerate()
 			goto done;
 		}
 
+		/*
+		 * Defer creation of media devices to probe them once
+		 * enumeration completes, they will be populated when searched
+		 * for. V4L2 devices found before their media device are stored
+		 * in the orphans list.
+		 */
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media")) {
+			mediaNodes.push_back(devnode);
+			udev_device_unref(dev);
+			continue;
+		}
+
 		ret = addUdevDevice(dev);
 		udev_device_unref(dev);
 		if (ret < 0)
@@ -157,6 +186,8 @@ done:
 	if (ret < 0)
 		return ret;
 
+	probeDevices(mediaNodes);
+
 	ret = udev_monitor_enable_receiving(monitor_);
 	if (ret < 0)
 		return ret;
@@ -310,24 +341,90 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 	return 0;
 }
 
+/*
+ * Queue all pending hotplug events, and process them when the events window
+ * expires. The window starts with the first event and isn't extended by the
+ * following events, to bound the hotplug latency.
+ */
 void DeviceEnumeratorUdev::udevNotify(EventNotifier *notifier)
 {
-	struct udev_device *dev = udev_monitor_receive_device(monitor_);
-	std::string action(udev_device_get_action(dev));
-	std::string deviceNode(udev_device_get_devnode(dev));
+	struct udev_device *dev;
+
+	while ((dev = udev_monitor_receive_device(monitor_))) {
+		LOG(DeviceEnumerator, Debug)
+			<< udev_device_get_action(dev) << " device "
+			<< udev_device_get_devnode(dev);
+
+		events_.push_back(dev);
+	}
+
+	if (!events_.empty() && !eventsTimer_.isRunning())
+		eventsTimer_.start(HotplugEventsWindow);
+}
+
+void DeviceEnumeratorUdev::processEvents(Timer *timer)
+{
+	std::list<struct udev_device *> events = std::move(events_);
+	events_.clear();
+
+	/*
+	 * Drop the devices that have been added and removed within the events
+	 * window, there's no point in creating them.
+	 */
+	for (auto iter = events.begin(); iter != events.end();) {
+		struct udev_device *dev = *iter;
+		if (strcmp(udev_device_get_action(dev), "remove")) {
+			++iter;
+			continue;
+		}
 
-	LOG(DeviceEnumerator, Debug)
-		<< action << " device " << udev_device_get_devnode(dev);
+		const char *deviceNode = udev_device_get_devnode(dev);
+		auto add = std::find_if(events.begin(), iter,
+					[&](struct udev_device *other) {
+			return !strcmp(udev_device_get_action(other), "add") &&
+			       !strcmp(udev_device_get_devnode(other), deviceNode);
+		});
+
+		if (add == iter) {
+			++iter;
+			continue;
+		}
+
+		LOG(DeviceEnumerator, Debug)
+			<< "Device " << deviceNode << " added and removed, skipping";
+
+		udev_device_unref(*add);
+		udev_device_unref(dev);
+		events.erase(add);
+		iter = events.erase(iter);
+	}
+
+	/*
+	 * Handle removals first, their disconnection is signalled to the
+	 * pipeline handlers without waiting for the new devices to be created.
+	 */
+	for (struct udev_device *dev : events) {
+		if (strcmp(udev_device_get_action(dev), "remove"))
+			continue;
 
-	if (action == "add") {
-		addUdevDevice(dev);
-	} else if (action == "remove") {
 		const char *subsystem = udev_device_get_subsystem(dev);
 		if (subsystem && !strcmp(subsystem, "media"))
-			removeDevice(deviceNode);
+			removeDevice(udev_device_get_devnode(dev));
+	}
+
+	bool added = false;
+
+	for (struct udev_device *dev : events) {
+		if (!strcmp(udev_device_get_action(dev), "add")) {
+			addUdevDevice(dev);
+			added = true;
+		}
+
+		udev_device_unref(dev);
 	}
 
-	udev_device_unref(dev);
+	if (added)
+		devicesAdded.emit();
 }
 
 } /* namespace libcamera */
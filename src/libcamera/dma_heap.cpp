@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dma_heap.cpp - dma-heap memory allocator
+ */
+
+#include "dma_heap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#include "log.h"
+#include "v4l2_videodevice.h"
+
+/**
+ * \file dma_heap.h
+ * \brief dma-heap memory allocator
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaHeap)
+
+/**
+ * \class DmaHeap
+ * \brief Allocate dmabuf objects from a Linux dma-heap
+ *
+ * The DmaHeap class wraps a dma-heap device node from /dev/dma_heap and
+ * allocates memory from it in the form of dmabuf objects. The system heap
+ * provides non-contiguous memory suitable for devices behind an IOMMU, and the
+ * CMA heap provides physically contiguous memory.
+ */
+
+/**
+ * \enum DmaHeap::Type
+ * \brief The type of dma-heap
+ * \var DmaHeap::System
+ * The system heap, allocating non-contiguous memory
+ * \var DmaHeap::Cma
+ * The CMA heap, allocating physically contiguous memory
+ */
+
+/**
+ * \brief Open the dma-heap of type \a type
+ * \param[in] type The type of dma-heap
+ *
+ * The CMA heap is named differently depending on the platform configuration.
+ * All known names are tried in turn. Use isValid() to check whether a heap has
+ * been found.
+ */
+DmaHeap::DmaHeap(Type type)
+	: fd_(-1)
+{
+	static const char *const systemHeapNames[] = {
+		"/dev/dma_heap/system",
+		nullptr,
+	};
+	static const char *const cmaHeapNames[] = {
+		"/dev/dma_heap/linux,cma",
+		"/dev/dma_heap/reserved",
+		nullptr,
+	};
+
+	const char *const *names = type == Cma ? cmaHeapNames : systemHeapNames;
+
+	for (; *names; ++names) {
+		fd_ = ::open(*names, O_RDWR | O_CLOEXEC);
+		if (fd_ >= 0)
+			return;
+
+		LOG(DmaHeap, Debug)
+			<< "Failed to open " << *names << ": " << strerror(errno);
+	}
+
+	LOG(DmaHeap, Debug) << "No dma-heap available";
+}
+
+DmaHeap::~DmaHeap()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+/**
+ * \fn DmaHeap::isValid()
+ * \brief Check if the dma-heap is available for allocation
+ * \return True if the dma-heap has been opened successfully, false otherwise
+ */
+
+/**
+ * \brief Allocate a dmabuf of \a size bytes
+ * \param[in] size The size of the allocation in bytes
+ *
+ * Ownership of the returned file descriptor is passed to the caller.
+ *
+ * \return The dmabuf file descriptor on success, or a negative error code
+ * otherwise
+ */
+int DmaHeap::alloc(size_t size)
+{
+	if (!isValid())
+		return -ENODEV;
+
+	if (!size)
+		return -EINVAL;
+
+	struct dma_heap_allocation_data alloc = {};
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	int ret = ::ioctl(fd_, DMA_HEAP_IOCTL_ALLOC, &alloc);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(DmaHeap, Error)
+			<< "Failed to allocate " << size << " bytes: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return alloc.fd;
+}
+
+/**
+ * \class DmaHeapAllocator
+ * \brief A pool of dma-heap buffers for streams using external memory
+ *
+ * The DmaHeapAllocator class allocates a pool of frame buffers from a dma-heap,
+ * with one dmabuf per plane sized according to a V4L2DeviceFormat. The pool
+ * isn't tied to any particular device, and can thus be shared by all the
+ * streams of one or multiple cameras that use the ExternalMemory type, as
+ * long as the buffers are big enough for their formats.
+ *
+ * Buffers are handed to streams through createBuffer(), which wraps them with
+ * Stream::createBuffer(const std::array<int, 3> &). The allocator retains
+ * ownership of the dmabuf file descriptors, which must thus outlive all Buffer
+ * instances created from them.
+ */
+
+/**
+ * \brief Construct an allocator for the dma-heap of type \a type
+ * \param[in] type The type of dma-heap
+ */
+DmaHeapAllocator::DmaHeapAllocator(DmaHeap::Type type)
+	: heap_(type)
+{
+}
+
+DmaHeapAllocator::~DmaHeapAllocator()
+{
+	release();
+}
+
+/**
+ * \fn DmaHeapAllocator::isValid()
+ * \brief Check if the allocator can allocate buffers
+ * \return True if the dma-heap is available, false otherwise
+ */
+
+/**
+ * \brief Allocate buffers for the \a format
+ * \param[in] format The format describing the size of each plane
+ * \param[in] count The number of buffers to allocate
+ *
+ * Allocate \a count buffers and add them to the pool. Each buffer contains one
+ * dmabuf per plane in \a format, sized to the plane size rounded up to the page
+ * size. This method may be called multiple times to grow the pool.
+ *
+ * \return The index of the first allocated buffer on success, or a negative
+ * error code otherwise
+ */
+int DmaHeapAllocator::allocate(const V4L2DeviceFormat &format,
+			       unsigned int count)
+{
+	if (!format.planesCount || format.planesCount > 3)
+		return -EINVAL;
+
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	unsigned int first = buffers_.size();
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::array<int, 3> fds = { -1, -1, -1 };
+
+		for (unsigned int p = 0; p < format.planesCount; ++p) {
+			size_t size = (format.planes[p].size + pageSize - 1)
+				    / pageSize * pageSize;
+
+			int fd = heap_.alloc(size);
+			if (fd < 0) {
+				for (int other : fds) {
+					if (other >= 0)
+						::close(other);
+				}
+
+				return fd;
+			}
+
+			fds[p] = fd;
+		}
+
+		buffers_.push_back(fds);
+	}
+
+	LOG(DmaHeap, Debug)
+		<< "Allocated " << count << " buffers for " << format.toString();
+
+	return first;
+}
+
+/**
+ * \brief Free all buffers in the pool
+ *
+ * All Buffer instances created from the pool shall have been destroyed before
+ * calling this method.
+ */
+void DmaHeapAllocator::release()
+{
+	for (const std::array<int, 3> &fds : buffers_) {
+		for (int fd : fds) {
+			if (fd >= 0)
+				::close(fd);
+		}
+	}
+
+	buffers_.clear();
+}
+
+/**
+ * \fn DmaHeapAllocator::count()
+ * \brief Retrieve the number of buffers in the pool
+ * \return The number of buffers in the pool
+ */
+
+/**
+ * \fn DmaHeapAllocator::dmabufs()
+ * \brief Retrieve the dmabuf file descriptors of a buffer in the pool
+ * \param[in] index The buffer index
+ * \return The dmabuf file descriptors of buffer \a index, with unused entries
+ * set to -1
+ */
+
+/**
+ * \brief Create a Buffer for \a stream referencing the buffer \a index
+ * \param[in] stream The stream to create the buffer for
+ * \param[in] index The buffer index in the pool
+ *
+ * The \a stream shall use the ExternalMemory type.
+ *
+ * \return A newly created Buffer on success or nullptr otherwise
+ */
+std::unique_ptr<Buffer> DmaHeapAllocator::createBuffer(Stream *stream,
+						       unsigned int index)
+{
+	if (index >= buffers_.size()) {
+		LOG(DmaHeap, Error) << "Invalid buffer index " << index;
+		return nullptr;
+	}
+
+	return stream->createBuffer(buffers_[index]);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,360 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dmabuf_importer.cpp - Import of buffers in GPU APIs
+ */
+
+#include <libcamera/dmabuf_importer.h>
+
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#include "formats.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file dmabuf_importer.h
+ * \brief Description of buffers for zero-copy import in GPU APIs
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmabufImporter)
+
+namespace {
+
+/*
+ * The DRM format codes and the EGL_EXT_image_dma_buf_import tokens are ABI,
+ * they are defined here to avoid depending on the DRM and EGL headers.
+ */
+constexpr uint32_t drmFourcc(char a, char b, char c, char d)
+{
+	return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) |
+	       (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+constexpr uint64_t DrmFormatModLinear = 0;
+
+constexpr int32_t EglNone = 0x3038;
+constexpr int32_t EglHeight = 0x3056;
+constexpr int32_t EglWidth = 0x3057;
+constexpr int32_t EglLinuxDrmFourcc = 0x3271;
+constexpr int32_t EglDmaBufPlaneFd[] = { 0x3272, 0x3275, 0x3278 };
+constexpr int32_t EglDmaBufPlaneOffset[] = { 0x3273, 0x3276, 0x3279 };
+constexpr int32_t EglDmaBufPlanePitch[] = { 0x3274, 0x3277, 0x327a };
+constexpr int32_t EglDmaBufPlaneModifierLo[] = { 0x3443, 0x3445, 0x3447 };
+constexpr int32_t EglDmaBufPlaneModifierHi[] = { 0x3444, 0x3446, 0x3448 };
+
+struct DrmFormatMapping {
+	unsigned int v4l2Format;
+	uint32_t drmFormat;
+};
+
+/*
+ * V4L2 names RGB formats by the order of the components in memory, while DRM
+ * names them by the order of the components in a little-endian word. 8-bit
+ * and 16-bit greyscale and Bayer formats are imported as single component
+ * images, for processing by shaders.
+ */
+constexpr DrmFormatMapping drmFormats[] = {
+	{ V4L2_PIX_FMT_RGB565, drmFourcc('R', 'G', '1', '6') },
+	{ V4L2_PIX_FMT_BGR24, drmFourcc('R', 'G', '2', '4') },
+	{ V4L2_PIX_FMT_RGB24, drmFourcc('B', 'G', '2', '4') },
+	{ V4L2_PIX_FMT_ABGR32, drmFourcc('A', 'R', '2', '4') },
+	{ V4L2_PIX_FMT_ARGB32, drmFourcc('B', 'A', '2', '4') },
+	{ V4L2_PIX_FMT_XBGR32, drmFourcc('X', 'R', '2', '4') },
+	{ V4L2_PIX_FMT_XRGB32, drmFourcc('B', 'X', '2', '4') },
+	{ V4L2_PIX_FMT_YUYV, drmFourcc('Y', 'U', 'Y', 'V') },
+	{ V4L2_PIX_FMT_YVYU, drmFourcc('Y', 'V', 'Y', 'U') },
+	{ V4L2_PIX_FMT_UYVY, drmFourcc('U', 'Y', 'V', 'Y') },
+	{ V4L2_PIX_FMT_VYUY, drmFourcc('V', 'Y', 'U', 'Y') },
+	{ V4L2_PIX_FMT_NV12, drmFourcc('N', 'V', '1', '2') },
+	{ V4L2_PIX_FMT_NV21, drmFourcc('N', 'V', '2', '1') },
+	{ V4L2_PIX_FMT_NV12M, drmFourcc('N', 'V', '1', '2') },
+	{ V4L2_PIX_FMT_NV21M, drmFourcc('N', 'V', '2', '1') },
+	{ V4L2_PIX_FMT_NV16, drmFourcc('N', 'V', '1', '6') },
+	{ V4L2_PIX_FMT_NV61, drmFourcc('N', 'V', '6', '1') },
+	{ V4L2_PIX_FMT_NV16M, drmFourcc('N', 'V', '1', '6') },
+	{ V4L2_PIX_FMT_NV61M, drmFourcc('N', 'V', '6', '1') },
+	{ V4L2_PIX_FMT_NV24, drmFourcc('N', 'V', '2', '4') },
+	{ V4L2_PIX_FMT_NV42, drmFourcc('N', 'V', '4', '2') },
+	{ V4L2_PIX_FMT_YUV420, drmFourcc('Y', 'U', '1', '2') },
+	{ V4L2_PIX_FMT_YVU420, drmFourcc('Y', 'V', '1', '2') },
+	{ V4L2_PIX_FMT_YUV420M, drmFourcc('Y', 'U', '1', '2') },
+	{ V4L2_PIX_FMT_YVU420M, drmFourcc('Y', 'V', '1', '2') },
+	{ V4L2_PIX_FMT_YUV422P, drmFourcc('Y', 'U', '1', '6') },
+	{ V4L2_PIX_FMT_YUV422M, drmFourcc('Y', 'U', '1', '6') },
+	{ V4L2_PIX_FMT_YVU422M, drmFourcc('Y', 'V', '1', '6') },
+	{ V4L2_PIX_FMT_YUV444M, drmFourcc('Y', 'U', '2', '4') },
+	{ V4L2_PIX_FMT_YVU444M, drmFourcc('Y', 'V', '2', '4') },
+	{ V4L2_PIX_FMT_GREY, drmFourcc('R', '8', ' ', ' ') },
+	{ V4L2_PIX_FMT_Y16, drmFourcc('R', '1', '6', ' ') },
+	{ V4L2_PIX_FMT_SBGGR8, drmFourcc('R', '8', ' ', ' ') },
+	{ V4L2_PIX_FMT_SGBRG8, drmFourcc('R', '8', ' ', ' ') },
+	{ V4L2_PIX_FMT_SGRBG8, drmFourcc('R', '8', ' ', ' ') },
+	{ V4L2_PIX_FMT_SRGGB8, drmFourcc('R', '8', ' ', ' ') },
+	{ V4L2_PIX_FMT_SBGGR16, drmFourcc('R', '1', '6', ' ') },
+	{ V4L2_PIX_FMT_SGBRG16, drmFourcc('R', '1', '6', ' ') },
+	{ V4L2_PIX_FMT_SGRBG16, drmFourcc('R', '1', '6', ' ') },
+	{ V4L2_PIX_FMT_SRGGB16, drmFourcc('R', '1', '6', ' ') },
+};
+
+} /* namespace */
+
+/**
+ * \struct DmabufPlaneLayout
+ * \brief The memory layout of an image plane in a dmabuf
+ *
+ * The plane layout fields map directly to the EGL_EXT_image_dma_buf_import
+ * plane attributes, and to the VkSubresourceLayout used to import dmabufs with
+ * VK_EXT_image_drm_format_modifier.
+ *
+ * \var DmabufPlaneLayout::fd
+ * \brief The dmabuf file descriptor containing the plane
+ *
+ * \var DmabufPlaneLayout::offset
+ * \brief The offset of the plane from the start of the dmabuf, in bytes
+ *
+ * \var DmabufPlaneLayout::pitch
+ * \brief The line stride of the plane, in bytes
+ *
+ * \var DmabufPlaneLayout::size
+ * \brief The size of the plane, in bytes
+ */
+
+/**
+ * \struct DmabufImage
+ * \brief The description of a buffer for import in GPU APIs
+ *
+ * \var DmabufImage::drmFormat
+ * \brief The DRM format code of the image
+ *
+ * \var DmabufImage::modifier
+ * \brief The DRM format modifier of the image
+ *
+ * The modifier is the one selected in the stream configuration, and defaults to
+ * DRM_FORMAT_MOD_LINEAR.
+ *
+ * \var DmabufImage::size
+ * \brief The image size, in pixels
+ *
+ * \var DmabufImage::numPlanes
+ * \brief The number of valid entries in the planes array
+ *
+ * \var DmabufImage::planes
+ * \brief The memory layout of the image planes
+ */
+
+/**
+ * \brief Build the attributes list to import the image as an EGLImage
+ *
+ * The attributes list is terminated by EGL_NONE, and is meant to be passed to
+ * eglCreateImageKHR() with the EGL_LINUX_DMA_BUF_EXT target. The modifier is
+ * only included when not linear, as the linear layout is implied otherwise,
+ * which avoids requiring the EGL_EXT_image_dma_buf_import_modifiers
+ * extension.
+ *
+ * \return The EGL attributes list
+ */
+std::vector<int32_t> DmabufImage::eglAttributes() const
+{
+	std::vector<int32_t> attribs = {
+		EglWidth, static_cast<int32_t>(size.width),
+		EglHeight, static_cast<int32_t>(size.height),
+		EglLinuxDrmFourcc, static_cast<int32_t>(drmFormat),
+	};
+
+	for (unsigned int i = 0; i < numPlanes && i < planes.size(); ++i) {
+		const DmabufPlaneLayout &plane = planes[i];
+
+		attribs.insert(attribs.end(), {
+			EglDmaBufPlaneFd[i], plane.fd,
+			EglDmaBufPlaneOffset[i], static_cast<int32_t>(plane.offset),
+			EglDmaBufPlanePitch[i], static_cast<int32_t>(plane.pitch),
+		});
+
+		if (modifier != DrmFormatModLinear)
+			attribs.insert(attribs.end(), {
+				EglDmaBufPlaneModifierLo[i], static_cast<int32_t>(modifier & 0xffffffff),
+				EglDmaBufPlaneModifierHi[i], static_cast<int32_t>(modifier >> 32),
+			});
+	}
+
+	attribs.push_back(EglNone);
+
+	return attribs;
+}
+
+/**
+ * \class DmabufImporter
+ * \brief Describe the buffers of a stream for zero-copy import in GPU APIs
+ *
+ * Importing a dmabuf in EGL or Vulkan requires the DRM format code of the image
+ * and the offset and stride of each of its planes, which differ between the
+ * contiguous single-planar formats such as NV12 and the multi-planar formats
+ * such as NV12M. The DmabufImporter computes them from the stream
+ * configuration once, and then describes each buffer of the stream as a
+ * DmabufImage without any memory access.
+ *
+ * The plane strides are computed without padding, as produced by the pipeline
+ * handlers for the supported formats.
+ */
+
+DmabufImporter::DmabufImporter()
+	: drmFormat_(0), modifier_(DrmFormatModLinear), numPlanes_(0),
+	  pitches_{}, sizes_{}
+{
+}
+
+/**
+ * \brief Configure the importer for the buffers of a stream
+ * \param[in] cfg The stream configuration
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The pixel format has no DRM equivalent
+ */
+int DmabufImporter::configure(const StreamConfiguration &cfg)
+{
+	return configure(cfg.pixelFormat, cfg.size, cfg.modifier);
+}
+
+/**
+ * \brief Configure the importer for a pixel format and size
+ * \param[in] format The V4L2 pixel format fourcc
+ * \param[in] size The image size, in pixels
+ * \param[in] modifier The DRM format modifier
+ *
+ * The plane layout of non-linear \a modifier values is defined by the
+ * modifier, the pitches and sizes computed for the linear layout are then
+ * only indicative.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The pixel format has no DRM equivalent
+ */
+int DmabufImporter::configure(unsigned int format, const Size &size,
+			      uint64_t modifier)
+{
+	drmFormat_ = 0;
+	modifier_ = modifier;
+	numPlanes_ = 0;
+
+	for (const DrmFormatMapping &mapping : drmFormats) {
+		if (mapping.v4l2Format == format) {
+			drmFormat_ = mapping.drmFormat;
+			break;
+		}
+	}
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(format);
+	if (!drmFormat_ || !info.isValid()) {
+		LOG(DmabufImporter, Error)
+			<< "Unsupported pixel format " << utils::hex(format);
+		drmFormat_ = 0;
+		return -EINVAL;
+	}
+
+	size_ = size;
+	numPlanes_ = info.numPlanes();
+
+	for (unsigned int i = 0; i < numPlanes_; ++i) {
+		pitches_[i] = info.stride(size.width, i);
+		sizes_[i] = info.planeSize(size.height, i, pitches_[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * \fn DmabufImporter::drmFormat()
+ * \brief Retrieve the DRM format code of the images
+ * \return The DRM format code, or 0 if the importer isn't configured
+ */
+
+/**
+ * \brief Describe a buffer of the stream
+ * \param[in] buffer The buffer
+ * \param[out] image The image description
+ *
+ * The dmabufs are taken from the \a buffer for streams using external memory,
+ * and from the buffer memory otherwise. The latter is only associated with the
+ * \a buffer from the time it is queued to the end of its request completion
+ * handler. The data offset of each plane reported by the buffer is taken into
+ * account.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The importer isn't configured or the buffer has no dmabuf
+ */
+int DmabufImporter::describe(Buffer *buffer, DmabufImage *image) const
+{
+	std::array<int, 3> fds = buffer->dmabufs();
+
+	if (fds[0] < 0 && buffer->mem()) {
+		const PlaneArray &planes = buffer->mem()->planes();
+		for (unsigned int i = 0; i < fds.size(); ++i)
+			fds[i] = i < planes.size() ? planes[i].dmabuf() : -1;
+	}
+
+	int ret = describe(fds, image);
+	if (ret)
+		return ret;
+
+	const std::array<unsigned int, 3> &offsets = buffer->planesOffset();
+	for (unsigned int i = 0; i < image->numPlanes; ++i) {
+		DmabufPlaneLayout &plane = image->planes[i];
+		plane.offset += plane.fd == fds[0] ? offsets[0] : offsets[i];
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Describe an image stored in dmabufs
+ * \param[in] fds The dmabuf file descriptors for each plane
+ * \param[out] image The image description
+ *
+ * Unused entries of \a fds shall be set to -1. Planes without a dmabuf are
+ * stored contiguously in the dmabuf of the first plane.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The importer isn't configured or \a fds has no dmabuf
+ */
+int DmabufImporter::describe(const std::array<int, 3> &fds,
+			     DmabufImage *image) const
+{
+	if (!drmFormat_ || fds[0] < 0)
+		return -EINVAL;
+
+	image->drmFormat = drmFormat_;
+	image->modifier = modifier_;
+	image->size = size_;
+	image->numPlanes = numPlanes_;
+	image->planes = {};
+
+	unsigned int offset = 0;
+
+	for (unsigned int i = 0; i < numPlanes_; ++i) {
+		DmabufPlaneLayout &plane = image->planes[i];
+
+		if (i && fds[i] >= 0) {
+			plane.fd = fds[i];
+			plane.offset = 0;
+		} else {
+			plane.fd = fds[0];
+			plane.offset = offset;
+			offset += sizes_[i];
+		}
+
+		plane.pitch = pitches_[i];
+		plane.size = sizes_[i];
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * embedded_data.cpp - Camera sensor embedded data parsers
+ */
+
+#include "embedded_data.h"
+
+#include <errno.h>
+#include <vector>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file embedded_data.h
+ * \brief Camera sensor embedded data parsers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(EmbeddedData)
+
+namespace {
+
+/* SMIA/CCS embedded data line format code and tags. */
+constexpr uint8_t SMIA_FORMAT_CODE = 0x0a;
+constexpr uint8_t SMIA_TAG_ADDRESS_MSB = 0xaa;
+constexpr uint8_t SMIA_TAG_ADDRESS_LSB = 0xa5;
+constexpr uint8_t SMIA_TAG_DATA = 0x5a;
+constexpr uint8_t SMIA_TAG_SKIP = 0x55;
+constexpr uint8_t SMIA_TAG_END = 0x07;
+
+struct SensorLayout {
+	const char *name;
+	SmiaEmbeddedDataParser::Layout layout;
+};
+
+const SensorLayout sensorLayouts[] = {
+	{ "imx219", { 10, { 0x015a, 2 }, { 0x0157, 1 }, { 0x0160, 2 } } },
+	{ "imx477", { 12, { 0x0202, 2 }, { 0x0204, 2 }, { 0x0340, 2 } } },
+};
+
+} /* namespace */
+
+/**
+ * \struct SensorMetadata
+ * \brief Sensor settings a frame has been captured with
+ *
+ * \var SensorMetadata::exposure
+ * \brief The exposure time, in lines
+ *
+ * \var SensorMetadata::gain
+ * \brief The analogue gain, in the sensor gain code units
+ *
+ * \var SensorMetadata::frameLength
+ * \brief The frame length, in lines
+ */
+
+/**
+ * \class EmbeddedDataParser
+ * \brief Interface to parse the embedded data lines of a camera sensor
+ *
+ * Many camera sensors can output, alongside the image data, embedded data
+ * lines that describe the settings each frame has been captured with. The
+ * format of the embedded data is sensor-specific, each supported sensor
+ * provides an implementation of this interface to extract the settings in a
+ * SensorMetadata structure.
+ */
+
+/**
+ * \brief Create the embedded data parser for a camera sensor
+ * \param[in] sensor The name of the camera sensor entity
+ *
+ * The parser is selected by the sensor model, taken as the first word of
+ * the entity name.
+ *
+ * \return The parser for \a sensor, or nullptr if the sensor isn't supported
+ */
+std::unique_ptr<EmbeddedDataParser> EmbeddedDataParser::create(const std::string &sensor)
+{
+	std::string model = sensor.substr(0, sensor.find(' '));
+
+	for (const SensorLayout &layout : sensorLayouts) {
+		if (model == layout.name)
+			return utils::make_unique<SmiaEmbeddedDataParser>(layout.layout);
+	}
+
+	return nullptr;
+}
+
+/**
+ * \fn EmbeddedDataParser::parse()
+ * \brief Parse embedded data lines
+ * \param[in] data The embedded data
+ * \param[in] size The size of the \a data in bytes
+ * \param[out] metadata The sensor settings of the frame
+ * \return 0 on success or a negative error code otherwise
+ */
+
+/**
+ * \class SmiaEmbeddedDataParser
+ * \brief Embedded data parser for SMIA and CCS compliant sensors
+ *
+ * SMIA and CCS sensors output their registers in the embedded data lines as a
+ * sequence of tagged bytes that set the register address and then carry the
+ * values of consecutive registers. The parser is configured with the layout of
+ * the registers that hold the settings reported in the SensorMetadata.
+ */
+
+/**
+ * \struct SmiaEmbeddedDataParser::Register
+ * \brief Location of a multi-byte big endian register
+ *
+ * \var SmiaEmbeddedDataParser::Register::address
+ * \brief The address of the most significant byte of the register
+ *
+ * \var SmiaEmbeddedDataParser::Register::size
+ * \brief The size of the register in bytes
+ */
+
+/**
+ * \struct SmiaEmbeddedDataParser::Layout
+ * \brief Embedded data layout of a sensor
+ *
+ * \var SmiaEmbeddedDataParser::Layout::bitsPerSample
+ * \brief The bits per sample the embedded data lines are packed with, as
+ * for the image data format
+ *
+ * \var SmiaEmbeddedDataParser::Layout::exposure
+ * \brief The exposure register
+ *
+ * \var SmiaEmbeddedDataParser::Layout::gain
+ * \brief The analogue gain register
+ *
+ * \var SmiaEmbeddedDataParser::Layout::frameLength
+ * \brief The frame length register
+ */
+
+/**
+ * \brief Construct a parser for the embedded data \a layout
+ * \param[in] layout The embedded data layout
+ */
+SmiaEmbeddedDataParser::SmiaEmbeddedDataParser(const Layout &layout)
+	: layout_(layout)
+{
+}
+
+int SmiaEmbeddedDataParser::parse(const uint8_t *data, size_t size,
+				  SensorMetadata *metadata) const
+{
+	std::map<uint16_t, uint8_t> registers;
+	int ret = parseRegisters(data, size, &registers);
+	if (ret)
+		return ret;
+
+	ret = value(registers, layout_.exposure, &metadata->exposure);
+	if (ret)
+		return ret;
+
+	ret = value(registers, layout_.gain, &metadata->gain);
+	if (ret)
+		return ret;
+
+	return value(registers, layout_.frameLength, &metadata->frameLength);
+}
+
+/*
+ * Unpack the embedded data bytes and decode the tags to retrieve the values of
+ * the registers.
+ */
+int SmiaEmbeddedDataParser::parseRegisters(const uint8_t *data, size_t size,
+					   std::map<uint16_t, uint8_t> *registers) const
+{
+	/*
+	 * Packed formats store the least significant bits of a group of
+	 * samples in an extra byte after the group, which carries no embedded
+	 * data.
+	 */
+	unsigned int group;
+	switch (layout_.bitsPerSample) {
+	case 10:
+		group = 4;
+		break;
+	case 12:
+		group = 2;
+		break;
+	default:
+		group = 0;
+		break;
+	}
+
+	std::vector<uint8_t> bytes;
+	bytes.reserve(size);
+	for (size_t i = 0; i < size; ++i) {
+		if (group && i % (group + 1) == group)
+			continue;
+		bytes.push_back(data[i]);
+	}
+
+	if (bytes.empty() || bytes[0] != SMIA_FORMAT_CODE) {
+		LOG(EmbeddedData, Debug) << "Invalid embedded data format code";
+		return -EINVAL;
+	}
+
+	uint16_t address = 0;
+
+	for (size_t i = 1; i + 1 < bytes.size(); i += 2) {
+		uint8_t tag = bytes[i];
+		uint8_t byte = bytes[i + 1];
+
+		switch (tag) {
+		case SMIA_TAG_ADDRESS_MSB:
+			address = (address & 0x00ff) | (byte << 8);
+			break;
+		case SMIA_TAG_ADDRESS_LSB:
+			address = (address & 0xff00) | byte;
+			break;
+		case SMIA_TAG_DATA:
+			(*registers)[address++] = byte;
+			break;
+		case SMIA_TAG_SKIP:
+			address++;
+			break;
+		case SMIA_TAG_END:
+			return 0;
+		default:
+			LOG(EmbeddedData, Debug)
+				<< "Invalid embedded data tag "
+				<< utils::hex<uint32_t>(tag, 2);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int SmiaEmbeddedDataParser::value(const std::map<uint16_t, uint8_t> &registers,
+				  const Register &reg, uint32_t *value) const
+{
+	uint32_t result = 0;
+
+	for (unsigned int i = 0; i < reg.size; ++i) {
+		auto it = registers.find(reg.address + i);
+		if (it == registers.end()) {
+			LOG(EmbeddedData, Debug)
+				<< "Register " << utils::hex<uint32_t>(reg.address + i, 4)
+				<< " missing from embedded data";
+			return -ENOENT;
+		}
+
+		result = (result << 8) | it->second;
+	}
+
+	*value = result;
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,344 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * encoder_libjpeg.cpp - JPEG encoding using libjpeg
+ */
+
+#include "encoder_libjpeg.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+#include <linux/videodev2.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file encoder_libjpeg.h
+ * \brief JPEG encoding using libjpeg
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(JPEG)
+
+namespace {
+
+struct ErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf escape;
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+	char message[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(JPEG, Debug) << "Encode error: " << message;
+
+	longjmp(err->escape, 1);
+}
+
+void outputMessage(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(JPEG, Debug) << message;
+}
+
+/*
+ * Compress to a fixed memory area. Unlike jpeg_mem_dest(), running out of
+ * space is an error instead of a reallocation, as the destination is a
+ * buffer provided by the caller, such as a gralloc buffer of the camera
+ * framework.
+ */
+struct DestinationManager {
+	struct jpeg_destination_mgr pub;
+	uint8_t *buffer;
+	size_t size;
+};
+
+void initDestination(j_compress_ptr cinfo)
+{
+	DestinationManager *dest = reinterpret_cast<DestinationManager *>(cinfo->dest);
+
+	dest->pub.next_output_byte = dest->buffer;
+	dest->pub.free_in_buffer = dest->size;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo)
+{
+	ERREXIT(cinfo, JERR_BUFFER_SIZE);
+	return FALSE;
+}
+
+void termDestination(j_compress_ptr cinfo)
+{
+}
+
+} /* namespace */
+
+struct EncoderLibJpeg::Context {
+	struct jpeg_compress_struct cinfo;
+	ErrorManager err;
+	DestinationManager dest;
+};
+
+/**
+ * \class EncoderLibJpeg
+ * \brief Encode YUV and RGB frames to JPEG with libjpeg
+ *
+ * The encoder compresses semi-planar and packed YUV frames, as well as packed
+ * RGB frames, optionally downscaled with nearest neighbour sampling, which
+ * allows using the same encoder for thumbnails. The input planes are repacked
+ * line by line to interleaved YCbCr or RGB, leaving colour conversion, chroma
+ * subsampling, DCT and entropy coding to libjpeg, whose libjpeg-turbo
+ * implementation accelerates them with SIMD.
+ *
+ * An encoder compresses one image at a time. Callers encoding frames
+ * concurrently shall use one encoder per thread.
+ */
+
+EncoderLibJpeg::EncoderLibJpeg()
+	: context_(new Context()), pixelFormat_(0), rgb_(false), packed_(false),
+	  vertSubSample_(1), swap_(false), yPos_(0), cbPos_(0)
+{
+	struct jpeg_compress_struct *cinfo = &context_->cinfo;
+
+	cinfo->err = jpeg_std_error(&context_->err.pub);
+	context_->err.pub.error_exit = errorExit;
+	context_->err.pub.output_message = outputMessage;
+
+	jpeg_create_compress(cinfo);
+
+	context_->dest.pub.init_destination = initDestination;
+	context_->dest.pub.empty_output_buffer = emptyOutputBuffer;
+	context_->dest.pub.term_destination = termDestination;
+	cinfo->dest = &context_->dest.pub;
+}
+
+EncoderLibJpeg::~EncoderLibJpeg()
+{
+	jpeg_destroy_compress(&context_->cinfo);
+}
+
+/**
+ * \brief Configure the encoder
+ * \param[in] inputSize The size of the frames to encode
+ * \param[in] pixelFormat The pixel format of the frames, as a V4L2 fourcc
+ * \param[in] outputSize The size of the JPEG images
+ * \param[in] quality The JPEG quality, from 1 to 100
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a pixelFormat or sizes aren't supported
+ */
+int EncoderLibJpeg::configure(const Size &inputSize, unsigned int pixelFormat,
+			      const Size &outputSize, int quality)
+{
+	if (!inputSize.width || !inputSize.height || inputSize.width % 2 ||
+	    !outputSize.width || !outputSize.height) {
+		LOG(JPEG, Error)
+			<< "Invalid frame size " << inputSize.toString()
+			<< " -> " << outputSize.toString();
+		return -EINVAL;
+	}
+
+	rgb_ = false;
+	packed_ = false;
+	vertSubSample_ = 1;
+	swap_ = false;
+	yPos_ = 0;
+	cbPos_ = 0;
+
+	switch (pixelFormat) {
+	case V4L2_PIX_FMT_NV21:
+		swap_ = true;
+		/* fall through */
+	case V4L2_PIX_FMT_NV12:
+		vertSubSample_ = 2;
+		break;
+	case V4L2_PIX_FMT_NV61:
+		swap_ = true;
+		/* fall through */
+	case V4L2_PIX_FMT_NV16:
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		packed_ = true;
+		cbPos_ = 1;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		packed_ = true;
+		cbPos_ = 3;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		packed_ = true;
+		yPos_ = 1;
+		break;
+	case V4L2_PIX_FMT_VYUY:
+		packed_ = true;
+		yPos_ = 1;
+		cbPos_ = 2;
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		swap_ = true;
+		/* fall through */
+	case V4L2_PIX_FMT_RGB24:
+		rgb_ = true;
+		break;
+	default:
+		LOG(JPEG, Error)
+			<< "Unsupported input format "
+			<< utils::hex<uint32_t>(pixelFormat, 8);
+		return -EINVAL;
+	}
+
+	struct jpeg_compress_struct *cinfo = &context_->cinfo;
+
+	cinfo->image_width = outputSize.width;
+	cinfo->image_height = outputSize.height;
+	cinfo->input_components = 3;
+	cinfo->in_color_space = rgb_ ? JCS_RGB : JCS_YCbCr;
+
+	/* The compression parameters are kept across images. */
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, quality, TRUE);
+
+	/* Precompute the horizontal sampling positions. */
+	columns_.resize(outputSize.width);
+	for (unsigned int x = 0; x < outputSize.width; ++x)
+		columns_[x] = x * inputSize.width / outputSize.width;
+
+	row_.resize(outputSize.width * 3);
+
+	inputSize_ = inputSize;
+	outputSize_ = outputSize;
+	pixelFormat_ = pixelFormat;
+
+	return 0;
+}
+
+/**
+ * \fn EncoderLibJpeg::outputSize()
+ * \brief Retrieve the size of the JPEG images
+ * \return The output size set by configure()
+ */
+
+/**
+ * \brief Encode a frame
+ * \param[in] luma The luma plane, or the whole frame for packed formats
+ * \param[in] chroma The chroma plane, ignored for packed formats
+ * \param[out] dst The memory to store the JPEG image
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ * \param[in] exif The EXIF data
+ *
+ * The \a exif data, if not empty, is stored in an APP1 segment in place of
+ * the JFIF header.
+ *
+ * \return The size of the JPEG image in bytes on success, or a negative error
+ * code otherwise
+ * \retval -EINVAL The encoder isn't configured or the frame is invalid
+ * \retval -ENOSPC The image doesn't fit in \a dstSize bytes
+ */
+int EncoderLibJpeg::encode(const uint8_t *luma, const uint8_t *chroma,
+			   uint8_t *dst, size_t dstSize,
+			   const std::vector<uint8_t> &exif)
+{
+	if (!pixelFormat_)
+		return -EINVAL;
+
+	return compress(luma, chroma, dst, dstSize, exif);
+}
+
+/*
+ * Run the libjpeg compression. This is kept separate from encode() as libjpeg
+ * reports errors with longjmp(), which must not skip over the destruction of
+ * C++ objects or clobber local variables of the caller.
+ */
+int EncoderLibJpeg::compress(const uint8_t *luma, const uint8_t *chroma,
+			     uint8_t *dst, size_t dstSize,
+			     const std::vector<uint8_t> &exif)
+{
+	struct jpeg_compress_struct *cinfo = &context_->cinfo;
+
+	if (setjmp(context_->err.escape)) {
+		int code = cinfo->err->msg_code;
+		jpeg_abort_compress(cinfo);
+		return code == JERR_BUFFER_SIZE ? -ENOSPC : -EINVAL;
+	}
+
+	context_->dest.buffer = dst;
+	context_->dest.size = dstSize;
+
+	cinfo->write_JFIF_header = exif.empty() ? TRUE : FALSE;
+
+	jpeg_start_compress(cinfo, TRUE);
+
+	if (!exif.empty())
+		jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif.data(), exif.size());
+
+	while (cinfo->next_scanline < outputSize_.height) {
+		JSAMPROW rows[1] = { row_.data() };
+
+		packRow(luma, chroma, cinfo->next_scanline);
+		jpeg_write_scanlines(cinfo, rows, 1);
+	}
+
+	jpeg_finish_compress(cinfo);
+
+	return dstSize - context_->dest.pub.free_in_buffer;
+}
+
+/* Pack an output line to interleaved YCbCr 4:4:4 or RGB. */
+void EncoderLibJpeg::packRow(const uint8_t *luma, const uint8_t *chroma,
+			     unsigned int line)
+{
+	unsigned int y = line * inputSize_.height / outputSize_.height;
+	uint8_t *dst = row_.data();
+
+	if (rgb_) {
+		const uint8_t *src = luma + y * inputSize_.width * 3;
+		unsigned int rPos = swap_ ? 2 : 0;
+
+		for (unsigned int x : columns_) {
+			const uint8_t *pixel = src + x * 3;
+
+			dst[0] = pixel[rPos];
+			dst[1] = pixel[1];
+			dst[2] = pixel[rPos ^ 2];
+			dst += 3;
+		}
+	} else if (packed_) {
+		const uint8_t *src = luma + y * inputSize_.width * 2;
+		unsigned int crPos = cbPos_ ^ 2;
+
+		for (unsigned int x : columns_) {
+			const uint8_t *pair = src + x / 2 * 4;
+
+			dst[0] = pair[yPos_ + (x % 2) * 2];
+			dst[1] = pair[cbPos_];
+			dst[2] = pair[crPos];
+			dst += 3;
+		}
+	} else {
+		const uint8_t *src = luma + y * inputSize_.width;
+		const uint8_t *uv = chroma + y / vertSubSample_ * inputSize_.width;
+
+		for (unsigned int x : columns_) {
+			const uint8_t *pair = uv + x / 2 * 2;
+
+			dst[0] = src[x];
+			dst[1] = pair[swap_];
+			dst[2] = pair[!swap_];
+			dst += 3;
+		}
+	}
+}
+
+} /* namespace libcamera */
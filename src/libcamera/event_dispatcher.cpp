@@ -7,6 +7,8 @@
 
 #include <libcamera/event_dispatcher.h>
 
+#include <libcamera/event_notifier.h>
+
 #include "log.h"
 
 /**
@@ -28,7 +30,9 @@ LOG_DEFINE_CATEGORY(Event)
  * To listen to events, libcamera creates EventNotifier instances and registers
  * them with the dispatcher with registerEventNotifier(). The event notifier
  * \ref EventNotifier::activated signal is then emitted by the dispatcher
- * whenever the event is detected.
+ * whenever the event is detected, as long as the notifier is enabled. Enabling
+ * and disabling a notifier is reported to the dispatcher with
+ * updateEventNotifier().
  *
  * To set timers, libcamera creates Timer instances and registers them with the
  * dispatcher with registerTimer(). The timer \ref Timer::timeout signal is then
@@ -46,9 +50,13 @@ EventDispatcher::~EventDispatcher()
  *
  * Once the \a notifier is registered with the dispatcher, the dispatcher will
  * emit the notifier \ref EventNotifier::activated signal whenever a
- * corresponding event is detected on the notifier's file descriptor. The event
- * is monitored until the notifier is unregistered with
- * unregisterEventNotifier().
+ * corresponding event is detected on the notifier's file descriptor while the
+ * notifier is enabled. The event is monitored until the notifier is
+ * unregistered with unregisterEventNotifier().
+ *
+ * Notifiers are registered when they are created, and unregistered when they
+ * are destroyed or moved to a different thread. They stay registered while
+ * they are disabled.
  *
  * Registering multiple notifiers for the same file descriptor and event type is
  * not allowed and results in undefined behaviour.
@@ -65,6 +73,29 @@ EventDispatcher::~EventDispatcher()
  * If the notifier isn't registered, this function performs no operation.
  */
 
+/**
+ * \brief Update the monitoring of an event notifier after it has been enabled
+ * or disabled
+ * \param[in] notifier The event notifier
+ *
+ * This function is called when a registered \a notifier is enabled or
+ * disabled, and shall start or stop monitoring its event according to
+ * EventNotifier::enabled(). As notifiers are commonly toggled for every
+ * buffer queued to or dequeued from a device, dispatchers should override it
+ * with an implementation that doesn't allocate memory.
+ *
+ * The default implementation registers enabled notifiers and unregisters
+ * disabled notifiers, for dispatchers that only monitor the events of the
+ * registered notifiers.
+ */
+void EventDispatcher::updateEventNotifier(EventNotifier *notifier)
+{
+	if (notifier->enabled())
+		registerEventNotifier(notifier);
+	else
+		unregisterEventNotifier(notifier);
+}
+
 /**
  * \fn EventDispatcher::registerTimer()
  * \brief Register a timer
@@ -0,0 +1,374 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include "event_dispatcher_epoll.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "log.h"
+#include "thread.h"
+
+/**
+ * \file event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+namespace {
+
+const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+const struct {
+	EventNotifier::Type type;
+	uint32_t events;
+} notifierEvents[] = {
+	{ EventNotifier::Read, EPOLLIN },
+	{ EventNotifier::Write, EPOLLOUT },
+	{ EventNotifier::Exception, EPOLLPRI },
+};
+
+} /* namespace */
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll keeps the file descriptors of the enabled event
+ * notifiers registered with the kernel, and only updates the registration when
+ * notifiers are registered, unregistered, enabled or disabled. Enabling or
+ * disabling a notifier modifies the kernel registration in place, without
+ * allocating memory, and file descriptors whose notifiers are all disabled are
+ * removed from the epoll instance until a notifier is enabled again, so that
+ * error and hang-up conditions don't wake up the dispatcher. Each registration
+ * points to the
+ * set of notifiers for its file descriptor, which is dispatched directly when
+ * the file descriptor is ready. The cost of waiting for events is thus
+ * independent of the number of file descriptors, unlike with
+ * EventDispatcherPoll that rebuilds its pollfd array for every iteration.
+ *
+ * The dispatcher can be installed on a thread with Thread::setEventDispatcher(),
+ * or selected as the default dispatcher for all threads by setting the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable to "epoll".
+ *
+ * Timers are stored in a TimerQueue, whose timerfd is registered with the
+ * epoll instance along with the file descriptors of the event notifiers.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: processingEvents_(false)
+{
+	/*
+	 * Create the epoll and event fds. Failures are fatal as we can't
+	 * implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll fd";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	/*
+	 * The eventfd and timerfd are identified by a null pointer and a
+	 * pointer to the timer queue respectively.
+	 */
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, eventfd_, &event) < 0)
+		LOG(Event, Fatal) << "Unable to register eventfd";
+
+	event.data.ptr = &timers_;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, timers_.fd(), &event) < 0)
+		LOG(Event, Fatal) << "Unable to register timerfd";
+
+	events_.resize(8);
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	int fd = notifier->fd();
+	EventNotifier::Type type = notifier->type();
+
+	auto iter = notifiers_.find(fd);
+	if (iter == notifiers_.end())
+		iter = notifiers_.insert({ fd, { fd, false, {} } }).first;
+
+	EventNotifierSetEpoll &set = iter->second;
+
+	if (set.notifiers[type]) {
+		if (set.notifiers[type] != notifier)
+			LOG(Event, Warning)
+				<< "Ignoring duplicate " << notifierType(type)
+				<< " notifier for fd " << fd;
+		return;
+	}
+
+	set.notifiers[type] = notifier;
+
+	int ret = update(&set);
+	if (ret < 0) {
+		LOG(Event, Warning)
+			<< "Failed to register " << notifierType(type)
+			<< " notifier for fd " << fd << ": " << strerror(-ret);
+
+		set.notifiers[type] = nullptr;
+		if (!set.empty())
+			return;
+
+		if (processingEvents_)
+			unregistered_.push_back(fd);
+		else
+			notifiers_.erase(iter);
+		return;
+	}
+
+	if (events_.size() < notifiers_.size() + 2)
+		events_.resize(notifiers_.size() * 2);
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	set.notifiers[type] = nullptr;
+	update(&set);
+
+	if (!set.empty())
+		return;
+
+	/*
+	 * Don't race with event processing if this method is called from an
+	 * event notifier, the set may be referenced by pending events. The
+	 * notifiers_ entry will be erased by processEvents().
+	 */
+	if (processingEvents_) {
+		unregistered_.push_back(iter->first);
+		return;
+	}
+
+	notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::updateEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	if (set.notifiers[notifier->type()] != notifier)
+		return;
+
+	int ret = update(&set);
+	if (ret < 0)
+		LOG(Event, Warning)
+			<< "Failed to update " << notifierType(notifier->type())
+			<< " notifier for fd " << set.fd << ": "
+			<< strerror(-ret);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/* Wait for events and process notifiers and timers. */
+	do {
+		ret = wait();
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning)
+			<< "epoll_wait() failed with " << strerror(-ret);
+	} else if (ret > 0) {
+		processNotifiers(ret);
+	}
+
+	timers_.process();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	for (const auto &event : notifierEvents) {
+		EventNotifier *notifier = notifiers[event.type];
+		if (notifier && notifier->enabled())
+			events |= event.events;
+	}
+
+	return events;
+}
+
+bool EventDispatcherEpoll::EventNotifierSetEpoll::empty() const
+{
+	return !notifiers[0] && !notifiers[1] && !notifiers[2];
+}
+
+/*
+ * Bring the kernel registration of a set of notifiers in sync with the enabled
+ * notifiers. The registration is modified in place when the events change, and
+ * removed when no notifier is enabled.
+ */
+int EventDispatcherEpoll::update(EventNotifierSetEpoll *set)
+{
+	struct epoll_event event = {};
+	event.events = set->events();
+	event.data.ptr = set;
+
+	if (!event.events) {
+		if (!set->registered)
+			return 0;
+
+		/*
+		 * The fd may have been closed already, in which case the
+		 * kernel has dropped the registration and removing it fails.
+		 */
+		epoll_ctl(epollfd_, EPOLL_CTL_DEL, set->fd, &event);
+		set->registered = false;
+
+		return 0;
+	}
+
+	int op = set->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(epollfd_, op, set->fd, &event) < 0)
+		return -errno;
+
+	set->registered = true;
+
+	return 0;
+}
+
+int EventDispatcherEpoll::wait()
+{
+	/* The timers are handled through the timerfd, wait without timeout. */
+	timers_.arm();
+
+	return epoll_wait(epollfd_, events_.data(), events_.size(), -1);
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(unsigned int count)
+{
+	processingEvents_ = true;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const struct epoll_event &event = events_[i];
+
+		if (!event.data.ptr) {
+			processInterrupt();
+			continue;
+		}
+
+		if (event.data.ptr == &timers_) {
+			timers_.acknowledge();
+			continue;
+		}
+
+		EventNotifierSetEpoll *set =
+			static_cast<EventNotifierSetEpoll *>(event.data.ptr);
+
+		for (const auto &type : notifierEvents) {
+			EventNotifier *notifier = set->notifiers[type.type];
+
+			if (notifier && notifier->enabled() &&
+			    event.events & type.events)
+				notifier->activated.emit(notifier);
+		}
+	}
+
+	processingEvents_ = false;
+
+	/* Erase the notifiers_ entries that have been emptied. */
+	for (int fd : unregistered_) {
+		auto iter = notifiers_.find(fd);
+		if (iter != notifiers_.end() && iter->second.empty())
+			notifiers_.erase(iter);
+	}
+
+	unregistered_.clear();
+}
+
+} /* namespace libcamera */
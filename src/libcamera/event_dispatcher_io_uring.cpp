@@ -0,0 +1,539 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_io_uring.cpp - io_uring-based event dispatcher
+ */
+
+#include "event_dispatcher_io_uring.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "log.h"
+#include "thread.h"
+
+/**
+ * \file event_dispatcher_io_uring.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+namespace {
+
+/* Number of submission queue entries, the completion queue is twice larger. */
+constexpr unsigned int RingEntries = 64;
+
+const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+const struct {
+	EventNotifier::Type type;
+	uint32_t events;
+} notifierEvents[] = {
+	{ EventNotifier::Read, POLLIN },
+	{ EventNotifier::Write, POLLOUT },
+	{ EventNotifier::Exception, POLLPRI },
+};
+
+int io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int io_uring_enter(int fd, unsigned int submit, unsigned int minComplete,
+		   unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, minComplete, flags,
+		       nullptr, 0);
+}
+
+} /* namespace */
+
+/**
+ * \class EventDispatcherIOUring
+ * \brief An io_uring-based event dispatcher
+ *
+ * The EventDispatcherIOUring waits for events through poll requests submitted
+ * to an io_uring instance. Poll requests for the event notifiers, the timerfd
+ * of the TimerQueue and the eventfd used to interrupt the dispatcher are all
+ * completed through the same completion queue, and the requests to submit are
+ * batched with the wait for completions in a single io_uring_enter() call. An
+ * iteration of the event loop thus costs a single system call to submit the
+ * poll requests re-armed for the file descriptors that became ready and wait
+ * for the next events, regardless of the number of file descriptors.
+ *
+ * Poll requests are one-shot, and are re-armed after the event notifiers have
+ * been activated. When the enabled notifiers of a file descriptor change while
+ * a poll request is in flight, the request is cancelled and re-armed with the
+ * new events upon completion. Disabled notifiers stay registered, and enabling
+ * or disabling them only submits poll requests.
+ *
+ * The dispatcher can be installed on a thread with Thread::setEventDispatcher(),
+ * or selected as the default dispatcher for all threads by setting the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable to "io_uring". As io_uring
+ * may not be supported by the kernel, or be disabled by a seccomp filter, the
+ * isValid() method shall be checked after construction.
+ */
+
+EventDispatcherIOUring::EventDispatcherIOUring()
+	: ringfd_(-1), eventfd_(-1), sqRing_(MAP_FAILED), sqRingSize_(0),
+	  cqRing_(MAP_FAILED), cqRingSize_(0), sqes_(nullptr), sqesSize_(0),
+	  sqArray_(nullptr), sqTail_(0), submit_(0), cqes_(nullptr),
+	  processingEvents_(false)
+{
+	int ret = setup();
+	if (ret < 0) {
+		LOG(Event, Error)
+			<< "Unable to create io_uring: " << strerror(-ret);
+		cleanup();
+		return;
+	}
+
+	/*
+	 * The eventfd and timerfd are identified by pointers to the eventfd_
+	 * and timers_ members respectively. Requests that don't need to be
+	 * processed upon completion have no user data.
+	 */
+	pollAdd(eventfd_, POLLIN, &eventfd_);
+	pollAdd(timers_.fd(), POLLIN, &timers_);
+}
+
+EventDispatcherIOUring::~EventDispatcherIOUring()
+{
+	cleanup();
+}
+
+int EventDispatcherIOUring::setup()
+{
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		return -errno;
+
+	struct io_uring_params params = {};
+	ringfd_ = io_uring_setup(RingEntries, &params);
+	if (ringfd_ < 0)
+		return -errno;
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Both rings share a single mapping on kernels that support it. */
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+	sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+	if (sqRing_ == MAP_FAILED)
+		return -errno;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cqRing_ = sqRing_;
+	} else {
+		cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ringfd_,
+			       IORING_OFF_CQ_RING);
+		if (cqRing_ == MAP_FAILED)
+			return -errno;
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return -errno;
+
+	sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+	uint8_t *sq = static_cast<uint8_t *>(sqRing_);
+	sq_.head = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+	sq_.tail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+	sq_.mask = *reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+	sq_.entries = params.sq_entries;
+	sqArray_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+	sqTail_ = *sq_.tail;
+
+	uint8_t *cq = static_cast<uint8_t *>(cqRing_);
+	cq_.head = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+	cq_.tail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+	cq_.mask = *reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+	cq_.entries = params.cq_entries;
+	cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+void EventDispatcherIOUring::cleanup()
+{
+	if (sqes_)
+		munmap(sqes_, sqesSize_);
+	if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+		munmap(cqRing_, cqRingSize_);
+	if (sqRing_ != MAP_FAILED)
+		munmap(sqRing_, sqRingSize_);
+
+	sqes_ = nullptr;
+	cqRing_ = MAP_FAILED;
+	sqRing_ = MAP_FAILED;
+
+	if (ringfd_ >= 0)
+		close(ringfd_);
+	if (eventfd_ >= 0)
+		close(eventfd_);
+
+	ringfd_ = -1;
+	eventfd_ = -1;
+}
+
+void EventDispatcherIOUring::registerEventNotifier(EventNotifier *notifier)
+{
+	int fd = notifier->fd();
+	EventNotifier::Type type = notifier->type();
+
+	std::unique_ptr<EventNotifierSetIOUring> &entry = notifiers_[fd];
+	if (!entry)
+		entry.reset(new EventNotifierSetIOUring{ fd, {}, 0, false });
+
+	EventNotifierSetIOUring *set = entry.get();
+
+	if (set->notifiers[type]) {
+		if (set->notifiers[type] != notifier)
+			LOG(Event, Warning)
+				<< "Ignoring duplicate " << notifierType(type)
+				<< " notifier for fd " << fd;
+		return;
+	}
+
+	set->notifiers[type] = notifier;
+	update(set);
+}
+
+void EventDispatcherIOUring::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetIOUring *set = iter->second.get();
+	EventNotifier::Type type = notifier->type();
+
+	if (!set->notifiers[type])
+		return;
+
+	if (set->notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	set->notifiers[type] = nullptr;
+	update(set);
+
+	if (!set->empty())
+		return;
+
+	/*
+	 * The set is referenced by the poll request until it completes, and
+	 * may be referenced by the completion being processed. The notifiers_
+	 * entry will be erased by processEvents() in those cases.
+	 */
+	if (set->armed || processingEvents_) {
+		unregistered_.push_back(iter->first);
+		return;
+	}
+
+	notifiers_.erase(iter);
+}
+
+void EventDispatcherIOUring::updateEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetIOUring *set = iter->second.get();
+	if (set->notifiers[notifier->type()] != notifier)
+		return;
+
+	update(set);
+}
+
+void EventDispatcherIOUring::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
+}
+
+void EventDispatcherIOUring::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+void EventDispatcherIOUring::processEvents()
+{
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/*
+	 * Submit the pending requests and wait for events. The timers are
+	 * handled through the timerfd, wait without timeout.
+	 */
+	timers_.arm();
+
+	do {
+		ret = enter(1);
+	} while (ret == -EINTR);
+
+	if (ret < 0)
+		LOG(Event, Warning)
+			<< "io_uring_enter() failed with " << strerror(-ret);
+
+	processCompletions();
+
+	timers_.process();
+}
+
+void EventDispatcherIOUring::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherIOUring::EventNotifierSetIOUring::events() const
+{
+	uint32_t events = 0;
+
+	for (const auto &event : notifierEvents) {
+		EventNotifier *notifier = notifiers[event.type];
+		if (notifier && notifier->enabled())
+			events |= event.events;
+	}
+
+	return events;
+}
+
+bool EventDispatcherIOUring::EventNotifierSetIOUring::empty() const
+{
+	return !notifiers[0] && !notifiers[1] && !notifiers[2];
+}
+
+/*
+ * Retrieve the next free submission queue entry. When the submission queue is
+ * full, the pending requests are submitted first to make room.
+ */
+struct io_uring_sqe *EventDispatcherIOUring::sqe()
+{
+	unsigned int head = __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE);
+	if (sqTail_ - head >= sq_.entries) {
+		int ret = enter(0);
+		if (ret < 0)
+			LOG(Event, Error)
+				<< "Failed to submit io_uring requests: "
+				<< strerror(-ret);
+	}
+
+	unsigned int index = sqTail_ & sq_.mask;
+	struct io_uring_sqe *sqe = &sqes_[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	sqArray_[index] = index;
+	sqTail_++;
+	submit_++;
+
+	return sqe;
+}
+
+/*
+ * Submit the pending requests, and wait for at least minComplete completions.
+ * Return 0 on success or a negative error code otherwise.
+ */
+int EventDispatcherIOUring::enter(unsigned int minComplete)
+{
+	unsigned int flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+
+	/* Publish the submission queue entries to the kernel. */
+	__atomic_store_n(sq_.tail, sqTail_, __ATOMIC_RELEASE);
+
+	int ret = io_uring_enter(ringfd_, submit_, minComplete, flags);
+	if (ret < 0)
+		return -errno;
+
+	submit_ -= std::min<unsigned int>(ret, submit_);
+
+	/*
+	 * When requests are submitted, a signal interrupting the wait doesn't
+	 * fail the call but returns the number of submitted entries. Report
+	 * it as an interruption to wait again.
+	 */
+	if (minComplete &&
+	    __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE) == *cq_.head)
+		return -EINTR;
+
+	return 0;
+}
+
+void EventDispatcherIOUring::pollAdd(int fd, uint32_t events, void *data)
+{
+	struct io_uring_sqe *sqe = this->sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = events;
+	sqe->user_data = reinterpret_cast<uintptr_t>(data);
+}
+
+void EventDispatcherIOUring::pollRemove(void *data)
+{
+	struct io_uring_sqe *sqe = this->sqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uintptr_t>(data);
+	sqe->user_data = 0;
+}
+
+/*
+ * Bring the poll request of a set of notifiers in sync with the notifiers. A
+ * poll request in flight with different events is cancelled, and the set will
+ * be updated again when the request completes.
+ */
+void EventDispatcherIOUring::update(EventNotifierSetIOUring *set)
+{
+	uint32_t events = set->events();
+
+	if (set->armed) {
+		if (set->armed != events && !set->cancelling) {
+			pollRemove(set);
+			set->cancelling = true;
+		}
+		return;
+	}
+
+	if (!events)
+		return;
+
+	pollAdd(set->fd, events, set);
+	set->armed = events;
+}
+
+void EventDispatcherIOUring::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherIOUring::processCompletion(const struct io_uring_cqe &cqe)
+{
+	void *data = reinterpret_cast<void *>(static_cast<uintptr_t>(cqe.user_data));
+
+	if (!data)
+		return;
+
+	if (data == &eventfd_) {
+		processInterrupt();
+		pollAdd(eventfd_, POLLIN, &eventfd_);
+		return;
+	}
+
+	if (data == &timers_) {
+		timers_.acknowledge();
+		pollAdd(timers_.fd(), POLLIN, &timers_);
+		return;
+	}
+
+	EventNotifierSetIOUring *set = static_cast<EventNotifierSetIOUring *>(data);
+	set->armed = 0;
+	set->cancelling = false;
+
+	if (cqe.res > 0) {
+		for (const auto &type : notifierEvents) {
+			EventNotifier *notifier = set->notifiers[type.type];
+
+			if (notifier && notifier->enabled() &&
+			    cqe.res & type.events)
+				notifier->activated.emit(notifier);
+		}
+	} else if (cqe.res < 0 && cqe.res != -ECANCELED) {
+		LOG(Event, Warning)
+			<< "Failed to poll fd " << set->fd << ": "
+			<< strerror(-cqe.res);
+	}
+
+	/* Re-arm the poll request, as it is one-shot. */
+	update(set);
+}
+
+void EventDispatcherIOUring::processCompletions()
+{
+	processingEvents_ = true;
+
+	unsigned int head = *cq_.head;
+	unsigned int tail = __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		/*
+		 * Copy the completion and release its entry right away, as
+		 * the notifiers may submit requests.
+		 */
+		struct io_uring_cqe cqe = cqes_[head & cq_.mask];
+		head++;
+		__atomic_store_n(cq_.head, head, __ATOMIC_RELEASE);
+
+		processCompletion(cqe);
+
+		if (head == tail)
+			tail = __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE);
+	}
+
+	processingEvents_ = false;
+
+	/* Erase the notifiers_ entries that have been emptied. */
+	std::vector<int> unregistered;
+	unregistered.swap(unregistered_);
+
+	for (int fd : unregistered) {
+		auto iter = notifiers_.find(fd);
+		if (iter == notifiers_.end() || !iter->second->empty())
+			continue;
+
+		if (iter->second->armed)
+			unregistered_.push_back(fd);
+		else
+			notifiers_.erase(iter);
+	}
+}
+
+} /* namespace libcamera */
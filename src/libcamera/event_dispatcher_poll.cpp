@@ -7,9 +7,6 @@
 
 #include "event_dispatcher_poll.h"
 
-#include <algorithm>
-#include <chrono>
-#include <iomanip>
 #include <poll.h>
 #include <stdint.h>
 #include <string.h>
@@ -21,7 +18,6 @@
 
 #include "log.h"
 #include "thread.h"
-#include "utils.h"
 
 /**
  * \file event_dispatcher_poll.h
@@ -46,6 +42,14 @@ static const char *notifierType(EventNotifier::Type type)
 /**
  * \class EventDispatcherPoll
  * \brief A poll-based event dispatcher
+ *
+ * Timers are stored in a TimerQueue, whose timerfd is polled along with the
+ * file descriptors of the event notifiers.
+ *
+ * As the pollfd array is rebuilt for every iteration from the registered
+ * notifiers, enabling and disabling a notifier only affects the next
+ * iteration, and doesn't modify the registered notifiers. File descriptors
+ * whose notifiers are all disabled are not polled.
  */
 
 EventDispatcherPoll::EventDispatcherPoll()
@@ -113,33 +117,22 @@ void EventDispatcherPoll::unregisterEventNotifier(EventNotifier *notifier)
 		notifiers_.erase(iter);
 }
 
-void EventDispatcherPoll::registerTimer(Timer *timer)
+void EventDispatcherPoll::updateEventNotifier(EventNotifier *notifier)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if ((*iter)->deadline() > timer->deadline()) {
-			timers_.insert(iter, timer);
-			return;
-		}
-	}
+	/*
+	 * The notifier state is checked when building the pollfd array, there
+	 * is nothing to update.
+	 */
+}
 
-	timers_.push_back(timer);
+void EventDispatcherPoll::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
 }
 
 void EventDispatcherPoll::unregisterTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if (*iter == timer) {
-			timers_.erase(iter);
-			return;
-		}
-
-		/*
-		 * As the timers list is ordered, we can stop as soon as we go
-		 * past the deadline.
-		 */
-		if ((*iter)->deadline() > timer->deadline())
-			break;
-	}
+	timers_.remove(timer);
 }
 
 void EventDispatcherPoll::processEvents()
@@ -148,14 +141,23 @@ void EventDispatcherPoll::processEvents()
 
 	Thread::current()->dispatchMessages();
 
-	/* Create the pollfd array. */
-	std::vector<struct pollfd> pollfds;
-	pollfds.reserve(notifiers_.size() + 1);
-
-	for (auto notifier : notifiers_)
-		pollfds.push_back({ notifier.first, notifier.second.events(), 0 });
+	/*
+	 * Fill the pollfd array. The array is reused across iterations to
+	 * avoid allocating memory once its capacity has grown to the number of
+	 * notifiers, as processEvents() is never called recursively.
+	 */
+	std::vector<struct pollfd> &pollfds = pollfds_;
+	pollfds.clear();
+	pollfds.reserve(notifiers_.size() + 2);
+
+	for (const auto &notifier : notifiers_) {
+		short events = notifier.second.events();
+		if (events)
+			pollfds.push_back({ notifier.first, events, 0 });
+	}
 
 	pollfds.push_back({ eventfd_, POLLIN, 0 });
+	pollfds.push_back({ timers_.fd(), POLLIN, 0 });
 
 	/* Wait for events and process notifiers and timers. */
 	do {
@@ -166,12 +168,17 @@ void EventDispatcherPoll::processEvents()
 		ret = -errno;
 		LOG(Event, Warning) << "poll() failed with " << strerror(-ret);
 	} else if (ret > 0) {
+		if (pollfds.back().revents & POLLIN)
+			timers_.acknowledge();
+		pollfds.pop_back();
+
 		processInterrupt(pollfds.back());
 		pollfds.pop_back();
+
 		processNotifiers(pollfds);
 	}
 
-	processTimers();
+	timers_.process();
 }
 
 void EventDispatcherPoll::interrupt()
@@ -191,11 +198,14 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 {
 	short events = 0;
 
-	if (notifiers[EventNotifier::Read])
+	if (notifiers[EventNotifier::Read] &&
+	    notifiers[EventNotifier::Read]->enabled())
 		events |= POLLIN;
-	if (notifiers[EventNotifier::Write])
+	if (notifiers[EventNotifier::Write] &&
+	    notifiers[EventNotifier::Write]->enabled())
 		events |= POLLOUT;
-	if (notifiers[EventNotifier::Exception])
+	if (notifiers[EventNotifier::Exception] &&
+	    notifiers[EventNotifier::Exception]->enabled())
 		events |= POLLPRI;
 
 	return events;
@@ -203,26 +213,10 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 
 int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
 {
-	/* Compute the timeout. */
-	Timer *nextTimer = !timers_.empty() ? timers_.front() : nullptr;
-	struct timespec timeout;
-
-	if (nextTimer) {
-		utils::time_point now = utils::clock::now();
-
-		if (nextTimer->deadline() > now)
-			timeout = utils::duration_to_timespec(nextTimer->deadline() - now);
-		else
-			timeout = { 0, 0 };
-
-		LOG(Event, Debug)
-			<< "timeout " << timeout.tv_sec << "."
-			<< std::setfill('0') << std::setw(9)
-			<< timeout.tv_nsec;
-	}
+	/* The timers are handled through the timerfd, poll without timeout. */
+	timers_.arm();
 
-	return ppoll(pollfds->data(), pollfds->size(),
-		     nextTimer ? &timeout : nullptr, nullptr);
+	return ppoll(pollfds->data(), pollfds->size(), nullptr, nullptr);
 }
 
 void EventDispatcherPoll::processInterrupt(const struct pollfd &pfd)
@@ -262,7 +256,11 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 		for (const auto &event : events) {
 			EventNotifier *notifier = set.notifiers[event.type];
 
-			if (!notifier)
+			/*
+			 * Skip notifiers that have been disabled, possibly by
+			 * a notifier of the same set activated before them.
+			 */
+			if (!notifier || !notifier->enabled())
 				continue;
 
 			/*
@@ -290,19 +288,4 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 	processingEvents_ = false;
 }
 
-void EventDispatcherPoll::processTimers()
-{
-	utils::time_point now = utils::clock::now();
-
-	while (!timers_.empty()) {
-		Timer *timer = timers_.front();
-		if (timer->deadline() > now)
-			break;
-
-		timers_.pop_front();
-		timer->stop();
-		timer->timeout.emit(timer);
-	}
-}
-
 } /* namespace libcamera */
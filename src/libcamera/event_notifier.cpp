@@ -64,14 +64,14 @@ namespace libcamera {
  * \param[in] parent The parent Object
  */
 EventNotifier::EventNotifier(int fd, Type type, Object *parent)
-	: Object(parent), fd_(fd), type_(type), enabled_(false)
+	: Object(parent), fd_(fd), type_(type), enabled_(true)
 {
-	setEnabled(true);
+	attach();
 }
 
 EventNotifier::~EventNotifier()
 {
-	setEnabled(false);
+	thread()->eventDispatcher()->unregisterEventNotifier(this);
 }
 
 /**
@@ -99,6 +99,11 @@ EventNotifier::~EventNotifier()
  *
  * This function enables or disables the notifier. A disabled notifier ignores
  * events and does not emit the \ref activated signal.
+ *
+ * The notifier stays registered with the event dispatcher when disabled, and
+ * the dispatcher only updates its monitoring of the file descriptor. Toggling
+ * the notifier is thus cheap enough to be performed for every buffer queued to
+ * or dequeued from a device.
  */
 void EventNotifier::setEnabled(bool enable)
 {
@@ -107,11 +112,7 @@ void EventNotifier::setEnabled(bool enable)
 
 	enabled_ = enable;
 
-	EventDispatcher *dispatcher = thread()->eventDispatcher();
-	if (enable)
-		dispatcher->registerEventNotifier(this);
-	else
-		dispatcher->unregisterEventNotifier(this);
+	thread()->eventDispatcher()->updateEventNotifier(this);
 }
 
 /**
@@ -126,13 +127,24 @@ void EventNotifier::setEnabled(bool enable)
 void EventNotifier::message(Message *msg)
 {
 	if (msg->type() == Message::ThreadMoveMessage) {
-		if (enabled_) {
-			setEnabled(false);
-			invokeMethod(&EventNotifier::setEnabled, true);
-		}
+		thread()->eventDispatcher()->unregisterEventNotifier(this);
+		invokeMethod(&EventNotifier::attach);
 	}
 
 	Object::message(msg);
 }
 
+/*
+ * Register the notifier with the event dispatcher of its thread, in its current
+ * state.
+ */
+void EventNotifier::attach()
+{
+	EventDispatcher *dispatcher = thread()->eventDispatcher();
+
+	dispatcher->registerEventNotifier(this);
+	if (!enabled_)
+		dispatcher->updateEventNotifier(this);
+}
+
 } /* namespace libcamera */
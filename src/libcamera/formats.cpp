@@ -9,6 +9,8 @@
 
 #include <errno.h>
 
+#include <linux/videodev2.h>
+
 /**
  * \file formats.h
  * \brief Types and helper methods to handle libcamera image formats
@@ -104,4 +106,341 @@ const std::map<unsigned int, std::vector<SizeRange>> &ImageFormats::data() const
 	return data_;
 }
 
+/**
+ * \struct PixelFormatPlaneInfo
+ * \brief Information about a single plane of a pixel format
+ *
+ * \var PixelFormatPlaneInfo::bytesPerGroup
+ * \brief The number of bytes that a pixel group consumes in the plane
+ *
+ * \var PixelFormatPlaneInfo::verticalSubSampling
+ * \brief Vertical subsampling multiplier
+ *
+ * This value is the ratio between the number of rows of pixels in the frame
+ * to the number of rows of pixels in the plane.
+ */
+
+/**
+ * \struct PixelFormatInfo
+ * \brief Information about pixel formats
+ *
+ * The PixelFormatInfo class groups together information describing the memory
+ * layout of a pixel format, identified by its V4L2 fourcc. The information is
+ * stored in a table of constant data, initialized at compile time, and looked
+ * up with info(). It is used to compute the line stride and size of the
+ * planes of a frame, in order to size buffers exactly.
+ *
+ * Pixels are stored in groups, with each group taking a fixed number of bytes
+ * in each plane. Horizontal subsampling is expressed by the number of bytes per
+ * group in the subsampled planes, and vertical subsampling by the
+ * verticalSubSampling value of the plane. Planes of the multi-planar V4L2
+ * formats are stored in separate memory buffers, their layout is otherwise
+ * identical to the corresponding single-planar formats.
+ *
+ * \var PixelFormatInfo::name
+ * \brief The format name as a human-readable string
+ *
+ * \var PixelFormatInfo::format
+ * \brief The V4L2 pixel format fourcc, or 0 for the invalid format information
+ *
+ * \var PixelFormatInfo::bitsPerPixel
+ * \brief The average number of bits per pixel
+ *
+ * The number of bits per pixel averages the total number of bits for all
+ * colour components over the whole image, excluding any padding bits or
+ * padding pixels. It is 0 for compressed formats.
+ *
+ * \var PixelFormatInfo::colourEncoding
+ * \brief The colour encoding type
+ *
+ * \var PixelFormatInfo::packed
+ * \brief Tell if multiple pixels are packed in the same bytes
+ *
+ * Packed formats are defined as storing data from multiple pixels in the same
+ * bytes, such as the MIPI CSI-2 10-bit Bayer formats that store four pixels
+ * in five bytes.
+ *
+ * \var PixelFormatInfo::pixelsPerGroup
+ * \brief The number of pixels in a pixel group
+ *
+ * A pixel group is the smallest horizontal run of pixels that can be stored
+ * independently from the adjacent pixels. Line strides are a multiple of the
+ * number of bytes per group.
+ *
+ * \var PixelFormatInfo::planes
+ * \brief Information about the planes of the format, up to three
+ *
+ * Unused planes have a number of bytes per group equal to 0.
+ */
+
+/**
+ * \enum PixelFormatInfo::ColourEncoding
+ * \brief The colour encoding type
+ *
+ * \var PixelFormatInfo::ColourEncodingRGB
+ * \brief RGB colour encoding
+ *
+ * \var PixelFormatInfo::ColourEncodingYUV
+ * \brief YUV colour encoding
+ *
+ * \var PixelFormatInfo::ColourEncodingRAW
+ * \brief RAW colour encoding
+ */
+
+namespace {
+
+constexpr PixelFormatInfo pixelFormatInfoInvalid = {
+	"INVALID", 0, 0, PixelFormatInfo::ColourEncodingRGB, false,
+	1, {{ { 0, 0 }, { 0, 0 }, { 0, 0 } }}
+};
+
+constexpr PixelFormatInfo pixelFormatInfo[] = {
+	/* RGB formats. */
+	{ "RGB565", V4L2_PIX_FMT_RGB565, 16, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "BGR24", V4L2_PIX_FMT_BGR24, 24, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "RGB24", V4L2_PIX_FMT_RGB24, 24, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "ABGR32", V4L2_PIX_FMT_ABGR32, 32, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "ARGB32", V4L2_PIX_FMT_ARGB32, 32, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "XBGR32", V4L2_PIX_FMT_XBGR32, 24, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "XRGB32", V4L2_PIX_FMT_XRGB32, 24, PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	/* YUV packed formats. */
+	{ "YUYV", V4L2_PIX_FMT_YUYV, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "YVYU", V4L2_PIX_FMT_YVYU, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "UYVY", V4L2_PIX_FMT_UYVY, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "VYUY", V4L2_PIX_FMT_VYUY, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	/* YUV semi-planar formats. */
+	{ "NV12", V4L2_PIX_FMT_NV12, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }} },
+	{ "NV21", V4L2_PIX_FMT_NV21, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }} },
+	{ "NV12M", V4L2_PIX_FMT_NV12M, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }} },
+	{ "NV21M", V4L2_PIX_FMT_NV21M, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }} },
+	{ "NV16", V4L2_PIX_FMT_NV16, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }} },
+	{ "NV61", V4L2_PIX_FMT_NV61, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }} },
+	{ "NV16M", V4L2_PIX_FMT_NV16M, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }} },
+	{ "NV61M", V4L2_PIX_FMT_NV61M, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }} },
+	{ "NV24", V4L2_PIX_FMT_NV24, 24, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 1, 1 }, { 2, 1 }, { 0, 0 } }} },
+	{ "NV42", V4L2_PIX_FMT_NV42, 24, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 1, 1 }, { 2, 1 }, { 0, 0 } }} },
+	/* YUV planar formats. */
+	{ "YUV420", V4L2_PIX_FMT_YUV420, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }} },
+	{ "YVU420", V4L2_PIX_FMT_YVU420, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }} },
+	{ "YUV420M", V4L2_PIX_FMT_YUV420M, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }} },
+	{ "YVU420M", V4L2_PIX_FMT_YVU420M, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }} },
+	{ "YUV422P", V4L2_PIX_FMT_YUV422P, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 1 }, { 1, 1 } }} },
+	{ "YUV422M", V4L2_PIX_FMT_YUV422M, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 1 }, { 1, 1 } }} },
+	{ "YVU422M", V4L2_PIX_FMT_YVU422M, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 2, 1 }, { 1, 1 }, { 1, 1 } }} },
+	{ "YUV444M", V4L2_PIX_FMT_YUV444M, 24, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 1, 1 }, { 1, 1 }, { 1, 1 } }} },
+	{ "YVU444M", V4L2_PIX_FMT_YVU444M, 24, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 1, 1 }, { 1, 1 }, { 1, 1 } }} },
+	/* Greyscale formats. */
+	{ "GREY", V4L2_PIX_FMT_GREY, 8, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "Y10", V4L2_PIX_FMT_Y10, 10, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "Y12", V4L2_PIX_FMT_Y12, 12, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "Y16", V4L2_PIX_FMT_Y16, 16, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "Y10P", V4L2_PIX_FMT_Y10P, 10, PixelFormatInfo::ColourEncodingYUV, true,
+	  4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }} },
+	/* Bayer formats. */
+	{ "SBGGR8", V4L2_PIX_FMT_SBGGR8, 8, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG8", V4L2_PIX_FMT_SGBRG8, 8, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG8", V4L2_PIX_FMT_SGRBG8, 8, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB8", V4L2_PIX_FMT_SRGGB8, 8, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SBGGR10", V4L2_PIX_FMT_SBGGR10, 10, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG10", V4L2_PIX_FMT_SGBRG10, 10, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG10", V4L2_PIX_FMT_SGRBG10, 10, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB10", V4L2_PIX_FMT_SRGGB10, 10, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SBGGR10P", V4L2_PIX_FMT_SBGGR10P, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG10P", V4L2_PIX_FMT_SGBRG10P, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG10P", V4L2_PIX_FMT_SGRBG10P, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB10P", V4L2_PIX_FMT_SRGGB10P, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SBGGR12", V4L2_PIX_FMT_SBGGR12, 12, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG12", V4L2_PIX_FMT_SGBRG12, 12, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG12", V4L2_PIX_FMT_SGRBG12, 12, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB12", V4L2_PIX_FMT_SRGGB12, 12, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SBGGR12P", V4L2_PIX_FMT_SBGGR12P, 12, PixelFormatInfo::ColourEncodingRAW, true,
+	  2, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG12P", V4L2_PIX_FMT_SGBRG12P, 12, PixelFormatInfo::ColourEncodingRAW, true,
+	  2, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG12P", V4L2_PIX_FMT_SGRBG12P, 12, PixelFormatInfo::ColourEncodingRAW, true,
+	  2, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB12P", V4L2_PIX_FMT_SRGGB12P, 12, PixelFormatInfo::ColourEncodingRAW, true,
+	  2, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SBGGR16", V4L2_PIX_FMT_SBGGR16, 16, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGBRG16", V4L2_PIX_FMT_SGBRG16, 16, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SGRBG16", V4L2_PIX_FMT_SGRBG16, 16, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "SRGGB16", V4L2_PIX_FMT_SRGGB16, 16, PixelFormatInfo::ColourEncodingRAW, false,
+	  2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }} },
+	/* Bayer formats packed by the IPU3 CIO2, 25 pixels in 32 bytes. */
+	{ "IPU3_SBGGR10", V4L2_PIX_FMT_IPU3_SBGGR10, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "IPU3_SGBRG10", V4L2_PIX_FMT_IPU3_SGBRG10, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "IPU3_SGRBG10", V4L2_PIX_FMT_IPU3_SGRBG10, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }} },
+	{ "IPU3_SRGGB10", V4L2_PIX_FMT_IPU3_SRGGB10, 10, PixelFormatInfo::ColourEncodingRAW, true,
+	  25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }} },
+	/* Compressed formats, the frame size isn't known in advance. */
+	{ "MJPEG", V4L2_PIX_FMT_MJPEG, 0, PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 0, 0 }, { 0, 0 }, { 0, 0 } }} },
+};
+
+} /* namespace */
+
+/**
+ * \fn PixelFormatInfo::isValid()
+ * \brief Check if the pixel format information is valid
+ * \return True if the pixel format information is valid, false otherwise
+ */
+
+/**
+ * \brief Retrieve information about a pixel format
+ * \param[in] format The V4L2 pixel format fourcc
+ * \return The PixelFormatInfo describing the \a format if known, or an invalid
+ * PixelFormatInfo otherwise
+ */
+const PixelFormatInfo &PixelFormatInfo::info(unsigned int format)
+{
+	for (const PixelFormatInfo &info : pixelFormatInfo) {
+		if (info.format == format)
+			return info;
+	}
+
+	return pixelFormatInfoInvalid;
+}
+
+/**
+ * \brief Retrieve the number of planes of the format
+ * \return The number of planes used by the format, 0 for compressed formats
+ */
+unsigned int PixelFormatInfo::numPlanes() const
+{
+	unsigned int count = 0;
+
+	for (const PixelFormatPlaneInfo &plane : planes) {
+		if (!plane.bytesPerGroup)
+			break;
+
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * \brief Compute the stride of a plane
+ * \param[in] width The width of the frame, in pixels
+ * \param[in] plane The plane index
+ * \param[in] align The stride alignment, in bytes
+ *
+ * The stride is the number of bytes necessary to store a full line of the
+ * \a plane, rounded up to a multiple of \a align. Partial pixel groups at the
+ * end of the line are stored as full groups.
+ *
+ * \return The number of bytes necessary to store a line of the plane, or 0 if
+ * the format or the \a plane isn't valid, or if the format is compressed
+ */
+unsigned int PixelFormatInfo::stride(unsigned int width, unsigned int plane,
+				     unsigned int align) const
+{
+	if (plane >= planes.size() || !planes[plane].bytesPerGroup || !align)
+		return 0;
+
+	unsigned int groups = (width + pixelsPerGroup - 1) / pixelsPerGroup;
+	unsigned int stride = groups * planes[plane].bytesPerGroup;
+
+	return (stride + align - 1) / align * align;
+}
+
+/**
+ * \brief Compute the size of a plane
+ * \param[in] height The height of the frame, in pixels
+ * \param[in] plane The plane index
+ * \param[in] stride The stride of the plane, in bytes
+ *
+ * The size of the plane is the \a stride multiplied by the number of lines of
+ * the plane, taking vertical subsampling into account.
+ *
+ * \return The size of the plane in bytes, or 0 if the format or the \a plane
+ * isn't valid
+ */
+unsigned int PixelFormatInfo::planeSize(unsigned int height, unsigned int plane,
+					unsigned int stride) const
+{
+	if (plane >= planes.size() || !planes[plane].verticalSubSampling)
+		return 0;
+
+	unsigned int vertSubSample = planes[plane].verticalSubSampling;
+	return stride * ((height + vertSubSample - 1) / vertSubSample);
+}
+
+/**
+ * \brief Compute the size of a frame
+ * \param[in] size The frame size, in pixels
+ * \param[in] align The stride alignment, in bytes, for all planes
+ *
+ * The frame size is the sum of the sizes of all planes, with the stride of each
+ * plane aligned to \a align.
+ *
+ * \return The number of bytes necessary to store the frame, or 0 if the format
+ * isn't valid or is compressed
+ */
+unsigned int PixelFormatInfo::frameSize(const Size &size, unsigned int align) const
+{
+	unsigned int sum = 0;
+
+	for (unsigned int i = 0; i < numPlanes(); ++i)
+		sum += planeSize(size.height, i, stride(size.width, i, align));
+
+	return sum;
+}
+
 } /* namespace libcamera */
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_context.cpp - Per-frame context tracking for pipeline handlers
+ */
+
+#include "frame_context.h"
+
+/**
+ * \file frame_context.h
+ * \brief Per-frame context tracking for pipeline handlers
+ */
+
+namespace libcamera {
+
+/**
+ * \struct FrameContext
+ * \brief Base structure for the pipeline handler per-frame contexts
+ *
+ * Pipeline handlers need to track state associated with each frame being
+ * processed, such as the request the frame belongs to and the internal
+ * buffers used to process it. This structure contains the fields common to
+ * all pipeline handlers, and is meant to be extended with pipeline-specific
+ * fields in a derived structure stored in a FrameContextRing.
+ *
+ * \var FrameContext::frame
+ * \brief The frame number
+ *
+ * \var FrameContext::request
+ * \brief The request the frame belongs to, may be null
+ */
+
+/**
+ * \class FrameContextRingBase
+ * \brief Base class for FrameContextRing
+ *
+ * This class provides the FrameContextRing template with access to the frame
+ * context associated with a request, independently of the context type.
+ */
+
+/**
+ * \fn FrameContextRingBase::attach()
+ * \brief Associate a frame context with a request
+ * \param[in] request The request
+ * \param[in] context The frame context
+ */
+
+/**
+ * \fn FrameContextRingBase::attached()
+ * \brief Retrieve the frame context last associated with a request
+ * \param[in] request The request
+ * \return The frame context last associated with \a request, which may be
+ * stale, or nullptr if no context has been associated with \a request
+ */
+
+/**
+ * \class FrameContextRing
+ * \brief Fixed-size ring of per-frame contexts
+ * \tparam T The frame context type, derived from FrameContext
+ *
+ * The FrameContextRing stores frame contexts in a ring of fixed depth,
+ * allocated at construction time. The context for a frame is stored in the
+ * slot selected by the frame number modulo the ring depth, and creating or
+ * destroying contexts never allocates memory.
+ *
+ * Contexts can be looked up in constant time by frame number, by request, and
+ * by buffer for buffers that belong to a request. Lookup by request relies
+ * on the request storing a reference to its context when the context is
+ * created. Contexts can additionally be looked up with a custom predicate
+ * with findIf(), for instance to locate the context associated with an
+ * internal buffer of the pipeline handler. This performs a linear search
+ * bounded by the ring depth.
+ *
+ * The ring depth shall be larger than the largest difference between the
+ * numbers of the oldest and newest frames in flight. Creating a context in a
+ * slot occupied by another frame fails.
+ */
+
+/**
+ * \fn FrameContextRing::FrameContextRing()
+ * \brief Construct a ring of \a depth frame contexts
+ * \param[in] depth The number of contexts in the ring
+ */
+
+/**
+ * \fn FrameContextRing::depth()
+ * \brief Retrieve the ring depth
+ * \return The number of contexts in the ring
+ */
+
+/**
+ * \fn FrameContextRing::create()
+ * \brief Create a context for a frame
+ * \param[in] frame The frame number
+ * \param[in] request The request the frame belongs to, may be null
+ *
+ * The context is reset to a default-constructed value, and its frame and
+ * request fields are initialised from \a frame and \a request.
+ *
+ * \return A pointer to the frame context, or nullptr if the slot for \a frame
+ * is occupied by another frame
+ */
+
+/**
+ * \fn FrameContextRing::destroy()
+ * \brief Destroy a frame context
+ * \param[in] context The frame context
+ *
+ * The slot occupied by \a context is released and can be used for a new
+ * frame. The \a context pointer shall not be used after this call.
+ */
+
+/**
+ * \fn FrameContextRing::find(unsigned int frame)
+ * \brief Find the context of a frame by frame number
+ * \param[in] frame The frame number
+ * \return A pointer to the frame context, or nullptr if no context exists for
+ * \a frame
+ */
+
+/**
+ * \fn FrameContextRing::find(const Request *request)
+ * \brief Find the context of a frame by request
+ * \param[in] request The request
+ * \return A pointer to the frame context, or nullptr if no context exists for
+ * \a request
+ */
+
+/**
+ * \fn FrameContextRing::find(const Buffer *buffer)
+ * \brief Find the context of a frame by buffer
+ * \param[in] buffer The buffer
+ *
+ * Only buffers associated with a request can be found by this method. Use
+ * findIf() to look up contexts by internal buffers.
+ *
+ * \return A pointer to the frame context, or nullptr if no context exists for
+ * the request \a buffer belongs to
+ */
+
+/**
+ * \fn FrameContextRing::findIf()
+ * \brief Find a frame context matching a predicate
+ * \param[in] pred The predicate, called with a reference to each active frame
+ * context
+ * \return A pointer to the first frame context for which \a pred returns
+ * true, or nullptr if no context matches
+ */
+
+/**
+ * \fn FrameContextRing::clear(Function func)
+ * \brief Destroy all frame contexts
+ * \param[in] func A function called with a reference to each active context
+ * before it is destroyed
+ */
+
+/**
+ * \fn FrameContextRing::clear()
+ * \brief Destroy all frame contexts
+ */
+
+} /* namespace libcamera */
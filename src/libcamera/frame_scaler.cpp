@@ -0,0 +1,626 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_scaler.cpp - CPU cropping and scaling of frames
+ */
+
+#include "frame_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/**
+ * \file frame_scaler.h
+ * \brief CPU cropping and scaling of frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(FrameScaler)
+
+namespace {
+
+/* The number of lines of the stripes processed in parallel. */
+constexpr unsigned int stripeHeight = 32;
+
+/* The filter weights are stored in 1.7 fixed point. */
+constexpr int weightOne = 128;
+
+struct ComponentInfo {
+	unsigned int offset;
+	unsigned int step;
+};
+
+struct PlaneInfo {
+	unsigned int horzSubSample;
+	unsigned int vertSubSample;
+	unsigned int bytesPerPixel;
+	std::vector<ComponentInfo> components;
+};
+
+/*
+ * The components are located at byte offset + n * step in the lines of their
+ * plane. The sizes and crop rectangles of the formats with subsampled
+ * components shall be aligned to the subsampling factors.
+ */
+struct FormatInfo {
+	unsigned int fourcc;
+	unsigned int horzAlign;
+	unsigned int vertAlign;
+	std::vector<PlaneInfo> planes;
+};
+
+const FormatInfo formatsInfo[] = {
+	{ V4L2_PIX_FMT_NV12, 2, 2, {
+		{ 1, 1, 1, { { 0, 1 } } },
+		{ 2, 2, 2, { { 0, 2 }, { 1, 2 } } },
+	} },
+	{ V4L2_PIX_FMT_NV21, 2, 2, {
+		{ 1, 1, 1, { { 0, 1 } } },
+		{ 2, 2, 2, { { 0, 2 }, { 1, 2 } } },
+	} },
+	{ V4L2_PIX_FMT_YUYV, 2, 1, {
+		{ 1, 1, 2, { { 0, 2 }, { 1, 4 }, { 3, 4 } } },
+	} },
+	{ V4L2_PIX_FMT_UYVY, 2, 1, {
+		{ 1, 1, 2, { { 1, 2 }, { 0, 4 }, { 2, 4 } } },
+	} },
+	{ V4L2_PIX_FMT_RGB24, 1, 1, {
+		{ 1, 1, 3, { { 0, 3 }, { 1, 3 }, { 2, 3 } } },
+	} },
+	{ V4L2_PIX_FMT_BGR24, 1, 1, {
+		{ 1, 1, 3, { { 0, 3 }, { 1, 3 }, { 2, 3 } } },
+	} },
+	{ V4L2_PIX_FMT_XRGB32, 1, 1, {
+		{ 1, 1, 4, { { 0, 4 }, { 1, 4 }, { 2, 4 }, { 3, 4 } } },
+	} },
+	{ V4L2_PIX_FMT_XBGR32, 1, 1, {
+		{ 1, 1, 4, { { 0, 4 }, { 1, 4 }, { 2, 4 }, { 3, 4 } } },
+	} },
+};
+
+const FormatInfo *findFormat(unsigned int fourcc)
+{
+	for (const FormatInfo &info : formatsInfo) {
+		if (info.fourcc == fourcc)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+/*
+ * The vertical pass computes the weighted sum of the input lines for every
+ * byte of the cropped line, on 15 bits as the weights add up to 128. The
+ * horizontal pass then filters the components of the resulting line, and
+ * rounds the result back to 8 bits. All implementations produce identical
+ * results.
+ */
+void verticalSamplesScalar(const uint8_t *const *rows, const int16_t *weights,
+			   unsigned int taps, uint16_t *dst, unsigned int first,
+			   unsigned int length)
+{
+	for (unsigned int x = first; x < length; ++x) {
+		unsigned int sum = 0;
+
+		for (unsigned int t = 0; t < taps; ++t)
+			sum += weights[t] * rows[t][x];
+
+		dst[x] = sum;
+	}
+}
+
+void verticalRowScalar(const uint8_t *const *rows, const int16_t *weights,
+		       unsigned int taps, uint16_t *dst, unsigned int length)
+{
+	verticalSamplesScalar(rows, weights, taps, dst, 0, length);
+}
+
+#if defined(__SSE2__)
+
+void verticalRowSse2(const uint8_t *const *rows, const int16_t *weights,
+		     unsigned int taps, uint16_t *dst, unsigned int length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int x;
+
+	for (x = 0; x + 16 <= length; x += 16) {
+		__m128i lo = zero;
+		__m128i hi = zero;
+
+		for (unsigned int t = 0; t < taps; ++t) {
+			__m128i weight = _mm_set1_epi16(weights[t]);
+			__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[t] + x));
+
+			lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weight));
+			hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weight));
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 8), hi);
+	}
+
+	verticalSamplesScalar(rows, weights, taps, dst, x, length);
+}
+
+#endif /* __SSE2__ */
+
+#if defined(__ARM_NEON)
+
+void verticalRowNeon(const uint8_t *const *rows, const int16_t *weights,
+		     unsigned int taps, uint16_t *dst, unsigned int length)
+{
+	unsigned int x;
+
+	for (x = 0; x + 16 <= length; x += 16) {
+		uint16x8_t lo = vdupq_n_u16(0);
+		uint16x8_t hi = vdupq_n_u16(0);
+
+		for (unsigned int t = 0; t < taps; ++t) {
+			uint8x8_t weight = vdup_n_u8(weights[t]);
+			uint8x16_t pixels = vld1q_u8(rows[t] + x);
+
+			lo = vmlal_u8(lo, vget_low_u8(pixels), weight);
+			hi = vmlal_u8(hi, vget_high_u8(pixels), weight);
+		}
+
+		vst1q_u16(dst + x, lo);
+		vst1q_u16(dst + x + 8, hi);
+	}
+
+	verticalSamplesScalar(rows, weights, taps, dst, x, length);
+}
+
+#endif /* __ARM_NEON */
+
+bool always()
+{
+	return true;
+}
+
+struct Implementation {
+	const char *name;
+	bool (*available)();
+	void (*verticalRow)(const uint8_t *const *rows, const int16_t *weights,
+			    unsigned int taps, uint16_t *dst,
+			    unsigned int length);
+};
+
+/* Implementations, by order of preference. */
+const Implementation implementations[] = {
+#if defined(__SSE2__)
+	{ "sse2", always, verticalRowSse2 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", always, verticalRowNeon },
+#endif
+	{ "scalar", always, verticalRowScalar },
+};
+
+const Implementation &selectImplementation()
+{
+	const char *name = utils::secure_getenv("LIBCAMERA_FRAME_SCALER");
+
+	if (name) {
+		for (const Implementation &impl : implementations) {
+			if (strcmp(impl.name, name) || !impl.available())
+				continue;
+
+			return impl;
+		}
+
+		LOG(FrameScaler, Warning)
+			<< "Frame scaler implementation " << name
+			<< " not available";
+	}
+
+	for (const Implementation &impl : implementations) {
+		if (impl.available())
+			return impl;
+	}
+
+	/* The scalar implementation is always available. */
+	return implementations[ARRAY_SIZE(implementations) - 1];
+}
+
+bool scalable(unsigned int input, unsigned int output)
+{
+	return input <= output * FrameScaler::MAX_SCALE_FACTOR &&
+	       output <= input * FrameScaler::MAX_SCALE_FACTOR;
+}
+
+} /* namespace */
+
+/**
+ * \class FrameScaler
+ * \brief Crop and scale frames on the CPU
+ *
+ * The FrameScaler class crops a rectangle out of frames and scales it to an
+ * output size, for the pipeline handlers whose hardware can't produce the
+ * size requested by applications. It supports the NV12, NV21, YUYV, UYVY,
+ * RGB24, BGR24, XRGB32 and XBGR32 formats, and outputs frames in the input
+ * format.
+ *
+ * Downscaling uses an area filter, which averages the input pixels covered
+ * by each output pixel, and upscaling a bilinear filter. The filters are
+ * separable, and applied vertically first on the cropped lines, which is
+ * vectorized with SSE2 on x86 and NEON on ARM, and then horizontally on each
+ * component. Frames are processed in horizontal stripes spread over the
+ * threads of a ThreadPool.
+ *
+ * The LIBCAMERA_FRAME_SCALER environment variable selects a specific
+ * implementation ("sse2", "neon" or "scalar") for testing purpose. It is
+ * ignored if the implementation isn't available.
+ */
+
+/**
+ * \var FrameScaler::MAX_SCALE_FACTOR
+ * \brief The maximum downscaling and upscaling factor in each direction
+ */
+
+FrameScaler::FrameScaler()
+	: stride_(0), frameSize_(0), implementation_(nullptr),
+	  verticalRow_(nullptr)
+{
+}
+
+/**
+ * \brief Retrieve the supported formats
+ * \return The V4L2 pixel formats of the frames the scaler can process
+ */
+const std::vector<unsigned int> &FrameScaler::formats()
+{
+	static std::vector<unsigned int> formats;
+
+	if (formats.empty()) {
+		for (const FormatInfo &format : formatsInfo)
+			formats.push_back(format.fourcc);
+	}
+
+	return formats;
+}
+
+/**
+ * \brief Compute the crop rectangle that preserves the output aspect ratio
+ * \param[in] format The V4L2 pixel format of the frames
+ * \param[in] inputSize The input frame size in pixels
+ * \param[in] outputSize The output frame size in pixels
+ *
+ * The crop rectangle is the largest rectangle of the \a outputSize aspect
+ * ratio that fits in the input frame, centered, and aligned to the \a format
+ * subsampling.
+ *
+ * \return The crop rectangle, or a null rectangle if the \a format isn't
+ * supported
+ */
+Rectangle FrameScaler::centeredCrop(unsigned int format, const Size &inputSize,
+				    const Size &outputSize)
+{
+	const FormatInfo *info = findFormat(format);
+	if (!info || !outputSize.width || !outputSize.height)
+		return {};
+
+	uint64_t width = inputSize.width;
+	uint64_t height = inputSize.height;
+
+	if (width * outputSize.height > height * outputSize.width)
+		width = height * outputSize.width / outputSize.height;
+	else
+		height = width * outputSize.height / outputSize.width;
+
+	Rectangle crop;
+	crop.w = std::max<unsigned int>(width / info->horzAlign * info->horzAlign,
+					info->horzAlign);
+	crop.h = std::max<unsigned int>(height / info->vertAlign * info->vertAlign,
+					info->vertAlign);
+	crop.x = (inputSize.width - crop.w) / 2 / info->horzAlign * info->horzAlign;
+	crop.y = (inputSize.height - crop.h) / 2 / info->vertAlign * info->vertAlign;
+
+	return crop;
+}
+
+/**
+ * \brief Configure the scaler for a format, crop rectangle and output size
+ * \param[in] format The V4L2 pixel format of the frames
+ * \param[in] inputSize The input frame size in pixels
+ * \param[in] stride The length of the input lines in bytes
+ * \param[in] crop The rectangle of the input frames to scale
+ * \param[in] outputSize The output frame size in pixels
+ *
+ * The planes of the input frames shall be contiguous in memory, with the same
+ * \a stride. The output frames have no padding between their lines and planes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The format isn't supported, the crop rectangle or output
+ * size isn't aligned to the format subsampling, the crop rectangle exceeds the
+ * input frame, or the scaling factor exceeds MAX_SCALE_FACTOR
+ */
+int FrameScaler::configure(unsigned int format, const Size &inputSize,
+			   unsigned int stride, const Rectangle &crop,
+			   const Size &outputSize)
+{
+	const FormatInfo *info = findFormat(format);
+	if (!info) {
+		LOG(FrameScaler, Error)
+			<< "Unsupported format " << utils::hex(format);
+		return -EINVAL;
+	}
+
+	if (crop.x < 0 || crop.y < 0 || !crop.w || !crop.h ||
+	    crop.x + crop.w > inputSize.width ||
+	    crop.y + crop.h > inputSize.height ||
+	    crop.x % info->horzAlign || crop.w % info->horzAlign ||
+	    crop.y % info->vertAlign || crop.h % info->vertAlign) {
+		LOG(FrameScaler, Error)
+			<< "Invalid crop rectangle " << crop.toString()
+			<< " for input size " << inputSize.toString();
+		return -EINVAL;
+	}
+
+	if (!outputSize.width || !outputSize.height ||
+	    outputSize.width % info->horzAlign ||
+	    outputSize.height % info->vertAlign ||
+	    !scalable(crop.w, outputSize.width) ||
+	    !scalable(crop.h, outputSize.height)) {
+		LOG(FrameScaler, Error)
+			<< "Can't scale " << crop.toString() << " to "
+			<< outputSize.toString();
+		return -EINVAL;
+	}
+
+	if (stride < inputSize.width * info->planes[0].bytesPerPixel) {
+		LOG(FrameScaler, Error) << "Stride " << stride << " too small";
+		return -EINVAL;
+	}
+
+	planes_.clear();
+
+	unsigned int inputOffset = 0;
+	unsigned int outputOffset = 0;
+
+	for (const PlaneInfo &planeInfo : info->planes) {
+		unsigned int hs = planeInfo.horzSubSample;
+		unsigned int vs = planeInfo.vertSubSample;
+		unsigned int bpp = planeInfo.bytesPerPixel;
+
+		Plane plane;
+		plane.horzSubSample = hs;
+		plane.vertSubSample = vs;
+		plane.inputOffset = inputOffset;
+		plane.outputOffset = outputOffset;
+		plane.outputStride = outputSize.width / hs * bpp;
+		plane.start = crop.x / hs * bpp;
+		plane.length = crop.w / hs * bpp;
+		plane.firstLine = crop.y / vs;
+		plane.outputLines = outputSize.height / vs;
+		plane.filter = computeFilter(crop.h / vs, plane.outputLines);
+
+		for (const ComponentInfo &componentInfo : planeInfo.components) {
+			Component component;
+			component.offset = componentInfo.offset;
+			component.step = componentInfo.step;
+			component.outputCount = plane.outputStride / component.step;
+			component.filter = computeFilter(plane.length / component.step,
+							 component.outputCount);
+			plane.components.push_back(std::move(component));
+		}
+
+		inputOffset += stride * (inputSize.height / vs);
+		outputOffset += plane.outputStride * plane.outputLines;
+		planes_.push_back(std::move(plane));
+	}
+
+	const Implementation &impl = selectImplementation();
+	implementation_ = impl.name;
+	verticalRow_ = impl.verticalRow;
+
+	outputSize_ = outputSize;
+	stride_ = stride;
+	frameSize_ = outputOffset;
+
+	LOG(FrameScaler, Debug)
+		<< "Scaling " << crop.toString() << " of "
+		<< inputSize.toString() << "-" << utils::hex(format)
+		<< " to " << outputSize.toString() << " with "
+		<< implementation_ << " implementation";
+
+	return 0;
+}
+
+/**
+ * \brief Crop and scale a frame
+ * \param[in] src The input frame
+ * \param[out] dst The output buffer, of at least frameSize() bytes
+ * \param[in] pool The thread pool to process the frame on, or nullptr to use
+ * the global thread pool
+ *
+ * The scaler shall be configured before use.
+ */
+void FrameScaler::process(const uint8_t *src, uint8_t *dst,
+			  ThreadPool *pool) const
+{
+	if (!implementation_)
+		return;
+
+	if (!pool)
+		pool = ThreadPool::instance();
+
+	unsigned int count = (outputSize_.height + stripeHeight - 1) / stripeHeight;
+
+	pool->parallelFor(count, [&](unsigned int i) {
+		process(src, dst, i * stripeHeight, stripeHeight);
+	});
+}
+
+/**
+ * \brief Crop and scale a horizontal stripe of a frame
+ * \param[in] src The input frame
+ * \param[out] dst The output buffer, of at least frameSize() bytes
+ * \param[in] first The index of the first output line to produce
+ * \param[in] count The number of output lines to produce
+ *
+ * This method produces output lines \a first to \a first + \a count - 1 only,
+ * \a first and \a count shall be even for the formats with vertically
+ * subsampled components. The \a src and \a dst buffers point to the beginning
+ * of the full frames. As the scaler holds no per-frame state, stripes of the
+ * same frame can be processed concurrently from different threads.
+ */
+void FrameScaler::process(const uint8_t *src, uint8_t *dst, unsigned int first,
+			  unsigned int count) const
+{
+	if (!implementation_)
+		return;
+
+	for (const Plane &plane : planes_) {
+		const Filter &filter = plane.filter;
+		unsigned int begin = first / plane.vertSubSample;
+		unsigned int end = std::min((first + count) / plane.vertSubSample,
+					    plane.outputLines);
+
+		std::vector<const uint8_t *> rows(filter.taps);
+		std::vector<uint16_t> line(plane.length);
+
+		for (unsigned int y = begin; y < end; ++y) {
+			const uint8_t *input = src + plane.inputOffset
+					     + (plane.firstLine + filter.first[y]) * stride_
+					     + plane.start;
+			for (unsigned int t = 0; t < filter.taps; ++t)
+				rows[t] = input + t * stride_;
+
+			verticalRow_(rows.data(), &filter.weights[y * filter.taps],
+				     filter.taps, line.data(), plane.length);
+
+			uint8_t *output = dst + plane.outputOffset
+					+ y * plane.outputStride;
+
+			for (const Component &component : plane.components) {
+				const Filter &horz = component.filter;
+				const unsigned int step = component.step;
+				const uint16_t *in = line.data() + component.offset;
+				uint8_t *out = output + component.offset;
+
+				for (unsigned int x = 0; x < component.outputCount; ++x) {
+					const uint16_t *samples = in + horz.first[x] * step;
+					const int16_t *weights = &horz.weights[x * horz.taps];
+					unsigned int sum = 1 << 13;
+
+					for (unsigned int t = 0; t < horz.taps; ++t)
+						sum += weights[t] * samples[t * step];
+
+					out[x * step] = sum >> 14;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \fn FrameScaler::outputSize()
+ * \brief Retrieve the configured output size
+ * \return The output frame size in pixels
+ */
+
+/**
+ * \brief Retrieve the size of the output frames
+ * \return The size of the output frames in bytes
+ */
+unsigned int FrameScaler::frameSize() const
+{
+	return frameSize_;
+}
+
+/**
+ * \fn FrameScaler::implementation()
+ * \brief Retrieve the name of the implementation used by the scaler
+ * \return The implementation name, or nullptr if the scaler isn't configured
+ */
+
+/*
+ * Compute the filter taps scaling \a input samples to \a output samples, with
+ * an area filter for downscaling and a bilinear filter otherwise. All output
+ * samples use the same number of taps, with zero weights for the unused ones,
+ * and the taps are shifted to stay within the input.
+ */
+FrameScaler::Filter FrameScaler::computeFilter(unsigned int input,
+					       unsigned int output)
+{
+	const double scale = static_cast<double>(input) / output;
+	std::vector<unsigned int> starts(output);
+	std::vector<std::vector<double>> coeffs(output);
+
+	for (unsigned int i = 0; i < output; ++i) {
+		std::vector<double> &coeff = coeffs[i];
+
+		if (scale > 1.0) {
+			double begin = i * scale;
+			double end = (i + 1) * scale;
+			unsigned int last = std::min<unsigned int>(std::ceil(end), input);
+
+			starts[i] = std::floor(begin);
+			for (unsigned int j = starts[i]; j < last; ++j) {
+				double overlap = std::min(end, j + 1.0) - std::max(begin, j + 0.0);
+				coeff.push_back(std::max(overlap, 0.0) / scale);
+			}
+		} else if (input == 1) {
+			starts[i] = 0;
+			coeff.push_back(1.0);
+		} else {
+			double pos = (i + 0.5) * scale - 0.5;
+			int start = std::floor(pos);
+			start = std::min(std::max(start, 0), static_cast<int>(input) - 2);
+			double frac = std::min(std::max(pos - start, 0.0), 1.0);
+
+			starts[i] = start;
+			coeff.push_back(1.0 - frac);
+			coeff.push_back(frac);
+		}
+	}
+
+	Filter filter;
+	filter.taps = 0;
+	for (const std::vector<double> &coeff : coeffs)
+		filter.taps = std::max<unsigned int>(filter.taps, coeff.size());
+
+	filter.first.resize(output);
+	filter.weights.assign(output * filter.taps, 0);
+
+	for (unsigned int i = 0; i < output; ++i) {
+		const std::vector<double> &coeff = coeffs[i];
+		unsigned int first = std::min(starts[i], input - filter.taps);
+		int16_t *weights = &filter.weights[i * filter.taps + starts[i] - first];
+
+		/* Quantize the weights, keeping their sum exact. */
+		int sum = 0;
+		unsigned int largest = 0;
+		for (unsigned int t = 0; t < coeff.size(); ++t) {
+			weights[t] = std::lround(coeff[t] * weightOne);
+			sum += weights[t];
+			if (weights[t] > weights[largest])
+				largest = t;
+		}
+
+		weights[largest] += weightOne - sum;
+		filter.first[i] = first;
+	}
+
+	return filter;
+}
+
+} /* namespace libcamera */
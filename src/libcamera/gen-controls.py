@@ -44,7 +44,7 @@ ${description}
 
         ctrls_doc.append(doc_template.substitute(info))
         ctrls_def.append(def_template.substitute(info))
-        ctrls_map.append('\t{ ' + id_name + ', &' + name + ' },')
+        ctrls_map.append('\t&' + name + ',')
 
     return {
         'controls_doc': '\n\n'.join(ctrls_doc),
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * buffer_pool_manager.h - Internal buffer pools shared between cameras
+ */
+#ifndef __LIBCAMERA_BUFFER_POOL_MANAGER_H__
+#define __LIBCAMERA_BUFFER_POOL_MANAGER_H__
+
+#include <array>
+#include <map>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/timer.h>
+
+#include "dma_heap.h"
+#include "v4l2_videodevice.h"
+
+namespace libcamera {
+
+class CameraData;
+
+class BufferPoolManager
+{
+public:
+	explicit BufferPoolManager(DmaHeap::Type type = DmaHeap::System);
+	BufferPoolManager(const BufferPoolManager &) = delete;
+	BufferPoolManager &operator=(const BufferPoolManager &) = delete;
+	~BufferPoolManager();
+
+	bool isValid() const { return heap_.isValid(); }
+
+	void setIdlePeriod(unsigned int msec) { idlePeriod_ = msec; }
+	void addCamera(const CameraData *data, unsigned int group);
+
+	BufferPool *acquire(const CameraData *data, const std::string &name,
+			    const V4L2DeviceFormat &format, unsigned int count);
+	BufferPool *acquire(const CameraData *data, const std::string &name,
+			    V4L2VideoDevice *video, unsigned int count);
+	void release(const CameraData *data);
+
+	size_t allocatedSize() const;
+
+private:
+	struct Slot {
+		Slot()
+			: user(nullptr), planesCount(0), sizes{}
+		{
+		}
+
+		const CameraData *user;
+		unsigned int planesCount;
+		std::array<size_t, 3> sizes;
+		std::vector<std::array<int, 3>> dmabufs;
+		BufferPool pool;
+	};
+
+	Slot *slot(const CameraData *data, const std::string &name);
+	int allocate(Slot *slot, const V4L2DeviceFormat &format,
+		     unsigned int count);
+	int populate(Slot *slot, const V4L2DeviceFormat &format,
+		     unsigned int count);
+	bool put(Slot *slot);
+	void free(Slot *slot);
+
+	void idleTimeout(Timer *timer);
+
+	DmaHeap heap_;
+	unsigned int idlePeriod_;
+	Timer idleTimer_;
+
+	std::map<const CameraData *, unsigned int> groups_;
+	std::map<std::pair<unsigned int, std::string>, Slot> slots_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BUFFER_POOL_MANAGER_H__ */
@@ -7,6 +7,8 @@
 #ifndef __LIBCAMERA_CAMERA_CONTROLS_H__
 #define __LIBCAMERA_CAMERA_CONTROLS_H__
 
+#include <vector>
+
 #include "control_validator.h"
 
 namespace libcamera {
@@ -23,6 +25,7 @@ public:
 
 private:
 	Camera *camera_;
+	std::vector<bool> supported_;
 };
 
 } /* namespace libcamera */
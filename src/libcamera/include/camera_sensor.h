@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_CAMERA_SENSOR_H__
 #define __LIBCAMERA_CAMERA_SENSOR_H__
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -19,10 +20,20 @@ namespace libcamera {
 class ControlInfoMap;
 class ControlList;
 class MediaEntity;
+class MediaRequest;
+class V4L2ControlBatch;
 class V4L2Subdevice;
 
 struct V4L2SubdeviceFormat;
 
+struct CameraSensorMode {
+	Size size;
+	unsigned int lineLength;
+	unsigned int frameLength;
+	unsigned int maxFrameLength;
+	float maxFrameRate;
+};
+
 class CameraSensor : protected Loggable
 {
 public:
@@ -33,29 +44,81 @@ public:
 	CameraSensor &operator=(const CameraSensor &) = delete;
 
 	int init();
+	static std::vector<int> initAll(const std::vector<CameraSensor *> &sensors);
 
 	const MediaEntity *entity() const { return entity_; }
 	const std::vector<unsigned int> &mbusCodes() const { return mbusCodes_; }
 	const std::vector<Size> &sizes() const { return sizes_; }
 	const Size &resolution() const;
 
+	uint64_t pixelRate() const { return pixelRate_; }
+	const CameraSensorMode *findMode(const Size &size,
+					 float minFrameRate = 0.0f) const;
 	V4L2SubdeviceFormat getFormat(const std::vector<unsigned int> &mbusCodes,
-				      const Size &size) const;
+				      const Size &size,
+				      float minFrameRate = 0.0f) const;
 	int setFormat(V4L2SubdeviceFormat *format);
+	const CameraSensorMode *mode() const { return mode_; }
+
+	bool cropSupported() const { return cropSupported_; }
+	const Rectangle &cropBounds() const { return cropBounds_; }
+	const std::vector<unsigned int> &binningFactors() const { return binningFactors_; }
+	V4L2SubdeviceFormat getFormat(const std::vector<unsigned int> &mbusCodes,
+				      const Size &size, const Rectangle &roi,
+				      Rectangle *crop,
+				      float minFrameRate = 0.0f) const;
+	int setFormat(V4L2SubdeviceFormat *format, Rectangle *crop);
+
+	int frameDurationLimits(int64_t *minDuration, int64_t *maxDuration,
+				const CameraSensorMode *mode = nullptr) const;
+	int setFrameDuration(ControlList *ctrls, int64_t *duration) const;
 
 	const ControlInfoMap &controls() const;
 	int getControls(ControlList *ctrls);
-	int setControls(ControlList *ctrls);
+	int setControls(ControlList *ctrls, MediaRequest *request = nullptr);
+	int prepareControls(V4L2ControlBatch *batch,
+			    const std::vector<unsigned int> &ids) const;
+	int getControls(V4L2ControlBatch *batch);
+	int setControls(V4L2ControlBatch *batch,
+			MediaRequest *request = nullptr);
+	int setControlEventsEnabled(bool enable);
 
 protected:
 	std::string logPrefix() const;
 
 private:
+	struct ModeGroup {
+		float aspectRatio;
+		std::vector<CameraSensorMode> modes;
+	};
+
+	void initCrop();
+	void initModes();
+	CameraSensorMode computeMode(const Size &size) const;
+	unsigned int findCode(const std::vector<unsigned int> &mbusCodes) const;
+	int64_t frameDuration(const CameraSensorMode &mode,
+			      unsigned int frameLength) const;
+
 	const MediaEntity *entity_;
 	V4L2Subdevice *subdev_;
 
 	std::vector<unsigned int> mbusCodes_;
 	std::vector<Size> sizes_;
+
+	uint64_t pixelRate_;
+	bool hasVblank_;
+	unsigned int hblank_;
+	unsigned int vblank_;
+	unsigned int maxVblank_;
+	std::vector<ModeGroup> modeGroups_;
+	const CameraSensorMode *mode_;
+
+	bool cropSupported_;
+	bool cropActive_;
+	Rectangle cropBounds_;
+	Rectangle cropDefault_;
+	std::vector<unsigned int> binningFactors_;
+	CameraSensorMode cropMode_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_server_protocol.h - Camera server wire protocol
+ */
+#ifndef __LIBCAMERA_CAMERA_SERVER_PROTOCOL_H__
+#define __LIBCAMERA_CAMERA_SERVER_PROTOCOL_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ipc_unixsocket.h"
+
+namespace libcamera {
+
+namespace CameraServerProtocol {
+
+static constexpr uint32_t Version = 1;
+static constexpr unsigned int MaxPlanes = 3;
+
+enum MessageType : uint32_t {
+	HelloMessage,
+	WelcomeMessage,
+	StreamInfoMessage,
+	BufferInfoMessage,
+	FrameMessage,
+	ReleaseMessage,
+};
+
+/* Client to server, first message on the connection. */
+struct Hello {
+	uint32_t type;
+	uint32_t version;
+	uint32_t maxHeld;
+};
+
+/* Server to client, maxHeld is 0 if the client is rejected. */
+struct Welcome {
+	uint32_t type;
+	uint32_t version;
+	uint32_t maxHeld;
+	uint32_t streams;
+};
+
+struct StreamInfo {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bufferCount;
+};
+
+/* Carries one file descriptor per plane. */
+struct BufferInfo {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t index;
+	uint32_t planes;
+	uint32_t length[MaxPlanes];
+};
+
+struct Frame {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t index;
+	uint32_t sequence;
+	uint32_t bytesused;
+	uint32_t dropped;
+	uint64_t timestamp;
+};
+
+/* Client to server, the client doesn't access the buffer anymore. */
+struct Release {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t index;
+};
+
+template<typename T>
+void pack(IPCUnixSocket::Payload *payload, const T &message)
+{
+	payload->data.resize(sizeof(message));
+	memcpy(payload->data.data(), &message, sizeof(message));
+	payload->fds.clear();
+}
+
+inline int type(const IPCUnixSocket::Payload &payload)
+{
+	uint32_t type;
+
+	if (payload.data.size() < sizeof(type))
+		return -EINVAL;
+
+	memcpy(&type, payload.data.data(), sizeof(type));
+	return type;
+}
+
+template<typename T>
+bool unpack(const IPCUnixSocket::Payload &payload, T *message)
+{
+	if (payload.data.size() != sizeof(*message))
+		return false;
+
+	memcpy(message, payload.data.data(), sizeof(*message));
+	return true;
+}
+
+} /* namespace CameraServerProtocol */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_SERVER_PROTOCOL_H__ */
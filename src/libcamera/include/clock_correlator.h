@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * clock_correlator.h - Conversion of timestamps between clock domains
+ */
+#ifndef __LIBCAMERA_CLOCK_CORRELATOR_H__
+#define __LIBCAMERA_CLOCK_CORRELATOR_H__
+
+#include <stdint.h>
+
+#include <libcamera/buffer.h>
+
+namespace libcamera {
+
+class ClockCorrelator
+{
+public:
+	static constexpr uint64_t DefaultPeriod = 1000000000ULL;
+
+	explicit ClockCorrelator(uint64_t period = DefaultPeriod);
+
+	bool convert(uint64_t timestamp, Buffer::Clock from, Buffer::Clock to,
+		     uint64_t *result);
+	void reset() { valid_ = false; }
+
+private:
+	static constexpr unsigned int ClockCount = Buffer::ClockRealtime + 1;
+
+	void sample();
+
+	uint64_t period_;
+	bool valid_;
+	uint64_t lastSample_;
+	int64_t offsets_[ClockCount];
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CLOCK_CORRELATOR_H__ */
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration_cache.h - Cache of camera configuration validation results
+ */
+#ifndef __LIBCAMERA_CONFIGURATION_CACHE_H__
+#define __LIBCAMERA_CONFIGURATION_CACHE_H__
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include <libcamera/camera.h>
+
+#include "thread.h"
+#include "utils.h"
+
+namespace libcamera {
+
+class ConfigurationCache
+{
+public:
+	static constexpr unsigned int DefaultCapacity = 16;
+
+	explicit ConfigurationCache(unsigned int capacity = DefaultCapacity)
+		: capacity_(capacity)
+	{
+	}
+
+	ConfigurationCache(const ConfigurationCache &) = delete;
+	ConfigurationCache &operator=(const ConfigurationCache &) = delete;
+
+	static std::string key(const CameraConfiguration &config);
+
+	template<typename Config>
+	bool lookup(const std::string &key, Config *config,
+		    CameraConfiguration::Status *status)
+	{
+		MutexLocker locker(mutex_);
+
+		const Entry *entry = find(key);
+		if (!entry)
+			return false;
+
+		*config = *static_cast<const Config *>(entry->config.get());
+		*status = entry->status;
+		return true;
+	}
+
+	void store(const std::string &key,
+		   std::unique_ptr<CameraConfiguration> config,
+		   CameraConfiguration::Status status);
+	void clear();
+
+	template<typename Config>
+	CameraConfiguration::Status
+	validate(Config *config, CameraConfiguration::Status (Config::*validator)(),
+		 std::shared_ptr<Camera> Config::*camera)
+	{
+		const std::string key = ConfigurationCache::key(*config);
+		std::shared_ptr<Camera> reference = config->*camera;
+		CameraConfiguration::Status status;
+
+		if (lookup(key, config, &status)) {
+			config->*camera = reference;
+			return status;
+		}
+
+		status = (config->*validator)();
+
+		std::unique_ptr<Config> entry = utils::make_unique<Config>(*config);
+		((*entry).*camera).reset();
+		store(key, std::move(entry), status);
+
+		return status;
+	}
+
+private:
+	struct Entry {
+		std::string key;
+		std::unique_ptr<CameraConfiguration> config;
+		CameraConfiguration::Status status;
+	};
+
+	const Entry *find(const std::string &key);
+
+	unsigned int capacity_;
+
+	Mutex mutex_;
+	std::list<Entry> entries_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CONFIGURATION_CACHE_H__ */
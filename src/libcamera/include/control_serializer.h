@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * control_serializer.h - Control (de)serializer
+ */
+#ifndef __LIBCAMERA_CONTROL_SERIALIZER_H__
+#define __LIBCAMERA_CONTROL_SERIALIZER_H__
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <libcamera/controls.h>
+
+struct ipa_controls_header;
+
+namespace libcamera {
+
+class ByteStreamBuffer;
+
+class ControlSerializer
+{
+public:
+	ControlSerializer();
+
+	void reset();
+
+	static size_t binarySize(const ControlInfoMap &info);
+	static size_t binarySize(const ControlList &list);
+
+	int serialize(const ControlInfoMap &info, ByteStreamBuffer &buffer);
+	int serialize(const ControlList &list, ByteStreamBuffer &buffer);
+
+	template<typename T>
+	T deserialize(ByteStreamBuffer &buffer);
+
+private:
+	static size_t binarySize(const ControlValue &value);
+	static size_t binarySize(const ControlRange &range);
+
+	static void store(const ControlValue &value, ByteStreamBuffer &buffer);
+	static void store(const ControlRange &range, ByteStreamBuffer &buffer);
+
+	ControlValue loadValue(ByteStreamBuffer &buffer, ControlType type,
+			       bool isArray = false, unsigned int count = 1);
+	ControlRange loadRange(ByteStreamBuffer &buffer, ControlType minType,
+			       ControlType maxType);
+
+	int readHeader(ByteStreamBuffer &buffer, ipa_controls_header *hdr);
+
+	unsigned int serial_;
+	std::vector<std::unique_ptr<ControlId>> controlIds_;
+	std::map<unsigned int, ControlInfoMap> infoMaps_;
+};
+
+template<>
+ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &buffer);
+template<>
+ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer);
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CONTROL_SERIALIZER_H__ */
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed_controls.h - Sensor controls applied with a per-control delay
+ */
+#ifndef __LIBCAMERA_DELAYED_CONTROLS_H__
+#define __LIBCAMERA_DELAYED_CONTROLS_H__
+
+#include <map>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class CameraSensor;
+
+class DelayedControls
+{
+public:
+	static constexpr unsigned int FRAME_DEPTH = 16;
+
+	DelayedControls(CameraSensor *sensor,
+			const std::unordered_map<uint32_t, unsigned int> &delays);
+
+	int reset();
+
+	bool push(const ControlList &controls);
+	bool pushFrame(const ControlList &controls, uint32_t *sequence);
+	ControlList get(uint32_t sequence) const;
+
+	void applyControls(uint32_t sequence);
+
+	unsigned int maxDelay() const { return maxDelay_; }
+
+private:
+	ControlList &values(uint32_t frame) { return values_[frame % FRAME_DEPTH]; }
+	const ControlList &values(uint32_t frame) const { return values_[frame % FRAME_DEPTH]; }
+
+	void queueFrame();
+
+	CameraSensor *sensor_;
+	std::unordered_map<uint32_t, unsigned int> delays_;
+	unsigned int maxDelay_;
+
+	uint32_t queueCount_;
+	uint32_t writeCount_;
+	std::vector<ControlList> values_;
+	ControlList queued_;
+	std::map<uint32_t, ControlList> overrides_;
+	ControlList written_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DELAYED_CONTROLS_H__ */
@@ -13,6 +13,8 @@
 
 #include <linux/media.h>
 
+#include <libcamera/signal.h>
+
 namespace libcamera {
 
 class MediaDevice;
@@ -24,6 +26,7 @@ public:
 
 	void add(const std::string &entity);
 
+	const std::string &driver() const { return driver_; }
 	bool match(const MediaDevice *device) const;
 
 private:
@@ -43,13 +46,20 @@ public:
 
 	std::shared_ptr<MediaDevice> search(const DeviceMatch &dm);
 
+	Signal<> devicesAdded;
+
 protected:
 	std::shared_ptr<MediaDevice> createDevice(const std::string &deviceNode);
+	void probeDevices(const std::vector<std::string> &deviceNodes);
+	virtual int populateMediaDevice(const std::shared_ptr<MediaDevice> &media) = 0;
 	void addDevice(const std::shared_ptr<MediaDevice> &media);
 	void removeDevice(const std::string &deviceNode);
 
 private:
+	void populateDevices(const std::string &driver);
+
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	std::vector<std::shared_ptr<MediaDevice>> probed_;
 };
 
 } /* namespace libcamera */
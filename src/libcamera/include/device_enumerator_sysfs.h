@@ -22,8 +22,10 @@ public:
 	int init();
 	int enumerate();
 
+protected:
+	int populateMediaDevice(const std::shared_ptr<MediaDevice> &media) override;
+
 private:
-	int populateMediaDevice(const std::shared_ptr<MediaDevice> &media);
 	std::string lookupDeviceNode(int major, int minor);
 };
 
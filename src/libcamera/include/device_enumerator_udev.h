@@ -14,6 +14,8 @@
 #include <string>
 #include <sys/types.h>
 
+#include <libcamera/timer.h>
+
 #include "device_enumerator.h"
 
 struct udev;
@@ -35,6 +37,9 @@ public:
 	int init() final;
 	int enumerate() final;
 
+protected:
+	int populateMediaDevice(const std::shared_ptr<MediaDevice> &media) override;
+
 private:
 	struct udev *udev_;
 	struct udev_monitor *monitor_;
@@ -63,11 +68,14 @@ private:
 	std::map<dev_t, MediaDeviceDeps *> devMap_;
 
 	int addUdevDevice(struct udev_device *dev);
-	int populateMediaDevice(const std::shared_ptr<MediaDevice> &media);
 	std::string lookupDeviceNode(dev_t devnum);
 
 	int addV4L2Device(dev_t devnum);
 	void udevNotify(EventNotifier *notifier);
+	void processEvents(Timer *timer);
+
+	std::list<struct udev_device *> events_;
+	Timer eventsTimer_;
 };
 
 } /* namespace libcamera */
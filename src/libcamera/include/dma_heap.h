@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dma_heap.h - dma-heap memory allocator
+ */
+#ifndef __LIBCAMERA_DMA_HEAP_H__
+#define __LIBCAMERA_DMA_HEAP_H__
+
+#include <array>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+namespace libcamera {
+
+class Buffer;
+class Stream;
+class V4L2DeviceFormat;
+
+class DmaHeap
+{
+public:
+	enum Type {
+		System,
+		Cma,
+	};
+
+	explicit DmaHeap(Type type = System);
+	DmaHeap(const DmaHeap &) = delete;
+	DmaHeap &operator=(const DmaHeap &) = delete;
+	~DmaHeap();
+
+	bool isValid() const { return fd_ >= 0; }
+	int alloc(size_t size);
+
+private:
+	int fd_;
+};
+
+class DmaHeapAllocator
+{
+public:
+	explicit DmaHeapAllocator(DmaHeap::Type type = DmaHeap::System);
+	DmaHeapAllocator(const DmaHeapAllocator &) = delete;
+	DmaHeapAllocator &operator=(const DmaHeapAllocator &) = delete;
+	~DmaHeapAllocator();
+
+	bool isValid() const { return heap_.isValid(); }
+
+	int allocate(const V4L2DeviceFormat &format, unsigned int count);
+	void release();
+
+	unsigned int count() const { return buffers_.size(); }
+	const std::array<int, 3> &dmabufs(unsigned int index) const
+	{
+		return buffers_[index];
+	}
+
+	std::unique_ptr<Buffer> createBuffer(Stream *stream, unsigned int index);
+
+private:
+	DmaHeap heap_;
+	std::vector<std::array<int, 3>> buffers_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DMA_HEAP_H__ */
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * embedded_data.h - Camera sensor embedded data parsers
+ */
+#ifndef __LIBCAMERA_EMBEDDED_DATA_H__
+#define __LIBCAMERA_EMBEDDED_DATA_H__
+
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace libcamera {
+
+struct SensorMetadata {
+	uint32_t exposure;
+	uint32_t gain;
+	uint32_t frameLength;
+};
+
+class EmbeddedDataParser
+{
+public:
+	virtual ~EmbeddedDataParser() {}
+
+	static std::unique_ptr<EmbeddedDataParser> create(const std::string &sensor);
+
+	virtual int parse(const uint8_t *data, size_t size,
+			  SensorMetadata *metadata) const = 0;
+};
+
+class SmiaEmbeddedDataParser : public EmbeddedDataParser
+{
+public:
+	struct Register {
+		uint16_t address;
+		unsigned int size;
+	};
+
+	struct Layout {
+		unsigned int bitsPerSample;
+		Register exposure;
+		Register gain;
+		Register frameLength;
+	};
+
+	explicit SmiaEmbeddedDataParser(const Layout &layout);
+
+	int parse(const uint8_t *data, size_t size,
+		  SensorMetadata *metadata) const override;
+
+private:
+	int parseRegisters(const uint8_t *data, size_t size,
+			   std::map<uint16_t, uint8_t> *registers) const;
+	int value(const std::map<uint16_t, uint8_t> &registers,
+		  const Register &reg, uint32_t *value) const;
+
+	Layout layout_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EMBEDDED_DATA_H__ */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * encoder_libjpeg.h - JPEG encoding using libjpeg
+ */
+#ifndef __LIBCAMERA_ENCODER_LIBJPEG_H__
+#define __LIBCAMERA_ENCODER_LIBJPEG_H__
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class EncoderLibJpeg
+{
+public:
+	EncoderLibJpeg();
+	EncoderLibJpeg(const EncoderLibJpeg &) = delete;
+	EncoderLibJpeg &operator=(const EncoderLibJpeg &) = delete;
+	~EncoderLibJpeg();
+
+	int configure(const Size &inputSize, unsigned int pixelFormat,
+		      const Size &outputSize, int quality);
+	int encode(const uint8_t *luma, const uint8_t *chroma,
+		   uint8_t *dst, size_t dstSize,
+		   const std::vector<uint8_t> &exif);
+
+	const Size &outputSize() const { return outputSize_; }
+
+private:
+	struct Context;
+
+	int compress(const uint8_t *luma, const uint8_t *chroma,
+		     uint8_t *dst, size_t dstSize,
+		     const std::vector<uint8_t> &exif);
+	void packRow(const uint8_t *luma, const uint8_t *chroma,
+		     unsigned int line);
+
+	std::unique_ptr<Context> context_;
+
+	Size inputSize_;
+	Size outputSize_;
+	unsigned int pixelFormat_;
+
+	bool rgb_;
+	bool packed_;
+	unsigned int vertSubSample_;
+	bool swap_;
+	unsigned int yPos_;
+	unsigned int cbPos_;
+
+	std::vector<unsigned int> columns_;
+	std::vector<uint8_t> row_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_ENCODER_LIBJPEG_H__ */
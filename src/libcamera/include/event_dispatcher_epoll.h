@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+#ifndef __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+#define __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+
+#include <libcamera/event_dispatcher.h>
+
+#include <map>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+
+#include "timer_queue.h"
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+	void updateEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		bool empty() const;
+
+		int fd;
+		bool registered;
+		EventNotifier *notifiers[3];
+	};
+
+	std::map<int, EventNotifierSetEpoll> notifiers_;
+	std::vector<int> unregistered_;
+	TimerQueue timers_;
+	int epollfd_;
+	int eventfd_;
+
+	std::vector<struct epoll_event> events_;
+	bool processingEvents_;
+
+	int update(EventNotifierSetEpoll *set);
+	int wait();
+	void processInterrupt();
+	void processNotifiers(unsigned int count);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__ */
@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_io_uring.h - io_uring-based event dispatcher
+ */
+#ifndef __LIBCAMERA_EVENT_DISPATCHER_IO_URING_H__
+#define __LIBCAMERA_EVENT_DISPATCHER_IO_URING_H__
+
+#include <libcamera/event_dispatcher.h>
+
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "timer_queue.h"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherIOUring final : public EventDispatcher
+{
+public:
+	EventDispatcherIOUring();
+	~EventDispatcherIOUring();
+
+	bool isValid() const { return ringfd_ >= 0; }
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+	void updateEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	struct EventNotifierSetIOUring {
+		uint32_t events() const;
+		bool empty() const;
+
+		int fd;
+		EventNotifier *notifiers[3];
+		uint32_t armed;
+		bool cancelling;
+	};
+
+	struct Ring {
+		unsigned int *head;
+		unsigned int *tail;
+		unsigned int mask;
+		unsigned int entries;
+	};
+
+	int setup();
+	void cleanup();
+
+	io_uring_sqe *sqe();
+	int enter(unsigned int minComplete);
+
+	void pollAdd(int fd, uint32_t events, void *data);
+	void pollRemove(void *data);
+	void update(EventNotifierSetIOUring *set);
+
+	void processInterrupt();
+	void processCompletion(const io_uring_cqe &cqe);
+	void processCompletions();
+
+	std::map<int, std::unique_ptr<EventNotifierSetIOUring>> notifiers_;
+	std::vector<int> unregistered_;
+	TimerQueue timers_;
+	int ringfd_;
+	int eventfd_;
+
+	void *sqRing_;
+	size_t sqRingSize_;
+	void *cqRing_;
+	size_t cqRingSize_;
+	io_uring_sqe *sqes_;
+	size_t sqesSize_;
+
+	Ring sq_;
+	unsigned int *sqArray_;
+	unsigned int sqTail_;
+	unsigned int submit_;
+
+	Ring cq_;
+	io_uring_cqe *cqes_;
+
+	bool processingEvents_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EVENT_DISPATCHER_IO_URING_H__ */
@@ -9,10 +9,11 @@
 
 #include <libcamera/event_dispatcher.h>
 
-#include <list>
 #include <map>
 #include <vector>
 
+#include "timer_queue.h"
+
 struct pollfd;
 
 namespace libcamera {
@@ -28,6 +29,7 @@ public:
 
 	void registerEventNotifier(EventNotifier *notifier);
 	void unregisterEventNotifier(EventNotifier *notifier);
+	void updateEventNotifier(EventNotifier *notifier);
 
 	void registerTimer(Timer *timer);
 	void unregisterTimer(Timer *timer);
@@ -42,15 +44,16 @@ private:
 	};
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	TimerQueue timers_;
 	int eventfd_;
 
+	std::vector<struct pollfd> pollfds_;
+
 	bool processingEvents_;
 
 	int poll(std::vector<struct pollfd> *pollfds);
 	void processInterrupt(const struct pollfd &pfd);
 	void processNotifiers(const std::vector<struct pollfd> &pollfds);
-	void processTimers();
 };
 
 } /* namespace libcamera */
@@ -8,6 +8,7 @@
 #ifndef __LIBCAMERA_FORMATS_H__
 #define __LIBCAMERA_FORMATS_H__
 
+#include <array>
 #include <map>
 #include <vector>
 
@@ -29,6 +30,40 @@ private:
 	std::map<unsigned int, std::vector<SizeRange>> data_;
 };
 
+struct PixelFormatPlaneInfo {
+	unsigned int bytesPerGroup;
+	unsigned int verticalSubSampling;
+};
+
+struct PixelFormatInfo {
+	enum ColourEncoding {
+		ColourEncodingRGB,
+		ColourEncodingYUV,
+		ColourEncodingRAW,
+	};
+
+	bool isValid() const { return format != 0; }
+
+	static const PixelFormatInfo &info(unsigned int format);
+
+	unsigned int numPlanes() const;
+
+	unsigned int stride(unsigned int width, unsigned int plane,
+			    unsigned int align = 1) const;
+	unsigned int planeSize(unsigned int height, unsigned int plane,
+			       unsigned int stride) const;
+	unsigned int frameSize(const Size &size, unsigned int align = 1) const;
+
+	const char *name;
+	unsigned int format;
+	unsigned int bitsPerPixel;
+	ColourEncoding colourEncoding;
+	bool packed;
+
+	unsigned int pixelsPerGroup;
+	std::array<PixelFormatPlaneInfo, 3> planes;
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_FORMATS_H__ */
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_context.h - Per-frame context tracking for pipeline handlers
+ */
+#ifndef __LIBCAMERA_FRAME_CONTEXT_H__
+#define __LIBCAMERA_FRAME_CONTEXT_H__
+
+#include <functional>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/request.h>
+
+namespace libcamera {
+
+struct FrameContext {
+	unsigned int frame;
+	Request *request;
+};
+
+class FrameContextRingBase
+{
+protected:
+	static void attach(Request *request, FrameContext *context)
+	{
+		request->frameContext_ = context;
+	}
+
+	static FrameContext *attached(const Request *request)
+	{
+		return request->frameContext_;
+	}
+};
+
+template<typename T>
+class FrameContextRing : protected FrameContextRingBase
+{
+public:
+	explicit FrameContextRing(unsigned int depth)
+		: contexts_(depth), active_(depth, false)
+	{
+	}
+
+	unsigned int depth() const { return contexts_.size(); }
+
+	T *create(unsigned int frame, Request *request)
+	{
+		unsigned int index = frame % contexts_.size();
+		if (active_[index])
+			return nullptr;
+
+		T &context = contexts_[index];
+		context = T();
+		context.frame = frame;
+		context.request = request;
+		active_[index] = true;
+
+		if (request)
+			attach(request, &context);
+
+		return &context;
+	}
+
+	void destroy(T *context)
+	{
+		active_[context - contexts_.data()] = false;
+	}
+
+	T *find(unsigned int frame)
+	{
+		unsigned int index = frame % contexts_.size();
+		if (!active_[index] || contexts_[index].frame != frame)
+			return nullptr;
+
+		return &contexts_[index];
+	}
+
+	T *find(const Request *request)
+	{
+		FrameContext *context = attached(request);
+		if (!context || !owns(context))
+			return nullptr;
+
+		T *ctx = static_cast<T *>(context);
+		if (!active_[ctx - contexts_.data()] || ctx->request != request)
+			return nullptr;
+
+		return ctx;
+	}
+
+	T *find(const Buffer *buffer)
+	{
+		Request *request = buffer->request();
+		return request ? find(request) : nullptr;
+	}
+
+	template<typename Predicate>
+	T *findIf(Predicate pred)
+	{
+		for (unsigned int index = 0; index < contexts_.size(); ++index) {
+			if (active_[index] && pred(contexts_[index]))
+				return &contexts_[index];
+		}
+
+		return nullptr;
+	}
+
+	template<typename Function>
+	void clear(Function func)
+	{
+		for (unsigned int index = 0; index < contexts_.size(); ++index) {
+			if (!active_[index])
+				continue;
+
+			func(contexts_[index]);
+			active_[index] = false;
+		}
+	}
+
+	void clear()
+	{
+		clear([](T &) {});
+	}
+
+private:
+	bool owns(const FrameContext *context) const
+	{
+		std::less<const FrameContext *> less;
+		const T *first = contexts_.data();
+		const T *last = first + contexts_.size();
+
+		return !less(context, first) && less(context, last);
+	}
+
+	std::vector<T> contexts_;
+	std::vector<bool> active_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_FRAME_CONTEXT_H__ */
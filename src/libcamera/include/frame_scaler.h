@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_scaler.h - CPU cropping and scaling of frames
+ */
+#ifndef __LIBCAMERA_FRAME_SCALER_H__
+#define __LIBCAMERA_FRAME_SCALER_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class ThreadPool;
+
+class FrameScaler
+{
+public:
+	static constexpr unsigned int MAX_SCALE_FACTOR = 16;
+
+	FrameScaler();
+
+	static const std::vector<unsigned int> &formats();
+	static Rectangle centeredCrop(unsigned int format, const Size &inputSize,
+				      const Size &outputSize);
+
+	int configure(unsigned int format, const Size &inputSize,
+		      unsigned int stride, const Rectangle &crop,
+		      const Size &outputSize);
+
+	void process(const uint8_t *src, uint8_t *dst,
+		     ThreadPool *pool = nullptr) const;
+	void process(const uint8_t *src, uint8_t *dst, unsigned int first,
+		     unsigned int count) const;
+
+	const Size &outputSize() const { return outputSize_; }
+	unsigned int frameSize() const;
+	const char *implementation() const { return implementation_; }
+
+private:
+	using VerticalRow = void (*)(const uint8_t *const *rows,
+				     const int16_t *weights, unsigned int taps,
+				     uint16_t *dst, unsigned int length);
+
+	/* The filter taps of every output sample along one dimension. */
+	struct Filter {
+		unsigned int taps;
+		std::vector<unsigned int> first;
+		std::vector<int16_t> weights;
+	};
+
+	struct Component {
+		unsigned int offset;
+		unsigned int step;
+		unsigned int outputCount;
+		Filter filter;
+	};
+
+	struct Plane {
+		unsigned int horzSubSample;
+		unsigned int vertSubSample;
+		unsigned int inputOffset;
+		unsigned int outputOffset;
+		unsigned int outputStride;
+		unsigned int start;
+		unsigned int length;
+		unsigned int firstLine;
+		unsigned int outputLines;
+		Filter filter;
+		std::vector<Component> components;
+	};
+
+	static Filter computeFilter(unsigned int input, unsigned int output);
+
+	Size outputSize_;
+	unsigned int stride_;
+	unsigned int frameSize_;
+	const char *implementation_;
+	VerticalRow verticalRow_;
+
+	std::vector<Plane> planes_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_FRAME_SCALER_H__ */
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_buffer_registry.h - Registry of the buffers mapped by an IPA
+ */
+#ifndef __LIBCAMERA_IPA_BUFFER_REGISTRY_H__
+#define __LIBCAMERA_IPA_BUFFER_REGISTRY_H__
+
+#include <map>
+#include <sys/types.h>
+#include <vector>
+
+#include <ipa/ipa_interface.h>
+
+namespace libcamera {
+
+class IPABufferRegistry
+{
+public:
+	IPABufferRegistry();
+
+	void map(IPAInterface *ipa, const std::vector<IPABuffer> &buffers);
+	void unmapAll(IPAInterface *ipa);
+
+	unsigned int generation() const { return generation_; }
+	unsigned int size() const { return entries_.size(); }
+
+private:
+	struct PlaneIdentity {
+		dev_t dev;
+		ino_t ino;
+		unsigned int length;
+
+		bool operator==(const PlaneIdentity &other) const
+		{
+			return dev == other.dev && ino == other.ino &&
+			       length == other.length;
+		}
+	};
+
+	struct Entry {
+		std::vector<PlaneIdentity> planes;
+		unsigned int generation;
+	};
+
+	static bool identify(const BufferMemory &memory,
+			     std::vector<PlaneIdentity> *planes);
+
+	unsigned int generation_;
+	std::map<unsigned int, Entry> entries_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_BUFFER_REGISTRY_H__ */
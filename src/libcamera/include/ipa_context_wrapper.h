@@ -7,8 +7,13 @@
 #ifndef __LIBCAMERA_IPA_CONTEXT_WRAPPER_H__
 #define __LIBCAMERA_IPA_CONTEXT_WRAPPER_H__
 
+#include <stdint.h>
+#include <vector>
+
 #include <ipa/ipa_interface.h>
 
+#include "control_serializer.h"
+
 namespace libcamera {
 
 class IPAContextWrapper final : public IPAInterface
@@ -20,20 +25,29 @@ public:
 	int init() override;
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
 		       const std::map<unsigned int, ControlInfoMap> &entityControls) override;
+	void configure(std::map<unsigned int, IPAStream> &&streamConfig,
+		       std::map<unsigned int, ControlInfoMap> &&entityControls) override;
 
 	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
 	void unmapBuffers(const std::vector<unsigned int> &ids) override;
 
 	virtual void processEvent(const IPAOperationData &data) override;
+	virtual void processEvent(IPAOperationData &&data) override;
 
 private:
-	static void queue_frame_action(void *ctx, unsigned int frame);
+	static void queue_frame_action(void *ctx, unsigned int frame,
+				       const struct ipa_operation_data *data);
 	static const struct ipa_callback_ops callbacks_;
 
-	void queueFrameAction(unsigned int frame, const IPAOperationData &data);
+	void queueFrameAction(unsigned int frame, IPAOperationData &&data);
 
 	struct ipa_context *ctx_;
 	IPAInterface *intf_;
+
+	ControlSerializer serializer_;
+	std::vector<uint8_t> controlsData_;
+	std::vector<struct ipa_control_list> lists_;
+	bool processing_;
 };
 
 } /* namespace libcamera */
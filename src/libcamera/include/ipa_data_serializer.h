@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_data_serializer.h - IPA interface data (de)serializer
+ */
+#ifndef __LIBCAMERA_IPA_DATA_SERIALIZER_H__
+#define __LIBCAMERA_IPA_DATA_SERIALIZER_H__
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <ipa/ipa_interface.h>
+
+#include "control_serializer.h"
+
+namespace libcamera {
+
+class ByteStreamBuffer;
+
+class IPADataSerializer
+{
+public:
+	void reset() { controls_.reset(); }
+
+	static size_t binarySize(const std::map<unsigned int, IPAStream> &streams);
+	static size_t binarySize(const std::map<unsigned int, ControlInfoMap> &infoMaps);
+	static size_t binarySize(const std::vector<IPABuffer> &buffers);
+	static size_t binarySize(const std::vector<unsigned int> &ids);
+	static size_t binarySize(const IPAOperationData &data);
+
+	int serialize(const std::map<unsigned int, IPAStream> &streams,
+		      ByteStreamBuffer &buffer);
+	int serialize(const std::map<unsigned int, ControlInfoMap> &infoMaps,
+		      ByteStreamBuffer &buffer);
+	int serialize(const std::vector<IPABuffer> &buffers,
+		      ByteStreamBuffer &buffer, std::vector<int32_t> *fds);
+	int serialize(const std::vector<unsigned int> &ids,
+		      ByteStreamBuffer &buffer);
+	int serialize(const IPAOperationData &data, ByteStreamBuffer &buffer);
+
+	int deserialize(ByteStreamBuffer &buffer,
+			std::map<unsigned int, IPAStream> *streams);
+	int deserialize(ByteStreamBuffer &buffer,
+			std::map<unsigned int, ControlInfoMap> *infoMaps);
+	int deserialize(ByteStreamBuffer &buffer,
+			const std::vector<int32_t> &fds,
+			std::vector<IPABuffer> *buffers);
+	int deserialize(ByteStreamBuffer &buffer,
+			std::vector<unsigned int> *ids);
+	int deserialize(ByteStreamBuffer &buffer, IPAOperationData *data);
+
+private:
+	ControlSerializer controls_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_DATA_SERIALIZER_H__ */
@@ -11,6 +11,7 @@
 
 #include <ipa/ipa_interface.h>
 #include <ipa/ipa_module_info.h>
+#include <libcamera/thread_scheduling.h>
 
 #include "ipa_module.h"
 #include "pipeline_handler.h"
@@ -20,19 +21,34 @@ namespace libcamera {
 class IPAManager
 {
 public:
+	enum ThreadModel {
+		SameThread,
+		ThreadedIPA,
+	};
+
 	static IPAManager *instance();
 
+	void prestartProxies();
+
+	void setThreadScheduling(const ThreadScheduling &scheduling);
+	const ThreadScheduling &threadScheduling() const { return threadScheduling_; }
+
 	std::unique_ptr<IPAInterface> createIPA(PipelineHandler *pipe,
 						uint32_t maxVersion,
-						uint32_t minVersion);
+						uint32_t minVersion,
+						enum ThreadModel threadModel = SameThread);
 
 private:
 	std::vector<IPAModule *> modules_;
+	bool scanned_;
+	ThreadScheduling threadScheduling_;
 
 	IPAManager();
 	~IPAManager();
 
+	void scan();
 	int addDir(const char *libDir);
+	std::unique_ptr<IPAInterface> createProxy(IPAModule *m, const char *name);
 };
 
 } /* namespace libcamera */
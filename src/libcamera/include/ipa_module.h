@@ -48,6 +48,7 @@ private:
 	IPAIntfFactory ipaCreate_;
 
 	int loadIPAModuleInfo();
+	int verifyIPAModuleInfo();
 };
 
 } /* namespace libcamera */
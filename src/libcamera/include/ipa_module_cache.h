@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache.h - Cache of IPA module information
+ */
+#ifndef __LIBCAMERA_IPA_MODULE_CACHE_H__
+#define __LIBCAMERA_IPA_MODULE_CACHE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+
+#include <ipa/ipa_module_info.h>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class IPAModuleInfoCache
+{
+public:
+	static IPAModuleInfoCache *instance();
+
+	bool lookup(const std::string &path, const struct stat &st,
+		    struct IPAModuleInfo *info);
+	void store(const std::string &path, const struct stat &st,
+		   const struct IPAModuleInfo &info);
+
+private:
+	struct Entry {
+		int64_t mtime;
+		uint64_t size;
+		struct IPAModuleInfo info;
+	};
+
+	IPAModuleInfoCache();
+
+	void load();
+	void save();
+
+	Mutex mutex_;
+	std::map<std::string, Entry> cache_;
+	std::string path_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_MODULE_CACHE_H__ */
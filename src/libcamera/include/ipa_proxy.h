@@ -26,8 +26,10 @@ public:
 
 	bool isValid() const { return valid_; }
 
+	static void prestart(unsigned int count) {}
+
 protected:
-	std::string resolvePath(const std::string &file) const;
+	static std::string resolvePath(const std::string &file);
 
 	bool valid_;
 };
@@ -39,6 +41,7 @@ public:
 	virtual ~IPAProxyFactory(){};
 
 	virtual std::unique_ptr<IPAProxy> create(IPAModule *ipam) = 0;
+	virtual void prestart(unsigned int count) = 0;
 
 	const std::string &name() const { return name_; }
 
@@ -49,17 +52,21 @@ private:
 	std::string name_;
 };
 
-#define REGISTER_IPA_PROXY(proxy)			\
-class proxy##Factory final : public IPAProxyFactory	\
+#define REGISTER_IPA_PROXY(proxy, name)			\
+class name##Factory final : public IPAProxyFactory	\
 {							\
 public:							\
-	proxy##Factory() : IPAProxyFactory(#proxy) {}	\
+	name##Factory() : IPAProxyFactory(#name) {}	\
 	std::unique_ptr<IPAProxy> create(IPAModule *ipam)	\
 	{						\
 		return utils::make_unique<proxy>(ipam);	\
 	}						\
+	void prestart(unsigned int count)		\
+	{						\
+		proxy::prestart(count);			\
+	}						\
 };							\
-static proxy##Factory global_##proxy##Factory;
+static name##Factory global_##name##Factory;
 
 } /* namespace libcamera */
 
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_state_store.h - Store of the IPA algorithms state
+ */
+#ifndef __LIBCAMERA_IPA_STATE_STORE_H__
+#define __LIBCAMERA_IPA_STATE_STORE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class IPAStateStore
+{
+public:
+	static IPAStateStore *instance();
+
+	bool lookup(const std::string &camera, std::vector<uint32_t> *state);
+	void store(const std::string &camera, const std::vector<uint32_t> &state);
+
+private:
+	IPAStateStore();
+
+	void load();
+	void save();
+
+	Mutex mutex_;
+	std::map<std::string, std::vector<uint32_t>> states_;
+	std::string path_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_STATE_STORE_H__ */
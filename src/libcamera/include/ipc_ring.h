@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_ring.h - IPC mechanism based on a shared memory ring buffer
+ */
+
+#ifndef __LIBCAMERA_IPC_RING_H__
+#define __LIBCAMERA_IPC_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class IPCRing
+{
+public:
+	enum Role {
+		Producer,
+		Consumer,
+	};
+
+	IPCRing();
+	~IPCRing();
+
+	int create(enum Role role, size_t size);
+	int bind(enum Role role, int memfd, int eventfd);
+	void close();
+	bool isBound() const;
+
+	int memfd() const { return memfd_; }
+	int eventfd() const { return eventfd_; }
+
+	uint8_t *reserve(size_t size);
+	int commit();
+
+	const uint8_t *front(size_t *size);
+	void pop();
+
+	Signal<IPCRing *> readyRead;
+
+private:
+	struct Control;
+
+	int map(enum Role role);
+	void dataNotifier(EventNotifier *notifier);
+
+	int memfd_;
+	int eventfd_;
+
+	Control *control_;
+	uint8_t *data_;
+	size_t mapSize_;
+	uint32_t capacity_;
+
+	uint32_t reservedHead_;
+	uint32_t reservedSize_;
+	uint32_t frontSize_;
+
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPC_RING_H__ */
@@ -33,9 +33,11 @@ public:
 	bool isBound() const;
 
 	int send(const Payload &payload);
+	int send(const std::vector<Payload> &payloads);
 	int receive(Payload *payload);
 
 	Signal<IPCUnixSocket *> readyRead;
+	Signal<IPCUnixSocket *> disconnected;
 
 private:
 	struct Header {
@@ -43,15 +45,19 @@ private:
 		uint8_t fds;
 	};
 
-	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
-	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
+	int sendData(const Header &header, const void *buffer, const int32_t *fds);
+	int recvData(const Header &header, void *buffer, int32_t *fds);
+	int receiveOne();
 
 	void dataNotifier(EventNotifier *notifier);
 
 	int fd_;
-	bool headerReceived_;
-	struct Header header_;
 	EventNotifier *notifier_;
+
+	std::vector<Payload> queue_;
+	unsigned int queueFirst_;
+	unsigned int queueCount_;
+	bool hangup_;
 };
 
 } /* namespace libcamera */
@@ -101,10 +101,34 @@ LogMessage _log(const char *file, unsigned int line,
 #ifndef __DOXYGEN__
 #define _LOG_CATEGORY(name) logCategory##name
 
+/*
+ * Turn the log message stream into a void expression, to use it as the second
+ * operand of the conditional operator in the _LOG1() and _LOG2() macros. The &
+ * operator has a lower precedence than <<, and binds after the message has
+ * been fully streamed.
+ */
+class LogMessageVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
+/*
+ * Check the category severity before creating the log message, to skip the
+ * message construction and the evaluation of the streamed operands
+ * altogether for disabled messages.
+ */
+#define _LOG_ENABLED(cat, sev) \
+	((sev) >= (cat).severity())
+
 #define _LOG1(severity) \
-	_log(__FILE__, __LINE__, Log##severity).stream()
+	!_LOG_ENABLED(LogCategory::defaultCategory(), Log##severity) ? \
+		static_cast<void>(0) : LogMessageVoidify() & \
+		_log(__FILE__, __LINE__, Log##severity).stream()
 #define _LOG2(category, severity) \
-	_log(__FILE__, __LINE__, _LOG_CATEGORY(category)(), Log##severity).stream()
+	!_LOG_ENABLED(_LOG_CATEGORY(category)(), Log##severity) ? \
+		static_cast<void>(0) : LogMessageVoidify() & \
+		_log(__FILE__, __LINE__, _LOG_CATEGORY(category)(), Log##severity).stream()
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * m2m_converter.h - Format conversion and scaling with V4L2 M2M devices
+ */
+#ifndef __LIBCAMERA_M2M_CONVERTER_H__
+#define __LIBCAMERA_M2M_CONVERTER_H__
+
+#include <memory>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/signal.h>
+
+#include "formats.h"
+
+namespace libcamera {
+
+class Buffer;
+class BufferPool;
+class DeviceEnumerator;
+class MediaDevice;
+class V4L2DeviceFormat;
+class V4L2M2MDevice;
+
+class M2MConverter
+{
+public:
+	explicit M2MConverter(const std::shared_ptr<MediaDevice> &media);
+	M2MConverter(const M2MConverter &) = delete;
+	M2MConverter &operator=(const M2MConverter &) = delete;
+	~M2MConverter();
+
+	static std::unique_ptr<M2MConverter> create(DeviceEnumerator *enumerator);
+
+	bool isValid() const { return m2m_ != nullptr; }
+	const char *driverName() const;
+
+	std::vector<unsigned int> inputFormats() const;
+	std::vector<unsigned int> outputFormats() const;
+	SizeRange outputSizes(unsigned int format) const;
+	bool supports(unsigned int inputFormat, const Size &inputSize,
+		      unsigned int outputFormat, const Size &outputSize) const;
+	bool supportsRotation() const;
+
+	int configure(const V4L2DeviceFormat &inputFormat,
+		      V4L2DeviceFormat *outputFormat,
+		      unsigned int rotation = 0);
+
+	int importInputBuffers(BufferPool *pool);
+	int importOutputBuffers(BufferPool *pool);
+	int exportOutputBuffers(BufferPool *pool);
+	void releaseBuffers();
+
+	int start();
+	void stop();
+	bool isRunning() const { return running_; }
+
+	int queueBuffers(Buffer *input, Buffer *output);
+
+	Signal<Buffer *, Buffer *> bufferReady;
+
+private:
+	void jobCompleted(Buffer *input, Buffer *output);
+
+	std::shared_ptr<MediaDevice> media_;
+	V4L2M2MDevice *m2m_;
+	bool running_;
+
+	ImageFormats inputFormats_;
+	ImageFormats outputFormats_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_M2M_CONVERTER_H__ */
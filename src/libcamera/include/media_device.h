@@ -8,8 +8,11 @@
 #define __LIBCAMERA_MEDIA_DEVICE_H__
 
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <linux/media.h>
@@ -20,6 +23,8 @@
 
 namespace libcamera {
 
+class MediaRequest;
+
 class MediaDevice
 {
 public:
@@ -33,12 +38,14 @@ public:
 	bool lock();
 	void unlock();
 
+	int probe();
 	int populate();
 	bool valid() const { return valid_; }
 
 	const std::string driver() const { return driver_; }
 	const std::string deviceNode() const { return deviceNode_; }
 	const std::string model() const { return model_; }
+	__u64 topologyVersion() const { return topologyVersion_; }
 
 	const std::vector<MediaEntity *> &entities() const { return entities_; }
 	MediaEntity *getEntityByName(const std::string &name) const;
@@ -49,6 +56,10 @@ public:
 			const MediaEntity *sink, unsigned int sinkIdx);
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
+	int setupLinks(const std::vector<std::pair<MediaLink *, bool>> &links,
+		       bool exclusive = false);
+
+	std::unique_ptr<MediaRequest> allocateRequest();
 
 	Signal<MediaDevice *> disconnected;
 
@@ -57,6 +68,7 @@ private:
 	std::string deviceNode_;
 	std::string model_;
 	unsigned int version_;
+	__u64 topologyVersion_;
 
 	int fd_;
 	bool valid_;
@@ -65,6 +77,7 @@ private:
 
 	int open();
 	void close();
+	int readDeviceInfo();
 
 	std::map<unsigned int, MediaObject *> objects_;
 	MediaObject *object(unsigned int id);
@@ -72,6 +85,7 @@ private:
 	void clear();
 
 	std::vector<MediaEntity *> entities_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
 
 	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
 						 unsigned int entityId);
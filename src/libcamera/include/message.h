@@ -8,6 +8,8 @@
 #define __LIBCAMERA_MESSAGE_H__
 
 #include <atomic>
+#include <cstddef>
+#include <stdint.h>
 
 #include <libcamera/bound_method.h>
 
@@ -36,10 +38,12 @@ public:
 	static Type registerMessageType();
 
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -47,16 +51,29 @@ private:
 class InvokeMessage : public Message
 {
 public:
-	InvokeMessage(BoundMethodBase *method, void *pack,
-		      bool deleteMethod = false);
+	InvokeMessage(size_t methodSize, size_t packSize,
+		      void (*destroyPack)(void *));
 	~InvokeMessage();
 
+	void *methodStorage() const { return storage_; }
+	void *packStorage() const { return pack_; }
+	void setMethod(BoundMethodBase *method, bool deleteMethod);
+
 	void invoke();
 
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr);
+
 private:
+	static constexpr size_t InlineSize = 192;
+
 	BoundMethodBase *method_;
 	void *pack_;
+	void (*destroyPack_)(void *);
 	bool deleteMethod_;
+
+	void *storage_;
+	alignas(std::max_align_t) uint8_t inline_[InlineSize];
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mjpeg_decoder.h - Motion-JPEG software decoder
+ */
+#ifndef __LIBCAMERA_MJPEG_DECODER_H__
+#define __LIBCAMERA_MJPEG_DECODER_H__
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class V4L2DeviceFormat;
+
+class MjpegDecoder
+{
+public:
+	MjpegDecoder();
+	MjpegDecoder(const MjpegDecoder &) = delete;
+	MjpegDecoder &operator=(const MjpegDecoder &) = delete;
+	~MjpegDecoder();
+
+	static const std::vector<unsigned int> &formats();
+
+	int configure(const Size &size, unsigned int pixelFormat,
+		      V4L2DeviceFormat *format);
+	int decode(const uint8_t *src, size_t srcSize,
+		   uint8_t *dst, size_t dstSize);
+
+private:
+	struct Context;
+
+	int decodeFrame(const uint8_t *src, size_t srcSize, uint8_t *dst);
+	void packYUYV(const uint8_t *row, uint8_t *dst);
+	void packNV12(const uint8_t *row, unsigned int line,
+		      uint8_t *luma, uint8_t *chroma);
+
+	std::unique_ptr<Context> context_;
+
+	Size size_;
+	unsigned int pixelFormat_;
+	size_t frameSize_;
+	std::vector<uint8_t> row_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_MJPEG_DECODER_H__ */
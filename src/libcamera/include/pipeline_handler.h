@@ -7,16 +7,27 @@
 #ifndef __LIBCAMERA_PIPELINE_HANDLER_H__
 #define __LIBCAMERA_PIPELINE_HANDLER_H__
 
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
 #include <ipa/ipa_interface.h>
+#include <libcamera/buffer.h>
 #include <libcamera/controls.h>
+#include <libcamera/request.h>
 #include <libcamera/stream.h>
+#include <libcamera/thread_scheduling.h>
+#include <libcamera/timer.h>
+
+#include "clock_correlator.h"
+#include "configuration_cache.h"
+#include "request_queue.h"
+#include "runtime_pm.h"
 
 namespace libcamera {
 
@@ -29,26 +40,59 @@ class DeviceEnumerator;
 class DeviceMatch;
 class MediaDevice;
 class PipelineHandler;
+class PipelineInvoker;
+class PipelineThread;
 class Request;
 
 class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe)
+		: pipe_(pipe), qosLevel_(0), qosStableFrames_(0),
+		  qosOverloadFrames_(0), qosFrameInterval_(0),
+		  qosLastCapture_(0), qosFrameDuration_(0),
+		  qosRequestedDuration_(0), qosAppliedDuration_(0),
+		  outOfOrderCompletion_(false),
+		  timestampClock_(Buffer::ClockMonotonic), initialized_(false)
 	{
+		standbyTimer_.timeout.connect(this, &CameraData::standbyTimeout);
 	}
 	virtual ~CameraData() {}
 
+	ControlList acquireMetadata();
+	void completeMetadata(Request *request, ControlList &&metadata);
+
 	Camera *camera_;
 	PipelineHandler *pipe_;
 	std::list<Request *> queuedRequests_;
+	std::list<Request *> requestNodes_;
+	RequestQueue submittedRequests_;
 	ControlInfoMap controlInfo_;
 	std::unique_ptr<IPAInterface> ipa_;
+	std::map<const Stream *, unsigned int> nextSequence_;
+	unsigned int qosLevel_;
+	unsigned int qosStableFrames_;
+	unsigned int qosOverloadFrames_;
+	uint64_t qosFrameInterval_;
+	uint64_t qosLastCapture_;
+	int64_t qosFrameDuration_;
+	int64_t qosRequestedDuration_;
+	int64_t qosAppliedDuration_;
+	bool outOfOrderCompletion_;
+	Buffer::Clock timestampClock_;
+	ClockCorrelator clockCorrelator_;
+	mutable ConfigurationCache validationCache_;
+	bool initialized_;
+	std::vector<std::unique_ptr<RuntimePM>> standbyDevices_;
+	Timer standbyTimer_;
 
 private:
 	CameraData(const CameraData &) = delete;
 	CameraData &operator=(const CameraData &) = delete;
+
+	void standbyTimeout(Timer *timer);
+
+	std::vector<ControlList> spareMetadata_;
 };
 
 class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>
@@ -64,24 +108,58 @@ public:
 	bool lock();
 	void unlock();
 
+	int initialize(Camera *camera);
+	virtual int initCamera(Camera *camera);
+
+	void setStandbyPeriod(unsigned int msec) { standbyPeriod_ = msec; }
+	unsigned int standbyPeriod() const { return standbyPeriod_; }
+	void wake(Camera *camera);
+	void standby(Camera *camera);
+
 	const ControlInfoMap &controls(Camera *camera);
 
 	virtual CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) = 0;
 	virtual int configure(Camera *camera, CameraConfiguration *config) = 0;
+	virtual int reconfigure(Camera *camera, CameraConfiguration *config);
 
 	virtual int allocateBuffers(Camera *camera,
 				    const std::set<Stream *> &streams) = 0;
 	virtual int freeBuffers(Camera *camera,
 				const std::set<Stream *> &streams) = 0;
+	virtual int addBuffers(Camera *camera, Stream *stream,
+			       unsigned int count);
 
 	virtual int start(Camera *camera) = 0;
 	virtual void stop(Camera *camera) = 0;
 
 	virtual int queueRequest(Camera *camera, Request *request);
+	virtual int queueRequests(Camera *camera,
+				  const std::vector<Request *> &requests);
 
+	void startRequest(Camera *camera, uint64_t timestamp);
 	bool completeBuffer(Camera *camera, Request *request, Buffer *buffer);
+	bool cancelBuffer(Camera *camera, Request *request, Buffer *buffer);
+	bool skipBuffer(Camera *camera, Request *request, Buffer *buffer);
+	bool skipFrame(Camera *camera, const Stream *stream, unsigned int frame);
+	void copyBufferMetadata(Buffer *buffer, const Buffer *source,
+				unsigned int bytesused);
+	void setBufferTimestamp(Buffer *buffer, uint64_t timestamp,
+				Buffer::TimestampSource source);
+	void setBufferMetadata(Buffer *buffer, unsigned int sequence,
+			       uint64_t timestamp, unsigned int bytesused);
 	void completeRequest(Camera *camera, Request *request);
+	void setOutOfOrderCompletion(Camera *camera, bool enable);
+	void setTimestampClock(Camera *camera, Buffer::Clock clock);
+	void traceRequest(Request *request, Request::Stage stage);
+
+	int invoke(const std::function<int()> &func);
+	int submitRequest(Camera *camera, Request *request);
+	int submitRequests(Camera *camera,
+			   const std::vector<Request *> &requests);
+	void flushSubmissions(Camera *camera);
+	void stopCamera(Camera *camera);
+	void flushCompletions();
 
 	const char *name() const { return name_; }
 
@@ -92,17 +170,36 @@ protected:
 
 	CameraData *cameraData(const Camera *camera);
 
+	std::vector<Request *> recoverRequests(Camera *camera);
+	void cancelRequest(Camera *camera, Request *request);
+
 	CameraManager *manager_;
 
 private:
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
+	bool isCurrentThread() const;
+	void post(const std::function<void()> &func);
+	void deliver(const std::function<void()> &func);
+	void processSubmittedRequests(Camera *camera);
+	void pushRequest(CameraData *data, Request *request);
+	unsigned int detectDroppedFrames(CameraData *data, Buffer *buffer);
+	void convertTimestamp(CameraData *data, Buffer *buffer);
+	bool updateQos(CameraData *data, Request *request, unsigned int dropped);
+	void applyQos(CameraData *data, Request *request);
+
 	std::vector<std::shared_ptr<MediaDevice>> mediaDevices_;
 	std::vector<std::weak_ptr<Camera>> cameras_;
 	std::map<const Camera *, std::unique_ptr<CameraData>> cameraData_;
 
 	const char *name_;
+	unsigned int standbyPeriod_;
+	PipelineThread *thread_;
+	std::unique_ptr<PipelineInvoker> invoker_;
+
+	bool batching_;
+	std::vector<std::function<void()>> completions_;
 
 	friend class PipelineHandlerFactory;
 };
@@ -113,7 +210,9 @@ public:
 	PipelineHandlerFactory(const char *name);
 	virtual ~PipelineHandlerFactory() { };
 
-	std::shared_ptr<PipelineHandler> create(CameraManager *manager);
+	std::shared_ptr<PipelineHandler> create(CameraManager *manager,
+						bool threaded = false,
+						const ThreadScheduling &scheduling = ThreadScheduling());
 
 	const std::string &name() const { return name_; }
 
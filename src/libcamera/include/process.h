@@ -39,6 +39,7 @@ public:
 
 private:
 	void closeAllFdsExcept(const std::vector<int> &fds);
+	int closeRangesExcept(const std::vector<int> &fds);
 	int isolate();
 	void died(int wstatus);
 
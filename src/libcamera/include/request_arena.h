@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * request_arena.h - Arena allocator for request-scoped data
+ */
+#ifndef __LIBCAMERA_REQUEST_ARENA_H__
+#define __LIBCAMERA_REQUEST_ARENA_H__
+
+#include <cstddef>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class RequestArenaPool
+{
+public:
+	static constexpr size_t BlockSize = 4096;
+	static constexpr unsigned int MaxFreeBlocks = 32;
+
+	RequestArenaPool();
+	RequestArenaPool(const RequestArenaPool &) = delete;
+	RequestArenaPool &operator=(const RequestArenaPool &) = delete;
+	~RequestArenaPool();
+
+	void *get();
+	void put(void *block);
+
+	unsigned int freeBlocks();
+
+private:
+	Mutex mutex_;
+	std::vector<void *> free_;
+};
+
+class RequestArena
+{
+public:
+	explicit RequestArena(const std::shared_ptr<RequestArenaPool> &pool);
+	RequestArena(const RequestArena &) = delete;
+	RequestArena &operator=(const RequestArena &) = delete;
+	~RequestArena();
+
+	void *allocate(size_t size, size_t alignment,
+		       void (*destructor)(void *) = nullptr);
+
+	void mark();
+	void reset();
+
+private:
+	struct alignas(std::max_align_t) Block {
+		Block *next;
+		size_t size;
+	};
+
+	struct Finalizer {
+		Finalizer *next;
+		void (*destructor)(void *);
+		void *object;
+	};
+
+	void *carve(size_t size, size_t alignment);
+	void release(Block *until);
+
+	std::shared_ptr<RequestArenaPool> pool_;
+
+	Block *blocks_;
+	char *ptr_;
+	char *end_;
+	Finalizer *finalizers_;
+
+	Block *markBlock_;
+	char *markPtr_;
+	Finalizer *markFinalizers_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_REQUEST_ARENA_H__ */
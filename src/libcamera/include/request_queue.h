@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * request_queue.h - Lock-free request submission queue
+ */
+#ifndef __LIBCAMERA_REQUEST_QUEUE_H__
+#define __LIBCAMERA_REQUEST_QUEUE_H__
+
+#include <atomic>
+#include <vector>
+
+namespace libcamera {
+
+class Request;
+
+class RequestQueue
+{
+public:
+	RequestQueue()
+		: head_(nullptr)
+	{
+	}
+
+	RequestQueue(const RequestQueue &) = delete;
+	RequestQueue &operator=(const RequestQueue &) = delete;
+
+	bool push(Request *request);
+	std::vector<Request *> takeAll();
+
+	bool empty() const { return !head_.load(std::memory_order_acquire); }
+
+private:
+	std::atomic<Request *> head_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_REQUEST_QUEUE_H__ */
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * runtime_pm.h - Runtime power management of media entities
+ */
+#ifndef __LIBCAMERA_RUNTIME_PM_H__
+#define __LIBCAMERA_RUNTIME_PM_H__
+
+#include <string>
+
+namespace libcamera {
+
+class MediaEntity;
+
+class RuntimePM
+{
+public:
+	explicit RuntimePM(const MediaEntity *entity);
+	RuntimePM(const RuntimePM &) = delete;
+	RuntimePM &operator=(const RuntimePM &) = delete;
+	~RuntimePM();
+
+	int hold();
+	void release();
+	bool isHeld() const { return held_; }
+
+private:
+	std::string name_;
+	std::string path_;
+	std::string control_;
+	bool held_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RUNTIME_PM_H__ */
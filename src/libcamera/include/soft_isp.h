@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * soft_isp.h - CPU image signal processing of raw Bayer frames
+ */
+#ifndef __LIBCAMERA_SOFT_ISP_H__
+#define __LIBCAMERA_SOFT_ISP_H__
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/raw_unpacker.h>
+
+namespace libcamera {
+
+class ThreadPool;
+
+class SoftIsp
+{
+public:
+	static constexpr unsigned int HISTOGRAM_BINS = 64;
+
+	struct Params {
+		Params();
+
+		unsigned int blackLevel;
+		std::array<float, 3> gains;
+		std::array<float, 9> ccm;
+		float gamma;
+	};
+
+	struct Statistics {
+		Statistics();
+
+		void clear();
+		void merge(const Statistics &other);
+
+		std::array<uint64_t, 3> sum;
+		std::array<uint32_t, HISTOGRAM_BINS> histogram;
+		uint32_t pixels;
+	};
+
+	SoftIsp();
+
+	static const std::vector<unsigned int> &inputFormats();
+	static const std::vector<unsigned int> &outputFormats();
+
+	int configure(unsigned int inputFormat, const Size &size,
+		      unsigned int stride, unsigned int outputFormat);
+	void setParams(const Params &params);
+
+	void process(const uint8_t *src, uint8_t *dst, Statistics *stats,
+		     ThreadPool *pool = nullptr) const;
+	void process(const uint8_t *src, uint8_t *dst, unsigned int first,
+		     unsigned int count, Statistics *stats) const;
+
+	const Size &size() const { return size_; }
+	unsigned int frameSize() const;
+	const char *implementation() const { return implementation_; }
+
+private:
+	using DebayerRow = void (*)(const uint16_t *above, const uint16_t *row,
+				    const uint16_t *below, uint16_t *x,
+				    uint16_t *g, uint16_t *y,
+				    unsigned int width, unsigned int greenPos);
+
+	void unpackRow(const uint8_t *src, unsigned int line,
+		       uint16_t *dst) const;
+
+	Size size_;
+	unsigned int stride_;
+	unsigned int inputFormat_;
+	unsigned int outputFormat_;
+	const char *implementation_;
+	DebayerRow debayerRow_;
+	RawUnpacker unpacker_;
+
+	unsigned int bitsPerSample_;
+	/* The colour of the pixels at even and odd positions of each line. */
+	std::array<unsigned int, 4> pattern_;
+
+	/* Per-colour gains and colour matrix, in 4.10 fixed point. */
+	unsigned int blackLevel_;
+	std::array<unsigned int, 3> gains_;
+	std::array<int, 9> ccm_;
+	std::vector<uint8_t> gammaLut_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SOFT_ISP_H__ */
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * startup_timeline.h - Timeline of the startup and camera open phases
+ */
+#ifndef __LIBCAMERA_STARTUP_TIMELINE_H__
+#define __LIBCAMERA_STARTUP_TIMELINE_H__
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/camera_manager.h>
+
+namespace libcamera {
+
+class StartupTimeline
+{
+public:
+	static constexpr unsigned int MAX_PHASES = 256;
+
+	class Scope
+	{
+	public:
+		Scope(const char *name, const std::string &subject);
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+		~Scope();
+
+	private:
+		const char *name_;
+		std::string subject_;
+		uint64_t start_;
+	};
+
+	static StartupTimeline *instance();
+	static uint64_t now();
+
+	void record(const char *name, const std::string &subject,
+		    uint64_t start, uint64_t end);
+	std::vector<StartupPhase> phases() const;
+
+private:
+	StartupTimeline() = default;
+
+	mutable std::mutex mutex_;
+	std::vector<StartupPhase> phases_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_STARTUP_TIMELINE_H__ */
@@ -12,6 +12,7 @@
 #include <thread>
 
 #include <libcamera/signal.h>
+#include <libcamera/thread_scheduling.h>
 
 namespace libcamera {
 
@@ -36,6 +37,9 @@ public:
 
 	bool isRunning();
 
+	int setScheduling(const ThreadScheduling &scheduling);
+	ThreadScheduling scheduling();
+
 	Signal<Thread *> finished;
 
 	static Thread *current();
@@ -44,6 +48,7 @@ public:
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 
 	void dispatchMessages();
+	void dispatchMessages(Object *receiver);
 
 protected:
 	int exec();
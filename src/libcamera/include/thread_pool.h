@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * thread_pool.h - Worker thread pool
+ */
+#ifndef __LIBCAMERA_THREAD_POOL_H__
+#define __LIBCAMERA_THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <libcamera/object.h>
+#include <libcamera/thread_scheduling.h>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int workers);
+	~ThreadPool();
+
+	static ThreadPool *instance();
+	static unsigned int defaultWorkers();
+
+	unsigned int workers() const { return workers_.size(); }
+	int setScheduling(const ThreadScheduling &scheduling);
+
+	void post(std::function<void()> task);
+
+	template<typename T, typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+	void post(std::function<void()> task, T *receiver, void (T::*done)())
+	{
+		post([task, receiver, done]() {
+			task();
+			receiver->invokeMethod(done);
+		});
+	}
+
+	void parallelFor(unsigned int count,
+			 const std::function<void(unsigned int)> &func);
+
+private:
+	class Worker;
+
+	struct Queue {
+		Mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void workerLoop(unsigned int index);
+	bool take(unsigned int index, std::function<void()> *task);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::unique_ptr<Queue>> queues_;
+
+	Mutex mutex_;
+	std::condition_variable workAvailable_;
+	std::atomic<unsigned int> queued_;
+	std::atomic<unsigned int> next_;
+	bool stopping_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_THREAD_POOL_H__ */
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer_queue.h - Timer queue for event dispatchers
+ */
+#ifndef __LIBCAMERA_TIMER_QUEUE_H__
+#define __LIBCAMERA_TIMER_QUEUE_H__
+
+#include <stddef.h>
+#include <vector>
+
+#include "utils.h"
+
+namespace libcamera {
+
+class Timer;
+
+class TimerQueue
+{
+public:
+	TimerQueue();
+	~TimerQueue();
+
+	void insert(Timer *timer);
+	void remove(Timer *timer);
+
+	bool empty() const { return heap_.empty(); }
+	size_t size() const { return heap_.size(); }
+	Timer *front() const { return heap_.empty() ? nullptr : heap_.front().timer; }
+
+	int fd() const { return timerfd_; }
+	void arm();
+	void acknowledge();
+
+	void process();
+
+private:
+	struct Entry {
+		utils::time_point deadline;
+		Timer *timer;
+	};
+
+	bool contains(Timer *timer) const;
+	void swap(size_t a, size_t b);
+	void siftUp(size_t pos);
+	void siftDown(size_t pos);
+	void removeAt(size_t pos);
+
+	std::vector<Entry> heap_;
+
+	int timerfd_;
+	bool armed_;
+	utils::time_point armedDeadline_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TIMER_QUEUE_H__ */
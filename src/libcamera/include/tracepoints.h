@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * tracepoints.h - Static tracepoints
+ */
+#ifndef __LIBCAMERA_TRACEPOINTS_H__
+#define __LIBCAMERA_TRACEPOINTS_H__
+
+namespace libcamera {
+
+class Tracer
+{
+public:
+	static Tracer *instance();
+
+	bool enabled() const { return fd_ >= 0; }
+	void emit(const char *event, const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+private:
+	Tracer();
+	~Tracer();
+
+	int fd_;
+};
+
+#ifdef HAVE_TRACING
+#define LIBCAMERA_TRACEPOINT(event, ...)				\
+do {									\
+	Tracer *_tracer = Tracer::instance();				\
+	if (_tracer->enabled())						\
+		_tracer->emit(#event, __VA_ARGS__);			\
+} while (0)
+#else
+#define LIBCAMERA_TRACEPOINT(event, ...) do { } while (0)
+#endif
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TRACEPOINTS_H__ */
@@ -33,6 +33,8 @@ char *secure_getenv(const char *name);
 std::string readlink(const char *path);
 std::string dirname(const std::string &path);
 
+bool dmabuf_identity(int fd, uint64_t *dev, uint64_t *ino);
+
 template<class InputIt1, class InputIt2>
 unsigned int set_overlap(InputIt1 first1, InputIt1 last1,
 			 InputIt2 first2, InputIt2 last2)
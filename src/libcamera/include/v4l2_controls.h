@@ -18,6 +18,12 @@ class V4L2ControlId : public ControlId
 {
 public:
 	V4L2ControlId(const struct v4l2_query_ext_ctrl &ctrl);
+
+	bool hasPayload() const { return numElements_ != 0; }
+	unsigned int numElements() const { return numElements_; }
+
+private:
+	unsigned int numElements_;
 };
 
 class V4L2ControlRange : public ControlRange
@@ -9,15 +9,43 @@
 
 #include <map>
 #include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include <linux/videodev2.h>
 
+#include <libcamera/signal.h>
+
 #include "log.h"
 #include "v4l2_controls.h"
 
 namespace libcamera {
 
+class EventNotifier;
+class MediaRequest;
+class V4L2Device;
+
+class V4L2ControlBatch
+{
+public:
+	V4L2ControlBatch();
+
+	bool isValid() const { return device_ != nullptr; }
+	unsigned int size() const { return ctrls_.size(); }
+
+	unsigned int id(unsigned int index) const { return ctrls_[index].id; }
+	ControlValue get(unsigned int index) const;
+	void set(unsigned int index, const ControlValue &value);
+	int set(const ControlList &ctrls);
+
+private:
+	friend class V4L2Device;
+
+	const V4L2Device *device_;
+	std::vector<struct v4l2_ext_control> ctrls_;
+	std::vector<ControlType> types_;
+};
+
 class V4L2Device : protected Loggable
 {
 public:
@@ -27,10 +55,22 @@ public:
 	const ControlInfoMap &controls() const { return controls_; }
 
 	int getControls(ControlList *ctrls);
-	int setControls(ControlList *ctrls);
+	int setControls(ControlList *ctrls, MediaRequest *request = nullptr);
+
+	int prepareControls(V4L2ControlBatch *batch,
+			    const std::vector<unsigned int> &ids) const;
+	int getControls(V4L2ControlBatch *batch);
+	int setControls(V4L2ControlBatch *batch,
+			MediaRequest *request = nullptr);
 
 	const std::string &deviceNode() const { return deviceNode_; }
 
+	int setFrameStartEnabled(bool enable);
+	Signal<uint32_t, uint64_t> frameStart;
+
+	int setControlEventsEnabled(bool enable);
+	bool controlEventsEnabled() const { return controlEventsEnabled_; }
+
 protected:
 	V4L2Device(const std::string &deviceNode);
 	~V4L2Device();
@@ -48,10 +88,25 @@ private:
 			    const struct v4l2_ext_control *v4l2Ctrls,
 			    unsigned int count);
 
+	bool getCachedControls(ControlList *ctrls);
+	void cacheControls(const ControlList &ctrls, unsigned int count);
+	void cacheControls(const V4L2ControlBatch &batch, unsigned int count);
+	int subscribeControlEvents(unsigned long request);
+	void updateEventNotifier();
+	void eventAvailable(EventNotifier *notifier);
+	void controlChanged(const struct v4l2_event &event);
+
 	std::vector<std::unique_ptr<V4L2ControlId>> controlIds_;
+	std::vector<unsigned int> eventControls_;
 	ControlInfoMap controls_;
 	std::string deviceNode_;
 	int fd_;
+
+	EventNotifier *fdEventNotifier_;
+	bool frameStartEnabled_;
+
+	bool controlEventsEnabled_;
+	std::map<unsigned int, ControlValue> controlValues_;
 };
 
 } /* namespace libcamera */
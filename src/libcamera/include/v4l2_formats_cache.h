@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * v4l2_formats_cache.h - Cache of V4L2 device formats enumeration
+ */
+#ifndef __LIBCAMERA_V4L2_FORMATS_CACHE_H__
+#define __LIBCAMERA_V4L2_FORMATS_CACHE_H__
+
+#include <map>
+#include <string>
+
+#include "formats.h"
+#include "thread.h"
+
+namespace libcamera {
+
+class V4L2FormatsCache
+{
+public:
+	static V4L2FormatsCache *instance();
+
+	bool lookup(const std::string &identity, ImageFormats *formats);
+	void store(const std::string &identity, const ImageFormats &formats);
+
+private:
+	V4L2FormatsCache();
+
+	void load();
+	void save();
+
+	Mutex mutex_;
+	std::map<std::string, ImageFormats> cache_;
+	std::string path_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_V4L2_FORMATS_CACHE_H__ */
@@ -9,6 +9,7 @@
 
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <libcamera/geometry.h>
@@ -41,6 +42,8 @@ public:
 
 	const MediaEntity *entity() const { return entity_; }
 
+	int getSelection(unsigned int pad, unsigned int target,
+			 Rectangle *rect);
 	int setCrop(unsigned int pad, Rectangle *rect);
 	int setCompose(unsigned int pad, Rectangle *rect);
 
@@ -49,6 +52,8 @@ public:
 	int getFormat(unsigned int pad, V4L2SubdeviceFormat *format);
 	int setFormat(unsigned int pad, V4L2SubdeviceFormat *format);
 
+	void invalidateCache();
+
 	static V4L2Subdevice *fromEntityName(const MediaDevice *media,
 					     const std::string &entity);
 
@@ -63,7 +68,18 @@ private:
 	int setSelection(unsigned int pad, unsigned int target,
 			 Rectangle *rect);
 
+	unsigned int stage(unsigned int pad, unsigned int target) const;
+	void invalidate(unsigned int pad, unsigned int target);
+
 	const MediaEntity *entity_;
+
+	/*
+	 * The last formats and selection rectangles applied to the pads, as
+	 * pairs of the requested and the applied values.
+	 */
+	std::map<unsigned int, std::pair<V4L2SubdeviceFormat, V4L2SubdeviceFormat>> formats_;
+	std::map<std::pair<unsigned int, unsigned int>,
+		 std::pair<Rectangle, Rectangle>> selections_;
 };
 
 } /* namespace libcamera */
@@ -7,6 +7,8 @@
 #ifndef __LIBCAMERA_V4L2_VIDEODEVICE_H__
 #define __LIBCAMERA_V4L2_VIDEODEVICE_H__
 
+#include <list>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -27,6 +29,7 @@ class BufferPool;
 class EventNotifier;
 class MediaDevice;
 class MediaEntity;
+class MediaRequest;
 
 struct V4L2Capability final : v4l2_capability {
 	const char *driver() const
@@ -122,6 +125,14 @@ public:
 class V4L2VideoDevice : public V4L2Device
 {
 public:
+	struct QueueStats {
+		unsigned int depth;
+		unsigned int maxDepth;
+		uint64_t samples;
+		uint64_t depthSum;
+		uint64_t underruns;
+	};
+
 	explicit V4L2VideoDevice(const std::string &deviceNode);
 	explicit V4L2VideoDevice(const MediaEntity *entity);
 	V4L2VideoDevice(const V4L2VideoDevice &) = delete;
@@ -143,14 +154,23 @@ public:
 
 	int exportBuffers(BufferPool *pool);
 	int importBuffers(BufferPool *pool);
+	int importUserPtrBuffers(BufferPool *pool);
+	int addBuffers(unsigned int count);
 	int releaseBuffers();
 
-	int queueBuffer(Buffer *buffer);
+	bool supportsRequests() const { return supportsRequests_; }
+
+	int queueBuffer(Buffer *buffer, MediaRequest *request = nullptr);
 	std::vector<std::unique_ptr<Buffer>> queueAllBuffers();
 	Signal<Buffer *> bufferReady;
 
+	const QueueStats &queueStats() const { return queueStats_; }
+	void resetQueueStats();
+
 	int streamOn();
 	int streamOff();
+	static int streamOn(const std::vector<V4L2VideoDevice *> &devices);
+	static int streamOff(const std::vector<V4L2VideoDevice *> &devices);
 
 	static V4L2VideoDevice *fromEntityName(const MediaDevice *media,
 					       const std::string &entity);
@@ -168,13 +188,22 @@ private:
 	int getFormatSingleplane(V4L2DeviceFormat *format);
 	int setFormatSingleplane(V4L2DeviceFormat *format);
 
+	std::string formatsIdentity();
 	std::vector<unsigned int> enumPixelformats();
 	std::vector<SizeRange> enumSizes(unsigned int pixelFormat);
 
 	int requestBuffers(unsigned int count);
+	int exportBuffer(BufferMemory *buffer, unsigned int index);
 	int createPlane(BufferMemory *buffer, unsigned int index,
 			unsigned int plane, unsigned int length);
 
+	int importBuffers(BufferPool *pool, enum v4l2_memory memory);
+	void setQueueSize(unsigned int count);
+	void sampleQueueDepth();
+
+	int stopStreaming();
+	void cancelQueuedBuffers();
+
 	Buffer *dequeueBuffer();
 	void bufferAvailable(EventNotifier *notifier);
 
@@ -183,9 +212,12 @@ private:
 	enum v4l2_buf_type bufferType_;
 	enum v4l2_memory memoryType_;
 	bool multiPlanar_;
+	bool supportsRequests_;
 
 	BufferPool *bufferPool_;
-	std::map<unsigned int, Buffer *> queuedBuffers_;
+	std::vector<Buffer *> queuedBuffers_;
+	unsigned int queuedCount_;
+	QueueStats queueStats_;
 
 	EventNotifier *fdEvent_;
 
@@ -204,11 +236,28 @@ public:
 	V4L2VideoDevice *output() { return output_; }
 	V4L2VideoDevice *capture() { return capture_; }
 
+	int queueJob(Buffer *output, Buffer *capture);
+	unsigned int jobsInFlight() const { return jobs_.size(); }
+	Signal<Buffer *, Buffer *> jobCompleted;
+
 private:
+	struct Job {
+		Buffer *output;
+		Buffer *capture;
+		bool outputDone;
+		bool captureDone;
+	};
+
+	void outputBufferReady(Buffer *buffer);
+	void captureBufferReady(Buffer *buffer);
+	void completeJobs();
+
 	std::string deviceNode_;
 
 	V4L2VideoDevice *output_;
 	V4L2VideoDevice *capture_;
+
+	std::list<Job> jobs_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_buffer_registry.cpp - Registry of the buffers mapped by an IPA
+ */
+
+#include "ipa_buffer_registry.h"
+
+#include <sys/stat.h>
+
+#include "log.h"
+
+/**
+ * \file ipa_buffer_registry.h
+ * \brief Registry of the buffers mapped by an IPA
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAManager)
+
+/**
+ * \class IPABufferRegistry
+ * \brief Track the buffers mapped by an IPA across buffer allocations
+ *
+ * Pipeline handlers share their parameters and statistics buffers with the IPA
+ * with IPAInterface::mapBuffers() when the buffers are allocated, and release
+ * them with IPAInterface::unmapBuffers(). Mapping a buffer is costly: the IPA
+ * has to map and prefault its memory, and isolated IPAs receive the dmabuf file
+ * descriptors over IPC.
+ *
+ * The IPABufferRegistry records the buffers mapped by an IPA, identified by
+ * their ID and the dmabufs of their planes. Each call to map() starts a new
+ * generation of buffers. Buffers whose ID and dmabufs are unchanged since the
+ * previous generation keep their IPA mapping, buffers that are new or whose
+ * dmabufs have changed are mapped, and buffers absent from the new generation
+ * are unmapped. Pipeline handlers that keep their buffers allocated across
+ * stop and start, or across reconfigurations, thus only pay for the buffers
+ * that actually changed.
+ *
+ * Buffers are not unmapped when the pipeline handler frees them, but when the
+ * next generation is mapped, or when unmapAll() is called. The IPA keeps the
+ * memory of freed buffers alive until then.
+ */
+
+IPABufferRegistry::IPABufferRegistry()
+	: generation_(0)
+{
+}
+
+/**
+ * \brief Map a new generation of buffers in the IPA
+ * \param[in] ipa The IPA interface
+ * \param[in] buffers The buffers shared with the IPA
+ *
+ * Unmap the buffers that are not part of \a buffers anymore, or whose dmabufs
+ * have changed, and map the new and changed buffers. Buffers with identical
+ * IDs and dmabufs are left untouched.
+ */
+void IPABufferRegistry::map(IPAInterface *ipa,
+			    const std::vector<IPABuffer> &buffers)
+{
+	std::vector<IPABuffer> mapped;
+	std::vector<unsigned int> unmapped;
+
+	generation_++;
+
+	for (const IPABuffer &buffer : buffers) {
+		std::vector<PlaneIdentity> planes;
+		bool valid = identify(buffer.memory, &planes);
+
+		auto iter = entries_.find(buffer.id);
+		if (iter != entries_.end()) {
+			Entry &entry = iter->second;
+			if (valid && entry.planes == planes) {
+				entry.generation = generation_;
+				continue;
+			}
+
+			unmapped.push_back(buffer.id);
+		}
+
+		Entry &entry = entries_[buffer.id];
+		entry.planes = std::move(planes);
+		entry.generation = generation_;
+
+		mapped.push_back(buffer);
+	}
+
+	/* Retire the buffers that haven't been part of this generation. */
+	for (auto iter = entries_.begin(); iter != entries_.end();) {
+		if (iter->second.generation == generation_) {
+			++iter;
+			continue;
+		}
+
+		unmapped.push_back(iter->first);
+		iter = entries_.erase(iter);
+	}
+
+	LOG(IPAManager, Debug)
+		<< "Buffers generation " << generation_ << ": "
+		<< buffers.size() - mapped.size() << " kept, "
+		<< mapped.size() << " mapped, " << unmapped.size()
+		<< " unmapped";
+
+	/* Stale mappings must be released before their IDs are reused. */
+	if (!unmapped.empty())
+		ipa->unmapBuffers(unmapped);
+	if (!mapped.empty())
+		ipa->mapBuffers(mapped);
+}
+
+/**
+ * \brief Unmap all buffers from the IPA
+ * \param[in] ipa The IPA interface
+ */
+void IPABufferRegistry::unmapAll(IPAInterface *ipa)
+{
+	std::vector<unsigned int> ids;
+	for (const auto &entry : entries_)
+		ids.push_back(entry.first);
+
+	entries_.clear();
+
+	if (!ids.empty())
+		ipa->unmapBuffers(ids);
+}
+
+/**
+ * \fn IPABufferRegistry::generation()
+ * \brief Retrieve the current buffers generation
+ *
+ * The generation is incremented by every call to map().
+ *
+ * \return The current buffers generation
+ */
+
+/**
+ * \fn IPABufferRegistry::size()
+ * \brief Retrieve the number of buffers mapped in the IPA
+ * \return The number of buffers mapped in the IPA
+ */
+
+/*
+ * Identify the dmabufs of the buffer planes by their inode, as file descriptor
+ * numbers may be reused for different dmabufs. Planes that can't be
+ * identified make the buffer always mapped again.
+ */
+bool IPABufferRegistry::identify(const BufferMemory &memory,
+				 std::vector<PlaneIdentity> *planes)
+{
+	for (const Plane &plane : memory.planes()) {
+		struct stat st;
+
+		if (plane.dmabuf() < 0 || fstat(plane.dmabuf(), &st))
+			return false;
+
+		planes->push_back({ st.st_dev, st.st_ino, plane.length() });
+	}
+
+	return true;
+}
+
+} /* namespace libcamera */
@@ -9,6 +9,10 @@
 
 #include <libcamera/controls.h>
 
+#include "byte_stream_buffer.h"
+#include "log.h"
+#include "tracepoints.h"
+
 /**
  * \file ipa_context_wrapper.h
  * \brief Image Processing Algorithm context wrapper
@@ -16,6 +20,18 @@
 
 namespace libcamera {
 
+LOG_DECLARE_CATEGORY(IPAManager)
+
+namespace {
+
+/* Control packets are aligned in the serialization buffer. */
+constexpr size_t packetSize(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+} /* namespace */
+
 /**
  * \class IPAContextWrapper
  * \brief Wrap an ipa_context and expose it as an IPAInterface
@@ -26,8 +42,11 @@ namespace libcamera {
  * using the IPAInterface API instead of the lower-level ipa_context API.
  *
  * The IPAInterface methods are converted to the ipa_context API by translating
- * all C++ arguments into plain C structures or byte arrays that contain no
- * pointer, as required by the ipa_context API.
+ * all C++ arguments into plain C structures, with ControlInfoMap and
+ * ControlList serialized to control packets, as required by the ipa_context
+ * API. The serialization buffers are reused across calls, processing an event
+ * thus doesn't allocate memory once the buffers have grown to the size of the
+ * largest event.
  */
 
 /**
@@ -39,7 +58,7 @@ namespace libcamera {
  * with it.
  */
 IPAContextWrapper::IPAContextWrapper(struct ipa_context *context)
-	: ctx_(context)
+	: ctx_(context), processing_(false)
 {
 	if (ctx_ && ctx_->ops->get_interface) {
 		intf_ = reinterpret_cast<IPAInterface *>(ctx_->ops->get_interface(ctx_));
@@ -78,7 +97,65 @@ void IPAContextWrapper::configure(const std::map<unsigned int, IPAStream> &strea
 	if (!ctx_)
 		return;
 
-	ctx_->ops->configure(ctx_);
+	serializer_.reset();
+
+	/* Translate the IPA stream configurations map. */
+	std::vector<struct ipa_stream> c_streams;
+	c_streams.reserve(streamConfig.size());
+
+	for (const auto &stream : streamConfig) {
+		struct ipa_stream c_stream;
+		c_stream.id = stream.first;
+		c_stream.pixel_format = stream.second.pixelFormat;
+		c_stream.width = stream.second.size.width;
+		c_stream.height = stream.second.size.height;
+		c_streams.push_back(c_stream);
+	}
+
+	/* Translate the IPA entity controls map. */
+	size_t size = 0;
+	for (const auto &info : entityControls)
+		size += packetSize(ControlSerializer::binarySize(info.second));
+
+	std::vector<uint8_t> data(size);
+	std::vector<struct ipa_control_info_map> c_infoMaps;
+	c_infoMaps.reserve(entityControls.size());
+
+	size_t offset = 0;
+	for (const auto &info : entityControls) {
+		size_t mapSize = ControlSerializer::binarySize(info.second);
+		ByteStreamBuffer buffer(data.data() + offset, mapSize);
+
+		if (serializer_.serialize(info.second, buffer) || buffer.overflow()) {
+			LOG(IPAManager, Error)
+				<< "Failed to serialize controls of entity "
+				<< info.first;
+			return;
+		}
+
+		struct ipa_control_info_map c_infoMap;
+		c_infoMap.id = info.first;
+		c_infoMap.data = data.data() + offset;
+		c_infoMap.size = mapSize;
+		c_infoMaps.push_back(c_infoMap);
+
+		offset += packetSize(mapSize);
+	}
+
+	ctx_->ops->configure(ctx_, c_streams.data(), c_streams.size(),
+			     c_infoMaps.data(), c_infoMaps.size());
+}
+
+void IPAContextWrapper::configure(std::map<unsigned int, IPAStream> &&streamConfig,
+				  std::map<unsigned int, ControlInfoMap> &&entityControls)
+{
+	if (intf_)
+		return intf_->configure(std::move(streamConfig),
+					std::move(entityControls));
+
+	/* The maps are serialized, there's nothing to move. */
+	configure(static_cast<const std::map<unsigned int, IPAStream> &>(streamConfig),
+		  static_cast<const std::map<unsigned int, ControlInfoMap> &>(entityControls));
 }
 
 void IPAContextWrapper::mapBuffers(const std::vector<IPABuffer> &buffers)
@@ -94,7 +171,7 @@ void IPAContextWrapper::mapBuffers(const std::vector<IPABuffer> &buffers)
 	for (unsigned int i = 0; i < buffers.size(); ++i) {
 		struct ipa_buffer &c_buffer = c_buffers[i];
 		const IPABuffer &buffer = buffers[i];
-		const std::vector<Plane> &planes = buffer.memory.planes();
+		const PlaneArray &planes = buffer.memory.planes();
 
 		c_buffer.id = buffer.id;
 		c_buffer.num_planes = planes.size();
@@ -122,27 +199,100 @@ void IPAContextWrapper::unmapBuffers(const std::vector<unsigned int> &ids)
 
 void IPAContextWrapper::processEvent(const IPAOperationData &data)
 {
+	LIBCAMERA_TRACEPOINT(ipa_process_event, "operation=%u", data.operation);
+
 	if (intf_)
 		return intf_->processEvent(data);
 
 	if (!ctx_)
 		return;
 
-	ctx_->ops->process_event(ctx_);
+	/*
+	 * The frame actions queued by the IPA while it processes the event may
+	 * lead to nested events, which can't reuse the buffers in use.
+	 */
+	bool nested = processing_;
+	std::vector<uint8_t> nestedData;
+	std::vector<struct ipa_control_list> nestedLists;
+	std::vector<uint8_t> &controlsData = nested ? nestedData : controlsData_;
+	std::vector<struct ipa_control_list> &lists = nested ? nestedLists : lists_;
+
+	size_t size = 0;
+	for (const ControlList &list : data.controls)
+		size += packetSize(ControlSerializer::binarySize(list));
+
+	if (controlsData.size() < size)
+		controlsData.resize(size);
+
+	lists.clear();
+
+	size_t offset = 0;
+	for (const ControlList &list : data.controls) {
+		size_t listSize = ControlSerializer::binarySize(list);
+		ByteStreamBuffer buffer(controlsData.data() + offset, listSize);
+
+		if (serializer_.serialize(list, buffer) || buffer.overflow()) {
+			LOG(IPAManager, Error)
+				<< "Failed to serialize controls for operation "
+				<< data.operation;
+			return;
+		}
+
+		struct ipa_control_list c_list;
+		c_list.data = controlsData.data() + offset;
+		c_list.size = listSize;
+		lists.push_back(c_list);
+
+		offset += packetSize(listSize);
+	}
+
+	struct ipa_operation_data c_data;
+	c_data.operation = data.operation;
+	c_data.data = data.data.data();
+	c_data.num_data = data.data.size();
+	c_data.lists = lists.data();
+	c_data.num_lists = lists.size();
+
+	processing_ = true;
+	ctx_->ops->process_event(ctx_, &c_data);
+	processing_ = nested;
+}
+
+void IPAContextWrapper::processEvent(IPAOperationData &&data)
+{
+	if (!intf_)
+		return processEvent(static_cast<const IPAOperationData &>(data));
+
+	LIBCAMERA_TRACEPOINT(ipa_process_event, "operation=%u", data.operation);
+
+	intf_->processEvent(std::move(data));
 }
 
 void IPAContextWrapper::queueFrameAction(unsigned int frame,
-					 const IPAOperationData &data)
+					 IPAOperationData &&data)
 {
-	IPAInterface::queueFrameAction.emit(frame, data);
+	LIBCAMERA_TRACEPOINT(ipa_queue_frame_action, "frame=%u operation=%u",
+			     frame, data.operation);
+
+	IPAInterface::queueFrameAction.emit(frame, std::move(data));
 }
 
-void IPAContextWrapper::queue_frame_action(void *ctx, unsigned int frame)
+void IPAContextWrapper::queue_frame_action(void *ctx, unsigned int frame,
+					   const struct ipa_operation_data *data)
 {
 	IPAContextWrapper *_this = static_cast<IPAContextWrapper *>(ctx);
-	IPAOperationData data;
+	IPAOperationData action;
+
+	action.operation = data->operation;
+	action.data.assign(data->data, data->data + data->num_data);
+
+	for (unsigned int i = 0; i < data->num_lists; ++i) {
+		const struct ipa_control_list &c_list = data->lists[i];
+		ByteStreamBuffer buffer(c_list.data, c_list.size);
+		action.controls.push_back(_this->serializer_.deserialize<ControlList>(buffer));
+	}
 
-	_this->queueFrameAction(frame, data);
+	_this->queueFrameAction(frame, std::move(action));
 }
 
 #ifndef __DOXYGEN__
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_controls.cpp - IPA control handling
+ */
+
+#include <ipa/ipa_controls.h>
+
+/**
+ * \file ipa_controls.h
+ * \brief Type definitions for serialized controls
+ *
+ * This file defines binary formats to store ControlList and ControlInfoMap
+ * instances in contiguous, self-contained memory areas called control packets.
+ * It describes the layout of the packets through a set of C structures. These
+ * formats shall be used when serializing ControlList and ControlInfoMap to
+ * transfer them through the IPA C interface and IPA IPC transports.
+ *
+ * A control packet contains a list of entries, each of them describing a single
+ * control info or control value. The packet starts with a fixed-size header
+ * described by the ipa_controls_header structure, followed by an array of
+ * fixed-size entries. Each entry is associated with data, stored either
+ * directly in the entry, or in a data section after the entries array.
+ *
+ * The following diagram describes the layout of the ControlList packet.
+ *
+ * ~~~~
+ *           +-------------------------+    .                      .
+ *  Header / | ipa_controls_header     |    |                      |
+ *         | |                         |    |                      |
+ *         \ |                         |    |                      |
+ *           +-------------------------+    |                      |
+ *         / | ipa_control_value_entry |    | hdr.data_offset      |
+ *         | | #0                      |    |                      |
+ * Control | +-------------------------+    |                      |
+ *   value | | ...                     |    |                      |
+ * entries | +-------------------------+    |                      |
+ *         | | ipa_control_value_entry |    |             hdr.size |
+ *         \ | #hdr.entries - 1        |    |                      |
+ *           +-------------------------+    |                      |
+ *           | empty space (optional)  |    |                      |
+ *           +-------------------------+ <--´  .                   |
+ *         / | ...                     |       | entry[n].offset   |
+ *    Data | | ...                     |       |                   |
+ * section | | value #n                | <-----´                   |
+ *         \ | ...                     |                           |
+ *           +-------------------------+                           |
+ *           | empty space (optional)  |                           |
+ *           +-------------------------+ <-------------------------´
+ * ~~~~
+ *
+ * The packet header contains the size of the packet, the number of entries, and
+ * the offset from the beginning of the packet to the data section. The packet
+ * entries array immediately follows the header. The data section starts at the
+ * offset ipa_controls_header::data_offset from the beginning of the packet, and
+ * shall be aligned to a multiple of 8 bytes.
+ *
+ * Entries are described by the ipa_control_value_entry structure. They contain
+ * the numerical ID of the control, its type, the number of elements for array
+ * values, and the offset of the value data from the beginning of the data
+ * section. Values are stored in the data section in the same order as the
+ * entries, each aligned to a multiple of 8 bytes. Scalar values use the native
+ * size and representation of their type, array values store their elements
+ * contiguously.
+ *
+ * The ControlInfoMap packet is identical to the ControlList packet, with
+ * entries described by the ipa_control_range_entry structure. The data
+ * associated with each entry stores the minimum and maximum values of the
+ * control range, each aligned to a multiple of 8 bytes.
+ *
+ * The length of the data section is the size of the packet minus the data
+ * offset. All fields are stored in the native endianness of the system, as
+ * packets are only exchanged between processes running on the same device.
+ */
+
+/**
+ * \def IPA_CONTROLS_FORMAT_VERSION
+ * \brief The current control serialization format version
+ */
+
+/**
+ * \enum ipa_controls_id_map_type
+ * \brief Enumerates the different control ID map types
+ *
+ * Each ControlInfoMap and ControlList refers to a control ID map that
+ * associates the ControlId references to a numerical identifier.
+ * During the serialization procedure the raw pointers to the ControlId
+ * instances cannot be transported on the wire, hence their numerical id is
+ * used to identify them in the serialized data buffer. At deserialization time
+ * it is required to associate back to the numerical id the ControlId instance
+ * it represents. This enumeration describes which ControlIdMap should be
+ * used to perform such operation.
+ *
+ * \var IPA_CONTROL_ID_MAP_CONTROLS
+ * \brief The numerical control identifier are resolved to a ControlId * using
+ * the global controls::controls id map
+ * \var IPA_CONTROL_ID_MAP_V4L2
+ * \brief The numerical control identifier are resolved to a ControlId * using
+ * ControlId instances created by the deserializer, typically for V4L2 controls
+ */
+
+/**
+ * \struct ipa_controls_header
+ * \brief Serialized control packet header
+ * \var ipa_controls_header::version
+ * Control packet format version number (shall be IPA_CONTROLS_FORMAT_VERSION)
+ * \var ipa_controls_header::handle
+ * For ControlInfoMap packets, this field contains a unique non-zero handle
+ * generated when the ControlInfoMap is serialized. For ControlList packets,
+ * this field contains the handle of the corresponding ControlInfoMap, or zero
+ * for lists using the global controls::controls id map.
+ * \var ipa_controls_header::entries
+ * Number of entries in the packet
+ * \var ipa_controls_header::size
+ * The total packet size in bytes
+ * \var ipa_controls_header::data_offset
+ * Offset in bytes from the beginning of the packet of the data section start
+ * \var ipa_controls_header::id_map_type
+ * The id map type as defined by the ipa_controls_id_map_type enumeration
+ * \var ipa_controls_header::reserved
+ * Reserved for future extensions
+ */
+
+/**
+ * \struct ipa_control_value_entry
+ * \brief Description of a serialized ControlValue entry
+ * \var ipa_control_value_entry::id
+ * The numerical ID of the control
+ * \var ipa_control_value_entry::type
+ * The type of the control (defined by enum ControlType)
+ * \var ipa_control_value_entry::is_array
+ * True if the control value stores an array, false otherwise
+ * \var ipa_control_value_entry::reserved
+ * Reserved for future extensions
+ * \var ipa_control_value_entry::count
+ * The number of control array elements for array controls (1 otherwise)
+ * \var ipa_control_value_entry::offset
+ * The offset in bytes from the beginning of the data section to the control
+ * value data (shall be a multiple of 8 bytes).
+ */
+
+/**
+ * \struct ipa_control_range_entry
+ * \brief Description of a serialized ControlRange entry
+ * \var ipa_control_range_entry::id
+ * The numerical ID of the control
+ * \var ipa_control_range_entry::type
+ * The type of the control (defined by enum ControlType)
+ * \var ipa_control_range_entry::offset
+ * The offset in bytes from the beginning of the data section to the range
+ * value data (shall be a multiple of 8 bytes)
+ * \var ipa_control_range_entry::min_type
+ * The type of the range minimum value (defined by enum ControlType)
+ * \var ipa_control_range_entry::max_type
+ * The type of the range maximum value (defined by enum ControlType)
+ * \var ipa_control_range_entry::reserved
+ * Reserved for future extensions
+ */
@@ -0,0 +1,425 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_data_serializer.cpp - IPA interface data (de)serializer
+ */
+
+#include "ipa_data_serializer.h"
+
+#include "byte_stream_buffer.h"
+#include "log.h"
+
+/**
+ * \file ipa_data_serializer.h
+ * \brief Serialization and deserialization of the IPA interface data types
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Serialization)
+
+/**
+ * \class IPADataSerializer
+ * \brief Serializer and deserializer for the IPA interface data types
+ *
+ * The IPADataSerializer serializes the arguments of the IPAInterface methods
+ * to transport them over IPC, and deserializes them on the other side. It
+ * complements the ControlSerializer, which it uses for the ControlInfoMap and
+ * ControlList instances embedded in the IPA interface data.
+ *
+ * As for the ControlSerializer, serialization is split in two steps. The
+ * binarySize() methods compute the size of the serialized data, and the
+ * serialize() methods store the data in a preallocated ByteStreamBuffer. The
+ * deserialize() methods parse the data from a ByteStreamBuffer.
+ *
+ * All data is stored in the native endianness of the system. Counts and
+ * numerical values are stored as 32-bit unsigned integers, in the order they
+ * appear in the data structures. The dmabuf file descriptors of IPABuffer
+ * planes are transported out of band, and are appended to a vector of file
+ * descriptors meant to be transferred through IPCUnixSocket::Payload::fds.
+ *
+ * An IPADataSerializer instance shall be used for all the ControlInfoMap and
+ * ControlList of a given IPA, as lists refer to the maps that have been
+ * previously serialized or deserialized.
+ */
+
+/**
+ * \fn IPADataSerializer::reset()
+ * \brief Reset the serializer
+ * \sa ControlSerializer::reset()
+ */
+
+/**
+ * \brief Retrieve the size in bytes required to serialize a stream
+ * configuration
+ * \param[in] streams The stream configuration
+ * \return The size in bytes required to store the serialized data
+ */
+size_t IPADataSerializer::binarySize(const std::map<unsigned int, IPAStream> &streams)
+{
+	return sizeof(uint32_t) + streams.size() * 4 * sizeof(uint32_t);
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize entity controls
+ * \param[in] infoMaps The entity controls
+ * \return The size in bytes required to store the serialized data
+ */
+size_t IPADataSerializer::binarySize(const std::map<unsigned int, ControlInfoMap> &infoMaps)
+{
+	size_t size = sizeof(uint32_t);
+
+	for (const auto &info : infoMaps)
+		size += sizeof(uint32_t) + ControlSerializer::binarySize(info.second);
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize IPA buffers
+ * \param[in] buffers The IPA buffers
+ *
+ * The file descriptors are transported out of band and not accounted for.
+ *
+ * \return The size in bytes required to store the serialized data
+ */
+size_t IPADataSerializer::binarySize(const std::vector<IPABuffer> &buffers)
+{
+	size_t size = sizeof(uint32_t);
+
+	for (const IPABuffer &buffer : buffers)
+		size += (2 + buffer.memory.planes().size()) * sizeof(uint32_t);
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize buffer IDs
+ * \param[in] ids The buffer IDs
+ * \return The size in bytes required to store the serialized data
+ */
+size_t IPADataSerializer::binarySize(const std::vector<unsigned int> &ids)
+{
+	return (1 + ids.size()) * sizeof(uint32_t);
+}
+
+/**
+ * \brief Retrieve the size in bytes required to serialize IPA operation data
+ * \param[in] data The IPA operation data
+ * \return The size in bytes required to store the serialized data
+ */
+size_t IPADataSerializer::binarySize(const IPAOperationData &data)
+{
+	size_t size = (3 + data.data.size()) * sizeof(uint32_t);
+
+	for (const ControlList &list : data.controls)
+		size += ControlSerializer::binarySize(list);
+
+	return size;
+}
+
+/**
+ * \brief Serialize a stream configuration
+ * \param[in] streams The stream configuration
+ * \param[in] buffer The memory buffer where to serialize the data
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC Not enough space is available in the buffer
+ */
+int IPADataSerializer::serialize(const std::map<unsigned int, IPAStream> &streams,
+				 ByteStreamBuffer &buffer)
+{
+	uint32_t count = streams.size();
+	buffer.write(&count);
+
+	for (const auto &stream : streams) {
+		uint32_t data[] = {
+			stream.first,
+			stream.second.pixelFormat,
+			stream.second.size.width,
+			stream.second.size.height,
+		};
+		buffer.write(data, 4);
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize entity controls
+ * \param[in] infoMaps The entity controls
+ * \param[in] buffer The memory buffer where to serialize the data
+ * \return 0 on success, a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const std::map<unsigned int, ControlInfoMap> &infoMaps,
+				 ByteStreamBuffer &buffer)
+{
+	uint32_t count = infoMaps.size();
+	buffer.write(&count);
+
+	for (const auto &info : infoMaps) {
+		uint32_t id = info.first;
+		buffer.write(&id);
+
+		int ret = controls_.serialize(info.second, buffer);
+		if (ret)
+			return ret;
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize IPA buffers
+ * \param[in] buffers The IPA buffers
+ * \param[in] buffer The memory buffer where to serialize the data
+ * \param[out] fds The vector of file descriptors to append the planes dmabufs
+ * to
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC Not enough space is available in the buffer
+ */
+int IPADataSerializer::serialize(const std::vector<IPABuffer> &buffers,
+				 ByteStreamBuffer &buffer,
+				 std::vector<int32_t> *fds)
+{
+	uint32_t count = buffers.size();
+	buffer.write(&count);
+
+	for (const IPABuffer &ipaBuffer : buffers) {
+		const PlaneArray &planes = ipaBuffer.memory.planes();
+		uint32_t header[] = {
+			ipaBuffer.id,
+			static_cast<uint32_t>(planes.size()),
+		};
+		buffer.write(header, 2);
+
+		for (const Plane &plane : planes) {
+			uint32_t length = plane.length();
+			buffer.write(&length);
+			fds->push_back(plane.dmabuf());
+		}
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize buffer IDs
+ * \param[in] ids The buffer IDs
+ * \param[in] buffer The memory buffer where to serialize the data
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC Not enough space is available in the buffer
+ */
+int IPADataSerializer::serialize(const std::vector<unsigned int> &ids,
+				 ByteStreamBuffer &buffer)
+{
+	uint32_t count = ids.size();
+	buffer.write(&count);
+
+	for (unsigned int id : ids) {
+		uint32_t value = id;
+		buffer.write(&value);
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize IPA operation data
+ * \param[in] data The IPA operation data
+ * \param[in] buffer The memory buffer where to serialize the data
+ * \return 0 on success, a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const IPAOperationData &data,
+				 ByteStreamBuffer &buffer)
+{
+	uint32_t header[] = {
+		data.operation,
+		static_cast<uint32_t>(data.data.size()),
+	};
+	buffer.write(header, 2);
+	buffer.write(data.data.data(), data.data.size());
+
+	uint32_t count = data.controls.size();
+	buffer.write(&count);
+
+	for (const ControlList &list : data.controls) {
+		int ret = controls_.serialize(list, buffer);
+		if (ret)
+			return ret;
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Deserialize a stream configuration
+ * \param[in] buffer The memory buffer that contains the serialized data
+ * \param[out] streams The deserialized stream configuration
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC The buffer doesn't contain enough data
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   std::map<unsigned int, IPAStream> *streams)
+{
+	uint32_t count;
+	if (buffer.read(&count))
+		return -ENOSPC;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uint32_t data[4];
+		if (buffer.read(data, 4))
+			return -ENOSPC;
+
+		IPAStream &stream = (*streams)[data[0]];
+		stream.pixelFormat = data[1];
+		stream.size = Size(data[2], data[3]);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize entity controls
+ * \param[in] buffer The memory buffer that contains the serialized data
+ * \param[out] infoMaps The deserialized entity controls
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC The buffer doesn't contain enough data
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   std::map<unsigned int, ControlInfoMap> *infoMaps)
+{
+	uint32_t count;
+	if (buffer.read(&count))
+		return -ENOSPC;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uint32_t id;
+		if (buffer.read(&id))
+			return -ENOSPC;
+
+		(*infoMaps)[id] = controls_.deserialize<ControlInfoMap>(buffer);
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Deserialize IPA buffers
+ * \param[in] buffer The memory buffer that contains the serialized data
+ * \param[in] fds The file descriptors transported with the data
+ * \param[out] buffers The deserialized IPA buffers
+ *
+ * The planes of the deserialized buffers duplicate the file descriptors from
+ * \a fds, which remain owned by the caller.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC The buffer doesn't contain enough data
+ * \retval -EINVAL The number of file descriptors doesn't match the planes
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   const std::vector<int32_t> &fds,
+				   std::vector<IPABuffer> *buffers)
+{
+	uint32_t count;
+	if (buffer.read(&count))
+		return -ENOSPC;
+
+	unsigned int fd = 0;
+
+	buffers->resize(count);
+	for (IPABuffer &ipaBuffer : *buffers) {
+		uint32_t header[2];
+		if (buffer.read(header, 2))
+			return -ENOSPC;
+
+		ipaBuffer.id = header[0];
+
+		if (header[1] > PlaneArray::Capacity) {
+			LOG(Serialization, Error)
+				<< "Too many planes for buffer " << ipaBuffer.id;
+			return -EINVAL;
+		}
+
+		PlaneArray &planes = ipaBuffer.memory.planes();
+		planes.resize(header[1]);
+
+		for (Plane &plane : planes) {
+			uint32_t length;
+			if (buffer.read(&length))
+				return -ENOSPC;
+
+			if (fd >= fds.size()) {
+				LOG(Serialization, Error)
+					<< "Missing file descriptor for buffer "
+					<< ipaBuffer.id;
+				return -EINVAL;
+			}
+
+			int ret = plane.setDmabuf(fds[fd++], length);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize buffer IDs
+ * \param[in] buffer The memory buffer that contains the serialized data
+ * \param[out] ids The deserialized buffer IDs
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC The buffer doesn't contain enough data
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   std::vector<unsigned int> *ids)
+{
+	uint32_t count;
+	if (buffer.read(&count))
+		return -ENOSPC;
+
+	ids->resize(count);
+	for (unsigned int &id : *ids) {
+		uint32_t value;
+		if (buffer.read(&value))
+			return -ENOSPC;
+
+		id = value;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize IPA operation data
+ * \param[in] buffer The memory buffer that contains the serialized data
+ * \param[out] data The deserialized IPA operation data
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC The buffer doesn't contain enough data
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   IPAOperationData *data)
+{
+	uint32_t header[2];
+	if (buffer.read(header, 2))
+		return -ENOSPC;
+
+	data->operation = header[0];
+	data->data.resize(header[1]);
+	if (buffer.read(data->data.data(), data->data.size()))
+		return -ENOSPC;
+
+	uint32_t count;
+	if (buffer.read(&count))
+		return -ENOSPC;
+
+	data->controls.clear();
+	data->controls.reserve(count);
+	for (unsigned int i = 0; i < count; ++i)
+		data->controls.push_back(controls_.deserialize<ControlList>(buffer));
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+} /* namespace libcamera */
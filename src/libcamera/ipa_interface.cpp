@@ -92,6 +92,75 @@
  * \brief The IPA context operations
  */
 
+/**
+ * \struct ipa_stream
+ * \brief Stream information for the IPA context operations
+ *
+ * \var ipa_stream::id
+ * \brief Identifier for the stream, defined by the IPA protocol
+ *
+ * \var ipa_stream::pixel_format
+ * \brief The stream pixel format, as defined by the PixelFormat class
+ *
+ * \var ipa_stream::width
+ * \brief The stream width in pixels
+ *
+ * \var ipa_stream::height
+ * \brief The stream height in pixels
+ */
+
+/**
+ * \struct ipa_control_info_map
+ * \brief ControlInfoMap description for the IPA context operations
+ *
+ * \var ipa_control_info_map::id
+ * \brief Identifier for the ControlInfoMap, defined by the IPA protocol
+ *
+ * \var ipa_control_info_map::data
+ * \brief Pointer to a control packet for the ControlInfoMap
+ * \sa ipa_controls.h
+ *
+ * \var ipa_control_info_map::size
+ * \brief The size of the control packet in bytes
+ */
+
+/**
+ * \struct ipa_control_list
+ * \brief ControlList description for the IPA context operations
+ *
+ * \var ipa_control_list::data
+ * \brief Pointer to a control packet for the ControlList
+ * \sa ipa_controls.h
+ *
+ * \var ipa_control_list::size
+ * \brief The size of the control packet in bytes
+ */
+
+/**
+ * \struct ipa_operation_data
+ * \brief IPA operation data for the IPA context operations
+ * \sa libcamera::IPAOperationData
+ *
+ * The data pointed to by the structure is owned by the caller, and is only
+ * valid for the duration of the operation or callback it is passed to. IPA
+ * modules that need to keep it shall copy it.
+ *
+ * \var ipa_operation_data::operation
+ * \brief IPA protocol operation
+ *
+ * \var ipa_operation_data::data
+ * \brief Pointer to the operation data array
+ *
+ * \var ipa_operation_data::num_data
+ * \brief Number of entries in the ipa_operation_data::data array
+ *
+ * \var ipa_operation_data::lists
+ * \brief Pointer to an array of ipa_control_list
+ *
+ * \var ipa_operation_data::num_lists
+ * \brief Number of entries in the ipa_control_list array
+ */
+
 /**
  * \struct ipa_buffer_plane
  * \brief A plane for an ipa_buffer
@@ -130,6 +199,7 @@
  * \param[in] cb_ctx The callback context registered with
  * ipa_context_ops::register_callbacks
  * \param[in] frame The frame number
+ * \param[in] data The IPA operation data
  *
  * \sa libcamera::IPAInterface::queueFrameAction
  */
@@ -184,6 +254,14 @@
  * \var ipa_context_ops::configure
  * \brief Configure the IPA stream and sensor settings
  * \param[in] ctx The IPA context
+ * \param[in] streams Array of ipa_stream describing the streams to configure
+ * \param[in] num_streams The number of entries in the \a streams array
+ * \param[in] maps Array of ipa_control_info_map describing the controls of
+ * the sensor and other devices
+ * \param[in] num_maps The number of entries in the \a maps array
+ *
+ * The ControlInfoMap packets shall be deserialized before the ControlList
+ * packets of later operations that refer to them.
  *
  * \sa libcamera::IPAInterface::configure()
  */
@@ -212,6 +290,7 @@
  * \var ipa_context_ops::process_event
  * \brief Process an event from the pipeline handler
  * \param[in] ctx The IPA context
+ * \param[in] data The IPA operation data
  *
  * \sa libcamera::IPAInterface::processEvent()
  */
@@ -346,7 +425,7 @@ namespace libcamera {
  */
 
 /**
- * \fn IPAInterface::configure()
+ * \fn IPAInterface::configure(const std::map<unsigned int, IPAStream> &streamConfig, const std::map<unsigned int, ControlInfoMap> &entityControls)
  * \brief Configure the IPA stream and sensor settings
  * \param[in] streamConfig Configuration of all active streams
  * \param[in] entityControls Controls provided by the pipeline entities
@@ -357,6 +436,19 @@ namespace libcamera {
  * protocol.
  */
 
+/**
+ * \fn IPAInterface::configure(std::map<unsigned int, IPAStream> &&streamConfig, std::map<unsigned int, ControlInfoMap> &&entityControls)
+ * \brief Configure the IPA, taking ownership of the configuration
+ * \param[in] streamConfig Configuration of all active streams
+ * \param[in] entityControls Controls provided by the pipeline entities
+ *
+ * This method behaves as the configure() overload taking const references, but
+ * allows proxies to move the maps instead of duplicating them.
+ *
+ * The default implementation calls the configure() overload taking const
+ * references.
+ */
+
 /**
  * \fn IPAInterface::mapBuffers()
  * \brief Map buffers shared between the pipeline handler and the IPA
@@ -402,7 +494,7 @@ namespace libcamera {
  */
 
 /**
- * \fn IPAInterface::processEvent()
+ * \fn IPAInterface::processEvent(const IPAOperationData &data)
  * \brief Process an event from the pipeline handler
  * \param[in] data IPA operation data
  *
@@ -414,6 +506,20 @@ namespace libcamera {
  * documented IPA protocol.
  */
 
+/**
+ * \fn IPAInterface::processEvent(IPAOperationData &&data)
+ * \brief Process an event from the pipeline handler, taking ownership of its data
+ * \param[in] data IPA operation data
+ *
+ * This method behaves as processEvent(const IPAOperationData &data), but allows
+ * the IPA, or the proxy carrying the event to it, to move the content of
+ * \a data instead of copying it. Pipeline handlers should use it for events
+ * built for the sole purpose of being sent to the IPA, which is the case of
+ * most per-frame events.
+ *
+ * The default implementation calls processEvent(const IPAOperationData &data).
+ */
+
 /**
  * \var IPAInterface::queueFrameAction
  * \brief Queue an action associated with a frame to the pipeline handler
@@ -429,6 +535,10 @@ namespace libcamera {
  * \a data.operation field, as defined by the IPA protocol, and the rest of the
  * \a data is interpreted accordingly. The pipeline handler shall queue the
  * action and execute it as appropriate.
+ *
+ * The \a data is passed by rvalue reference, the slot takes ownership of its
+ * content and may move the control lists out of it instead of copying them.
+ * The signal shall thus be connected to a single slot.
  */
 
 } /* namespace libcamera */
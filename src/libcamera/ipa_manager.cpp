@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <dirent.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
@@ -17,6 +18,7 @@
 #include "ipa_proxy.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "startup_timeline.h"
 #include "utils.h"
 
 /**
@@ -94,7 +96,46 @@ LOG_DEFINE_CATEGORY(IPAManager)
  */
 
 IPAManager::IPAManager()
+	: scanned_(false)
 {
+}
+
+IPAManager::~IPAManager()
+{
+	for (IPAModule *module : modules_)
+		delete module;
+}
+
+/**
+ * \brief Retrieve the IPA manager instance
+ *
+ * The IPAManager is a singleton and can't be constructed manually. This
+ * function shall instead be used to retrieve the single global instance of the
+ * manager.
+ *
+ * \return The IPA manager instance
+ */
+IPAManager *IPAManager::instance()
+{
+	static IPAManager ipaManager;
+	return &ipaManager;
+}
+
+/**
+ * \brief Discover the IPA modules
+ *
+ * The IPA module directories are scanned the first time an IPA module is
+ * needed, to keep it out of the start-up of systems whose pipeline handlers
+ * don't use any IPA. The information of the modules found is cached by the
+ * IPAModuleInfoCache.
+ */
+void IPAManager::scan()
+{
+	if (scanned_)
+		return;
+
+	scanned_ = true;
+
 	unsigned int ipaCount = 0;
 	int ret;
 
@@ -146,27 +187,6 @@ IPAManager::IPAManager()
 			<< modulePaths << "'";
 }
 
-IPAManager::~IPAManager()
-{
-	for (IPAModule *module : modules_)
-		delete module;
-}
-
-/**
- * \brief Retrieve the IPA manager instance
- *
- * The IPAManager is a singleton and can't be constructed manually. This
- * function shall instead be used to retrieve the single global instance of the
- * manager.
- *
- * \return The IPA manager instance
- */
-IPAManager *IPAManager::instance()
-{
-	static IPAManager ipaManager;
-	return &ipaManager;
-}
-
 /**
  * \brief Load IPA modules from a directory
  * \param[in] libDir directory to search for IPA modules
@@ -218,21 +238,124 @@ int IPAManager::addDir(const char *libDir)
 	return count;
 }
 
+/**
+ * \brief Start IPA proxy workers ahead of time
+ *
+ * Isolating a closed-source IPA module requires starting a worker process,
+ * which takes a significant amount of time. To keep it out of the IPA creation,
+ * the LIBCAMERA_IPA_PROXY_PRESTART environment variable can be set to a number
+ * of proxy workers to start when the camera manager starts. The workers load
+ * the IPA module when the IPA is created, and are replaced as they get used.
+ *
+ * Nothing is started if the variable isn't set, or if no closed-source module
+ * has been found.
+ */
+void IPAManager::prestartProxies()
+{
+	const char *env = utils::secure_getenv("LIBCAMERA_IPA_PROXY_PRESTART");
+	if (!env || !*env)
+		return;
+
+	char *end;
+	unsigned long count = strtoul(env, &end, 10);
+	if (*end) {
+		LOG(IPAManager, Warning)
+			<< "Invalid proxy worker count " << env;
+		return;
+	}
+
+	scan();
+
+	bool isolated = std::any_of(modules_.begin(), modules_.end(),
+				    [](IPAModule *m) { return !m->isOpenSource(); });
+	if (!count || !isolated)
+		return;
+
+	for (IPAProxyFactory *factory : IPAProxyFactory::factories())
+		factory->prestart(count);
+}
+
+/**
+ * \brief Set the scheduling parameters of the IPA threads
+ * \param[in] scheduling The scheduling parameters
+ *
+ * The scheduling parameters apply to the threads of the IPA modules running
+ * with the IPAManager::ThreadedIPA thread model that are created after this
+ * call. Isolated IPA modules run in separate processes and aren't affected.
+ */
+void IPAManager::setThreadScheduling(const ThreadScheduling &scheduling)
+{
+	threadScheduling_ = scheduling;
+}
+
+/**
+ * \fn IPAManager::threadScheduling()
+ * \brief Retrieve the scheduling parameters of the IPA threads
+ * \return The scheduling parameters of the IPA threads
+ */
+
+/**
+ * \enum IPAManager::ThreadModel
+ * \brief Thread model for open-source IPA modules
+ * \var IPAManager::SameThread
+ * The IPA is called synchronously in the thread of the pipeline handler
+ * \var IPAManager::ThreadedIPA
+ * The IPA runs in a thread of its own and is called asynchronously
+ */
+
+std::unique_ptr<IPAInterface> IPAManager::createProxy(IPAModule *m,
+						      const char *name)
+{
+	IPAProxyFactory *pf = nullptr;
+	std::vector<IPAProxyFactory *> &factories = IPAProxyFactory::factories();
+
+	for (IPAProxyFactory *factory : factories) {
+		if (!strcmp(factory->name().c_str(), name)) {
+			pf = factory;
+			break;
+		}
+	}
+
+	if (!pf) {
+		LOG(IPAManager, Error) << "Failed to get proxy factory " << name;
+		return nullptr;
+	}
+
+	std::unique_ptr<IPAProxy> proxy = pf->create(m);
+	if (!proxy->isValid()) {
+		LOG(IPAManager, Error) << "Failed to load proxy " << name;
+		return nullptr;
+	}
+
+	return proxy;
+}
+
 /**
  * \brief Create an IPA interface that matches a given pipeline handler
  * \param[in] pipe The pipeline handler that wants a matching IPA interface
  * \param[in] minVersion Minimum acceptable version of IPA module
  * \param[in] maxVersion Maximum acceptable version of IPA module
+ * \param[in] threadModel Thread in which to run an open-source IPA
+ *
+ * Open-source IPA modules are called directly in the pipeline handler thread
+ * by default. Pipeline handlers whose IPA performs heavy processing in
+ * processEvent() can select ThreadedIPA to run it in a thread of its own,
+ * provided they handle queueFrameAction asynchronously and don't reuse the
+ * buffers passed to the IPA before it's done with them. Closed-source modules
+ * are always isolated in a separate process.
  *
  * \return A newly created IPA interface, or nullptr if no matching
  * IPA module is found or if the IPA interface fails to initialize
  */
 std::unique_ptr<IPAInterface> IPAManager::createIPA(PipelineHandler *pipe,
 						    uint32_t maxVersion,
-						    uint32_t minVersion)
+						    uint32_t minVersion,
+						    enum ThreadModel threadModel)
 {
 	IPAModule *m = nullptr;
 
+	scan();
+
 	for (IPAModule *module : modules_) {
 		if (module->match(pipe, minVersion, maxVersion)) {
 			m = module;
@@ -243,31 +366,18 @@ std::unique_ptr<IPAInterface> IPAManager::createIPA(PipelineHandler *pipe,
 	if (!m)
 		return nullptr;
 
-	if (!m->isOpenSource()) {
-		IPAProxyFactory *pf = nullptr;
-		std::vector<IPAProxyFactory *> &factories = IPAProxyFactory::factories();
-
-		for (IPAProxyFactory *factory : factories) {
-			/* TODO: Better matching */
-			if (!strcmp(factory->name().c_str(), "IPAProxyLinux")) {
-				pf = factory;
-				break;
-			}
-		}
-
-		if (!pf) {
-			LOG(IPAManager, Error) << "Failed to get proxy factory";
-			return nullptr;
-		}
+	StartupTimeline::Scope phase("ipa-load", m->path());
 
-		std::unique_ptr<IPAProxy> proxy = pf->create(m);
-		if (!proxy->isValid()) {
-			LOG(IPAManager, Error) << "Failed to load proxy";
-			return nullptr;
-		}
+	/*
+	 * Closed-source modules are isolated in a separate process, open-source
+	 * modules run in the pipeline handler process, optionally in their own
+	 * thread.
+	 */
+	if (!m->isOpenSource())
+		return createProxy(m, "IPAProxyLinux");
 
-		return proxy;
-	}
+	if (threadModel == ThreadedIPA)
+		return createProxy(m, "IPAProxyThread");
 
 	if (!m->load())
 		return nullptr;
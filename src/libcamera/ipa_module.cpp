@@ -20,6 +20,7 @@
 #include <tuple>
 #include <unistd.h>
 
+#include "ipa_module_cache.h"
 #include "log.h"
 #include "pipeline_handler.h"
 #include "utils.h"
@@ -283,6 +284,13 @@ IPAModule::~IPAModule()
 
 int IPAModule::loadIPAModuleInfo()
 {
+	IPAModuleInfoCache *cache = IPAModuleInfoCache::instance();
+	struct stat st;
+
+	/* Skip parsing the ELF file if its information has been cached. */
+	if (!stat(libPath_.c_str(), &st) && cache->lookup(libPath_, st, &info_))
+		return verifyIPAModuleInfo();
+
 	int fd = open(libPath_.c_str(), O_RDONLY);
 	if (fd < 0) {
 		int ret = -errno;
@@ -295,7 +303,6 @@ int IPAModule::loadIPAModuleInfo()
 	size_t dataSize;
 	void *map;
 	size_t soSize;
-	struct stat st;
 	int ret = fstat(fd, &st);
 	if (ret < 0)
 		goto close;
@@ -322,18 +329,19 @@ int IPAModule::loadIPAModuleInfo()
 	if (data && dataSize == sizeof(info_))
 		memcpy(&info_, data, dataSize);
 
-	if (!data)
-		goto unmap;
-
-	if (info_.moduleAPIVersion != IPA_MODULE_API_VERSION) {
-		LOG(IPAModule, Error) << "IPA module API version mismatch";
+	if (!data || dataSize != sizeof(info_)) {
 		ret = -EINVAL;
+		goto unmap;
 	}
 
+	cache->store(libPath_, st, info_);
+
+	ret = verifyIPAModuleInfo();
+
 unmap:
 	munmap(map, soSize);
 close:
-	if (ret || !data)
+	if (ret)
 		LOG(IPAModule, Error)
 			<< "Error loading IPA module info for " << libPath_;
 
@@ -341,6 +349,16 @@ close:
 	return ret;
 }
 
+int IPAModule::verifyIPAModuleInfo()
+{
+	if (info_.moduleAPIVersion != IPA_MODULE_API_VERSION) {
+		LOG(IPAModule, Error) << "IPA module API version mismatch";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Check if the IPAModule instance is valid
  *
@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache.cpp - Cache of IPA module information
+ */
+
+#include "ipa_module_cache.h"
+
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file ipa_module_cache.h
+ * \brief Cache of IPA module information
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAModule)
+
+namespace {
+
+const char *const CacheHeader = "# libcamera IPA module info cache v1";
+
+int64_t modificationTime(const struct stat &st)
+{
+	return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000
+	       + st.st_mtim.tv_nsec;
+}
+
+bool readString(std::istream &record, char *str, size_t size)
+{
+	std::size_t length;
+
+	if (!(record >> length) || record.get() != ' ' || length >= size)
+		return false;
+
+	memset(str, 0, size);
+	return !!record.read(str, length);
+}
+
+void writeString(std::ostream &file, const char *str, size_t size)
+{
+	std::size_t length = strnlen(str, size - 1);
+
+	file << " " << length << " ";
+	file.write(str, length);
+}
+
+} /* namespace */
+
+/**
+ * \class IPAModuleInfoCache
+ * \brief Process-wide cache of the IPA module information
+ *
+ * Retrieving the IPAModuleInfo of an IPA module requires mapping the shared
+ * object and parsing its ELF symbol table, for every module found in the IPA
+ * module directories. The IPAModuleInfoCache stores the information indexed by
+ * the module path, along with the modification time and size of the file. A
+ * cached entry is only used if the module file still matches both, and is
+ * replaced otherwise.
+ *
+ * The cache is useful across processes, and is persisted to disk when the
+ * LIBCAMERA_IPA_MODULE_CACHE environment variable is set to the path of the
+ * cache file. The file is loaded when the cache is first used, and rewritten
+ * every time a new entry is stored.
+ */
+
+IPAModuleInfoCache::IPAModuleInfoCache()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_IPA_MODULE_CACHE");
+	if (path && *path) {
+		path_ = path;
+		load();
+	}
+}
+
+/**
+ * \brief Retrieve the IPA module information cache instance
+ * \return The IPA module information cache
+ */
+IPAModuleInfoCache *IPAModuleInfoCache::instance()
+{
+	static IPAModuleInfoCache instance;
+	return &instance;
+}
+
+/**
+ * \brief Look up the information of an IPA module in the cache
+ * \param[in] path The IPA module path
+ * \param[in] st The status of the IPA module file
+ * \param[out] info The cached IPA module information
+ * \return True if a matching entry has been found in the cache, false otherwise
+ */
+bool IPAModuleInfoCache::lookup(const std::string &path, const struct stat &st,
+				struct IPAModuleInfo *info)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = cache_.find(path);
+	if (it == cache_.end())
+		return false;
+
+	const Entry &entry = it->second;
+	if (entry.mtime != modificationTime(st) ||
+	    entry.size != static_cast<uint64_t>(st.st_size))
+		return false;
+
+	*info = entry.info;
+	return true;
+}
+
+/**
+ * \brief Store the information of an IPA module in the cache
+ * \param[in] path The IPA module path
+ * \param[in] st The status of the IPA module file
+ * \param[in] info The IPA module information
+ */
+void IPAModuleInfoCache::store(const std::string &path, const struct stat &st,
+			       const struct IPAModuleInfo &info)
+{
+	MutexLocker locker(mutex_);
+
+	Entry &entry = cache_[path];
+	entry.mtime = modificationTime(st);
+	entry.size = st.st_size;
+	entry.info = info;
+
+	if (!path_.empty())
+		save();
+}
+
+/**
+ * \brief Load the cache from disk
+ *
+ * The cache file contains one module record per line. Each record contains the
+ * module path, modification time in nanoseconds and size, followed by the
+ * fields of the IPAModuleInfo in order. Strings are stored with their length
+ * first. Malformed records cause the rest of the file to be ignored.
+ */
+void IPAModuleInfoCache::load()
+{
+	std::ifstream file(path_);
+	if (!file.is_open())
+		return;
+
+	std::string line;
+	if (!std::getline(file, line) || line != CacheHeader) {
+		LOG(IPAModule, Warning)
+			<< "Ignoring invalid IPA module cache " << path_;
+		return;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream record(line);
+		std::size_t length;
+
+		if (!(record >> length) || record.get() != ' ')
+			break;
+
+		std::string path(length, '\0');
+		if (!record.read(&path[0], length))
+			break;
+
+		Entry entry = {};
+		struct IPAModuleInfo &info = entry.info;
+		int moduleAPIVersion;
+		uint32_t pipelineVersion;
+
+		if (!(record >> entry.mtime >> entry.size >> moduleAPIVersion
+			     >> pipelineVersion) ||
+		    record.get() != ' ' ||
+		    !readString(record, info.pipelineName, sizeof(info.pipelineName)) ||
+		    record.get() != ' ' ||
+		    !readString(record, info.name, sizeof(info.name)) ||
+		    record.get() != ' ' ||
+		    !readString(record, info.license, sizeof(info.license)))
+			break;
+
+		info.moduleAPIVersion = moduleAPIVersion;
+		info.pipelineVersion = pipelineVersion;
+
+		cache_[path] = entry;
+	}
+
+	LOG(IPAModule, Debug)
+		<< "Loaded " << cache_.size() << " modules from IPA module cache";
+}
+
+/**
+ * \brief Save the cache to disk
+ *
+ * The cache is written to a temporary file renamed to the cache file, to
+ * guarantee that concurrent readers never see a partially written cache.
+ */
+void IPAModuleInfoCache::save()
+{
+	std::string tmpPath = path_ + "." + std::to_string(getpid());
+
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file.is_open()) {
+			LOG(IPAModule, Warning)
+				<< "Failed to write IPA module cache " << path_;
+			return;
+		}
+
+		file << CacheHeader << std::endl;
+
+		for (const auto &it : cache_) {
+			const Entry &entry = it.second;
+			const struct IPAModuleInfo &info = entry.info;
+
+			file << it.first.size() << " " << it.first << " "
+			     << entry.mtime << " " << entry.size << " "
+			     << info.moduleAPIVersion << " "
+			     << info.pipelineVersion;
+
+			writeString(file, info.pipelineName, sizeof(info.pipelineName));
+			writeString(file, info.name, sizeof(info.name));
+			writeString(file, info.license, sizeof(info.license));
+
+			file << std::endl;
+		}
+
+		if (!file.good()) {
+			LOG(IPAModule, Warning)
+				<< "Failed to write IPA module cache " << path_;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		int ret = -errno;
+		LOG(IPAModule, Warning)
+			<< "Failed to update IPA module cache " << path_ << ": "
+			<< strerror(-ret);
+		unlink(tmpPath.c_str());
+	}
+}
+
+} /* namespace libcamera */
@@ -59,6 +59,17 @@ IPAProxy::~IPAProxy()
  * \return True if the IPAProxy is valid, false otherwise
  */
 
+/**
+ * \fn IPAProxy::prestart()
+ * \brief Start resources shared by the proxy instances ahead of time
+ * \param[in] count Number of instances to prepare for
+ *
+ * Proxies that isolate the IPA in a separate process can start \a count
+ * processes in advance, to keep process creation out of the time it takes to
+ * create the proxy instances. This default implementation does nothing. The
+ * method is called through IPAProxyFactory::prestart().
+ */
+
 /**
  * \brief Find a valid full path for a proxy worker for a given executable name
  * \param[in] file File name of proxy worker executable
@@ -73,7 +84,7 @@ IPAProxy::~IPAProxy()
  * \return The full path to the proxy worker executable, or an empty string if
  * no valid executable path
  */
-std::string IPAProxy::resolvePath(const std::string &file) const
+std::string IPAProxy::resolvePath(const std::string &file)
 {
 	/* Try finding the exec target from the install directory first */
 	std::string proxyFile = "/" + file;
@@ -156,6 +167,15 @@ IPAProxyFactory::IPAProxyFactory(const char *name)
  * corresponding to the factory
  */
 
+/**
+ * \fn IPAProxyFactory::prestart()
+ * \brief Prepare the IPAProxy class corresponding to the factory for use
+ * \param[in] count Number of instances to prepare for
+ *
+ * This virtual function is implemented by the REGISTER_IPA_PROXY() macro. It
+ * calls the static IPAProxy::prestart() method of the IPAProxy subclass.
+ */
+
 /**
  * \fn IPAProxyFactory::name()
  * \brief Retrieve the factory name
@@ -196,9 +216,11 @@ std::vector<IPAProxyFactory *> &IPAProxyFactory::factories()
  * \def REGISTER_IPA_PROXY
  * \brief Register a IPAProxy with the IPAProxy factory
  * \param[in] proxy Class name of IPAProxy derived class to register
+ * \param[in] name Name of the proxy, used to select it in the IPAManager
  *
  * Register a proxy subclass with the factory and make it available to
- * isolate IPA modules.
+ * isolate IPA modules. The \a name is independent of the \a proxy class name,
+ * to allow proxy classes to be defined in their own namespace.
  */
 
 } /* namespace libcamera */
@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_state_store.cpp - Store of the IPA algorithms state
+ */
+
+#include "ipa_state_store.h"
+
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file ipa_state_store.h
+ * \brief Store of the IPA algorithms state
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAManager)
+
+namespace {
+
+const char *const StoreHeader = "# libcamera IPA state v1";
+
+} /* namespace */
+
+/**
+ * \class IPAStateStore
+ * \brief Process-wide store of the converged state of IPA algorithms
+ *
+ * IPAs start the algorithms from default values when a camera is started, and
+ * need many frames to converge to the exposure, gain and white balance that
+ * suit the scene. As scenes rarely change much between two capture sessions,
+ * starting from the state the algorithms had converged to in the previous
+ * session usually produces good frames right away.
+ *
+ * The IPAStateStore holds the state of the IPA of each camera, indexed by the
+ * camera name. The state is opaque to the store, it is an array of 32-bit
+ * values whose layout is defined by the IPA protocol of each pipeline handler.
+ * Pipeline handlers store the state exported by their IPA when the camera is
+ * stopped, and look it up to pass it back to the IPA when the camera is
+ * started.
+ *
+ * The state is kept in memory for the lifetime of the process. It is persisted
+ * to disk when the LIBCAMERA_IPA_STATE_FILE environment variable is set to the
+ * path of the state file, which is loaded when the store is first used and
+ * rewritten every time a state is stored.
+ */
+
+IPAStateStore::IPAStateStore()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_IPA_STATE_FILE");
+	if (path && *path) {
+		path_ = path;
+		load();
+	}
+}
+
+/**
+ * \brief Retrieve the IPA state store instance
+ * \return The IPA state store
+ */
+IPAStateStore *IPAStateStore::instance()
+{
+	static IPAStateStore instance;
+	return &instance;
+}
+
+/**
+ * \brief Look up the IPA state of a camera
+ * \param[in] camera The camera name
+ * \param[out] state The IPA state
+ * \return True if a state has been found for the camera, false otherwise
+ */
+bool IPAStateStore::lookup(const std::string &camera,
+			   std::vector<uint32_t> *state)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = states_.find(camera);
+	if (it == states_.end())
+		return false;
+
+	*state = it->second;
+	return true;
+}
+
+/**
+ * \brief Store the IPA state of a camera
+ * \param[in] camera The camera name
+ * \param[in] state The IPA state
+ *
+ * The state replaces any state previously stored for the camera. Storing an
+ * identical state doesn't rewrite the state file.
+ */
+void IPAStateStore::store(const std::string &camera,
+			  const std::vector<uint32_t> &state)
+{
+	MutexLocker locker(mutex_);
+
+	std::vector<uint32_t> &entry = states_[camera];
+	if (entry == state)
+		return;
+
+	entry = state;
+
+	if (!path_.empty())
+		save();
+}
+
+/**
+ * \brief Load the store from disk
+ *
+ * The state file contains one record per line. Each record contains the length
+ * of the camera name, the camera name, the number of values of the state and
+ * the values. Malformed records cause the rest of the file to be ignored.
+ */
+void IPAStateStore::load()
+{
+	std::ifstream file(path_);
+	if (!file.is_open())
+		return;
+
+	std::string line;
+	if (!std::getline(file, line) || line != StoreHeader) {
+		LOG(IPAManager, Warning)
+			<< "Ignoring invalid IPA state file " << path_;
+		return;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream record(line);
+		std::size_t length;
+
+		if (!(record >> length) || record.get() != ' ')
+			break;
+
+		std::string camera(length, '\0');
+		if (!record.read(&camera[0], length))
+			break;
+
+		std::size_t count;
+		if (!(record >> count))
+			break;
+
+		std::vector<uint32_t> state(count);
+		for (uint32_t &value : state)
+			record >> value;
+
+		if (!record)
+			break;
+
+		states_[camera] = std::move(state);
+	}
+
+	LOG(IPAManager, Debug)
+		<< "Loaded IPA state for " << states_.size() << " cameras";
+}
+
+/**
+ * \brief Save the store to disk
+ *
+ * The store is written to a temporary file renamed to the state file, to
+ * guarantee that concurrent readers never see a partially written file.
+ */
+void IPAStateStore::save()
+{
+	std::string tmpPath = path_ + "." + std::to_string(getpid());
+
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file.is_open()) {
+			LOG(IPAManager, Warning)
+				<< "Failed to write IPA state file " << path_;
+			return;
+		}
+
+		file << StoreHeader << std::endl;
+
+		for (const auto &it : states_) {
+			const std::vector<uint32_t> &state = it.second;
+
+			file << it.first.size() << " " << it.first << " "
+			     << state.size();
+			for (uint32_t value : state)
+				file << " " << value;
+			file << std::endl;
+		}
+
+		if (!file.good()) {
+			LOG(IPAManager, Warning)
+				<< "Failed to write IPA state file " << path_;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		int ret = -errno;
+		LOG(IPAManager, Warning)
+			<< "Failed to update IPA state file " << path_ << ": "
+			<< strerror(-ret);
+		unlink(tmpPath.c_str());
+	}
+}
+
+} /* namespace libcamera */
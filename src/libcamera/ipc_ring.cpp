@@ -0,0 +1,448 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_ring.cpp - IPC mechanism based on a shared memory ring buffer
+ */
+
+#include "ipc_ring.h"
+
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * \file ipc_ring.h
+ * \brief IPC mechanism based on a shared memory ring buffer
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPCRing)
+
+namespace {
+
+constexpr uint32_t WrapMarker = 0xffffffff;
+
+uint32_t recordSize(uint32_t length)
+{
+	return (sizeof(uint32_t) + length + 7) & ~7;
+}
+
+} /* namespace */
+
+/*
+ * The control block is stored at the beginning of the shared memory, followed
+ * by the ring data. The head and tail are free-running byte counters, written
+ * by the producer and consumer respectively, and kept in separate cache lines.
+ */
+struct IPCRing::Control {
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+	uint32_t capacity;
+};
+
+/**
+ * \class IPCRing
+ * \brief IPC mechanism based on a shared memory ring buffer
+ *
+ * The IPCRing transports messages in one direction between two processes
+ * through a ring buffer stored in shared memory. Compared to the IPCUnixSocket,
+ * it doesn't require any system call to transfer the message data, and a
+ * single eventfd write to notify the consumer. Notifications are further
+ * coalesced: the producer only signals the consumer when the ring was empty
+ * before the message was added, as the consumer is otherwise guaranteed to
+ * process the message when it empties the ring.
+ *
+ * The IPCRing can't transport file descriptors. Users that need to pass file
+ * descriptors shall send them through an IPCUnixSocket, and order them with
+ * respect to the ring messages with a protocol of their own.
+ *
+ * The ring is created by one side with create(), which allocates the shared
+ * memory and the eventfd. Their file descriptors, retrieved with memfd() and
+ * eventfd(), are passed to the other side that binds to the ring with bind().
+ * Each side selects its role, only the producer can add messages to the ring,
+ * and only the consumer can retrieve them.
+ *
+ * Messages are added by first reserving space with reserve(), writing the
+ * message data to the returned memory, and then making the message available
+ * to the consumer with commit(). The consumer is notified by the \ref readyRead
+ * signal, and retrieves messages with front() and pop(). When the signal is
+ * emitted the consumer must either process all messages present in the ring,
+ * or resume processing without waiting for another notification.
+ *
+ * Messages are stored contiguously in the ring, their size is limited to half
+ * of the ring size.
+ */
+
+/**
+ * \enum IPCRing::Role
+ * \brief Role of the ring user
+ * \var IPCRing::Producer
+ * The user adds messages to the ring
+ * \var IPCRing::Consumer
+ * The user retrieves messages from the ring
+ */
+
+IPCRing::IPCRing()
+	: memfd_(-1), eventfd_(-1), control_(nullptr), data_(nullptr),
+	  mapSize_(0), capacity_(0), reservedHead_(0), reservedSize_(0),
+	  frontSize_(0), notifier_(nullptr)
+{
+}
+
+IPCRing::~IPCRing()
+{
+	close();
+}
+
+/**
+ * \brief Create a new ring
+ * \param[in] role The role of the ring user
+ * \param[in] size The minimum size of the ring data in bytes
+ *
+ * This method allocates the shared memory and the eventfd for a new ring and
+ * binds the instance to it with the \a role. The ring size is rounded up to a
+ * power of two.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCRing::create(enum Role role, size_t size)
+{
+	uint32_t capacity = 4096;
+	int ret;
+
+	if (isBound())
+		return -EINVAL;
+
+	while (capacity < size)
+		capacity <<= 1;
+
+	memfd_ = memfd_create("libcamera-ipc-ring", MFD_CLOEXEC);
+	if (memfd_ < 0) {
+		ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to create shared memory: " << strerror(-ret);
+		goto error;
+	}
+
+	if (ftruncate(memfd_, sizeof(Control) + capacity) < 0) {
+		ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to size shared memory: " << strerror(-ret);
+		goto error;
+	}
+
+	eventfd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0) {
+		ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to create eventfd: " << strerror(-ret);
+		goto error;
+	}
+
+	{
+		/* The memfd contents is zeroed, only the capacity is set. */
+		void *mem = mmap(nullptr, sizeof(Control), PROT_READ | PROT_WRITE,
+				 MAP_SHARED, memfd_, 0);
+		if (mem == MAP_FAILED) {
+			ret = -errno;
+			LOG(IPCRing, Error)
+				<< "Failed to map shared memory: " << strerror(-ret);
+			goto error;
+		}
+
+		static_cast<Control *>(mem)->capacity = capacity;
+		munmap(mem, sizeof(Control));
+	}
+
+	ret = map(role);
+	if (ret)
+		goto error;
+
+	return 0;
+
+error:
+	close();
+	return ret;
+}
+
+/**
+ * \brief Bind to an existing ring
+ * \param[in] role The role of the ring user
+ * \param[in] memfd The ring shared memory file descriptor
+ * \param[in] eventfd The ring eventfd file descriptor
+ *
+ * This method binds the instance to an existing ring identified by the \a memfd
+ * and \a eventfd file descriptors, obtained from the memfd() and eventfd()
+ * methods of the instance that created the ring. Ownership of the file
+ * descriptors is transferred to the IPCRing.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCRing::bind(enum Role role, int memfd, int eventfd)
+{
+	if (isBound())
+		return -EINVAL;
+
+	memfd_ = memfd;
+	eventfd_ = eventfd;
+
+	int ret = map(role);
+	if (ret)
+		close();
+
+	return ret;
+}
+
+/**
+ * \brief Close the ring
+ *
+ * No communication is possible after close() has been called.
+ */
+void IPCRing::close()
+{
+	delete notifier_;
+	notifier_ = nullptr;
+
+	if (control_)
+		munmap(control_, mapSize_);
+
+	if (eventfd_ != -1)
+		::close(eventfd_);
+	if (memfd_ != -1)
+		::close(memfd_);
+
+	memfd_ = -1;
+	eventfd_ = -1;
+	control_ = nullptr;
+	data_ = nullptr;
+	mapSize_ = 0;
+	capacity_ = 0;
+	reservedSize_ = 0;
+	frontSize_ = 0;
+}
+
+/**
+ * \brief Check if the ring is bound
+ * \return True if the ring is bound, false otherwise
+ */
+bool IPCRing::isBound() const
+{
+	return control_ != nullptr;
+}
+
+/**
+ * \fn IPCRing::memfd()
+ * \brief Retrieve the file descriptor of the ring shared memory
+ * \return The shared memory file descriptor, or -1 if the ring isn't bound
+ */
+
+/**
+ * \fn IPCRing::eventfd()
+ * \brief Retrieve the file descriptor of the ring notification eventfd
+ * \return The eventfd file descriptor, or -1 if the ring isn't bound
+ */
+
+/**
+ * \brief Reserve space for a message in the ring
+ * \param[in] size The message size in bytes
+ *
+ * This method reserves \a size bytes in the ring for a new message and returns
+ * a pointer to the reserved memory. The message is made available to the
+ * consumer by commit(). A reservation that isn't committed is overridden by
+ * the next call to reserve().
+ *
+ * \return A pointer to the message data, or nullptr if the message is too
+ * large or the ring is full
+ */
+uint8_t *IPCRing::reserve(size_t size)
+{
+	if (!control_ || notifier_ || size > capacity_ / 2)
+		return nullptr;
+
+	uint32_t total = recordSize(size);
+	uint32_t head = control_->head.load(std::memory_order_relaxed);
+	uint32_t offset = head & (capacity_ - 1);
+
+	/* Messages are contiguous, skip the end of the ring if needed. */
+	uint32_t skip = capacity_ - offset < total ? capacity_ - offset : 0;
+	uint32_t used = head - control_->tail.load();
+
+	if (used > capacity_ || used + skip + total > capacity_)
+		return nullptr;
+
+	if (skip)
+		*reinterpret_cast<uint32_t *>(data_ + offset) = WrapMarker;
+
+	reservedHead_ = head + skip;
+	reservedSize_ = total;
+
+	uint8_t *record = data_ + (reservedHead_ & (capacity_ - 1));
+	*reinterpret_cast<uint32_t *>(record) = size;
+
+	return record + sizeof(uint32_t);
+}
+
+/**
+ * \brief Make the reserved message available to the consumer
+ *
+ * The consumer is notified if the ring was empty before the message was added.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL No message has been reserved
+ */
+int IPCRing::commit()
+{
+	if (!reservedSize_)
+		return -EINVAL;
+
+	uint32_t head = control_->head.load(std::memory_order_relaxed);
+	control_->head.store(reservedHead_ + reservedSize_);
+	reservedSize_ = 0;
+
+	/*
+	 * The consumer stores the tail before checking the head, and the
+	 * producer stores the head before checking the tail. Either the
+	 * consumer sees the new message, or the producer sees an empty ring.
+	 */
+	if (control_->tail.load() != head)
+		return 0;
+
+	uint64_t value = 1;
+	if (write(eventfd_, &value, sizeof(value)) < 0) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to notify consumer: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the first message in the ring
+ * \param[out] size The message size in bytes
+ *
+ * The message data remains valid and unchanged, and is returned by subsequent
+ * calls to front(), until the message is removed from the ring by pop().
+ *
+ * \return A pointer to the message data, or nullptr if the ring is empty
+ */
+const uint8_t *IPCRing::front(size_t *size)
+{
+	if (!control_ || !notifier_)
+		return nullptr;
+
+	uint32_t tail = control_->tail.load(std::memory_order_relaxed);
+
+	while (true) {
+		uint32_t head = control_->head.load();
+		if (head == tail)
+			return nullptr;
+
+		/* Don't trust the producer, validate everything. */
+		uint32_t available = head - tail;
+		uint32_t offset = tail & (capacity_ - 1);
+		if (available > capacity_ || offset & 7)
+			break;
+
+		uint32_t length = *reinterpret_cast<const uint32_t *>(data_ + offset);
+		if (length == WrapMarker) {
+			tail += capacity_ - offset;
+			control_->tail.store(tail);
+			continue;
+		}
+
+		if (length > capacity_ / 2)
+			break;
+
+		uint32_t total = recordSize(length);
+		if (total > available || total > capacity_ - offset)
+			break;
+
+		frontSize_ = total;
+		*size = length;
+
+		return data_ + offset + sizeof(uint32_t);
+	}
+
+	LOG(IPCRing, Error) << "Corrupted ring";
+	return nullptr;
+}
+
+/**
+ * \brief Remove the first message from the ring
+ *
+ * The message must have been retrieved with front() first.
+ */
+void IPCRing::pop()
+{
+	if (!frontSize_)
+		return;
+
+	uint32_t tail = control_->tail.load(std::memory_order_relaxed);
+	control_->tail.store(tail + frontSize_);
+	frontSize_ = 0;
+}
+
+/**
+ * \var IPCRing::readyRead
+ * \brief A Signal emitted when messages are ready to be read
+ */
+
+int IPCRing::map(enum Role role)
+{
+	struct stat st;
+	if (fstat(memfd_, &st) < 0)
+		return -errno;
+
+	if (static_cast<size_t>(st.st_size) < sizeof(Control))
+		return -EINVAL;
+
+	mapSize_ = st.st_size;
+	void *mem = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 memfd_, 0);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to map shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	control_ = static_cast<Control *>(mem);
+	data_ = static_cast<uint8_t *>(mem) + sizeof(Control);
+
+	/* Retrieve the capacity once, the other side could modify it. */
+	capacity_ = control_->capacity;
+	if (!capacity_ || capacity_ & (capacity_ - 1) ||
+	    capacity_ > mapSize_ - sizeof(Control)) {
+		LOG(IPCRing, Error) << "Invalid ring size " << capacity_;
+		return -EINVAL;
+	}
+
+	if (role == Consumer) {
+		notifier_ = new EventNotifier(eventfd_, EventNotifier::Read);
+		notifier_->activated.connect(this, &IPCRing::dataNotifier);
+	}
+
+	return 0;
+}
+
+void IPCRing::dataNotifier(EventNotifier *notifier)
+{
+	uint64_t value;
+
+	if (read(eventfd_, &value, sizeof(value)) < 0)
+		return;
+
+	readyRead.emit(this);
+}
+
+} /* namespace libcamera */
@@ -7,7 +7,7 @@
 
 #include "ipc_unixsocket.h"
 
-#include <poll.h>
+#include <algorithm>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -23,6 +23,17 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCUnixSocket)
 
+namespace {
+
+/* Number of messages received or sent with a single notification or call. */
+constexpr unsigned int ReceiveBatch = 8;
+constexpr unsigned int SendBatch = 8;
+
+/* The number of file descriptors is stored in a uint8_t in the header. */
+constexpr unsigned int MaxFds = 255;
+
+} /* namespace */
+
 /**
  * \struct IPCUnixSocket::Payload
  * \brief Container for an IPC payload
@@ -65,7 +76,8 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  */
 
 IPCUnixSocket::IPCUnixSocket()
-	: fd_(-1), headerReceived_(false), notifier_(nullptr)
+	: fd_(-1), notifier_(nullptr), queueFirst_(0), queueCount_(0),
+	  hangup_(false)
 {
 }
 
@@ -121,6 +133,7 @@ int IPCUnixSocket::bind(int fd)
 		return -EINVAL;
 
 	fd_ = fd;
+	queue_.resize(ReceiveBatch);
 	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
 	notifier_->activated.connect(this, &IPCUnixSocket::dataNotifier);
 
@@ -143,7 +156,18 @@ void IPCUnixSocket::close()
 	::close(fd_);
 
 	fd_ = -1;
-	headerReceived_ = false;
+
+	/* Close the file descriptors of the messages not retrieved yet. */
+	for (unsigned int i = 0; i < queueCount_; ++i) {
+		const Payload &payload = queue_[(queueFirst_ + i) % ReceiveBatch];
+		for (int32_t fd : payload.fds)
+			::close(fd);
+	}
+
+	queue_.clear();
+	queueFirst_ = 0;
+	queueCount_ = 0;
+	hangup_ = false;
 }
 
 /**
@@ -167,40 +191,119 @@ bool IPCUnixSocket::isBound() const
  */
 int IPCUnixSocket::send(const Payload &payload)
 {
-	int ret;
-
 	if (!isBound())
 		return -ENOTCONN;
 
-	Header hdr;
+	if ((payload.data.empty() && payload.fds.empty()) ||
+	    payload.fds.size() > MaxFds)
+		return -EINVAL;
+
+	Header hdr = {};
 	hdr.data = payload.data.size();
 	hdr.fds = payload.fds.size();
 
-	if (!hdr.data && !hdr.fds)
-		return -EINVAL;
+	return sendData(hdr, payload.data.data(), payload.fds.data());
+}
 
-	ret = ::send(fd_, &hdr, sizeof(hdr), 0);
-	if (ret < 0) {
-		ret = -errno;
-		LOG(IPCUnixSocket, Error)
-			<< "Failed to send: " << strerror(-ret);
-		return ret;
+/**
+ * \brief Send multiple message payloads
+ * \param[in] payloads Message payloads to send
+ *
+ * This method queues all the message \a payloads for transmission to the other
+ * end of the IPC channel, in order. It batches the payloads with the
+ * sendmmsg() system call, and is thus more efficient than multiple calls to
+ * send() when several messages are ready for transmission at once.
+ *
+ * \return The number of payloads sent on success, or a negative error code if
+ * no payload could be sent
+ */
+int IPCUnixSocket::send(const std::vector<Payload> &payloads)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	for (const Payload &payload : payloads) {
+		if ((payload.data.empty() && payload.fds.empty()) ||
+		    payload.fds.size() > MaxFds)
+			return -EINVAL;
+	}
+
+	union Control {
+		char buf[CMSG_SPACE(MaxFds * sizeof(int32_t))];
+		struct cmsghdr align;
+	};
+
+	struct mmsghdr msgs[SendBatch];
+	struct iovec iov[SendBatch][2];
+	Header headers[SendBatch];
+	Control control[SendBatch];
+	unsigned int sent = 0;
+
+	while (sent < payloads.size()) {
+		unsigned int count = std::min<size_t>(payloads.size() - sent,
+						      SendBatch);
+
+		for (unsigned int i = 0; i < count; ++i) {
+			const Payload &payload = payloads[sent + i];
+			unsigned int num = payload.fds.size();
+			Header &hdr = headers[i];
+
+			hdr = {};
+			hdr.data = payload.data.size();
+			hdr.fds = num;
+
+			iov[i][0].iov_base = &hdr;
+			iov[i][0].iov_len = sizeof(hdr);
+			iov[i][1].iov_base = const_cast<uint8_t *>(payload.data.data());
+			iov[i][1].iov_len = hdr.data;
+
+			struct msghdr &msg = msgs[i].msg_hdr;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov[i];
+			msg.msg_iovlen = 2;
+
+			if (num) {
+				struct cmsghdr *cmsg = &control[i].align;
+				cmsg->cmsg_len = CMSG_LEN(num * sizeof(int32_t));
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_RIGHTS;
+				memcpy(CMSG_DATA(cmsg), payload.fds.data(),
+				       num * sizeof(int32_t));
+
+				msg.msg_control = cmsg;
+				msg.msg_controllen = CMSG_SPACE(num * sizeof(int32_t));
+			}
+		}
+
+		int ret = sendmmsg(fd_, msgs, count, MSG_NOSIGNAL);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(IPCUnixSocket, Error)
+				<< "Failed to sendmmsg: " << strerror(-ret);
+			return sent ? sent : ret;
+		}
+
+		sent += ret;
+		if (static_cast<unsigned int>(ret) < count)
+			break;
 	}
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return sent;
 }
 
 /**
  * \brief Receive a message payload
  * \param[out] payload Payload where to write the received message
  *
- * This method receives the message payload from the IPC channel and writes it
- * to the \a payload. If no message payload is available, it returns
- * immediately with -EAGAIN. The \ref readyRead signal shall be used to receive
- * notification of message availability.
+ * This method retrieves the next received message payload and writes it to
+ * the \a payload. If no message payload is available, it returns immediately
+ * with -EAGAIN. The \ref readyRead signal shall be used to receive notification
+ * of message availability.
  *
- * \todo Add state machine to make sure we don't block forever and that
- * a header is always followed by a payload.
+ * The message storage is exchanged with the storage of the \a payload, which
+ * is then reused to receive subsequent messages. Callers that receive messages
+ * in the same \a payload avoid memory allocations once buffers have grown to
+ * the size of the messages.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EAGAIN No message payload is available
@@ -212,35 +315,55 @@ int IPCUnixSocket::receive(Payload *payload)
 	if (!isBound())
 		return -ENOTCONN;
 
-	if (!headerReceived_)
+	if (!queueCount_)
 		return -EAGAIN;
 
-	payload->data.resize(header_.data);
-	payload->fds.resize(header_.fds);
-
-	int ret = recvData(payload->data.data(), header_.data,
-			   payload->fds.data(), header_.fds);
-	if (ret < 0)
-		return ret;
+	Payload &message = queue_[queueFirst_];
+	payload->data.swap(message.data);
+	payload->fds.swap(message.fds);
+	message.fds.clear();
 
-	headerReceived_ = false;
-	notifier_->setEnabled(true);
+	queueFirst_ = (queueFirst_ + 1) % ReceiveBatch;
+	queueCount_--;
+	if (!hangup_)
+		notifier_->setEnabled(true);
 
 	return 0;
 }
 
+/**
+ * \var IPCUnixSocket::disconnected
+ * \brief A Signal emitted when the remote side closes the channel
+ *
+ * The signal is only emitted for connection-oriented sockets, such as
+ * SOCK_SEQPACKET sockets obtained from accept() or connect() and bound with
+ * bind(). It is emitted after the messages received before the connection was
+ * closed. The socket shall not be closed or deleted from within the signal
+ * handler.
+ */
+
 /**
  * \var IPCUnixSocket::readyRead
  * \brief A Signal emitted when a message is ready to be read
+ *
+ * The signal is emitted once for each received message. Messages received in
+ * a burst are queued, and the signal is then emitted multiple times in a row.
  */
 
-int IPCUnixSocket::sendData(const void *buffer, size_t length,
-			    const int32_t *fds, unsigned int num)
+/*
+ * The header and the payload are transmitted in a single datagram, to minimize
+ * the number of system calls and wake-ups on both sides of the channel.
+ */
+int IPCUnixSocket::sendData(const Header &header, const void *buffer,
+			    const int32_t *fds)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = const_cast<void *>(buffer);
-	iov[0].iov_len = length;
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<Header *>(&header);
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = const_cast<void *>(buffer);
+	iov[1].iov_len = header.data;
 
+	unsigned int num = header.fds;
 	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
 
@@ -253,13 +376,13 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg;
-	msg.msg_controllen = cmsg->cmsg_len;
+	msg.msg_iovlen = 2;
+	msg.msg_control = num ? cmsg : nullptr;
+	msg.msg_controllen = num ? cmsg->cmsg_len : 0;
 	msg.msg_flags = 0;
 	memcpy(CMSG_DATA(cmsg), fds, num * sizeof(uint32_t));
 
-	if (sendmsg(fd_, &msg, 0) < 0) {
+	if (sendmsg(fd_, &msg, MSG_NOSIGNAL) < 0) {
 		int ret = -errno;
 		LOG(IPCUnixSocket, Error)
 			<< "Failed to sendmsg: " << strerror(-ret);
@@ -269,13 +392,17 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	return 0;
 }
 
-int IPCUnixSocket::recvData(void *buffer, size_t length,
-			    int32_t *fds, unsigned int num)
+int IPCUnixSocket::recvData(const Header &header, void *buffer, int32_t *fds)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = buffer;
-	iov[0].iov_len = length;
+	Header hdr;
+
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = buffer;
+	iov[1].iov_len = header.data;
 
+	unsigned int num = header.fds;
 	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
 
@@ -288,7 +415,7 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iovlen = 2;
 	msg.msg_control = cmsg;
 	msg.msg_controllen = cmsg->cmsg_len;
 	msg.msg_flags = 0;
@@ -301,43 +428,97 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 		return ret;
 	}
 
-	memcpy(fds, CMSG_DATA(cmsg), num * sizeof(uint32_t));
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		LOG(IPCUnixSocket, Error) << "Truncated message received";
+		return -EMSGSIZE;
+	}
+
+	if (num)
+		memcpy(fds, CMSG_DATA(cmsg), num * sizeof(uint32_t));
+
+	return 0;
+}
+
+/*
+ * Receive one message in the queue. The header is peeked first to size the
+ * payload buffers, which keep their capacity across messages.
+ */
+int IPCUnixSocket::receiveOne()
+{
+	Header hdr;
+
+	ssize_t size = ::recv(fd_, &hdr, sizeof(hdr), MSG_PEEK);
+	if (size < 0)
+		return -errno;
+
+	/*
+	 * Messages always carry a header, an empty read signals that the peer
+	 * of a connection-oriented socket has closed the connection.
+	 */
+	if (size == 0)
+		return -ECONNRESET;
+
+	Payload &payload = queue_[(queueFirst_ + queueCount_) % ReceiveBatch];
+
+	if (static_cast<size_t>(size) < sizeof(hdr)) {
+		/* Drop the malformed datagram. */
+		::recv(fd_, &hdr, sizeof(hdr), 0);
+		LOG(IPCUnixSocket, Error) << "Received message too short";
+		return 0;
+	}
+
+	payload.data.resize(hdr.data);
+	payload.fds.resize(hdr.fds);
+
+	int ret = recvData(hdr, payload.data.data(), payload.fds.data());
+	if (ret == -EMSGSIZE)
+		return 0;
+	if (ret < 0)
+		return ret;
+
+	queueCount_++;
 
 	return 0;
 }
 
 void IPCUnixSocket::dataNotifier(EventNotifier *notifier)
 {
-	int ret;
+	unsigned int count = queueCount_;
 
-	if (!headerReceived_) {
-		/* Receive the header. */
-		ret = ::recv(fd_, &header_, sizeof(header_), 0);
-		if (ret < 0) {
-			ret = -errno;
-			LOG(IPCUnixSocket, Error)
-				<< "Failed to receive header: " << strerror(-ret);
-			return;
+	/*
+	 * Drain the socket up to the size of the queue, to process bursts of
+	 * messages with a single notification.
+	 */
+	while (queueCount_ < ReceiveBatch) {
+		int ret = receiveOne();
+		if (ret == -ECONNRESET) {
+			hangup_ = true;
+			break;
 		}
 
-		headerReceived_ = true;
+		if (ret < 0) {
+			if (ret != -EAGAIN)
+				LOG(IPCUnixSocket, Error)
+					<< "Failed to receive message: "
+					<< strerror(-ret);
+			break;
+		}
 	}
 
 	/*
-	 * If the payload has arrived, disable the notifier and emit the
-	 * readyRead signal. The notifier will be reenabled by the receive()
-	 * method.
+	 * Disable the notifier when the queue is full, receive() reenables it
+	 * when it frees a slot. A closed connection stays readable, so the
+	 * notifier is disabled for good.
 	 */
-	struct pollfd fds = { fd_, POLLIN, 0 };
-	ret = poll(&fds, 1, 0);
-	if (ret < 0)
-		return;
+	if (queueCount_ == ReceiveBatch || hangup_)
+		notifier_->setEnabled(false);
 
-	if (!(fds.revents & POLLIN))
-		return;
+	count = queueCount_ - count;
+	for (unsigned int i = 0; i < count; ++i)
+		readyRead.emit(this);
 
-	notifier_->setEnabled(false);
-	readyRead.emit(this);
+	if (hangup_)
+		disconnected.emit(this);
 }
 
 } /* namespace libcamera */
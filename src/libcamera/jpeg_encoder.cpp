@@ -0,0 +1,400 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_encoder.cpp - Asynchronous JPEG encoding of captured frames
+ */
+
+#include <libcamera/jpeg_encoder.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#ifdef HAVE_LIBJPEG
+#include "encoder_libjpeg.h"
+#endif
+#include "formats.h"
+#include "log.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/**
+ * \file jpeg_encoder.h
+ * \brief Asynchronous JPEG encoding of captured frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(JpegEncoder)
+
+/*
+ * A JPEG encoding context and its output buffer. A slot is busy from the call
+ * to encode() until the encoding completes and the output buffer is released.
+ */
+struct JpegEncoder::Slot {
+	Slot(unsigned int index, unsigned int size)
+		: data(new uint8_t[size]), buffer(index), encoding(false),
+		  held(false)
+	{
+		memory.planes().emplace_back();
+		memory.planes().back().setUserPtr(data.get(), size);
+		buffer.mem_ = &memory;
+	}
+
+	bool busy() const { return encoding || held; }
+
+#ifdef HAVE_LIBJPEG
+	EncoderLibJpeg encoder;
+#endif
+	std::unique_ptr<uint8_t[]> data;
+	BufferMemory memory;
+	Buffer buffer;
+	BufferRef source;
+
+	bool encoding;
+	bool held;
+};
+
+/**
+ * \class JpegEncoder
+ * \brief Encode the frames of a YUV or RGB stream to JPEG images
+ *
+ * The JpegEncoder produces JPEG images from the frames of any stream in one of
+ * the formats(), regardless of the pipeline handler that captures them. It
+ * allows applications to provide a JPEG still capture stream on top of a YUV
+ * stream without implementing the encoding themselves.
+ *
+ * Frames are encoded asynchronously on the libcamera worker threads, without
+ * copying them. The source buffer is read through its CPU mapping, and is held
+ * with a BufferRef until its encoding completes, which prevents it from being
+ * queued to the camera in the meantime. Only recyclable buffers, retrieved with
+ * Stream::buffer() or Stream::importBuffer(), can thus be encoded.
+ *
+ * The encoder owns a pool of output buffers, one per frame in flight. When a
+ * frame has been encoded the bufferEncoded signal is emitted with the source
+ * buffer and the output buffer, whose bytesused() reports the size of the JPEG
+ * image and whose sequence and timestamp are copied from the source buffer.
+ * The output buffer shall be returned to the encoder with releaseBuffer() once
+ * the application is done with the JPEG image. At most maxInFlight frames, as
+ * set by configure(), are encoded or held in output buffers at a time, which
+ * bounds the memory and CPU time consumed by the encoder when the application
+ * can't keep up with the frame rate.
+ *
+ * JPEG encoding requires libcamera to be compiled with libjpeg. formats()
+ * returns an empty list otherwise, and configure() fails.
+ */
+
+/**
+ * \var JpegEncoder::DEFAULT_QUALITY
+ * \brief The default JPEG quality
+ */
+
+JpegEncoder::JpegEncoder()
+	: pixelFormat_(0), bufferSize_(0)
+{
+}
+
+/**
+ * \brief Destroy the encoder, waiting for the frames in flight to be encoded
+ *
+ * The output buffers are freed, and shall not be used anymore.
+ */
+JpegEncoder::~JpegEncoder()
+{
+	flush();
+}
+
+/**
+ * \brief Retrieve the frame formats supported by the encoder
+ * \return The V4L2 pixel formats of the frames the encoder can compress
+ */
+const std::vector<unsigned int> &JpegEncoder::formats()
+{
+	static const std::vector<unsigned int> formats = {
+#ifdef HAVE_LIBJPEG
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_NV21,
+		V4L2_PIX_FMT_NV16,
+		V4L2_PIX_FMT_NV61,
+		V4L2_PIX_FMT_YUYV,
+		V4L2_PIX_FMT_YVYU,
+		V4L2_PIX_FMT_UYVY,
+		V4L2_PIX_FMT_VYUY,
+		V4L2_PIX_FMT_RGB24,
+		V4L2_PIX_FMT_BGR24,
+#endif
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the encoder for the frames of a stream
+ * \param[in] cfg The configuration of the stream to encode
+ * \param[in] quality The JPEG quality, from 1 to 100
+ * \param[in] maxInFlight The maximum number of frames in flight
+ *
+ * The JPEG images have the same size as the frames of the stream. The output
+ * buffers are allocated for the \a maxInFlight frames, and any previous output
+ * buffer is freed. The encoder shall not be reconfigured while frames are in
+ * flight.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The stream configuration or parameters aren't supported
+ * \retval -EBUSY Frames are in flight
+ * \retval -ENOTSUP libcamera is compiled without libjpeg
+ */
+int JpegEncoder::configure(const StreamConfiguration &cfg, int quality,
+			   unsigned int maxInFlight)
+{
+#ifdef HAVE_LIBJPEG
+	const std::vector<unsigned int> &supported = formats();
+	if (std::find(supported.begin(), supported.end(), cfg.pixelFormat) ==
+	    supported.end()) {
+		LOG(JpegEncoder, Error)
+			<< "Unsupported pixel format "
+			<< utils::hex<uint32_t>(cfg.pixelFormat, 8);
+		return -EINVAL;
+	}
+
+	if (quality < 1 || quality > 100 || !maxInFlight) {
+		LOG(JpegEncoder, Error)
+			<< "Invalid quality " << quality << " or frames in flight "
+			<< maxInFlight;
+		return -EINVAL;
+	}
+
+	if (inFlight()) {
+		LOG(JpegEncoder, Error) << "Frames in flight";
+		return -EBUSY;
+	}
+
+	/*
+	 * The images rarely exceed the size of a 4:2:0 frame, largely
+	 * oversized for natural scenes. The memory isn't touched beyond the
+	 * image size.
+	 */
+	unsigned int bufferSize = cfg.size.width * cfg.size.height * 3 / 2 + 65536;
+
+	std::vector<std::unique_ptr<Slot>> slots;
+	for (unsigned int i = 0; i < maxInFlight; ++i) {
+		slots.emplace_back(utils::make_unique<Slot>(i, bufferSize));
+
+		int ret = slots.back()->encoder.configure(cfg.size,
+							  cfg.pixelFormat,
+							  cfg.size, quality);
+		if (ret)
+			return ret;
+	}
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	slots_ = std::move(slots);
+	size_ = cfg.size;
+	pixelFormat_ = cfg.pixelFormat;
+	bufferSize_ = bufferSize;
+
+	return 0;
+#else
+	LOG(JpegEncoder, Error) << "JPEG encoding requires libjpeg";
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * \brief Queue a frame for encoding
+ * \param[in] source The frame to encode
+ *
+ * The \a source buffer is held until the bufferEncoded signal is emitted for
+ * it. It shall be a recyclable buffer of the stream the encoder is configured
+ * for, with its frame stored contiguously in its planes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The encoder isn't configured, or \a source isn't a
+ * recyclable buffer holding a valid frame
+ * \retval -EBUSY The maximum number of frames are in flight
+ */
+int JpegEncoder::encode(Buffer *source)
+{
+	if (!pixelFormat_)
+		return -EINVAL;
+
+	if (source->status() != Buffer::BufferSuccess) {
+		LOG(JpegEncoder, Debug) << "Can't encode a failed frame";
+		return -EINVAL;
+	}
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	auto it = std::find_if(slots_.begin(), slots_.end(),
+			       [](const std::unique_ptr<Slot> &slot) {
+				       return !slot->busy();
+			       });
+	if (it == slots_.end())
+		return -EBUSY;
+
+	Slot *slot = it->get();
+	slot->source = BufferRef(source);
+	if (!slot->source.isValid())
+		return -EINVAL;
+
+	slot->encoding = true;
+	slot->held = true;
+
+	ThreadPool::instance()->post([this, slot]() { encodeFrame(slot); });
+
+	return 0;
+}
+
+/**
+ * \brief Return an output buffer to the encoder
+ * \param[in] buffer The output buffer, received with the bufferEncoded signal
+ *
+ * The \a buffer shall not be accessed after this call.
+ */
+void JpegEncoder::releaseBuffer(Buffer *buffer)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (std::unique_ptr<Slot> &slot : slots_) {
+		if (&slot->buffer == buffer) {
+			slot->held = false;
+			return;
+		}
+	}
+
+	LOG(JpegEncoder, Warning) << "Unknown output buffer";
+}
+
+/**
+ * \brief Wait for all frames queued for encoding to be encoded
+ *
+ * The bufferEncoded signal has been emitted for all frames when this method
+ * returns. The output buffers held by the application are not released.
+ */
+void JpegEncoder::flush()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	idle_.wait(locker, [&]() {
+		return std::none_of(slots_.begin(), slots_.end(),
+				    [](const std::unique_ptr<Slot> &slot) {
+					    return slot->encoding;
+				    });
+	});
+}
+
+/**
+ * \fn JpegEncoder::size()
+ * \brief Retrieve the size of the JPEG images
+ * \return The size of the JPEG images, which is the size of the frames
+ */
+
+/**
+ * \fn JpegEncoder::bufferSize()
+ * \brief Retrieve the size of the output buffers
+ * \return The size of the output buffers in bytes
+ */
+
+/**
+ * \brief Retrieve the number of frames in flight
+ *
+ * The frames in flight are the frames being encoded, and the frames held in
+ * output buffers that haven't been released.
+ *
+ * \return The number of frames in flight
+ */
+unsigned int JpegEncoder::inFlight() const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	return std::count_if(slots_.begin(), slots_.end(),
+			     [](const std::unique_ptr<Slot> &slot) {
+				     return slot->busy();
+			     });
+}
+
+/**
+ * \var JpegEncoder::bufferEncoded
+ * \brief Signal emitted when a frame has been encoded
+ *
+ * The signal is emitted with the source buffer and the output buffer. The
+ * output buffer status is Buffer::BufferError if the frame couldn't be
+ * encoded. The source buffer is released right after the signal is emitted,
+ * and is only passed to identify the frame.
+ *
+ * The signal is emitted from a worker thread. Slots of objects deriving from
+ * Object are invoked in the thread the object is bound to, other slots are
+ * invoked directly in the worker thread.
+ */
+
+/* Encode a frame, in a worker thread. */
+void JpegEncoder::encodeFrame(Slot *slot)
+{
+	Buffer *source = slot->source.buffer();
+	Buffer &output = slot->buffer;
+	int ret = -ENOMEM;
+
+	{
+		BufferMemory *mem = source->mem();
+		CpuAccess access(*mem, Plane::AccessRead);
+
+		PlaneArray &planes = mem->planes();
+		const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat_);
+		unsigned int length = 0;
+
+		for (Plane &plane : planes)
+			length += plane.length();
+
+		const uint8_t *luma = static_cast<const uint8_t *>(planes[0].mem());
+		const uint8_t *chroma = planes.size() > 1
+				      ? static_cast<const uint8_t *>(planes[1].mem())
+				      : luma + size_.width * size_.height;
+
+		if (!luma || !chroma) {
+			LOG(JpegEncoder, Error) << "Failed to map the frame";
+		} else if (length < info.frameSize(size_)) {
+			LOG(JpegEncoder, Error) << "Frame too small";
+			ret = -EINVAL;
+		} else {
+#ifdef HAVE_LIBJPEG
+			ret = slot->encoder.encode(luma, chroma, slot->data.get(),
+						   bufferSize_, {});
+#endif
+		}
+	}
+
+	if (ret < 0)
+		LOG(JpegEncoder, Warning)
+			<< "Failed to encode frame " << source->sequence()
+			<< ": " << strerror(-ret);
+
+	output.bytesused_ = ret > 0 ? ret : 0;
+	output.planesBytesused_ = { output.bytesused_, 0, 0 };
+	output.planesOffset_ = { 0, 0, 0 };
+	output.timestamp_ = source->timestamp();
+	output.timestampClock_ = source->timestampClock();
+	output.timestampSource_ = source->timestampSource();
+	output.sequence_ = source->sequence();
+	output.status_ = ret > 0 ? Buffer::BufferSuccess : Buffer::BufferError;
+
+	bufferEncoded.emit(source, &output);
+
+	slot->source.reset();
+
+	/*
+	 * Notify with the lock held, as the encoder may be destroyed as soon as
+	 * flush() can observe the slot as idle.
+	 */
+	std::lock_guard<std::mutex> locker(mutex_);
+	slot->encoding = false;
+	idle_.notify_all();
+}
+
+} /* namespace libcamera */
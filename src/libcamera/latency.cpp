@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * latency.cpp - Latency statistics
+ */
+
+#include <libcamera/latency.h>
+
+#include <algorithm>
+
+/**
+ * \file latency.h
+ * \brief Latency statistics
+ */
+
+namespace libcamera {
+
+/**
+ * \class LatencyHistogram
+ * \brief Histogram of latency samples
+ *
+ * The LatencyHistogram accumulates latency samples, expressed in nanoseconds,
+ * in NUM_BUCKETS buckets of exponentially growing size. The first bucket
+ * counts samples lower than 1µs, and each following bucket \a i counts
+ * samples in the [2^(i-1), 2^i[ µs range. The last bucket additionally counts
+ * all larger samples.
+ *
+ * The histogram can be updated and read concurrently from different threads
+ * without locking. Readers may observe a histogram being updated in a
+ * slightly inconsistent state, which is acceptable for statistics purpose.
+ */
+
+/**
+ * \var LatencyHistogram::NUM_BUCKETS
+ * \brief The number of buckets in the histogram
+ */
+
+/**
+ * \brief Construct an empty latency histogram
+ */
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+/**
+ * \brief Add a sample to the histogram
+ * \param[in] latency The latency in nanoseconds
+ */
+void LatencyHistogram::add(uint64_t latency)
+{
+	uint64_t us = latency / 1000;
+	unsigned int index = us ? 64 - __builtin_clzll(us) : 0;
+	if (index >= NUM_BUCKETS)
+		index = NUM_BUCKETS - 1;
+
+	buckets_[index].fetch_add(1, std::memory_order_relaxed);
+	samples_.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = max_.load(std::memory_order_relaxed);
+	while (latency > max &&
+	       !max_.compare_exchange_weak(max, latency, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * \brief Reset the histogram, discarding all samples
+ */
+void LatencyHistogram::reset()
+{
+	for (std::atomic<uint64_t> &bucket : buckets_)
+		bucket.store(0, std::memory_order_relaxed);
+
+	samples_.store(0, std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * \fn LatencyHistogram::samples()
+ * \brief Retrieve the number of samples in the histogram
+ * \return The number of samples
+ */
+
+/**
+ * \fn LatencyHistogram::max()
+ * \brief Retrieve the largest sample added to the histogram
+ * \return The largest latency in nanoseconds, or 0 if the histogram is empty
+ */
+
+/**
+ * \brief Retrieve the number of samples in a bucket
+ * \param[in] index The bucket index
+ * \return The number of samples in the bucket, or 0 if \a index is out of
+ * range
+ */
+uint64_t LatencyHistogram::bucket(unsigned int index) const
+{
+	if (index >= NUM_BUCKETS)
+		return 0;
+
+	return buckets_[index].load(std::memory_order_relaxed);
+}
+
+/**
+ * \brief Estimate a percentile of the latency distribution
+ * \param[in] percent The percentile, between 0 and 100
+ *
+ * The percentile is estimated as the upper limit of the bucket containing the
+ * sample at the requested rank, bounded by the largest sample. It is thus an
+ * upper bound of the real percentile, with a precision of a factor of two.
+ *
+ * \return The percentile latency in nanoseconds, or 0 if the histogram is empty
+ */
+uint64_t LatencyHistogram::percentile(unsigned int percent) const
+{
+	uint64_t samples = this->samples();
+	if (!samples)
+		return 0;
+
+	if (percent > 100)
+		percent = 100;
+
+	/* Rank of the sample, rounded up, at least 1. */
+	uint64_t rank = (samples * percent + 99) / 100;
+	if (!rank)
+		rank = 1;
+
+	uint64_t count = 0;
+	for (unsigned int index = 0; index < NUM_BUCKETS; ++index) {
+		count += bucket(index);
+		if (count >= rank)
+			return std::min(bucketLimit(index), max());
+	}
+
+	return max();
+}
+
+/**
+ * \brief Retrieve the upper limit of a bucket
+ * \param[in] index The bucket index
+ * \return The exclusive upper limit of the bucket samples, in nanoseconds
+ */
+uint64_t LatencyHistogram::bucketLimit(unsigned int index)
+{
+	if (index >= NUM_BUCKETS - 1)
+		return UINT64_MAX;
+
+	return (1ULL << index) * 1000;
+}
+
+} /* namespace libcamera */
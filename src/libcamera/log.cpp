@@ -7,15 +7,21 @@
 
 #include "log.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string.h>
 #include <syslog.h>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <libcamera/logging.h>
 
@@ -48,6 +54,15 @@
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
  * to stderr.
+ *
+ * Log messages are written to the log output synchronously by default, in the
+ * context of the thread that logs them. When the LIBCAMERA_LOG_ASYNC
+ * environment variable is set to a non-zero value, or when asynchronous
+ * logging is enabled with logSetAsync(), messages are instead queued to a
+ * per-thread buffer of bounded size and written by a background thread.
+ * Messages logged while the buffer of a thread is full are dropped, and the
+ * number of dropped messages is reported in the log. Messages from different
+ * threads may then be output out of order.
  */
 
 /**
@@ -108,10 +123,17 @@ public:
 
 	bool isValid() const;
 	void write(const LogMessage &msg);
+	void write(LogSeverity severity, const char *category,
+		   const utils::time_point &timestamp,
+		   const std::string &fileInfo, const std::string &msg);
+	void flush();
 
 private:
-	void writeSyslog(const LogMessage &msg);
-	void writeStream(const LogMessage &msg);
+	void writeSyslog(LogSeverity severity, const char *category,
+			 const std::string &fileInfo, const std::string &msg);
+	void writeStream(LogSeverity severity, const char *category,
+			 const utils::time_point &timestamp,
+			 const std::string &fileInfo, const std::string &msg);
 
 	std::ostream *stream_;
 	LoggingTarget target_;
@@ -178,38 +200,372 @@ bool LogOutput::isValid() const
 /**
  * \brief Write message to log output
  * \param[in] msg Message to write
+ *
+ * The log output is flushed after writing the message.
  */
 void LogOutput::write(const LogMessage &msg)
+{
+	write(msg.severity(), msg.category().name(), msg.timestamp(),
+	      msg.fileInfo(), msg.msg());
+	flush();
+}
+
+/**
+ * \brief Write message fields to log output
+ * \param[in] severity The message severity
+ * \param[in] category The message category name
+ * \param[in] timestamp The message timestamp
+ * \param[in] fileInfo The message file information
+ * \param[in] msg The message text
+ *
+ * The log output isn't flushed, the caller shall call flush() when done
+ * writing messages.
+ */
+void LogOutput::write(LogSeverity severity, const char *category,
+		      const utils::time_point &timestamp,
+		      const std::string &fileInfo, const std::string &msg)
 {
 	switch (target_) {
 	case LoggingTargetSyslog:
-		writeSyslog(msg);
+		writeSyslog(severity, category, fileInfo, msg);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		writeStream(msg);
+		writeStream(severity, category, timestamp, fileInfo, msg);
 		break;
 	default:
 		break;
 	}
 }
 
-void LogOutput::writeSyslog(const LogMessage &msg)
+/**
+ * \brief Flush the messages written to the log output
+ */
+void LogOutput::flush()
+{
+	if (stream_)
+		stream_->flush();
+}
+
+void LogOutput::writeSyslog(LogSeverity severity, const char *category,
+			    const std::string &fileInfo, const std::string &msg)
 {
-	std::string str = std::string(log_severity_name(msg.severity())) + " " +
-	      		  msg.category().name() + " " + msg.fileInfo() + " " +
-			  msg.msg();
-	syslog(log_severity_to_syslog(msg.severity()), "%s", str.c_str());
+	std::string str = std::string(log_severity_name(severity)) + " " +
+			  category + " " + fileInfo + " " + msg;
+	syslog(log_severity_to_syslog(severity), "%s", str.c_str());
 }
 
-void LogOutput::writeStream(const LogMessage &msg)
+void LogOutput::writeStream(LogSeverity severity, const char *category,
+			    const utils::time_point &timestamp,
+			    const std::string &fileInfo, const std::string &msg)
 {
-	std::string str = "[" + utils::time_point_to_string(msg.timestamp()) +
-			  "]" + log_severity_name(msg.severity()) + " " +
-			  msg.category().name() + " " + msg.fileInfo() + " " +
-			  msg.msg();
+	std::string str = "[" + utils::time_point_to_string(timestamp) +
+			  "]" + log_severity_name(severity) + " " +
+			  category + " " + fileInfo + " " + msg;
 	stream_->write(str.c_str(), str.size());
-	stream_->flush();
+}
+
+/**
+ * \brief Single producer, single consumer buffer of log messages
+ *
+ * The LogRing class stores log messages logged by one thread until they get
+ * written to the log output by the AsyncLogWriter. Messages are stored in a
+ * circular buffer of fixed size as a header followed by the file information
+ * and message text. A message that doesn't fit in the free space of the buffer
+ * is dropped and accounted for in the dropped counter.
+ */
+class LogRing
+{
+public:
+	static constexpr size_t Size = 64 * 1024;
+
+	LogRing();
+
+	bool push(const LogMessage &msg);
+	bool pop(LogOutput *output);
+	bool empty() const;
+
+	unsigned int takeDropped() { return dropped_.exchange(0); }
+
+private:
+	struct Header {
+		uint32_t size;
+		LogSeverity severity;
+		const char *category;
+		utils::time_point timestamp;
+		uint32_t fileInfoSize;
+		uint32_t msgSize;
+	};
+
+	static constexpr size_t Alignment = 8;
+
+	std::unique_ptr<char[]> data_;
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+	std::atomic<unsigned int> dropped_;
+};
+
+LogRing::LogRing()
+	: data_(new char[Size]), head_(0), tail_(0), dropped_(0)
+{
+}
+
+/**
+ * \brief Queue a message to the ring, from the producer thread
+ * \param[in] msg The message
+ * \return True if the message has been queued, false if it has been dropped
+ */
+bool LogRing::push(const LogMessage &msg)
+{
+	const std::string &fileInfo = msg.fileInfo();
+	std::string text = msg.msg();
+
+	size_t size = sizeof(Header) + fileInfo.size() + text.size();
+	size = (size + Alignment - 1) & ~(Alignment - 1);
+
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	size_t head = head_.load(std::memory_order_acquire);
+	size_t offset = tail % Size;
+	size_t contiguous = Size - offset;
+
+	/* Skip the end of the buffer if the message doesn't fit there. */
+	size_t needed = size <= contiguous ? size : contiguous + size;
+	if (size > Size / 2 || needed > Size - (tail - head)) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	if (size > contiguous) {
+		uint32_t padding = 0;
+		memcpy(&data_[offset], &padding, sizeof(padding));
+		tail += contiguous;
+		offset = 0;
+	}
+
+	Header header;
+	header.size = size;
+	header.severity = msg.severity();
+	header.category = msg.category().name();
+	header.timestamp = msg.timestamp();
+	header.fileInfoSize = fileInfo.size();
+	header.msgSize = text.size();
+
+	char *data = &data_[offset];
+	memcpy(data, &header, sizeof(header));
+	data += sizeof(header);
+	memcpy(data, fileInfo.data(), fileInfo.size());
+	data += fileInfo.size();
+	memcpy(data, text.data(), text.size());
+
+	tail_.store(tail + size, std::memory_order_release);
+	return true;
+}
+
+/**
+ * \brief Write the oldest message of the ring to \a output, from the consumer
+ * \param[in] output The log output, may be null to discard the message
+ * \return True if a message has been popped, false if the ring is empty
+ */
+bool LogRing::pop(LogOutput *output)
+{
+	size_t head = head_.load(std::memory_order_relaxed);
+	size_t tail = tail_.load(std::memory_order_acquire);
+	if (head == tail)
+		return false;
+
+	size_t offset = head % Size;
+
+	uint32_t size;
+	memcpy(&size, &data_[offset], sizeof(size));
+	if (!size) {
+		/* Padding, the message is at the beginning of the buffer. */
+		head += Size - offset;
+		offset = 0;
+	}
+
+	Header header;
+	memcpy(&header, &data_[offset], sizeof(header));
+
+	if (output) {
+		const char *data = &data_[offset + sizeof(header)];
+		std::string fileInfo(data, header.fileInfoSize);
+		std::string text(data + header.fileInfoSize, header.msgSize);
+
+		output->write(header.severity, header.category,
+			      header.timestamp, fileInfo, text);
+	}
+
+	head_.store(head + header.size, std::memory_order_release);
+	return true;
+}
+
+/**
+ * \brief Check if the ring is empty, from the consumer
+ * \return True if the ring holds no message, false otherwise
+ */
+bool LogRing::empty() const
+{
+	return head_.load(std::memory_order_relaxed) ==
+	       tail_.load(std::memory_order_acquire);
+}
+
+/**
+ * \brief Background writer for log messages
+ *
+ * The AsyncLogWriter class owns one LogRing per thread that logs messages, and
+ * writes the queued messages to the log output from a background thread. The
+ * writer thread is only woken up when it sleeps, so a burst of messages costs
+ * a single wakeup.
+ */
+class AsyncLogWriter
+{
+public:
+	AsyncLogWriter(std::shared_ptr<LogOutput> *output);
+	~AsyncLogWriter();
+
+	void write(const LogMessage &msg);
+	void flush();
+
+private:
+	LogRing *ring();
+	void drain();
+	void run();
+
+	std::shared_ptr<LogOutput> *output_;
+
+	std::mutex ringsMutex_;
+	std::vector<std::shared_ptr<LogRing>> rings_;
+
+	std::mutex drainMutex_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::atomic<bool> sleeping_;
+	bool stop_;
+
+	std::thread thread_;
+};
+
+AsyncLogWriter::AsyncLogWriter(std::shared_ptr<LogOutput> *output)
+	: output_(output), sleeping_(false), stop_(false)
+{
+	thread_ = std::thread(&AsyncLogWriter::run, this);
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stop_ = true;
+		sleeping_.store(false);
+	}
+	cv_.notify_one();
+
+	thread_.join();
+	drain();
+}
+
+/**
+ * \brief Queue a message to the ring of the calling thread
+ * \param[in] msg The message
+ */
+void AsyncLogWriter::write(const LogMessage &msg)
+{
+	if (!ring()->push(msg))
+		return;
+
+	if (sleeping_.exchange(false)) {
+		std::lock_guard<std::mutex> locker(mutex_);
+		cv_.notify_one();
+	}
+}
+
+/**
+ * \brief Write all queued messages to the log output from the calling thread
+ */
+void AsyncLogWriter::flush()
+{
+	drain();
+}
+
+/*
+ * Retrieve the ring of the calling thread, creating it on first use. The ring
+ * is shared between the thread and the writer, the writer releases it when the
+ * thread has exited and the ring has been drained.
+ */
+LogRing *AsyncLogWriter::ring()
+{
+	static thread_local std::shared_ptr<LogRing> ring;
+
+	if (!ring) {
+		ring = std::make_shared<LogRing>();
+
+		std::lock_guard<std::mutex> locker(ringsMutex_);
+		rings_.push_back(ring);
+	}
+
+	return ring.get();
+}
+
+void AsyncLogWriter::drain()
+{
+	std::lock_guard<std::mutex> drainLocker(drainMutex_);
+
+	std::vector<std::shared_ptr<LogRing>> rings;
+	{
+		std::lock_guard<std::mutex> locker(ringsMutex_);
+		rings = rings_;
+	}
+
+	std::shared_ptr<LogOutput> output = std::atomic_load(output_);
+
+	for (const std::shared_ptr<LogRing> &ring : rings) {
+		while (ring->pop(output.get()))
+			;
+
+		unsigned int dropped = ring->takeDropped();
+		if (dropped && output)
+			output->write(LogWarning, "Log", utils::clock::now(), "",
+				      std::to_string(dropped) +
+				      " log messages dropped\n");
+	}
+
+	if (output)
+		output->flush();
+
+	/*
+	 * Release the drained rings of threads that have exited, the writer
+	 * then holds the last reference.
+	 */
+	rings.clear();
+
+	std::lock_guard<std::mutex> locker(ringsMutex_);
+	for (auto iter = rings_.begin(); iter != rings_.end();) {
+		if (iter->use_count() == 1 && (*iter)->empty())
+			iter = rings_.erase(iter);
+		else
+			++iter;
+	}
+}
+
+void AsyncLogWriter::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (!stop_) {
+		locker.unlock();
+
+		/*
+		 * Announce that the thread is about to sleep before draining
+		 * the rings, a message queued after the last drain will then
+		 * wake the thread up.
+		 */
+		sleeping_.store(true);
+		drain();
+
+		locker.lock();
+		cv_.wait(locker, [&] { return stop_ || !sleeping_.load(); });
+	}
 }
 
 /**
@@ -228,9 +584,11 @@ public:
 	int logSetStream(std::ostream *stream);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
+	void logSetAsync(bool async);
 
 private:
 	Logger();
+	~Logger();
 
 	void parseLogFile();
 	void parseLogLevels();
@@ -240,13 +598,16 @@ private:
 	void registerCategory(LogCategory *category);
 	void unregisterCategory(LogCategory *category);
 
-	void writeSyslog(const LogMessage &msg);
-	void writeStream(const LogMessage &msg);
+	void setOutput(const std::shared_ptr<LogOutput> &output);
 
 	std::unordered_set<LogCategory *> categories_;
 	std::list<std::pair<std::string, LogSeverity>> levels_;
 
 	std::shared_ptr<LogOutput> output_;
+
+	std::mutex asyncMutex_;
+	std::unique_ptr<AsyncLogWriter> asyncWriter_;
+	std::atomic<bool> async_;
 };
 
 /**
@@ -343,6 +704,29 @@ void logSetLevel(const char *category, const char *level)
 	Logger::instance()->logSetLevel(category, level);
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages from a background thread
+ *
+ * This function selects whether log messages are written to the log output
+ * synchronously, in the context of the thread that logs them, or queued and
+ * written asynchronously by a background thread. Asynchronous logging moves
+ * the cost of the log output, such as disk latency, out of the threads that
+ * log messages.
+ *
+ * Messages are queued in a buffer of bounded size per thread. When the buffer
+ * of a thread is full, new messages from that thread are dropped until the
+ * background thread catches up, and the number of dropped messages is then
+ * reported. Fatal messages are always written synchronously, after all queued
+ * messages.
+ *
+ * Disabling asynchronous logging writes all queued messages before returning.
+ */
+void logSetAsync(bool async)
+{
+	Logger::instance()->logSetAsync(async);
+}
+
 /**
  * \brief Retrieve the logger instance
  *
@@ -363,6 +747,16 @@ Logger *Logger::instance()
  */
 void Logger::write(const LogMessage &msg)
 {
+	if (async_.load(std::memory_order_acquire)) {
+		/* Fatal messages must be output before aborting. */
+		if (msg.severity() != LogFatal) {
+			asyncWriter_->write(msg);
+			return;
+		}
+
+		asyncWriter_->flush();
+	}
+
 	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
 	if (!output)
 		return;
@@ -384,7 +778,7 @@ int Logger::logSetFile(const char *path)
 	if (!output->isValid())
 		return -EINVAL;
 
-	std::atomic_store(&output_, output);
+	setOutput(output);
 	return 0;
 }
 
@@ -399,7 +793,7 @@ int Logger::logSetFile(const char *path)
 int Logger::logSetStream(std::ostream *stream)
 {
 	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(stream);
-	std::atomic_store(&output_, output);
+	setOutput(output);
 	return 0;
 }
 
@@ -418,11 +812,10 @@ int Logger::logSetTarget(enum LoggingTarget target)
 	switch (target) {
 	case LoggingTargetSyslog:
 		output = std::make_shared<LogOutput>();
-		std::atomic_store(&output_, output);
+		setOutput(output);
 		break;
 	case LoggingTargetNone:
-		output = nullptr;
-		std::atomic_store(&output_, std::shared_ptr<LogOutput>());
+		setOutput(nullptr);
 		break;
 	default:
 		return -EINVAL;
@@ -452,13 +845,67 @@ void Logger::logSetLevel(const char *category, const char *level)
 	}
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages from a background thread
+ *
+ * \sa libcamera::logSetAsync()
+ */
+void Logger::logSetAsync(bool async)
+{
+	std::lock_guard<std::mutex> locker(asyncMutex_);
+
+	/*
+	 * The writer is kept when disabling asynchronous logging, as other
+	 * threads may still be queuing messages to it.
+	 */
+	if (async && !asyncWriter_)
+		asyncWriter_ = utils::make_unique<AsyncLogWriter>(&output_);
+
+	async_.store(async);
+
+	if (!async && asyncWriter_)
+		asyncWriter_->flush();
+}
+
+/**
+ * \brief Replace the log output
+ * \param[in] output The new log output
+ *
+ * Messages queued for asynchronous output are written to the previous output
+ * before switching to the new one.
+ */
+void Logger::setOutput(const std::shared_ptr<LogOutput> &output)
+{
+	std::lock_guard<std::mutex> locker(asyncMutex_);
+
+	if (asyncWriter_)
+		asyncWriter_->flush();
+
+	std::atomic_store(&output_, output);
+}
+
 /**
  * \brief Construct a logger
  */
 Logger::Logger()
+	: async_(false)
 {
 	parseLogFile();
 	parseLogLevels();
+
+	const char *async = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (async && strtoul(async, nullptr, 10))
+		logSetAsync(true);
+}
+
+/**
+ * \brief Destroy the logger, writing all queued messages
+ */
+Logger::~Logger()
+{
+	async_.store(false);
+	asyncWriter_.reset();
 }
 
 /**
@@ -969,6 +1416,11 @@ LogMessage _log(const char *fileName, unsigned int line,
  * absent the default category is used. The  \a severity controls whether the
  * message is printed or discarded, depending on the log level for the category.
  *
+ * The log level is checked before the message is created. When the message is
+ * discarded, the operands streamed to it are not evaluated, and the cost of
+ * the statement is limited to the log level check. Operands with side effects
+ * should thus not be used in log messages.
+ *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  */
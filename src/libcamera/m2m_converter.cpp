@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * m2m_converter.cpp - Format conversion and scaling with V4L2 M2M devices
+ */
+
+#include "m2m_converter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <linux/media.h>
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/controls.h>
+
+#include "device_enumerator.h"
+#include "log.h"
+#include "media_device.h"
+#include "utils.h"
+#include "v4l2_videodevice.h"
+
+/**
+ * \file m2m_converter.h
+ * \brief Format conversion and scaling with V4L2 memory-to-memory devices
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Converter)
+
+namespace {
+
+/* The drivers of the known memory-to-memory format converters. */
+const char *const converterDrivers[] = {
+	"rockchip-rga",
+	"mtk-mdp",
+	"vim2m",
+};
+
+bool contains(const std::vector<SizeRange> &ranges, const Size &size)
+{
+	for (const SizeRange &range : ranges) {
+		if (range.contains(size))
+			return true;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+/**
+ * \class M2MConverter
+ * \brief Post-processing stage backed by a V4L2 memory-to-memory converter
+ *
+ * Many platforms include a memory-to-memory 2D engine, such as the Rockchip
+ * RGA, that converts pixel formats, scales and rotates frames. The
+ * M2MConverter wraps such a device to process frames captured by a pipeline
+ * handler in hardware when the format or size requested by the application
+ * isn't natively produced by the camera.
+ *
+ * The converter reads its input frames from the buffers of the V4L2 output
+ * queue of the device, and writes its output frames to the buffers of the
+ * V4L2 capture queue. Both queues import dmabuf buffers, the frames thus go
+ * from the camera to the application without being touched by the CPU.
+ *
+ * Each converter instance opens its own file handle on the device, which the
+ * V4L2 memory-to-memory framework backs with a separate context. Converters
+ * are thus not acquired exclusively, and can be shared between cameras and
+ * pipeline handlers.
+ *
+ * The bufferReady signal is emitted for every pair of buffers queued with
+ * queueBuffers(), when both have been processed, in queueing order.
+ */
+
+/**
+ * \brief Create a converter for the memory-to-memory \a media device
+ * \param[in] media The media device of the converter
+ *
+ * The converter device is opened from the video node of the \a media device.
+ * Use isValid() to check whether the converter has been opened successfully.
+ */
+M2MConverter::M2MConverter(const std::shared_ptr<MediaDevice> &media)
+	: media_(media), m2m_(nullptr), running_(false)
+{
+	const MediaEntity *node = nullptr;
+	for (const MediaEntity *entity : media->entities()) {
+		if (entity->function() == MEDIA_ENT_F_IO_V4L &&
+		    !entity->deviceNode().empty()) {
+			node = entity;
+			break;
+		}
+	}
+
+	if (!node) {
+		LOG(Converter, Debug)
+			<< "No video node in " << media->driver();
+		return;
+	}
+
+	V4L2M2MDevice *m2m = new V4L2M2MDevice(node->deviceNode());
+	if (m2m->open()) {
+		delete m2m;
+		return;
+	}
+
+	inputFormats_ = m2m->output()->formats();
+	outputFormats_ = m2m->capture()->formats();
+	if (inputFormats_.isEmpty() || outputFormats_.isEmpty()) {
+		LOG(Converter, Debug)
+			<< "Failed to enumerate the " << media->driver()
+			<< " formats";
+		delete m2m;
+		return;
+	}
+
+	m2m->jobCompleted.connect(this, &M2MConverter::jobCompleted);
+	m2m_ = m2m;
+}
+
+M2MConverter::~M2MConverter()
+{
+	if (!m2m_)
+		return;
+
+	stop();
+	releaseBuffers();
+	delete m2m_;
+}
+
+/**
+ * \brief Create a converter for the first available memory-to-memory device
+ * \param[in] enumerator The device enumerator
+ *
+ * The media devices of the known converter drivers are tried in turn.
+ *
+ * \return The converter, or nullptr if no converter is available
+ */
+std::unique_ptr<M2MConverter> M2MConverter::create(DeviceEnumerator *enumerator)
+{
+	for (const char *driver : converterDrivers) {
+		std::shared_ptr<MediaDevice> media = enumerator->search(DeviceMatch(driver));
+		if (!media)
+			continue;
+
+		std::unique_ptr<M2MConverter> converter =
+			utils::make_unique<M2MConverter>(media);
+		if (!converter->isValid())
+			continue;
+
+		LOG(Converter, Debug) << "Using converter " << driver;
+		return converter;
+	}
+
+	return nullptr;
+}
+
+/**
+ * \fn M2MConverter::isValid()
+ * \brief Check if the converter has been opened successfully
+ * \return True if the converter is valid, false otherwise
+ */
+
+/**
+ * \brief Retrieve the name of the converter driver
+ * \return The name of the converter driver
+ */
+const char *M2MConverter::driverName() const
+{
+	return m2m_->capture()->driverName();
+}
+
+/**
+ * \brief Retrieve the pixel formats the converter accepts as input
+ * \return The list of supported input pixel formats
+ */
+std::vector<unsigned int> M2MConverter::inputFormats() const
+{
+	return inputFormats_.formats();
+}
+
+/**
+ * \brief Retrieve the pixel formats the converter can produce
+ * \return The list of supported output pixel formats
+ */
+std::vector<unsigned int> M2MConverter::outputFormats() const
+{
+	return outputFormats_.formats();
+}
+
+/**
+ * \brief Retrieve the range of output sizes for \a format
+ * \param[in] format The output pixel format
+ * \return The range of sizes the converter can produce in \a format, or an
+ * empty range if the format isn't supported
+ */
+SizeRange M2MConverter::outputSizes(unsigned int format) const
+{
+	const std::vector<SizeRange> &sizes = outputFormats_.sizes(format);
+	if (sizes.empty())
+		return {};
+
+	SizeRange range = sizes.front();
+	for (const SizeRange &size : sizes) {
+		range.min.width = std::min(range.min.width, size.min.width);
+		range.min.height = std::min(range.min.height, size.min.height);
+		range.max.width = std::max(range.max.width, size.max.width);
+		range.max.height = std::max(range.max.height, size.max.height);
+	}
+
+	return range;
+}
+
+/**
+ * \brief Check if the converter supports a conversion
+ * \param[in] inputFormat The input pixel format
+ * \param[in] inputSize The input frame size
+ * \param[in] outputFormat The output pixel format
+ * \param[in] outputSize The output frame size
+ * \return True if the converter can process frames of \a inputSize in
+ * \a inputFormat to frames of \a outputSize in \a outputFormat
+ */
+bool M2MConverter::supports(unsigned int inputFormat, const Size &inputSize,
+			    unsigned int outputFormat, const Size &outputSize) const
+{
+	return contains(inputFormats_.sizes(inputFormat), inputSize) &&
+	       contains(outputFormats_.sizes(outputFormat), outputSize);
+}
+
+/**
+ * \brief Check if the converter can rotate frames
+ * \return True if the converter supports rotation, false otherwise
+ */
+bool M2MConverter::supportsRotation() const
+{
+	return m2m_->capture()->controls().count(V4L2_CID_ROTATE);
+}
+
+/**
+ * \brief Configure the converter formats
+ * \param[in] inputFormat The format of the input frames
+ * \param[inout] outputFormat The format of the output frames
+ * \param[in] rotation The clockwise rotation in degrees, a multiple of 90
+ *
+ * The \a outputFormat size is the size of the frames after rotation. The
+ * \a outputFormat is updated with the format applied by the device, including
+ * the stride and the size of its planes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The device doesn't support the requested formats
+ * \retval -ENOTSUP The device doesn't support the requested rotation
+ */
+int M2MConverter::configure(const V4L2DeviceFormat &inputFormat,
+			    V4L2DeviceFormat *outputFormat,
+			    unsigned int rotation)
+{
+	V4L2DeviceFormat format = inputFormat;
+	int ret = m2m_->output()->setFormat(&format);
+	if (ret)
+		return ret;
+
+	if (format.fourcc != inputFormat.fourcc ||
+	    format.size != inputFormat.size) {
+		LOG(Converter, Error)
+			<< "Input format " << inputFormat.toString()
+			<< " not supported";
+		return -EINVAL;
+	}
+
+	const V4L2DeviceFormat requested = *outputFormat;
+	ret = m2m_->capture()->setFormat(outputFormat);
+	if (ret)
+		return ret;
+
+	if (outputFormat->fourcc != requested.fourcc ||
+	    outputFormat->size != requested.size) {
+		LOG(Converter, Error)
+			<< "Output format " << requested.toString()
+			<< " not supported";
+		return -EINVAL;
+	}
+
+	if (rotation % 90) {
+		LOG(Converter, Error) << "Invalid rotation " << rotation;
+		return -EINVAL;
+	}
+
+	if (!supportsRotation()) {
+		if (rotation % 360)
+			return -ENOTSUP;
+		return 0;
+	}
+
+	ControlList controls(m2m_->capture()->controls());
+	controls.set(V4L2_CID_ROTATE, static_cast<int32_t>(rotation % 360));
+
+	return m2m_->capture()->setControls(&controls);
+}
+
+/**
+ * \brief Import the input buffers of the converter
+ * \param[in] pool The dmabuf buffers the frames to process are read from
+ * \return 0 on success or a negative error code otherwise
+ */
+int M2MConverter::importInputBuffers(BufferPool *pool)
+{
+	return m2m_->output()->importBuffers(pool);
+}
+
+/**
+ * \brief Import the output buffers of the converter
+ * \param[in] pool The dmabuf buffers the processed frames are written to
+ * \return 0 on success or a negative error code otherwise
+ */
+int M2MConverter::importOutputBuffers(BufferPool *pool)
+{
+	return m2m_->capture()->importBuffers(pool);
+}
+
+/**
+ * \brief Allocate the output buffers of the converter
+ * \param[in] pool The buffer pool to export the allocated buffers to
+ * \return 0 on success or a negative error code otherwise
+ */
+int M2MConverter::exportOutputBuffers(BufferPool *pool)
+{
+	return m2m_->capture()->exportBuffers(pool);
+}
+
+/**
+ * \brief Release the input and output buffers of the converter
+ */
+void M2MConverter::releaseBuffers()
+{
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+}
+
+/**
+ * \brief Start the converter
+ * \return 0 on success or a negative error code otherwise
+ */
+int M2MConverter::start()
+{
+	int ret = m2m_->output()->streamOn();
+	if (ret)
+		return ret;
+
+	ret = m2m_->capture()->streamOn();
+	if (ret) {
+		m2m_->output()->streamOff();
+		return ret;
+	}
+
+	running_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Stop the converter
+ *
+ * The bufferReady signal is emitted for all the queued buffers, marked as
+ * cancelled, before this method returns.
+ */
+void M2MConverter::stop()
+{
+	if (!running_)
+		return;
+
+	running_ = false;
+
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+}
+
+/**
+ * \fn M2MConverter::isRunning()
+ * \brief Check if the converter has been started
+ * \return True if the converter is running, false otherwise
+ */
+
+/**
+ * \brief Queue a frame to be processed by the converter
+ * \param[in] input The buffer containing the frame to process
+ * \param[in] output The buffer to store the processed frame to
+ *
+ * The output buffer is queued first. If only the input buffer fails to be
+ * queued, the frame is still tracked, and bufferReady is emitted with a null
+ * input buffer when the output buffer completes.
+ *
+ * \return 0 if the output buffer has been queued, or a negative error code
+ * otherwise, in which case bufferReady isn't emitted for the buffers
+ */
+int M2MConverter::queueBuffers(Buffer *input, Buffer *output)
+{
+	if (!running_)
+		return -EBUSY;
+
+	unsigned int jobs = m2m_->jobsInFlight();
+	int ret = m2m_->queueJob(input, output);
+	if (ret && m2m_->jobsInFlight() > jobs) {
+		LOG(Converter, Error) << "Failed to queue input buffer";
+		return 0;
+	}
+
+	return ret;
+}
+
+/**
+ * \var M2MConverter::bufferReady
+ * \brief A Signal emitted when a frame has been processed
+ *
+ * The signal carries the input and output buffers passed to queueBuffers().
+ * The output buffer status reports whether the frame has been processed
+ * successfully. The input buffer is null if it failed to be queued.
+ */
+
+void M2MConverter::jobCompleted(Buffer *input, Buffer *output)
+{
+	bufferReady.emit(input, output);
+}
+
+} /* namespace libcamera */
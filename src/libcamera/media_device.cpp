@@ -7,6 +7,7 @@
 
 #include "media_device.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
@@ -19,6 +20,9 @@
 #include <linux/media.h>
 
 #include "log.h"
+#include "media_request.h"
+#include "startup_timeline.h"
+#include "utils.h"
 
 /**
  * \file media_device.h
@@ -46,7 +50,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  *
  * The graph is valid once successfully populated, as reported by the valid()
  * function. It can be queried to list all entities(), or entities can be
- * looked up by name with getEntityByName(). The graph can be traversed from
+ * looked up by name with getEntityByName(), in constant time through an index
+ * of the entity names. The graph can be traversed from
  * entity to entity through pads and links as exposed by the corresponding
  * classes.
  *
@@ -63,8 +68,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * populate() before the media graph can be queried.
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1), valid_(false), acquired_(false),
-	  lockOwner_(false)
+	: deviceNode_(deviceNode), topologyVersion_(0), fd_(-1), valid_(false),
+	  acquired_(false), lockOwner_(false)
 {
 }
 
@@ -183,6 +188,28 @@ void MediaDevice::unlock()
  * \sa acquire(), release()
  */
 
+/**
+ * \brief Retrieve the media device information without populating the graph
+ *
+ * This function retrieves the media device information, making the driver()
+ * and model() available, without enumerating the media graph. It allows
+ * deciding whether the media device is of any interest before populating it
+ * with populate(), which is more expensive.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::probe()
+{
+	int ret = open();
+	if (ret)
+		return ret;
+
+	ret = readDeviceInfo();
+	close();
+
+	return ret;
+}
+
 /**
  * \brief Populate the MediaDevice with device information and media objects
  *
@@ -196,10 +223,16 @@ void MediaDevice::unlock()
  * while pads are accessible from the entity they belong to and links from the
  * pads they connect.
  *
+ * When the media device has already been populated, and the topology version
+ * reported by the kernel hasn't changed since, the existing media graph is
+ * kept and all pointers to media objects remain valid. Otherwise the media
+ * graph is cleared and populated again.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaDevice::populate()
 {
+	StartupTimeline::Scope phase("populate", deviceNode_);
 	struct media_v2_topology topology = { };
 	struct media_v2_entity *ents = nullptr;
 	struct media_v2_interface *interfaces = nullptr;
@@ -208,24 +241,15 @@ int MediaDevice::populate()
 	__u64 version = -1;
 	int ret;
 
-	clear();
-
 	ret = open();
-	if (ret)
-		return ret;
-
-	struct media_device_info info = {};
-	ret = ioctl(fd_, MEDIA_IOC_DEVICE_INFO, &info);
 	if (ret) {
-		ret = -errno;
-		LOG(MediaDevice, Error)
-			<< "Failed to get media device info " << strerror(-ret);
-		goto done;
+		clear();
+		return ret;
 	}
 
-	driver_ = info.driver;
-	model_ = info.model;
-	version_ = info.media_version;
+	ret = readDeviceInfo();
+	if (ret)
+		goto done;
 
 	/*
 	 * Keep calling G_TOPOLOGY until the version number stays stable.
@@ -249,6 +273,22 @@ int MediaDevice::populate()
 		if (version == topology.topology_version)
 			break;
 
+		/*
+		 * The first call only retrieves the topology version and the
+		 * number of objects. Reuse the existing graph if the topology
+		 * hasn't changed.
+		 */
+		if (!ents && valid_ &&
+		    topology.topology_version == topologyVersion_) {
+			LOG(MediaDevice, Debug)
+				<< "Topology version " << topologyVersion_
+				<< " unchanged, reusing media graph";
+			close();
+			return 0;
+		}
+
+		clear();
+
 		delete[] ents;
 		delete[] interfaces;
 		delete[] pads;
@@ -265,8 +305,10 @@ int MediaDevice::populate()
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
-	    populateLinks(topology))
+	    populateLinks(topology)) {
+		topologyVersion_ = topology.topology_version;
 		valid_ = true;
+	}
 
 	ret = 0;
 done:
@@ -277,7 +319,7 @@ done:
 	delete[] pads;
 	delete[] links;
 
-	if (!valid_) {
+	if (ret || !valid_) {
 		clear();
 		return -EINVAL;
 	}
@@ -309,6 +351,17 @@ done:
  * \return The MediaDevice model name
  */
 
+/**
+ * \fn MediaDevice::topologyVersion()
+ * \brief Retrieve the topology version of the media graph
+ *
+ * The topology version is incremented by the kernel every time the media graph
+ * topology changes. It is used by populate() to detect whether the media graph
+ * needs to be populated again.
+ *
+ * \return The topology version of the populated media graph
+ */
+
 /**
  * \fn MediaDevice::entities()
  * \brief Retrieve the list of entities in the media graph
@@ -322,11 +375,8 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
-
-	return nullptr;
+	auto it = entitiesByName_.find(name);
+	return it == entitiesByName_.end() ? nullptr : it->second;
 }
 
 /**
@@ -438,6 +488,84 @@ int MediaDevice::disableLinks()
 	return 0;
 }
 
+/**
+ * \brief Set up a group of links in the media device
+ * \param[in] links The links and their requested enabled state
+ * \param[in] exclusive Disable all the other links of the media device
+ *
+ * Bring all the \a links to their requested state as a single transaction.
+ * Links are disabled before others are enabled, which allows moving a data
+ * connection from one pad to another. Links already in the requested state
+ * are skipped, configuring a pipeline that hasn't changed doesn't issue any
+ * link setup call to the kernel.
+ *
+ * When \a exclusive is true, all the links of the media device that are not
+ * listed in \a links and are not immutable are disabled as well, replacing a
+ * disableLinks() call followed by enabling the \a links individually.
+ *
+ * If a link fails to be set up, the links changed by this call so far are
+ * restored to their previous state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::setupLinks(const std::vector<std::pair<MediaLink *, bool>> &links,
+			    bool exclusive)
+{
+	std::vector<MediaLink *> disable;
+	std::vector<MediaLink *> enable;
+
+	for (const auto &it : links) {
+		if (it.second)
+			enable.push_back(it.first);
+		else
+			disable.push_back(it.first);
+	}
+
+	if (exclusive) {
+		for (MediaEntity *entity : entities_) {
+			for (MediaPad *pad : entity->pads()) {
+				if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
+					continue;
+
+				for (MediaLink *link : pad->links()) {
+					if (link->flags() & MEDIA_LNK_FL_IMMUTABLE)
+						continue;
+
+					if (std::find(enable.begin(), enable.end(),
+						      link) == enable.end())
+						disable.push_back(link);
+				}
+			}
+		}
+	}
+
+	std::vector<std::pair<MediaLink *, bool>> changes;
+	for (MediaLink *link : disable)
+		changes.emplace_back(link, false);
+	for (MediaLink *link : enable)
+		changes.emplace_back(link, true);
+
+	std::vector<std::pair<MediaLink *, bool>> applied;
+
+	for (const auto &change : changes) {
+		MediaLink *link = change.first;
+		bool enabled = link->flags() & MEDIA_LNK_FL_ENABLED;
+		if (enabled == change.second)
+			continue;
+
+		int ret = link->setEnabled(change.second);
+		if (ret) {
+			for (auto it = applied.rbegin(); it != applied.rend(); ++it)
+				it->first->setEnabled(!it->second);
+			return ret;
+		}
+
+		applied.push_back(change);
+	}
+
+	return 0;
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -448,6 +576,40 @@ int MediaDevice::disableLinks()
  * driver unloading for most devices. The media device is passed as a parameter.
  */
 
+/**
+ * \brief Allocate a Media Controller request
+ *
+ * Requests allow applying controls and queueing buffers to the devices of the
+ * media graph atomically for a frame, see MediaRequest. They are only
+ * supported by drivers implementing the Media Controller request API, this
+ * method returns nullptr otherwise. Pipeline handlers shall fall back to
+ * applying controls immediately in that case.
+ *
+ * The media device shall be acquired before requests can be allocated.
+ *
+ * \return The allocated request, or nullptr if the device doesn't support
+ * requests or an error occurred
+ */
+std::unique_ptr<MediaRequest> MediaDevice::allocateRequest()
+{
+	if (fd_ == -1) {
+		LOG(MediaDevice, Error)
+			<< "Media device must be acquired to allocate requests";
+		return nullptr;
+	}
+
+	int fd;
+	int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &fd);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Debug)
+			<< "Failed to allocate request: " << strerror(-ret);
+		return nullptr;
+	}
+
+	return utils::make_unique<MediaRequest>(fd);
+}
+
 /**
  * \brief Open the media device
  *
@@ -497,6 +659,28 @@ void MediaDevice::close()
 	fd_ = -1;
 }
 
+/*
+ * Retrieve the media device information from the open device node and store
+ * the driver and model names and the media API version.
+ */
+int MediaDevice::readDeviceInfo()
+{
+	struct media_device_info info = {};
+	int ret = ioctl(fd_, MEDIA_IOC_DEVICE_INFO, &info);
+	if (ret) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to get media device info " << strerror(-ret);
+		return ret;
+	}
+
+	driver_ = info.driver;
+	model_ = info.model;
+	version_ = info.media_version;
+
+	return 0;
+}
+
 /**
  * \var MediaDevice::objects_
  * \brief Global map of media objects (entities, pads, links) keyed by their
@@ -556,6 +740,8 @@ void MediaDevice::clear()
 
 	objects_.clear();
 	entities_.clear();
+	entitiesByName_.clear();
+	topologyVersion_ = 0;
 	valid_ = false;
 }
 
@@ -564,6 +750,14 @@ void MediaDevice::clear()
  * \brief Global list of media entities in the media graph
  */
 
+/**
+ * \var MediaDevice::entitiesByName_
+ * \brief Index of the media entities in the media graph by name
+ *
+ * When multiple entities share the same name, the index references the first
+ * one in the entities_ list.
+ */
+
 /**
  * \brief Find the interface associated with an entity
  * \param[in] topology The media topology as returned by MEDIA_IOC_G_TOPOLOGY
@@ -643,6 +837,7 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		}
 
 		entities_.push_back(entity);
+		entitiesByName_.emplace(entity->name(), entity);
 	}
 
 	return true;
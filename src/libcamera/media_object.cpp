@@ -112,17 +112,23 @@ LOG_DECLARE_CATEGORY(MediaDevice)
  * Enabling a link establishes a data connection between two pads, while
  * disabling it interrupts that connection.
  *
+ * The link flags are tracked from the media graph enumeration, links already
+ * in the requested state are not set up again.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaLink::setEnabled(bool enable)
 {
+	if (!!(flags_ & MEDIA_LNK_FL_ENABLED) == enable)
+		return 0;
+
 	unsigned int flags = enable ? MEDIA_LNK_FL_ENABLED : 0;
 
 	int ret = dev_->setupLink(this, flags);
 	if (ret)
 		return ret;
 
-	flags_ = flags;
+	flags_ = (flags_ & ~MEDIA_LNK_FL_ENABLED) | flags;
 
 	return 0;
 }
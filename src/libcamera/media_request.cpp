@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_request.cpp - Media Controller request
+ */
+
+#include "media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include <libcamera/event_notifier.h>
+
+#include "log.h"
+
+/**
+ * \file media_request.h
+ * \brief Media Controller requests for atomic application of frame parameters
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A Media Controller request
+ *
+ * Media Controller requests group V4L2 controls and buffers that the kernel
+ * applies atomically to a frame. Controls are added to a request with
+ * V4L2Device::setControls() and buffers with V4L2VideoDevice::queueBuffer(),
+ * and the request is then handed to the kernel with queue(). This removes the
+ * need to time the application of per-frame controls in software.
+ *
+ * Requests are allocated by MediaDevice::allocateRequest() on devices that
+ * support them. The completed signal is emitted when the kernel has completed
+ * the request, after which the request can be reused with reinit().
+ */
+
+/**
+ * \brief Construct a MediaRequest wrapping the request file descriptor \a fd
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of \a fd and closes it when destroyed.
+ */
+MediaRequest::MediaRequest(int fd)
+	: fd_(fd), queued_(false)
+{
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->setEnabled(false);
+	notifier_->activated.connect(this, &MediaRequest::requestReady);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ * \return The request file descriptor
+ */
+
+/**
+ * \fn MediaRequest::queued()
+ * \brief Check if the request has been queued and hasn't completed yet
+ * \return True if the request is queued, false otherwise
+ */
+
+/**
+ * \brief Queue the request to the kernel
+ *
+ * All controls and buffers associated with the request are applied atomically
+ * by the kernel.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is already queued
+ * \retval -ENOENT The request contains no buffer
+ */
+int MediaRequest::queue()
+{
+	if (queued_)
+		return -EBUSY;
+
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	queued_ = true;
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialise the request for reuse
+ *
+ * Release all controls and buffers associated with the request. The request
+ * shall not be queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::reinit()
+{
+	if (queued_)
+		return -EBUSY;
+
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_REINIT) < 0) {
+		int ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinit request: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief A Signal emitted when the kernel has completed the request
+ */
+
+void MediaRequest::requestReady(EventNotifier *notifier)
+{
+	notifier_->setEnabled(false);
+	queued_ = false;
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
@@ -7,6 +7,8 @@
 
 #include "message.h"
 
+#include <atomic>
+
 #include <libcamera/signal.h>
 
 #include "log.h"
@@ -58,7 +60,7 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), receiver_(nullptr), next_(nullptr)
 {
 }
 
@@ -110,29 +112,229 @@ Message::Type Message::registerMessageType()
 	return static_cast<Message::Type>(nextUserType_++);
 }
 
+namespace {
+
+/*
+ * Header of the memory blocks handed out by the InvokeMessage pools. It keeps
+ * the message storage aligned to std::max_align_t.
+ */
+struct alignas(std::max_align_t) MessageBlock {
+	class MessagePool *pool;
+	MessageBlock *next;
+};
+
+/*
+ * Per-thread pool of InvokeMessage memory blocks. Blocks are allocated by the
+ * thread that posts the message and released by the thread that receives it.
+ * Released blocks are returned to their pool through a lock-free stack, and
+ * the owner thread reuses them once its local free list is exhausted.
+ *
+ * The pool is reference-counted by its owner thread and by the blocks it has
+ * handed out, so blocks released after the owner thread exits still return to
+ * a valid pool.
+ */
+class MessagePool
+{
+public:
+	static void *allocate(size_t size);
+	static void release(void *ptr);
+
+private:
+	struct Owner {
+		~Owner()
+		{
+			if (pool)
+				pool->threadExit();
+		}
+
+		MessagePool *pool = nullptr;
+	};
+
+	MessagePool()
+		: refs_(1), free_(nullptr), returned_(nullptr)
+	{
+	}
+
+	static MessagePool *current();
+	static void freeBlocks(MessageBlock *block);
+
+	void threadExit();
+	void unref();
+
+	static thread_local Owner owner_;
+
+	std::atomic<unsigned int> refs_;
+	MessageBlock *free_;
+	std::atomic<MessageBlock *> returned_;
+};
+
+thread_local MessagePool::Owner MessagePool::owner_;
+
+constexpr size_t MessageBlockSize = sizeof(MessageBlock) + sizeof(InvokeMessage);
+
+MessagePool *MessagePool::current()
+{
+	if (!owner_.pool)
+		owner_.pool = new MessagePool();
+
+	return owner_.pool;
+}
+
+void *MessagePool::allocate(size_t size)
+{
+	MessageBlock *block;
+
+	/* Derived classes don't fit in the blocks, allocate them directly. */
+	if (size > sizeof(InvokeMessage)) {
+		block = static_cast<MessageBlock *>(::operator new(sizeof(MessageBlock) + size));
+		block->pool = nullptr;
+		return block + 1;
+	}
+
+	MessagePool *pool = current();
+
+	block = pool->free_;
+	if (!block)
+		block = pool->returned_.exchange(nullptr, std::memory_order_acquire);
+
+	if (block)
+		pool->free_ = block->next;
+	else
+		block = static_cast<MessageBlock *>(::operator new(MessageBlockSize));
+
+	block->pool = pool;
+	pool->refs_.fetch_add(1, std::memory_order_relaxed);
+
+	return block + 1;
+}
+
+void MessagePool::release(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	MessageBlock *block = static_cast<MessageBlock *>(ptr) - 1;
+	MessagePool *pool = block->pool;
+
+	if (!pool) {
+		::operator delete(block);
+		return;
+	}
+
+	if (pool == owner_.pool) {
+		block->next = pool->free_;
+		pool->free_ = block;
+	} else {
+		MessageBlock *head = pool->returned_.load(std::memory_order_relaxed);
+		do {
+			block->next = head;
+		} while (!pool->returned_.compare_exchange_weak(head, block,
+								std::memory_order_release,
+								std::memory_order_relaxed));
+	}
+
+	pool->unref();
+}
+
+void MessagePool::freeBlocks(MessageBlock *block)
+{
+	while (block) {
+		MessageBlock *next = block->next;
+		::operator delete(block);
+		block = next;
+	}
+}
+
+void MessagePool::threadExit()
+{
+	freeBlocks(free_);
+	free_ = nullptr;
+
+	unref();
+}
+
+void MessagePool::unref()
+{
+	if (refs_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	/* The owner thread has exited and all blocks have been released. */
+	freeBlocks(free_);
+	freeBlocks(returned_.exchange(nullptr, std::memory_order_acquire));
+	delete this;
+}
+
+} /* namespace */
+
 /**
  * \class InvokeMessage
  * \brief A message carrying a method invocation across threads
+ *
+ * The InvokeMessage stores the bound method and the packed method arguments
+ * inline when they fit in InvokeMessage::InlineSize bytes, and in a separate
+ * heap allocation otherwise. The messages themselves are allocated from
+ * per-thread pools, making method invocation across threads free of heap
+ * allocations in the common case.
+ *
+ * Callers construct the message with the size of the bound method and of the
+ * argument pack, construct them in place in the methodStorage() and
+ * packStorage() respectively, and set the method with setMethod() before
+ * posting the message.
  */
 
 /**
  * \brief Construct an InvokeMessage for method invocation on an Object
- * \param[in] method The bound method
- * \param[in] pack The packed method arguments
- * \param[in] deleteMethod True to delete the \a method when the message is
- * destroyed
+ * \param[in] methodSize The size of the bound method to store in the message,
+ * or 0 if the method is stored externally
+ * \param[in] packSize The size of the packed method arguments
+ * \param[in] destroyPack Function called to destroy the packed arguments
  */
-InvokeMessage::InvokeMessage(BoundMethodBase *method, void *pack,
-			     bool deleteMethod)
-	: Message(Message::InvokeMessage), method_(method), pack_(pack),
-	  deleteMethod_(deleteMethod)
+InvokeMessage::InvokeMessage(size_t methodSize, size_t packSize,
+			     void (*destroyPack)(void *))
+	: Message(Message::InvokeMessage), method_(nullptr),
+	  destroyPack_(destroyPack), deleteMethod_(false)
 {
+	constexpr size_t alignment = alignof(std::max_align_t);
+	size_t packOffset = (methodSize + alignment - 1) / alignment * alignment;
+	size_t size = packOffset + packSize;
+
+	storage_ = size <= InlineSize ? inline_ : ::operator new(size);
+	pack_ = static_cast<uint8_t *>(storage_) + packOffset;
 }
 
 InvokeMessage::~InvokeMessage()
 {
+	destroyPack_(pack_);
+
 	if (deleteMethod_)
-		delete method_;
+		method_->~BoundMethodBase();
+
+	if (storage_ != inline_)
+		::operator delete(storage_);
+}
+
+/**
+ * \fn InvokeMessage::methodStorage()
+ * \brief Retrieve the storage for the bound method
+ * \return The storage for the bound method
+ */
+
+/**
+ * \fn InvokeMessage::packStorage()
+ * \brief Retrieve the storage for the packed method arguments
+ * \return The storage for the packed method arguments
+ */
+
+/**
+ * \brief Set the method to be invoked
+ * \param[in] method The bound method
+ * \param[in] deleteMethod True if the \a method has been constructed in the
+ * methodStorage() and shall be destroyed with the message
+ */
+void InvokeMessage::setMethod(BoundMethodBase *method, bool deleteMethod)
+{
+	method_ = method;
+	deleteMethod_ = deleteMethod;
 }
 
 /**
@@ -144,6 +346,30 @@ void InvokeMessage::invoke()
 	method_->invokePack(pack_);
 }
 
+/**
+ * \brief Allocate memory for an InvokeMessage from the current thread's pool
+ * \param[in] size The allocation size
+ * \return A pointer to the allocated memory
+ */
+void *InvokeMessage::operator new(size_t size)
+{
+	return MessagePool::allocate(size);
+}
+
+/**
+ * \brief Release memory allocated for an InvokeMessage to its pool
+ * \param[in] ptr The allocated memory
+ */
+void InvokeMessage::operator delete(void *ptr)
+{
+	MessagePool::release(ptr);
+}
+
+/**
+ * \var InvokeMessage::InlineSize
+ * \brief The size of the inline storage for the bound method and arguments
+ */
+
 /**
  * \var InvokeMessage::method_
  * \brief The method to be invoked
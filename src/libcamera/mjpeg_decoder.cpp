@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mjpeg_decoder.cpp - Motion-JPEG software decoder
+ */
+
+#include "mjpeg_decoder.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+#include <linux/videodev2.h>
+
+#include "formats.h"
+#include "log.h"
+#include "utils.h"
+#include "v4l2_videodevice.h"
+
+/**
+ * \file mjpeg_decoder.h
+ * \brief Motion-JPEG software decoder
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(MJPEG)
+
+namespace {
+
+struct ErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf escape;
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+	char message[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(MJPEG, Debug) << "Decode error: " << message;
+
+	longjmp(err->escape, 1);
+}
+
+void outputMessage(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(MJPEG, Debug) << message;
+}
+
+} /* namespace */
+
+struct MjpegDecoder::Context {
+	struct jpeg_decompress_struct cinfo;
+	ErrorManager err;
+};
+
+/**
+ * \class MjpegDecoder
+ * \brief Decode Motion-JPEG frames to YUV in software
+ *
+ * Most UVC cameras only offer their larger resolutions and higher frame rates
+ * in the Motion-JPEG format, which applications can't process without a JPEG
+ * decoder. The MjpegDecoder class decodes MJPEG frames with libjpeg to one of
+ * the YUV formats reported by formats(), in memory provided by the caller.
+ *
+ * The decoder is configured once for a frame size and output format with
+ * configure(), and then decodes frames with decode(). Frames whose size
+ * differs from the configured size are rejected.
+ */
+
+MjpegDecoder::MjpegDecoder()
+	: context_(utils::make_unique<Context>()), pixelFormat_(0), frameSize_(0)
+{
+	struct jpeg_decompress_struct *cinfo = &context_->cinfo;
+
+	cinfo->err = jpeg_std_error(&context_->err.pub);
+	context_->err.pub.error_exit = errorExit;
+	context_->err.pub.output_message = outputMessage;
+
+	jpeg_create_decompress(cinfo);
+}
+
+MjpegDecoder::~MjpegDecoder()
+{
+	jpeg_destroy_decompress(&context_->cinfo);
+}
+
+/**
+ * \brief Retrieve the output formats supported by the decoder
+ * \return The V4L2 pixel formats the decoder can output, in preference order
+ */
+const std::vector<unsigned int> &MjpegDecoder::formats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_YUYV,
+		V4L2_PIX_FMT_NV12,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the decoder
+ * \param[in] size The frame size
+ * \param[in] pixelFormat The output pixel format, as a V4L2 fourcc
+ * \param[out] format The layout of the decoded frames
+ *
+ * The \a format is filled with the line stride and plane size of the decoded
+ * frames, to allocate the output buffers. Both output formats are stored in a
+ * single plane.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a pixelFormat or \a size isn't supported
+ */
+int MjpegDecoder::configure(const Size &size, unsigned int pixelFormat,
+			    V4L2DeviceFormat *format)
+{
+	if (!size.width || !size.height || size.width % 2 || size.height % 2) {
+		LOG(MJPEG, Error) << "Invalid frame size " << size.toString();
+		return -EINVAL;
+	}
+
+	*format = {};
+	format->fourcc = pixelFormat;
+	format->size = size;
+	format->planesCount = 1;
+
+	switch (pixelFormat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_NV12:
+		break;
+	default:
+		LOG(MJPEG, Error)
+			<< "Unsupported output format "
+			<< utils::hex<uint32_t>(pixelFormat, 8);
+		return -EINVAL;
+	}
+
+	/* All planes are stored contiguously with the same stride. */
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	format->planes[0].bpl = info.stride(size.width, 0);
+	format->planes[0].size = info.frameSize(size);
+
+	size_ = size;
+	pixelFormat_ = pixelFormat;
+	frameSize_ = format->planes[0].size;
+	row_.resize(size.width * 3);
+
+	return 0;
+}
+
+/**
+ * \brief Decode an MJPEG frame
+ * \param[in] src The MJPEG frame
+ * \param[in] srcSize The size of the MJPEG frame in bytes
+ * \param[out] dst The memory to store the decoded frame
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ *
+ * MJPEG frames that omit the Huffman tables, as allowed by the UVC
+ * specification, are decoded with the standard tables.
+ *
+ * \return The size of the decoded frame in bytes on success, or a negative
+ * error code otherwise
+ * \retval -EINVAL The frame is corrupted or its size doesn't match the
+ * configured size
+ * \retval -ENOSPC The \a dst memory is too small
+ */
+int MjpegDecoder::decode(const uint8_t *src, size_t srcSize,
+			 uint8_t *dst, size_t dstSize)
+{
+	if (!pixelFormat_)
+		return -EINVAL;
+
+	if (dstSize < frameSize_)
+		return -ENOSPC;
+
+	int ret = decodeFrame(src, srcSize, dst);
+	if (ret)
+		return ret;
+
+	return frameSize_;
+}
+
+/*
+ * Run the libjpeg decompression. This is kept separate from decode() as
+ * libjpeg reports errors with longjmp(), which must not skip over the
+ * destruction of C++ objects or clobber local variables of the caller.
+ */
+int MjpegDecoder::decodeFrame(const uint8_t *src, size_t srcSize, uint8_t *dst)
+{
+	struct jpeg_decompress_struct *cinfo = &context_->cinfo;
+
+	if (setjmp(context_->err.escape)) {
+		jpeg_abort_decompress(cinfo);
+		return -EINVAL;
+	}
+
+	jpeg_mem_src(cinfo, const_cast<uint8_t *>(src), srcSize);
+	jpeg_read_header(cinfo, TRUE);
+
+	if (cinfo->image_width != size_.width ||
+	    cinfo->image_height != size_.height) {
+		LOG(MJPEG, Debug)
+			<< "Frame size " << cinfo->image_width << "x"
+			<< cinfo->image_height << " doesn't match "
+			<< size_.toString();
+		jpeg_abort_decompress(cinfo);
+		return -EINVAL;
+	}
+
+	/*
+	 * Decode to interleaved YCbCr, skipping the colour space conversion.
+	 * The chroma planes are subsampled again when packing, fancy
+	 * upsampling would only waste cycles.
+	 */
+	cinfo->out_color_space = JCS_YCbCr;
+	cinfo->dct_method = JDCT_IFAST;
+	cinfo->do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(cinfo);
+
+	while (cinfo->output_scanline < size_.height) {
+		unsigned int line = cinfo->output_scanline;
+		JSAMPROW rows[1] = { row_.data() };
+
+		jpeg_read_scanlines(cinfo, rows, 1);
+
+		if (pixelFormat_ == V4L2_PIX_FMT_YUYV)
+			packYUYV(row_.data(), dst + line * size_.width * 2);
+		else
+			packNV12(row_.data(), line, dst + line * size_.width,
+				 dst + size_.width * size_.height);
+	}
+
+	jpeg_finish_decompress(cinfo);
+
+	/* Truncated or corrupted frames are only reported as warnings. */
+	if (cinfo->err->num_warnings) {
+		LOG(MJPEG, Debug) << "Corrupted frame";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Pack a YCbCr 4:4:4 line to YUYV, averaging the chroma of pixel pairs. */
+void MjpegDecoder::packYUYV(const uint8_t *row, uint8_t *dst)
+{
+	for (unsigned int x = 0; x < size_.width; x += 2) {
+		const uint8_t *p = row + x * 3;
+
+		dst[0] = p[0];
+		dst[1] = (p[1] + p[4] + 1) / 2;
+		dst[2] = p[3];
+		dst[3] = (p[2] + p[5] + 1) / 2;
+		dst += 4;
+	}
+}
+
+/*
+ * Pack a YCbCr 4:4:4 line to the NV12 planes. The chroma is only sampled on
+ * even lines to avoid buffering a second line.
+ */
+void MjpegDecoder::packNV12(const uint8_t *row, unsigned int line,
+			    uint8_t *luma, uint8_t *chroma)
+{
+	for (unsigned int x = 0; x < size_.width; ++x)
+		luma[x] = row[x * 3];
+
+	if (line % 2)
+		return;
+
+	uint8_t *uv = chroma + line / 2 * size_.width;
+	for (unsigned int x = 0; x < size_.width; x += 2) {
+		const uint8_t *p = row + x * 3;
+
+		uv[x] = (p[1] + p[4] + 1) / 2;
+		uv[x + 1] = (p[2] + p[5] + 1) / 2;
+	}
+}
+
+} /* namespace libcamera */
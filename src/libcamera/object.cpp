@@ -145,15 +145,12 @@ void Object::message(Message *msg)
  * Arguments \a args passed by value or reference are copied, while pointers
  * are passed untouched. The caller shall ensure that any pointer argument
  * remains valid until the method is invoked.
+ *
+ * The bound method and the argument copies are stored inline in the
+ * InvokeMessage when they fit, and the message itself is allocated from a
+ * per-thread pool, avoiding heap allocations for the invocation.
  */
 
-void Object::invokeMethod(BoundMethodBase *method, void *args)
-{
-	std::unique_ptr<Message> msg =
-		utils::make_unique<InvokeMessage>(method, args, true);
-	postMessage(std::move(msg));
-}
-
 /**
  * \fn Object::thread()
  * \brief Retrieve the thread the object is bound to
@@ -7,17 +7,27 @@
 
 #include <algorithm>
 #include <iomanip>
+#include <map>
+#include <math.h>
 #include <memory>
+#include <queue>
+#include <stdlib.h>
+#include <tuple>
 #include <vector>
 
 #include <linux/media-bus-format.h>
 
+#include <ipa/ipu3.h>
 #include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "buffer_pool_manager.h"
 #include "camera_sensor.h"
 #include "device_enumerator.h"
+#include "frame_context.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -26,6 +36,9 @@
 #include "v4l2_subdevice.h"
 #include "v4l2_videodevice.h"
 
+#define IPU3_PARAM_BASE 0x100
+#define IPU3_STAT_BASE 0x200
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPU3)
@@ -34,6 +47,7 @@ class ImgUDevice
 {
 public:
 	static constexpr unsigned int PAD_INPUT = 0;
+	static constexpr unsigned int PAD_PARAM = 1;
 	static constexpr unsigned int PAD_OUTPUT = 2;
 	static constexpr unsigned int PAD_VF = 3;
 	static constexpr unsigned int PAD_STAT = 4;
@@ -44,10 +58,39 @@ public:
 		unsigned int pad;
 		std::string name;
 		BufferPool *pool;
+		Size size;
+	};
+
+	/* The sizes of the frames an ImgU pipe receives and produces. */
+	struct Pipe {
+		Size input;
+		Size main;
+		Size viewfinder;
+	};
+
+	/*
+	 * The sizes programmed on the ImgU input: the input feeder crop, the
+	 * Bayer downscaler (BDS) output and the GDC output, which the output
+	 * and viewfinder are scaled from.
+	 */
+	struct PipeConfig {
+		unsigned int bdsFactor;
+		Size iif;
+		Size bds;
+		Size gdc;
+
+		bool operator==(const PipeConfig &other) const
+		{
+			return iif == other.iif && bds == other.bds &&
+			       gdc == other.gdc;
+		}
 	};
 
+	static constexpr unsigned int BDS_FACTOR_DENOMINATOR = 32;
+
 	ImgUDevice()
-		: imgu_(nullptr), input_(nullptr)
+		: imgu_(nullptr), input_(nullptr), param_(nullptr),
+		  paramPool_(nullptr)
 	{
 		output_.dev = nullptr;
 		viewfinder_.dev = nullptr;
@@ -58,16 +101,24 @@ public:
 	{
 		delete imgu_;
 		delete input_;
+		delete param_;
 		delete output_.dev;
 		delete viewfinder_.dev;
 		delete stat_.dev;
 	}
 
 	int init(MediaDevice *media, unsigned int index);
-	int configureInput(const Size &size,
+	static Pipe pipe(const Size &input, const StreamConfiguration *main,
+			 const StreamConfiguration *viewfinder);
+	static PipeConfig calculatePipeConfig(const Pipe &pipe);
+
+	int configureInput(const PipeConfig &config,
 			   V4L2DeviceFormat *inputFormat);
 	int configureOutput(ImgUOutput *output,
 			    const StreamConfiguration &cfg);
+	int reconfigureOutput(ImgUOutput *output,
+			      const StreamConfiguration &cfg,
+			      BufferPool *pool, bool import);
 
 	int importInputBuffers(BufferPool *pool);
 	int importOutputBuffers(ImgUOutput *output, BufferPool *pool);
@@ -79,8 +130,10 @@ public:
 
 	int linkSetup(const std::string &source, unsigned int sourcePad,
 		      const std::string &sink, unsigned int sinkPad,
-		      bool enable);
-	int enableLinks(bool enable);
+		      bool enable,
+		      std::vector<std::pair<MediaLink *, bool>> *links);
+	int enableLinks(bool enable,
+			std::vector<std::pair<MediaLink *, bool>> *links);
 
 	unsigned int index_;
 	std::string name_;
@@ -88,13 +141,18 @@ public:
 
 	V4L2Subdevice *imgu_;
 	V4L2VideoDevice *input_;
+	V4L2VideoDevice *param_;
 	ImgUOutput output_;
 	ImgUOutput viewfinder_;
 	ImgUOutput stat_;
-	/* \todo Add param video device for 3A tuning */
+	PipeConfig pipeConfig_;
 
+	/*
+	 * The parameters and statistics pools are acquired from the pipeline
+	 * handler pools, the non-active outputs use the ImgU pools.
+	 */
+	BufferPool *paramPool_;
 	BufferPool vfPool_;
-	BufferPool statPool_;
 	BufferPool outPool_;
 };
 
@@ -102,9 +160,14 @@ class CIO2Device
 {
 public:
 	static constexpr unsigned int CIO2_BUFFER_COUNT = 4;
+	static constexpr unsigned int CIO2_MIN_BUFFER_COUNT = 2;
+	static constexpr unsigned int CIO2_MAX_BUFFER_COUNT = 8;
 
 	CIO2Device()
-		: output_(nullptr), csi2_(nullptr), sensor_(nullptr)
+		: output_(nullptr), csi2_(nullptr), sensor_(nullptr),
+		  nominalBufferCount_(CIO2_BUFFER_COUNT),
+		  bufferCount_(CIO2_BUFFER_COUNT), streamBufferCount_(0),
+		  pool_(nullptr)
 	{
 	}
 
@@ -115,57 +178,131 @@ public:
 		delete sensor_;
 	}
 
-	int init(const MediaDevice *media, unsigned int index);
+	static MediaLink *sensorLink(const MediaDevice *media,
+				     unsigned int index);
+
+	int init(const MediaDevice *media, unsigned int index,
+		 CameraSensor *sensor);
 	int configure(const Size &size,
 		      V4L2DeviceFormat *outputFormat);
 
-	BufferPool *exportBuffers();
+	BufferPool *allocateBuffers(BufferPoolManager *pools,
+				    const CameraData *data,
+				    unsigned int streamBufferCount);
 	void freeBuffers();
 
 	int start(std::vector<std::unique_ptr<Buffer>> *buffers);
 	int stop();
 
 	static int mediaBusToFormat(unsigned int code);
+	static bool isRawFormat(unsigned int fourcc);
 
 	V4L2VideoDevice *output_;
 	V4L2Subdevice *csi2_;
 	CameraSensor *sensor_;
 
-	BufferPool pool_;
+	unsigned int nominalBufferCount_;
+	unsigned int bufferCount_;
+	unsigned int streamBufferCount_;
+	BufferPool *pool_;
 };
 
 class IPU3Stream : public Stream
 {
 public:
 	IPU3Stream()
-		: active_(false), device_(nullptr)
+		: active_(false), raw_(false), imgu_(nullptr), device_(nullptr)
 	{
 	}
 
 	bool active_;
+	bool raw_;
 	std::string name_;
+	ImgUDevice *imgu_;
 	ImgUDevice::ImgUOutput *device_;
 };
 
+struct IPU3FrameInfo : public FrameContext {
+	Buffer *paramBuffer;
+	Buffer *statBuffer;
+
+	bool paramQueued;
+	bool metadataProcessed;
+};
+
 class IPU3CameraData : public CameraData
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), imguRestarting_(false), frame_(0),
+		  frameInfo_(IPU3_FRAME_DEPTH), requestControls_(controls::controls)
 	{
 	}
 
+	int loadIPA();
+
+	IPU3FrameInfo *createFrameInfo(Request *request);
+	void destroyFrameInfo(IPU3FrameInfo *info);
+	void tryCompleteRequest(Request *request);
+
+	void connectImgU(ImgUDevice *imgu);
+	void queueImgUBuffers(Request *request);
+
+	const ImgUDevice::PipeConfig &pipeConfig(const ImgUDevice::Pipe &pipe) const;
+
 	void imguOutputBufferReady(Buffer *buffer);
 	void imguInputBufferReady(Buffer *buffer);
+	void imguParamBufferReady(Buffer *buffer);
+	void imguStatBufferReady(Buffer *buffer);
 	void cio2BufferReady(Buffer *buffer);
 
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	/* The ImgUs processing the CIO2 frames, starting with imgu_. */
+	std::vector<ImgUDevice *> imgus_;
+	/* The number of ImgU inputs each CIO2 buffer is queued to. */
+	std::vector<unsigned int> imguInputPending_;
+	/* Requests waiting for the CIO2 frame their ImgU buffers use. */
+	std::queue<Request *> pendingRequests_;
 
 	IPU3Stream outStream_;
 	IPU3Stream vfStream_;
+	IPU3Stream rawStream_;
+
+	Size sensorSize_;
+	bool imguRestarting_;
+
+	/*
+	 * The ImgU pipe configurations computed so far for the sensor, indexed
+	 * by the pipe input, main output and viewfinder sizes.
+	 */
+	mutable std::map<std::tuple<Size, Size, Size>,
+			 ImgUDevice::PipeConfig> pipeConfigs_;
 
 	std::vector<std::unique_ptr<Buffer>> rawBuffers_;
+
+	/*
+	 * The parameters and statistics buffers of the ImgU processing the
+	 * still capture pipe, shared with the IPA.
+	 */
+	unsigned int frame_;
+	std::vector<IPABuffer> ipaBuffers_;
+	std::queue<Buffer *> paramBuffers_;
+	std::queue<Buffer *> statBuffers_;
+	FrameContextRing<IPU3FrameInfo> frameInfo_;
+
+	/* Controls accumulated from all requests queued since start(). */
+	ControlList requestControls_;
+
+private:
+	/*
+	 * Frames in flight are limited by the number of parameters buffers,
+	 * leave room for the gaps caused by dropped frames.
+	 */
+	static constexpr unsigned int IPU3_FRAME_DEPTH = 16;
+
+	void queueFrameAction(unsigned int frame, IPAOperationData &&action);
+	void metadataReady(unsigned int frame, ControlList &&metadata);
 };
 
 class IPU3CameraConfiguration : public CameraConfiguration
@@ -180,8 +317,14 @@ public:
 
 private:
 	static constexpr unsigned int IPU3_BUFFER_COUNT = 4;
+	static constexpr unsigned int IPU3_MIN_BUFFER_COUNT = 2;
+	static constexpr unsigned int IPU3_MAX_BUFFER_COUNT = 8;
 
+	Status validateConfiguration();
 	void adjustStream(StreamConfiguration &cfg, bool scale);
+	bool isLive() const;
+
+	std::vector<ImgUDevice::Pipe> imguPipes() const;
 
 	/*
 	 * The IPU3CameraData instance is guaranteed to be valid as long as the
@@ -210,6 +353,7 @@ public:
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
 	int allocateBuffers(Camera *camera,
 			    const std::set<Stream *> &streams) override;
@@ -222,6 +366,7 @@ public:
 	int queueRequest(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
+	int initCamera(Camera *camera) override;
 
 private:
 	IPU3CameraData *cameraData(const Camera *camera)
@@ -231,11 +376,21 @@ private:
 	}
 
 	int registerCameras();
+	void logQueueStats(const char *name, const V4L2VideoDevice *dev);
+	int configureImgU(IPU3CameraData *data, ImgUDevice *imgu,
+			  IPU3CameraConfiguration *config,
+			  const Size &sensorSize, V4L2DeviceFormat cio2Format);
 
 	ImgUDevice imgu0_;
 	ImgUDevice imgu1_;
 	MediaDevice *cio2MediaDev_;
 	MediaDevice *imguMediaDev_;
+
+	/*
+	 * The CIO2, parameters and statistics buffers, shared by all cameras
+	 * as only one of them can be acquired at a time.
+	 */
+	std::unique_ptr<BufferPoolManager> pools_;
 };
 
 IPU3CameraConfiguration::IPU3CameraConfiguration(Camera *camera,
@@ -291,10 +446,18 @@ void IPU3CameraConfiguration::adjustStream(StreamConfiguration &cfg, bool scale)
 		cfg.size.height &= ~3;
 	}
 
-	cfg.bufferCount = IPU3_BUFFER_COUNT;
+	cfg.bufferCount = queueDepth(IPU3_MIN_BUFFER_COUNT, IPU3_BUFFER_COUNT,
+				     IPU3_MAX_BUFFER_COUNT);
 }
 
 CameraConfiguration::Status IPU3CameraConfiguration::validate()
+{
+	return data_->validationCache_.validate(this,
+						&IPU3CameraConfiguration::validateConfiguration,
+						&IPU3CameraConfiguration::camera_);
+}
+
+CameraConfiguration::Status IPU3CameraConfiguration::validateConfiguration()
 {
 	const CameraSensor *sensor = data_->cio2_.sensor_;
 	Status status = Valid;
@@ -302,10 +465,54 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 2) {
-		config_.resize(2);
+	/*
+	 * Cap the number of entries to the available streams, one raw stream
+	 * captured from the CIO2 and two processed streams from the ImgU. Only
+	 * the first entry requesting a raw format is considered for the raw
+	 * stream, the other ones are adjusted to processed streams.
+	 */
+	unsigned int processedCount = 0;
+	bool rawRequested = false;
+
+	for (auto it = config_.begin(); it != config_.end();) {
+		if (!rawRequested && CIO2Device::isRawFormat(it->pixelFormat)) {
+			rawRequested = true;
+		} else if (processedCount < 2) {
+			processedCount++;
+		} else {
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		++it;
+	}
+
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
 		status = Adjusted;
+
+	/* Frame decimation isn't supported. */
+	for (StreamConfiguration &cfg : config_) {
+		if (cfg.frameDecimation != 1) {
+			cfg.frameDecimation = 1;
+			status = Adjusted;
+		}
+	}
+
+	/*
+	 * The ImgU stalls if none of its outputs is in use, the raw stream can
+	 * thus only be captured alongside processed streams.
+	 */
+	if (!processedCount) {
+		LOG(IPU3, Debug)
+			<< "Raw stream requires at least one processed stream";
+		return Invalid;
 	}
 
 	/*
@@ -339,13 +546,16 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 	 * each of them. The viewfinder stream can scale, while the output
 	 * stream can crop only, so select the output stream when the requested
 	 * resolution is equal to the sensor resolution, and the viewfinder
-	 * stream otherwise.
+	 * stream otherwise. The raw stream captures full sensor frames in the
+	 * CIO2 format.
 	 */
 	std::set<const IPU3Stream *> availableStreams = {
 		&data_->outStream_,
 		&data_->vfStream_,
 	};
 
+	bool rawAssigned = false;
+
 	streams_.clear();
 	streams_.reserve(config_.size());
 
@@ -355,19 +565,33 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 		const Size size = cfg.size;
 		const IPU3Stream *stream;
 
-		if (cfg.size == sensorFormat_.size)
+		if (!rawAssigned && CIO2Device::isRawFormat(cfg.pixelFormat)) {
+			stream = &data_->rawStream_;
+			rawAssigned = true;
+		} else if (cfg.size == sensorFormat_.size) {
 			stream = &data_->outStream_;
-		else
+		} else {
 			stream = &data_->vfStream_;
+		}
 
-		if (availableStreams.find(stream) == availableStreams.end())
+		if (!stream->raw_ &&
+		    availableStreams.find(stream) == availableStreams.end())
 			stream = *availableStreams.begin();
 
 		LOG(IPU3, Debug)
 			<< "Assigned '" << stream->name_ << "' to stream " << i;
 
-		bool scale = stream == &data_->vfStream_;
-		adjustStream(config_[i], scale);
+		if (stream->raw_) {
+			cfg.pixelFormat =
+				CIO2Device::mediaBusToFormat(sensorFormat_.mbus_code);
+			cfg.size = sensorFormat_.size;
+			cfg.bufferCount = queueDepth(IPU3_MIN_BUFFER_COUNT,
+						     IPU3_BUFFER_COUNT,
+						     IPU3_MAX_BUFFER_COUNT);
+		} else {
+			bool scale = stream == &data_->vfStream_;
+			adjustStream(config_[i], scale);
+		}
 
 		if (cfg.pixelFormat != pixelFormat || cfg.size != size) {
 			LOG(IPU3, Debug)
@@ -380,14 +604,104 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 		availableStreams.erase(stream);
 	}
 
+	/*
+	 * Compute the ImgU pipe configurations now, configure() then only has
+	 * to look them up.
+	 */
+	for (const ImgUDevice::Pipe &pipe : imguPipes()) {
+		const ImgUDevice::PipeConfig &pipeConfig = data_->pipeConfig(pipe);
+
+		LOG(IPU3, Debug)
+			<< "ImgU pipe " << pipe.input.toString() << " -> "
+			<< pipe.main.toString() << ": IF "
+			<< pipeConfig.iif.toString() << ", BDS "
+			<< pipeConfig.bds.toString() << ", GDC "
+			<< pipeConfig.gdc.toString();
+	}
+
+	live_ = isLive();
+
 	return status;
 }
 
+/*
+ * The ImgU can be stopped and reconfigured while the CIO2 keeps capturing, as
+ * long as the sensor format doesn't change. Only the resolution of the ImgU
+ * outputs can thus be changed live. As the buffers of the outputs have to be
+ * reallocated, this is further limited to streams using external memory.
+ */
+bool IPU3CameraConfiguration::isLive() const
+{
+	if (sensorFormat_.size != data_->sensorSize_)
+		return false;
+
+	/* Only a single ImgU can be restarted. */
+	if (data_->imgus_.size() > 1)
+		return false;
+
+	/* The outputs are scaled from the GDC output, which can't change. */
+	std::vector<ImgUDevice::Pipe> pipes = imguPipes();
+	if (pipes.size() != 1 ||
+	    !(data_->pipeConfig(pipes[0]) == data_->imgu_->pipeConfig_))
+		return false;
+
+	unsigned int activeStreams = data_->outStream_.active_ +
+				     data_->vfStream_.active_ +
+				     data_->rawStream_.active_;
+	if (config_.size() != activeStreams)
+		return false;
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		const StreamConfiguration &cfg = config_[i];
+		const IPU3Stream *stream = streams_[i];
+		const StreamConfiguration &current = stream->configuration();
+
+		if (!stream->active_)
+			return false;
+
+		if (cfg.pixelFormat != current.pixelFormat ||
+		    cfg.memoryType != current.memoryType ||
+		    cfg.bufferCount != current.bufferCount)
+			return false;
+
+		if (cfg.size != current.size && cfg.memoryType != ExternalMemory)
+			return false;
+	}
+
+	return true;
+}
+
 PipelineHandlerIPU3::PipelineHandlerIPU3(CameraManager *manager)
 	: PipelineHandler(manager), cio2MediaDev_(nullptr), imguMediaDev_(nullptr)
 {
 }
 
+/*
+ * Describe the pipes of the ImgUs the configuration uses. When both the output
+ * and viewfinder streams are in use, each of them is produced by a different
+ * ImgU.
+ */
+std::vector<ImgUDevice::Pipe> IPU3CameraConfiguration::imguPipes() const
+{
+	const StreamConfiguration *outCfg = nullptr;
+	const StreamConfiguration *vfCfg = nullptr;
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		if (streams_[i] == &data_->outStream_)
+			outCfg = &config_[i];
+		else if (streams_[i] == &data_->vfStream_)
+			vfCfg = &config_[i];
+	}
+
+	const Size &input = sensorFormat_.size;
+
+	if (outCfg && vfCfg)
+		return { ImgUDevice::pipe(input, outCfg, nullptr),
+			 ImgUDevice::pipe(input, nullptr, vfCfg) };
+
+	return { ImgUDevice::pipe(input, outCfg, vfCfg) };
+}
+
 CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
@@ -396,6 +710,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 	std::set<IPU3Stream *> streams = {
 		&data->outStream_,
 		&data->vfStream_,
+		&data->rawStream_,
 	};
 
 	config = new IPU3CameraConfiguration(camera, data);
@@ -468,6 +783,34 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 			break;
 		}
 
+		case StreamRole::StillCaptureRaw: {
+			if (streams.find(&data->rawStream_) == streams.end()) {
+				LOG(IPU3, Error)
+					<< "No stream available for requested role "
+					<< role;
+				break;
+			}
+
+			stream = &data->rawStream_;
+
+			/*
+			 * Default to the largest sensor resolution in the
+			 * format the CIO2 produces for it.
+			 */
+			const CameraSensor *sensor = data->cio2_.sensor_;
+			V4L2SubdeviceFormat sensorFormat =
+				sensor->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10,
+						    MEDIA_BUS_FMT_SGBRG10_1X10,
+						    MEDIA_BUS_FMT_SGRBG10_1X10,
+						    MEDIA_BUS_FMT_SRGGB10_1X10 },
+						  sensor->resolution());
+			cfg.pixelFormat =
+				CIO2Device::mediaBusToFormat(sensorFormat.mbus_code);
+			cfg.size = sensorFormat.size;
+
+			break;
+		}
+
 		default:
 			LOG(IPU3, Error)
 				<< "Requested stream role not supported: " << role;
@@ -496,10 +839,50 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	IPU3CameraData *data = cameraData(camera);
 	IPU3Stream *outStream = &data->outStream_;
 	IPU3Stream *vfStream = &data->vfStream_;
+	IPU3Stream *rawStream = &data->rawStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
 	int ret;
 
+	/*
+	 * The validation results depend on the current configuration to check
+	 * if the new one can be applied live, drop them.
+	 */
+	data->validationCache_.clear();
+
+	/* Assign the streams to the configuration entries. */
+	outStream->active_ = false;
+	vfStream->active_ = false;
+	rawStream->active_ = false;
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		/*
+		 * Use a const_cast<> here instead of storing a mutable stream
+		 * pointer in the configuration to let the compiler catch
+		 * unwanted modifications of camera data in the configuration
+		 * validate() implementation.
+		 */
+		IPU3Stream *stream = const_cast<IPU3Stream *>(config->streams()[i]);
+		StreamConfiguration &cfg = (*config)[i];
+
+		stream->active_ = true;
+		cfg.setStream(stream);
+	}
+
+	/*
+	 * When both the output and viewfinder streams are in use, run the
+	 * still capture pipe on the camera ImgU and the video pipe on the
+	 * other ImgU, doubling the processing throughput. As only one camera
+	 * can be acquired at a time, the other ImgU is always available.
+	 */
+	data->imgus_ = { data->imgu_ };
+	if (outStream->active_ && vfStream->active_)
+		data->imgus_.push_back(data->imgu_ == &imgu0_ ? &imgu1_ : &imgu0_);
+
+	outStream->imgu_ = data->imgus_.front();
+	outStream->device_ = &outStream->imgu_->output_;
+	vfStream->imgu_ = data->imgus_.back();
+	vfStream->device_ = &vfStream->imgu_->viewfinder_;
+
 	/*
 	 * FIXME: enabled links in one ImgU pipe interfere with capture
 	 * operations on the other one. This can be easily triggered by
@@ -517,9 +900,10 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * would be 'stop()', but the Camera class state machine allows
 	 * start()<->stop() sequences without any configure() in between.
 	 *
-	 * As of now, disable all links in the ImgU media graph before
-	 * configuring the device, to allow alternate the usage of the two
-	 * ImgU pipes.
+	 * As of now, disable all the other links in the ImgU media graph
+	 * when configuring the device, to allow alternate the usage of the
+	 * two ImgU pipes. Links already in the right state are left
+	 * untouched.
 	 *
 	 * As a consequence, a Camera using an ImgU shall be configured before
 	 * any start()/stop() sequence. An application that wants to
@@ -527,18 +911,25 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * without going through any re-configuration (a sequence that is
 	 * allowed by the Camera state machine) would now fail on the IPU3.
 	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
+	std::vector<std::pair<MediaLink *, bool>> links;
 
-	/*
-	 * \todo: Enable links selectively based on the requested streams.
-	 * As of now, enable all links unconditionally.
-	 */
-	ret = data->imgu_->enableLinks(true);
+	for (ImgUDevice *imgu : data->imgus_) {
+		/*
+		 * \todo: Enable links selectively based on the requested
+		 * streams. As of now, enable all links unconditionally.
+		 */
+		ret = imgu->enableLinks(true, &links);
+		if (ret)
+			return ret;
+	}
+
+	ret = imguMediaDev_->setupLinks(links, true);
 	if (ret)
 		return ret;
 
+	for (ImgUDevice *imgu : data->imgus_)
+		data->connectImgU(imgu);
+
 	/*
 	 * Pass the requested stream size to the CIO2 unit and get back the
 	 * adjusted format to be propagated to the ImgU output devices.
@@ -549,49 +940,69 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (ret)
 		return ret;
 
-	ret = imgu->configureInput(sensorSize, &cio2Format);
-	if (ret)
-		return ret;
-
-	/* Apply the format to the configured streams output devices. */
-	outStream->active_ = false;
-	vfStream->active_ = false;
-
-	for (unsigned int i = 0; i < config->size(); ++i) {
-		/*
-		 * Use a const_cast<> here instead of storing a mutable stream
-		 * pointer in the configuration to let the compiler catch
-		 * unwanted modifications of camera data in the configuration
-		 * validate() implementation.
-		 */
-		IPU3Stream *stream = const_cast<IPU3Stream *>(config->streams()[i]);
-		StreamConfiguration &cfg = (*config)[i];
-
-		stream->active_ = true;
-		cfg.setStream(stream);
-
-		ret = imgu->configureOutput(stream->device_, cfg);
-		if (ret)
-			return ret;
-	}
-
 	/*
-	 * As we need to set format also on the non-active streams, use
-	 * the configuration of the active one for that purpose (there should
-	 * be at least one active stream in the configuration request).
+	 * Size the internal CIO2 buffers, and thus the ImgU parameters and
+	 * statistics pools, to the queue profile.
 	 */
-	if (!outStream->active_) {
-		ret = imgu->configureOutput(outStream->device_, config->at(0));
+	cio2->bufferCount_ = config->queueDepth(CIO2Device::CIO2_MIN_BUFFER_COUNT,
+						cio2->nominalBufferCount_,
+						CIO2Device::CIO2_MAX_BUFFER_COUNT);
+
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = configureImgU(data, imgu, config, sensorSize,
+				    cio2Format);
 		if (ret)
 			return ret;
 	}
 
-	if (!vfStream->active_) {
-		ret = imgu->configureOutput(vfStream->device_, config->at(0));
-		if (ret)
-			return ret;
+	data->sensorSize_ = sensorSize;
+
+	return 0;
+}
+
+/*
+ * Configure the input of \a imgu with the CIO2 format and the pipe
+ * configuration computed at validate() time, and its outputs with the
+ * configuration of the streams they produce. The outputs that produce no
+ * stream need to be configured as well, use the configuration of the other
+ * output for them.
+ */
+int PipelineHandlerIPU3::configureImgU(IPU3CameraData *data,
+				       ImgUDevice *imgu,
+				       IPU3CameraConfiguration *config,
+				       const Size &sensorSize,
+				       V4L2DeviceFormat cio2Format)
+{
+	const StreamConfiguration *outCfg = nullptr;
+	const StreamConfiguration *vfCfg = nullptr;
+	int ret;
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		const ImgUDevice::ImgUOutput *output = config->streams()[i]->device_;
+
+		if (output == &imgu->output_)
+			outCfg = &config->at(i);
+		else if (output == &imgu->viewfinder_)
+			vfCfg = &config->at(i);
 	}
 
+	ImgUDevice::Pipe pipe = ImgUDevice::pipe(sensorSize, outCfg, vfCfg);
+	imgu->pipeConfig_ = data->pipeConfig(pipe);
+
+	ret = imgu->configureInput(imgu->pipeConfig_, &cio2Format);
+	if (ret)
+		return ret;
+
+	ret = imgu->configureOutput(&imgu->output_, outCfg ? *outCfg : *vfCfg);
+	if (ret)
+		return ret;
+
+	ret = imgu->configureOutput(&imgu->viewfinder_, vfCfg ? *vfCfg : *outCfg);
+	if (ret)
+		return ret;
+
+	bool video = vfCfg != nullptr;
+
 	/*
 	 * Apply the largest available format to the stat node.
 	 * \todo Revise this when we'll actually use the stat node.
@@ -606,7 +1017,7 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	/* Apply the "pipe_mode" control to the ImgU subdevice. */
 	ControlList ctrls(imgu->imgu_->controls());
 	ctrls.set(V4L2_CID_IPU3_PIPE_MODE,
-		  static_cast<int32_t>(vfStream->active_ ? IPU3PipeModeVideo :
+		  static_cast<int32_t>(video ? IPU3PipeModeVideo :
 				       IPU3PipeModeStillCapture));
 	ret = imgu->imgu_->setControls(&ctrls);
 	if (ret) {
@@ -617,84 +1028,217 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	return 0;
 }
 
-/**
- * \todo Clarify if 'viewfinder' and 'stat' nodes have to be set up and
- * started even if not in use. As of now, if not properly configured and
- * enabled, the ImgU processing pipeline stalls.
- *
- * In order to be able to start the 'viewfinder' and 'stat' nodes, we need
- * memory to be reserved.
+/*
+ * Stop the ImgU only and reconfigure the outputs whose resolution changes,
+ * while the CIO2 keeps capturing. Raw frames captured in the meantime are
+ * queued to the ImgU input and processed once the ImgU restarts.
  */
-int PipelineHandlerIPU3::allocateBuffers(Camera *camera,
-					 const std::set<Stream *> &streams)
+int PipelineHandlerIPU3::reconfigure(Camera *camera, CameraConfiguration *c)
 {
+	IPU3CameraConfiguration *config =
+		static_cast<IPU3CameraConfiguration *>(c);
 	IPU3CameraData *data = cameraData(camera);
 	IPU3Stream *outStream = &data->outStream_;
 	IPU3Stream *vfStream = &data->vfStream_;
-	CIO2Device *cio2 = &data->cio2_;
 	ImgUDevice *imgu = data->imgu_;
-	unsigned int bufferCount;
+	const StreamConfiguration *outputCfg = nullptr;
 	int ret;
 
-	/* Share buffers between CIO2 output and ImgU input. */
-	BufferPool *pool = cio2->exportBuffers();
-	if (!pool)
-		return -ENOMEM;
+	data->validationCache_.clear();
 
-	ret = imgu->importInputBuffers(pool);
-	if (ret)
-		goto error;
+	/* Return the raw buffers held by the ImgU input to the CIO2. */
+	data->imguRestarting_ = true;
+	ret = imgu->stop();
+	data->imguRestarting_ = false;
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to stop ImgU";
+		return ret;
+	}
 
-	/*
-	 * Use for the stat's internal pool the same number of buffer as
-	 * for the input pool.
-	 * \todo To be revised when we'll actually use the stat node.
-	 */
-	bufferCount = pool->count();
-	imgu->stat_.pool->createBuffers(bufferCount);
-	ret = imgu->exportOutputBuffers(&imgu->stat_, imgu->stat_.pool);
-	if (ret)
-		goto error;
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		IPU3Stream *stream = const_cast<IPU3Stream *>(config->streams()[i]);
+		StreamConfiguration &cfg = (*config)[i];
 
-	/* Allocate buffers for each active stream. */
-	for (Stream *s : streams) {
-		IPU3Stream *stream = static_cast<IPU3Stream *>(s);
-		ImgUDevice::ImgUOutput *dev = stream->device_;
+		cfg.setStream(stream);
 
-		if (stream->memoryType() == InternalMemory)
-			ret = imgu->exportOutputBuffers(dev, &stream->bufferPool());
-		else
-			ret = imgu->importOutputBuffers(dev, &stream->bufferPool());
+		/* The raw stream can't change live. */
+		if (stream->raw_)
+			continue;
+
+		if (!outputCfg)
+			outputCfg = &cfg;
+
+		if (cfg.size == stream->device_->size)
+			continue;
+
+		ret = imgu->reconfigureOutput(stream->device_, cfg,
+					      &stream->bufferPool(), true);
 		if (ret)
-			goto error;
+			return ret;
 	}
 
-	/*
-	 * Allocate buffers also on non-active outputs; use the same number
-	 * of buffers as the active ones.
-	 */
-	if (!outStream->active_) {
-		bufferCount = vfStream->configuration().bufferCount;
-		outStream->device_->pool->createBuffers(bufferCount);
-		ret = imgu->exportOutputBuffers(outStream->device_,
-						outStream->device_->pool);
+	/* Track the configuration of the active stream on inactive outputs. */
+	if (!outStream->active_ && outputCfg->size != outStream->device_->size) {
+		ret = imgu->reconfigureOutput(outStream->device_, *outputCfg,
+					      outStream->device_->pool, false);
 		if (ret)
-			goto error;
+			return ret;
 	}
 
-	if (!vfStream->active_) {
-		bufferCount = outStream->configuration().bufferCount;
-		vfStream->device_->pool->createBuffers(bufferCount);
-		ret = imgu->exportOutputBuffers(vfStream->device_,
-						vfStream->device_->pool);
+	if (!vfStream->active_ && outputCfg->size != vfStream->device_->size) {
+		ret = imgu->reconfigureOutput(vfStream->device_, *outputCfg,
+					      vfStream->device_->pool, false);
 		if (ret)
-			goto error;
+			return ret;
 	}
 
-	return 0;
-
-error:
-	freeBuffers(camera, streams);
+	ret = imgu->start();
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to restart ImgU";
+		imgu->stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \todo Clarify if 'viewfinder' and 'stat' nodes have to be set up and
+ * started even if not in use. As of now, if not properly configured and
+ * enabled, the ImgU processing pipeline stalls.
+ *
+ * In order to be able to start the 'viewfinder' and 'stat' nodes, we need
+ * memory to be reserved.
+ */
+int PipelineHandlerIPU3::allocateBuffers(Camera *camera,
+					 const std::set<Stream *> &streams)
+{
+	IPU3CameraData *data = cameraData(camera);
+	IPU3Stream *outStream = &data->outStream_;
+	IPU3Stream *vfStream = &data->vfStream_;
+	CIO2Device *cio2 = &data->cio2_;
+	unsigned int rawBufferCount = 0;
+	unsigned int bufferCount;
+	int ret;
+
+	for (Stream *s : streams) {
+		IPU3Stream *stream = static_cast<IPU3Stream *>(s);
+
+		if (s->memoryType() == UserPtrMemory) {
+			LOG(IPU3, Error) << "User pointer memory not supported";
+			return -ENOTSUP;
+		}
+
+		if (!stream->raw_)
+			continue;
+
+		if (s->memoryType() != InternalMemory) {
+			LOG(IPU3, Error)
+				<< "Raw stream supports internal memory only";
+			return -ENOTSUP;
+		}
+
+		rawBufferCount = s->bufferPool().count();
+	}
+
+	/*
+	 * Share buffers between CIO2 output and ImgU input. The raw stream
+	 * buffers are allocated from the same pool, to be handed to the
+	 * application without any copy.
+	 */
+	BufferPool *pool = cio2->allocateBuffers(pools_.get(), data,
+						 rawBufferCount);
+	if (!pool)
+		return -ENOMEM;
+
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = imgu->importInputBuffers(pool);
+		if (ret)
+			goto error;
+
+		/*
+		 * Use for the parameters and stat internal pools the same
+		 * number of buffers as for the input pool.
+		 */
+		imgu->paramPool_ = pools_->acquire(data, imgu->name_ + " parameters",
+						   imgu->param_, pool->count());
+		if (!imgu->paramPool_) {
+			ret = -ENOMEM;
+			goto error;
+		}
+
+		imgu->stat_.pool = pools_->acquire(data, imgu->name_ + " 3a stat",
+						   imgu->stat_.dev, pool->count());
+		if (!imgu->stat_.pool) {
+			ret = -ENOMEM;
+			goto error;
+		}
+	}
+
+	/* Share the parameters and statistics buffers with the IPA. */
+	for (unsigned int i = 0; i < pool->count(); i++) {
+		data->ipaBuffers_.push_back({ .id = IPU3_PARAM_BASE | i,
+					      .memory = data->imgu_->paramPool_->buffers()[i] });
+		data->paramBuffers_.push(new Buffer(i));
+	}
+
+	for (unsigned int i = 0; i < pool->count(); i++) {
+		data->ipaBuffers_.push_back({ .id = IPU3_STAT_BASE | i,
+					      .memory = data->imgu_->stat_.pool->buffers()[i] });
+		data->statBuffers_.push(new Buffer(i));
+	}
+
+	data->ipa_->mapBuffers(data->ipaBuffers_);
+
+	/* Allocate buffers for each active stream. */
+	for (Stream *s : streams) {
+		IPU3Stream *stream = static_cast<IPU3Stream *>(s);
+		ImgUDevice *imgu = stream->imgu_;
+		ImgUDevice::ImgUOutput *dev = stream->device_;
+
+		if (stream->raw_) {
+			std::vector<BufferMemory> &buffers = stream->buffers();
+			for (unsigned int i = 0; i < buffers.size(); ++i)
+				buffers[i].planes() = pool->buffers()[i].planes();
+			continue;
+		}
+
+		if (stream->memoryType() == InternalMemory)
+			ret = imgu->exportOutputBuffers(dev, &stream->bufferPool());
+		else
+			ret = imgu->importOutputBuffers(dev, &stream->bufferPool());
+		if (ret)
+			goto error;
+	}
+
+	/*
+	 * Allocate buffers also on non-active outputs; use the same number
+	 * of buffers as the active ones.
+	 */
+	bufferCount = outStream->active_ ? outStream->configuration().bufferCount
+		    : vfStream->configuration().bufferCount;
+
+	for (ImgUDevice *imgu : data->imgus_) {
+		for (ImgUDevice::ImgUOutput *output : { &imgu->output_, &imgu->viewfinder_ }) {
+			if ((outStream->active_ && output == outStream->device_) ||
+			    (vfStream->active_ && output == vfStream->device_))
+				continue;
+
+			output->pool->createBuffers(bufferCount);
+			ret = imgu->exportOutputBuffers(output, output->pool);
+			if (ret)
+				goto error;
+
+			/* The CPU never reads the non-active outputs. */
+			for (BufferMemory &mem : output->pool->buffers())
+				mem.setDeviceOnly(true);
+		}
+	}
+
+	return 0;
+
+error:
+	freeBuffers(camera, streams);
 
 	return ret;
 }
@@ -704,8 +1248,30 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera,
 {
 	IPU3CameraData *data = cameraData(camera);
 
+	while (!data->statBuffers_.empty()) {
+		delete data->statBuffers_.front();
+		data->statBuffers_.pop();
+	}
+
+	while (!data->paramBuffers_.empty()) {
+		delete data->paramBuffers_.front();
+		data->paramBuffers_.pop();
+	}
+
+	if (!data->ipaBuffers_.empty()) {
+		std::vector<unsigned int> ids;
+		for (IPABuffer &ipabuf : data->ipaBuffers_)
+			ids.push_back(ipabuf.id);
+
+		data->ipa_->unmapBuffers(ids);
+		data->ipaBuffers_.clear();
+	}
+
 	data->cio2_.freeBuffers();
-	data->imgu_->freeBuffers();
+	for (ImgUDevice *imgu : data->imgus_)
+		imgu->freeBuffers();
+
+	pools_->release(data);
 
 	return 0;
 }
@@ -714,22 +1280,51 @@ int PipelineHandlerIPU3::start(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
 	int ret;
 
+	data->imguInputPending_.assign(cio2->pool_->count(), 0);
+	data->frame_ = 0;
+	data->requestControls_.clear();
+
+	/* Inform the IPA of the stream configuration and sensor controls. */
+	std::map<unsigned int, IPAStream> streamConfig;
+	IPU3Stream *primary = data->outStream_.active_ ? &data->outStream_
+			    : &data->vfStream_;
+	streamConfig[0] = {
+		.pixelFormat = primary->configuration().pixelFormat,
+		.size = primary->configuration().size,
+	};
+
+	/* The IPA measures the statistics on the BDS output, pass its size. */
+	streamConfig[1] = {
+		.pixelFormat = primary->configuration().pixelFormat,
+		.size = data->imgu_->pipeConfig_.bds,
+	};
+
+	std::map<unsigned int, ControlInfoMap> entityControls;
+	entityControls.emplace(0, cio2->sensor_->controls());
+
+	data->ipa_->configure(std::move(streamConfig), std::move(entityControls));
+
 	/*
 	 * Start the ImgU video devices, buffers will be queued to the
 	 * ImgU output and viewfinder when requests will be queued.
 	 */
+	cio2->output_->resetQueueStats();
+	data->imgu_->input_->resetQueueStats();
+
 	ret = cio2->start(&data->rawBuffers_);
 	if (ret)
 		goto error;
 
-	ret = imgu->start();
-	if (ret) {
-		imgu->stop();
-		cio2->stop();
-		goto error;
+	for (ImgUDevice *imgu : data->imgus_) {
+		ret = imgu->start();
+		if (ret) {
+			for (ImgUDevice *used : data->imgus_)
+				used->stop();
+			cio2->stop();
+			goto error;
+		}
 	}
 
 	return 0;
@@ -746,28 +1341,97 @@ void PipelineHandlerIPU3::stop(Camera *camera)
 	IPU3CameraData *data = cameraData(camera);
 	int ret;
 
+	/*
+	 * Report how often the internal queues ran dry during the session,
+	 * frames are dropped at the sensor when the CIO2 has no buffer.
+	 */
+	logQueueStats("CIO2", data->cio2_.output_);
+	logQueueStats("ImgU input", data->imgu_->input_);
+
 	ret = data->cio2_.stop();
-	ret |= data->imgu_->stop();
+
+	/*
+	 * Hand the buffers of the requests that never got a frame to the
+	 * ImgU, stopping it then completes them in the cancelled state.
+	 */
+	while (!data->pendingRequests_.empty()) {
+		data->queueImgUBuffers(data->pendingRequests_.front());
+		data->pendingRequests_.pop();
+	}
+
+	for (ImgUDevice *imgu : data->imgus_)
+		ret |= imgu->stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera "
 				   << camera->name();
 
 	data->rawBuffers_.clear();
+	data->frameInfo_.clear([data](IPU3FrameInfo &info) {
+		data->paramBuffers_.push(info.paramBuffer);
+		data->statBuffers_.push(info.statBuffer);
+	});
+}
+
+void PipelineHandlerIPU3::logQueueStats(const char *name,
+					 const V4L2VideoDevice *dev)
+{
+	const V4L2VideoDevice::QueueStats &stats = dev->queueStats();
+	double average = stats.samples
+		       ? static_cast<double>(stats.depthSum) / stats.samples : 0;
+
+	LOG(IPU3, Info)
+		<< name << " queue ran dry " << stats.underruns << " times"
+		<< ", average depth " << std::fixed << std::setprecision(1)
+		<< average << ", maximum depth " << stats.maxDepth;
 }
 
 int PipelineHandlerIPU3::queueRequest(Camera *camera, Request *request)
 {
+	IPU3CameraData *data = cameraData(camera);
 	int error = 0;
 
+	IPU3FrameInfo *info = data->createFrameInfo(request);
+	if (!info)
+		return -ENOBUFS;
+
+	/*
+	 * Let the IPA fill the parameters for the frame. The parameters and
+	 * statistics buffers are queued to the ImgU when the parameters are
+	 * ready. The IPA retains the state of the controls it has been given,
+	 * only pass it the controls that changed since the previous request.
+	 */
+	IPAOperationData op;
+	op.operation = IPU3_IPA_EVENT_QUEUE_REQUEST;
+	op.data = { info->frame, IPU3_PARAM_BASE | info->paramBuffer->index() };
+	op.controls = { request->controls().delta(data->requestControls_) };
+	data->requestControls_.merge(request->controls());
+
+	data->ipa_->processEvent(std::move(op));
+
+	/*
+	 * Raw stream buffers are captured by the CIO2 directly. The buffers
+	 * of the processed streams are queued to the ImgU along with the next
+	 * CIO2 frame, see cio2BufferReady().
+	 */
+	bool processed = false;
+
 	for (auto it : request->buffers()) {
 		IPU3Stream *stream = static_cast<IPU3Stream *>(it.first);
 		Buffer *buffer = it.second;
 
-		int ret = stream->device_->dev->queueBuffer(buffer);
+		if (!stream->raw_) {
+			processed = true;
+			continue;
+		}
+
+		int ret = data->cio2_.output_->queueBuffer(buffer);
 		if (ret < 0)
 			error = ret;
 	}
 
+	if (processed)
+		data->pendingRequests_.push(request);
+
 	PipelineHandler::queueRequest(camera, request);
 
 	return error;
@@ -820,11 +1484,23 @@ bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 	if (ret)
 		return ret;
 
+	pools_ = utils::make_unique<BufferPoolManager>();
+	pools_->setIdlePeriod(standbyPeriod());
+
 	ret = registerCameras();
 
 	return ret == 0;
 }
 
+int PipelineHandlerIPU3::initCamera(Camera *camera)
+{
+	int ret = cameraData(camera)->loadIPA();
+	if (ret)
+		LOG(IPU3, Error) << "Failed to load IPA";
+
+	return ret;
+}
+
 /**
  * \brief Initialise ImgU and CIO2 devices associated with cameras
  *
@@ -847,25 +1523,53 @@ int PipelineHandlerIPU3::registerCameras()
 	if (ret)
 		return ret;
 
+	/*
+	 * Initialize the image sensors connected to all CSI-2 receivers
+	 * concurrently, as sensor probing dominates the time spent in match().
+	 */
+	std::vector<std::unique_ptr<CameraSensor>> sensors;
+	std::vector<unsigned int> sensorIds;
+	for (unsigned int id = 0; id < 4; ++id) {
+		MediaLink *link = CIO2Device::sensorLink(cio2MediaDev_, id);
+		if (!link)
+			continue;
+
+		sensors.emplace_back(new CameraSensor(link->source()->entity()));
+		sensorIds.push_back(id);
+	}
+
+	std::vector<CameraSensor *> pending;
+	for (const std::unique_ptr<CameraSensor> &sensor : sensors)
+		pending.push_back(sensor.get());
+
+	std::vector<int> results = CameraSensor::initAll(pending);
+
 	/*
 	 * For each CSI-2 receiver on the IPU3, create a Camera if an
 	 * image sensor is connected to it and the sensor can produce images
 	 * in a compatible format.
 	 */
 	unsigned int numCameras = 0;
-	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
+	for (unsigned int i = 0; i < sensors.size() && numCameras < 2; ++i) {
+		unsigned int id = sensorIds[i];
+		if (results[i])
+			continue;
+
 		std::unique_ptr<IPU3CameraData> data =
 			utils::make_unique<IPU3CameraData>(this);
 		std::set<Stream *> streams = {
 			&data->outStream_,
 			&data->vfStream_,
+			&data->rawStream_,
 		};
 		CIO2Device *cio2 = &data->cio2_;
 
-		ret = cio2->init(cio2MediaDev_, id);
+		ret = cio2->init(cio2MediaDev_, id, sensors[i].release());
 		if (ret)
 			continue;
 
+		pools_->addCamera(data.get(), 0);
+
 		/**
 		 * \todo Dynamically assign ImgU and output devices to each
 		 * stream and camera; as of now, limit support to two cameras
@@ -873,10 +1577,24 @@ int PipelineHandlerIPU3::registerCameras()
 		 * second.
 		 */
 		data->imgu_ = numCameras ? &imgu1_ : &imgu0_;
+		data->imgus_ = { data->imgu_ };
+		data->outStream_.imgu_ = data->imgu_;
 		data->outStream_.device_ = &data->imgu_->output_;
 		data->outStream_.name_ = "output";
+		data->vfStream_.imgu_ = data->imgu_;
 		data->vfStream_.device_ = &data->imgu_->viewfinder_;
 		data->vfStream_.name_ = "viewfinder";
+		data->rawStream_.raw_ = true;
+		data->rawStream_.name_ = "raw";
+
+		ControlInfoMap::Map ctrls;
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::AeEnable),
+			      std::forward_as_tuple(false, true));
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::AwbEnable),
+			      std::forward_as_tuple(false, true));
+		data->controlInfo_ = std::move(ctrls);
 
 		/*
 		 * Connect video devices' 'bufferReady' signals to their
@@ -885,15 +1603,16 @@ int PipelineHandlerIPU3::registerCameras()
 		 * Frames produced by the CIO2 unit are passed to the
 		 * associated ImgU input where they get processed and
 		 * returned through the ImgU main and secondary outputs.
+		 * Frames captured to raw stream buffers are returned to
+		 * the application directly. As ImgUs can be shared between
+		 * cameras, their signals are connected at configure time.
 		 */
 		data->cio2_.output_->bufferReady.connect(data.get(),
 					&IPU3CameraData::cio2BufferReady);
-		data->imgu_->input_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguInputBufferReady);
-		data->imgu_->output_.dev->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->viewfinder_.dev->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
+
+		/* Keep the sensor powered in standby, it's slow to power up. */
+		data->standbyDevices_.push_back(
+			utils::make_unique<RuntimePM>(cio2->sensor_->entity()));
 
 		/* Create and register the Camera instance. */
 		std::string cameraName = cio2->sensor_->entity()->name() + " "
@@ -915,21 +1634,212 @@ int PipelineHandlerIPU3::registerCameras()
 	return numCameras ? 0 : -ENODEV;
 }
 
+int IPU3CameraData::loadIPA()
+{
+	ipa_ = IPAManager::instance()->createIPA(pipe_, 1, 1);
+	if (!ipa_)
+		return -ENOENT;
+
+	ipa_->queueFrameAction.connect(this,
+				       &IPU3CameraData::queueFrameAction);
+
+	return 0;
+}
+
+void IPU3CameraData::queueFrameAction(unsigned int frame,
+				      IPAOperationData &&action)
+{
+	switch (action.operation) {
+	case IPU3_IPA_ACTION_V4L2_SET: {
+		/*
+		 * \todo Apply the controls with the sensor delays taken into
+		 * account, to synchronize them with \a frame.
+		 */
+		cio2_.sensor_->setControls(&action.controls[0]);
+		break;
+	}
+	case IPU3_IPA_ACTION_PARAM_FILLED: {
+		IPU3FrameInfo *info = frameInfo_.find(frame);
+		if (!info)
+			break;
+
+		/* Queue the parameters ahead of the frame they apply to. */
+		if (!imgu_->param_->queueBuffer(info->paramBuffer))
+			info->paramQueued = true;
+
+		if (imgu_->stat_.dev->queueBuffer(info->statBuffer))
+			info->metadataProcessed = true;
+		break;
+	}
+	case IPU3_IPA_ACTION_METADATA:
+		metadataReady(frame, std::move(action.controls[0]));
+		break;
+	default:
+		LOG(IPU3, Error) << "Unknown action " << action.operation;
+		break;
+	}
+}
+
+/**
+ * \brief Retrieve the ImgU pipe configuration for \a pipe
+ * \param[in] pipe The ImgU pipe sizes
+ *
+ * The configuration is computed the first time \a pipe is seen and cached for
+ * the lifetime of the camera, as the sensor doesn't change.
+ *
+ * \return The ImgU pipe configuration
+ */
+const ImgUDevice::PipeConfig &IPU3CameraData::pipeConfig(const ImgUDevice::Pipe &pipe) const
+{
+	auto key = std::make_tuple(pipe.input, pipe.main, pipe.viewfinder);
+
+	auto it = pipeConfigs_.find(key);
+	if (it != pipeConfigs_.end())
+		return it->second;
+
+	ImgUDevice::PipeConfig config = ImgUDevice::calculatePipeConfig(pipe);
+	return pipeConfigs_.emplace(key, config).first->second;
+}
+
+void IPU3CameraData::metadataReady(unsigned int frame,
+				   ControlList &&metadata)
+{
+	IPU3FrameInfo *info = frameInfo_.find(frame);
+	if (!info)
+		return;
+
+	info->request->metadata() = std::move(metadata);
+	info->metadataProcessed = true;
+
+	pipe_->traceRequest(info->request, Request::StageIPAAction);
+
+	tryCompleteRequest(info->request);
+}
+
+IPU3FrameInfo *IPU3CameraData::createFrameInfo(Request *request)
+{
+	if (paramBuffers_.empty() || statBuffers_.empty()) {
+		LOG(IPU3, Error) << "Parameters or statistics buffer underrun";
+		return nullptr;
+	}
+
+	IPU3FrameInfo *info = frameInfo_.create(frame_, request);
+	if (!info) {
+		LOG(IPU3, Error) << "Too many frames in flight";
+		return nullptr;
+	}
+
+	info->paramBuffer = paramBuffers_.front();
+	info->statBuffer = statBuffers_.front();
+	info->paramQueued = false;
+	info->metadataProcessed = false;
+
+	paramBuffers_.pop();
+	statBuffers_.pop();
+	frame_++;
+
+	return info;
+}
+
+void IPU3CameraData::destroyFrameInfo(IPU3FrameInfo *info)
+{
+	paramBuffers_.push(info->paramBuffer);
+	statBuffers_.push(info->statBuffer);
+
+	frameInfo_.destroy(info);
+}
+
+/*
+ * Complete \a request once all its buffers have completed, the IPA has
+ * produced its metadata and the ImgU has consumed its parameters.
+ */
+void IPU3CameraData::tryCompleteRequest(Request *request)
+{
+	IPU3FrameInfo *info = frameInfo_.find(request);
+	if (!info)
+		return;
+
+	if (request->hasPendingBuffers())
+		return;
+
+	if (!info->metadataProcessed || info->paramQueued)
+		return;
+
+	/*
+	 * Release the frame context first, the request may be requeued from
+	 * the completion handler.
+	 */
+	destroyFrameInfo(info);
+
+	pipe_->completeRequest(camera_, request);
+}
+
 /* -----------------------------------------------------------------------------
  * Buffer Ready slots
  */
 
+/**
+ * \brief Route the buffer completion signals of an ImgU to the camera
+ * \param[in] imgu The ImgU
+ *
+ * The ImgUs are assigned to cameras when they are configured, disconnect the
+ * signals from the camera that used \a imgu last.
+ */
+void IPU3CameraData::connectImgU(ImgUDevice *imgu)
+{
+	imgu->input_->bufferReady.disconnect();
+	imgu->param_->bufferReady.disconnect();
+	imgu->output_.dev->bufferReady.disconnect();
+	imgu->viewfinder_.dev->bufferReady.disconnect();
+	imgu->stat_.dev->bufferReady.disconnect();
+
+	imgu->input_->bufferReady.connect(this,
+					  &IPU3CameraData::imguInputBufferReady);
+	imgu->param_->bufferReady.connect(this,
+					  &IPU3CameraData::imguParamBufferReady);
+	imgu->output_.dev->bufferReady.connect(this,
+					       &IPU3CameraData::imguOutputBufferReady);
+	imgu->viewfinder_.dev->bufferReady.connect(this,
+						   &IPU3CameraData::imguOutputBufferReady);
+	imgu->stat_.dev->bufferReady.connect(this,
+					     &IPU3CameraData::imguStatBufferReady);
+}
+
+/**
+ * \brief Queue the buffers of the processed streams of a request to the ImgU
+ * \param[in] request The request
+ */
+void IPU3CameraData::queueImgUBuffers(Request *request)
+{
+	for (auto it : request->buffers()) {
+		IPU3Stream *stream = static_cast<IPU3Stream *>(it.first);
+		Buffer *buffer = it.second;
+
+		if (stream->raw_)
+			continue;
+
+		int ret = stream->device_->dev->queueBuffer(buffer);
+		if (ret < 0)
+			LOG(IPU3, Error)
+				<< "Failed to queue buffer to " << stream->name_;
+	}
+}
+
 /**
  * \brief Handle buffers completion at the ImgU input
  * \param[in] buffer The completed buffer
  *
- * Buffers completed from the ImgU input are immediately queued back to the
- * CIO2 unit to continue frame capture.
+ * Buffers completed from the ImgU inputs are queued back to the CIO2 unit to
+ * continue frame capture once all the ImgUs have processed them.
  */
 void IPU3CameraData::imguInputBufferReady(Buffer *buffer)
 {
 	/* \todo Handle buffer failures when state is set to BufferError. */
-	if (buffer->status() == Buffer::BufferCancelled)
+	if (buffer->status() == Buffer::BufferCancelled && !imguRestarting_)
+		return;
+
+	unsigned int &pending = imguInputPending_[buffer->index()];
+	if (pending && --pending)
 		return;
 
 	cio2_.output_->queueBuffer(buffer);
@@ -945,28 +1855,93 @@ void IPU3CameraData::imguOutputBufferReady(Buffer *buffer)
 {
 	Request *request = buffer->request();
 
-	if (!pipe_->completeBuffer(camera_, request, buffer))
-		/* Request not completed yet, return here. */
+	pipe_->completeBuffer(camera_, request, buffer);
+	tryCompleteRequest(request);
+}
+
+/**
+ * \brief Handle buffers completion at the ImgU parameters input
+ * \param[in] buffer The completed buffer
+ *
+ * The parameters buffer is returned to the pool when the request completes.
+ */
+void IPU3CameraData::imguParamBufferReady(Buffer *buffer)
+{
+	IPU3FrameInfo *info = frameInfo_.findIf([buffer](const IPU3FrameInfo &i) {
+		return i.paramBuffer == buffer;
+	});
+	if (!info)
+		return;
+
+	info->paramQueued = false;
+	tryCompleteRequest(info->request);
+}
+
+/**
+ * \brief Handle buffers completion at the ImgU statistics output
+ * \param[in] buffer The completed buffer
+ *
+ * Statistics are passed to the IPA, which computes the sensor controls for the
+ * next frames and the metadata of the request.
+ */
+void IPU3CameraData::imguStatBufferReady(Buffer *buffer)
+{
+	IPU3FrameInfo *info = frameInfo_.findIf([buffer](const IPU3FrameInfo &i) {
+		return i.statBuffer == buffer;
+	});
+	if (!info)
 		return;
 
-	/* Mark the request as complete. */
-	pipe_->completeRequest(camera_, request);
+	if (buffer->status() == Buffer::BufferCancelled) {
+		info->metadataProcessed = true;
+		tryCompleteRequest(info->request);
+		return;
+	}
+
+	IPAOperationData op;
+	op.operation = IPU3_IPA_EVENT_SIGNAL_STAT_BUFFER;
+	op.data = { info->frame, IPU3_STAT_BASE | buffer->index() };
+	ipa_->processEvent(std::move(op));
 }
 
 /**
  * \brief Handle buffers completion at the CIO2 output
  * \param[in] buffer The completed buffer
  *
- * Buffers completed from the CIO2 are immediately queued to the ImgU unit
- * for further processing.
+ * Buffers completed from the CIO2 are immediately queued to the ImgU units
+ * for further processing. Buffers belonging to the raw stream are instead
+ * completed to the application, and return to the CIO2 when queued again in
+ * a new request.
+ *
+ * Each frame is paired with the oldest request waiting for one, whose ImgU
+ * buffers are queued right before the frame. All the processed streams of a
+ * request are thus produced from the same CIO2 frame, which lets applications
+ * add a still capture buffer to any request of a running video stream without
+ * reconfiguring the pipeline. Frames that no request waits for are still
+ * processed by the ImgUs, to keep the statistics flowing to the IPA.
  */
 void IPU3CameraData::cio2BufferReady(Buffer *buffer)
 {
+	Request *request = buffer->request();
+	if (request) {
+		pipe_->completeBuffer(camera_, request, buffer);
+		tryCompleteRequest(request);
+		return;
+	}
+
 	/* \todo Handle buffer failures when state is set to BufferError. */
 	if (buffer->status() == Buffer::BufferCancelled)
 		return;
 
-	imgu_->input_->queueBuffer(buffer);
+	if (!pendingRequests_.empty()) {
+		queueImgUBuffers(pendingRequests_.front());
+		pendingRequests_.pop();
+	}
+
+	imguInputPending_[buffer->index()] = imgus_.size();
+
+	for (ImgUDevice *imgu : imgus_)
+		imgu->input_->queueBuffer(buffer);
 }
 
 /* -----------------------------------------------------------------------------
@@ -1009,6 +1984,11 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 	if (ret)
 		return ret;
 
+	param_ = V4L2VideoDevice::fromEntityName(media, name_ + " parameters");
+	ret = param_->open();
+	if (ret)
+		return ret;
+
 	output_.dev = V4L2VideoDevice::fromEntityName(media, name_ + " output");
 	ret = output_.dev->open();
 	if (ret)
@@ -1035,18 +2015,185 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 
 	stat_.pad = PAD_STAT;
 	stat_.name = "stat";
-	stat_.pool = &statPool_;
+	stat_.pool = nullptr;
 
 	return 0;
 }
 
+/**
+ * \brief Describe an ImgU pipe
+ * \param[in] input The ImgU input frame size
+ * \param[in] main The configuration of the output stream, if any
+ * \param[in] viewfinder The configuration of the viewfinder stream, if any
+ *
+ * At least one of \a main and \a viewfinder shall be provided. When the pipe
+ * produces a single stream, it is considered as the main one.
+ *
+ * \return The ImgU pipe
+ */
+ImgUDevice::Pipe ImgUDevice::pipe(const Size &input,
+				  const StreamConfiguration *main,
+				  const StreamConfiguration *viewfinder)
+{
+	Pipe pipe;
+
+	pipe.input = input;
+	pipe.main = main ? main->size : viewfinder->size;
+	if (main && viewfinder)
+		pipe.viewfinder = viewfinder->size;
+
+	return pipe;
+}
+
+namespace {
+
+constexpr unsigned int IF_ALIGN_W = 2;
+constexpr unsigned int IF_ALIGN_H = 4;
+constexpr unsigned int IF_CROP_MAX_W = 40;
+constexpr unsigned int IF_CROP_MAX_H = 540;
+constexpr unsigned int BDS_ALIGN_W = 2;
+constexpr unsigned int BDS_ALIGN_H = 4;
+constexpr unsigned int BDS_FACTOR_MAX = 80;
+constexpr unsigned int GDC_ALIGN_W = 8;
+constexpr unsigned int GDC_ALIGN_H = 4;
+constexpr unsigned int FILTER_W = 4;
+constexpr unsigned int FILTER_H = 4;
+
+/*
+ * Compute the GDC output size for \a pipe. The GDC output shall cover all the
+ * outputs, which the YUV scaler downscales from it.
+ */
+Size gdcSize(const ImgUDevice::Pipe &pipe)
+{
+	const Size &in = pipe.input;
+	const Size &main = pipe.main;
+	const Size &vf = pipe.viewfinder;
+	Size gdc;
+
+	if (vf.width && vf.height) {
+		unsigned int height = main.width * vf.height / vf.width;
+		gdc.width = main.width;
+		gdc.height = (std::max(main.height, height) + GDC_ALIGN_H - 1)
+			   & ~(GDC_ALIGN_H - 1);
+		return gdc;
+	}
+
+	/*
+	 * If the output aspect ratio differs from the input one, the GDC crops
+	 * the BDS output to the output size. Otherwise split the downscaling
+	 * between the BDS, for up to a factor of 2, and the YUV scaler, which
+	 * reduces the bandwidth after the BDS without losing field of view.
+	 */
+	float inRatio = static_cast<float>(in.width) / in.height;
+	float mainRatio = static_cast<float>(main.width) / main.height;
+	if (fabs(inRatio - mainRatio) > 0.1)
+		return main;
+
+	float totalFactor = static_cast<float>(in.width) / main.width;
+	float yuvFactor = totalFactor > 2 ? totalFactor / 2 : totalFactor;
+
+	gdc.width = static_cast<unsigned int>(main.width * yuvFactor);
+	gdc.height = static_cast<unsigned int>(main.height * yuvFactor);
+
+	/* Leave room for the ImgU filters around the GDC output. */
+	gdc.width = std::min(gdc.width, in.width - FILTER_W * 2);
+	gdc.height = std::min(gdc.height, in.height - FILTER_H * 2);
+
+	gdc.width = std::max(gdc.width & ~(GDC_ALIGN_W - 1), main.width);
+	gdc.height = std::max(gdc.height & ~(GDC_ALIGN_H - 1), main.height);
+
+	return gdc;
+}
+
+} /* namespace */
+
+/**
+ * \brief Compute the ImgU pipe configuration for \a pipe
+ * \param[in] pipe The ImgU pipe sizes
+ *
+ * Search the input feeder crop and BDS scaling factor that maximize the field
+ * of view of the GDC output, and among those the smallest BDS output, which
+ * the rest of the pipe processes. The BDS scales by a factor between 1 and
+ * 2.5 in steps of 1/32 and shall output integer sizes, and the GDC output
+ * shall leave room for the ImgU filters in the BDS output.
+ *
+ * If no configuration satisfies the constraints, the function falls back to
+ * processing the full input without any BDS scaling, leaving the scaling to
+ * the ImgU driver.
+ *
+ * The search is expensive enough to be performed once per pipe, see
+ * IPU3CameraData::pipeConfig().
+ *
+ * \return The ImgU pipe configuration
+ */
+ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(const Pipe &pipe)
+{
+	const Size &in = pipe.input;
+	Size gdc = gdcSize(pipe);
+
+	PipeConfig best = { BDS_FACTOR_DENOMINATOR, in, in, in };
+	bool found = false;
+
+	unsigned int minIfWidth = in.width > IF_CROP_MAX_W
+				? in.width - IF_CROP_MAX_W : IF_ALIGN_W;
+	unsigned int minIfHeight = in.height > IF_CROP_MAX_H
+				 ? in.height - IF_CROP_MAX_H : IF_ALIGN_H;
+
+	for (unsigned int ifWidth = in.width & ~(IF_ALIGN_W - 1);
+	     ifWidth >= minIfWidth; ifWidth -= IF_ALIGN_W) {
+		for (unsigned int factor = BDS_FACTOR_DENOMINATOR;
+		     factor <= BDS_FACTOR_MAX; ++factor) {
+			/* The GDC output covers gdc * factor input pixels. */
+			if (found && factor < best.bdsFactor)
+				continue;
+
+			if ((ifWidth * BDS_FACTOR_DENOMINATOR) % factor)
+				continue;
+
+			unsigned int bdsWidth = ifWidth * BDS_FACTOR_DENOMINATOR
+					      / factor;
+			if (bdsWidth % BDS_ALIGN_W ||
+			    bdsWidth < gdc.width + FILTER_W * 2)
+				continue;
+
+			for (unsigned int ifHeight = in.height & ~(IF_ALIGN_H - 1);
+			     ifHeight >= minIfHeight; ifHeight -= IF_ALIGN_H) {
+				if ((ifHeight * BDS_FACTOR_DENOMINATOR) % factor)
+					continue;
+
+				unsigned int bdsHeight = ifHeight * BDS_FACTOR_DENOMINATOR
+						       / factor;
+				if (bdsHeight % BDS_ALIGN_H ||
+				    bdsHeight < gdc.height + FILTER_H * 2)
+					continue;
+
+				if (found && factor == best.bdsFactor &&
+				    bdsWidth * bdsHeight >= best.bds.width * best.bds.height)
+					continue;
+
+				best = { factor, { ifWidth, ifHeight },
+					 { bdsWidth, bdsHeight }, gdc };
+				found = true;
+			}
+		}
+	}
+
+	if (!found)
+		LOG(IPU3, Debug)
+			<< "No ImgU pipe configuration for "
+			<< in.toString() << " -> " << pipe.main.toString()
+			<< ", processing the full input";
+
+	return best;
+}
+
 /**
  * \brief Configure the ImgU unit input
- * \param[in] size The ImgU input frame size
+ * \param[in] config The ImgU pipe configuration
  * \param[in] inputFormat The format to be applied to ImgU input
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::configureInput(const Size &size,
+int ImgUDevice::configureInput(const PipeConfig &config,
 			       V4L2DeviceFormat *inputFormat)
 {
 	/* Configure the ImgU input video device with the requested sizes. */
@@ -1062,30 +2209,33 @@ int ImgUDevice::configureInput(const Size &size,
 	 * GDC output sizes to configure the crop/compose rectangles.
 	 *
 	 * The current IPU3 driver implementation uses GDC sizes as the
-	 * 'ImgU Input' subdevice sizes, and the input video device sizes
-	 * to configure the crop/compose rectangles, contradicting the
-	 * V4L2 specification.
+	 * 'ImgU Input' subdevice sizes, and the crop and compose rectangles
+	 * as the input feeder and BDS output sizes, contradicting the V4L2
+	 * specification.
 	 */
 	Rectangle rect = {
 		.x = 0,
 		.y = 0,
-		.w = inputFormat->size.width,
-		.h = inputFormat->size.height,
+		.w = config.iif.width,
+		.h = config.iif.height,
 	};
 	ret = imgu_->setCrop(PAD_INPUT, &rect);
 	if (ret)
 		return ret;
 
+	LOG(IPU3, Debug) << "ImgU input feeder rectangle = " << rect.toString();
+
+	rect.w = config.bds.width;
+	rect.h = config.bds.height;
 	ret = imgu_->setCompose(PAD_INPUT, &rect);
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "ImgU input feeder and BDS rectangle = "
-			 << rect.toString();
+	LOG(IPU3, Debug) << "ImgU BDS rectangle = " << rect.toString();
 
 	V4L2SubdeviceFormat imguFormat = {};
 	imguFormat.mbus_code = MEDIA_BUS_FMT_FIXED;
-	imguFormat.size = size;
+	imguFormat.size = config.gdc;
 
 	ret = imgu_->setFormat(PAD_INPUT, &imguFormat);
 	if (ret)
@@ -1116,6 +2266,8 @@ int ImgUDevice::configureOutput(ImgUOutput *output,
 	if (ret)
 		return ret;
 
+	output->size = cfg.size;
+
 	/* No need to apply format to the stat node. */
 	if (output == &stat_)
 		return 0;
@@ -1135,6 +2287,45 @@ int ImgUDevice::configureOutput(ImgUOutput *output,
 	return 0;
 }
 
+/**
+ * \brief Reconfigure an ImgU output and reallocate its buffers
+ * \param[in] output The ImgU output device to reconfigure
+ * \param[in] cfg The requested configuration
+ * \param[in] pool The buffer pool associated with \a output
+ * \param[in] import True to import buffers from \a pool, false to export them
+ *
+ * The ImgU shall be stopped when calling this method.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int ImgUDevice::reconfigureOutput(ImgUOutput *output,
+				  const StreamConfiguration &cfg,
+				  BufferPool *pool, bool import)
+{
+	unsigned int count = pool->count();
+
+	/* Exported buffers can't be freed while mapped. */
+	if (!import)
+		pool->destroyBuffers();
+
+	int ret = output->dev->releaseBuffers();
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to release ImgU "
+				 << output->name << " buffers";
+		return ret;
+	}
+
+	ret = configureOutput(output, cfg);
+	if (ret)
+		return ret;
+
+	if (import)
+		return importOutputBuffers(output, pool);
+
+	pool->createBuffers(count);
+	return exportOutputBuffers(output, pool);
+}
+
 /**
  * \brief Import buffers from \a pool into the ImgU input
  * \param[in] pool The buffer pool to import
@@ -1215,9 +2406,23 @@ void ImgUDevice::freeBuffers()
 	if (ret)
 		LOG(IPU3, Error) << "Failed to release ImgU viewfinder buffers";
 
+	ret = param_->releaseBuffers();
+	if (ret)
+		LOG(IPU3, Error) << "Failed to release ImgU parameters buffers";
+
 	ret = input_->releaseBuffers();
 	if (ret)
 		LOG(IPU3, Error) << "Failed to release ImgU input buffers";
+
+	/*
+	 * Drop the exported buffers of the non-active outputs, they would
+	 * otherwise keep their memory allocated until the next allocation.
+	 */
+	outPool_.destroyBuffers();
+	vfPool_.destroyBuffers();
+
+	paramPool_ = nullptr;
+	stat_.pool = nullptr;
 }
 
 int ImgUDevice::start()
@@ -1243,6 +2448,12 @@ int ImgUDevice::start()
 		return ret;
 	}
 
+	ret = param_->streamOn();
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to start ImgU parameters";
+		return ret;
+	}
+
 	ret = input_->streamOn();
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to start ImgU input";
@@ -1254,27 +2465,26 @@ int ImgUDevice::start()
 
 int ImgUDevice::stop()
 {
-	int ret;
-
-	ret = output_.dev->streamOff();
-	ret |= viewfinder_.dev->streamOff();
-	ret |= stat_.dev->streamOff();
-	ret |= input_->streamOff();
-
-	return ret;
+	/*
+	 * The CIO2 has been stopped already, no new frame reaches the ImgU.
+	 * Stop all its video nodes concurrently.
+	 */
+	return V4L2VideoDevice::streamOff({ output_.dev, viewfinder_.dev,
+					    stat_.dev, param_, input_ });
 }
 
 /**
- * \brief Enable or disable a single link on the ImgU instance
+ * \brief Add a single link of the ImgU instance to a link setup
  *
- * This method assumes the media device associated with the ImgU instance
- * is open.
+ * The link and its requested state \a enable are appended to \a links, to be
+ * applied with MediaDevice::setupLinks().
  *
  * \return 0 on success or a negative error code otherwise
  */
 int ImgUDevice::linkSetup(const std::string &source, unsigned int sourcePad,
 			  const std::string &sink, unsigned int sinkPad,
-			  bool enable)
+			  bool enable,
+			  std::vector<std::pair<MediaLink *, bool>> *links)
 {
 	MediaLink *link = media_->link(source, sourcePad, sink, sinkPad);
 	if (!link) {
@@ -1284,39 +2494,50 @@ int ImgUDevice::linkSetup(const std::string &source, unsigned int sourcePad,
 		return -ENODEV;
 	}
 
-	return link->setEnabled(enable);
+	links->emplace_back(link, enable);
+
+	return 0;
 }
 
 /**
  * \brief Enable or disable all media links in the ImgU instance to prepare
  * for capture operations
  *
+ * The links are appended to \a links, to be set up along with the links of
+ * the other ImgU instance in a single MediaDevice::setupLinks() call.
+ *
  * \todo This method will probably be removed or changed once links will be
  * enabled or disabled selectively.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::enableLinks(bool enable)
+int ImgUDevice::enableLinks(bool enable,
+			    std::vector<std::pair<MediaLink *, bool>> *links)
 {
 	std::string viewfinderName = name_ + " viewfinder";
 	std::string outputName = name_ + " output";
 	std::string statName = name_ + " 3a stat";
 	std::string inputName = name_ + " input";
+	std::string paramName = name_ + " parameters";
 	int ret;
 
-	ret = linkSetup(inputName, 0, name_, PAD_INPUT, enable);
+	ret = linkSetup(inputName, 0, name_, PAD_INPUT, enable, links);
+	if (ret)
+		return ret;
+
+	ret = linkSetup(paramName, 0, name_, PAD_PARAM, enable, links);
 	if (ret)
 		return ret;
 
-	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable);
+	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable, links);
 	if (ret)
 		return ret;
 
-	ret = linkSetup(name_, PAD_VF, viewfinderName, 0, enable);
+	ret = linkSetup(name_, PAD_VF, viewfinderName, 0, enable, links);
 	if (ret)
 		return ret;
 
-	return linkSetup(name_, PAD_STAT, statName, 0, enable);
+	return linkSetup(name_, PAD_STAT, statName, 0, enable, links);
 }
 
 /*------------------------------------------------------------------------------
@@ -1324,44 +2545,61 @@ int ImgUDevice::enableLinks(bool enable)
  */
 
 /**
- * \brief Initialize components of the CIO2 device with \a index
+ * \brief Retrieve the link between an image sensor and the CIO2 with \a index
  * \param[in] media The CIO2 media device
  * \param[in] index The CIO2 device index
  *
- * Create and open the video device and subdevices in the CIO2 instance at \a
- * index, if a supported image sensor is connected to the CSI-2 receiver of
- * this CIO2 instance.  Enable the media links connecting the CIO2 components
- * to prepare for capture operations and cached the sensor maximum size.
- *
- * \return 0 on success or a negative error code otherwise
- * \retval -ENODEV No supported image sensor is connected to this CIO2 instance
+ * \return The media link connecting the image sensor to the CSI-2 receiver of
+ * the CIO2 instance at \a index, or nullptr if no sensor is connected
  */
-int CIO2Device::init(const MediaDevice *media, unsigned int index)
+MediaLink *CIO2Device::sensorLink(const MediaDevice *media, unsigned int index)
 {
-	int ret;
-
-	/*
-	 * Verify that a sensor subdevice is connected to this CIO2 instance
-	 * and enable the media link between the two.
-	 */
 	std::string csi2Name = "ipu3-csi2 " + std::to_string(index);
 	MediaEntity *csi2Entity = media->getEntityByName(csi2Name);
 	const std::vector<MediaPad *> &pads = csi2Entity->pads();
 	if (pads.empty())
-		return -ENODEV;
+		return nullptr;
 
 	/* IPU3 CSI-2 receivers have a single sink pad at index 0. */
 	MediaPad *sink = pads[0];
 	const std::vector<MediaLink *> &links = sink->links();
 	if (links.empty())
+		return nullptr;
+
+	return links[0];
+}
+
+/**
+ * \brief Initialize components of the CIO2 device with \a index
+ * \param[in] media The CIO2 media device
+ * \param[in] index The CIO2 device index
+ * \param[in] sensor The initialized image sensor connected to the CIO2
+ *
+ * Create and open the video device and subdevices in the CIO2 instance at \a
+ * index, if the image \a sensor connected to the CSI-2 receiver of this CIO2
+ * instance is supported. Enable the media links connecting the CIO2 components
+ * to prepare for capture operations and cached the sensor maximum size.
+ *
+ * The CIO2 device takes ownership of the \a sensor, which shall have been
+ * initialized by the caller.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV No supported image sensor is connected to this CIO2 instance
+ */
+int CIO2Device::init(const MediaDevice *media, unsigned int index,
+		     CameraSensor *sensor)
+{
+	int ret;
+
+	sensor_ = sensor;
+
+	/* Enable the media link between the sensor and this CIO2 instance. */
+	MediaLink *link = sensorLink(media, index);
+	if (!link || link->source()->entity() != sensor_->entity())
 		return -ENODEV;
 
-	MediaLink *link = links[0];
-	MediaEntity *sensorEntity = link->source()->entity();
-	sensor_ = new CameraSensor(sensorEntity);
-	ret = sensor_->init();
-	if (ret)
-		return ret;
+	std::string csi2Name = "ipu3-csi2 " + std::to_string(index);
+	MediaEntity *csi2Entity = media->getEntityByName(csi2Name);
 
 	ret = link->setEnabled(true);
 	if (ret)
@@ -1403,6 +2641,26 @@ int CIO2Device::init(const MediaDevice *media, unsigned int index)
 	if (ret)
 		return ret;
 
+	/*
+	 * The number of internal buffers sets the depth of the CIO2 and ImgU
+	 * input queues, independently of the number of buffers of the streams.
+	 * Workloads that hold buffers for a long time can increase it with the
+	 * LIBCAMERA_IPU3_CIO2_BUFFERS environment variable. The value is used
+	 * for the balanced queue profile, the other profiles use the minimum
+	 * and maximum counts.
+	 */
+	const char *count = utils::secure_getenv("LIBCAMERA_IPU3_CIO2_BUFFERS");
+	if (count && *count) {
+		char *end;
+		unsigned long value = strtoul(count, &end, 10);
+		if (*end || value < CIO2_MIN_BUFFER_COUNT || value > VIDEO_MAX_FRAME)
+			LOG(IPU3, Warning)
+				<< "Invalid CIO2 buffer count " << count
+				<< ", using " << nominalBufferCount_;
+		else
+			nominalBufferCount_ = value;
+	}
+
 	return 0;
 }
 
@@ -1449,24 +2707,40 @@ int CIO2Device::configure(const Size &size,
 }
 
 /**
- * \brief Allocate CIO2 memory buffers and export them in a BufferPool
+ * \brief Allocate CIO2 memory buffers from the pipeline handler pools
+ * \param[in] pools The pipeline handler pools
+ * \param[in] data The camera data
+ * \param[in] streamBufferCount The number of buffers for the raw stream
  *
- * Allocate memory buffers in the CIO2 video device and export them to
- * a buffer pool that can be imported by another device.
+ * Acquire the CIO2 pool of the camera \a data from the \a pools, and set the
+ * CIO2 video device up to capture to its buffers. The pool can be imported by
+ * another device. The first \a streamBufferCount buffers of the pool back the
+ * raw stream and are queued by requests, the internal buffers following them
+ * are queued when the CIO2 is started.
  *
- * \return The buffer pool with export buffers on success or nullptr otherwise
+ * \return The buffer pool on success or nullptr otherwise
  */
-BufferPool *CIO2Device::exportBuffers()
+BufferPool *CIO2Device::allocateBuffers(BufferPoolManager *pools,
+					const CameraData *data,
+					unsigned int streamBufferCount)
 {
-	pool_.createBuffers(CIO2_BUFFER_COUNT);
-
-	int ret = output_->exportBuffers(&pool_);
-	if (ret) {
-		LOG(IPU3, Error) << "Failed to export CIO2 buffers";
+	streamBufferCount_ = streamBufferCount;
+	pool_ = pools->acquire(data, "cio2", output_,
+			       streamBufferCount_ + bufferCount_);
+	if (!pool_) {
+		LOG(IPU3, Error) << "Failed to allocate CIO2 buffers";
 		return nullptr;
 	}
 
-	return &pool_;
+	/*
+	 * The internal buffers are only transferred to the ImgU, skip CPU
+	 * cache maintenance for them.
+	 */
+	std::vector<BufferMemory> &buffers = pool_->buffers();
+	for (unsigned int i = 0; i < buffers.size(); ++i)
+		buffers[i].setDeviceOnly(i >= streamBufferCount_);
+
+	return pool_;
 }
 
 void CIO2Device::freeBuffers()
@@ -1477,9 +2751,16 @@ void CIO2Device::freeBuffers()
 
 int CIO2Device::start(std::vector<std::unique_ptr<Buffer>> *buffers)
 {
-	*buffers = output_->queueAllBuffers();
-	if (buffers->empty())
-		return -EINVAL;
+	buffers->clear();
+
+	for (unsigned int i = streamBufferCount_; i < pool_->count(); ++i) {
+		Buffer *buffer = new Buffer(i);
+		buffers->emplace_back(buffer);
+
+		int ret = output_->queueBuffer(buffer);
+		if (ret)
+			return ret;
+	}
 
 	return output_->streamOn();
 }
@@ -1505,6 +2786,19 @@ int CIO2Device::mediaBusToFormat(unsigned int code)
 	}
 }
 
+bool CIO2Device::isRawFormat(unsigned int fourcc)
+{
+	switch (fourcc) {
+	case V4L2_PIX_FMT_IPU3_SBGGR10:
+	case V4L2_PIX_FMT_IPU3_SGBRG10:
+	case V4L2_PIX_FMT_IPU3_SGRBG10:
+	case V4L2_PIX_FMT_IPU3_SRGGB10:
+		return true;
+	default:
+		return false;
+	}
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerIPU3);
 
 } /* namespace libcamera */
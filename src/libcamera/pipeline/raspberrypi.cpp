@@ -5,15 +5,26 @@
  * raspberrypi.cpp - Pipeline handler for Raspberry Pi devices
  */
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
 #include <ipa/raspberrypi.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "buffer_pool_manager.h"
 #include "camera_sensor.h"
+#include "delayed_controls.h"
 #include "device_enumerator.h"
+#include "embedded_data.h"
 #include "ipa_manager.h"
+#include "ipa_state_store.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -23,67 +34,174 @@
 
 /* RPi Definition, not yet in UAPI */
 #define V4L2_META_FMT_STATS v4l2_fourcc('S', 'T', 'A', 'T')
+#define V4L2_META_FMT_SENSOR_DATA v4l2_fourcc('S', 'E', 'N', 'S')
 
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RPI)
 
+class RPiCameraData;
+
+struct RPiIspFormats {
+	V4L2DeviceFormat output;
+	V4L2DeviceFormat capture0;
+	V4L2DeviceFormat capture1;
+	V4L2DeviceFormat stats;
+};
+
+/*
+ * The ISP devices, shared by all the cameras of the pipeline handler. A single
+ * camera owns the ISP from buffer allocation to buffer release, and the ISP is
+ * reconfigured with the formats of the camera when it changes hands.
+ */
+class RPiIsp
+{
+public:
+	RPiIsp()
+		: output_(nullptr), capture0_(nullptr), capture1_(nullptr),
+		  stats_(nullptr), owner_(nullptr), configured_(nullptr)
+	{
+	}
+
+	~RPiIsp()
+	{
+		delete output_;
+		delete capture0_;
+		delete capture1_;
+		delete stats_;
+	}
+
+	int open(MediaDevice *media);
+
+	V4L2VideoDevice *output_;
+	V4L2VideoDevice *capture0_;
+	V4L2VideoDevice *capture1_;
+	V4L2VideoDevice *stats_;
+
+	/* The camera using the ISP, and the camera it is configured for. */
+	RPiCameraData *owner_;
+	RPiCameraData *configured_;
+};
+
 class RPiCameraData : public CameraData
 {
 public:
 	RPiCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), sensor_(nullptr), unicam_(nullptr)
+		: CameraData(pipe), sensor_(nullptr), unicam_(nullptr),
+		  frameStartEnabled_(false), embedded_(nullptr),
+		  embeddedActive_(false), isp_(nullptr), vfActive_(false),
+		  zslFrames_(0), zslTimestamp_(0), heldFrame_(nullptr),
+		  nextManualFrame_(0), ispInputs_(0), ispRequests_(0),
+		  bayerPool_(nullptr), vfPool_(nullptr), statsPool_(nullptr)
 	{
 	}
 
 	~RPiCameraData()
 	{
-		bayerBuffers_.destroyBuffers();
 		delete sensor_;
 		delete unicam_;
-
-		/* Perhaps move this to an ISP container class or struct */
-		delete isp_.output_;
-		delete isp_.capture0_;
-		delete isp_.capture1_;
-		delete isp_.stats_;
+		delete embedded_;
 	}
 
+	void frameStarted(uint32_t sequence, uint64_t timestamp);
 	void sensorReady(Buffer *buffer);
+	void embeddedReady(Buffer *buffer);
 	void ispOutputReady(Buffer *buffer);
 	void ispCaptureReady(Buffer *buffer);
 	void ispViewFinderReady(Buffer *buffer);
 	void ispStatsReady(Buffer *buffer);
 
+	void dispatchRequests();
+	void queueIspInput(Buffer *buffer);
+	void retainFrame(Buffer *buffer);
+
 	int loadIPA();
-	void queueFrameAction(unsigned int frame,
-			      const IPAOperationData &action);
+	void queueFrameAction(unsigned int frame, IPAOperationData &&action);
 
-	void metadataReady(unsigned int frame, const ControlList &metadata);
+	void metadataReady(unsigned int frame, ControlList &&metadata);
+	ControlList sensorMetadata(uint64_t timestamp) const;
 
 	CameraSensor *sensor_;
 	V4L2VideoDevice *unicam_;
 
-	struct {
-		V4L2VideoDevice *output_;
-		V4L2VideoDevice *capture0_;
-		V4L2VideoDevice *capture1_;
-		V4L2VideoDevice *stats_;
-	} isp_;
+	/*
+	 * Sensor controls set by the IPA, applied at the frame they target.
+	 * Frame start events, when supported by the receiver, trigger the
+	 * writes, the end of the previous frame is used otherwise.
+	 */
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+	bool frameStartEnabled_;
+
+	/*
+	 * Sensor embedded data, when supported by the sensor, indexed by the
+	 * timestamp of the frames. The ISP copies the timestamp of its input
+	 * buffers to the corresponding capture and statistics buffers.
+	 */
+	V4L2VideoDevice *embedded_;
+	std::unique_ptr<EmbeddedDataParser> parser_;
+	bool embeddedActive_;
+	BufferPool embeddedPool_;
+	std::vector<std::unique_ptr<Buffer>> embeddedBuffers_;
+	std::map<uint64_t, SensorMetadata> sensorMetadata_;
+
+	/* The ISP shared by all cameras and the formats for this camera. */
+	RPiIsp *isp_;
+	RPiIspFormats ispFormats_;
 
 	Stream stream_;
+	Stream vfStream_;
+	bool vfActive_;
 
-	/* Sensor Capture buffers */
-	BufferPool bayerBuffers_;
+	/* Sensor Capture buffers, from the pools shared between cameras */
 	std::vector<std::unique_ptr<Buffer>> rawBuffers_;
 
-	/* View-finder buffers */
-	BufferPool vfPool_;
-	std::vector<std::unique_ptr<Buffer>> vfBuffers_;
+	/*
+	 * Requests are queued to the ISP in order, and are processed with its
+	 * inputs in order.
+	 *
+	 * Zero shutter lag capture. The raw frames processed by the ISP are
+	 * retained, ordered by timestamp, before being requeued to unicam.
+	 * Requests selecting a retained frame wait with the following ones in
+	 * pendingRequests_ until all the requests queued to the ISP have an
+	 * input, for the frame to be processed to their buffers.
+	 *
+	 * Manual exposure. Requests setting the SensorExposure or
+	 * SensorAnalogueGain controls override the sensor controls of a single
+	 * frame, and wait in the same way for that frame, held in heldFrame_
+	 * when it's captured. Consecutive requests target consecutive frames.
+	 */
+	struct PendingRequest {
+		Request *request;
+		bool manual;
+		uint32_t sequence;
+	};
+
+	unsigned int zslFrames_;
+	std::deque<Buffer *> zslRing_;
+	std::deque<PendingRequest> pendingRequests_;
+	uint64_t zslTimestamp_;
+	Buffer *heldFrame_;
+	uint32_t nextManualFrame_;
+	unsigned int ispInputs_;
+	unsigned int ispRequests_;
 
-	/* ISP statistics buffers */
-	BufferPool statsPool_;
+	/*
+	 * The internal pools, acquired from the pipeline handler pools when
+	 * the buffers are allocated:
+	 * - the Bayer frames, between unicam and the ISP,
+	 * - the view-finder buffers, when the viewfinder stream isn't used,
+	 * - the ISP statistics buffers, shared with the IPA.
+	 */
+	BufferPool *bayerPool_;
+	BufferPool *vfPool_;
+	BufferPool *statsPool_;
+
+	std::vector<std::unique_ptr<Buffer>> vfBuffers_;
 	std::vector<std::unique_ptr<Buffer>> statsBuffers_;
+	std::vector<IPABuffer> ipaBuffers_;
+
+	/* Last converged state of the IPA algorithms. */
+	std::vector<uint32_t> ipaState_;
 };
 
 class RPiCameraConfiguration : public CameraConfiguration
@@ -117,6 +235,7 @@ public:
 	int queueRequest(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
+	int initCamera(Camera *camera) override;
 
 private:
 	RPiCameraData *cameraData(const Camera *camera)
@@ -125,10 +244,28 @@ private:
 			PipelineHandler::cameraData(camera));
 	}
 
-	std::shared_ptr<MediaDevice> unicam_;
-	std::shared_ptr<MediaDevice> isp_;
+	int createCamera(MediaDevice *unicam);
+	int configureIsp(RPiCameraData *data);
+
+	void ispOutputReady(Buffer *buffer);
+	void ispCaptureReady(Buffer *buffer);
+	void ispViewFinderReady(Buffer *buffer);
+	void ispStatsReady(Buffer *buffer);
+
+	std::vector<std::shared_ptr<MediaDevice>> unicamMedia_;
+	std::shared_ptr<MediaDevice> ispMedia_;
+	RPiIsp isp_;
+
+	/*
+	 * The intermediate buffers, shared by all cameras as they can't use
+	 * the ISP concurrently.
+	 */
+	std::unique_ptr<BufferPoolManager> pools_;
 };
 
+/* The number of raw frames that can be retained for zero shutter lag. */
+static constexpr unsigned int maxZslFrames = 8;
+
 RPiCameraConfiguration::RPiCameraConfiguration()
 	: CameraConfiguration()
 {
@@ -141,33 +278,73 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	/* todo: Experiment with increased stream support through the ISP. */
-	if (config_.size() > 1) {
-		config_.resize(1);
+	/*
+	 * The ISP produces two scaled outputs, the first configuration entry
+	 * maps to the main capture output and the second one to the viewfinder
+	 * output.
+	 */
+	if (config_.size() > 2) {
+		config_.resize(2);
 		status = Adjusted;
 	}
 
-	StreamConfiguration &cfg = config_[0];
+	if (zslFrames_ > maxZslFrames) {
+		zslFrames_ = maxZslFrames;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
+	/* Frame decimation isn't supported. */
+	for (StreamConfiguration &cfg : config_) {
+		if (cfg.frameDecimation != 1) {
+			cfg.frameDecimation = 1;
+			status = Adjusted;
+		}
+	}
 
 	/* todo: restrict to hardware capabilities. */
 
-	cfg.bufferCount = 4;
+	for (StreamConfiguration &cfg : config_)
+		cfg.bufferCount = queueDepth(2, 4, 8);
 
 	return status;
 }
 
+int RPiIsp::open(MediaDevice *media)
+{
+	output_ = new V4L2VideoDevice(media->getEntityByName("bcm2835-isp0-output0"));
+	int ret = output_->open();
+	if (ret)
+		return ret;
+
+	capture0_ = new V4L2VideoDevice(media->getEntityByName("bcm2835-isp0-capture1"));
+	ret = capture0_->open();
+	if (ret)
+		return ret;
+
+	capture1_ = new V4L2VideoDevice(media->getEntityByName("bcm2835-isp0-capture2"));
+	ret = capture1_->open();
+	if (ret)
+		return ret;
+
+	stats_ = new V4L2VideoDevice(media->getEntityByName("bcm2835-isp0-capture3"));
+	return stats_->open();
+}
+
 PipelineHandlerRPi::PipelineHandlerRPi(CameraManager *manager)
-	: PipelineHandler(manager), unicam_(nullptr), isp_(nullptr)
+	: PipelineHandler(manager), ispMedia_(nullptr)
 {
 }
 
 PipelineHandlerRPi::~PipelineHandlerRPi()
 {
-	if (unicam_)
-		unicam_->release();
+	for (std::shared_ptr<MediaDevice> &unicam : unicamMedia_)
+		unicam->release();
 
-	if (isp_)
-		isp_->release();
+	if (ispMedia_)
+		ispMedia_->release();
 }
 
 CameraConfiguration *
@@ -193,6 +370,16 @@ PipelineHandlerRPi::generateConfiguration(Camera *camera,
 
 	config->addConfiguration(cfg);
 
+	/* A second role is served by the low resolution viewfinder output. */
+	if (roles.size() > 1) {
+		StreamConfiguration vfCfg{};
+		vfCfg.pixelFormat = V4L2_PIX_FMT_YUYV;
+		vfCfg.size = { 640, 480 };
+		vfCfg.bufferCount = 4;
+
+		config->addConfiguration(vfCfg);
+	}
+
 	config->validate();
 
 	return config;
@@ -202,9 +389,14 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 {
 	RPiCameraData *data = cameraData(camera);
 	StreamConfiguration &cfg = config->at(0);
-	uint32_t unicam_fourcc;
 	int ret;
 
+	/* The ISP can't be reconfigured while another camera uses it. */
+	if (isp_.owner_ && isp_.owner_ != data) {
+		LOG(RPI, Error) << "ISP in use by another camera";
+		return -EBUSY;
+	}
+
 	Size sensorSize = { 1920, 1080 };
 	/*
 	 * Output size failed when it was set to 1088, should ISP accept this,
@@ -235,65 +427,113 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		return -EINVAL;
 	}
 
-	format.size = outputSize;
-	unicam_fourcc = format.fourcc;
-
-	ret = data->isp_.output_->setFormat(&format);
-	if (ret)
-		return ret;
-
-	if (format.size != outputSize ||
-	    format.fourcc != unicam_fourcc) {
-		LOG(RPI, Error) << "Failed to set format on ISP output device: "
-				<< format.toString();
-		return -EINVAL;
+	/*
+	 * Record the ISP formats for the camera, they're applied now and
+	 * again whenever the ISP has been reconfigured for another camera.
+	 *
+	 * The ISP input matches the unicam output. The ViewFinder channel
+	 * must be configured even when the application doesn't use it, in
+	 * which case it produces small frames to internal buffers.
+	 */
+	RPiIspFormats &formats = data->ispFormats_;
+
+	formats.output = {};
+	formats.output.size = outputSize;
+	formats.output.fourcc = format.fourcc;
+
+	formats.capture0 = {};
+	formats.capture0.size = cfg.size;
+	formats.capture0.fourcc = cfg.pixelFormat;
+
+	data->vfActive_ = config->size() > 1;
+
+	formats.capture1 = {};
+	if (data->vfActive_) {
+		const StreamConfiguration &vfCfg = config->at(1);
+		formats.capture1.size = vfCfg.size;
+		formats.capture1.fourcc = vfCfg.pixelFormat;
+	} else {
+		formats.capture1.size = { 320, 240 };
+		formats.capture1.fourcc = cfg.pixelFormat;
 	}
 
-	/* Configure the ISP to generate the requested size and format. */
-	format.size = cfg.size;
-	format.fourcc = cfg.pixelFormat;
-
-	ret = data->isp_.capture0_->setFormat(&format);
+	formats.stats = {};
+	formats.stats.fourcc = V4L2_META_FMT_STATS;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != cfg.pixelFormat) {
-		LOG(RPI, Error)
-			<< "Failed to set format on ISP capture device: "
-			<< format.toString();
-		return -EINVAL;
-	}
+	ret = configureIsp(data);
+	if (ret)
+		return ret;
 
 	cfg.setStream(&data->stream_);
+	if (data->vfActive_)
+		config->at(1).setStream(&data->vfStream_);
 
-	/* Configure the ViewFinder ISP stream. */
+	data->zslFrames_ = config->zslFrames();
 
-	/* We must configure the viewfinder ISP channel even though we don't
-	 * yet support multiple streams.
+	/*
+	 * Configure the embedded data format. Embedded data is optional, fall
+	 * back to capturing images only on failure.
 	 */
-
-	/* Fixed (small) viewfinder stream for small buffers initially */
-	format.size = { 320, 240 };
-	format.fourcc = cfg.pixelFormat;
-
-	ret = data->isp_.capture1_->setFormat(&format);
-	if (ret) {
-		LOG(RPI, Error)
-			<< "Failed to set format on viewfinder ISP: "
-			<< format.toString();
-		return ret;
+	data->embeddedActive_ = false;
+
+	if (data->embedded_) {
+		V4L2DeviceFormat embeddedFormat = {};
+		embeddedFormat.fourcc = V4L2_META_FMT_SENSOR_DATA;
+
+		ret = data->embedded_->setFormat(&embeddedFormat);
+		if (ret || embeddedFormat.fourcc != V4L2_META_FMT_SENSOR_DATA)
+			LOG(RPI, Warning)
+				<< "Failed to set embedded data format, sensor metadata disabled";
+		else
+			data->embeddedActive_ = true;
 	}
 
-	/* Configure the Stats buffer format */
-	format.fourcc = V4L2_META_FMT_STATS;
+	return 0;
+}
 
-	ret = data->isp_.stats_->setFormat(&format);
-	if (ret) {
-		LOG(RPI, Error)
-			<< "Failed to set format on ISP stats node: "
-			<< format.toString();
-		return ret;
+/*
+ * Apply the ISP formats of the camera \a data. This switches the ISP context
+ * to the camera, and must only be called when no other camera owns the ISP.
+ */
+int PipelineHandlerRPi::configureIsp(RPiCameraData *data)
+{
+	const RPiIspFormats &formats = data->ispFormats_;
+	const struct {
+		V4L2VideoDevice *video;
+		const V4L2DeviceFormat &format;
+		const char *name;
+	} nodes[] = {
+		{ isp_.output_, formats.output, "output" },
+		{ isp_.capture0_, formats.capture0, "capture" },
+		{ isp_.capture1_, formats.capture1, "viewfinder" },
+		{ isp_.stats_, formats.stats, "stats" },
+	};
+
+	isp_.configured_ = nullptr;
+
+	for (const auto &node : nodes) {
+		V4L2DeviceFormat format = node.format;
+
+		int ret = node.video->setFormat(&format);
+		if (ret) {
+			LOG(RPI, Error)
+				<< "Failed to set format on ISP " << node.name
+				<< " node: " << format.toString();
+			return ret;
+		}
+
+		/* The size of metadata formats is ignored. */
+		if (format.fourcc != node.format.fourcc ||
+		    (node.video != isp_.stats_ && format.size != node.format.size)) {
+			LOG(RPI, Error)
+				<< "Failed to set format on ISP " << node.name
+				<< " node: " << format.toString();
+			return -EINVAL;
+		}
 	}
 
+	isp_.configured_ = data;
+
 	return 0;
 }
 
@@ -301,49 +541,119 @@ int PipelineHandlerRPi::allocateBuffers(Camera *camera,
 					const std::set<Stream *> &streams)
 {
 	RPiCameraData *data = cameraData(camera);
-	Stream *stream = *streams.begin();
+	Stream *stream = &data->stream_;
 	const StreamConfiguration &cfg = stream->configuration();
 	int ret;
 
+	for (Stream *s : streams) {
+		if (s->memoryType() == UserPtrMemory) {
+			LOG(RPI, Error) << "User pointer memory not supported";
+			return -ENOTSUP;
+		}
+	}
+
+	/*
+	 * Take ownership of the ISP once the buffers are allocated, switching
+	 * it to the formats of this camera if it has been configured for
+	 * another one since.
+	 */
+	if (isp_.owner_ && isp_.owner_ != data) {
+		LOG(RPI, Error) << "ISP in use by another camera";
+		return -EBUSY;
+	}
+
+	if (isp_.configured_ != data) {
+		ret = configureIsp(data);
+		if (ret)
+			return ret;
+	}
+
 	/*
 	 * unicam -> isp.output |-> isp.capture0 -> Application
-	 *			|-> isp.capture1 -> (VF Not enabled, loopback)
+	 *			|-> isp.capture1 -> Application (VF), or loopback
 	 *			|-> isp.stats -> Internal IPA use only
 	 */
 
-	/* Create a new intermediate buffer pool. */
-	data->bayerBuffers_.createBuffers(cfg.bufferCount);
-
-	/* Tie the unicam video buffers to the intermediate pool. */
-	ret = data->unicam_->exportBuffers(&data->bayerBuffers_);
-	if (ret)
+	/*
+	 * Tie the unicam video buffers to the intermediate pool, with
+	 * additional buffers for the frames retained for zero shutter lag.
+	 */
+	data->bayerPool_ = pools_->acquire(data, "bayer", data->unicam_,
+					   cfg.bufferCount + data->zslFrames_);
+	if (!data->bayerPool_) {
+		ret = -ENOMEM;
 		return ret;
+	}
 
-	ret = data->isp_.output_->importBuffers(&data->bayerBuffers_);
+	ret = data->isp_->output_->importBuffers(data->bayerPool_);
 	if (ret)
 		return ret;
 
-	/* Create temporary internal buffers for the viewfinder stream */
-	data->vfPool_.createBuffers(cfg.bufferCount);
-	ret = data->isp_.capture1_->exportBuffers(&data->vfPool_);
+	/* The CPU never accesses the Bayer frames, skip cache maintenance. */
+	for (BufferMemory &mem : data->bayerPool_->buffers())
+		mem.setDeviceOnly(true);
+
+	/*
+	 * Tie the viewfinder stream buffers to the viewfinder capture device,
+	 * or create temporary internal buffers when the stream isn't used.
+	 */
+	if (data->vfActive_) {
+		Stream *vfStream = &data->vfStream_;
+
+		if (vfStream->memoryType() == InternalMemory)
+			ret = data->isp_->capture1_->exportBuffers(&vfStream->bufferPool());
+		else
+			ret = data->isp_->capture1_->importBuffers(&vfStream->bufferPool());
+	} else {
+		data->vfPool_ = pools_->acquire(data, "viewfinder",
+						data->isp_->capture1_,
+						cfg.bufferCount);
+		if (data->vfPool_) {
+			for (BufferMemory &mem : data->vfPool_->buffers())
+				mem.setDeviceOnly(true);
+		} else {
+			ret = -ENOMEM;
+		}
+	}
 	if (ret) {
 		LOG(RPI, Error) << "Failed to create Viewfinder buffers";
 		return ret;
 	}
 
 	/* Create internal buffers for the statistics stream */
-	data->statsPool_.createBuffers(cfg.bufferCount);
-	ret = data->isp_.stats_->exportBuffers(&data->statsPool_);
-	if (ret) {
+	data->statsPool_ = pools_->acquire(data, "stats", data->isp_->stats_,
+					   cfg.bufferCount);
+	if (!data->statsPool_) {
 		LOG(RPI, Error) << "Failed to create Statistics buffers";
+		ret = -ENOMEM;
 		return ret;
 	}
 
+	if (data->embeddedActive_) {
+		data->embeddedPool_.createBuffers(cfg.bufferCount);
+		ret = data->embedded_->exportBuffers(&data->embeddedPool_);
+		if (ret) {
+			LOG(RPI, Warning)
+				<< "Failed to create embedded data buffers, sensor metadata disabled";
+			data->embeddedPool_.destroyBuffers();
+			data->embeddedActive_ = false;
+		}
+	}
+
+	for (unsigned int i = 0; i < data->statsPool_->count(); i++)
+		data->ipaBuffers_.push_back({ .id = i,
+					      .memory = data->statsPool_->buffers()[i] });
+
+	data->ipa_->mapBuffers(data->ipaBuffers_);
+
 	/* Tie the stream buffers to the capture device of the ISP. */
 	if (stream->memoryType() == InternalMemory)
-		ret = data->isp_.capture0_->exportBuffers(&stream->bufferPool());
+		ret = data->isp_->capture0_->exportBuffers(&stream->bufferPool());
 	else
-		ret = data->isp_.capture0_->importBuffers(&stream->bufferPool());
+		ret = data->isp_->capture0_->importBuffers(&stream->bufferPool());
+
+	if (!ret)
+		isp_.owner_ = data;
 
 	return ret;
 }
@@ -354,19 +664,48 @@ int PipelineHandlerRPi::freeBuffers(Camera *camera,
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
+	std::vector<unsigned int> ids;
+	for (IPABuffer &ipabuf : data->ipaBuffers_)
+		ids.push_back(ipabuf.id);
+
+	data->ipa_->unmapBuffers(ids);
+	data->ipaBuffers_.clear();
+
 	ret = data->unicam_->releaseBuffers();
 	if (ret)
 		return ret;
 
-	ret = data->isp_.output_->releaseBuffers();
+	ret = data->isp_->output_->releaseBuffers();
+	if (ret)
+		return ret;
+
+	ret = data->isp_->capture0_->releaseBuffers();
 	if (ret)
 		return ret;
 
-	ret = data->isp_.capture0_->releaseBuffers();
+	ret = data->isp_->capture1_->releaseBuffers();
 	if (ret)
 		return ret;
 
-	data->bayerBuffers_.destroyBuffers();
+	ret = data->isp_->stats_->releaseBuffers();
+	if (ret)
+		return ret;
+
+	if (data->embeddedActive_) {
+		ret = data->embedded_->releaseBuffers();
+		if (ret)
+			return ret;
+
+		data->embeddedPool_.destroyBuffers();
+	}
+
+	pools_->release(data);
+	data->bayerPool_ = nullptr;
+	data->vfPool_ = nullptr;
+	data->statsPool_ = nullptr;
+
+	/* Hand the ISP over to the other cameras. */
+	isp_.owner_ = nullptr;
 
 	return ret;
 }
@@ -374,7 +713,6 @@ int PipelineHandlerRPi::freeBuffers(Camera *camera,
 int PipelineHandlerRPi::start(Camera *camera)
 {
 	RPiCameraData *data = cameraData(camera);
-	ControlList controls(data->sensor_->controls());
 	int ret;
 
 	data->rawBuffers_ = data->unicam_->queueAllBuffers();
@@ -383,49 +721,92 @@ int PipelineHandlerRPi::start(Camera *camera)
 		return -EINVAL;
 	}
 
-	/* Queue internal viewfinder buffers. */
-	data->vfBuffers_ = data->isp_.capture1_->queueAllBuffers();
-	if (data->rawBuffers_.empty()) {
-		LOG(RPI, Debug) << "Failed to queue viewfinder buffers";
-		ret = -EINVAL;
-		goto err;
+	/*
+	 * Queue internal viewfinder buffers, the application provides them
+	 * through requests when it uses the viewfinder stream.
+	 */
+	if (!data->vfActive_) {
+		data->vfBuffers_ = data->isp_->capture1_->queueAllBuffers();
+		if (data->vfBuffers_.empty()) {
+			LOG(RPI, Debug) << "Failed to queue viewfinder buffers";
+			ret = -EINVAL;
+			goto err;
+		}
 	}
 
 	/* Queue internal ISP buffers. */
-	data->statsBuffers_ = data->isp_.stats_->queueAllBuffers();
+	data->statsBuffers_ = data->isp_->stats_->queueAllBuffers();
 	if (data->statsBuffers_.empty()) {
 		LOG(RPI, Debug) << "Failed to queue internal ISP buffers";
 		ret = -EINVAL;
 		goto err;
 	}
 
-	LOG(RPI, Warning) << "Using hard-coded exposure/gain defaults";
-
-	controls.set(V4L2_CID_EXPOSURE, 1700);
-	controls.set(V4L2_CID_ANALOGUE_GAIN, 180);
-	ret = data->sensor_->setControls(&controls);
-	if (ret) {
-		LOG(RPI, Error) << "Failed to set controls";
-		goto err;
+	/*
+	 * Inform the IPA of the stream configuration and sensor controls. It
+	 * sets the initial exposure and gain, and then updates them from the
+	 * ISP statistics.
+	 */
+	{
+		std::map<unsigned int, IPAStream> streamConfig;
+		streamConfig[0] = {
+			.pixelFormat = data->stream_.configuration().pixelFormat,
+			.size = data->stream_.configuration().size,
+		};
+
+		if (data->vfActive_)
+			streamConfig[1] = {
+				.pixelFormat = data->vfStream_.configuration().pixelFormat,
+				.size = data->vfStream_.configuration().size,
+			};
+
+		std::map<unsigned int, ControlInfoMap> entityControls;
+		entityControls.emplace(0, data->sensor_->controls());
+
+		ret = data->delayedCtrls_->reset();
+		if (ret)
+			goto err;
+
+		data->ipa_->configure(std::move(streamConfig), std::move(entityControls));
+
+		/*
+		 * Start the algorithms from their last converged state, from
+		 * this process or from a previous one.
+		 */
+		if (!data->ipaState_.empty() ||
+		    IPAStateStore::instance()->lookup(camera->name(), &data->ipaState_)) {
+			IPAOperationData state;
+			state.operation = RPI_IPA_EVENT_RESTORE_STATE;
+			state.data = data->ipaState_;
+			data->ipa_->processEvent(std::move(state));
+		}
 	}
 
-	/* A clean (reduced line count) implementation below would be nice. */
-
-	ret = data->isp_.output_->streamOn();
+	/*
+	 * Start all the ISP nodes concurrently, Unicam is started last and
+	 * feeds the ISP once it is ready.
+	 */
+	ret = V4L2VideoDevice::streamOn({ data->isp_->output_,
+					  data->isp_->capture0_,
+					  data->isp_->capture1_,
+					  data->isp_->stats_ });
 	if (ret)
 		goto err;
 
-	ret = data->isp_.capture0_->streamOn();
-	if (ret)
-		goto err;
+	if (data->embeddedActive_) {
+		data->embeddedBuffers_ = data->embedded_->queueAllBuffers();
+		if (data->embeddedBuffers_.empty()) {
+			LOG(RPI, Debug) << "Failed to queue embedded data buffers";
+			ret = -EINVAL;
+			goto err;
+		}
 
-	ret = data->isp_.capture1_->streamOn();
-	if (ret)
-		goto err;
+		ret = data->embedded_->streamOn();
+		if (ret)
+			goto err;
+	}
 
-	ret = data->isp_.stats_->streamOn();
-	if (ret)
-		goto err;
+	data->frameStartEnabled_ = !data->unicam_->setFrameStartEnabled(true);
 
 	ret = data->unicam_->streamOn();
 	if (ret)
@@ -443,33 +824,90 @@ void PipelineHandlerRPi::stop(Camera *camera)
 {
 	RPiCameraData *data = cameraData(camera);
 
-	data->isp_.stats_->streamOff();
-	data->isp_.capture1_->streamOff();
-	data->isp_.capture0_->streamOff();
-	data->isp_.output_->streamOff();
+	/*
+	 * Stop the source first so that no new frame reaches the ISP, then stop
+	 * all the ISP nodes concurrently.
+	 */
 	data->unicam_->streamOff();
+	data->unicam_->setFrameStartEnabled(false);
+	data->frameStartEnabled_ = false;
+	if (data->embeddedActive_)
+		data->embedded_->streamOff();
+
+	V4L2VideoDevice::streamOff({ data->isp_->output_, data->isp_->capture0_,
+				     data->isp_->capture1_, data->isp_->stats_ });
+
+	/* Cancel the requests still waiting for their frame. */
+	for (const RPiCameraData::PendingRequest &pending : data->pendingRequests_) {
+		Request *request = pending.request;
+
+		for (auto it : request->buffers())
+			cancelBuffer(camera, request, it.second);
+
+		completeRequest(camera, request);
+	}
+
+	data->pendingRequests_.clear();
+	data->zslRing_.clear();
+	data->zslTimestamp_ = 0;
+	data->heldFrame_ = nullptr;
+	data->nextManualFrame_ = 0;
+	data->ispInputs_ = 0;
+	data->ispRequests_ = 0;
 
 	data->rawBuffers_.clear();
+	data->embeddedBuffers_.clear();
+	data->sensorMetadata_.clear();
+	data->vfBuffers_.clear();
+	data->statsBuffers_.clear();
+
+	if (!data->ipaState_.empty())
+		IPAStateStore::instance()->store(camera->name(), data->ipaState_);
 }
 
 int PipelineHandlerRPi::queueRequest(Camera *camera, Request *request)
 {
 	RPiCameraData *data = cameraData(camera);
-	Stream *stream = &data->stream_;
 
-	Buffer *buffer = request->findBuffer(stream);
-	if (!buffer) {
+	Buffer *buffer = request->findBuffer(&data->stream_);
+	Buffer *vfBuffer = data->vfActive_
+			 ? request->findBuffer(&data->vfStream_) : nullptr;
+	if (!buffer && !vfBuffer) {
 		LOG(RPI, Error)
 			<< "Attempt to queue request with invalid stream";
 		return -ENOENT;
 	}
 
-	int ret = data->isp_.capture0_->queueBuffer(buffer);
-	if (ret < 0)
-		return ret;
-
 	PipelineHandler::queueRequest(camera, request);
 
+	/* Override the sensor controls of the frame the request targets. */
+	const ControlList &controls = request->controls();
+	RPiCameraData::PendingRequest pending = { request, false, 0 };
+
+	if (controls.contains(controls::SensorExposure) ||
+	    controls.contains(controls::SensorAnalogueGain)) {
+		ControlList ctrls(data->sensor_->controls());
+		if (controls.contains(controls::SensorExposure))
+			ctrls.set(V4L2_CID_EXPOSURE,
+				  controls.get(controls::SensorExposure));
+		if (controls.contains(controls::SensorAnalogueGain))
+			ctrls.set(V4L2_CID_ANALOGUE_GAIN,
+				  controls.get(controls::SensorAnalogueGain));
+
+		uint32_t sequence = data->nextManualFrame_;
+		if (data->delayedCtrls_->pushFrame(ctrls, &sequence)) {
+			pending.manual = true;
+			pending.sequence = sequence;
+			data->nextManualFrame_ = sequence + 1;
+		} else {
+			LOG(RPI, Warning)
+				<< "Failed to apply manual sensor controls";
+		}
+	}
+
+	data->pendingRequests_.push_back(pending);
+	data->dispatchRequests();
+
 	return 0;
 }
 
@@ -486,50 +924,68 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	isp.add("bcm2835-isp0-capture2"); /* ViewFinder */
 	isp.add("bcm2835-isp0-capture3"); /* Stats */
 
-	unicam_ = enumerator->search(unicam);
-	if (!unicam_)
+	ispMedia_ = enumerator->search(isp);
+	if (!ispMedia_)
 		return false;
 
-	isp_ = enumerator->search(isp);
-	if (!isp_)
+	ispMedia_->acquire();
+
+	if (isp_.open(ispMedia_.get()))
 		return false;
 
-	unicam_->acquire();
-	isp_->acquire();
+	/* Unicam and the ISP require physically contiguous memory. */
+	pools_ = utils::make_unique<BufferPoolManager>(DmaHeap::Cma);
+	pools_->setIdlePeriod(standbyPeriod());
 
-	std::unique_ptr<RPiCameraData> data = utils::make_unique<RPiCameraData>(this);
+	isp_.output_->bufferReady.connect(this, &PipelineHandlerRPi::ispOutputReady);
+	isp_.capture0_->bufferReady.connect(this, &PipelineHandlerRPi::ispCaptureReady);
+	isp_.capture1_->bufferReady.connect(this, &PipelineHandlerRPi::ispViewFinderReady);
+	isp_.stats_->bufferReady.connect(this, &PipelineHandlerRPi::ispStatsReady);
 
-	/* Locate and open the unicam video node. */
-	data->unicam_ = new V4L2VideoDevice(unicam_->getEntityByName("unicam"));
-	if (data->unicam_->open())
-		return false;
+	/*
+	 * The ISP is a memory-to-memory device, share it between the cameras
+	 * of all the Unicam receivers.
+	 */
+	unsigned int numCameras = 0;
+	std::shared_ptr<MediaDevice> unicamMedia;
 
-	/* Open the ISP video nodes. */
-	data->isp_.output_ = new V4L2VideoDevice(isp_->getEntityByName("bcm2835-isp0-output0"));
-	if (data->isp_.output_->open())
-		return false;
+	while ((unicamMedia = enumerator->search(unicam))) {
+		unicamMedia->acquire();
+		unicamMedia_.push_back(unicamMedia);
 
-	data->isp_.capture0_ = new V4L2VideoDevice(isp_->getEntityByName("bcm2835-isp0-capture1"));
-	if (data->isp_.capture0_->open())
-		return false;
+		if (!createCamera(unicamMedia.get()))
+			numCameras++;
+	}
 
-	data->isp_.capture1_ = new V4L2VideoDevice(isp_->getEntityByName("bcm2835-isp0-capture2"));
-	if (data->isp_.capture1_->open())
-		return false;
+	return numCameras != 0;
+}
 
-	data->isp_.stats_ = new V4L2VideoDevice(isp_->getEntityByName("bcm2835-isp0-capture3"));
-	if (data->isp_.stats_->open())
-		return false;
+int PipelineHandlerRPi::initCamera(Camera *camera)
+{
+	int ret = cameraData(camera)->loadIPA();
+	if (ret)
+		LOG(RPI, Error) << "Failed to load a suitable IPA library";
+
+	return ret;
+}
+
+int PipelineHandlerRPi::createCamera(MediaDevice *unicam)
+{
+	std::unique_ptr<RPiCameraData> data = utils::make_unique<RPiCameraData>(this);
+	data->isp_ = &isp_;
+
+	/* Locate and open the unicam video node. */
+	data->unicam_ = new V4L2VideoDevice(unicam->getEntityByName("unicam"));
+	if (data->unicam_->open())
+		return -ENODEV;
 
-	/* Wire up all the buffer connections */
 	data->unicam_->bufferReady.connect(data.get(), &RPiCameraData::sensorReady);
-	data->isp_.output_->bufferReady.connect(data.get(), &RPiCameraData::ispOutputReady);
-	data->isp_.capture0_->bufferReady.connect(data.get(), &RPiCameraData::ispCaptureReady);
-	data->isp_.capture1_->bufferReady.connect(data.get(), &RPiCameraData::ispViewFinderReady);
-	data->isp_.stats_->bufferReady.connect(data.get(), &RPiCameraData::ispStatsReady);
+	data->unicam_->frameStart.connect(data.get(), &RPiCameraData::frameStarted);
+
+	pools_->addCamera(data.get(), 0);
 
 	/* Identify the sensor */
-	for (MediaEntity *entity : unicam_->entities()) {
+	for (MediaEntity *entity : unicam->entities()) {
 		if (entity->function() == MEDIA_ENT_F_CAM_SENSOR) {
 			data->sensor_ = new CameraSensor(entity);
 			break;
@@ -537,23 +993,82 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	}
 
 	if (!data->sensor_)
-		return false;
+		return -ENODEV;
 
-	if (data->sensor_->init())
-		return false;
+	int ret = data->sensor_->init();
+	if (ret)
+		return ret;
 
-	if (data->loadIPA()) {
-		LOG(RPI, Error) << "Failed to load a suitable IPA library";
-		return false;
+	/*
+	 * The supported sensors apply the exposure two frames after it is
+	 * written, and the analogue gain one frame after.
+	 */
+	std::unordered_map<uint32_t, unsigned int> delays = {
+		{ V4L2_CID_EXPOSURE, 2 },
+		{ V4L2_CID_ANALOGUE_GAIN, 1 },
+	};
+	data->delayedCtrls_ = utils::make_unique<DelayedControls>(data->sensor_, delays);
+
+	/*
+	 * Capture the sensor embedded data when both the receiver and the
+	 * sensor support it.
+	 */
+	MediaEntity *embedded = unicam->getEntityByName("unicam-embedded");
+	if (embedded)
+		data->parser_ = EmbeddedDataParser::create(data->sensor_->entity()->name());
+
+	if (data->parser_) {
+		data->embedded_ = new V4L2VideoDevice(embedded);
+		if (data->embedded_->open()) {
+			delete data->embedded_;
+			data->embedded_ = nullptr;
+			data->parser_.reset();
+		} else {
+			data->embedded_->bufferReady.connect(data.get(), &RPiCameraData::embeddedReady);
+		}
 	}
 
 	/* Create and register the camera. */
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{ &data->stream_, &data->vfStream_ };
 	std::shared_ptr<Camera> camera =
 		Camera::create(this, data->sensor_->entity()->name(), streams);
 	registerCamera(std::move(camera), std::move(data));
 
-	return true;
+	return 0;
+}
+
+/*
+ * The ISP is shared between the cameras, deliver its buffers to the camera
+ * that currently owns it.
+ */
+void PipelineHandlerRPi::ispOutputReady(Buffer *buffer)
+{
+	if (isp_.owner_)
+		isp_.owner_->ispOutputReady(buffer);
+}
+
+void PipelineHandlerRPi::ispCaptureReady(Buffer *buffer)
+{
+	if (isp_.owner_)
+		isp_.owner_->ispCaptureReady(buffer);
+}
+
+void PipelineHandlerRPi::ispViewFinderReady(Buffer *buffer)
+{
+	if (isp_.owner_)
+		isp_.owner_->ispViewFinderReady(buffer);
+}
+
+void PipelineHandlerRPi::ispStatsReady(Buffer *buffer)
+{
+	if (isp_.owner_)
+		isp_.owner_->ispStatsReady(buffer);
+}
+
+void RPiCameraData::frameStarted(uint32_t sequence, uint64_t timestamp)
+{
+	delayedCtrls_->applyControls(sequence);
+	pipe_->startRequest(camera_, timestamp);
 }
 
 void RPiCameraData::sensorReady(Buffer *buffer)
@@ -562,8 +1077,98 @@ void RPiCameraData::sensorReady(Buffer *buffer)
 	if (buffer->status() == Buffer::BufferCancelled)
 		return;
 
-	/* Deliver the frame from the sensor to the ISP. */
-	isp_.output_->queueBuffer(buffer);
+	if (!frameStartEnabled_)
+		delayedCtrls_->applyControls(buffer->sequence() + 1);
+
+	/*
+	 * Without embedded data, report the sensor controls the frame has
+	 * been captured with as applied by the delayed controls.
+	 */
+	if (!embeddedActive_) {
+		ControlList ctrls = delayedCtrls_->get(buffer->sequence());
+		SensorMetadata metadata = {};
+		if (ctrls.contains(V4L2_CID_EXPOSURE))
+			metadata.exposure = ctrls.get(V4L2_CID_EXPOSURE).get<int32_t>();
+		if (ctrls.contains(V4L2_CID_ANALOGUE_GAIN))
+			metadata.gain = ctrls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>();
+
+		sensorMetadata_[buffer->timestamp()] = metadata;
+		while (sensorMetadata_.size() > rawBuffers_.size() * 2)
+			sensorMetadata_.erase(sensorMetadata_.begin());
+	}
+
+	/*
+	 * Hold the frame a manual request waits for, and deliver the other
+	 * frames to the ISP when requests queued to the ISP wait for an input,
+	 * or when no request waits for the ISP to process a specific frame.
+	 */
+	if (!pendingRequests_.empty() && pendingRequests_.front().manual &&
+	    buffer->sequence() >= pendingRequests_.front().sequence &&
+	    !heldFrame_) {
+		heldFrame_ = buffer;
+		dispatchRequests();
+		return;
+	}
+
+	if (pendingRequests_.empty() || ispRequests_ > ispInputs_)
+		queueIspInput(buffer);
+	else
+		retainFrame(buffer);
+}
+
+void RPiCameraData::embeddedReady(Buffer *buffer)
+{
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	BufferMemory &mem = embeddedPool_.buffers()[buffer->index()];
+	Plane &plane = mem.planes()[0];
+
+	SensorMetadata metadata;
+	int ret;
+	{
+		CpuAccess access(mem, Plane::AccessRead);
+		ret = parser_->parse(static_cast<const uint8_t *>(plane.mem()),
+				     std::min(buffer->bytesused(), plane.length()),
+				     &metadata);
+	}
+
+	if (!ret) {
+		sensorMetadata_[buffer->timestamp()] = metadata;
+
+		/* Drop the metadata of the frames that got lost on the way. */
+		while (sensorMetadata_.size() >
+		       (embeddedPool_.count() + zslFrames_) * 2)
+			sensorMetadata_.erase(sensorMetadata_.begin());
+	} else {
+		LOG(RPI, Debug) << "Failed to parse embedded data";
+	}
+
+	embedded_->queueBuffer(buffer);
+}
+
+/*
+ * Retrieve the sensor settings the frame with the \a timestamp has been
+ * captured with, as an empty list if they're unknown.
+ */
+ControlList RPiCameraData::sensorMetadata(uint64_t timestamp) const
+{
+	ControlList controls(controls::controls);
+
+	auto it = sensorMetadata_.find(timestamp);
+	if (it == sensorMetadata_.end())
+		return controls;
+
+	const SensorMetadata &metadata = it->second;
+	controls.set(controls::SensorExposure,
+		     static_cast<int32_t>(metadata.exposure));
+	controls.set(controls::SensorAnalogueGain,
+		     static_cast<int32_t>(metadata.gain));
+	if (metadata.frameLength)
+		controls.set(controls::SensorFrameLength,
+			     static_cast<int32_t>(metadata.frameLength));
+
+	return controls;
 }
 
 void RPiCameraData::ispOutputReady(Buffer *buffer)
@@ -573,27 +1178,173 @@ void RPiCameraData::ispOutputReady(Buffer *buffer)
 		return;
 
 	/* Return a completed buffer from the ISP back to the sensor. */
-	unicam_->queueBuffer(buffer);
+	ispInputs_--;
+	retainFrame(buffer);
+	dispatchRequests();
 }
 
 void RPiCameraData::ispCaptureReady(Buffer *buffer)
 {
 	Request *request = buffer->request();
+	bool cancelled = buffer->status() == Buffer::BufferCancelled;
+
+	if (!cancelled)
+		request->metadata().merge(sensorMetadata(buffer->timestamp()));
+
+	if (!pipe_->completeBuffer(camera_, request, buffer))
+		return;
 
-	pipe_->completeBuffer(camera_, request, buffer);
 	pipe_->completeRequest(camera_, request);
+
+	if (!cancelled) {
+		ispRequests_--;
+		dispatchRequests();
+	}
 }
 
 void RPiCameraData::ispViewFinderReady(Buffer *buffer)
 {
-	/* Simply requeue buffer for now */
-	isp_.capture1_->queueBuffer(buffer);
+	if (vfActive_) {
+		ispCaptureReady(buffer);
+		return;
+	}
+
+	/* Requeue internal buffers when the viewfinder stream isn't used. */
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	isp_->capture1_->queueBuffer(buffer);
 }
 
 void RPiCameraData::ispStatsReady(Buffer *buffer)
 {
-	/* Simply requeue buffer for now */
-	isp_.stats_->queueBuffer(buffer);
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	/*
+	 * The statistics of retained frames processed again describe past
+	 * scenes, don't feed them to the algorithms.
+	 */
+	if (buffer->timestamp() == zslTimestamp_) {
+		isp_->stats_->queueBuffer(buffer);
+		return;
+	}
+
+	/*
+	 * The IPA consumes the statistics in processEvent(), the buffer can be
+	 * requeued right after.
+	 */
+	IPAOperationData op;
+	op.operation = RPI_IPA_EVENT_SIGNAL_STAT_BUFFER;
+	op.data = { buffer->sequence(), buffer->index() };
+	op.controls.push_back(sensorMetadata(buffer->timestamp()));
+	ipa_->processEvent(std::move(op));
+
+	isp_->stats_->queueBuffer(buffer);
+}
+
+/*
+ * Queue the pending requests to the ISP, in order. A request selecting a
+ * retained frame with the ZslTimestamp control, or waiting for the frame its
+ * manual sensor controls apply to, is only queued when all the requests queued
+ * to the ISP have an input, with its frame as the next ISP input. The frame is
+ * then guaranteed to be processed to the buffers of the request.
+ */
+void RPiCameraData::dispatchRequests()
+{
+	while (!pendingRequests_.empty()) {
+		PendingRequest pending = pendingRequests_.front();
+		Request *request = pending.request;
+		Buffer *raw = nullptr;
+
+		if (pending.manual) {
+			if (!heldFrame_ || ispInputs_ != ispRequests_)
+				return;
+
+			raw = heldFrame_;
+			heldFrame_ = nullptr;
+		} else if (zslFrames_ && request->controls().contains(controls::ZslTimestamp)) {
+			if (ispInputs_ != ispRequests_)
+				return;
+
+			uint64_t timestamp = request->controls().get(controls::ZslTimestamp);
+			auto it = std::find_if(zslRing_.begin(), zslRing_.end(),
+					       [timestamp](const Buffer *frame) {
+						       return frame->timestamp() == timestamp;
+					       });
+			if (it != zslRing_.end()) {
+				raw = *it;
+				zslRing_.erase(it);
+			} else {
+				LOG(RPI, Debug)
+					<< "No retained frame with timestamp "
+					<< timestamp << ", capturing a new one";
+			}
+		}
+
+		pendingRequests_.pop_front();
+
+		Buffer *buffer = request->findBuffer(&stream_);
+		Buffer *vfBuffer = vfActive_ ? request->findBuffer(&vfStream_) : nullptr;
+		unsigned int queued = 0;
+
+		for (auto &it : { std::make_pair(isp_->capture0_, buffer),
+				  std::make_pair(isp_->capture1_, vfBuffer) }) {
+			if (!it.second)
+				continue;
+
+			if (it.first->queueBuffer(it.second) >= 0) {
+				queued++;
+				continue;
+			}
+
+			LOG(RPI, Error) << "Failed to queue request buffer";
+			if (pipe_->cancelBuffer(camera_, request, it.second))
+				pipe_->completeRequest(camera_, request);
+		}
+
+		if (queued)
+			ispRequests_++;
+
+		if (raw) {
+			LOG(RPI, Debug)
+				<< "Processing frame " << raw->sequence();
+			if (!pending.manual)
+				zslTimestamp_ = raw->timestamp();
+			queueIspInput(raw);
+		}
+	}
+}
+
+void RPiCameraData::queueIspInput(Buffer *buffer)
+{
+	ispInputs_++;
+	isp_->output_->queueBuffer(buffer);
+}
+
+/*
+ * Retain a raw frame for zero shutter lag capture, returning the oldest
+ * retained frame to unicam, or return the frame to unicam directly when no
+ * frame is retained.
+ */
+void RPiCameraData::retainFrame(Buffer *buffer)
+{
+	if (!zslFrames_ || buffer->status() != Buffer::BufferSuccess) {
+		unicam_->queueBuffer(buffer);
+		return;
+	}
+
+	/* Frames processed again are reinserted at their original position. */
+	auto it = std::upper_bound(zslRing_.begin(), zslRing_.end(), buffer,
+				   [](const Buffer *a, const Buffer *b) {
+					   return a->timestamp() < b->timestamp();
+				   });
+	zslRing_.insert(it, buffer);
+
+	if (zslRing_.size() > zslFrames_) {
+		unicam_->queueBuffer(zslRing_.front());
+		zslRing_.pop_front();
+	}
 }
 
 int RPiCameraData::loadIPA()
@@ -609,16 +1360,18 @@ int RPiCameraData::loadIPA()
 }
 
 void RPiCameraData::queueFrameAction(unsigned int frame,
-				     const IPAOperationData &action)
+				     IPAOperationData &&action)
 {
 	switch (action.operation) {
 	case RPI_IPA_ACTION_V4L2_SET: {
-#if 0 // disabled cargo-cult from RkISP1
-		const ControlList &controls = action.controls[0];
-		timeline_.scheduleAction(utils::make_unique<RkISP1ActionSetSensor>(frame,
-										   sensor_,
-										   controls));
-#endif
+		/*
+		 * Queue the controls for the next frame. Controls that can't
+		 * be queued are applied right away.
+		 */
+		ControlList &controls = action.controls[0];
+		if (!delayedCtrls_->push(controls) &&
+		    sensor_->setControls(&controls))
+			LOG(RPI, Error) << "Failed to set sensor controls";
 		break;
 	}
 	case RPI_IPA_ACTION_PARAM_FILLED: {
@@ -630,7 +1383,10 @@ void RPiCameraData::queueFrameAction(unsigned int frame,
 		break;
 	}
 	case RPI_IPA_ACTION_METADATA:
-		metadataReady(frame, action.controls[0]);
+		metadataReady(frame, std::move(action.controls[0]));
+		break;
+	case RPI_IPA_ACTION_STATE:
+		ipaState_ = std::move(action.data);
 		break;
 	default:
 		LOG(RPI, Error) << "Unknown action " << action.operation;
@@ -638,7 +1394,7 @@ void RPiCameraData::queueFrameAction(unsigned int frame,
 	}
 }
 
-void RPiCameraData::metadataReady(unsigned int frame, const ControlList &metadata)
+void RPiCameraData::metadataReady(unsigned int frame, ControlList &&metadata)
 {
 	LOG(RPI, Debug) << "Received some MetaData, but nothing I can do yet..";
 
@@ -649,7 +1405,7 @@ void RPiCameraData::metadataReady(unsigned int frame, const ControlList &metadat
 	if (!info)
 		return;
 
-	info->request->metadata() = metadata;
+	info->request->metadata() = std::move(metadata);
 	info->metadataProcessed = true;
 
 	pipe->tryCompleteRequest(info->request);
@@ -7,9 +7,13 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <iomanip>
+#include <map>
 #include <memory>
 #include <queue>
+#include <stdlib.h>
+#include <vector>
 
 #include <linux/media-bus-format.h>
 
@@ -19,10 +23,14 @@
 #include <libcamera/control_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
+#include <libcamera/timer.h>
 
 #include "camera_sensor.h"
 #include "device_enumerator.h"
+#include "frame_context.h"
+#include "ipa_buffer_registry.h"
 #include "ipa_manager.h"
+#include "ipa_state_store.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -38,8 +46,69 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RkISP1)
 
+namespace {
+
+/* The maximum output sizes of the main and self path resizers. */
+const Size RKISP1_MAIN_PATH_MAX{ 4416, 3312 };
+const Size RKISP1_SELF_PATH_MAX{ 1920, 1920 };
+
+/* The maximum number of frames the parameters can be prepared ahead. */
+constexpr unsigned int RKISP1_MAX_PARAM_LOOKAHEAD = 4;
+
+/*
+ * The capture watchdog restarts the video nodes when no buffer completes for a
+ * few frame intervals. Until the first frame has been captured and the frame
+ * interval is known, allow for the sensor startup time instead. The watchdog
+ * gives up when the restarts don't bring any frame.
+ */
+constexpr unsigned int RKISP1_WATCHDOG_FRAMES = 3;
+constexpr std::chrono::milliseconds RKISP1_WATCHDOG_MIN_TIMEOUT{ 20 };
+constexpr std::chrono::milliseconds RKISP1_WATCHDOG_STARTUP_TIMEOUT{ 1000 };
+constexpr unsigned int RKISP1_WATCHDOG_MAX_RECOVERIES = 3;
+
+/*
+ * The Bayer formats the main path captures in ISP bypass mode, in order of
+ * preference, and the corresponding sensor media bus codes.
+ */
+const std::array<std::pair<unsigned int, unsigned int>, 12> RKISP1_RAW_FORMATS{ {
+	{ MEDIA_BUS_FMT_SBGGR12_1X12, V4L2_PIX_FMT_SBGGR12 },
+	{ MEDIA_BUS_FMT_SGBRG12_1X12, V4L2_PIX_FMT_SGBRG12 },
+	{ MEDIA_BUS_FMT_SGRBG12_1X12, V4L2_PIX_FMT_SGRBG12 },
+	{ MEDIA_BUS_FMT_SRGGB12_1X12, V4L2_PIX_FMT_SRGGB12 },
+	{ MEDIA_BUS_FMT_SBGGR10_1X10, V4L2_PIX_FMT_SBGGR10 },
+	{ MEDIA_BUS_FMT_SGBRG10_1X10, V4L2_PIX_FMT_SGBRG10 },
+	{ MEDIA_BUS_FMT_SGRBG10_1X10, V4L2_PIX_FMT_SGRBG10 },
+	{ MEDIA_BUS_FMT_SRGGB10_1X10, V4L2_PIX_FMT_SRGGB10 },
+	{ MEDIA_BUS_FMT_SBGGR8_1X8, V4L2_PIX_FMT_SBGGR8 },
+	{ MEDIA_BUS_FMT_SGBRG8_1X8, V4L2_PIX_FMT_SGBRG8 },
+	{ MEDIA_BUS_FMT_SGRBG8_1X8, V4L2_PIX_FMT_SGRBG8 },
+	{ MEDIA_BUS_FMT_SRGGB8_1X8, V4L2_PIX_FMT_SRGGB8 },
+} };
+
+unsigned int rawFormatToMediaBus(unsigned int fourcc)
+{
+	for (const auto &format : RKISP1_RAW_FORMATS) {
+		if (format.second == fourcc)
+			return format.first;
+	}
+
+	return 0;
+}
+
+unsigned int mediaBusToRawFormat(unsigned int code)
+{
+	for (const auto &format : RKISP1_RAW_FORMATS) {
+		if (format.first == code)
+			return format.second;
+	}
+
+	return 0;
+}
+
+} /* namespace */
+
 class PipelineHandlerRkISP1;
-class RkISP1ActionQueueBuffers;
+class RkISP1CameraData;
 
 enum RkISP1ActionType {
 	SetSensor,
@@ -47,13 +116,11 @@ enum RkISP1ActionType {
 	QueueBuffers,
 };
 
-struct RkISP1FrameInfo {
-	unsigned int frame;
-	Request *request;
-
+struct RkISP1FrameInfo : public FrameContext {
 	Buffer *paramBuffer;
 	Buffer *statBuffer;
-	Buffer *videoBuffer;
+	Buffer *mainPathBuffer;
+	Buffer *selfPathBuffer;
 
 	bool paramFilled;
 	bool paramDequeued;
@@ -65,31 +132,80 @@ class RkISP1Frames
 public:
 	RkISP1Frames(PipelineHandler *pipe);
 
-	RkISP1FrameInfo *create(unsigned int frame, Request *request, Stream *stream);
+	RkISP1FrameInfo *create(unsigned int frame, Request *request,
+				Stream *mainPathStream, Stream *selfPathStream);
 	int destroy(unsigned int frame);
+	void clear();
+
+	Buffer *prepareParams(unsigned int frame);
+	void setParamFilled(unsigned int frame);
 
 	RkISP1FrameInfo *find(unsigned int frame);
 	RkISP1FrameInfo *find(Buffer *buffer);
 	RkISP1FrameInfo *find(Request *request);
 
 private:
+	/*
+	 * Frames in flight are limited by the number of parameters buffers,
+	 * leave room for the gaps caused by dropped frames.
+	 */
+	static constexpr unsigned int RKISP1_FRAME_DEPTH = 16;
+
+	struct PreparedParams {
+		Buffer *buffer;
+		bool filled;
+	};
+
 	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+	FrameContextRing<RkISP1FrameInfo> frameInfo_;
+
+	/* Parameters buffers prepared ahead of their frame's request. */
+	std::map<unsigned int, PreparedParams> preparedParams_;
 };
 
 class RkISP1Timeline : public Timeline
 {
 public:
-	RkISP1Timeline()
-		: Timeline()
+	RkISP1Timeline(RkISP1CameraData *data)
+		: Timeline(), data_(data), frameStartEnabled_(false),
+		  sensorControls_(ACTION_DEPTH, ControlList(controls::controls))
 	{
-		setDelay(SetSensor, -1, 5);
+		setDelay(SetSensor, -sensorDelay(), 5);
 		setDelay(SOE, 0, -1);
 		setDelay(QueueBuffers, -1, 10);
 	}
 
+	void scheduleSensorControls(unsigned int frame, ControlList &&controls)
+	{
+		flushActions(frame);
+		sensorControls_[frame % ACTION_DEPTH] = std::move(controls);
+		scheduleAction(frame, SetSensor);
+	}
+
+	void scheduleQueueBuffers(unsigned int frame)
+	{
+		scheduleAction(frame, QueueBuffers);
+	}
+
+	void setFrameStartEnabled(bool enable)
+	{
+		frameStartEnabled_ = enable;
+	}
+
+	void frameStart(uint32_t sequence, uint64_t timestamp)
+	{
+		utils::time_point soe = std::chrono::time_point<utils::clock>()
+			+ std::chrono::nanoseconds(timestamp);
+
+		notifyStartOfExposure(sequence, soe);
+	}
+
 	void bufferReady(Buffer *buffer)
 	{
+		/* Frame start events, when available, provide the real SOE. */
+		if (frameStartEnabled_)
+			return;
+
 		/*
 		 * Calculate SOE by taking the end of DMA set by the kernel and applying
 		 * the time offsets provideprovided by the IPA to find the best estimate
@@ -110,15 +226,59 @@ public:
 		utils::duration delay = std::chrono::milliseconds(msdelay);
 		setRawDelay(type, frame, delay);
 	}
+
+protected:
+	void runAction(unsigned int frame, unsigned int type) override;
+
+private:
+	/*
+	 * Sensor controls are applied ahead of the frame they target, by the
+	 * number of frames the sensor takes to latch them. The default suits
+	 * most sensors, others can override it with the
+	 * LIBCAMERA_RKISP1_SENSOR_DELAY environment variable.
+	 */
+	static int sensorDelay()
+	{
+		int delay = 1;
+
+		const char *env = utils::secure_getenv("LIBCAMERA_RKISP1_SENSOR_DELAY");
+		if (env && *env) {
+			char *end;
+			unsigned long value = strtoul(env, &end, 10);
+			if (*end || value >= ACTION_DEPTH)
+				LOG(RkISP1, Warning)
+					<< "Invalid sensor delay " << env
+					<< ", using " << delay;
+			else
+				delay = value;
+		}
+
+		return delay;
+	}
+
+	void setSensorControls(unsigned int frame);
+	void queueBuffers(unsigned int frame);
+
+	RkISP1CameraData *data_;
+	bool frameStartEnabled_;
+
+	/*
+	 * The sensor controls of the SetSensor actions, indexed like the
+	 * timeline action ring.
+	 */
+	std::vector<ControlList> sensorControls_;
 };
 
 class RkISP1CameraData : public CameraData
 {
 public:
 	RkISP1CameraData(PipelineHandler *pipe)
-		: CameraData(pipe), sensor_(nullptr), frame_(0),
-		  frameInfo_(pipe)
+		: CameraData(pipe), sensor_(nullptr), selfPathActive_(false),
+		  frame_(0), paramLookahead_(1), frameInfo_(pipe), timeline_(this),
+		  requestControls_(controls::controls), recovering_(false),
+		  frameCaptured_(false), recoveries_(0)
 	{
+		watchdog_.timeout.connect(this, &RkISP1CameraData::watchdogTimeout);
 	}
 
 	~RkISP1CameraData()
@@ -128,18 +288,33 @@ public:
 
 	int loadIPA();
 
-	Stream stream_;
+	Stream mainPathStream_;
+	Stream selfPathStream_;
 	CameraSensor *sensor_;
+	bool selfPathActive_;
 	unsigned int frame_;
+	unsigned int paramLookahead_;
 	std::vector<IPABuffer> ipaBuffers_;
+	IPABufferRegistry ipaBufferRegistry_;
+	std::vector<uint32_t> ipaState_;
 	RkISP1Frames frameInfo_;
 	RkISP1Timeline timeline_;
+	V4L2ControlBatch sensorControls_;
+
+	/* Controls accumulated from all requests queued since start(). */
+	ControlList requestControls_;
+
+	/* Restart the video nodes when the capture stalls. */
+	Timer watchdog_;
+	bool recovering_;
+	bool frameCaptured_;
+	unsigned int recoveries_;
 
 private:
-	void queueFrameAction(unsigned int frame,
-			      const IPAOperationData &action);
+	void queueFrameAction(unsigned int frame, IPAOperationData &&action);
+	void watchdogTimeout(Timer *timer);
 
-	void metadataReady(unsigned int frame, const ControlList &metadata);
+	void metadataReady(unsigned int frame, ControlList &&metadata);
 };
 
 class RkISP1CameraConfiguration : public CameraConfiguration
@@ -150,9 +325,17 @@ public:
 	Status validate() override;
 
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
+	const Rectangle &sensorCrop() { return sensorCrop_; }
+	bool isRaw() const { return raw_; }
 
 private:
 	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
+	static constexpr unsigned int RKISP1_MIN_BUFFER_COUNT = 2;
+	static constexpr unsigned int RKISP1_MAX_BUFFER_COUNT = 8;
+
+	Status validateConfiguration();
+	Status validatePath(StreamConfiguration *cfg, const Size &maxSize);
+	Status validateRawPath(StreamConfiguration *cfg);
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -163,6 +346,8 @@ private:
 	const RkISP1CameraData *data_;
 
 	V4L2SubdeviceFormat sensorFormat_;
+	Rectangle sensorCrop_;
+	bool raw_;
 };
 
 class PipelineHandlerRkISP1 : public PipelineHandler
@@ -184,8 +369,11 @@ public:
 	void stop(Camera *camera) override;
 
 	int queueRequest(Camera *camera, Request *request) override;
+	int queueRequests(Camera *camera,
+			  const std::vector<Request *> &requests) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
+	int initCamera(Camera *camera) override;
 
 private:
 	RkISP1CameraData *cameraData(const Camera *camera)
@@ -194,13 +382,27 @@ private:
 			PipelineHandler::cameraData(camera));
 	}
 
-	friend RkISP1ActionQueueBuffers;
 	friend RkISP1CameraData;
+	friend RkISP1Timeline;
 	friend RkISP1Frames;
 
 	int initLinks();
-	int createCamera(MediaEntity *sensor);
+	int createCamera(CameraSensor *sensor);
+	int prepareRequest(Camera *camera, Request *request,
+			   IPAOperationData *op);
+	void scheduleRequests(RkISP1CameraData *data, unsigned int first);
+	void prepareLookahead(RkISP1CameraData *data);
+	int startStreams(Camera *camera);
+	void stopStreams(Camera *camera);
+	void armWatchdog(RkISP1CameraData *data);
+	void recover(Camera *camera);
+	V4L2VideoDevice *videoDevice(RkISP1CameraData *data, Stream *stream);
+	int configurePath(V4L2VideoDevice *video, const StreamConfiguration &cfg);
+	int allocateInternalBuffers(V4L2VideoDevice *video, BufferPool *pool,
+				    unsigned int count);
+	void releaseInternalBuffers(V4L2VideoDevice *video, BufferPool *pool);
 	void tryCompleteRequest(Request *request);
+	void frameStart(uint32_t sequence, uint64_t timestamp);
 	void bufferReady(Buffer *buffer);
 	void paramReady(Buffer *buffer);
 	void statReady(Buffer *buffer);
@@ -208,7 +410,8 @@ private:
 	MediaDevice *media_;
 	V4L2Subdevice *dphy_;
 	V4L2Subdevice *isp_;
-	V4L2VideoDevice *video_;
+	V4L2VideoDevice *mainPath_;
+	V4L2VideoDevice *selfPath_;
 	V4L2VideoDevice *param_;
 	V4L2VideoDevice *stat_;
 
@@ -222,17 +425,23 @@ private:
 };
 
 RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
-	: pipe_(dynamic_cast<PipelineHandlerRkISP1 *>(pipe))
+	: pipe_(dynamic_cast<PipelineHandlerRkISP1 *>(pipe)),
+	  frameInfo_(RKISP1_FRAME_DEPTH)
 {
 }
 
-RkISP1FrameInfo *RkISP1Frames::create(unsigned int frame, Request *request, Stream *stream)
+RkISP1FrameInfo *RkISP1Frames::create(unsigned int frame, Request *request,
+				      Stream *mainPathStream,
+				      Stream *selfPathStream)
 {
-	if (pipe_->paramBuffers_.empty()) {
+	auto prepared = preparedParams_.find(frame);
+	if (prepared == preparedParams_.end() && pipe_->paramBuffers_.empty()) {
 		LOG(RkISP1, Error) << "Parameters buffer underrun";
 		return nullptr;
 	}
-	Buffer *paramBuffer = pipe_->paramBuffers_.front();
+	Buffer *paramBuffer = prepared != preparedParams_.end()
+			    ? prepared->second.buffer
+			    : pipe_->paramBuffers_.front();
 
 	if (pipe_->statBuffers_.empty()) {
 		LOG(RkISP1, Error) << "Statisitc buffer underrun";
@@ -240,28 +449,32 @@ RkISP1FrameInfo *RkISP1Frames::create(unsigned int frame, Request *request, Stre
 	}
 	Buffer *statBuffer = pipe_->statBuffers_.front();
 
-	Buffer *videoBuffer = request->findBuffer(stream);
-	if (!videoBuffer) {
+	Buffer *mainPathBuffer = request->findBuffer(mainPathStream);
+	Buffer *selfPathBuffer = request->findBuffer(selfPathStream);
+	if (!mainPathBuffer && !selfPathBuffer) {
 		LOG(RkISP1, Error)
 			<< "Attempt to queue request with invalid stream";
 		return nullptr;
 	}
 
-	pipe_->paramBuffers_.pop();
-	pipe_->statBuffers_.pop();
+	RkISP1FrameInfo *info = frameInfo_.create(frame, request);
+	if (!info) {
+		LOG(RkISP1, Error) << "Too many frames in flight";
+		return nullptr;
+	}
 
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
+	if (prepared != preparedParams_.end()) {
+		info->paramFilled = prepared->second.filled;
+		preparedParams_.erase(prepared);
+	} else {
+		pipe_->paramBuffers_.pop();
+	}
+	pipe_->statBuffers_.pop();
 
-	info->frame = frame;
-	info->request = request;
 	info->paramBuffer = paramBuffer;
-	info->videoBuffer = videoBuffer;
+	info->mainPathBuffer = mainPathBuffer;
+	info->selfPathBuffer = selfPathBuffer;
 	info->statBuffer = statBuffer;
-	info->paramFilled = false;
-	info->paramDequeued = false;
-	info->metadataProcessed = false;
-
-	frameInfo_[frame] = info;
 
 	return info;
 }
@@ -275,104 +488,157 @@ int RkISP1Frames::destroy(unsigned int frame)
 	pipe_->paramBuffers_.push(info->paramBuffer);
 	pipe_->statBuffers_.push(info->statBuffer);
 
-	frameInfo_.erase(info->frame);
-
-	delete info;
+	frameInfo_.destroy(info);
 
 	return 0;
 }
 
-RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
+void RkISP1Frames::clear()
+{
+	frameInfo_.clear([this](RkISP1FrameInfo &info) {
+		pipe_->paramBuffers_.push(info.paramBuffer);
+		pipe_->statBuffers_.push(info.statBuffer);
+	});
+
+	for (const auto &prepared : preparedParams_)
+		pipe_->paramBuffers_.push(prepared.second.buffer);
+	preparedParams_.clear();
+}
+
+/*
+ * Reserve a parameters buffer for \a frame before its request is queued, for
+ * the IPA to fill it ahead of time. The buffer is attached to the frame when
+ * the request is queued.
+ */
+Buffer *RkISP1Frames::prepareParams(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
+	if (pipe_->paramBuffers_.empty()) {
+		LOG(RkISP1, Error) << "Parameters buffer underrun";
+		return nullptr;
+	}
 
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	Buffer *buffer = pipe_->paramBuffers_.front();
+	pipe_->paramBuffers_.pop();
+
+	preparedParams_[frame] = { buffer, false };
 
-	LOG(RkISP1, Error) << "Can't locate info from frame";
-	return nullptr;
+	return buffer;
 }
 
-RkISP1FrameInfo *RkISP1Frames::find(Buffer *buffer)
+void RkISP1Frames::setParamFilled(unsigned int frame)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->videoBuffer == buffer)
-			return info;
+	auto prepared = preparedParams_.find(frame);
+	if (prepared != preparedParams_.end()) {
+		prepared->second.filled = true;
+		return;
 	}
 
-	LOG(RkISP1, Error) << "Can't locate info from buffer";
-	return nullptr;
+	RkISP1FrameInfo *info = find(frame);
+	if (info)
+		info->paramFilled = true;
 }
 
-RkISP1FrameInfo *RkISP1Frames::find(Request *request)
+RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->request == request)
-			return info;
-	}
+	RkISP1FrameInfo *info = frameInfo_.find(frame);
+	if (!info)
+		LOG(RkISP1, Error) << "Can't locate info from frame";
 
-	LOG(RkISP1, Error) << "Can't locate info from request";
-	return nullptr;
+	return info;
 }
 
-class RkISP1ActionSetSensor : public FrameAction
+RkISP1FrameInfo *RkISP1Frames::find(Buffer *buffer)
 {
-public:
-	RkISP1ActionSetSensor(unsigned int frame, CameraSensor *sensor, const ControlList &controls)
-		: FrameAction(frame, SetSensor), sensor_(sensor), controls_(controls) {}
+	/* Video buffers belong to a request, internal buffers don't. */
+	RkISP1FrameInfo *info = buffer->request()
+			      ? frameInfo_.find(buffer)
+			      : frameInfo_.findIf([buffer](const RkISP1FrameInfo &i) {
+					return i.paramBuffer == buffer ||
+					       i.statBuffer == buffer;
+				});
+	if (!info)
+		LOG(RkISP1, Error) << "Can't locate info from buffer";
 
-protected:
-	void run() override
-	{
-		sensor_->setControls(&controls_);
-	}
+	return info;
+}
 
-private:
-	CameraSensor *sensor_;
-	ControlList controls_;
-};
+RkISP1FrameInfo *RkISP1Frames::find(Request *request)
+{
+	RkISP1FrameInfo *info = frameInfo_.find(request);
+	if (!info)
+		LOG(RkISP1, Error) << "Can't locate info from request";
+
+	return info;
+}
 
-class RkISP1ActionQueueBuffers : public FrameAction
+void RkISP1Timeline::runAction(unsigned int frame, unsigned int type)
 {
-public:
-	RkISP1ActionQueueBuffers(unsigned int frame, RkISP1CameraData *data,
-				 PipelineHandlerRkISP1 *pipe)
-		: FrameAction(frame, QueueBuffers), data_(data), pipe_(pipe)
-	{
+	switch (type) {
+	case SetSensor:
+		setSensorControls(frame);
+		break;
+	case QueueBuffers:
+		queueBuffers(frame);
+		break;
+	default:
+		LOG(RkISP1, Error) << "Unknown action type " << type;
+		break;
 	}
+}
 
-protected:
-	void run() override
-	{
-		RkISP1FrameInfo *info = data_->frameInfo_.find(frame());
-		if (!info)
-			LOG(RkISP1, Fatal) << "Frame not known";
+void RkISP1Timeline::setSensorControls(unsigned int frame)
+{
+	ControlList &controls = sensorControls_[frame % ACTION_DEPTH];
+	V4L2ControlBatch *batch = &data_->sensorControls_;
 
-		if (info->paramFilled)
-			pipe_->param_->queueBuffer(info->paramBuffer);
-		else
-			LOG(RkISP1, Error)
-				<< "Parameters not ready on time for frame "
-				<< frame() << ", ignore parameters.";
+	/*
+	 * Use the prepared batch when the IPA sets the controls it has been
+	 * prepared for, to avoid validating them for every frame.
+	 */
+	if (batch->isValid() && !batch->set(controls))
+		data_->sensor_->setControls(batch);
+	else
+		data_->sensor_->setControls(&controls);
+}
+
+void RkISP1Timeline::queueBuffers(unsigned int frame)
+{
+	PipelineHandlerRkISP1 *pipe =
+		static_cast<PipelineHandlerRkISP1 *>(data_->pipe_);
+
+	RkISP1FrameInfo *info = data_->frameInfo_.find(frame);
+	if (!info)
+		LOG(RkISP1, Fatal) << "Frame not known";
 
-		pipe_->stat_->queueBuffer(info->statBuffer);
-		pipe_->video_->queueBuffer(info->videoBuffer);
+	/*
+	 * When the IPA misses the deadline, don't queue the parameters buffer,
+	 * the ISP then keeps the parameters of the previous frame.
+	 */
+	if (info->paramFilled) {
+		pipe->param_->queueBuffer(info->paramBuffer);
+	} else {
+		LOG(RkISP1, Warning)
+			<< "Parameters not ready on time for frame "
+			<< frame << ", keeping previous parameters";
+		info->paramDequeued = true;
 	}
 
-private:
-	RkISP1CameraData *data_;
-	PipelineHandlerRkISP1 *pipe_;
-};
+	pipe->stat_->queueBuffer(info->statBuffer);
+
+	if (info->mainPathBuffer)
+		pipe->mainPath_->queueBuffer(info->mainPathBuffer);
+	if (info->selfPathBuffer)
+		pipe->selfPath_->queueBuffer(info->selfPathBuffer);
+}
 
 int RkISP1CameraData::loadIPA()
 {
-	ipa_ = IPAManager::instance()->createIPA(pipe_, 1, 1);
+	/*
+	 * Run the IPA in its own thread, the parameters are prepared ahead of
+	 * time and the frame actions are handled asynchronously.
+	 */
+	ipa_ = IPAManager::instance()->createIPA(pipe_, 1, 1,
+						 IPAManager::ThreadedIPA);
 	if (!ipa_)
 		return -ENOENT;
 
@@ -383,24 +649,21 @@ int RkISP1CameraData::loadIPA()
 }
 
 void RkISP1CameraData::queueFrameAction(unsigned int frame,
-					const IPAOperationData &action)
+					IPAOperationData &&action)
 {
 	switch (action.operation) {
 	case RKISP1_IPA_ACTION_V4L2_SET: {
-		const ControlList &controls = action.controls[0];
-		timeline_.scheduleAction(utils::make_unique<RkISP1ActionSetSensor>(frame,
-										   sensor_,
-										   controls));
+		timeline_.scheduleSensorControls(frame, std::move(action.controls[0]));
 		break;
 	}
-	case RKISP1_IPA_ACTION_PARAM_FILLED: {
-		RkISP1FrameInfo *info = frameInfo_.find(frame);
-		if (info)
-			info->paramFilled = true;
+	case RKISP1_IPA_ACTION_PARAM_FILLED:
+		frameInfo_.setParamFilled(frame);
 		break;
-	}
 	case RKISP1_IPA_ACTION_METADATA:
-		metadataReady(frame, action.controls[0]);
+		metadataReady(frame, std::move(action.controls[0]));
+		break;
+	case RKISP1_IPA_ACTION_STATE:
+		ipaState_ = std::move(action.data);
 		break;
 	default:
 		LOG(RkISP1, Error) << "Unkown action " << action.operation;
@@ -408,7 +671,15 @@ void RkISP1CameraData::queueFrameAction(unsigned int frame,
 	}
 }
 
-void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &metadata)
+void RkISP1CameraData::watchdogTimeout(Timer *timer)
+{
+	PipelineHandlerRkISP1 *pipe =
+		static_cast<PipelineHandlerRkISP1 *>(pipe_);
+
+	pipe->recover(camera_);
+}
+
+void RkISP1CameraData::metadataReady(unsigned int frame, ControlList &&metadata)
 {
 	PipelineHandlerRkISP1 *pipe =
 		static_cast<PipelineHandlerRkISP1 *>(pipe_);
@@ -417,21 +688,29 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 	if (!info)
 		return;
 
-	info->request->metadata() = metadata;
+	completeMetadata(info->request, std::move(metadata));
 	info->metadataProcessed = true;
 
+	pipe->traceRequest(info->request, Request::StageIPAAction);
+
 	pipe->tryCompleteRequest(info->request);
 }
 
 RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 						     RkISP1CameraData *data)
-	: CameraConfiguration()
+	: CameraConfiguration(), raw_(false)
 {
 	camera_ = camera->shared_from_this();
 	data_ = data;
 }
 
-CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+/*
+ * Adjust the pixel format and size of the configuration entry \a cfg to the
+ * capabilities of a path whose resizer outputs at most \a maxSize.
+ */
+CameraConfiguration::Status
+RkISP1CameraConfiguration::validatePath(StreamConfiguration *cfg,
+					const Size &maxSize)
 {
 	static const std::array<unsigned int, 8> formats{
 		V4L2_PIX_FMT_YUYV,
@@ -444,77 +723,196 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		V4L2_PIX_FMT_GREY,
 	};
 
-	const CameraSensor *sensor = data_->sensor_;
 	Status status = Valid;
 
-	if (config_.empty())
-		return Invalid;
-
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
-		status = Adjusted;
-	}
-
-	StreamConfiguration &cfg = config_[0];
-
 	/* Adjust the pixel format. */
-	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+	if (std::find(formats.begin(), formats.end(), cfg->pixelFormat) ==
 	    formats.end()) {
 		LOG(RkISP1, Debug) << "Adjusting format to NV12";
-		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg->pixelFormat = V4L2_PIX_FMT_NV12;
 		status = Adjusted;
 	}
 
-	/* Select the sensor format. */
-	sensorFormat_ = sensor->getFormat({ MEDIA_BUS_FMT_SBGGR12_1X12,
-					    MEDIA_BUS_FMT_SGBRG12_1X12,
-					    MEDIA_BUS_FMT_SGRBG12_1X12,
-					    MEDIA_BUS_FMT_SRGGB12_1X12,
-					    MEDIA_BUS_FMT_SBGGR10_1X10,
-					    MEDIA_BUS_FMT_SGBRG10_1X10,
-					    MEDIA_BUS_FMT_SGRBG10_1X10,
-					    MEDIA_BUS_FMT_SRGGB10_1X10,
-					    MEDIA_BUS_FMT_SBGGR8_1X8,
-					    MEDIA_BUS_FMT_SGBRG8_1X8,
-					    MEDIA_BUS_FMT_SGRBG8_1X8,
-					    MEDIA_BUS_FMT_SRGGB8_1X8 },
-					  cfg.size);
-	if (!sensorFormat_.size.width || !sensorFormat_.size.height)
-		sensorFormat_.size = sensor->resolution();
-
 	/*
 	 * Provide a suitable default that matches the sensor aspect
 	 * ratio and clamp the size to the hardware bounds.
 	 *
 	 * \todo: Check the hardware alignment constraints.
 	 */
-	const Size size = cfg.size;
+	const Size size = cfg->size;
 
-	if (!cfg.size.width || !cfg.size.height) {
-		cfg.size.width = 1280;
-		cfg.size.height = 1280 * sensorFormat_.size.height
-				/ sensorFormat_.size.width;
+	if (!cfg->size.width || !cfg->size.height) {
+		cfg->size.width = 1280;
+		cfg->size.height = 1280 * sensorFormat_.size.height
+				 / sensorFormat_.size.width;
 	}
 
-	cfg.size.width = std::max(32U, std::min(4416U, cfg.size.width));
-	cfg.size.height = std::max(16U, std::min(3312U, cfg.size.height));
+	cfg->size.width = std::max(32U, std::min(maxSize.width, cfg->size.width));
+	cfg->size.height = std::max(16U, std::min(maxSize.height, cfg->size.height));
 
-	if (cfg.size != size) {
+	if (cfg->size != size) {
 		LOG(RkISP1, Debug)
 			<< "Adjusting size from " << size.toString()
-			<< " to " << cfg.size.toString();
+			<< " to " << cfg->size.toString();
+		status = Adjusted;
+	}
+
+	if (!cfg->frameDecimation) {
+		cfg->frameDecimation = 1;
+		status = Adjusted;
+	}
+
+	cfg->bufferCount = queueDepth(RKISP1_MIN_BUFFER_COUNT, RKISP1_BUFFER_COUNT,
+				      RKISP1_MAX_BUFFER_COUNT);
+
+	return status;
+}
+
+/*
+ * Adjust the configuration entry \a cfg of a main path capturing raw Bayer
+ * frames with the ISP in bypass mode. The frames are neither processed nor
+ * scaled, the format and size are those of the sensor.
+ */
+CameraConfiguration::Status
+RkISP1CameraConfiguration::validateRawPath(StreamConfiguration *cfg)
+{
+	Status status = Valid;
+
+	unsigned int pixelFormat = mediaBusToRawFormat(sensorFormat_.mbus_code);
+	if (cfg->pixelFormat != pixelFormat) {
+		LOG(RkISP1, Debug) << "Adjusting raw format to the sensor format";
+		cfg->pixelFormat = pixelFormat;
+		status = Adjusted;
+	}
+
+	if (cfg->size != sensorFormat_.size) {
+		LOG(RkISP1, Debug)
+			<< "Adjusting raw size from " << cfg->size.toString()
+			<< " to " << sensorFormat_.size.toString();
+		cfg->size = sensorFormat_.size;
+		status = Adjusted;
+	}
+
+	if (!cfg->frameDecimation) {
+		cfg->frameDecimation = 1;
+		status = Adjusted;
+	}
+
+	cfg->bufferCount = queueDepth(RKISP1_MIN_BUFFER_COUNT, RKISP1_BUFFER_COUNT,
+				      RKISP1_MAX_BUFFER_COUNT);
+
+	return status;
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+{
+	return data_->validationCache_.validate(this,
+						&RkISP1CameraConfiguration::validateConfiguration,
+						&RkISP1CameraConfiguration::camera_);
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::validateConfiguration()
+{
+	const CameraSensor *sensor = data_->sensor_;
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/*
+	 * Cap the number of entries to the available streams. The first entry
+	 * is captured from the main path, the second one from the self path.
+	 */
+	if (config_.size() > 2) {
+		config_.resize(2);
+		status = Adjusted;
+	}
+
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
+	/*
+	 * Raw Bayer frames can only be captured from the main path, with the
+	 * ISP in bypass mode. The ISP output is then in Bayer format, which
+	 * the self path can't process, raw capture is thus exclusive.
+	 */
+	unsigned int rawCode = rawFormatToMediaBus(config_[0].pixelFormat);
+	raw_ = rawCode != 0;
+
+	if (raw_ && config_.size() > 1) {
+		LOG(RkISP1, Debug)
+			<< "Raw capture can't run alongside the self path";
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	if (config_.size() > 1 && rawFormatToMediaBus(config_[1].pixelFormat)) {
+		LOG(RkISP1, Debug) << "Self path can't capture raw frames";
+		config_[1].pixelFormat = V4L2_PIX_FMT_NV12;
 		status = Adjusted;
 	}
 
-	cfg.bufferCount = RKISP1_BUFFER_COUNT;
+	/*
+	 * Select the sensor format from the largest requested size, both paths
+	 * are scaled from the ISP output. When a region of interest is set
+	 * on the first stream, crop the sensor to it to lower the bandwidth
+	 * on the CSI-2 bus. Both paths share the sensor crop.
+	 */
+	Size maxSize;
+	for (const StreamConfiguration &cfg : config_) {
+		maxSize.width = std::max(maxSize.width, cfg.size.width);
+		maxSize.height = std::max(maxSize.height, cfg.size.height);
+	}
+
+	/* Prefer the sensor format matching the requested raw format. */
+	std::vector<unsigned int> mbusCodes;
+	if (raw_)
+		mbusCodes.push_back(rawCode);
+	for (const auto &format : RKISP1_RAW_FORMATS) {
+		if (format.first != rawCode)
+			mbusCodes.push_back(format.first);
+	}
+
+	sensorFormat_ = sensor->getFormat(mbusCodes, maxSize, config_[0].roi,
+					  &sensorCrop_);
+	if (!sensorFormat_.size.width || !sensorFormat_.size.height) {
+		sensorFormat_.size = sensor->resolution();
+		sensorCrop_ = {};
+	}
+
+	if (sensor->cropSupported()) {
+		for (StreamConfiguration &cfg : config_) {
+			if (cfg.roi != sensorCrop_) {
+				cfg.roi = sensorCrop_;
+				status = Adjusted;
+			}
+		}
+	}
+
+	if (raw_) {
+		if (validateRawPath(&config_[0]) == Adjusted)
+			status = Adjusted;
+	} else if (validatePath(&config_[0], RKISP1_MAIN_PATH_MAX) == Adjusted) {
+		status = Adjusted;
+	}
+
+	if (config_.size() > 1 &&
+	    validatePath(&config_[1], RKISP1_SELF_PATH_MAX) == Adjusted)
+		status = Adjusted;
 
 	return status;
 }
 
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
 	: PipelineHandler(manager), dphy_(nullptr), isp_(nullptr),
-	  video_(nullptr), param_(nullptr), stat_(nullptr)
+	  mainPath_(nullptr), selfPath_(nullptr), param_(nullptr),
+	  stat_(nullptr)
 {
 }
 
@@ -522,7 +920,8 @@ PipelineHandlerRkISP1::~PipelineHandlerRkISP1()
 {
 	delete param_;
 	delete stat_;
-	delete video_;
+	delete selfPath_;
+	delete mainPath_;
 	delete isp_;
 	delete dphy_;
 }
@@ -540,11 +939,50 @@ CameraConfiguration *PipelineHandlerRkISP1::generateConfiguration(Camera *camera
 	if (roles.empty())
 		return config;
 
-	StreamConfiguration cfg{};
-	cfg.pixelFormat = V4L2_PIX_FMT_NV12;
-	cfg.size = data->sensor_->resolution();
+	/*
+	 * The first role is assigned to the main path, at the sensor
+	 * resolution, and the second one to the self path, which defaults to
+	 * a viewfinder size.
+	 */
+	if (roles.size() > 2) {
+		LOG(RkISP1, Error) << "Only two streams are supported";
+		delete config;
+		return nullptr;
+	}
+
+	/*
+	 * Raw frames are captured from the main path with the ISP in bypass
+	 * mode, which leaves no processed output for the self path.
+	 */
+	for (unsigned int i = 0; i < roles.size(); ++i) {
+		if (roles[i] == StreamRole::StillCaptureRaw &&
+		    (i != 0 || roles.size() > 1)) {
+			LOG(RkISP1, Error)
+				<< "Raw capture is only supported as a single stream";
+			delete config;
+			return nullptr;
+		}
+	}
+
+	const Size &resolution = data->sensor_->resolution();
+
+	for (unsigned int i = 0; i < roles.size(); ++i) {
+		StreamConfiguration cfg{};
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
 
-	config->addConfiguration(cfg);
+		if (roles[i] == StreamRole::StillCaptureRaw) {
+			/* Default to the preferred Bayer format at full size. */
+			cfg.pixelFormat = RKISP1_RAW_FORMATS[0].second;
+			cfg.size = resolution;
+		} else if (i == 0) {
+			cfg.size = resolution;
+		} else {
+			cfg.size.width = std::min(1280U, resolution.width);
+			cfg.size.height = std::min(720U, resolution.height);
+		}
+
+		config->addConfiguration(cfg);
+	}
 
 	config->validate();
 
@@ -556,7 +994,6 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	RkISP1CameraConfiguration *config =
 		static_cast<RkISP1CameraConfiguration *>(c);
 	RkISP1CameraData *data = cameraData(camera);
-	StreamConfiguration &cfg = config->at(0);
 	CameraSensor *sensor = data->sensor_;
 	int ret;
 
@@ -588,9 +1025,15 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	 * the pipeline.
 	 */
 	V4L2SubdeviceFormat format = config->sensorFormat();
+	Rectangle crop = config->sensorCrop();
 	LOG(RkISP1, Debug) << "Configuring sensor with " << format.toString();
 
-	ret = sensor->setFormat(&format);
+	if (crop.w && crop.h) {
+		LOG(RkISP1, Debug) << "Cropping sensor to " << crop.toString();
+		ret = sensor->setFormat(&format, &crop);
+	} else {
+		ret = sensor->setFormat(&format);
+	}
 	if (ret < 0)
 		return ret;
 
@@ -612,8 +1055,12 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 
 	LOG(RkISP1, Debug) << "ISP input pad configured with " << format.toString();
 
-	/* YUYV8_2X8 is required on the ISP source path pad for YUV output. */
-	format.mbus_code = MEDIA_BUS_FMT_YUYV8_2X8;
+	/*
+	 * YUYV8_2X8 is required on the ISP source path pad for YUV output. For
+	 * raw capture the ISP is bypassed and outputs the sensor format.
+	 */
+	if (!config->isRaw())
+		format.mbus_code = MEDIA_BUS_FMT_YUYV8_2X8;
 	LOG(RkISP1, Debug) << "Configuring ISP output pad with " << format.toString();
 
 	ret = isp_->setFormat(2, &format);
@@ -622,12 +1069,60 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 
 	LOG(RkISP1, Debug) << "ISP output pad configured with " << format.toString();
 
-	V4L2DeviceFormat outputFormat = {};
+	ret = configurePath(mainPath_, config->at(0));
+	if (ret)
+		return ret;
+
+	data->selfPathActive_ = config->size() > 1;
+	if (data->selfPathActive_) {
+		ret = configurePath(selfPath_, config->at(1));
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * The parameters and statistics formats are fixed. They can't be set
+	 * while their buffers are kept allocated, and don't need to be.
+	 */
+	if (!paramPool_.count()) {
+		V4L2DeviceFormat paramFormat = {};
+		paramFormat.fourcc = V4L2_META_FMT_RK_ISP1_PARAMS;
+		ret = param_->setFormat(&paramFormat);
+		if (ret)
+			return ret;
+	}
+
+	if (!statPool_.count()) {
+		V4L2DeviceFormat statFormat = {};
+		statFormat.fourcc = V4L2_META_FMT_RK_ISP1_STAT_3A;
+		ret = stat_->setFormat(&statFormat);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * Prepare the parameters just in time for the low latency queue
+	 * profile, and one more frame ahead for the throughput profile.
+	 */
+	data->paramLookahead_ = config->queueDepth(0, 1, 2);
+
+	config->at(0).setStream(&data->mainPathStream_);
+	if (data->selfPathActive_)
+		config->at(1).setStream(&data->selfPathStream_);
+
+	return 0;
+}
+
+/* Configure the capture format of the main or self path \a video node. */
+int PipelineHandlerRkISP1::configurePath(V4L2VideoDevice *video,
+					 const StreamConfiguration &cfg)
+{
+	V4L2DeviceFormat outputFormat = {};
 	outputFormat.fourcc = cfg.pixelFormat;
 	outputFormat.size = cfg.size;
-	outputFormat.planesCount = 2;
+	outputFormat.planesCount = rawFormatToMediaBus(cfg.pixelFormat) ? 1 : 2;
 
-	ret = video_->setFormat(&outputFormat);
+	int ret = video->setFormat(&outputFormat);
 	if (ret)
 		return ret;
 
@@ -638,70 +1133,138 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 		return -EINVAL;
 	}
 
-	V4L2DeviceFormat paramFormat = {};
-	paramFormat.fourcc = V4L2_META_FMT_RK_ISP1_PARAMS;
-	ret = param_->setFormat(&paramFormat);
-	if (ret)
-		return ret;
-
-	V4L2DeviceFormat statFormat = {};
-	statFormat.fourcc = V4L2_META_FMT_RK_ISP1_STAT_3A;
-	ret = stat_->setFormat(&statFormat);
-	if (ret)
-		return ret;
-
-	cfg.setStream(&data->stream_);
-
 	return 0;
 }
 
+V4L2VideoDevice *PipelineHandlerRkISP1::videoDevice(RkISP1CameraData *data,
+						     Stream *stream)
+{
+	return stream == &data->selfPathStream_ ? selfPath_ : mainPath_;
+}
+
 int PipelineHandlerRkISP1::allocateBuffers(Camera *camera,
 					   const std::set<Stream *> &streams)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	Stream *stream = *streams.begin();
+	unsigned int bufferCount = 0;
 	int ret;
 
-	if (stream->memoryType() == InternalMemory)
-		ret = video_->exportBuffers(&stream->bufferPool());
-	else
-		ret = video_->importBuffers(&stream->bufferPool());
+	for (Stream *stream : streams) {
+		if (stream->memoryType() == UserPtrMemory) {
+			LOG(RkISP1, Error) << "User pointer memory not supported";
+			return -ENOTSUP;
+		}
+	}
 
-	if (ret)
-		return ret;
+	std::vector<V4L2VideoDevice *> allocated;
+
+	for (Stream *stream : streams) {
+		V4L2VideoDevice *video = videoDevice(data, stream);
+
+		if (stream->memoryType() == InternalMemory)
+			ret = video->exportBuffers(&stream->bufferPool());
+		else
+			ret = video->importBuffers(&stream->bufferPool());
 
-	paramPool_.createBuffers(stream->configuration().bufferCount + 1);
-	ret = param_->exportBuffers(&paramPool_);
+		if (ret) {
+			for (V4L2VideoDevice *dev : allocated)
+				dev->releaseBuffers();
+			return ret;
+		}
+
+		allocated.push_back(video);
+		bufferCount = std::max(bufferCount,
+				       stream->configuration().bufferCount);
+	}
+
+	/*
+	 * Parameters are prepared paramLookahead_ frames ahead of the requests,
+	 * giving the IPA more time to fill them at the expense of a longer
+	 * latency for the ISP controls. The lookahead is selected by the queue
+	 * profile at configure() time, can be overridden with the
+	 * LIBCAMERA_RKISP1_PARAM_LOOKAHEAD environment variable, and requires
+	 * as many additional parameters buffers.
+	 */
+	const char *lookahead = utils::secure_getenv("LIBCAMERA_RKISP1_PARAM_LOOKAHEAD");
+	if (lookahead && *lookahead) {
+		char *end;
+		unsigned long value = strtoul(lookahead, &end, 10);
+		if (*end || value > RKISP1_MAX_PARAM_LOOKAHEAD)
+			LOG(RkISP1, Warning)
+				<< "Invalid parameters lookahead " << lookahead
+				<< ", using " << data->paramLookahead_;
+		else
+			data->paramLookahead_ = value;
+	}
+
+	unsigned int paramCount = bufferCount + 1 + data->paramLookahead_;
+
+	/*
+	 * The parameters and statistics buffers are kept allocated by
+	 * freeBuffers(), and only reallocated when their number changes. This
+	 * preserves their mapping in the IPA across stop and start cycles.
+	 */
+	ret = allocateInternalBuffers(param_, &paramPool_, paramCount);
 	if (ret) {
-		video_->releaseBuffers();
+		for (V4L2VideoDevice *dev : allocated)
+			dev->releaseBuffers();
 		return ret;
 	}
 
-	statPool_.createBuffers(stream->configuration().bufferCount + 1);
-	ret = stat_->exportBuffers(&statPool_);
+	ret = allocateInternalBuffers(stat_, &statPool_, bufferCount + 1);
 	if (ret) {
-		param_->releaseBuffers();
-		video_->releaseBuffers();
+		releaseInternalBuffers(param_, &paramPool_);
+		for (V4L2VideoDevice *dev : allocated)
+			dev->releaseBuffers();
 		return ret;
 	}
 
-	for (unsigned int i = 0; i < stream->configuration().bufferCount + 1; i++) {
+	for (unsigned int i = 0; i < paramCount; i++) {
 		data->ipaBuffers_.push_back({ .id = RKISP1_PARAM_BASE | i,
 					      .memory = paramPool_.buffers()[i] });
 		paramBuffers_.push(new Buffer(i));
 	}
 
-	for (unsigned int i = 0; i < stream->configuration().bufferCount + 1; i++) {
+	for (unsigned int i = 0; i < bufferCount + 1; i++) {
 		data->ipaBuffers_.push_back({ .id = RKISP1_STAT_BASE | i,
 					      .memory = statPool_.buffers()[i] });
 		statBuffers_.push(new Buffer(i));
 	}
 
-	data->ipa_->mapBuffers(data->ipaBuffers_);
+	data->ipaBufferRegistry_.map(data->ipa_.get(), data->ipaBuffers_);
+
+	return ret;
+}
+
+int PipelineHandlerRkISP1::allocateInternalBuffers(V4L2VideoDevice *video,
+						   BufferPool *pool,
+						   unsigned int count)
+{
+	if (pool->count() == count)
+		return 0;
+
+	releaseInternalBuffers(video, pool);
+
+	pool->createBuffers(count);
+	int ret = video->exportBuffers(pool);
+	if (ret)
+		pool->destroyBuffers();
 
 	return ret;
 }
 
+void PipelineHandlerRkISP1::releaseInternalBuffers(V4L2VideoDevice *video,
+						   BufferPool *pool)
+{
+	if (!pool->count())
+		return;
+
+	if (video->releaseBuffers())
+		LOG(RkISP1, Error) << "Failed to release internal buffers";
+
+	pool->destroyBuffers();
+}
+
 int PipelineHandlerRkISP1::freeBuffers(Camera *camera,
 				       const std::set<Stream *> &streams)
 {
@@ -717,21 +1280,16 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera,
 		paramBuffers_.pop();
 	}
 
-	std::vector<unsigned int> ids;
-	for (IPABuffer &ipabuf : data->ipaBuffers_)
-		ids.push_back(ipabuf.id);
-
-	data->ipa_->unmapBuffers(ids);
+	/*
+	 * The parameters and statistics buffers stay allocated and mapped in
+	 * the IPA, to be reused by the next allocateBuffers() call.
+	 */
 	data->ipaBuffers_.clear();
 
-	if (param_->releaseBuffers())
-		LOG(RkISP1, Error) << "Failed to release parameters buffers";
-
-	if (stat_->releaseBuffers())
-		LOG(RkISP1, Error) << "Failed to release stat buffers";
-
-	if (video_->releaseBuffers())
-		LOG(RkISP1, Error) << "Failed to release video buffers";
+	for (Stream *stream : streams) {
+		if (videoDevice(data, stream)->releaseBuffers())
+			LOG(RkISP1, Error) << "Failed to release video buffers";
+	}
 
 	return 0;
 }
@@ -742,69 +1300,96 @@ int PipelineHandlerRkISP1::start(Camera *camera)
 	int ret;
 
 	data->frame_ = 0;
-
-	ret = param_->streamOn();
-	if (ret) {
-		LOG(RkISP1, Error)
-			<< "Failed to start parameters " << camera->name();
-		return ret;
-	}
-
-	ret = stat_->streamOn();
-	if (ret) {
-		param_->streamOff();
-		LOG(RkISP1, Error)
-			<< "Failed to start statistics " << camera->name();
-		return ret;
-	}
-
-	ret = video_->streamOn();
-	if (ret) {
-		param_->streamOff();
-		stat_->streamOff();
-
-		LOG(RkISP1, Error)
-			<< "Failed to start camera " << camera->name();
-	}
+	data->requestControls_.clear();
+	data->frameCaptured_ = false;
+	data->recoveries_ = 0;
 
 	activeCamera_ = camera;
 
 	/* Inform IPA of stream configuration and sensor controls. */
 	std::map<unsigned int, IPAStream> streamConfig;
 	streamConfig[0] = {
-		.pixelFormat = data->stream_.configuration().pixelFormat,
-		.size = data->stream_.configuration().size,
+		.pixelFormat = data->mainPathStream_.configuration().pixelFormat,
+		.size = data->mainPathStream_.configuration().size,
 	};
 
+	if (data->selfPathActive_)
+		streamConfig[1] = {
+			.pixelFormat = data->selfPathStream_.configuration().pixelFormat,
+			.size = data->selfPathStream_.configuration().size,
+		};
+
 	std::map<unsigned int, ControlInfoMap> entityControls;
 	entityControls.emplace(0, data->sensor_->controls());
 
-	data->ipa_->configure(streamConfig, entityControls);
+	/*
+	 * The IPA updates the exposure and gain for every frame, but only
+	 * passes the controls that changed. Seed the batch with the current
+	 * sensor values for the other ones.
+	 */
+	const ControlInfoMap &sensorControls = data->sensor_->controls();
+	if (sensorControls.find(V4L2_CID_EXPOSURE) != sensorControls.end() &&
+	    sensorControls.find(V4L2_CID_ANALOGUE_GAIN) != sensorControls.end()) {
+		data->sensor_->prepareControls(&data->sensorControls_,
+					       { V4L2_CID_EXPOSURE,
+						 V4L2_CID_ANALOGUE_GAIN });
+		data->sensor_->getControls(&data->sensorControls_);
+	} else {
+		data->sensorControls_ = V4L2ControlBatch();
+	}
 
-	return ret;
+	/*
+	 * Configure the IPA and prepare the lookahead parameters before
+	 * starting the streams. The IPA runs asynchronously, it thus sets up
+	 * while the video nodes start, and is ready for the first frame.
+	 */
+	data->ipa_->configure(std::move(streamConfig), std::move(entityControls));
+
+	/*
+	 * Start the algorithms from their last converged state, from this
+	 * process or from a previous one.
+	 */
+	if (!data->ipaState_.empty() ||
+	    IPAStateStore::instance()->lookup(camera->name(), &data->ipaState_)) {
+		IPAOperationData state;
+		state.operation = RKISP1_IPA_EVENT_RESTORE_STATE;
+		state.data = data->ipaState_;
+		data->ipa_->processEvent(std::move(state));
+	}
+
+	prepareLookahead(data);
+
+	ret = startStreams(camera);
+	if (ret) {
+		data->frameInfo_.clear();
+		activeCamera_ = nullptr;
+		return ret;
+	}
+
+	/*
+	 * Use frame start events from the ISP to track the start of exposure
+	 * when supported, and fall back to estimating it from buffer
+	 * completion otherwise.
+	 */
+	data->timeline_.setFrameStartEnabled(!isp_->setFrameStartEnabled(true));
+
+	return 0;
 }
 
 void PipelineHandlerRkISP1::stop(Camera *camera)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	int ret;
 
-	ret = video_->streamOff();
-	if (ret)
-		LOG(RkISP1, Warning)
-			<< "Failed to stop camera " << camera->name();
+	isp_->setFrameStartEnabled(false);
 
-	ret = stat_->streamOff();
-	if (ret)
-		LOG(RkISP1, Warning)
-			<< "Failed to stop statistics " << camera->name();
-
-	ret = param_->streamOff();
-	if (ret)
-		LOG(RkISP1, Warning)
-			<< "Failed to stop parameters " << camera->name();
+	stopStreams(camera);
 
+	data->watchdog_.stop();
 	data->timeline_.reset();
+	data->frameInfo_.clear();
+
+	if (!data->ipaState_.empty())
+		IPAStateStore::instance()->store(camera->name(), data->ipaState_);
 
 	activeCamera_ = nullptr;
 }
@@ -812,66 +1397,347 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 int PipelineHandlerRkISP1::queueRequest(Camera *camera, Request *request)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	Stream *stream = &data->stream_;
+	unsigned int first = data->frame_;
+
+	IPAOperationData op;
+	op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
+
+	int ret = prepareRequest(camera, request, &op);
+	if (ret)
+		return ret;
+
+	data->ipa_->processEvent(std::move(op));
+	scheduleRequests(data, first);
+
+	if (!data->watchdog_.isRunning())
+		armWatchdog(data);
+
+	return 0;
+}
+
+int PipelineHandlerRkISP1::queueRequests(Camera *camera,
+					 const std::vector<Request *> &requests)
+{
+	RkISP1CameraData *data = cameraData(camera);
+	unsigned int first = data->frame_;
+	int ret = 0;
+
+	/* Pass all the requests to the IPA in a single event. */
+	IPAOperationData op;
+	op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
+	op.data.reserve(requests.size() * 2);
+	op.controls.reserve(requests.size());
+
+	for (Request *request : requests) {
+		ret = prepareRequest(camera, request, &op);
+		if (ret)
+			break;
+	}
+
+	if (!op.controls.empty()) {
+		data->ipa_->processEvent(std::move(op));
+		scheduleRequests(data, first);
+	}
+
+	if (!data->watchdog_.isRunning())
+		armWatchdog(data);
+
+	return ret;
+}
+
+/*
+ * Add the request to the RKISP1_IPA_EVENT_QUEUE_REQUEST event \a op. The event
+ * carries, for each request, the frame number and parameters buffer ID in the
+ * data array, and the request controls in the controls array.
+ */
+int PipelineHandlerRkISP1::prepareRequest(Camera *camera, Request *request,
+					  IPAOperationData *op)
+{
+	RkISP1CameraData *data = cameraData(camera);
 
 	PipelineHandler::queueRequest(camera, request);
 
 	RkISP1FrameInfo *info = data->frameInfo_.create(data->frame_, request,
-							stream);
+							&data->mainPathStream_,
+							&data->selfPathStream_);
 	if (!info)
 		return -ENOENT;
 
+	/*
+	 * Don't queue the buffers of decimated and throttled streams on the
+	 * frames they skip. The frame is still processed by the ISP to keep
+	 * the IPA running for the other stream.
+	 */
+	if (info->mainPathBuffer &&
+	    skipFrame(camera, &data->mainPathStream_, data->frame_)) {
+		skipBuffer(camera, request, info->mainPathBuffer);
+		info->mainPathBuffer = nullptr;
+	}
+
+	if (info->selfPathBuffer &&
+	    skipFrame(camera, &data->selfPathStream_, data->frame_)) {
+		skipBuffer(camera, request, info->selfPathBuffer);
+		info->selfPathBuffer = nullptr;
+	}
+
+	/*
+	 * With a lookahead, the parameters of this frame have been prepared
+	 * already, and the request controls apply to the parameters of a later
+	 * frame. Fall back to this frame's parameters if no buffer is available.
+	 */
+	unsigned int paramFrame = data->frame_;
+	Buffer *paramBuffer = info->paramBuffer;
+
+	if (data->paramLookahead_) {
+		Buffer *buffer = data->frameInfo_.prepareParams(data->frame_ +
+								data->paramLookahead_);
+		if (buffer) {
+			paramFrame = data->frame_ + data->paramLookahead_;
+			paramBuffer = buffer;
+		}
+	}
+
+	op->data.push_back(paramFrame);
+	op->data.push_back(RKISP1_PARAM_BASE | paramBuffer->index());
+
+	/*
+	 * The IPA retains the state of the controls it has been given, only
+	 * pass it the controls that changed since the previous request.
+	 */
+	op->controls.push_back(request->controls().delta(data->requestControls_));
+	data->requestControls_.merge(request->controls());
+
+	data->frame_++;
+
+	return 0;
+}
+
+/*
+ * Schedule queueing of the buffers for the frames prepared since \a first,
+ * once the IPA has been given the corresponding requests.
+ */
+void PipelineHandlerRkISP1::scheduleRequests(RkISP1CameraData *data,
+					     unsigned int first)
+{
+	for (unsigned int frame = first; frame != data->frame_; ++frame)
+		data->timeline_.scheduleQueueBuffers(frame);
+}
+
+/*
+ * Prepare the parameters of the frames covered by the lookahead, before the
+ * first request is queued.
+ */
+void PipelineHandlerRkISP1::prepareLookahead(RkISP1CameraData *data)
+{
 	IPAOperationData op;
 	op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
-	op.data = { data->frame_, RKISP1_PARAM_BASE | info->paramBuffer->index() };
-	op.controls = { request->controls() };
-	data->ipa_->processEvent(op);
 
-	data->timeline_.scheduleAction(utils::make_unique<RkISP1ActionQueueBuffers>(data->frame_,
-										    data,
-										    this));
+	for (unsigned int frame = 0; frame < data->paramLookahead_; ++frame) {
+		Buffer *buffer = data->frameInfo_.prepareParams(frame);
+		if (!buffer)
+			break;
 
-	data->frame_++;
+		op.data.push_back(frame);
+		op.data.push_back(RKISP1_PARAM_BASE | buffer->index());
+		op.controls.push_back(ControlList(controls::controls));
+	}
+
+	if (!op.controls.empty())
+		data->ipa_->processEvent(std::move(op));
+}
+
+int PipelineHandlerRkISP1::startStreams(Camera *camera)
+{
+	RkISP1CameraData *data = cameraData(camera);
+	int ret;
+
+	/*
+	 * The parameters and statistics nodes are independent, start them
+	 * concurrently, before the capture paths that start the sensor.
+	 */
+	ret = V4L2VideoDevice::streamOn({ param_, stat_ });
+	if (ret) {
+		LOG(RkISP1, Error)
+			<< "Failed to start parameters and statistics "
+			<< camera->name();
+		return ret;
+	}
+
+	ret = mainPath_->streamOn();
+	if (ret) {
+		V4L2VideoDevice::streamOff({ param_, stat_ });
+
+		LOG(RkISP1, Error)
+			<< "Failed to start camera " << camera->name();
+		return ret;
+	}
+
+	if (data->selfPathActive_) {
+		ret = selfPath_->streamOn();
+		if (ret) {
+			V4L2VideoDevice::streamOff({ mainPath_, param_, stat_ });
+
+			LOG(RkISP1, Error)
+				<< "Failed to start self path " << camera->name();
+			return ret;
+		}
+	}
 
 	return 0;
 }
 
+void PipelineHandlerRkISP1::stopStreams(Camera *camera)
+{
+	/*
+	 * The ISP is fed directly by the sensor and has no separate source
+	 * node to quiesce first, stop all the video nodes concurrently. The
+	 * self path is skipped when it isn't streaming.
+	 */
+	int ret = V4L2VideoDevice::streamOff({ selfPath_, mainPath_, stat_,
+					       param_ });
+	if (ret)
+		LOG(RkISP1, Warning)
+			<< "Failed to stop camera " << camera->name();
+}
+
+/*
+ * Arm the capture watchdog for the next buffer completion, or stop it when no
+ * request is pending.
+ */
+void PipelineHandlerRkISP1::armWatchdog(RkISP1CameraData *data)
+{
+	if (data->queuedRequests_.empty()) {
+		data->watchdog_.stop();
+		return;
+	}
+
+	utils::duration interval = data->timeline_.frameInterval();
+	std::chrono::milliseconds timeout = RKISP1_WATCHDOG_STARTUP_TIMEOUT;
+
+	if (data->frameCaptured_ && interval > utils::duration::zero()) {
+		timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+			RKISP1_WATCHDOG_FRAMES * interval);
+		timeout = std::max(timeout, RKISP1_WATCHDOG_MIN_TIMEOUT);
+	}
+
+	data->watchdog_.start(timeout);
+}
+
+/*
+ * Recover from a capture stall by restarting the video nodes only. The sensor
+ * configuration, the buffers and the IPA state are kept, and the requests
+ * that haven't been captured are queued again.
+ */
+void PipelineHandlerRkISP1::recover(Camera *camera)
+{
+	RkISP1CameraData *data = cameraData(camera);
+
+	if (data->recoveries_ >= RKISP1_WATCHDOG_MAX_RECOVERIES) {
+		LOG(RkISP1, Error)
+			<< "Capture of " << camera->name()
+			<< " still stalled after " << data->recoveries_
+			<< " restarts, giving up";
+		return;
+	}
+
+	data->recoveries_++;
+
+	LOG(RkISP1, Warning)
+		<< "Capture of " << camera->name()
+		<< " stalled, restarting the video nodes";
+
+	utils::time_point begin = utils::clock::now();
+
+	/* Don't complete the requests with the buffers cancelled by streamOff. */
+	data->recovering_ = true;
+	stopStreams(camera);
+	data->recovering_ = false;
+
+	data->timeline_.reset();
+	data->frameInfo_.clear();
+	data->frameCaptured_ = false;
+	data->frame_ = 0;
+
+	std::vector<Request *> requests = recoverRequests(camera);
+
+	int ret = startStreams(camera);
+	if (ret) {
+		LOG(RkISP1, Error)
+			<< "Failed to restart " << camera->name();
+
+		for (Request *request : requests)
+			cancelRequest(camera, request);
+		return;
+	}
+
+	prepareLookahead(data);
+
+	IPAOperationData op;
+	op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
+
+	for (auto it = requests.begin(); it != requests.end(); ++it) {
+		if (!prepareRequest(camera, *it, &op))
+			continue;
+
+		/*
+		 * The request has been added to the queued requests, cancel
+		 * it there, and the ones that follow it.
+		 */
+		for (auto const &buffer : (*it)->buffers())
+			cancelBuffer(camera, *it, buffer.second);
+		completeRequest(camera, *it);
+
+		for (++it; it != requests.end(); ++it)
+			cancelRequest(camera, *it);
+		break;
+	}
+
+	if (!op.controls.empty()) {
+		data->ipa_->processEvent(std::move(op));
+		scheduleRequests(data, 0);
+	}
+
+	armWatchdog(data);
+
+	LOG(RkISP1, Info)
+		<< "Restarted " << camera->name() << " in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(
+			   utils::clock::now() - begin).count()
+		<< "us, " << requests.size() << " requests requeued";
+}
+
 /* -----------------------------------------------------------------------------
  * Match and Setup
  */
 
 int PipelineHandlerRkISP1::initLinks()
 {
+	std::vector<std::pair<MediaLink *, bool>> links;
 	MediaLink *link;
-	int ret;
-
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
 
 	link = media_->link("rockchip-sy-mipi-dphy", 1, "rkisp1-isp-subdev", 0);
 	if (!link)
 		return -ENODEV;
 
-	ret = link->setEnabled(true);
-	if (ret < 0)
-		return ret;
+	links.emplace_back(link, true);
 
 	link = media_->link("rkisp1-isp-subdev", 2, "rkisp1_mainpath", 0);
 	if (!link)
 		return -ENODEV;
 
-	ret = link->setEnabled(true);
-	if (ret < 0)
-		return ret;
+	links.emplace_back(link, true);
 
-	return 0;
+	link = media_->link("rkisp1-isp-subdev", 2, "rkisp1_selfpath", 0);
+	if (!link)
+		return -ENODEV;
+
+	links.emplace_back(link, true);
+
+	return media_->setupLinks(links, true);
 }
 
-int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
+int PipelineHandlerRkISP1::createCamera(CameraSensor *sensor)
 {
-	int ret;
-
 	std::unique_ptr<RkISP1CameraData> data =
 		utils::make_unique<RkISP1CameraData>(this);
 
@@ -882,18 +1748,17 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 
 	data->controlInfo_ = std::move(ctrls);
 
-	data->sensor_ = new CameraSensor(sensor);
-	ret = data->sensor_->init();
-	if (ret)
-		return ret;
+	data->sensor_ = sensor;
 
-	ret = data->loadIPA();
-	if (ret)
-		return ret;
+	/* Keep the sensor powered in standby, it's slow to power up. */
+	data->standbyDevices_.push_back(utils::make_unique<RuntimePM>(sensor->entity()));
 
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{
+		&data->mainPathStream_,
+		&data->selfPathStream_,
+	};
 	std::shared_ptr<Camera> camera =
-		Camera::create(this, sensor->name(), streams);
+		Camera::create(this, sensor->entity()->name(), streams);
 	registerCamera(std::move(camera), std::move(data));
 
 	return 0;
@@ -924,9 +1789,13 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (isp_->open() < 0)
 		return false;
 
-	/* Locate and open the capture video node. */
-	video_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
-	if (video_->open() < 0)
+	/* Locate and open the capture video nodes. */
+	mainPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
+	if (mainPath_->open() < 0)
+		return false;
+
+	selfPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_selfpath");
+	if (selfPath_->open() < 0)
 		return false;
 
 	stat_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1-statistics");
@@ -937,7 +1806,9 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (param_->open() < 0)
 		return false;
 
-	video_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+	isp_->frameStart.connect(this, &PipelineHandlerRkISP1::frameStart);
+	mainPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+	selfPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
 	stat_->bufferReady.connect(this, &PipelineHandlerRkISP1::statReady);
 	param_->bufferReady.connect(this, &PipelineHandlerRkISP1::paramReady);
 
@@ -955,12 +1826,29 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (!pad)
 		return false;
 
+	std::vector<CameraSensor *> sensors;
 	for (MediaLink *link : pad->links())
-		createCamera(link->source()->entity());
+		sensors.push_back(new CameraSensor(link->source()->entity()));
+
+	/* Probe all sensors concurrently, and create cameras in link order. */
+	std::vector<int> results = CameraSensor::initAll(sensors);
+	for (unsigned int i = 0; i < sensors.size(); ++i) {
+		if (results[i]) {
+			delete sensors[i];
+			continue;
+		}
+
+		createCamera(sensors[i]);
+	}
 
 	return true;
 }
 
+int PipelineHandlerRkISP1::initCamera(Camera *camera)
+{
+	return cameraData(camera)->loadIPA();
+}
+
 /* -----------------------------------------------------------------------------
  * Buffer Handling
  */
@@ -981,9 +1869,24 @@ void PipelineHandlerRkISP1::tryCompleteRequest(Request *request)
 	if (!info->paramDequeued)
 		return;
 
+	/*
+	 * Release the frame context first, the request may be requeued from
+	 * the completion handler.
+	 */
+	data->frameInfo_.destroy(info->frame);
+
 	completeRequest(activeCamera_, request);
+}
 
-	data->frameInfo_.destroy(info->frame);
+void PipelineHandlerRkISP1::frameStart(uint32_t sequence, uint64_t timestamp)
+{
+	if (!activeCamera_)
+		return;
+
+	RkISP1CameraData *data = cameraData(activeCamera_);
+	data->timeline_.frameStart(sequence, timestamp);
+
+	startRequest(activeCamera_, timestamp);
 }
 
 void PipelineHandlerRkISP1::bufferReady(Buffer *buffer)
@@ -992,13 +1895,28 @@ void PipelineHandlerRkISP1::bufferReady(Buffer *buffer)
 	RkISP1CameraData *data = cameraData(activeCamera_);
 	Request *request = buffer->request();
 
-	data->timeline_.bufferReady(buffer);
+	if (data->recovering_)
+		return;
+
+	if (buffer->status() == Buffer::BufferSuccess) {
+		data->frameCaptured_ = true;
+		data->recoveries_ = 0;
+	}
+
+	/*
+	 * Both paths capture the same frames, estimate the start of exposure
+	 * from the main path only.
+	 */
+	if (buffer->stream() == &data->mainPathStream_)
+		data->timeline_.bufferReady(buffer);
 
 	if (data->frame_ <= buffer->sequence())
 		data->frame_ = buffer->sequence() + 1;
 
 	completeBuffer(activeCamera_, request, buffer);
 	tryCompleteRequest(request);
+
+	armWatchdog(data);
 }
 
 void PipelineHandlerRkISP1::paramReady(Buffer *buffer)
@@ -1006,6 +1924,9 @@ void PipelineHandlerRkISP1::paramReady(Buffer *buffer)
 	ASSERT(activeCamera_);
 	RkISP1CameraData *data = cameraData(activeCamera_);
 
+	if (data->recovering_)
+		return;
+
 	RkISP1FrameInfo *info = data->frameInfo_.find(buffer);
 
 	info->paramDequeued = true;
@@ -1017,6 +1938,9 @@ void PipelineHandlerRkISP1::statReady(Buffer *buffer)
 	ASSERT(activeCamera_);
 	RkISP1CameraData *data = cameraData(activeCamera_);
 
+	if (data->recovering_)
+		return;
+
 	RkISP1FrameInfo *info = data->frameInfo_.find(buffer);
 	if (!info)
 		return;
@@ -1027,7 +1951,9 @@ void PipelineHandlerRkISP1::statReady(Buffer *buffer)
 	IPAOperationData op;
 	op.operation = RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER;
 	op.data = { frame, statid };
-	data->ipa_->processEvent(op);
+	/* Lend a metadata list for the IPA to fill in place. */
+	op.controls.push_back(data->acquireMetadata());
+	data->ipa_->processEvent(std::move(op));
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRkISP1);
@@ -18,21 +18,9 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Timeline)
 
-/**
- * \class FrameAction
- * \brief Action that can be schedule on a Timeline
- *
- * A frame action is an event schedule to be executed on a Timeline. A frame
- * action has two primal attributes a frame number and a type.
- *
- * The frame number describes the frame to which the action is associated. The
- * type is a numerical ID which identifies the action within the pipeline and
- * IPA protocol.
- */
-
 /**
  * \class Timeline
- * \brief Executor of FrameAction
+ * \brief Executor of per-frame actions
  *
  * The timeline has three primary functions:
  *
@@ -41,7 +29,7 @@ LOG_DEFINE_CATEGORY(Timeline)
  *    of the frame interval (time between two consecutive SOE events).
  *
  *    The estimated frame interval together with recorded SOE events are the
- *    foundation for how the timeline schedule FrameAction at specific points
+ *    foundation for how the timeline schedules actions at specific points
  *    in time.
  *    \todo Improve the frame interval estimation algorithm.
  *
@@ -53,15 +41,32 @@ LOG_DEFINE_CATEGORY(Timeline)
  *    The action type delays shall be updated by the IPA in conjunction with
  *    how it changes the capture parameters.
  *
- * 3. Schedule actions on the timeline. This is the process of taking a
- *    FrameAction which contains an abstract description of what frame and
- *    what type of action it contains and turning that into an time point
- *    and make sure the action is executed at that time.
+ * 3. Schedule actions on the timeline. This is the process of taking an
+ *    abstract description of an action, the frame it applies to and its
+ *    type, and turning that into an time point and make sure the action is
+ *    executed at that time.
+ *
+ * Actions are stored in a ring of ACTION_DEPTH slots indexed by frame number,
+ * with one slot per action type in each of them. Scheduling an action doesn't
+ * allocate memory, the pipeline handler stores the data the action needs in
+ * its own per-frame storage and runs the action from runAction().
+ *
+ * The deadline of an action is first estimated from the latest recorded SOE
+ * and the frame interval. Every SOE event then refreshes the deadlines of the
+ * pending actions, which become exact once the SOE of the frame they are
+ * relative to is known. When the hardware reports frame start events, actions
+ * are thus driven by the real frame timing instead of the estimate.
  */
 
 Timeline::Timeline()
-	: frameInterval_(0)
+	: historyCount_(0), historyNext_(0), frameInterval_(0)
 {
+	for (Delay &delay : delays_)
+		delay.valid = false;
+
+	for (ActionSlot &slot : actions_)
+		slot.pending = 0;
+
 	timer_.timeout.connect(this, &Timeline::timeout);
 }
 
@@ -76,122 +81,236 @@ void Timeline::reset()
 {
 	timer_.stop();
 
-	actions_.clear();
-	history_.clear();
+	for (ActionSlot &slot : actions_)
+		slot.pending = 0;
+
+	historyCount_ = 0;
+	historyNext_ = 0;
 }
 
 /**
  * \brief Schedule an action on the timeline
- * \param[in] action FrameAction to schedule
+ * \param[in] frame The frame the action applies to
+ * \param[in] type The action type
  *
  * The act of scheduling an action to the timeline is the process of taking
  * the properties of the action (type, frame and time offsets) and translating
  * that to a time point using the current values for the action type timings
  * value recorded in the timeline. If an action is scheduled too late, execute
  * it immediately.
+ *
+ * Scheduling an action of the same type twice for a frame replaces the first
+ * one. If the ring slot of \a frame is still used by an older frame, the
+ * actions of the older frame are run first.
  */
-void Timeline::scheduleAction(std::unique_ptr<FrameAction> action)
+void Timeline::scheduleAction(unsigned int frame, unsigned int type)
 {
-	unsigned int lastFrame;
-	utils::time_point lastTime;
-
-	if (history_.empty()) {
-		lastFrame = 0;
-		lastTime = std::chrono::steady_clock::now();
-	} else {
-		lastFrame = history_.back().first;
-		lastTime = history_.back().second;
-	}
+	ASSERT(type < MAX_ACTION_TYPES);
 
-	/*
-	 * Calculate when the action shall be schedule by first finding out how
-	 * many frames in the future the action acts on and then add the actions
-	 * frame offset. After the spatial frame offset is found out translate
-	 * that to a time point by using the last estimated start of exposure
-	 * (SOE) as the fixed offset. Lastly add the action time offset to the
-	 * time point.
-	 */
-	int frame = action->frame() - lastFrame + frameOffset(action->type());
-	utils::time_point deadline = lastTime + frame * frameInterval_
-		+ timeOffset(action->type());
+	flushActions(frame);
 
+	utils::time_point when = deadline(frame, type);
 	utils::time_point now = std::chrono::steady_clock::now();
-	if (deadline < now) {
+	if (when < now) {
 		LOG(Timeline, Warning)
 			<< "Action scheduled too late "
-			<< utils::time_point_to_string(deadline)
+			<< utils::time_point_to_string(when)
 			<< ", run now " << utils::time_point_to_string(now);
-		action->run();
-	} else {
-		actions_.emplace(deadline, std::move(action));
-		updateDeadline();
+		runAction(frame, type);
+		return;
 	}
+
+	ActionSlot &slot = actions_[frame % ACTION_DEPTH];
+	slot.frame = frame;
+	slot.pending |= 1 << type;
+	slot.deadlines[type] = when;
+
+	updateDeadline();
 }
 
+/**
+ * \fn Timeline::runAction()
+ * \brief Run an action
+ * \param[in] frame The frame the action applies to
+ * \param[in] type The action type
+ *
+ * This function is implemented by the pipeline handler timelines to run the
+ * action of \a type for \a frame when its deadline is reached.
+ */
+
+/**
+ * \brief Record the start of exposure of a frame
+ * \param[in] frame The frame number
+ * \param[in] time The start of exposure time
+ *
+ * Update the frame interval estimate, and the deadlines of all the pending
+ * actions, which run immediately if they are due.
+ */
 void Timeline::notifyStartOfExposure(unsigned int frame, utils::time_point time)
 {
-	history_.push_back(std::make_pair(frame, time));
+	history_[historyNext_] = std::make_pair(frame, time);
+	historyNext_ = (historyNext_ + 1) % HISTORY_DEPTH;
+	if (historyCount_ < HISTORY_DEPTH)
+		historyCount_++;
+
+	if (historyCount_ > HISTORY_DEPTH / 2) {
+		/* Update esitmated time between two start of exposures. */
+		unsigned int oldest = (historyNext_ + HISTORY_DEPTH - historyCount_)
+				    % HISTORY_DEPTH;
+		const auto &first = history_[oldest];
+		unsigned int frames = frame - first.first;
+
+		if (frames)
+			frameInterval_ = (time - first.second) / frames;
+	}
 
-	if (history_.size() <= HISTORY_DEPTH / 2)
-		return;
+	for (ActionSlot &slot : actions_) {
+		for (unsigned int type = 0; type < MAX_ACTION_TYPES; ++type) {
+			if (slot.pending & (1 << type))
+				slot.deadlines[type] = deadline(slot.frame, type);
+		}
+	}
+
+	runActions(std::chrono::steady_clock::now());
+	updateDeadline();
+}
 
-	while (history_.size() > HISTORY_DEPTH)
-		history_.pop_front();
+/**
+ * \brief Run the pending actions of the frame occupying the ring slot of
+ * \a frame
+ * \param[in] frame The frame number
+ *
+ * This function is called before storing data for \a frame in storage indexed
+ * the same way as the action ring, to make sure the actions of an older frame
+ * don't run with the data of \a frame.
+ */
+void Timeline::flushActions(unsigned int frame)
+{
+	ActionSlot &slot = actions_[frame % ACTION_DEPTH];
+	if (!slot.pending || slot.frame == frame)
+		return;
 
-	/* Update esitmated time between two start of exposures. */
-	utils::duration sumExposures(0);
-	unsigned int numExposures = 0;
+	LOG(Timeline, Warning)
+		<< "Too many frames in flight, run actions for frame "
+		<< slot.frame << " now";
 
-	utils::time_point lastTime;
-	for (auto it = history_.begin(); it != history_.end(); it++) {
-		if (it != history_.begin()) {
-			sumExposures += it->second - lastTime;
-			numExposures++;
-		}
+	for (unsigned int type = 0; type < MAX_ACTION_TYPES; ++type) {
+		if (!(slot.pending & (1 << type)))
+			continue;
 
-		lastTime = it->second;
+		slot.pending &= ~(1 << type);
+		runAction(slot.frame, type);
 	}
-
-	frameInterval_ = sumExposures;
-	if (numExposures)
-		frameInterval_ /= numExposures;
 }
 
 int Timeline::frameOffset(unsigned int type) const
 {
-	const auto it = delays_.find(type);
-	if (it == delays_.end()) {
+	if (type >= MAX_ACTION_TYPES || !delays_[type].valid) {
 		LOG(Timeline, Error)
 			<< "No frame offset set for action type " << type;
 		return 0;
 	}
 
-	return it->second.first;
+	return delays_[type].frame;
 }
 
 utils::duration Timeline::timeOffset(unsigned int type) const
 {
-	const auto it = delays_.find(type);
-	if (it == delays_.end()) {
+	if (type >= MAX_ACTION_TYPES || !delays_[type].valid) {
 		LOG(Timeline, Error)
 			<< "No time offset set for action type " << type;
 		return utils::duration::zero();
 	}
 
-	return it->second.second;
+	return delays_[type].time;
 }
 
 void Timeline::setRawDelay(unsigned int type, int frame, utils::duration time)
 {
-	delays_[type] = std::make_pair(frame, time);
+	ASSERT(type < MAX_ACTION_TYPES);
+
+	delays_[type] = { true, frame, time };
+}
+
+/*
+ * Retrieve the start of exposure of \a frame, from the history if recorded, or
+ * extrapolated from the latest recorded one otherwise.
+ */
+utils::time_point Timeline::startOfExposure(unsigned int frame) const
+{
+	if (!historyCount_)
+		return std::chrono::steady_clock::now()
+		       + static_cast<int>(frame) * frameInterval_;
+
+	for (unsigned int i = 0; i < historyCount_; ++i) {
+		const auto &entry = history_[i];
+		if (entry.first == frame)
+			return entry.second;
+	}
+
+	const auto &last = history_[(historyNext_ + HISTORY_DEPTH - 1) % HISTORY_DEPTH];
+	int frames = frame - last.first;
+
+	return last.second + frames * frameInterval_;
+}
+
+/*
+ * Calculate when the action shall be run by first finding out which frame it
+ * is relative to by adding the action type frame offset, translating that to a
+ * time point using the start of exposure of that frame, and lastly adding the
+ * action type time offset.
+ */
+utils::time_point Timeline::deadline(unsigned int frame, unsigned int type) const
+{
+	return startOfExposure(frame + frameOffset(type)) + timeOffset(type);
+}
+
+/* Run all the actions due at \a now, by order of deadline. */
+void Timeline::runActions(utils::time_point now)
+{
+	while (true) {
+		ActionSlot *next = nullptr;
+		unsigned int nextType = 0;
+
+		for (ActionSlot &slot : actions_) {
+			for (unsigned int type = 0; type < MAX_ACTION_TYPES; ++type) {
+				if (!(slot.pending & (1 << type)))
+					continue;
+
+				if (!next || slot.deadlines[type] <
+					     next->deadlines[nextType]) {
+					next = &slot;
+					nextType = type;
+				}
+			}
+		}
+
+		if (!next || next->deadlines[nextType] > now)
+			break;
+
+		next->pending &= ~(1 << nextType);
+		runAction(next->frame, nextType);
+	}
 }
 
 void Timeline::updateDeadline()
 {
-	if (actions_.empty())
+	const utils::time_point *earliest = nullptr;
+
+	for (const ActionSlot &slot : actions_) {
+		for (unsigned int type = 0; type < MAX_ACTION_TYPES; ++type) {
+			if (!(slot.pending & (1 << type)))
+				continue;
+
+			if (!earliest || slot.deadlines[type] < *earliest)
+				earliest = &slot.deadlines[type];
+		}
+	}
+
+	if (!earliest)
 		return;
 
-	const utils::time_point &deadline = actions_.begin()->first;
+	utils::time_point deadline = *earliest;
 
 	if (timer_.isRunning() && deadline >= timer_.deadline())
 		return;
@@ -206,21 +325,7 @@ void Timeline::updateDeadline()
 
 void Timeline::timeout(Timer *timer)
 {
-	utils::time_point now = std::chrono::steady_clock::now();
-
-	for (auto it = actions_.begin(); it != actions_.end();) {
-		const utils::time_point &sched = it->first;
-
-		if (sched > now)
-			break;
-
-		FrameAction *action = it->second.get();
-
-		action->run();
-
-		it = actions_.erase(it);
-	}
-
+	runActions(std::chrono::steady_clock::now());
 	updateDeadline();
 }
 
@@ -7,8 +7,9 @@
 #ifndef __LIBCAMERA_TIMELINE_H__
 #define __LIBCAMERA_TIMELINE_H__
 
-#include <list>
-#include <map>
+#include <array>
+#include <stdint.h>
+#include <utility>
 
 #include <libcamera/timer.h>
 
@@ -16,54 +17,62 @@
 
 namespace libcamera {
 
-class FrameAction
-{
-public:
-	FrameAction(unsigned int frame, unsigned int type)
-		: frame_(frame), type_(type) {}
-
-	virtual ~FrameAction() {}
-
-	unsigned int frame() const { return frame_; }
-	unsigned int type() const { return type_; }
-
-	virtual void run() = 0;
-
-private:
-	unsigned int frame_;
-	unsigned int type_;
-};
-
 class Timeline
 {
 public:
+	static constexpr unsigned int ACTION_DEPTH = 16;
+	static constexpr unsigned int MAX_ACTION_TYPES = 8;
+
 	Timeline();
 	virtual ~Timeline() {}
 
 	virtual void reset();
-	virtual void scheduleAction(std::unique_ptr<FrameAction> action);
+	void scheduleAction(unsigned int frame, unsigned int type);
 	virtual void notifyStartOfExposure(unsigned int frame, utils::time_point time);
 
 	utils::duration frameInterval() const { return frameInterval_; }
 
 protected:
+	virtual void runAction(unsigned int frame, unsigned int type) = 0;
+
+	void flushActions(unsigned int frame);
+
 	int frameOffset(unsigned int type) const;
 	utils::duration timeOffset(unsigned int type) const;
 
 	void setRawDelay(unsigned int type, int frame, utils::duration time);
 
-	std::map<unsigned int, std::pair<int, utils::duration>> delays_;
-
 private:
 	static constexpr unsigned int HISTORY_DEPTH = 10;
 
+	struct Delay {
+		bool valid;
+		int frame;
+		utils::duration time;
+	};
+
+	struct ActionSlot {
+		unsigned int frame;
+		uint32_t pending;
+		std::array<utils::time_point, MAX_ACTION_TYPES> deadlines;
+	};
+
+	utils::time_point startOfExposure(unsigned int frame) const;
+	utils::time_point deadline(unsigned int frame, unsigned int type) const;
+
+	void runActions(utils::time_point now);
 	void timeout(Timer *timer);
 	void updateDeadline();
 
-	std::list<std::pair<unsigned int, utils::time_point>> history_;
-	std::multimap<utils::time_point, std::unique_ptr<FrameAction>> actions_;
+	std::array<Delay, MAX_ACTION_TYPES> delays_;
+
+	std::array<std::pair<unsigned int, utils::time_point>, HISTORY_DEPTH> history_;
+	unsigned int historyCount_;
+	unsigned int historyNext_;
 	utils::duration frameInterval_;
 
+	std::array<ActionSlot, ACTION_DEPTH> actions_;
+
 	Timer timer_;
 };
 
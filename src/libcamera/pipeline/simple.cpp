@@ -0,0 +1,780 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * simple.cpp - Pipeline handler for raw sensors behind ISP-less receivers
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+
+#include <linux/media-bus-format.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "camera_sensor.h"
+#include "delayed_controls.h"
+#include "device_enumerator.h"
+#include "dma_heap.h"
+#include "log.h"
+#include "media_device.h"
+#include "pipeline_handler.h"
+#include "soft_isp.h"
+#include "utils.h"
+#include "v4l2_controls.h"
+#include "v4l2_subdevice.h"
+#include "v4l2_videodevice.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Simple)
+
+namespace {
+
+/* Receivers without an ISP, whose raw frames are processed on the CPU. */
+const char *const supportedDrivers[] = {
+	"imx7-csi",
+	"qcom-camss",
+	"sun6i-csi",
+};
+
+/* The V4L2 pixel formats the receivers store the sensor media bus codes in. */
+const std::map<unsigned int, std::vector<unsigned int>> bayerFormats = {
+	{ MEDIA_BUS_FMT_SBGGR8_1X8, { V4L2_PIX_FMT_SBGGR8 } },
+	{ MEDIA_BUS_FMT_SGBRG8_1X8, { V4L2_PIX_FMT_SGBRG8 } },
+	{ MEDIA_BUS_FMT_SGRBG8_1X8, { V4L2_PIX_FMT_SGRBG8 } },
+	{ MEDIA_BUS_FMT_SRGGB8_1X8, { V4L2_PIX_FMT_SRGGB8 } },
+	{ MEDIA_BUS_FMT_SBGGR10_1X10, { V4L2_PIX_FMT_SBGGR10P, V4L2_PIX_FMT_SBGGR10 } },
+	{ MEDIA_BUS_FMT_SGBRG10_1X10, { V4L2_PIX_FMT_SGBRG10P, V4L2_PIX_FMT_SGBRG10 } },
+	{ MEDIA_BUS_FMT_SGRBG10_1X10, { V4L2_PIX_FMT_SGRBG10P, V4L2_PIX_FMT_SGRBG10 } },
+	{ MEDIA_BUS_FMT_SRGGB10_1X10, { V4L2_PIX_FMT_SRGGB10P, V4L2_PIX_FMT_SRGGB10 } },
+	{ MEDIA_BUS_FMT_SBGGR12_1X12, { V4L2_PIX_FMT_SBGGR12P, V4L2_PIX_FMT_SBGGR12 } },
+	{ MEDIA_BUS_FMT_SGBRG12_1X12, { V4L2_PIX_FMT_SGBRG12P, V4L2_PIX_FMT_SGBRG12 } },
+	{ MEDIA_BUS_FMT_SGRBG12_1X12, { V4L2_PIX_FMT_SGRBG12P, V4L2_PIX_FMT_SGRBG12 } },
+	{ MEDIA_BUS_FMT_SRGGB12_1X12, { V4L2_PIX_FMT_SRGGB12P, V4L2_PIX_FMT_SRGGB12 } },
+};
+
+/* The number of raw frames captured ahead of the requests. */
+constexpr unsigned int rawBufferCount = 4;
+
+/* The auto-exposure target, as the mean linear luminance of the frame. */
+constexpr float aeTarget = 0.18f;
+
+/* The fraction of the error corrected by the 3A algorithms at every frame. */
+constexpr float aeSpeed = 0.5f;
+constexpr float awbSpeed = 0.2f;
+
+} /* namespace */
+
+class SimpleCameraData : public CameraData
+{
+public:
+	SimpleCameraData(PipelineHandler *pipe)
+		: CameraData(pipe), sensor_(nullptr), video_(nullptr),
+		  aeEnabled_(true), awbEnabled_(true)
+	{
+	}
+
+	~SimpleCameraData()
+	{
+		for (const Entity &entity : entities_)
+			delete entity.subdev;
+		delete sensor_;
+		delete video_;
+	}
+
+	int init(MediaEntity *sensor);
+	void bufferReady(Buffer *buffer);
+
+	void processControls(Request *request);
+	void processStats(uint32_t sequence, const SoftIsp::Statistics &stats);
+
+	/* The subdevices between the sensor and the receiver video node. */
+	struct Entity {
+		V4L2Subdevice *subdev;
+		unsigned int sink;
+		unsigned int source;
+	};
+
+	CameraSensor *sensor_;
+	std::vector<Entity> entities_;
+	std::vector<MediaLink *> links_;
+	V4L2VideoDevice *video_;
+	Stream stream_;
+
+	/* The sensor media bus codes the receiver can capture. */
+	std::vector<unsigned int> sensorCodes_;
+
+	/*
+	 * Raw frames are captured continuously to internal buffers, and
+	 * processed to the buffers of the pending requests.
+	 */
+	BufferPool rawPool_;
+	std::vector<std::unique_ptr<Buffer>> rawBuffers_;
+	std::queue<Request *> pendingRequests_;
+
+	SoftIsp isp_;
+	V4L2DeviceFormat outputFormat_;
+	DmaHeapAllocator allocator_;
+
+	/* Auto-exposure and white balance, driving the sensor and ISP. */
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+	SoftIsp::Params params_;
+	bool aeEnabled_;
+	bool awbEnabled_;
+};
+
+class SimpleCameraConfiguration : public CameraConfiguration
+{
+public:
+	SimpleCameraConfiguration(Camera *camera, SimpleCameraData *data);
+
+	Status validate() override;
+
+	const V4L2SubdeviceFormat &sensorFormat() const { return sensorFormat_; }
+
+private:
+	/*
+	 * The SimpleCameraData instance is guaranteed to be valid as long as
+	 * the corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const SimpleCameraData *data_;
+
+	V4L2SubdeviceFormat sensorFormat_;
+};
+
+class PipelineHandlerSimple : public PipelineHandler
+{
+public:
+	PipelineHandlerSimple(CameraManager *manager);
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int allocateBuffers(Camera *camera,
+			    const std::set<Stream *> &streams) override;
+	int freeBuffers(Camera *camera,
+			const std::set<Stream *> &streams) override;
+
+	int start(Camera *camera) override;
+	void stop(Camera *camera) override;
+
+	int queueRequest(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	SimpleCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<SimpleCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+
+	int createCamera(MediaDevice *media, MediaEntity *sensor);
+};
+
+SimpleCameraConfiguration::SimpleCameraConfiguration(Camera *camera,
+						     SimpleCameraData *data)
+	: CameraConfiguration()
+{
+	camera_ = camera->shared_from_this();
+	data_ = data;
+}
+
+CameraConfiguration::Status SimpleCameraConfiguration::validate()
+{
+	const std::vector<unsigned int> &formats = SoftIsp::outputFormats();
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/* The ISP produces a single output. */
+	if (config_.size() > 1) {
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
+	StreamConfiguration &cfg = config_[0];
+
+	/* Frame decimation isn't supported. */
+	if (cfg.frameDecimation != 1) {
+		cfg.frameDecimation = 1;
+		status = Adjusted;
+	}
+
+	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+	    formats.end()) {
+		LOG(Simple, Debug) << "Adjusting format to NV12";
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		status = Adjusted;
+	}
+
+	/* The ISP doesn't scale, the output size is a sensor mode size. */
+	sensorFormat_ = data_->sensor_->getFormat(data_->sensorCodes_, cfg.size);
+	if (!sensorFormat_.mbus_code) {
+		LOG(Simple, Error) << "No supported sensor format";
+		return Invalid;
+	}
+
+	if (cfg.size != sensorFormat_.size) {
+		cfg.size = sensorFormat_.size;
+		LOG(Simple, Debug)
+			<< "Adjusting size to " << cfg.size.toString();
+		status = Adjusted;
+	}
+
+	cfg.bufferCount = queueDepth(2, 4, 8);
+
+	return status;
+}
+
+PipelineHandlerSimple::PipelineHandlerSimple(CameraManager *manager)
+	: PipelineHandler(manager)
+{
+}
+
+CameraConfiguration *PipelineHandlerSimple::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	SimpleCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new SimpleCameraConfiguration(camera, data);
+
+	if (roles.empty())
+		return config;
+
+	StreamConfiguration cfg{};
+	cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+	cfg.size = data->sensor_->resolution();
+	cfg.bufferCount = 4;
+
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerSimple::configure(Camera *camera, CameraConfiguration *c)
+{
+	SimpleCameraConfiguration *config =
+		static_cast<SimpleCameraConfiguration *>(c);
+	SimpleCameraData *data = cameraData(camera);
+	StreamConfiguration &cfg = config->at(0);
+	int ret;
+
+	/* Propagate the sensor format along the pipeline. */
+	V4L2SubdeviceFormat subformat = config->sensorFormat();
+	ret = data->sensor_->setFormat(&subformat);
+	if (ret)
+		return ret;
+
+	for (const SimpleCameraData::Entity &entity : data->entities_) {
+		ret = entity.subdev->setFormat(entity.sink, &subformat);
+		if (ret)
+			return ret;
+
+		ret = entity.subdev->setFormat(entity.source, &subformat);
+		if (ret)
+			return ret;
+	}
+
+	if (subformat.size != cfg.size) {
+		LOG(Simple, Error)
+			<< "Sensor format " << subformat.toString()
+			<< " not supported by the pipeline";
+		return -EINVAL;
+	}
+
+	/* Prefer the packed formats, they use less memory bandwidth. */
+	V4L2DeviceFormat format = {};
+	for (unsigned int fourcc : bayerFormats.at(subformat.mbus_code)) {
+		format = {};
+		format.fourcc = fourcc;
+		format.size = subformat.size;
+
+		ret = data->video_->setFormat(&format);
+		if (ret)
+			return ret;
+
+		if (format.fourcc == fourcc && format.size == subformat.size)
+			break;
+
+		format.fourcc = 0;
+	}
+
+	if (!format.fourcc) {
+		LOG(Simple, Error)
+			<< "Failed to set format on the receiver: "
+			<< format.toString();
+		return -EINVAL;
+	}
+
+	ret = data->isp_.configure(format.fourcc, format.size,
+				   format.planes[0].bpl, cfg.pixelFormat);
+	if (ret)
+		return ret;
+
+	data->outputFormat_ = {};
+	data->outputFormat_.fourcc = cfg.pixelFormat;
+	data->outputFormat_.size = cfg.size;
+	data->outputFormat_.planesCount = 1;
+	data->outputFormat_.planes[0].size = data->isp_.frameSize();
+
+	LOG(Simple, Debug)
+		<< "Processing " << format.toString() << " to " << cfg.toString();
+
+	cfg.setStream(&data->stream_);
+
+	return 0;
+}
+
+/*
+ * Allocate the internal raw buffers the receiver captures to, and the output
+ * buffers for streams that don't use external memory.
+ */
+int PipelineHandlerSimple::allocateBuffers(Camera *camera,
+					   const std::set<Stream *> &streams)
+{
+	SimpleCameraData *data = cameraData(camera);
+	Stream *stream = &data->stream_;
+	BufferPool &pool = stream->bufferPool();
+	int ret;
+
+	if (stream->memoryType() == UserPtrMemory) {
+		LOG(Simple, Error) << "User pointer memory not supported";
+		return -ENOTSUP;
+	}
+
+	data->rawPool_.createBuffers(rawBufferCount);
+	ret = data->video_->exportBuffers(&data->rawPool_);
+	if (ret)
+		return ret;
+
+	if (stream->memoryType() == ExternalMemory)
+		return 0;
+
+	if (!data->allocator_.isValid()) {
+		LOG(Simple, Error) << "No dma-heap to allocate output buffers";
+		ret = -ENODEV;
+		goto error;
+	}
+
+	ret = data->allocator_.allocate(data->outputFormat_, pool.count());
+	if (ret < 0)
+		goto error;
+
+	for (unsigned int i = 0; i < pool.count(); ++i) {
+		PlaneArray &planes = pool.buffers()[i].planes();
+
+		planes.clear();
+		planes.emplace_back();
+		ret = planes.back().setDmabuf(data->allocator_.dmabufs(i)[0],
+					      data->outputFormat_.planes[0].size);
+		if (ret)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	data->allocator_.release();
+	data->video_->releaseBuffers();
+	data->rawPool_.destroyBuffers();
+	return ret;
+}
+
+int PipelineHandlerSimple::freeBuffers(Camera *camera,
+				       const std::set<Stream *> &streams)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	data->allocator_.release();
+
+	int ret = data->video_->releaseBuffers();
+	data->rawPool_.destroyBuffers();
+
+	return ret;
+}
+
+int PipelineHandlerSimple::start(Camera *camera)
+{
+	SimpleCameraData *data = cameraData(camera);
+	int ret;
+
+	if (data->delayedCtrls_) {
+		ret = data->delayedCtrls_->reset();
+		if (ret)
+			return ret;
+	}
+
+	data->rawBuffers_ = data->video_->queueAllBuffers();
+	if (data->rawBuffers_.empty()) {
+		LOG(Simple, Error) << "Failed to queue raw buffers";
+		return -EINVAL;
+	}
+
+	ret = data->video_->streamOn();
+	if (ret) {
+		data->rawBuffers_.clear();
+		return ret;
+	}
+
+	return 0;
+}
+
+void PipelineHandlerSimple::stop(Camera *camera)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	data->video_->streamOff();
+	data->rawBuffers_.clear();
+
+	while (!data->pendingRequests_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		data->pendingRequests_.pop();
+
+		for (auto it : request->buffers())
+			cancelBuffer(camera, request, it.second);
+
+		completeRequest(camera, request);
+	}
+}
+
+int PipelineHandlerSimple::queueRequest(Camera *camera, Request *request)
+{
+	SimpleCameraData *data = cameraData(camera);
+	Buffer *buffer = request->findBuffer(&data->stream_);
+	if (!buffer) {
+		LOG(Simple, Error)
+			<< "Attempt to queue request with invalid stream";
+
+		return -ENOENT;
+	}
+
+	data->processControls(request);
+
+	PipelineHandler::queueRequest(camera, request);
+	data->pendingRequests_.push(request);
+
+	return 0;
+}
+
+bool PipelineHandlerSimple::match(DeviceEnumerator *enumerator)
+{
+	for (const char *driver : supportedDrivers) {
+		DeviceMatch dm(driver);
+
+		MediaDevice *media = acquireMediaDevice(enumerator, dm);
+		if (!media)
+			continue;
+
+		unsigned int numCameras = 0;
+		for (MediaEntity *entity : media->entities()) {
+			if (entity->function() != MEDIA_ENT_F_CAM_SENSOR)
+				continue;
+
+			if (!createCamera(media, entity))
+				numCameras++;
+		}
+
+		return numCameras != 0;
+	}
+
+	return false;
+}
+
+int PipelineHandlerSimple::createCamera(MediaDevice *media, MediaEntity *sensor)
+{
+	std::unique_ptr<SimpleCameraData> data =
+		utils::make_unique<SimpleCameraData>(this);
+
+	int ret = data->init(sensor);
+	if (ret) {
+		LOG(Simple, Debug)
+			<< "Skipping sensor " << sensor->name() << ": " << ret;
+		return ret;
+	}
+
+	std::set<Stream *> streams{ &data->stream_ };
+	std::shared_ptr<Camera> camera =
+		Camera::create(this, sensor->name(), streams);
+	registerCamera(std::move(camera), std::move(data));
+
+	return 0;
+}
+
+/*
+ * Locate the video node the sensor frames are captured to, following the
+ * links from the sensor through the receiver subdevices, and open the devices
+ * along the path.
+ */
+int SimpleCameraData::init(MediaEntity *sensor)
+{
+	MediaEntity *entity = sensor;
+	MediaPad *sink = nullptr;
+	int ret;
+
+	while (entity->function() != MEDIA_ENT_F_IO_V4L) {
+		/* Prefer the enabled links, and the first link otherwise. */
+		MediaLink *next = nullptr;
+		MediaPad *source = nullptr;
+
+		for (MediaPad *pad : entity->pads()) {
+			if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
+				continue;
+
+			for (MediaLink *link : pad->links()) {
+				if (!next || (link->flags() & MEDIA_LNK_FL_ENABLED)) {
+					next = link;
+					source = pad;
+				}
+			}
+		}
+
+		if (!next || links_.size() > 8)
+			return -ENODEV;
+
+		if (entity != sensor)
+			entities_.push_back({ new V4L2Subdevice(entity),
+					      sink->index(), source->index() });
+
+		links_.push_back(next);
+		sink = next->sink();
+		entity = sink->entity();
+	}
+
+	for (MediaLink *link : links_) {
+		if (link->flags() & MEDIA_LNK_FL_ENABLED)
+			continue;
+
+		ret = link->setEnabled(true);
+		if (ret < 0)
+			return ret;
+	}
+
+	sensor_ = new CameraSensor(sensor);
+	ret = sensor_->init();
+	if (ret)
+		return ret;
+
+	for (unsigned int code : sensor_->mbusCodes()) {
+		if (bayerFormats.count(code))
+			sensorCodes_.push_back(code);
+	}
+
+	if (sensorCodes_.empty()) {
+		LOG(Simple, Debug) << "No raw Bayer sensor format";
+		return -EINVAL;
+	}
+
+	for (const Entity &e : entities_) {
+		ret = e.subdev->open();
+		if (ret)
+			return ret;
+	}
+
+	video_ = new V4L2VideoDevice(entity);
+	ret = video_->open();
+	if (ret)
+		return ret;
+
+	video_->bufferReady.connect(this, &SimpleCameraData::bufferReady);
+
+	/*
+	 * Drive the exposure time and analogue gain when the sensor supports
+	 * them. The delays are the most common ones, exposure takes one frame
+	 * longer than gain to apply.
+	 */
+	const ControlInfoMap &sensorControls = sensor_->controls();
+	std::unordered_map<uint32_t, unsigned int> delays;
+	if (sensorControls.find(V4L2_CID_EXPOSURE) != sensorControls.end())
+		delays[V4L2_CID_EXPOSURE] = 2;
+	if (sensorControls.find(V4L2_CID_ANALOGUE_GAIN) != sensorControls.end())
+		delays[V4L2_CID_ANALOGUE_GAIN] = 1;
+
+	ControlInfoMap::Map ctrls;
+	if (!delays.empty()) {
+		delayedCtrls_ = utils::make_unique<DelayedControls>(sensor_, delays);
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::AeEnable),
+			      std::forward_as_tuple(false, true));
+	} else {
+		aeEnabled_ = false;
+	}
+
+	ctrls.emplace(std::piecewise_construct,
+		      std::forward_as_tuple(&controls::AwbEnable),
+		      std::forward_as_tuple(false, true));
+
+	controlInfo_ = std::move(ctrls);
+
+	return 0;
+}
+
+void SimpleCameraData::processControls(Request *request)
+{
+	const ControlList &controls = request->controls();
+
+	if (delayedCtrls_ && controls.contains(controls::AeEnable))
+		aeEnabled_ = controls.get(controls::AeEnable);
+	if (controls.contains(controls::AwbEnable))
+		awbEnabled_ = controls.get(controls::AwbEnable);
+}
+
+void SimpleCameraData::bufferReady(Buffer *buffer)
+{
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	uint32_t sequence = buffer->sequence();
+
+	if (delayedCtrls_)
+		delayedCtrls_->applyControls(sequence + 1);
+
+	/* Drop the frames captured when no request is pending. */
+	if (pendingRequests_.empty()) {
+		video_->queueBuffer(buffer);
+		return;
+	}
+
+	Request *request = pendingRequests_.front();
+	pendingRequests_.pop();
+
+	Buffer *output = request->findBuffer(&stream_);
+	unsigned int bytesused = 0;
+	SoftIsp::Statistics stats;
+
+	if (buffer->status() == Buffer::BufferSuccess) {
+		Plane &src = rawPool_.buffers()[buffer->index()].planes()[0];
+		Plane &dst = output->mem()->planes()[0];
+
+		CpuAccess srcAccess(src, Plane::AccessRead);
+		CpuAccess dstAccess(dst, Plane::AccessWrite);
+
+		if (!src.mem() || !dst.mem() || dst.length() < isp_.frameSize()) {
+			LOG(Simple, Warning)
+				<< "Failed to map buffers for frame " << sequence;
+		} else {
+			isp_.process(static_cast<const uint8_t *>(src.mem()),
+				     static_cast<uint8_t *>(dst.mem()), &stats);
+			bytesused = isp_.frameSize();
+		}
+	}
+
+	video_->queueBuffer(buffer);
+
+	if (delayedCtrls_) {
+		ControlList ctrls = delayedCtrls_->get(sequence);
+		if (ctrls.contains(V4L2_CID_EXPOSURE))
+			request->metadata().set(controls::SensorExposure,
+						ctrls.get(V4L2_CID_EXPOSURE).get<int32_t>());
+		if (ctrls.contains(V4L2_CID_ANALOGUE_GAIN))
+			request->metadata().set(controls::SensorAnalogueGain,
+						ctrls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>());
+	}
+
+	pipe_->copyBufferMetadata(output, buffer, bytesused);
+	pipe_->completeBuffer(camera_, request, output);
+	pipe_->completeRequest(camera_, request);
+
+	if (bytesused)
+		processStats(sequence, stats);
+}
+
+/*
+ * Run the auto white balance and exposure algorithms on the statistics of the
+ * frame \a sequence. The white balance assumes a grey world, and the exposure
+ * targets a fixed mean luminance, favouring the exposure time over the gain.
+ * The analogue gain code is assumed to be linear.
+ */
+void SimpleCameraData::processStats(uint32_t sequence,
+				    const SoftIsp::Statistics &stats)
+{
+	if (!stats.pixels)
+		return;
+
+	if (awbEnabled_ && stats.sum[0] && stats.sum[2]) {
+		float green = stats.sum[1];
+		for (unsigned int c : { 0, 2 }) {
+			float target = params_.gains[c] * green / stats.sum[c];
+			target = std::min(std::max(target, 0.25f), 8.0f);
+			params_.gains[c] += (target - params_.gains[c]) * awbSpeed;
+		}
+
+		isp_.setParams(params_);
+	}
+
+	if (!aeEnabled_)
+		return;
+
+	float mean = 0.0f;
+	for (unsigned int i = 0; i < SoftIsp::HISTOGRAM_BINS; ++i)
+		mean += (i + 0.5f) * stats.histogram[i];
+	mean /= static_cast<float>(stats.pixels) * SoftIsp::HISTOGRAM_BINS;
+
+	float factor = aeTarget / std::max(mean, 0.001f);
+	factor = 1.0f + (std::min(std::max(factor, 0.25f), 4.0f) - 1.0f) * aeSpeed;
+
+	const ControlInfoMap &info = sensor_->controls();
+	ControlList frame = delayedCtrls_->get(sequence);
+	ControlList ctrls(info);
+
+	int32_t exposure = 1;
+	int32_t gain = 1;
+	int32_t minGain = 1;
+	int32_t maxGain = 1;
+
+	if (frame.contains(V4L2_CID_ANALOGUE_GAIN)) {
+		const ControlRange &range = info.at(V4L2_CID_ANALOGUE_GAIN);
+		gain = std::max(frame.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>(), 1);
+		minGain = std::max(range.min().get<int32_t>(), 1);
+		maxGain = std::max(range.max().get<int32_t>(), minGain);
+	}
+
+	float desired = std::max(exposure * gain * factor, 1.0f);
+
+	if (frame.contains(V4L2_CID_EXPOSURE)) {
+		const ControlRange &range = info.at(V4L2_CID_EXPOSURE);
+		exposure = std::max(frame.get(V4L2_CID_EXPOSURE).get<int32_t>(), 1);
+		desired = std::max(exposure * gain * factor, 1.0f);
+
+		int32_t minExposure = std::max(range.min().get<int32_t>(), 1);
+		int32_t maxExposure = std::max(range.max().get<int32_t>(), minExposure);
+		exposure = std::lround(desired / minGain);
+		exposure = std::min(std::max(exposure, minExposure), maxExposure);
+		ctrls.set(V4L2_CID_EXPOSURE, exposure);
+	}
+
+	if (frame.contains(V4L2_CID_ANALOGUE_GAIN)) {
+		gain = std::lround(desired / exposure);
+		gain = std::min(std::max(gain, minGain), maxGain);
+		ctrls.set(V4L2_CID_ANALOGUE_GAIN, gain);
+	}
+
+	if (!delayedCtrls_->push(ctrls))
+		LOG(Simple, Debug) << "Failed to queue sensor controls";
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerSimple);
+
+} /* namespace libcamera */
@@ -0,0 +1,634 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * synthetic.cpp - Pipeline handler for synthetic cameras
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "log.h"
+#include "pipeline_handler.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Synthetic)
+
+namespace {
+
+/* The frame duration limits, in microseconds. */
+constexpr int64_t SYNTHETIC_MIN_FRAME_DURATION = 1000000 / 240;
+constexpr int64_t SYNTHETIC_MAX_FRAME_DURATION = 1000000;
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *env = utils::secure_getenv(name);
+	if (!env || !*env)
+		return defaultValue;
+
+	char *end;
+	unsigned long value = strtoul(env, &end, 10);
+	if (*end) {
+		LOG(Synthetic, Warning) << "Invalid " << name << " value " << env;
+		return defaultValue;
+	}
+
+	return value;
+}
+
+struct SyntheticFormat {
+	unsigned int fourcc;
+	unsigned int bpp;
+	/* The offsets of the red, green and blue components in a pixel. */
+	std::array<unsigned int, 3> offsets;
+};
+
+const std::array<SyntheticFormat, 3> syntheticFormats{ {
+	{ V4L2_PIX_FMT_RGB24, 3, { { 0, 1, 2 } } },
+	{ V4L2_PIX_FMT_BGR24, 3, { { 2, 1, 0 } } },
+	{ V4L2_PIX_FMT_ARGB32, 4, { { 2, 1, 0 } } },
+} };
+
+const SyntheticFormat *findFormat(unsigned int fourcc)
+{
+	for (const SyntheticFormat &format : syntheticFormats) {
+		if (format.fourcc == fourcc)
+			return &format;
+	}
+
+	return nullptr;
+}
+
+} /* namespace */
+
+class SyntheticCameraData : public CameraData
+{
+public:
+	enum Pattern {
+		PatternNone,
+		PatternBars,
+	};
+
+	SyntheticCameraData(PipelineHandler *pipe);
+
+	void configure(const StreamConfiguration &cfg);
+	int allocateMemory(Stream *stream, unsigned int first);
+
+	void start();
+	void stop();
+
+	void queueRequest(Request *request);
+
+	Stream stream_;
+
+	unsigned int frameSize_;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct ProcessingRequest {
+		Request *request;
+		Clock::time_point deadline;
+	};
+
+	void scheduleFrame();
+	void frameTimeout(Timer *timer);
+	void ipaTimeout(Timer *timer);
+
+	void fillBuffer(Buffer *buffer);
+
+	Pattern pattern_;
+	std::chrono::microseconds jitter_;
+	std::chrono::microseconds ipaLatency_;
+	std::chrono::microseconds frameDuration_;
+
+	Timer frameTimer_;
+	Timer ipaTimer_;
+	std::mt19937 random_;
+
+	std::deque<Request *> waitingRequests_;
+	std::deque<ProcessingRequest> processingRequests_;
+
+	Size size_;
+	unsigned int stride_;
+	unsigned int bpp_;
+	std::vector<uint8_t> line_;
+
+	unsigned int sequence_;
+	Clock::time_point nextFrame_;
+};
+
+class SyntheticCameraConfiguration : public CameraConfiguration
+{
+public:
+	SyntheticCameraConfiguration();
+
+	Status validate() override;
+};
+
+class PipelineHandlerSynthetic : public PipelineHandler
+{
+public:
+	PipelineHandlerSynthetic(CameraManager *manager);
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int allocateBuffers(Camera *camera,
+			    const std::set<Stream *> &streams) override;
+	int freeBuffers(Camera *camera,
+			const std::set<Stream *> &streams) override;
+	int addBuffers(Camera *camera, Stream *stream,
+		       unsigned int count) override;
+
+	int start(Camera *camera) override;
+	void stop(Camera *camera) override;
+
+	int queueRequest(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	SyntheticCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<SyntheticCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+};
+
+/*
+ * The frames are produced from timers at LIBCAMERA_SYNTHETIC_FPS frames per
+ * second, with a random jitter of up to LIBCAMERA_SYNTHETIC_JITTER
+ * microseconds. Requests complete LIBCAMERA_SYNTHETIC_IPA_LATENCY microseconds
+ * after their frame to simulate IPA processing. Setting
+ * LIBCAMERA_SYNTHETIC_PATTERN to "none" skips filling the buffers with the
+ * color bars test pattern.
+ */
+SyntheticCameraData::SyntheticCameraData(PipelineHandler *pipe)
+	: CameraData(pipe), frameSize_(0), random_(0), stride_(0), bpp_(0),
+	  sequence_(0)
+{
+	unsigned int fps = std::max(envValue("LIBCAMERA_SYNTHETIC_FPS", 30), 1U);
+	frameDuration_ = std::chrono::microseconds(utils::clamp<int64_t>(1000000 / fps,
+		SYNTHETIC_MIN_FRAME_DURATION, SYNTHETIC_MAX_FRAME_DURATION));
+
+	/* Keep the frames in order, the jitter can't reach half a frame. */
+	jitter_ = std::min(std::chrono::microseconds(envValue("LIBCAMERA_SYNTHETIC_JITTER", 0)),
+			   frameDuration_ / 2 - std::chrono::microseconds(1));
+	ipaLatency_ = std::chrono::microseconds(envValue("LIBCAMERA_SYNTHETIC_IPA_LATENCY", 0));
+
+	const char *pattern = utils::secure_getenv("LIBCAMERA_SYNTHETIC_PATTERN");
+	if (pattern && !strcmp(pattern, "none"))
+		pattern_ = PatternNone;
+	else
+		pattern_ = PatternBars;
+
+	frameTimer_.timeout.connect(this, &SyntheticCameraData::frameTimeout);
+	ipaTimer_.timeout.connect(this, &SyntheticCameraData::ipaTimeout);
+}
+
+void SyntheticCameraData::configure(const StreamConfiguration &cfg)
+{
+	const SyntheticFormat *format = findFormat(cfg.pixelFormat);
+
+	size_ = cfg.size;
+	bpp_ = format->bpp;
+	stride_ = size_.width * bpp_;
+	frameSize_ = stride_ * size_.height;
+
+	/*
+	 * Render a line of 100% color bars twice the frame width. The frames
+	 * are filled with a window of the line offset by the frame sequence
+	 * number, which scrolls the bars and makes consecutive frames differ.
+	 */
+	static const std::array<std::array<uint8_t, 3>, 8> colors{ {
+		{ { 255, 255, 255 } },
+		{ { 255, 255, 0 } },
+		{ { 0, 255, 255 } },
+		{ { 0, 255, 0 } },
+		{ { 255, 0, 255 } },
+		{ { 255, 0, 0 } },
+		{ { 0, 0, 255 } },
+		{ { 0, 0, 0 } },
+	} };
+
+	unsigned int barWidth = std::max<unsigned int>(size_.width / colors.size(), 1);
+
+	line_.assign(stride_ * 2, 0xff);
+	for (unsigned int x = 0; x < size_.width * 2; ++x) {
+		const std::array<uint8_t, 3> &color =
+			colors[(x / barWidth) % colors.size()];
+		uint8_t *pixel = &line_[x * bpp_];
+
+		for (unsigned int i = 0; i < 3; ++i)
+			pixel[format->offsets[i]] = color[i];
+	}
+}
+
+/*
+ * Back the buffers of the stream pool starting at index \a first with memfd
+ * objects, which the rest of libcamera handles as dmabufs.
+ */
+int SyntheticCameraData::allocateMemory(Stream *stream, unsigned int first)
+{
+	std::vector<BufferMemory> &buffers = stream->bufferPool().buffers();
+
+	for (unsigned int i = first; i < buffers.size(); ++i) {
+		int fd = memfd_create("libcamera-synthetic", MFD_CLOEXEC);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(Synthetic, Error)
+				<< "Failed to create buffer memory: " << strerror(-ret);
+			return ret;
+		}
+
+		if (ftruncate(fd, frameSize_) < 0) {
+			int ret = -errno;
+			LOG(Synthetic, Error)
+				<< "Failed to size buffer memory: " << strerror(-ret);
+			close(fd);
+			return ret;
+		}
+
+		buffers[i].planes().emplace_back();
+		int ret = buffers[i].planes().back().setDmabuf(fd, frameSize_);
+		close(fd);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+void SyntheticCameraData::start()
+{
+	sequence_ = 0;
+	nextFrame_ = Clock::now() + frameDuration_;
+	scheduleFrame();
+}
+
+void SyntheticCameraData::stop()
+{
+	frameTimer_.stop();
+	ipaTimer_.stop();
+
+	/* The buffers of the requests being processed have completed. */
+	while (!processingRequests_.empty()) {
+		Request *request = processingRequests_.front().request;
+		processingRequests_.pop_front();
+		pipe_->completeRequest(camera_, request);
+	}
+
+	while (!waitingRequests_.empty()) {
+		Request *request = waitingRequests_.front();
+		waitingRequests_.pop_front();
+
+		for (auto it : request->buffers())
+			pipe_->cancelBuffer(camera_, request, it.second);
+		pipe_->completeRequest(camera_, request);
+	}
+}
+
+void SyntheticCameraData::queueRequest(Request *request)
+{
+	ControlList &controls = request->controls();
+	if (controls.contains(controls::FrameDuration)) {
+		int64_t duration = utils::clamp(controls.get(controls::FrameDuration),
+						SYNTHETIC_MIN_FRAME_DURATION,
+						SYNTHETIC_MAX_FRAME_DURATION);
+		frameDuration_ = std::chrono::microseconds(duration);
+		jitter_ = std::min(jitter_, frameDuration_ / 2 - std::chrono::microseconds(1));
+	}
+
+	pipe_->traceRequest(request, Request::StageDeviceQueued);
+	waitingRequests_.push_back(request);
+}
+
+void SyntheticCameraData::scheduleFrame()
+{
+	Clock::time_point deadline = nextFrame_;
+
+	if (jitter_.count()) {
+		std::uniform_int_distribution<int64_t> distribution(-jitter_.count(),
+								    jitter_.count());
+		deadline += std::chrono::microseconds(distribution(random_));
+	}
+
+	frameTimer_.start(deadline);
+}
+
+void SyntheticCameraData::frameTimeout(Timer *timer)
+{
+	Clock::time_point now = Clock::now();
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		now.time_since_epoch()).count();
+
+	/* Frames are produced, and dropped, without requests like sensors. */
+	if (!waitingRequests_.empty()) {
+		Request *request = waitingRequests_.front();
+		waitingRequests_.pop_front();
+
+		pipe_->startRequest(camera_, timestamp);
+
+		int64_t duration = frameDuration_.count();
+		request->metadata().set(controls::FrameDuration, duration);
+
+		/* Decimated and throttled frames are not rendered. */
+		bool skip = pipe_->skipFrame(camera_, &stream_, sequence_);
+
+		for (auto it : request->buffers()) {
+			Buffer *buffer = it.second;
+
+			if (skip) {
+				pipe_->skipBuffer(camera_, request, buffer);
+				continue;
+			}
+
+			fillBuffer(buffer);
+			pipe_->setBufferMetadata(buffer, sequence_, timestamp,
+						 buffer->mem()->planes().empty() ? 0 : frameSize_);
+			pipe_->completeBuffer(camera_, request, buffer);
+		}
+
+		if (!ipaLatency_.count()) {
+			pipe_->completeRequest(camera_, request);
+		} else {
+			processingRequests_.push_back({ request, now + ipaLatency_ });
+			if (!ipaTimer_.isRunning())
+				ipaTimer_.start(processingRequests_.front().deadline);
+		}
+	}
+
+	sequence_++;
+
+	/* Skip the frames that the event loop has been too late for. */
+	nextFrame_ += frameDuration_;
+	while (nextFrame_ <= now) {
+		nextFrame_ += frameDuration_;
+		sequence_++;
+	}
+
+	scheduleFrame();
+}
+
+void SyntheticCameraData::ipaTimeout(Timer *timer)
+{
+	Clock::time_point now = Clock::now();
+
+	while (!processingRequests_.empty()) {
+		ProcessingRequest &processing = processingRequests_.front();
+		if (processing.deadline > now) {
+			ipaTimer_.start(processing.deadline);
+			return;
+		}
+
+		Request *request = processing.request;
+		processingRequests_.pop_front();
+
+		pipe_->traceRequest(request, Request::StageIPAAction);
+		pipe_->completeRequest(camera_, request);
+	}
+}
+
+void SyntheticCameraData::fillBuffer(Buffer *buffer)
+{
+	if (pattern_ == PatternNone || buffer->mem()->planes().empty())
+		return;
+
+	Plane &plane = buffer->mem()->planes()[0];
+	uint8_t *mem = static_cast<uint8_t *>(plane.mem());
+	if (!mem || plane.length() < frameSize_)
+		return;
+
+	const uint8_t *src = &line_[(sequence_ * 4 % size_.width) * bpp_];
+	for (unsigned int y = 0; y < size_.height; ++y)
+		memcpy(mem + y * stride_, src, stride_);
+}
+
+SyntheticCameraConfiguration::SyntheticCameraConfiguration()
+	: CameraConfiguration()
+{
+}
+
+CameraConfiguration::Status SyntheticCameraConfiguration::validate()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/* Cap the number of entries to the available streams. */
+	if (config_.size() > 1) {
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
+	StreamConfiguration &cfg = config_[0];
+
+	/* Adjust the pixel format. */
+	if (!findFormat(cfg.pixelFormat)) {
+		LOG(Synthetic, Debug) << "Adjusting format to RGB24";
+		cfg.pixelFormat = V4L2_PIX_FMT_RGB24;
+		status = Adjusted;
+	}
+
+	/* Clamp the size to reasonable limits. */
+	const Size size = cfg.size;
+
+	cfg.size.width = std::max(16U, std::min(4096U, cfg.size.width));
+	cfg.size.height = std::max(16U, std::min(2160U, cfg.size.height));
+
+	if (cfg.size != size) {
+		LOG(Synthetic, Debug)
+			<< "Adjusting size to " << cfg.size.toString();
+		status = Adjusted;
+	}
+
+	if (!cfg.frameDecimation) {
+		cfg.frameDecimation = 1;
+		status = Adjusted;
+	}
+
+	/* Keep the number of buffers requested by the application if any. */
+	if (!cfg.bufferCount || queueProfile_ != Balanced)
+		cfg.bufferCount = queueDepth(2, 4, 8);
+
+	return status;
+}
+
+PipelineHandlerSynthetic::PipelineHandlerSynthetic(CameraManager *manager)
+	: PipelineHandler(manager)
+{
+}
+
+CameraConfiguration *PipelineHandlerSynthetic::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	CameraConfiguration *config = new SyntheticCameraConfiguration();
+
+	if (roles.empty())
+		return config;
+
+	StreamConfiguration cfg{};
+	cfg.pixelFormat = V4L2_PIX_FMT_RGB24;
+	cfg.size = { 640, 480 };
+	cfg.bufferCount = 4;
+
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerSynthetic::configure(Camera *camera, CameraConfiguration *config)
+{
+	SyntheticCameraData *data = cameraData(camera);
+	StreamConfiguration &cfg = config->at(0);
+
+	data->configure(cfg);
+	cfg.setStream(&data->stream_);
+
+	return 0;
+}
+
+int PipelineHandlerSynthetic::allocateBuffers(Camera *camera,
+					      const std::set<Stream *> &streams)
+{
+	SyntheticCameraData *data = cameraData(camera);
+	Stream *stream = *streams.begin();
+
+	/* Imported buffers are mapped by the stream when queued. */
+	if (stream->memoryType() != InternalMemory)
+		return 0;
+
+	return data->allocateMemory(stream, 0);
+}
+
+int PipelineHandlerSynthetic::freeBuffers(Camera *camera,
+					  const std::set<Stream *> &streams)
+{
+	/* The memory is released with the stream buffer pool. */
+	return 0;
+}
+
+int PipelineHandlerSynthetic::addBuffers(Camera *camera, Stream *stream,
+					 unsigned int count)
+{
+	SyntheticCameraData *data = cameraData(camera);
+
+	if (stream->memoryType() != InternalMemory)
+		return 0;
+
+	return data->allocateMemory(stream, stream->bufferPool().count() - count);
+}
+
+int PipelineHandlerSynthetic::start(Camera *camera)
+{
+	SyntheticCameraData *data = cameraData(camera);
+	data->start();
+
+	return 0;
+}
+
+void PipelineHandlerSynthetic::stop(Camera *camera)
+{
+	SyntheticCameraData *data = cameraData(camera);
+	data->stop();
+}
+
+int PipelineHandlerSynthetic::queueRequest(Camera *camera, Request *request)
+{
+	SyntheticCameraData *data = cameraData(camera);
+
+	Buffer *buffer = request->findBuffer(&data->stream_);
+	if (!buffer) {
+		LOG(Synthetic, Error)
+			<< "Attempt to queue request with invalid stream";
+		return -ENOENT;
+	}
+
+	PipelineHandler::queueRequest(camera, request);
+	data->queueRequest(request);
+
+	return 0;
+}
+
+/*
+ * Synthetic cameras are disabled by default, and enabled by setting the
+ * LIBCAMERA_SYNTHETIC_CAMERAS environment variable to the number of cameras to
+ * create. Each pipeline handler instance registers one camera, named
+ * "Synthetic <index>", such that cameras are recreated when the camera manager
+ * is restarted and each of them runs in its own thread when pipeline threads
+ * are enabled.
+ */
+bool PipelineHandlerSynthetic::match(DeviceEnumerator *enumerator)
+{
+	unsigned int count = envValue("LIBCAMERA_SYNTHETIC_CAMERAS", 0);
+
+	std::string name;
+	unsigned int index;
+	for (index = 0; index < count; ++index) {
+		name = "Synthetic " + std::to_string(index);
+		if (!manager_->get(name))
+			break;
+	}
+
+	if (index == count)
+		return false;
+
+	std::unique_ptr<SyntheticCameraData> data =
+		utils::make_unique<SyntheticCameraData>(this);
+
+	ControlInfoMap::Map ctrls;
+	ctrls.emplace(std::piecewise_construct,
+		      std::forward_as_tuple(&controls::FrameDuration),
+		      std::forward_as_tuple(SYNTHETIC_MIN_FRAME_DURATION,
+					    SYNTHETIC_MAX_FRAME_DURATION));
+	data->controlInfo_ = std::move(ctrls);
+
+	/* Create and register the camera. */
+	std::set<Stream *> streams{ &data->stream_ };
+	std::shared_ptr<Camera> camera = Camera::create(this, name, streams);
+	registerCamera(std::move(camera), std::move(data));
+
+	return true;
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerSynthetic);
+
+} /* namespace libcamera */
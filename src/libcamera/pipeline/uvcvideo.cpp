@@ -6,53 +6,290 @@
  */
 
 #include <algorithm>
+#include <deque>
 #include <iomanip>
+#include <queue>
+#include <string.h>
 #include <tuple>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/object.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "device_enumerator.h"
+#include "dma_heap.h"
+#include "formats.h"
+#include "frame_scaler.h"
 #include "log.h"
+#include "m2m_converter.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
 #include "utils.h"
 #include "v4l2_controls.h"
 #include "v4l2_videodevice.h"
 
+#ifdef HAVE_LIBJPEG
+#include "mjpeg_decoder.h"
+#endif
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
-class UVCCameraData : public CameraData
+namespace {
+
+/* UVC payload header bmHeaderInfo flags. */
+constexpr uint8_t UVC_STREAM_PTS = 1 << 2;
+constexpr uint8_t UVC_STREAM_SCR = 1 << 3;
+
+uint32_t readLE32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) |
+	       (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool supportsFormat(const ImageFormats &formats, unsigned int fourcc,
+		    const Size &size)
+{
+	const std::map<unsigned int, std::vector<SizeRange>> &data = formats.data();
+	auto it = data.find(fourcc);
+	if (it == data.end())
+		return false;
+
+	for (const SizeRange &range : it->second) {
+		if (range.contains(size))
+			return true;
+	}
+
+	return false;
+}
+
+} /* namespace */
+
+/*
+ * Convert the UVC device clock to the host clock.
+ *
+ * UVC devices timestamp frames with the device clock in the payload header
+ * PTS, and report in the payload header SCR the value of the device clock at
+ * the time the payload was sent. The uvcvideo driver reports the host time at
+ * which each payload has been received along with the headers. A linear
+ * regression over the most recent SCR samples estimates both the offset and
+ * the frequency of the device clock relative to the host clock, smoothing out
+ * the USB scheduling jitter.
+ */
+class UVCClock
+{
+public:
+	UVCClock();
+
+	void reset();
+	void addSample(uint32_t stc, uint64_t timestamp);
+	bool convert(uint32_t pts, uint64_t *timestamp) const;
+
+private:
+	static constexpr unsigned int MAX_SAMPLES = 32;
+
+	struct Sample {
+		/* The device clock, extended to 64 bits to handle wrap-around. */
+		uint64_t stc;
+		uint64_t timestamp;
+	};
+
+	std::deque<Sample> samples_;
+};
+
+UVCClock::UVCClock()
+{
+}
+
+void UVCClock::reset()
+{
+	samples_.clear();
+}
+
+void UVCClock::addSample(uint32_t stc, uint64_t timestamp)
+{
+	Sample sample{ stc, timestamp };
+
+	if (!samples_.empty()) {
+		const Sample &last = samples_.back();
+
+		/* Consecutive payloads often carry the same SCR. */
+		if (static_cast<uint32_t>(last.stc) == stc ||
+		    timestamp <= last.timestamp)
+			return;
+
+		sample.stc = last.stc + static_cast<uint32_t>(stc - last.stc);
+	}
+
+	samples_.push_back(sample);
+	if (samples_.size() > MAX_SAMPLES)
+		samples_.pop_front();
+}
+
+bool UVCClock::convert(uint32_t pts, uint64_t *timestamp) const
+{
+	if (samples_.size() < 2)
+		return false;
+
+	const Sample &first = samples_.front();
+	double meanStc = 0.0;
+	double meanTs = 0.0;
+
+	for (const Sample &sample : samples_) {
+		meanStc += sample.stc - first.stc;
+		meanTs += sample.timestamp - first.timestamp;
+	}
+
+	meanStc /= samples_.size();
+	meanTs /= samples_.size();
+
+	double covariance = 0.0;
+	double variance = 0.0;
+
+	for (const Sample &sample : samples_) {
+		double dStc = sample.stc - first.stc - meanStc;
+		double dTs = sample.timestamp - first.timestamp - meanTs;
+
+		covariance += dStc * dTs;
+		variance += dStc * dStc;
+	}
+
+	if (!variance || covariance <= 0.0)
+		return false;
+
+	/*
+	 * The PTS is sampled before the SCR of the payloads carrying the
+	 * frame. Extend it relative to the most recent sample.
+	 */
+	const Sample &last = samples_.back();
+	int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(last.stc) - pts);
+	double stc = static_cast<double>(last.stc - first.stc) - delta;
+
+	double ts = meanTs + covariance / variance * (stc - meanStc);
+	if (ts + first.timestamp < 0.0)
+		return false;
+
+	*timestamp = first.timestamp + static_cast<int64_t>(ts);
+	return true;
+}
+
+class UVCCameraData : public CameraData, public Object
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), video_(nullptr)
+		: CameraData(pipe), media_(nullptr), entity_(nullptr),
+		  video_(nullptr),
+		  pendingControls_(controls::controls),
+		  appliedControls_(controls::controls), controlsQueued_(false),
+		  metadata_(nullptr), metadataActive_(false),
+		  metadataSequence_(0), decode_(false), scale_(false),
+		  convert_(false)
 	{
 	}
 
 	~UVCCameraData()
 	{
+		delete metadata_;
 		delete video_;
 	}
 
 	int init(MediaEntity *entity);
+	int initMetadata(MediaEntity *entity);
 	void bufferReady(Buffer *buffer);
+	void metadataReady(Buffer *buffer);
+	void processPendingBuffers();
+	void flushPendingBuffers();
+	void captureDone(Buffer *buffer);
+
+	void queueControls(const ControlList &controls);
+	void applyControls();
 
+	/* The video and metadata nodes are opened on first use only. */
+	MediaDevice *media_;
+	MediaEntity *entity_;
 	V4L2VideoDevice *video_;
 	Stream stream_;
+
+	/*
+	 * Each control is a USB control transfer that can take milliseconds.
+	 * The controls of the requests are accumulated and applied from the
+	 * event loop, skipping the ones already set to the same value.
+	 */
+	ControlList pendingControls_;
+	ControlList appliedControls_;
+	bool controlsQueued_;
+
+	/*
+	 * The UVC metadata node, when available, reports the payload headers
+	 * of the frames, used to timestamp buffers with the device clock.
+	 * Captured buffers wait in pendingBuffers_ for their metadata.
+	 */
+	V4L2VideoDevice *metadata_;
+	bool metadataActive_;
+	BufferPool metadataPool_;
+	std::vector<std::unique_ptr<Buffer>> metadataBuffers_;
+	UVCClock clock_;
+	std::map<unsigned int, uint64_t> timestamps_;
+	unsigned int metadataSequence_;
+	std::queue<Buffer *> pendingBuffers_;
+
+	ImageFormats videoFormats_;
+	std::map<unsigned int, std::vector<SizeRange>> formats_;
+
+	Size captureSize(unsigned int fourcc, const Size &size) const;
+	bool convertSource(unsigned int fourcc, const Size &size,
+			   V4L2DeviceFormat *format) const;
+
+	/*
+	 * When the configured format is only available in MJPEG from the
+	 * device, or the configured size isn't supported by the device, frames
+	 * are captured to internal buffers and decoded or scaled to the request
+	 * buffers. A memory-to-memory converter, when available, converts and
+	 * scales frames in hardware instead of the CPU.
+	 */
+	bool decode_;
+	bool scale_;
+	bool convert_;
+	void processBuffer(Buffer *buffer);
+	void conversionDone(Buffer *input, Buffer *output);
+
+	std::unique_ptr<M2MConverter> converter_;
+	std::map<Buffer *, Buffer *> convertBuffers_;
+
+#ifdef HAVE_LIBJPEG
+	MjpegDecoder decoder_;
+#endif
+	FrameScaler scaler_;
+	V4L2DeviceFormat outputFormat_;
+	DmaHeapAllocator allocator_;
+
+	BufferPool capturePool_;
+	std::vector<std::unique_ptr<Buffer>> captureBuffers_;
+	std::queue<Buffer *> availableCaptureBuffers_;
+	std::map<Buffer *, Buffer *> outputBuffers_;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
 {
 public:
-	UVCCameraConfiguration();
+	UVCCameraConfiguration(Camera *camera, UVCCameraData *data);
 
 	Status validate() override;
+
+private:
+	Status validateConfiguration();
+
+	/*
+	 * The UVCCameraData instance is guaranteed to be valid as long as the
+	 * corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const UVCCameraData *data_;
 };
 
 class PipelineHandlerUVC : public PipelineHandler
@@ -68,6 +305,8 @@ public:
 			    const std::set<Stream *> &streams) override;
 	int freeBuffers(Camera *camera,
 			const std::set<Stream *> &streams) override;
+	int addBuffers(Camera *camera, Stream *stream,
+		       unsigned int count) override;
 
 	int start(Camera *camera) override;
 	void stop(Camera *camera) override;
@@ -75,9 +314,11 @@ public:
 	int queueRequest(Camera *camera, Request *request) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
+	int initCamera(Camera *camera) override;
 
 private:
-	int processControls(UVCCameraData *data, Request *request);
+	void processControls(UVCCameraData *data, Request *request);
+	int allocateCaptureBuffers(UVCCameraData *data, Stream *stream);
 
 	UVCCameraData *cameraData(const Camera *camera)
 	{
@@ -86,12 +327,22 @@ private:
 	}
 };
 
-UVCCameraConfiguration::UVCCameraConfiguration()
+UVCCameraConfiguration::UVCCameraConfiguration(Camera *camera,
+					       UVCCameraData *data)
 	: CameraConfiguration()
 {
+	camera_ = camera->shared_from_this();
+	data_ = data;
 }
 
 CameraConfiguration::Status UVCCameraConfiguration::validate()
+{
+	return data_->validationCache_.validate(this,
+						&UVCCameraConfiguration::validateConfiguration,
+						&UVCCameraConfiguration::camera_);
+}
+
+CameraConfiguration::Status UVCCameraConfiguration::validateConfiguration()
 {
 	Status status = Valid;
 
@@ -104,7 +355,23 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
 	StreamConfiguration &cfg = config_[0];
+
+	/* Frame decimation isn't supported. */
+	if (cfg.frameDecimation != 1) {
+		cfg.frameDecimation = 1;
+		status = Adjusted;
+	}
+
 	const StreamFormats &formats = cfg.formats();
 	const unsigned int pixelFormat = cfg.pixelFormat;
 	const Size size = cfg.size;
@@ -119,13 +386,52 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
-	const std::vector<Size> &formatSizes = formats.sizes(cfg.pixelFormat);
-	cfg.size = formatSizes.front();
-	for (const Size &formatsSize : formatSizes) {
-		if (formatsSize > size)
-			break;
+	/*
+	 * The sizes not supported by the device are converted by the
+	 * memory-to-memory converter within its output range, or cropped and
+	 * scaled down from a larger frame size for the formats the device
+	 * supports natively, up to its largest frame size.
+	 */
+	const bool native = supportsFormat(data_->videoFormats_, cfg.pixelFormat,
+					   size);
+	Size convertSize;
+	if (!native && data_->converter_) {
+		const SizeRange range = data_->converter_->outputSizes(cfg.pixelFormat);
+		convertSize.width = std::min(std::max(size.width, range.min.width),
+					     range.max.width) & ~1U;
+		convertSize.height = std::min(std::max(size.height, range.min.height),
+					      range.max.height) & ~1U;
+	}
 
-		cfg.size = formatsSize;
+	V4L2DeviceFormat source;
+	const Size captureSize = data_->captureSize(cfg.pixelFormat, size);
+	if (native) {
+		cfg.size = size;
+	} else if (convertSize.width && convertSize.height &&
+		   data_->convertSource(cfg.pixelFormat, convertSize, &source)) {
+		cfg.size = convertSize;
+	} else if (captureSize.width) {
+		const unsigned int factor = FrameScaler::MAX_SCALE_FACTOR;
+		const Size minSize = {
+			(captureSize.width + factor - 1) / factor,
+			(captureSize.height + factor - 1) / factor,
+		};
+
+		cfg.size.width = std::min(std::max(size.width, minSize.width),
+					  captureSize.width);
+		cfg.size.height = std::min(std::max(size.height, minSize.height),
+					   captureSize.height);
+		cfg.size.width = std::max(cfg.size.width & ~1U, 2U);
+		cfg.size.height = std::max(cfg.size.height & ~1U, 2U);
+	} else {
+		const std::vector<Size> &formatSizes = formats.sizes(cfg.pixelFormat);
+		cfg.size = formatSizes.front();
+		for (const Size &formatsSize : formatSizes) {
+			if (formatsSize > size)
+				break;
+
+			cfg.size = formatsSize;
+		}
 	}
 
 	if (cfg.size != size) {
@@ -135,7 +441,7 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
-	cfg.bufferCount = 4;
+	cfg.bufferCount = queueDepth(2, 4, 8);
 
 	return status;
 }
@@ -149,13 +455,12 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
 	UVCCameraData *data = cameraData(camera);
-	CameraConfiguration *config = new UVCCameraConfiguration();
+	CameraConfiguration *config = new UVCCameraConfiguration(camera, data);
 
 	if (roles.empty())
 		return config;
 
-	ImageFormats v4l2formats = data->video_->formats();
-	StreamFormats formats(v4l2formats.data());
+	StreamFormats formats(data->formats_);
 	StreamConfiguration cfg(formats);
 
 	cfg.pixelFormat = formats.pixelformats().front();
@@ -179,14 +484,83 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	format.fourcc = cfg.pixelFormat;
 	format.size = cfg.size;
 
+	/*
+	 * Prefer the formats and sizes natively supported by the device, and
+	 * fall back to converting a native frame in hardware, to scaling a
+	 * larger native frame, or to decoding MJPEG otherwise.
+	 */
+	bool native = supportsFormat(data->videoFormats_, cfg.pixelFormat,
+				     cfg.size);
+	const Size captureSize = data->captureSize(cfg.pixelFormat, cfg.size);
+
+	data->decode_ = false;
+	data->scale_ = false;
+	data->convert_ = false;
+	if (!native && data->convertSource(cfg.pixelFormat, cfg.size, &format)) {
+		data->convert_ = true;
+	} else if (!native && captureSize.width) {
+		format.size = captureSize;
+		data->scale_ = true;
+	} else if (!native) {
+#ifdef HAVE_LIBJPEG
+		ret = data->decoder_.configure(cfg.size, cfg.pixelFormat,
+					       &data->outputFormat_);
+		if (ret)
+			return ret;
+
+		format.fourcc = V4L2_PIX_FMT_MJPEG;
+		data->decode_ = true;
+#endif
+	}
+
+	const V4L2DeviceFormat requested = format;
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != cfg.pixelFormat)
+	if (format.size != requested.size || format.fourcc != requested.fourcc)
 		return -EINVAL;
 
+	if (data->convert_) {
+		data->outputFormat_ = {};
+		data->outputFormat_.fourcc = cfg.pixelFormat;
+		data->outputFormat_.size = cfg.size;
+
+		ret = data->converter_->configure(format, &data->outputFormat_);
+		if (ret)
+			return ret;
+
+		LOG(UVC, Debug)
+			<< "Converting " << format.toString() << " frames to "
+			<< cfg.toString() << " with "
+			<< data->converter_->driverName();
+	}
+
+	if (data->scale_) {
+		const Rectangle crop = FrameScaler::centeredCrop(cfg.pixelFormat,
+								 format.size,
+								 cfg.size);
+		ret = data->scaler_.configure(cfg.pixelFormat, format.size,
+					      format.planes[0].bpl, crop,
+					      cfg.size);
+		if (ret)
+			return ret;
+
+		data->outputFormat_ = {};
+		data->outputFormat_.fourcc = cfg.pixelFormat;
+		data->outputFormat_.size = cfg.size;
+		data->outputFormat_.planesCount = 1;
+		data->outputFormat_.planes[0].size = data->scaler_.frameSize();
+
+		LOG(UVC, Debug)
+			<< "Scaling " << format.size.toString() << " frames to "
+			<< cfg.toString();
+	}
+
+	if (data->decode_)
+		LOG(UVC, Debug)
+			<< "Decoding MJPEG to " << cfg.toString();
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
@@ -201,32 +575,225 @@ int PipelineHandlerUVC::allocateBuffers(Camera *camera,
 
 	LOG(UVC, Debug) << "Requesting " << cfg.bufferCount << " buffers";
 
-	if (stream->memoryType() == InternalMemory)
-		return data->video_->exportBuffers(&stream->bufferPool());
+	int ret;
+
+	if (data->decode_ || data->scale_ || data->convert_)
+		ret = allocateCaptureBuffers(data, stream);
+	else if (stream->memoryType() == InternalMemory)
+		ret = data->video_->exportBuffers(&stream->bufferPool());
+	else if (stream->memoryType() == UserPtrMemory)
+		ret = data->video_->importUserPtrBuffers(&stream->bufferPool());
 	else
-		return data->video_->importBuffers(&stream->bufferPool());
+		ret = data->video_->importBuffers(&stream->bufferPool());
+
+	if (ret)
+		return ret;
+
+	/* The timestamps fall back to the driver's when metadata is missing. */
+	data->metadataActive_ = false;
+	if (data->metadata_) {
+		data->metadataPool_.createBuffers(cfg.bufferCount);
+		ret = data->metadata_->exportBuffers(&data->metadataPool_);
+		if (ret) {
+			LOG(UVC, Warning)
+				<< "Failed to create metadata buffers, device timestamps disabled";
+			data->metadataPool_.destroyBuffers();
+		} else {
+			data->metadataActive_ = true;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate the internal buffers the device captures to, and the decoded or
+ * scaled buffers for streams that don't use external memory. The converter
+ * imports the internal buffers and the stream buffers, allocating the latter
+ * for streams that don't use external memory.
+ */
+int PipelineHandlerUVC::allocateCaptureBuffers(UVCCameraData *data,
+					      Stream *stream)
+{
+	const StreamConfiguration &cfg = stream->configuration();
+	BufferPool &pool = stream->bufferPool();
+	unsigned int count = std::max(cfg.bufferCount, pool.count());
+	int ret;
+
+	if (stream->memoryType() == UserPtrMemory) {
+		LOG(UVC, Error) << "User pointer memory can't be processed to";
+		return -ENOTSUP;
+	}
+
+	data->capturePool_.createBuffers(count);
+	ret = data->video_->exportBuffers(&data->capturePool_);
+	if (ret)
+		return ret;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		data->captureBuffers_.emplace_back(utils::make_unique<Buffer>(i));
+		data->availableCaptureBuffers_.push(data->captureBuffers_.back().get());
+	}
+
+	if (data->convert_) {
+		/* The converted frames are never accessed by the CPU. */
+		for (BufferMemory &mem : data->capturePool_.buffers())
+			mem.setDeviceOnly(true);
+
+		ret = data->converter_->importInputBuffers(&data->capturePool_);
+		if (ret)
+			goto error;
+
+		if (stream->memoryType() == ExternalMemory)
+			ret = data->converter_->importOutputBuffers(&pool);
+		else
+			ret = data->converter_->exportOutputBuffers(&pool);
+		if (ret)
+			goto error;
+
+		return 0;
+	}
+
+	if (stream->memoryType() == ExternalMemory)
+		return 0;
+
+	if (!data->allocator_.isValid()) {
+		LOG(UVC, Error) << "No dma-heap to allocate output buffers";
+		ret = -ENODEV;
+		goto error;
+	}
+
+	ret = data->allocator_.allocate(data->outputFormat_, pool.count());
+	if (ret < 0)
+		goto error;
+
+	for (unsigned int i = 0; i < pool.count(); ++i) {
+		PlaneArray &planes = pool.buffers()[i].planes();
+
+		planes.clear();
+		planes.emplace_back();
+		ret = planes.back().setDmabuf(data->allocator_.dmabufs(i)[0],
+					      data->outputFormat_.planes[0].size);
+		if (ret)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	if (data->convert_)
+		data->converter_->releaseBuffers();
+	data->availableCaptureBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->allocator_.release();
+	data->video_->releaseBuffers();
+	return ret;
 }
 
 int PipelineHandlerUVC::freeBuffers(Camera *camera,
 				    const std::set<Stream *> &streams)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	if (data->metadataActive_) {
+		data->metadata_->releaseBuffers();
+		data->metadataPool_.destroyBuffers();
+		data->metadataActive_ = false;
+	}
+
+	if (data->convert_)
+		data->converter_->releaseBuffers();
+
+	data->outputBuffers_.clear();
+	data->convertBuffers_.clear();
+	data->availableCaptureBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->allocator_.release();
+
 	return data->video_->releaseBuffers();
 }
 
+int PipelineHandlerUVC::addBuffers(Camera *camera, Stream *stream,
+				   unsigned int count)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	/* \todo Grow the decoded, scaled and converted buffers pool. */
+	if (data->decode_ || data->scale_ || data->convert_)
+		return -ENOTSUP;
+
+	return data->video_->addBuffers(count);
+}
+
 int PipelineHandlerUVC::start(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
-	return data->video_->streamOn();
+	int ret;
+
+	/*
+	 * The device controls may have been modified while the camera was
+	 * stopped, apply all controls again.
+	 */
+	data->appliedControls_.clear();
+
+	if (data->metadataActive_) {
+		data->clock_.reset();
+		data->metadataSequence_ = 0;
+
+		data->metadataBuffers_ = data->metadata_->queueAllBuffers();
+		if (data->metadataBuffers_.empty())
+			return -EINVAL;
+
+		ret = data->metadata_->streamOn();
+		if (ret) {
+			data->metadataBuffers_.clear();
+			return ret;
+		}
+	}
+
+	ret = data->video_->streamOn();
+	if (ret)
+		goto error;
+
+	if (data->convert_) {
+		ret = data->converter_->start();
+		if (ret) {
+			data->video_->streamOff();
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	if (data->metadataActive_) {
+		data->metadata_->streamOff();
+		data->metadataBuffers_.clear();
+	}
+	return ret;
 }
 
 void PipelineHandlerUVC::stop(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	/*
+	 * Complete the buffers waiting for their metadata first, to complete
+	 * requests in order.
+	 */
+	data->flushPendingBuffers();
+	if (data->convert_)
+		data->converter_->stop();
 	data->video_->streamOff();
+
+	if (data->metadataActive_) {
+		data->metadata_->streamOff();
+		data->metadataBuffers_.clear();
+		data->timestamps_.clear();
+	}
 }
 
-int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
+void PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
 {
 	ControlList controls(data->video_->controls());
 
@@ -248,18 +815,7 @@ int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
 		}
 	}
 
-	for (const auto &ctrl : controls)
-		LOG(UVC, Debug)
-			<< "Setting control " << ctrl.first->name()
-			<< " to " << ctrl.second.toString();
-
-	int ret = data->video_->setControls(&controls);
-	if (ret) {
-		LOG(UVC, Error) << "Failed to set controls: " << ret;
-		return ret < 0 ? ret : -EINVAL;
-	}
-
-	return ret;
+	data->queueControls(controls);
 }
 
 int PipelineHandlerUVC::queueRequest(Camera *camera, Request *request)
@@ -273,14 +829,37 @@ int PipelineHandlerUVC::queueRequest(Camera *camera, Request *request)
 		return -ENOENT;
 	}
 
-	int ret = processControls(data, request);
-	if (ret < 0)
-		return ret;
+	int ret;
+
+	if (data->decode_ || data->scale_ || data->convert_) {
+		if (data->availableCaptureBuffers_.empty()) {
+			LOG(UVC, Error) << "Capture buffer underrun";
+			return -ENOBUFS;
+		}
+
+		Buffer *captureBuffer = data->availableCaptureBuffers_.front();
+		ret = data->video_->queueBuffer(captureBuffer);
+		if (ret < 0)
+			return ret;
+
+		data->availableCaptureBuffers_.pop();
+		data->outputBuffers_[captureBuffer] = buffer;
+
+		processControls(data, request);
+		PipelineHandler::queueRequest(camera, request);
+
+		return 0;
+	}
 
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
 
+	/*
+	 * Queue the controls after the buffer, applying them can't delay
+	 * the capture.
+	 */
+	processControls(data, request);
 	PipelineHandler::queueRequest(camera, request);
 
 	return 0;
@@ -297,16 +876,28 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 
 	std::unique_ptr<UVCCameraData> data = utils::make_unique<UVCCameraData>(this);
 
-	/* Locate and initialise the camera data with the default video node. */
+	/*
+	 * Use a memory-to-memory converter, if available, for the formats and
+	 * sizes the device can't produce natively.
+	 */
+	data->converter_ = M2MConverter::create(enumerator);
+	if (data->converter_)
+		data->converter_->bufferReady.connect(data.get(),
+						      &UVCCameraData::conversionDone);
+
+	/*
+	 * Locate the default video node. The camera data is initialised with
+	 * it by initCamera(), on first use of the camera.
+	 */
+	data->media_ = media;
 	for (MediaEntity *entity : media->entities()) {
 		if (entity->flags() & MEDIA_ENT_FL_DEFAULT) {
-			if (data->init(entity))
-				return false;
+			data->entity_ = entity;
 			break;
 		}
 	}
 
-	if (!data) {
+	if (!data->entity_) {
 		LOG(UVC, Error) << "Could not find a default video device";
 		return false;
 	}
@@ -322,6 +913,30 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	return true;
 }
 
+int PipelineHandlerUVC::initCamera(Camera *camera)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	int ret = data->init(data->entity_);
+	if (ret) {
+		delete data->video_;
+		data->video_ = nullptr;
+		return ret;
+	}
+
+	/* Locate the metadata node, if any. */
+	for (MediaEntity *entity : data->media_->entities()) {
+		if (entity->function() != MEDIA_ENT_F_IO_V4L ||
+		    entity->flags() & MEDIA_ENT_FL_DEFAULT)
+			continue;
+
+		if (!data->initMetadata(entity))
+			break;
+	}
+
+	return 0;
+}
+
 int UVCCameraData::init(MediaEntity *entity)
 {
 	int ret;
@@ -334,6 +949,68 @@ int UVCCameraData::init(MediaEntity *entity)
 
 	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
 
+	pendingControls_ = ControlList(video_->controls());
+	appliedControls_ = ControlList(video_->controls());
+
+	/*
+	 * Advertise the formats the MJPEG frames can be decoded to, in addition
+	 * to the native formats, for all the MJPEG frame sizes.
+	 */
+	videoFormats_ = video_->formats();
+	formats_ = videoFormats_.data();
+
+#ifdef HAVE_LIBJPEG
+	auto mjpeg = formats_.find(V4L2_PIX_FMT_MJPEG);
+	if (mjpeg != formats_.end()) {
+		const std::vector<SizeRange> mjpegSizes = mjpeg->second;
+
+		for (unsigned int fourcc : MjpegDecoder::formats()) {
+			std::vector<SizeRange> &sizes = formats_[fourcc];
+
+			for (const SizeRange &size : mjpegSizes) {
+				if (std::find(sizes.begin(), sizes.end(), size) == sizes.end())
+					sizes.push_back(size);
+			}
+		}
+	}
+#endif
+
+	/*
+	 * Advertise the formats the converter can produce from the native
+	 * formats, for its whole output size range up to the largest native
+	 * frame size.
+	 */
+	if (converter_) {
+		Size largest;
+		for (const auto &format : videoFormats_.data()) {
+			const std::vector<unsigned int> inputs = converter_->inputFormats();
+			if (std::find(inputs.begin(), inputs.end(), format.first) == inputs.end())
+				continue;
+
+			for (const SizeRange &range : format.second) {
+				if (range.max.width * range.max.height >
+				    largest.width * largest.height)
+					largest = range.max;
+			}
+		}
+
+		for (unsigned int fourcc : converter_->outputFormats()) {
+			if (!largest.width)
+				break;
+
+			SizeRange range = converter_->outputSizes(fourcc);
+			range.max.width = std::min(range.max.width, largest.width);
+			range.max.height = std::min(range.max.height, largest.height);
+			if (range.min.width > range.max.width ||
+			    range.min.height > range.max.height)
+				continue;
+
+			std::vector<SizeRange> &sizes = formats_[fourcc];
+			if (std::find(sizes.begin(), sizes.end(), range) == sizes.end())
+				sizes.push_back(range);
+		}
+	}
+
 	/* Initialise the supported controls. */
 	const ControlInfoMap &controls = video_->controls();
 	ControlInfoMap::Map ctrls;
@@ -372,14 +1049,375 @@ int UVCCameraData::init(MediaEntity *entity)
 	return 0;
 }
 
+/*
+ * Retrieve the native frame size to capture and scale from to produce frames of
+ * \a size in \a fourcc, or a null size if the format can't be scaled. The
+ * smallest native size covering \a size is preferred, and the largest native
+ * size is used otherwise.
+ */
+Size UVCCameraData::captureSize(unsigned int fourcc, const Size &size) const
+{
+	const std::vector<unsigned int> &scalable = FrameScaler::formats();
+	if (std::find(scalable.begin(), scalable.end(), fourcc) == scalable.end())
+		return {};
+
+	auto it = videoFormats_.data().find(fourcc);
+	if (it == videoFormats_.data().end())
+		return {};
+
+	Size best;
+	Size largest;
+
+	for (const SizeRange &range : it->second) {
+		const Size &candidate = range.max;
+		unsigned int area = candidate.width * candidate.height;
+
+		if (area > largest.width * largest.height)
+			largest = candidate;
+
+		if (candidate.width < size.width || candidate.height < size.height)
+			continue;
+
+		if (!best.width || area < best.width * best.height)
+			best = candidate;
+	}
+
+	return best.width ? best : largest;
+}
+
+/*
+ * Select the native \a format to capture and convert from to produce frames of
+ * \a size in \a fourcc with the converter. The native frames in \a fourcc are
+ * preferred, to only scale them, and the smallest native size covering \a size
+ * is preferred to the largest native size otherwise. Returns false if the
+ * converter can't produce the frames.
+ */
+bool UVCCameraData::convertSource(unsigned int fourcc, const Size &size,
+				  V4L2DeviceFormat *format) const
+{
+	if (!converter_)
+		return false;
+
+	V4L2DeviceFormat best = {};
+	bool bestCovers = false;
+	unsigned int bestArea = 0;
+
+	for (const auto &native : videoFormats_.data()) {
+		for (const SizeRange &range : native.second) {
+			const Size &candidate = range.max;
+			if (!converter_->supports(native.first, candidate,
+						  fourcc, size))
+				continue;
+
+			bool covers = candidate.width >= size.width &&
+				      candidate.height >= size.height;
+			unsigned int area = candidate.width * candidate.height;
+
+			bool better;
+			if (!best.fourcc)
+				better = true;
+			else if ((native.first == fourcc) != (best.fourcc == fourcc))
+				better = native.first == fourcc;
+			else if (covers != bestCovers)
+				better = covers;
+			else
+				better = covers ? area < bestArea : area > bestArea;
+
+			if (!better)
+				continue;
+
+			best.fourcc = native.first;
+			best.size = candidate;
+			bestCovers = covers;
+			bestArea = area;
+		}
+	}
+
+	if (!best.fourcc)
+		return false;
+
+	format->fourcc = best.fourcc;
+	format->size = best.size;
+	return true;
+}
+
+void UVCCameraData::queueControls(const ControlList &controls)
+{
+	pendingControls_.merge(controls);
+
+	if (controlsQueued_ || pendingControls_.empty())
+		return;
+
+	controlsQueued_ = true;
+	invokeMethod(&UVCCameraData::applyControls);
+}
+
+void UVCCameraData::applyControls()
+{
+	controlsQueued_ = false;
+
+	ControlList changes = pendingControls_.delta(appliedControls_);
+	pendingControls_.clear();
+	if (changes.empty())
+		return;
+
+	for (const auto &ctrl : changes)
+		LOG(UVC, Debug)
+			<< "Setting control " << ctrl.first->name()
+			<< " to " << ctrl.second.toString();
+
+	int ret = video_->setControls(&changes);
+	if (ret) {
+		LOG(UVC, Error) << "Failed to set controls: " << ret;
+		return;
+	}
+
+	appliedControls_.merge(changes);
+}
+
+/*
+ * Open the metadata node \a entity. Returns 0 on success, or a negative error
+ * code if the \a entity isn't a UVC metadata node.
+ */
+int UVCCameraData::initMetadata(MediaEntity *entity)
+{
+	V4L2VideoDevice *metadata = new V4L2VideoDevice(entity);
+	int ret = metadata->open();
+	if (ret) {
+		delete metadata;
+		return ret;
+	}
+
+	V4L2DeviceFormat format = {};
+	format.fourcc = V4L2_META_FMT_UVC;
+
+	ret = metadata->setFormat(&format);
+	if (ret || format.fourcc != V4L2_META_FMT_UVC) {
+		delete metadata;
+		return -EINVAL;
+	}
+
+	metadata->bufferReady.connect(this, &UVCCameraData::metadataReady);
+	metadata_ = metadata;
+
+	LOG(UVC, Debug) << "Using metadata node " << entity->name();
+
+	return 0;
+}
+
 void UVCCameraData::bufferReady(Buffer *buffer)
 {
+	if (metadataActive_ && buffer->status() != Buffer::BufferCancelled) {
+		pendingBuffers_.push(buffer);
+		processPendingBuffers();
+		return;
+	}
+
+	captureDone(buffer);
+}
+
+void UVCCameraData::metadataReady(Buffer *buffer)
+{
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	BufferMemory &mem = metadataPool_.buffers()[buffer->index()];
+	Plane &plane = mem.planes()[0];
+	bool hasPts = false;
+	uint32_t pts = 0;
+
+	{
+		CpuAccess access(mem, Plane::AccessRead);
+		const uint8_t *data = static_cast<const uint8_t *>(plane.mem());
+		size_t size = data ? std::min(buffer->bytesused(), plane.length()) : 0;
+
+		/*
+		 * The buffer contains a sequence of struct uvc_meta_buf, made
+		 * of the 64-bit host timestamp, the 16-bit host SOF and the
+		 * payload header, starting with its length and flags.
+		 */
+		size_t offset = 0;
+		while (offset + 12 <= size) {
+			const uint8_t *block = data + offset;
+			uint8_t length = block[10];
+			uint8_t flags = block[11];
+
+			unsigned int needed = 2 + (flags & UVC_STREAM_PTS ? 4 : 0)
+					    + (flags & UVC_STREAM_SCR ? 6 : 0);
+			if (length < needed || offset + 10 + length > size)
+				break;
+
+			uint64_t timestamp;
+			memcpy(&timestamp, block, sizeof(timestamp));
+
+			const uint8_t *header = block + 12;
+			if (flags & UVC_STREAM_PTS) {
+				if (!hasPts) {
+					pts = readLE32(header);
+					hasPts = true;
+				}
+				header += 4;
+			}
+
+			if (flags & UVC_STREAM_SCR)
+				clock_.addSample(readLE32(header), timestamp);
+
+			offset += 10 + length;
+		}
+	}
+
+	uint64_t timestamp;
+	if (hasPts && clock_.convert(pts, &timestamp))
+		timestamps_[buffer->sequence()] = timestamp;
+
+	metadataSequence_ = buffer->sequence() + 1;
+
+	/* Drop the timestamps of the frames that got lost on the way. */
+	while (timestamps_.size() > metadataPool_.count() * 2)
+		timestamps_.erase(timestamps_.begin());
+
+	metadata_->queueBuffer(buffer);
+
+	processPendingBuffers();
+}
+
+/*
+ * Complete the captured buffers whose metadata has been received, with the
+ * device timestamp when available. Buffers whose metadata got lost are
+ * completed with the driver timestamp.
+ */
+void UVCCameraData::processPendingBuffers()
+{
+	while (!pendingBuffers_.empty()) {
+		Buffer *buffer = pendingBuffers_.front();
+
+		auto it = timestamps_.find(buffer->sequence());
+		if (it != timestamps_.end()) {
+			/* The PTS is sampled when the frame capture starts. */
+			pipe_->setBufferTimestamp(buffer, it->second,
+						  Buffer::TimestampStartOfExposure);
+			timestamps_.erase(it);
+		} else if (buffer->sequence() >= metadataSequence_ &&
+			   pendingBuffers_.size() <= metadataPool_.count()) {
+			break;
+		}
+
+		pendingBuffers_.pop();
+		captureDone(buffer);
+	}
+}
+
+void UVCCameraData::flushPendingBuffers()
+{
+	while (!pendingBuffers_.empty()) {
+		captureDone(pendingBuffers_.front());
+		pendingBuffers_.pop();
+	}
+}
+
+void UVCCameraData::captureDone(Buffer *buffer)
+{
+	if (decode_ || scale_ || convert_) {
+		processBuffer(buffer);
+		return;
+	}
+
 	Request *request = buffer->request();
 
 	pipe_->completeBuffer(camera_, request, buffer);
 	pipe_->completeRequest(camera_, request);
 }
 
+void UVCCameraData::processBuffer(Buffer *buffer)
+{
+	auto it = outputBuffers_.find(buffer);
+	if (it == outputBuffers_.end())
+		return;
+
+	Buffer *output = it->second;
+	Request *request = output->request();
+	int ret = 0;
+
+	outputBuffers_.erase(it);
+
+	if (convert_ && buffer->status() == Buffer::BufferSuccess) {
+		ret = converter_->queueBuffers(buffer, output);
+		if (!ret) {
+			convertBuffers_[output] = buffer;
+			return;
+		}
+
+		LOG(UVC, Warning)
+			<< "Failed to convert frame " << buffer->sequence()
+			<< ": " << strerror(-ret);
+	} else if (buffer->status() == Buffer::BufferSuccess) {
+		Plane &src = capturePool_.buffers()[buffer->index()].planes()[0];
+		Plane &dst = output->mem()->planes()[0];
+
+		CpuAccess srcAccess(src, Plane::AccessRead);
+		CpuAccess dstAccess(dst, Plane::AccessWrite);
+
+		if (!src.mem() || !dst.mem()) {
+			ret = -ENOMEM;
+		} else if (scale_) {
+			if (dst.length() < scaler_.frameSize()) {
+				ret = -ENOSPC;
+			} else {
+				scaler_.process(static_cast<uint8_t *>(src.mem()),
+						static_cast<uint8_t *>(dst.mem()));
+				ret = scaler_.frameSize();
+			}
+		} else {
+#ifdef HAVE_LIBJPEG
+			ret = decoder_.decode(static_cast<uint8_t *>(src.mem()),
+					      buffer->bytesused(),
+					      static_cast<uint8_t *>(dst.mem()),
+					      dst.length());
+#endif
+		}
+
+		if (ret < 0)
+			LOG(UVC, Warning)
+				<< "Failed to " << (scale_ ? "scale" : "decode")
+				<< " frame " << buffer->sequence() << ": "
+				<< strerror(-ret);
+	}
+
+	availableCaptureBuffers_.push(buffer);
+
+	pipe_->copyBufferMetadata(output, buffer, ret > 0 ? ret : 0);
+	pipe_->completeBuffer(camera_, request, output);
+	pipe_->completeRequest(camera_, request);
+}
+
+/*
+ * Complete the request of a frame processed by the converter, with the
+ * metadata of the captured frame. The \a input buffer is null if it failed to
+ * be queued to the converter.
+ */
+void UVCCameraData::conversionDone(Buffer *input, Buffer *output)
+{
+	auto it = convertBuffers_.find(output);
+	if (it == convertBuffers_.end())
+		return;
+
+	Buffer *buffer = it->second;
+	Request *request = output->request();
+
+	convertBuffers_.erase(it);
+	availableCaptureBuffers_.push(buffer);
+
+	/* Cancelled frames keep the metadata reported by the converter. */
+	if (output->status() != Buffer::BufferCancelled) {
+		unsigned int bytesused = input && output->status() == Buffer::BufferSuccess
+				       ? output->bytesused() : 0;
+		pipe_->copyBufferMetadata(output, buffer, bytesused);
+	}
+
+	pipe_->completeBuffer(camera_, request, output);
+	pipe_->completeRequest(camera_, request);
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerUVC);
 
 } /* namespace libcamera */
@@ -9,6 +9,7 @@
 #include <array>
 #include <iomanip>
 #include <tuple>
+#include <vector>
 
 #include <linux/media-bus-format.h>
 
@@ -40,7 +41,8 @@ class VimcCameraData : public CameraData
 public:
 	VimcCameraData(PipelineHandler *pipe)
 		: CameraData(pipe), sensor_(nullptr), debayer_(nullptr),
-		  scaler_(nullptr), video_(nullptr), raw_(nullptr)
+		  scaler_(nullptr), video_(nullptr), raw_(nullptr),
+		  frameDuration_(0)
 	{
 	}
 
@@ -56,12 +58,24 @@ public:
 	int init(MediaDevice *media);
 	void bufferReady(Buffer *buffer);
 
+	V4L2VideoDevice *video(const Stream *stream)
+	{
+		return stream == &rawStream_ ? raw_ : video_;
+	}
+
 	CameraSensor *sensor_;
 	V4L2Subdevice *debayer_;
 	V4L2Subdevice *scaler_;
 	V4L2VideoDevice *video_;
 	V4L2VideoDevice *raw_;
 	Stream stream_;
+	Stream rawStream_;
+
+	/* The video devices of the configured streams. */
+	std::vector<V4L2VideoDevice *> activeVideos_;
+
+	/* The frame duration applied to the sensor, 0 if not controlled. */
+	int64_t frameDuration_;
 };
 
 class VimcCameraConfiguration : public CameraConfiguration
@@ -70,6 +84,10 @@ public:
 	VimcCameraConfiguration();
 
 	Status validate() override;
+
+private:
+	Status validateProcessed(StreamConfiguration &cfg);
+	Status validateRaw(StreamConfiguration &cfg, const Size &sensorSize);
 };
 
 class PipelineHandlerVimc : public PipelineHandler
@@ -85,6 +103,8 @@ public:
 			    const std::set<Stream *> &streams) override;
 	int freeBuffers(Camera *camera,
 			const std::set<Stream *> &streams) override;
+	int addBuffers(Camera *camera, Stream *stream,
+		       unsigned int count) override;
 
 	int start(Camera *camera) override;
 	void stop(Camera *camera) override;
@@ -108,26 +128,94 @@ VimcCameraConfiguration::VimcCameraConfiguration()
 {
 }
 
+/*
+ * The camera produces a processed RGB stream from the RGB/YUV Capture node,
+ * and a raw Bayer stream from the Raw Capture 1 node, both fed by Sensor B.
+ * Configurations contain one or both of them, in any order, the raw stream
+ * being identified by its pixel format.
+ */
 CameraConfiguration::Status VimcCameraConfiguration::validate()
 {
-	static const std::array<unsigned int, 3> formats{
-		V4L2_PIX_FMT_BGR24,
-		V4L2_PIX_FMT_RGB24,
-		V4L2_PIX_FMT_ARGB32,
-	};
-
 	Status status = Valid;
 
 	if (config_.empty())
 		return Invalid;
 
 	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
+	if (config_.size() > 2) {
+		config_.resize(2);
 		status = Adjusted;
 	}
 
-	StreamConfiguration &cfg = config_[0];
+	/* Zero shutter lag capture isn't supported. */
+	if (zslFrames_) {
+		zslFrames_ = 0;
+		status = Adjusted;
+	}
+
+	if (validateModifiers() == Adjusted)
+		status = Adjusted;
+
+	/* Use the other stream for the second entry if both are the same. */
+	if (config_.size() == 2) {
+		bool firstRaw = config_[0].pixelFormat == V4L2_PIX_FMT_SGRBG8;
+		bool secondRaw = config_[1].pixelFormat == V4L2_PIX_FMT_SGRBG8;
+
+		if (firstRaw == secondRaw) {
+			config_[1].pixelFormat = firstRaw ? V4L2_PIX_FMT_RGB24
+							  : V4L2_PIX_FMT_SGRBG8;
+			status = Adjusted;
+		}
+	}
+
+	StreamConfiguration *processed = nullptr;
+	StreamConfiguration *raw = nullptr;
+
+	for (StreamConfiguration &cfg : config_) {
+		if (cfg.pixelFormat == V4L2_PIX_FMT_SGRBG8)
+			raw = &cfg;
+		else
+			processed = &cfg;
+
+		/* Frame decimation isn't supported. */
+		if (cfg.frameDecimation != 1) {
+			cfg.frameDecimation = 1;
+			status = Adjusted;
+		}
+
+		cfg.bufferCount = queueDepth(2, 4, 8);
+	}
+
+	/*
+	 * The processed stream sets the sensor size, the raw stream is
+	 * otherwise free to select it.
+	 */
+	Size sensorSize;
+
+	if (processed) {
+		if (validateProcessed(*processed) == Adjusted)
+			status = Adjusted;
+
+		sensorSize = { processed->size.width / 3,
+			       processed->size.height / 3 };
+	}
+
+	if (raw && validateRaw(*raw, sensorSize) == Adjusted)
+		status = Adjusted;
+
+	return status;
+}
+
+CameraConfiguration::Status
+VimcCameraConfiguration::validateProcessed(StreamConfiguration &cfg)
+{
+	static const std::array<unsigned int, 3> formats{
+		V4L2_PIX_FMT_BGR24,
+		V4L2_PIX_FMT_RGB24,
+		V4L2_PIX_FMT_ARGB32,
+	};
+
+	Status status = Valid;
 
 	/* Adjust the pixel format. */
 	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
@@ -152,7 +240,40 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
-	cfg.bufferCount = 4;
+	return status;
+}
+
+/*
+ * Validate the raw stream configuration. The raw frames are captured at the
+ * \a sensorSize selected by the processed stream if any, and otherwise within
+ * the sizes the processed path can be configured with, as the format of all
+ * the pads of the pipeline is validated when streaming starts.
+ */
+CameraConfiguration::Status
+VimcCameraConfiguration::validateRaw(StreamConfiguration &cfg,
+				     const Size &sensorSize)
+{
+	Status status = Valid;
+
+	if (cfg.pixelFormat != V4L2_PIX_FMT_SGRBG8) {
+		cfg.pixelFormat = V4L2_PIX_FMT_SGRBG8;
+		status = Adjusted;
+	}
+
+	const Size size = cfg.size;
+
+	if (sensorSize.width) {
+		cfg.size = sensorSize;
+	} else {
+		cfg.size.width = std::max(16U, std::min(1365U, cfg.size.width));
+		cfg.size.height = std::max(16U, std::min(720U, cfg.size.height));
+	}
+
+	if (cfg.size != size) {
+		LOG(VIMC, Debug)
+			<< "Adjusting raw size to " << cfg.size.toString();
+		status = Adjusted;
+	}
 
 	return status;
 }
@@ -166,16 +287,39 @@ CameraConfiguration *PipelineHandlerVimc::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
 	CameraConfiguration *config = new VimcCameraConfiguration();
+	bool processed = false;
+	bool raw = false;
 
-	if (roles.empty())
-		return config;
+	/*
+	 * Assign the raw stream to the StillCaptureRaw role, and the processed
+	 * stream to the other roles, skipping the roles whose stream is
+	 * already in use.
+	 */
+	for (const StreamRole &role : roles) {
+		StreamConfiguration cfg{};
+		cfg.bufferCount = 4;
+
+		if (role == StreamRole::StillCaptureRaw) {
+			if (raw)
+				continue;
+
+			cfg.pixelFormat = V4L2_PIX_FMT_SGRBG8;
+			cfg.size = { 640, 360 };
+			raw = true;
+		} else {
+			if (processed)
+				continue;
+
+			cfg.pixelFormat = V4L2_PIX_FMT_RGB24;
+			cfg.size = { 1920, 1080 };
+			processed = true;
+		}
 
-	StreamConfiguration cfg{};
-	cfg.pixelFormat = V4L2_PIX_FMT_RGB24;
-	cfg.size = { 1920, 1080 };
-	cfg.bufferCount = 4;
+		config->addConfiguration(cfg);
+	}
 
-	config->addConfiguration(cfg);
+	if (config->empty())
+		return config;
 
 	config->validate();
 
@@ -185,18 +329,32 @@ CameraConfiguration *PipelineHandlerVimc::generateConfiguration(Camera *camera,
 int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 {
 	VimcCameraData *data = cameraData(camera);
-	StreamConfiguration &cfg = config->at(0);
+	StreamConfiguration *processed = nullptr;
+	StreamConfiguration *raw = nullptr;
 	int ret;
 
+	for (StreamConfiguration &cfg : *config) {
+		if (cfg.pixelFormat == V4L2_PIX_FMT_SGRBG8)
+			raw = &cfg;
+		else
+			processed = &cfg;
+	}
+
 	/* The scaler hardcodes a x3 scale-up ratio. */
 	V4L2SubdeviceFormat subformat = {};
 	subformat.mbus_code = MEDIA_BUS_FMT_SGRBG8_1X8;
-	subformat.size = { cfg.size.width / 3, cfg.size.height / 3 };
+	if (processed)
+		subformat.size = { processed->size.width / 3,
+				   processed->size.height / 3 };
+	else
+		subformat.size = raw->size;
 
 	ret = data->sensor_->setFormat(&subformat);
 	if (ret)
 		return ret;
 
+	data->frameDuration_ = 0;
+
 	ret = data->debayer_->setFormat(0, &subformat);
 	if (ret)
 		return ret;
@@ -210,35 +368,52 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 	if (ret)
 		return ret;
 
-	subformat.size = cfg.size;
+	const Size sensorSize = subformat.size;
+
+	subformat.size = { sensorSize.width * 3, sensorSize.height * 3 };
 	ret = data->scaler_->setFormat(1, &subformat);
 	if (ret)
 		return ret;
 
+	/*
+	 * Formats have to be set on both capture video nodes, even when not
+	 * capturing from them, otherwise the vimc driver will fail pipeline
+	 * validation.
+	 */
 	V4L2DeviceFormat format = {};
-	format.fourcc = cfg.pixelFormat;
-	format.size = cfg.size;
+	format.fourcc = processed ? processed->pixelFormat : V4L2_PIX_FMT_RGB24;
+	format.size = subformat.size;
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != cfg.pixelFormat)
+	if (processed && (format.size != processed->size ||
+			  format.fourcc != processed->pixelFormat))
 		return -EINVAL;
 
-	/*
-	 * Format has to be set on the raw capture video node, otherwise the
-	 * vimc driver will fail pipeline validation.
-	 */
 	format.fourcc = V4L2_PIX_FMT_SGRBG8;
-	format.size = { cfg.size.width / 3, cfg.size.height / 3 };
+	format.size = sensorSize;
 
 	ret = data->raw_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	cfg.setStream(&data->stream_);
+	if (raw && (format.size != raw->size ||
+		    format.fourcc != raw->pixelFormat))
+		return -EINVAL;
+
+	data->activeVideos_.clear();
+
+	if (processed) {
+		processed->setStream(&data->stream_);
+		data->activeVideos_.push_back(data->video_);
+	}
+
+	if (raw) {
+		raw->setStream(&data->rawStream_);
+		data->activeVideos_.push_back(data->raw_);
+	}
 
 	return 0;
 }
@@ -247,44 +422,83 @@ int PipelineHandlerVimc::allocateBuffers(Camera *camera,
 					 const std::set<Stream *> &streams)
 {
 	VimcCameraData *data = cameraData(camera);
-	Stream *stream = *streams.begin();
-	const StreamConfiguration &cfg = stream->configuration();
 
-	LOG(VIMC, Debug) << "Requesting " << cfg.bufferCount << " buffers";
+	for (Stream *stream : streams) {
+		const StreamConfiguration &cfg = stream->configuration();
+		V4L2VideoDevice *video = data->video(stream);
+		int ret;
 
-	if (stream->memoryType() == InternalMemory)
-		return data->video_->exportBuffers(&stream->bufferPool());
-	else
-		return data->video_->importBuffers(&stream->bufferPool());
+		LOG(VIMC, Debug) << "Requesting " << cfg.bufferCount << " buffers";
+
+		if (stream->memoryType() == InternalMemory)
+			ret = video->exportBuffers(&stream->bufferPool());
+		else if (stream->memoryType() == UserPtrMemory)
+			ret = video->importUserPtrBuffers(&stream->bufferPool());
+		else
+			ret = video->importBuffers(&stream->bufferPool());
+
+		if (ret) {
+			freeBuffers(camera, streams);
+			return ret;
+		}
+	}
+
+	return 0;
 }
 
 int PipelineHandlerVimc::freeBuffers(Camera *camera,
 				     const std::set<Stream *> &streams)
 {
 	VimcCameraData *data = cameraData(camera);
-	return data->video_->releaseBuffers();
+	int ret = 0;
+
+	for (Stream *stream : streams) {
+		int err = data->video(stream)->releaseBuffers();
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+}
+
+int PipelineHandlerVimc::addBuffers(Camera *camera, Stream *stream,
+				    unsigned int count)
+{
+	VimcCameraData *data = cameraData(camera);
+	return data->video(stream)->addBuffers(count);
 }
 
 int PipelineHandlerVimc::start(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
-	return data->video_->streamOn();
+	return V4L2VideoDevice::streamOn(data->activeVideos_);
 }
 
 void PipelineHandlerVimc::stop(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
-	data->video_->streamOff();
+	V4L2VideoDevice::streamOff(data->activeVideos_);
 }
 
 int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 {
+	/* Don't allocate a sensor control list for requests without controls. */
+	if (request->controls().empty())
+		return 0;
+
 	ControlList controls(data->sensor_->controls());
 
 	for (auto it : request->controls()) {
 		const ControlId &id = *it.first;
 		ControlValue &value = it.second;
 
+		if (id == controls::FrameDuration) {
+			int64_t duration = value.get<int64_t>();
+			if (!data->sensor_->setFrameDuration(&controls, &duration))
+				data->frameDuration_ = duration;
+			continue;
+		}
+
 		if (id == controls::Brightness)
 			controls.set(V4L2_CID_BRIGHTNESS, value);
 		else if (id == controls::Contrast)
@@ -310,21 +524,16 @@ int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 int PipelineHandlerVimc::queueRequest(Camera *camera, Request *request)
 {
 	VimcCameraData *data = cameraData(camera);
-	Buffer *buffer = request->findBuffer(&data->stream_);
-	if (!buffer) {
-		LOG(VIMC, Error)
-			<< "Attempt to queue request with invalid stream";
-
-		return -ENOENT;
-	}
 
 	int ret = processControls(data, request);
 	if (ret < 0)
 		return ret;
 
-	ret = data->video_->queueBuffer(buffer);
-	if (ret < 0)
-		return ret;
+	for (auto it : request->buffers()) {
+		ret = data->video(it.first)->queueBuffer(it.second);
+		if (ret < 0)
+			return ret;
+	}
 
 	PipelineHandler::queueRequest(camera, request);
 
@@ -362,7 +571,7 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 		return false;
 
 	/* Create and register the camera. */
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{ &data->stream_, &data->rawStream_ };
 	std::shared_ptr<Camera> camera = Camera::create(this, "VIMC Sensor B",
 							streams);
 	registerCamera(std::move(camera), std::move(data));
@@ -410,6 +619,8 @@ int VimcCameraData::init(MediaDevice *media)
 	if (raw_->open())
 		return -ENODEV;
 
+	raw_->bufferReady.connect(this, &VimcCameraData::bufferReady);
+
 	/* Initialise the supported controls. */
 	const ControlInfoMap &controls = sensor_->controls();
 	ControlInfoMap::Map ctrls;
@@ -437,6 +648,12 @@ int VimcCameraData::init(MediaDevice *media)
 			      std::forward_as_tuple(range));
 	}
 
+	int64_t minDuration, maxDuration;
+	if (!sensor_->frameDurationLimits(&minDuration, &maxDuration))
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::FrameDuration),
+			      std::forward_as_tuple(minDuration, maxDuration));
+
 	controlInfo_ = std::move(ctrls);
 	return 0;
 }
@@ -445,8 +662,12 @@ void VimcCameraData::bufferReady(Buffer *buffer)
 {
 	Request *request = buffer->request();
 
+	if (frameDuration_)
+		request->metadata().set(controls::FrameDuration, frameDuration_);
+
 	pipe_->completeBuffer(camera_, request, buffer);
-	pipe_->completeRequest(camera_, request);
+	if (!request->hasPendingBuffers())
+		pipe_->completeRequest(camera_, request);
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerVimc);
@@ -7,13 +7,22 @@
 
 #include "pipeline_handler.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <iterator>
+#include <string.h>
+
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/object.h>
 
 #include "device_enumerator.h"
 #include "log.h"
 #include "media_device.h"
+#include "startup_timeline.h"
+#include "thread.h"
 #include "utils.h"
 
 /**
@@ -58,6 +67,61 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * exists.
  */
 
+/**
+ * \brief Retrieve an empty metadata list to be filled for a frame
+ *
+ * Creating a ControlList for the metadata of every frame allocates its storage,
+ * which is then merged into the request metadata and freed. To avoid this,
+ * pipeline handlers retrieve the list with this method, lend it to the IPA with
+ * the event that triggers the metadata computation, and hand it back filled to
+ * completeMetadata(). The storage is then recycled from frame to frame.
+ *
+ * This method shall be called from the pipeline handler thread.
+ *
+ * \return An empty control list for the controls::controls map
+ */
+ControlList CameraData::acquireMetadata()
+{
+	if (spareMetadata_.empty())
+		return ControlList(controls::controls);
+
+	ControlList metadata = std::move(spareMetadata_.back());
+	spareMetadata_.pop_back();
+	return metadata;
+}
+
+/**
+ * \brief Store the metadata of a frame in a request
+ * \param[in] request The request
+ * \param[in] metadata The metadata for the frame captured by \a request
+ *
+ * Store \a metadata in the metadata list of the \a request. When the request
+ * metadata is empty, which is the common case, the storage of the two lists is
+ * exchanged, and the metadata reaches the application without being copied.
+ * Otherwise \a metadata is merged into the request metadata. In both cases the
+ * remaining storage is retained for acquireMetadata().
+ *
+ * This method shall be called from the pipeline handler thread.
+ */
+void CameraData::completeMetadata(Request *request, ControlList &&metadata)
+{
+	ControlList &requestMetadata = request->metadata();
+
+	if (requestMetadata.empty()) {
+		requestMetadata.swap(metadata);
+	} else {
+		requestMetadata.merge(metadata);
+		metadata.clear();
+	}
+
+	/*
+	 * Lists are normally acquired and completed in pairs, bound the spares
+	 * to the number of frames that can be in flight in case they're not.
+	 */
+	if (spareMetadata_.size() < 8)
+		spareMetadata_.push_back(std::move(metadata));
+}
+
 /**
  * \var CameraData::camera_
  * \brief The camera related to this CameraData instance
@@ -88,12 +152,33 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * PipelineHandler::completeRequest()
  */
 
+/**
+ * \var CameraData::requestNodes_
+ * \brief The list nodes recycled from completed requests
+ *
+ * The nodes of the queuedRequests_ list are moved to this list when requests
+ * complete, and moved back when requests are queued. This avoids a memory
+ * allocation per request once capture has reached a steady state. Pipeline
+ * handlers shall not use it directly.
+ */
+
+/**
+ * \var CameraData::submittedRequests_
+ * \brief The requests submitted by the camera and not yet queued
+ *
+ * When the pipeline handler runs in its own thread, requests queued by the
+ * application are stored in this lock-free queue by submitRequest() and
+ * passed to queueRequests() from the pipeline handler thread.
+ *
+ * \sa PipelineHandler::submitRequest()
+ */
+
 /**
  * \var CameraData::controlInfo_
  * \brief The set of controls supported by the camera
  *
  * The control information shall be initialised by the pipeline handler when
- * creating the camera, and shall not be modified afterwards.
+ * creating the camera or in initCamera(), and shall not be modified afterwards.
  */
 
 /**
@@ -104,6 +189,245 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * stream(s). If no IPA exists for the camera, this field is set to nullptr.
  */
 
+/**
+ * \var CameraData::nextSequence_
+ * \brief The sequence number expected for the next frame of each stream
+ *
+ * The sequence numbers are tracked by the pipeline handler base class when
+ * buffers complete, to detect the frames dropped by the devices.
+ *
+ * \sa PipelineHandler::completeBuffer()
+ */
+
+/**
+ * \var CameraData::qosLevel_
+ * \brief The bandwidth throttling level of the camera
+ * \sa controls::QosLevel
+ */
+
+/**
+ * \var CameraData::qosStableFrames_
+ * \brief The number of requests completed without dropped frames or overload
+ * since the last change of the throttling level
+ */
+
+/**
+ * \var CameraData::qosOverloadFrames_
+ * \brief The number of consecutive requests whose processing has overrun the
+ * frame interval
+ */
+
+/**
+ * \var CameraData::qosFrameInterval_
+ * \brief The frame interval in nanoseconds, estimated from the capture
+ * timestamps while the frame rate isn't throttled
+ */
+
+/**
+ * \var CameraData::qosLastCapture_
+ * \brief The capture timestamp of the last completed request, or 0 if it had
+ * no captured frame
+ */
+
+/**
+ * \var CameraData::qosFrameDuration_
+ * \brief The frame duration in microseconds the frame rate is throttled to,
+ * or 0 when the frame rate isn't throttled
+ */
+
+/**
+ * \var CameraData::qosRequestedDuration_
+ * \brief The last frame duration in microseconds requested by the
+ * application, or 0 if none has been requested
+ */
+
+/**
+ * \var CameraData::qosAppliedDuration_
+ * \brief The frame duration in microseconds last applied to the requests to
+ * throttle the frame rate, or 0 if the frame rate isn't throttled
+ */
+
+/**
+ * \var CameraData::outOfOrderCompletion_
+ * \brief Whether requests can complete out of order
+ * \sa PipelineHandler::setOutOfOrderCompletion()
+ */
+
+/**
+ * \var CameraData::timestampClock_
+ * \brief The clock domain the buffer timestamps are converted to
+ * \sa PipelineHandler::setTimestampClock()
+ */
+
+/**
+ * \var CameraData::clockCorrelator_
+ * \brief The correlator converting the buffer timestamps to timestampClock_
+ */
+
+/**
+ * \var CameraData::validationCache_
+ * \brief The cache of the camera configurations validated for the camera
+ *
+ * The cache is mutable as camera configurations only borrow a const reference
+ * to the camera data.
+ */
+
+/**
+ * \var CameraData::initialized_
+ * \brief Whether the camera has been initialized by
+ * PipelineHandler::initCamera()
+ */
+
+/**
+ * \var CameraData::standbyDevices_
+ * \brief The devices kept powered while the camera is in use or in standby
+ *
+ * Pipeline handlers add to this list the devices whose power up delays the
+ * start of the camera, typically the camera sensor, when registering the
+ * camera. The devices are held by PipelineHandler::wake() and released when
+ * the standby period set by PipelineHandler::setStandbyPeriod() expires.
+ */
+
+/**
+ * \var CameraData::standbyTimer_
+ * \brief The timer tracking the standby period of the released camera
+ */
+
+void CameraData::standbyTimeout(Timer *timer)
+{
+	for (std::unique_ptr<RuntimePM> &device : standbyDevices_)
+		device->release();
+}
+
+/*
+ * Object used to call functions in the thread it is bound to, through the
+ * thread's message queue.
+ */
+class PipelineInvoker : public Object
+{
+public:
+	void invoke(std::function<void()> func)
+	{
+		func();
+	}
+};
+
+namespace {
+
+/* The maximum bandwidth throttling level. */
+constexpr unsigned int QosMaxLevel = 4;
+
+/* The number of frames without drops before lowering the throttling level. */
+constexpr unsigned int QosRecoveryFrames = 60;
+
+/* The number of consecutive overloaded frames before raising the level. */
+constexpr unsigned int QosOverloadFrames = 4;
+
+/* The capture to completion latency, in frames, that denotes an overload. */
+constexpr unsigned int QosLatencyFrames = 3;
+
+} /* namespace */
+
+/**
+ * \class PipelineThread
+ * \brief Thread running a pipeline handler
+ *
+ * When pipeline threads are enabled in the camera manager, each pipeline
+ * handler runs in its own PipelineThread. The pipeline handler is matched,
+ * operated and destroyed in that thread, which binds all the event notifiers
+ * and timers it creates, including the ones of its V4L2 devices and IPA
+ * proxies, to the thread's event dispatcher. Buffer completion is thus
+ * handled independently of the application's event loop.
+ *
+ * The PipelineThread also delivers the completion notifications of the
+ * pipeline handler asynchronously to the thread the camera manager runs in.
+ */
+class PipelineThread : public Thread
+{
+public:
+	PipelineThread()
+	{
+		pipeline_.moveToThread(this);
+	}
+
+	int call(const std::function<int()> &func);
+	void post(const std::function<void()> &func);
+	void deliver(const std::function<void()> &func);
+	void flush();
+
+private:
+	PipelineInvoker pipeline_;
+	PipelineInvoker application_;
+};
+
+/**
+ * \brief Call a function synchronously in the pipeline thread
+ * \param[in] func The function
+ *
+ * The calling thread is blocked until \a func returns. When called from the
+ * pipeline thread itself, \a func is called directly.
+ *
+ * \return The value returned by \a func
+ */
+int PipelineThread::call(const std::function<int()> &func)
+{
+	if (Thread::current() == this)
+		return func();
+
+	Mutex mutex;
+	std::condition_variable cv;
+	bool done = false;
+	int ret = 0;
+
+	post([&]() {
+		ret = func();
+
+		/*
+		 * Notify with the lock held, the caller destroys the condition
+		 * variable as soon as it returns from wait().
+		 */
+		MutexLocker locker(mutex);
+		done = true;
+		cv.notify_one();
+	});
+
+	MutexLocker locker(mutex);
+	cv.wait(locker, [&] { return done; });
+
+	return ret;
+}
+
+/**
+ * \brief Call a function asynchronously in the pipeline thread
+ * \param[in] func The function
+ */
+void PipelineThread::post(const std::function<void()> &func)
+{
+	pipeline_.invokeMethod(&PipelineInvoker::invoke, func);
+}
+
+/**
+ * \brief Call a function asynchronously in the camera manager thread
+ * \param[in] func The function
+ */
+void PipelineThread::deliver(const std::function<void()> &func)
+{
+	application_.invokeMethod(&PipelineInvoker::invoke, func);
+}
+
+/**
+ * \brief Call all functions pending delivery to the camera manager thread
+ *
+ * This method shall be called from the camera manager thread. It has no effect
+ * when called from any other thread.
+ */
+void PipelineThread::flush()
+{
+	Thread *thread = application_.thread();
+	if (Thread::current() == thread)
+		thread->dispatchMessages(&application_);
+}
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -115,6 +439,15 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * They implement std::enable_shared_from_this<> in order to create new
  * std::shared_ptr<> in code paths originating from member functions of the
  * PipelineHandler class where only the 'this' pointer is available.
+ *
+ * By default all pipeline handlers run in the thread of the camera manager.
+ * When pipeline threads are enabled with CameraManager::setPipelineThreads(),
+ * each pipeline handler instance runs in a dedicated thread instead. All
+ * methods of the pipeline handler, starting with match(), are then called in
+ * that thread. The Camera class uses invoke() and submitRequest() to reach the
+ * pipeline handler, and completion notifications are delivered to the camera
+ * manager thread asynchronously. Pipeline handlers don't need to be aware of
+ * the thread they run in.
  */
 
 /**
@@ -127,7 +460,8 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * respective factories.
  */
 PipelineHandler::PipelineHandler(CameraManager *manager)
-	: manager_(manager)
+	: manager_(manager), standbyPeriod_(0), thread_(nullptr),
+	  batching_(false)
 {
 }
 
@@ -233,6 +567,121 @@ void PipelineHandler::unlock()
 		media->unlock();
 }
 
+/**
+ * \brief Initialize a camera on first use
+ * \param[in] camera The camera to initialize
+ *
+ * Call initCamera() for \a camera the first time this method is called, and
+ * after every failure of initCamera(). The Camera class initializes the camera
+ * before it is acquired, and before its controls and configurations are
+ * retrieved.
+ *
+ * This method shall be called in the pipeline handler thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::initialize(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	if (data->initialized_)
+		return 0;
+
+	StartupTimeline::Scope phase("camera-init", camera->name());
+
+	int ret = initCamera(camera);
+	if (ret) {
+		LOG(Pipeline, Error)
+			<< "Failed to initialize camera " << camera->name()
+			<< ": " << strerror(-ret);
+		return ret;
+	}
+
+	data->initialized_ = true;
+
+	return 0;
+}
+
+/**
+ * \fn PipelineHandler::setStandbyPeriod()
+ * \brief Set the period the cameras are kept warm after being released
+ * \param[in] msec The standby period in milliseconds, 0 to disable standby
+ *
+ * \sa CameraManager::setStandbyPeriod()
+ */
+
+/**
+ * \fn PipelineHandler::standbyPeriod()
+ * \brief Retrieve the period the cameras are kept warm after being released
+ * \return The standby period in milliseconds, 0 if standby is disabled
+ */
+
+/**
+ * \brief Keep the devices of a camera powered
+ * \param[in] camera The camera being acquired
+ *
+ * Cancel the standby period of \a camera if it is running, and hold the
+ * CameraData::standbyDevices_ when standby is enabled. The Camera class wakes
+ * the camera when it is acquired.
+ *
+ * This method shall be called in the pipeline handler thread.
+ */
+void PipelineHandler::wake(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	data->standbyTimer_.stop();
+
+	if (!standbyPeriod_)
+		return;
+
+	for (std::unique_ptr<RuntimePM> &device : data->standbyDevices_)
+		device->hold();
+}
+
+/**
+ * \brief Start the standby period of a camera
+ * \param[in] camera The camera being released
+ *
+ * The devices of \a camera held by wake() are released when the standby
+ * period expires, unless the camera is acquired again in the meantime. The
+ * Camera class starts the standby period when the camera is released.
+ *
+ * This method shall be called in the pipeline handler thread.
+ */
+void PipelineHandler::standby(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	bool held = std::any_of(data->standbyDevices_.begin(),
+				data->standbyDevices_.end(),
+				[](const std::unique_ptr<RuntimePM> &device) {
+					return device->isHeld();
+				});
+	if (held)
+		data->standbyTimer_.start(standbyPeriod_);
+}
+
+/**
+ * \brief Complete the initialization of a camera
+ * \param[in] camera The camera to initialize
+ *
+ * Pipeline handlers register their cameras from match(), which runs for all
+ * the cameras in the system when the camera manager starts. To keep the cost
+ * of starting the camera manager independent of the number of cameras, the
+ * pipeline handlers should only gather in match() the information needed to
+ * register the cameras, and defer the expensive initialization steps, such as
+ * opening video nodes, enumerating their formats and controls, or loading IPA
+ * modules, to this method. It is called once per camera, on first use.
+ *
+ * The default implementation does nothing.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::initCamera(Camera *camera)
+{
+	return 0;
+}
+
 /**
  * \brief Retrieve the list of controls for a camera
  * \param[in] camera The camera
@@ -287,6 +736,34 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * \return 0 on success or a negative error code otherwise
  */
 
+/**
+ * \brief Apply a configuration to a running camera
+ * \param[in] camera The camera to reconfigure
+ * \param[in] config The camera configuration to apply
+ *
+ * Apply \a config to \a camera while it is running. The configuration is
+ * guaranteed to have been validated and reported as live by the pipeline
+ * handler's CameraConfiguration::validate() implementation, which shall only
+ * do so when the change can be applied without stopping the camera. The
+ * pipeline handler shall associate each StreamConfiguration entry with the
+ * same Stream instance as in the current configuration, using
+ * StreamConfiguration::setStream().
+ *
+ * Requests in flight may complete with cancelled buffers for the streams
+ * affected by the change, while the rest of the pipeline keeps running.
+ *
+ * Pipeline handlers that support live reconfiguration shall override this
+ * method. The default implementation returns -ENOTSUP.
+ *
+ * The intended caller of this method is the Camera class.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	return -ENOTSUP;
+}
+
 /**
  * \fn PipelineHandler::allocateBuffers()
  * \brief Allocate buffers for a stream
@@ -316,6 +793,32 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * \return 0 on success or a negative error code otherwise
  */
 
+/**
+ * \brief Allocate additional buffers for a stream
+ * \param[in] camera The camera the \a stream belongs to
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] count The number of buffers to add
+ *
+ * This method allocates \a count additional buffers for the \a stream, after
+ * buffers have been allocated with allocateBuffers(), possibly while the
+ * camera is running. The stream's buffer pool has already been grown by \a
+ * count buffers when this method is called, and the pipeline handler shall
+ * associate the new buffers with the new pool entries without disturbing the
+ * buffers in use.
+ *
+ * Pipeline handlers that support growing their buffer pools shall override
+ * this method. The default implementation returns -ENOTSUP.
+ *
+ * The intended caller of this method is the Camera class.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::addBuffers(Camera *camera, Stream *stream,
+				unsigned int count)
+{
+	return -ENOTSUP;
+}
+
 /**
  * \fn PipelineHandler::start()
  * \brief Start capturing from a group of streams
@@ -361,11 +864,74 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
 int PipelineHandler::queueRequest(Camera *camera, Request *request)
 {
 	CameraData *data = cameraData(camera);
-	data->queuedRequests_.push_back(request);
+	pushRequest(data, request);
+
+	return 0;
+}
+
+/**
+ * \brief Queue multiple requests to the camera
+ * \param[in] camera The camera to queue the requests to
+ * \param[in] requests The requests to queue, in order
+ *
+ * This method queues a batch of capture requests to the pipeline handler for
+ * processing. Pipeline handlers may override it to process the batch at once,
+ * for instance to perform a single round trip with their IPA for all the
+ * requests, and shall in that case handle each request as queueRequest()
+ * would. The base implementation calls queueRequest() for each request and
+ * stops at the first error.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::queueRequests(Camera *camera,
+				   const std::vector<Request *> &requests)
+{
+	for (Request *request : requests) {
+		int ret = queueRequest(camera, request);
+		if (ret)
+			return ret;
+	}
 
 	return 0;
 }
 
+/**
+ * \brief Signal the start of the frame for the next request
+ * \param[in] camera The camera the request belongs to
+ * \param[in] timestamp The frame start timestamp in nanoseconds
+ *
+ * This method shall be called by pipeline handlers when the device reports the
+ * start of a frame, usually from the V4L2Device::frameStart signal. The frame
+ * is associated with the oldest request that has been queued to a device and
+ * hasn't started yet. The request is timestamped with the
+ * Request::StageStarted stage and the Camera::requestStarted signal is emitted.
+ *
+ * Frames starting while no request is queued to the devices are ignored.
+ */
+void PipelineHandler::startRequest(Camera *camera, uint64_t timestamp)
+{
+	CameraData *data = cameraData(camera);
+
+	for (Request *request : data->queuedRequests_) {
+		if (request->timestamp(Request::StageStarted))
+			continue;
+
+		if (!request->timestamp(Request::StageDeviceQueued))
+			return;
+
+		request->trace(Request::StageStarted, timestamp);
+
+		if (thread_)
+			deliver([camera, request, timestamp]() {
+				camera->requestStarted.emit(request, timestamp);
+			});
+		else
+			camera->requestStarted.emit(request, timestamp);
+
+		return;
+	}
+}
+
 /**
  * \brief Complete a buffer for a request
  * \param[in] camera The camera the request belongs to
@@ -379,28 +945,230 @@ int PipelineHandler::queueRequest(Camera *camera, Request *request)
  * pipeline handlers a chance to perform any operation that may still be
  * needed. They shall complete requests explicitly with completeRequest().
  *
+ * The buffers of each stream shall be completed in capture order, their
+ * sequence numbers are checked to detect the frames dropped by the devices.
+ *
  * \return True if all buffers contained in the request have completed, false
  * otherwise
  */
 bool PipelineHandler::completeBuffer(Camera *camera, Request *request,
 				     Buffer *buffer)
 {
-	camera->bufferCompleted.emit(request, buffer);
-	return request->completeBuffer(buffer);
+	unsigned int dropped = detectDroppedFrames(cameraData(camera), buffer);
+	request->framesDropped_ = std::max(request->framesDropped_, dropped);
+
+	/*
+	 * Complete the buffer before notifying the application, to let it
+	 * recycle the buffer from the signal handler.
+	 */
+	bool complete = request->completeBuffer(buffer);
+	convertTimestamp(cameraData(camera), buffer);
+
+	if (buffer->status_ == Buffer::BufferSuccess && buffer->stream_)
+		buffer->modifier_ = buffer->stream_->configuration().modifier;
+
+	if (thread_)
+		deliver([camera, request, buffer]() {
+			camera->bufferCompleted.emit(request, buffer);
+		});
+	else
+		camera->bufferCompleted.emit(request, buffer);
+
+	return complete;
 }
 
 /**
- * \brief Signal request completion
- * \param[in] camera The camera that the request belongs to
- * \param[in] request The request that has completed
+ * \brief Complete a buffer that couldn't be queued in the cancelled state
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The request the buffer belongs to
+ * \param[in] buffer The buffer
  *
- * The pipeline handler shall call this method to notify the \a camera that the
- * request has completed. The request is deleted and shall not be accessed once
- * this method returns.
+ * Pipeline handlers that hold some buffers of accepted requests back, and
+ * can't queue them to a device anymore, shall call this method to complete
+ * them with the cancelled status, in place of completeBuffer().
  *
- * This method ensures that requests will be returned to the application in
- * submission order, the pipeline handler may call it on any complete request
- * without any ordering constraint.
+ * \return True if all buffers contained in the request have completed, false
+ * otherwise
+ */
+bool PipelineHandler::cancelBuffer(Camera *camera, Request *request,
+				   Buffer *buffer)
+{
+	buffer->cancel();
+	return completeBuffer(camera, request, buffer);
+}
+
+/**
+ * \brief Complete a buffer of a skipped frame without filling it
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The request the buffer belongs to
+ * \param[in] buffer The buffer
+ *
+ * Pipeline handlers that implement stream frame decimation shall call this
+ * method to complete the buffers of decimated streams on the frames they skip,
+ * without queueing them to a device. The buffers complete with the skipped
+ * status, which doesn't affect the status of the \a request.
+ *
+ * \sa StreamConfiguration::frameDecimation
+ *
+ * \return True if all buffers contained in the request have completed, false
+ * otherwise
+ */
+bool PipelineHandler::skipBuffer(Camera *camera, Request *request,
+				 Buffer *buffer)
+{
+	buffer->skip();
+	return completeBuffer(camera, request, buffer);
+}
+
+/**
+ * \brief Check if a stream skips a frame due to its decimation
+ * \param[in] camera The camera
+ * \param[in] stream The stream
+ * \param[in] frame The frame sequence number
+ *
+ * The stream decimation combines the StreamConfiguration::frameDecimation
+ * configured by the application with the throttling of the stream according to
+ * its StreamConfiguration::priority and the current throttling level of the \a
+ * camera. Pipeline handlers that implement frame decimation shall call this
+ * method to decide which frames to skip, and complete the stream buffers of
+ * the skipped frames with skipBuffer().
+ *
+ * \return True if \a stream skips \a frame, false otherwise
+ */
+bool PipelineHandler::skipFrame(Camera *camera, const Stream *stream,
+				unsigned int frame)
+{
+	CameraData *data = cameraData(camera);
+	const StreamConfiguration &cfg = stream->configuration();
+	unsigned int level = data->qosLevel_;
+	unsigned int shift;
+
+	switch (cfg.priority) {
+	case LowPriority:
+		shift = level;
+		break;
+	case NormalPriority:
+		shift = level > 2 ? level - 2 : 0;
+		break;
+	case HighPriority:
+	default:
+		shift = 0;
+		break;
+	}
+
+	unsigned int decimation = std::max(cfg.frameDecimation, 1U) << shift;
+	return decimation > 1 && frame % decimation;
+}
+
+/**
+ * \brief Copy the metadata of a buffer processed in software
+ * \param[in] buffer The buffer to update
+ * \param[in] source The buffer the content of \a buffer has been produced from
+ * \param[in] bytesused The number of bytes written to \a buffer
+ *
+ * Pipeline handlers that produce the content of a request buffer in software
+ * from an internal capture buffer, such as when decoding compressed frames,
+ * shall call this method before completing the \a buffer. The capture status,
+ * sequence number and timestamp of the \a source are copied to the \a buffer,
+ * and its payload is set to \a bytesused bytes in the first plane. A \a
+ * bytesused value of 0 marks the \a buffer as erroneous if the \a source had
+ * been captured successfully.
+ */
+void PipelineHandler::copyBufferMetadata(Buffer *buffer, const Buffer *source,
+					 unsigned int bytesused)
+{
+	if (source->status_ == Buffer::BufferSuccess && !bytesused)
+		buffer->status_ = Buffer::BufferError;
+	else
+		buffer->status_ = source->status_;
+	buffer->sequence_ = source->sequence_;
+	buffer->timestamp_ = source->timestamp_;
+	buffer->timestampClock_ = source->timestampClock_;
+	buffer->timestampSource_ = source->timestampSource_;
+	buffer->bytesused_ = bytesused;
+	buffer->planesBytesused_ = { bytesused, 0, 0 };
+	buffer->planesOffset_ = { 0, 0, 0 };
+}
+
+/**
+ * \brief Override the timestamp of a captured buffer
+ * \param[in] buffer The buffer
+ * \param[in] timestamp The timestamp, in nanoseconds on the CLOCK_MONOTONIC
+ * clock
+ * \param[in] source The frame event the \a timestamp refers to
+ *
+ * Buffers are timestamped by the V4L2 video devices with the time reported by
+ * their driver. Pipeline handlers that can timestamp frames more accurately,
+ * for instance from device clock information, shall call this method before
+ * completing the \a buffer.
+ */
+void PipelineHandler::setBufferTimestamp(Buffer *buffer, uint64_t timestamp,
+					 Buffer::TimestampSource source)
+{
+	buffer->timestamp_ = timestamp;
+	buffer->timestampClock_ = Buffer::ClockMonotonic;
+	buffer->timestampSource_ = source;
+}
+
+/**
+ * \brief Set the metadata of a buffer produced without a video device
+ * \param[in] buffer The buffer to update
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The frame timestamp, in nanoseconds on the
+ * CLOCK_MONOTONIC clock
+ * \param[in] bytesused The number of bytes written to \a buffer
+ *
+ * Pipeline handlers that produce frames entirely in software, without a V4L2
+ * video device to fill the buffer metadata, shall call this method before
+ * completing the \a buffer. The payload is set to \a bytesused bytes in the
+ * first plane, and a \a bytesused value of 0 marks the \a buffer as
+ * erroneous.
+ */
+void PipelineHandler::setBufferMetadata(Buffer *buffer, unsigned int sequence,
+					uint64_t timestamp, unsigned int bytesused)
+{
+	buffer->status_ = bytesused ? Buffer::BufferSuccess : Buffer::BufferError;
+	buffer->sequence_ = sequence;
+	buffer->timestamp_ = timestamp;
+	buffer->timestampClock_ = Buffer::ClockMonotonic;
+	buffer->timestampSource_ = Buffer::TimestampEndOfFrame;
+	buffer->bytesused_ = bytesused;
+	buffer->planesBytesused_ = { bytesused, 0, 0 };
+	buffer->planesOffset_ = { 0, 0, 0 };
+}
+
+/**
+ * \brief Timestamp a processing stage of a request
+ * \param[in] request The request
+ * \param[in] stage The processing stage
+ *
+ * The stages of the request processing common to all pipeline handlers are
+ * timestamped automatically by the Camera, the PipelineHandler and the video
+ * devices. Pipeline handlers shall call this method to timestamp the stages
+ * specific to their implementation, such as Request::StageIPAAction.
+ */
+void PipelineHandler::traceRequest(Request *request, Request::Stage stage)
+{
+	request->trace(stage);
+}
+
+/**
+ * \brief Signal request completion
+ * \param[in] camera The camera that the request belongs to
+ * \param[in] request The request that has completed
+ *
+ * The pipeline handler shall call this method to notify the \a camera that the
+ * request has completed. The request is deleted and shall not be accessed once
+ * this method returns.
+ *
+ * This method ensures that requests will be returned to the application in
+ * submission order, the pipeline handler may call it on any complete request
+ * without any ordering constraint. When out of order completion is enabled,
+ * requests are returned as soon as they complete instead.
+ *
+ * When frames have been dropped before a request, their number is reported
+ * in the controls::FramesDropped metadata of the request, and the
+ * Camera::framesDropped signal is emitted before the request completes.
  */
 void PipelineHandler::completeRequest(Camera *camera, Request *request)
 {
@@ -408,15 +1176,498 @@ void PipelineHandler::completeRequest(Camera *camera, Request *request)
 
 	CameraData *data = cameraData(camera);
 
-	while (!data->queuedRequests_.empty()) {
-		request = data->queuedRequests_.front();
-		if (request->status() == Request::RequestPending)
-			break;
+	auto it = data->queuedRequests_.begin();
+	while (it != data->queuedRequests_.end()) {
+		request = *it;
+		if (request->status() == Request::RequestPending) {
+			if (!data->outOfOrderCompletion_)
+				break;
+
+			++it;
+			continue;
+		}
 
 		ASSERT(!request->hasPendingBuffers());
-		data->queuedRequests_.pop_front();
-		camera->requestComplete(request);
+		auto next = std::next(it);
+		data->requestNodes_.splice(data->requestNodes_.end(),
+					   data->queuedRequests_, it);
+		it = next;
+
+		unsigned int dropped = 0;
+		if (request->status() == Request::RequestComplete)
+			dropped = request->framesDropped_;
+
+		/* Qualify the namespace, controls() is a member function. */
+		if (dropped)
+			request->metadata().set(libcamera::controls::FramesDropped,
+						static_cast<int32_t>(dropped));
+
+		bool throttled = updateQos(data, request, dropped);
+		unsigned int level = data->qosLevel_;
+
+		if (thread_)
+			deliver([camera, request, dropped, throttled, level]() {
+				if (dropped)
+					camera->framesDropped.emit(request, dropped);
+				if (throttled)
+					camera->qosLevelChanged.emit(request, level);
+				camera->requestComplete(request);
+			});
+		else {
+			if (dropped)
+				camera->framesDropped.emit(request, dropped);
+			if (throttled)
+				camera->qosLevelChanged.emit(request, level);
+			camera->requestComplete(request);
+		}
+	}
+}
+
+/**
+ * \brief Add a request to the list of queued requests
+ * \param[in] data The camera data
+ * \param[in] request The request
+ *
+ * Reuse a list node recycled from a completed request when available, and
+ * allocate a new node otherwise.
+ */
+void PipelineHandler::pushRequest(CameraData *data, Request *request)
+{
+	if (data->requestNodes_.empty()) {
+		data->queuedRequests_.push_back(request);
+		return;
+	}
+
+	data->queuedRequests_.splice(data->queuedRequests_.end(),
+				     data->requestNodes_,
+				     data->requestNodes_.begin());
+	data->queuedRequests_.back() = request;
+}
+
+/**
+ * \brief Detect the frames dropped before a completed buffer
+ * \param[in] data The camera data
+ * \param[in] buffer The buffer, completed in capture order for its stream
+ *
+ * Compare the sequence number of the \a buffer, if captured successfully, with
+ * the sequence number expected for its stream. The expected sequence numbers
+ * are resynchronized when they go backward, as happens when the devices are
+ * restarted. The number of frames dropped on each stream is accounted for in
+ * the stream statistics.
+ *
+ * \return The number of frames dropped before the buffer
+ */
+unsigned int PipelineHandler::detectDroppedFrames(CameraData *data,
+						  Buffer *buffer)
+{
+	Stream *stream = buffer->stream();
+	auto next = data->nextSequence_.find(stream);
+
+	/* Skipped frames are not captured, but not dropped either. */
+	if (buffer->status() == Buffer::BufferSkipped) {
+		if (next != data->nextSequence_.end())
+			next->second++;
+		return 0;
+	}
+
+	if (buffer->status() != Buffer::BufferSuccess)
+		return 0;
+
+	unsigned int sequence = buffer->sequence();
+	unsigned int dropped = 0;
+
+	if (next != data->nextSequence_.end() && sequence > next->second) {
+		dropped = sequence - next->second;
+		stream->framesDropped_.fetch_add(dropped, std::memory_order_relaxed);
+	}
+
+	data->nextSequence_[stream] = sequence + 1;
+
+	return dropped;
+}
+
+/**
+ * \brief Set the request completion order for a camera
+ * \param[in] camera The camera
+ * \param[in] enable True to complete requests out of order
+ *
+ * This method is called by the camera when it is configured.
+ *
+ * \sa CameraConfiguration::setOutOfOrderCompletion()
+ */
+void PipelineHandler::setOutOfOrderCompletion(Camera *camera, bool enable)
+{
+	cameraData(camera)->outOfOrderCompletion_ = enable;
+}
+
+/**
+ * \brief Set the clock domain of the buffer timestamps of a camera
+ * \param[in] camera The camera
+ * \param[in] clock The clock domain, or Buffer::ClockUnknown to disable the
+ * conversion
+ *
+ * This method is called by the camera when it is configured.
+ *
+ * \sa CameraConfiguration::setTimestampClock()
+ */
+void PipelineHandler::setTimestampClock(Camera *camera, Buffer::Clock clock)
+{
+	CameraData *data = cameraData(camera);
+
+	data->timestampClock_ = clock;
+	data->clockCorrelator_.reset();
+}
+
+/*
+ * Convert the timestamp of a completed buffer to the clock domain configured
+ * for the camera. Buffers whose timestamp clock is unknown are left untouched.
+ */
+void PipelineHandler::convertTimestamp(CameraData *data, Buffer *buffer)
+{
+	if (data->timestampClock_ == Buffer::ClockUnknown ||
+	    buffer->timestampClock_ == data->timestampClock_ ||
+	    buffer->status_ != Buffer::BufferSuccess)
+		return;
+
+	uint64_t timestamp;
+	if (!data->clockCorrelator_.convert(buffer->timestamp_,
+					    buffer->timestampClock_,
+					    data->timestampClock_, &timestamp))
+		return;
+
+	buffer->timestamp_ = timestamp;
+	buffer->timestampClock_ = data->timestampClock_;
+}
+
+/**
+ * \brief Update the throttling level of a camera
+ * \param[in] data The camera data
+ * \param[in] request The completed request
+ * \param[in] dropped The number of frames dropped before the request
+ *
+ * Raise the throttling level when frames have been dropped, or when the
+ * processing of QosOverloadFrames consecutive requests has overrun the frame
+ * interval, either because the IPA has taken longer than a frame to handle the
+ * frame, or because the request has completed more than QosLatencyFrames
+ * frames after its capture. Lower the level after QosRecoveryFrames requests
+ * without dropped frames or overload.
+ *
+ * At the maximum level, the frame rate of cameras that support the
+ * controls::FrameDuration control is halved, until the level is lowered. The
+ * level is reported in the controls::QosLevel metadata of the request when not
+ * 0.
+ *
+ * \return True if the throttling level has changed, false otherwise
+ */
+bool PipelineHandler::updateQos(CameraData *data, Request *request,
+				unsigned int dropped)
+{
+	if (request->status() != Request::RequestComplete)
+		return false;
+
+	uint64_t captured = request->timestamp(Request::StageCaptured);
+	uint64_t ipaAction = request->timestamp(Request::StageIPAAction);
+	uint64_t completed = request->timestamp(Request::StageCompleted);
+
+	/*
+	 * Estimate the frame interval from the capture timestamps of
+	 * consecutive requests, accounting for the frames dropped in-between.
+	 * Intervals longer than a few frames come from requests queued late
+	 * by the application and are ignored, as are the intervals spanning
+	 * requests without a captured frame. The estimate is frozen while the
+	 * frame rate is throttled, to restore it afterwards.
+	 */
+	if (captured > data->qosLastCapture_ && data->qosLastCapture_ &&
+	    !data->qosFrameDuration_) {
+		uint64_t interval = (captured - data->qosLastCapture_) / (dropped + 1);
+		if (!data->qosFrameInterval_)
+			data->qosFrameInterval_ = interval;
+		else if (interval < data->qosFrameInterval_ * 4)
+			data->qosFrameInterval_ = (data->qosFrameInterval_ * 7 + interval) / 8;
+	}
+
+	data->qosLastCapture_ = captured;
+
+	uint64_t interval = data->qosFrameInterval_;
+	bool overloaded = interval && captured &&
+			  (ipaAction > captured + interval ||
+			   completed > captured + interval * QosLatencyFrames);
+
+	/*
+	 * Requests without a captured frame, such as those of throttled
+	 * streams, tell nothing about the processing load and don't break a
+	 * series of overloaded requests.
+	 */
+	if (overloaded)
+		data->qosOverloadFrames_++;
+	else if (captured)
+		data->qosOverloadFrames_ = 0;
+
+	unsigned int level = data->qosLevel_;
+
+	if (dropped || data->qosOverloadFrames_ >= QosOverloadFrames) {
+		if (data->qosLevel_ < QosMaxLevel) {
+			data->qosLevel_++;
+			LOG(Pipeline, Debug)
+				<< (dropped ? "Frames dropped" : "Processing overrun")
+				<< ", throttling level raised to " << data->qosLevel_;
+		}
+		data->qosStableFrames_ = 0;
+		data->qosOverloadFrames_ = 0;
+	} else if (overloaded) {
+		data->qosStableFrames_ = 0;
+	} else if (data->qosLevel_ &&
+		   ++data->qosStableFrames_ >= QosRecoveryFrames) {
+		data->qosLevel_--;
+		data->qosStableFrames_ = 0;
+		LOG(Pipeline, Debug)
+			<< "Throttling level lowered to " << data->qosLevel_;
+	}
+
+	/*
+	 * Halve the frame rate at the maximum level, relative to the frame
+	 * duration requested by the application or, if none, to the estimated
+	 * frame interval. The new duration is applied by applyQos() to the
+	 * next requests.
+	 */
+	bool throttleRate = data->qosLevel_ == QosMaxLevel &&
+			    data->controlInfo_.count(&libcamera::controls::FrameDuration);
+	if (throttleRate && !data->qosFrameDuration_) {
+		int64_t duration = data->qosRequestedDuration_
+				 ? data->qosRequestedDuration_
+				 : static_cast<int64_t>(interval / 1000);
+		data->qosFrameDuration_ = duration * 2;
+	} else if (!throttleRate) {
+		data->qosFrameDuration_ = 0;
+	}
+
+	if (data->qosLevel_)
+		request->metadata().set(libcamera::controls::QosLevel,
+					static_cast<int32_t>(data->qosLevel_));
+
+	return data->qosLevel_ != level;
+}
+
+/**
+ * \brief Throttle the frame rate of a request according to the throttling level
+ * \param[in] data The camera data
+ * \param[in] request The request about to be queued to the pipeline handler
+ *
+ * Set the controls::FrameDuration control of the \a request to the frame
+ * duration selected by updateQos() when the frame rate is throttled, and to
+ * the frame duration requested by the application, or the estimated frame
+ * interval, when the throttling ends. The frame durations requested by the
+ * application are recorded, and honoured when longer than the throttled
+ * duration.
+ */
+void PipelineHandler::applyQos(CameraData *data, Request *request)
+{
+	ControlList &controls = request->controls();
+	bool requested = controls.contains(libcamera::controls::FrameDuration);
+	int64_t duration;
+
+	if (requested)
+		data->qosRequestedDuration_ =
+			controls.get(libcamera::controls::FrameDuration);
+
+	if (data->qosFrameDuration_) {
+		duration = std::max(data->qosFrameDuration_,
+				    data->qosRequestedDuration_);
+		if (duration == data->qosAppliedDuration_ && !requested)
+			return;
+
+		data->qosAppliedDuration_ = duration;
+	} else if (data->qosAppliedDuration_) {
+		data->qosAppliedDuration_ = 0;
+		if (requested)
+			return;
+
+		duration = data->qosRequestedDuration_
+			 ? data->qosRequestedDuration_
+			 : static_cast<int64_t>(data->qosFrameInterval_ / 1000);
+	} else {
+		return;
 	}
+
+	LOG(Pipeline, Debug) << "Frame duration set to " << duration << "us";
+	controls.set(libcamera::controls::FrameDuration, duration);
+}
+
+/**
+ * \brief Call a function in the pipeline handler thread
+ * \param[in] func The function
+ *
+ * This method is used by the Camera class to call pipeline handler methods. If
+ * the pipeline handler runs in its own thread, \a func is called in that
+ * thread and the caller is blocked until it returns. Otherwise \a func is
+ * called directly.
+ *
+ * \return The value returned by \a func
+ */
+int PipelineHandler::invoke(const std::function<int()> &func)
+{
+	if (!thread_)
+		return func();
+
+	return thread_->call(func);
+}
+
+/**
+ * \brief Submit a request to the pipeline handler
+ * \param[in] camera The camera to queue the request to
+ * \param[in] request The request to queue
+ *
+ * This method is used by the Camera class to queue requests. If the pipeline
+ * handler runs in its own thread, the \a request is stored in a lock-free
+ * queue, and all the requests submitted until the pipeline handler thread
+ * processes them are passed to queueRequests() in a single batch. Requests that
+ * the pipeline handler fails to queue are then completed in the cancelled
+ * state. Otherwise the request is passed to queueRequest() directly when
+ * submitted from the camera manager thread, and through the same lock-free
+ * queue, processed in the camera manager thread, when submitted from any other
+ * thread.
+ *
+ * This method may be called from any thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::submitRequest(Camera *camera, Request *request)
+{
+	if (!thread_ && isCurrentThread()) {
+		applyQos(cameraData(camera), request);
+		return queueRequest(camera, request);
+	}
+
+	CameraData *data = cameraData(camera);
+	if (data->submittedRequests_.push(request))
+		post([this, camera]() {
+			processSubmittedRequests(camera);
+		});
+
+	return 0;
+}
+
+/**
+ * \brief Submit multiple requests to the pipeline handler
+ * \param[in] camera The camera to queue the requests to
+ * \param[in] requests The requests to queue, in order
+ *
+ * This method behaves as submitRequest() for a batch of \a requests. If the
+ * pipeline handler doesn't run in its own thread and the requests are
+ * submitted from the camera manager thread, they are passed to queueRequests()
+ * directly.
+ *
+ * This method may be called from any thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::submitRequests(Camera *camera,
+				    const std::vector<Request *> &requests)
+{
+	CameraData *data = cameraData(camera);
+
+	if (!thread_ && isCurrentThread()) {
+		for (Request *request : requests)
+			applyQos(data, request);
+		return queueRequests(camera, requests);
+	}
+
+	bool wake = false;
+
+	for (Request *request : requests)
+		wake |= data->submittedRequests_.push(request);
+
+	if (wake)
+		post([this, camera]() {
+			processSubmittedRequests(camera);
+		});
+
+	return 0;
+}
+
+/**
+ * \brief Queue the requests submitted to the pipeline handler
+ * \param[in] camera The camera
+ *
+ * This method shall be called from the pipeline handler thread, or from the
+ * camera manager thread if the pipeline handler doesn't run in its own thread.
+ * It passes the requests submitted with submitRequest() and not processed yet
+ * to the pipeline handler, for instance before stopping the camera to ensure
+ * that they get cancelled.
+ */
+void PipelineHandler::flushSubmissions(Camera *camera)
+{
+	processSubmittedRequests(camera);
+}
+
+/**
+ * \brief Stop a camera and cancel its pending requests
+ * \param[in] camera The camera to stop
+ *
+ * This method is used by the Camera class to stop the \a camera. It passes the
+ * requests submitted and not processed yet to the pipeline handler and calls
+ * stop(). If the pipeline handler runs in its own thread, the completion
+ * notifications of all the requests cancelled by stop() are collected and
+ * delivered to the camera manager thread in a single batch, instead of one
+ * message per buffer and request.
+ *
+ * This method shall be called from the pipeline handler thread, through
+ * invoke().
+ */
+void PipelineHandler::stopCamera(Camera *camera)
+{
+	flushSubmissions(camera);
+
+	/* The next capture timestamp isn't consecutive with the last one. */
+	cameraData(camera)->qosLastCapture_ = 0;
+
+	batching_ = true;
+	stop(camera);
+	batching_ = false;
+
+	if (completions_.empty())
+		return;
+
+	std::shared_ptr<std::vector<std::function<void()>>> completions =
+		std::make_shared<std::vector<std::function<void()>>>();
+	completions->swap(completions_);
+
+	thread_->deliver([completions]() {
+		for (const std::function<void()> &func : *completions)
+			func();
+	});
+}
+
+/**
+ * \brief Deliver pending completion notifications synchronously
+ *
+ * If the pipeline handler runs in its own thread, this method delivers all the
+ * buffer and request completion notifications that are pending delivery to the
+ * camera manager thread. It is used by the Camera class to complete all
+ * cancelled requests before Camera::stop() returns. This method shall be called
+ * from the camera manager thread.
+ */
+void PipelineHandler::flushCompletions()
+{
+	if (thread_)
+		thread_->flush();
+}
+
+/**
+ * \brief Deliver a notification to the camera manager thread
+ * \param[in] func The function emitting the notification
+ *
+ * This method shall only be called when the pipeline handler runs in its own
+ * thread. The notification is queued for delivery, or, while stopping a camera
+ * with stopCamera(), batched with the other notifications of the cancelled
+ * requests.
+ */
+void PipelineHandler::deliver(const std::function<void()> &func)
+{
+	if (batching_)
+		completions_.push_back(func);
+	else
+		thread_->deliver(func);
 }
 
 /**
@@ -494,6 +1745,143 @@ void PipelineHandler::disconnect()
 	cameras_.clear();
 }
 
+/**
+ * \brief Check if the caller runs in the pipeline handler thread
+ *
+ * The pipeline handler thread is the thread of the camera manager when the
+ * pipeline handler doesn't run in its own thread.
+ *
+ * \return True if the caller runs in the pipeline handler thread, false
+ * otherwise
+ */
+bool PipelineHandler::isCurrentThread() const
+{
+	if (thread_)
+		return Thread::current() == thread_;
+
+	return !invoker_ || Thread::current() == invoker_->thread();
+}
+
+/**
+ * \brief Call a function asynchronously in the pipeline handler thread
+ * \param[in] func The function
+ */
+void PipelineHandler::post(const std::function<void()> &func)
+{
+	if (thread_)
+		thread_->post(func);
+	else
+		invoker_->invokeMethod(&PipelineInvoker::invoke, func);
+}
+
+/**
+ * \brief Queue the requests submitted to the pipeline handler thread
+ * \param[in] camera The camera the requests have been submitted to
+ */
+void PipelineHandler::processSubmittedRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	std::vector<Request *> requests = data->submittedRequests_.takeAll();
+	if (requests.empty())
+		return;
+
+	for (Request *request : requests)
+		applyQos(data, request);
+
+	int ret = queueRequests(camera, requests);
+	if (!ret)
+		return;
+
+	LOG(Pipeline, Error)
+		<< "Failed to queue requests: " << strerror(-ret);
+
+	/* Cancel all the requests that the pipeline handler hasn't accepted. */
+	for (Request *request : requests) {
+		auto it = std::find(data->queuedRequests_.begin(),
+				    data->queuedRequests_.end(), request);
+		if (it == data->queuedRequests_.end())
+			cancelRequest(camera, request);
+	}
+}
+
+/**
+ * \brief Complete a request that couldn't be queued in the cancelled state
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The request
+ *
+ * The \a request shall not be in the list of queued requests. It is added to
+ * the list, all its buffers are cancelled, and it is completed.
+ */
+void PipelineHandler::cancelRequest(Camera *camera, Request *request)
+{
+	CameraData *data = cameraData(camera);
+	pushRequest(data, request);
+
+	for (auto it : request->buffers())
+		cancelBuffer(camera, request, it.second);
+
+	completeRequest(camera, request);
+}
+
+/**
+ * \brief Take back the queued requests to capture them again
+ * \param[in] camera The camera the requests belong to
+ *
+ * Pipeline handlers that recover from a device stall by restarting their
+ * devices call this method once the devices have been stopped, to requeue the
+ * requests that haven't been captured. The requests that have no completed
+ * buffer are removed from the list of queued requests and returned in
+ * submission order, for the pipeline handler to queue them again.
+ *
+ * The requests that have started completing can't be captured again. Their
+ * pending buffers are cancelled and they are completed. To preserve the
+ * completion order, all the requests queued before them are completed in the
+ * cancelled state as well.
+ *
+ * \return The requests to queue again, in submission order
+ */
+std::vector<Request *> PipelineHandler::recoverRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	auto untouched = [](const Request *request) {
+		return request->status() == Request::RequestPending &&
+		       request->pending_ == (1ULL << request->buffers().size()) - 1;
+	};
+
+	auto split = data->queuedRequests_.end();
+	while (split != data->queuedRequests_.begin() &&
+	       untouched(*std::prev(split)))
+		--split;
+
+	std::vector<Request *> requests(split, data->queuedRequests_.end());
+	data->queuedRequests_.erase(split, data->queuedRequests_.end());
+
+	/*
+	 * Completing a request removes it and the completed requests that
+	 * follow it from the list, and deletes them. Gather the requests to
+	 * cancel first.
+	 */
+	std::vector<Request *> cancelled;
+	for (Request *request : data->queuedRequests_) {
+		if (request->status() == Request::RequestPending)
+			cancelled.push_back(request);
+	}
+
+	for (Request *request : cancelled) {
+		const Request::BufferMap &buffers = request->buffers();
+		for (unsigned int i = 0; i < buffers.size(); ++i) {
+			if (request->pending_ & (1U << i))
+				cancelBuffer(camera, request, buffers.begin()[i].second);
+		}
+
+		completeRequest(camera, request);
+	}
+
+	return requests;
+}
+
 /**
  * \brief Retrieve the pipeline-specific data associated with a Camera
  * \param[in] camera The camera whose data to retrieve
@@ -553,15 +1941,52 @@ PipelineHandlerFactory::PipelineHandlerFactory(const char *name)
 /**
  * \brief Create an instance of the PipelineHandler corresponding to the factory
  * \param[in] manager The camera manager
+ * \param[in] threaded Whether to run the pipeline handler in its own thread
+ * \param[in] scheduling The scheduling parameters of the pipeline handler
+ * thread
+ *
+ * When \a threaded is true, a thread is started for the pipeline handler, and
+ * the pipeline handler is destroyed in that thread when the last reference to
+ * it is released. The last reference shall not be released from the pipeline
+ * handler thread itself.
  *
  * \return A shared pointer to a new instance of the PipelineHandler subclass
  * corresponding to the factory
  */
-std::shared_ptr<PipelineHandler> PipelineHandlerFactory::create(CameraManager *manager)
+std::shared_ptr<PipelineHandler> PipelineHandlerFactory::create(CameraManager *manager,
+								bool threaded,
+								const ThreadScheduling &scheduling)
 {
 	PipelineHandler *handler = createInstance(manager);
 	handler->name_ = name_.c_str();
-	return std::shared_ptr<PipelineHandler>(handler);
+
+	if (!threaded) {
+		handler->invoker_.reset(new PipelineInvoker());
+		return std::shared_ptr<PipelineHandler>(handler);
+	}
+
+	handler->thread_ = new PipelineThread();
+	handler->thread_->setScheduling(scheduling);
+	handler->thread_->start();
+
+	return std::shared_ptr<PipelineHandler>(handler, [](PipelineHandler *pipe) {
+		PipelineThread *thread = pipe->thread_;
+		ASSERT(Thread::current() != thread);
+
+		/*
+		 * The event notifiers and timers owned by the pipeline handler
+		 * are bound to its thread, delete it there before stopping the
+		 * thread.
+		 */
+		thread->call([pipe]() {
+			delete pipe;
+			return 0;
+		});
+
+		thread->exit();
+		thread->wait();
+		delete thread;
+	});
 }
 
 /**
@@ -23,6 +23,7 @@
 #include <libcamera/event_notifier.h>
 
 #include "log.h"
+#include "startup_timeline.h"
 #include "utils.h"
 
 /**
@@ -250,6 +251,22 @@ int Process::start(const std::string &path,
 	if (running_)
 		return 0;
 
+	/*
+	 * Prepare everything the child needs before forking, memory allocation
+	 * isn't safe in the child of a multi-threaded process.
+	 */
+	std::vector<int> keep(fds);
+	std::sort(keep.begin(), keep.end());
+
+	std::vector<const char *> argv;
+	argv.reserve(args.size() + 2);
+	argv.push_back(path.c_str());
+	for (const std::string &arg : args)
+		argv.push_back(arg.c_str());
+	argv.push_back(nullptr);
+
+	uint64_t start = StartupTimeline::now();
+
 	int childPid = fork();
 	if (childPid == -1) {
 		ret = -errno;
@@ -261,32 +278,35 @@ int Process::start(const std::string &path,
 
 		running_ = true;
 
+		/* The child doesn't record the phase, it may not allocate. */
+		StartupTimeline::instance()->record("process-start", path, start,
+						    StartupTimeline::now());
+
 		return 0;
 	} else {
 		if (isolate())
 			_exit(EXIT_FAILURE);
 
-		closeAllFdsExcept(fds);
+		closeAllFdsExcept(keep);
 
 		unsetenv("LIBCAMERA_LOG_FILE");
 
-		const char **argv = new const char *[args.size() + 2];
-		unsigned int len = args.size();
-		argv[0] = path.c_str();
-		for (unsigned int i = 0; i < len; i++)
-			argv[i+1] = args[i].c_str();
-		argv[len+1] = nullptr;
-
-		execv(path.c_str(), (char **)argv);
+		execv(path.c_str(), const_cast<char **>(argv.data()));
 
 		exit(EXIT_FAILURE);
 	}
 }
 
+/*
+ * Close all file descriptors except the ones in the sorted fds vector. The
+ * close_range() system call handles the gaps between the kept descriptors in
+ * constant time, while walking /proc/self/fd takes one system call per open
+ * descriptor, which is expensive for processes that hold many dmabufs.
+ */
 void Process::closeAllFdsExcept(const std::vector<int> &fds)
 {
-	std::vector<int> v(fds);
-	sort(v.begin(), v.end());
+	if (!closeRangesExcept(fds))
+		return;
 
 	DIR *dir = opendir("/proc/self/fd");
 	if (!dir)
@@ -302,13 +322,58 @@ void Process::closeAllFdsExcept(const std::vector<int> &fds)
 			continue;
 
 		if (fd >= 0 && fd != dfd &&
-		    !std::binary_search(v.begin(), v.end(), fd))
+		    !std::binary_search(fds.begin(), fds.end(), fd))
 			close(fd);
 	}
 
 	closedir(dir);
 }
 
+int Process::closeRangesExcept(const std::vector<int> &fds)
+{
+#if HAVE_CLOSE_RANGE
+	/*
+	 * Marking the descriptors close-on-exec is cheaper than closing them,
+	 * and has the same effect as the child exec()s right away. Fall back
+	 * to closing them on kernels older than v5.11.
+	 */
+#ifdef CLOSE_RANGE_CLOEXEC
+	unsigned int flags = CLOSE_RANGE_CLOEXEC;
+#else
+	unsigned int flags = 0;
+#endif
+
+	auto closeRange = [&flags](unsigned int first, unsigned int last) {
+		int ret = close_range(first, last, flags);
+		if (ret && errno == EINVAL && flags) {
+			flags = 0;
+			ret = close_range(first, last, flags);
+		}
+
+		return ret ? -errno : 0;
+	};
+
+	unsigned int first = 0;
+	for (int fd : fds) {
+		/* Skip invalid and duplicated descriptors. */
+		if (fd < 0 || static_cast<unsigned int>(fd) < first)
+			continue;
+
+		if (static_cast<unsigned int>(fd) > first) {
+			int ret = closeRange(first, fd - 1);
+			if (ret)
+				return ret;
+		}
+
+		first = fd + 1;
+	}
+
+	return closeRange(first, ~0U);
+#else
+	return -ENOSYS;
+#endif
+}
+
 int Process::isolate()
 {
 	int ret = unshare(CLONE_NEWUSER | CLONE_NEWNET);
@@ -5,17 +5,29 @@
  * ipa_proxy_linux.cpp - Default Image Processing Algorithm proxy for Linux
  */
 
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <vector>
 
 #include <ipa/ipa_interface.h>
 #include <ipa/ipa_module_info.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
 #include "ipa_proxy.h"
+#include "ipc_ring.h"
 #include "ipc_unixsocket.h"
 #include "log.h"
 #include "process.h"
+#include "tracepoints.h"
 
 #include "ipa_proxy_linux_protocol.h"
 
@@ -31,32 +43,230 @@ public:
 	Proxy(IPAModule *ipam);
 	~Proxy();
 
-	int init() override { return 0; }
+	int init() override;
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
-		       const std::map<unsigned int, ControlInfoMap> &entityControls) override {}
-	void mapBuffers(const std::vector<IPABuffer> &buffers) override {}
-	void unmapBuffers(const std::vector<unsigned int> &ids) override {}
-	void processEvent(const IPAOperationData &event) override {}
+		       const std::map<unsigned int, ControlInfoMap> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+
+	static void prestart(unsigned int count);
 
 private:
-	int sendMessage(const Message &msg);
-	void readyRead(IPCUnixSocket *ipc);
+	ByteStreamBuffer prepareMessage(enum MessageType type, size_t size);
+	int sendMessage(const ByteStreamBuffer &buffer);
+	int sendFds(enum MessageType type, const std::vector<int32_t> &fds,
+		    const std::string &data = std::string());
+	uint64_t sendBlob(const std::map<unsigned int, ControlInfoMap> &entityControls,
+			  size_t size);
+	void readyRead(IPCRing *ring);
+	void processMessage(const uint8_t *data, size_t size);
+	void workerFinished(Process *proc, enum Process::ExitStatus exitStatus,
+			    int exitCode);
 
 	Process *proc_;
 
 	IPCUnixSocket *socket_;
+	IPCRing toWorker_;
+	IPCRing fromWorker_;
+	IPADataSerializer serializer_;
+	std::deque<uint64_t> blobs_;
+};
+
+/*
+ * Size of each ring. Messages are limited to half of the ring size, which
+ * leaves plenty of room for the IPA configuration.
+ */
+static constexpr size_t RingSize = 256 * 1024;
+
+/*
+ * Configuration payloads larger than the threshold are sent as blobs. The
+ * worker keeps the most recent blobs mapped, to cover the few configurations
+ * an application typically switches between.
+ */
+static constexpr size_t BlobThreshold = 4096;
+static constexpr unsigned int MaxBlobs = 4;
+
+namespace {
+
+/*
+ * Pool of worker processes started in advance. Forking the worker, executing
+ * it and initializing the libcamera logging in the child are thus kept out of
+ * the proxy creation, the worker loads the IPA module only when the proxy sets
+ * it up. The pool is refilled when a worker is taken from it, and workers that
+ * died while waiting are discarded.
+ */
+class WorkerPool
+{
+public:
+	struct Worker {
+		Process *proc;
+		int socket;
+	};
+
+	~WorkerPool();
+
+	void prestart(const std::string &path, unsigned int count);
+	Worker take(const std::string &path);
+
+private:
+	static Worker spawn(const std::string &path);
+
+	std::mutex mutex_;
+	std::deque<Worker> spares_;
+	unsigned int count_ = 0;
 };
 
+WorkerPool::~WorkerPool()
+{
+	for (Worker &worker : spares_) {
+		delete worker.proc;
+		::close(worker.socket);
+	}
+}
+
+void WorkerPool::prestart(const std::string &path, unsigned int count)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	count_ = count;
+
+	while (spares_.size() < count_) {
+		Worker worker = spawn(path);
+		if (!worker.proc)
+			break;
+
+		spares_.push_back(worker);
+	}
+
+	LOG(IPAProxy, Debug) << spares_.size() << " proxy workers started";
+}
+
+WorkerPool::Worker WorkerPool::take(const std::string &path)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	while (!spares_.empty()) {
+		Worker worker = spares_.front();
+		spares_.pop_front();
+
+		if (worker.proc->exitStatus() != Process::NotExited) {
+			LOG(IPAProxy, Warning) << "Discarding dead proxy worker";
+			delete worker.proc;
+			::close(worker.socket);
+			continue;
+		}
+
+		Worker spare = spawn(path);
+		if (spare.proc)
+			spares_.push_back(spare);
+
+		return worker;
+	}
+
+	return spawn(path);
+}
+
+WorkerPool::Worker WorkerPool::spawn(const std::string &path)
+{
+	Worker worker = { nullptr, -1 };
+
+	int sockets[2];
+	int ret = socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sockets);
+	if (ret) {
+		LOG(IPAProxy, Error)
+			<< "Failed to create socket: " << strerror(errno);
+		return worker;
+	}
+
+	Process *proc = new Process();
+	ret = proc->start(path, { std::to_string(sockets[1]) }, { sockets[1] });
+	::close(sockets[1]);
+	if (ret) {
+		LOG(IPAProxy, Error)
+			<< "Failed to start proxy worker process";
+		delete proc;
+		::close(sockets[0]);
+		return worker;
+	}
+
+	worker.proc = proc;
+	worker.socket = sockets[0];
+
+	return worker;
+}
+
+WorkerPool pool;
+
+/* 64-bit FNV-1a hash, never zero as zero identifies inline data. */
+uint64_t hashBlob(const std::vector<uint8_t> &data)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (uint8_t byte : data) {
+		hash ^= byte;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash ? hash : 1;
+}
+
+/*
+ * Store the data in a memfd sealed against any modification, the worker can
+ * then map it without fearing it to change under its feet.
+ */
+int createSealedMemfd(const std::vector<uint8_t> &data)
+{
+	int fd = memfd_create("libcamera-ipa-blob",
+			      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(IPAProxy, Error)
+			<< "Failed to create blob: " << strerror(-ret);
+		return ret;
+	}
+
+	const uint8_t *ptr = data.data();
+	size_t remaining = data.size();
+
+	while (remaining) {
+		ssize_t written = ::write(fd, ptr, remaining);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			int ret = -errno;
+			LOG(IPAProxy, Error)
+				<< "Failed to write blob: " << strerror(-ret);
+			::close(fd);
+			return ret;
+		}
+
+		ptr += written;
+		remaining -= written;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				   F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		int ret = -errno;
+		LOG(IPAProxy, Error)
+			<< "Failed to seal blob: " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+} /* namespace */
+
 Proxy::Proxy(IPAModule *ipam)
 	: proc_(nullptr), socket_(nullptr)
 {
 	LOG(IPAProxy, Debug)
-		<< "initializing dummy proxy: loading IPA from "
+		<< "initializing proxy: loading IPA from "
 		<< ipam->path();
 
-	std::vector<int> fds;
-	std::vector<std::string> args;
-	args.push_back(ipam->path());
 	const std::string path = resolvePath("ipa_proxy_linux");
 	if (path.empty()) {
 		LOG(IPAProxy, Error)
@@ -64,50 +274,297 @@ Proxy::Proxy(IPAModule *ipam)
 		return;
 	}
 
-	socket_ = new IPCUnixSocket();
-	int fd = socket_->create();
-	if (fd < 0) {
-		LOG(IPAProxy, Error)
-			<< "Failed to create socket";
+	WorkerPool::Worker worker = pool.take(path);
+	if (!worker.proc)
 		return;
-	}
-	socket_->readyRead.connect(this, &Proxy::readyRead);
-	args.push_back(std::to_string(fd));
-	fds.push_back(fd);
 
-	proc_ = new Process();
-	int ret = proc_->start(path, args, fds);
-	if (ret) {
-		LOG(IPAProxy, Error)
-			<< "Failed to start proxy worker process";
+	proc_ = worker.proc;
+	proc_->finished.connect(this, &Proxy::workerFinished);
+
+	socket_ = new IPCUnixSocket();
+	socket_->bind(worker.socket);
+
+	/* Hand the rings and the IPA module over to the worker. */
+	if (toWorker_.create(IPCRing::Producer, RingSize) ||
+	    fromWorker_.create(IPCRing::Consumer, RingSize)) {
+		LOG(IPAProxy, Error) << "Failed to create IPC rings";
 		return;
 	}
 
+	fromWorker_.readyRead.connect(this, &Proxy::readyRead);
+
 	valid_ = true;
+
+	int ret = sendFds(MessageSetup, { toWorker_.memfd(), toWorker_.eventfd(),
+					  fromWorker_.memfd(), fromWorker_.eventfd() },
+			  ipam->path());
+	if (ret)
+		valid_ = false;
 }
 
 Proxy::~Proxy()
 {
+	/* Let the worker release the IPA before it gets killed. */
+	if (valid_) {
+		ByteStreamBuffer buffer = prepareMessage(MessageDestroy, 0);
+		sendMessage(buffer);
+	}
+
 	delete proc_;
 	delete socket_;
 }
 
-int Proxy::sendMessage(const Message &msg)
+int Proxy::init()
 {
-	struct IPCUnixSocket::Payload payload;
+	ByteStreamBuffer buffer = prepareMessage(MessageInit, 0);
 
-	payload.data.resize(sizeof(msg));
+	return sendMessage(buffer);
+}
+
+void Proxy::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		      const std::map<unsigned int, ControlInfoMap> &entityControls)
+{
+	size_t controlsSize = IPADataSerializer::binarySize(entityControls);
+	uint64_t blob = 0;
+
+	if (controlsSize >= BlobThreshold)
+		blob = sendBlob(entityControls, controlsSize);
+
+	size_t size = sizeof(blob) + IPADataSerializer::binarySize(streamConfig);
+	if (!blob)
+		size += controlsSize;
+
+	ByteStreamBuffer buffer = prepareMessage(MessageConfigure, size);
+
+	buffer.write(&blob);
+	serializer_.serialize(streamConfig, buffer);
+	if (!blob)
+		serializer_.serialize(entityControls, buffer);
+
+	sendMessage(buffer);
+}
+
+void Proxy::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	size_t size = IPADataSerializer::binarySize(buffers);
+
+	ByteStreamBuffer buffer = prepareMessage(MessageMapBuffers, size);
+
+	std::vector<int32_t> fds;
+	serializer_.serialize(buffers, buffer, &fds);
+
+	/* The file descriptors must reach the worker before the message. */
+	if (sendFds(MessageMapBuffers, fds))
+		return;
+
+	sendMessage(buffer);
+}
+
+void Proxy::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	size_t size = IPADataSerializer::binarySize(ids);
+
+	ByteStreamBuffer buffer = prepareMessage(MessageUnmapBuffers, size);
+
+	serializer_.serialize(ids, buffer);
+
+	sendMessage(buffer);
+}
+
+void Proxy::processEvent(const IPAOperationData &event)
+{
+	LIBCAMERA_TRACEPOINT(ipa_process_event, "operation=%u", event.operation);
+
+	size_t size = IPADataSerializer::binarySize(event);
+
+	ByteStreamBuffer buffer = prepareMessage(MessageProcessEvent, size);
+
+	serializer_.serialize(event, buffer);
+
+	sendMessage(buffer);
+}
+
+ByteStreamBuffer Proxy::prepareMessage(enum MessageType type, size_t size)
+{
+	/*
+	 * Serialize the message in place in the ring. If no space can be
+	 * reserved, the empty buffer overflows and sendMessage() fails.
+	 */
+	size += sizeof(Message);
+
+	uint8_t *data = valid_ ? toWorker_.reserve(size) : nullptr;
+	if (!data) {
+		if (valid_)
+			LOG(IPAProxy, Error) << "Failed to reserve message " << type;
+		size = 0;
+	}
+
+	ByteStreamBuffer buffer(data, size);
+
+	Message msg = { type };
+	buffer.write(&msg);
+
+	return buffer;
+}
+
+int Proxy::sendMessage(const ByteStreamBuffer &buffer)
+{
+	if (!valid_)
+		return -ENOTCONN;
+
+	if (buffer.overflow() || buffer.offset() != buffer.size()) {
+		LOG(IPAProxy, Error) << "Failed to serialize message";
+		return -EINVAL;
+	}
+
+	return toWorker_.commit();
+}
+
+int Proxy::sendFds(enum MessageType type, const std::vector<int32_t> &fds,
+		   const std::string &data)
+{
+	if (!valid_)
+		return -ENOTCONN;
+
+	IPCUnixSocket::Payload payload;
+	payload.data.resize(sizeof(Message) + data.size());
+	payload.fds = fds;
+
+	Message msg = { type };
 	memcpy(payload.data.data(), &msg, sizeof(msg));
+	memcpy(payload.data.data() + sizeof(msg), data.data(), data.size());
+
+	int ret = socket_->send(payload);
+	if (ret)
+		LOG(IPAProxy, Error) << "Failed to send file descriptors: " << ret;
+
+	return ret;
+}
+
+/*
+ * Serialize the entity controls and make them available to the worker as a
+ * blob, sending it only if the worker doesn't hold a blob with the same
+ * contents already. Return the blob key, or 0 if the controls shall be sent
+ * inline.
+ */
+uint64_t Proxy::sendBlob(const std::map<unsigned int, ControlInfoMap> &entityControls,
+			 size_t size)
+{
+	std::vector<uint8_t> data(size);
+	ByteStreamBuffer buffer(data.data(), data.size());
+	if (serializer_.serialize(entityControls, buffer))
+		return 0;
+
+	uint64_t key = hashBlob(data);
+
+	auto iter = std::find(blobs_.begin(), blobs_.end(), key);
+	if (iter != blobs_.end()) {
+		blobs_.erase(iter);
+		blobs_.push_back(key);
+		return key;
+	}
+
+	int fd = createSealedMemfd(data);
+	if (fd < 0)
+		return 0;
+
+	std::string payload(reinterpret_cast<const char *>(&key), sizeof(key));
+	int ret = sendFds(MessageBlob, { fd }, payload);
+	::close(fd);
+	if (ret)
+		return 0;
+
+	blobs_.push_back(key);
+
+	/* Release the least recently used blob. */
+	if (blobs_.size() > MaxBlobs) {
+		uint64_t release = blobs_.front();
+		blobs_.pop_front();
+
+		ByteStreamBuffer message = prepareMessage(MessageReleaseBlob,
+							  sizeof(release));
+		message.write(&release);
+		sendMessage(message);
+	}
+
+	return key;
+}
+
+void Proxy::readyRead(IPCRing *ring)
+{
+	const uint8_t *data;
+	size_t size;
+
+	while ((data = ring->front(&size))) {
+		processMessage(data, size);
+		ring->pop();
+	}
+}
+
+void Proxy::processMessage(const uint8_t *data, size_t size)
+{
+	ByteStreamBuffer buffer(data, size);
+
+	Message msg;
+	if (buffer.read(&msg)) {
+		LOG(IPAProxy, Error) << "Received message too short";
+		return;
+	}
 
-	return socket_->send(payload);
+	switch (msg.type) {
+	case MessageQueueFrameAction: {
+		uint32_t frame;
+		IPAOperationData action;
+
+		if (buffer.read(&frame) ||
+		    serializer_.deserialize(buffer, &action)) {
+			LOG(IPAProxy, Error) << "Invalid frame action message";
+			return;
+		}
+
+		LIBCAMERA_TRACEPOINT(ipa_queue_frame_action,
+				     "frame=%u operation=%u", frame,
+				     action.operation);
+
+		queueFrameAction.emit(frame, std::move(action));
+		break;
+	}
+
+	default:
+		LOG(IPAProxy, Error) << "Unknown message type " << msg.type;
+		break;
+	}
 }
 
-void Proxy::readyRead(IPCUnixSocket *ipc)
+void Proxy::prestart(unsigned int count)
 {
+	const std::string path = resolvePath("ipa_proxy_linux");
+	if (path.empty()) {
+		LOG(IPAProxy, Error)
+			<< "Failed to get proxy worker path";
+		return;
+	}
+
+	pool.prestart(path, count);
 }
 
-REGISTER_IPA_PROXY(Proxy)
+void Proxy::workerFinished(Process *proc, enum Process::ExitStatus exitStatus,
+			   int exitCode)
+{
+	/*
+	 * The IPA state is lost with the worker, further calls would be
+	 * silently dropped.
+	 */
+	LOG(IPAProxy, Error)
+		<< "Proxy worker "
+		<< (exitStatus == Process::SignalExit ? "killed" : "exited")
+		<< " unexpectedly (" << exitCode << ")";
+
+	valid_ = false;
+}
 
 } /* namespace IPAProxyLinux */
 
+REGISTER_IPA_PROXY(IPAProxyLinux::Proxy, IPAProxyLinux)
+
 } /* namespace libcamera */
@@ -11,8 +11,51 @@ namespace libcamera {
 
 namespace IPAProxyLinux {
 
+/*
+ * Messages are exchanged through a pair of IPCRing, one for each direction.
+ * Each message starts with a Message header, followed by the arguments of the
+ * corresponding IPAInterface operation serialized with the IPADataSerializer,
+ * in the order they appear in the method prototype:
+ *
+ * - MessageInit: no argument
+ * - MessageConfigure: blob key (uint64_t), stream configuration, entity
+ *   controls. When the key isn't zero the entity controls are omitted, they are
+ *   read from the blob with that key instead
+ * - MessageMapBuffers: IPA buffers
+ * - MessageUnmapBuffers: buffer IDs
+ * - MessageProcessEvent: IPA operation data
+ * - MessageQueueFrameAction: frame number (uint32_t), IPA operation data
+ * - MessageReleaseBlob: blob key (uint64_t)
+ *
+ * The IPCUnixSocket is only used to pass file descriptors, in messages that
+ * contain a Message header only, with the exception of MessageSetup:
+ *
+ * - MessageSetup: memfd and eventfd of the proxy to worker ring, followed by the
+ *   memfd and eventfd of the worker to proxy ring, sent once at startup. The
+ *   header is followed by the path of the IPA module to load, without a
+ *   terminating null character
+ * - MessageMapBuffers: dmabufs of the planes of the buffers, sent before the
+ *   corresponding ring message
+ * - MessageBlob: sealed memfd storing serialized configuration data, followed
+ *   by the blob key (uint64_t), sent before the first ring message that
+ *   refers to it
+ *
+ * Blobs carry the configuration payloads too large to be copied through the
+ * ring at every configure() call. The key is a hash of the blob contents, the
+ * worker maps each blob read-only once and keeps it until the proxy releases
+ * it, a reconfiguration with identical data only sends the key.
+ */
 enum MessageType {
 	MessageDestroy,
+	MessageInit,
+	MessageConfigure,
+	MessageMapBuffers,
+	MessageUnmapBuffers,
+	MessageProcessEvent,
+	MessageQueueFrameAction,
+	MessageSetup,
+	MessageBlob,
+	MessageReleaseBlob,
 };
 
 struct Message {
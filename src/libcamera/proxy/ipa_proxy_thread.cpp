@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_proxy_thread.cpp - Proxy running an Image Processing Algorithm in a thread
+ */
+
+#include <errno.h>
+#include <memory>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/ipa_module_info.h>
+#include <libcamera/object.h>
+
+#include "ipa_context_wrapper.h"
+#include "ipa_manager.h"
+#include "ipa_module.h"
+#include "ipa_proxy.h"
+#include "log.h"
+#include "thread.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAProxy)
+
+namespace IPAProxyThread {
+
+/*
+ * The IPA is called from its own thread, to keep the time spent in the
+ * algorithms out of the pipeline handler thread that handles the V4L2 buffers
+ * of all cameras. Calls are delivered asynchronously in order through
+ * Object::invokeMethod(), and frame actions are sent back the same way to the
+ * thread the proxy has been created in.
+ */
+class Proxy : public IPAProxy, public Object
+{
+public:
+	Proxy(IPAModule *ipam);
+	~Proxy();
+
+	int init() override;
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, ControlInfoMap> &entityControls) override;
+	void configure(std::map<unsigned int, IPAStream> &&streamConfig,
+		       std::map<unsigned int, ControlInfoMap> &&entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+	void processEvent(IPAOperationData &&event) override;
+
+private:
+	/*
+	 * The arguments are taken by value, as they are stored in the message
+	 * posted to the IPA thread. They're moved to the IPA, which is their
+	 * last user.
+	 */
+	class ThreadProxy : public Object
+	{
+	public:
+		void setIPA(IPAInterface *ipa) { ipa_ = ipa; }
+
+		void configure(std::map<unsigned int, IPAStream> streamConfig,
+			       std::map<unsigned int, ControlInfoMap> entityControls)
+		{
+			ipa_->configure(std::move(streamConfig), std::move(entityControls));
+		}
+
+		void mapBuffers(std::vector<IPABuffer> buffers)
+		{
+			ipa_->mapBuffers(buffers);
+		}
+
+		void unmapBuffers(std::vector<unsigned int> ids)
+		{
+			ipa_->unmapBuffers(ids);
+		}
+
+		void processEvent(IPAOperationData event)
+		{
+			ipa_->processEvent(std::move(event));
+		}
+
+	private:
+		IPAInterface *ipa_;
+	};
+
+	void queueFrameActionThread(unsigned int frame,
+				    IPAOperationData &&action);
+
+	std::unique_ptr<IPAInterface> ipa_;
+
+	Thread thread_;
+	ThreadProxy proxy_;
+};
+
+Proxy::Proxy(IPAModule *ipam)
+{
+	if (!ipam->load())
+		return;
+
+	struct ipa_context *ctx = ipam->createContext();
+	if (!ctx) {
+		LOG(IPAProxy, Error)
+			<< "Failed to create IPA context for " << ipam->path();
+		return;
+	}
+
+	ipa_ = utils::make_unique<IPAContextWrapper>(ctx);
+
+	/*
+	 * The frame actions are emitted from the IPA thread, and delivered to
+	 * the thread of the proxy as the proxy is an Object.
+	 */
+	ipa_->queueFrameAction.connect(this, &Proxy::queueFrameActionThread);
+
+	proxy_.setIPA(ipa_.get());
+	proxy_.moveToThread(&thread_);
+
+	valid_ = true;
+}
+
+Proxy::~Proxy()
+{
+	/*
+	 * Stop the thread before destroying the IPA. Calls still pending are
+	 * dropped along with the proxy_ messages.
+	 */
+	thread_.exit();
+	thread_.wait();
+}
+
+int Proxy::init()
+{
+	/*
+	 * Initialize the IPA synchronously to report the result to the caller,
+	 * the thread isn't running yet and can't race with this call.
+	 */
+	if (thread_.isRunning())
+		return -EBUSY;
+
+	int ret = ipa_->init();
+	if (ret)
+		return ret;
+
+	thread_.setScheduling(IPAManager::instance()->threadScheduling());
+	thread_.start();
+
+	return 0;
+}
+
+void Proxy::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		      const std::map<unsigned int, ControlInfoMap> &entityControls)
+{
+	proxy_.invokeMethod(&ThreadProxy::configure, streamConfig, entityControls);
+}
+
+void Proxy::configure(std::map<unsigned int, IPAStream> &&streamConfig,
+		      std::map<unsigned int, ControlInfoMap> &&entityControls)
+{
+	proxy_.invokeMethod(&ThreadProxy::configure, std::move(streamConfig),
+			    std::move(entityControls));
+}
+
+void Proxy::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	proxy_.invokeMethod(&ThreadProxy::mapBuffers, buffers);
+}
+
+void Proxy::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	proxy_.invokeMethod(&ThreadProxy::unmapBuffers, ids);
+}
+
+void Proxy::processEvent(const IPAOperationData &event)
+{
+	proxy_.invokeMethod(&ThreadProxy::processEvent, event);
+}
+
+void Proxy::processEvent(IPAOperationData &&event)
+{
+	proxy_.invokeMethod(&ThreadProxy::processEvent, std::move(event));
+}
+
+void Proxy::queueFrameActionThread(unsigned int frame,
+				   IPAOperationData &&action)
+{
+	queueFrameAction.emit(frame, std::move(action));
+}
+
+} /* namespace IPAProxyThread */
+
+REGISTER_IPA_PROXY(IPAProxyThread::Proxy, IPAProxyThread)
+
+} /* namespace libcamera */
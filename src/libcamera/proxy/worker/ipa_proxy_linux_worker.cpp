@@ -5,7 +5,15 @@
  * ipa_proxy_linux_worker.cpp - Default Image Processing Algorithm proxy worker for Linux
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <iostream>
+#include <map>
+#include <queue>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -14,7 +22,11 @@
 #include <libcamera/logging.h>
 #include <libcamera/object.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_context_wrapper.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
+#include "ipc_ring.h"
 #include "ipc_unixsocket.h"
 #include "log.h"
 #include "thread.h"
@@ -32,35 +44,45 @@ namespace IPAProxyLinux {
 class Worker : public Object
 {
 public:
-	Worker(const char *module, int socket);
+	Worker(int socket);
 	~Worker();
 
-	bool isValid() { return context_ != nullptr; }
+	bool isValid() { return socket_.isBound(); }
 
 	int exec();
 
 private:
+	struct Blob {
+		void *data;
+		size_t size;
+	};
+
 	void readyRead(IPCUnixSocket *ipc);
+	void ringReady(IPCRing *ring);
+	void processMessages();
+	int setup(const IPCUnixSocket::Payload &payload);
+	int mapBlob(const IPCUnixSocket::Payload &payload);
+	void releaseBlob(uint64_t key);
+	int loadModule(const std::string &path);
+	int dispatch(enum MessageType type, ByteStreamBuffer &buffer,
+		     const std::vector<int32_t> &fds);
+	void queueFrameAction(unsigned int frame, IPAOperationData &&data);
 
 	EventLoop loop_;
 	IPCUnixSocket socket_;
+	IPCRing fromProxy_;
+	IPCRing toProxy_;
+	std::queue<std::vector<int32_t>> pendingFds_;
+	std::map<uint64_t, Blob> blobs_;
 	std::unique_ptr<IPAModule> module_;
-	struct ipa_context *context_;
+	std::unique_ptr<IPAInterface> ipa_;
+	IPADataSerializer serializer_;
 };
 
-Worker::Worker(const char *module, int socket)
-	: context_(nullptr)
+Worker::Worker(int socket)
 {
 	LOG(IPAProxyLinuxWorker, Debug)
-		<< "Starting worker for IPA module '" << module
-		<< "' with IPC socket " << socket;
-
-	module_ = utils::make_unique<IPAModule>(module);
-	if (!module_->isValid() || !module_->load()) {
-		LOG(IPAProxyLinuxWorker, Error)
-			<< "IPAModule " << module << " should be valid but isn't";
-		return;
-	}
+		<< "Starting worker with IPC socket " << socket;
 
 	socket_.readyRead.connect(this, &Worker::readyRead);
 	if (socket_.bind(socket) < 0) {
@@ -68,19 +90,15 @@ Worker::Worker(const char *module, int socket)
 		return;
 	}
 
-	context_ = module_->createContext();
-	if (!context_) {
-		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
-		return;
-	}
-
 	LOG(IPAProxyLinuxWorker, Debug) << "Proxy worker successfully started";
 }
 
 Worker::~Worker()
 {
-	if (context_)
-		context_->ops->destroy(context_);
+	for (const auto &blob : blobs_) {
+		if (blob.second.data)
+			munmap(blob.second.data, blob.second.size);
+	}
 }
 
 int Worker::exec()
@@ -100,23 +118,343 @@ void Worker::readyRead(IPCUnixSocket *ipc)
 		return;
 	}
 
-	Message *msg;
-	if (payload.data.size() < sizeof(*msg)) {
+	const uint8_t *data = payload.data.data();
+	ByteStreamBuffer buffer(data, payload.data.size());
+
+	Message msg;
+	if (buffer.read(&msg)) {
 		LOG(IPAProxyLinuxWorker, Error)
 			<< "Received message too short";
 		return;
 	}
 
-	msg = reinterpret_cast<Message *>(payload.data.data());
-	switch (msg->type) {
-	case MessageDestroy:
+	switch (msg.type) {
+	case MessageSetup:
+		ret = setup(payload);
+		if (ret) {
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "Failed to set up worker: " << ret;
+			loop_.exit(EXIT_FAILURE);
+			return;
+		}
+		break;
+
+	case MessageMapBuffers:
+		/* The file descriptors are consumed by the ring message. */
+		pendingFds_.push(std::move(payload.fds));
+		break;
+
+	case MessageBlob:
+		ret = mapBlob(payload);
+		if (ret)
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "Failed to map blob: " << ret;
 		break;
 
 	default:
 		LOG(IPAProxyLinuxWorker, Error)
-			<< "Unknown message type " << msg->type;
+			<< "Invalid socket message of type " << msg.type;
+		for (int32_t fd : payload.fds)
+			close(fd);
+		return;
+	}
+
+	processMessages();
+}
+
+int Worker::setup(const IPCUnixSocket::Payload &payload)
+{
+	const std::vector<int32_t> &fds = payload.fds;
+
+	if (ipa_ || fds.size() != 4) {
+		for (int32_t fd : fds)
+			close(fd);
+		return -EINVAL;
+	}
+
+	int ret = fromProxy_.bind(IPCRing::Consumer, fds[0], fds[1]);
+	if (ret) {
+		close(fds[2]);
+		close(fds[3]);
+		return ret;
+	}
+
+	fromProxy_.readyRead.connect(this, &Worker::ringReady);
+
+	ret = toProxy_.bind(IPCRing::Producer, fds[2], fds[3]);
+	if (ret)
+		return ret;
+
+	/* The IPA module path follows the message header. */
+	const char *path = reinterpret_cast<const char *>(payload.data.data())
+			 + sizeof(Message);
+	return loadModule(std::string(path, payload.data.size() - sizeof(Message)));
+}
+
+int Worker::mapBlob(const IPCUnixSocket::Payload &payload)
+{
+	const std::vector<int32_t> &fds = payload.fds;
+	uint64_t key;
+
+	if (fds.size() != 1 || payload.data.size() != sizeof(Message) + sizeof(key)) {
+		for (int32_t fd : fds)
+			close(fd);
+		return -EINVAL;
+	}
+
+	memcpy(&key, payload.data.data() + sizeof(Message), sizeof(key));
+
+	/*
+	 * Register the blob even if it can't be mapped, the messages that refer
+	 * to it would otherwise wait for it forever.
+	 */
+	Blob &blob = blobs_[key];
+	if (blob.data)
+		munmap(blob.data, blob.size);
+	blob = { nullptr, 0 };
+
+	/* Only trust blobs that the proxy can't modify anymore. */
+	const int required = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+	int seals = fcntl(fds[0], F_GET_SEALS);
+	if (seals < 0 || (seals & required) != required) {
+		close(fds[0]);
+		return -EPERM;
+	}
+
+	struct stat st;
+	if (fstat(fds[0], &st) < 0 || !st.st_size) {
+		close(fds[0]);
+		return -EINVAL;
+	}
+
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fds[0], 0);
+	close(fds[0]);
+	if (data == MAP_FAILED)
+		return -errno;
+
+	blob = { data, static_cast<size_t>(st.st_size) };
+
+	return 0;
+}
+
+void Worker::releaseBlob(uint64_t key)
+{
+	auto iter = blobs_.find(key);
+	if (iter == blobs_.end())
+		return;
+
+	if (iter->second.data)
+		munmap(iter->second.data, iter->second.size);
+	blobs_.erase(iter);
+}
+
+int Worker::loadModule(const std::string &path)
+{
+	LOG(IPAProxyLinuxWorker, Debug) << "Loading IPA module '" << path << "'";
+
+	module_ = utils::make_unique<IPAModule>(path);
+	if (!module_->isValid() || !module_->load()) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "IPAModule " << path << " should be valid but isn't";
+		return -EINVAL;
+	}
+
+	struct ipa_context *context = module_->createContext();
+	if (!context) {
+		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
+		return -EINVAL;
+	}
+
+	/* The wrapper takes ownership of the context. */
+	ipa_ = utils::make_unique<IPAContextWrapper>(context);
+	ipa_->queueFrameAction.connect(this, &Worker::queueFrameAction);
+
+	return 0;
+}
+
+void Worker::ringReady(IPCRing *ring)
+{
+	processMessages();
+}
+
+void Worker::processMessages()
+{
+	const uint8_t *data;
+	size_t size;
+
+	while ((data = fromProxy_.front(&size))) {
+		ByteStreamBuffer buffer(data, size);
+
+		Message msg;
+		if (buffer.read(&msg)) {
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "Received message too short";
+			fromProxy_.pop();
+			continue;
+		}
+
+		/*
+		 * The file descriptors are sent through the socket before the
+		 * ring message, but notifications may be processed in any
+		 * order. Wait for them if they haven't been received yet,
+		 * processing will resume from readyRead().
+		 */
+		std::vector<int32_t> fds;
+		if (msg.type == MessageMapBuffers) {
+			if (pendingFds_.empty())
+				return;
+
+			fds = std::move(pendingFds_.front());
+			pendingFds_.pop();
+		}
+
+		/* Likewise for the blob that a configuration refers to. */
+		if (msg.type == MessageConfigure) {
+			uint64_t key = 0;
+			if (size >= sizeof(Message) + sizeof(key))
+				memcpy(&key, data + sizeof(Message), sizeof(key));
+
+			if (key && !blobs_.count(key))
+				return;
+		}
+
+		int ret = dispatch(msg.type, buffer, fds);
+		if (ret)
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "Invalid message of type " << msg.type << ": " << ret;
+
+		/* The buffer planes duplicate the file descriptors they use. */
+		for (int32_t fd : fds)
+			close(fd);
+
+		fromProxy_.pop();
+	}
+}
+
+int Worker::dispatch(enum MessageType type, ByteStreamBuffer &buffer,
+		     const std::vector<int32_t> &fds)
+{
+	int ret;
+
+	switch (type) {
+	case MessageDestroy:
+		loop_.exit(0);
+		break;
+
+	case MessageInit:
+		ipa_->init();
+		break;
+
+	case MessageConfigure: {
+		std::map<unsigned int, IPAStream> streamConfig;
+		std::map<unsigned int, ControlInfoMap> entityControls;
+		uint64_t key;
+
+		ret = buffer.read(&key);
+		if (!ret)
+			ret = serializer_.deserialize(buffer, &streamConfig);
+		if (ret)
+			return ret;
+
+		if (key) {
+			auto iter = blobs_.find(key);
+			if (iter == blobs_.end() || !iter->second.data)
+				return -ENOENT;
+
+			const Blob &blob = iter->second;
+			ByteStreamBuffer controls(static_cast<const uint8_t *>(blob.data),
+						  blob.size);
+			ret = serializer_.deserialize(controls, &entityControls);
+		} else {
+			ret = serializer_.deserialize(buffer, &entityControls);
+		}
+		if (ret)
+			return ret;
+
+		ipa_->configure(std::move(streamConfig), std::move(entityControls));
+		break;
+	}
+
+	case MessageReleaseBlob: {
+		uint64_t key;
+
+		ret = buffer.read(&key);
+		if (ret)
+			return ret;
+
+		releaseBlob(key);
+		break;
+	}
+
+	case MessageMapBuffers: {
+		std::vector<IPABuffer> buffers;
+
+		ret = serializer_.deserialize(buffer, fds, &buffers);
+		if (ret)
+			return ret;
+
+		ipa_->mapBuffers(buffers);
+		break;
+	}
+
+	case MessageUnmapBuffers: {
+		std::vector<unsigned int> ids;
+
+		ret = serializer_.deserialize(buffer, &ids);
+		if (ret)
+			return ret;
+
+		ipa_->unmapBuffers(ids);
 		break;
 	}
+
+	case MessageProcessEvent: {
+		IPAOperationData event;
+
+		ret = serializer_.deserialize(buffer, &event);
+		if (ret)
+			return ret;
+
+		ipa_->processEvent(std::move(event));
+		break;
+	}
+
+	default:
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Unknown message type " << type;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void Worker::queueFrameAction(unsigned int frame, IPAOperationData &&data)
+{
+	size_t size = sizeof(Message) + sizeof(uint32_t)
+		    + IPADataSerializer::binarySize(data);
+
+	uint8_t *mem = toProxy_.reserve(size);
+	if (!mem) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Failed to reserve frame action message";
+		return;
+	}
+
+	ByteStreamBuffer buffer(mem, size);
+
+	Message msg = { MessageQueueFrameAction };
+	uint32_t frameNumber = frame;
+	buffer.write(&msg);
+	buffer.write(&frameNumber);
+
+	int ret = serializer_.serialize(data, buffer);
+	if (ret) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Failed to serialize frame action: " << ret;
+		return;
+	}
+
+	toProxy_.commit();
 }
 
 } /* namespace IPAProxyLinux */
@@ -134,15 +472,15 @@ int main(int argc, char **argv)
 	logSetFile(logPath.c_str());
 #endif
 
-	if (argc < 3) {
+	if (argc < 2) {
 		LOG(IPAProxyLinuxWorker, Debug)
 			<< "Tried to start worker with no args";
 		return EXIT_FAILURE;
 	}
 
-	int fd = std::stoi(argv[2]);
+	int fd = std::stoi(argv[1]);
 
-	IPAProxyLinux::Worker worker(argv[1], fd);
+	IPAProxyLinux::Worker worker(fd);
 	if (!worker.isValid())
 		return EXIT_FAILURE;
 
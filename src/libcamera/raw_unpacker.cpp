@@ -0,0 +1,687 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_unpacker.cpp - Unpacking of packed raw formats
+ */
+
+#include <libcamera/raw_unpacker.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file raw_unpacker.h
+ * \brief Unpacking of raw frames to 16-bit samples
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(RawUnpacker)
+
+namespace {
+
+enum Packing {
+	Unpacked8,
+	Unpacked16,
+	Csi2Packed,
+	Ipu3Packed,
+};
+
+struct FormatInfo {
+	unsigned int fourcc;
+	unsigned int bitsPerSample;
+	Packing packing;
+};
+
+const FormatInfo formatsInfo[] = {
+	{ V4L2_PIX_FMT_GREY, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SBGGR8, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SGBRG8, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SGRBG8, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SRGGB8, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_Y10, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SBGGR10, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SGBRG10, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SGRBG10, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SRGGB10, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_Y12, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SBGGR12, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SGBRG12, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SGRBG12, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SRGGB12, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_Y16, 16, Unpacked16 },
+	{ V4L2_PIX_FMT_SBGGR16, 16, Unpacked16 },
+	{ V4L2_PIX_FMT_SGBRG16, 16, Unpacked16 },
+	{ V4L2_PIX_FMT_SGRBG16, 16, Unpacked16 },
+	{ V4L2_PIX_FMT_SRGGB16, 16, Unpacked16 },
+	{ V4L2_PIX_FMT_Y10P, 10, Csi2Packed },
+	{ V4L2_PIX_FMT_SBGGR10P, 10, Csi2Packed },
+	{ V4L2_PIX_FMT_SGBRG10P, 10, Csi2Packed },
+	{ V4L2_PIX_FMT_SGRBG10P, 10, Csi2Packed },
+	{ V4L2_PIX_FMT_SRGGB10P, 10, Csi2Packed },
+	{ V4L2_PIX_FMT_SBGGR12P, 12, Csi2Packed },
+	{ V4L2_PIX_FMT_SGBRG12P, 12, Csi2Packed },
+	{ V4L2_PIX_FMT_SGRBG12P, 12, Csi2Packed },
+	{ V4L2_PIX_FMT_SRGGB12P, 12, Csi2Packed },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, 10, Ipu3Packed },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, 10, Ipu3Packed },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, 10, Ipu3Packed },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, 10, Ipu3Packed },
+};
+
+unsigned int divRoundUp(unsigned int value, unsigned int divisor)
+{
+	return (value + divisor - 1) / divisor;
+}
+
+const FormatInfo *findFormat(unsigned int fourcc)
+{
+	for (const FormatInfo &info : formatsInfo) {
+		if (info.fourcc == fourcc)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+/*
+ * The MIPI CSI-2 packed formats store the 8 MSBs of 4 (10-bit) or 2 (12-bit)
+ * samples in consecutive bytes, followed by a byte with their LSBs. The IPU3
+ * packed format stores 25 10-bit samples in 32-byte blocks, as a little-endian
+ * bitstream, padded with 6 bits.
+ */
+unsigned int lineLength(const FormatInfo &info, unsigned int width)
+{
+	switch (info.packing) {
+	case Unpacked8:
+		return width;
+	case Unpacked16:
+		return width * 2;
+	case Csi2Packed:
+		return info.bitsPerSample == 10 ? divRoundUp(width, 4) * 5
+						: divRoundUp(width, 2) * 3;
+	case Ipu3Packed:
+		return divRoundUp(width, 25) * 32;
+	}
+
+	return 0;
+}
+
+void unpacked8RowScalar(const uint8_t *src, uint16_t *dst, unsigned int width,
+			unsigned int bits)
+{
+	for (unsigned int x = 0; x < width; ++x)
+		dst[x] = src[x];
+}
+
+void unpacked16RowScalar(const uint8_t *src, uint16_t *dst, unsigned int width,
+			 unsigned int bits)
+{
+	const uint16_t mask = (1U << bits) - 1;
+
+	for (unsigned int x = 0; x < width; ++x)
+		dst[x] = (src[x * 2] | (src[x * 2 + 1] << 8)) & mask;
+}
+
+void csi2Packed10RowScalar(const uint8_t *src, uint16_t *dst,
+			   unsigned int width, unsigned int bits)
+{
+	for (unsigned int x = 0; x < width; ++x) {
+		const uint8_t *group = src + x / 4 * 5;
+		unsigned int k = x % 4;
+
+		dst[x] = (group[k] << 2) | ((group[4] >> (k * 2)) & 0x3);
+	}
+}
+
+void csi2Packed12RowScalar(const uint8_t *src, uint16_t *dst,
+			   unsigned int width, unsigned int bits)
+{
+	for (unsigned int x = 0; x < width; ++x) {
+		const uint8_t *group = src + x / 2 * 3;
+		unsigned int k = x % 2;
+
+		dst[x] = (group[k] << 4) | ((group[2] >> (k * 4)) & 0xf);
+	}
+}
+
+void ipu3Packed10RowScalar(const uint8_t *src, uint16_t *dst,
+			   unsigned int width, unsigned int bits)
+{
+	for (unsigned int x = 0; x < width; ++x) {
+		const uint8_t *block = src + x / 25 * 32;
+		unsigned int bit = x % 25 * 10;
+		const uint8_t *pair = block + bit / 8;
+
+		dst[x] = ((pair[0] | (pair[1] << 8)) >> (bit % 8)) & 0x3ff;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__ARM_NEON)
+
+/*
+ * The vectorized implementations unpack 8 samples at a time from 16 bytes of
+ * input. Two byte shuffles gather, for each sample, the bytes holding its MSBs
+ * in a and its LSBs in b, in 16-bit lanes. Multiplying the lanes shifts the
+ * sample bits in place, and the sample is then
+ *
+ *	((a * mulA) | ((b * mulB) & mask)) >> shift
+ *
+ * Shuffle indices with the high bit set produce zero bytes, both with SSSE3
+ * and NEON.
+ */
+struct Layout {
+	uint8_t a[16];
+	uint8_t b[16];
+	uint16_t mulA[8];
+	uint16_t mulB[8];
+	uint16_t mask;
+	unsigned int shift;
+};
+
+constexpr uint8_t Z = 0xff;
+
+Layout csi2Packed10Layout()
+{
+	Layout layout = {};
+
+	for (unsigned int i = 0; i < 8; ++i) {
+		unsigned int group = i / 4 * 5;
+		unsigned int k = i % 4;
+
+		layout.a[i * 2] = Z;
+		layout.a[i * 2 + 1] = group + k;
+		layout.b[i * 2] = group + 4;
+		layout.b[i * 2 + 1] = Z;
+		layout.mulA[i] = 1;
+		layout.mulB[i] = 1 << (6 - k * 2);
+	}
+
+	layout.mask = 0xc0;
+	layout.shift = 6;
+
+	return layout;
+}
+
+Layout csi2Packed12Layout()
+{
+	Layout layout = {};
+
+	for (unsigned int i = 0; i < 8; ++i) {
+		unsigned int group = i / 2 * 3;
+		unsigned int k = i % 2;
+
+		layout.a[i * 2] = Z;
+		layout.a[i * 2 + 1] = group + k;
+		layout.b[i * 2] = group + 2;
+		layout.b[i * 2 + 1] = Z;
+		layout.mulA[i] = 1;
+		layout.mulB[i] = k ? 1 : 16;
+	}
+
+	layout.mask = 0xf0;
+	layout.shift = 4;
+
+	return layout;
+}
+
+/*
+ * The 8 IPU3 samples starting at byte offset of the 16 input bytes. The 16-bit
+ * word holding each sample is shifted left for the sample to end on bit 15,
+ * which discards the bits of the next sample.
+ */
+Layout ipu3Packed10Layout(unsigned int offset)
+{
+	Layout layout = {};
+
+	for (unsigned int i = 0; i < 8; ++i) {
+		unsigned int bit = i * 10;
+
+		layout.a[i * 2] = offset + bit / 8;
+		layout.a[i * 2 + 1] = offset + bit / 8 + 1;
+		layout.b[i * 2] = Z;
+		layout.b[i * 2 + 1] = Z;
+		layout.mulA[i] = 1 << (6 - bit % 8);
+		layout.mulB[i] = 0;
+	}
+
+	layout.mask = 0;
+	layout.shift = 6;
+
+	return layout;
+}
+
+const Layout csi2Packed10 = csi2Packed10Layout();
+const Layout csi2Packed12 = csi2Packed12Layout();
+const Layout ipu3Packed10 = ipu3Packed10Layout(0);
+/* The third sample group of a block is read from byte 16, as a 16-byte load. */
+const Layout ipu3Packed10Tail = ipu3Packed10Layout(4);
+
+#endif /* __x86_64__ || __i386__ || __ARM_NEON */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * The SSSE3 kernels are compiled for the SSSE3 target regardless of the
+ * compiler flags, and only selected at runtime when the CPU supports them, as
+ * byte shuffles are not available with SSE2.
+ */
+#define SSSE3 __attribute__((target("ssse3")))
+
+SSSE3 void unpack8Ssse3(const uint8_t *src, uint16_t *dst, const Layout &layout)
+{
+	__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+	__m128i a = _mm_shuffle_epi8(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(layout.a)));
+	__m128i b = _mm_shuffle_epi8(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(layout.b)));
+
+	a = _mm_mullo_epi16(a, _mm_loadu_si128(reinterpret_cast<const __m128i *>(layout.mulA)));
+	b = _mm_mullo_epi16(b, _mm_loadu_si128(reinterpret_cast<const __m128i *>(layout.mulB)));
+	b = _mm_and_si128(b, _mm_set1_epi16(layout.mask));
+
+	__m128i samples = _mm_srl_epi16(_mm_or_si128(a, b),
+					_mm_cvtsi32_si128(layout.shift));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), samples);
+}
+
+SSSE3 void csi2Packed10RowSsse3(const uint8_t *src, uint16_t *dst,
+				unsigned int width, unsigned int bits)
+{
+	unsigned int length = divRoundUp(width, 4) * 5;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width && x / 4 * 5 + 16 <= length; x += 8)
+		unpack8Ssse3(src + x / 4 * 5, dst + x, csi2Packed10);
+
+	csi2Packed10RowScalar(src + x / 4 * 5, dst + x, width - x, bits);
+}
+
+SSSE3 void csi2Packed12RowSsse3(const uint8_t *src, uint16_t *dst,
+				unsigned int width, unsigned int bits)
+{
+	unsigned int length = divRoundUp(width, 2) * 3;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width && x / 2 * 3 + 16 <= length; x += 8)
+		unpack8Ssse3(src + x / 2 * 3, dst + x, csi2Packed12);
+
+	csi2Packed12RowScalar(src + x / 2 * 3, dst + x, width - x, bits);
+}
+
+SSSE3 void ipu3Packed10RowSsse3(const uint8_t *src, uint16_t *dst,
+				unsigned int width, unsigned int bits)
+{
+	unsigned int x;
+
+	for (x = 0; x + 25 <= width; x += 25, src += 32) {
+		unpack8Ssse3(src, dst + x, ipu3Packed10);
+		unpack8Ssse3(src + 10, dst + x + 8, ipu3Packed10);
+		unpack8Ssse3(src + 16, dst + x + 16, ipu3Packed10Tail);
+		dst[x + 24] = (src[30] | (src[31] << 8)) & 0x3ff;
+	}
+
+	ipu3Packed10RowScalar(src, dst + x, width - x, bits);
+}
+
+#undef SSSE3
+
+bool hasSsse3()
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+#if defined(__ARM_NEON)
+
+uint8x16_t shuffleNeon(uint8x16_t data, const uint8_t *indices)
+{
+	uint8x8x2_t table = { { vget_low_u8(data), vget_high_u8(data) } };
+
+	return vcombine_u8(vtbl2_u8(table, vld1_u8(indices)),
+			   vtbl2_u8(table, vld1_u8(indices + 8)));
+}
+
+void unpack8Neon(const uint8_t *src, uint16_t *dst, const Layout &layout)
+{
+	uint8x16_t data = vld1q_u8(src);
+	uint16x8_t a = vreinterpretq_u16_u8(shuffleNeon(data, layout.a));
+	uint16x8_t b = vreinterpretq_u16_u8(shuffleNeon(data, layout.b));
+
+	a = vmulq_u16(a, vld1q_u16(layout.mulA));
+	b = vmulq_u16(b, vld1q_u16(layout.mulB));
+	b = vandq_u16(b, vdupq_n_u16(layout.mask));
+
+	int16x8_t shift = vdupq_n_s16(-static_cast<int16_t>(layout.shift));
+	vst1q_u16(dst, vshlq_u16(vorrq_u16(a, b), shift));
+}
+
+void csi2Packed10RowNeon(const uint8_t *src, uint16_t *dst,
+			 unsigned int width, unsigned int bits)
+{
+	unsigned int length = divRoundUp(width, 4) * 5;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width && x / 4 * 5 + 16 <= length; x += 8)
+		unpack8Neon(src + x / 4 * 5, dst + x, csi2Packed10);
+
+	csi2Packed10RowScalar(src + x / 4 * 5, dst + x, width - x, bits);
+}
+
+void csi2Packed12RowNeon(const uint8_t *src, uint16_t *dst,
+			 unsigned int width, unsigned int bits)
+{
+	unsigned int length = divRoundUp(width, 2) * 3;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width && x / 2 * 3 + 16 <= length; x += 8)
+		unpack8Neon(src + x / 2 * 3, dst + x, csi2Packed12);
+
+	csi2Packed12RowScalar(src + x / 2 * 3, dst + x, width - x, bits);
+}
+
+void ipu3Packed10RowNeon(const uint8_t *src, uint16_t *dst,
+			 unsigned int width, unsigned int bits)
+{
+	unsigned int x;
+
+	for (x = 0; x + 25 <= width; x += 25, src += 32) {
+		unpack8Neon(src, dst + x, ipu3Packed10);
+		unpack8Neon(src + 10, dst + x + 8, ipu3Packed10);
+		unpack8Neon(src + 16, dst + x + 16, ipu3Packed10Tail);
+		dst[x + 24] = (src[30] | (src[31] << 8)) & 0x3ff;
+	}
+
+	ipu3Packed10RowScalar(src, dst + x, width - x, bits);
+}
+
+#endif /* __ARM_NEON */
+
+bool always()
+{
+	return true;
+}
+
+using UnpackRow = void (*)(const uint8_t *src, uint16_t *dst,
+			   unsigned int width, unsigned int bits);
+
+/*
+ * The 8-bit and 16-bit formats only need widening or masking, which the
+ * compilers vectorize, and always use the scalar implementation.
+ */
+struct Implementation {
+	const char *name;
+	bool (*available)();
+	UnpackRow csi2Packed10Row;
+	UnpackRow csi2Packed12Row;
+	UnpackRow ipu3Packed10Row;
+};
+
+/* Implementations, by order of preference. */
+const Implementation implementations[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "ssse3", hasSsse3, csi2Packed10RowSsse3, csi2Packed12RowSsse3,
+	  ipu3Packed10RowSsse3 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", always, csi2Packed10RowNeon, csi2Packed12RowNeon,
+	  ipu3Packed10RowNeon },
+#endif
+	{ "scalar", always, csi2Packed10RowScalar, csi2Packed12RowScalar,
+	  ipu3Packed10RowScalar },
+};
+
+const Implementation &selectImplementation()
+{
+	const char *name = utils::secure_getenv("LIBCAMERA_RAW_UNPACKER");
+
+	if (name) {
+		for (const Implementation &impl : implementations) {
+			if (strcmp(impl.name, name) || !impl.available())
+				continue;
+
+			return impl;
+		}
+
+		LOG(RawUnpacker, Warning)
+			<< "Raw unpacker implementation " << name
+			<< " not available";
+	}
+
+	for (const Implementation &impl : implementations) {
+		if (impl.available())
+			return impl;
+	}
+
+	/* The scalar implementation is always available. */
+	return implementations[ARRAY_SIZE(implementations) - 1];
+}
+
+} /* namespace */
+
+/**
+ * \class RawUnpacker
+ * \brief Unpack raw frames to 16-bit samples
+ *
+ * The RawUnpacker class unpacks raw frames, Bayer or greyscale, to one 16-bit
+ * sample per pixel in native endianness, right-aligned, with the lines of the
+ * unpacked frames contiguous in memory. It supports the MIPI CSI-2 RAW10 and
+ * RAW12 packed formats, the IPU3 10-bit packed format, and the 8-bit and
+ * 16-bit container formats, which are widened or stripped of their line
+ * padding.
+ *
+ * The packed formats are unpacked with SSSE3 on x86 and with NEON on ARM,
+ * selected at runtime based on the CPU capabilities, or with a scalar
+ * implementation otherwise. All implementations produce identical results.
+ *
+ * The LIBCAMERA_RAW_UNPACKER environment variable selects a specific
+ * implementation ("ssse3", "neon" or "scalar") for testing purpose. It is
+ * ignored if the implementation isn't available.
+ */
+
+RawUnpacker::RawUnpacker()
+	: stride_(0), lineLength_(0), bitsPerSample_(0),
+	  implementation_(nullptr), unpackRow_(nullptr)
+{
+}
+
+/**
+ * \brief Configure the unpacker for a format and size
+ * \param[in] format The V4L2 pixel format of the frames to unpack
+ * \param[in] size The frame size in pixels
+ * \param[in] stride The length of the lines of the frames to unpack in bytes
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a format isn't supported, or the \a stride is smaller
+ * than the minimum stride for the \a format and \a size
+ */
+int RawUnpacker::configure(unsigned int format, const Size &size,
+			   unsigned int stride)
+{
+	const FormatInfo *info = findFormat(format);
+	if (!info) {
+		LOG(RawUnpacker, Error)
+			<< "Unsupported format " << utils::hex(format);
+		return -EINVAL;
+	}
+
+	unsigned int length = lineLength(*info, size.width);
+	if (stride < length) {
+		LOG(RawUnpacker, Error)
+			<< "Stride " << stride << " too small for "
+			<< size.toString() << "-" << utils::hex(format);
+		return -EINVAL;
+	}
+
+	const Implementation &impl = selectImplementation();
+
+	switch (info->packing) {
+	case Unpacked8:
+		unpackRow_ = unpacked8RowScalar;
+		break;
+	case Unpacked16:
+		unpackRow_ = unpacked16RowScalar;
+		break;
+	case Csi2Packed:
+		unpackRow_ = info->bitsPerSample == 10 ? impl.csi2Packed10Row
+						       : impl.csi2Packed12Row;
+		break;
+	case Ipu3Packed:
+		unpackRow_ = impl.ipu3Packed10Row;
+		break;
+	}
+
+	implementation_ = impl.name;
+	size_ = size;
+	stride_ = stride;
+	lineLength_ = length;
+	bitsPerSample_ = info->bitsPerSample;
+
+	LOG(RawUnpacker, Debug)
+		<< "Unpacking " << size_.toString() << "-" << utils::hex(format)
+		<< " with " << implementation_ << " implementation";
+
+	return 0;
+}
+
+/**
+ * \brief Unpack a frame
+ * \param[in] src The frame to unpack
+ * \param[out] dst The unpacked frame buffer
+ *
+ * The \a dst buffer shall be at least frameSize() bytes long. The unpacker
+ * shall be configured before use.
+ */
+void RawUnpacker::unpack(const uint8_t *src, uint16_t *dst) const
+{
+	unpack(src, dst, 0, size_.height);
+}
+
+/**
+ * \brief Unpack a horizontal stripe of a frame
+ * \param[in] src The frame to unpack
+ * \param[out] dst The unpacked frame buffer
+ * \param[in] first The index of the first line to unpack
+ * \param[in] count The number of lines to unpack
+ *
+ * This function unpacks lines \a first to \a first + \a count - 1 only. The
+ * \a src and \a dst buffers point to the beginning of the full frames. As the
+ * unpacker holds no per-frame state, stripes of the same frame can be unpacked
+ * concurrently from different threads.
+ */
+void RawUnpacker::unpack(const uint8_t *src, uint16_t *dst, unsigned int first,
+			 unsigned int count) const
+{
+	unsigned int width = size_.width;
+	unsigned int last = std::min(first + count, size_.height);
+
+	if (!implementation_)
+		return;
+
+	for (unsigned int y = first; y < last; ++y)
+		unpackRow_(src + y * stride_, dst + y * width, width,
+			   bitsPerSample_);
+}
+
+/**
+ * \brief Unpack a frame in place
+ * \param[in,out] frame The frame to unpack
+ *
+ * The \a frame buffer shall be at least frameSize() bytes long, and aligned to
+ * 16 bits. The unpacked frame overwrites the packed frame, starting at the
+ * beginning of the buffer.
+ *
+ * Each line is copied before being unpacked, and the lines are processed in the
+ * order that never overwrites a line that hasn't been unpacked yet: from the
+ * first line when the unpacked lines are shorter than the stride, and from the
+ * last line otherwise.
+ */
+void RawUnpacker::unpack(uint8_t *frame) const
+{
+	unsigned int width = size_.width;
+	unsigned int height = size_.height;
+	bool forward = width * 2 <= stride_;
+
+	if (!implementation_)
+		return;
+
+	std::vector<uint8_t> line(lineLength_);
+	uint16_t *dst = reinterpret_cast<uint16_t *>(frame);
+
+	for (unsigned int i = 0; i < height; ++i) {
+		unsigned int y = forward ? i : height - 1 - i;
+
+		memcpy(line.data(), frame + y * stride_, lineLength_);
+		unpackRow_(line.data(), dst + y * width, width, bitsPerSample_);
+	}
+}
+
+/**
+ * \brief Unpack a single line
+ * \param[in] src The line to unpack
+ * \param[out] dst The unpacked line buffer
+ *
+ * The \a dst buffer shall be large enough to store one sample per pixel of the
+ * configured width.
+ */
+void RawUnpacker::unpackLine(const uint8_t *src, uint16_t *dst) const
+{
+	if (!implementation_)
+		return;
+
+	unpackRow_(src, dst, size_.width, bitsPerSample_);
+}
+
+/**
+ * \brief Compute the minimum stride of a format
+ * \param[in] format The V4L2 pixel format
+ * \param[in] width The frame width in pixels
+ * \return The minimum length of the lines of \a width pixels in bytes, or 0 if
+ * the \a format isn't supported
+ */
+unsigned int RawUnpacker::minimumStride(unsigned int format, unsigned int width)
+{
+	const FormatInfo *info = findFormat(format);
+	if (!info)
+		return 0;
+
+	return lineLength(*info, width);
+}
+
+/**
+ * \fn RawUnpacker::bitsPerSample()
+ * \brief Retrieve the number of significant bits of the unpacked samples
+ * \return The number of bits per sample, or 0 if the unpacker isn't configured
+ */
+
+/**
+ * \brief Retrieve the size of the unpacked frames
+ * \return The size of the unpacked frames in bytes
+ */
+unsigned int RawUnpacker::frameSize() const
+{
+	return size_.width * size_.height * 2;
+}
+
+/**
+ * \fn RawUnpacker::implementation()
+ * \brief Retrieve the name of the implementation used by the unpacker
+ * \return The implementation name, or nullptr if the unpacker isn't configured
+ */
+
+} /* namespace libcamera */
@@ -16,6 +16,8 @@
 
 #include "camera_controls.h"
 #include "log.h"
+#include "request_arena.h"
+#include "utils.h"
 
 /**
  * \file request.h
@@ -37,6 +39,38 @@ LOG_DEFINE_CATEGORY(Request)
  * The request has been cancelled due to capture stop
  */
 
+/**
+ * \enum Request::ReuseFlag
+ * Flags to control the behaviour of Request::reuse()
+ * \var Request::Default
+ * Don't reuse buffers
+ * \var Request::ReuseBuffers
+ * Reuse the buffers that were previously added by addBuffer()
+ */
+
+/**
+ * \enum Request::Stage
+ * \brief Stages of the request processing, timestamped for latency tracing
+ * \var Request::StageQueued
+ * The request has been queued to the camera
+ * \var Request::StageDeviceQueued
+ * The first buffer of the request has been queued to a video device
+ * \var Request::StageStarted
+ * The sensor has started capturing the frame for the request, as reported by
+ * the frame start event of the device
+ * \var Request::StageCaptured
+ * The first buffer of the request has been captured, as reported by the
+ * device timestamp of the buffer
+ * \var Request::StageBufferReady
+ * The last buffer of the request has completed
+ * \var Request::StageIPAAction
+ * The pipeline handler has handled the last IPA action for the request
+ * \var Request::StageCompleted
+ * The request has completed
+ * \var Request::StageCount
+ * The number of stages
+ */
+
 /**
  * \class Request
  * \brief A frame capture request
@@ -57,32 +91,96 @@ LOG_DEFINE_CATEGORY(Request)
  *
  */
 Request::Request(Camera *camera, uint64_t cookie)
-	: camera_(camera), cookie_(cookie), status_(RequestPending),
-	  cancelled_(false)
+	: camera_(camera), pending_(0), released_(0), framesDropped_(0),
+	  frameContext_(nullptr), queueNext_(nullptr),
+	  timestamps_{},
+	  cookie_(cookie), status_(RequestPending), cancelled_(false),
+	  reused_(false)
 {
-	/**
-	 * \todo Should the Camera expose a validator instance, to avoid
-	 * creating a new instance for each request?
+	/*
+	 * Size the buffer map for the camera streams, adding buffers to the
+	 * request then never allocates memory.
 	 */
-	validator_ = new CameraControlValidator(camera);
-	controls_ = new ControlList(controls::controls, validator_);
+	bufferMap_.entries_.reserve(camera->streams().size());
+
+	/*
+	 * The request-scoped data is allocated from an arena backed by memory
+	 * blocks recycled between all the requests of the camera. The control
+	 * lists live as long as the request, allocate them before the mark.
+	 */
+	arena_ = utils::make_unique<RequestArena>(camera->arenaPool_);
+
+	/* The validator is owned by the camera and shared by all requests. */
+	validator_ = camera->validator();
+	controls_ = create<ControlList>(controls::controls, validator_);
 
 	/**
 	 * \todo: Add a validator for metadata controls.
 	 */
-	metadata_ = new ControlList(controls::controls);
+	metadata_ = create<ControlList>(controls::controls);
+
+	arena_->mark();
 }
 
 Request::~Request()
 {
 	for (auto it : bufferMap_) {
 		Buffer *buffer = it.second;
-		delete buffer;
+		if (!buffer->recyclable_)
+			delete buffer;
+	}
+}
+
+/**
+ * \brief Reset the request for reuse
+ * \param[in] flags Indicate whether or not to reuse the buffers
+ *
+ * Reset the status and clear the controls and metadata of the request to allow
+ * it to be queued again to the camera. The storage of the controls and
+ * metadata lists is preserved. If \a flags contains ReuseBuffers, the buffers
+ * stay part of the request and their metadata and status are reset, otherwise
+ * they are released and new buffers shall be added before the request is
+ * queued.
+ *
+ * When this method is called from the Camera::requestCompleted signal handler,
+ * ownership of the request is returned to the application and the camera
+ * doesn't delete the request after the handler returns. The application is
+ * then responsible for either queueing the request again or deleting it.
+ *
+ * The objects created with create() since the request has been created or
+ * last reused are destroyed.
+ *
+ * Requests that have been queued and haven't completed yet can't be reused.
+ */
+void Request::reuse(ReuseFlag flags)
+{
+	if (hasPendingBuffers()) {
+		LOG(Request, Error) << "Can't reuse a request in progress";
+		return;
 	}
 
-	delete metadata_;
-	delete controls_;
-	delete validator_;
+	if (flags & ReuseBuffers) {
+		for (auto it : bufferMap_)
+			it.second->reset();
+	} else {
+		for (auto it : bufferMap_) {
+			Buffer *buffer = it.second;
+			if (!buffer->recyclable_)
+				delete buffer;
+		}
+
+		bufferMap_.entries_.clear();
+	}
+
+	status_ = RequestPending;
+	cancelled_ = false;
+	reused_ = true;
+
+	/* Release the data created for the previous capture. */
+	arena_->reset();
+
+	controls_->clear();
+	metadata_->clear();
 }
 
 /**
@@ -101,6 +199,83 @@ Request::~Request()
  * \return A reference to the ControlList in this request
  */
 
+/**
+ * \class Request::BufferMap
+ * \brief Associate the streams of a request with their buffers
+ *
+ * The BufferMap is a lightweight container that stores the Stream and Buffer
+ * pairs of a request. As a camera has a small number of streams, the pairs
+ * are stored in a flat array sized to the number of streams of the camera at
+ * request construction time, and stream lookups are performed with a linear
+ * search. This avoids memory allocations and hashing when buffers are added
+ * to or completed for a request.
+ *
+ * Iterating over a BufferMap visits the Stream and Buffer pairs in the order
+ * the buffers have been added to the request. A BufferMap can hold up to
+ * MAX_BUFFERS entries.
+ */
+
+/**
+ * \typedef Request::BufferMap::value_type
+ * \brief The Stream and Buffer pair type
+ */
+
+/**
+ * \typedef Request::BufferMap::const_iterator
+ * \brief Const iterator over the map entries
+ */
+
+/**
+ * \typedef Request::BufferMap::iterator
+ * \brief Iterator over the map entries, the map entries can't be modified
+ */
+
+/**
+ * \var Request::BufferMap::MAX_BUFFERS
+ * \brief The maximum number of buffers in a request
+ */
+
+/**
+ * \fn Request::BufferMap::begin()
+ * \brief Retrieve an iterator to the first entry of the map
+ * \return An iterator to the first entry of the map
+ */
+
+/**
+ * \fn Request::BufferMap::end()
+ * \brief Retrieve an iterator pointing to the past-the-end entry of the map
+ * \return An iterator to the element following the last entry of the map
+ */
+
+/**
+ * \fn Request::BufferMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map contains no entry, false otherwise
+ */
+
+/**
+ * \fn Request::BufferMap::size()
+ * \brief Retrieve the number of entries in the map
+ * \return The number of entries in the map
+ */
+
+/**
+ * \brief Find the entry for a stream
+ * \param[in] stream The stream
+ * \return An iterator to the entry for \a stream, or end() if the stream isn't
+ * part of the map
+ */
+Request::BufferMap::const_iterator Request::BufferMap::find(Stream *stream) const
+{
+	const_iterator it;
+	for (it = begin(); it != end(); ++it) {
+		if (it->first == stream)
+			break;
+	}
+
+	return it;
+}
+
 /**
  * \fn Request::buffers()
  * \brief Retrieve the request's streams to buffers map
@@ -133,13 +308,82 @@ int Request::addBuffer(std::unique_ptr<Buffer> buffer)
 		return -EINVAL;
 	}
 
-	auto it = bufferMap_.find(stream);
-	if (it != bufferMap_.end()) {
+	int ret = insertBuffer(stream, buffer.get());
+	if (ret)
+		return ret;
+
+	buffer.release();
+
+	return 0;
+}
+
+/**
+ * \brief Store a recyclable Buffer with its associated Stream in the Request
+ * \param[in] buffer The Buffer to store in the request
+ *
+ * This method adds a recyclable buffer retrieved with Stream::buffer() to the
+ * request. Ownership of the buffer stays with the stream, the buffer isn't
+ * deleted when the request is destroyed, and can thus be added to a new
+ * request once this request completes. The buffer metadata and status are
+ * reset.
+ *
+ * A request can only contain one buffer per stream. If a buffer has already
+ * been added to the request for the same stream, this method returns -EEXIST.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EEXIST The request already contains a buffer for the stream
+ * \retval -EINVAL The buffer is not a recyclable buffer
+ * \retval -EBUSY The buffer is part of a request that hasn't completed yet, or
+ * is held by a BufferRef
+ */
+int Request::addBuffer(Buffer *buffer)
+{
+	if (!buffer || !buffer->recyclable_) {
+		LOG(Request, Error) << "Invalid recyclable buffer";
+		return -EINVAL;
+	}
+
+	if (buffer->request()) {
+		LOG(Request, Error) << "Buffer in use by another request";
+		return -EBUSY;
+	}
+
+	if (buffer->held()) {
+		LOG(Request, Debug) << "Buffer held by a BufferRef";
+		buffer->stream()->starvationCount_++;
+		return -EBUSY;
+	}
+
+	int ret = insertBuffer(buffer->stream(), buffer);
+	if (ret)
+		return ret;
+
+	buffer->reset();
+
+	return 0;
+}
+
+/**
+ * \brief Add a Buffer for a Stream to the buffer map
+ * \param[in] stream The stream
+ * \param[in] buffer The buffer
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EEXIST The request already contains a buffer for the stream
+ * \retval -ENOSPC The request already contains the maximum number of buffers
+ */
+int Request::insertBuffer(Stream *stream, Buffer *buffer)
+{
+	if (bufferMap_.find(stream) != bufferMap_.end()) {
 		LOG(Request, Error) << "Buffer already set for stream";
 		return -EEXIST;
 	}
 
-	bufferMap_[stream] = buffer.release();
+	if (bufferMap_.size() == BufferMap::MAX_BUFFERS) {
+		LOG(Request, Error) << "Too many buffers in request";
+		return -ENOSPC;
+	}
+
+	bufferMap_.entries_.emplace_back(stream, buffer);
 
 	return 0;
 }
@@ -153,6 +397,30 @@ int Request::addBuffer(std::unique_ptr<Buffer> buffer)
  * map.
  */
 
+/**
+ * \var Request::pending_
+ * \brief Bitmask of the buffers pending completion
+ *
+ * Bit n is set when the buffer stored in the n-th entry of the bufferMap_ is
+ * pending completion.
+ */
+
+/**
+ * \var Request::released_
+ * \brief Bitmask of the completed buffers recycled before request completion
+ *
+ * Bit n is set when the buffer stored in the n-th entry of the bufferMap_ has
+ * been released with releaseBuffer().
+ */
+
+/**
+ * \var Request::framesDropped_
+ * \brief The number of frames dropped before the request
+ *
+ * The pipeline handler base class updates the number of dropped frames as the
+ * buffers of the request complete, with the largest gap among its streams.
+ */
+
 /**
  * \brief Return the buffer associated with a stream
  * \param[in] stream The stream the buffer is associated to
@@ -203,6 +471,51 @@ Buffer *Request::findBuffer(Stream *stream) const
  * otherwise
  */
 
+/**
+ * \fn Request::timestamp()
+ * \brief Retrieve the time at which the request reached a processing stage
+ * \param[in] stage The processing stage
+ *
+ * Timestamps are expressed in nanoseconds on the CLOCK_MONOTONIC clock, and
+ * are reset when the request is queued. Not all pipeline handlers go through
+ * all stages, the timestamp of a stage that hasn't been reached is 0.
+ *
+ * \return The timestamp of \a stage in nanoseconds, or 0 if the request hasn't
+ * reached \a stage
+ */
+
+/**
+ * \fn Request::create()
+ * \brief Create an object whose lifetime is bound to the request
+ * \param[in] args The arguments passed to the object constructor
+ *
+ * This function creates an object of type \a T in memory allocated from the
+ * request arena. The arena is backed by memory blocks shared by all the
+ * requests of the camera, and recycled when requests are reused or destroyed.
+ * Creating data that is only needed for the duration of a capture, such as
+ * per-frame processing parameters or descriptors mapping the request to an
+ * external framework, with this function thus avoids allocating and freeing
+ * memory from the heap for every frame.
+ *
+ * The object is destroyed, and its memory released, when the request is
+ * reused with reuse() or destroyed. The caller shall not delete it. The
+ * request arena isn't thread-safe, objects shall only be created by the owner
+ * of the request, which is the application before the request is queued and
+ * after it completes, and the pipeline handler in-between.
+ *
+ * \return A pointer to the object
+ */
+
+/*
+ * Allocate memory from the request arena, for use by create(). The destructor
+ * is called on the memory when the arena is reset.
+ */
+void *Request::allocate(size_t size, size_t alignment,
+			void (*destructor)(void *))
+{
+	return arena_->allocate(size, alignment, destructor);
+}
+
 /**
  * \brief Validate the request and prepare it for the completion handler
  *
@@ -218,11 +531,15 @@ int Request::prepare()
 		return -EINVAL;
 	}
 
-	for (auto const &pair : bufferMap_) {
-		Buffer *buffer = pair.second;
-		buffer->setRequest(this);
-		pending_.insert(buffer);
-	}
+	for (auto const &pair : bufferMap_)
+		pair.second->setRequest(this);
+
+	pending_ = (1ULL << bufferMap_.size()) - 1;
+	released_ = 0;
+	framesDropped_ = 0;
+
+	timestamps_.fill(0);
+	trace(StageQueued);
 
 	return 0;
 }
@@ -238,15 +555,17 @@ void Request::complete()
 {
 	ASSERT(!hasPendingBuffers());
 	status_ = cancelled_ ? RequestCancelled : RequestComplete;
+
+	trace(StageCompleted);
 }
 
 /**
  * \brief Complete a buffer for the request
  * \param[in] buffer The buffer that has completed
  *
- * A request tracks the status of all buffers it contains through a set of
- * pending buffers. This function removes the \a buffer from the set to mark it
- * as complete. All buffers associate with the request shall be marked as
+ * A request tracks the status of all buffers it contains through a bitmask of
+ * pending buffers. This function clears the bit of the \a buffer to mark it as
+ * complete. All buffers associate with the request shall be marked as
  * complete by calling this function once and once only before reporting the
  * request as complete with the complete() method.
  *
@@ -255,15 +574,115 @@ void Request::complete()
  */
 bool Request::completeBuffer(Buffer *buffer)
 {
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	unsigned int index;
+	for (index = 0; index < bufferMap_.size(); ++index) {
+		if (bufferMap_.entries_[index].second == buffer)
+			break;
+	}
+
+	ASSERT(index < bufferMap_.size() && (pending_ & (1U << index)));
+	pending_ &= ~(1U << index);
 
 	buffer->setRequest(nullptr);
 
 	if (buffer->status() == Buffer::BufferCancelled)
 		cancelled_ = true;
+	else if (buffer->timestamp() &&
+		 buffer->timestampClock() == Buffer::ClockMonotonic)
+		trace(StageCaptured, buffer->timestamp());
+
+	trace(StageBufferReady);
 
 	return !hasPendingBuffers();
 }
 
+/**
+ * \brief Release a completed buffer from the request
+ * \param[in] buffer The buffer
+ *
+ * Mark the recyclable \a buffer as released, to remove it from the request
+ * when the request completes. The buffer map isn't modified immediately, as
+ * pipeline handlers may still iterate over it.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The buffer is not a recyclable buffer
+ * \retval -EBUSY The buffer hasn't completed yet
+ * \retval -ENOENT The buffer isn't part of the request
+ */
+int Request::releaseBuffer(Buffer *buffer)
+{
+	if (!buffer->recyclable_) {
+		LOG(Request, Error) << "Only recyclable buffers can be released";
+		return -EINVAL;
+	}
+
+	unsigned int index;
+	for (index = 0; index < bufferMap_.size(); ++index) {
+		if (bufferMap_.entries_[index].second == buffer)
+			break;
+	}
+
+	if (index == bufferMap_.size() || released_ & (1U << index))
+		return -ENOENT;
+
+	if (pending_ & (1U << index))
+		return -EBUSY;
+
+	released_ |= 1U << index;
+
+	return 0;
+}
+
+/**
+ * \brief Remove the released buffers from the buffer map
+ *
+ * This method is called when the request completes, before the buffers of the
+ * request are reported to the application.
+ */
+void Request::removeReleasedBuffers()
+{
+	if (!released_)
+		return;
+
+	std::vector<BufferMap::value_type> &entries = bufferMap_.entries_;
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < entries.size(); ++i) {
+		if (!(released_ & (1U << i)))
+			entries[count++] = entries[i];
+	}
+
+	entries.resize(count);
+	released_ = 0;
+}
+
+/**
+ * \brief Timestamp a processing stage of the request with the current time
+ * \param[in] stage The processing stage
+ * \sa trace(Stage, uint64_t)
+ */
+void Request::trace(Stage stage)
+{
+	trace(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count());
+}
+
+/**
+ * \brief Timestamp a processing stage of the request
+ * \param[in] stage The processing stage
+ * \param[in] timestamp The timestamp in nanoseconds
+ *
+ * The StageDeviceQueued, StageStarted and StageCaptured stages record the first
+ * occurrence of the event for the request, all other stages record the last
+ * occurrence.
+ */
+void Request::trace(Stage stage, uint64_t timestamp)
+{
+	if ((stage == StageDeviceQueued || stage == StageStarted ||
+	     stage == StageCaptured) && timestamps_[stage])
+		return;
+
+	timestamps_[stage] = timestamp;
+}
+
 } /* namespace libcamera */
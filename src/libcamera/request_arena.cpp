@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * request_arena.cpp - Arena allocator for request-scoped data
+ */
+
+#include "request_arena.h"
+
+#include <new>
+#include <stdint.h>
+
+/**
+ * \file request_arena.h
+ * \brief Arena allocator for request-scoped data
+ */
+
+namespace libcamera {
+
+namespace {
+
+char *alignPointer(char *ptr, size_t alignment)
+{
+	uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
+	value = (value + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+	return reinterpret_cast<char *>(value);
+}
+
+} /* namespace */
+
+/**
+ * \class RequestArenaPool
+ * \brief A pool of memory blocks recycled between request arenas
+ *
+ * The RequestArenaPool provides the fixed-size memory blocks that back the
+ * RequestArena of all the requests of a camera. Blocks returned to the pool
+ * when a request is reused or destroyed are handed to the next arena that
+ * needs memory, so that creating, reusing and destroying requests at the frame
+ * rate doesn't hit the heap. Up to MaxFreeBlocks blocks are retained, and the
+ * remaining blocks are freed.
+ *
+ * As requests can be destroyed from any thread, the pool is thread-safe.
+ */
+
+/**
+ * \var RequestArenaPool::BlockSize
+ * \brief The size of the memory blocks in bytes
+ */
+
+/**
+ * \var RequestArenaPool::MaxFreeBlocks
+ * \brief The maximum number of free blocks retained by the pool
+ */
+
+RequestArenaPool::RequestArenaPool()
+{
+	free_.reserve(MaxFreeBlocks);
+}
+
+RequestArenaPool::~RequestArenaPool()
+{
+	for (void *block : free_)
+		::operator delete(block);
+}
+
+/**
+ * \brief Retrieve a free block, or allocate a new one if none is available
+ * \return A memory block of BlockSize bytes
+ */
+void *RequestArenaPool::get()
+{
+	{
+		MutexLocker locker(mutex_);
+
+		if (!free_.empty()) {
+			void *block = free_.back();
+			free_.pop_back();
+			return block;
+		}
+	}
+
+	return ::operator new(BlockSize);
+}
+
+/**
+ * \brief Return a block to the pool
+ * \param[in] block The block, retrieved with get()
+ */
+void RequestArenaPool::put(void *block)
+{
+	{
+		MutexLocker locker(mutex_);
+
+		if (free_.size() < MaxFreeBlocks) {
+			free_.push_back(block);
+			return;
+		}
+	}
+
+	::operator delete(block);
+}
+
+/**
+ * \brief Retrieve the number of free blocks retained by the pool
+ * \return The number of free blocks
+ */
+unsigned int RequestArenaPool::freeBlocks()
+{
+	MutexLocker locker(mutex_);
+	return free_.size();
+}
+
+/**
+ * \class RequestArena
+ * \brief A monotonic allocator for the data whose lifetime is bound to a request
+ *
+ * A capture request carries data allocated by the application, the camera, the
+ * pipeline handler and the Android camera HAL, that lives until the request is
+ * reused or destroyed. Allocating each item from the heap, and freeing them
+ * from the thread that retires the request, fragments the heap. The
+ * RequestArena instead carves them from memory blocks retrieved from a
+ * RequestArenaPool shared by all the requests of a camera.
+ *
+ * Memory is allocated with allocate(), by bumping a pointer in the current
+ * block. Objects allocated with a destructor are destroyed in the reverse order
+ * of their allocation when the arena is reset with reset() or destroyed. The
+ * memory is then released at once, by returning the blocks to the pool.
+ *
+ * Data that shall survive reset(), such as the control lists created with the
+ * request, is allocated before calling mark(). reset() then only releases the
+ * data allocated after the mark.
+ *
+ * Allocations larger than a block are allocated from the heap, and freed when
+ * the arena is reset. The arena isn't thread-safe, it shall be accessed from
+ * the thread that currently owns the request only.
+ */
+
+/**
+ * \brief Construct an empty arena
+ * \param[in] pool The pool to retrieve memory blocks from
+ */
+RequestArena::RequestArena(const std::shared_ptr<RequestArenaPool> &pool)
+	: pool_(pool), blocks_(nullptr), ptr_(nullptr), end_(nullptr),
+	  finalizers_(nullptr), markBlock_(nullptr), markPtr_(nullptr),
+	  markFinalizers_(nullptr)
+{
+}
+
+/**
+ * \brief Destroy all the objects of the arena and release its memory
+ */
+RequestArena::~RequestArena()
+{
+	markBlock_ = nullptr;
+	markPtr_ = nullptr;
+	markFinalizers_ = nullptr;
+
+	reset();
+}
+
+/**
+ * \brief Allocate memory from the arena
+ * \param[in] size The size of the memory in bytes
+ * \param[in] alignment The alignment of the memory, a power of two
+ * \param[in] destructor The function to call on the memory when it is released
+ *
+ * When \a destructor is not null, it is called with a pointer to the memory
+ * when the arena is reset or destroyed. The caller shall construct an object
+ * in the memory before that.
+ *
+ * \return A pointer to the memory
+ */
+void *RequestArena::allocate(size_t size, size_t alignment,
+			     void (*destructor)(void *))
+{
+	if (!destructor)
+		return carve(size, alignment);
+
+	Finalizer *finalizer = static_cast<Finalizer *>(
+		carve(sizeof(Finalizer), alignof(Finalizer)));
+	void *object = carve(size, alignment);
+
+	finalizer->next = finalizers_;
+	finalizer->destructor = destructor;
+	finalizer->object = object;
+	finalizers_ = finalizer;
+
+	return object;
+}
+
+/**
+ * \brief Mark the current allocations as persistent
+ *
+ * The memory allocated before the mark isn't released by reset(), only by the
+ * arena destructor.
+ */
+void RequestArena::mark()
+{
+	markBlock_ = blocks_;
+	markPtr_ = ptr_;
+	markFinalizers_ = finalizers_;
+}
+
+/**
+ * \brief Destroy the objects and release the memory allocated after the mark
+ */
+void RequestArena::reset()
+{
+	while (finalizers_ != markFinalizers_) {
+		Finalizer *finalizer = finalizers_;
+		finalizers_ = finalizer->next;
+		finalizer->destructor(finalizer->object);
+	}
+
+	release(markBlock_);
+
+	ptr_ = markPtr_;
+	end_ = blocks_ ? reinterpret_cast<char *>(blocks_) + blocks_->size
+		       : nullptr;
+}
+
+void *RequestArena::carve(size_t size, size_t alignment)
+{
+	char *ptr = alignPointer(ptr_, alignment);
+	if (blocks_ && ptr + size <= end_) {
+		ptr_ = ptr + size;
+		return ptr;
+	}
+
+	/*
+	 * Retrieve a new block from the pool, or allocate a dedicated block
+	 * for large allocations.
+	 */
+	constexpr size_t header = sizeof(Block);
+	size_t blockSize = header + size + alignment;
+	void *memory;
+
+	if (blockSize > RequestArenaPool::BlockSize) {
+		memory = ::operator new(blockSize);
+	} else {
+		memory = pool_->get();
+		blockSize = RequestArenaPool::BlockSize;
+	}
+
+	Block *block = static_cast<Block *>(memory);
+	block->next = blocks_;
+	block->size = blockSize;
+	blocks_ = block;
+
+	ptr = alignPointer(static_cast<char *>(memory) + header, alignment);
+	ptr_ = ptr + size;
+	end_ = static_cast<char *>(memory) + blockSize;
+
+	return ptr;
+}
+
+/* Release the blocks allocated after the block \a until. */
+void RequestArena::release(Block *until)
+{
+	while (blocks_ != until) {
+		Block *block = blocks_;
+		blocks_ = block->next;
+
+		if (block->size == RequestArenaPool::BlockSize)
+			pool_->put(block);
+		else
+			::operator delete(block);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * request_queue.cpp - Lock-free request submission queue
+ */
+
+#include "request_queue.h"
+
+#include <algorithm>
+
+#include <libcamera/request.h>
+
+/**
+ * \file request_queue.h
+ * \brief Lock-free request submission queue
+ */
+
+namespace libcamera {
+
+/**
+ * \class RequestQueue
+ * \brief A lock-free multiple producers, single consumer queue of requests
+ *
+ * The RequestQueue transfers requests from the threads that queue them to
+ * the thread that processes them without taking any lock. Any number of
+ * threads can push() requests concurrently, while a single thread consumes
+ * them with takeAll().
+ *
+ * The queue is intrusive, it links requests through a pointer stored in the
+ * Request itself and never allocates memory when pushing. A request shall
+ * thus be stored in a single queue at a time.
+ */
+
+/**
+ * \fn RequestQueue::RequestQueue()
+ * \brief Construct an empty request queue
+ */
+
+/**
+ * \brief Push a request to the queue
+ * \param[in] request The request
+ *
+ * This method may be called from any thread.
+ *
+ * \return True if the queue was empty before the request was pushed, false
+ * otherwise
+ */
+bool RequestQueue::push(Request *request)
+{
+	Request *head = head_.load(std::memory_order_relaxed);
+
+	do {
+		request->queueNext_ = head;
+	} while (!head_.compare_exchange_weak(head, request,
+					      std::memory_order_release,
+					      std::memory_order_relaxed));
+
+	return !head;
+}
+
+/**
+ * \brief Remove all requests from the queue
+ *
+ * This method shall only be called from the consumer thread.
+ *
+ * \return The requests that were stored in the queue, in the order they have
+ * been pushed
+ */
+std::vector<Request *> RequestQueue::takeAll()
+{
+	Request *request = head_.exchange(nullptr, std::memory_order_acquire);
+	std::vector<Request *> requests;
+
+	for (; request; request = request->queueNext_)
+		requests.push_back(request);
+
+	std::reverse(requests.begin(), requests.end());
+
+	return requests;
+}
+
+/**
+ * \fn RequestQueue::empty()
+ * \brief Check if the queue is empty
+ * \return True if the queue contains no request, false otherwise
+ */
+
+} /* namespace libcamera */
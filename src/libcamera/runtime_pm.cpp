@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * runtime_pm.cpp - Runtime power management of media entities
+ */
+
+#include "runtime_pm.h"
+
+#include <errno.h>
+#include <fstream>
+
+#include "log.h"
+#include "media_object.h"
+
+/**
+ * \file runtime_pm.h
+ * \brief Runtime power management of media entities
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(RuntimePM)
+
+/**
+ * \class RuntimePM
+ * \brief Keep the device of a media entity powered
+ *
+ * Drivers power their device up when streaming starts and down when it stops,
+ * through the kernel runtime power management. Powering a sensor up takes tens
+ * to hundreds of milliseconds, which delays the start of every capture
+ * session. The RuntimePM class keeps the device of a media entity powered
+ * between sessions by setting its runtime power management control to "on"
+ * in sysfs, and restores the previous control when released.
+ *
+ * Writing the control usually requires privileges granted by a udev rule. When
+ * the control can't be written, hold() fails and the device is power managed
+ * by the driver as usual.
+ */
+
+/**
+ * \brief Construct a runtime power management handle for \a entity
+ * \param[in] entity The media entity whose device to keep powered
+ */
+RuntimePM::RuntimePM(const MediaEntity *entity)
+	: name_(entity->name()), held_(false)
+{
+	if (entity->deviceMajor() || entity->deviceMinor())
+		path_ = "/sys/dev/char/" + std::to_string(entity->deviceMajor())
+		      + ":" + std::to_string(entity->deviceMinor())
+		      + "/device/power/control";
+}
+
+RuntimePM::~RuntimePM()
+{
+	release();
+}
+
+/**
+ * \brief Keep the device powered
+ *
+ * Calling this method when the device is already held has no effect.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The entity has no device node
+ * \retval -EACCES The runtime power management control can't be accessed
+ */
+int RuntimePM::hold()
+{
+	if (held_)
+		return 0;
+
+	if (path_.empty())
+		return -ENODEV;
+
+	std::ifstream input(path_);
+	if (!(input >> control_)) {
+		LOG(RuntimePM, Debug)
+			<< "No runtime power management for " << name_;
+		return -EACCES;
+	}
+
+	std::ofstream output(path_);
+	if (!(output << "on" << std::flush)) {
+		LOG(RuntimePM, Debug)
+			<< "Can't keep " << name_ << " powered";
+		return -EACCES;
+	}
+
+	LOG(RuntimePM, Debug) << "Keeping " << name_ << " powered";
+
+	held_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Let the driver power the device down when unused
+ *
+ * The runtime power management control of the device is restored to the value
+ * it had when hold() was called.
+ */
+void RuntimePM::release()
+{
+	if (!held_)
+		return;
+
+	std::ofstream output(path_);
+	output << control_ << std::flush;
+
+	LOG(RuntimePM, Debug) << "Released " << name_;
+
+	held_ = false;
+}
+
+/**
+ * \fn RuntimePM::isHeld()
+ * \brief Check if the device is kept powered
+ * \return True if the device is held by hold(), false otherwise
+ */
+
+} /* namespace libcamera */
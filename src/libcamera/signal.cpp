@@ -7,6 +7,8 @@
 
 #include <libcamera/signal.h>
 
+#include <algorithm>
+
 /**
  * \file signal.h
  * \brief Signal & slot implementation
@@ -105,6 +107,74 @@ namespace libcamera {
  * function are passed to the slot functions unchanged. If a slot modifies one
  * of the arguments (when passed by pointer or reference), the modification is
  * thus visible to all subsequently called slots.
+ *
+ * Arguments passed by rvalue reference are moved to the slots, which can take
+ * ownership of their content without copying it. Signals with rvalue reference
+ * parameters shall thus be connected to a single slot. When the slot is called
+ * asynchronously, the arguments are moved to the message delivered to the
+ * object's thread instead of being copied.
+ *
+ * Slots may connect and disconnect slots of the signal being emitted. Slots
+ * disconnected during emission are not called anymore, and slots connected
+ * during emission are called starting from the next emission. Slots may also
+ * destroy the signal being emitted, in which case the remaining slots are not
+ * called.
+ */
+
+/*
+ * Signals may be destroyed by one of their slots, for instance by a timeout
+ * handler deleting its timer. Mark the emissions in progress to stop them
+ * without accessing the signal anymore, and delete the slots whose deletion
+ * has been deferred.
+ */
+SignalBase::~SignalBase()
+{
+	for (Emission *emission = emission_; emission; emission = emission->outer)
+		emission->destroyed = true;
+
+	for (BoundMethodBase *slot : released_)
+		delete slot;
+}
+
+/*
+ * Disconnect a slot. The slot is deleted immediately if no emission is in
+ * progress, and deferred to the end of the emission otherwise, as it may be
+ * the slot being called.
  */
+void SignalBase::release(BoundMethodBase **slot)
+{
+	if (emission_)
+		released_.push_back(*slot);
+	else
+		delete *slot;
+
+	*slot = nullptr;
+}
+
+/* Remove the entries of disconnected slots. */
+void SignalBase::compact()
+{
+	slots_.erase(std::remove(slots_.begin(), slots_.end(), nullptr),
+		     slots_.end());
+
+	for (BoundMethodBase *slot : released_)
+		delete slot;
+	released_.clear();
+}
+
+void SignalBase::beginEmit(Emission *emission)
+{
+	emission->outer = emission_;
+	emission->destroyed = false;
+	emission_ = emission;
+}
+
+void SignalBase::endEmit(Emission *emission)
+{
+	emission_ = emission->outer;
+
+	if (!emission_ && !released_.empty())
+		compact();
+}
 
 } /* namespace libcamera */
@@ -0,0 +1,740 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * soft_isp.cpp - CPU image signal processing of raw Bayer frames
+ */
+
+#include "soft_isp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/**
+ * \file soft_isp.h
+ * \brief CPU image signal processing of raw Bayer frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SoftIsp)
+
+namespace {
+
+/* Samples are processed on 12 bits, whatever the sensor bit depth. */
+constexpr unsigned int sampleMax = 4095;
+
+/* The number of lines of the stripes processed in parallel. */
+constexpr unsigned int stripeHeight = 32;
+
+enum Colour {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+struct InputFormat {
+	unsigned int fourcc;
+	unsigned int bitsPerSample;
+	std::array<unsigned int, 4> pattern;
+};
+
+#define BGGR { Blue, Green, Green, Red }
+#define GBRG { Green, Blue, Red, Green }
+#define GRBG { Green, Red, Blue, Green }
+#define RGGB { Red, Green, Green, Blue }
+
+const InputFormat inputFormatsInfo[] = {
+	{ V4L2_PIX_FMT_SBGGR8, 8, BGGR },
+	{ V4L2_PIX_FMT_SGBRG8, 8, GBRG },
+	{ V4L2_PIX_FMT_SGRBG8, 8, GRBG },
+	{ V4L2_PIX_FMT_SRGGB8, 8, RGGB },
+	{ V4L2_PIX_FMT_SBGGR10, 10, BGGR },
+	{ V4L2_PIX_FMT_SGBRG10, 10, GBRG },
+	{ V4L2_PIX_FMT_SGRBG10, 10, GRBG },
+	{ V4L2_PIX_FMT_SRGGB10, 10, RGGB },
+	{ V4L2_PIX_FMT_SBGGR10P, 10, BGGR },
+	{ V4L2_PIX_FMT_SGBRG10P, 10, GBRG },
+	{ V4L2_PIX_FMT_SGRBG10P, 10, GRBG },
+	{ V4L2_PIX_FMT_SRGGB10P, 10, RGGB },
+	{ V4L2_PIX_FMT_SBGGR12, 12, BGGR },
+	{ V4L2_PIX_FMT_SGBRG12, 12, GBRG },
+	{ V4L2_PIX_FMT_SGRBG12, 12, GRBG },
+	{ V4L2_PIX_FMT_SRGGB12, 12, RGGB },
+	{ V4L2_PIX_FMT_SBGGR12P, 12, BGGR },
+	{ V4L2_PIX_FMT_SGBRG12P, 12, GBRG },
+	{ V4L2_PIX_FMT_SGRBG12P, 12, GRBG },
+	{ V4L2_PIX_FMT_SRGGB12P, 12, RGGB },
+};
+
+#undef BGGR
+#undef GBRG
+#undef GRBG
+#undef RGGB
+
+const InputFormat *findInputFormat(unsigned int fourcc)
+{
+	for (const InputFormat &format : inputFormatsInfo) {
+		if (format.fourcc == fourcc)
+			return &format;
+	}
+
+	return nullptr;
+}
+
+/*
+ * Bilinear demosaicing of a line. The x, g and y outputs receive the non-green
+ * colour of the line, green, and the non-green colour of the adjacent lines.
+ * The pixels at positions whose parity is greenPos are green. The input lines
+ * are padded with one sample on each side.
+ *
+ * Sums of four 12-bit samples fit in 16 bits, all implementations use the
+ * same integer arithmetic and produce identical results.
+ */
+void debayerRowScalar(const uint16_t *above, const uint16_t *row,
+		      const uint16_t *below, uint16_t *x, uint16_t *g,
+		      uint16_t *y, unsigned int width, unsigned int greenPos)
+{
+	for (int i = 0; i < static_cast<int>(width); ++i) {
+		unsigned int lr = row[i - 1] + row[i + 1];
+		unsigned int ud = above[i] + below[i];
+
+		if (static_cast<unsigned int>(i & 1) == greenPos) {
+			x[i] = lr >> 1;
+			g[i] = row[i];
+			y[i] = ud >> 1;
+		} else {
+			x[i] = row[i];
+			g[i] = (lr + ud) >> 2;
+			y[i] = (above[i - 1] + above[i + 1] +
+				below[i - 1] + below[i + 1]) >> 2;
+		}
+	}
+}
+
+#if defined(__SSE2__)
+
+__m128i loadSse2(const uint16_t *src)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+}
+
+void storeSse2(uint16_t *dst, __m128i value)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), value);
+}
+
+/* Select a in the lanes set in mask, and b in the other lanes. */
+__m128i selectSse2(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+void debayerRowSse2(const uint16_t *above, const uint16_t *row,
+		    const uint16_t *below, uint16_t *x, uint16_t *g,
+		    uint16_t *y, unsigned int width, unsigned int greenPos)
+{
+	const __m128i green = greenPos ? _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0)
+				       : _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+	unsigned int i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		__m128i c = loadSse2(row + i);
+		__m128i lr = _mm_add_epi16(loadSse2(row + i - 1), loadSse2(row + i + 1));
+		__m128i ud = _mm_add_epi16(loadSse2(above + i), loadSse2(below + i));
+		__m128i diag = _mm_add_epi16(_mm_add_epi16(loadSse2(above + i - 1),
+							   loadSse2(above + i + 1)),
+					     _mm_add_epi16(loadSse2(below + i - 1),
+							   loadSse2(below + i + 1)));
+
+		__m128i h2 = _mm_srli_epi16(lr, 1);
+		__m128i v2 = _mm_srli_epi16(ud, 1);
+		__m128i cross = _mm_srli_epi16(_mm_add_epi16(lr, ud), 2);
+		diag = _mm_srli_epi16(diag, 2);
+
+		storeSse2(x + i, selectSse2(green, h2, c));
+		storeSse2(g + i, selectSse2(green, c, cross));
+		storeSse2(y + i, selectSse2(green, v2, diag));
+	}
+
+	/* The tail starts at an even position, the parity is preserved. */
+	debayerRowScalar(above + i, row + i, below + i, x + i, g + i, y + i,
+			 width - i, greenPos);
+}
+
+#endif /* __SSE2__ */
+
+#if defined(__ARM_NEON)
+
+void debayerRowNeon(const uint16_t *above, const uint16_t *row,
+		    const uint16_t *below, uint16_t *x, uint16_t *g,
+		    uint16_t *y, unsigned int width, unsigned int greenPos)
+{
+	static const uint16_t masks[2][8] = {
+		{ 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 },
+		{ 0, 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff },
+	};
+	const uint16x8_t green = vld1q_u16(masks[greenPos]);
+	unsigned int i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		uint16x8_t c = vld1q_u16(row + i);
+		uint16x8_t lr = vaddq_u16(vld1q_u16(row + i - 1), vld1q_u16(row + i + 1));
+		uint16x8_t ud = vaddq_u16(vld1q_u16(above + i), vld1q_u16(below + i));
+		uint16x8_t diag = vaddq_u16(vaddq_u16(vld1q_u16(above + i - 1),
+						      vld1q_u16(above + i + 1)),
+					    vaddq_u16(vld1q_u16(below + i - 1),
+						      vld1q_u16(below + i + 1)));
+
+		uint16x8_t h2 = vshrq_n_u16(lr, 1);
+		uint16x8_t v2 = vshrq_n_u16(ud, 1);
+		uint16x8_t cross = vshrq_n_u16(vaddq_u16(lr, ud), 2);
+		diag = vshrq_n_u16(diag, 2);
+
+		vst1q_u16(x + i, vbslq_u16(green, h2, c));
+		vst1q_u16(g + i, vbslq_u16(green, c, cross));
+		vst1q_u16(y + i, vbslq_u16(green, v2, diag));
+	}
+
+	debayerRowScalar(above + i, row + i, below + i, x + i, g + i, y + i,
+			 width - i, greenPos);
+}
+
+#endif /* __ARM_NEON */
+
+bool always()
+{
+	return true;
+}
+
+struct Implementation {
+	const char *name;
+	bool (*available)();
+	void (*debayerRow)(const uint16_t *above, const uint16_t *row,
+			   const uint16_t *below, uint16_t *x, uint16_t *g,
+			   uint16_t *y, unsigned int width,
+			   unsigned int greenPos);
+};
+
+/* Implementations, by order of preference. */
+const Implementation implementations[] = {
+#if defined(__SSE2__)
+	{ "sse2", always, debayerRowSse2 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", always, debayerRowNeon },
+#endif
+	{ "scalar", always, debayerRowScalar },
+};
+
+const Implementation &selectImplementation()
+{
+	const char *name = utils::secure_getenv("LIBCAMERA_SOFT_ISP");
+
+	if (name) {
+		for (const Implementation &impl : implementations) {
+			if (strcmp(impl.name, name) || !impl.available())
+				continue;
+
+			return impl;
+		}
+
+		LOG(SoftIsp, Warning)
+			<< "Software ISP implementation " << name
+			<< " not available";
+	}
+
+	for (const Implementation &impl : implementations) {
+		if (impl.available())
+			return impl;
+	}
+
+	/* The scalar implementation is always available. */
+	return implementations[ARRAY_SIZE(implementations) - 1];
+}
+
+unsigned int toFixed(float value)
+{
+	return std::max(0.0f, std::round(value * 1024.0f));
+}
+
+uint8_t clip(int value)
+{
+	return std::min(std::max(value, 0), 255);
+}
+
+} /* namespace */
+
+/**
+ * \class SoftIsp
+ * \brief Process raw Bayer frames to YUV or RGB on the CPU
+ *
+ * The SoftIsp class implements the image processing pipeline of the cameras
+ * whose receiver has no ISP. It processes 8-bit, 10-bit and 12-bit Bayer
+ * frames, unpacked or in the MIPI CSI-2 packed formats, with black level
+ * subtraction, white balance gains, bilinear demosaicing, a colour correction
+ * matrix and gamma correction, and outputs NV12, RGB24 or XRGB32 frames.
+ *
+ * Frames are processed in horizontal stripes spread over the threads of a
+ * ThreadPool. The auto-exposure and auto white balance statistics are
+ * accumulated in the same pass, to avoid reading the frame twice.
+ *
+ * The demosaicing, which dominates the processing time, is vectorized with
+ * SSE2 on x86 and with NEON on ARM. A scalar implementation is used on other
+ * platforms. All implementations produce identical results. The
+ * LIBCAMERA_SOFT_ISP environment variable selects a specific implementation
+ * ("sse2", "neon" or "scalar") for testing purpose. It is ignored if the
+ * implementation isn't available.
+ */
+
+/**
+ * \var SoftIsp::HISTOGRAM_BINS
+ * \brief The number of bins of the luminance histogram
+ */
+
+/**
+ * \struct SoftIsp::Params
+ * \brief Image processing parameters
+ *
+ * \var SoftIsp::Params::blackLevel
+ * \brief The black level, on a 12-bit scale whatever the sensor bit depth
+ *
+ * \var SoftIsp::Params::gains
+ * \brief The red, green and blue white balance gains
+ *
+ * \var SoftIsp::Params::ccm
+ * \brief The colour correction matrix, in row-major order
+ *
+ * The matrix is applied to the white-balanced red, green and blue values.
+ * Its coefficients are clamped to the [-8.0, 8.0] range.
+ *
+ * \var SoftIsp::Params::gamma
+ * \brief The gamma of the output encoding
+ */
+
+/**
+ * \brief Construct parameters with no black level, unity gains, an identity
+ * colour correction matrix and a 2.2 gamma
+ */
+SoftIsp::Params::Params()
+	: blackLevel(0), gains{ { 1.0f, 1.0f, 1.0f } },
+	  ccm{ { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f } },
+	  gamma(2.2f)
+{
+}
+
+/**
+ * \struct SoftIsp::Statistics
+ * \brief Frame statistics for the auto-exposure and white balance algorithms
+ *
+ * The statistics are computed on the demosaiced frame, after black level
+ * subtraction and white balance, before colour correction.
+ *
+ * \var SoftIsp::Statistics::sum
+ * \brief The sums of the red, green and blue values, on 12 bits
+ *
+ * \var SoftIsp::Statistics::histogram
+ * \brief The histogram of the linear luminance, over HISTOGRAM_BINS bins
+ *
+ * \var SoftIsp::Statistics::pixels
+ * \brief The number of pixels the statistics have been computed on
+ */
+
+/**
+ * \brief Construct empty statistics
+ */
+SoftIsp::Statistics::Statistics()
+{
+	clear();
+}
+
+/**
+ * \brief Reset the statistics
+ */
+void SoftIsp::Statistics::clear()
+{
+	sum.fill(0);
+	histogram.fill(0);
+	pixels = 0;
+}
+
+/**
+ * \brief Accumulate the statistics of another part of the frame
+ * \param[in] other The statistics to accumulate
+ */
+void SoftIsp::Statistics::merge(const Statistics &other)
+{
+	for (unsigned int i = 0; i < sum.size(); ++i)
+		sum[i] += other.sum[i];
+	for (unsigned int i = 0; i < histogram.size(); ++i)
+		histogram[i] += other.histogram[i];
+	pixels += other.pixels;
+}
+
+SoftIsp::SoftIsp()
+	: stride_(0), inputFormat_(0), outputFormat_(0),
+	  implementation_(nullptr), debayerRow_(nullptr), bitsPerSample_(0),
+	  pattern_{}, blackLevel_(0), gains_{}, ccm_{}
+{
+	setParams(Params());
+}
+
+/**
+ * \brief Retrieve the supported input formats
+ * \return The V4L2 pixel formats of the frames the ISP can process
+ */
+const std::vector<unsigned int> &SoftIsp::inputFormats()
+{
+	static std::vector<unsigned int> formats;
+
+	if (formats.empty()) {
+		for (const InputFormat &format : inputFormatsInfo)
+			formats.push_back(format.fourcc);
+	}
+
+	return formats;
+}
+
+/**
+ * \brief Retrieve the supported output formats
+ * \return The V4L2 pixel formats the ISP can output
+ */
+const std::vector<unsigned int> &SoftIsp::outputFormats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_RGB24,
+		V4L2_PIX_FMT_XRGB32,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the ISP for an input and output format
+ * \param[in] inputFormat The V4L2 pixel format of the raw frames
+ * \param[in] size The frame size in pixels
+ * \param[in] stride The length of the raw frame lines in bytes
+ * \param[in] outputFormat The V4L2 pixel format of the output frames
+ *
+ * The output frames have the same size as the input frames. Their lines and
+ * planes are contiguous in memory, without padding.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The formats or size aren't supported
+ */
+int SoftIsp::configure(unsigned int inputFormat, const Size &size,
+		       unsigned int stride, unsigned int outputFormat)
+{
+	const InputFormat *format = findInputFormat(inputFormat);
+	if (!format) {
+		LOG(SoftIsp, Error)
+			<< "Unsupported input format " << utils::hex(inputFormat);
+		return -EINVAL;
+	}
+
+	const std::vector<unsigned int> &outputs = outputFormats();
+	if (std::find(outputs.begin(), outputs.end(), outputFormat) == outputs.end()) {
+		LOG(SoftIsp, Error)
+			<< "Unsupported output format " << utils::hex(outputFormat);
+		return -EINVAL;
+	}
+
+	/* The demosaicing processes 2x2 blocks. */
+	if (size.width < 2 || size.height < 2 || size.width % 2 ||
+	    size.height % 2) {
+		LOG(SoftIsp, Error)
+			<< "Invalid frame size " << size.toString();
+		return -EINVAL;
+	}
+
+	int ret = unpacker_.configure(inputFormat, size, stride);
+	if (ret)
+		return ret;
+
+	const Implementation &impl = selectImplementation();
+	implementation_ = impl.name;
+	debayerRow_ = impl.debayerRow;
+
+	size_ = size;
+	stride_ = stride;
+	inputFormat_ = inputFormat;
+	outputFormat_ = outputFormat;
+	bitsPerSample_ = format->bitsPerSample;
+	pattern_ = format->pattern;
+
+	LOG(SoftIsp, Debug)
+		<< "Processing " << size_.toString() << "-" << utils::hex(inputFormat)
+		<< " to " << utils::hex(outputFormat) << " with "
+		<< implementation_ << " implementation";
+
+	return 0;
+}
+
+/**
+ * \brief Set the image processing parameters
+ * \param[in] params The parameters
+ *
+ * The parameters apply to the frames processed after this call. They shall not
+ * be changed while a frame is being processed.
+ */
+void SoftIsp::setParams(const Params &params)
+{
+	blackLevel_ = std::min(params.blackLevel, sampleMax - 1);
+
+	/* Stretch the range left after black level subtraction to 12 bits. */
+	float scale = static_cast<float>(sampleMax) / (sampleMax - blackLevel_);
+	for (unsigned int i = 0; i < gains_.size(); ++i)
+		gains_[i] = toFixed(std::min(params.gains[i] * scale, 16.0f));
+
+	for (unsigned int i = 0; i < ccm_.size(); ++i) {
+		float coeff = std::min(std::max(params.ccm[i], -8.0f), 8.0f);
+		ccm_[i] = std::round(coeff * 1024.0f);
+	}
+
+	float gamma = params.gamma > 0.0f ? params.gamma : 1.0f;
+	gammaLut_.resize(sampleMax + 1);
+	for (unsigned int i = 0; i <= sampleMax; ++i) {
+		float value = std::pow(static_cast<float>(i) / sampleMax, 1.0f / gamma);
+		gammaLut_[i] = clip(std::round(value * 255.0f));
+	}
+}
+
+/**
+ * \brief Process a frame
+ * \param[in] src The raw frame
+ * \param[out] dst The output buffer, of at least frameSize() bytes
+ * \param[out] stats The frame statistics, may be nullptr
+ * \param[in] pool The thread pool to process the stripes on, the pool shared
+ * by the process if nullptr
+ *
+ * The ISP shall be configured before use. This method returns when the whole
+ * frame has been processed.
+ */
+void SoftIsp::process(const uint8_t *src, uint8_t *dst, Statistics *stats,
+		      ThreadPool *pool) const
+{
+	if (!implementation_)
+		return;
+
+	if (!pool)
+		pool = ThreadPool::instance();
+
+	unsigned int count = (size_.height + stripeHeight - 1) / stripeHeight;
+	std::vector<Statistics> stripes(stats ? count : 0);
+
+	pool->parallelFor(count, [&](unsigned int i) {
+		process(src, dst, i * stripeHeight, stripeHeight,
+			stats ? &stripes[i] : nullptr);
+	});
+
+	if (!stats)
+		return;
+
+	stats->clear();
+	for (const Statistics &stripe : stripes)
+		stats->merge(stripe);
+}
+
+/**
+ * \brief Process a horizontal stripe of a frame
+ * \param[in] src The raw frame
+ * \param[out] dst The output buffer, of at least frameSize() bytes
+ * \param[in] first The index of the first line to process
+ * \param[in] count The number of lines to process
+ * \param[out] stats The statistics of the stripe, may be nullptr
+ *
+ * This method processes lines \a first to \a first + \a count - 1 only, \a
+ * first and \a count shall be even. The \a src and \a dst buffers point to the
+ * beginning of the full frames. As the ISP holds no per-frame state, stripes of
+ * the same frame can be processed concurrently from different threads.
+ */
+void SoftIsp::process(const uint8_t *src, uint8_t *dst, unsigned int first,
+		      unsigned int count, Statistics *stats) const
+{
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+	const unsigned int last = std::min(first + count, height);
+
+	if (!implementation_ || first >= last)
+		return;
+
+	/*
+	 * Rolling buffers for the padded input lines, the demosaiced line, and
+	 * the chroma sums of the lines pairs for NV12.
+	 */
+	std::vector<uint16_t> buffers((width + 2) * 3);
+	std::array<uint16_t *, 3> lines = {
+		&buffers[1], &buffers[width + 3], &buffers[2 * width + 5]
+	};
+	std::vector<uint16_t> planes(width * 3);
+	std::vector<uint16_t> chroma(outputFormat_ == V4L2_PIX_FMT_NV12 ? width / 2 * 3 : 0);
+
+	/* The lines outside of the frame are mirrored, preserving the CFA. */
+	auto line = [height](int y) -> unsigned int {
+		return y < 0 ? 1 : y >= static_cast<int>(height) ? height - 2 : y;
+	};
+
+	unpackRow(src, line(static_cast<int>(first) - 1), lines[(first + 2) % 3]);
+	unpackRow(src, first, lines[first % 3]);
+
+	for (unsigned int y = first; y < last; ++y) {
+		unpackRow(src, line(y + 1), lines[(y + 1) % 3]);
+
+		unsigned int parity = (y % 2) * 2;
+		unsigned int greenPos = pattern_[parity] == Green ? 0 : 1;
+		unsigned int colour = pattern_[parity + !greenPos];
+
+		uint16_t *x = &planes[0];
+		uint16_t *g = &planes[width];
+		uint16_t *z = &planes[width * 2];
+		debayerRow_(lines[(y + 2) % 3], lines[y % 3], lines[(y + 1) % 3],
+			    x, g, z, width, greenPos);
+
+		const uint16_t *r = colour == Red ? x : z;
+		const uint16_t *b = colour == Red ? z : x;
+
+		for (unsigned int i = 0; i < width; ++i) {
+			int red = r[i];
+			int green = g[i];
+			int blue = b[i];
+
+			if (stats) {
+				unsigned int luma = (red * 77 + green * 150 + blue * 29) >> 8;
+				stats->sum[Red] += red;
+				stats->sum[Green] += green;
+				stats->sum[Blue] += blue;
+				stats->histogram[luma * HISTOGRAM_BINS / (sampleMax + 1)]++;
+			}
+
+			int values[3];
+			for (unsigned int c = 0; c < 3; ++c) {
+				const int *m = &ccm_[c * 3];
+				int value = (m[0] * red + m[1] * green + m[2] * blue + 512) >> 10;
+				values[c] = gammaLut_[std::min(std::max(value, 0),
+							       static_cast<int>(sampleMax))];
+			}
+
+			switch (outputFormat_) {
+			case V4L2_PIX_FMT_XRGB32: {
+				uint8_t *pixel = dst + (y * width + i) * 4;
+				pixel[0] = values[Blue];
+				pixel[1] = values[Green];
+				pixel[2] = values[Red];
+				pixel[3] = 0xff;
+				break;
+			}
+			case V4L2_PIX_FMT_RGB24: {
+				uint8_t *pixel = dst + (y * width + i) * 3;
+				pixel[0] = values[Red];
+				pixel[1] = values[Green];
+				pixel[2] = values[Blue];
+				break;
+			}
+			case V4L2_PIX_FMT_NV12: {
+				dst[y * width + i] = ((66 * values[Red] + 129 * values[Green] +
+						       25 * values[Blue] + 128) >> 8) + 16;
+
+				/* Average the colours of 2x2 blocks for the chroma. */
+				uint16_t *sums = &chroma[i / 2 * 3];
+				bool start = y % 2 == 0 && i % 2 == 0;
+				for (unsigned int c = 0; c < 3; ++c)
+					sums[c] = start ? values[c] : sums[c] + values[c];
+
+				if (y % 2 == 0 || i % 2 == 0)
+					break;
+
+				int cr = (sums[Red] + 2) >> 2;
+				int cg = (sums[Green] + 2) >> 2;
+				int cb = (sums[Blue] + 2) >> 2;
+				uint8_t *uv = dst + width * height + y / 2 * width + i - 1;
+				uv[0] = ((-38 * cr - 74 * cg + 112 * cb + 128) >> 8) + 128;
+				uv[1] = ((112 * cr - 94 * cg - 18 * cb + 128) >> 8) + 128;
+				break;
+			}
+			}
+		}
+
+		if (stats)
+			stats->pixels += width;
+	}
+}
+
+/**
+ * \brief Retrieve the size of the output frames
+ * \return The output frame size in bytes
+ */
+unsigned int SoftIsp::frameSize() const
+{
+	unsigned int pixels = size_.width * size_.height;
+
+	switch (outputFormat_) {
+	case V4L2_PIX_FMT_NV12:
+		return pixels * 3 / 2;
+	case V4L2_PIX_FMT_RGB24:
+		return pixels * 3;
+	case V4L2_PIX_FMT_XRGB32:
+		return pixels * 4;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Unpack a raw line to 12-bit samples, subtracting the black level and
+ * applying the white balance gains. The destination is padded with one
+ * mirrored sample on each side for demosaicing.
+ */
+void SoftIsp::unpackRow(const uint8_t *src, unsigned int line,
+			uint16_t *dst) const
+{
+	const unsigned int width = size_.width;
+	const unsigned int shift = 12 - bitsPerSample_;
+
+	unpacker_.unpackLine(src + line * stride_, dst);
+
+	const unsigned int parity = (line % 2) * 2;
+	const unsigned int gains[2] = {
+		gains_[pattern_[parity]],
+		gains_[pattern_[parity + 1]],
+	};
+
+	for (unsigned int x = 0; x < width; ++x) {
+		unsigned int sample = dst[x] << shift;
+		unsigned int value = sample > blackLevel_ ? sample - blackLevel_ : 0;
+		dst[x] = std::min((value * gains[x & 1]) >> 10, sampleMax);
+	}
+
+	dst[-1] = dst[1];
+	dst[width] = dst[width - 2];
+}
+
+/**
+ * \fn SoftIsp::size()
+ * \brief Retrieve the configured frame size
+ * \return The frame size in pixels
+ */
+
+/**
+ * \fn SoftIsp::implementation()
+ * \brief Retrieve the name of the implementation used by the ISP
+ * \return The implementation name, or nullptr if the ISP isn't configured
+ */
+
+} /* namespace libcamera */
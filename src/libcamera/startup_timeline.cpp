@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * startup_timeline.cpp - Timeline of the startup and camera open phases
+ */
+
+#include "startup_timeline.h"
+
+#include <chrono>
+#include <inttypes.h>
+
+#include "log.h"
+#include "tracepoints.h"
+#include "utils.h"
+
+/**
+ * \file startup_timeline.h
+ * \brief Timeline of the startup and camera open phases
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(StartupTimeline)
+
+/**
+ * \class StartupTimeline
+ * \brief Record the phases leading to the first frame of the cameras
+ *
+ * The time to the first frame of a camera is spent in many phases, from the
+ * device enumeration and pipeline handlers matching in CameraManager::start(),
+ * to the camera configuration, buffer allocation and start, and the completion
+ * of the first request. The StartupTimeline records the start and end time of
+ * each phase, along with the subject of the phase, such as the pipeline
+ * handler, media device, sensor, IPA module or camera it applies to.
+ *
+ * The timeline is process-wide, as the phases are spread over objects that
+ * don't know about each other, and phases can be recorded concurrently from
+ * any thread. Phases are recorded with a Scope, or with record() for phases
+ * that span multiple calls. They are also emitted as startup_phase
+ * tracepoints.
+ *
+ * Only the first MAX_PHASES phases are retained, the timeline is meant to
+ * cover the startup of the process and the first capture sessions, not to
+ * grow with the process lifetime. Applications retrieve it with
+ * CameraManager::startupTimeline().
+ */
+
+/**
+ * \var StartupTimeline::MAX_PHASES
+ * \brief The maximum number of phases retained in the timeline
+ */
+
+/**
+ * \class StartupTimeline::Scope
+ * \brief Record a phase for the lifetime of the scope
+ *
+ * The phase starts when the Scope is constructed, and ends when it is
+ * destroyed.
+ */
+
+/**
+ * \brief Start a phase
+ * \param[in] name The phase name, which shall be a string literal
+ * \param[in] subject The subject of the phase
+ */
+StartupTimeline::Scope::Scope(const char *name, const std::string &subject)
+	: name_(name), subject_(subject), start_(now())
+{
+}
+
+StartupTimeline::Scope::~Scope()
+{
+	StartupTimeline::instance()->record(name_, subject_, start_, now());
+}
+
+/**
+ * \brief Retrieve the timeline instance
+ * \return The timeline instance
+ */
+StartupTimeline *StartupTimeline::instance()
+{
+	static StartupTimeline timeline;
+	return &timeline;
+}
+
+/**
+ * \brief Retrieve the current time
+ *
+ * The time is expressed in nanoseconds on the CLOCK_MONOTONIC clock, as the
+ * request timestamps.
+ *
+ * \return The current time in nanoseconds
+ */
+uint64_t StartupTimeline::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+}
+
+/**
+ * \brief Record a phase
+ * \param[in] name The phase name
+ * \param[in] subject The subject of the phase
+ * \param[in] start The phase start time, in nanoseconds
+ * \param[in] end The phase end time, in nanoseconds
+ *
+ * This method is thread-safe.
+ */
+void StartupTimeline::record(const char *name, const std::string &subject,
+			     uint64_t start, uint64_t end)
+{
+	LIBCAMERA_TRACEPOINT(startup_phase,
+			     "phase=%s subject=%s start=%" PRIu64 " end=%" PRIu64,
+			     name, subject.c_str(), start, end);
+
+	LOG(StartupTimeline, Debug)
+		<< name << " " << subject << ": " << (end - start) / 1000
+		<< "us";
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	if (phases_.size() >= MAX_PHASES)
+		return;
+
+	phases_.push_back({ name, subject, start, end });
+}
+
+/**
+ * \brief Retrieve the recorded phases
+ *
+ * This method is thread-safe.
+ *
+ * \return The phases, in the order they have completed
+ */
+std::vector<StartupPhase> StartupTimeline::phases() const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	return phases_;
+}
+
+} /* namespace libcamera */
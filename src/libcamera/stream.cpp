@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <array>
 #include <climits>
+#include <functional>
 #include <iomanip>
 #include <sstream>
 
@@ -82,6 +83,10 @@ LOG_DEFINE_CATEGORY(Stream)
  * size shall be considered to be supported until it has been verified using
  * CameraConfiguration::validate().
  *
+ * Pipeline handlers whose devices can produce compressed or tiled memory
+ * layouts additionally advertise, for each pixel format, the DRM format
+ * modifiers they support besides DRM_FORMAT_MOD_LINEAR.
+ *
  * \todo Review the usage patterns of this class, and cache the computed
  * pixelformats(), sizes() and range() if this would improve performances.
  */
@@ -99,6 +104,18 @@ StreamFormats::StreamFormats(const std::map<unsigned int, std::vector<SizeRange>
 {
 }
 
+/**
+ * \brief Construct a StreamFormats object with image formats and modifiers
+ * \param[in] formats A map of pixel formats to a sizes description
+ * \param[in] modifiers A map of pixel formats to the non-linear DRM format
+ * modifiers supported for them
+ */
+StreamFormats::StreamFormats(const std::map<unsigned int, std::vector<SizeRange>> &formats,
+			     const std::map<unsigned int, std::vector<uint64_t>> &modifiers)
+	: formats_(formats), modifiers_(modifiers)
+{
+}
+
 /**
  * \brief Retrieve the list of supported pixel formats
  * \return The list of supported pixel formats
@@ -266,6 +283,25 @@ SizeRange StreamFormats::range(unsigned int pixelformat) const
 	return range;
 }
 
+/**
+ * \brief Retrieve the DRM format modifiers supported for \a pixelformat
+ * \param[in] pixelformat Pixel format to retrieve modifiers for
+ *
+ * The linear layout, DRM_FORMAT_MOD_LINEAR, is supported for all pixel formats
+ * and isn't included in the list.
+ *
+ * \return The list of non-linear DRM format modifiers supported for \a
+ * pixelformat, empty if the stream only produces linear images
+ */
+std::vector<uint64_t> StreamFormats::modifiers(unsigned int pixelformat) const
+{
+	auto const it = modifiers_.find(pixelformat);
+	if (it == modifiers_.end())
+		return {};
+
+	return it->second;
+}
+
 /**
  * \enum MemoryType
  * \brief Define the memory type used by a Stream
@@ -275,6 +311,25 @@ SizeRange StreamFormats::range(unsigned int pixelformat) const
  * \var MemoryType::ExternalMemory
  * The Stream uses memory allocated externally by application and imported in
  * the library.
+ * \var MemoryType::UserPtrMemory
+ * The Stream uses memory allocated by the application and identified by CPU
+ * addresses, for devices that can't import dmabuf objects. The application
+ * sets the memory of each plane of the stream's buffers with
+ * Plane::setUserPtr() after allocating the buffers, and shall keep it valid
+ * until the buffers are freed.
+ */
+
+/**
+ * \enum StreamPriority
+ * \brief Define the priority of a stream when the system is overloaded
+ * \var StreamPriority::LowPriority
+ * The stream is throttled first when frames are dropped, such as a
+ * viewfinder or an analytics stream.
+ * \var StreamPriority::NormalPriority
+ * The stream is throttled when frames keep being dropped after throttling
+ * the low priority streams.
+ * \var StreamPriority::HighPriority
+ * The stream is never throttled, such as a video recording stream.
  */
 
 /**
@@ -290,7 +345,8 @@ SizeRange StreamFormats::range(unsigned int pixelformat) const
  * handlers provied StreamFormats.
  */
 StreamConfiguration::StreamConfiguration()
-	: pixelFormat(0), memoryType(InternalMemory), stream_(nullptr)
+	: pixelFormat(0), modifier(0), roi(), memoryType(InternalMemory), frameDecimation(1),
+	  priority(NormalPriority), stream_(nullptr)
 {
 }
 
@@ -298,8 +354,8 @@ StreamConfiguration::StreamConfiguration()
  * \brief Construct a configuration with stream formats
  */
 StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
-	: pixelFormat(0), memoryType(InternalMemory), stream_(nullptr),
-	  formats_(formats)
+	: pixelFormat(0), modifier(0), roi(), memoryType(InternalMemory), frameDecimation(1),
+	  priority(NormalPriority), stream_(nullptr), formats_(formats)
 {
 }
 
@@ -316,6 +372,37 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * format described in V4L2 using the V4L2_PIX_FMT_* definitions.
  */
 
+/**
+ * \var StreamConfiguration::modifier
+ * \brief Stream DRM format modifier
+ *
+ * The DRM format modifier, as defined by the DRM_FORMAT_MOD_* macros of
+ * drm_fourcc.h, describes the memory layout of the images, such as tiled or
+ * compressed (AFBC) layouts. Compressed frames can be passed as-is to the
+ * encoders and displays that support the same modifier, without ever writing
+ * linear pixels to memory.
+ *
+ * The default value of 0, DRM_FORMAT_MOD_LINEAR, selects the linear layout
+ * described by the pixel format. Cameras reset the modifier to linear at
+ * validation time when it isn't listed in the formats() of the stream for
+ * the pixel format.
+ */
+
+/**
+ * \var StreamConfiguration::roi
+ * \brief Region of interest of the sensor pixel array to capture
+ *
+ * The region of interest is expressed in pixels in the coordinates of the
+ * sensor pixel array at its full resolution. When set, cameras that support it
+ * crop the pixel array, and bin it when possible, at the sensor level, to only
+ * transfer the region of interest and lower the bus bandwidth. The stream is
+ * then scaled from the region of interest to the stream size.
+ *
+ * An empty rectangle, the default, selects the full field of view. Cameras that
+ * support sensor cropping adjust the region of interest at validation time to
+ * the crop rectangle that the sensor will use, other cameras ignore it.
+ */
+
 /**
  * \var StreamConfiguration::memoryType
  * \brief The memory type the stream shall use
@@ -326,6 +413,37 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * \brief Requested number of buffers to allocate for the stream
  */
 
+/**
+ * \var StreamConfiguration::frameDecimation
+ * \brief Capture one frame out of every \a frameDecimation frames
+ *
+ * Streams that don't need the full camera frame rate, such as a viewfinder
+ * running alongside a video recording stream, can be decimated to lower the
+ * memory bandwidth and CPU time they consume. The stream then only captures
+ * the frames whose sequence number is a multiple of \a frameDecimation. On the
+ * other frames, the stream buffers of the requests are not queued to the
+ * device, and complete immediately with the Buffer::BufferSkipped status.
+ * Applications can thus keep queueing identical requests for all frames.
+ *
+ * The default value of 1 captures all frames. Cameras that don't support
+ * decimation reset the value to 1 at validation time.
+ */
+
+/**
+ * \var StreamConfiguration::priority
+ * \brief The priority of the stream under memory bandwidth pressure
+ *
+ * When a camera drops frames, typically because concurrent cameras and
+ * encoders exceed the memory bandwidth, or falls behind the frame rate under
+ * CPU contention, it throttles its low priority streams first to keep its high
+ * priority streams at the full frame rate. Throttled
+ * streams are decimated further than their configured frameDecimation, and
+ * the throttling level is reported in the controls::QosLevel metadata of the
+ * requests.
+ *
+ * Cameras that don't support frame decimation ignore the priority.
+ */
+
 /**
  * \fn StreamConfiguration::stream()
  * \brief Retrieve the stream associated with the configuration
@@ -369,6 +487,8 @@ std::string StreamConfiguration::toString() const
 {
 	std::stringstream ss;
 	ss << size.toString() << "-" << utils::hex(pixelFormat);
+	if (modifier)
+		ss << "-" << utils::hex(modifier);
 	return ss.str();
 }
 
@@ -383,6 +503,9 @@ std::string StreamConfiguration::toString() const
  * \var StillCapture
  * The stream is intended to capture high-resolution, high-quality still images
  * with low frame rate. The captured frames may be exposed with flash.
+ * \var StillCaptureRaw
+ * The stream is intended to capture unprocessed images in the native format
+ * of the camera sensor, typically for offline processing by the application.
  * \var VideoRecording
  * The stream is intended to capture video for the purpose of recording or
  * streaming. The video stream may produce a high frame rate and may be
@@ -420,6 +543,8 @@ std::string StreamConfiguration::toString() const
  * \brief Construct a stream with default parameters
  */
 Stream::Stream()
+	: heldBuffers_(0), starvationCount_(0), queueDepth_(0),
+	  maxQueueDepth_(0), framesCompleted_(0), framesDropped_(0)
 {
 }
 
@@ -494,6 +619,132 @@ std::unique_ptr<Buffer> Stream::createBuffer(const std::array<int, 3> &fds)
 	return std::unique_ptr<Buffer>(buffer);
 }
 
+/**
+ * \brief Import dmabuf file descriptors as a recyclable Buffer
+ * \param[in] fds The dmabuf file descriptors for each plane
+ *
+ * This method creates a recyclable Buffer that references the memory area
+ * identified by the dmabuf \a fds. Unlike buffers created with
+ * createBuffer(const std::array<int, 3> &), the imported buffer is owned by the
+ * stream and is added to requests with Request::addBuffer(Buffer *), without
+ * any memory allocation. The identity of its dmabuf objects is computed once at
+ * import time, and mapping the buffer to buffer memory when it is queued is
+ * then a cache lookup only.
+ *
+ * This is meant for applications that cycle a fixed set of externally
+ * allocated buffers, and can cache the imported buffer for each of them. The
+ * buffer stays valid until it is released with releaseBuffer() or the stream
+ * buffers are freed.
+ *
+ * This method is only valid for streams that use the ExternalMemory type. It
+ * will return a null pointer when called on streams using other memory types.
+ *
+ * \return The imported Buffer on success or nullptr otherwise
+ */
+Buffer *Stream::importBuffer(const std::array<int, 3> &fds)
+{
+	if (memoryType_ != ExternalMemory) {
+		LOG(Stream, Error) << "Invalid stream memory type";
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> locker(bufferCacheMutex_);
+
+	importedBuffers_.emplace_back();
+	Buffer *buffer = &importedBuffers_.back();
+	buffer->dmabuf_ = fds;
+	buffer->stream_ = this;
+	buffer->recyclable_ = true;
+
+	BufferCacheEntry &entry = importedIds_[buffer];
+	entry.valid = identify(fds, &entry.id);
+
+	return buffer;
+}
+
+/**
+ * \brief Release a buffer imported with importBuffer()
+ * \param[in] buffer The imported buffer
+ *
+ * The \a buffer is deleted and shall not be used anymore. It shall not be part
+ * of a request.
+ */
+void Stream::releaseBuffer(Buffer *buffer)
+{
+	std::lock_guard<std::mutex> locker(bufferCacheMutex_);
+
+	if (!importedIds_.erase(buffer))
+		return;
+
+	importedBuffers_.remove_if([buffer](const Buffer &imported) {
+		return &imported == buffer;
+	});
+}
+
+/**
+ * \brief Retrieve the recyclable Buffer instance for the memory buffer \a index
+ * \param[in] index The desired buffer index
+ *
+ * Streams using the InternalMemory type preconstruct one Buffer instance for
+ * each BufferMemory in the stream's buffers pool when the camera is
+ * configured. This method retrieves the instance corresponding to \a index.
+ *
+ * The returned buffer is owned by the stream and stays valid until the stream
+ * buffers are freed. It is added to a request with Request::addBuffer(Buffer *)
+ * and isn't deleted when the request completes, allowing applications to add
+ * it to a new request from the request completion handler without any memory
+ * allocation. A recyclable buffer can only be part of a single request at a
+ * time.
+ *
+ * This method is only valid for streams that use the InternalMemory or
+ * UserPtrMemory types. It will return a null pointer when called on streams
+ * using the ExternalMemory type.
+ *
+ * \return The Buffer instance on success or nullptr otherwise
+ */
+Buffer *Stream::buffer(unsigned int index)
+{
+	if (memoryType_ == ExternalMemory) {
+		LOG(Stream, Error) << "Invalid stream memory type";
+		return nullptr;
+	}
+
+	if (index >= recyclableBuffers_.size()) {
+		LOG(Stream, Error) << "Invalid buffer index " << index;
+		return nullptr;
+	}
+
+	return &recyclableBuffers_[index];
+}
+
+/**
+ * \fn Stream::heldBuffers()
+ * \brief Retrieve the number of recyclable buffers currently held
+ * \sa BufferRef
+ * \return The number of held buffers
+ */
+
+/**
+ * \fn Stream::starvationCount()
+ * \brief Retrieve the number of times a held buffer prevented queueing
+ *
+ * The starvation count is incremented every time Request::addBuffer() or
+ * Camera::queueRequest() rejects a buffer of the stream because it is held by
+ * a BufferRef. A non-zero count indicates that consumers are holding buffers
+ * for longer than the pipeline can sustain, and that the buffer pool should be
+ * enlarged or consumers sped up.
+ *
+ * \return The number of rejected queueing attempts
+ */
+
+/**
+ * \var Stream::bufferReleased
+ * \brief Signal emitted when the last hold on a buffer is released
+ *
+ * This signal is emitted from the thread releasing the last BufferRef holding
+ * the buffer. The buffer can be added to a request again from that point.
+ */
+
 /**
  * \fn Stream::bufferPool()
  * \brief Retrieve the buffer pool for the stream
@@ -534,9 +785,24 @@ std::unique_ptr<Buffer> Stream::createBuffer(const std::array<int, 3> &fds)
  * The buffer memory to use, once the \a buffer reaches the video device,
  * is selected using the index assigned to the \a buffer and to minimize
  * relocations in the V4L2 back-end, this operation provides a best-effort
- * caching mechanism that associates to the dmabuf file descriptors contained
- * in the \a buffer the index of the buffer memory that was lastly queued with
- * those file descriptors set.
+ * caching mechanism that associates the dmabuf objects contained in the \a
+ * buffer with the index of the buffer memory that was lastly queued with
+ * those dmabuf objects.
+ *
+ * Dmabuf objects are identified by the device and inode numbers of their file
+ * descriptors, not by the file descriptor numbers, as the same dmabuf can be
+ * referenced by different file descriptors over time and a file descriptor
+ * number can be reused for a different dmabuf after being closed. As the buffer
+ * memory duplicates the file descriptors it is given, cached dmabuf objects
+ * are kept alive and their identity can't be reused while they are in the
+ * cache. On kernels older than v5.3 dmabuf objects have no unique identity,
+ * and every mapping is a cache miss.
+ *
+ * On a cache hit the buffer memory is reused as-is, preserving its planes and
+ * their CPU mappings, and the V4L2 back-end sees the same dmabuf queued at the
+ * same index. On a miss the least recently used buffer memory is evicted and
+ * its planes are replaced. Cache entries are moved between the free and mapped
+ * lists, a hit doesn't allocate memory.
  *
  * If the Stream uses internally allocated memory, the index of the memory
  * buffer to use will match the one request at Stream::createBuffer(unsigned int)
@@ -550,43 +816,60 @@ int Stream::mapBuffer(const Buffer *buffer)
 {
 	ASSERT(memoryType_ == ExternalMemory);
 
+	std::lock_guard<std::mutex> locker(bufferCacheMutex_);
+
 	if (bufferCache_.empty())
 		return -ENOMEM;
 
 	const std::array<int, 3> &dmabufs = buffer->dmabufs();
 
+	/* The identity of imported buffers is computed at import time. */
+	BufferCacheEntry entry;
+	auto imported = importedIds_.find(buffer);
+	if (imported != importedIds_.end())
+		entry = imported->second;
+	else
+		entry.valid = identify(dmabufs, &entry.id);
+
 	/*
-	 * Try to find a previously mapped buffer in the cache. If we miss, use
-	 * the oldest entry in the cache.
+	 * Try to find a previously mapped buffer in the free entries of the
+	 * cache. If we hit, the buffer memory already references the same
+	 * dmabuf objects and can be used as-is. The index keeps pointing to
+	 * the entry while it is mapped.
 	 */
-	auto map = std::find_if(bufferCache_.begin(), bufferCache_.end(),
-				[&](std::pair<std::array<int, 3>, unsigned int> &entry) {
-					return entry.first == dmabufs;
-				});
-	if (map == bufferCache_.end())
-		map = bufferCache_.begin();
+	auto hit = entry.valid ? bufferCacheIndex_.find(entry.id)
+			       : bufferCacheIndex_.end();
+	if (hit != bufferCacheIndex_.end()) {
+		BufferCacheList::iterator map = hit->second;
+		if (mappedBuffers_[map->index] == mappedCache_.end()) {
+			mappedCache_.splice(mappedCache_.end(), bufferCache_, map);
+			mappedBuffers_[map->index] = map;
+			return map->index;
+		}
+	}
 
 	/*
-	 * Update the dmabuf file descriptors of the entry. We can't assume that
-	 * identical file descriptor numbers refer to the same dmabuf object as
-	 * it may have been closed and its file descriptor reused. We thus need
-	 * to update the plane's internally cached mmap()ed memory.
+	 * If we miss, evict the least recently used entry, at the front of the
+	 * cache, and update the dmabuf file descriptors of its buffer memory.
+	 * When the same dmabuf objects are already mapped through another
+	 * entry, leave the new entry out of the index.
 	 */
-	unsigned int index = map->second;
-	BufferMemory *mem = &bufferPool_.buffers()[index];
-	mem->planes().clear();
+	bool duplicate = hit != bufferCacheIndex_.end();
+	BufferCacheList::iterator map = bufferCache_.begin();
+	if (map->valid)
+		bufferCacheIndex_.erase(map->id);
 
-	for (unsigned int i = 0; i < dmabufs.size(); ++i) {
-		if (dmabufs[i] == -1)
-			break;
+	map->id = entry.id;
+	map->valid = entry.valid && !duplicate;
+	if (map->valid)
+		bufferCacheIndex_.emplace(map->id, map);
 
-		mem->planes().emplace_back();
-		mem->planes().back().setDmabuf(dmabufs[i], 0);
-	}
+	mappedCache_.splice(mappedCache_.end(), bufferCache_, map);
+	mappedBuffers_[map->index] = map;
+
+	setDmabufs(&bufferPool_.buffers()[map->index], dmabufs);
 
-	/* Remove the buffer from the cache and return its index. */
-	bufferCache_.erase(map);
-	return index;
+	return map->index;
 }
 
 /**
@@ -594,13 +877,77 @@ int Stream::mapBuffer(const Buffer *buffer)
  * \param[in] buffer The buffer to unmap
  *
  * This method releases the buffer memory entry that was mapped by mapBuffer(),
- * making it available for new mappings.
+ * making it available for new mappings. The entry is stored in the cache as the
+ * most recently used one.
  */
 void Stream::unmapBuffer(const Buffer *buffer)
 {
 	ASSERT(memoryType_ == ExternalMemory);
 
-	bufferCache_.emplace_back(buffer->dmabufs(), buffer->index());
+	std::lock_guard<std::mutex> locker(bufferCacheMutex_);
+
+	BufferCacheList::iterator &map = mappedBuffers_[buffer->index()];
+	if (map == mappedCache_.end())
+		return;
+
+	bufferCache_.splice(bufferCache_.end(), mappedCache_, map);
+	map = mappedCache_.end();
+}
+
+/**
+ * \brief Compute the identity of the dmabuf objects of a buffer
+ * \param[in] fds The dmabuf file descriptors for each plane
+ * \param[out] id The dmabuf identity
+ *
+ * \return True if the identity of all dmabuf objects could be computed, false
+ * otherwise
+ */
+bool Stream::identify(const std::array<int, 3> &fds, DmabufIdentity *id)
+{
+	for (unsigned int i = 0; i < fds.size(); ++i) {
+		std::pair<uint64_t, uint64_t> &plane = id->planes[i];
+
+		if (fds[i] == -1) {
+			plane = { 0, 0 };
+			continue;
+		}
+
+		if (!utils::dmabuf_identity(fds[i], &plane.first, &plane.second))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Replace the planes of buffer memory with dmabuf file descriptors
+ * \param[in] mem The buffer memory
+ * \param[in] fds The dmabuf file descriptors for each plane
+ */
+void Stream::setDmabufs(BufferMemory *mem, const std::array<int, 3> &fds)
+{
+	mem->planes().clear();
+
+	for (unsigned int i = 0; i < fds.size(); ++i) {
+		if (fds[i] == -1)
+			break;
+
+		mem->planes().emplace_back();
+		mem->planes().back().setDmabuf(fds[i], 0);
+	}
+}
+
+std::size_t Stream::DmabufIdentityHash::operator()(const DmabufIdentity &id) const
+{
+	std::hash<uint64_t> hasher;
+	std::size_t hash = 0;
+
+	for (const std::pair<uint64_t, uint64_t> &plane : id.planes) {
+		hash ^= hasher(plane.first) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+		hash ^= hasher(plane.second) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	}
+
+	return hash;
 }
 
 /**
@@ -619,17 +966,47 @@ void Stream::createBuffers(MemoryType memory, unsigned int count)
 	memoryType_ = memory;
 	bufferPool_.createBuffers(count);
 
-	/* Streams with internal memory usage do not need buffer mapping. */
-	if (memoryType_ == InternalMemory)
+	addBuffers(0, count);
+}
+
+/**
+ * \brief Prepare buffers added to the stream's buffer pool for use
+ * \param[in] first The index of the first added buffer
+ * \param[in] count The number of added buffers
+ *
+ * Create the recyclable buffers for streams using internal or user pointer
+ * memory, or add the new buffer memory entries to the mapping cache for
+ * streams using external memory.
+ */
+void Stream::addBuffers(unsigned int first, unsigned int count)
+{
+	/*
+	 * Streams with internal or user pointer memory usage do not need
+	 * buffer mapping, but provide recyclable buffers. Adding elements at
+	 * the end of a deque doesn't invalidate references to existing buffers.
+	 */
+	if (memoryType_ != ExternalMemory) {
+		for (unsigned int i = first; i < first + count; ++i) {
+			recyclableBuffers_.emplace_back(i);
+			Buffer &buffer = recyclableBuffers_.back();
+			buffer.stream_ = this;
+			buffer.recyclable_ = true;
+		}
+
 		return;
+	}
 
 	/*
-	 * Prepare for buffer mapping by adding all buffer memory entries to the
-	 * cache.
+	 * Prepare for buffer mapping by adding the buffer memory entries to the
+	 * cache. Unused entries are added at the front to be used first.
 	 */
-	bufferCache_.clear();
-	for (unsigned int i = 0; i < bufferPool_.count(); ++i)
-		bufferCache_.emplace_back(std::array<int, 3>{ -1, -1, -1 }, i);
+	for (unsigned int i = first; i < first + count; ++i) {
+		BufferCacheEntry entry = {};
+		entry.index = i;
+		bufferCache_.push_front(entry);
+	}
+
+	mappedBuffers_.resize(first + count, mappedCache_.end());
 }
 
 /**
@@ -640,9 +1017,78 @@ void Stream::createBuffers(MemoryType memory, unsigned int count)
  */
 void Stream::destroyBuffers()
 {
+	if (heldBuffers_)
+		LOG(Stream, Warning)
+			<< "Destroying buffers while " << heldBuffers_
+			<< " are held";
+
+	recyclableBuffers_.clear();
+	importedBuffers_.clear();
+	importedIds_.clear();
+	heldBuffers_ = 0;
+	starvationCount_ = 0;
+	bufferCacheIndex_.clear();
+	bufferCache_.clear();
+	mappedCache_.clear();
+	mappedBuffers_.clear();
 	bufferPool_.destroyBuffers();
 }
 
+/**
+ * \brief Reset the runtime statistics of the stream
+ *
+ * The statistics are reset by the Camera when starting a capture session. The
+ * buffers queued to the stream at that time, if any, are not accounted for.
+ *
+ * \sa Camera::statistics()
+ */
+void Stream::resetStatistics()
+{
+	queueDepth_.store(0, std::memory_order_relaxed);
+	maxQueueDepth_.store(0, std::memory_order_relaxed);
+	framesCompleted_.store(0, std::memory_order_relaxed);
+	framesDropped_.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * \brief Account for a buffer queued to the stream
+ *
+ * Increment the queue depth of the stream and update its maximum.
+ */
+void Stream::bufferQueued()
+{
+	unsigned int depth = queueDepth_.fetch_add(1, std::memory_order_relaxed) + 1;
+	unsigned int max = maxQueueDepth_.load(std::memory_order_relaxed);
+	while (depth > max &&
+	       !maxQueueDepth_.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+		;
+}
+
+/**
+ * \brief Account for a buffer of the stream that has completed
+ * \param[in] buffer The buffer
+ *
+ * Decrement the queue depth of the stream and, if the \a buffer has been
+ * captured successfully, increment the number of completed frames. The frames
+ * dropped by the device are accounted for by the PipelineHandler.
+ */
+void Stream::bufferCompleted(const Buffer *buffer)
+{
+	/*
+	 * Buffers queued before the statistics have been reset may complete
+	 * after, don't let the depth wrap around.
+	 */
+	unsigned int depth = queueDepth_.load(std::memory_order_relaxed);
+	while (depth &&
+	       !queueDepth_.compare_exchange_weak(depth, depth - 1, std::memory_order_relaxed))
+		;
+
+	if (buffer->status() != Buffer::BufferSuccess)
+		return;
+
+	framesCompleted_.fetch_add(1, std::memory_order_relaxed);
+}
+
 /**
  * \var Stream::bufferPool_
  * \brief The pool of buffers associated with the stream
@@ -7,14 +7,29 @@
 
 #include "thread.h"
 
+#include <algorithm>
 #include <atomic>
+#include <errno.h>
 #include <list>
+#include <memory>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
 
 #include <libcamera/event_dispatcher.h>
 
+#include "event_dispatcher_epoll.h"
+#ifdef HAVE_IO_URING
+#include "event_dispatcher_io_uring.h"
+#endif
 #include "event_dispatcher_poll.h"
 #include "log.h"
 #include "message.h"
+#include "tracepoints.h"
+#include "utils.h"
 
 /**
  * \file thread.h
@@ -29,20 +44,151 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted to the queue from any thread without locking, by pushing
+ * them to a lock-free intrusive stack. The thread owning the queue collects the
+ * posted messages into an intrusive FIFO list, protected by the mutex, from
+ * which they are dispatched or removed. Posting a message thus requires no
+ * memory allocation and never contends with message dispatching.
+ *
+ * The wakeup pending flag coalesces the event dispatcher interruptions. Only
+ * the first message posted after the owning thread has started collecting
+ * messages interrupts the event dispatcher.
  */
 class MessageQueue
 {
 public:
+	MessageQueue()
+		: wakeupPending_(false), posted_(nullptr), head_(nullptr),
+		  tail_(nullptr)
+	{
+	}
+
+	~MessageQueue()
+	{
+		collect();
+
+		while (Message *msg = takeFirst())
+			delete msg;
+	}
+
+	bool post(Message *msg);
+	void collect();
+	Message *takeFirst();
+	Message *take(Object *receiver);
+
 	/**
-	 * \brief List of queued Message instances
+	 * \brief Protects the list of collected messages
 	 */
-	std::list<std::unique_ptr<Message>> list_;
+	Mutex mutex_;
 	/**
-	 * \brief Protects the \ref list_
+	 * \brief Set when the event dispatcher has been interrupted
 	 */
-	Mutex mutex_;
+	std::atomic<bool> wakeupPending_;
+
+private:
+	std::atomic<Message *> posted_;
+	Message *head_;
+	Message *tail_;
 };
 
+/**
+ * \brief Post a message to the queue
+ * \param[in] msg The message, ownership is transferred to the queue
+ * \return True if the event dispatcher needs to be interrupted, false if an
+ * interruption is already pending
+ */
+bool MessageQueue::post(Message *msg)
+{
+	Message *head = posted_.load(std::memory_order_relaxed);
+	do {
+		msg->next_ = head;
+	} while (!posted_.compare_exchange_weak(head, msg));
+
+	return !wakeupPending_.exchange(true);
+}
+
+/**
+ * \brief Move the posted messages to the end of the list, in posting order
+ *
+ * The caller shall hold the mutex_.
+ */
+void MessageQueue::collect()
+{
+	Message *posted = posted_.exchange(nullptr);
+	if (!posted)
+		return;
+
+	/* The stack holds the messages in reverse order. */
+	Message *first = nullptr;
+	Message *last = posted;
+	while (posted) {
+		Message *next = posted->next_;
+		posted->next_ = first;
+		first = posted;
+		posted = next;
+	}
+
+	if (tail_)
+		tail_->next_ = first;
+	else
+		head_ = first;
+	tail_ = last;
+}
+
+/**
+ * \brief Remove the first message from the list
+ *
+ * The caller shall hold the mutex_.
+ *
+ * \return The first message, or nullptr if the list is empty
+ */
+Message *MessageQueue::takeFirst()
+{
+	Message *msg = head_;
+	if (!msg)
+		return nullptr;
+
+	head_ = msg->next_;
+	if (!head_)
+		tail_ = nullptr;
+
+	msg->next_ = nullptr;
+	return msg;
+}
+
+/**
+ * \brief Remove the first message for \a receiver from the list
+ * \param[in] receiver The receiver
+ *
+ * The caller shall hold the mutex_.
+ *
+ * \return The first message for \a receiver, or nullptr if the list contains
+ * no message for \a receiver
+ */
+Message *MessageQueue::take(Object *receiver)
+{
+	Message *prev = nullptr;
+
+	for (Message *msg = head_; msg; prev = msg, msg = msg->next_) {
+		if (msg->receiver_ != receiver)
+			continue;
+
+		if (prev)
+			prev->next_ = msg->next_;
+		else
+			head_ = msg->next_;
+
+		if (tail_ == msg)
+			tail_ = prev;
+
+		msg->next_ = nullptr;
+		return msg;
+	}
+
+	return nullptr;
+}
+
 /**
  * \brief Thread-local internal data
  */
@@ -50,7 +196,8 @@ class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), tid_(0),
+		  dispatcher_(nullptr)
 	{
 	}
 
@@ -62,6 +209,8 @@ private:
 
 	Thread *thread_;
 	bool running_;
+	pid_t tid_;
+	ThreadScheduling scheduling_;
 
 	Mutex mutex_;
 
@@ -82,6 +231,7 @@ public:
 	ThreadMain()
 	{
 		data_->running_ = true;
+		data_->tid_ = syscall(SYS_gettid);
 	}
 
 protected:
@@ -92,6 +242,54 @@ protected:
 };
 
 static thread_local ThreadData *currentThreadData = nullptr;
+
+namespace {
+
+int applyScheduling(pid_t tid, const ThreadScheduling &scheduling)
+{
+	struct sched_param param = {};
+	int policy;
+
+	switch (scheduling.policy) {
+	case ThreadScheduling::PolicyFifo:
+		policy = SCHED_FIFO;
+		param.sched_priority = scheduling.priority;
+		break;
+	case ThreadScheduling::PolicyRoundRobin:
+		policy = SCHED_RR;
+		param.sched_priority = scheduling.priority;
+		break;
+	case ThreadScheduling::PolicyOther:
+	default:
+		policy = SCHED_OTHER;
+		break;
+	}
+
+	if (sched_setscheduler(tid, policy, &param) < 0)
+		return -errno;
+
+	if (policy == SCHED_OTHER &&
+	    setpriority(PRIO_PROCESS, tid, scheduling.nice) < 0)
+		return -errno;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if (scheduling.cpus.empty()) {
+		for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			CPU_SET(cpu, &cpus);
+	} else {
+		for (unsigned int cpu : scheduling.cpus)
+			CPU_SET(cpu, &cpus);
+	}
+
+	if (sched_setaffinity(tid, sizeof(cpus), &cpus) < 0)
+		return -errno;
+
+	return 0;
+}
+
+} /* namespace */
 static ThreadMain mainThread;
 
 /**
@@ -131,8 +329,12 @@ ThreadData *ThreadData::current()
  *
  * Thread instances by default run an event loop until the exit() method is
  * called. A custom event dispatcher may be installed with
- * setEventDispatcher(), otherwise a poll-based event dispatcher is used. This
- * behaviour can be overriden by overloading the run() method.
+ * setEventDispatcher(), otherwise a poll-based event dispatcher is used, or an
+ * epoll-based or io_uring-based event dispatcher if the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable is set to "epoll" or
+ * "io_uring" respectively. The poll-based event dispatcher is used as a
+ * fallback when io_uring isn't available. This behaviour can be overriden by
+ * overloading the run() method.
  */
 
 /**
@@ -191,6 +393,20 @@ void Thread::startThread()
 
 	currentThreadData = data_;
 
+	MutexLocker locker(data_->mutex_);
+	data_->tid_ = syscall(SYS_gettid);
+
+	if (!data_->scheduling_.isDefault()) {
+		int ret = applyScheduling(data_->tid_, data_->scheduling_);
+		if (ret < 0)
+			LOG(Thread, Error)
+				<< "Failed to set thread scheduling to "
+				<< data_->scheduling_.toString() << ": "
+				<< strerror(-ret);
+	}
+
+	locker.unlock();
+
 	run();
 }
 
@@ -239,6 +455,7 @@ void Thread::finishThread()
 {
 	data_->mutex_.lock();
 	data_->running_ = false;
+	data_->tid_ = 0;
 	data_->mutex_.unlock();
 
 	finished.emit(this);
@@ -293,6 +510,79 @@ bool Thread::isRunning()
 	return data_->running_;
 }
 
+/**
+ * \brief Set the scheduling parameters of the thread
+ * \param[in] scheduling The scheduling parameters
+ *
+ * This method sets the scheduling policy, priority and CPU affinity of the
+ * thread. If the thread is running the parameters are applied immediately,
+ * otherwise they are stored and applied when the thread is started. Failure to
+ * apply the parameters when the thread starts is logged, and the thread then
+ * runs with its inherited scheduling.
+ *
+ * For the main thread, the parameters apply to the thread that loaded
+ * libcamera.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The scheduling parameters are invalid
+ * \retval -EPERM The process isn't allowed to use the scheduling parameters
+ */
+int Thread::setScheduling(const ThreadScheduling &scheduling)
+{
+	if (scheduling.policy != ThreadScheduling::PolicyOther) {
+		int policy = scheduling.policy == ThreadScheduling::PolicyFifo
+			   ? SCHED_FIFO : SCHED_RR;
+		if (scheduling.priority < sched_get_priority_min(policy) ||
+		    scheduling.priority > sched_get_priority_max(policy)) {
+			LOG(Thread, Error)
+				<< "Invalid real-time priority " << scheduling.priority;
+			return -EINVAL;
+		}
+	}
+
+	if (scheduling.nice < -20 || scheduling.nice > 19) {
+		LOG(Thread, Error) << "Invalid nice value " << scheduling.nice;
+		return -EINVAL;
+	}
+
+	for (unsigned int cpu : scheduling.cpus) {
+		if (cpu >= CPU_SETSIZE) {
+			LOG(Thread, Error) << "Invalid CPU " << cpu;
+			return -EINVAL;
+		}
+	}
+
+	MutexLocker locker(data_->mutex_);
+
+	if (data_->tid_) {
+		int ret = applyScheduling(data_->tid_, scheduling);
+		if (ret < 0) {
+			LOG(Thread, Error)
+				<< "Failed to set thread scheduling to "
+				<< scheduling.toString() << ": " << strerror(-ret);
+			return ret;
+		}
+	}
+
+	data_->scheduling_ = scheduling;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the scheduling parameters of the thread
+ *
+ * The returned parameters are the ones set with setScheduling(), and don't
+ * reflect scheduling changes performed outside of libcamera.
+ *
+ * \return The scheduling parameters of the thread
+ */
+ThreadScheduling Thread::scheduling()
+{
+	MutexLocker locker(data_->mutex_);
+	return data_->scheduling_;
+}
+
 /**
  * \var Thread::finished
  * \brief Signal the end of thread execution
@@ -336,8 +626,10 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
  * \brief Retrieve the event dispatcher
  *
  * This method retrieves the event dispatcher set with setEventDispatcher().
- * If no dispatcher has been set, a default poll-based implementation is created
- * and returned, and no custom event dispatcher may be installed anymore.
+ * If no dispatcher has been set, a default implementation is created and
+ * returned, and no custom event dispatcher may be installed anymore. The
+ * default implementation is poll-based, or epoll-based if the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable is set to "epoll".
  *
  * The returned event dispatcher is valid until the thread is destroyed.
  *
@@ -345,9 +637,33 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
  */
 EventDispatcher *Thread::eventDispatcher()
 {
-	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
-					 std::memory_order_release);
+	if (!data_->dispatcher_.load(std::memory_order_relaxed)) {
+		const char *type = utils::secure_getenv("LIBCAMERA_EVENT_DISPATCHER");
+		EventDispatcher *dispatcher;
+
+		if (type && !strcmp(type, "epoll"))
+			dispatcher = new EventDispatcherEpoll();
+		else
+			dispatcher = nullptr;
+
+#ifdef HAVE_IO_URING
+		if (type && !strcmp(type, "io_uring")) {
+			EventDispatcherIOUring *ioUring = new EventDispatcherIOUring();
+			if (ioUring->isValid()) {
+				dispatcher = ioUring;
+			} else {
+				LOG(Thread, Warning)
+					<< "io_uring not available, falling back to poll";
+				delete ioUring;
+			}
+		}
+#endif
+
+		if (!dispatcher)
+			dispatcher = new EventDispatcherPoll();
+
+		data_->dispatcher_.store(dispatcher, std::memory_order_release);
+	}
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
 }
@@ -375,10 +691,16 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
+	LIBCAMERA_TRACEPOINT(message_post, "type=%d receiver=%p",
+			     msg->type(), receiver);
+
+	/*
+	 * Account for the message before posting it, as it can be dispatched
+	 * as soon as it is posted.
+	 */
 	receiver->pendingMessages_++;
-	locker.unlock();
+	if (!data_->messages_.post(msg.release()))
+		return;
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -396,24 +718,20 @@ void Thread::removeMessages(Object *receiver)
 {
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
+	MessageQueue &queue = data_->messages_;
+	MutexLocker locker(queue.mutex_);
 	if (!receiver->pendingMessages_)
 		return;
 
+	/*
+	 * Move the messages to the pending deletion list to delete them after
+	 * releasing the lock.
+	 */
 	std::vector<std::unique_ptr<Message>> toDelete;
-	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
-		if (!msg)
-			continue;
-		if (msg->receiver_ != receiver)
-			continue;
 
-		/*
-		 * Move the message to the pending deletion list to delete it
-		 * after releasing the lock. The messages list element will
-		 * contain a null pointer, and will be removed when dispatching
-		 * messages.
-		 */
-		toDelete.push_back(std::move(msg));
+	queue.collect();
+	while (Message *msg = queue.take(receiver)) {
+		toDelete.emplace_back(msg);
 		receiver->pendingMessages_--;
 	}
 
@@ -428,17 +746,66 @@ void Thread::removeMessages(Object *receiver)
  */
 void Thread::dispatchMessages()
 {
-	MutexLocker locker(data_->messages_.mutex_);
+	MessageQueue &queue = data_->messages_;
 
-	while (!data_->messages_.list_.empty()) {
-		std::unique_ptr<Message> msg = std::move(data_->messages_.list_.front());
-		data_->messages_.list_.pop_front();
-		if (!msg)
-			continue;
+	/*
+	 * Clear the wakeup flag before collecting messages, messages posted
+	 * after this point will interrupt the event dispatcher again.
+	 */
+	queue.wakeupPending_.store(false);
+
+	MutexLocker locker(queue.mutex_);
+
+	while (true) {
+		Message *next = queue.takeFirst();
+		if (!next) {
+			/* Pick up the messages posted while dispatching. */
+			queue.collect();
+			next = queue.takeFirst();
+			if (!next)
+				break;
+		}
 
+		std::unique_ptr<Message> msg(next);
 		Object *receiver = msg->receiver_;
 		ASSERT(data_ == receiver->thread()->data_);
 
+		locker.unlock();
+		LIBCAMERA_TRACEPOINT(message_dispatch, "type=%d receiver=%p",
+				     msg->type(), receiver);
+		receiver->message(msg.get());
+		locker.lock();
+
+		receiver->pendingMessages_--;
+	}
+}
+
+/**
+ * \brief Dispatch posted messages for a receiver
+ * \param[in] receiver The receiver whose messages to dispatch
+ *
+ * Dispatch all messages posted to \a receiver, in the order they have been
+ * posted, leaving the messages for other receivers pending. This allows
+ * synchronously flushing the messages of a single object without dispatching
+ * unrelated messages. The \a receiver shall be bound to this thread, and this
+ * method shall be called from this thread.
+ */
+void Thread::dispatchMessages(Object *receiver)
+{
+	ASSERT(data_ == receiver->thread()->data_);
+
+	MessageQueue &queue = data_->messages_;
+	MutexLocker locker(queue.mutex_);
+
+	queue.collect();
+
+	while (receiver->pendingMessages_) {
+		Message *next = queue.take(receiver);
+		if (!next)
+			break;
+
+		std::unique_ptr<Message> msg(next);
+
 		locker.unlock();
 		receiver->message(msg.get());
 		locker.lock();
@@ -466,21 +833,26 @@ void Thread::moveObject(Object *object)
 void Thread::moveObject(Object *object, ThreadData *currentData,
 			ThreadData *targetData)
 {
+	/*
+	 * Bind the object to the new thread before moving its messages, to
+	 * ensure the new thread never dispatches a message to an object it
+	 * doesn't own.
+	 */
+	object->thread_ = this;
+
 	/* Move pending messages to the message queue of the new thread. */
 	if (object->pendingMessages_) {
-		unsigned int movedMessages = 0;
+		MessageQueue &queue = currentData->messages_;
+		MutexLocker locker(queue.mutex_);
+		bool wakeup = false;
 
-		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
-			if (!msg)
-				continue;
-			if (msg->receiver_ != object)
-				continue;
+		queue.collect();
+		while (Message *msg = queue.take(object))
+			wakeup |= targetData->messages_.post(msg);
 
-			targetData->messages_.list_.push_back(std::move(msg));
-			movedMessages++;
-		}
+		locker.unlock();
 
-		if (movedMessages) {
+		if (wakeup) {
 			EventDispatcher *dispatcher =
 				targetData->dispatcher_.load(std::memory_order_acquire);
 			if (dispatcher)
@@ -488,8 +860,6 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 		}
 	}
 
-	object->thread_ = this;
-
 	/* Move all children. */
 	for (auto child : object->children_)
 		moveObject(child, currentData, targetData);
@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * thread_pool.cpp - Worker thread pool
+ */
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <thread>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file thread_pool.h
+ * \brief Worker thread pool
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(ThreadPool)
+
+namespace {
+
+/* The pool and queue index of the current worker thread. */
+thread_local ThreadPool *currentPool = nullptr;
+thread_local unsigned int currentQueue = 0;
+
+} /* namespace */
+
+/*
+ * Worker threads don't use an event loop, they wait for tasks on the pool
+ * condition variable until the pool is destroyed.
+ */
+class ThreadPool::Worker : public Thread
+{
+public:
+	Worker(ThreadPool *pool, unsigned int index)
+		: pool_(pool), index_(index)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		pool_->workerLoop(index_);
+	}
+
+private:
+	ThreadPool *pool_;
+	unsigned int index_;
+};
+
+/**
+ * \class ThreadPool
+ * \brief Run CPU processing tasks on a shared set of worker threads
+ *
+ * CPU processing stages, such as format conversion, image processing, JPEG
+ * compression or statistics computation, would oversubscribe the CPUs if each
+ * of them spawned its own threads. The ThreadPool offers a set of worker
+ * threads to share between them, and the instance() method returns a pool
+ * shared by the whole process.
+ *
+ * Tasks are posted with post(). Each worker thread has its own task queue, and
+ * tasks posted from a worker are queued to that worker, keeping the data they
+ * use in the CPU caches. Idle workers steal tasks from the queues of the other
+ * workers, which balances the load when tasks have unequal durations.
+ *
+ * Posting a task with a receiver Object calls a method of the receiver once
+ * the task completes. The method is invoked through Object::invokeMethod(),
+ * and thus runs in the receiver's thread when control returns to its event
+ * loop. This allows returning results to the thread that requested the work
+ * without any explicit synchronization.
+ *
+ * \code{.cpp}
+ * void Converter::queueFrame(FrameBuffer *input, FrameBuffer *output)
+ * {
+ * 	ThreadPool::instance()->post([=]() { convert(input, output); },
+ * 				     this, &Converter::frameConverted);
+ * }
+ * \endcode
+ *
+ * The parallelFor() method splits a per-frame processing in stripes processed
+ * in parallel, and returns when all stripes have been processed.
+ *
+ * Posting tasks and calling parallelFor() is thread-safe.
+ */
+
+/**
+ * \brief Construct a ThreadPool with \a workers threads
+ * \param[in] workers The number of worker threads
+ *
+ * When \a workers is 0, posted tasks run synchronously in the calling thread.
+ */
+ThreadPool::ThreadPool(unsigned int workers)
+	: queued_(0), next_(0), stopping_(false)
+{
+	for (unsigned int i = 0; i < workers; ++i)
+		queues_.emplace_back(new Queue());
+
+	for (unsigned int i = 0; i < workers; ++i) {
+		Worker *worker = new Worker(this, i);
+		workers_.emplace_back(worker);
+		worker->start();
+	}
+}
+
+/**
+ * \brief Destroy the ThreadPool
+ *
+ * All pending tasks are run before the worker threads are stopped.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		stopping_ = true;
+	}
+
+	workAvailable_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/**
+ * \brief Retrieve the process-wide thread pool
+ *
+ * The pool is created on first use with defaultWorkers() worker threads.
+ *
+ * \return The process-wide thread pool
+ */
+ThreadPool *ThreadPool::instance()
+{
+	static ThreadPool pool(defaultWorkers());
+	return &pool;
+}
+
+/**
+ * \brief Retrieve the default number of worker threads
+ *
+ * The number of worker threads is set by the LIBCAMERA_THREAD_POOL_WORKERS
+ * environment variable. It defaults to one less than the number of CPUs, as
+ * threads calling parallelFor() take part in processing.
+ *
+ * \return The default number of worker threads
+ */
+unsigned int ThreadPool::defaultWorkers()
+{
+	unsigned int cpus = std::thread::hardware_concurrency();
+	unsigned int count = cpus > 1 ? cpus - 1 : 0;
+
+	const char *env = utils::secure_getenv("LIBCAMERA_THREAD_POOL_WORKERS");
+	if (!env || !*env)
+		return count;
+
+	char *end;
+	unsigned long value = strtoul(env, &end, 10);
+	if (*end) {
+		LOG(ThreadPool, Warning) << "Invalid worker count " << env;
+		return count;
+	}
+
+	return value;
+}
+
+/**
+ * \fn ThreadPool::workers()
+ * \brief Retrieve the number of worker threads
+ * \return The number of worker threads
+ */
+
+/**
+ * \brief Set the scheduling parameters of the worker threads
+ * \param[in] scheduling The scheduling parameters
+ *
+ * \sa Thread::setScheduling()
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int ThreadPool::setScheduling(const ThreadScheduling &scheduling)
+{
+	for (std::unique_ptr<Worker> &worker : workers_) {
+		int ret = worker->setScheduling(scheduling);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Post a task to the pool
+ * \param[in] task The task
+ *
+ * The \a task is run asynchronously by one of the worker threads. Tasks posted
+ * from a worker thread are run by preference by the same worker.
+ */
+void ThreadPool::post(std::function<void()> task)
+{
+	if (workers_.empty()) {
+		task();
+		return;
+	}
+
+	unsigned int index = currentPool == this
+			   ? currentQueue
+			   : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+	Queue &queue = *queues_[index];
+	{
+		MutexLocker locker(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	/*
+	 * Increment the number of queued tasks with the lock held, to avoid
+	 * racing with workers going to sleep.
+	 */
+	{
+		MutexLocker locker(mutex_);
+		queued_++;
+	}
+
+	workAvailable_.notify_one();
+}
+
+/**
+ * \fn ThreadPool::post(std::function<void()> task, T *receiver, void (T::*done)())
+ * \brief Post a task to the pool and notify a receiver when it completes
+ * \param[in] task The task
+ * \param[in] receiver The receiver
+ * \param[in] done The receiver method to call when the task completes
+ *
+ * The \a done method of the \a receiver is invoked in the receiver's thread
+ * after the \a task completes. The \a receiver shall remain valid until then.
+ */
+
+/**
+ * \brief Run a function for a range of stripes in parallel
+ * \param[in] count The number of stripes
+ * \param[in] func The function, called with the stripe index
+ *
+ * Call \a func for each stripe index in the [0, \a count[ range, on the worker
+ * threads and on the calling thread. Stripes are handed out dynamically, so
+ * that faster threads process more stripes. This method returns when all
+ * stripes have been processed, it may be called from a task running on the
+ * pool.
+ */
+void ThreadPool::parallelFor(unsigned int count,
+			     const std::function<void(unsigned int)> &func)
+{
+	if (workers_.empty() || count < 2) {
+		for (unsigned int i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	struct Stripes {
+		const std::function<void(unsigned int)> *func;
+		unsigned int count;
+		std::atomic<unsigned int> next;
+		std::atomic<unsigned int> done;
+		Mutex mutex;
+		std::condition_variable finished;
+	};
+
+	/*
+	 * Helper tasks may be run after all stripes have been processed, when
+	 * the function isn't valid anymore. They only access the shared state,
+	 * which they keep alive.
+	 */
+	std::shared_ptr<Stripes> stripes = std::make_shared<Stripes>();
+	stripes->func = &func;
+	stripes->count = count;
+	stripes->next = 0;
+	stripes->done = 0;
+
+	auto process = [stripes]() {
+		unsigned int i;
+		while ((i = stripes->next++) < stripes->count) {
+			(*stripes->func)(i);
+
+			if (++stripes->done == stripes->count) {
+				MutexLocker locker(stripes->mutex);
+				stripes->finished.notify_one();
+			}
+		}
+	};
+
+	unsigned int helpers = std::min<unsigned int>(count - 1, workers_.size());
+	for (unsigned int i = 0; i < helpers; ++i)
+		post(process);
+
+	process();
+
+	MutexLocker locker(stripes->mutex);
+	stripes->finished.wait(locker, [&]() {
+		return stripes->done == stripes->count;
+	});
+}
+
+bool ThreadPool::take(unsigned int index, std::function<void()> *task)
+{
+	unsigned int count = queues_.size();
+
+	/* Run the most recent local task first, and steal the oldest ones. */
+	for (unsigned int i = 0; i < count; ++i) {
+		Queue &queue = *queues_[(index + i) % count];
+		MutexLocker locker(queue.mutex);
+
+		if (queue.tasks.empty())
+			continue;
+
+		if (i == 0) {
+			*task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		} else {
+			*task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+
+		queued_--;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+	currentPool = this;
+	currentQueue = index;
+
+	while (true) {
+		std::function<void()> task;
+		if (take(index, &task)) {
+			task();
+			continue;
+		}
+
+		MutexLocker locker(mutex_);
+		workAvailable_.wait(locker, [&]() {
+			return stopping_ || queued_;
+		});
+
+		if (stopping_ && !queued_)
+			break;
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * thread_scheduling.cpp - Thread scheduling parameters
+ */
+
+#include <libcamera/thread_scheduling.h>
+
+#include <sstream>
+
+/**
+ * \file thread_scheduling.h
+ * \brief Thread scheduling parameters
+ */
+
+namespace libcamera {
+
+/**
+ * \class ThreadScheduling
+ * \brief Scheduling policy, priority and CPU affinity of a thread
+ *
+ * The ThreadScheduling class groups the scheduling parameters applied to the
+ * threads created by libcamera. The default parameters select the normal
+ * time-sharing scheduling policy with the default nice value, and allow the
+ * thread to run on all CPUs, matching the scheduling of a thread created
+ * without any specific configuration.
+ *
+ * The real-time policies require the CAP_SYS_NICE capability, or a suitable
+ * RLIMIT_RTPRIO resource limit. Applying parameters that the process isn't
+ * allowed to use fails, and leaves the thread scheduling unchanged.
+ */
+
+/**
+ * \enum ThreadScheduling::Policy
+ * \brief The scheduling policy
+ * \var ThreadScheduling::PolicyOther
+ * The normal time-sharing policy (SCHED_OTHER)
+ * \var ThreadScheduling::PolicyFifo
+ * The first-in first-out real-time policy (SCHED_FIFO)
+ * \var ThreadScheduling::PolicyRoundRobin
+ * The round-robin real-time policy (SCHED_RR)
+ */
+
+/**
+ * \brief Construct default thread scheduling parameters
+ */
+ThreadScheduling::ThreadScheduling()
+	: policy(PolicyOther), priority(0), nice(0)
+{
+}
+
+/**
+ * \brief Check if the parameters match the default thread scheduling
+ * \return True if the parameters are the default parameters, false otherwise
+ */
+bool ThreadScheduling::isDefault() const
+{
+	return policy == PolicyOther && !nice && cpus.empty();
+}
+
+/**
+ * \brief Assemble and return a string describing the scheduling parameters
+ * \return A string describing the scheduling parameters
+ */
+std::string ThreadScheduling::toString() const
+{
+	static const char *policyNames[] = { "other", "fifo", "rr" };
+	std::stringstream ss;
+
+	ss << policyNames[policy];
+	if (policy == PolicyOther)
+		ss << " nice " << nice;
+	else
+		ss << " priority " << priority;
+
+	if (!cpus.empty()) {
+		ss << " cpus ";
+		for (unsigned int i = 0; i < cpus.size(); ++i)
+			ss << (i ? "," : "") << cpus[i];
+	}
+
+	return ss.str();
+}
+
+/**
+ * \var ThreadScheduling::policy
+ * \brief The scheduling policy
+ */
+
+/**
+ * \var ThreadScheduling::priority
+ * \brief The static priority for the real-time policies
+ *
+ * The priority ranges from 1 (lowest) to 99 (highest) on Linux. It is ignored
+ * for the PolicyOther policy.
+ */
+
+/**
+ * \var ThreadScheduling::nice
+ * \brief The nice value for the PolicyOther policy
+ *
+ * The nice value ranges from -20 (highest priority) to 19 (lowest priority).
+ * It is ignored for the real-time policies.
+ */
+
+/**
+ * \var ThreadScheduling::cpus
+ * \brief The CPUs the thread is allowed to run on
+ *
+ * An empty list allows the thread to run on all CPUs.
+ */
+
+} /* namespace libcamera */
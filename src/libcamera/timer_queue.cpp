@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer_queue.cpp - Timer queue for event dispatchers
+ */
+
+#include "timer_queue.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/timer.h>
+
+#include "log.h"
+#include "tracepoints.h"
+
+/**
+ * \file timer_queue.h
+ * \brief Timer queue for event dispatchers
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Timer)
+
+/**
+ * \class TimerQueue
+ * \brief Queue of the timers registered with an event dispatcher
+ *
+ * The TimerQueue stores the running timers of an event dispatcher in a binary
+ * heap ordered by deadline. Each timer records its position in the heap, which
+ * makes inserting and removing timers O(log n) operations without any memory
+ * allocation once the heap has grown to its steady state size. The timer with
+ * the earliest deadline is available in constant time.
+ *
+ * The deadline of each timer is recorded when the timer is inserted, the queue
+ * thus stays consistent when Timer::start() updates the deadline of a running
+ * timer before removing it from the queue.
+ *
+ * The queue also manages a timerfd, armed for the earliest deadline, that
+ * event dispatchers monitor along with the file descriptors of their event
+ * notifiers. This provides timeouts with the precision of the kernel timers
+ * regardless of the timeout resolution of the system call used to wait for
+ * events. The timerfd is only updated by arm(), called by the event dispatcher
+ * before waiting for events, and only when the earliest deadline has changed.
+ */
+
+/**
+ * \brief Construct an empty timer queue
+ *
+ * The timerfd is created with the CLOCK_MONOTONIC clock, which backs the
+ * std::chrono::steady_clock used by timers. Failure to create the timerfd is
+ * fatal as timers can't be implemented without it.
+ */
+TimerQueue::TimerQueue()
+	: armed_(false)
+{
+	timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timerfd_ < 0)
+		LOG(Timer, Fatal) << "Unable to create timerfd";
+}
+
+TimerQueue::~TimerQueue()
+{
+	close(timerfd_);
+}
+
+/**
+ * \brief Insert a timer in the queue
+ * \param[in] timer The timer
+ *
+ * The timer is ordered according to its current deadline. Inserting a timer
+ * already present in the queue moves it according to its current deadline.
+ */
+void TimerQueue::insert(Timer *timer)
+{
+	if (contains(timer))
+		removeAt(timer->queuePosition_);
+
+	size_t pos = heap_.size();
+	heap_.push_back({ timer->deadline(), timer });
+	timer->queuePosition_ = pos;
+
+	siftUp(pos);
+}
+
+/**
+ * \brief Remove a timer from the queue
+ * \param[in] timer The timer
+ *
+ * Removing a timer not present in the queue has no effect.
+ */
+void TimerQueue::remove(Timer *timer)
+{
+	if (!contains(timer))
+		return;
+
+	removeAt(timer->queuePosition_);
+}
+
+/**
+ * \fn TimerQueue::empty()
+ * \brief Check if the queue is empty
+ * \return True if the queue contains no timer, false otherwise
+ */
+
+/**
+ * \fn TimerQueue::size()
+ * \brief Retrieve the number of timers in the queue
+ * \return The number of timers in the queue
+ */
+
+/**
+ * \fn TimerQueue::front()
+ * \brief Retrieve the timer with the earliest deadline
+ * \return The timer with the earliest deadline, or nullptr if the queue is
+ * empty
+ */
+
+/**
+ * \fn TimerQueue::fd()
+ * \brief Retrieve the timerfd
+ *
+ * The timerfd becomes readable when the earliest deadline, at the time of the
+ * last call to arm(), has been reached.
+ *
+ * \return The timerfd
+ */
+
+/**
+ * \brief Arm the timerfd for the earliest deadline
+ *
+ * The timerfd is reprogrammed only when the earliest deadline has changed since
+ * the last call, and disarmed when the queue is empty.
+ */
+void TimerQueue::arm()
+{
+	struct itimerspec spec = {};
+
+	if (heap_.empty()) {
+		if (!armed_)
+			return;
+
+		armed_ = false;
+	} else {
+		const utils::time_point &deadline = heap_.front().deadline;
+		if (armed_ && armedDeadline_ == deadline)
+			return;
+
+		armed_ = true;
+		armedDeadline_ = deadline;
+
+		/* A zero value disarms the timer, use the smallest delay. */
+		utils::duration value = deadline.time_since_epoch();
+		spec.it_value = utils::duration_to_timespec(value);
+		if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+			spec.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+		int ret = -errno;
+		LOG(Timer, Error)
+			<< "Failed to arm timerfd: " << strerror(-ret);
+		armed_ = false;
+	}
+}
+
+/**
+ * \brief Acknowledge the expiration of the timerfd
+ *
+ * This method shall be called when the timerfd is readable, to reset its
+ * readiness.
+ */
+void TimerQueue::acknowledge()
+{
+	uint64_t expirations;
+
+	if (read(timerfd_, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		LOG(Timer, Error)
+			<< "Failed to read timerfd: " << strerror(errno);
+
+	armed_ = false;
+}
+
+/**
+ * \brief Fire all timers whose deadline has been reached
+ *
+ * Expired timers are removed from the queue and stopped before their timeout
+ * signal is emitted. Timers restarted from their timeout handler are inserted
+ * back in the queue, and fire during a later call if their new deadline has
+ * already been reached.
+ */
+void TimerQueue::process()
+{
+	utils::time_point now = utils::clock::now();
+
+	while (!heap_.empty()) {
+		const Entry &entry = heap_.front();
+		if (entry.deadline > now)
+			break;
+
+		Timer *timer = entry.timer;
+		removeAt(0);
+		timer->stop();
+
+		LIBCAMERA_TRACEPOINT(timer_fire, "timer=%p", timer);
+		timer->timeout.emit(timer);
+	}
+}
+
+bool TimerQueue::contains(Timer *timer) const
+{
+	size_t pos = timer->queuePosition_;
+	return pos < heap_.size() && heap_[pos].timer == timer;
+}
+
+void TimerQueue::swap(size_t a, size_t b)
+{
+	std::swap(heap_[a], heap_[b]);
+	heap_[a].timer->queuePosition_ = a;
+	heap_[b].timer->queuePosition_ = b;
+}
+
+void TimerQueue::siftUp(size_t pos)
+{
+	while (pos > 0) {
+		size_t parent = (pos - 1) / 2;
+		if (!(heap_[pos].deadline < heap_[parent].deadline))
+			break;
+
+		swap(pos, parent);
+		pos = parent;
+	}
+}
+
+void TimerQueue::siftDown(size_t pos)
+{
+	size_t size = heap_.size();
+
+	while (true) {
+		size_t smallest = pos;
+		size_t left = pos * 2 + 1;
+		size_t right = left + 1;
+
+		if (left < size && heap_[left].deadline < heap_[smallest].deadline)
+			smallest = left;
+		if (right < size && heap_[right].deadline < heap_[smallest].deadline)
+			smallest = right;
+
+		if (smallest == pos)
+			break;
+
+		swap(pos, smallest);
+		pos = smallest;
+	}
+}
+
+void TimerQueue::removeAt(size_t pos)
+{
+	heap_[pos].timer->queuePosition_ = SIZE_MAX;
+
+	size_t last = heap_.size() - 1;
+	if (pos != last) {
+		heap_[pos] = heap_[last];
+		heap_[pos].timer->queuePosition_ = pos;
+	}
+
+	heap_.pop_back();
+
+	if (pos < heap_.size()) {
+		siftUp(pos);
+		siftDown(pos);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * tracepoints.cpp - Static tracepoints
+ */
+
+#include "tracepoints.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file tracepoints.h
+ * \brief Static tracepoints
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Trace)
+
+/**
+ * \def LIBCAMERA_TRACEPOINT(event, fmt, ...)
+ * \brief Emit a tracepoint
+ * \param[in] event The event name, without quotes
+ * \param[in] fmt The printf-style format of the event fields
+ *
+ * Tracepoints mark events of interest on the hot paths of libcamera, such as
+ * buffer queueing and dequeueing, request queueing and completion, IPA calls,
+ * message dispatching and timers expiration. They are compiled in only when
+ * libcamera is configured with the 'tracing' option, and expand to nothing
+ * otherwise, in which case their arguments are not evaluated.
+ *
+ * When compiled in, tracepoints are further enabled at runtime by setting the
+ * LIBCAMERA_TRACING environment variable to 1. They are then written to the
+ * kernel ftrace buffer through the trace_marker file, interleaved with the
+ * kernel tracepoints, in the form "libcamera:<event>: <fields>". A disabled
+ * tracepoint only costs a branch.
+ */
+
+/**
+ * \class Tracer
+ * \brief Backend for the static tracepoints
+ *
+ * The Tracer is a singleton that holds the trace_marker file descriptor shared
+ * by all tracepoints. It shouldn't be used directly, tracepoints shall be
+ * emitted with the LIBCAMERA_TRACEPOINT() macro.
+ */
+
+Tracer::Tracer()
+	: fd_(-1)
+{
+	const char *tracing = utils::secure_getenv("LIBCAMERA_TRACING");
+	if (!tracing || strcmp(tracing, "1"))
+		return;
+
+	static const char *markers[] = {
+		"/sys/kernel/tracing/trace_marker",
+		"/sys/kernel/debug/tracing/trace_marker",
+	};
+
+	for (const char *marker : markers) {
+		fd_ = ::open(marker, O_WRONLY | O_CLOEXEC);
+		if (fd_ >= 0)
+			return;
+	}
+
+	LOG(Trace, Warning) << "Failed to open trace marker: "
+			    << strerror(errno);
+}
+
+Tracer::~Tracer()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+/**
+ * \brief Retrieve the tracer instance
+ * \return The tracer instance
+ */
+Tracer *Tracer::instance()
+{
+	static Tracer tracer;
+	return &tracer;
+}
+
+/**
+ * \fn Tracer::enabled()
+ * \brief Check if tracing is enabled
+ * \return True if tracepoints are emitted, false otherwise
+ */
+
+/**
+ * \brief Emit a tracepoint
+ * \param[in] event The event name
+ * \param[in] fmt The printf-style format of the event fields
+ *
+ * The event is written to the trace marker with a single write() call, which
+ * the kernel guarantees to be atomic with respect to other writers.
+ */
+void Tracer::emit(const char *event, const char *fmt, ...)
+{
+	char buffer[256];
+	va_list ap;
+
+	int len = snprintf(buffer, sizeof(buffer), "libcamera:%s: ", event);
+
+	va_start(ap, fmt);
+	len += vsnprintf(buffer + len, sizeof(buffer) - len, fmt, ap);
+	va_end(ap);
+
+	if (len >= static_cast<int>(sizeof(buffer)))
+		len = sizeof(buffer) - 1;
+
+	/* Failures are silently ignored, tracing is best effort. */
+	ssize_t ret = ::write(fd_, buffer, len);
+	(void)ret;
+}
+
+} /* namespace libcamera */
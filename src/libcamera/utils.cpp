@@ -11,6 +11,8 @@
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <linux/limits.h>
@@ -109,6 +111,60 @@ std::string dirname(const std::string &path)
 	return path;
 }
 
+/**
+ * \brief Retrieve the identity of the dmabuf object referenced by \a fd
+ * \param[in] fd The dmabuf file descriptor
+ * \param[out] dev The device number of the dmabuf inode
+ * \param[out] ino The inode number of the dmabuf inode
+ *
+ * Since Linux 5.3 each dmabuf object has its own inode, whose device and inode
+ * numbers identify the object regardless of the file descriptor referencing
+ * it. Older kernels back all dmabuf objects with the anonymous inode shared by
+ * all anon_inode files, which is detected by comparing with the inode of an
+ * eventfd. The dmabuf objects have no usable identity in that case.
+ *
+ * \return True if \a dev and \a ino uniquely identify the dmabuf object, false
+ * otherwise
+ */
+bool dmabuf_identity(int fd, uint64_t *dev, uint64_t *ino)
+{
+	struct AnonInode {
+		bool valid;
+		dev_t dev;
+		ino_t ino;
+	};
+
+	static const AnonInode anonInode = []() {
+		AnonInode inode = {};
+		struct stat st;
+
+		int efd = eventfd(0, EFD_CLOEXEC);
+		if (efd < 0)
+			return inode;
+
+		if (!fstat(efd, &st))
+			inode = { true, st.st_dev, st.st_ino };
+
+		close(efd);
+		return inode;
+	}();
+
+	/* Without a reference anonymous inode, uniqueness can't be checked. */
+	if (!anonInode.valid)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return false;
+
+	if (st.st_dev == anonInode.dev && st.st_ino == anonInode.ino)
+		return false;
+
+	*dev = st.st_dev;
+	*ino = st.st_ino;
+	return true;
+}
+
 /**
  * \fn libcamera::utils::make_unique(Args &&... args)
  * \brief Constructs an object of type T and wraps it in a std::unique_ptr.
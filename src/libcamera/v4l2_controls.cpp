@@ -32,8 +32,13 @@
  * variable inside the control, or they might as well deal with more complex
  * data types, such as arrays of matrices, stored in a contiguous memory
  * locations associated with the control and called 'the payload'. Such controls
- * are called 'compound controls' and are currently not supported by the
- * libcamera V4L2 control framework.
+ * are called 'compound controls'.
+ *
+ * Array controls and compound controls are supported through array
+ * ControlValue instances. Arrays of integer controls map to arrays of the
+ * corresponding integer type, and the payload of other compound controls is
+ * stored as an array of bytes. The ControlValue storage is passed to the
+ * kernel directly, without intermediate copies.
  *
  * libcamera implements support for controls using the V4L2 Extended Control
  * API, which allows future handling of controls with payloads of arbitrary
@@ -43,8 +48,6 @@
  * by the ControlList class, to match the V4L2 extended controls API. The
  * interface to set and get control is implemented by the V4L2Device class, and
  * this file only provides the data type definitions.
- *
- * \todo Add support for compound controls
  */
 
 namespace libcamera {
@@ -69,6 +72,15 @@ ControlType v4l2_ctrl_type(const struct v4l2_query_ext_ctrl &ctrl)
 	case V4L2_CTRL_TYPE_INTEGER64:
 		return ControlTypeInteger64;
 
+	case V4L2_CTRL_TYPE_U8:
+		return ControlTypeByte;
+
+	case V4L2_CTRL_TYPE_U16:
+		return ControlTypeUnsigned16;
+
+	case V4L2_CTRL_TYPE_U32:
+		return ControlTypeUnsigned32;
+
 	case V4L2_CTRL_TYPE_MENU:
 	case V4L2_CTRL_TYPE_BUTTON:
 	case V4L2_CTRL_TYPE_BITMASK:
@@ -80,10 +92,33 @@ ControlType v4l2_ctrl_type(const struct v4l2_query_ext_ctrl &ctrl)
 		return ControlTypeInteger32;
 
 	default:
+		/* Other compound controls are handled as raw payloads. */
+		if (ctrl.type >= V4L2_CTRL_COMPOUND_TYPES)
+			return ControlTypeByte;
+
 		return ControlTypeNone;
 	}
 }
 
+unsigned int v4l2_ctrl_elements(const struct v4l2_query_ext_ctrl &ctrl)
+{
+	if (!(ctrl.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD))
+		return 0;
+
+	switch (ctrl.type) {
+	case V4L2_CTRL_TYPE_INTEGER:
+	case V4L2_CTRL_TYPE_INTEGER64:
+	case V4L2_CTRL_TYPE_U8:
+	case V4L2_CTRL_TYPE_U16:
+	case V4L2_CTRL_TYPE_U32:
+		return ctrl.elems;
+
+	default:
+		/* Compound payloads are stored as bytes. */
+		return ctrl.elem_size * ctrl.elems;
+	}
+}
+
 } /* namespace */
 
 /**
@@ -99,10 +134,30 @@ ControlType v4l2_ctrl_type(const struct v4l2_query_ext_ctrl &ctrl)
  * \param[in] ctrl The struct v4l2_query_ext_ctrl as returned by the kernel
  */
 V4L2ControlId::V4L2ControlId(const struct v4l2_query_ext_ctrl &ctrl)
-	: ControlId(ctrl.id, v4l2_ctrl_name(ctrl), v4l2_ctrl_type(ctrl))
+	: ControlId(ctrl.id, v4l2_ctrl_name(ctrl), v4l2_ctrl_type(ctrl)),
+	  numElements_(v4l2_ctrl_elements(ctrl))
 {
 }
 
+/**
+ * \fn V4L2ControlId::hasPayload()
+ * \brief Check if the control is an array or compound control
+ *
+ * The value of controls with a payload is stored in an array ControlValue.
+ *
+ * \return True if the control value is stored in a payload, false otherwise
+ */
+
+/**
+ * \fn V4L2ControlId::numElements()
+ * \brief Retrieve the number of elements of the control payload
+ *
+ * For compound controls other than arrays of integers, the number of elements
+ * is the payload size in bytes.
+ *
+ * \return The number of payload elements, or 0 if the control has no payload
+ */
+
 /**
  * \class V4L2ControlRange
  * \brief Convenience specialisation of ControlRange for V4L2 controls
@@ -118,7 +173,8 @@ V4L2ControlId::V4L2ControlId(const struct v4l2_query_ext_ctrl &ctrl)
  */
 V4L2ControlRange::V4L2ControlRange(const struct v4l2_query_ext_ctrl &ctrl)
 {
-	if (ctrl.type == V4L2_CTRL_TYPE_INTEGER64)
+	if (ctrl.type == V4L2_CTRL_TYPE_INTEGER64 ||
+	    ctrl.type == V4L2_CTRL_TYPE_U32)
 		ControlRange::operator=(ControlRange(static_cast<int64_t>(ctrl.minimum),
 						     static_cast<int64_t>(ctrl.maximum)));
 	else
@@ -7,13 +7,17 @@
 
 #include "v4l2_device.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <libcamera/event_notifier.h>
+
 #include "log.h"
+#include "media_request.h"
 #include "utils.h"
 #include "v4l2_controls.h"
 
@@ -26,6 +30,126 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(V4L2)
 
+/**
+ * \class V4L2ControlBatch
+ * \brief A prepared set of V4L2 controls read or written together
+ *
+ * V4L2Device::getControls() and V4L2Device::setControls() validate the
+ * controls of the ControlList and build the V4L2 ioctl argument on every call.
+ * For controls accessed repeatedly, such as the sensor exposure and gain
+ * updated by the AE algorithm every few frames, a V4L2ControlBatch performs
+ * that work once. The batch is prepared for a list of control IDs with
+ * V4L2Device::prepareControls(), and stores the ioctl argument ready to use.
+ * Control values are then accessed by index in the order of the IDs, and the
+ * whole batch is read or written with a single ioctl and no lookup.
+ *
+ * A batch is bound to the device that prepared it, and can only be used with
+ * that device.
+ */
+
+/**
+ * \brief Construct an invalid control batch
+ */
+V4L2ControlBatch::V4L2ControlBatch()
+	: device_(nullptr)
+{
+}
+
+/**
+ * \fn V4L2ControlBatch::isValid()
+ * \brief Check if the batch has been prepared
+ * \return True if the batch has been prepared by a V4L2Device, false otherwise
+ */
+
+/**
+ * \fn V4L2ControlBatch::size()
+ * \brief Retrieve the number of controls in the batch
+ * \return The number of controls in the batch
+ */
+
+/**
+ * \fn V4L2ControlBatch::id()
+ * \brief Retrieve the V4L2 ID of the control at \a index
+ * \param[in] index The control index in the batch
+ * \return The V4L2 control ID
+ */
+
+/**
+ * \brief Retrieve the value of the control at \a index
+ * \param[in] index The control index in the batch
+ *
+ * The value is the one last read or written by the device.
+ *
+ * \return The control value
+ */
+ControlValue V4L2ControlBatch::get(unsigned int index) const
+{
+	const struct v4l2_ext_control &ctrl = ctrls_[index];
+
+	if (types_[index] == ControlTypeInteger64)
+		return ControlValue(static_cast<int64_t>(ctrl.value64));
+
+	return ControlValue(static_cast<int32_t>(ctrl.value));
+}
+
+/**
+ * \brief Set the value of the control at \a index
+ * \param[in] index The control index in the batch
+ * \param[in] value The control value
+ */
+void V4L2ControlBatch::set(unsigned int index, const ControlValue &value)
+{
+	struct v4l2_ext_control &ctrl = ctrls_[index];
+
+	if (types_[index] == ControlTypeInteger64)
+		ctrl.value64 = value.get<int64_t>();
+	else
+		ctrl.value = value.get<int32_t>();
+}
+
+/**
+ * \brief Set the value of the batch controls from a control list
+ * \param[in] ctrls The control list
+ *
+ * Copy the value of all the controls in \a ctrls to the batch. The list may
+ * contain any subset of the batch controls, in any order, in which case the
+ * other batch controls retain their previous value. If \a ctrls contains a
+ * control not part of the batch, the batch isn't modified.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The controls in \a ctrls don't match the batch
+ */
+int V4L2ControlBatch::set(const ControlList &ctrls)
+{
+	if (ctrls.size() > ctrls_.size())
+		return -EINVAL;
+
+	if (ctrls.empty())
+		return 0;
+
+	unsigned int indexes[ctrls_.size()];
+	unsigned int i = 0;
+
+	for (const auto &ctrl : ctrls) {
+		unsigned int index;
+		for (index = 0; index < ctrls_.size(); ++index) {
+			if (ctrls_[index].id == ctrl.first->id())
+				break;
+		}
+
+		if (index == ctrls_.size())
+			return -EINVAL;
+
+		indexes[i++] = index;
+	}
+
+	i = 0;
+	for (const auto &ctrl : ctrls)
+		set(indexes[i++], ctrl.second);
+
+	return 0;
+}
+
 /**
  * \class V4L2Device
  * \brief Base class for V4L2VideoDevice and V4L2Subdevice
@@ -48,7 +172,8 @@ LOG_DEFINE_CATEGORY(V4L2)
  * at open() time, and the \a logTag to prefix log messages with.
  */
 V4L2Device::V4L2Device(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1)
+	: deviceNode_(deviceNode), fd_(-1), fdEventNotifier_(nullptr),
+	  frameStartEnabled_(false), controlEventsEnabled_(false)
 {
 }
 
@@ -126,6 +251,12 @@ void V4L2Device::close()
 	if (!isOpen())
 		return;
 
+	delete fdEventNotifier_;
+	fdEventNotifier_ = nullptr;
+	frameStartEnabled_ = false;
+	controlEventsEnabled_ = false;
+	controlValues_.clear();
+
 	if (::close(fd_) < 0)
 		LOG(V4L2, Error) << "Failed to close V4L2 device: "
 				 << strerror(errno);
@@ -152,15 +283,22 @@ void V4L2Device::close()
  * their values in the corresponding \a ctrls entry.
  *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is a compound control, or if any
- * other error occurs during validation of the requested controls, no control is
- * read and this method returns -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
+ * during validation of the requested controls, no control is read and this
+ * method returns -EINVAL.
+ *
+ * The payload of array and compound controls is read directly into the storage
+ * of the corresponding array ControlValue, which is allocated if needed.
  *
  * If an error occurs while reading the controls, the index of the first control
  * that couldn't be read is returned. The value of all controls below that index
  * are updated in \a ctrls, while the value of all the other controls are not
  * changed.
  *
+ * When control change events are enabled with setControlEventsEnabled(), and
+ * all controls in \a ctrls are tracked through events, the values are read from
+ * the cache without accessing the device.
+ *
  * \return 0 on success or an error code otherwise
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
@@ -171,11 +309,14 @@ int V4L2Device::getControls(ControlList *ctrls)
 	if (count == 0)
 		return 0;
 
+	if (getCachedControls(ctrls))
+		return 0;
+
 	struct v4l2_ext_control v4l2Ctrls[count];
 	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
 
 	unsigned int i = 0;
-	for (const auto &ctrl : *ctrls) {
+	for (auto &ctrl : *ctrls) {
 		const ControlId *id = ctrl.first;
 		const auto iter = controls_.find(id->id());
 		if (iter == controls_.end()) {
@@ -185,6 +326,28 @@ int V4L2Device::getControls(ControlList *ctrls)
 		}
 
 		v4l2Ctrls[i].id = id->id();
+
+		/*
+		 * Let the kernel write the payload of array and compound
+		 * controls directly to the ControlValue storage.
+		 */
+		const V4L2ControlId *v4l2Id =
+			static_cast<const V4L2ControlId *>(iter->first);
+		ControlValue &value = ctrl.second;
+		if (v4l2Id->hasPayload()) {
+			if (!value.isArray() || value.type() != v4l2Id->type() ||
+			    value.numElements() != v4l2Id->numElements())
+				value = ControlValue(v4l2Id->type(),
+						     v4l2Id->numElements());
+
+			v4l2Ctrls[i].size = value.dataSize();
+			v4l2Ctrls[i].ptr = value.data();
+		} else if (value.isArray()) {
+			LOG(V4L2, Error)
+				<< "Control '" << id->name() << "' is not an array";
+			return -EINVAL;
+		}
+
 		i++;
 	}
 
@@ -219,27 +382,35 @@ int V4L2Device::getControls(ControlList *ctrls)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in, or nullptr
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is a
- * compound control, or if any other error occurs during validation of
- * the requested controls, no control is written and this method returns
- * -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is an array or
+ * compound control whose value doesn't match the control payload size, or if
+ * any other error occurs during validation of the requested controls, no
+ * control is written and this method returns -EINVAL.
+ *
+ * The payload of array and compound controls is passed to the kernel directly
+ * from the storage of the array ControlValue, without intermediate copies.
  *
  * If an error occurs while writing the controls, the index of the first
  * control that couldn't be written is returned. All controls below that index
  * are written and their values are updated in \a ctrls, while all other
  * controls are not written and their values are not changed.
  *
+ * When a \a request is given, the controls are not applied immediately but
+ * stored in the request, and applied by the kernel when the request is queued,
+ * atomically with the buffers it contains.
+ *
  * \return 0 on success or an error code otherwise
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, MediaRequest *request)
 {
 	unsigned int count = ctrls->size();
 	if (count == 0)
@@ -249,7 +420,7 @@ int V4L2Device::setControls(ControlList *ctrls)
 	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
 
 	unsigned int i = 0;
-	for (const auto &ctrl : *ctrls) {
+	for (auto &ctrl : *ctrls) {
 		const ControlId *id = ctrl.first;
 		const auto iter = controls_.find(id->id());
 		if (iter == controls_.end()) {
@@ -260,8 +431,29 @@ int V4L2Device::setControls(ControlList *ctrls)
 
 		v4l2Ctrls[i].id = id->id();
 
+		/*
+		 * Pass the payload of array and compound controls to the
+		 * kernel directly from the ControlValue storage.
+		 */
+		const V4L2ControlId *v4l2Id =
+			static_cast<const V4L2ControlId *>(iter->first);
+		ControlValue &value = ctrl.second;
+		if (v4l2Id->hasPayload() || value.isArray()) {
+			if (!value.isArray() || value.type() != v4l2Id->type() ||
+			    value.numElements() != v4l2Id->numElements()) {
+				LOG(V4L2, Error)
+					<< "Invalid payload for control '"
+					<< id->name() << "'";
+				return -EINVAL;
+			}
+
+			v4l2Ctrls[i].size = value.dataSize();
+			v4l2Ctrls[i].ptr = value.data();
+			i++;
+			continue;
+		}
+
 		/* Set the v4l2_ext_control value for the write operation. */
-		const ControlValue &value = ctrl.second;
 		switch (id->type()) {
 		case ControlTypeInteger64:
 			v4l2Ctrls[i].value64 = value.get<int64_t>();
@@ -279,7 +471,12 @@ int V4L2Device::setControls(ControlList *ctrls)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls;
 	v4l2ExtCtrls.count = count;
 
@@ -303,9 +500,479 @@ int V4L2Device::setControls(ControlList *ctrls)
 
 	updateControls(ctrls, v4l2Ctrls, count);
 
+	/*
+	 * Update the cache right away instead of waiting for the events, so
+	 * that the values read back are consistent with the values just set.
+	 * Controls stored in a request are cached when the request applies
+	 * them and the corresponding events are received.
+	 */
+	if (!request && controlEventsEnabled_)
+		cacheControls(*ctrls, count);
+
 	return ret;
 }
 
+/**
+ * \brief Prepare a control batch for repeated access to a set of controls
+ * \param[out] batch The control batch to prepare
+ * \param[in] ids The V4L2 IDs of the controls
+ *
+ * Validate the controls identified by \a ids and prepare the \a batch to read
+ * or write them with getControls(V4L2ControlBatch *) and
+ * setControls(V4L2ControlBatch *, MediaRequest *). The values of the batch
+ * controls are initialised to 0.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL One of the controls is not supported by the device
+ */
+int V4L2Device::prepareControls(V4L2ControlBatch *batch,
+				const std::vector<unsigned int> &ids) const
+{
+	batch->device_ = nullptr;
+	batch->ctrls_.clear();
+	batch->types_.clear();
+
+	for (unsigned int id : ids) {
+		const auto iter = controls_.find(id);
+		if (iter == controls_.end()) {
+			LOG(V4L2, Error)
+				<< "Control " << utils::hex(id) << " not found";
+			batch->ctrls_.clear();
+			batch->types_.clear();
+			return -EINVAL;
+		}
+
+		const V4L2ControlId *v4l2Id =
+			static_cast<const V4L2ControlId *>(iter->first);
+		if (v4l2Id->hasPayload()) {
+			LOG(V4L2, Error)
+				<< "Control " << utils::hex(id)
+				<< " has a payload, not supported in batches";
+			batch->ctrls_.clear();
+			batch->types_.clear();
+			return -EINVAL;
+		}
+
+		struct v4l2_ext_control ctrl = {};
+		ctrl.id = id;
+		batch->ctrls_.push_back(ctrl);
+		batch->types_.push_back(iter->first->type());
+	}
+
+	batch->device_ = this;
+
+	return 0;
+}
+
+/**
+ * \brief Read the controls of a prepared batch from the device
+ * \param[inout] batch The control batch
+ *
+ * This method reads the value of all controls of \a batch with a single ioctl.
+ * When all the batch controls are cached through control change events, the
+ * values are read from the cache instead.
+ *
+ * \sa getControls(ControlList *)
+ *
+ * \return 0 on success or an error code otherwise
+ * \retval -EINVAL The batch hasn't been prepared by this device
+ * \retval i The index of the control that failed
+ */
+int V4L2Device::getControls(V4L2ControlBatch *batch)
+{
+	if (batch->device_ != this) {
+		LOG(V4L2, Error) << "Invalid control batch";
+		return -EINVAL;
+	}
+
+	unsigned int count = batch->size();
+	if (count == 0)
+		return 0;
+
+	if (controlEventsEnabled_) {
+		bool cached = true;
+		for (const struct v4l2_ext_control &ctrl : batch->ctrls_) {
+			if (!controlValues_.count(ctrl.id)) {
+				cached = false;
+				break;
+			}
+		}
+
+		if (cached) {
+			for (unsigned int i = 0; i < count; ++i)
+				batch->set(i, controlValues_[batch->id(i)]);
+			return 0;
+		}
+	}
+
+	struct v4l2_ext_controls v4l2ExtCtrls = {};
+	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	v4l2ExtCtrls.controls = batch->ctrls_.data();
+	v4l2ExtCtrls.count = count;
+
+	int ret = ioctl(VIDIOC_G_EXT_CTRLS, &v4l2ExtCtrls);
+	if (ret) {
+		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+
+		if (errorIdx == 0 || errorIdx >= count) {
+			LOG(V4L2, Error) << "Unable to read controls: "
+					 << strerror(-ret);
+			return -EINVAL;
+		}
+
+		LOG(V4L2, Error) << "Unable to read control " << errorIdx
+				 << ": " << strerror(-ret);
+		return errorIdx;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Write the controls of a prepared batch to the device
+ * \param[inout] batch The control batch
+ * \param[in] request The media request to store the controls in, or nullptr
+ *
+ * This method writes the value of all controls of \a batch with a single
+ * ioctl, and stores the values actually applied to the device in the batch.
+ *
+ * \sa setControls(ControlList *, MediaRequest *)
+ *
+ * \return 0 on success or an error code otherwise
+ * \retval -EINVAL The batch hasn't been prepared by this device
+ * \retval i The index of the control that failed
+ */
+int V4L2Device::setControls(V4L2ControlBatch *batch, MediaRequest *request)
+{
+	if (batch->device_ != this) {
+		LOG(V4L2, Error) << "Invalid control batch";
+		return -EINVAL;
+	}
+
+	unsigned int count = batch->size();
+	if (count == 0)
+		return 0;
+
+	struct v4l2_ext_controls v4l2ExtCtrls = {};
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
+	v4l2ExtCtrls.controls = batch->ctrls_.data();
+	v4l2ExtCtrls.count = count;
+
+	int ret = ioctl(VIDIOC_S_EXT_CTRLS, &v4l2ExtCtrls);
+	if (ret) {
+		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+
+		if (errorIdx == 0 || errorIdx >= count) {
+			LOG(V4L2, Error) << "Unable to set controls: "
+					 << strerror(-ret);
+			return -EINVAL;
+		}
+
+		LOG(V4L2, Error) << "Unable to set control " << errorIdx
+				 << ": " << strerror(-ret);
+		count = errorIdx - 1;
+		ret = errorIdx;
+	}
+
+	if (!request && controlEventsEnabled_)
+		cacheControls(*batch, count);
+
+	return ret;
+}
+
+/**
+ * \brief Enable or disable frame start event notification
+ * \param[in] enable True to enable frame start events, false to disable them
+ *
+ * This function enables or disables generation of frame start events. Once
+ * enabled, the events are signalled through the frameStart signal.
+ *
+ * Frame start events are generated by drivers that support the
+ * V4L2_EVENT_FRAME_SYNC event, usually when the first line of a frame is
+ * received, and provide a more accurate start of exposure reference than
+ * buffer completion.
+ *
+ * \return 0 on success, a negative error code otherwise
+ */
+int V4L2Device::setFrameStartEnabled(bool enable)
+{
+	if (frameStartEnabled_ == enable)
+		return 0;
+
+	struct v4l2_event_subscription event{};
+	event.type = V4L2_EVENT_FRAME_SYNC;
+
+	unsigned long request = enable ? VIDIOC_SUBSCRIBE_EVENT
+			      : VIDIOC_UNSUBSCRIBE_EVENT;
+	int ret = ioctl(request, &event);
+	if (enable && ret) {
+		LOG(V4L2, Debug)
+			<< "Unable to subscribe to frame start events: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	frameStartEnabled_ = enable;
+	updateEventNotifier();
+
+	return ret;
+}
+
+/**
+ * \brief Enable or disable control value caching through control change events
+ * \param[in] enable True to enable the control cache, false to disable it
+ *
+ * Reading controls with getControls() requires a round trip to the device,
+ * which is costly for controls read back for every frame. This function
+ * subscribes to V4L2_EVENT_CTRL value change events for all the controls that
+ * report changes through events, and keeps a cache of their current values up
+ * to date from the events. While enabled, getControls() serves reads of cached
+ * controls without any ioctl.
+ *
+ * Volatile controls, whose value is changed by the hardware without
+ * generating events, and write-only controls are never cached, and reading
+ * them still accesses the device.
+ *
+ * \return 0 on success, a negative error code otherwise
+ */
+int V4L2Device::setControlEventsEnabled(bool enable)
+{
+	if (controlEventsEnabled_ == enable)
+		return 0;
+
+	if (!enable) {
+		subscribeControlEvents(VIDIOC_UNSUBSCRIBE_EVENT);
+		controlEventsEnabled_ = false;
+		controlValues_.clear();
+		updateEventNotifier();
+		return 0;
+	}
+
+	int ret = subscribeControlEvents(VIDIOC_SUBSCRIBE_EVENT);
+	if (ret) {
+		LOG(V4L2, Debug)
+			<< "Unable to subscribe to control events: "
+			<< strerror(-ret);
+		subscribeControlEvents(VIDIOC_UNSUBSCRIBE_EVENT);
+		return ret;
+	}
+
+	/*
+	 * Seed the cache with the current values. The events are subscribed
+	 * first, such that any change racing with the read is reported by an
+	 * event and no update is lost.
+	 */
+	ControlList ctrls(controls_);
+	for (unsigned int id : eventControls_)
+		ctrls.set(id, ControlValue(0));
+
+	ret = getControls(&ctrls);
+	if (ret) {
+		LOG(V4L2, Error) << "Unable to read controls for the cache";
+		subscribeControlEvents(VIDIOC_UNSUBSCRIBE_EVENT);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	cacheControls(ctrls, ctrls.size());
+	controlEventsEnabled_ = true;
+	updateEventNotifier();
+
+	return 0;
+}
+
+/**
+ * \fn V4L2Device::controlEventsEnabled()
+ * \brief Check if control values are cached through control change events
+ * \return True if control change events are enabled, false otherwise
+ */
+
+/**
+ * \var V4L2Device::frameStart
+ * \brief A Signal emitted when capture of a frame has started
+ *
+ * The signal carries the frame sequence number and the time at which the
+ * event was generated, expressed in nanoseconds on the same clock as buffer
+ * timestamps. Frame start events are only emitted once enabled with
+ * setFrameStartEnabled().
+ */
+
+/**
+ * \brief Slot to handle V4L2 events from the V4L2 device
+ * \param[in] notifier The event notifier
+ *
+ * When this slot is called, a V4L2 event is available to be dequeued from the
+ * device.
+ */
+void V4L2Device::eventAvailable(EventNotifier *notifier)
+{
+	struct v4l2_event event{};
+	int ret = ioctl(VIDIOC_DQEVENT, &event);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Failed to dequeue event, disabling event notifier";
+		notifier->setEnabled(false);
+		return;
+	}
+
+	switch (event.type) {
+	case V4L2_EVENT_FRAME_SYNC: {
+		uint64_t timestamp = event.timestamp.tv_sec * 1000000000ULL
+				   + event.timestamp.tv_nsec;
+		frameStart.emit(event.u.frame_sync.frame_sequence, timestamp);
+		break;
+	}
+
+	case V4L2_EVENT_CTRL:
+		controlChanged(event);
+		break;
+
+	default:
+		LOG(V4L2, Error)
+			<< "Spurious event (" << event.type
+			<< "), disabling event notifier";
+		notifier->setEnabled(false);
+		break;
+	}
+}
+
+/*
+ * \brief Update the control cache from a control change event
+ * \param[in] event The V4L2_EVENT_CTRL event
+ */
+void V4L2Device::controlChanged(const struct v4l2_event &event)
+{
+	if (!controlEventsEnabled_)
+		return;
+
+	const struct v4l2_event_ctrl &ctrl = event.u.ctrl;
+	if (!(ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE))
+		return;
+
+	auto iter = controlValues_.find(event.id);
+	if (iter == controlValues_.end())
+		return;
+
+	ControlValue &value = iter->second;
+	if (value.type() == ControlTypeInteger64)
+		value.set<int64_t>(ctrl.value64);
+	else
+		value.set<int32_t>(ctrl.value);
+}
+
+/*
+ * \brief Subscribe or unsubscribe control change events for cached controls
+ * \param[in] request VIDIOC_SUBSCRIBE_EVENT or VIDIOC_UNSUBSCRIBE_EVENT
+ *
+ * Events are subscribed with feedback enabled, such that control changes
+ * applied through this file handle, including through media requests, are
+ * reported too.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2Device::subscribeControlEvents(unsigned long request)
+{
+	for (unsigned int id : eventControls_) {
+		struct v4l2_event_subscription event{};
+		event.type = V4L2_EVENT_CTRL;
+		event.id = id;
+		event.flags = V4L2_EVENT_SUB_FL_ALLOW_FEEDBACK;
+
+		int ret = ioctl(request, &event);
+		if (ret && request == VIDIOC_SUBSCRIBE_EVENT)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * \brief Enable the event notifier when any event type is enabled
+ */
+void V4L2Device::updateEventNotifier()
+{
+	bool enable = frameStartEnabled_ || controlEventsEnabled_;
+
+	if (!fdEventNotifier_) {
+		if (!enable)
+			return;
+
+		fdEventNotifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+		fdEventNotifier_->activated.connect(this, &V4L2Device::eventAvailable);
+	}
+
+	fdEventNotifier_->setEnabled(enable);
+}
+
+/*
+ * \brief Read controls from the cache
+ * \param[inout] ctrls The list of controls to read
+ *
+ * The controls are only read from the cache if all of them are cached.
+ *
+ * \return True if the controls have been read from the cache, false otherwise
+ */
+bool V4L2Device::getCachedControls(ControlList *ctrls)
+{
+	if (!controlEventsEnabled_)
+		return false;
+
+	for (const auto &ctrl : *ctrls) {
+		if (!controlValues_.count(ctrl.first->id()))
+			return false;
+	}
+
+	for (auto &ctrl : *ctrls)
+		ctrl.second = controlValues_[ctrl.first->id()];
+
+	return true;
+}
+
+/*
+ * \brief Store the value of the first \a count controls of \a ctrls in the cache
+ * \param[in] ctrls The list of controls
+ * \param[in] count The number of controls to store
+ *
+ * Only controls that report changes through events are stored.
+ */
+void V4L2Device::cacheControls(const ControlList &ctrls, unsigned int count)
+{
+	unsigned int i = 0;
+	for (const auto &ctrl : ctrls) {
+		if (i++ == count)
+			break;
+
+		unsigned int id = ctrl.first->id();
+		if (std::find(eventControls_.begin(), eventControls_.end(), id) ==
+		    eventControls_.end())
+			continue;
+
+		controlValues_[id] = ctrl.second;
+	}
+}
+
+/*
+ * \brief Store the value of the first \a count controls of \a batch in the cache
+ * \param[in] batch The control batch
+ * \param[in] count The number of controls to store
+ */
+void V4L2Device::cacheControls(const V4L2ControlBatch &batch,
+			       unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int id = batch.id(i);
+		if (std::find(eventControls_.begin(), eventControls_.end(), id) ==
+		    eventControls_.end())
+			continue;
+
+		controlValues_[id] = batch.get(i);
+	}
+}
+
 /**
  * \brief Perform an IOCTL system call on the device node
  * \param[in] request The IOCTL request code
@@ -355,24 +1022,27 @@ void V4L2Device::listControls()
 		    ctrl.flags & V4L2_CTRL_FLAG_DISABLED)
 			continue;
 
-		if (ctrl.elems != 1 || ctrl.nr_of_dims) {
-			LOG(V4L2, Debug)
-				<< "Array control " << utils::hex(ctrl.id)
-				<< " not supported";
-			continue;
-		}
-
 		switch (ctrl.type) {
-		case V4L2_CTRL_TYPE_INTEGER:
 		case V4L2_CTRL_TYPE_BOOLEAN:
 		case V4L2_CTRL_TYPE_MENU:
 		case V4L2_CTRL_TYPE_BUTTON:
-		case V4L2_CTRL_TYPE_INTEGER64:
 		case V4L2_CTRL_TYPE_BITMASK:
 		case V4L2_CTRL_TYPE_INTEGER_MENU:
+			if (ctrl.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD) {
+				LOG(V4L2, Debug)
+					<< "Array control " << utils::hex(ctrl.id)
+					<< " not supported";
+				continue;
+			}
 			break;
-		/* \todo Support compound controls. */
+		case V4L2_CTRL_TYPE_INTEGER:
+		case V4L2_CTRL_TYPE_INTEGER64:
+			break;
+		/* \todo Support string controls. */
 		default:
+			if (ctrl.type >= V4L2_CTRL_COMPOUND_TYPES)
+				break;
+
 			LOG(V4L2, Debug)
 				<< "Control " << utils::hex(ctrl.id)
 				<< " has unsupported type " << ctrl.type;
@@ -381,6 +1051,17 @@ void V4L2Device::listControls()
 
 		controlIds_.emplace_back(utils::make_unique<V4L2ControlId>(ctrl));
 		ctrls.emplace(controlIds_.back().get(), V4L2ControlRange(ctrl));
+
+		/*
+		 * Volatile controls change without generating events,
+		 * write-only controls can't be read, and events don't carry
+		 * payloads, they can't be cached.
+		 */
+		if (ctrl.type != V4L2_CTRL_TYPE_BUTTON &&
+		    !(ctrl.flags & (V4L2_CTRL_FLAG_VOLATILE |
+				    V4L2_CTRL_FLAG_WRITE_ONLY |
+				    V4L2_CTRL_FLAG_HAS_PAYLOAD)))
+			eventControls_.push_back(ctrl.id);
 	}
 
 	controls_ = std::move(ctrls);
@@ -406,6 +1087,12 @@ void V4L2Device::updateControls(ControlList *ctrls,
 		const ControlId *id = ctrl.first;
 		ControlValue &value = ctrl.second;
 
+		/* Payloads are accessed in place by the kernel. */
+		if (value.isArray()) {
+			i++;
+			continue;
+		}
+
 		switch (id->type()) {
 		case ControlTypeInteger64:
 			value.set<int64_t>(v4l2Ctrl->value64);
@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * v4l2_formats_cache.cpp - Cache of V4L2 device formats enumeration
+ */
+
+#include "v4l2_formats_cache.h"
+
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file v4l2_formats_cache.h
+ * \brief Cache of V4L2 device formats enumeration
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(V4L2)
+
+namespace {
+
+const char *const CacheHeader = "# libcamera V4L2 formats cache v1";
+
+} /* namespace */
+
+/**
+ * \class V4L2FormatsCache
+ * \brief Process-wide cache of the formats supported by V4L2 video devices
+ *
+ * Enumerating the pixel formats and frame sizes supported by a V4L2 video
+ * device requires one ioctl per format and per frame size, which adds up to a
+ * noticeable delay when several devices are enumerated. The V4L2FormatsCache
+ * stores the result of V4L2VideoDevice::formats() indexed by a device identity
+ * string, such that subsequent enumerations of the same device can skip the
+ * ioctls.
+ *
+ * The identity string is computed by the caller and shall uniquely identify
+ * the device and its formats. It typically combines the device node, the
+ * driver name, card, bus information and version, and the sysfs path of the
+ * device. A change in any of those invalidates the cached entry.
+ *
+ * The cache can optionally be persisted to disk, to speed up cold start of
+ * new processes. This is enabled by setting the LIBCAMERA_V4L2_FORMATS_CACHE
+ * environment variable to the path of the cache file. The file is loaded when
+ * the cache is first used, and rewritten every time a new entry is stored.
+ */
+
+V4L2FormatsCache::V4L2FormatsCache()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_V4L2_FORMATS_CACHE");
+	if (path && *path) {
+		path_ = path;
+		load();
+	}
+}
+
+/**
+ * \brief Retrieve the formats cache instance
+ * \return The formats cache
+ */
+V4L2FormatsCache *V4L2FormatsCache::instance()
+{
+	static V4L2FormatsCache instance;
+	return &instance;
+}
+
+/**
+ * \brief Look up the formats of a device in the cache
+ * \param[in] identity The device identity
+ * \param[out] formats The cached formats
+ * \return True if the device has been found in the cache, false otherwise
+ */
+bool V4L2FormatsCache::lookup(const std::string &identity, ImageFormats *formats)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = cache_.find(identity);
+	if (it == cache_.end())
+		return false;
+
+	*formats = it->second;
+	return true;
+}
+
+/**
+ * \brief Store the formats of a device in the cache
+ * \param[in] identity The device identity
+ * \param[in] formats The formats supported by the device
+ */
+void V4L2FormatsCache::store(const std::string &identity,
+			     const ImageFormats &formats)
+{
+	MutexLocker locker(mutex_);
+
+	cache_[identity] = formats;
+
+	if (!path_.empty())
+		save();
+}
+
+/**
+ * \brief Load the cache from disk
+ *
+ * The cache file contains one device record per line. Each record starts with
+ * the length of the identity string, followed by the identity itself, the
+ * number of formats, and for each format, its fourcc, the number of sizes and
+ * all size ranges. Malformed records cause the rest of the file to be ignored.
+ */
+void V4L2FormatsCache::load()
+{
+	std::ifstream file(path_);
+	if (!file.is_open())
+		return;
+
+	std::string line;
+	if (!std::getline(file, line) || line != CacheHeader) {
+		LOG(V4L2, Warning)
+			<< "Ignoring invalid formats cache " << path_;
+		return;
+	}
+
+	while (std::getline(file, line)) {
+		std::istringstream record(line);
+		std::size_t length;
+
+		if (!(record >> length) || record.get() != ' ')
+			break;
+
+		std::string identity(length, '\0');
+		if (!record.read(&identity[0], length))
+			break;
+
+		ImageFormats formats;
+		unsigned int numFormats;
+		if (!(record >> numFormats))
+			break;
+
+		bool valid = true;
+		for (unsigned int i = 0; i < numFormats && valid; ++i) {
+			unsigned int fourcc;
+			unsigned int numSizes;
+			if (!(record >> fourcc >> numSizes)) {
+				valid = false;
+				break;
+			}
+
+			std::vector<SizeRange> sizes;
+			for (unsigned int j = 0; j < numSizes; ++j) {
+				SizeRange range;
+				if (!(record >> range.min.width >> range.min.height
+					     >> range.max.width >> range.max.height
+					     >> range.hStep >> range.vStep)) {
+					valid = false;
+					break;
+				}
+
+				sizes.push_back(range);
+			}
+
+			if (valid && formats.addFormat(fourcc, sizes))
+				valid = false;
+		}
+
+		if (!valid)
+			break;
+
+		cache_[identity] = formats;
+	}
+
+	LOG(V4L2, Debug)
+		<< "Loaded " << cache_.size() << " devices from formats cache";
+}
+
+/**
+ * \brief Save the cache to disk
+ *
+ * The cache is written to a temporary file renamed to the cache file, to
+ * guarantee that concurrent readers never see a partially written cache.
+ */
+void V4L2FormatsCache::save()
+{
+	std::string tmpPath = path_ + "." + std::to_string(getpid());
+
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file.is_open()) {
+			LOG(V4L2, Warning)
+				<< "Failed to write formats cache " << path_;
+			return;
+		}
+
+		file << CacheHeader << std::endl;
+
+		for (const auto &entry : cache_) {
+			const std::string &identity = entry.first;
+			const auto &data = entry.second.data();
+
+			file << identity.size() << " " << identity << " "
+			     << data.size();
+
+			for (const auto &format : data) {
+				file << " " << format.first << " "
+				     << format.second.size();
+
+				for (const SizeRange &range : format.second)
+					file << " " << range.min.width
+					     << " " << range.min.height
+					     << " " << range.max.width
+					     << " " << range.max.height
+					     << " " << range.hStep
+					     << " " << range.vStep;
+			}
+
+			file << std::endl;
+		}
+
+		if (!file.good()) {
+			LOG(V4L2, Warning)
+				<< "Failed to write formats cache " << path_;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		int ret = -errno;
+		LOG(V4L2, Warning)
+			<< "Failed to update formats cache " << path_ << ": "
+			<< strerror(-ret);
+		unlink(tmpPath.c_str());
+	}
+}
+
+} /* namespace libcamera */
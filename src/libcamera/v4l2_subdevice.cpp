@@ -14,6 +14,7 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <linux/media.h>
 #include <linux/v4l2-subdev.h>
 
 #include <libcamera/geometry.h>
@@ -32,6 +33,18 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(V4L2)
 
+namespace {
+
+/* The pseudo selection target used to cache the pad formats. */
+constexpr unsigned int FormatTarget = ~0U;
+
+bool operator==(const V4L2SubdeviceFormat &lhs, const V4L2SubdeviceFormat &rhs)
+{
+	return lhs.mbus_code == rhs.mbus_code && lhs.size == rhs.size;
+}
+
+} /* namespace */
+
 /**
  * \struct V4L2SubdeviceFormat
  * \brief The V4L2 sub-device image format and sizes
@@ -93,6 +106,21 @@ const std::string V4L2SubdeviceFormat::toString() const
  * path of the entity's device node. No API call other than open(), isOpen()
  * and close() shall be called on an unopened device instance. Upon destruction
  * any device left open will be closed, and any resources released.
+ *
+ * Pipeline handlers configure the whole media graph every time a camera is
+ * configured, and most of the pad formats and selection rectangles are left
+ * unchanged when switching between modes. As each format or selection ioctl
+ * may trigger a costly revalidation in the driver, the subdevice caches the
+ * last value requested for each pad along with the value applied by the
+ * driver, and skips the ioctl when the same value is requested again.
+ *
+ * The driver propagates the settings of a subdevice downstream, from the sink
+ * pad format to the sink crop and compose rectangles, and then from the source
+ * crop and compose rectangles to the source pad formats. Setting a value thus
+ * invalidates the cached values of the next stages, which are applied again
+ * the next time they're requested. The cache assumes that no other user
+ * modifies the subdevice configuration behind its back, invalidateCache() shall
+ * be called otherwise.
  */
 
 /**
@@ -115,6 +143,8 @@ V4L2Subdevice::~V4L2Subdevice()
  */
 int V4L2Subdevice::open()
 {
+	invalidateCache();
+
 	return V4L2Device::open(O_RDWR);
 }
 
@@ -124,6 +154,44 @@ int V4L2Subdevice::open()
  * \return The subdevice's associated media entity.
  */
 
+/**
+ * \brief Retrieve a selection rectangle from one of the V4L2 subdevice pads
+ * \param[in] pad The 0-indexed pad number to query
+ * \param[in] target The selection target, one of the V4L2_SEL_TGT_* values
+ * \param[out] rect The retrieved rectangle
+ *
+ * Subdevices that don't implement the selection API, or the requested target,
+ * return -ENOTTY or -EINVAL. As the selection API is optional, those errors are
+ * not logged.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2Subdevice::getSelection(unsigned int pad, unsigned int target,
+				Rectangle *rect)
+{
+	struct v4l2_subdev_selection sel = {};
+
+	sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	sel.pad = pad;
+	sel.target = target;
+
+	int ret = ioctl(VIDIOC_SUBDEV_G_SELECTION, &sel);
+	if (ret < 0) {
+		if (ret != -ENOTTY && ret != -EINVAL)
+			LOG(V4L2, Error)
+				<< "Unable to get rectangle " << target
+				<< " on pad " << pad << ": " << strerror(-ret);
+		return ret;
+	}
+
+	rect->x = sel.r.left;
+	rect->y = sel.r.top;
+	rect->w = sel.r.width;
+	rect->h = sel.r.height;
+
+	return 0;
+}
+
 /**
  * \brief Set a crop rectangle on one of the V4L2 subdevice pads
  * \param[in] pad The 0-indexed pad number the rectangle is to be applied to
@@ -214,7 +282,8 @@ int V4L2Subdevice::getFormat(unsigned int pad, V4L2SubdeviceFormat *format)
  *
  * Apply the requested image format to the desired media pad and return the
  * actually applied format parameters, as \ref V4L2Subdevice::getFormat would
- * do.
+ * do. The device isn't accessed if the same format has been requested by the
+ * previous call for the pad and hasn't been invalidated since then.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -227,8 +296,18 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format)
 	subdevFmt.format.height = format->size.height;
 	subdevFmt.format.code = format->mbus_code;
 
+	auto cached = formats_.find(pad);
+	if (cached != formats_.end() && cached->second.first == *format) {
+		*format = cached->second.second;
+		return 0;
+	}
+
+	const V4L2SubdeviceFormat requested = *format;
+
 	int ret = ioctl(VIDIOC_SUBDEV_S_FMT, &subdevFmt);
+	invalidate(pad, FormatTarget);
 	if (ret) {
+		formats_.erase(pad);
 		LOG(V4L2, Error)
 			<< "Unable to set format on pad " << pad
 			<< ": " << strerror(-ret);
@@ -239,9 +318,25 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format)
 	format->size.height = subdevFmt.format.height;
 	format->mbus_code = subdevFmt.format.code;
 
+	formats_[pad] = { requested, *format };
+
 	return 0;
 }
 
+/**
+ * \brief Invalidate the cached pad formats and selection rectangles
+ *
+ * The values cached by setFormat(), setCrop() and setCompose() are discarded,
+ * the next calls to those methods are applied to the device unconditionally.
+ * This method shall be called when the subdevice configuration may have been
+ * modified without going through this instance.
+ */
+void V4L2Subdevice::invalidateCache()
+{
+	formats_.clear();
+	selections_.clear();
+}
+
 /**
  * \brief Create a new video subdevice instance from \a entity in media device
  * \a media
@@ -342,8 +437,19 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 	sel.r.width = rect->w;
 	sel.r.height = rect->h;
 
+	const std::pair<unsigned int, unsigned int> key{ pad, target };
+	auto cached = selections_.find(key);
+	if (cached != selections_.end() && cached->second.first == *rect) {
+		*rect = cached->second.second;
+		return 0;
+	}
+
+	const Rectangle requested = *rect;
+
 	int ret = ioctl(VIDIOC_SUBDEV_S_SELECTION, &sel);
+	invalidate(pad, target);
 	if (ret < 0) {
+		selections_.erase(key);
 		LOG(V4L2, Error)
 			<< "Unable to set rectangle " << target << " on pad "
 			<< pad << ": " << strerror(-ret);
@@ -355,7 +461,66 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 	rect->w = sel.r.width;
 	rect->h = sel.r.height;
 
+	selections_[key] = { requested, *rect };
+
 	return 0;
 }
 
+/*
+ * Compute the position of the \a target of a \a pad in the order in which the
+ * driver propagates the configuration through the subdevice. Pads that can't
+ * be identified are considered as sink pads.
+ */
+unsigned int V4L2Subdevice::stage(unsigned int pad, unsigned int target) const
+{
+	const std::vector<MediaPad *> &pads = entity_->pads();
+	bool source = pad < pads.size() &&
+		      pads[pad]->flags() & MEDIA_PAD_FL_SOURCE;
+
+	unsigned int index;
+	switch (target) {
+	case FormatTarget:
+		index = source ? 2 : 0;
+		break;
+	case V4L2_SEL_TGT_CROP:
+		index = source ? 0 : 1;
+		break;
+	default:
+		index = source ? 1 : 2;
+		break;
+	}
+
+	return source ? 3 + index : index;
+}
+
+/*
+ * Invalidate the cached values that a driver may have modified when the
+ * \a target of a \a pad is set. The settings of sink pads propagate to all
+ * pads, while the settings of source pads only propagate to the next stages of
+ * the same pad.
+ */
+void V4L2Subdevice::invalidate(unsigned int pad, unsigned int target)
+{
+	unsigned int limit = stage(pad, target);
+	bool sink = limit < 3;
+
+	auto affected = [&](unsigned int p, unsigned int t) {
+		return (sink || p == pad) && stage(p, t) > limit;
+	};
+
+	for (auto it = formats_.begin(); it != formats_.end();) {
+		if (affected(it->first, FormatTarget))
+			it = formats_.erase(it);
+		else
+			++it;
+	}
+
+	for (auto it = selections_.begin(); it != selections_.end();) {
+		if (affected(it->first.first, it->first.second))
+			it = selections_.erase(it);
+		else
+			++it;
+	}
+}
+
 } /* namespace libcamera */
@@ -7,23 +7,33 @@
 
 #include "v4l2_videodevice.h"
 
+#include <algorithm>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <iomanip>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/event_notifier.h>
+#include <libcamera/request.h>
 
 #include "log.h"
 #include "media_device.h"
 #include "media_object.h"
+#include "media_request.h"
+#include "thread_pool.h"
+#include "tracepoints.h"
 #include "utils.h"
+#include "v4l2_formats_cache.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -272,8 +282,9 @@ const std::string V4L2DeviceFormat::toString() const
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), multiPlanar_(false), bufferPool_(nullptr),
-	  fdEvent_(nullptr), streaming_(false)
+	: V4L2Device(deviceNode), multiPlanar_(false), supportsRequests_(false),
+	  bufferPool_(nullptr),
+	  queuedCount_(0), fdEvent_(nullptr), streaming_(false)
 {
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
@@ -700,12 +711,21 @@ int V4L2VideoDevice::setFormatSingleplane(V4L2DeviceFormat *format)
  *
  * Enumerate all pixel formats and frame sizes supported by the video device.
  *
+ * Enumeration results are cached by the V4L2FormatsCache, indexed by the
+ * device identity, and subsequent calls for the same device don't access the
+ * device.
+ *
  * \return A list of the supported video device formats
  */
 ImageFormats V4L2VideoDevice::formats()
 {
 	ImageFormats formats;
 
+	std::string identity = formatsIdentity();
+	if (!identity.empty() &&
+	    V4L2FormatsCache::instance()->lookup(identity, &formats))
+		return formats;
+
 	for (unsigned int pixelformat : enumPixelformats()) {
 		std::vector<SizeRange> sizes = enumSizes(pixelformat);
 		if (sizes.empty())
@@ -719,9 +739,42 @@ ImageFormats V4L2VideoDevice::formats()
 		}
 	}
 
+	if (!identity.empty() && !formats.isEmpty())
+		V4L2FormatsCache::instance()->store(identity, formats);
+
 	return formats;
 }
 
+/**
+ * \brief Compute the identity of the device for the formats cache
+ *
+ * The identity combines the device node, the V4L2 capabilities and the sysfs
+ * path of the device, such that a different device, driver or bus location
+ * invalidates cached formats.
+ *
+ * \return The device identity, or an empty string if it can't be computed
+ */
+std::string V4L2VideoDevice::formatsIdentity()
+{
+	struct stat st;
+	if (fstat(fd(), &st) < 0 || !S_ISCHR(st.st_mode))
+		return std::string();
+
+	std::string sysfs = "/sys/dev/char/" + std::to_string(major(st.st_rdev))
+			  + ":" + std::to_string(minor(st.st_rdev));
+	char *path = realpath(sysfs.c_str(), nullptr);
+	if (!path)
+		return std::string();
+
+	std::ostringstream identity;
+	identity << deviceNode() << ":" << path << ":" << caps_.driver()
+		 << ":" << caps_.card() << ":" << caps_.bus_info()
+		 << ":" << caps_.version << ":" << bufferType_;
+	free(path);
+
+	return identity.str();
+}
+
 std::vector<unsigned int> V4L2VideoDevice::enumPixelformats()
 {
 	std::vector<unsigned int> formats;
@@ -826,6 +879,8 @@ int V4L2VideoDevice::requestBuffers(unsigned int count)
 
 	LOG(V4L2, Debug) << rb.count << " buffers requested.";
 
+	supportsRequests_ = rb.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+
 	return rb.count;
 }
 
@@ -857,39 +912,9 @@ int V4L2VideoDevice::exportBuffers(BufferPool *pool)
 
 	/* Map the buffers. */
 	for (i = 0; i < pool->count(); ++i) {
-		struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
-		struct v4l2_buffer buf = {};
-		BufferMemory &buffer = pool->buffers()[i];
-
-		buf.index = i;
-		buf.type = bufferType_;
-		buf.memory = memoryType_;
-		buf.length = VIDEO_MAX_PLANES;
-		buf.m.planes = planes;
-
-		ret = ioctl(VIDIOC_QUERYBUF, &buf);
-		if (ret < 0) {
-			LOG(V4L2, Error)
-				<< "Unable to query buffer " << i << ": "
-				<< strerror(-ret);
-			break;
-		}
-
-		if (multiPlanar_) {
-			for (unsigned int p = 0; p < buf.length; ++p) {
-				ret = createPlane(&buffer, i, p,
-						  buf.m.planes[p].length);
-				if (ret)
-					break;
-			}
-		} else {
-			ret = createPlane(&buffer, i, 0, buf.length);
-		}
-
-		if (ret) {
-			LOG(V4L2, Error) << "Failed to create plane";
+		ret = exportBuffer(&pool->buffers()[i], i);
+		if (ret)
 			break;
-		}
 	}
 
 	if (ret) {
@@ -899,10 +924,55 @@ int V4L2VideoDevice::exportBuffers(BufferPool *pool)
 	}
 
 	bufferPool_ = pool;
+	setQueueSize(pool->count());
 
 	return 0;
 }
 
+int V4L2VideoDevice::exportBuffer(BufferMemory *buffer, unsigned int index)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_buffer buf = {};
+	int ret;
+
+	buf.index = index;
+	buf.type = bufferType_;
+	buf.memory = memoryType_;
+	buf.length = VIDEO_MAX_PLANES;
+	buf.m.planes = planes;
+
+	ret = ioctl(VIDIOC_QUERYBUF, &buf);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to query buffer " << index << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (multiPlanar_) {
+		if (buf.length > PlaneArray::Capacity) {
+			LOG(V4L2, Error)
+				<< "Buffer " << index << " has too many planes ("
+				<< buf.length << ")";
+			return -EINVAL;
+		}
+
+		for (unsigned int p = 0; p < buf.length; ++p) {
+			ret = createPlane(buffer, index, p,
+					  buf.m.planes[p].length);
+			if (ret)
+				break;
+		}
+	} else {
+		ret = createPlane(buffer, index, 0, buf.length);
+	}
+
+	if (ret)
+		LOG(V4L2, Error) << "Failed to create plane";
+
+	return ret;
+}
+
 int V4L2VideoDevice::createPlane(BufferMemory *buffer, unsigned int index,
 				 unsigned int planeIndex, unsigned int length)
 {
@@ -940,11 +1010,32 @@ int V4L2VideoDevice::createPlane(BufferMemory *buffer, unsigned int index,
  * \return 0 on success or a negative error code otherwise
  */
 int V4L2VideoDevice::importBuffers(BufferPool *pool)
+{
+	return importBuffers(pool, V4L2_MEMORY_DMABUF);
+}
+
+/**
+ * \brief Import the application allocated \a pool of user pointer buffers
+ * \param[in] pool BufferPool of buffers to import
+ *
+ * Set up the device to capture to or output from memory allocated by the
+ * application and identified by CPU addresses, using the V4L2 USERPTR memory
+ * type. The planes of the \a pool buffers shall be set with
+ * Plane::setUserPtr() before the buffers are queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::importUserPtrBuffers(BufferPool *pool)
+{
+	return importBuffers(pool, V4L2_MEMORY_USERPTR);
+}
+
+int V4L2VideoDevice::importBuffers(BufferPool *pool, enum v4l2_memory memory)
 {
 	unsigned int allocatedBuffers;
 	int ret;
 
-	memoryType_ = V4L2_MEMORY_DMABUF;
+	memoryType_ = memory;
 
 	ret = requestBuffers(pool->count());
 	if (ret < 0)
@@ -960,6 +1051,80 @@ int V4L2VideoDevice::importBuffers(BufferPool *pool)
 
 	LOG(V4L2, Debug) << "provided pool of " << pool->count() << " buffers";
 	bufferPool_ = pool;
+	setQueueSize(pool->count());
+
+	return 0;
+}
+
+/**
+ * \brief Allocate additional buffers while the device is in use
+ * \param[in] count The number of buffers to add
+ *
+ * This method grows the set of buffers of the device using VIDIOC_CREATE_BUFS,
+ * without affecting the buffers already allocated or queued. It can be called
+ * while streaming. The buffer pool passed to exportBuffers() or importBuffers()
+ * shall have been grown by \a count buffers beforehand with
+ * BufferPool::addBuffers().
+ *
+ * For internally allocated buffers, the new buffers are exported to their
+ * entries in the buffer pool. The buffers are sized for the current format.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::addBuffers(unsigned int count)
+{
+	if (!bufferPool_)
+		return -EINVAL;
+
+	unsigned int first = queuedBuffers_.size();
+	if (bufferPool_->count() != first + count) {
+		LOG(V4L2, Error) << "Buffer pool hasn't been grown";
+		return -EINVAL;
+	}
+
+	struct v4l2_create_buffers cb = {};
+	cb.count = count;
+	cb.memory = memoryType_;
+	cb.format.type = bufferType_;
+
+	int ret = ioctl(VIDIOC_G_FMT, &cb.format);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to get format: " << strerror(-ret);
+		return ret;
+	}
+
+	ret = ioctl(VIDIOC_CREATE_BUFS, &cb);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to create " << count << " buffers: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	/*
+	 * Buffers can't be freed individually, a partial allocation leaves the
+	 * extra buffers unused until all buffers are released.
+	 */
+	if (cb.index != first || cb.count != count) {
+		LOG(V4L2, Error)
+			<< "Created " << cb.count << " buffers at index "
+			<< cb.index << ", expected " << count << " at index "
+			<< first;
+		return -ENOMEM;
+	}
+
+	if (memoryType_ == V4L2_MEMORY_MMAP) {
+		for (unsigned int i = first; i < first + count; ++i) {
+			ret = exportBuffer(&bufferPool_->buffers()[i], i);
+			if (ret)
+				return ret;
+		}
+	}
+
+	queuedBuffers_.resize(first + count, nullptr);
+
+	LOG(V4L2, Debug) << "Added " << count << " buffers";
 
 	return 0;
 }
@@ -972,22 +1137,39 @@ int V4L2VideoDevice::releaseBuffers()
 	LOG(V4L2, Debug) << "Releasing bufferPool";
 
 	bufferPool_ = nullptr;
+	setQueueSize(0);
 
 	return requestBuffers(0);
 }
 
+/**
+ * \fn V4L2VideoDevice::supportsRequests()
+ * \brief Check if the device supports queueing buffers through media requests
+ *
+ * Support for requests is reported by the driver when buffers are allocated or
+ * imported, this method shall thus only be called after exportBuffers() or
+ * importBuffers().
+ *
+ * \return True if the device supports media requests, false otherwise
+ */
+
 /**
  * \brief Queue a buffer into the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to associate the buffer with, or nullptr
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
  * will be processed by the device. Once the device has finished processing the
  * buffer, it will be available for dequeue.
  *
+ * When a \a request is given, the buffer is associated with the media request
+ * and only handed to the driver when the request is queued. This requires the
+ * device to support requests, as reported by supportsRequests().
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(Buffer *buffer)
+int V4L2VideoDevice::queueBuffer(Buffer *buffer, MediaRequest *request)
 {
 	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
 	struct v4l2_buffer buf = {};
@@ -998,8 +1180,27 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 	buf.memory = memoryType_;
 	buf.field = V4L2_FIELD_NONE;
 
+	if (buf.index >= queuedBuffers_.size()) {
+		LOG(V4L2, Error) << "Invalid buffer index " << buf.index;
+		return -EINVAL;
+	}
+
+	if (request) {
+		if (!supportsRequests_) {
+			LOG(V4L2, Error) << "Requests are not supported";
+			return -ENOTSUP;
+		}
+
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
 	BufferMemory *mem = &bufferPool_->buffers()[buf.index];
-	const std::vector<Plane> &planes = mem->planes();
+	const PlaneArray &planes = mem->planes();
+
+	if (mem->deviceOnly())
+		buf.flags |= V4L2_BUF_FLAG_NO_CACHE_INVALIDATE |
+			     V4L2_BUF_FLAG_NO_CACHE_CLEAN;
 
 	if (buf.memory == V4L2_MEMORY_DMABUF) {
 		if (multiPlanar_) {
@@ -1008,6 +1209,29 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 		} else {
 			buf.m.fd = planes[0].dmabuf();
 		}
+	} else if (buf.memory == V4L2_MEMORY_USERPTR) {
+		if (planes.empty()) {
+			LOG(V4L2, Error)
+				<< "No user memory for buffer " << buf.index;
+			return -EINVAL;
+		}
+
+		/*
+		 * The planes reference user memory, mem() returns the address
+		 * without mapping anything.
+		 */
+		if (multiPlanar_) {
+			for (unsigned int p = 0; p < planes.size(); ++p) {
+				Plane &plane = mem->planes()[p];
+				v4l2Planes[p].m.userptr =
+					reinterpret_cast<unsigned long>(plane.mem());
+				v4l2Planes[p].length = plane.length();
+			}
+		} else {
+			Plane &plane = mem->planes()[0];
+			buf.m.userptr = reinterpret_cast<unsigned long>(plane.mem());
+			buf.length = plane.length();
+		}
 	}
 
 	if (multiPlanar_) {
@@ -1045,10 +1269,18 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 		return ret;
 	}
 
-	if (queuedBuffers_.empty())
+	LIBCAMERA_TRACEPOINT(v4l2_qbuf, "device=%s index=%u",
+			     deviceNode().c_str(), buf.index);
+
+	if (buffer->request())
+		buffer->request()->trace(Request::StageDeviceQueued);
+
+	if (!queuedCount_)
 		fdEvent_->setEnabled(true);
 
 	queuedBuffers_[buf.index] = buffer;
+	queuedCount_++;
+	sampleQueueDepth();
 
 	return 0;
 }
@@ -1080,7 +1312,7 @@ std::vector<std::unique_ptr<Buffer>> V4L2VideoDevice::queueAllBuffers()
 {
 	int ret;
 
-	if (!queuedBuffers_.empty())
+	if (queuedCount_)
 		return {};
 
 	if (V4L2_TYPE_IS_OUTPUT(bufferType_))
@@ -1122,34 +1354,72 @@ Buffer *V4L2VideoDevice::dequeueBuffer()
 	}
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
-	if (ret < 0) {
+	if (ret == -EAGAIN) {
+		return nullptr;
+	} else if (ret < 0) {
 		LOG(V4L2, Error)
 			<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
 
-	ASSERT(buf.index < bufferPool_->count());
+	ASSERT(buf.index < queuedBuffers_.size());
 
-	auto it = queuedBuffers_.find(buf.index);
-	Buffer *buffer = it->second;
-	queuedBuffers_.erase(it);
+	Buffer *buffer = queuedBuffers_[buf.index];
+	ASSERT(buffer);
 
-	if (queuedBuffers_.empty())
+	queuedBuffers_[buf.index] = nullptr;
+	queuedCount_--;
+	sampleQueueDepth();
+
+	if (!queuedCount_) {
 		fdEvent_->setEnabled(false);
+		queueStats_.underruns++;
+	}
 
 	buffer->index_ = buf.index;
 	buffer->timestamp_ = buf.timestamp.tv_sec * 1000000000ULL
 			   + buf.timestamp.tv_usec * 1000ULL;
+	buffer->timestampClock_ = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
+				== V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+				? Buffer::ClockMonotonic : Buffer::ClockUnknown;
+	buffer->timestampSource_ = (buf.flags & V4L2_BUF_FLAG_TSTAMP_SRC_MASK)
+				 == V4L2_BUF_FLAG_TSTAMP_SRC_SOE
+				 ? Buffer::TimestampStartOfExposure
+				 : Buffer::TimestampEndOfFrame;
 	buffer->sequence_ = buf.sequence;
 	buffer->status_ = buf.flags & V4L2_BUF_FLAG_ERROR
 			? Buffer::BufferError : Buffer::BufferSuccess;
 
+	LIBCAMERA_TRACEPOINT(v4l2_dqbuf,
+			     "device=%s index=%u sequence=%u timestamp=%" PRIu64,
+			     deviceNode().c_str(), buf.index, buf.sequence,
+			     buffer->timestamp_);
+
+	buffer->planesBytesused_ = { 0, 0, 0 };
+	buffer->planesOffset_ = { 0, 0, 0 };
+
 	if (multiPlanar_) {
 		buffer->bytesused_ = 0;
-		for (unsigned int p = 0; p < buf.length; ++p)
-			buffer->bytesused_ += planes[p].bytesused;
+		for (unsigned int p = 0; p < buf.length; ++p) {
+			const struct v4l2_plane &plane = planes[p];
+
+			buffer->bytesused_ += plane.bytesused;
+
+			if (p >= buffer->planesBytesused_.size())
+				continue;
+
+			/*
+			 * The plane bytesused includes the data offset, report
+			 * the payload size only.
+			 */
+			unsigned int offset = std::min(plane.data_offset,
+						       plane.bytesused);
+			buffer->planesOffset_[p] = offset;
+			buffer->planesBytesused_[p] = plane.bytesused - offset;
+		}
 	} else {
 		buffer->bytesused_ = buf.bytesused;
+		buffer->planesBytesused_[0] = buf.bytesused;
 	}
 
 	return buffer;
@@ -1159,22 +1429,31 @@ Buffer *V4L2VideoDevice::dequeueBuffer()
  * \brief Slot to handle completed buffer events from the V4L2 video device
  * \param[in] notifier The event notifier
  *
- * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * When this slot is called, one or more Buffers have become available from the
+ * device. All of them are dequeued and emitted through the bufferReady Signal
+ * in completion order.
  *
  * For Capture video devices the Buffer will contain valid data.
  * For Output video devices the Buffer can be considered empty.
  */
 void V4L2VideoDevice::bufferAvailable(EventNotifier *notifier)
 {
-	Buffer *buffer = dequeueBuffer();
-	if (!buffer)
-		return;
+	/*
+	 * Dequeue all buffers ready at this point, to avoid a round-trip
+	 * through the event dispatcher for each buffer when falling behind.
+	 * The bufferReady handlers may stop streaming or release the buffers,
+	 * stop as soon as no buffer is queued anymore.
+	 */
+	while (bufferPool_ && queuedCount_) {
+		Buffer *buffer = dequeueBuffer();
+		if (!buffer)
+			return;
 
-	LOG(V4L2, Debug) << "Buffer " << buffer->index() << " is available";
+		LOG(V4L2, Debug) << "Buffer " << buffer->index() << " is available";
 
-	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+		/* Notify anyone listening to the device. */
+		bufferReady.emit(buffer);
+	}
 }
 
 /**
@@ -1182,6 +1461,67 @@ void V4L2VideoDevice::bufferAvailable(EventNotifier *notifier)
  * \brief A Signal emitted when a buffer completes
  */
 
+/**
+ * \struct V4L2VideoDevice::QueueStats
+ * \brief Statistics about the number of buffers queued to the device
+ *
+ * The queue depth is sampled every time a buffer is queued or dequeued. The
+ * statistics are cheap to retrieve and help tuning the number of buffers
+ * allocated for a stream: a low average depth or a non-zero underruns count
+ * indicate that the device is starved of buffers.
+ *
+ * \var V4L2VideoDevice::QueueStats::depth
+ * \brief The number of buffers currently queued to the device
+ * \var V4L2VideoDevice::QueueStats::maxDepth
+ * \brief The maximum number of buffers queued to the device
+ * \var V4L2VideoDevice::QueueStats::samples
+ * \brief The number of times the queue depth has been sampled
+ * \var V4L2VideoDevice::QueueStats::depthSum
+ * \brief The sum of all queue depth samples, divided by \a samples to compute
+ * the average queue depth
+ * \var V4L2VideoDevice::QueueStats::underruns
+ * \brief The number of times the queue has run empty on buffer dequeue
+ */
+
+/**
+ * \fn V4L2VideoDevice::queueStats()
+ * \brief Retrieve the buffer queue statistics
+ * \return The buffer queue statistics
+ */
+
+/**
+ * \brief Reset the buffer queue statistics
+ *
+ * Reset all statistics but the current queue depth.
+ */
+void V4L2VideoDevice::resetQueueStats()
+{
+	queueStats_ = {};
+	queueStats_.depth = queuedCount_;
+}
+
+/**
+ * \brief Resize the queued buffers table for a pool of \a count buffers
+ * \param[in] count The number of buffers in the pool
+ */
+void V4L2VideoDevice::setQueueSize(unsigned int count)
+{
+	queuedBuffers_.assign(count, nullptr);
+	queuedCount_ = 0;
+	resetQueueStats();
+}
+
+/**
+ * \brief Record a sample of the queue depth in the statistics
+ */
+void V4L2VideoDevice::sampleQueueDepth()
+{
+	queueStats_.depth = queuedCount_;
+	queueStats_.maxDepth = std::max(queueStats_.maxDepth, queuedCount_);
+	queueStats_.samples++;
+	queueStats_.depthSum += queuedCount_;
+}
+
 /**
  * \brief Start the video stream
  * \return 0 on success or a negative error code otherwise
@@ -1202,6 +1542,40 @@ int V4L2VideoDevice::streamOn()
 	return 0;
 }
 
+/**
+ * \brief Start the video stream of multiple devices concurrently
+ * \param[in] devices The video devices
+ *
+ * This method starts the video stream of all the \a devices as streamOn()
+ * does, but issues the VIDIOC_STREAMON ioctls concurrently from the workers of
+ * the thread pool. It is meant to start the downstream devices of a pipeline,
+ * whose order doesn't matter, before starting its source. If any device fails
+ * to start, the devices that have been started are stopped.
+ *
+ * \return 0 on success or the error code of the first device that failed to
+ * start otherwise
+ */
+int V4L2VideoDevice::streamOn(const std::vector<V4L2VideoDevice *> &devices)
+{
+	if (devices.size() == 1)
+		return devices[0]->streamOn();
+
+	std::vector<int> results(devices.size());
+	ThreadPool::instance()->parallelFor(devices.size(),
+		[&](unsigned int index) {
+			results[index] = devices[index]->streamOn();
+		});
+
+	for (int ret : results) {
+		if (ret) {
+			streamOff(devices);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * \brief Stop the video stream
  *
@@ -1214,34 +1588,108 @@ int V4L2VideoDevice::streamOn()
  */
 int V4L2VideoDevice::streamOff()
 {
-	int ret;
-
 	if (!streaming_)
 		return 0;
 
-	ret = ioctl(VIDIOC_STREAMOFF, &bufferType_);
-	if (ret < 0) {
-		LOG(V4L2, Error)
-			<< "Failed to stop streaming: " << strerror(-ret);
+	int ret = stopStreaming();
+	if (ret < 0)
 		return ret;
+
+	cancelQueuedBuffers();
+
+	return 0;
+}
+
+/**
+ * \brief Stop the video stream of multiple devices concurrently
+ * \param[in] devices The video devices
+ *
+ * This method stops the video stream of all the \a devices as streamOff()
+ * does, but issues the VIDIOC_STREAMOFF ioctls concurrently from the workers
+ * of the thread pool. Drivers that wait for the hardware to be idle when
+ * stopping a stream thus wait in parallel, bounding the time needed to stop a
+ * pipeline to the slowest of its devices instead of the sum of all of them.
+ *
+ * The buffers that are still queued are then cancelled, and the bufferReady
+ * signal emitted for them, in the calling thread, in the order of the \a
+ * devices. Callers shall stop the source of the pipeline before using this
+ * method to tear down the downstream devices, in order not to feed them new
+ * data while they are stopping.
+ *
+ * \return 0 on success or the error code of the first device that failed to
+ * stop otherwise
+ */
+int V4L2VideoDevice::streamOff(const std::vector<V4L2VideoDevice *> &devices)
+{
+	std::vector<V4L2VideoDevice *> streaming;
+	for (V4L2VideoDevice *device : devices) {
+		if (device->streaming_)
+			streaming.push_back(device);
+	}
+
+	if (streaming.size() <= 1)
+		return streaming.empty() ? 0 : streaming[0]->streamOff();
+
+	std::vector<int> results(streaming.size());
+	ThreadPool::instance()->parallelFor(streaming.size(),
+		[&](unsigned int index) {
+			results[index] = streaming[index]->stopStreaming();
+		});
+
+	int ret = 0;
+	for (unsigned int i = 0; i < streaming.size(); ++i) {
+		if (results[i] < 0) {
+			if (!ret)
+				ret = results[i];
+			continue;
+		}
+
+		streaming[i]->cancelQueuedBuffers();
 	}
 
+	return ret;
+}
+
+/**
+ * \brief Issue the VIDIOC_STREAMOFF ioctl
+ *
+ * This method may be called from any thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::stopStreaming()
+{
+	int ret = ioctl(VIDIOC_STREAMOFF, &bufferType_);
+	if (ret < 0)
+		LOG(V4L2, Error)
+			<< "Failed to stop streaming: " << strerror(-ret);
+
+	return ret;
+}
+
+/**
+ * \brief Cancel the buffers still queued after the video stream is stopped
+ */
+void V4L2VideoDevice::cancelQueuedBuffers()
+{
 	/* Send back all queued buffers. */
-	for (auto it : queuedBuffers_) {
-		unsigned int index = it.first;
-		Buffer *buffer = it.second;
+	for (unsigned int index = 0; index < queuedBuffers_.size(); ++index) {
+		Buffer *buffer = queuedBuffers_[index];
+		if (!buffer)
+			continue;
+
+		queuedBuffers_[index] = nullptr;
+		queuedCount_--;
 
 		buffer->index_ = index;
 		buffer->cancel();
 		bufferReady.emit(buffer);
 	}
 
-	queuedBuffers_.clear();
+	queueStats_.depth = 0;
 	fdEvent_->setEnabled(false);
 
 	streaming_ = false;
-
-	return 0;
 }
 
 /**
@@ -1278,6 +1726,13 @@ V4L2VideoDevice *V4L2VideoDevice::fromEntityName(const MediaDevice *media,
  *
  * Calling V4L2VideoDevice::open() and V4L2VideoDevice::close() on the capture
  * or output V4L2VideoDevice is not permitted.
+ *
+ * Buffers can be queued to the output and capture devices directly. To keep
+ * the hardware busy, the V4L2M2MDevice additionally offers a job abstraction:
+ * each job pairs an output buffer with the capture buffer it is processed to.
+ * Any number of jobs can be queued with queueJob() and kept in flight, and the
+ * jobCompleted signal is emitted for each job once both its buffers have
+ * completed, in the order the jobs have been queued.
  */
 
 /**
@@ -1301,6 +1756,9 @@ V4L2M2MDevice::V4L2M2MDevice(const std::string &deviceNode)
 {
 	output_ = new V4L2VideoDevice(deviceNode);
 	capture_ = new V4L2VideoDevice(deviceNode);
+
+	output_->bufferReady.connect(this, &V4L2M2MDevice::outputBufferReady);
+	capture_->bufferReady.connect(this, &V4L2M2MDevice::captureBufferReady);
 }
 
 V4L2M2MDevice::~V4L2M2MDevice()
@@ -1363,6 +1821,106 @@ void V4L2M2MDevice::close()
 {
 	capture_->close();
 	output_->close();
+
+	jobs_.clear();
+}
+
+/**
+ * \brief Queue a processing job to the memory-to-memory device
+ * \param[in] output The output buffer containing the data to process
+ * \param[in] capture The capture buffer to store the processed data
+ *
+ * Queue the \a capture buffer to the capture device and the \a output buffer
+ * to the output device, and track them as a single job. The jobCompleted
+ * signal is emitted when both buffers have completed.
+ *
+ * The capture buffer is queued first to ensure the device has a destination
+ * buffer available when processing of the output buffer starts. If queueing
+ * the output buffer fails, the job is still tracked with a null output buffer
+ * until the capture buffer completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2M2MDevice::queueJob(Buffer *output, Buffer *capture)
+{
+	int ret = capture_->queueBuffer(capture);
+	if (ret)
+		return ret;
+
+	ret = output_->queueBuffer(output);
+	if (ret) {
+		jobs_.push_back({ nullptr, capture, true, false });
+		return ret;
+	}
+
+	jobs_.push_back({ output, capture, false, false });
+
+	return 0;
+}
+
+/**
+ * \fn V4L2M2MDevice::jobsInFlight()
+ * \brief Retrieve the number of jobs queued and not completed yet
+ * \return The number of jobs in flight
+ */
+
+/**
+ * \var V4L2M2MDevice::jobCompleted
+ * \brief A Signal emitted when a job completes
+ *
+ * The signal carries the output and capture buffers of the job. Jobs complete
+ * in the order they have been queued. The buffers status reports whether the
+ * job has been processed successfully or cancelled.
+ */
+
+void V4L2M2MDevice::outputBufferReady(Buffer *buffer)
+{
+	for (Job &job : jobs_) {
+		if (job.output == buffer && !job.outputDone) {
+			job.outputDone = true;
+			break;
+		}
+	}
+
+	completeJobs();
+}
+
+void V4L2M2MDevice::captureBufferReady(Buffer *buffer)
+{
+	for (Job &job : jobs_) {
+		if (job.capture == buffer && !job.captureDone) {
+			job.captureDone = true;
+			break;
+		}
+	}
+
+	completeJobs();
+}
+
+void V4L2M2MDevice::completeJobs()
+{
+	while (!jobs_.empty()) {
+		Job &job = jobs_.front();
+		if (!job.outputDone || !job.captureDone)
+			return;
+
+		/*
+		 * The output and capture queues process buffers in order, their
+		 * sequence numbers are expected to match.
+		 */
+		if (job.output && job.output->status() == Buffer::BufferSuccess &&
+		    job.output->sequence() != job.capture->sequence())
+			LOG(V4L2, Debug)
+				<< "Job sequence mismatch: output "
+				<< job.output->sequence() << ", capture "
+				<< job.capture->sequence();
+
+		Buffer *output = job.output;
+		Buffer *capture = job.capture;
+		jobs_.pop_front();
+
+		jobCompleted.emit(output, capture);
+	}
 }
 
 } /* namespace libcamera */
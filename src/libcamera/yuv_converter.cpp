@@ -0,0 +1,618 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv_converter.cpp - YUV to RGB conversion
+ */
+
+#include <libcamera/yuv_converter.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file yuv_converter.h
+ * \brief Conversion of YUV frames to RGB
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(YuvConverter)
+
+namespace {
+
+/*
+ * The conversion uses the ITU-R BT.601 limited range coefficients in 8.8
+ * fixed point. All implementations produce identical results.
+ */
+
+uint8_t clip(int value)
+{
+	return std::min(std::max(value, 0), 255);
+}
+
+void yuvToXrgb(int y, int u, int v, uint8_t *dst)
+{
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+
+	dst[0] = clip((298 * c + 516 * d + 128) >> 8);
+	dst[1] = clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+	dst[2] = clip((298 * c + 409 * e + 128) >> 8);
+	dst[3] = 0xff;
+}
+
+void semiPlanarRowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+			 unsigned int width, bool swap)
+{
+	unsigned int cbPos = swap ? 1 : 0;
+	unsigned int crPos = swap ? 0 : 1;
+
+	for (unsigned int x = 0; x < width; x += 2) {
+		yuvToXrgb(y[x], uv[cbPos], uv[crPos], dst);
+		if (x + 1 < width)
+			yuvToXrgb(y[x + 1], uv[cbPos], uv[crPos], dst + 4);
+
+		uv += 2;
+		dst += 8;
+	}
+}
+
+/* Semi-planar formats without horizontal chroma subsampling. */
+void semiPlanar444RowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+			    unsigned int width, bool swap)
+{
+	unsigned int cbPos = swap ? 1 : 0;
+	unsigned int crPos = swap ? 0 : 1;
+
+	for (unsigned int x = 0; x < width; ++x) {
+		yuvToXrgb(y[x], uv[cbPos], uv[crPos], dst);
+		uv += 2;
+		dst += 4;
+	}
+}
+
+void packedRowScalar(const uint8_t *src, uint8_t *dst, unsigned int width,
+		     unsigned int yPos, unsigned int cbPos)
+{
+	unsigned int crPos = (cbPos + 2) % 4;
+
+	for (unsigned int x = 0; x < width; x += 2) {
+		yuvToXrgb(src[yPos], src[cbPos], src[crPos], dst);
+		if (x + 1 < width)
+			yuvToXrgb(src[yPos + 2], src[cbPos], src[crPos], dst + 4);
+
+		src += 4;
+		dst += 8;
+	}
+}
+
+#if defined(__SSE2__)
+
+__m128i pairSse2(int16_t a, int16_t b)
+{
+	return _mm_set1_epi32(static_cast<uint16_t>(a) |
+			      static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16);
+}
+
+/*
+ * Convert 8 pixels. The y and uv vectors store 16-bit samples, with one Cb, Cr
+ * pair for every two pixels in uv, Cr first if swap is true.
+ */
+void convert8Sse2(__m128i y, __m128i uv, bool swap, uint8_t *dst)
+{
+	const __m128i low = _mm_set1_epi32(0xffff);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi32(128);
+
+	__m128i u = _mm_and_si128(uv, low);
+	__m128i v = _mm_srli_epi32(uv, 16);
+	if (swap)
+		std::swap(u, v);
+
+	u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+	v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	__m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+	__m128i cdLo = _mm_unpacklo_epi16(c, d);
+	__m128i cdHi = _mm_unpackhi_epi16(c, d);
+	__m128i ceLo = _mm_unpacklo_epi16(c, e);
+	__m128i ceHi = _mm_unpackhi_epi16(c, e);
+	__m128i e1Lo = _mm_unpacklo_epi16(e, one);
+	__m128i e1Hi = _mm_unpackhi_epi16(e, one);
+
+	const __m128i cr = pairSse2(298, 409);
+	const __m128i cgCb = pairSse2(298, -100);
+	const __m128i cgCr = pairSse2(-208, 128);
+	const __m128i cb = pairSse2(298, 516);
+
+	__m128i rLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, cr), round), 8);
+	__m128i rHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, cr), round), 8);
+	__m128i gLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, cgCb),
+						   _mm_madd_epi16(e1Lo, cgCr)), 8);
+	__m128i gHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, cgCb),
+						   _mm_madd_epi16(e1Hi, cgCr)), 8);
+	__m128i bLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, cb), round), 8);
+	__m128i bHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, cb), round), 8);
+
+	__m128i r = _mm_packus_epi16(_mm_packs_epi32(rLo, rHi), zero);
+	__m128i g = _mm_packus_epi16(_mm_packs_epi32(gLo, gHi), zero);
+	__m128i b = _mm_packus_epi16(_mm_packs_epi32(bLo, bHi), zero);
+
+	__m128i bg = _mm_unpacklo_epi8(b, g);
+	__m128i ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+void semiPlanarRowSse2(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+		       unsigned int width, bool swap)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i ys = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + x));
+		__m128i uvs = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(uv + x));
+
+		convert8Sse2(_mm_unpacklo_epi8(ys, zero),
+			     _mm_unpacklo_epi8(uvs, zero), swap, dst + x * 4);
+	}
+
+	semiPlanarRowScalar(y + x, uv + x, dst + x * 4, width - x, swap);
+}
+
+void packedRowSse2(const uint8_t *src, uint8_t *dst, unsigned int width,
+		   unsigned int yPos, unsigned int cbPos)
+{
+	const __m128i low = _mm_set1_epi16(0xff);
+	bool yOdd = yPos & 1;
+	bool swap = cbPos >= 2;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+		__m128i even = _mm_and_si128(pixels, low);
+		__m128i odd = _mm_srli_epi16(pixels, 8);
+
+		convert8Sse2(yOdd ? odd : even, yOdd ? even : odd, swap,
+			     dst + x * 4);
+	}
+
+	packedRowScalar(src + x * 2, dst + x * 4, width - x, yPos, cbPos);
+}
+
+#endif /* __SSE2__ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * The AVX2 kernels are compiled for the AVX2 target regardless of the compiler
+ * flags, and only selected at runtime when the CPU supports them. They process
+ * 16 pixels, 8 in each 128-bit lane, as all the arithmetic instructions operate
+ * within lanes.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 __m256i pairAvx2(int16_t a, int16_t b)
+{
+	return _mm256_set1_epi32(static_cast<uint16_t>(a) |
+				 static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16);
+}
+
+AVX2 void convert16Avx2(__m256i y, __m256i uv, bool swap, uint8_t *dst)
+{
+	const __m256i low = _mm256_set1_epi32(0xffff);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i round = _mm256_set1_epi32(128);
+
+	__m256i u = _mm256_and_si256(uv, low);
+	__m256i v = _mm256_srli_epi32(uv, 16);
+	if (swap)
+		std::swap(u, v);
+
+	u = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+	v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+
+	__m256i c = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+	__m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+	__m256i e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+
+	__m256i cdLo = _mm256_unpacklo_epi16(c, d);
+	__m256i cdHi = _mm256_unpackhi_epi16(c, d);
+	__m256i ceLo = _mm256_unpacklo_epi16(c, e);
+	__m256i ceHi = _mm256_unpackhi_epi16(c, e);
+	__m256i e1Lo = _mm256_unpacklo_epi16(e, one);
+	__m256i e1Hi = _mm256_unpackhi_epi16(e, one);
+
+	const __m256i cr = pairAvx2(298, 409);
+	const __m256i cgCb = pairAvx2(298, -100);
+	const __m256i cgCr = pairAvx2(-208, 128);
+	const __m256i cb = pairAvx2(298, 516);
+
+	__m256i rLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceLo, cr), round), 8);
+	__m256i rHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceHi, cr), round), 8);
+	__m256i gLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdLo, cgCb),
+							 _mm256_madd_epi16(e1Lo, cgCr)), 8);
+	__m256i gHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdHi, cgCb),
+							 _mm256_madd_epi16(e1Hi, cgCr)), 8);
+	__m256i bLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdLo, cb), round), 8);
+	__m256i bHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdHi, cb), round), 8);
+
+	__m256i r = _mm256_packus_epi16(_mm256_packs_epi32(rLo, rHi), zero);
+	__m256i g = _mm256_packus_epi16(_mm256_packs_epi32(gLo, gHi), zero);
+	__m256i b = _mm256_packus_epi16(_mm256_packs_epi32(bLo, bHi), zero);
+
+	__m256i bg = _mm256_unpacklo_epi8(b, g);
+	__m256i ra = _mm256_unpacklo_epi8(r, _mm256_set1_epi8(-1));
+	__m256i lo = _mm256_unpacklo_epi16(bg, ra);
+	__m256i hi = _mm256_unpackhi_epi16(bg, ra);
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst),
+			    _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32),
+			    _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+AVX2 void semiPlanarRowAvx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+			    unsigned int width, bool swap)
+{
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i ys = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+		__m128i uvs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x));
+
+		convert16Avx2(_mm256_cvtepu8_epi16(ys), _mm256_cvtepu8_epi16(uvs),
+			      swap, dst + x * 4);
+	}
+
+	semiPlanarRowScalar(y + x, uv + x, dst + x * 4, width - x, swap);
+}
+
+AVX2 void packedRowAvx2(const uint8_t *src, uint8_t *dst, unsigned int width,
+			unsigned int yPos, unsigned int cbPos)
+{
+	const __m256i low = _mm256_set1_epi16(0xff);
+	bool yOdd = yPos & 1;
+	bool swap = cbPos >= 2;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 2));
+		__m256i even = _mm256_and_si256(pixels, low);
+		__m256i odd = _mm256_srli_epi16(pixels, 8);
+
+		convert16Avx2(yOdd ? odd : even, yOdd ? even : odd, swap,
+			      dst + x * 4);
+	}
+
+	packedRowScalar(src + x * 2, dst + x * 4, width - x, yPos, cbPos);
+}
+
+#undef AVX2
+
+bool hasAvx2()
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+#if defined(__ARM_NEON)
+
+uint8x8_t clipNeon(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovn_u16(vcombine_u16(vqshrun_n_s32(lo, 8),
+				       vqshrun_n_s32(hi, 8)));
+}
+
+/* Convert 8 pixels with one Cb and Cr sample per pixel. */
+void convert8Neon(uint8x8_t y, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+	int16x8_t c = vreinterpretq_s16_u16(vsubl_u8(y, vdup_n_u8(16)));
+	int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+	int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+
+	const int32x4_t round = vdupq_n_s32(128);
+	int32x4_t yLo = vmlal_n_s16(round, vget_low_s16(c), 298);
+	int32x4_t yHi = vmlal_n_s16(round, vget_high_s16(c), 298);
+
+	int32x4_t rLo = vmlal_n_s16(yLo, vget_low_s16(e), 409);
+	int32x4_t rHi = vmlal_n_s16(yHi, vget_high_s16(e), 409);
+	int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(yLo, vget_low_s16(d), -100),
+				    vget_low_s16(e), -208);
+	int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(yHi, vget_high_s16(d), -100),
+				    vget_high_s16(e), -208);
+	int32x4_t bLo = vmlal_n_s16(yLo, vget_low_s16(d), 516);
+	int32x4_t bHi = vmlal_n_s16(yHi, vget_high_s16(d), 516);
+
+	uint8x8x4_t pixels;
+	pixels.val[0] = clipNeon(bLo, bHi);
+	pixels.val[1] = clipNeon(gLo, gHi);
+	pixels.val[2] = clipNeon(rLo, rHi);
+	pixels.val[3] = vdup_n_u8(0xff);
+
+	vst4_u8(dst, pixels);
+}
+
+void semiPlanarRowNeon(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+		       unsigned int width, bool swap)
+{
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16_t ys = vld1q_u8(y + x);
+		uint8x8x2_t uvs = vld2_u8(uv + x);
+		uint8x8_t u = uvs.val[swap ? 1 : 0];
+		uint8x8_t v = uvs.val[swap ? 0 : 1];
+		uint8x8x2_t us = vzip_u8(u, u);
+		uint8x8x2_t vs = vzip_u8(v, v);
+
+		convert8Neon(vget_low_u8(ys), us.val[0], vs.val[0], dst + x * 4);
+		convert8Neon(vget_high_u8(ys), us.val[1], vs.val[1], dst + x * 4 + 32);
+	}
+
+	semiPlanarRowScalar(y + x, uv + x, dst + x * 4, width - x, swap);
+}
+
+void packedRowNeon(const uint8_t *src, uint8_t *dst, unsigned int width,
+		   unsigned int yPos, unsigned int cbPos)
+{
+	unsigned int crPos = (cbPos + 2) % 4;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x8x4_t pixels = vld4_u8(src + x * 2);
+		uint8x8x2_t ys = vzip_u8(pixels.val[yPos], pixels.val[yPos + 2]);
+		uint8x8x2_t us = vzip_u8(pixels.val[cbPos], pixels.val[cbPos]);
+		uint8x8x2_t vs = vzip_u8(pixels.val[crPos], pixels.val[crPos]);
+
+		convert8Neon(ys.val[0], us.val[0], vs.val[0], dst + x * 4);
+		convert8Neon(ys.val[1], us.val[1], vs.val[1], dst + x * 4 + 32);
+	}
+
+	packedRowScalar(src + x * 2, dst + x * 4, width - x, yPos, cbPos);
+}
+
+#endif /* __ARM_NEON */
+
+bool always()
+{
+	return true;
+}
+
+struct Implementation {
+	const char *name;
+	bool (*available)();
+	void (*semiPlanarRow)(const uint8_t *y, const uint8_t *uv, uint8_t *dst,
+			      unsigned int width, bool swap);
+	void (*packedRow)(const uint8_t *src, uint8_t *dst, unsigned int width,
+			  unsigned int yPos, unsigned int cbPos);
+};
+
+/* Implementations, by order of preference. */
+const Implementation implementations[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "avx2", hasAvx2, semiPlanarRowAvx2, packedRowAvx2 },
+#endif
+#if defined(__SSE2__)
+	{ "sse2", always, semiPlanarRowSse2, packedRowSse2 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", always, semiPlanarRowNeon, packedRowNeon },
+#endif
+	{ "scalar", always, semiPlanarRowScalar, packedRowScalar },
+};
+
+const Implementation &selectImplementation()
+{
+	const char *name = utils::secure_getenv("LIBCAMERA_YUV_CONVERTER");
+
+	if (name) {
+		for (const Implementation &impl : implementations) {
+			if (strcmp(impl.name, name) || !impl.available())
+				continue;
+
+			return impl;
+		}
+
+		LOG(YuvConverter, Warning)
+			<< "YUV converter implementation " << name
+			<< " not available";
+	}
+
+	for (const Implementation &impl : implementations) {
+		if (impl.available())
+			return impl;
+	}
+
+	/* The scalar implementation is always available. */
+	return implementations[ARRAY_SIZE(implementations) - 1];
+}
+
+} /* namespace */
+
+/**
+ * \class YuvConverter
+ * \brief Convert YUV frames to XRGB8888
+ *
+ * The YuvConverter class converts frames in the semi-planar NV12, NV21, NV16,
+ * NV61, NV24 and NV42 formats, and in the packed YUYV, YVYU, UYVY and VYUY
+ * formats, to XRGB8888, stored as B, G, R and 0xff bytes in memory. The
+ * conversion uses the ITU-R BT.601 limited range encoding.
+ *
+ * The conversion is vectorized with NEON on ARM, and with SSE2 or AVX2 on x86,
+ * selected at runtime based on the CPU capabilities. A scalar implementation
+ * is used on other platforms, and for the formats without horizontal chroma
+ * subsampling. All implementations produce identical results.
+ *
+ * The LIBCAMERA_YUV_CONVERTER environment variable selects a specific
+ * implementation ("avx2", "sse2", "neon" or "scalar") for testing purpose. It
+ * is ignored if the implementation isn't available.
+ */
+
+YuvConverter::YuvConverter()
+	: implementation_(nullptr), semiPlanarRow_(nullptr),
+	  packedRow_(nullptr), packed_(false), horzSubSample_(1),
+	  vertSubSample_(1), swap_(false), yPos_(0), cbPos_(0)
+{
+}
+
+/**
+ * \brief Configure the converter for a format and size
+ * \param[in] format The V4L2 pixel format of the frames to convert
+ * \param[in] size The frame size in pixels
+ *
+ * The lines of the frames to convert shall be contiguous in memory, without
+ * padding. The planes of the semi-planar formats shall be contiguous as well.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a format isn't supported
+ */
+int YuvConverter::configure(unsigned int format, const Size &size)
+{
+	packed_ = false;
+	horzSubSample_ = 2;
+	vertSubSample_ = 1;
+	swap_ = false;
+
+	switch (format) {
+	case V4L2_PIX_FMT_NV12:
+		vertSubSample_ = 2;
+		break;
+	case V4L2_PIX_FMT_NV21:
+		vertSubSample_ = 2;
+		swap_ = true;
+		break;
+	case V4L2_PIX_FMT_NV16:
+		break;
+	case V4L2_PIX_FMT_NV61:
+		swap_ = true;
+		break;
+	case V4L2_PIX_FMT_NV24:
+		horzSubSample_ = 1;
+		break;
+	case V4L2_PIX_FMT_NV42:
+		horzSubSample_ = 1;
+		swap_ = true;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		packed_ = true;
+		yPos_ = 0;
+		cbPos_ = 1;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		packed_ = true;
+		yPos_ = 0;
+		cbPos_ = 3;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		packed_ = true;
+		yPos_ = 1;
+		cbPos_ = 0;
+		break;
+	case V4L2_PIX_FMT_VYUY:
+		packed_ = true;
+		yPos_ = 1;
+		cbPos_ = 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	const Implementation &impl = selectImplementation();
+	implementation_ = impl.name;
+	packedRow_ = impl.packedRow;
+	semiPlanarRow_ = horzSubSample_ == 2 ? impl.semiPlanarRow
+					     : semiPlanar444RowScalar;
+	size_ = size;
+
+	LOG(YuvConverter, Debug)
+		<< "Converting " << size_.toString() << "-" << utils::hex(format)
+		<< " with " << implementation_ << " implementation";
+
+	return 0;
+}
+
+/**
+ * \brief Convert a frame
+ * \param[in] src The frame to convert
+ * \param[out] dst The XRGB8888 output buffer
+ *
+ * The \a dst buffer shall be large enough to store the frame at 4 bytes per
+ * pixel. The converter shall be configured before use.
+ */
+void YuvConverter::convert(const uint8_t *src, uint8_t *dst) const
+{
+	convert(src, dst, 0, size_.height);
+}
+
+/**
+ * \brief Convert a horizontal stripe of a frame
+ * \param[in] src The frame to convert
+ * \param[out] dst The XRGB8888 output buffer
+ * \param[in] first The index of the first line to convert
+ * \param[in] count The number of lines to convert
+ *
+ * This function converts lines \a first to \a first + \a count - 1 only. The
+ * \a src and \a dst buffers point to the beginning of the full frames. As the
+ * converter holds no per-frame state, stripes of the same frame can be
+ * converted concurrently from different threads.
+ */
+void YuvConverter::convert(const uint8_t *src, uint8_t *dst,
+			   unsigned int first, unsigned int count) const
+{
+	unsigned int width = size_.width;
+	unsigned int height = size_.height;
+	unsigned int last = std::min(first + count, height);
+
+	if (!implementation_)
+		return;
+
+	if (packed_) {
+		for (unsigned int y = first; y < last; ++y)
+			packedRow_(src + y * width * 2, dst + y * width * 4,
+				   width, yPos_, cbPos_);
+		return;
+	}
+
+	const uint8_t *uv = src + width * height;
+	unsigned int uvStride = width * 2 / horzSubSample_;
+
+	for (unsigned int y = first; y < last; ++y)
+		semiPlanarRow_(src + y * width,
+			       uv + y / vertSubSample_ * uvStride,
+			       dst + y * width * 4, width, swap_);
+}
+
+/**
+ * \fn YuvConverter::implementation()
+ * \brief Retrieve the name of the implementation used by the converter
+ * \return The implementation name, or nullptr if the converter isn't configured
+ */
+
+} /* namespace libcamera */
@@ -5,67 +5,123 @@
  * format_convert.cpp - qcam - Convert buffer to RGB
  */
 
+#include <algorithm>
 #include <errno.h>
+#include <functional>
+#include <string.h>
+#include <vector>
 
 #include <linux/videodev2.h>
 
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#endif
+
 #include <QImage>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
 
 #include "format_converter.h"
 
-#define RGBSHIFT		8
-#ifndef MAX
-#define MAX(a,b)		((a)>(b)?(a):(b))
-#endif
-#ifndef MIN
-#define MIN(a,b)		((a)<(b)?(a):(b))
-#endif
-#ifndef CLAMP
-#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
-#endif
-#ifndef CLIP
-#define CLIP(x)			CLAMP(x,0,255)
-#endif
+/*
+ * Frames are converted in horizontal stripes, one per thread of the global
+ * thread pool. Smaller stripes aren't worth the synchronization overhead.
+ */
+static constexpr unsigned int MIN_STRIPE_HEIGHT = 16;
+
+class StripeTask : public QRunnable
+{
+public:
+	StripeTask(std::function<void()> func, QSemaphore *done)
+		: func_(func), done_(done)
+	{
+	}
+
+	void run() override
+	{
+		func_();
+		done_->release();
+	}
+
+private:
+	std::function<void()> func_;
+	QSemaphore *done_;
+};
+
+#ifdef HAVE_LIBJPEG
+
+struct MjpegErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf escape;
+};
+
+static void mjpegErrorExit(j_common_ptr cinfo)
+{
+	MjpegErrorManager *err = reinterpret_cast<MjpegErrorManager *>(cinfo->err);
+
+	longjmp(err->escape, 1);
+}
+
+/* Corrupted frames are common with MJPEG, don't flood the console. */
+static void mjpegOutputMessage(j_common_ptr cinfo)
+{
+}
+
+struct FormatConverter::MjpegContext {
+	struct jpeg_decompress_struct cinfo;
+	MjpegErrorManager err;
+
+	/* Line buffer for the lines that can't be decoded to the image. */
+	std::vector<unsigned char> row;
+};
+
+FormatConverter::FormatConverter()
+	: mjpeg_(new MjpegContext())
+{
+	struct jpeg_decompress_struct *cinfo = &mjpeg_->cinfo;
+
+	cinfo->err = jpeg_std_error(&mjpeg_->err.pub);
+	mjpeg_->err.pub.error_exit = mjpegErrorExit;
+	mjpeg_->err.pub.output_message = mjpegOutputMessage;
+
+	jpeg_create_decompress(cinfo);
+}
+
+FormatConverter::~FormatConverter()
+{
+	jpeg_destroy_decompress(&mjpeg_->cinfo);
+}
+
+#else
+
+struct FormatConverter::MjpegContext {
+};
+
+FormatConverter::FormatConverter()
+{
+}
+
+FormatConverter::~FormatConverter()
+{
+}
+
+#endif /* HAVE_LIBJPEG */
 
 int FormatConverter::configure(unsigned int format, unsigned int width,
 			       unsigned int height)
 {
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 2;
-		nvSwap_ = false;
-		break;
 	case V4L2_PIX_FMT_NV21:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 2;
-		nvSwap_ = true;
-		break;
 	case V4L2_PIX_FMT_NV16:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 1;
-		nvSwap_ = false;
-		break;
 	case V4L2_PIX_FMT_NV61:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 1;
-		nvSwap_ = true;
-		break;
 	case V4L2_PIX_FMT_NV24:
-		formatFamily_ = NV;
-		horzSubSample_ = 1;
-		vertSubSample_ = 1;
-		nvSwap_ = false;
-		break;
 	case V4L2_PIX_FMT_NV42:
 		formatFamily_ = NV;
-		horzSubSample_ = 1;
-		vertSubSample_ = 1;
-		nvSwap_ = true;
 		break;
 	case V4L2_PIX_FMT_BGR24:
 		formatFamily_ = RGB;
@@ -89,24 +145,10 @@ int FormatConverter::configure(unsigned int format, unsigned int width,
 		bpp_ = 4;
 		break;
 	case V4L2_PIX_FMT_VYUY:
-		formatFamily_ = YUV;
-		y_pos_ = 1;
-		cb_pos_ = 2;
-		break;
 	case V4L2_PIX_FMT_YVYU:
-		formatFamily_ = YUV;
-		y_pos_ = 0;
-		cb_pos_ = 3;
-		break;
 	case V4L2_PIX_FMT_UYVY:
-		formatFamily_ = YUV;
-		y_pos_ = 1;
-		cb_pos_ = 0;
-		break;
 	case V4L2_PIX_FMT_YUYV:
 		formatFamily_ = YUV;
-		y_pos_ = 0;
-		cb_pos_ = 1;
 		break;
 	case V4L2_PIX_FMT_MJPEG:
 		formatFamily_ = MJPEG;
@@ -115,6 +157,12 @@ int FormatConverter::configure(unsigned int format, unsigned int width,
 		return -EINVAL;
 	};
 
+	if (formatFamily_ == NV || formatFamily_ == YUV) {
+		int ret = yuvConverter_.configure(format, { width, height });
+		if (ret < 0)
+			return ret;
+	}
+
 	format_ = format;
 	width_ = width;
 	height_ = height;
@@ -125,78 +173,145 @@ int FormatConverter::configure(unsigned int format, unsigned int width,
 void FormatConverter::convert(const unsigned char *src, size_t size,
 			      QImage *dst)
 {
-	switch (formatFamily_) {
-	case MJPEG:
-		dst->loadFromData(src, size, "JPEG");
-		break;
-	case YUV:
-		convertYUV(src, dst->bits());
-		break;
-	case RGB:
-		convertRGB(src, dst->bits());
-		break;
-	case NV:
-		convertNV(src, dst->bits());
-		break;
-	};
+	if (formatFamily_ == MJPEG) {
+		convertMJPEG(src, size, dst);
+		return;
+	}
+
+	QThreadPool *pool = QThreadPool::globalInstance();
+	unsigned int stripes = std::max(1u, std::min<unsigned int>(
+		pool->maxThreadCount(), height_ / MIN_STRIPE_HEIGHT));
+	unsigned char *bits = dst->bits();
+	QSemaphore done;
+
+	/* Run all stripes but the last one in the pool, and the last one here. */
+	for (unsigned int i = 0; i < stripes - 1; ++i) {
+		unsigned int first = i * height_ / stripes;
+		unsigned int count = (i + 1) * height_ / stripes - first;
+
+		pool->start(new StripeTask([=]() {
+			convertStripe(src, bits, first, count);
+		}, &done));
+	}
+
+	unsigned int first = (stripes - 1) * height_ / stripes;
+	convertStripe(src, bits, first, height_ - first);
+
+	done.acquire(stripes - 1);
 }
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
+void FormatConverter::convertMJPEG(const unsigned char *src, size_t size,
+				   QImage *dst)
 {
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
+#ifdef HAVE_LIBJPEG
+	/* Corrupted frames are skipped, keeping the previous image. */
+	decodeMJPEG(src, size, dst);
+#else
+	dst->loadFromData(src, size, "JPEG");
+#endif
 }
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+#ifdef HAVE_LIBJPEG
+/*
+ * Decode a frame in the preallocated image. This is kept separate from
+ * convertMJPEG() as libjpeg reports errors with longjmp(), which must not skip
+ * over the destruction of C++ objects.
+ */
+int FormatConverter::decodeMJPEG(const unsigned char *src, size_t size,
+				 QImage *dst)
 {
-	unsigned int c_stride = width_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
-	unsigned int cb_pos = nvSwap_ ? 1 : 0;
-	unsigned int cr_pos = nvSwap_ ? 0 : 1;
-	const unsigned char *src_c = src + width_ * height_;
-	int r, g, b;
+	struct jpeg_decompress_struct *cinfo = &mjpeg_->cinfo;
+	unsigned int width = dst->width();
+	unsigned int height = dst->height();
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
+	if (setjmp(mjpeg_->err.escape)) {
+		jpeg_abort_decompress(cinfo);
+		return -EINVAL;
+	}
+
+	jpeg_mem_src(cinfo, const_cast<unsigned char *>(src), size);
+	jpeg_read_header(cinfo, TRUE);
+
+	/*
+	 * Use DCT scaling to decode at the smallest size that still covers the
+	 * image, when the image is smaller than the frame.
+	 */
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = 1;
+	while (cinfo->scale_denom < 8 &&
+	       cinfo->image_width / (cinfo->scale_denom * 2) >= width &&
+	       cinfo->image_height / (cinfo->scale_denom * 2) >= height)
+		cinfo->scale_denom *= 2;
+
+	cinfo->dct_method = JDCT_IFAST;
+#ifdef JCS_EXTENSIONS
+	/* libjpeg-turbo outputs XRGB8888 directly, with X set to 0xff. */
+	cinfo->out_color_space = JCS_EXT_BGRX;
+#else
+	cinfo->out_color_space = JCS_RGB;
+#endif
+
+	jpeg_start_decompress(cinfo);
+
+	/*
+	 * Decode lines straight to the image when the formats and sizes match,
+	 * and through the line buffer otherwise.
+	 */
+	unsigned int bpp = cinfo->output_components;
+	unsigned int copyWidth = std::min<unsigned int>(cinfo->output_width, width);
+	bool direct = bpp == 4 && cinfo->output_width <= width;
+	mjpeg_->row.resize(cinfo->output_width * bpp);
+
+	while (cinfo->output_scanline < cinfo->output_height) {
+		unsigned int line = cinfo->output_scanline;
+		unsigned char *out = line < height ? dst->scanLine(line) : nullptr;
+		JSAMPROW rows[1] = { direct && out ? out : mjpeg_->row.data() };
+
+		jpeg_read_scanlines(cinfo, rows, 1);
+
+		if (!out || direct)
+			continue;
+
+		const unsigned char *in = mjpeg_->row.data();
+		if (bpp == 4) {
+			memcpy(out, in, copyWidth * 4);
+			continue;
+		}
+
+		for (unsigned int x = 0; x < copyWidth; ++x) {
+			out[x * 4 + 0] = in[x * 3 + 2];
+			out[x * 4 + 1] = in[x * 3 + 1];
+			out[x * 4 + 2] = in[x * 3 + 0];
+			out[x * 4 + 3] = 0xff;
 		}
 	}
+
+	jpeg_finish_decompress(cinfo);
+
+	return 0;
+}
+#endif /* HAVE_LIBJPEG */
+
+void FormatConverter::convertStripe(const unsigned char *src,
+				    unsigned char *dst, unsigned int first,
+				    unsigned int count)
+{
+	if (formatFamily_ == RGB)
+		convertRGB(src, dst, first, count);
+	else
+		yuvConverter_.convert(src, dst, first, count);
 }
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst,
+				 unsigned int first, unsigned int count)
 {
 	unsigned int x, y;
 	int r, g, b;
 
-	for (y = 0; y < height_; y++) {
+	src += first * width_ * bpp_;
+	dst += first * width_ * 4;
+
+	for (y = first; y < first + count && y < height_; y++) {
 		for (x = 0; x < width_; x++) {
 			r = src[bpp_ * x + r_pos_];
 			g = src[bpp_ * x + g_pos_];
@@ -212,41 +327,3 @@ void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
 		dst += width_ * 4;
 	}
 }
-
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
-{
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
-		}
-	}
-}
@@ -7,13 +7,19 @@
 #ifndef __QCAM_FORMAT_CONVERTER_H__
 #define __QCAM_FORMAT_CONVERTER_H__
 
+#include <memory>
 #include <stddef.h>
 
+#include <libcamera/yuv_converter.h>
+
 class QImage;
 
 class FormatConverter
 {
 public:
+	FormatConverter();
+	~FormatConverter();
+
 	int configure(unsigned int format, unsigned int width,
 		      unsigned int height);
 
@@ -27,9 +33,14 @@ private:
 		YUV,
 	};
 
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	struct MjpegContext;
+
+	void convertMJPEG(const unsigned char *src, size_t size, QImage *dst);
+	int decodeMJPEG(const unsigned char *src, size_t size, QImage *dst);
+	void convertStripe(const unsigned char *src, unsigned char *dst,
+			   unsigned int first, unsigned int count);
+	void convertRGB(const unsigned char *src, unsigned char *dst,
+			unsigned int first, unsigned int count);
 
 	unsigned int format_;
 	unsigned int width_;
@@ -37,20 +48,17 @@ private:
 
 	enum FormatFamily formatFamily_;
 
-	/* NV parameters */
-	unsigned int horzSubSample_;
-	unsigned int vertSubSample_;
-	bool nvSwap_;
+	/* MJPEG decoder */
+	std::unique_ptr<MjpegContext> mjpeg_;
+
+	/* NV and YUV converter */
+	libcamera::YuvConverter yuvConverter_;
 
 	/* RGB parameters */
 	unsigned int bpp_;
 	unsigned int r_pos_;
 	unsigned int g_pos_;
 	unsigned int b_pos_;
-
-	/* YUV parameters */
-	unsigned int y_pos_;
-	unsigned int cb_pos_;
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
@@ -18,11 +18,16 @@
 
 #include "main_window.h"
 #include "viewfinder.h"
+#ifdef HAVE_QOPENGLWIDGET
+#include "viewfinder_gl.h"
+#endif
+#include "viewfinder_qt.h"
 
 using namespace libcamera;
 
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
-	: options_(options), isCapturing_(false)
+	: options_(options), isCapturing_(false), viewfinder_(nullptr),
+	  viewfinderGL_(false), pendingRequest_(nullptr), pendingBytesused_(0)
 {
 	int ret;
 
@@ -30,10 +35,21 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	setWindowTitle(title_);
 	connect(&titleTimer_, SIGNAL(timeout()), this, SLOT(updateTitle()));
 
-	viewfinder_ = new ViewFinder(this);
-	setCentralWidget(viewfinder_);
-	viewfinder_->setFixedSize(500, 500);
-	adjustSize();
+	std::string renderer = options_.isSet(OptRenderer)
+			     ? static_cast<std::string>(options_[OptRenderer])
+			     : "qt";
+	if (renderer == "gles") {
+#ifdef HAVE_QOPENGLWIDGET
+		createViewFinder(true);
+#else
+		std::cout << "OpenGL ES renderer not available" << std::endl;
+#endif
+	} else if (renderer != "qt") {
+		std::cout << "Invalid renderer " << renderer << std::endl;
+	}
+
+	if (!viewfinder_)
+		createViewFinder(false);
 
 	ret = openCamera(cm);
 	if (!ret)
@@ -66,6 +82,31 @@ void MainWindow::updateTitle()
 	setWindowTitle(title_ + " : " + QString::number(fps, 'f', 2) + " fps");
 }
 
+void MainWindow::createViewFinder(bool gl)
+{
+	QWidget *widget;
+
+#ifdef HAVE_QOPENGLWIDGET
+	if (gl) {
+		ViewFinderGL *viewfinder = new ViewFinderGL(this);
+		viewfinder_ = viewfinder;
+		widget = viewfinder;
+	} else
+#endif
+	{
+		ViewFinderQt *viewfinder = new ViewFinderQt(this);
+		viewfinder_ = viewfinder;
+		widget = viewfinder;
+	}
+
+	viewfinderGL_ = gl;
+
+	/* The previous central widget, if any, is deleted. */
+	setCentralWidget(widget);
+	widget->setFixedSize(500, 500);
+	adjustSize();
+}
+
 int MainWindow::openCamera(CameraManager *cm)
 {
 	std::string cameraName;
@@ -148,6 +189,14 @@ int MainWindow::startCapture()
 		return ret;
 	}
 
+#ifdef HAVE_QOPENGLWIDGET
+	if (viewfinderGL_ && !ViewFinderGL::isFormatSupported(cfg.pixelFormat)) {
+		std::cout << "Pixel format not supported by the OpenGL ES renderer, "
+			  << "falling back to the qt renderer" << std::endl;
+		createViewFinder(false);
+	}
+#endif
+
 	Stream *stream = cfg.stream();
 	ret = viewfinder_->setFormat(cfg.pixelFormat, cfg.size.width,
 				     cfg.size.height);
@@ -158,7 +207,7 @@ int MainWindow::startCapture()
 
 	adjustSize();
 
-	ret = camera_->allocateBuffers();
+	ret = camera_->allocateBuffers(Camera::AllocatePrefault);
 	if (ret) {
 		std::cerr << "Failed to allocate buffers"
 			  << std::endl;
@@ -174,13 +223,13 @@ int MainWindow::startCapture()
 			goto error;
 		}
 
-		std::unique_ptr<Buffer> buffer = stream->createBuffer(i);
+		Buffer *buffer = stream->buffer(i);
 		if (!buffer) {
-			std::cerr << "Can't create buffer " << i << std::endl;
+			std::cerr << "Can't get buffer " << i << std::endl;
 			goto error;
 		}
 
-		ret = request->addBuffer(std::move(buffer));
+		ret = request->addBuffer(buffer);
 		if (ret < 0) {
 			std::cerr << "Can't set buffer for request" << std::endl;
 			goto error;
@@ -229,6 +278,9 @@ void MainWindow::stopCapture()
 	if (ret)
 		std::cout << "Failed to stop capture" << std::endl;
 
+	delete pendingRequest_;
+	pendingRequest_ = nullptr;
+
 	camera_->freeBuffers();
 	isCapturing_ = false;
 
@@ -239,7 +291,7 @@ void MainWindow::stopCapture()
 }
 
 void MainWindow::requestComplete(Request *request,
-				 const std::map<Stream *, Buffer *> &buffers)
+				 const Request::BufferMap &buffers)
 {
 	if (request->status() == Request::RequestCancelled)
 		return;
@@ -259,32 +311,41 @@ void MainWindow::requestComplete(Request *request,
 		  << " fps: " << std::fixed << std::setprecision(2) << fps
 		  << std::endl;
 
-	display(buffer);
+	/*
+	 * Keep only the most recent frame for display, and convert it when
+	 * the event loop gets idle. If the previous frame hasn't been
+	 * displayed yet, it is dropped and its request queued right away, so
+	 * that capture runs at the sensor rate regardless of the display
+	 * speed. The buffer metadata is reset by reuse(), save the bytesused
+	 * value first.
+	 */
+	unsigned int bytesused = buffer->bytesused();
+	request->reuse(Request::ReuseBuffers);
+
+	if (pendingRequest_)
+		camera_->queueRequest(pendingRequest_);
+	else
+		QTimer::singleShot(0, this, SLOT(processViewfinder()));
+
+	pendingRequest_ = request;
+	pendingBytesused_ = bytesused;
+}
 
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
+void MainWindow::processViewfinder()
+{
+	Request *request = pendingRequest_;
+	if (!request)
 		return;
-	}
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		Buffer *buffer = it->second;
-		unsigned int index = buffer->index();
+	pendingRequest_ = nullptr;
 
-		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(index);
-		if (!newBuffer) {
-			std::cerr << "Can't create buffer " << index << std::endl;
-			return;
-		}
-
-		request->addBuffer(std::move(newBuffer));
-	}
+	Buffer *buffer = request->buffers().begin()->second;
+	display(buffer, pendingBytesused_);
 
 	camera_->queueRequest(request);
 }
 
-int MainWindow::display(Buffer *buffer)
+int MainWindow::display(Buffer *buffer, unsigned int bytesused)
 {
 	BufferMemory *mem = buffer->mem();
 	if (mem->planes().size() != 1)
@@ -292,7 +353,9 @@ int MainWindow::display(Buffer *buffer)
 
 	Plane &plane = mem->planes().front();
 	unsigned char *raw = static_cast<unsigned char *>(plane.mem());
-	viewfinder_->display(raw, buffer->bytesused());
+
+	CpuAccess access(plane, Plane::AccessRead);
+	viewfinder_->display(raw, bytesused);
 
 	return 0;
 }
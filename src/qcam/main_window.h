@@ -28,6 +28,7 @@ class ViewFinder;
 enum {
 	OptCamera = 'c',
 	OptHelp = 'h',
+	OptRenderer = 'r',
 	OptSize = 's',
 };
 
@@ -41,16 +42,18 @@ public:
 
 private Q_SLOTS:
 	void updateTitle();
+	void processViewfinder();
 
 private:
+	void createViewFinder(bool gl);
 	int openCamera(CameraManager *cm);
 
 	int startCapture();
 	void stopCapture();
 
 	void requestComplete(Request *request,
-			     const std::map<Stream *, Buffer *> &buffers);
-	int display(Buffer *buffer);
+			     const Request::BufferMap &buffers);
+	int display(Buffer *buffer, unsigned int bytesused);
 
 	QString title_;
 	QTimer titleTimer_;
@@ -68,6 +71,11 @@ private:
 	uint32_t framesCaptured_;
 
 	ViewFinder *viewfinder_;
+	bool viewfinderGL_;
+
+	/* Most recent completed request, waiting to be displayed. */
+	Request *pendingRequest_;
+	unsigned int pendingBytesused_;
 };
 
 #endif /* __QCAM_MAIN_WINDOW__ */
@@ -2,34 +2,21 @@
 /*
  * Copyright (C) 2019, Google Inc.
  *
- * viewfinder.h - qcam - Viewfinder
+ * viewfinder.h - qcam - Viewfinder base class
  */
 #ifndef __QCAM_VIEWFINDER_H__
 #define __QCAM_VIEWFINDER_H__
 
-#include <QLabel>
+#include <stddef.h>
 
-#include "format_converter.h"
-
-class QImage;
-
-class ViewFinder : public QLabel
+class ViewFinder
 {
 public:
-	ViewFinder(QWidget *parent);
-	~ViewFinder();
-
-	int setFormat(unsigned int format, unsigned int width,
-		      unsigned int height);
-	void display(const unsigned char *rgb, size_t size);
-
-private:
-	unsigned int format_;
-	unsigned int width_;
-	unsigned int height_;
+	virtual ~ViewFinder() {}
 
-	FormatConverter converter_;
-	QImage *image_;
+	virtual int setFormat(unsigned int format, unsigned int width,
+			      unsigned int height) = 0;
+	virtual void display(const unsigned char *raw, size_t size) = 0;
 };
 
 #endif /* __QCAM_VIEWFINDER__ */
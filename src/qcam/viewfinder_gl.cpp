@@ -0,0 +1,301 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.cpp - qcam - OpenGL ES viewfinder
+ */
+
+#include <errno.h>
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include "viewfinder_gl.h"
+
+/*
+ * The frames are uploaded to textures as-is and converted to RGB in the
+ * fragment shader. Semi-planar formats use a luminance texture for the Y plane
+ * and a luminance-alpha texture for the interleaved CbCr plane. Packed formats
+ * use a single RGBA texture with one texel per pair of pixels, the luma sample
+ * being selected based on the pixel position.
+ */
+static const char *vertexShader = R"(
+attribute vec4 vertexIn;
+attribute vec2 textureIn;
+varying vec2 textureOut;
+
+void main(void)
+{
+	gl_Position = vertexIn;
+	textureOut = textureIn;
+}
+)";
+
+static const char *fragmentShader = R"(
+#ifdef GL_ES
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+#endif
+
+varying vec2 textureOut;
+uniform sampler2D tex_y;
+uniform sampler2D tex_uv;
+uniform float tex_width;
+
+void main(void)
+{
+	float y, c0, c1, u, v;
+
+#if defined(YUV_PACKED)
+	vec4 pair = texture2D(tex_y, textureOut);
+	float odd = mod(floor(textureOut.x * tex_width), 2.0);
+#if defined(YUV_PACKED_Y_FIRST)
+	y = mix(pair.r, pair.b, odd);
+	c0 = pair.g;
+	c1 = pair.a;
+#else
+	y = mix(pair.g, pair.a, odd);
+	c0 = pair.r;
+	c1 = pair.b;
+#endif
+#else
+	vec4 uv = texture2D(tex_uv, textureOut);
+	y = texture2D(tex_y, textureOut).r;
+	c0 = uv.r;
+	c1 = uv.a;
+#endif
+
+#if defined(YUV_SWAP)
+	u = c1;
+	v = c0;
+#else
+	u = c0;
+	v = c1;
+#endif
+
+	/* ITU-R BT.601 limited range. */
+	const mat3 yuv2rgb = mat3(1.164, 1.164, 1.164,
+				  0.0, -0.392, 2.017,
+				  1.596, -0.813, 0.0);
+	vec3 yuv = vec3(y - 0.0625, u - 0.5, v - 0.5);
+
+	gl_FragColor = vec4(yuv2rgb * yuv, 1.0);
+}
+)";
+
+static const GLfloat vertices[] = {
+	-1.0f, -1.0f,
+	-1.0f, +1.0f,
+	+1.0f, -1.0f,
+	+1.0f, +1.0f,
+};
+
+static const GLfloat textureCoords[] = {
+	0.0f, 1.0f,
+	0.0f, 0.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+};
+
+ViewFinderGL::ViewFinderGL(QWidget *parent)
+	: QOpenGLWidget(parent), format_(0), width_(0), height_(0),
+	  packed_(false), vertSubSample_(1), programValid_(false),
+	  initialized_(false), hasFrame_(false), textures_{}
+{
+}
+
+ViewFinderGL::~ViewFinderGL()
+{
+	if (!initialized_)
+		return;
+
+	makeCurrent();
+	glDeleteTextures(2, textures_);
+	program_.reset();
+	doneCurrent();
+}
+
+bool ViewFinderGL::isFormatSupported(unsigned int format)
+{
+	switch (format) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_VYUY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int ViewFinderGL::setFormat(unsigned int format, unsigned int width,
+			    unsigned int height)
+{
+	if (!isFormatSupported(format))
+		return -EINVAL;
+
+	packed_ = false;
+	vertSubSample_ = 1;
+	shaderDefines_.clear();
+
+	switch (format) {
+	case V4L2_PIX_FMT_NV12:
+		vertSubSample_ = 2;
+		break;
+	case V4L2_PIX_FMT_NV21:
+		vertSubSample_ = 2;
+		shaderDefines_ = "#define YUV_SWAP\n";
+		break;
+	case V4L2_PIX_FMT_NV16:
+		break;
+	case V4L2_PIX_FMT_NV61:
+		shaderDefines_ = "#define YUV_SWAP\n";
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		packed_ = true;
+		shaderDefines_ = "#define YUV_PACKED\n"
+				 "#define YUV_PACKED_Y_FIRST\n";
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		packed_ = true;
+		shaderDefines_ = "#define YUV_PACKED\n"
+				 "#define YUV_PACKED_Y_FIRST\n"
+				 "#define YUV_SWAP\n";
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		packed_ = true;
+		shaderDefines_ = "#define YUV_PACKED\n";
+		break;
+	case V4L2_PIX_FMT_VYUY:
+		packed_ = true;
+		shaderDefines_ = "#define YUV_PACKED\n"
+				 "#define YUV_SWAP\n";
+		break;
+	}
+
+	format_ = format;
+	width_ = width;
+	height_ = height;
+
+	/* The program is recreated with the new defines at the next paint. */
+	programValid_ = false;
+	hasFrame_ = false;
+
+	setFixedSize(width, height);
+
+	return 0;
+}
+
+void ViewFinderGL::display(const unsigned char *raw, size_t size)
+{
+	size_t frameSize = packed_ ? width_ * height_ * 2
+			 : width_ * height_ + width_ * height_ / vertSubSample_;
+
+	/* Frames received before the GL context is created are dropped. */
+	if (!initialized_ || size < frameSize)
+		return;
+
+	/*
+	 * Upload the frame right away, as the buffer is requeued to the camera
+	 * when this function returns.
+	 */
+	makeCurrent();
+
+	if (packed_) {
+		uploadTexture(textures_[0], GL_RGBA, width_ / 2, height_, raw);
+	} else {
+		uploadTexture(textures_[0], GL_LUMINANCE, width_, height_, raw);
+		uploadTexture(textures_[1], GL_LUMINANCE_ALPHA, width_ / 2,
+			      height_ / vertSubSample_, raw + width_ * height_);
+	}
+
+	doneCurrent();
+
+	hasFrame_ = true;
+	update();
+}
+
+void ViewFinderGL::initializeGL()
+{
+	initializeOpenGLFunctions();
+
+	glGenTextures(2, textures_);
+	for (GLuint texture : textures_) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	initialized_ = true;
+}
+
+void ViewFinderGL::paintGL()
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (!hasFrame_)
+		return;
+
+	if (!programValid_ && !createProgram())
+		return;
+
+	program_->bind();
+	program_->enableAttributeArray("vertexIn");
+	program_->setAttributeArray("vertexIn", vertices, 2);
+	program_->enableAttributeArray("textureIn");
+	program_->setAttributeArray("textureIn", textureCoords, 2);
+	program_->setUniformValue("tex_y", 0);
+	program_->setUniformValue("tex_uv", 1);
+	program_->setUniformValue("tex_width", static_cast<GLfloat>(width_));
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textures_[0]);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, textures_[1]);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	program_->disableAttributeArray("vertexIn");
+	program_->disableAttributeArray("textureIn");
+	program_->release();
+}
+
+bool ViewFinderGL::createProgram()
+{
+	program_.reset(new QOpenGLShaderProgram());
+
+	if (!program_->addShaderFromSourceCode(QOpenGLShader::Vertex,
+					       vertexShader) ||
+	    !program_->addShaderFromSourceCode(QOpenGLShader::Fragment,
+					       shaderDefines_ + fragmentShader) ||
+	    !program_->link()) {
+		std::cerr << "Failed to create shader program: "
+			  << program_->log().toStdString() << std::endl;
+		program_.reset();
+		return false;
+	}
+
+	programValid_ = true;
+	return true;
+}
+
+void ViewFinderGL::uploadTexture(GLuint texture, GLint format,
+				 unsigned int width, unsigned int height,
+				 const unsigned char *data)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+		     GL_UNSIGNED_BYTE, data);
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.h - qcam - OpenGL ES viewfinder
+ */
+#ifndef __QCAM_VIEWFINDER_GL_H__
+#define __QCAM_VIEWFINDER_GL_H__
+
+#include <memory>
+
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+
+#include "viewfinder.h"
+
+class ViewFinderGL : public QOpenGLWidget, public ViewFinder,
+		     protected QOpenGLFunctions
+{
+public:
+	ViewFinderGL(QWidget *parent);
+	~ViewFinderGL();
+
+	static bool isFormatSupported(unsigned int format);
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height) override;
+	void display(const unsigned char *raw, size_t size) override;
+
+protected:
+	void initializeGL() override;
+	void paintGL() override;
+
+private:
+	bool createProgram();
+	void uploadTexture(GLuint texture, GLint format, unsigned int width,
+			   unsigned int height, const unsigned char *data);
+
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+
+	/* Semi-planar (NV) or packed (YUYV) format parameters. */
+	bool packed_;
+	unsigned int vertSubSample_;
+	QByteArray shaderDefines_;
+
+	std::unique_ptr<QOpenGLShaderProgram> program_;
+	bool programValid_;
+	bool initialized_;
+	bool hasFrame_;
+
+	GLuint textures_[2];
+};
+
+#endif /* __QCAM_VIEWFINDER_GL_H__ */
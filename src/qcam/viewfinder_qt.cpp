@@ -2,26 +2,26 @@
 /*
  * Copyright (C) 2019, Google Inc.
  *
- * viewfinder.cpp - qcam - Viewfinder
+ * viewfinder_qt.cpp - qcam - QLabel-based viewfinder
  */
 
 #include <QImage>
 #include <QPixmap>
 
 #include "format_converter.h"
-#include "viewfinder.h"
+#include "viewfinder_qt.h"
 
-ViewFinder::ViewFinder(QWidget *parent)
+ViewFinderQt::ViewFinderQt(QWidget *parent)
 	: QLabel(parent), format_(0), width_(0), height_(0), image_(nullptr)
 {
 }
 
-ViewFinder::~ViewFinder()
+ViewFinderQt::~ViewFinderQt()
 {
 	delete image_;
 }
 
-void ViewFinder::display(const unsigned char *raw, size_t size)
+void ViewFinderQt::display(const unsigned char *raw, size_t size)
 {
 	converter_.convert(raw, size, image_);
 
@@ -29,7 +29,7 @@ void ViewFinder::display(const unsigned char *raw, size_t size)
 	setPixmap(pixmap);
 }
 
-int ViewFinder::setFormat(unsigned int format, unsigned int width,
+int ViewFinderQt::setFormat(unsigned int format, unsigned int width,
 			  unsigned int height)
 {
 	int ret;
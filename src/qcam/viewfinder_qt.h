@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_qt.h - qcam - QLabel-based viewfinder
+ */
+#ifndef __QCAM_VIEWFINDER_QT_H__
+#define __QCAM_VIEWFINDER_QT_H__
+
+#include <QLabel>
+
+#include "format_converter.h"
+#include "viewfinder.h"
+
+class QImage;
+
+class ViewFinderQt : public QLabel, public ViewFinder
+{
+public:
+	ViewFinderQt(QWidget *parent);
+	~ViewFinderQt();
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height) override;
+	void display(const unsigned char *rgb, size_t size) override;
+
+private:
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+
+	FormatConverter converter_;
+	QImage *image_;
+};
+
+#endif /* __QCAM_VIEWFINDER_QT__ */
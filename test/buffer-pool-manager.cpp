@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * buffer-pool-manager.cpp - Internal buffer pools sharing tests
+ */
+
+#include <iostream>
+#include <sys/stat.h>
+
+#include "buffer_pool_manager.h"
+#include "pipeline_handler.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class BufferPoolManagerTest : public Test
+{
+protected:
+	static ino_t inode(BufferPool *pool, unsigned int index)
+	{
+		struct stat st;
+		if (fstat(pool->buffers()[index].planes()[0].dmabuf(), &st))
+			return 0;
+
+		return st.st_ino;
+	}
+
+	int run()
+	{
+		BufferPoolManager pools;
+		if (!pools.isValid()) {
+			cout << "No dma-heap available" << endl;
+			return TestSkip;
+		}
+
+		/* Cameras 0 and 1 can't run concurrently, camera 2 can. */
+		CameraData data0(nullptr);
+		CameraData data1(nullptr);
+		CameraData data2(nullptr);
+
+		pools.addCamera(&data0, 0);
+		pools.addCamera(&data1, 0);
+		pools.addCamera(&data2, 1);
+
+		V4L2DeviceFormat format = {};
+		format.size = { 640, 480 };
+		format.planesCount = 1;
+		format.planes[0].size = 640 * 480 * 2;
+
+		if (pools.allocatedSize()) {
+			cout << "Pools allocated before use" << endl;
+			return TestFail;
+		}
+
+		BufferPool *pool0 = pools.acquire(&data0, "raw", format, 4);
+		if (!pool0 || pool0->count() != 4) {
+			cout << "Failed to acquire pool" << endl;
+			return TestFail;
+		}
+
+		if (pools.allocatedSize() != 4 * format.planes[0].size) {
+			cout << "Invalid allocated size " << pools.allocatedSize()
+			     << endl;
+			return TestFail;
+		}
+
+		ino_t ino = inode(pool0, 0);
+
+		if (pools.acquire(&data1, "raw", format, 4)) {
+			cout << "Pool shared by concurrent cameras" << endl;
+			return TestFail;
+		}
+
+		BufferPool *pool2 = pools.acquire(&data2, "raw", format, 4);
+		if (!pool2 || pool2 == pool0) {
+			cout << "Failed to acquire pool in another group" << endl;
+			return TestFail;
+		}
+
+		/* Retain the released pools, and reuse them in the group. */
+		pools.setIdlePeriod(1000);
+		pools.release(&data0);
+
+		BufferPool *pool1 = pools.acquire(&data1, "raw", format, 2);
+		if (!pool1 || pool1->count() != 2 || inode(pool1, 0) != ino) {
+			cout << "Failed to share pool" << endl;
+			return TestFail;
+		}
+
+		pools.release(&data1);
+
+		/* A larger format reallocates the pool. */
+		format.planes[0].size *= 2;
+		pool1 = pools.acquire(&data1, "raw", format, 4);
+		if (!pool1 || pools.allocatedSize() != 6 * format.planes[0].size) {
+			cout << "Failed to reallocate pool" << endl;
+			return TestFail;
+		}
+
+		/* Without an idle period, the pools are freed on release. */
+		pools.setIdlePeriod(0);
+		pools.release(&data1);
+		pools.release(&data2);
+
+		if (pools.allocatedSize()) {
+			cout << "Failed to free pools" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(BufferPoolManagerTest)
@@ -97,6 +97,47 @@ protected:
 			return TestFail;
 		}
 
+		/* The mode lookup must agree with the format selection. */
+		const CameraSensorMode *mode = sensor_->findMode(Size(1024, 768));
+		if (!mode || mode->size != format.size) {
+			cerr << "Failed to find a suitable mode" << endl;
+			return TestFail;
+		}
+
+		/* Frame rate limits are ignored when the pixel rate is unknown. */
+		if (!sensor_->pixelRate() &&
+		    sensor_->findMode(Size(1024, 768), 1000.0f) != mode) {
+			cerr << "Mode rejected for an unknown frame rate" << endl;
+			return TestFail;
+		}
+
+		/* Region of interest cropping must stay within the bounds. */
+		const Rectangle roi = { 1, 1, 1281, 961 };
+		Rectangle crop;
+		format = sensor_->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10 },
+					    Size(640, 480), roi, &crop);
+
+		if (!sensor_->cropSupported()) {
+			if (crop.w || crop.h ||
+			    format.size != sensor_->findMode(Size(640, 480))->size) {
+				cerr << "Region of interest selected without crop support"
+				     << endl;
+				return TestFail;
+			}
+		} else {
+			const Rectangle &bounds = sensor_->cropBounds();
+			if (crop.x < bounds.x || crop.y < bounds.y ||
+			    crop.x + crop.w > bounds.x + bounds.w ||
+			    crop.y + crop.h > bounds.y + bounds.h ||
+			    crop.w % 2 || crop.h % 2 ||
+			    format.size.width < 640 || format.size.height < 480 ||
+			    format.size.width > crop.w || format.size.height > crop.h) {
+				cerr << "Invalid crop " << crop.toString()
+				     << " for " << format.toString() << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera buffer hold test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class BufferHold : public CameraTest
+{
+protected:
+	unsigned int completeRequestsCount_;
+	unsigned int releasedBuffersCount_;
+	std::vector<BufferRef> held_;
+
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/*
+		 * Hold the buffer of the first requests, and requeue the others
+		 * right away.
+		 */
+		Buffer *buffer = buffers.begin()->second;
+		if (held_.size() < 2) {
+			held_.emplace_back(buffer);
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	void bufferReleased(Buffer *buffer)
+	{
+		releasedBuffersCount_++;
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->buffer(i))) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		completeRequestsCount_ = 0;
+		releasedBuffersCount_ = 0;
+
+		camera_->requestCompleted.connect(this, &BufferHold::requestComplete);
+		stream->bufferReleased.connect(this, &BufferHold::bufferReleased);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (held_.size() != 2 || stream->heldBuffers() != 2) {
+			cout << "Failed to hold buffers" << endl;
+			return TestFail;
+		}
+
+		/* Held buffers shall not be added to a new request. */
+		Request *request = camera_->createRequest();
+		int ret = request->addBuffer(held_[0].buffer());
+		delete request;
+		if (ret != -EBUSY || !stream->starvationCount()) {
+			cout << "Held buffer added to a request" << endl;
+			return TestFail;
+		}
+
+		/* Copies share the hold, which is released with the last one. */
+		BufferRef copy = held_[0];
+		held_.clear();
+		if (releasedBuffersCount_ != 1 || stream->heldBuffers() != 1) {
+			cout << "Buffers released too early" << endl;
+			return TestFail;
+		}
+
+		copy.reset();
+		if (releasedBuffersCount_ != 2 || stream->heldBuffers() != 0) {
+			cout << "Failed to release buffers" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferHold);
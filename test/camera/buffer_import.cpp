@@ -259,7 +259,8 @@ public:
 
 		std::unique_ptr<Buffer> buffer = stream_->createBuffer({ dmabuf, -1, -1 });
 		request->addBuffer(move(buffer));
-		camera_->queueRequest(request);
+		if (camera_->queueRequest(request))
+			delete request;
 	}
 
 protected:
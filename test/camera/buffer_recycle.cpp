@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera buffer recycle test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Recycle each buffer as soon as it completes, and queue it in a new request.
+ * The requests then complete without any buffer.
+ */
+class BufferRecycle : public CameraTest
+{
+protected:
+	unsigned int recycledBuffersCount_;
+	unsigned int completeRequestsCount_;
+	unsigned int errors_;
+
+	void bufferComplete(Request *request, Buffer *buffer)
+	{
+		if (buffer->status() != Buffer::BufferSuccess)
+			return;
+
+		if (camera_->recycleBuffer(request, buffer)) {
+			errors_++;
+			return;
+		}
+
+		/* A buffer can only be recycled once. */
+		if (camera_->recycleBuffer(request, buffer) != -ENOENT)
+			errors_++;
+
+		recycledBuffersCount_++;
+
+		Request *next = camera_->createRequest();
+		if (next->addBuffer(buffer) || camera_->queueRequest(next)) {
+			delete next;
+			errors_++;
+		}
+	}
+
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		if (!buffers.empty())
+			errors_++;
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (config_->outOfOrderCompletion()) {
+			cout << "Out of order completion enabled by default" << endl;
+			return TestFail;
+		}
+
+		config_->setOutOfOrderCompletion(true);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->buffer(i))) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		recycledBuffersCount_ = 0;
+		completeRequestsCount_ = 0;
+		errors_ = 0;
+
+		camera_->bufferCompleted.connect(this, &BufferRecycle::bufferComplete);
+		camera_->requestCompleted.connect(this, &BufferRecycle::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (errors_) {
+			cout << errors_ << " buffer recycling errors" << endl;
+			return TestFail;
+		}
+
+		if (recycledBuffersCount_ <= cfg.bufferCount ||
+		    completeRequestsCount_ < recycledBuffersCount_) {
+			cout << "Failed to capture with recycled buffers" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferRecycle);
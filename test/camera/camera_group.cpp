@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera camera group test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class CameraGroupTest : public CameraTest
+{
+protected:
+	void frameSetReady(const CameraGroup::FrameSet &set)
+	{
+		if (set.size() != 1 || set[0].camera != camera_.get() ||
+		    set[0].buffers.size() != 1 ||
+		    !set[0].buffers.begin()->second.isValid() ||
+		    set[0].buffers.begin()->second.buffer()->timestamp() !=
+		    set[0].timestamp) {
+			invalid_++;
+			return;
+		}
+
+		sets_++;
+
+		/* Keep the first frames to check they aren't requeued. */
+		if (held_.size() < heldMax_)
+			held_.push_back(set);
+	}
+
+	void runFor(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		CameraGroup group;
+		if (group.start() != -EINVAL) {
+			cout << "Empty group started" << endl;
+			return TestFail;
+		}
+
+		if (group.addCamera(camera_, config_.get()) ||
+		    group.addCamera(camera_, config_.get()) != -EEXIST ||
+		    group.size() != 1) {
+			cout << "Failed to add camera to the group" << endl;
+			return TestFail;
+		}
+
+		group.frameSetReady.connect(this, &CameraGroupTest::frameSetReady);
+
+		sets_ = 0;
+		invalid_ = 0;
+		heldMax_ = config_->at(0).bufferCount - 1;
+
+		if (group.start()) {
+			cout << "Failed to start the group" << endl;
+			return TestFail;
+		}
+
+		if (group.addCamera(camera_, config_.get()) != -EBUSY) {
+			cout << "Camera added to a running group" << endl;
+			return TestFail;
+		}
+
+		runFor(1000);
+
+		/* Frames of a single camera always match. */
+		if (invalid_ || group.droppedFrames() || sets_ < 10) {
+			cout << "Invalid frame sets: " << sets_ << " delivered, "
+			     << invalid_ << " invalid, " << group.droppedFrames()
+			     << " dropped" << endl;
+			return TestFail;
+		}
+
+		/* Held frames are not requeued, the last buffer keeps cycling. */
+		Stream *stream = config_->at(0).stream();
+		if (held_.size() != heldMax_ || stream->heldBuffers() != heldMax_) {
+			cout << "Held frames have been requeued" << endl;
+			return TestFail;
+		}
+
+		held_.clear();
+		if (stream->heldBuffers()) {
+			cout << "Failed to release held frames" << endl;
+			return TestFail;
+		}
+
+		unsigned int sets = sets_;
+		runFor(200);
+
+		if (sets_ <= sets) {
+			cout << "Released frames have not been requeued" << endl;
+			return TestFail;
+		}
+
+		if (group.stop()) {
+			cout << "Failed to stop the group" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::vector<CameraGroup::FrameSet> held_;
+	unsigned int heldMax_;
+	unsigned int sets_;
+	unsigned int invalid_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraGroupTest);
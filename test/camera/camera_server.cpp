@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera camera sharing test
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class ClientState
+{
+public:
+	ClientState(bool hold)
+		: frames(0), dropped(0), invalid(0), ready(false),
+		  rejected(false), hold_(hold)
+	{
+		client.ready.connect(this, &ClientState::clientReady);
+		client.frameReady.connect(this, &ClientState::frameReady);
+		client.disconnected.connect(this, &ClientState::disconnected);
+	}
+
+	void releaseAll()
+	{
+		for (const CameraClient::Frame &frame : held_)
+			client.release(frame);
+		held_.clear();
+		hold_ = false;
+	}
+
+	CameraClient client;
+	unsigned int frames;
+	unsigned int dropped;
+	unsigned int invalid;
+	bool ready;
+	bool rejected;
+	std::map<unsigned int, unsigned int> sequences;
+
+private:
+	void clientReady(CameraClient *c)
+	{
+		ready = true;
+	}
+
+	void frameReady(CameraClient *c, const CameraClient::Frame &frame)
+	{
+		BufferMemory *memory = client.buffer(frame);
+		if (!memory || memory->planes().empty() ||
+		    !memory->planes()[0].mem())
+			invalid++;
+
+		frames++;
+		dropped += frame.dropped;
+		sequences[frame.sequence] = frame.index;
+
+		if (hold_)
+			held_.push_back(frame);
+		else
+			client.release(frame);
+	}
+
+	void disconnected(CameraClient *c)
+	{
+		rejected = !ready;
+	}
+
+	bool hold_;
+	std::vector<CameraClient::Frame> held_;
+};
+
+class CameraServerTest : public CameraTest
+{
+protected:
+	void runFor(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		path_ = "/tmp/libcamera-camera-server-test-" + to_string(getpid());
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		/* Six buffers leave four frames for the clients. */
+		config_->at(0).bufferCount = 6;
+		if (config_->validate() == CameraConfiguration::Invalid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		if (config_->at(0).bufferCount != 6) {
+			cout << "Camera doesn't support six buffers" << endl;
+			return TestSkip;
+		}
+
+		CameraServer server(camera_);
+		if (server.start(path_, config_.get())) {
+			cout << "Failed to start the server" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The fast client releases frames right away, the slow one
+		 * holds them, the greedy one is granted the last frame, and
+		 * the last one is rejected.
+		 */
+		ClientState fast(false);
+		ClientState slow(true);
+		ClientState greedy(false);
+		ClientState rejected(false);
+
+		ClientState *clients[] = { &fast, &slow, &greedy, &rejected };
+		unsigned int requests[] = { 2, 1, 4, 1 };
+
+		/* Connect one at a time, frames are granted in order. */
+		for (unsigned int i = 0; i < 4; ++i) {
+			if (clients[i]->client.connect(path_, requests[i])) {
+				cout << "Failed to connect to the server" << endl;
+				return TestFail;
+			}
+
+			runFor(50);
+		}
+
+		runFor(1000);
+
+		if (!fast.ready || !slow.ready || !greedy.ready) {
+			cout << "Clients not ready" << endl;
+			return TestFail;
+		}
+
+		if (fast.client.maxHeld() != 2 || slow.client.maxHeld() != 1 ||
+		    greedy.client.maxHeld() != 1 || !rejected.rejected ||
+		    server.clients() != 3 || server.availableBuffers() != 0) {
+			cout << "Invalid frame grants" << endl;
+			return TestFail;
+		}
+
+		if (fast.client.streams().size() != 1 ||
+		    fast.client.streams()[0].size != config_->at(0).size ||
+		    fast.client.streams()[0].buffers.size() != 6) {
+			cout << "Invalid stream information" << endl;
+			return TestFail;
+		}
+
+		/* The slow client doesn't delay the other ones. */
+		if (fast.frames < 10 || greedy.frames < 10 || slow.frames != 1) {
+			cout << "Invalid number of frames: " << fast.frames << ", "
+			     << greedy.frames << ", " << slow.frames << endl;
+			return TestFail;
+		}
+
+		if (fast.invalid || slow.invalid || greedy.invalid) {
+			cout << "Failed to map frames" << endl;
+			return TestFail;
+		}
+
+		/* The clients share the same capture. */
+		for (const auto &item : greedy.sequences) {
+			auto iter = fast.sequences.find(item.first);
+			if (iter != fast.sequences.end() && iter->second != item.second) {
+				cout << "Clients received different frames" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Releasing frames resumes delivery, reporting skipped frames. */
+		slow.releaseAll();
+		runFor(200);
+
+		if (slow.frames < 2 || !slow.dropped) {
+			cout << "Failed to resume delivery" << endl;
+			return TestFail;
+		}
+
+		/* Disconnecting returns the granted frames to the server. */
+		fast.client.disconnect();
+		runFor(100);
+
+		if (server.clients() != 2 || server.availableBuffers() != 2) {
+			cout << "Failed to handle client disconnection" << endl;
+			return TestFail;
+		}
+
+		server.stop();
+
+		if (access(path_.c_str(), F_OK) == 0) {
+			cout << "Failed to remove the socket" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(path_.c_str());
+		CameraTest::cleanup();
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::string path_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraServerTest);
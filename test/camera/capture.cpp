@@ -27,7 +27,7 @@ protected:
 		completeBuffersCount_++;
 	}
 
-	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
 	{
 		if (request->status() != Request::RequestComplete)
 			return;
@@ -41,7 +41,8 @@ protected:
 
 		request = camera_->createRequest();
 		request->addBuffer(std::move(newBuffer));
-		camera_->queueRequest(request);
+		if (camera_->queueRequest(request))
+			delete request;
 	}
 
 	int init() override
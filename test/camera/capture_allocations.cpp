@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera steady-state capture allocations test
+ */
+
+#include <iostream>
+
+#include "allocation_counter.h"
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Capture frames with recycled requests and check that the number of heap
+ * allocations per frame stays within budget once the capture has reached a
+ * steady state. Allocations are counted for the whole process, including the
+ * camera manager thread and the test itself.
+ */
+class CaptureAllocations : public CameraTest
+{
+protected:
+	/* The number of frames captured before and while counting. */
+	static constexpr unsigned int WarmupFrames = 10;
+	static constexpr unsigned int MeasuredFrames = 60;
+
+	/* The maximum number of allocations per frame, in percent. */
+	static constexpr unsigned int AllocationsBudget = 10;
+
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		/* Requests cancelled when stopping the camera are ignored. */
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		for (auto it : buffers) {
+			if (it.second->status() != Buffer::BufferSuccess)
+				errors_++;
+		}
+
+		if (completed_ == WarmupFrames)
+			allocations_.reset();
+
+		completed_++;
+		if (completed_ == WarmupFrames + MeasuredFrames) {
+			frameAllocations_ = allocations_.count();
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->createBuffer(i))) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		completed_ = 0;
+		errors_ = 0;
+
+		camera_->requestCompleted.connect(this, &CaptureAllocations::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(5000);
+		while (timer.isRunning() &&
+		       completed_ < WarmupFrames + MeasuredFrames)
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		if (completed_ < WarmupFrames + MeasuredFrames) {
+			cout << "Timeout after " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		if (errors_) {
+			cout << errors_ << " buffers completed with an error" << endl;
+			return TestFail;
+		}
+
+		cout << frameAllocations_ << " allocations in " << MeasuredFrames
+		     << " frames" << endl;
+
+		if (frameAllocations_ * 100 > MeasuredFrames * AllocationsBudget) {
+			cout << "Allocations per frame exceed the budget of "
+			     << AllocationsBudget / 100.0 << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+
+	AllocationCounter allocations_;
+	uint64_t frameAllocations_;
+
+	unsigned int completed_;
+	unsigned int errors_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CaptureAllocations);
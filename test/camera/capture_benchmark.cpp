@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera capture benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+
+#include "allocation_counter.h"
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+uint64_t cpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL
+	     + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *str = getenv(name);
+	if (!str)
+		return defaultValue;
+
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (*end != '\0' || !value)
+		return defaultValue;
+
+	return value;
+}
+
+class CaptureBenchmark : public CameraTest
+{
+protected:
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		/* Requests cancelled when stopping the camera are ignored. */
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		for (auto it : buffers) {
+			if (it.second->status() != Buffer::BufferSuccess)
+				errors_++;
+		}
+
+		if (completed_ == warmup_)
+			startMeasurement();
+
+		if (completed_ >= warmup_) {
+			const ControlList &metadata = request->metadata();
+			if (metadata.contains(controls::LatencyCompleted))
+				latencies_.push_back(metadata.get(controls::LatencyCompleted));
+		}
+
+		completed_++;
+		if (completed_ == warmup_ + frames_) {
+			stopMeasurement();
+			return;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	void startMeasurement()
+	{
+		startTime_ = std::chrono::steady_clock::now();
+		startCpu_ = cpuTime();
+		allocations_.reset();
+	}
+
+	void stopMeasurement()
+	{
+		stopTime_ = std::chrono::steady_clock::now();
+		stopCpu_ = cpuTime();
+		frameAllocations_ = allocations_.count();
+		done_ = true;
+	}
+
+	uint64_t percentile(unsigned int percent) const
+	{
+		if (latencies_.empty())
+			return 0;
+
+		size_t index = (latencies_.size() - 1) * percent / 100;
+		return latencies_[index];
+	}
+
+	std::string report()
+	{
+		double duration = std::chrono::duration<double>(stopTime_ - startTime_).count();
+
+		std::sort(latencies_.begin(), latencies_.end());
+
+		std::string configuration;
+		for (const StreamConfiguration &cfg : *config_) {
+			if (!configuration.empty())
+				configuration += ", ";
+			configuration += cfg.toString();
+		}
+
+		std::stringstream json;
+		json << "{" << endl
+		     << "  \"benchmark\": \"capture\"," << endl
+		     << "  \"camera\": \"" << camera_->name() << "\"," << endl
+		     << "  \"configuration\": \"" << configuration << "\"," << endl
+		     << "  \"streams\": " << config_->size() << "," << endl
+		     << "  \"buffers\": " << bufferCount_ << "," << endl
+		     << "  \"frames\": " << frames_ << "," << endl
+		     << "  \"errors\": " << errors_ << "," << endl
+		     << "  \"throughput_fps\": " << frames_ / duration << "," << endl
+		     << "  \"cpu_ns_per_frame\": "
+		     << (stopCpu_ - startCpu_) / frames_ << "," << endl
+		     << "  \"allocations_per_frame\": "
+		     << static_cast<double>(frameAllocations_) / frames_
+		     << "," << endl
+		     << "  \"latency_ns\": {" << endl
+		     << "    \"samples\": " << latencies_.size() << "," << endl
+		     << "    \"min\": " << percentile(0) << "," << endl
+		     << "    \"p50\": " << percentile(50) << "," << endl
+		     << "    \"p90\": " << percentile(90) << "," << endl
+		     << "    \"p99\": " << percentile(99) << "," << endl
+		     << "    \"max\": " << percentile(100) << endl
+		     << "  }" << endl
+		     << "}" << endl;
+
+		return json.str();
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		/*
+		 * Use a fixed format to make results comparable between runs.
+		 * The number of frames and the output file can be set through
+		 * the environment, as well as the number of streams, to add a
+		 * raw stream to the video stream.
+		 */
+		StreamRoles roles{ StreamRole::VideoRecording };
+		if (envValue("LIBCAMERA_BENCHMARK_STREAMS", 1) > 1)
+			roles.push_back(StreamRole::StillCaptureRaw);
+
+		config_ = camera_->generateConfiguration(roles);
+		if (!config_ || config_->size() != roles.size()) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config_->at(0);
+		cfg.size = { 640, 480 };
+
+		if (config_->validate() == CameraConfiguration::Invalid) {
+			cout << "Failed to validate configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		/* Queue as many requests as the smallest stream has buffers. */
+		bufferCount_ = cfg.bufferCount;
+		for (const StreamConfiguration &streamCfg : *config_)
+			bufferCount_ = std::min(bufferCount_, streamCfg.bufferCount);
+
+		frames_ = envValue("LIBCAMERA_BENCHMARK_FRAMES", 3000);
+		warmup_ = bufferCount_ * 2;
+		completed_ = 0;
+		errors_ = 0;
+		done_ = false;
+
+		/* Reserve the storage upfront, not to bias the allocations count. */
+		latencies_.reserve(frames_);
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < bufferCount_; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			for (const StreamConfiguration &cfg : *config_) {
+				Stream *stream = cfg.stream();
+				if (request->addBuffer(stream->createBuffer(i))) {
+					cout << "Failed to associate buffer with request" << endl;
+					return TestFail;
+				}
+			}
+
+			requests.push_back(request);
+		}
+
+		camera_->requestCompleted.connect(this, &CaptureBenchmark::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		/* Allow for a 10 fps worst case before giving up. */
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start((warmup_ + frames_) * 100 + 1000);
+		while (timer.isRunning() && !done_)
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		if (!done_) {
+			cout << "Timeout after " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		std::string result = report();
+		cout << result;
+
+		const char *output = getenv("LIBCAMERA_BENCHMARK_OUTPUT");
+		if (output) {
+			std::ofstream file(output);
+			file << result;
+			if (!file) {
+				cout << "Failed to write " << output << endl;
+				return TestFail;
+			}
+		}
+
+		return errors_ ? TestFail : TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+
+	unsigned int bufferCount_;
+	unsigned int frames_;
+	unsigned int warmup_;
+	unsigned int completed_;
+	unsigned int errors_;
+	bool done_;
+
+	std::vector<uint64_t> latencies_;
+
+	std::chrono::steady_clock::time_point startTime_;
+	std::chrono::steady_clock::time_point stopTime_;
+	uint64_t startCpu_;
+	uint64_t stopCpu_;
+
+	AllocationCounter allocations_;
+	uint64_t frameAllocations_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CaptureBenchmark)
@@ -80,6 +80,39 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that zero shutter lag capture, which the VIMC camera
+		 * doesn't support, is disabled by validation.
+		 */
+		config_->setZslFrames(4);
+		if (config_->validate() != CameraConfiguration::Adjusted ||
+		    config_->zslFrames()) {
+			cout << "Unsupported zero shutter lag not disabled" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test that the queue profile selects the number of buffers,
+		 * and that the default profile restores it.
+		 */
+		config_->setQueueProfile(CameraConfiguration::LowLatency);
+		config_->validate();
+		unsigned int lowLatencyCount = cfg.bufferCount;
+
+		config_->setQueueProfile(CameraConfiguration::Throughput);
+		config_->validate();
+		unsigned int throughputCount = cfg.bufferCount;
+
+		config_->setQueueProfile(CameraConfiguration::Balanced);
+		config_->validate();
+
+		if (!lowLatencyCount || lowLatencyCount >= cfg.bufferCount ||
+		    throughputCount <= cfg.bufferCount) {
+			cout << "Queue profile not applied to the buffer count"
+			     << endl;
+			return TestFail;
+		}
+
 		/*
 		 * Test that setting an invalid configuration fails.
 		 */
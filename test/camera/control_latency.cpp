@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera control latency test
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+
+#include "synthetic_capture_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Toggle the frame duration of the synthetic camera every few requests, and
+ * measure the number of frames between the request the control is set in and
+ * the first frame whose metadata reports the new value. The synthetic camera
+ * applies controls when requests are queued, the latency depends on the number
+ * of requests in flight only, and mustn't vary by more than one frame between
+ * trials to account for requests completing in batches.
+ */
+class ControlLatencyTest : public SyntheticCaptureTest
+{
+protected:
+	static constexpr unsigned int Trials = 6;
+	static constexpr unsigned int Interval = 16;
+
+	struct Sample {
+		unsigned int sequence;
+		int64_t duration;
+	};
+
+	void processRequest(Request *request, const Request::BufferMap &buffers) override
+	{
+		Sample sample;
+		sample.sequence = buffers.begin()->second->sequence();
+		sample.duration = request->metadata().get(controls::FrameDuration);
+		samples_.push_back(sample);
+
+		auto target = targets_.find(request->cookie());
+		if (target != targets_.end()) {
+			toggles_.emplace_back(samples_.size() - 1, target->second);
+			targets_.erase(target);
+		}
+	}
+
+	void prepareRequest(Request *request) override
+	{
+		/* Start from the low duration, and toggle every interval requests. */
+		queued_++;
+		if (queued_ == 1) {
+			request->controls().set(controls::FrameDuration, durations_[0]);
+		} else if (!(queued_ % Interval) && toggled_ < Trials) {
+			toggled_++;
+			int64_t duration = durations_[toggled_ % 2];
+			request->controls().set(controls::FrameDuration, duration);
+			targets_[request->cookie()] = duration;
+		}
+	}
+
+	/* Capture until the frames following the last toggle complete. */
+	bool captureDone() const override
+	{
+		return toggles_.size() >= Trials &&
+		       samples_.size() >= toggles_.back().first + Interval / 2;
+	}
+
+	int init() override
+	{
+		int ret = SyntheticCaptureTest::init();
+		if (ret)
+			return ret;
+
+		durations_[0] = 10000;
+		durations_[1] = 20000;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::Viewfinder });
+		if (!config || config->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		queued_ = 0;
+		toggled_ = 0;
+
+		int ret = startCapture(config.get());
+		if (ret)
+			return ret;
+
+		runCapture(5000);
+
+		ret = stopCapture();
+		if (ret)
+			return ret;
+
+		if (toggles_.size() < Trials) {
+			cout << "Only " << toggles_.size() << " trials completed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Search the frames around each toggle, from half an interval
+		 * before to half an interval after, for the new duration.
+		 */
+		std::map<int, unsigned int> latencies;
+		for (const auto &toggle : toggles_) {
+			unsigned int index = toggle.first;
+			int64_t target = toggle.second;
+			unsigned int first = index >= Interval / 2 ? index - Interval / 2 : 0;
+			unsigned int last = std::min<unsigned int>(index + Interval / 2,
+								   samples_.size());
+
+			if (samples_[first].duration == target) {
+				cout << "Frame duration " << target
+				     << " reported before the trial" << endl;
+				return TestFail;
+			}
+
+			unsigned int i;
+			for (i = first; i < last; ++i) {
+				if (samples_[i].duration == target)
+					break;
+			}
+
+			if (i == last) {
+				cout << "Frame duration " << target
+				     << " not reported in the metadata" << endl;
+				return TestFail;
+			}
+
+			int latency = static_cast<int>(samples_[i].sequence) -
+				      static_cast<int>(samples_[index].sequence);
+			latencies[latency]++;
+		}
+
+		int minLatency = latencies.begin()->first;
+		int maxLatency = latencies.rbegin()->first;
+
+		if (maxLatency - minLatency > 1) {
+			cout << "Inconsistent control latency:";
+			for (const auto &it : latencies)
+				cout << " " << it.first << " (" << it.second << ")";
+			cout << endl;
+			return TestFail;
+		}
+
+		if (minLatency < -static_cast<int>(cfg.bufferCount) ||
+		    maxLatency > static_cast<int>(cfg.bufferCount)) {
+			cout << "Control latency exceeds the number of requests in flight"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int64_t durations_[2];
+	unsigned int queued_;
+	unsigned int toggled_;
+	std::map<uint64_t, int64_t> targets_;
+	std::vector<std::pair<unsigned int, int64_t>> toggles_;
+	std::vector<Sample> samples_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ControlLatencyTest);
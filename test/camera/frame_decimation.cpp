@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera stream frame decimation test
+ */
+
+#include <iostream>
+
+#include "synthetic_capture_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Capture from a decimated stream of the synthetic camera, and check that only
+ * the frames whose sequence number is a multiple of the decimation factor are
+ * captured, while the buffers of the other requests are skipped.
+ */
+class FrameDecimationTest : public SyntheticCaptureTest
+{
+protected:
+	static constexpr unsigned int Decimation = 3;
+
+	void processRequest(Request *request, const Request::BufferMap &buffers) override
+	{
+		Buffer *buffer = buffers.begin()->second;
+		switch (buffer->status()) {
+		case Buffer::BufferSuccess:
+			if (buffer->sequence() % Decimation)
+				invalid_++;
+			captured_++;
+			break;
+		case Buffer::BufferSkipped:
+			skipped_++;
+			break;
+		default:
+			invalid_++;
+			break;
+		}
+	}
+
+	int init() override
+	{
+		int ret = SyntheticCaptureTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::Viewfinder });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		/* Invalid decimation factors must be adjusted. */
+		cfg.frameDecimation = 0;
+		if (config_->validate() != CameraConfiguration::Adjusted ||
+		    cfg.frameDecimation != 1) {
+			cout << "Invalid frame decimation not adjusted" << endl;
+			return TestFail;
+		}
+
+		cfg.frameDecimation = Decimation;
+		if (config_->validate() != CameraConfiguration::Valid) {
+			cout << "Frame decimation not supported" << endl;
+			return TestFail;
+		}
+
+		captured_ = 0;
+		skipped_ = 0;
+		invalid_ = 0;
+
+		int ret = startCapture(config_.get());
+		if (ret)
+			return ret;
+
+		runCapture(500);
+
+		ret = stopCapture();
+		if (ret)
+			return ret;
+
+		if (invalid_) {
+			cout << invalid_ << " invalid frames" << endl;
+			return TestFail;
+		}
+
+		/* Two frames out of three are skipped, leave margin for late frames. */
+		if (captured_ < 5 || skipped_ < captured_) {
+			cout << "Unexpected decimation, " << captured_
+			     << " frames captured, " << skipped_ << " skipped"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	unsigned int captured_;
+	unsigned int skipped_;
+	unsigned int invalid_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(FrameDecimationTest);
@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera JPEG encoder test
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "mjpeg_decoder.h"
+#include "v4l2_videodevice.h"
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class JpegEncoderTest : public CameraTest
+{
+protected:
+	std::atomic<unsigned int> encodedCount_;
+	std::atomic<unsigned int> failedCount_;
+	unsigned int busyCount_;
+
+	std::mutex mutex_;
+	std::vector<Buffer *> outputs_;
+
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		/*
+		 * Encode the frame, holding its buffer until it is encoded, or
+		 * requeue it right away when all output buffers are in use.
+		 */
+		Buffer *buffer = buffers.begin()->second;
+		int ret = encoder_.encode(buffer);
+		if (!ret)
+			return;
+
+		if (ret == -EBUSY)
+			busyCount_++;
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	/* Called from a worker thread. */
+	void bufferEncoded(Buffer *source, Buffer *output)
+	{
+		if (!validate(source, output))
+			failedCount_++;
+
+		encodedCount_++;
+
+		/* Keep the output buffers to exhaust the pool. */
+		std::lock_guard<std::mutex> locker(mutex_);
+		outputs_.push_back(output);
+	}
+
+	bool validate(Buffer *source, Buffer *output)
+	{
+		if (output->status() != Buffer::BufferSuccess ||
+		    output->sequence() != source->sequence() ||
+		    output->timestamp() != source->timestamp() ||
+		    output->bytesused() < 4 ||
+		    output->bytesused() > encoder_.bufferSize()) {
+			cout << "Invalid output buffer" << endl;
+			return false;
+		}
+
+		const uint8_t *data =
+			static_cast<const uint8_t *>(output->mem()->planes()[0].mem());
+		unsigned int size = output->bytesused();
+		if (data[0] != 0xff || data[1] != 0xd8 ||
+		    data[size - 2] != 0xff || data[size - 1] != 0xd9) {
+			cout << "Invalid JPEG markers" << endl;
+			return false;
+		}
+
+		/* Decoding checks the image size. */
+		MjpegDecoder decoder;
+		V4L2DeviceFormat format;
+		if (decoder.configure(encoder_.size(), V4L2_PIX_FMT_YUYV, &format))
+			return false;
+
+		std::vector<uint8_t> frame(format.planes[0].size);
+		int ret = decoder.decode(data, size, frame.data(), frame.size());
+		if (ret != static_cast<int>(frame.size())) {
+			cout << "Failed to decode JPEG image" << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::StillCapture });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		const std::vector<unsigned int> &formats = JpegEncoder::formats();
+		if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+		    formats.end()) {
+			cout << "Default format can't be encoded" << endl;
+			return TestSkip;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (encoder_.configure(cfg, 0) != -EINVAL) {
+			cout << "Invalid quality accepted" << endl;
+			return TestFail;
+		}
+
+		if (encoder_.configure(cfg, 90, 2)) {
+			cout << "Failed to configure the encoder" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->buffer(i))) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		encodedCount_ = 0;
+		failedCount_ = 0;
+		busyCount_ = 0;
+
+		camera_->requestCompleted.connect(this, &JpegEncoderTest::requestComplete);
+		encoder_.bufferEncoded.connect(this, &JpegEncoderTest::bufferEncoded);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		encoder_.flush();
+
+		if (failedCount_) {
+			cout << "Failed to encode frames" << endl;
+			return TestFail;
+		}
+
+		/* The frames in flight are bounded by the output buffers. */
+		if (encodedCount_ != 2 || encoder_.inFlight() != 2 || !busyCount_) {
+			cout << "Invalid number of frames in flight" << endl;
+			return TestFail;
+		}
+
+		for (Buffer *output : outputs_)
+			encoder_.releaseBuffer(output);
+
+		if (encoder_.inFlight()) {
+			cout << "Failed to release output buffers" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	JpegEncoder encoder_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(JpegEncoderTest);
@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera multi-camera scalability benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+/*
+ * The CPU time of the calling thread. Pipeline handlers run in the camera
+ * manager thread by default, this is thus the time spent in the event
+ * dispatcher and in all the pipeline handlers.
+ */
+uint64_t threadCpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL
+	     + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *str = getenv(name);
+	if (!str)
+		return defaultValue;
+
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (*end != '\0' || !value)
+		return defaultValue;
+
+	return value;
+}
+
+uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned int percent)
+{
+	if (sorted.empty())
+		return 0;
+
+	size_t index = (sorted.size() - 1) * percent / 100;
+	return sorted[index];
+}
+
+class CameraCapture
+{
+public:
+	CameraCapture(std::shared_ptr<Camera> camera, unsigned int frames)
+		: camera_(camera), frames_(frames), completed_(0), errors_(0),
+		  running_(false)
+	{
+		latencies_.reserve(frames_);
+	}
+
+	~CameraCapture()
+	{
+		stop();
+		camera_->release();
+	}
+
+	int configure()
+	{
+		if (camera_->acquire()) {
+			cout << camera_->name() << ": failed to acquire" << endl;
+			return TestFail;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << camera_->name() << ": failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		/* Use the same format on all cameras to compare them. */
+		config_->at(0).size = { 640, 480 };
+		if (config_->validate() == CameraConfiguration::Invalid ||
+		    camera_->configure(config_.get())) {
+			cout << camera_->name() << ": failed to configure" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << camera_->name() << ": failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int start()
+	{
+		StreamConfiguration &cfg = config_->at(0);
+		Stream *stream = cfg.stream();
+
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request || request->addBuffer(stream->createBuffer(i))) {
+				cout << camera_->name() << ": failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		camera_->requestCompleted.connect(this, &CameraCapture::requestComplete);
+
+		if (camera_->start()) {
+			cout << camera_->name() << ": failed to start" << endl;
+			return TestFail;
+		}
+
+		running_ = true;
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << camera_->name() << ": failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void stop()
+	{
+		if (!running_)
+			return;
+
+		camera_->stop();
+		camera_->requestCompleted.disconnect(this, &CameraCapture::requestComplete);
+		camera_->freeBuffers();
+		running_ = false;
+	}
+
+	bool done() const { return completed_ >= frames_; }
+
+	const std::string &name() const { return camera_->name(); }
+	unsigned int completed() const { return completed_; }
+	unsigned int errors() const { return errors_; }
+	const std::vector<uint64_t> &latencies() const { return latencies_; }
+
+private:
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		/* Requests cancelled when stopping the camera are ignored. */
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		for (auto it : buffers) {
+			if (it.second->status() != Buffer::BufferSuccess)
+				errors_++;
+		}
+
+		const ControlList &metadata = request->metadata();
+		if (metadata.contains(controls::LatencyCompleted))
+			latencies_.push_back(metadata.get(controls::LatencyCompleted));
+
+		if (++completed_ >= frames_)
+			return;
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+
+	std::vector<uint64_t> latencies_;
+	unsigned int frames_;
+	unsigned int completed_;
+	unsigned int errors_;
+	bool running_;
+};
+
+/*
+ * Capture from a growing number of cameras concurrently, and report the
+ * per-camera latency and the CPU time spent in the camera manager thread per
+ * frame for each camera count. The cameras are taken in enumeration order. The
+ * number of frames per camera and the maximum number of cameras can be set
+ * with LIBCAMERA_BENCHMARK_FRAMES and LIBCAMERA_BENCHMARK_CAMERAS, and the
+ * results are written to the LIBCAMERA_BENCHMARK_OUTPUT file when set.
+ */
+class MultiCameraBenchmark : public Test
+{
+protected:
+	int init() override
+	{
+		cm_ = new CameraManager();
+
+		if (cm_->start()) {
+			cout << "Failed to start camera manager" << endl;
+			delete cm_;
+			return TestFail;
+		}
+
+		unsigned int count = cm_->cameras().size();
+		maxCameras_ = std::min(envValue("LIBCAMERA_BENCHMARK_CAMERAS", count),
+				       count);
+		if (!maxCameras_) {
+			cout << "No camera available" << endl;
+			cm_->stop();
+			delete cm_;
+			return TestSkip;
+		}
+
+		frames_ = envValue("LIBCAMERA_BENCHMARK_FRAMES", 300);
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		std::stringstream json;
+		json << "{" << endl
+		     << "  \"benchmark\": \"multi-camera\"," << endl
+		     << "  \"frames_per_camera\": " << frames_ << "," << endl
+		     << "  \"results\": [" << endl;
+
+		unsigned int count = 1;
+		while (true) {
+			int ret = capture(count, json);
+			if (ret)
+				return ret;
+
+			if (count == maxCameras_)
+				break;
+
+			count = std::min(count * 2, maxCameras_);
+			json << "," << endl;
+		}
+
+		json << endl
+		     << "  ]" << endl
+		     << "}" << endl;
+
+		std::string result = json.str();
+		cout << result;
+
+		const char *output = getenv("LIBCAMERA_BENCHMARK_OUTPUT");
+		if (output) {
+			std::ofstream file(output);
+			file << result;
+			if (!file) {
+				cout << "Failed to write " << output << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		cm_->stop();
+		delete cm_;
+	}
+
+private:
+	int capture(unsigned int count, std::stringstream &json)
+	{
+		std::vector<std::unique_ptr<CameraCapture>> captures;
+		for (unsigned int i = 0; i < count; ++i) {
+			captures.emplace_back(new CameraCapture(cm_->cameras()[i], frames_));
+			int ret = captures.back()->configure();
+			if (ret)
+				return ret;
+		}
+
+		auto allDone = [&]() {
+			return std::all_of(captures.begin(), captures.end(),
+					   [](const std::unique_ptr<CameraCapture> &capture) {
+						   return capture->done();
+					   });
+		};
+
+		auto startTime = std::chrono::steady_clock::now();
+		uint64_t startCpu = threadCpuTime();
+
+		for (std::unique_ptr<CameraCapture> &capture : captures) {
+			int ret = capture->start();
+			if (ret)
+				return ret;
+		}
+
+		/* Allow for a 10 fps worst case before giving up. */
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(frames_ * 100 + 1000);
+		while (timer.isRunning() && !allDone())
+			dispatcher->processEvents();
+
+		uint64_t cpu = threadCpuTime() - startCpu;
+		double duration = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - startTime).count();
+
+		for (std::unique_ptr<CameraCapture> &capture : captures)
+			capture->stop();
+
+		unsigned int frames = 0;
+		unsigned int errors = 0;
+		std::vector<uint64_t> latencies;
+
+		for (const std::unique_ptr<CameraCapture> &capture : captures) {
+			frames += capture->completed();
+			errors += capture->errors();
+			latencies.insert(latencies.end(), capture->latencies().begin(),
+					 capture->latencies().end());
+		}
+
+		if (!allDone()) {
+			cout << "Timeout with " << count << " cameras after "
+			     << frames << " frames" << endl;
+			return TestFail;
+		}
+
+		if (errors) {
+			cout << errors << " buffers completed with an error with "
+			     << count << " cameras" << endl;
+			return TestFail;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		json << "    {" << endl
+		     << "      \"cameras\": " << count << "," << endl
+		     << "      \"frames\": " << frames << "," << endl
+		     << "      \"throughput_fps\": " << frames / duration << "," << endl
+		     << "      \"dispatcher_cpu_ns_per_frame\": " << cpu / frames << "," << endl
+		     << "      \"latency_ns\": { \"p50\": " << percentile(latencies, 50)
+		     << ", \"p99\": " << percentile(latencies, 99)
+		     << ", \"max\": " << percentile(latencies, 100) << " }," << endl
+		     << "      \"per_camera\": [" << endl;
+
+		for (unsigned int i = 0; i < captures.size(); ++i) {
+			std::vector<uint64_t> sorted = captures[i]->latencies();
+			std::sort(sorted.begin(), sorted.end());
+
+			json << "        { \"camera\": \"" << captures[i]->name()
+			     << "\", \"p50\": " << percentile(sorted, 50)
+			     << ", \"p99\": " << percentile(sorted, 99) << " }"
+			     << (i + 1 < captures.size() ? "," : "") << endl;
+		}
+
+		json << "      ]" << endl
+		     << "    }";
+
+		return TestPass;
+	}
+
+	CameraManager *cm_;
+	unsigned int maxCameras_;
+	unsigned int frames_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(MultiCameraBenchmark)
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera::queueRequests() test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Queue a batch of requests containing an invalid request, and check that only
+ * the requests preceding it are queued, while the application keeps ownership
+ * of the invalid request and of the requests that follow it.
+ */
+class QueueRequestsTest : public CameraTest
+{
+protected:
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_.push_back(request->cookie());
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	Request *createRequest(uint64_t cookie, int index)
+	{
+		Request *request = camera_->createRequest(cookie);
+		if (!request || index < 0)
+			return request;
+
+		Stream *stream = config_->at(0).stream();
+		if (request->addBuffer(stream->createBuffer(index))) {
+			delete request;
+			return nullptr;
+		}
+
+		return request;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (cfg.bufferCount < 2) {
+			cout << "Not enough buffers for the test" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		/* The second request is invalid as it contains no buffer. */
+		std::vector<Request *> requests = {
+			createRequest(0, 0),
+			createRequest(1, -1),
+			createRequest(2, 1),
+		};
+
+		for (Request *request : requests) {
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				for (Request *r : requests)
+					delete r;
+				return TestFail;
+			}
+		}
+
+		camera_->requestCompleted.connect(this, &QueueRequestsTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			for (Request *request : requests)
+				delete request;
+			return TestFail;
+		}
+
+		int ret = runBatch(requests);
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return ret;
+	}
+
+	int runBatch(std::vector<Request *> &requests)
+	{
+		/* The batch stops at the invalid request. */
+		int queued = camera_->queueRequests(requests);
+		if (queued != 1) {
+			cout << "Expected 1 request queued, got " << queued << endl;
+			/* The requests can't be deleted safely anymore. */
+			return TestFail;
+		}
+
+		/* A batch starting with an invalid request queues nothing. */
+		std::vector<Request *> remaining(requests.begin() + 1, requests.end());
+		queued = camera_->queueRequests(remaining);
+		if (queued != 0) {
+			cout << "Expected no request queued, got " << queued << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The application still owns the remaining requests, which can
+		 * be queued again or deleted.
+		 */
+		delete requests[1];
+
+		if (camera_->queueRequest(requests[2])) {
+			cout << "Failed to queue the request following the batch" << endl;
+			delete requests[2];
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (completed_.size() < 2 && timer.isRunning())
+			dispatcher->processEvents();
+
+		if (completed_ != std::vector<uint64_t>{ 0, 2 }) {
+			cout << "Unexpected requests completed:";
+			for (uint64_t cookie : completed_)
+				cout << " " << cookie;
+			cout << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	std::vector<uint64_t> completed_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(QueueRequestsTest);
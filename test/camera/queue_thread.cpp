@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera request queueing from a separate thread test
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Requeue the completed requests from a worker thread, as an encoder thread
+ * would, without going back through the camera manager thread.
+ */
+class QueueThreadTest : public CameraTest
+{
+protected:
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		if (buffers.begin()->second->status() == Buffer::BufferSuccess)
+			completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+
+		std::lock_guard<std::mutex> locker(mutex_);
+		pending_.push_back(request);
+		cv_.notify_one();
+	}
+
+	void worker()
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+
+		while (true) {
+			cv_.wait(locker, [&] { return stop_ || !pending_.empty(); });
+			if (pending_.empty())
+				return;
+
+			Request *request = pending_.front();
+			pending_.pop_front();
+
+			locker.unlock();
+
+			/* Requests queued after the camera stops are rejected. */
+			int ret = camera_->queueRequest(request);
+			if (ret == -EACCES)
+				delete request;
+			else if (ret)
+				errors_++;
+			else
+				queued_++;
+
+			locker.lock();
+		}
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->createBuffer(i))) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		completed_ = 0;
+		queued_ = 0;
+		errors_ = 0;
+		stop_ = false;
+
+		camera_->requestCompleted.connect(this, &QueueThreadTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		std::thread thread(&QueueThreadTest::worker, this);
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		int ret = camera_->stop();
+
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+			stop_ = true;
+			cv_.notify_one();
+		}
+
+		thread.join();
+
+		for (Request *request : pending_)
+			delete request;
+		pending_.clear();
+
+		if (ret) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (errors_) {
+			cout << errors_ << " requests failed to be queued" << endl;
+			return TestFail;
+		}
+
+		if (completed_ <= cfg.bufferCount || queued_ < cfg.bufferCount) {
+			cout << "Failed to capture with requests queued from a thread"
+			     << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Request *> pending_;
+	bool stop_;
+
+	unsigned int completed_;
+	std::atomic<unsigned int> queued_;
+	std::atomic<unsigned int> errors_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(QueueThreadTest);
@@ -38,6 +38,9 @@ protected:
 		if (camera_->queueRequest(&request) != -EACCES)
 			return TestFail;
 
+		if (camera_->queueRequests({ &request }) != -EACCES)
+			return TestFail;
+
 		if (camera_->stop() != -EACCES)
 			return TestFail;
 
@@ -141,7 +144,18 @@ protected:
 		if (camera_->release() != -EBUSY)
 			return TestFail;
 
-		if (camera_->configure(defconf_.get()) != -EACCES)
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config)
+			return TestFail;
+
+		/* Only an identical configuration is accepted in this state. */
+		config->at(0).size = { 48, 48 };
+		if (config->validate() == CameraConfiguration::Invalid ||
+		    config->at(0).size == defconf_->at(0).size)
+			return TestFail;
+
+		if (camera_->configure(config.get()) != -EACCES)
 			return TestFail;
 
 		if (camera_->allocateBuffers() != -EACCES)
@@ -155,6 +169,9 @@ protected:
 			return TestFail;
 
 		/* Test operations which should pass. */
+		if (camera_->configure(defconf_.get()))
+			return TestFail;
+
 		Request *request2 = camera_->createRequest();
 		if (!request2)
 			return TestFail;
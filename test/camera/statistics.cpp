@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera camera statistics test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class StatisticsTest : public CameraTest
+{
+protected:
+	void framesDropped(Request *request, unsigned int count)
+	{
+		signalledDrops_ += count;
+	}
+
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete) {
+			cancelledRequestsCount_++;
+			return;
+		}
+
+		completeRequestsCount_++;
+
+		const ControlList &metadata = request->metadata();
+		if (metadata.contains(controls::FramesDropped))
+			reportedDrops_ += metadata.get(controls::FramesDropped);
+
+		/* Requeue the buffer once the request is complete. */
+		Stream *stream = buffers.begin()->first;
+		Buffer *buffer = buffers.begin()->second;
+		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(buffer->index());
+
+		request = camera_->createRequest();
+		request->addBuffer(std::move(newBuffer));
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->createBuffer(i))) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		completeRequestsCount_ = 0;
+		cancelledRequestsCount_ = 0;
+		signalledDrops_ = 0;
+		reportedDrops_ = 0;
+
+		camera_->framesDropped.connect(this, &StatisticsTest::framesDropped);
+		camera_->requestCompleted.connect(this, &StatisticsTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		CameraStatistics stats = camera_->statistics();
+		if (stats.requestsCompleted || stats.requestsCancelled ||
+		    stats.streams.size() != 1 || !stats.streams.count(stream) ||
+		    stats.streams[stream].framesCompleted ||
+		    stats.streams[stream].queueDepth) {
+			cout << "Statistics not reset at start" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		stats = camera_->statistics();
+		if (stats.streams[stream].queueDepth != cfg.bufferCount ||
+		    stats.streams[stream].maxQueueDepth != cfg.bufferCount) {
+			cout << "Invalid queue depth after queueing" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		stats = camera_->statistics();
+		const StreamStatistics &streamStats = stats.streams[stream];
+
+		if (!completeRequestsCount_ ||
+		    stats.requestsCompleted != completeRequestsCount_ ||
+		    streamStats.framesCompleted != completeRequestsCount_) {
+			cout << "Invalid number of completed frames: "
+			     << stats.requestsCompleted << " requests, "
+			     << streamStats.framesCompleted << " frames, expected "
+			     << completeRequestsCount_ << endl;
+			return TestFail;
+		}
+
+		/* Completed buffers are requeued right away. */
+		if (streamStats.queueDepth != cfg.bufferCount ||
+		    streamStats.maxQueueDepth != cfg.bufferCount) {
+			cout << "Invalid queue depth while capturing" << endl;
+			return TestFail;
+		}
+
+		/* Dropped frames are reported consistently. */
+		if (signalledDrops_ != reportedDrops_ ||
+		    streamStats.framesDropped != reportedDrops_) {
+			cout << "Inconsistent dropped frames: " << signalledDrops_
+			     << " signalled, " << reportedDrops_ << " reported, "
+			     << streamStats.framesDropped << " counted" << endl;
+			return TestFail;
+		}
+
+		const CameraStatistics::Percentiles &latency = stats.latency;
+		if (!latency.p50 || latency.p50 > latency.p90 ||
+		    latency.p90 > latency.p99 || latency.p99 > latency.max) {
+			cout << "Invalid latency percentiles" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		stats = camera_->statistics();
+		if (stats.requestsCancelled != cancelledRequestsCount_ ||
+		    stats.streams[stream].queueDepth) {
+			cout << "Invalid statistics after stop" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	unsigned int completeRequestsCount_;
+	unsigned int cancelledRequestsCount_;
+	unsigned int signalledDrops_;
+	unsigned int reportedDrops_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(StatisticsTest);
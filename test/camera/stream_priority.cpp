@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera stream priority throttling test
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+
+#include "synthetic_capture_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Overload the synthetic camera with an IPA latency longer than two frame
+ * durations, and check that the camera raises its throttling level one step
+ * at a time up to the maximum, throttles low priority streams and lowers its
+ * frame rate at the maximum level, while it keeps high priority streams at the
+ * full frame rate. The capture is bounded by a number of requests, such that
+ * the result doesn't depend on the speed of the machine.
+ */
+class StreamPriorityTest : public SyntheticCaptureTest
+{
+protected:
+	static constexpr unsigned int QosMaxLevel = 4;
+
+	/*
+	 * Each level is raised after four overloaded frames, and the low
+	 * priority stream captures one frame out of 2^level, which takes 60
+	 * requests to reach the maximum level. Leave as many to throttle the
+	 * frame rate.
+	 */
+	static constexpr unsigned int CaptureRequests = 120;
+
+	void processRequest(Request *request, const Request::BufferMap &buffers) override
+	{
+		completed_++;
+
+		const ControlList &metadata = request->metadata();
+		if (metadata.contains(controls::QosLevel))
+			throttled_++;
+
+		if (metadata.contains(controls::FrameDuration)) {
+			int64_t duration = metadata.get(controls::FrameDuration);
+			minDuration_ = std::min(minDuration_, duration);
+			maxDuration_ = std::max(maxDuration_, duration);
+		}
+
+		Buffer *buffer = buffers.begin()->second;
+		if (buffer->status() == Buffer::BufferSkipped)
+			skipped_++;
+	}
+
+	bool captureDone() const override
+	{
+		return completed_ >= CaptureRequests;
+	}
+
+	void qosLevelChanged(Request *request, unsigned int level)
+	{
+		levels_.push_back(level);
+	}
+
+	int checkLevels(const std::vector<unsigned int> &expected)
+	{
+		if (levels_ != expected) {
+			cout << "Unexpected throttling level sequence:";
+			for (unsigned int level : levels_)
+				cout << " " << level;
+			cout << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init() override
+	{
+		setenv("LIBCAMERA_SYNTHETIC_IPA_LATENCY", "25000", 1);
+
+		return SyntheticCaptureTest::init();
+	}
+
+	int capture(StreamPriority priority)
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::Viewfinder });
+		if (!config || config->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Queue enough requests to cover the IPA latency, such that every
+		 * frame is captured and the overload is the only throttling cause.
+		 */
+		StreamConfiguration &cfg = config->at(0);
+		cfg.priority = priority;
+		cfg.bufferCount = 8;
+
+		throttled_ = 0;
+		skipped_ = 0;
+		completed_ = 0;
+		levels_.clear();
+		minDuration_ = std::numeric_limits<int64_t>::max();
+		maxDuration_ = 0;
+
+		camera_->qosLevelChanged.connect(this, &StreamPriorityTest::qosLevelChanged);
+
+		int ret = startCapture(config.get());
+		if (ret)
+			return ret;
+
+		/* The timeout only guards against a stalled capture. */
+		bool done = runCapture(10000);
+
+		ret = stopCapture();
+		if (ret)
+			return ret;
+
+		camera_->qosLevelChanged.disconnect(this, &StreamPriorityTest::qosLevelChanged);
+
+		if (!done) {
+			cout << "Capture timed out after " << completed_
+			     << " requests" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = capture(LowPriority);
+		if (ret)
+			return ret;
+
+		if (!throttled_ || !skipped_) {
+			cout << "Low priority stream not throttled" << endl;
+			return TestFail;
+		}
+
+		std::vector<unsigned int> levels;
+		for (unsigned int level = 1; level <= QosMaxLevel; ++level)
+			levels.push_back(level);
+
+		ret = checkLevels(levels);
+		if (ret)
+			return ret;
+
+		if (maxDuration_ <= minDuration_) {
+			cout << "Frame rate not throttled" << endl;
+			return TestFail;
+		}
+
+		/* The overload keeps the camera at the maximum level. */
+		ret = capture(HighPriority);
+		if (ret)
+			return ret;
+
+		if (!throttled_ || skipped_) {
+			cout << "High priority stream throttled" << endl;
+			return TestFail;
+		}
+
+		return checkLevels({});
+	}
+
+	unsigned int throttled_;
+	unsigned int skipped_;
+	unsigned int completed_;
+	std::vector<unsigned int> levels_;
+	int64_t minDuration_;
+	int64_t maxDuration_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(StreamPriorityTest);
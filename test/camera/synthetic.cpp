@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera synthetic camera test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcamera/control_ids.h>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+class SyntheticTest : public CameraTest
+{
+protected:
+	void requestComplete(Request *request, const Request::BufferMap &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		const ControlList &metadata = request->metadata();
+		if (!metadata.contains(controls::FrameDuration) ||
+		    metadata.get(controls::FrameDuration) != 10000)
+			invalid_++;
+
+		Buffer *buffer = buffers.begin()->second;
+		if (buffer->status() != Buffer::BufferSuccess ||
+		    buffer->bytesused() != frameSize_ || !checkPattern(buffer))
+			invalid_++;
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		/* Requests completed by Camera::stop() can't be queued again. */
+		if (camera_->queueRequest(request))
+			delete request;
+	}
+
+	/* All lines are identical and start with a pure primary color mix. */
+	bool checkPattern(Buffer *buffer)
+	{
+		Plane &plane = buffer->mem()->planes()[0];
+		const uint8_t *mem = static_cast<const uint8_t *>(plane.mem());
+		if (!mem)
+			return false;
+
+		for (unsigned int i = 0; i < 3; ++i) {
+			if (mem[i] != 0 && mem[i] != 255)
+				return false;
+		}
+
+		const uint8_t *last = mem + stride_ * (height_ - 1);
+		return !memcmp(mem, last, stride_);
+	}
+
+	int init() override
+	{
+		/* Create two synthetic cameras, at 100 fps with IPA latency. */
+		setenv("LIBCAMERA_SYNTHETIC_CAMERAS", "2", 1);
+		setenv("LIBCAMERA_SYNTHETIC_FPS", "100", 1);
+		setenv("LIBCAMERA_SYNTHETIC_IPA_LATENCY", "2000", 1);
+		setenv("LIBCAMERA_TEST_CAMERA", "Synthetic 1", 1);
+
+		int ret = CameraTest::init();
+		if (ret)
+			return ret == TestSkip ? TestFail : ret;
+
+		if (!cm_->get("Synthetic 0") || cm_->get("Synthetic 2")) {
+			cout << "Invalid number of synthetic cameras" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		stride_ = cfg.size.width * 3;
+		height_ = cfg.size.height;
+		frameSize_ = stride_ * height_;
+
+		Stream *stream = cfg.stream();
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream->createBuffer(i))) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request);
+		}
+
+		completed_ = 0;
+		invalid_ = 0;
+
+		camera_->requestCompleted.connect(this, &SyntheticTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(requests) !=
+		    static_cast<int>(requests.size())) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/* 50 frames are expected, leave margin for loaded machines. */
+		if (completed_ < 20 || completed_ > 52) {
+			cout << "Unexpected number of frames: " << completed_ << endl;
+			return TestFail;
+		}
+
+		if (invalid_) {
+			cout << invalid_ << " invalid frames" << endl;
+			return TestFail;
+		}
+
+		/* The IPA processing time is reported with a bucket resolution. */
+		CameraStatistics stats = camera_->statistics();
+		if (stats.ipaTime.p50 < 1000000) {
+			cout << "IPA latency not simulated" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	unsigned int stride_;
+	unsigned int height_;
+	unsigned int frameSize_;
+	unsigned int completed_;
+	unsigned int invalid_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(SyntheticTest);
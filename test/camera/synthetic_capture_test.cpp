@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera synthetic camera capture tests
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include "synthetic_capture_test.h"
+
+using namespace libcamera;
+using namespace std;
+
+/*
+ * Capture from the first synthetic camera at 100 frames per second. Tests
+ * set additional LIBCAMERA_SYNTHETIC_* variables before calling init() to
+ * alter the camera behaviour.
+ */
+int SyntheticCaptureTest::init()
+{
+	setenv("LIBCAMERA_SYNTHETIC_CAMERAS", "1", 1);
+	setenv("LIBCAMERA_SYNTHETIC_FPS", "100", 1);
+	setenv("LIBCAMERA_TEST_CAMERA", "Synthetic 0", 1);
+
+	int ret = CameraTest::init();
+	if (ret)
+		return ret == TestSkip ? TestFail : ret;
+
+	if (camera_->acquire()) {
+		cout << "Failed to acquire the camera" << endl;
+		CameraTest::cleanup();
+		return TestFail;
+	}
+
+	return TestPass;
+}
+
+/*
+ * Configure the camera with \a config, and queue one request per buffer of the
+ * first stream. The completed requests are passed to processRequest(), then
+ * reused, passed to prepareRequest() and queued again.
+ */
+int SyntheticCaptureTest::startCapture(CameraConfiguration *config)
+{
+	if (camera_->configure(config)) {
+		cout << "Failed to set the configuration" << endl;
+		return TestFail;
+	}
+
+	if (camera_->allocateBuffers()) {
+		cout << "Failed to allocate buffers" << endl;
+		return TestFail;
+	}
+
+	StreamConfiguration &cfg = config->at(0);
+	std::vector<Request *> requests;
+	for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+		Request *request = camera_->createRequest(i);
+		if (!request || request->addBuffer(cfg.stream()->createBuffer(i))) {
+			cout << "Failed to create request" << endl;
+			delete request;
+			for (Request *r : requests)
+				delete r;
+			return TestFail;
+		}
+
+		requests.push_back(request);
+	}
+
+	camera_->requestCompleted.connect(this, &SyntheticCaptureTest::requestComplete);
+
+	if (camera_->start()) {
+		cout << "Failed to start camera" << endl;
+		for (Request *request : requests)
+			delete request;
+		return TestFail;
+	}
+
+	int queued = camera_->queueRequests(requests);
+	if (queued != static_cast<int>(requests.size())) {
+		cout << "Failed to queue requests" << endl;
+		for (unsigned int i = std::max(queued, 0); i < requests.size(); ++i)
+			delete requests[i];
+		return TestFail;
+	}
+
+	return TestPass;
+}
+
+/*
+ * Process events until captureDone() returns true, or for \a timeout
+ * milliseconds at most. Return true if the capture is done.
+ */
+bool SyntheticCaptureTest::runCapture(unsigned int timeout)
+{
+	EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+	Timer timer;
+	timer.start(timeout);
+	while (!captureDone() && timer.isRunning())
+		dispatcher->processEvents();
+
+	return captureDone();
+}
+
+int SyntheticCaptureTest::stopCapture()
+{
+	if (camera_->stop()) {
+		cout << "Failed to stop camera" << endl;
+		return TestFail;
+	}
+
+	camera_->requestCompleted.disconnect(this, &SyntheticCaptureTest::requestComplete);
+
+	if (camera_->freeBuffers()) {
+		cout << "Failed to free buffers" << endl;
+		return TestFail;
+	}
+
+	return TestPass;
+}
+
+void SyntheticCaptureTest::requestComplete(Request *request,
+					   const Request::BufferMap &buffers)
+{
+	/* Requests cancelled when stopping the camera are ignored. */
+	if (request->status() != Request::RequestComplete)
+		return;
+
+	processRequest(request, buffers);
+
+	request->reuse(Request::ReuseBuffers);
+	prepareRequest(request);
+
+	/* Requests completed by Camera::stop() can't be queued again. */
+	if (camera_->queueRequest(request))
+		delete request;
+}
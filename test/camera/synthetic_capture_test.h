@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * synthetic_capture_test.h - libcamera synthetic camera capture test base class
+ */
+#ifndef __LIBCAMERA_SYNTHETIC_CAPTURE_TEST_H__
+#define __LIBCAMERA_SYNTHETIC_CAPTURE_TEST_H__
+
+#include "camera_test.h"
+
+class SyntheticCaptureTest : public CameraTest
+{
+protected:
+	int init();
+
+	int startCapture(CameraConfiguration *config);
+	bool runCapture(unsigned int timeout);
+	int stopCapture();
+
+	virtual void processRequest(Request *request,
+				    const Request::BufferMap &buffers) = 0;
+	virtual void prepareRequest(Request *request) {}
+	virtual bool captureDone() const { return false; }
+
+private:
+	void requestComplete(Request *request, const Request::BufferMap &buffers);
+};
+
+#endif /* __LIBCAMERA_SYNTHETIC_CAPTURE_TEST_H__ */
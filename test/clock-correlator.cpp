@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * clock-correlator.cpp - Clock correlator tests
+ */
+
+#include <iostream>
+#include <time.h>
+
+#include "clock_correlator.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+uint64_t readClock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t distance(uint64_t a, uint64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+} /* namespace */
+
+class ClockCorrelatorTest : public Test
+{
+protected:
+	int run()
+	{
+		/* Allow for scheduling delays between the clock readings. */
+		constexpr uint64_t tolerance = 10000000;
+
+		ClockCorrelator correlator;
+		uint64_t result;
+
+		uint64_t monotonic = readClock(CLOCK_MONOTONIC);
+		if (!correlator.convert(monotonic, Buffer::ClockMonotonic,
+					Buffer::ClockMonotonic, &result) ||
+		    result != monotonic) {
+			cout << "Identity conversion failed" << endl;
+			return TestFail;
+		}
+
+		if (correlator.convert(monotonic, Buffer::ClockUnknown,
+				       Buffer::ClockBoottime, &result)) {
+			cout << "Unknown clock converted" << endl;
+			return TestFail;
+		}
+
+		uint64_t boottime = readClock(CLOCK_BOOTTIME);
+		if (!correlator.convert(monotonic, Buffer::ClockMonotonic,
+					Buffer::ClockBoottime, &result) ||
+		    distance(result, boottime) > tolerance) {
+			cout << "Boottime conversion failed" << endl;
+			return TestFail;
+		}
+
+		uint64_t realtime = readClock(CLOCK_REALTIME);
+		uint64_t back;
+		if (!correlator.convert(realtime, Buffer::ClockRealtime,
+					Buffer::ClockMonotonic, &result) ||
+		    distance(result, readClock(CLOCK_MONOTONIC)) > tolerance ||
+		    !correlator.convert(result, Buffer::ClockMonotonic,
+					Buffer::ClockRealtime, &back) ||
+		    back != realtime) {
+			cout << "Realtime conversion failed" << endl;
+			return TestFail;
+		}
+
+		/* Timestamps past the correlation period are correlated again. */
+		ClockCorrelator shortPeriod(1000);
+		shortPeriod.convert(monotonic, Buffer::ClockMonotonic,
+				    Buffer::ClockBoottime, &result);
+
+		monotonic = readClock(CLOCK_MONOTONIC);
+		boottime = readClock(CLOCK_BOOTTIME);
+		if (!shortPeriod.convert(monotonic, Buffer::ClockMonotonic,
+					 Buffer::ClockBoottime, &result) ||
+		    distance(result, boottime) > tolerance) {
+			cout << "Correlation not refreshed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ClockCorrelatorTest)
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration-cache.cpp - Camera configuration cache tests
+ */
+
+#include <iostream>
+#include <memory>
+
+#include <libcamera/camera.h>
+
+#include "configuration_cache.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class TestConfiguration : public CameraConfiguration
+{
+public:
+	TestConfiguration()
+		: validations_(0), cookie_(0)
+	{
+	}
+
+	Status validate() override
+	{
+		validations_++;
+		cookie_ = config_.size();
+
+		if (config_.front().bufferCount != 4) {
+			config_.front().bufferCount = 4;
+			return Adjusted;
+		}
+
+		return Valid;
+	}
+
+	unsigned int validations_;
+	unsigned int cookie_;
+	std::shared_ptr<Camera> camera_;
+};
+
+} /* namespace */
+
+class ConfigurationCacheTest : public Test
+{
+protected:
+	int run()
+	{
+		ConfigurationCache cache(2);
+
+		TestConfiguration config;
+		StreamConfiguration cfg;
+		cfg.size = { 640, 480 };
+		cfg.bufferCount = 2;
+		config.addConfiguration(cfg);
+
+		const std::string key = ConfigurationCache::key(config);
+		CameraConfiguration::Status status;
+
+		if (cache.lookup(key, &config, &status)) {
+			cout << "Unexpected cache hit" << endl;
+			return TestFail;
+		}
+
+		status = config.validate();
+		cache.store(key, std::unique_ptr<CameraConfiguration>(new TestConfiguration(config)),
+			    status);
+
+		/* A configuration with the same parameters hits the cache. */
+		TestConfiguration other;
+		other.addConfiguration(cfg);
+		if (ConfigurationCache::key(other) != key ||
+		    !cache.lookup(key, &other, &status)) {
+			cout << "Cache miss for identical configuration" << endl;
+			return TestFail;
+		}
+
+		if (status != CameraConfiguration::Adjusted ||
+		    other.at(0).bufferCount != 4 || other.cookie_ != 1) {
+			cout << "Cached configuration mismatch" << endl;
+			return TestFail;
+		}
+
+		/* Changing any parameter changes the key. */
+		other.setQueueProfile(CameraConfiguration::LowLatency);
+		if (ConfigurationCache::key(other) == key) {
+			cout << "Queue profile not part of the key" << endl;
+			return TestFail;
+		}
+
+		other.setQueueProfile(CameraConfiguration::Balanced);
+		other.at(0).size = { 320, 240 };
+		if (ConfigurationCache::key(other) == key) {
+			cout << "Stream size not part of the key" << endl;
+			return TestFail;
+		}
+
+		/* The least recently used entries are evicted. */
+		for (unsigned int i = 0; i < 2; ++i) {
+			other.at(0).bufferCount = 10 + i;
+			std::string otherKey = ConfigurationCache::key(other);
+			cache.store(otherKey,
+				    std::unique_ptr<CameraConfiguration>(new TestConfiguration(other)),
+				    CameraConfiguration::Valid);
+		}
+
+		if (cache.lookup(key, &other, &status)) {
+			cout << "Least recently used entry not evicted" << endl;
+			return TestFail;
+		}
+
+		cache.clear();
+		if (cache.lookup(ConfigurationCache::key(other), &other, &status)) {
+			cout << "Cache not cleared" << endl;
+			return TestFail;
+		}
+
+		/* Validating through the cache only validates on a miss. */
+		TestConfiguration first;
+		first.addConfiguration(cfg);
+		status = cache.validate(&first, &TestConfiguration::validate,
+					&TestConfiguration::camera_);
+		if (status != CameraConfiguration::Adjusted || first.validations_ != 1) {
+			cout << "Configuration not validated on cache miss" << endl;
+			return TestFail;
+		}
+
+		/* The cached copy overwrites the validation count on a hit. */
+		TestConfiguration second;
+		second.addConfiguration(cfg);
+		second.validations_ = 10;
+		status = cache.validate(&second, &TestConfiguration::validate,
+					&TestConfiguration::camera_);
+		if (status != CameraConfiguration::Adjusted ||
+		    second.validations_ != 1 || second.at(0).bufferCount != 4) {
+			cout << "Cached validation result not used" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ConfigurationCacheTest)
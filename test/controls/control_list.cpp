@@ -154,6 +154,84 @@ protected:
 			return TestFail;
 		}
 
+		/* Clear the list and verify that it can be reused. */
+		list.clear();
+
+		if (!list.empty() || list.contains(controls::Brightness) ||
+		    list.begin() != list.end()) {
+			cout << "List should be empty after clear" << endl;
+			return TestFail;
+		}
+
+		list.set(controls::Contrast, 30);
+
+		if (list.size() != 1 || list.get(controls::Contrast) != 30) {
+			cout << "Failed to reuse cleared list" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Copy the list, modify the copy and verify that the original
+		 * isn't affected.
+		 */
+		ControlList copy = list;
+		copy.set(controls::Contrast, 40);
+		copy.set(controls::Brightness, 50);
+
+		if (list.size() != 1 || list.get(controls::Contrast) != 30 ||
+		    copy.size() != 2 || copy.get(controls::Contrast) != 40) {
+			cout << "Modifying a copy affected the original list" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Compute the delta between the lists, and verify it contains
+		 * the changed and added controls only.
+		 */
+		ControlList changes = copy.delta(list);
+		if (changes.size() != 2 ||
+		    changes.get(controls::Contrast) != 40 ||
+		    changes.get(controls::Brightness) != 50) {
+			cout << "Failed to compute delta" << endl;
+			return TestFail;
+		}
+
+		list.merge(changes);
+		if (list.size() != 2 || list.get(controls::Contrast) != 40 ||
+		    list.get(controls::Brightness) != 50) {
+			cout << "Failed to merge controls" << endl;
+			return TestFail;
+		}
+
+		if (!copy.delta(list).empty() || !ControlList(list).delta(list).empty()) {
+			cout << "Identical lists should have an empty delta" << endl;
+			return TestFail;
+		}
+
+		/* Swap the lists and verify that their content is exchanged. */
+		ControlList other(controls::controls);
+		other.swap(list);
+
+		if (!list.empty() || other.size() != 2 ||
+		    other.get(controls::Contrast) != 40) {
+			cout << "Failed to swap lists" << endl;
+			return TestFail;
+		}
+
+		/* Array controls can be set through their typed control. */
+		ControlList metadata(controls::controls);
+		metadata.set(controls::LumaHistogram,
+			     std::vector<uint32_t>{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+						    11, 12, 13, 14, 15, 16 });
+
+		const ControlValue &histogram = metadata.get(controls::LUMA_HISTOGRAM);
+		if (!histogram.isArray() || histogram.numElements() != 16 ||
+		    histogram.type() != ControlTypeUnsigned32 ||
+		    histogram.array<uint32_t>()[15] != 16) {
+			cout << "Failed to set array control" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
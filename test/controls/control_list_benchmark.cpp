@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_list_benchmark.cpp - ControlList benchmark
+ */
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class ControlListBenchmark : public Benchmark
+{
+public:
+	ControlListBenchmark()
+		: Benchmark("control_list")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		ControlList list(controls::controls);
+		int32_t sum = 0;
+
+		measure("set", [&]() { list.set(controls::Brightness, 64); });
+
+		measure("get", [&]() { sum += list.get(controls::Brightness); });
+
+		measure("contains", [&]() { sum += list.contains(controls::Contrast); });
+
+		/* A list of the size of the per-frame request controls. */
+		list.set(controls::AeEnable, true);
+		list.set(controls::Contrast, 128);
+		list.set(controls::Saturation, 128);
+		list.set(controls::SensorExposure, 1000);
+		list.set(controls::SensorAnalogueGain, 16);
+
+		measure("copy", [&]() {
+			ControlList copy(list);
+			sum += copy.size();
+		});
+
+		ControlList merged(controls::controls);
+		measure("merge", [&]() { merged.merge(list); });
+
+		measure("delta", [&]() {
+			ControlList delta = list.delta(merged);
+			sum += delta.size();
+		});
+
+		return sum ? TestPass : TestFail;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(ControlListBenchmark)
@@ -6,8 +6,10 @@
  */
 
 #include <iostream>
+#include <vector>
 
 #include <libcamera/controls.h>
+#include <libcamera/geometry.h>
 
 #include "test.h"
 
@@ -62,6 +64,89 @@ protected:
 			return TestFail;
 		}
 
+		/* Test array values. */
+		std::vector<uint16_t> curve = { 0, 1024, 2048, 4095 };
+		ControlValue array(curve);
+		if (!array.isArray() || array.type() != ControlTypeUnsigned16 ||
+		    array.numElements() != 4 || array.dataSize() != 8 ||
+		    array.array<uint16_t>()[3] != 4095) {
+			cerr << "Failed to store array" << endl;
+			return TestFail;
+		}
+
+		cout << "Array: " << array.toString() << endl;
+
+		if (array != ControlValue(curve) ||
+		    array == ControlValue(std::vector<uint16_t>{ 1, 2 })) {
+			cerr << "Failed to compare arrays" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> table(256, 0x42);
+		const uint8_t *tableData = table.data();
+		ControlValue payload(std::move(table));
+		if (payload.data() != tableData || payload.numElements() != 256) {
+			cerr << "Byte payload copied on move" << endl;
+			return TestFail;
+		}
+
+		ControlValue zeroed(ControlTypeInteger32, 3);
+		if (zeroed.numElements() != 3 || zeroed.array<int32_t>()[2] != 0) {
+			cerr << "Failed to create zeroed array" << endl;
+			return TestFail;
+		}
+
+		zeroed.set<int32_t>(5);
+		if (zeroed.isArray() || zeroed.get<int32_t>() != 5) {
+			cerr << "Failed to replace array with integer" << endl;
+			return TestFail;
+		}
+
+		/* Test floating point and rectangle values. */
+		ControlValue gain(1.5f);
+		if (gain.type() != ControlTypeFloat || gain.get<float>() != 1.5f) {
+			cerr << "Failed to get Float" << endl;
+			return TestFail;
+		}
+
+		Rectangle crop = { 16, 8, 640, 480 };
+		ControlValue rect(crop);
+		if (rect.type() != ControlTypeRectangle ||
+		    rect.get<Rectangle>() != crop) {
+			cerr << "Failed to get Rectangle" << endl;
+			return TestFail;
+		}
+
+		cout << "Rectangle: " << rect.toString() << endl;
+
+		/* Small arrays are stored inline and copied. */
+		std::vector<float> ccm = { 1.0f, 0.0f, 0.0f,
+					   0.0f, 1.0f, 0.0f,
+					   0.0f, 0.0f, 1.0f };
+		ControlValue matrix(ccm);
+		ControlValue matrixCopy(matrix);
+		if (matrixCopy.data() == matrix.data() ||
+		    matrixCopy.array<float>()[8] != 1.0f) {
+			cerr << "Small array not stored inline" << endl;
+			return TestFail;
+		}
+
+		/* Large arrays are shared between copies until written. */
+		const ControlValue &original = payload;
+		const ControlValue shared(payload);
+		if (shared.data() != original.data()) {
+			cerr << "Large array not shared on copy" << endl;
+			return TestFail;
+		}
+
+		ControlValue written(payload);
+		written.array<uint8_t>()[0] = 0x00;
+		if (original.array<uint8_t>()[0] != 0x42 ||
+		    written.array<uint8_t>()[0] != 0x00) {
+			cerr << "Shared array modified through a copy" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed-controls.cpp - Delayed sensor controls tests
+ */
+
+#include <iostream>
+
+#include <linux/v4l2-controls.h>
+
+#include "camera_sensor.h"
+#include "delayed_controls.h"
+#include "device_enumerator.h"
+#include "media_device.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DelayedControlsTest : public Test
+{
+protected:
+	int init()
+	{
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_) {
+			cerr << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		DeviceMatch dm("vimc");
+		media_ = enumerator_->search(dm);
+		if (!media_) {
+			cerr << "Unable to find \'vimc\' media device node" << endl;
+			return TestSkip;
+		}
+
+		MediaEntity *entity = media_->getEntityByName("Sensor A");
+		if (!entity) {
+			cerr << "Unable to find media entity 'Sensor A'" << endl;
+			return TestFail;
+		}
+
+		sensor_ = new CameraSensor(entity);
+		if (sensor_->init() < 0) {
+			cerr << "Unable to initialise camera sensor" << endl;
+			return TestFail;
+		}
+
+		const ControlInfoMap &controls = sensor_->controls();
+		if (controls.find(V4L2_CID_BRIGHTNESS) == controls.end() ||
+		    controls.find(V4L2_CID_CONTRAST) == controls.end()) {
+			cerr << "Sensor doesn't support brightness and contrast" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int push(int32_t brightness, int32_t contrast)
+	{
+		ControlList ctrls(sensor_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, brightness);
+		ctrls.set(V4L2_CID_CONTRAST, contrast);
+
+		return delayed_->push(ctrls) ? 0 : -EINVAL;
+	}
+
+	int check(const ControlList &ctrls, int32_t brightness, int32_t contrast)
+	{
+		int32_t b = ctrls.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+		int32_t c = ctrls.get(V4L2_CID_CONTRAST).get<int32_t>();
+
+		if (b != brightness || c != contrast) {
+			cerr << "Expected brightness " << brightness
+			     << " and contrast " << contrast << ", got "
+			     << b << " and " << c << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int checkSensor(int32_t brightness, int32_t contrast)
+	{
+		ControlList ctrls(sensor_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, 0);
+		ctrls.set(V4L2_CID_CONTRAST, 0);
+
+		if (sensor_->getControls(&ctrls)) {
+			cerr << "Failed to read sensor controls" << endl;
+			return TestFail;
+		}
+
+		return check(ctrls, brightness, contrast);
+	}
+
+	int run()
+	{
+		/* Contrast takes one frame longer than brightness to apply. */
+		delayed_ = new DelayedControls(sensor_, { { V4L2_CID_BRIGHTNESS, 1 },
+							  { V4L2_CID_CONTRAST, 2 } });
+
+		ControlList initial(sensor_->controls());
+		initial.set(V4L2_CID_BRIGHTNESS, 100);
+		initial.set(V4L2_CID_CONTRAST, 100);
+		if (sensor_->setControls(&initial) || delayed_->reset()) {
+			cerr << "Failed to reset controls" << endl;
+			return TestFail;
+		}
+
+		/* Values are queued for frames 3, 4 and 5. */
+		for (int32_t i = 0; i < 3; ++i) {
+			if (push(110 + i, 120 + i)) {
+				cerr << "Failed to push controls " << i << endl;
+				return TestFail;
+			}
+		}
+
+		/* Each control is written its delay ahead of the frame. */
+		delayed_->applyControls(0);
+		if (checkSensor(100, 100) != TestPass)
+			return TestFail;
+
+		delayed_->applyControls(1);
+		if (checkSensor(100, 120) != TestPass)
+			return TestFail;
+
+		delayed_->applyControls(2);
+		if (checkSensor(110, 121) != TestPass)
+			return TestFail;
+
+		if (check(delayed_->get(2), 100, 100) != TestPass ||
+		    check(delayed_->get(3), 110, 120) != TestPass)
+			return TestFail;
+
+		/*
+		 * Skip frames 3 and 4, the writes they would have triggered
+		 * are missed and the frames report the values in effect.
+		 */
+		delayed_->applyControls(5);
+		if (checkSensor(112, 122) != TestPass)
+			return TestFail;
+
+		if (check(delayed_->get(4), 110, 121) != TestPass ||
+		    check(delayed_->get(5), 110, 121) != TestPass ||
+		    check(delayed_->get(6), 112, 121) != TestPass ||
+		    check(delayed_->get(7), 112, 122) != TestPass)
+			return TestFail;
+
+		/*
+		 * Override frames 8 and 9, the earliest frames whose contrast
+		 * can still be written on time, and the brightness of frame 10
+		 * once it has been queued. The overrides don't leak to the
+		 * following frames.
+		 */
+		ControlList frame(sensor_->controls());
+		frame.set(V4L2_CID_BRIGHTNESS, 130);
+		frame.set(V4L2_CID_CONTRAST, 140);
+		uint32_t sequence = 0;
+		if (!delayed_->pushFrame(frame, &sequence) || sequence != 8) {
+			cerr << "Failed to override frame 8" << endl;
+			return TestFail;
+		}
+
+		if (push(113, 123)) {
+			cerr << "Failed to push controls" << endl;
+			return TestFail;
+		}
+
+		ControlList brightness(sensor_->controls());
+		brightness.set(V4L2_CID_BRIGHTNESS, 131);
+		sequence++;
+		if (!delayed_->pushFrame(brightness, &sequence) || sequence != 9) {
+			cerr << "Failed to override frame 9" << endl;
+			return TestFail;
+		}
+
+		delayed_->applyControls(6);
+		if (checkSensor(112, 140) != TestPass)
+			return TestFail;
+
+		delayed_->applyControls(7);
+		if (checkSensor(130, 123) != TestPass)
+			return TestFail;
+
+		delayed_->applyControls(8);
+		if (checkSensor(131, 123) != TestPass)
+			return TestFail;
+
+		brightness.set(V4L2_CID_BRIGHTNESS, 150);
+		sequence = 0;
+		if (!delayed_->pushFrame(brightness, &sequence) || sequence != 10) {
+			cerr << "Failed to override frame 10" << endl;
+			return TestFail;
+		}
+
+		if (check(delayed_->get(8), 130, 140) != TestPass ||
+		    check(delayed_->get(9), 131, 123) != TestPass ||
+		    check(delayed_->get(10), 150, 123) != TestPass ||
+		    check(delayed_->get(11), 113, 123) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		delete delayed_;
+		delete sensor_;
+	}
+
+private:
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::shared_ptr<MediaDevice> media_;
+	CameraSensor *sensor_ = nullptr;
+	DelayedControls *delayed_ = nullptr;
+};
+
+TEST_REGISTER(DelayedControlsTest)
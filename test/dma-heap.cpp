@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dma-heap.cpp - dma-heap allocator tests
+ */
+
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dma_heap.h"
+#include "test.h"
+#include "v4l2_videodevice.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DmaHeapTest : public Test
+{
+protected:
+	int run()
+	{
+		DmaHeapAllocator allocator;
+		if (!allocator.isValid()) {
+			cout << "No dma-heap available" << endl;
+			return TestSkip;
+		}
+
+		V4L2DeviceFormat format = {};
+		format.size = { 640, 480 };
+		format.planesCount = 2;
+		format.planes[0].size = 640 * 480;
+		format.planes[1].size = 640 * 480 / 2;
+
+		int ret = allocator.allocate(format, 4);
+		if (ret != 0 || allocator.count() != 4) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		ret = allocator.allocate(format, 2);
+		if (ret != 4 || allocator.count() != 6) {
+			cout << "Failed to grow the pool" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < allocator.count(); ++i) {
+			const std::array<int, 3> &fds = allocator.dmabufs(i);
+			if (fds[0] < 0 || fds[1] < 0 || fds[2] != -1) {
+				cout << "Invalid dmabufs for buffer " << i << endl;
+				return TestFail;
+			}
+
+			off_t size = lseek(fds[1], 0, SEEK_END);
+			if (size < 640 * 480 / 2) {
+				cout << "Invalid plane size " << size << endl;
+				return TestFail;
+			}
+		}
+
+		allocator.release();
+		if (allocator.count()) {
+			cout << "Failed to release buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(DmaHeapTest)
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dmabuf-importer.cpp - Dmabuf importer tests
+ */
+
+#include <errno.h>
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/dmabuf_importer.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DmabufImporterTest : public Test
+{
+protected:
+	int run()
+	{
+		DmabufImporter importer;
+		DmabufImage image;
+
+		if (importer.configure(V4L2_PIX_FMT_MJPEG, { 640, 480 }) != -EINVAL) {
+			cout << "Compressed format accepted" << endl;
+			return TestFail;
+		}
+
+		if (importer.describe({ 5, -1, -1 }, &image) != -EINVAL) {
+			cout << "Unconfigured importer described an image" << endl;
+			return TestFail;
+		}
+
+		/* V4L2 and DRM name RGB formats in opposite orders. */
+		if (importer.configure(V4L2_PIX_FMT_RGB24, { 640, 480 }) ||
+		    importer.drmFormat() != 0x34324742) {
+			cout << "Invalid RGB24 DRM format" << endl;
+			return TestFail;
+		}
+
+		/* Contiguous planes share the dmabuf of the first plane. */
+		if (importer.configure(V4L2_PIX_FMT_NV12, { 640, 480 }) ||
+		    importer.describe({ 5, -1, -1 }, &image)) {
+			cout << "Failed to describe NV12 image" << endl;
+			return TestFail;
+		}
+
+		if (image.drmFormat != 0x3231564e || image.modifier != 0 ||
+		    image.numPlanes != 2 ||
+		    image.planes[0].fd != 5 || image.planes[0].offset != 0 ||
+		    image.planes[0].pitch != 640 ||
+		    image.planes[1].fd != 5 || image.planes[1].offset != 640 * 480 ||
+		    image.planes[1].pitch != 640 ||
+		    image.planes[1].size != 640 * 240) {
+			cout << "Invalid NV12 image layout" << endl;
+			return TestFail;
+		}
+
+		/* The EGL attributes include 3 attributes per plane. */
+		std::vector<int32_t> attribs = image.eglAttributes();
+		if (attribs.size() != 6 + 2 * 6 + 1 || attribs.back() != 0x3038 ||
+		    attribs[5] != 0x3231564e || attribs[7] != 5 ||
+		    attribs[15] != 640 * 480) {
+			cout << "Invalid EGL attributes" << endl;
+			return TestFail;
+		}
+
+		/* Multi-planar formats use one dmabuf per plane. */
+		if (importer.configure(V4L2_PIX_FMT_YUV420M, { 64, 48 }) ||
+		    importer.describe({ 5, 6, 7 }, &image)) {
+			cout << "Failed to describe YUV420M image" << endl;
+			return TestFail;
+		}
+
+		if (image.numPlanes != 3 ||
+		    image.planes[1].fd != 6 || image.planes[1].offset != 0 ||
+		    image.planes[2].fd != 7 || image.planes[2].pitch != 32 ||
+		    image.planes[2].size != 32 * 24) {
+			cout << "Invalid YUV420M image layout" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(DmabufImporterTest)
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * embedded-data.cpp - Sensor embedded data parser tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <vector>
+
+#include "embedded_data.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EmbeddedDataTest : public Test
+{
+protected:
+	int run()
+	{
+		if (EmbeddedDataParser::create("unknown 1-0010")) {
+			cout << "Parser created for an unknown sensor" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<EmbeddedDataParser> parser =
+			EmbeddedDataParser::create("imx219 10-0010");
+		if (!parser) {
+			cout << "Failed to create imx219 parser" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Gain 0x45 at 0x0157, exposure 0x0123 at 0x015a and frame
+		 * length 0x0678 at 0x0160.
+		 */
+		const std::vector<uint8_t> registers = {
+			0x0a,
+			0xaa, 0x01, 0xa5, 0x57, 0x5a, 0x45,
+			0x55, 0x00, 0x55, 0x00,
+			0x5a, 0x01, 0x5a, 0x23,
+			0xa5, 0x60, 0x5a, 0x06, 0x5a, 0x78,
+			0x07, 0x00,
+		};
+
+		/* Pack in RAW10, with an LSB byte after every four bytes. */
+		std::vector<uint8_t> data;
+		for (unsigned int i = 0; i < registers.size(); ++i) {
+			data.push_back(registers[i]);
+			if (i % 4 == 3)
+				data.push_back(0xff);
+		}
+
+		SensorMetadata metadata{};
+		int ret = parser->parse(data.data(), data.size(), &metadata);
+		if (ret) {
+			cout << "Failed to parse embedded data" << endl;
+			return TestFail;
+		}
+
+		if (metadata.exposure != 0x0123 || metadata.gain != 0x45 ||
+		    metadata.frameLength != 0x0678) {
+			cout << "Invalid sensor metadata " << metadata.exposure
+			     << " " << metadata.gain << " "
+			     << metadata.frameLength << endl;
+			return TestFail;
+		}
+
+		/* Invalid format code. */
+		data[0] = 0x00;
+		if (parser->parse(data.data(), data.size(), &metadata) != -EINVAL) {
+			cout << "Invalid format code not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(EmbeddedDataTest)
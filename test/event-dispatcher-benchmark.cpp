@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event-dispatcher-benchmark.cpp - Event dispatcher scalability benchmark
+ */
+
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/object.h>
+#include <libcamera/timer.h>
+
+#include "benchmark.h"
+#include "message.h"
+#include "thread.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class MessageReceiver : public Object
+{
+protected:
+	void message(Message *msg) override
+	{
+	}
+};
+
+/*
+ * Measure the cost of processing a single event while the number of idle
+ * event sources grows, as with one set of devices per camera. Costs that grow
+ * with the number of sources point to linear scans in the event dispatcher
+ * and the thread message queue. The dispatcher under test can be selected
+ * with the LIBCAMERA_EVENT_DISPATCHER environment variable.
+ */
+class EventDispatcherBenchmark : public Benchmark
+{
+public:
+	EventDispatcherBenchmark()
+		: Benchmark("event-dispatcher")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		static const unsigned int counts[] = { 1, 4, 16, 64 };
+
+		for (unsigned int count : counts) {
+			int ret = measureSources(count);
+			if (ret)
+				return ret;
+		}
+
+		return TestPass;
+	}
+
+private:
+	void readReady(EventNotifier *notifier)
+	{
+		char data;
+		if (read(notifier->fd(), &data, 1) == 1)
+			reads_++;
+	}
+
+	int measureSources(unsigned int count)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		const std::string suffix = "-" + std::to_string(count);
+
+		std::vector<int> fds;
+		std::vector<std::unique_ptr<EventNotifier>> notifiers;
+		std::vector<std::unique_ptr<Timer>> timers;
+		std::vector<std::unique_ptr<MessageReceiver>> receivers;
+		int ret = TestPass;
+
+		/* Create the idle sources, only the first pipe will be written. */
+		for (unsigned int i = 0; i < count; ++i) {
+			int pipefd[2];
+			if (pipe(pipefd)) {
+				ret = TestFail;
+				break;
+			}
+
+			fds.push_back(pipefd[0]);
+			fds.push_back(pipefd[1]);
+
+			notifiers.emplace_back(new EventNotifier(pipefd[0], EventNotifier::Read));
+			notifiers.back()->activated.connect(this, &EventDispatcherBenchmark::readReady);
+
+			timers.emplace_back(new Timer());
+			timers.back()->start(3600000 + i);
+
+			receivers.emplace_back(new MessageReceiver());
+		}
+
+		if (ret == TestPass) {
+			int fd = fds[1];
+			reads_ = 0;
+
+			measure("notifier" + suffix, [&]() {
+				unsigned int reads = reads_;
+				if (write(fd, "x", 1) != 1)
+					return;
+				while (reads_ == reads)
+					dispatcher->processEvents();
+			});
+
+			Timer timer;
+			measure("timer" + suffix, [&]() {
+				timer.start(0);
+				while (timer.isRunning())
+					dispatcher->processEvents();
+			});
+
+			/* Post one message per receiver, the cost grows linearly. */
+			Thread *thread = Thread::current();
+			measure("message" + suffix, [&]() {
+				for (std::unique_ptr<MessageReceiver> &receiver : receivers)
+					receiver->postMessage(utils::make_unique<Message>(Message::None));
+				thread->dispatchMessages();
+			});
+
+			if (!reads_)
+				ret = TestFail;
+		}
+
+		notifiers.clear();
+		timers.clear();
+
+		for (int fd : fds)
+			close(fd);
+
+		return ret;
+	}
+
+	unsigned int reads_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(EventDispatcherBenchmark)
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event-dispatcher-epoll.cpp - Epoll-based event dispatcher test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "event_dispatcher_epoll.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EventDispatcherEpollTest : public Test
+{
+protected:
+	int init()
+	{
+		/* Select the epoll dispatcher before the first use. */
+		setenv("LIBCAMERA_EVENT_DISPATCHER", "epoll", 1);
+
+		dispatcher_ = Thread::current()->eventDispatcher();
+		if (!dynamic_cast<EventDispatcherEpoll *>(dispatcher_)) {
+			cout << "Epoll dispatcher not selected" << endl;
+			return TestFail;
+		}
+
+		if (pipe(pipeA_) || pipe(pipeB_) ||
+		    socketpair(AF_UNIX, SOCK_STREAM, 0, sockets_)) {
+			cout << "Failed to create file descriptors" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* Read and write notifiers for the same fd. */
+		EventNotifier readNotifier(sockets_[0], EventNotifier::Read);
+		EventNotifier writeNotifier(sockets_[0], EventNotifier::Write);
+		readNotifier.activated.connect(this, &EventDispatcherEpollTest::readReady);
+		writeNotifier.activated.connect(this, &EventDispatcherEpollTest::writeReady);
+
+		reads_ = 0;
+		writes_ = 0;
+
+		if (write(sockets_[1], "x", 1) != 1) {
+			cout << "Socket write failed" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (reads_ != 1 || writes_ != 1) {
+			cout << "Notifiers for the same fd failed: " << reads_
+			     << " reads, " << writes_ << " writes" << endl;
+			return TestFail;
+		}
+
+		/* The write notifier disabled itself, the read one stays. */
+		if (write(sockets_[1], "x", 1) != 1) {
+			cout << "Socket write failed" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (reads_ != 2 || writes_ != 1) {
+			cout << "Notifier disabling in handler failed" << endl;
+			return TestFail;
+		}
+
+		readNotifier.setEnabled(false);
+
+		/*
+		 * Disable a notifier whose event is pending from the handler
+		 * of another notifier. Whichever is dispatched first must
+		 * prevent the other from being dispatched.
+		 */
+		notifierA_ = new EventNotifier(pipeA_[0], EventNotifier::Read);
+		notifierB_ = new EventNotifier(pipeB_[0], EventNotifier::Read);
+		notifierA_->activated.connect(this, &EventDispatcherEpollTest::pipeReady);
+		notifierB_->activated.connect(this, &EventDispatcherEpollTest::pipeReady);
+
+		pipeNotifications_ = 0;
+
+		if (write(pipeA_[1], "x", 1) != 1 || write(pipeB_[1], "x", 1) != 1) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		delete notifierA_;
+		delete notifierB_;
+
+		if (pipeNotifications_ != 1) {
+			cout << "Pending event of disabled notifier dispatched"
+			     << endl;
+			return TestFail;
+		}
+
+		/* Timers must not fire before their deadline. */
+		Timer timer;
+		auto start = std::chrono::steady_clock::now();
+		timer.start(50);
+		while (timer.isRunning())
+			dispatcher_->processEvents();
+		auto duration = std::chrono::steady_clock::now() - start;
+
+		if (duration < std::chrono::milliseconds(50) ||
+		    duration > std::chrono::milliseconds(100)) {
+			cout << "Timer fired after "
+			     << std::chrono::duration_cast<std::chrono::microseconds>(duration).count()
+			     << "us" << endl;
+			return TestFail;
+		}
+
+		/* Event processing interruption. */
+		timer.start(1000);
+		dispatcher_->interrupt();
+		dispatcher_->processEvents();
+
+		if (!timer.isRunning()) {
+			cout << "Event processing interruption failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		close(pipeA_[0]);
+		close(pipeA_[1]);
+		close(pipeB_[0]);
+		close(pipeB_[1]);
+		close(sockets_[0]);
+		close(sockets_[1]);
+	}
+
+private:
+	void processEvents(unsigned int timeout)
+	{
+		Timer timer;
+		timer.start(timeout);
+		while (timer.isRunning())
+			dispatcher_->processEvents();
+	}
+
+	void readReady(EventNotifier *notifier)
+	{
+		char data;
+		if (read(notifier->fd(), &data, 1) == 1)
+			reads_++;
+	}
+
+	void writeReady(EventNotifier *notifier)
+	{
+		writes_++;
+		notifier->setEnabled(false);
+	}
+
+	void pipeReady(EventNotifier *notifier)
+	{
+		char data;
+		if (read(notifier->fd(), &data, 1) != 1)
+			return;
+
+		pipeNotifications_++;
+
+		notifierA_->setEnabled(false);
+		notifierB_->setEnabled(false);
+	}
+
+	EventDispatcher *dispatcher_;
+
+	int pipeA_[2];
+	int pipeB_[2];
+	int sockets_[2];
+
+	unsigned int reads_;
+	unsigned int writes_;
+
+	EventNotifier *notifierA_;
+	EventNotifier *notifierB_;
+	unsigned int pipeNotifications_;
+};
+
+TEST_REGISTER(EventDispatcherEpollTest)
@@ -106,6 +106,38 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that a disabled notifier doesn't wake up the dispatcher
+		 * when its file descriptor hangs up.
+		 */
+		int hupfd[2];
+		if (pipe(hupfd)) {
+			cout << "Pipe creation failed" << endl;
+			return TestFail;
+		}
+
+		EventNotifier hupNotifier(hupfd[0], EventNotifier::Read);
+		hupNotifier.setEnabled(false);
+
+		/* Let the dispatcher settle the notifier state first. */
+		timeout.start(10);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		close(hupfd[1]);
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		bool woken = timeout.isRunning();
+		timeout.stop();
+
+		close(hupfd[0]);
+
+		if (woken) {
+			cout << "Disabled event notifier woke up dispatcher" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
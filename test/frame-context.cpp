@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame-context.cpp - Frame context ring tests
+ */
+
+#include <iostream>
+#include <memory>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/request.h>
+
+#include "frame_context.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+struct TestFrameContext : public FrameContext {
+	unsigned int value;
+};
+
+class FrameContextTest : public Test
+{
+protected:
+	int init()
+	{
+		cm_ = new CameraManager();
+
+		/* Requests need a camera, skip the related tests without one. */
+		if (!cm_->start())
+			camera_ = cm_->get("VIMC Sensor B");
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		FrameContextRing<TestFrameContext> ring(4);
+
+		if (ring.depth() != 4) {
+			cout << "Invalid ring depth" << endl;
+			return TestFail;
+		}
+
+		/* Lookup by frame number. */
+		TestFrameContext *ctx = ring.create(5, nullptr);
+		if (!ctx || ctx->frame != 5 || ctx->value != 0) {
+			cout << "Failed to create frame context" << endl;
+			return TestFail;
+		}
+
+		ctx->value = 42;
+
+		if (ring.find(5) != ctx || ring.find(1) || ring.find(6)) {
+			cout << "Lookup by frame failed" << endl;
+			return TestFail;
+		}
+
+		/* Slot collision with a frame in flight. */
+		if (ring.create(9, nullptr)) {
+			cout << "Created context in occupied slot" << endl;
+			return TestFail;
+		}
+
+		ring.destroy(ctx);
+		if (ring.find(5)) {
+			cout << "Destroyed context still found" << endl;
+			return TestFail;
+		}
+
+		/* A recycled slot is reset. */
+		ctx = ring.create(9, nullptr);
+		if (!ctx || ctx->value != 0) {
+			cout << "Recycled frame context not reset" << endl;
+			return TestFail;
+		}
+
+		Buffer buffer;
+		if (ring.find(&buffer)) {
+			cout << "Found context for buffer without request" << endl;
+			return TestFail;
+		}
+
+		if (camera_ && testRequests(ring) != TestPass)
+			return TestFail;
+
+		/* Lookup with a predicate. */
+		ctx->value = 7;
+		TestFrameContext *found = ring.findIf([](const TestFrameContext &c) {
+			return c.value == 7;
+		});
+		if (found != ctx) {
+			cout << "Lookup by predicate failed" << endl;
+			return TestFail;
+		}
+
+		/* Clear all contexts. */
+		unsigned int cleared = 0;
+		ring.clear([&cleared](TestFrameContext &) { cleared++; });
+		if (cleared != 1 || ring.find(9)) {
+			cout << "Failed to clear frame contexts" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testRequests(FrameContextRing<TestFrameContext> &ring)
+	{
+		/* Lookup by request. */
+		std::unique_ptr<Request> request(new Request(camera_.get()));
+		std::unique_ptr<Request> other(new Request(camera_.get()));
+
+		TestFrameContext *reqCtx = ring.create(10, request.get());
+		if (!reqCtx || ring.find(request.get()) != reqCtx ||
+		    ring.find(other.get())) {
+			cout << "Lookup by request failed" << endl;
+			return TestFail;
+		}
+
+		/* A stale request reference isn't followed. */
+		ring.destroy(reqCtx);
+		if (ring.find(request.get())) {
+			cout << "Destroyed context found by request" << endl;
+			return TestFail;
+		}
+
+		reqCtx = ring.create(14, other.get());
+		if (ring.find(request.get()) || ring.find(other.get()) != reqCtx) {
+			cout << "Stale request lookup failed" << endl;
+			return TestFail;
+		}
+
+		ring.destroy(reqCtx);
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		camera_.reset();
+		cm_->stop();
+		delete cm_;
+	}
+
+private:
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+};
+
+TEST_REGISTER(FrameContextTest)
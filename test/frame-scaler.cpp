@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame-scaler.cpp - Frame scaler tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "frame_scaler.h"
+#include "thread_pool.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int WIDTH = 84;
+constexpr unsigned int HEIGHT = 66;
+constexpr unsigned int STRIDE = WIDTH * 4 + 12;
+
+struct Format {
+	const char *name;
+	unsigned int fourcc;
+	unsigned int bytesPerPixel;
+	/* The size of the chroma plane relative to the luma plane, in bytes. */
+	unsigned int chromaRatio;
+};
+
+const Format formats[] = {
+	{ "NV12", V4L2_PIX_FMT_NV12, 1, 2 },
+	{ "YUYV", V4L2_PIX_FMT_YUYV, 2, 0 },
+	{ "RGB24", V4L2_PIX_FMT_RGB24, 3, 0 },
+	{ "XRGB32", V4L2_PIX_FMT_XRGB32, 4, 0 },
+};
+
+const char *implementations[] = { "scalar", "sse2", "neon" };
+
+/* The input frame size in bytes, with the chroma plane of NV12. */
+unsigned int inputSize(const Format &format)
+{
+	return STRIDE * HEIGHT + (format.chromaRatio ? STRIDE * HEIGHT / 2 : 0);
+}
+
+/* Extract a crop rectangle from a frame, with no line padding. */
+std::vector<uint8_t> extract(const Format &format, const std::vector<uint8_t> &src,
+			     const Rectangle &rect)
+{
+	std::vector<uint8_t> dst;
+	unsigned int bpp = format.bytesPerPixel;
+
+	for (unsigned int y = 0; y < rect.h; ++y) {
+		const uint8_t *line = &src[(rect.y + y) * STRIDE + rect.x * bpp];
+		dst.insert(dst.end(), line, line + rect.w * bpp);
+	}
+
+	if (!format.chromaRatio)
+		return dst;
+
+	for (unsigned int y = 0; y < rect.h / 2; ++y) {
+		const uint8_t *line = &src[STRIDE * HEIGHT + (rect.y / 2 + y) * STRIDE + rect.x];
+		dst.insert(dst.end(), line, line + rect.w);
+	}
+
+	return dst;
+}
+
+} /* namespace */
+
+class FrameScalerTest : public Test
+{
+protected:
+	int init()
+	{
+		pool_ = new ThreadPool(2);
+		return TestPass;
+	}
+
+	int testInvalid()
+	{
+		FrameScaler scaler;
+
+		if (scaler.configure(V4L2_PIX_FMT_SRGGB8, { WIDTH, HEIGHT }, STRIDE,
+				     { 0, 0, WIDTH, HEIGHT }, { WIDTH, HEIGHT }) != -EINVAL) {
+			cout << "Invalid format accepted" << endl;
+			return TestFail;
+		}
+
+		if (scaler.configure(V4L2_PIX_FMT_NV12, { WIDTH, HEIGHT }, STRIDE,
+				     { 1, 0, WIDTH - 2, HEIGHT }, { WIDTH, HEIGHT }) != -EINVAL) {
+			cout << "Unaligned crop rectangle accepted" << endl;
+			return TestFail;
+		}
+
+		if (scaler.configure(V4L2_PIX_FMT_RGB24, { WIDTH, HEIGHT }, STRIDE,
+				     { 4, 0, WIDTH, HEIGHT }, { WIDTH, HEIGHT }) != -EINVAL) {
+			cout << "Out of bounds crop rectangle accepted" << endl;
+			return TestFail;
+		}
+
+		if (scaler.configure(V4L2_PIX_FMT_YUYV, { WIDTH, HEIGHT }, STRIDE,
+				     { 0, 0, WIDTH, HEIGHT }, { 4, HEIGHT }) != -EINVAL) {
+			cout << "Excessive downscaling accepted" << endl;
+			return TestFail;
+		}
+
+		if (scaler.configure(V4L2_PIX_FMT_XRGB32, { WIDTH, HEIGHT }, WIDTH,
+				     { 0, 0, WIDTH, HEIGHT }, { WIDTH, HEIGHT }) != -EINVAL) {
+			cout << "Too small stride accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	/* Cropping without scaling copies the crop rectangle. */
+	int testCrop(const Format &format, const std::vector<uint8_t> &src)
+	{
+		const Rectangle crop = { 6, 4, WIDTH - 16, HEIGHT - 10 };
+		FrameScaler scaler;
+
+		if (scaler.configure(format.fourcc, { WIDTH, HEIGHT }, STRIDE, crop,
+				     { crop.w, crop.h })) {
+			cout << "Failed to configure " << format.name << " crop" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> dst(scaler.frameSize());
+		scaler.process(src.data(), dst.data(), pool_);
+
+		if (dst != extract(format, src, crop)) {
+			cout << "Invalid " << format.name << " crop" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	/* Halving the size averages blocks of 2x2 pixels. */
+	int testHalve(const std::vector<uint8_t> &src)
+	{
+		FrameScaler scaler;
+
+		if (scaler.configure(V4L2_PIX_FMT_XRGB32, { WIDTH, HEIGHT }, STRIDE,
+				     { 0, 0, WIDTH, HEIGHT },
+				     { WIDTH / 2, HEIGHT / 2 })) {
+			cout << "Failed to configure downscaling" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> dst(scaler.frameSize());
+		scaler.process(src.data(), dst.data(), pool_);
+
+		for (unsigned int y = 0; y < HEIGHT / 2; ++y) {
+			for (unsigned int x = 0; x < WIDTH / 2 * 4; ++x) {
+				const uint8_t *in = &src[y * 2 * STRIDE + (x / 4 * 8) + x % 4];
+				unsigned int sum = in[0] + in[4] + in[STRIDE] + in[STRIDE + 4];
+
+				if (dst[y * WIDTH / 2 * 4 + x] != (sum + 2) / 4) {
+					cout << "Invalid downscaling at (" << x / 4
+					     << ", " << y << ")" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* Upscaling a flat field produces a flat field. */
+	int testFlat(const Format &format)
+	{
+		std::vector<uint8_t> src(inputSize(format), 77);
+		FrameScaler scaler;
+
+		if (scaler.configure(format.fourcc, { WIDTH, HEIGHT }, STRIDE,
+				     { 10, 8, 20, 16 }, { 130, 98 })) {
+			cout << "Failed to configure " << format.name << " upscaling" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> dst(scaler.frameSize());
+		scaler.process(src.data(), dst.data(), pool_);
+
+		for (uint8_t value : dst) {
+			if (value != 77) {
+				cout << "Invalid " << format.name << " upscaling" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* All implementations produce identical results. */
+	int testImplementations(const Format &format, const std::vector<uint8_t> &src)
+	{
+		static const Size sizes[] = { { 38, 30 }, { 62, 46 }, { 250, 200 } };
+
+		for (const Size &size : sizes) {
+			std::vector<uint8_t> expected;
+
+			for (const char *name : implementations) {
+				setenv("LIBCAMERA_FRAME_SCALER", name, 1);
+
+				FrameScaler scaler;
+				if (scaler.configure(format.fourcc, { WIDTH, HEIGHT }, STRIDE,
+						     { 2, 2, WIDTH - 4, HEIGHT - 4 }, size)) {
+					cout << "Failed to configure " << format.name
+					     << " scaling to " << size.toString() << endl;
+					return TestFail;
+				}
+
+				/* Skip implementations not available on this CPU. */
+				if (strcmp(scaler.implementation(), name))
+					continue;
+
+				std::vector<uint8_t> dst(scaler.frameSize());
+				scaler.process(src.data(), dst.data(), pool_);
+
+				if (expected.empty()) {
+					expected = dst;
+					continue;
+				}
+
+				if (dst != expected) {
+					cout << "Invalid " << format.name << " scaling to "
+					     << size.toString() << " with " << name
+					     << " implementation" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		unsetenv("LIBCAMERA_FRAME_SCALER");
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (testInvalid() != TestPass)
+			return TestFail;
+
+		srand(0);
+
+		for (const Format &format : formats) {
+			std::vector<uint8_t> src(inputSize(format));
+			for (uint8_t &value : src)
+				value = rand();
+
+			if (testCrop(format, src) != TestPass)
+				return TestFail;
+
+			if (testFlat(format) != TestPass)
+				return TestFail;
+
+			if (testImplementations(format, src) != TestPass)
+				return TestFail;
+
+			if (format.fourcc == V4L2_PIX_FMT_XRGB32 &&
+			    testHalve(src) != TestPass)
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		delete pool_;
+	}
+
+private:
+	ThreadPool *pool_ = nullptr;
+};
+
+TEST_REGISTER(FrameScalerTest)
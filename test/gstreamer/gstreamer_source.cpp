@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstreamer_source.cpp - GStreamer libcamerasrc smoke test
+ */
+
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+
+#include <gst/gst.h>
+
+#include "test.h"
+
+using namespace std;
+
+class GstreamerSourceTest : public Test
+{
+protected:
+	int init()
+	{
+		frames_ = 0;
+
+		gst_init(nullptr, nullptr);
+
+		GstElementFactory *factory = gst_element_factory_find("libcamerasrc");
+		if (!factory) {
+			cerr << "libcamerasrc element not found" << endl;
+			return TestFail;
+		}
+		gst_object_unref(factory);
+
+		pipeline_ = gst_pipeline_new("pipeline");
+		source_ = gst_element_factory_make("libcamerasrc", "source");
+		sink_ = gst_element_factory_make("fakesink", "sink");
+		if (!pipeline_ || !source_ || !sink_) {
+			cerr << "Failed to create pipeline elements" << endl;
+			return TestFail;
+		}
+
+		const char *name = getenv("LIBCAMERA_TEST_CAMERA");
+		if (name)
+			g_object_set(source_, "camera-name", name, nullptr);
+
+		g_object_set(sink_, "signal-handoffs", TRUE, nullptr);
+		g_signal_connect(sink_, "handoff", G_CALLBACK(handoff), this);
+
+		gst_bin_add_many(GST_BIN(pipeline_), source_, sink_, nullptr);
+		if (!gst_element_link(source_, sink_)) {
+			cerr << "Failed to link libcamerasrc to fakesink" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const unsigned int nframes = 10;
+
+		GstBus *bus = gst_element_get_bus(pipeline_);
+		int ret = capture(bus, nframes);
+		gst_object_unref(bus);
+
+		gst_element_set_state(pipeline_, GST_STATE_NULL);
+
+		if (ret != TestPass)
+			return ret;
+
+		if (frames_ < nframes) {
+			cerr << "Captured " << frames_ << " frames, expected "
+			     << nframes << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (pipeline_)
+			gst_object_unref(pipeline_);
+
+		gst_deinit();
+	}
+
+private:
+	static void handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad,
+			    gpointer data)
+	{
+		static_cast<GstreamerSourceTest *>(data)->frames_++;
+	}
+
+	int capture(GstBus *bus, unsigned int nframes)
+	{
+		if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) ==
+		    GST_STATE_CHANGE_FAILURE) {
+			int ret = error(bus);
+
+			/* Skip when no camera is available in the system. */
+			if (ret == TestSkip)
+				cout << "No camera available, skipping" << endl;
+			else
+				cerr << "Failed to start the pipeline" << endl;
+
+			return ret;
+		}
+
+		/* Wait for the frames to be captured, up to 5 seconds. */
+		for (unsigned int i = 0; i < 50 && frames_ < nframes; ++i) {
+			GstMessage *msg = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND,
+								     GST_MESSAGE_ERROR);
+			if (msg) {
+				gst_message_unref(msg);
+				cerr << "Error while capturing frames" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Stop the source and wait for the EOS to reach the sink. */
+		gst_element_send_event(pipeline_, gst_event_new_eos());
+
+		GstMessage *msg = gst_bus_timed_pop_filtered(bus, 2 * GST_SECOND,
+							     static_cast<GstMessageType>(GST_MESSAGE_EOS |
+											 GST_MESSAGE_ERROR));
+		if (!msg || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_EOS) {
+			if (msg)
+				gst_message_unref(msg);
+			cerr << "Failed to stop the pipeline" << endl;
+			return TestFail;
+		}
+
+		gst_message_unref(msg);
+
+		return TestPass;
+	}
+
+	int error(GstBus *bus)
+	{
+		GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+		if (!msg)
+			return TestFail;
+
+		GError *err = nullptr;
+		gst_message_parse_error(msg, &err, nullptr);
+
+		int ret = g_error_matches(err, GST_RESOURCE_ERROR,
+					  GST_RESOURCE_ERROR_NOT_FOUND)
+			? TestSkip : TestFail;
+
+		g_error_free(err);
+		gst_message_unref(msg);
+
+		return ret;
+	}
+
+	GstElement *pipeline_ = nullptr;
+	GstElement *source_ = nullptr;
+	GstElement *sink_ = nullptr;
+
+	std::atomic<unsigned int> frames_;
+};
+
+TEST_REGISTER(GstreamerSourceTest)
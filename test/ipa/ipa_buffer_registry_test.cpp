@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_buffer_registry_test.cpp - Test the IPA buffer mapping registry
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <ipa/ipa_interface.h>
+#include <libcamera/buffer.h>
+
+#include "ipa_buffer_registry.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* Record the buffer IDs mapped and unmapped by the registry. */
+class RecorderIPA : public IPAInterface
+{
+public:
+	int init() override { return 0; }
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, ControlInfoMap> &entityControls) override {}
+	void processEvent(const IPAOperationData &data) override {}
+
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override
+	{
+		for (const IPABuffer &buffer : buffers)
+			mapped.push_back(buffer.id);
+	}
+
+	void unmapBuffers(const std::vector<unsigned int> &ids) override
+	{
+		unmapped.insert(unmapped.end(), ids.begin(), ids.end());
+	}
+
+	void reset()
+	{
+		mapped.clear();
+		unmapped.clear();
+	}
+
+	std::vector<unsigned int> mapped;
+	std::vector<unsigned int> unmapped;
+};
+
+} /* namespace */
+
+class IPABufferRegistryTest : public Test
+{
+protected:
+	int init() override
+	{
+		for (unsigned int i = 0; i < 4; ++i) {
+			if (createBuffer(i))
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		IPABufferRegistry registry;
+
+		/* All buffers are mapped the first time. */
+		registry.map(&ipa_, buffers_);
+		if (!check({ 0, 1, 2, 3 }, {}) || registry.size() != 4) {
+			cerr << "Initial buffers not mapped" << endl;
+			return TestFail;
+		}
+
+		/* Unchanged buffers are kept mapped. */
+		registry.map(&ipa_, buffers_);
+		if (!check({}, {}) || registry.generation() != 2) {
+			cerr << "Unchanged buffers mapped again" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Replace the dmabuf of buffer 1 and drop buffer 3. The former
+		 * is remapped, the latter unmapped.
+		 */
+		buffers_.pop_back();
+		if (createBuffer(1))
+			return TestFail;
+		std::swap(buffers_[1], buffers_.back());
+		buffers_.pop_back();
+
+		registry.map(&ipa_, buffers_);
+		if (!check({ 1 }, { 1, 3 }) || registry.size() != 3) {
+			cerr << "Changed buffers not handled" << endl;
+			return TestFail;
+		}
+
+		/* Buffers are all unmapped on request. */
+		registry.unmapAll(&ipa_);
+		if (!check({}, { 0, 1, 2 }) || registry.size() != 0) {
+			cerr << "Buffers not unmapped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		for (int fd : fds_)
+			close(fd);
+	}
+
+private:
+	int createBuffer(unsigned int id)
+	{
+		int fd = memfd_create("ipa-buffer", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, 4096)) {
+			cerr << "Failed to create buffer " << id << endl;
+			return -errno;
+		}
+
+		fds_.push_back(fd);
+
+		IPABuffer buffer;
+		buffer.id = id;
+		buffer.memory.planes().resize(1);
+		buffer.memory.planes()[0].setDmabuf(fd, 4096);
+		buffers_.push_back(std::move(buffer));
+
+		return 0;
+	}
+
+	bool check(std::vector<unsigned int> mapped,
+		   std::vector<unsigned int> unmapped)
+	{
+		std::sort(ipa_.mapped.begin(), ipa_.mapped.end());
+		std::sort(ipa_.unmapped.begin(), ipa_.unmapped.end());
+
+		bool ok = ipa_.mapped == mapped && ipa_.unmapped == unmapped;
+		ipa_.reset();
+
+		return ok;
+	}
+
+	RecorderIPA ipa_;
+	std::vector<IPABuffer> buffers_;
+	std::vector<int> fds_;
+};
+
+TEST_REGISTER(IPABufferRegistryTest)
@@ -110,6 +110,30 @@ protected:
 			return TestFail;
 		}
 
+		/* Test initialization of the IPA module in its own thread. */
+		trace_ = IPAOperationNone;
+		ipa_ = IPAManager::instance()->createIPA(pipe_.get(), 0, 0,
+							 IPAManager::ThreadedIPA);
+		if (!ipa_) {
+			cerr << "Failed to create threaded VIMC IPA interface" << endl;
+			return TestFail;
+		}
+
+		if (ipa_->init()) {
+			cerr << "Failed to initialize threaded VIMC IPA" << endl;
+			return TestFail;
+		}
+
+		timer.start(1000);
+		while (timer.isRunning() && trace_ != IPAOperationInit)
+			dispatcher->processEvents();
+
+		if (trace_ != IPAOperationInit) {
+			cerr << "Failed to test threaded IPA initialization sequence"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
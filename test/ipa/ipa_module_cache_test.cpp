@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache_test.cpp - Test the IPA module information cache
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ipa_module.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAModuleCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		const std::string prefix = "/tmp/libcamera-ipa-cache-" + to_string(getpid());
+		cachePath_ = prefix + ".cache";
+		stalePath_ = prefix + "-stale.so";
+
+		if (copy(ModulePath, stalePath_))
+			return TestFail;
+
+		/*
+		 * Seed the cache with fake information for the module, and for
+		 * the copy with a modification time that doesn't match.
+		 */
+		struct stat st;
+		if (stat(ModulePath, &st)) {
+			cerr << "Failed to stat " << ModulePath << endl;
+			return TestFail;
+		}
+
+		int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000
+			      + st.st_mtim.tv_nsec;
+
+		std::ofstream file(cachePath_);
+		file << "# libcamera IPA module info cache v1" << endl;
+		writeRecord(file, ModulePath, mtime, st.st_size);
+		writeRecord(file, stalePath_, mtime - 1, st.st_size);
+		file.close();
+
+		setenv("LIBCAMERA_IPA_MODULE_CACHE", cachePath_.c_str(), 1);
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/* The cached information must be used for a matching file. */
+		IPAModule cached(ModulePath);
+		if (!cached.isValid() || strcmp(cached.info().name, "Cached IPA")) {
+			cerr << "Cached information not used" << endl;
+			return TestFail;
+		}
+
+		/* A modified file must be parsed again, and the cache updated. */
+		IPAModule stale(stalePath_);
+		if (!stale.isValid() ||
+		    strcmp(stale.info().name, "Dummy IPA for Vimc")) {
+			cerr << "Stale cached information used" << endl;
+			return TestFail;
+		}
+
+		std::ifstream file(cachePath_);
+		std::string contents((std::istreambuf_iterator<char>(file)),
+				     std::istreambuf_iterator<char>());
+		if (contents.find("Dummy IPA for Vimc") == std::string::npos) {
+			cerr << "Cache file not updated" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(cachePath_.c_str());
+		unlink(stalePath_.c_str());
+	}
+
+private:
+	static constexpr const char *ModulePath = "src/ipa/ipa_vimc.so";
+
+	int copy(const std::string &from, const std::string &to)
+	{
+		std::ifstream in(from, std::ios::binary);
+		std::ofstream out(to, std::ios::binary);
+		out << in.rdbuf();
+		if (!in || !out) {
+			cerr << "Failed to copy " << from << endl;
+			return -EIO;
+		}
+
+		return 0;
+	}
+
+	void writeRecord(std::ofstream &file, const std::string &path,
+			 int64_t mtime, off_t size)
+	{
+		file << path.size() << " " << path << " " << mtime << " "
+		     << size << " " << IPA_MODULE_API_VERSION << " 0"
+		     << " 19 PipelineHandlerVimc 10 Cached IPA"
+		     << " 16 GPL-2.0-or-later" << endl;
+	}
+
+	std::string cachePath_;
+	std::string stalePath_;
+};
+
+TEST_REGISTER(IPAModuleCacheTest)
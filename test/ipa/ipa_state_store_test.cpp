@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_state_store_test.cpp - Test the IPA state store
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "ipa_state_store.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAStateStoreTest : public Test
+{
+protected:
+	int init() override
+	{
+		statePath_ = "/tmp/libcamera-ipa-state-" + to_string(getpid());
+
+		/* Seed the state file with a camera name containing spaces. */
+		std::ofstream file(statePath_);
+		file << "# libcamera IPA state v1" << endl;
+		file << "13 sensor 1-0010 3 100 200 300" << endl;
+		file.close();
+
+		setenv("LIBCAMERA_IPA_STATE_FILE", statePath_.c_str(), 1);
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		IPAStateStore *store = IPAStateStore::instance();
+		std::vector<uint32_t> state;
+
+		/* The state must be loaded from the file. */
+		if (!store->lookup("sensor 1-0010", &state) ||
+		    state != std::vector<uint32_t>{ 100, 200, 300 }) {
+			cerr << "State not loaded from file" << endl;
+			return TestFail;
+		}
+
+		if (store->lookup("sensor 2-0010", &state)) {
+			cerr << "State found for unknown camera" << endl;
+			return TestFail;
+		}
+
+		/* Stored states must be visible and persisted. */
+		store->store("sensor 2-0010", { 1, 2 });
+		if (!store->lookup("sensor 2-0010", &state) ||
+		    state != std::vector<uint32_t>{ 1, 2 }) {
+			cerr << "Stored state not found" << endl;
+			return TestFail;
+		}
+
+		std::ifstream file(statePath_);
+		std::string contents((std::istreambuf_iterator<char>(file)),
+				     std::istreambuf_iterator<char>());
+		if (contents.find("13 sensor 2-0010 2 1 2") == std::string::npos ||
+		    contents.find("13 sensor 1-0010 3 100 200 300") == std::string::npos) {
+			cerr << "State file not updated" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(statePath_.c_str());
+	}
+
+private:
+	std::string statePath_;
+};
+
+TEST_REGISTER(IPAStateStoreTest)
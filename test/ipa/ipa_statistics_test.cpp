@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_statistics_test.cpp - Test the IPA statistics helpers
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "ipa_statistics.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAStatisticsTest : public Test
+{
+protected:
+	int init() override
+	{
+		/*
+		 * Use a width that isn't a multiple of the vector sizes to
+		 * exercise the scalar tails.
+		 */
+		width_ = 75;
+		height_ = 6;
+		stride_ = 160;
+
+		frame_.resize(stride_ * height_);
+		for (unsigned int i = 0; i < frame_.size(); ++i)
+			frame_[i] = (i * 37 + i / 7) & 0xff;
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testArrays() != TestPass || testHistogram() != TestPass ||
+		    testPlanes() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	int testArrays()
+	{
+		const uint8_t *a = frame_.data();
+		const uint8_t *b = frame_.data() + stride_;
+		unsigned int count = stride_ - 1;
+		uint64_t sum = 0;
+		uint64_t sumW = 0;
+		uint64_t dot = 0;
+		uint64_t sad = 0;
+		uint64_t sumMin = 0;
+		unsigned int numMin = 0;
+
+		for (unsigned int i = 0; i < count; ++i) {
+			sum += a[i];
+			sumW += b[i];
+			dot += a[i] * b[i];
+			sad += std::abs(a[i] - b[i]);
+
+			if (a[i] >= 100) {
+				sumMin += a[i];
+				numMin++;
+			}
+		}
+
+		if (IPAStatistics::sum(a, count) != sum) {
+			cout << "Invalid sum" << endl;
+			return TestFail;
+		}
+
+		if (IPAStatistics::sumAbsDiff(a, b, count) != sad) {
+			cout << "Invalid sum of absolute differences" << endl;
+			return TestFail;
+		}
+
+		if (IPAStatistics::mean(a, count) != static_cast<double>(sum) / count ||
+		    IPAStatistics::mean(a, count, 100) != static_cast<double>(sumMin) / numMin) {
+			cout << "Invalid mean" << endl;
+			return TestFail;
+		}
+
+		if (IPAStatistics::weightedMean(a, b, count) !=
+		    static_cast<double>(dot) / sumW) {
+			cout << "Invalid weighted mean" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testHistogram()
+	{
+		/* A YUYV plane, with the luma samples at even offsets. */
+		IPAStatistics::Plane plane = { frame_.data(), width_ / 2, height_,
+					       stride_, 2 };
+		std::vector<uint32_t> expected(16);
+		std::vector<uint32_t> bins(16, 42);
+
+		for (unsigned int y = 0; y < plane.height; ++y) {
+			for (unsigned int x = 0; x < plane.width; ++x)
+				expected[frame_[y * stride_ + x * 2] >> 4]++;
+		}
+
+		IPAStatistics::histogram(plane, bins.data(), bins.size());
+		if (bins != expected) {
+			cout << "Invalid histogram" << endl;
+			return TestFail;
+		}
+
+		/* All samples in bins 2 and 3, covering values [128, 256[. */
+		uint32_t flat[4] = { 0, 0, 10, 10 };
+		if (IPAStatistics::histogramMean(flat, 4, 0, 4) != 192.0 ||
+		    IPAStatistics::histogramMean(flat, 4, 0, 3) != 160.0 ||
+		    IPAStatistics::histogramMean(flat, 4, 0, 2) != 0.0) {
+			cout << "Invalid histogram mean" << endl;
+			return TestFail;
+		}
+
+		if (IPAStatistics::histogramPercentile(flat, 4, 0.5) != 192.0 ||
+		    IPAStatistics::histogramPercentile(flat, 4, 0.25) != 160.0 ||
+		    IPAStatistics::histogramPercentile(flat, 4, 1.0) != 256.0) {
+			cout << "Invalid histogram percentile" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testPlanes()
+	{
+		IPAStatistics::Plane plane = { frame_.data(), width_, height_,
+					       stride_, 1 };
+
+		/* Zone averages, on a 3x2 grid. */
+		double averages[6];
+		IPAStatistics::zoneAverages(plane, 3, 2, averages);
+
+		for (unsigned int zone = 0; zone < 6; ++zone) {
+			unsigned int column = zone % 3;
+			unsigned int row = zone / 3;
+			uint64_t sum = 0;
+			unsigned int num = 0;
+
+			for (unsigned int y = row * 3; y < row * 3 + 3; ++y) {
+				for (unsigned int x = column * 25; x < column * 25 + 25; ++x) {
+					sum += frame_[y * stride_ + x];
+					num++;
+				}
+			}
+
+			if (std::abs(averages[zone] - static_cast<double>(sum) / num) > 1e-9) {
+				cout << "Invalid average for zone " << zone << endl;
+				return TestFail;
+			}
+		}
+
+		/* Bayer sums, in the GRBG order. */
+		uint64_t sums[2][2] = {};
+		for (unsigned int y = 0; y < height_; ++y) {
+			for (unsigned int x = 0; x < width_ - 1; ++x)
+				sums[y % 2][x % 2] += frame_[y * stride_ + x];
+		}
+
+		IPAStatistics::ColourSums colours =
+			IPAStatistics::bayerSums(plane, IPAStatistics::BayerGRBG);
+		if (colours.red != sums[0][1] || colours.blue != sums[1][0] ||
+		    colours.green != sums[0][0] + sums[1][1] ||
+		    colours.count != (width_ / 2) * (height_ / 2)) {
+			cout << "Invalid Bayer sums" << endl;
+			return TestFail;
+		}
+
+		/* Chroma sums, on an interleaved plane. */
+		plane.width = width_ / 2;
+
+		uint64_t cb;
+		uint64_t cr;
+		IPAStatistics::chromaSums(plane, &cb, &cr);
+		if (cb != sums[0][0] + sums[1][0] || cr != sums[0][1] + sums[1][1]) {
+			cout << "Invalid chroma sums" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int width_;
+	unsigned int height_;
+	unsigned int stride_;
+	std::vector<uint8_t> frame_;
+};
+
+TEST_REGISTER(IPAStatisticsTest)
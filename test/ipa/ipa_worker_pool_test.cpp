@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_worker_pool_test.cpp - Test the IPA worker thread pool
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "ipa_worker_pool.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAWorkerPoolTest : public Test
+{
+protected:
+	int run() override
+	{
+		if (runPool(0) != TestPass || runPool(3) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	int runPool(unsigned int workers)
+	{
+		IPAWorkerPool pool(workers);
+		std::vector<unsigned int> results(4);
+		std::atomic<unsigned int> running(0);
+		std::atomic<unsigned int> concurrency(0);
+
+		for (unsigned int i = 0; i < results.size(); ++i) {
+			pool.addTask("task" + std::to_string(i),
+				     [&, i]() {
+					     unsigned int n = ++running;
+					     if (n > concurrency)
+						     concurrency = n;
+
+					     std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					     results[i]++;
+					     --running;
+				     });
+		}
+
+		for (unsigned int frame = 0; frame < 5; ++frame)
+			pool.run();
+
+		for (unsigned int i = 0; i < results.size(); ++i) {
+			if (results[i] != 5) {
+				cerr << "Task " << i << " ran " << results[i]
+				     << " times with " << workers << " workers"
+				     << endl;
+				return TestFail;
+			}
+
+			const IPAWorkerPool::Timing &timing = pool.timing(i);
+			if (timing.count != 5 ||
+			    timing.last < std::chrono::milliseconds(10) ||
+			    timing.max < timing.last ||
+			    timing.total < timing.max) {
+				cerr << "Invalid timing for task " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (pool.name(2) != "task2") {
+			cerr << "Invalid task name" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Without workers the tasks run serially, with workers they
+		 * should overlap on any machine with more than one CPU.
+		 */
+		if (!workers && concurrency != 1) {
+			cerr << "Tasks ran in parallel without workers" << endl;
+			return TestFail;
+		}
+
+		if (workers && std::thread::hardware_concurrency() > 1 &&
+		    concurrency < 2) {
+			cerr << "Tasks didn't run in parallel" << endl;
+			return TestFail;
+		}
+
+		pool.resetTimings();
+		if (pool.timing(0).count) {
+			cerr << "Timings not reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(IPAWorkerPoolTest)
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_wrappers_test.cpp - Test the IPA interface and context wrappers
+ */
+
+#include <iostream>
+#include <map>
+#include <string.h>
+#include <vector>
+
+#include <ipa/ipa_interface.h>
+#include <libcamera/controls.h>
+
+#include "ipa_context_wrapper.h"
+#include "ipa_interface_wrapper.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+enum Operation {
+	Op_configure,
+	Op_processEvent,
+};
+
+ControlId exposure(0x00980911, "Exposure", ControlTypeInteger32);
+ControlId gain(0x009e0903, "Analogue Gain", ControlTypeInteger32);
+
+/*
+ * Check the arguments received through the C IPA interface, and reply to
+ * events with a frame action built from the event data.
+ */
+class TestIPAInterface : public IPAInterface
+{
+public:
+	TestIPAInterface()
+		: sequence_(0)
+	{
+	}
+
+	int init() override
+	{
+		return 0;
+	}
+
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, ControlInfoMap> &entityControls) override
+	{
+		if (streamConfig.size() != 1 ||
+		    streamConfig.at(1).pixelFormat != 0x56595559 ||
+		    streamConfig.at(1).size != Size(1024, 768))
+			return fail(Op_configure, "Invalid stream configuration");
+
+		if (entityControls.size() != 1)
+			return fail(Op_configure, "Invalid number of entity controls");
+
+		entityControls_ = entityControls.at(42);
+		auto iter = entityControls_.find(exposure.id());
+		if (entityControls_.size() != 2 || iter == entityControls_.end() ||
+		    iter->second.max().get<int32_t>() != 1000)
+			return fail(Op_configure, "Invalid entity controls");
+
+		pass(Op_configure);
+	}
+
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override
+	{
+	}
+
+	void unmapBuffers(const std::vector<unsigned int> &ids) override
+	{
+	}
+
+	void processEvent(const IPAOperationData &data) override
+	{
+		/* Don't reply if the configuration failed. */
+		if (!results_[Op_configure])
+			return;
+
+		if (data.operation != Op_processEvent || data.data.size() != 2 ||
+		    data.data[0] != sequence_ || data.data[1] != 0xdeadbeef)
+			return fail(Op_processEvent, "Invalid event data");
+
+		if (data.controls.size() != 1 ||
+		    data.controls[0].get(exposure.id()).get<int32_t>() !=
+		    static_cast<int32_t>(500 + sequence_))
+			return fail(Op_processEvent, "Invalid event controls");
+
+		ControlList controls(entityControls_);
+		controls.set(gain.id(), ControlValue(static_cast<int32_t>(16 + sequence_)));
+
+		IPAOperationData action;
+		action.operation = data.operation;
+		action.data = { sequence_ };
+		action.controls.push_back(controls);
+
+		sequence_++;
+
+		queueFrameAction.emit(sequence_, std::move(action));
+	}
+
+private:
+	void fail(Operation op, const char *msg)
+	{
+		cerr << msg << endl;
+		results_[op] = false;
+	}
+
+	void pass(Operation op)
+	{
+		results_[op] = true;
+	}
+
+	std::map<Operation, bool> results_;
+	ControlInfoMap entityControls_;
+	unsigned int sequence_;
+};
+
+} /* namespace */
+
+class IPAWrappersTest : public Test
+{
+protected:
+	int init() override
+	{
+		/*
+		 * Hide the IPAInterface implemented by the IPAInterfaceWrapper
+		 * from the IPAContextWrapper, to make it use the C API.
+		 */
+		IPAInterfaceWrapper *intf = new IPAInterfaceWrapper(new TestIPAInterface());
+		ops_ = *intf->ops;
+		ops_.get_interface = nullptr;
+		intf->ops = &ops_;
+
+		ctx_ = new IPAContextWrapper(intf);
+		ctx_->queueFrameAction.connect(this, &IPAWrappersTest::queueFrameAction);
+
+		return ctx_->init() ? TestFail : TestPass;
+	}
+
+	int run() override
+	{
+		ControlInfoMap infoMap{
+			{ &exposure, ControlRange(1, 1000) },
+			{ &gain, ControlRange(16, 256) },
+		};
+
+		std::map<unsigned int, IPAStream> streamConfig;
+		streamConfig[1] = { 0x56595559, Size(1024, 768) };
+
+		std::map<unsigned int, ControlInfoMap> entityControls;
+		entityControls.emplace(42, infoMap);
+
+		ctx_->configure(streamConfig, entityControls);
+
+		/*
+		 * Send events in a row to exercise the reuse of the
+		 * serialization buffers.
+		 */
+		for (unsigned int i = 0; i < 3; ++i) {
+			ControlList controls(infoMap);
+			controls.set(exposure.id(), ControlValue(static_cast<int32_t>(500 + i)));
+
+			IPAOperationData event;
+			event.operation = Op_processEvent;
+			event.data = { i, 0xdeadbeef };
+			event.controls.push_back(controls);
+
+			ctx_->processEvent(event);
+
+			if (frame_ != i + 1 || action_.operation != Op_processEvent ||
+			    action_.data.size() != 1 || action_.data[0] != i) {
+				cerr << "Invalid frame action for event " << i << endl;
+				return TestFail;
+			}
+
+			if (action_.controls.size() != 1 ||
+			    action_.controls[0].idmap() != infoMap.idmap() ||
+			    action_.controls[0].get(gain.id()).get<int32_t>() !=
+			    static_cast<int32_t>(16 + i)) {
+				cerr << "Invalid frame action controls for event "
+				     << i << endl;
+				return TestFail;
+			}
+		}
+
+		/* Events moved to the IPA must be delivered unchanged. */
+		ControlList controls(infoMap);
+		controls.set(exposure.id(), ControlValue(static_cast<int32_t>(503)));
+
+		IPAOperationData event;
+		event.operation = Op_processEvent;
+		event.data = { 3, 0xdeadbeef };
+		event.controls.push_back(std::move(controls));
+
+		ctx_->processEvent(std::move(event));
+
+		if (frame_ != 4 || action_.data.size() != 1 || action_.data[0] != 3 ||
+		    action_.controls.size() != 1) {
+			cerr << "Invalid frame action for moved event" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete ctx_;
+	}
+
+private:
+	void queueFrameAction(unsigned int frame, IPAOperationData &&data)
+	{
+		frame_ = frame;
+		action_ = std::move(data);
+	}
+
+	struct ipa_context_ops ops_;
+	IPAInterface *ctx_ = nullptr;
+
+	unsigned int frame_ = 0;
+	IPAOperationData action_;
+};
+
+TEST_REGISTER(IPAWrappersTest)
@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_benchmark.cpp - IPC latency and throughput benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "ipc_ring.h"
+#include "ipc_unixsocket.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+enum Command : uint8_t {
+	CmdPing,
+	CmdFlood,
+	CmdSync,
+};
+
+/* Size of the messages, in the range of a per-frame IPA event. */
+constexpr unsigned int MessageSize = 64;
+
+/* Number of messages sent in a row before waiting for the peer. */
+constexpr unsigned int Window = 8;
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *str = getenv(name);
+	if (!str)
+		return defaultValue;
+
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (*end != '\0' || !value)
+		return defaultValue;
+
+	return value;
+}
+
+/*
+ * Peer running in a separate thread. Ping and sync messages are sent back
+ * unmodified, flood messages are dropped.
+ */
+class EchoThread : public Thread
+{
+public:
+	EchoThread(int socket, int ringMemfd[2], int ringEventfd[2])
+		: socket_(socket)
+	{
+		for (unsigned int i = 0; i < 2; ++i) {
+			ringMemfd_[i] = ringMemfd[i];
+			ringEventfd_[i] = ringEventfd[i];
+		}
+	}
+
+protected:
+	void run() override
+	{
+		ipc_.bind(socket_);
+		ipc_.readyRead.connect(this, &EchoThread::socketReady);
+
+		in_.bind(IPCRing::Consumer, ringMemfd_[0], ringEventfd_[0]);
+		out_.bind(IPCRing::Producer, ringMemfd_[1], ringEventfd_[1]);
+		in_.readyRead.connect(this, &EchoThread::ringReady);
+
+		exec();
+
+		in_.close();
+		out_.close();
+		ipc_.close();
+	}
+
+private:
+	void socketReady(IPCUnixSocket *ipc)
+	{
+		if (ipc->receive(&payload_))
+			return;
+
+		if (payload_.data[0] != CmdFlood)
+			ipc->send(payload_);
+	}
+
+	void ringReady(IPCRing *ring)
+	{
+		const uint8_t *data;
+		size_t size;
+
+		while ((data = ring->front(&size))) {
+			uint8_t *reply = out_.reserve(size);
+			if (reply) {
+				std::copy(data, data + size, reply);
+				out_.commit();
+			}
+
+			ring->pop();
+		}
+	}
+
+	int socket_;
+	int ringMemfd_[2];
+	int ringEventfd_[2];
+
+	IPCUnixSocket ipc_;
+	IPCUnixSocket::Payload payload_;
+	IPCRing in_;
+	IPCRing out_;
+};
+
+} /* namespace */
+
+class IPCBenchmark : public Test
+{
+protected:
+	int init() override
+	{
+		messages_ = envValue("LIBCAMERA_BENCHMARK_MESSAGES", 10000);
+		messages_ = (messages_ + Window - 1) / Window * Window;
+
+		int socket = ipc_.create();
+		if (socket < 0)
+			return TestFail;
+
+		if (toPeer_.create(IPCRing::Producer, 4096) ||
+		    fromPeer_.create(IPCRing::Consumer, 4096))
+			return TestFail;
+
+		int memfd[2] = { dup(toPeer_.memfd()), dup(fromPeer_.memfd()) };
+		int eventfd[2] = { dup(toPeer_.eventfd()), dup(fromPeer_.eventfd()) };
+
+		ipc_.readyRead.connect(this, &IPCBenchmark::socketReady);
+		fromPeer_.readyRead.connect(this, &IPCBenchmark::ringReady);
+
+		peer_ = new EchoThread(socket, memfd, eventfd);
+		peer_->start();
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		std::vector<uint64_t> socketLatencies;
+		std::vector<uint64_t> ringLatencies;
+		double singleRate;
+		double batchRate;
+
+		if (measureSocketLatency(&socketLatencies) ||
+		    measureRingLatency(&ringLatencies) ||
+		    measureThroughput(false, &singleRate) ||
+		    measureThroughput(true, &batchRate)) {
+			cout << "IPC exchange failed" << endl;
+			return TestFail;
+		}
+
+		std::stringstream json;
+		json << "{" << endl
+		     << "  \"benchmark\": \"ipc\"," << endl
+		     << "  \"message_size\": " << MessageSize << "," << endl
+		     << "  \"messages\": " << messages_ << "," << endl
+		     << "  \"socket_round_trip_ns\": "
+		     << latencies(socketLatencies) << "," << endl
+		     << "  \"ring_round_trip_ns\": "
+		     << latencies(ringLatencies) << "," << endl
+		     << "  \"socket_messages_per_s\": " << singleRate << "," << endl
+		     << "  \"socket_batched_messages_per_s\": " << batchRate << endl
+		     << "}" << endl;
+
+		std::string result = json.str();
+		cout << result;
+
+		const char *output = getenv("LIBCAMERA_BENCHMARK_OUTPUT");
+		if (output) {
+			std::ofstream file(output);
+			file << result;
+			if (!file) {
+				cout << "Failed to write " << output << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (!peer_)
+			return;
+
+		peer_->exit();
+		peer_->wait();
+		delete peer_;
+	}
+
+private:
+	int waitReply()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timeout;
+		timeout.start(1000);
+		while (!replied_) {
+			if (!timeout.isRunning())
+				return -ETIMEDOUT;
+
+			dispatcher->processEvents();
+		}
+
+		replied_ = false;
+		return 0;
+	}
+
+	int measureSocketLatency(std::vector<uint64_t> *samples)
+	{
+		IPCUnixSocket::Payload ping;
+		ping.data.resize(MessageSize, CmdPing);
+
+		samples->reserve(messages_);
+
+		for (unsigned int i = 0; i < messages_; ++i) {
+			auto start = std::chrono::steady_clock::now();
+
+			if (ipc_.send(ping) || waitReply())
+				return -EIO;
+
+			auto end = std::chrono::steady_clock::now();
+			samples->push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+
+		return 0;
+	}
+
+	int measureRingLatency(std::vector<uint64_t> *samples)
+	{
+		samples->reserve(messages_);
+
+		for (unsigned int i = 0; i < messages_; ++i) {
+			auto start = std::chrono::steady_clock::now();
+
+			uint8_t *data = toPeer_.reserve(MessageSize);
+			if (!data)
+				return -ENOSPC;
+
+			std::fill(data, data + MessageSize, CmdPing);
+			if (toPeer_.commit() || waitReply())
+				return -EIO;
+
+			auto end = std::chrono::steady_clock::now();
+			samples->push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+
+		return 0;
+	}
+
+	/*
+	 * Send windows of messages, the last message of each window is a sync
+	 * message to wait for the peer before sending the next window. This
+	 * keeps the socket queue from overflowing.
+	 */
+	int measureThroughput(bool batch, double *rate)
+	{
+		std::vector<IPCUnixSocket::Payload> window(Window);
+		for (IPCUnixSocket::Payload &payload : window)
+			payload.data.resize(MessageSize, CmdFlood);
+		window.back().data[0] = CmdSync;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < messages_; i += Window) {
+			if (batch) {
+				if (ipc_.send(window) != static_cast<int>(Window))
+					return -EIO;
+			} else {
+				for (const IPCUnixSocket::Payload &payload : window) {
+					if (ipc_.send(payload))
+						return -EIO;
+				}
+			}
+
+			if (waitReply())
+				return -EIO;
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		*rate = messages_ / std::chrono::duration<double>(end - start).count();
+
+		return 0;
+	}
+
+	std::string latencies(std::vector<uint64_t> &samples)
+	{
+		std::sort(samples.begin(), samples.end());
+
+		auto percentile = [&samples](unsigned int percent) {
+			return samples[(samples.size() - 1) * percent / 100];
+		};
+
+		std::stringstream ss;
+		ss << "{ \"min\": " << percentile(0)
+		   << ", \"p50\": " << percentile(50)
+		   << ", \"p90\": " << percentile(90)
+		   << ", \"p99\": " << percentile(99)
+		   << ", \"max\": " << percentile(100) << " }";
+
+		return ss.str();
+	}
+
+	void socketReady(IPCUnixSocket *ipc)
+	{
+		if (!ipc->receive(&payload_))
+			replied_ = true;
+	}
+
+	void ringReady(IPCRing *ring)
+	{
+		size_t size;
+
+		while (ring->front(&size)) {
+			ring->pop();
+			replied_ = true;
+		}
+	}
+
+	unsigned int messages_;
+	bool replied_ = false;
+
+	IPCUnixSocket ipc_;
+	IPCUnixSocket::Payload payload_;
+	IPCRing toPeer_;
+	IPCRing fromPeer_;
+
+	EchoThread *peer_ = nullptr;
+};
+
+TEST_REGISTER(IPCBenchmark)
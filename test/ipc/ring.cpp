@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ring.cpp - Shared memory ring IPC test
+ */
+
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "ipc_ring.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RingTest : public Test
+{
+protected:
+	int init()
+	{
+		if (producer_.create(IPCRing::Producer, 4096)) {
+			cerr << "Failed to create ring" << endl;
+			return TestFail;
+		}
+
+		if (consumer_.bind(IPCRing::Consumer, dup(producer_.memfd()),
+				   dup(producer_.eventfd()))) {
+			cerr << "Failed to bind to ring" << endl;
+			return TestFail;
+		}
+
+		consumer_.readyRead.connect(this, &RingTest::readyRead);
+
+		return TestPass;
+	}
+
+	int send(unsigned int size, uint8_t value)
+	{
+		uint8_t *data = producer_.reserve(size);
+		if (!data)
+			return -ENOSPC;
+
+		memset(data, value, size);
+		return producer_.commit();
+	}
+
+	int receive(unsigned int size, uint8_t value)
+	{
+		size_t length;
+		const uint8_t *data = consumer_.front(&length);
+		if (!data || length != size)
+			return -EINVAL;
+
+		for (unsigned int i = 0; i < size; ++i) {
+			if (data[i] != value)
+				return -EINVAL;
+		}
+
+		consumer_.pop();
+		return 0;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		/* Messages larger than half of the ring are rejected. */
+		if (producer_.reserve(4096 / 2 + 1)) {
+			cerr << "Oversized message accepted" << endl;
+			return TestFail;
+		}
+
+		size_t length;
+		if (consumer_.reserve(16) || producer_.front(&length)) {
+			cerr << "Ring used in the wrong direction" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Exercise wrap-around with messages of varying sizes, working
+		 * in lockstep between the producer and the consumer.
+		 */
+		for (unsigned int i = 0; i < 1000; ++i) {
+			unsigned int size = (i * 37) % 1500 + 1;
+
+			if (send(size, i)) {
+				cerr << "Failed to send message " << i << endl;
+				return TestFail;
+			}
+
+			if (receive(size, i)) {
+				cerr << "Failed to receive message " << i << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * Fill the ring and check that it is drained in order. Messages
+		 * take 104 bytes with their header, and the end of the ring may
+		 * be skipped once.
+		 */
+		unsigned int count = 0;
+		while (!send(100, count))
+			count++;
+
+		if (count < 4096 / 104 - 1 || count > 4096 / 104) {
+			cerr << "Ring holds " << count << " messages" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < count; ++i) {
+			if (receive(100, i)) {
+				cerr << "Failed to drain message " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (consumer_.front(&length)) {
+			cerr << "Ring not empty after draining" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The consumer is notified once for a batch of messages sent
+		 * while it doesn't run.
+		 */
+		notifications_ = 0;
+		received_ = 0;
+
+		for (unsigned int i = 0; i < 10; ++i)
+			send(64, i);
+
+		Timer timer;
+		timer.start(100);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (notifications_ != 1 || received_ != 10) {
+			cerr << "Received " << received_ << " messages in "
+			     << notifications_ << " notifications" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	void readyRead(IPCRing *ring)
+	{
+		notifications_++;
+
+		while (!receive(64, received_))
+			received_++;
+	}
+
+	IPCRing producer_;
+	IPCRing consumer_;
+
+	unsigned int notifications_;
+	unsigned int received_;
+};
+
+TEST_REGISTER(RingTest)
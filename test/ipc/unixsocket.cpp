@@ -298,6 +298,35 @@ protected:
 		return 0;
 	}
 
+	int testBatch()
+	{
+		std::vector<IPCUnixSocket::Payload> messages(10);
+
+		for (unsigned int i = 0; i < messages.size(); ++i) {
+			IPCUnixSocket::Payload &message = messages[i];
+			int size;
+
+			size = prepareFDs(&message, i % 3);
+			if (size < 0)
+				return size;
+
+			message.data.resize(1 + sizeof(size));
+			message.data[0] = CMD_LEN_CMP;
+			memcpy(message.data.data() + 1, &size, sizeof(size));
+		}
+
+		if (ipc_.send(messages) != static_cast<int>(messages.size()))
+			return TestFail;
+
+		for (IPCUnixSocket::Payload &message : messages) {
+			for (int fd : message.fds)
+				close(fd);
+		}
+
+		/* The slave stops on comparison failures, check it's alive. */
+		return testReverse();
+	}
+
 	int testFdOrder()
 	{
 		IPCUnixSocket::Payload message, response;
@@ -392,6 +421,12 @@ protected:
 			return TestFail;
 		}
 
+		/* Test sending a batch of messages. */
+		if (testBatch()) {
+			cerr << "Batch test failed" << endl;
+			return TestFail;
+		}
+
 		/* Test order of file descriptors. */
 		if (testFdOrder()) {
 			cerr << "fd order test failed" << endl;
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * latency-histogram.cpp - Latency histogram tests
+ */
+
+#include <iostream>
+
+#include <libcamera/latency.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class LatencyHistogramTest : public Test
+{
+protected:
+	int run()
+	{
+		LatencyHistogram histogram;
+
+		if (histogram.samples() || histogram.max() ||
+		    histogram.percentile(99)) {
+			cout << "Histogram not empty at construction" << endl;
+			return TestFail;
+		}
+
+		/* 98 samples of 10µs, one of 100µs and one of 10ms. */
+		for (unsigned int i = 0; i < 98; ++i)
+			histogram.add(10000);
+		histogram.add(100000);
+		histogram.add(10000000);
+
+		if (histogram.samples() != 100 || histogram.max() != 10000000) {
+			cout << "Invalid samples count or maximum" << endl;
+			return TestFail;
+		}
+
+		/* 10µs falls in the [8, 16[ µs bucket. */
+		if (histogram.bucket(4) != 98) {
+			cout << "Invalid bucket count " << histogram.bucket(4)
+			     << endl;
+			return TestFail;
+		}
+
+		if (histogram.percentile(50) != 16000 ||
+		    histogram.percentile(98) != 16000 ||
+		    histogram.percentile(99) != 128000 ||
+		    histogram.percentile(100) != 10000000) {
+			cout << "Invalid percentiles: "
+			     << histogram.percentile(50) << " "
+			     << histogram.percentile(98) << " "
+			     << histogram.percentile(99) << " "
+			     << histogram.percentile(100) << endl;
+			return TestFail;
+		}
+
+		/* Sub-microsecond and huge samples land in the edge buckets. */
+		histogram.add(500);
+		histogram.add(UINT64_MAX);
+		if (histogram.bucket(0) != 1 ||
+		    histogram.bucket(LatencyHistogram::NUM_BUCKETS - 1) != 1) {
+			cout << "Invalid edge buckets" << endl;
+			return TestFail;
+		}
+
+		histogram.reset();
+		if (histogram.samples() || histogram.max() || histogram.bucket(4)) {
+			cout << "Histogram not empty after reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(LatencyHistogramTest)
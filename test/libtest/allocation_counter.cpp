@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * allocation_counter.cpp - Heap allocations counter for tests
+ */
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+void *allocate(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	return malloc(size ? size : 1);
+}
+
+} /* namespace */
+
+AllocationCounter::AllocationCounter()
+{
+	reset();
+}
+
+/* Restart counting from the current number of allocations. */
+void AllocationCounter::reset()
+{
+	start_ = total();
+}
+
+/* Return the number of allocations since the last reset. */
+uint64_t AllocationCounter::count() const
+{
+	return total() - start_;
+}
+
+/* Return the number of allocations since the process started. */
+uint64_t AllocationCounter::total()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+	void *ptr = allocate(size);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	free(ptr);
+}
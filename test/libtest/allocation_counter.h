@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * allocation_counter.h - Heap allocations counter for tests
+ */
+#ifndef __TEST_ALLOCATION_COUNTER_H__
+#define __TEST_ALLOCATION_COUNTER_H__
+
+#include <stdint.h>
+
+/*
+ * Count the heap allocations of the whole process, including the ones
+ * performed by libcamera, by replacing the global allocation operators. The
+ * replacement operators are only linked in the tests that use this class.
+ */
+class AllocationCounter
+{
+public:
+	AllocationCounter();
+
+	void reset();
+	uint64_t count() const;
+
+	static uint64_t total();
+
+private:
+	uint64_t start_;
+};
+
+#endif /* __TEST_ALLOCATION_COUNTER_H__ */
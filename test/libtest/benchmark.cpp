@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.cpp - libcamera micro-benchmark base class
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace {
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *str = getenv(name);
+	if (!str)
+		return defaultValue;
+
+	char *end;
+	unsigned long value = strtoul(str, &end, 10);
+	if (*end != '\0' || !value)
+		return defaultValue;
+
+	return value;
+}
+
+} /* namespace */
+
+constexpr Benchmark::Duration Benchmark::MinSampleTime;
+
+Benchmark::Benchmark(const std::string &name)
+	: name_(name)
+{
+	samples_ = envValue("LIBCAMERA_BENCHMARK_SAMPLES", 100);
+	warmup_ = std::max(samples_ / 10, 1U);
+}
+
+int Benchmark::run()
+{
+	int ret = benchmark();
+	if (ret)
+		return ret;
+
+	std::string result = report();
+	cout << result;
+
+	const char *output = getenv("LIBCAMERA_BENCHMARK_OUTPUT");
+	if (output) {
+		std::ofstream file(output);
+		file << result;
+		if (!file) {
+			cout << "Failed to write " << output << endl;
+			return TestFail;
+		}
+	}
+
+	return TestPass;
+}
+
+void Benchmark::addResult(const std::string &name, unsigned int iterations,
+			  std::vector<uint64_t> &samples)
+{
+	std::sort(samples.begin(), samples.end());
+
+	auto percentile = [&](unsigned int percent) {
+		size_t index = (samples.size() - 1) * percent / 100;
+		return static_cast<double>(samples[index]) / iterations;
+	};
+
+	Result result;
+	result.name = name;
+	result.iterations = iterations;
+	result.samples = samples.size();
+	result.min = percentile(0);
+	result.median = percentile(50);
+	result.p99 = percentile(99);
+
+	results_.push_back(result);
+}
+
+std::string Benchmark::report() const
+{
+	std::stringstream json;
+	json << "{" << endl
+	     << "  \"benchmark\": \"" << name_ << "\"," << endl
+	     << "  \"results\": [" << endl;
+
+	for (unsigned int i = 0; i < results_.size(); ++i) {
+		const Result &result = results_[i];
+
+		json << "    {" << endl
+		     << "      \"name\": \"" << result.name << "\"," << endl
+		     << "      \"iterations\": " << result.iterations << "," << endl
+		     << "      \"samples\": " << result.samples << "," << endl
+		     << "      \"min_ns\": " << result.min << "," << endl
+		     << "      \"median_ns\": " << result.median << "," << endl
+		     << "      \"p99_ns\": " << result.p99 << endl
+		     << "    }" << (i + 1 < results_.size() ? "," : "") << endl;
+	}
+
+	json << "  ]" << endl
+	     << "}" << endl;
+
+	return json.str();
+}
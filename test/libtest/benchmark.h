@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.h - libcamera micro-benchmark base class
+ */
+#ifndef __TEST_BENCHMARK_H__
+#define __TEST_BENCHMARK_H__
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+/*
+ * Base class for micro-benchmarks. Derived classes implement benchmark() and
+ * call measure() for each operation to time. The number of iterations per
+ * sample is doubled until a sample lasts long enough to be timed accurately,
+ * and the samples are taken after a warmup period. The results are printed as
+ * JSON, and written to the LIBCAMERA_BENCHMARK_OUTPUT file when set. The
+ * number of samples can be set with LIBCAMERA_BENCHMARK_SAMPLES.
+ */
+class Benchmark : public Test
+{
+public:
+	Benchmark(const std::string &name);
+
+protected:
+	int run() override;
+	virtual int benchmark() = 0;
+
+	template<typename Func>
+	void measure(const std::string &name, Func func)
+	{
+		unsigned int iterations = 1;
+		while (iterations < MaxIterations &&
+		       sample(func, iterations) < MinSampleTime)
+			iterations *= 2;
+
+		for (unsigned int i = 0; i < warmup_; ++i)
+			sample(func, iterations);
+
+		std::vector<uint64_t> samples;
+		samples.reserve(samples_);
+
+		for (unsigned int i = 0; i < samples_; ++i)
+			samples.push_back(sample(func, iterations).count());
+
+		addResult(name, iterations, samples);
+	}
+
+private:
+	using Duration = std::chrono::nanoseconds;
+
+	static constexpr Duration MinSampleTime{ 100000 };
+	static constexpr unsigned int MaxIterations = 1 << 20;
+
+	struct Result {
+		std::string name;
+		unsigned int iterations;
+		unsigned int samples;
+		double min;
+		double median;
+		double p99;
+	};
+
+	template<typename Func>
+	static Duration sample(Func &func, unsigned int iterations)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < iterations; ++i)
+			func();
+
+		auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration_cast<Duration>(end - start);
+	}
+
+	void addResult(const std::string &name, unsigned int iterations,
+		       std::vector<uint64_t> &samples);
+	std::string report() const;
+
+	std::string name_;
+	unsigned int warmup_;
+	unsigned int samples_;
+	std::vector<Result> results_;
+};
+
+#endif /* __TEST_BENCHMARK_H__ */
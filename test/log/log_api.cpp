@@ -115,6 +115,38 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testDisabled()
+	{
+		unsigned int count = 0;
+
+		logSetTarget(LoggingTargetNone);
+
+		/* Operands of disabled messages must not be evaluated. */
+		logSetLevel("LogAPITest", "WARN");
+		LOG(LogAPITest, Debug) << "bad " << ++count;
+		LOG(LogAPITest, Info) << "bad " << ++count;
+
+		if (count != 0) {
+			cerr << "Disabled log message evaluated" << endl;
+			return TestFail;
+		}
+
+		LOG(LogAPITest, Warning) << "good " << ++count;
+
+		if (count != 1) {
+			cerr << "Enabled log message not evaluated" << endl;
+			return TestFail;
+		}
+
+		/* The macro must be usable as the body of an if statement. */
+		if (count == 1)
+			LOG(LogAPITest, Info) << "bad";
+		else
+			return TestFail;
+
+		return TestPass;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -140,6 +172,10 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testDisabled();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * log_async.cpp - Asynchronous logging test
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/logging.h>
+
+#include "log.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(LogAsyncTest)
+
+namespace {
+
+/*
+ * Stream buffer that blocks the first write until released, to stall the
+ * background writer thread.
+ */
+class BlockingBuffer : public std::stringbuf
+{
+public:
+	BlockingBuffer()
+		: blocked_(false), released_(false)
+	{
+	}
+
+	bool blocked() const { return blocked_; }
+
+	void release()
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		released_ = true;
+		cv_.notify_all();
+	}
+
+protected:
+	std::streamsize xsputn(const char *s, std::streamsize count) override
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		blocked_ = true;
+		cv_.wait(locker, [&] { return released_; });
+		locker.unlock();
+
+		return std::stringbuf::xsputn(s, count);
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::atomic<bool> blocked_;
+	bool released_;
+};
+
+} /* namespace */
+
+class LogAsyncTest : public Test
+{
+protected:
+	int init() override
+	{
+		logSetLevel("LogAsyncTest", "INFO");
+		return TestPass;
+	}
+
+	int testThreads()
+	{
+		static constexpr unsigned int NumThreads = 4;
+		static constexpr unsigned int NumMessages = 200;
+
+		stringstream log;
+		logSetStream(&log);
+		logSetAsync(true);
+
+		vector<thread> threads;
+		for (unsigned int i = 0; i < NumThreads; ++i) {
+			threads.emplace_back([i]() {
+				for (unsigned int j = 0; j < NumMessages; ++j)
+					LOG(LogAsyncTest, Info)
+						<< "thread " << i << " message " << j;
+			});
+		}
+
+		for (thread &t : threads)
+			t.join();
+
+		/* Disabling asynchronous logging writes queued messages. */
+		logSetAsync(false);
+		logSetTarget(LoggingTargetNone);
+
+		/* Messages from each thread must be output in order. */
+		vector<unsigned int> next(NumThreads, 0);
+		string line;
+		while (getline(log, line)) {
+			unsigned int thread, message;
+			size_t pos = line.find("thread ");
+			if (pos == string::npos ||
+			    sscanf(line.c_str() + pos, "thread %u message %u",
+				   &thread, &message) != 2 ||
+			    thread >= NumThreads) {
+				cout << "Invalid log line: " << line << endl;
+				return TestFail;
+			}
+
+			if (message != next[thread]) {
+				cout << "Thread " << thread << " message " << message
+				     << " out of order" << endl;
+				return TestFail;
+			}
+
+			next[thread]++;
+		}
+
+		for (unsigned int i = 0; i < NumThreads; ++i) {
+			if (next[i] != NumMessages) {
+				cout << "Thread " << i << " logged " << next[i]
+				     << " messages" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testOverflow()
+	{
+		static constexpr unsigned int NumMessages = 5000;
+
+		BlockingBuffer buffer;
+		ostream log(&buffer);
+		logSetStream(&log);
+		logSetAsync(true);
+
+		/* Stall the writer thread on the first message. */
+		LOG(LogAsyncTest, Info) << "message 0";
+		while (!buffer.blocked())
+			this_thread::yield();
+
+		for (unsigned int i = 1; i < NumMessages; ++i)
+			LOG(LogAsyncTest, Info) << "message " << i;
+
+		buffer.release();
+		logSetAsync(false);
+		logSetTarget(LoggingTargetNone);
+
+		/*
+		 * The ring overflows, all messages must be accounted for as
+		 * either output or dropped.
+		 */
+		istringstream output(buffer.str());
+		unsigned int messages = 0;
+		unsigned int dropped = 0;
+		string line;
+		while (getline(output, line)) {
+			size_t pos = line.find(" log messages dropped");
+			if (pos != string::npos) {
+				size_t start = line.rfind(' ', pos - 1) + 1;
+				dropped += stoul(line.substr(start, pos - start));
+				continue;
+			}
+
+			if (line.find("message ") == string::npos) {
+				cout << "Invalid log line: " << line << endl;
+				return TestFail;
+			}
+
+			messages++;
+		}
+
+		if (!dropped || messages + dropped != NumMessages) {
+			cout << messages << " messages output, " << dropped
+			     << " dropped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testThreads() != TestPass)
+			return TestFail;
+
+		if (testOverflow() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(LogAsyncTest)
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * m2m-converter.cpp - V4L2 M2M converter tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+
+#include <libcamera/buffer.h>
+
+#include "device_enumerator.h"
+#include "m2m_converter.h"
+#include "test.h"
+#include "v4l2_videodevice.h"
+
+using namespace std;
+using namespace libcamera;
+
+class M2MConverterTest : public Test
+{
+protected:
+	int init()
+	{
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_) {
+			cout << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cout << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		converter_ = M2MConverter::create(enumerator_.get());
+		if (!converter_) {
+			cout << "No M2M converter found" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (converter_->inputFormats().empty() ||
+		    converter_->outputFormats().empty()) {
+			cout << "No converter formats" << endl;
+			return TestFail;
+		}
+
+		unsigned int fourcc = converter_->outputFormats().front();
+		SizeRange range = converter_->outputSizes(fourcc);
+		if (!range.max.width || !range.max.height) {
+			cout << "No output sizes for the first format" << endl;
+			return TestFail;
+		}
+
+		if (converter_->outputSizes(0).max.width) {
+			cout << "Output sizes for an invalid format" << endl;
+			return TestFail;
+		}
+
+		/* Convert from the first input format to the first output format. */
+		V4L2DeviceFormat input = {};
+		input.fourcc = converter_->inputFormats().front();
+		input.size = range.max;
+
+		V4L2DeviceFormat output = {};
+		output.fourcc = fourcc;
+		output.size = range.max;
+
+		if (!converter_->supports(input.fourcc, input.size, output.fourcc,
+					  output.size))
+			return TestSkip;
+
+		if (converter_->configure(input, &output)) {
+			cout << "Failed to configure the converter" << endl;
+			return TestFail;
+		}
+
+		if (!output.planes[0].size) {
+			cout << "Output plane size not reported" << endl;
+			return TestFail;
+		}
+
+		if (converter_->configure(input, &output, 45) != -EINVAL) {
+			cout << "Invalid rotation accepted" << endl;
+			return TestFail;
+		}
+
+		BufferPool pool;
+		pool.createBuffers(2);
+		if (converter_->exportOutputBuffers(&pool)) {
+			cout << "Failed to export output buffers" << endl;
+			return TestFail;
+		}
+
+		converter_->releaseBuffers();
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		converter_.reset();
+	}
+
+private:
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::unique_ptr<M2MConverter> converter_;
+};
+
+TEST_REGISTER(M2MConverterTest)
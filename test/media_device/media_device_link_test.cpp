@@ -210,6 +210,65 @@ class MediaDeviceLinkTest : public MediaDeviceTest
 			return TestFail;
 		}
 
+		/*
+		 * Set up links exclusively, and verify the requested link is
+		 * enabled and all the other ones are disabled.
+		 */
+		MediaLink *other = media_->link("Debayer A", 1, "Scaler", 0);
+		if (other->setEnabled(true)) {
+			cerr << "Failed to enable link 'Debayer A':[1] -> 'Scaler':[0]"
+			     << endl;
+			return TestFail;
+		}
+
+		if (media_->setupLinks({ { link, true } }, true)) {
+			cerr << "Failed to set up link " << linkName << endl;
+			return TestFail;
+		}
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED) ||
+		    other->flags() & MEDIA_LNK_FL_ENABLED) {
+			cerr << "Exclusive link setup didn't apply the requested"
+			     << " link states" << endl;
+			return TestFail;
+		}
+
+		/* Setting up the same links again shall be a no-op. */
+		if (media_->setupLinks({ { link, true } }, true)) {
+			cerr << "Failed to set up link " << linkName
+			     << " a second time" << endl;
+			return TestFail;
+		}
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED)) {
+			cerr << "Link " << linkName
+			     << " was disabled by a redundant link setup" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Populating the media device again with an unchanged topology
+		 * shall keep the existing media graph.
+		 */
+		media_->release();
+
+		if (media_->populate()) {
+			cerr << "Failed to populate media device again" << endl;
+			return TestFail;
+		}
+
+		if (media_->getEntityByName("Debayer A") != source ||
+		    media_->link("Debayer A", 1, "Scaler", 0) != link) {
+			cerr << "Media graph not reused for unchanged topology"
+			     << endl;
+			return TestFail;
+		}
+
+		if (!media_->acquire()) {
+			cerr << "Unable to acquire media device again" << endl;
+			return TestFail;
+		}
+
 		return 0;
 	}
 
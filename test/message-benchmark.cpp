@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * message-benchmark.cpp - Message posting and dispatching benchmark
+ */
+
+#include <libcamera/object.h>
+
+#include "benchmark.h"
+#include "message.h"
+#include "thread.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class MessageReceiver : public Object
+{
+public:
+	MessageReceiver()
+		: received_(0)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+
+protected:
+	void message(Message *msg) override
+	{
+		if (msg->type() == Message::None)
+			received_++;
+	}
+
+private:
+	unsigned int received_;
+};
+
+class MessageBenchmark : public Benchmark
+{
+public:
+	MessageBenchmark()
+		: Benchmark("message")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		Thread *thread = Thread::current();
+		MessageReceiver receiver;
+
+		measure("post-dispatch", [&]() {
+			receiver.postMessage(utils::make_unique<Message>(Message::None));
+			thread->dispatchMessages();
+		});
+
+		measure("post-dispatch-16", [&]() {
+			for (unsigned int i = 0; i < 16; ++i)
+				receiver.postMessage(utils::make_unique<Message>(Message::None));
+			thread->dispatchMessages();
+		});
+
+		measure("post-dispatch-receiver", [&]() {
+			receiver.postMessage(utils::make_unique<Message>(Message::None));
+			thread->dispatchMessages(&receiver);
+		});
+
+		return receiver.received() ? TestPass : TestFail;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(MessageBenchmark)
@@ -8,6 +8,7 @@
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include "message.h"
 #include "thread.h"
@@ -47,6 +48,53 @@ private:
 	Status status_;
 };
 
+class SequenceMessage : public Message
+{
+public:
+	SequenceMessage(Message::Type type, unsigned int producer,
+			unsigned int sequence)
+		: Message(type), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class SequenceReceiver : public Object
+{
+public:
+	SequenceReceiver(Message::Type type, unsigned int producers)
+		: type_(type), next_(producers, 0), received_(0),
+		  outOfOrder_(false)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+	bool outOfOrder() const { return outOfOrder_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != type_)
+			return;
+
+		SequenceMessage *seq = static_cast<SequenceMessage *>(msg);
+
+		if (seq->sequence_ != next_[seq->producer_])
+			outOfOrder_ = true;
+
+		next_[seq->producer_] = seq->sequence_ + 1;
+		received_++;
+	}
+
+private:
+	Message::Type type_;
+	std::vector<unsigned int> next_;
+	std::atomic<unsigned int> received_;
+	bool outOfOrder_;
+};
+
 class MessageTest : public Test
 {
 protected:
@@ -83,6 +131,67 @@ protected:
 			break;
 		}
 
+		/* Dispatch the messages of a single receiver. */
+		MessageReceiver first;
+		MessageReceiver second;
+
+		second.postMessage(utils::make_unique<Message>(Message::None));
+		first.postMessage(utils::make_unique<Message>(Message::None));
+
+		Thread::current()->dispatchMessages(&first);
+
+		if (first.status() != MessageReceiver::MessageReceived ||
+		    second.status() != MessageReceiver::NoMessage) {
+			cout << "Failed to dispatch messages for one receiver" << endl;
+			return TestFail;
+		}
+
+		Thread::current()->dispatchMessages();
+
+		if (second.status() != MessageReceiver::MessageReceived) {
+			cout << "Message left pending after selective dispatch" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Post messages concurrently from multiple threads, and check
+		 * that they are all delivered in posting order for each thread.
+		 */
+		const unsigned int producers = 4;
+		const unsigned int count = 10000;
+
+		Message::Type seqType = Message::registerMessageType();
+		SequenceReceiver seqReceiver(seqType, producers);
+		seqReceiver.moveToThread(&thread_);
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < producers; ++i) {
+			threads.emplace_back([&seqReceiver, seqType, i]() {
+				for (unsigned int j = 0; j < count; ++j)
+					seqReceiver.postMessage(utils::make_unique<SequenceMessage>(seqType, i, j));
+			});
+		}
+
+		for (std::thread &thread : threads)
+			thread.join();
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (seqReceiver.received() == producers * count)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		if (seqReceiver.received() != producers * count) {
+			cout << "Received " << seqReceiver.received() << " of "
+			     << producers * count << " messages" << endl;
+			return TestFail;
+		}
+
+		if (seqReceiver.outOfOrder()) {
+			cout << "Messages received out of order" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
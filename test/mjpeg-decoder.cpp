@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mjpeg-decoder.cpp - MJPEG decoder tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <jpeglib.h>
+#include <linux/videodev2.h>
+
+#include "mjpeg_decoder.h"
+#include "test.h"
+#include "v4l2_videodevice.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int WIDTH = 64;
+constexpr unsigned int HEIGHT = 32;
+
+/* Encode a frame with a luma gradient and constant chroma. */
+std::vector<uint8_t> encodeFrame()
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *data = nullptr;
+	unsigned long size = 0;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &data, &size);
+
+	cinfo.image_width = WIDTH;
+	cinfo.image_height = HEIGHT;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 100, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	std::vector<uint8_t> row(WIDTH * 3);
+	while (cinfo.next_scanline < HEIGHT) {
+		for (unsigned int x = 0; x < WIDTH; ++x) {
+			row[x * 3] = x * 4;
+			row[x * 3 + 1] = 96;
+			row[x * 3 + 2] = 160;
+		}
+
+		JSAMPROW rows[1] = { row.data() };
+		jpeg_write_scanlines(&cinfo, rows, 1);
+	}
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	std::vector<uint8_t> frame(data, data + size);
+	free(data);
+
+	return frame;
+}
+
+bool near(unsigned int value, unsigned int expected)
+{
+	return abs(static_cast<int>(value) - static_cast<int>(expected)) <= 6;
+}
+
+} /* namespace */
+
+class MjpegDecoderTest : public Test
+{
+protected:
+	int run()
+	{
+		const std::vector<uint8_t> frame = encodeFrame();
+		MjpegDecoder decoder;
+		V4L2DeviceFormat format;
+		int ret;
+
+		if (decoder.configure({ WIDTH, HEIGHT }, V4L2_PIX_FMT_MJPEG,
+				      &format) != -EINVAL) {
+			cout << "Invalid output format accepted" << endl;
+			return TestFail;
+		}
+
+		/* Decode to YUYV. */
+		ret = decoder.configure({ WIDTH, HEIGHT }, V4L2_PIX_FMT_YUYV,
+					&format);
+		if (ret || format.planes[0].size != WIDTH * HEIGHT * 2) {
+			cout << "Failed to configure YUYV output" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> yuyv(format.planes[0].size);
+		ret = decoder.decode(frame.data(), frame.size(), yuyv.data(),
+				     yuyv.size());
+		if (ret != static_cast<int>(yuyv.size())) {
+			cout << "Failed to decode to YUYV: " << ret << endl;
+			return TestFail;
+		}
+
+		const uint8_t *pixel = &yuyv[(HEIGHT / 2 * WIDTH + 16) * 2];
+		if (!near(pixel[0], 64) || !near(pixel[1], 96) ||
+		    !near(pixel[2], 68) || !near(pixel[3], 160)) {
+			cout << "Invalid YUYV pixel values" << endl;
+			return TestFail;
+		}
+
+		if (decoder.decode(frame.data(), frame.size(), yuyv.data(),
+				   yuyv.size() - 1) != -ENOSPC) {
+			cout << "Short output buffer not detected" << endl;
+			return TestFail;
+		}
+
+		/* Decode to NV12. */
+		ret = decoder.configure({ WIDTH, HEIGHT }, V4L2_PIX_FMT_NV12,
+					&format);
+		if (ret || format.planes[0].size != WIDTH * HEIGHT * 3 / 2) {
+			cout << "Failed to configure NV12 output" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> nv12(format.planes[0].size);
+		ret = decoder.decode(frame.data(), frame.size(), nv12.data(),
+				     nv12.size());
+		if (ret != static_cast<int>(nv12.size())) {
+			cout << "Failed to decode to NV12: " << ret << endl;
+			return TestFail;
+		}
+
+		const uint8_t *uv = &nv12[WIDTH * HEIGHT + HEIGHT / 4 * WIDTH + 16];
+		if (!near(nv12[HEIGHT / 2 * WIDTH + 16], 64) ||
+		    !near(uv[0], 96) || !near(uv[1], 160)) {
+			cout << "Invalid NV12 pixel values" << endl;
+			return TestFail;
+		}
+
+		/* Frame size mismatch and corrupted frames. */
+		ret = decoder.configure({ WIDTH * 2, HEIGHT }, V4L2_PIX_FMT_NV12,
+					&format);
+		nv12.resize(format.planes[0].size);
+		if (ret || decoder.decode(frame.data(), frame.size(), nv12.data(),
+					  nv12.size()) != -EINVAL) {
+			cout << "Frame size mismatch not detected" << endl;
+			return TestFail;
+		}
+
+		decoder.configure({ WIDTH, HEIGHT }, V4L2_PIX_FMT_NV12, &format);
+
+		std::vector<uint8_t> corrupted(frame.begin(),
+					       frame.begin() + frame.size() / 4);
+		if (decoder.decode(corrupted.data(), corrupted.size(),
+				   nv12.data(), nv12.size()) != -EINVAL) {
+			cout << "Truncated frame not detected" << endl;
+			return TestFail;
+		}
+
+		corrupted = frame;
+		corrupted[1] = 0x00;
+		if (decoder.decode(corrupted.data(), corrupted.size(),
+				   nv12.data(), nv12.size()) != -EINVAL) {
+			cout << "Invalid frame not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MjpegDecoderTest)
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * object-invoke-benchmark.cpp - Object method invocation benchmark
+ */
+
+#include <array>
+#include <string>
+
+#include <libcamera/object.h>
+
+#include "benchmark.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class InvokedObject : public Object
+{
+public:
+	InvokedObject()
+		: calls_(0), peer_(nullptr)
+	{
+	}
+
+	unsigned int calls() const { return calls_; }
+	void setPeer(InvokedObject *peer) { peer_ = peer; }
+
+	void method(int value)
+	{
+		calls_ += value;
+	}
+
+	void methodLarge(std::string str, std::array<uint8_t, 256> data)
+	{
+		calls_ += data[0];
+	}
+
+	void ping(int value)
+	{
+		peer_->invokeMethod(&InvokedObject::method, value);
+	}
+
+private:
+	unsigned int calls_;
+	InvokedObject *peer_;
+};
+
+class ObjectInvokeBenchmark : public Benchmark
+{
+public:
+	ObjectInvokeBenchmark()
+		: Benchmark("object-invoke")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		Thread *current = Thread::current();
+		InvokedObject object;
+
+		measure("invoke-same-thread", [&]() {
+			object.invokeMethod(&InvokedObject::method, 1);
+			current->dispatchMessages();
+		});
+
+		std::string str("a string argument beyond the small string size");
+		std::array<uint8_t, 256> data;
+		data.fill(1);
+
+		measure("invoke-same-thread-large", [&]() {
+			object.invokeMethod(&InvokedObject::methodLarge, str, data);
+			current->dispatchMessages();
+		});
+
+		/*
+		 * Round trip to an object in another thread, which invokes a
+		 * method back in the current thread.
+		 */
+		InvokedObject remote;
+		remote.setPeer(&object);
+		remote.moveToThread(&thread_);
+		thread_.start();
+
+		/*
+		 * Spin on the message queue, as processing events would block
+		 * in the event dispatcher after dispatching the reply.
+		 */
+		measure("invoke-round-trip", [&]() {
+			unsigned int calls = object.calls();
+			remote.invokeMethod(&InvokedObject::ping, 1);
+			while (object.calls() == calls)
+				current->dispatchMessages();
+		});
+
+		thread_.exit(0);
+		thread_.wait();
+
+		return object.calls() ? TestPass : TestFail;
+	}
+
+private:
+	Thread thread_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ObjectInvokeBenchmark)
@@ -5,13 +5,16 @@
  * object-invoke.cpp - Cross-thread Object method invocation test
  */
 
+#include <array>
 #include <chrono>
 #include <iostream>
+#include <string>
 #include <thread>
 
 #include <libcamera/event_dispatcher.h>
 #include <libcamera/object.h>
 
+#include "allocation_counter.h"
 #include "test.h"
 #include "thread.h"
 
@@ -50,9 +53,19 @@ public:
 		value_ = value;
 	}
 
+	void methodLarge(std::string str, std::array<uint8_t, 256> data)
+	{
+		str_ = str;
+		status_ = CallReceived;
+		value_ = data[255];
+	}
+
+	const std::string &str() const { return str_; }
+
 private:
 	Status status_;
 	int value_;
+	std::string str_;
 };
 
 class ObjectInvokeTest : public Test
@@ -120,9 +133,67 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Once the message pool has been primed, cross-thread method
+		 * invocation shall not allocate memory, neither in the calling
+		 * thread nor in the thread the method is invoked in.
+		 */
+		AllocationCounter allocations;
+
+		for (int i = 1; i <= 10; ++i) {
+			object.reset();
+
+			object.invokeMethod(&InvokedObject::method, i);
+
+			if (waitForCall(object))
+				return TestFail;
+
+			if (object.value() != i) {
+				cout << "Method invoked with incorrect value " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (allocations.count()) {
+			cout << "Method invocation allocated memory "
+			     << allocations.count() << " times" << endl;
+			return TestFail;
+		}
+
+		/* Arguments too large to be stored inline shall be handled. */
+		std::string str(1000, 'x');
+		std::string arg(str);
+		std::array<uint8_t, 256> data;
+		data.fill(42);
+
+		object.reset();
+		object.invokeMethod(&InvokedObject::methodLarge, arg, data);
+		arg.clear();
+
+		if (waitForCall(object))
+			return TestFail;
+
+		if (object.str() != str || object.value() != 42) {
+			cout << "Method invoked with incorrect large arguments" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
+	int waitForCall(const InvokedObject &object)
+	{
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (object.status() != InvokedObject::NoCall)
+				return 0;
+
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		cout << "Method not invoked for custom thread" << endl;
+		return -ETIMEDOUT;
+	}
+
 	void cleanup()
 	{
 		thread_.exit(0);
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * pixel-format-info.cpp - Pixel format information tests
+ */
+
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include "formats.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class PixelFormatInfoTest : public Test
+{
+protected:
+	int check(unsigned int format, const Size &size, unsigned int align,
+		  unsigned int stride, unsigned int frameSize)
+	{
+		const PixelFormatInfo &info = PixelFormatInfo::info(format);
+		if (!info.isValid()) {
+			cout << "No information for format " << format << endl;
+			return TestFail;
+		}
+
+		if (info.stride(size.width, 0, align) != stride ||
+		    info.frameSize(size, align) != frameSize) {
+			cout << "Invalid layout for " << info.name << " "
+			     << size.toString() << ": stride "
+			     << info.stride(size.width, 0, align) << ", size "
+			     << info.frameSize(size, align) << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (PixelFormatInfo::info(0).isValid() ||
+		    PixelFormatInfo::info(V4L2_PIX_FMT_HSV24).isValid()) {
+			cout << "Unknown format reported as valid" << endl;
+			return TestFail;
+		}
+
+		const PixelFormatInfo &nv12 = PixelFormatInfo::info(V4L2_PIX_FMT_NV12);
+		if (nv12.numPlanes() != 2 || nv12.bitsPerPixel != 12 ||
+		    nv12.colourEncoding != PixelFormatInfo::ColourEncodingYUV) {
+			cout << "Invalid NV12 information" << endl;
+			return TestFail;
+		}
+
+		/* Odd sizes round the subsampled planes up. */
+		if (check(V4L2_PIX_FMT_NV12, { 640, 480 }, 1, 640, 640 * 480 * 3 / 2) ||
+		    check(V4L2_PIX_FMT_NV12, { 641, 481 }, 1, 642, 642 * 481 + 642 * 241) ||
+		    check(V4L2_PIX_FMT_YUV420, { 640, 480 }, 1, 640, 640 * 480 * 3 / 2) ||
+		    check(V4L2_PIX_FMT_YUV420, { 640, 480 }, 256, 768,
+			  768 * 480 + 2 * 512 * 240) ||
+		    check(V4L2_PIX_FMT_YUYV, { 1920, 1080 }, 1, 3840, 3840 * 1080) ||
+		    check(V4L2_PIX_FMT_RGB24, { 1920, 1080 }, 64, 5760, 5760 * 1080) ||
+		    check(V4L2_PIX_FMT_SRGGB10P, { 4056, 3040 }, 1, 5070, 5070 * 3040) ||
+		    check(V4L2_PIX_FMT_SBGGR12P, { 4056, 3040 }, 1, 6084, 6084 * 3040))
+			return TestFail;
+
+		/* The IPU3 packs 25 pixels in 32 bytes. */
+		if (check(V4L2_PIX_FMT_IPU3_SGRBG10, { 2592, 1944 }, 64, 3328,
+			  3328 * 1944))
+			return TestFail;
+
+		const PixelFormatInfo &mjpeg = PixelFormatInfo::info(V4L2_PIX_FMT_MJPEG);
+		if (!mjpeg.isValid() || mjpeg.numPlanes() ||
+		    mjpeg.frameSize({ 640, 480 })) {
+			cout << "Invalid MJPEG information" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(PixelFormatInfoTest)
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * plane-mapping.cpp - Plane CPU mapping sharing tests
+ */
+
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class PlaneMappingTest : public Test
+{
+protected:
+	int init()
+	{
+		fd_ = memfd_create("plane-mapping", MFD_CLOEXEC);
+		if (fd_ < 0) {
+			cout << "Failed to create memfd" << endl;
+			return TestSkip;
+		}
+
+		if (ftruncate(fd_, 4096) < 0) {
+			cout << "Failed to resize memfd" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		Plane plane;
+		plane.setDmabuf(fd_, 4096);
+
+		void *mem = plane.mem();
+		if (!mem) {
+			cout << "Failed to map plane" << endl;
+			return TestFail;
+		}
+
+		memset(mem, 0x5a, 4096);
+
+		/* A plane referencing the same memory shall share the mapping. */
+		int fd = dup(fd_);
+		Plane other;
+		other.setDmabuf(fd, 4096);
+		close(fd);
+
+		if (other.mem() != mem) {
+			cout << "Mapping not shared between planes" << endl;
+			return TestFail;
+		}
+
+		/* Copies shall share the mapping and survive the original. */
+		Plane *copy = new Plane(plane);
+		if (copy->mem() != mem || copy->dmabuf() == plane.dmabuf()) {
+			cout << "Invalid plane copy" << endl;
+			delete copy;
+			return TestFail;
+		}
+
+		plane = Plane();
+		other = Plane();
+
+		if (static_cast<unsigned char *>(copy->mem())[4095] != 0x5a) {
+			cout << "Plane copy memory corrupted" << endl;
+			delete copy;
+			return TestFail;
+		}
+
+		/* The mapping shall be reused across setDmabuf() calls. */
+		copy->setDmabuf(fd_, 4096);
+		if (copy->mem() != mem) {
+			cout << "Mapping not reused after setDmabuf()" << endl;
+			delete copy;
+			return TestFail;
+		}
+
+		/* CPU access to memory not backed by a dmabuf shall succeed. */
+		{
+			CpuAccess access(*copy, Plane::AccessReadWrite);
+			if (access.status()) {
+				cout << "Failed to begin CPU access" << endl;
+				delete copy;
+				return TestFail;
+			}
+		}
+
+		delete copy;
+
+		/* Planes with an unknown length shall map the whole memory. */
+		Plane unsized;
+		unsized.setDmabuf(fd_, 0);
+		if (!unsized.mem() || unsized.length() != 4096) {
+			cout << "Failed to map plane with unknown length" << endl;
+			return TestFail;
+		}
+
+		/* Prefaulting shall map the plane, and succeed when mapped. */
+		Plane prefaulted;
+		prefaulted.setDmabuf(fd_, 4096);
+		if (prefaulted.prefault() || prefaulted.prefault() ||
+		    prefaulted.mem() != mem) {
+			cout << "Failed to prefault plane" << endl;
+			return TestFail;
+		}
+
+		/* User pointer planes shall reference the memory as-is. */
+		std::vector<unsigned char> userMem(4096, 0xa5);
+		Plane user;
+		if (user.setUserPtr(userMem.data(), userMem.size()) ||
+		    user.mem() != userMem.data() || user.dmabuf() != -1) {
+			cout << "Failed to set user pointer plane" << endl;
+			return TestFail;
+		}
+
+		Plane userCopy(user);
+		if (!userCopy.isUserPtr() || userCopy.mem() != userMem.data()) {
+			cout << "Invalid user pointer plane copy" << endl;
+			return TestFail;
+		}
+
+		{
+			CpuAccess access(userCopy, Plane::AccessRead);
+			if (access.status()) {
+				cout << "Failed to access user pointer plane" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Switching to a dmabuf shall drop the user pointer. */
+		user.setDmabuf(fd_, 4096);
+		if (user.isUserPtr() || user.mem() != mem) {
+			cout << "User pointer not released by setDmabuf()" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	int fd_;
+};
+
+TEST_REGISTER(PlaneMappingTest)
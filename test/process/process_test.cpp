@@ -5,7 +5,9 @@
  * process_test.cpp - Process test
  */
 
+#include <fcntl.h>
 #include <iostream>
+#include <string.h>
 #include <unistd.h>
 #include <vector>
 
@@ -29,6 +31,28 @@ public:
 
 		return status;
 	}
+
+	/*
+	 * The arguments list the descriptors that must be open, followed by
+	 * a "-" separator and the descriptors that must be closed.
+	 */
+	int checkFds(int argc, char **argv)
+	{
+		bool keep = true;
+
+		for (int i = 2; i < argc; ++i) {
+			if (!strcmp(argv[i], "-")) {
+				keep = false;
+				continue;
+			}
+
+			bool open = fcntl(std::stoi(argv[i]), F_GETFD) != -1;
+			if (open != keep)
+				return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
 };
 
 class ProcessTest : public Test
@@ -42,15 +66,55 @@ public:
 protected:
 	int run()
 	{
-		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
-		Timer timeout;
-
 		int exitCode = 42;
 		vector<std::string> args;
 		args.push_back(to_string(exitCode));
-		proc_.finished.connect(this, &ProcessTest::procFinished);
 
-		int ret = proc_.start("/proc/self/exe", args);
+		if (runChild(args, {}, exitCode))
+			return TestFail;
+
+		/*
+		 * Check that only the requested file descriptors are inherited,
+		 * including the ones before, between and after them.
+		 */
+		int fds[6];
+		for (unsigned int i = 0; i < 6; i += 2) {
+			if (pipe(&fds[i])) {
+				cerr << "failed to create pipes" << endl;
+				return TestFail;
+			}
+		}
+
+		args = { "fds", to_string(fds[1]), to_string(fds[3]), "-",
+			 to_string(fds[0]), to_string(fds[2]), to_string(fds[4]),
+			 to_string(fds[5]) };
+
+		int ret = runChild(args, { fds[3], fds[1], fds[3] }, EXIT_SUCCESS);
+
+		for (int fd : fds)
+			close(fd);
+
+		if (ret) {
+			cerr << "file descriptors not closed correctly" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	int runChild(const vector<std::string> &args, const vector<int> &fds,
+		     int exitCode)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		Process proc;
+		exitStatus_ = Process::NotExited;
+		exitCode_ = -1;
+		proc.finished.connect(this, &ProcessTest::procFinished);
+
+		int ret = proc.start("/proc/self/exe", args, fds);
 		if (ret) {
 			cerr << "failed to start process" << endl;
 			return TestFail;
@@ -74,14 +138,12 @@ protected:
 		return TestPass;
 	}
 
-private:
 	void procFinished(Process *proc, enum Process::ExitStatus exitStatus, int exitCode)
 	{
 		exitStatus_ = exitStatus;
 		exitCode_ = exitCode;
 	}
 
-	Process proc_;
 	enum Process::ExitStatus exitStatus_;
 	int exitCode_;
 };
@@ -92,6 +154,9 @@ private:
  */
 int main(int argc, char **argv)
 {
+	if (argc > 2 && !strcmp(argv[1], "fds"))
+		return ProcessTestChild().checkFds(argc, argv);
+
 	if (argc == 2) {
 		int status = std::stoi(argv[1]);
 		ProcessTestChild child;
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw-unpacker.cpp - Raw unpacker tests
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/raw_unpacker.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* Not a multiple of the vector and block sizes, to exercise the scalar tail. */
+constexpr unsigned int WIDTH = 78;
+constexpr unsigned int HEIGHT = 6;
+
+enum Packing {
+	Unpacked8,
+	Unpacked16,
+	Csi2Packed,
+	Ipu3Packed,
+};
+
+struct Format {
+	const char *name;
+	unsigned int fourcc;
+	unsigned int bitsPerSample;
+	Packing packing;
+	unsigned int stride;
+};
+
+const Format formats[] = {
+	{ "SRGGB8", V4L2_PIX_FMT_SRGGB8, 8, Unpacked8, WIDTH },
+	{ "SGBRG10", V4L2_PIX_FMT_SGBRG10, 10, Unpacked16, WIDTH * 2 },
+	{ "Y16", V4L2_PIX_FMT_Y16, 16, Unpacked16, WIDTH * 2 + 4 },
+	{ "SGRBG10P", V4L2_PIX_FMT_SGRBG10P, 10, Csi2Packed, 100 },
+	{ "SBGGR12P", V4L2_PIX_FMT_SBGGR12P, 12, Csi2Packed, 117 },
+	{ "IPU3_SRGGB10", V4L2_PIX_FMT_IPU3_SRGGB10, 10, Ipu3Packed, 128 },
+};
+
+const char *implementations[] = { "scalar", "ssse3", "neon" };
+
+/* Pack samples to a frame, one bit at a time for the packed formats. */
+std::vector<uint8_t> pack(const Format &format,
+			  const std::vector<uint16_t> &samples)
+{
+	std::vector<uint8_t> frame(format.stride * HEIGHT);
+
+	for (unsigned int y = 0; y < HEIGHT; ++y) {
+		uint8_t *line = &frame[y * format.stride];
+
+		for (unsigned int x = 0; x < WIDTH; ++x) {
+			uint16_t sample = samples[y * WIDTH + x];
+
+			switch (format.packing) {
+			case Unpacked8:
+				line[x] = sample;
+				break;
+
+			case Unpacked16:
+				line[x * 2] = sample & 0xff;
+				line[x * 2 + 1] = sample >> 8;
+				break;
+
+			case Csi2Packed: {
+				unsigned int group = format.bitsPerSample == 10 ? 4 : 2;
+				unsigned int lsbs = format.bitsPerSample - 8;
+				uint8_t *pixels = line + x / group * (group + 1);
+				unsigned int k = x % group;
+
+				pixels[k] = sample >> lsbs;
+				pixels[group] |= (sample & ((1 << lsbs) - 1)) << (k * lsbs);
+				break;
+			}
+
+			case Ipu3Packed: {
+				uint8_t *block = line + x / 25 * 32;
+				unsigned int bit = x % 25 * 10;
+
+				for (unsigned int i = 0; i < 10; ++i, ++bit) {
+					if (sample & (1 << i))
+						block[bit / 8] |= 1 << (bit % 8);
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	return frame;
+}
+
+} /* namespace */
+
+class RawUnpackerTest : public Test
+{
+protected:
+	int testInvalid()
+	{
+		RawUnpacker unpacker;
+
+		if (unpacker.configure(V4L2_PIX_FMT_NV12, { WIDTH, HEIGHT },
+				       WIDTH) != -EINVAL) {
+			cout << "Invalid format accepted" << endl;
+			return TestFail;
+		}
+
+		if (unpacker.configure(V4L2_PIX_FMT_SRGGB10P, { WIDTH, HEIGHT },
+				       WIDTH * 5 / 4) != -EINVAL) {
+			cout << "Too small stride accepted" << endl;
+			return TestFail;
+		}
+
+		if (RawUnpacker::minimumStride(V4L2_PIX_FMT_IPU3_SBGGR10, 100) != 128 ||
+		    RawUnpacker::minimumStride(V4L2_PIX_FMT_SBGGR12P, 5) != 9 ||
+		    RawUnpacker::minimumStride(V4L2_PIX_FMT_NV12, 100) != 0) {
+			cout << "Invalid minimum stride" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testUnpack(const Format &format, const char *name)
+	{
+		std::vector<uint16_t> samples(WIDTH * HEIGHT);
+		for (uint16_t &sample : samples)
+			sample = rand() & ((1 << format.bitsPerSample) - 1);
+
+		std::vector<uint8_t> src = pack(format, samples);
+
+		RawUnpacker unpacker;
+		if (unpacker.configure(format.fourcc, { WIDTH, HEIGHT },
+				       format.stride)) {
+			cout << "Failed to configure " << format.name << endl;
+			return TestFail;
+		}
+
+		/* Skip implementations not available on this CPU. */
+		if (strcmp(unpacker.implementation(), name))
+			return TestSkip;
+
+		if (unpacker.bitsPerSample() != format.bitsPerSample ||
+		    unpacker.frameSize() != WIDTH * HEIGHT * 2) {
+			cout << "Invalid " << format.name << " frame info" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint16_t> dst(WIDTH * HEIGHT);
+		unpacker.unpack(src.data(), dst.data());
+
+		if (dst != samples) {
+			cout << "Invalid " << format.name << " unpacking with "
+			     << name << " implementation" << endl;
+			return TestFail;
+		}
+
+		/* The buffer is large enough for both the packed and unpacked frames. */
+		std::vector<uint16_t> frame((std::max<size_t>(src.size(), dst.size() * 2) + 1) / 2);
+		memcpy(frame.data(), src.data(), src.size());
+		unpacker.unpack(reinterpret_cast<uint8_t *>(frame.data()));
+		frame.resize(WIDTH * HEIGHT);
+
+		if (frame != samples) {
+			cout << "Invalid " << format.name << " in-place unpacking with "
+			     << name << " implementation" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (testInvalid() != TestPass)
+			return TestFail;
+
+		srand(0);
+
+		for (const char *name : implementations) {
+			setenv("LIBCAMERA_RAW_UNPACKER", name, 1);
+
+			for (const Format &format : formats) {
+				if (testUnpack(format, name) == TestFail)
+					return TestFail;
+			}
+		}
+
+		unsetenv("LIBCAMERA_RAW_UNPACKER");
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(RawUnpackerTest)
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * request-arena.cpp - Request arena allocator tests
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "request_arena.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RequestArenaTest : public Test
+{
+protected:
+	static void destroy(void *object)
+	{
+		destroyed_.push_back(*static_cast<int *>(object));
+	}
+
+	int *create(RequestArena *arena, int value)
+	{
+		int *object = static_cast<int *>(
+			arena->allocate(sizeof(int), alignof(int), &destroy));
+		*object = value;
+		return object;
+	}
+
+	int run()
+	{
+		std::shared_ptr<RequestArenaPool> pool =
+			std::make_shared<RequestArenaPool>();
+
+		{
+			RequestArena arena(pool);
+
+			/* Persistent data survives reset(). */
+			int *persistent = create(&arena, 1);
+			arena.mark();
+
+			create(&arena, 2);
+			create(&arena, 3);
+
+			void *aligned = arena.allocate(64, 64);
+			if (reinterpret_cast<uintptr_t>(aligned) % 64) {
+				cout << "Invalid allocation alignment" << endl;
+				return TestFail;
+			}
+
+			/* Fill more than a block, and allocate a large block. */
+			for (unsigned int i = 0; i < 2048; ++i)
+				arena.allocate(8, 8);
+
+			arena.allocate(RequestArenaPool::BlockSize * 2, 8);
+
+			arena.reset();
+
+			if (destroyed_ != std::vector<int>{ 3, 2 }) {
+				cout << "Objects not destroyed in reverse order"
+				     << endl;
+				return TestFail;
+			}
+
+			if (*persistent != 1) {
+				cout << "Persistent data corrupted" << endl;
+				return TestFail;
+			}
+
+			/* The blocks past the mark are returned to the pool. */
+			if (pool->freeBlocks() < 2) {
+				cout << "Blocks not returned to the pool" << endl;
+				return TestFail;
+			}
+
+			/* Memory is reused after reset(). */
+			unsigned int freeBlocks = pool->freeBlocks();
+
+			for (unsigned int i = 0; i < 2048; ++i)
+				arena.allocate(8, 8);
+
+			if (pool->freeBlocks() >= freeBlocks) {
+				cout << "Blocks not reused from the pool" << endl;
+				return TestFail;
+			}
+
+			destroyed_.clear();
+		}
+
+		if (destroyed_ != std::vector<int>{ 1 }) {
+			cout << "Persistent object not destroyed" << endl;
+			return TestFail;
+		}
+
+		if (pool->freeBlocks() < 3) {
+			cout << "Blocks not released by the arena" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	static std::vector<int> destroyed_;
+};
+
+std::vector<int> RequestArenaTest::destroyed_;
+
+TEST_REGISTER(RequestArenaTest)
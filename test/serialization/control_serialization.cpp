@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * control_serialization.cpp - Serialize and deserialize controls
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlSerializationTest : public Test
+{
+protected:
+	int run()
+	{
+		ControlId exposure(0x00980911, "Exposure", ControlTypeInteger32);
+		ControlId gain(0x009e0903, "Analogue Gain", ControlTypeInteger32);
+		ControlId table(0x00a00001, "Table", ControlTypeUnsigned16);
+
+		ControlInfoMap infoMap{
+			{ &exposure, ControlRange(1, 1000) },
+			{ &gain, ControlRange(16, 256) },
+			{ &table, ControlRange(0, 4095) },
+		};
+
+		ControlSerializer sender;
+		ControlSerializer receiver;
+
+		/* Serialize and deserialize the ControlInfoMap. */
+		vector<uint8_t> infoData(ControlSerializer::binarySize(infoMap));
+		ByteStreamBuffer infoBuffer(infoData.data(), infoData.size());
+
+		if (sender.serialize(infoMap, infoBuffer) ||
+		    infoBuffer.offset() != infoData.size()) {
+			cerr << "Failed to serialize ControlInfoMap" << endl;
+			return TestFail;
+		}
+
+		ByteStreamBuffer infoInput(const_cast<const uint8_t *>(infoData.data()),
+					   infoData.size());
+		ControlInfoMap newInfoMap = receiver.deserialize<ControlInfoMap>(infoInput);
+
+		if (newInfoMap.size() != infoMap.size()) {
+			cerr << "Deserialized ControlInfoMap has wrong size" << endl;
+			return TestFail;
+		}
+
+		for (const auto &info : infoMap) {
+			auto iter = newInfoMap.find(info.first->id());
+			if (iter == newInfoMap.end() ||
+			    iter->first->type() != info.first->type() ||
+			    iter->second.min() != info.second.min() ||
+			    iter->second.max() != info.second.max()) {
+				cerr << "Deserialized ControlInfoMap doesn't match" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Serialize a ControlList from the sender to the receiver. */
+		vector<uint16_t> elements(64);
+		for (unsigned int i = 0; i < elements.size(); ++i)
+			elements[i] = i * 64;
+
+		ControlList list(infoMap);
+		list.set(exposure.id(), ControlValue(500));
+		list.set(gain.id(), ControlValue(32));
+		list.set(table.id(), ControlValue(elements));
+
+		ControlList newList = roundTrip(sender, receiver, list);
+		if (newList.size() != list.size() ||
+		    newList.idmap() != newInfoMap.idmap() ||
+		    newList.get(exposure.id()) != list.get(exposure.id()) ||
+		    newList.get(gain.id()) != list.get(gain.id()) ||
+		    newList.get(table.id()) != list.get(table.id())) {
+			cerr << "Deserialized ControlList doesn't match" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Serialize a ControlList built on a copy of the deserialized
+		 * map back to the sender, and verify it refers to the original
+		 * ControlId instances.
+		 */
+		ControlInfoMap infoCopy = newInfoMap;
+		ControlList reply(infoCopy);
+		reply.set(exposure.id(), ControlValue(800));
+
+		ControlList newReply = roundTrip(receiver, sender, reply);
+		if (newReply.size() != 1 || newReply.idmap() != infoMap.idmap() ||
+		    newReply.begin()->first != &exposure ||
+		    newReply.get(exposure.id()).get<int32_t>() != 800) {
+			cerr << "Deserialized reply doesn't match" << endl;
+			return TestFail;
+		}
+
+		/* Serialize a ControlList of libcamera controls. */
+		ControlList controls(controls::controls);
+		controls.set(controls::AeEnable, true);
+		controls.set(controls::Brightness, 255);
+		controls.set(controls::Contrast, -128);
+
+		ControlList newControls = roundTrip(receiver, sender, controls);
+		if (newControls.size() != 3 ||
+		    newControls.get(controls::AeEnable) != true ||
+		    newControls.get(controls::Brightness) != 255 ||
+		    newControls.get(controls::Contrast) != -128) {
+			cerr << "Deserialized controls don't match" << endl;
+			return TestFail;
+		}
+
+		/* A buffer too small shall be reported as an overflow. */
+		vector<uint8_t> small(ControlSerializer::binarySize(list) - 1);
+		ByteStreamBuffer smallBuffer(small.data(), small.size());
+		if (sender.serialize(list, smallBuffer) != -ENOSPC ||
+		    !smallBuffer.overflow()) {
+			cerr << "Overflow not detected" << endl;
+			return TestFail;
+		}
+
+		/* A list of an unknown ControlInfoMap can't be serialized. */
+		ControlSerializer other;
+		vector<uint8_t> data(ControlSerializer::binarySize(list));
+		ByteStreamBuffer buffer(data.data(), data.size());
+		if (other.serialize(list, buffer) != -ENOENT) {
+			cerr << "List of unknown map shouldn't be serialized" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	ControlList roundTrip(ControlSerializer &from, ControlSerializer &to,
+			      const ControlList &list)
+	{
+		vector<uint8_t> data(ControlSerializer::binarySize(list));
+		ByteStreamBuffer output(data.data(), data.size());
+
+		if (from.serialize(list, output) ||
+		    output.offset() != data.size())
+			return ControlList(controls::controls);
+
+		ByteStreamBuffer input(const_cast<const uint8_t *>(data.data()),
+				       data.size());
+		return to.deserialize<ControlList>(input);
+	}
+};
+
+TEST_REGISTER(ControlSerializationTest)
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_data_serialization.cpp - Serialize and deserialize IPA interface data
+ */
+
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+#include <ipa/ipa_interface.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPADataSerializationTest : public Test
+{
+protected:
+	int init()
+	{
+		fd_ = open("/dev/zero", O_RDONLY);
+		if (fd_ < 0) {
+			cerr << "Failed to open /dev/zero" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		IPADataSerializer sender;
+		IPADataSerializer receiver;
+
+		/* Stream configuration. */
+		map<unsigned int, IPAStream> streams;
+		streams[0] = { 0x56595559, Size(1920, 1080) };
+		streams[3] = { 0x3231564e, Size(640, 480) };
+
+		vector<uint8_t> data(IPADataSerializer::binarySize(streams));
+		ByteStreamBuffer output(data.data(), data.size());
+		if (sender.serialize(streams, output)) {
+			cerr << "Failed to serialize streams" << endl;
+			return TestFail;
+		}
+
+		map<unsigned int, IPAStream> newStreams;
+		ByteStreamBuffer input(const_cast<const uint8_t *>(data.data()),
+				       data.size());
+		if (receiver.deserialize(input, &newStreams) ||
+		    newStreams.size() != 2 ||
+		    newStreams[3].pixelFormat != 0x3231564e ||
+		    newStreams[3].size != Size(640, 480)) {
+			cerr << "Deserialized streams don't match" << endl;
+			return TestFail;
+		}
+
+		/* Buffers, with file descriptors passed out of band. */
+		vector<IPABuffer> buffers(2);
+		for (unsigned int i = 0; i < buffers.size(); ++i) {
+			buffers[i].id = i + 10;
+			buffers[i].memory.planes().resize(2);
+			for (Plane &plane : buffers[i].memory.planes())
+				plane.setDmabuf(fd_, 4096 * (i + 1));
+		}
+
+		vector<int32_t> fds;
+		data.resize(IPADataSerializer::binarySize(buffers));
+		output = ByteStreamBuffer(data.data(), data.size());
+		if (sender.serialize(buffers, output, &fds) || fds.size() != 4) {
+			cerr << "Failed to serialize buffers" << endl;
+			return TestFail;
+		}
+
+		vector<IPABuffer> newBuffers;
+		input = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+					 data.size());
+		if (receiver.deserialize(input, fds, &newBuffers) ||
+		    newBuffers.size() != 2 || newBuffers[1].id != 11 ||
+		    newBuffers[1].memory.planes().size() != 2 ||
+		    newBuffers[1].memory.planes()[1].length() != 8192 ||
+		    newBuffers[1].memory.planes()[1].dmabuf() < 0) {
+			cerr << "Deserialized buffers don't match" << endl;
+			return TestFail;
+		}
+
+		/* Operation data, round-trip benchmark. */
+		IPAOperationData event;
+		event.operation = 3;
+		event.data = { 42, 0x10000 };
+		event.controls.emplace_back(controls::controls);
+
+		ControlList &ctrls = event.controls.back();
+		ctrls.set(controls::AeEnable, true);
+		ctrls.set(controls::Brightness, 128);
+		ctrls.set(controls::Contrast, 64);
+		ctrls.set(controls::Saturation, 32);
+
+		data.resize(IPADataSerializer::binarySize(event));
+
+		static constexpr unsigned int ITERATIONS = 100000;
+		IPAOperationData newEvent;
+
+		auto start = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < ITERATIONS; ++i) {
+			output = ByteStreamBuffer(data.data(), data.size());
+			if (sender.serialize(event, output)) {
+				cerr << "Failed to serialize operation data" << endl;
+				return TestFail;
+			}
+
+			input = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+						 data.size());
+			if (receiver.deserialize(input, &newEvent)) {
+				cerr << "Failed to deserialize operation data" << endl;
+				return TestFail;
+			}
+		}
+
+		auto duration = chrono::steady_clock::now() - start;
+
+		cout << "Operation data round trip: " << data.size() << " bytes in "
+		     << chrono::duration_cast<chrono::nanoseconds>(duration).count() / ITERATIONS
+		     << " ns" << endl;
+
+		if (newEvent.operation != event.operation ||
+		    newEvent.data != event.data ||
+		    newEvent.controls.size() != 1 ||
+		    newEvent.controls[0].size() != 4 ||
+		    newEvent.controls[0].get(controls::Brightness) != 128 ||
+		    newEvent.controls[0].get(controls::AeEnable) != true) {
+			cerr << "Deserialized operation data doesn't match" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	int fd_;
+};
+
+TEST_REGISTER(IPADataSerializationTest)
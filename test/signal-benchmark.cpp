@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * signal-benchmark.cpp - Signal emission benchmark
+ */
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+unsigned int calls;
+
+void staticSlot(int value)
+{
+	calls += value;
+}
+
+class Receiver
+{
+public:
+	void slot(int value)
+	{
+		calls += value;
+	}
+};
+
+class ObjectReceiver : public Object
+{
+public:
+	void slot(int value)
+	{
+		calls += value;
+	}
+};
+
+class SignalBenchmark : public Benchmark
+{
+public:
+	SignalBenchmark()
+		: Benchmark("signal")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		Receiver receiver;
+		ObjectReceiver object;
+
+		Signal<int> unconnected;
+		measure("emit-unconnected", [&]() { unconnected.emit(1); });
+
+		Signal<int> staticSignal;
+		staticSignal.connect(&staticSlot);
+		measure("emit-static", [&]() { staticSignal.emit(1); });
+
+		Signal<int> memberSignal;
+		memberSignal.connect(&receiver, &Receiver::slot);
+		measure("emit-member", [&]() { memberSignal.emit(1); });
+
+		/* The object lives in the current thread, the slot is called directly. */
+		Signal<int> objectSignal;
+		objectSignal.connect(&object, &ObjectReceiver::slot);
+		measure("emit-object", [&]() { objectSignal.emit(1); });
+
+		Signal<int> multiSignal;
+		for (unsigned int i = 0; i < 4; ++i)
+			multiSignal.connect(&receiver, &Receiver::slot);
+		measure("emit-4-slots", [&]() { multiSignal.emit(1); });
+
+		Signal<int> connectSignal;
+		measure("connect-disconnect", [&]() {
+			connectSignal.connect(&object, &ObjectReceiver::slot);
+			connectSignal.disconnect(&object, &ObjectReceiver::slot);
+		});
+
+		return calls ? TestPass : TestFail;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(SignalBenchmark)
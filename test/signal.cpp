@@ -69,6 +69,24 @@ protected:
 		signalVoid_.disconnect(this, &SignalTest::slotDisconnect);
 	}
 
+	void slotDisconnectOther()
+	{
+		signalVoid_.disconnect(this, &SignalTest::slotVoid);
+	}
+
+	void slotConnect()
+	{
+		signalVoid_.disconnect(this, &SignalTest::slotConnect);
+		signalVoid_.connect(this, &SignalTest::slotVoid);
+	}
+
+	void slotDestroy()
+	{
+		dynamicSignal_->disconnect(this, &SignalTest::slotDestroy);
+		delete dynamicSignal_;
+		dynamicSignal_ = nullptr;
+	}
+
 	void slotInteger1(int value)
 	{
 		values_[0] = value;
@@ -85,6 +103,11 @@ protected:
 		name_ = name;
 	}
 
+	void slotRvalue(std::string &&name)
+	{
+		name_ = std::move(name);
+	}
+
 	int init()
 	{
 		return 0;
@@ -115,6 +138,17 @@ protected:
 			return TestFail;
 		}
 
+		/* Test signal with rvalue reference parameters. */
+		name_.clear();
+		std::string name("Marvin");
+		signalRvalue_.connect(this, &SignalTest::slotRvalue);
+		signalRvalue_.emit(std::move(name));
+
+		if (name_ != "Marvin") {
+			cout << "Signal rvalue parameters test failed" << endl;
+			return TestFail;
+		}
+
 		/* Test signal connected to multiple slots. */
 		memset(values_, 0, sizeof(values_));
 		valueStatic_ = 0;
@@ -174,6 +208,58 @@ protected:
 			return TestFail;
 		}
 
+		/* Test disconnection of a later slot during emission. */
+		signalVoid_.disconnect();
+		signalVoid_.connect(this, &SignalTest::slotDisconnectOther);
+		signalVoid_.connect(this, &SignalTest::slotVoid);
+
+		called_ = false;
+		signalVoid_.emit();
+
+		if (called_) {
+			cout << "Signal other slot disconnection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test connection from slot, the new slot shall only be called
+		 * for the next emission.
+		 */
+		signalVoid_.disconnect();
+		signalVoid_.connect(this, &SignalTest::slotConnect);
+
+		called_ = false;
+		signalVoid_.emit();
+
+		if (called_) {
+			cout << "Signal slot connected from slot called too early" << endl;
+			return TestFail;
+		}
+
+		signalVoid_.emit();
+
+		if (!called_) {
+			cout << "Signal connection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test destruction of the signal from slot, the slots disconnected
+		 * during emission shall be freed and the later slots shall not be
+		 * called. This shall not generate any valgrind warning.
+		 */
+		dynamicSignal_ = new Signal<>();
+		dynamicSignal_->connect(this, &SignalTest::slotDestroy);
+		dynamicSignal_->connect(this, &SignalTest::slotVoid);
+
+		called_ = false;
+		dynamicSignal_->emit();
+
+		if (dynamicSignal_ || called_) {
+			cout << "Signal destruction from slot test failed" << endl;
+			return TestFail;
+		}
+
 		/* ----------------- Signal -> Object tests ----------------- */
 
 		/*
@@ -267,6 +353,8 @@ private:
 	Signal<> signalVoid_;
 	Signal<int> signalInt_;
 	Signal<int, const std::string &> signalMultiArgs_;
+	Signal<std::string &&> signalRvalue_;
+	Signal<> *dynamicSignal_;
 
 	bool called_;
 	int values_[3];
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * soft-isp.cpp - Software ISP tests
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "soft_isp.h"
+#include "thread_pool.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* Not a multiple of the vector sizes, to exercise the scalar tail. */
+constexpr unsigned int WIDTH = 76;
+constexpr unsigned int HEIGHT = 70;
+
+struct Format {
+	const char *name;
+	unsigned int fourcc;
+	unsigned int stride;
+};
+
+const Format inputs[] = {
+	{ "SRGGB8", V4L2_PIX_FMT_SRGGB8, WIDTH },
+	{ "SGBRG10", V4L2_PIX_FMT_SGBRG10, WIDTH * 2 },
+	{ "SGRBG10P", V4L2_PIX_FMT_SGRBG10P, WIDTH * 5 / 4 },
+	{ "SBGGR12P", V4L2_PIX_FMT_SBGGR12P, WIDTH * 3 / 2 },
+};
+
+const Format outputs[] = {
+	{ "NV12", V4L2_PIX_FMT_NV12, 0 },
+	{ "RGB24", V4L2_PIX_FMT_RGB24, 0 },
+	{ "XRGB32", V4L2_PIX_FMT_XRGB32, 0 },
+};
+
+const char *implementations[] = { "scalar", "sse2", "neon" };
+
+/* Fill a frame with 12-bit samples of value 2048. */
+std::vector<uint8_t> flatFrame(const Format &format)
+{
+	std::vector<uint8_t> frame(format.stride * HEIGHT);
+
+	for (unsigned int y = 0; y < HEIGHT; ++y) {
+		uint8_t *line = &frame[y * format.stride];
+
+		for (unsigned int x = 0; x < format.stride; ++x) {
+			switch (format.fourcc) {
+			case V4L2_PIX_FMT_SRGGB8:
+				line[x] = 128;
+				break;
+			case V4L2_PIX_FMT_SGBRG10:
+				line[x] = x % 2 ? 2 : 0;
+				break;
+			case V4L2_PIX_FMT_SGRBG10P:
+				line[x] = x % 5 == 4 ? 0 : 128;
+				break;
+			case V4L2_PIX_FMT_SBGGR12P:
+				line[x] = x % 3 == 2 ? 0 : 128;
+				break;
+			}
+		}
+	}
+
+	return frame;
+}
+
+} /* namespace */
+
+class SoftIspTest : public Test
+{
+protected:
+	int init()
+	{
+		pool_ = new ThreadPool(2);
+		return TestPass;
+	}
+
+	int testInvalid()
+	{
+		SoftIsp isp;
+
+		if (isp.configure(V4L2_PIX_FMT_NV12, { WIDTH, HEIGHT }, WIDTH,
+				  V4L2_PIX_FMT_NV12) != -EINVAL) {
+			cout << "Invalid input format accepted" << endl;
+			return TestFail;
+		}
+
+		if (isp.configure(V4L2_PIX_FMT_SRGGB8, { WIDTH, HEIGHT }, WIDTH,
+				  V4L2_PIX_FMT_SRGGB8) != -EINVAL) {
+			cout << "Invalid output format accepted" << endl;
+			return TestFail;
+		}
+
+		if (isp.configure(V4L2_PIX_FMT_SRGGB8, { WIDTH, HEIGHT + 1 }, WIDTH,
+				  V4L2_PIX_FMT_NV12) != -EINVAL) {
+			cout << "Odd frame height accepted" << endl;
+			return TestFail;
+		}
+
+		if (isp.configure(V4L2_PIX_FMT_SRGGB10, { WIDTH, HEIGHT }, WIDTH,
+				  V4L2_PIX_FMT_NV12) != -EINVAL) {
+			cout << "Too small stride accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	/*
+	 * A flat field produces a flat output, with the white balance gains
+	 * applied, and the statistics reflect it.
+	 */
+	int testFlat()
+	{
+		SoftIsp::Params params;
+		params.gains = { { 1.5f, 1.0f, 1.0f } };
+		params.gamma = 1.0f;
+
+		for (const Format &input : inputs) {
+			std::vector<uint8_t> src = flatFrame(input);
+			std::vector<uint8_t> dst(WIDTH * HEIGHT * 4);
+			SoftIsp isp;
+
+			if (isp.configure(input.fourcc, { WIDTH, HEIGHT }, input.stride,
+					  V4L2_PIX_FMT_XRGB32)) {
+				cout << "Failed to configure " << input.name << endl;
+				return TestFail;
+			}
+
+			isp.setParams(params);
+
+			SoftIsp::Statistics stats;
+			isp.process(src.data(), dst.data(), &stats, pool_);
+
+			for (unsigned int i = 0; i < WIDTH * HEIGHT; ++i) {
+				const uint8_t *pixel = &dst[i * 4];
+				if (pixel[0] != 128 || pixel[1] != 128 ||
+				    pixel[2] != 191 || pixel[3] != 255) {
+					cout << "Invalid " << input.name
+					     << " flat field output at pixel " << i
+					     << endl;
+					return TestFail;
+				}
+			}
+
+			const uint64_t pixels = WIDTH * HEIGHT;
+			if (stats.pixels != pixels || stats.sum[0] != 3072 * pixels ||
+			    stats.sum[1] != 2048 * pixels || stats.sum[2] != 2048 * pixels) {
+				cout << "Invalid " << input.name << " statistics" << endl;
+				return TestFail;
+			}
+
+			/* The luminance is (3072 * 77 + 2048 * 179) / 256. */
+			unsigned int bin = 2356 * SoftIsp::HISTOGRAM_BINS / 4096;
+			if (stats.histogram[bin] != pixels) {
+				cout << "Invalid " << input.name << " histogram" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* All implementations produce identical results. */
+	int testImplementations()
+	{
+		SoftIsp::Params params;
+		params.blackLevel = 256;
+		params.gains = { { 1.8f, 1.0f, 1.4f } };
+		params.ccm = { { 1.6f, -0.4f, -0.2f,
+				 -0.3f, 1.5f, -0.2f,
+				 -0.1f, -0.5f, 1.6f } };
+
+		srand(0);
+
+		for (const Format &input : inputs) {
+			std::vector<uint8_t> src(input.stride * HEIGHT);
+			for (uint8_t &sample : src)
+				sample = rand();
+
+			for (const Format &output : outputs) {
+				std::vector<uint8_t> expected;
+				SoftIsp::Statistics expectedStats;
+
+				for (const char *name : implementations) {
+					setenv("LIBCAMERA_SOFT_ISP", name, 1);
+
+					SoftIsp isp;
+					int ret = isp.configure(input.fourcc,
+								{ WIDTH, HEIGHT },
+								input.stride,
+								output.fourcc);
+					if (ret) {
+						cout << "Failed to configure "
+						     << input.name << " to "
+						     << output.name << endl;
+						return TestFail;
+					}
+
+					/* Skip implementations not available on this CPU. */
+					if (strcmp(isp.implementation(), name))
+						continue;
+
+					isp.setParams(params);
+
+					std::vector<uint8_t> dst(isp.frameSize());
+					SoftIsp::Statistics stats;
+					isp.process(src.data(), dst.data(), &stats, pool_);
+
+					if (expected.empty()) {
+						expected = dst;
+						expectedStats = stats;
+						continue;
+					}
+
+					if (dst != expected ||
+					    stats.sum != expectedStats.sum ||
+					    stats.histogram != expectedStats.histogram) {
+						cout << "Invalid " << input.name << " to "
+						     << output.name << " processing with "
+						     << name << " implementation" << endl;
+						return TestFail;
+					}
+				}
+			}
+		}
+
+		unsetenv("LIBCAMERA_SOFT_ISP");
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (testInvalid() != TestPass)
+			return TestFail;
+
+		if (testFlat() != TestPass)
+			return TestFail;
+
+		if (testImplementations() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		delete pool_;
+	}
+
+private:
+	ThreadPool *pool_ = nullptr;
+};
+
+TEST_REGISTER(SoftIspTest)
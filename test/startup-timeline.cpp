@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * startup-timeline.cpp - Startup timeline tests
+ */
+
+#include <iostream>
+#include <thread>
+
+#include <libcamera/camera_manager.h>
+
+#include "startup_timeline.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class StartupTimelineTest : public Test
+{
+protected:
+	int run()
+	{
+		StartupTimeline *timeline = StartupTimeline::instance();
+
+		uint64_t before = StartupTimeline::now();
+
+		{
+			StartupTimeline::Scope outer("outer", "");
+			StartupTimeline::Scope inner("inner", "subject");
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		uint64_t after = StartupTimeline::now();
+
+		vector<StartupPhase> phases = CameraManager::startupTimeline();
+		if (phases.size() != 2) {
+			cout << "Invalid number of phases " << phases.size() << endl;
+			return TestFail;
+		}
+
+		/* Phases are ordered by completion, the inner scope first. */
+		const StartupPhase &inner = phases[0];
+		const StartupPhase &outer = phases[1];
+
+		if (inner.name != "inner" || inner.subject != "subject" ||
+		    outer.name != "outer" || !outer.subject.empty()) {
+			cout << "Invalid phases" << endl;
+			return TestFail;
+		}
+
+		if (outer.start < before || outer.start > inner.start ||
+		    inner.end > outer.end || outer.end > after) {
+			cout << "Invalid phase times" << endl;
+			return TestFail;
+		}
+
+		if (inner.end - inner.start < 10000000) {
+			cout << "Invalid phase duration" << endl;
+			return TestFail;
+		}
+
+		/* Phases recorded concurrently are all retained. */
+		vector<thread> threads;
+		for (unsigned int i = 0; i < 4; ++i)
+			threads.emplace_back([]() {
+				for (unsigned int j = 0; j < 16; ++j)
+					StartupTimeline::Scope phase("thread", "");
+			});
+
+		for (thread &t : threads)
+			t.join();
+
+		if (timeline->phases().size() != 2 + 4 * 16) {
+			cout << "Failed to record concurrent phases" << endl;
+			return TestFail;
+		}
+
+		/* The timeline stops growing once full. */
+		for (unsigned int i = 0; i < StartupTimeline::MAX_PHASES; ++i)
+			timeline->record("fill", "", 0, 0);
+
+		if (timeline->phases().size() != StartupTimeline::MAX_PHASES) {
+			cout << "Timeline not bounded" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(StartupTimelineTest)
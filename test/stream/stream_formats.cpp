@@ -6,6 +6,8 @@
  */
 
 #include <iostream>
+#include <stdint.h>
+#include <vector>
 
 #include <libcamera/geometry.h>
 #include <libcamera/stream.h>
@@ -94,6 +96,22 @@ protected:
 			      Size(2560, 2048), Size(3200, 2048), }))
 			return TestFail;
 
+		/* Test modifiers, with an arbitrary vendor modifier value. */
+		const uint64_t modifier = 0x0800000000000001ULL;
+		StreamFormats modifiers({
+			{ 1, { SizeRange(640, 480) } },
+			{ 2, { SizeRange(640, 480) } },
+		}, {
+			{ 2, { modifier } },
+		});
+
+		if (!modifiers.modifiers(1).empty() ||
+		    modifiers.modifiers(2) != std::vector<uint64_t>{ modifier } ||
+		    !discrete.modifiers(1).empty()) {
+			cout << "Failed modifiers" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * thread-pool.cpp - Worker thread pool test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/object.h>
+#include <libcamera/timer.h>
+
+#include "test.h"
+#include "thread.h"
+#include "thread_pool.h"
+
+using namespace std;
+using namespace libcamera;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: calls_(0), invalidThread_(false)
+	{
+	}
+
+	void done()
+	{
+		if (Thread::current() != thread())
+			invalidThread_ = true;
+		calls_++;
+	}
+
+	unsigned int calls_;
+	bool invalidThread_;
+};
+
+class ThreadPoolTest : public Test
+{
+protected:
+	int run()
+	{
+		ThreadPool pool(3);
+
+		if (pool.workers() != 3) {
+			cout << "Invalid number of workers" << endl;
+			return TestFail;
+		}
+
+		/* Post tasks, including tasks posted from tasks. */
+		std::atomic<unsigned int> count{ 0 };
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			pool.post([&]() {
+				count++;
+				pool.post([&]() { count++; });
+			});
+		}
+
+		for (unsigned int i = 0; i < 100 && count != 200; ++i)
+			this_thread::sleep_for(chrono::milliseconds(10));
+
+		if (count != 200) {
+			cout << "Ran " << count << " of 200 tasks" << endl;
+			return TestFail;
+		}
+
+		/* Notify a receiver in the current thread. */
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Receiver receiver;
+
+		for (unsigned int i = 0; i < 10; ++i)
+			pool.post([]() {}, &receiver, &Receiver::done);
+
+		Timer timeout;
+		timeout.start(1000);
+		while (receiver.calls_ != 10 && timeout.isRunning())
+			dispatcher->processEvents();
+
+		if (receiver.calls_ != 10 || receiver.invalidThread_) {
+			cout << "Receiver notified " << receiver.calls_
+			     << " times" << (receiver.invalidThread_ ? " in the wrong thread" : "")
+			     << endl;
+			return TestFail;
+		}
+
+		/* Process stripes in parallel, including nested loops. */
+		std::vector<unsigned int> stripes(64, 0);
+
+		pool.parallelFor(stripes.size(), [&](unsigned int i) {
+			std::atomic<unsigned int> sum{ 0 };
+			pool.parallelFor(8, [&](unsigned int j) { sum += j; });
+			stripes[i] += sum;
+		});
+
+		for (unsigned int i = 0; i < stripes.size(); ++i) {
+			if (stripes[i] != 28) {
+				cout << "Stripe " << i << " processed incorrectly"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/* A pool without workers runs everything synchronously. */
+		ThreadPool serial(0);
+		count = 0;
+		serial.post([&]() { count++; });
+		serial.parallelFor(10, [&](unsigned int) { count++; });
+
+		if (count != 11) {
+			cout << "Serial pool failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ThreadPoolTest)
@@ -6,7 +6,10 @@
  */
 
 #include <chrono>
+#include <errno.h>
 #include <iostream>
+#include <sched.h>
+#include <sys/resource.h>
 #include <thread>
 
 #include "thread.h"
@@ -35,6 +38,38 @@ private:
 	unsigned int iterations_;
 };
 
+class SchedulingThread : public Thread
+{
+public:
+	SchedulingThread()
+		: nice_(0), cpu0_(false), cpus_(0)
+	{
+	}
+
+	int nice() const { return nice_; }
+	bool cpu0() const { return cpu0_; }
+	int cpus() const { return cpus_; }
+
+protected:
+	void run()
+	{
+		nice_ = getpriority(PRIO_PROCESS, 0);
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set))
+			return;
+
+		cpu0_ = CPU_ISSET(0, &set);
+		cpus_ = CPU_COUNT(&set);
+	}
+
+private:
+	int nice_;
+	bool cpu0_;
+	int cpus_;
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -82,6 +117,45 @@ protected:
 
 		delete thread;
 
+		/*
+		 * Test scheduling parameters applied at thread start. Lowering
+		 * the priority doesn't require any privilege.
+		 */
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) || !CPU_ISSET(0, &set)) {
+			cout << "CPU 0 not available, skipping scheduling test"
+			     << endl;
+			return TestPass;
+		}
+
+		ThreadScheduling scheduling;
+		scheduling.nice = getpriority(PRIO_PROCESS, 0) + 1;
+		scheduling.cpus = { 0 };
+
+		SchedulingThread schedThread;
+		if (schedThread.setScheduling(scheduling)) {
+			cout << "Failed to set thread scheduling" << endl;
+			return TestFail;
+		}
+
+		schedThread.start();
+		schedThread.wait();
+
+		if (schedThread.nice() != scheduling.nice ||
+		    !schedThread.cpu0() || schedThread.cpus() != 1) {
+			cout << "Thread scheduling not applied" << endl;
+			return TestFail;
+		}
+
+		/* Test invalid scheduling parameters. */
+		scheduling.policy = ThreadScheduling::PolicyFifo;
+		scheduling.priority = 1000;
+		if (schedThread.setScheduling(scheduling) != -EINVAL) {
+			cout << "Invalid priority accepted" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer-benchmark.cpp - Timer benchmark
+ */
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "benchmark.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+class TimerBenchmark : public Benchmark
+{
+public:
+	TimerBenchmark()
+		: Benchmark("timer")
+	{
+	}
+
+protected:
+	int benchmark() override
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timer;
+		Timer other;
+
+		measure("start-stop", [&]() {
+			timer.start(1000);
+			timer.stop();
+		});
+
+		/* Restarting a running timer reorders the timers list. */
+		other.start(500);
+		timer.start(1000);
+		measure("restart", [&]() { timer.start(1000); });
+		timer.stop();
+		other.stop();
+
+		measure("expire", [&]() {
+			timer.start(0);
+			while (timer.isRunning())
+				dispatcher->processEvents();
+		});
+
+		return TestPass;
+	}
+};
+
+} /* namespace */
+
+TEST_REGISTER(TimerBenchmark)
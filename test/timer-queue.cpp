@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer-queue.cpp - Timer queue test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <poll.h>
+#include <vector>
+
+#include <libcamera/timer.h>
+
+#include "test.h"
+#include "timer_queue.h"
+
+using namespace std;
+using namespace libcamera;
+
+class TimerQueueTest : public Test
+{
+protected:
+	int run()
+	{
+		/*
+		 * Timers are only started to set their deadline, the queue is
+		 * tested independently of the thread event dispatcher.
+		 */
+		std::vector<Timer> timers(64);
+		utils::time_point base = utils::clock::now() + std::chrono::hours(1);
+		TimerQueue queue;
+
+		for (unsigned int i = 0; i < timers.size(); ++i) {
+			timers[i].start(base + std::chrono::milliseconds((i * 37) % 64));
+			queue.insert(&timers[i]);
+		}
+
+		/* Remove every other timer, out of order. */
+		for (unsigned int i = 0; i < timers.size(); i += 2)
+			queue.remove(&timers[(i * 5) % timers.size()]);
+
+		/* Removing a timer twice has no effect. */
+		queue.remove(&timers[0]);
+
+		if (queue.size() != timers.size() / 2) {
+			cout << "Queue holds " << queue.size() << " timers" << endl;
+			return TestFail;
+		}
+
+		utils::time_point last = base;
+		while (!queue.empty()) {
+			Timer *timer = queue.front();
+			if (timer->deadline() < last) {
+				cout << "Timers not ordered by deadline" << endl;
+				return TestFail;
+			}
+
+			last = timer->deadline();
+			queue.remove(timer);
+		}
+
+		/*
+		 * Updating the deadline of a queued timer before removing it
+		 * must not corrupt the queue.
+		 */
+		timers[0].start(base + std::chrono::seconds(2));
+		timers[1].start(base + std::chrono::seconds(1));
+		queue.insert(&timers[0]);
+		queue.insert(&timers[1]);
+
+		timers[0].start(base);
+		queue.remove(&timers[0]);
+
+		if (queue.size() != 1 || queue.front() != &timers[1]) {
+			cout << "Queue corrupted by deadline update" << endl;
+			return TestFail;
+		}
+
+		queue.remove(&timers[1]);
+
+		/* The timerfd must expire at the earliest deadline. */
+		timers[0].start(std::chrono::milliseconds(50));
+		timers[1].start(std::chrono::milliseconds(20));
+		queue.insert(&timers[0]);
+		queue.insert(&timers[1]);
+		queue.arm();
+
+		auto start = std::chrono::steady_clock::now();
+		struct pollfd pfd = { queue.fd(), POLLIN, 0 };
+		int ret = poll(&pfd, 1, 1000);
+		auto duration = std::chrono::steady_clock::now() - start;
+
+		if (ret != 1 || duration < std::chrono::milliseconds(19) ||
+		    duration > std::chrono::milliseconds(45)) {
+			cout << "Timerfd expired after "
+			     << std::chrono::duration_cast<std::chrono::microseconds>(duration).count()
+			     << "us" << endl;
+			return TestFail;
+		}
+
+		queue.acknowledge();
+		queue.remove(&timers[0]);
+		queue.remove(&timers[1]);
+
+		for (Timer &timer : timers)
+			timer.stop();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TimerQueueTest)
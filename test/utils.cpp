@@ -7,6 +7,9 @@
 
 #include <iostream>
 #include <sstream>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "test.h"
 #include "utils.h"
@@ -46,7 +49,48 @@ protected:
 			return TestFail;
 		}
 
-		return TestPass;
+		return testDmabufIdentity();
+	}
+
+	int testDmabufIdentity()
+	{
+		uint64_t dev, ino, dupDev, dupIno;
+		int ret = TestPass;
+
+		/* Files sharing the anonymous inode have no identity. */
+		int efd = eventfd(0, EFD_CLOEXEC);
+		if (efd < 0) {
+			cerr << "Failed to create eventfd" << endl;
+			return TestFail;
+		}
+
+		if (utils::dmabuf_identity(efd, &dev, &ino)) {
+			cerr << "Anonymous inode identified as unique" << endl;
+			ret = TestFail;
+		}
+
+		close(efd);
+
+		/* Duplicated file descriptors share the identity. */
+		int fd = memfd_create("utils", MFD_CLOEXEC);
+		if (fd < 0) {
+			cerr << "Failed to create memfd" << endl;
+			return TestFail;
+		}
+
+		int dupFd = dup(fd);
+
+		if (!utils::dmabuf_identity(fd, &dev, &ino) ||
+		    !utils::dmabuf_identity(dupFd, &dupDev, &dupIno) ||
+		    dev != dupDev || ino != dupIno) {
+			cerr << "Failed to identify duplicated file" << endl;
+			ret = TestFail;
+		}
+
+		close(dupFd);
+		close(fd);
+
+		return ret;
 	}
 };
 
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * v4l2-formats-cache.cpp - V4L2 formats cache tests
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "test.h"
+#include "v4l2_formats_cache.h"
+
+using namespace std;
+using namespace libcamera;
+
+class V4L2FormatsCacheTest : public Test
+{
+protected:
+	int init()
+	{
+		path_ = "/tmp/libcamera-formats-cache-" + to_string(getpid());
+		setenv("LIBCAMERA_V4L2_FORMATS_CACHE", path_.c_str(), 1);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		V4L2FormatsCache *cache = V4L2FormatsCache::instance();
+		const std::string identity = "/dev/video0:/sys/devices/test:test";
+
+		ImageFormats formats;
+		if (cache->lookup(identity, &formats)) {
+			cout << "Unexpected cache hit" << endl;
+			return TestFail;
+		}
+
+		formats.addFormat(0x56595559, { { 320, 240 }, { 640, 480 } });
+		formats.addFormat(0x47504a4d, { { 16, 16, 1920, 1080, 8, 2 } });
+		cache->store(identity, formats);
+
+		ImageFormats cached;
+		if (!cache->lookup(identity, &cached) ||
+		    cached.data().size() != 2 ||
+		    cached.sizes(0x47504a4d).size() != 1 ||
+		    cached.sizes(0x47504a4d)[0].hStep != 8) {
+			cout << "Cached formats mismatch" << endl;
+			return TestFail;
+		}
+
+		/* The cache shall be persisted to disk. */
+		std::ifstream file(path_);
+		std::string header, record;
+		if (!getline(file, header) || !getline(file, record) ||
+		    record.find(identity) == std::string::npos) {
+			cout << "Formats cache not written to disk" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unlink(path_.c_str());
+	}
+
+private:
+	std::string path_;
+};
+
+TEST_REGISTER(V4L2FormatsCacheTest)
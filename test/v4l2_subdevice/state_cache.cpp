@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 Subdevice pad state cache test
+ */
+
+#include <iostream>
+
+#include "v4l2_subdevice.h"
+#include "v4l2_subdevice_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/* Test the pad state cache on the "Scaler" subdevice of vimc media device. */
+
+class StateCacheTest : public V4L2SubdeviceTest
+{
+protected:
+	int run() override;
+};
+
+int StateCacheTest::run()
+{
+	V4L2SubdeviceFormat sink = {};
+	int ret = scaler_->getFormat(0, &sink);
+	if (ret) {
+		cerr << "Failed to get sink format" << endl;
+		return TestFail;
+	}
+
+	sink.size = { 640, 480 };
+	V4L2SubdeviceFormat applied = sink;
+	ret = scaler_->setFormat(0, &applied);
+	if (ret) {
+		cerr << "Failed to set sink format" << endl;
+		return TestFail;
+	}
+
+	/* Setting the same format again must report the same result. */
+	V4L2SubdeviceFormat cached = sink;
+	ret = scaler_->setFormat(0, &cached);
+	if (ret || cached.size != applied.size ||
+	    cached.mbus_code != applied.mbus_code) {
+		cerr << "Cached sink format doesn't match" << endl;
+		return TestFail;
+	}
+
+	V4L2SubdeviceFormat source = {};
+	ret = scaler_->getFormat(1, &source);
+	if (ret) {
+		cerr << "Failed to get source format" << endl;
+		return TestFail;
+	}
+
+	const V4L2SubdeviceFormat requested = source;
+	ret = scaler_->setFormat(1, &source);
+	if (ret) {
+		cerr << "Failed to set source format" << endl;
+		return TestFail;
+	}
+
+	/*
+	 * Changing the sink format propagates to the source pad, the source
+	 * format must then be applied again and not be taken from the cache.
+	 */
+	sink.size = { 320, 240 };
+	ret = scaler_->setFormat(0, &sink);
+	if (ret) {
+		cerr << "Failed to change sink format" << endl;
+		return TestFail;
+	}
+
+	source = requested;
+	ret = scaler_->setFormat(1, &source);
+	if (ret) {
+		cerr << "Failed to set source format again" << endl;
+		return TestFail;
+	}
+
+	V4L2SubdeviceFormat current = {};
+	ret = scaler_->getFormat(1, &current);
+	if (ret || current.size != source.size ||
+	    current.mbus_code != source.mbus_code) {
+		cerr << "Stale source format returned from the cache" << endl;
+		return TestFail;
+	}
+
+	return TestPass;
+}
+
+TEST_REGISTER(StateCacheTest);
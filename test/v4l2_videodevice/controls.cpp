@@ -93,6 +93,71 @@ protected:
 			return TestFail;
 		}
 
+		/* Test reading controls from the event-driven cache. */
+		ret = capture_->setControlEventsEnabled(true);
+		if (ret) {
+			cerr << "Failed to enable control events" << endl;
+			return TestFail;
+		}
+
+		ctrls.set(V4L2_CID_BRIGHTNESS, brightness.max());
+		ret = capture_->setControls(&ctrls);
+		if (ret) {
+			cerr << "Failed to set controls (cached)" << endl;
+			return TestFail;
+		}
+
+		ControlList cached(info);
+		cached.set(V4L2_CID_BRIGHTNESS, -1);
+		cached.set(V4L2_CID_CONTRAST, -1);
+
+		ret = capture_->getControls(&cached);
+		if (ret) {
+			cerr << "Failed to get cached controls" << endl;
+			return TestFail;
+		}
+
+		if (cached.get(V4L2_CID_BRIGHTNESS) != brightness.max() ||
+		    cached.get(V4L2_CID_CONTRAST) != contrast.max()) {
+			cerr << "Incorrect value for cached controls" << endl;
+			return TestFail;
+		}
+
+		capture_->setControlEventsEnabled(false);
+
+		/* Test prepared control batches. */
+		V4L2ControlBatch batch;
+		ret = capture_->prepareControls(&batch, { V4L2_CID_BRIGHTNESS,
+							  V4L2_CID_SATURATION });
+		if (ret || !batch.isValid() || batch.size() != 2) {
+			cerr << "Failed to prepare control batch" << endl;
+			return TestFail;
+		}
+
+		batch.set(0, brightness.min());
+		batch.set(1, saturation.max());
+		ret = capture_->setControls(&batch);
+		if (ret) {
+			cerr << "Failed to set control batch" << endl;
+			return TestFail;
+		}
+
+		batch.set(0, -1);
+		batch.set(1, -1);
+		ret = capture_->getControls(&batch);
+		if (ret || batch.get(0) != brightness.min() ||
+		    batch.get(1) != saturation.max()) {
+			cerr << "Incorrect value for control batch" << endl;
+			return TestFail;
+		}
+
+		V4L2ControlBatch invalid;
+		if (!capture_->prepareControls(&invalid, { 0 }) ||
+		    invalid.isValid()) {
+			cerr << "Invalid control batch prepared" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv-converter.cpp - YUV to RGB converter tests
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/yuv_converter.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* Not a multiple of the vector sizes, to exercise the scalar tail. */
+constexpr unsigned int WIDTH = 70;
+constexpr unsigned int HEIGHT = 6;
+
+struct Format {
+	const char *name;
+	unsigned int fourcc;
+	bool packed;
+	unsigned int horzSubSample;
+	unsigned int vertSubSample;
+	unsigned int yPos;
+	unsigned int cbPos;
+	unsigned int crPos;
+};
+
+const Format formats[] = {
+	{ "NV12", V4L2_PIX_FMT_NV12, false, 2, 2, 0, 0, 1 },
+	{ "NV21", V4L2_PIX_FMT_NV21, false, 2, 2, 0, 1, 0 },
+	{ "NV16", V4L2_PIX_FMT_NV16, false, 2, 1, 0, 0, 1 },
+	{ "NV61", V4L2_PIX_FMT_NV61, false, 2, 1, 0, 1, 0 },
+	{ "NV24", V4L2_PIX_FMT_NV24, false, 1, 1, 0, 0, 1 },
+	{ "NV42", V4L2_PIX_FMT_NV42, false, 1, 1, 0, 1, 0 },
+	{ "YUYV", V4L2_PIX_FMT_YUYV, true, 2, 1, 0, 1, 3 },
+	{ "YVYU", V4L2_PIX_FMT_YVYU, true, 2, 1, 0, 3, 1 },
+	{ "UYVY", V4L2_PIX_FMT_UYVY, true, 2, 1, 1, 0, 2 },
+	{ "VYUY", V4L2_PIX_FMT_VYUY, true, 2, 1, 1, 2, 0 },
+};
+
+const char *implementations[] = { "scalar", "sse2", "avx2", "neon" };
+
+uint8_t clip(int value)
+{
+	return std::min(std::max(value, 0), 255);
+}
+
+/* Reference conversion, one pixel at a time. */
+std::vector<uint8_t> convertReference(const Format &format,
+				      const std::vector<uint8_t> &src)
+{
+	std::vector<uint8_t> dst(WIDTH * HEIGHT * 4);
+
+	for (unsigned int y = 0; y < HEIGHT; ++y) {
+		for (unsigned int x = 0; x < WIDTH; ++x) {
+			int luma, cb, cr;
+
+			if (format.packed) {
+				const uint8_t *pair = &src[(y * WIDTH + x / 2 * 2) * 2];
+				luma = pair[format.yPos + (x % 2) * 2];
+				cb = pair[format.cbPos];
+				cr = pair[format.crPos];
+			} else {
+				unsigned int stride = WIDTH * 2 / format.horzSubSample;
+				const uint8_t *uv = &src[WIDTH * HEIGHT +
+							 y / format.vertSubSample * stride +
+							 x / format.horzSubSample * 2];
+				luma = src[y * WIDTH + x];
+				cb = uv[format.cbPos];
+				cr = uv[format.crPos];
+			}
+
+			int c = luma - 16;
+			int d = cb - 128;
+			int e = cr - 128;
+			uint8_t *pixel = &dst[(y * WIDTH + x) * 4];
+
+			pixel[0] = clip((298 * c + 516 * d + 128) >> 8);
+			pixel[1] = clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+			pixel[2] = clip((298 * c + 409 * e + 128) >> 8);
+			pixel[3] = 0xff;
+		}
+	}
+
+	return dst;
+}
+
+} /* namespace */
+
+class YuvConverterTest : public Test
+{
+protected:
+	int run()
+	{
+		YuvConverter converter;
+
+		if (converter.configure(V4L2_PIX_FMT_RGB24, { WIDTH, HEIGHT }) != -EINVAL) {
+			cout << "Invalid format accepted" << endl;
+			return TestFail;
+		}
+
+		/* Random samples, large enough for all formats. */
+		std::vector<uint8_t> src(WIDTH * HEIGHT * 3);
+		srand(0);
+		for (uint8_t &sample : src)
+			sample = rand();
+
+		std::vector<uint8_t> dst(WIDTH * HEIGHT * 4);
+
+		for (const Format &format : formats) {
+			std::vector<uint8_t> expected = convertReference(format, src);
+
+			for (const char *name : implementations) {
+				setenv("LIBCAMERA_YUV_CONVERTER", name, 1);
+
+				int ret = converter.configure(format.fourcc,
+							      { WIDTH, HEIGHT });
+				if (ret) {
+					cout << "Failed to configure " << format.name
+					     << endl;
+					return TestFail;
+				}
+
+				/* Skip implementations not available on this CPU. */
+				if (strcmp(converter.implementation(), name))
+					continue;
+
+				std::fill(dst.begin(), dst.end(), 0);
+				converter.convert(src.data(), dst.data());
+
+				if (dst != expected) {
+					cout << "Invalid " << format.name
+					     << " conversion with " << name
+					     << " implementation" << endl;
+					return TestFail;
+				}
+
+				/*
+				 * Convert in two stripes, splitting on an odd
+				 * line to share chroma lines between stripes.
+				 */
+				std::fill(dst.begin(), dst.end(), 0);
+				converter.convert(src.data(), dst.data(), 3, HEIGHT);
+				converter.convert(src.data(), dst.data(), 0, 3);
+
+				if (dst != expected) {
+					cout << "Invalid " << format.name
+					     << " stripe conversion with " << name
+					     << " implementation" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		unsetenv("LIBCAMERA_YUV_CONVERTER");
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(YuvConverterTest)